@@ -3328,6 +3328,35 @@ else
 fi
 ])# R_LZMA
 
+## R_ZSTD
+## -------
+## Try finding the zstd library and headers, which are optional.
+AC_DEFUN([R_ZSTD],
+[AC_CHECK_LIB(zstd, ZSTD_compressStream2, [have_zstd=yes], [have_zstd=no])
+if test "${have_zstd}" = yes; then
+  AC_CHECK_HEADERS(zstd.h, [have_zstd=yes], [have_zstd=no])
+fi
+if test "x${have_zstd}" = xyes; then
+  AC_DEFINE(HAVE_ZSTD, 1, [Define if your system has zstd >= 1.4.0.])
+  LIBS="-lzstd ${LIBS}"
+fi
+])# R_ZSTD
+
+## R_LZ4
+## -------
+## Try finding the lz4 library and headers, which are optional.
+AC_DEFUN([R_LZ4],
+[AC_CHECK_LIB(lz4, LZ4F_compressBegin, [have_lz4=yes], [have_lz4=no])
+if test "${have_lz4}" = yes; then
+  AC_CHECK_HEADERS(lz4frame.h lz4hc.h, [], [have_lz4=no])
+fi
+if test "x${have_lz4}" = xyes; then
+  AC_DEFINE(HAVE_LZ4, 1,
+            [Define if your system has the lz4 library with the frame API.])
+  LIBS="-llz4 ${LIBS}"
+fi
+])# R_LZ4
+
 
 ## R_SYS_POSIX_LEAPSECONDS
 ## -----------------------
@@ -77,14 +77,16 @@ static void genptry(int n, double *p, double *ptry, double scale, void *ex)
 }
 
 
+/* The rows of these are many small blocks, so they are taken from a
+   scratch arena rather than the heap: callers must R_ArenaPop. */
 static double ** matrix(int nrh, int nch)
 {
     int   i;
     double **m;
 
-    m = (double **) R_alloc((nrh + 1), sizeof(double *));
+    m = (double **) R_ArenaAlloc((nrh + 1), sizeof(double *));
     for (i = 0; i <= nrh; i++)
-	m[i] = (double*) R_alloc((nch + 1), sizeof(double));
+	m[i] = (double*) R_ArenaAlloc((nch + 1), sizeof(double));
     return m;
 }
 
@@ -93,9 +95,9 @@ static double ** Lmatrix(int n)
     int   i;
     double **m;
 
-    m = (double **) R_alloc(n, sizeof(double *));
+    m = (double **) R_ArenaAlloc(n, sizeof(double *));
     for (i = 0; i < n; i++)
-	m[i] = (double *) R_alloc((i + 1), sizeof(double));
+	m[i] = (double *) R_ArenaAlloc((i + 1), sizeof(double));
     return m;
 }
 
@@ -124,6 +126,7 @@ vmmin(int n0, double *b, double *Fmin, optimfn fminfn, optimgr fmingr,
     double s, steplength;
     double D1, D2;
     int   n, *l;
+    void *arena;
 
     if (maxit <= 0) {
 	*fail = 0;
@@ -141,6 +144,7 @@ vmmin(int n0, double *b, double *Fmin, optimfn fminfn, optimgr fmingr,
     t = vect(n);
     X = vect(n);
     c = vect(n);
+    arena = R_ArenaPush();
     B = Lmatrix(n);
     f = fminfn(n0, b, ex);
     if (!R_FINITE(f))
@@ -256,6 +260,7 @@ vmmin(int n0, double *b, double *Fmin, optimfn fminfn, optimgr fmingr,
     *fail = (iter < maxit) ? 0 : 1;
     *fncount = funcount;
     *grcount = gradcount;
+    R_ArenaPop(arena);
 }
 
 
@@ -281,6 +286,7 @@ void nmmin(int n, double *Bvec, double *X, double *Fmin, optimfn fminfn,
     double size, step, temp, trystep;
     char tstr[9]; // allow for 10^8 iters ...
     double VH, VL, VR;
+    void *arena;
 
     if (maxit <= 0) {
 	*Fmin = fminfn(n, Bvec, ex);
@@ -290,6 +296,7 @@ void nmmin(int n, double *Bvec, double *X, double *Fmin, optimfn fminfn,
     }
     if (trace)
 	Rprintf("  Nelder-Mead direct search function minimizer\n");
+    arena = R_ArenaPush();
     P = matrix(n, n+1);
     *fail = FALSE;
     f = fminfn(n, Bvec, ex);
@@ -462,6 +469,7 @@ void nmmin(int n, double *Bvec, double *X, double *Fmin, optimfn fminfn,
     for (i = 0; i < n; i++) X[i] = P[i][L - 1];
     if (funcount > maxit) *fail = 1;
     *fncount = funcount;
+    R_ArenaPop(arena);
 }
 
 /* Conjugate gradients, based on Pascal code
@@ -1,6 +1,6 @@
 /*
  *  R : A Computer Language for Statistical Data Analysis
- *  Modifications copyright (C) 2007-2016  The R Core Team
+ *  Modifications copyright (C) 2007-2017  The R Core Team
  *
  *  This program is free software; you can redistribute it and/or modify
  *  it under the terms of the GNU General Public License as published by
@@ -290,6 +290,52 @@ static char		lcl_TZname[TZ_STRLEN_MAX + 1];
 static int		lcl_is_set;
 static int		gmt_is_set;
 
+/* R addition: the states of the most recently loaded zones, keyed by
+   name ("" for the system zone) and TZDIR.  as.POSIXlt(tz=) and
+   friends set TZ and then reset it, so without this every call
+   re-reads and re-parses two zone files. */
+#define TZ_CACHE_SIZE 8
+static struct {
+    char name[TZ_STRLEN_MAX + 1];
+    char dir[1000];
+    struct state *sp;  /* NULL for an unused entry */
+} tzcache[TZ_CACHE_SIZE];
+static int tzcache_next;
+
+static const char *tzcache_dir(void)
+{
+    const char *p = getenv("TZDIR");
+    return p ? p : "";
+}
+
+static int tzcache_get(const char *name, struct state * const sp)
+{
+    const char *dir = tzcache_dir();
+    for (int i = 0; i < TZ_CACHE_SIZE; i++)
+	if (tzcache[i].sp && strcmp(tzcache[i].name, name) == 0 &&
+	    strcmp(tzcache[i].dir, dir) == 0) {
+	    memcpy(sp, tzcache[i].sp, sizeof(struct state));
+	    return TRUE;
+	}
+    return FALSE;
+}
+
+static void tzcache_put(const char *name, const struct state * const sp)
+{
+    const char *dir = tzcache_dir();
+    int i = tzcache_next;
+
+    if (strlen(name) > TZ_STRLEN_MAX || strlen(dir) >= sizeof tzcache[i].dir)
+	return;
+    if (!tzcache[i].sp &&
+	!(tzcache[i].sp = (struct state *) malloc(sizeof(struct state))))
+	return;
+    strcpy(tzcache[i].name, name);
+    strcpy(tzcache[i].dir, dir);
+    memcpy(tzcache[i].sp, sp, sizeof(struct state));
+    tzcache_next = (i + 1) % TZ_CACHE_SIZE;
+}
+
 char * tzname[2] = {
     wildabbr,
     wildabbr
@@ -1206,7 +1252,11 @@ R_tzsetwall(void)
     if (lcl_is_set < 0) return;
     lcl_is_set = -1;
 
-    if (tzload((char *) NULL, lclptr, TRUE) != 0) gmtload(lclptr);
+    if (!tzcache_get("", lclptr)) {
+	if (tzload((char *) NULL, lclptr, TRUE) == 0)
+	    tzcache_put("", lclptr);
+	else gmtload(lclptr);
+    }
     settzname();
 }
 
@@ -1241,9 +1291,12 @@ tzset(void)
 	lclptr->ttis[0].tt_gmtoff = 0;
 	lclptr->ttis[0].tt_abbrind = 0;
 	(void) strcpy(lclptr->chars, gmt);
-    } else if (tzload(name, lclptr, TRUE) != 0)
-	if (name[0] == ':' || tzparse(name, lclptr, FALSE) != 0)
+    } else if (!tzcache_get(name, lclptr)) {
+	if (tzload(name, lclptr, TRUE) == 0)
+	    tzcache_put(name, lclptr);
+	else if (name[0] == ':' || tzparse(name, lclptr, FALSE) != 0)
 	    (void) gmtload(lclptr);
+    }
     settzname();
 }
 
@@ -1,7 +1,7 @@
 /*
  *  R : A Computer Language for Statistical Data Analysis
  *  Copyright (C) 1995, 1996  Robert Gentleman and Ross Ihaka
- *  Copyright (C) 1998--2015  The R Core Team.
+ *  Copyright (C) 1998--2017  The R Core Team.
  *
  *  This program is free software; you can redistribute it and/or modify
  *  it under the terms of the GNU General Public License as published by
@@ -141,6 +141,37 @@ int ENC_KNOWN(SEXP x);
 int SET_CACHED(SEXP x);
 int IS_CACHED(SEXP x);
 #endif
+/* Known sortedness of logical, integer and double vectors, as left by
+   sort(): 0 if unknown, else the direction and the end holding the
+   NAs, if any.  Vectors are marked not mutable when this is set, so it
+   is never stale: changing one copies it, and copies start unknown. */
+#define UNKNOWN_SORTEDNESS 0
+#define SORTED_INCR 1
+#define SORTED_DECR 2
+#define SORTED_INCR_NA_1ST 3
+#define SORTED_DECR_NA_1ST 4
+#define KNOWN_INCR(s) ((s) == SORTED_INCR || (s) == SORTED_INCR_NA_1ST)
+#define KNOWN_DECR(s) ((s) == SORTED_DECR || (s) == SORTED_DECR_NA_1ST)
+#define KNOWN_NA_1ST(s) ((s) >= SORTED_INCR_NA_1ST)
+#ifdef USE_RINTERNALS
+# define SORTED(x) ((x)->sxpinfo.sorted)
+# define SET_SORTED(x,v) (((x)->sxpinfo.sorted)=(v))
+#else
+int SORTED(SEXP x);
+void SET_SORTED(SEXP x, int v);
+#endif
+int R_KnownSorted(SEXP x);
+Rboolean R_SortedAnyNA(SEXP x, int sorted);
+
+/* Growable vectors, as left by EnlargeVector(): storage was allocated
+   for TRUELENGTH elements, of which the first LENGTH are in use.  The
+   bit is needed as TRUELENGTH of other vectors may hold other things
+   (such as hash table counts), and it is not copied by duplicate(). */
+#define GROWABLE_MASK ((unsigned short)(1<<5))
+#define GROWABLE_BIT_SET(x) (LEVELS(x) & GROWABLE_MASK)
+#define SET_GROWABLE_BIT(x) SETLEVELS(x, LEVELS(x) | GROWABLE_MASK)
+#define IS_GROWABLE(x) (GROWABLE_BIT_SET(x) && XLENGTH(x) < XTRUELENGTH(x))
+
 /* macros and declarations for managing CHARSXP cache */
 # define CXHEAD(x) (x)
 # define CXTAIL(x) ATTRIB(x)
@@ -289,7 +320,7 @@ extern int putenv(char *string);
 #endif
 #endif
 
-#define HSIZE	   4119	/* The size of the hash table for symbols */
+#define HSIZE	   4119	/* The initial size of the hash table for symbols */
 #define MAXIDSIZE 10000	/* Largest symbol size,
 			   in bytes excluding terminator.
 			   Was 256 prior to 2.13.0, now just a sanity check.
@@ -521,6 +552,7 @@ typedef struct RCNTXT {
     void (*cend)(void *);	/* C "on.exit" thunk */
     void *cenddata;		/* data for C "on.exit" thunk */
     void *vmax;		        /* top of R_alloc stack */
+    void *arenamark;		/* top of R_ArenaAlloc arenas */
     int intsusp;                /* interrupts are suspended */
     int gcenabled;		/* R_GCenabled value */
     SEXP handlerstack;          /* condition handler stack */
@@ -529,12 +561,17 @@ typedef struct RCNTXT {
     R_bcstack_t *nodestack;
 #ifdef BC_INT_STACK
     IStackval *intstack;
+#endif
+#if defined(R_MEMORY_PROFILING) || defined(R_PROFILING)
+    void *bcpc;			/* R_BCpc value */
+    SEXP bcbody;		/* R_BCbody value */
 #endif
     SEXP srcref;	        /* The source line in effect */
     int browserfinish;     /* should browser finish this context without stopping */
     SEXP returnValue;			/* only set during on.exit calls */
     struct RCNTXT *jumptarget;	/* target for a continuing jump */
     int jumpmask;               /* associated LONGJMP argument */
+    int nojump;			/* cjmpbuf was not set, as for leaf closures */
 } RCNTXT, *context;
 
 /* The Various Context Types.
@@ -657,6 +694,7 @@ LibExtern SEXP*	R_PPStack;	    /* The pointer protection stack */
 extern0 SEXP	R_CurrentExpr;	    /* Currently evaluating expression */
 extern0 SEXP	R_ReturnedValue;    /* Slot for return-ing values */
 extern0 SEXP*	R_SymbolTable;	    /* The symbol table */
+extern0 int	R_SymbolTableSize INI_as(HSIZE); /* and its size */
 #ifdef R_USE_SIGNALS
 extern0 RCNTXT R_Toplevel;	      /* Storage for the toplevel context */
 extern0 RCNTXT* R_ToplevelContext;  /* The toplevel context */
@@ -672,6 +710,10 @@ extern0 int	R_Expressions	INI_as(5000);	/* options(expressions) */
 extern0 int	R_Expressions_keep INI_as(5000);	/* options(expressions) */
 extern0 Rboolean R_KeepSource	INI_as(FALSE);	/* options(keep.source) */
 extern0 Rboolean R_CBoundsCheck	INI_as(FALSE);	/* options(CBoundsCheck) */
+/* options(matprod): see array.c */
+typedef enum { MATPROD_DEFAULT = 1, MATPROD_INTERNAL, MATPROD_BLAS } MatprodType;
+extern0 MatprodType R_Matprod	INI_as(MATPROD_DEFAULT);
+extern0 double	R_GCPauseTarget	INI_as(0.0);	/* options(gc.pause.target), ms */
 extern0 int	R_WarnLength	INI_as(1000);	/* Error/warning max length */
 extern0 int	R_nwarnings	INI_as(50);
 extern uintptr_t R_CStackLimit	INI_as((uintptr_t)-1);	/* C stack limit */
@@ -770,9 +812,21 @@ extern0 R_bcstack_t *R_BCNodeStackBase, *R_BCNodeStackTop, *R_BCNodeStackEnd;
 # define R_BCINTSTACKSIZE 10000
 extern0 IStackval *R_BCIntStackBase, *R_BCIntStackTop, *R_BCIntStackEnd;
 #endif
+#if defined(R_MEMORY_PROFILING) || defined(R_PROFILING)
+/* the program counter and code of the innermost bcEval, for Rprofmem and Rprof */
+extern0 void *R_BCpc INI_as(NULL);
+extern0 SEXP R_BCbody INI_as(NULL);
+int R_BCCurrentPC(SEXP body);
+#endif
+/* changed when cached variable lookups may be invalid, see envir.c */
+extern0 unsigned int R_EnvEpoch INI_as(1);
 extern0 int R_jit_enabled INI_as(0);
+extern0 int R_jit_threshold INI_as(2);	/* calls before JIT compilation */
 extern0 int R_compile_pkgs INI_as(0);
+extern0 Rboolean R_loop_kernels INI_as(FALSE);
 extern SEXP R_cmpfun(SEXP);
+extern void R_jitClosure(SEXP);
+int R_RunLoopKernel(SEXP, SEXP, SEXP, Rboolean, int);
 extern void R_init_jit_enabled(void);
 extern void R_initAsignSymbols(void);
 
@@ -782,6 +836,22 @@ LibExtern SEXP R_CachedScalarInteger INI_as(NULL);
 LibExtern int R_num_math_threads INI_as(1);
 LibExtern int R_max_num_math_threads INI_as(1);
 
+/* Counts of some interpreter events, always kept: see do_perfstats */
+typedef enum {
+    PERF_DUPLICATE,		/* duplicate() and shallow_duplicate() */
+    PERF_PROMISE,		/* promises created by mkPROMISE() */
+    PERF_CONTEXT,		/* contexts begun */
+    PERF_JIT_COMPILE,		/* closures compiled by R_cmpfun() */
+    PERF_GC,			/* garbage collections */
+    PERF_STRING_LOOKUP,		/* look-ups in the CHARSXP cache */
+    PERF_STRING_NEW,		/* CHARSXPs added to the cache */
+    PERF_STRING_RESIZE,		/* resizes of the CHARSXP cache */
+    PERF_GLOBAL_CACHE_FLUSH,	/* global cache entries flushed */
+    PERF_NCOUNTERS
+} R_PerfCounter;
+extern0 R_size_t R_PerfStats[PERF_NCOUNTERS];
+#define R_PERF_COUNT(c) (R_PerfStats[c]++)
+
 /* Pointer  type and utilities for dispatch in the methods package */
 typedef SEXP (*R_stdGen_ptr_t)(SEXP, SEXP, SEXP); /* typedef */
 //R_stdGen_ptr_t R_get_standardGeneric_ptr(void); /* get method */
@@ -912,6 +982,7 @@ LibExtern SEXP R_LogicalNAValue INI_as(NULL);
 # define matchArg		Rf_matchArg
 # define matchArgExact		Rf_matchArgExact
 # define matchArgs		Rf_matchArgs
+# define matchArgsCached	Rf_matchArgsCached
 # define matchPar		Rf_matchPar
 # define Mbrtowc		Rf_mbrtowc
 # define mbtoucs		Rf_mbtoucs
@@ -946,6 +1017,7 @@ LibExtern SEXP R_LogicalNAValue INI_as(NULL);
 # define Seql			Rf_Seql
 # define sexptype2char		Rf_sexptype2char
 # define Scollate		Rf_Scollate
+# define Scollate_key		Rf_Scollate_key
 # define sortVector		Rf_sortVector
 # define SrcrefPrompt		Rf_SrcrefPrompt
 # define ssort			Rf_ssort
@@ -1109,13 +1181,17 @@ void KillAllDevices(void);
 SEXP levelsgets(SEXP, SEXP);
 void mainloop(void);
 SEXP makeSubscript(SEXP, SEXP, R_xlen_t *, SEXP);
+R_xlen_t R_contiguousSubscript(SEXP, R_xlen_t);
 SEXP markKnown(const char *, SEXP);
 SEXP mat2indsub(SEXP, SEXP, SEXP);
 SEXP matchArg(SEXP, SEXP*);
 SEXP matchArgExact(SEXP, SEXP*);
 SEXP matchArgs(SEXP, SEXP, SEXP);
+SEXP matchArgsCached(SEXP, SEXP, SEXP);
 SEXP matchPar(const char *, SEXP*);
 void memtrace_report(void *, void *);
+void R_mkCharLenCEVec(SEXP, R_xlen_t, const char **, const int *, int,
+		      cetype_t);
 SEXP mkCLOSXP(SEXP, SEXP, SEXP);
 SEXP mkFalse(void);
 SEXP mkPRIMSXP (int, int);
@@ -1149,6 +1225,7 @@ SEXP R_data_class(SEXP , Rboolean);
 SEXP R_data_class2(SEXP);
 char *R_LibraryFileName(const char *, char *, size_t);
 SEXP R_LoadFromFile(FILE*, int);
+SEXP R_HashTableChains(SEXP);
 SEXP R_NewHashedEnv(SEXP, SEXP);
 extern int R_Newhashpjw(const char *);
 FILE* R_OpenLibraryFile(const char *);
@@ -1165,6 +1242,10 @@ int R_SetOptionWidth(int);
 void R_Suicide(const char *);
 void R_getProcTime(double *data);
 int R_isMissing(SEXP symbol, SEXP rho);
+R_xlen_t R_lglCount(const int *, R_xlen_t, Rboolean);
+void R_lglWhich(const int *, R_xlen_t, R_xlen_t, Rboolean, int *, double *);
+const char *R_mmapVectorFile(SEXP, Rboolean *);
+SEXP R_mmapVectorAt(const char *, SEXPTYPE, R_xlen_t, double);
 const char *sexptype2char(SEXPTYPE type);
 void sortVector(SEXP, Rboolean);
 void SrcrefPrompt(const char *, SEXP);
@@ -1233,6 +1314,9 @@ const char *EncodeReal2(double, int, int, int);
 const char *EncodeChar(SEXP);
 
 
+/* main/RNG.c, used in package stats */
+Rboolean R_RNG_substreams(R_xlen_t n, int *seeds, Rboolean normal);
+
 /* main/sort.c */
 void orderVector1(int *indx, int n, SEXP key, Rboolean nalast,
 		  Rboolean decreasing, SEXP rho);
@@ -1278,6 +1362,7 @@ char *Rf_strchr(const char *s, int c);
 char *Rf_strrchr(const char *s, int c);
 
 SEXP fixup_NaRm(SEXP args); /* summary.c */
+double R_rsummary(double *x, R_xlen_t n, int op); /* summary.c */
 void invalidate_cached_recodings(void);  /* from sysutils.c */
 void resetICUcollator(void); /* from util.c */
 void dt_invalidate_locale(); /* from Rstrptime.h */
@@ -1315,6 +1400,7 @@ size_t Rwcstombs(char *s, const wchar_t *wc, size_t n);
 FILE *RC_fopen(const SEXP fn, const char *mode, const Rboolean expand);
 int Seql(SEXP a, SEXP b);
 int Scollate(SEXP a, SEXP b);
+int Scollate_key(SEXP a, char *buf, int size);
 
 double R_strtod4(const char *str, char **endptr, char dec, Rboolean NA);
 double R_strtod(const char *str, char **endptr);
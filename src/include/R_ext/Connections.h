@@ -79,6 +79,9 @@ struct Rconn {
     void *ex_ptr;
     void *private;
     int status; /* for pipes etc */
+    /* read-ahead buffer, NULL if not in use */
+    unsigned char *buff;
+    size_t buff_len, buff_stored_len, buff_pos;
 };
 
 #ifdef  __cplusplus
@@ -1,6 +1,6 @@
 /*
  *  R : A Computer Language for Statistical Data Analysis
- *  Copyright (C) 2001-11 The R Core Team.
+ *  Copyright (C) 2001-2017 The R Core Team.
  *
  *  This program is free software; you can redistribute it and/or modify
  *  it under the terms of the GNU Lesser General Public License as published by
@@ -670,6 +670,25 @@ struct _DevDesc {
     int haveRaster; /* 1 = no, 2 = yes, 3 = except for missing values */
     int haveCapture, haveLocator;  /* 1 = no, 2 = yes */
 
+    /* added in 3.5.0: draw n plotting symbols 'pch' (0 to 25) of
+       size 'size' (as for GESymbol) at (x[i], y[i]), as GESymbol
+       would draw each.  Only called for symbols lying wholly within
+       the clipping region.
+
+       The symbols may be drawn in any order, and all at once (e.g. as
+       a single path).  Returns FALSE (having drawn nothing) if the
+       device cannot draw this symbol or these colours this way, and
+       the engine then draws them one at a time.
+
+       Can be left unimplemented as NULL.
+     */
+#if R_USE_PROTOTYPES
+    Rboolean (*points)(int n, double *x, double *y, int pch, double size,
+		       const pGEcontext gc, pDevDesc dd);
+#else
+    Rboolean (*points)();
+#endif
+
 
     /* Area for future expansion.
        By zeroing this, devices are more likely to work if loaded
@@ -1,6 +1,6 @@
 /*
  *  R : A Computer Language for Statistical Data Analysis
- *  Copyright (C) 2001-11 The R Core Team.
+ *  Copyright (C) 2001-2017 The R Core Team.
  *
  *  This program is free software; you can redistribute it and/or modify
  *  it under the terms of the GNU Lesser General Public License as published by
@@ -64,9 +64,10 @@ extern "C" {
  *             - added this version number to snapshots (as attribute)
  *             - added R version number to snapshots (as attribute)
  *             - added pkgName to graphics system state info (as attribute)
+ * Version 12: Add dev_Points() and GEPoints() (R 3.5.0)
  */
 
-#define R_GE_version 11
+#define R_GE_version 12
 
 int R_GE_getVersion(void);
 
@@ -411,6 +412,8 @@ void GEText(double x, double y, const char * const str, cetype_t enc,
 void GEMode(int mode, pGEDevDesc dd);
 void GESymbol(double x, double y, int pch, double size,
 	      const pGEcontext gc, pGEDevDesc dd);
+void GEPoints(int n, double *x, double *y, int pch, double size,
+	      const pGEcontext gc, pGEDevDesc dd);
 void GEPretty(double *lo, double *up, int *ndiv);
 void GEMetricInfo(int c, const pGEcontext gc,
 		  double *ascent, double *descent, double *width,
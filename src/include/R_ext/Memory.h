@@ -49,6 +49,27 @@ long double *R_allocLD(size_t nelem);
 char*	S_alloc(long, int);
 char*	S_realloc(char *, long, long, int);
 
+void*	R_ArenaPush(void);
+void*	R_ArenaAlloc(size_t, int);
+void	R_ArenaPop(void *);
+
+/* Called at the end of each garbage collection, while the collector
+   is still active: hooks must not allocate R objects or signal errors. */
+#define R_GC_EVENT_CLASSES 8
+typedef struct {
+    int number;		/* the collection count, as used by gcinfo */
+    int level;		/* old generations collected, -1 for a slice of
+			   an incremental cycle */
+    double elapsed;	/* seconds */
+    double freed[R_GC_EVENT_CLASSES]; /* bytes freed in each node class */
+    double large;	/* bytes in large vectors afterwards */
+    double nsize, vsize; /* heap sizes afterwards, in bytes */
+} R_GCEvent;
+typedef void (*R_GCEventHook)(const R_GCEvent *, void *);
+
+void	R_AddGCEventHook(R_GCEventHook, void *);
+void	R_RemoveGCEventHook(R_GCEventHook, void *);
+
 #ifdef  __cplusplus
 }
 #endif
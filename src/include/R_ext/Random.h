@@ -1,6 +1,6 @@
 /*
  *  R : A Computer Language for Statistical Data Analysis
- *  Copyright (C) 1998-2016    The R Core Team
+ *  Copyright (C) 1998-2017    The R Core Team
  *
  *  This program is free software; you can redistribute it and/or modify
  *  it under the terms of the GNU Lesser General Public License as published by
@@ -54,6 +54,8 @@ void GetRNGstate(void);
 void PutRNGstate(void);
 
 double unif_rand(void);
+/* n values of unif_rand() at once */
+void unif_rand_n(double *, int);
 /* These are also defined in Rmath.h */
 double norm_rand(void);
 double exp_rand(void);
@@ -80,5 +80,17 @@ int Rsockselect(int nsock, int *insockfd, int *ready, int *write, double timeout
 
 #define set_iconv Rf_set_iconv
 void set_iconv(Rconnection con);
+
+/* Rconn_fgetc() for the common case of a byte waiting in the read-ahead
+   buffer with nothing saved or pushed back: the scanners call this per
+   byte. */
+static R_INLINE int Rconn_fgetc_buff(Rconnection con)
+{
+    if(con->buff_pos < con->buff_stored_len && con->save == -1000 &&
+       con->save2 == -1000 && con->nPushBack <= 0 &&
+       con->buff[con->buff_pos] != '\r')
+	return con->buff[con->buff_pos++];
+    return Rconn_fgetc(con);
+}
 #endif
 
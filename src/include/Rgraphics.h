@@ -1,7 +1,7 @@
 /*
  *  R : A Computer Language for Statistical Data Analysis
  *  Copyright (C) 1995, 1996  Robert Gentleman and Ross Ihaka
- *  Copyright (C) 1998--2016  R Core Team
+ *  Copyright (C) 1998--2017  R Core Team
  *
  *  This program is free software; you can redistribute it and/or modify
  *  it under the terms of the GNU Lesser General Public License as published by
@@ -91,6 +91,7 @@ typedef enum {
 #define GStrHeight		Rf_GStrHeight
 #define GStrWidth		Rf_GStrWidth
 #define GSymbol			Rf_GSymbol
+#define GSymbols		Rf_GSymbols
 #define GText			Rf_GText
 #define GVStrHeight		Rf_GVStrHeight
 #define GVStrWidth		Rf_GVStrWidth
@@ -222,6 +223,8 @@ void GPretty(double*, double*, int*); /* used in plot3d.c */
 void GMtext(const char *, cetype_t, int, double, int, double, int, double, pGEDevDesc);
 /* Draw one of the predefined symbols (circle, square, diamond, ...) */
 void GSymbol(double, double, int, int, pGEDevDesc);
+/* The same symbol at several points in device coordinates */
+void GSymbols(int, double*, double*, int, pGEDevDesc);
 
 /* From plotmath.c, used in plot.c */
 double GExpressionHeight(SEXP, GUnit, pGEDevDesc);
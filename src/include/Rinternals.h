@@ -205,9 +205,13 @@ struct sxpinfo_struct {
     unsigned int debug :  1;
     unsigned int trace :  1;  /* functions and memory tracing */
     unsigned int spare :  1;  /* currently unused */
-    unsigned int gcgen :  1;  /* old generation number */
     unsigned int gccls :  3;  /* node class */
-}; /*		    Tot: 32 */
+    unsigned int gcgen :  2;  /* old generation number */
+    unsigned int gcage :  3;  /* collections survived in this generation */
+    unsigned int sorted:  3;  /* known sortedness of vectors, see Defn.h */
+    unsigned int rcnt  : 16;  /* reference count, see REFCNT below */
+    unsigned int extra :  8;  /* currently unused */
+}; /*		    Tot: 64 (31 + 1 unused + 32) */
 
 struct vecsxp_struct {
     R_len_t	length;
@@ -253,14 +257,18 @@ struct promsxp_struct {
    fields used to maintain the collector's linked list structures. */
 
 /* Define SWITH_TO_REFCNT to use reference counting instead of the
-   'NAMED' mechanism. This uses the R-devel binary layout. The two
-   'named' field bits are used for the REFCNT, so REFCNTMAX is 3. */
+   'NAMED' mechanism.  Otherwise reference counts are still computed,
+   in their own 16-bit field, alongside NAMED, but NAMED alone decides
+   whether an object may be modified in place: the counts do not yet
+   cover all references, e.g. from the byte code node stack or from
+   argument lists of builtins.  Explicitly setting NAMED to 2 also pins
+   the count at REFCNTMAX. */
 //#define SWITCH_TO_REFCNT
 
-#if defined(SWITCH_TO_REFCNT) && ! defined(COMPUTE_REFCNT_VALUES)
+#ifndef COMPUTE_REFCNT_VALUES
 # define COMPUTE_REFCNT_VALUES
 #endif
-#define REFCNTMAX (4 - 1)
+#define REFCNTMAX ((1 << 16) - 1)
 
 #define SEXPREC_HEADER \
     struct sxpinfo_struct sxpinfo; \
@@ -311,7 +319,7 @@ typedef union { VECTOR_SEXPREC s; double align; } SEXPREC_ALIGN;
 #define SETLEVELS(x,v)	(((x)->sxpinfo.gp)=((unsigned short)v))
 
 #if defined(COMPUTE_REFCNT_VALUES)
-# define REFCNT(x) ((x)->sxpinfo.named)
+# define REFCNT(x) ((x)->sxpinfo.rcnt)
 # define TRACKREFS(x) (TYPEOF(x) == CLOSXP ? TRUE : ! (x)->sxpinfo.spare)
 #else
 # define REFCNT(x) 0
@@ -323,6 +331,15 @@ typedef union { VECTOR_SEXPREC s; double align; } SEXPREC_ALIGN;
 # undef SET_NAMED
 # define NAMED(x) REFCNT(x)
 # define SET_NAMED(x, v) do {} while (0)
+#elif defined(COMPUTE_REFCNT_VALUES)
+# undef SET_NAMED
+# define SET_NAMED(x, v) do {				\
+	SEXP sn__x__ = (x);				\
+	int sn__v__ = (v);				\
+	sn__x__->sxpinfo.named = sn__v__;		\
+	if (sn__v__ >= 2) REFCNT(sn__x__) = REFCNTMAX;	\
+    } while (0)
+# define INCREMENT_NAMED_COUNT(x) ((x)->sxpinfo.named++)
 #endif
 
 /* S4 object bit, set by R_do_new_object for all new() calls */
@@ -466,11 +483,19 @@ Rboolean (Rf_isObject)(SEXP s);
     (IS_SCALAR(x, type) && ATTRIB(x) == R_NilValue)
 
 #define NAMEDMAX 2
-#define INCREMENT_NAMED(x) do {				\
+#ifdef INCREMENT_NAMED_COUNT
+# define INCREMENT_NAMED(x) do {			\
+	SEXP __x__ = (x);				\
+	if (NAMED(__x__) != NAMEDMAX)			\
+	    INCREMENT_NAMED_COUNT(__x__);		\
+    } while (0)
+#else
+# define INCREMENT_NAMED(x) do {			\
 	SEXP __x__ = (x);				\
 	if (NAMED(__x__) != NAMEDMAX)			\
 	    SET_NAMED(__x__, NAMED(__x__) + 1);		\
     } while (0)
+#endif
 
 #if defined(COMPUTE_REFCNT_VALUES)
 # define SET_REFCNT(x,v) (REFCNT(x) = (v))
@@ -899,6 +924,7 @@ typedef enum {
 cetype_t Rf_getCharCE(SEXP);
 SEXP Rf_mkCharCE(const char *, cetype_t);
 SEXP Rf_mkCharLenCE(const char *, int, cetype_t);
+SEXP R_lookupCharLenCE(const char *, int, cetype_t);
 const char *Rf_reEnc(const char *x, cetype_t ce_in, cetype_t ce_out, int subst);
 
 				/* return(.) NOT reached : for -Wall */
@@ -929,6 +955,7 @@ void R_RegisterFinalizer(SEXP s, SEXP fun);
 void R_RegisterCFinalizer(SEXP s, R_CFinalizer_t fun);
 void R_RegisterFinalizerEx(SEXP s, SEXP fun, Rboolean onexit);
 void R_RegisterCFinalizerEx(SEXP s, R_CFinalizer_t fun, Rboolean onexit);
+void R_RegisterThreadSafeCFinalizer(SEXP s, R_CFinalizer_t fun, Rboolean onexit);
 void R_RunPendingFinalizers(void);
 
 /* Weak reference interface */
@@ -938,6 +965,11 @@ SEXP R_WeakRefKey(SEXP w);
 SEXP R_WeakRefValue(SEXP w);
 void R_RunWeakRefFinalizer(SEXP w);
 
+/* Vectors backed by a file mapped into memory (memory.c); a negative
+   length means as many elements as the file holds */
+SEXP R_mmapVector(const char *file, SEXPTYPE type, R_xlen_t length,
+		  Rboolean readonly);
+
 SEXP R_PromiseExpr(SEXP);
 SEXP R_ClosureExpr(SEXP);
 void R_initialize_bcode(void);
@@ -995,7 +1027,8 @@ typedef enum {
     R_pstream_ascii_format,
     R_pstream_binary_format,
     R_pstream_xdr_format,
-    R_pstream_asciihex_format
+    R_pstream_asciihex_format,
+    R_pstream_binary_le_format
 } R_pstream_format_t;
 
 typedef struct R_outpstream_st *R_outpstream_t;
@@ -383,6 +383,7 @@ BMDeviceDriver(pDevDesc dd, int kind, const char *filename,
     dd->polyline = Cairo_Polyline;
     dd->polygon = Cairo_Polygon;
     dd->path = Cairo_Path;
+    dd->points = Cairo_Points;
     dd->raster = Cairo_Raster;
 #ifdef HAVE_PANGOCAIRO
     dd->metricInfo = PangoCairo_MetricInfo;
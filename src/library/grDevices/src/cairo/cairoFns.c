@@ -1,6 +1,6 @@
 /*
  *  R : A Computer Language for Statistical Data Analysis
- *  Copyright (C) 2008--2013  R Core Team
+ *  Copyright (C) 2008--2017  R Core Team
  *
  *  This program is free software; you can redistribute it and/or modify
  *  it under the terms of the GNU General Public License as published by
@@ -25,6 +25,7 @@
     cairo_close_path
     cairo_create
     cairo_destroy
+    cairo_fill
     cairo_fill_preserve
     cairo_get_source
     cairo_get_target
@@ -35,6 +36,7 @@
     cairo_line_to
     cairo_move_to
     cairo_new_path
+    cairo_new_sub_path (1.2)
     cairo_paint
     cairo_pattern_set_extend
     cairo_pattern_set_filter
@@ -257,6 +259,92 @@ static void Cairo_Polygon(int n, double *x, double *y,
     }
 }
 
+/* Plotting symbols as a single path, with the geometry of GESymbol
+   in ../../../main/engine.c.  Only symbols drawn in one opaque colour
+   are handled, as for them the order of drawing does not matter. */
+#define SMALL	0.25
+#define RADIUS	0.375
+#define TRC0	1.55512030155621416073
+#define TRC1	1.34677368708859836060
+#define TRC2	0.77756015077810708036
+
+static Rboolean Cairo_Points(int n, double *x, double *y, int pch,
+			     double size, const pGEcontext gc, pDevDesc dd)
+{
+    pX11Desc xd = (pX11Desc) dd->deviceSpecific;
+    cairo_t *cc = xd->cc;
+    int i;
+    Rboolean fill = TRUE, stroke = FALSE;
+    double r = RADIUS * size, xc, yc,
+	/* device units per inch in x over those in y, with sign */
+	ys = dd->ipr[0] / dd->ipr[1] * (dd->top > dd->bottom ? 1 : -1);
+
+    if (R_ALPHA(gc->col) != 255 || gc->lty != LTY_SOLID) return FALSE;
+    switch(pch) {
+    case 0: case 1: case 2: case 5: case 6:
+	fill = FALSE; stroke = TRUE;
+	break;
+    case 19: case 20:
+	stroke = TRUE;
+	break;
+    case 15: case 16: case 17: case 18:
+	break;
+    default:
+	return FALSE;
+    }
+
+    cairo_new_path(cc);
+    for (i = 0; i < n; i++) {
+	double xi = x[i], yi = y[i];
+	switch(pch) {
+	case 0: case 15:
+	    xc = RADIUS * size;
+	    yc = xc * ys;
+	    cairo_rectangle(cc, xi - xc, yi - yc, 2 * xc, 2 * yc);
+	    break;
+	case 1: case 16: case 19: case 20:
+	    xc = (pch == 20) ? SMALL * size : r;
+	    cairo_new_sub_path(cc);
+	    cairo_arc(cc, xi, yi, (xc > 0.5 ? xc : 0.5), 0.0, 2 * M_PI);
+	    break;
+	case 2: case 6: case 17:
+	{
+	    double h = (pch == 6) ? -1 : 1;
+	    xc = TRC1 * r;
+	    yc = h * TRC2 * r * ys;
+	    cairo_move_to(cc, xi, yi + h * TRC0 * r * ys);
+	    cairo_line_to(cc, xi, yi + h * TRC0 * r * ys);
+	    cairo_line_to(cc, xi + xc, yi - yc);
+	    cairo_line_to(cc, xi - xc, yi - yc);
+	    cairo_close_path(cc);
+	    break;
+	}
+	case 5: case 18:
+	    xc = (pch == 5) ? M_SQRT2 * r : r;
+	    yc = xc * ys;
+	    cairo_move_to(cc, xi - xc, yi);
+	    cairo_line_to(cc, xi - xc, yi);
+	    cairo_line_to(cc, xi, yi + yc);
+	    cairo_line_to(cc, xi + xc, yi);
+	    cairo_line_to(cc, xi, yi - yc);
+	    cairo_close_path(cc);
+	    break;
+	}
+    }
+
+    CairoColor(gc->col, xd);
+    if (fill) {
+	cairo_set_antialias(cc, CAIRO_ANTIALIAS_NONE);
+	if (stroke) cairo_fill_preserve(cc); else cairo_fill(cc);
+	cairo_set_antialias(cc, xd->antialias);
+    }
+    if (stroke) {
+	CairoLineType(gc, xd);
+	cairo_stroke(cc);
+    }
+    return TRUE;
+}
+
 static void Cairo_Path(double *x, double *y,
                        int npoly, int *nper,
                        Rboolean winding,
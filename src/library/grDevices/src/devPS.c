@@ -1,7 +1,7 @@
 /*
  *  R : A Computer Language for Statistical Data Analysis
  *  Copyright (C) 1995, 1996  Robert Gentleman and Ross Ihaka
- *  Copyright (C) 1998--2015  The R Core Team
+ *  Copyright (C) 1998--2017  The R Core Team
  *
  *  This program is free software; you can redistribute it and/or modify
  *  it under the terms of the GNU General Public License as published by
@@ -5437,6 +5437,7 @@ typedef struct {
     Rboolean fillOddEven; /* polygon fill mode */
     Rboolean useCompression;
     char tmpname[PATH_MAX]; /* used before compression */
+    FILE *pagefp; /* the content of the current page, to be compressed */
 
     /*
      * Fonts and encodings used on the device
@@ -5888,6 +5889,7 @@ PDFDeviceDriver(pDevDesc dd, const char *file, const char *paper,
     pd->useKern = (useKern != 0);
     pd->fillOddEven = fillOddEven;
     pd->useCompression = useCompression;
+    pd->pagefp = NULL;
     if(useCompression && pd->versionMajor == 1 && pd->versionMinor < 2) {
 	pd->versionMinor = 2;
 	warning(_("increasing the PDF version to 1.2"));
@@ -7107,32 +7109,59 @@ static void PDF_Size(double *left, double *right,
     *top = dd->top;
 }
 
+/* Deflate the first len bytes of pd->pagefp into the output file a
+   block at a time, returning the number of bytes written */
+static int PDF_deflatePage(PDFDesc *pd, long len)
+{
+    Bytef in[16384], out[16384];
+    z_stream strm;
+    int flush, res;
+    long total = 0;
+
+    strm.zalloc = Z_NULL;
+    strm.zfree = Z_NULL;
+    strm.opaque = Z_NULL;
+    res = deflateInit(&strm, Z_DEFAULT_COMPRESSION);
+    if(res != Z_OK)
+	error("internal compression error %d in PDF_endpage", res);
+    fflush(pd->pagefp);
+    rewind(pd->pagefp);
+    do {
+	size_t nin = fread(in, 1, len < (long) sizeof(in) ? len : sizeof(in),
+			   pd->pagefp);
+	if (nin == 0 && len > 0) error("internal read error in PDF_endpage");
+	len -= nin;
+	flush = (len > 0) ? Z_NO_FLUSH : Z_FINISH;
+	strm.next_in = in;
+	strm.avail_in = (uInt) nin;
+	do {
+	    size_t nout;
+	    strm.next_out = out;
+	    strm.avail_out = sizeof(out);
+	    res = deflate(&strm, flush);
+	    if(res == Z_STREAM_ERROR)
+		error("internal compression error %d in PDF_endpage", res);
+	    nout = sizeof(out) - strm.avail_out;
+	    if(fwrite(out, 1, nout, pd->mainfp) != nout)
+		error(_("write failed"));
+	    total += nout;
+	} while (strm.avail_out == 0);
+    } while (flush != Z_FINISH);
+    deflateEnd(&strm);
+    return (int) total;
+}
+
 static void PDF_endpage(PDFDesc *pd)
 {
     if(pd->inText) textoff(pd);
     fprintf(pd->pdffp, "Q\n");
     if (pd->useCompression) {
-	fflush(pd->pdffp);
-	fseek(pd->pdffp, 0, SEEK_END);
-	unsigned int len = (unsigned int) ftell(pd->pdffp);
-	fseek(pd->pdffp, 0, SEEK_SET);
-	Bytef *buf = Calloc(len, Bytef);
-	uLong outlen = (uLong)(1.001*len + 20);
-	Bytef *buf2 = Calloc(outlen, Bytef);
-	size_t res = fread(buf, 1, len, pd->pdffp);
-	if (res < len) error("internal read error in PDF_endpage");
-	fclose(pd->pdffp);
-	unlink(pd->tmpname);
+	long len = ftell(pd->pdffp);
 	pd->pdffp = pd->mainfp;
-	int res2 = compress(buf2, &outlen, buf, len);
-	if(res2 != Z_OK) 
-	    error("internal compression error %d in PDF_endpage", res2);
-	fprintf(pd->pdffp, "%d 0 obj\n<<\n/Length %d /Filter /FlateDecode\n>>\nstream\n", 
-		pd->nobjs, (int) outlen);
-	size_t nwrite = fwrite(buf2, 1, outlen, pd->pdffp);
-	if(nwrite != outlen) error(_("write failed"));
-	Free(buf); Free(buf2);
+	int outlen = PDF_deflatePage(pd, len);
 	fprintf(pd->pdffp, "endstream\nendobj\n");
+	pd->pos[++pd->nobjs] = (int) ftell(pd->pdffp);
+	fprintf(pd->pdffp, "%d 0 obj\n%d\nendobj\n", pd->nobjs, outlen);
     } else {
 	int here = (int) ftell(pd->pdffp);
 	fprintf(pd->pdffp, "endstream\nendobj\n");
@@ -7215,13 +7244,22 @@ static void PDF_NewPage(const pGEcontext gc,
 	    pd->nobjs, pd->nobjs+1);
     pd->pos[++pd->nobjs] = (int) ftell(pd->pdffp);
     if (pd->useCompression) {
-	char *tmp = R_tmpnam("pdf", R_TempDir);
-	/* assume tmpname is less than PATH_MAX */
-	strcpy(pd->tmpname, tmp);
-	pd->pdffp = fopen(tmp, "w+b");
-	free(tmp);
-	if(! pd->pdffp) error("cannot open file '%s', reason %s", 
-			      tmp, strerror(errno));
+	fprintf(pd->pdffp,
+		"%d 0 obj\n<<\n/Length %d 0 R /Filter /FlateDecode\n>>\nstream\n",
+		pd->nobjs, pd->nobjs + 1);
+	/* The page content goes to a temporary file (the same one for
+	   each page) and is deflated into the output by PDF_endpage */
+	if (!pd->pagefp) {
+	    char *tmp = R_tmpnam("pdf", R_TempDir);
+	    /* assume tmpname is less than PATH_MAX */
+	    strcpy(pd->tmpname, tmp);
+	    free(tmp);
+	    pd->pagefp = fopen(pd->tmpname, "w+b");
+	    if(! pd->pagefp) error("cannot open file '%s', reason %s",
+				   pd->tmpname, strerror(errno));
+	}
+	rewind(pd->pagefp);
+	pd->pdffp = pd->pagefp;
     } else {
 	fprintf(pd->pdffp, "%d 0 obj\n<<\n/Length %d 0 R\n>>\nstream\n",
 		pd->nobjs, pd->nobjs + 1);
@@ -7259,6 +7297,10 @@ static void PDF_Close(pDevDesc dd)
         /* may no longer be needed */
         killRasterArray(pd->rasters, pd->maxRasters);
     }
+    if (pd->pagefp) {
+	fclose(pd->pagefp);
+	unlink(pd->tmpname);
+    }
     PDFcleanup(6, pd); /* which frees masks and rasters */
 }
 
@@ -1,7 +1,7 @@
 /*
  *  R : A Computer Language for Statistical Data Analysis
  *  Copyright (C) 1995, 1996  Robert Gentleman and Ross Ihaka
- *  Copyright (C) 1997--2016  The R Core Team
+ *  Copyright (C) 1997--2017  The R Core Team
  *  Copyright (C) 2002--2011  The R Foundation
  *
  *  This program is free software; you can redistribute it and/or modify
@@ -3256,6 +3256,19 @@ void GSymbol(double x, double y, int coords, int pch, pGEDevDesc dd)
     GESymbol(x, y, pch, size, &gc, dd);
 }
 
+/* Draw the same symbol at n points in device coordinates, as n calls
+   to GSymbol would: devices may draw them all at once. */
+void GSymbols(int n, double *x, double *y, int pch, pGEDevDesc dd)
+{
+    double size = GConvertYUnits(GSTR_0, INCHES, DEVICE, dd);
+    R_GE_gcontext gc; gcontextFromGP(&gc, dd);
+
+    GClip(dd);
+    gc.lty = LTY_SOLID;
+    if(pch == 46) size = gpptr(dd)->cex;
+    GEPoints(n, x, y, pch, size, &gc, dd);
+}
+
 
 /* Draw text in plot margins. */
 void GMtext(const char *str, cetype_t enc, int side, double line, int outer,
@@ -1,7 +1,7 @@
 /*
  *  R : A Computer Language for Statistical Data Analysis
  *  Copyright (C) 1995, 1996  Robert Gentleman and Ross Ihaka
- *  Copyright (C) 1997--2014  The R Core Team
+ *  Copyright (C) 1997--2017  The R Core Team
  *  Copyright (C) 2002--2009  The R Foundation
  *
  *  This program is free software; you can redistribute it and/or modify
@@ -1536,6 +1536,13 @@ SEXP C_plotXY(SEXP args)
 
     /* Points : */
     if (type == 'p' || type == 'b' || type == 'o') {
+	/* Runs of points with the same symbol, size and colours are
+	   drawn by a single call */
+	double *xs, *ys;
+	int ns = 0, runpch = 0;
+	const void *vmax = vmaxget();
+	xs = (double *) R_alloc(n, sizeof(double));
+	ys = (double *) R_alloc(n, sizeof(double));
 	for (i = 0; i < n; i++) {
 	    xx = x[i];
 	    yy = y[i];
@@ -1548,17 +1555,32 @@ SEXP C_plotXY(SEXP args)
 		    thisbg = INTEGER(bg)[i % nbg];
 		    if (!(R_TRANSPARENT(thiscol) &&
 			  R_TRANSPARENT(thisbg))) {
-			gpptr(dd)->cex = thiscex * gpptr(dd)->cexbase;
-			gpptr(dd)->col = thiscol;
-			if(nlwd > 1 &&
-			   R_FINITE((thislwd = REAL(lwd)[i % nlwd])))
-			    gpptr(dd)->lwd = thislwd;
-			gpptr(dd)->bg = thisbg;
-			GSymbol(xx, yy, DEVICE, thispch, dd);
+			thislwd = (nlwd > 1) ? REAL(lwd)[i % nlwd] : NA_REAL;
+			if (ns > 0 &&
+			    (thispch != runpch ||
+			     thiscex * gpptr(dd)->cexbase != gpptr(dd)->cex ||
+			     thiscol != gpptr(dd)->col ||
+			     thisbg != gpptr(dd)->bg ||
+			     (R_FINITE(thislwd) && thislwd != gpptr(dd)->lwd))) {
+			    GSymbols(ns, xs, ys, runpch, dd);
+			    ns = 0;
+			}
+			if (ns == 0) {
+			    gpptr(dd)->cex = thiscex * gpptr(dd)->cexbase;
+			    gpptr(dd)->col = thiscol;
+			    if(R_FINITE(thislwd))
+				gpptr(dd)->lwd = thislwd;
+			    gpptr(dd)->bg = thisbg;
+			    runpch = thispch;
+			}
+			xs[ns] = xx;
+			ys[ns++] = yy;
 		    }
 		}
 	    }
 	}
+	if (ns > 0) GSymbols(ns, xs, ys, runpch, dd);
+	vmaxset(vmax);
     }
     GMode(0, dd);
     GRestorePars(dd);
@@ -1831,6 +1831,7 @@ SEXP L_lineTo(SEXP x, SEXP y, SEXP arrow)
  */
 SEXP L_lines(SEXP x, SEXP y, SEXP index, SEXP arrow) 
 {
+    Rboolean vec;
     int i, j, nx, nl, start=0;
     double *xx, *yy;
     double xold, yold;
@@ -1870,12 +1871,15 @@ SEXP L_lines(SEXP x, SEXP y, SEXP index, SEXP arrow)
 	yy = (double *) R_alloc(nx, sizeof(double));
 	xold = NA_REAL;
 	yold = NA_REAL;
+	vec = transformLocnVec(x, y, nx, INTEGER(indices), vpc,
+			       vpWidthCM, vpHeightCM, dd, transform, xx, yy);
 	for (i=0; i<nx; i++) {
-	    transformLocn(x, y, INTEGER(indices)[i] - 1, vpc, &gc,
-			  vpWidthCM, vpHeightCM,
-			  dd,
-			  transform,
-			  &(xx[i]), &(yy[i]));
+	    if (!vec)
+		transformLocn(x, y, INTEGER(indices)[i] - 1, vpc, &gc,
+			      vpWidthCM, vpHeightCM,
+			      dd,
+			      transform,
+			      &(xx[i]), &(yy[i]));
 	    /* The graphics engine only takes device coordinates
 	     */
 	    xx[i] = toDeviceX(xx[i], GE_INCHES, dd);
@@ -2368,6 +2372,7 @@ SEXP L_arrows(SEXP x1, SEXP x2, SEXP xnm1, SEXP xn,
 
 SEXP L_polygon(SEXP x, SEXP y, SEXP index)
 {
+    Rboolean vec;
     int i, j, nx, np, start=0;
     double *xx, *yy;
     double xold, yold;
@@ -2407,12 +2412,15 @@ SEXP L_polygon(SEXP x, SEXP y, SEXP index)
 	yy = (double *) R_alloc(nx + 1, sizeof(double));
 	xold = NA_REAL;
 	yold = NA_REAL;
+	vec = transformLocnVec(x, y, nx, INTEGER(indices), vpc,
+			       vpWidthCM, vpHeightCM, dd, transform, xx, yy);
 	for (j=0; j<nx; j++) {
-	    transformLocn(x, y, INTEGER(indices)[j] - 1, vpc, &gc,
-			  vpWidthCM, vpHeightCM,
-			  dd,
-			  transform,
-			  &(xx[j]), &(yy[j]));
+	    if (!vec)
+		transformLocn(x, y, INTEGER(indices)[j] - 1, vpc, &gc,
+			      vpWidthCM, vpHeightCM,
+			      dd,
+			      transform,
+			      &(xx[j]), &(yy[j]));
 	    /* The graphics engine only takes device coordinates
 	     */
 	    xx[j] = toDeviceX(xx[j], GE_INCHES, dd);
@@ -2818,6 +2826,7 @@ SEXP L_rectBounds(SEXP x, SEXP y, SEXP w, SEXP h, SEXP hjust, SEXP vjust,
 
 SEXP L_path(SEXP x, SEXP y, SEXP index, SEXP rule)
 {
+    Rboolean vec;
     int i, j, k, npoly, *nper, ntot;
     double *xx, *yy;
     const void *vmax;
@@ -2857,12 +2866,16 @@ SEXP L_path(SEXP x, SEXP y, SEXP index, SEXP rule)
     k = 0;
     for (i=0; i < npoly; i++) {
         SEXP indices = VECTOR_ELT(index, i);
+	vec = transformLocnVec(x, y, nper[i], INTEGER(indices), vpc,
+			       vpWidthCM, vpHeightCM, dd, transform,
+			       xx + k, yy + k);
         for (j=0; j < nper[i]; j++) {            
-	    transformLocn(x, y, INTEGER(indices)[j] - 1, vpc, &gc,
-			  vpWidthCM, vpHeightCM,
-			  dd,
-			  transform,
-			  &(xx[k]), &(yy[k]));
+	    if (!vec)
+		transformLocn(x, y, INTEGER(indices)[j] - 1, vpc, &gc,
+			      vpWidthCM, vpHeightCM,
+			      dd,
+			      transform,
+			      &(xx[k]), &(yy[k]));
 	    /* The graphics engine only takes device coordinates
 	     */
 	    xx[k] = toDeviceX(xx[k], GE_INCHES, dd);
@@ -3301,6 +3314,7 @@ SEXP L_textBounds(SEXP label, SEXP x, SEXP y,
 
 SEXP L_points(SEXP x, SEXP y, SEXP pch, SEXP size)
 {
+    Rboolean vec;
     int i, nx, npch;
     /*    double *xx, *yy;*/
     double *xx, *yy;
@@ -3327,13 +3341,17 @@ SEXP L_points(SEXP x, SEXP y, SEXP pch, SEXP size)
     vmax = vmaxget();
     xx = (double *) R_alloc(nx, sizeof(double));
     yy = (double *) R_alloc(nx, sizeof(double));
+    vec = transformLocnVec(x, y, nx, NULL, vpc,
+			   vpWidthCM, vpHeightCM, dd, transform, xx, yy);
     for (i=0; i<nx; i++) {
-	gcontextFromgpar(currentgp, i, &gc, dd);
-	transformLocn(x, y, i, vpc, &gc,
-		      vpWidthCM, vpHeightCM,
-		      dd,
-		      transform,
-		      &(xx[i]), &(yy[i]));
+	if (!vec) {
+	    gcontextFromgpar(currentgp, i, &gc, dd);
+	    transformLocn(x, y, i, vpc, &gc,
+			  vpWidthCM, vpHeightCM,
+			  dd,
+			  transform,
+			  &(xx[i]), &(yy[i]));
+	}
 	/* The graphics engine only takes device coordinates
 	 */
 	xx[i] = toDeviceX(xx[i], GE_INCHES, dd);
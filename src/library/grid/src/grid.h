@@ -394,6 +394,13 @@ void transformLocn(SEXP x, SEXP y, int index, LViewportContext vpc,
 		   LTransform t,
 		   double *xx, double *yy);
 
+Rboolean transformLocnVec(SEXP x, SEXP y, int n, int *index,
+			  LViewportContext vpc,
+			  double widthCM, double heightCM,
+			  pGEDevDesc dd,
+			  LTransform t,
+			  double *xx, double *yy);
+
 double transformWidthtoINCHES(SEXP w, int index, LViewportContext vpc,
 			      const pGEcontext gc,
 			      double widthCM, double heightCM,
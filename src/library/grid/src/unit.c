@@ -1518,6 +1518,81 @@ void transformLocn(SEXP x, SEXP y, int index,
     *yy = locationY(lout);
 }
 
+/* Are all the units of x ones whose value depends only on the
+ * viewport (and not on data or the graphical context)?
+ */
+static Rboolean simpleUnits(SEXP x)
+{
+    SEXP units;
+    int i, n;
+    if (isUnitArithmetic(x) || isUnitList(x))
+	return FALSE;
+    units = getAttrib(x, install("valid.unit"));
+    if (TYPEOF(units) != INTSXP)
+	return FALSE;
+    n = LENGTH(units);
+    for (i = 0; i < n; i++) {
+	switch (INTEGER(units)[i]) {
+	case L_NPC:
+	case L_NATIVE:
+	case L_CM:
+	case L_INCHES:
+	case L_SNPC:
+	case L_MM:
+	case L_POINTS:
+	case L_PICAS:
+	case L_BIGPOINTS:
+	case L_DIDA:
+	case L_CICERO:
+	case L_SCALEDPOINTS:
+	    break;
+	default:
+	    return FALSE;
+	}
+    }
+    return TRUE;
+}
+
+/* 
+ * transformLocn() for n locations at once (index[i] - 1, or i if
+ * index is NULL), looking up the units of x and y only once.
+ * Only done for plain units none of which needs data or a
+ * graphical context:  returns FALSE (and does nothing) otherwise,
+ * in which case the caller should use transformLocn().
+ */
+Rboolean transformLocnVec(SEXP x, SEXP y, int n, int *index,
+			  LViewportContext vpc,
+			  double widthCM, double heightCM,
+			  pGEDevDesc dd,
+			  LTransform t,
+			  double *xx, double *yy)
+{
+    LLocation lin, lout;
+    int i, j, nx, ny, nux, nuy, *ux, *uy;
+    if (!simpleUnits(x) || !simpleUnits(y))
+	return FALSE;
+    nx = LENGTH(x);
+    ny = LENGTH(y);
+    ux = INTEGER(getAttrib(x, install("valid.unit")));
+    nux = LENGTH(getAttrib(x, install("valid.unit")));
+    uy = INTEGER(getAttrib(y, install("valid.unit")));
+    nuy = LENGTH(getAttrib(y, install("valid.unit")));
+    for (i = 0; i < n; i++) {
+	j = index ? index[i] - 1 : i;
+	xx[i] = transformLocation(numeric(x, j % nx), ux[j % nux], R_NilValue,
+				  vpc.xscalemin, vpc.xscalemax, NULL,
+				  widthCM, heightCM, 0, L_plain, dd);
+	yy[i] = transformLocation(numeric(y, j % ny), uy[j % nuy], R_NilValue,
+				  vpc.yscalemin, vpc.yscalemax, NULL,
+				  heightCM, widthCM, 0, L_plain, dd);
+	location(xx[i], yy[i], lin);
+	trans(lin, t, lout);
+	xx[i] = locationX(lout);
+	yy[i] = locationY(lout);
+    }
+    return TRUE;
+}
+
 double transformWidthtoINCHES(SEXP w, int index,
 			      LViewportContext vpc,
 			      const pGEcontext gc,
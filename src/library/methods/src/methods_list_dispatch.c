@@ -1,6 +1,6 @@
 /*
  *  R : A Computer Language for Statistical Data Analysis
- *  Copyright (C) 2001-2016   The R Core Team.
+ *  Copyright (C) 2001-2017   The R Core Team.
  *
  *  This program is free software; you can redistribute it and/or modify
  *  it under the terms of the GNU General Public License as published by
@@ -258,7 +258,7 @@ SEXP R_quick_method_check(SEXP args, SEXP mlist, SEXP fdef)
 SEXP R_quick_dispatch(SEXP args, SEXP genericEnv, SEXP fdef)
 {
     /* Match the list of (evaluated) args to the methods table. */
-    static SEXP  R_allmtable = NULL, R_siglength;
+    static SEXP  R_allmtable = NULL, R_siglength, R_mtpending;
     SEXP object, value, mtable;
     const char *class; int nprotect = 0, nsig, nargs;
 #define NBUF 200
@@ -266,9 +266,13 @@ SEXP R_quick_dispatch(SEXP args, SEXP genericEnv, SEXP fdef)
     if(!R_allmtable) {
 	R_allmtable = install(".AllMTable");
 	R_siglength = install(".SigLength");
+	R_mtpending = install(".MTablePending");
     }
     if(!genericEnv || TYPEOF(genericEnv) != ENVSXP)
 	return R_NilValue; /* a bug or not initialized yet */
+    /* methods not yet merged into the tables: leave it to the generic */
+    if(findVarInFrame(genericEnv, R_mtpending) != R_UnboundValue)
+	return R_NilValue;
     mtable = findVarInFrame(genericEnv, R_allmtable);
     if(mtable == R_UnboundValue || TYPEOF(mtable) != ENVSXP)
 	return R_NilValue;
@@ -951,7 +955,8 @@ static SEXP do_mtable(SEXP fdef, SEXP ev)
 
 SEXP R_dispatchGeneric(SEXP fname, SEXP ev, SEXP fdef)
 {
-    static SEXP R_mtable = NULL, R_allmtable, R_sigargs, R_siglength, R_dots;
+    static SEXP R_mtable = NULL, R_allmtable, R_sigargs, R_siglength, R_dots,
+	R_mtpending;
     int nprotect = 0;
     SEXP mtable, classes, thisClass = R_NilValue /* -Wall */, sigargs,
 	siglength, f_env = R_NilValue, method, f, val = R_NilValue;
@@ -964,6 +969,7 @@ SEXP R_dispatchGeneric(SEXP fname, SEXP ev, SEXP fdef)
 	R_sigargs = install(".SigArgs");
 	R_siglength = install(".SigLength");
 	R_dots = install("...");
+	R_mtpending = install(".MTablePending");
     }
     switch(TYPEOF(fdef)) {
     case CLOSXP:
@@ -983,8 +989,11 @@ SEXP R_dispatchGeneric(SEXP fname, SEXP ev, SEXP fdef)
 	      class_string(fdef));
     }
     PROTECT(mtable = findVarInFrame(f_env, R_allmtable)); nprotect++;
-    if(mtable == R_UnboundValue) {
-	do_mtable(fdef, ev); /* Should initialize the generic */
+    if(mtable == R_UnboundValue ||
+       findVarInFrame(f_env, R_mtpending) != R_UnboundValue) {
+	/* Should initialize the generic, or merge the methods of
+	   packages attached since it was last used */
+	do_mtable(fdef, ev);
 	PROTECT(mtable = findVarInFrame(f_env, R_allmtable)); nprotect++;
     }
     PROTECT(sigargs = findVarInFrame(f_env, R_sigargs)); nprotect++;
@@ -41,6 +41,9 @@
 #include <signal.h>
 #include <errno.h>
 #include <fcntl.h>
+#ifdef HAVE_SHM_OPEN
+# include <sys/mman.h>
+#endif
 
 #include <Rinterface.h> /* for R_Interactive */
 
@@ -66,6 +69,8 @@ void Dprintf(char *format, ...) {
 typedef struct child_info {
     pid_t pid; /* child's pid */
     int pfd, sifd; /* master's ends of pipes */
+    int pool; /* persistent worker, not reported by mc_children() */
+    unsigned int shmid; /* names the child's shared memory segment */
     struct child_info *next;
 } child_info_t;
 
@@ -74,6 +79,76 @@ static child_info_t *children; /* in master, linked list of details of children
 static int master_fd = -1; /* in child, write end of data pipe */
 static int is_master = 1; /* 0 in child */
 
+/* Results of at least this many bytes are passed to the master in a
+   POSIX shared memory segment: the pipe only carries the marker
+   MC_SHM_MARK (never a valid length) followed by an shm_rec.
+
+   Each child has a single segment name, made from the master's pid and
+   a number the master assigns at fork, so the master can remove the
+   segment of a child whose result it never reads: when the child is
+   removed from the list, and for the children left at exit.  The
+   master unlinks a segment as soon as it has opened it, and until then
+   the child sends any further results down the pipe. */
+#define MC_SHM_MIN  (1 << 20)
+#define MC_SHM_MARK 0xffffffffU
+
+typedef struct shm_rec {
+    unsigned int len;
+    char name[60];
+} shm_rec_t;
+
+static pid_t mc_master_pid; /* in child, the master's pid */
+static unsigned int mc_shmid; /* in child, the id of its segment */
+static unsigned int mc_shmid_last; /* in master, the last id given */
+
+#ifdef HAVE_SHM_OPEN
+static void shm_name(char *buf, size_t n, pid_t master, unsigned int id)
+{
+    snprintf(buf, n, "/R-mc-%d-%u", (int) master, id);
+}
+
+/* in master, remove the segment of a child, if any is left */
+static void unlink_child_shm(child_info_t *ci)
+{
+    char name[60];
+    shm_name(name, sizeof(name), getpid(), ci->shmid);
+    shm_unlink(name);
+}
+
+static void unlink_children_shm(void)
+{
+    child_info_t *ci;
+    for (ci = children; ci; ci = ci->next) unlink_child_shm(ci);
+}
+#else
+# define unlink_child_shm(ci)
+#endif
+
+/* read or write all of len bytes, restarting after signals */
+static int read_all(int fd, void *buf, size_t len)
+{
+    size_t i = 0;
+    while (i < len) {
+	ssize_t n = read(fd, (char *) buf + i, len - i);
+	if (n < 0 && errno == EINTR) continue;
+	if (n < 1) return 0;
+	i += n;
+    }
+    return 1;
+}
+
+static int write_all(int fd, const void *buf, size_t len)
+{
+    size_t i = 0;
+    while (i < len) {
+	ssize_t n = write(fd, (const char *) buf + i, len - i);
+	if (n < 0 && errno == EINTR) continue;
+	if (n < 1) return 0;
+	i += n;
+    }
+    return 1;
+}
+
 static int rm_child_(int pid) 
 {
     child_info_t *ci = children, *prev = 0;
@@ -85,6 +160,7 @@ static int rm_child_(int pid)
 	    /* make sure we close all descriptors */
 	    if (ci->pfd > 0) { close(ci->pfd); ci->pfd = -1; }
 	    if (ci->sifd > 0) { close(ci->sifd); ci->sifd = -1; }
+	    unlink_child_shm(ci);
 	    /* now remove it from the list */
 	    if (prev) prev->next = ci->next;
 	    else children = ci->next;
@@ -121,6 +197,7 @@ static void rm_closed() {
 	if (ci->pfd == -1) {
 	    child_info_t *next = ci->next;
 	    if (ci->sifd > 0) { close(ci->sifd); ci->sifd = -1; }
+	    unlink_child_shm(ci);
 	    if (prev) prev->next = ci->next;
             else children = ci->next;
 	    if (ci->pid)
@@ -238,7 +315,7 @@ static void parent_sig_handler(int sig) {
 }
 #endif
 
-SEXP mc_fork(SEXP sEstranged)
+SEXP mc_fork(SEXP sEstranged, SEXP sPool)
 {
     int pipefd[2]; /* write end, read end */
     int sipfd[2];
@@ -261,6 +338,15 @@ SEXP mc_fork(SEXP sEstranged)
 
     /* make sure we get SIGCHLD to clean up the child process */
     setup_sig_handler();
+#ifdef HAVE_SHM_OPEN
+    static int shm_atexit = 0;
+    if (!estranged && !shm_atexit) {
+	atexit(unlink_children_shm);
+	shm_atexit = 1;
+    }
+#endif
+    unsigned int shmid = ++mc_shmid_last;
+    pid_t master = getpid();
 
     fflush(stdout); // or children may output pending text
     pid = fork();
@@ -282,6 +368,8 @@ SEXP mc_fork(SEXP sEstranged)
 	    close(pipefd[0]); /* close read end */
 	    master_fd = res_i[1] = pipefd[1];
 	    res_i[2] = NA_INTEGER;
+	    mc_master_pid = master;
+	    mc_shmid = shmid;
 	    /* re-map stdin */
 	    dup2(sipfd[0], STDIN_FILENO);
 	    close(sipfd[0]);
@@ -320,6 +408,8 @@ SEXP mc_fork(SEXP sEstranged)
 	ci->pid = pid;
 	ci->pfd = pipefd[0];
 	ci->sifd= sipfd[1];
+	ci->pool = (asLogical(sPool) == 1);
+	ci->shmid = shmid;
 	ci->next = children;
 	children = ci;
     }
@@ -377,6 +467,44 @@ SEXP mc_send_master(SEXP what)
     b = RAW(what);
 #ifdef MC_DEBUG
     Dprintf("child %d: send_master (%d bytes)\n", getpid(), len);
+#endif
+#ifdef HAVE_SHM_OPEN
+    if (len >= MC_SHM_MIN) {
+	unsigned int mark = MC_SHM_MARK;
+	shm_rec_t rec;
+	void *p = MAP_FAILED;
+	int fd;
+
+	memset(&rec, 0, sizeof(rec));
+	rec.len = len;
+	shm_name(rec.name, sizeof(rec.name), mc_master_pid, mc_shmid);
+	/* fails while the master has not opened the last one */
+	fd = shm_open(rec.name, O_RDWR | O_CREAT | O_EXCL, 0600);
+	if (fd != -1) {
+	    /* On tmpfs ftruncate() succeeds without reserving the pages,
+	       and the copy would then die of SIGBUS when they run out. */
+#ifdef HAVE_POSIX_FALLOCATE
+	    if (posix_fallocate(fd, 0, (off_t) len) == 0)
+#else
+	    if (ftruncate(fd, (off_t) len) == 0)
+#endif
+		p = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	    close(fd);
+	    if (p != MAP_FAILED) {
+		memcpy(p, b, len);
+		munmap(p, len);
+		if (write_all(master_fd, &mark, sizeof(mark)) &&
+		    write_all(master_fd, &rec, sizeof(rec)))
+		    return ScalarLogical(1);
+		shm_unlink(rec.name);
+		close(master_fd);
+		master_fd = -1;
+		error(_("write error, closing pipe to the master"));
+	    }
+	    shm_unlink(rec.name);
+	}
+	/* otherwise fall back to the pipe */
+    }
 #endif
     if (write(master_fd, &len, sizeof(len)) != sizeof(len)) {
 	close(master_fd);
@@ -420,6 +548,43 @@ SEXP mc_send_child_stdin(SEXP sPid, SEXP what)
     return ScalarLogical(1);
 }
 
+/* Jobs for a pool worker are sent on its stdin pipe, each preceded by
+   its length, and read by the worker with mc_read_job(). */
+SEXP mc_send_child_job(SEXP sPid, SEXP what)
+{
+    unsigned int len;
+    int pid = asInteger(sPid);
+    child_info_t *ci = children;
+    if (!is_master) 
+	error(_("only the master process can send data to a child process"));
+    if (TYPEOF(what) != RAWSXP) error("what must be a raw vector");
+    while (ci) {
+	if (ci->pid == pid) break;
+	ci = ci -> next;
+    }
+    if (!ci || ci->sifd <= 0) error(_("child %d does not exist"), pid);
+    len = LENGTH(what);
+    if (!write_all(ci->sifd, &len, sizeof(len)) ||
+	!write_all(ci->sifd, RAW(what), len))
+	error(_("write error"));
+    return ScalarLogical(1);
+}
+
+/* NULL once the master has closed the pipe */
+SEXP mc_read_job()
+{
+    unsigned int len;
+    SEXP rv;
+    if (is_master)
+	error(_("only children can read jobs from the master process"));
+    if (!read_all(STDIN_FILENO, &len, sizeof(len)))
+	return R_NilValue;
+    rv = allocVector(RAWSXP, len);
+    if (!read_all(STDIN_FILENO, RAW(rv), len))
+	return R_NilValue;
+    return rv;
+}
+
 SEXP mc_select_children(SEXP sTimeout, SEXP sWhich) 
 {
     int maxfd = 0, sr, zombies = 0;
@@ -446,8 +611,8 @@ SEXP mc_select_children(SEXP sTimeout, SEXP sWhich)
     FD_ZERO(&fs);
     while (ci && ci->pid) {
 	if (ci->pfd == -1) zombies++;
-	if (ci->pfd > maxfd) maxfd = ci->pfd;
-	if (ci->pfd > 0) {
+	if (ci->pfd > maxfd && (which || !ci->pool)) maxfd = ci->pfd;
+	if (ci->pfd > 0 && (which || !ci->pool)) {
 	    if (which) { /* check for the FD only if it's on the list */
 		unsigned int k = 0;
 		while (k < wlen) 
@@ -527,6 +692,39 @@ static SEXP read_child_ci(child_info_t *ci)
 	ci->pfd = -1;
 	rm_child_(pid);
 	return ScalarInteger(pid);
+    } else if (len == MC_SHM_MARK) { /* result is in shared memory */
+	SEXP rv = R_NilValue;
+#ifdef HAVE_SHM_OPEN
+	shm_rec_t rec;
+	void *p = MAP_FAILED;
+	int sfd = -1;
+	if (read_all(fd, &rec, sizeof(rec))) {
+	    rec.name[sizeof(rec.name) - 1] = '\0';
+	    sfd = shm_open(rec.name, O_RDONLY, 0);
+	    shm_unlink(rec.name);
+	}
+	if (sfd != -1) {
+	    p = mmap(NULL, rec.len, PROT_READ, MAP_SHARED, sfd, 0);
+	    close(sfd);
+	}
+	if (p != MAP_FAILED) {
+	    rv = allocVector(RAWSXP, rec.len);
+	    memcpy(RAW(rv), p, rec.len);
+	    munmap(p, rec.len);
+	}
+#endif
+	if (rv == R_NilValue) {
+	    int pid = ci->pid;
+	    close(fd);
+	    ci->pfd = -1;
+	    rm_child_(pid);
+	    error(_("unable to read the result of child %d from shared memory"),
+		  pid);
+	}
+	PROTECT(rv);
+	setAttrib(rv, install("pid"), ScalarInteger(ci->pid));
+	UNPROTECT(1);
+	return rv;
     } else {
 	SEXP rv = allocVector(RAWSXP, len);
 	unsigned char *rvb = RAW(rv);
@@ -593,8 +791,10 @@ SEXP mc_read_children(SEXP sTimeout)
     }
     FD_ZERO(&fs);
     while (ci && ci->pid) {
-	if (ci->pfd > maxfd) maxfd = ci->pfd;
-	if (ci->pfd > 0) FD_SET(ci->pfd, &fs);
+	if (ci->pfd > 0 && !ci->pool) {
+	    if (ci->pfd > maxfd) maxfd = ci->pfd;
+	    FD_SET(ci->pfd, &fs);
+	}
 	ci = ci -> next;
     }
 #ifdef MC_DEBUG
@@ -630,13 +830,14 @@ SEXP mc_rm_child(SEXP sPid)
     return ScalarLogical(rm_child_(pid));
 }
 
-SEXP mc_children() 
+/* the children, either those forked for jobs or the pool workers */
+static SEXP children_(int pool)
 {
     rm_closed();
     child_info_t *ci = children;
     unsigned int count = 0;
     while (ci && ci->pid > 0) {
-	count++;
+	if (ci->pool == pool) count++;
 	ci = ci->next;
     }
     SEXP res = allocVector(INTSXP, count);
@@ -644,7 +845,7 @@ SEXP mc_children()
 	int *pids = INTEGER(res);
 	ci = children;
 	while (ci && ci->pid > 0) {
-	    (pids++)[0] = ci->pid;
+	    if (ci->pool == pool) (pids++)[0] = ci->pid;
 	    ci = ci->next;
 	}
 	/* in theory signals can flag a pid as closed in the
@@ -656,6 +857,16 @@ SEXP mc_children()
     return res;
 }
 
+SEXP mc_children() 
+{
+    return children_(0);
+}
+
+SEXP mc_pool_children()
+{
+    return children_(1);
+}
+
 SEXP mc_fds(SEXP sFdi) 
 {
     int fdi = asInteger(sFdi);
@@ -663,7 +874,7 @@ SEXP mc_fds(SEXP sFdi)
     SEXP res;
     child_info_t *ci = children;
     while (ci && ci->pid > 0) {
-	count++;
+	if (!ci->pool) count++;
 	ci = ci->next;
     }
     res = allocVector(INTSXP, count);
@@ -671,7 +882,7 @@ SEXP mc_fds(SEXP sFdi)
 	int *fds = INTEGER(res);
 	ci = children;
 	while (ci && ci->pid > 0) {
-	    (fds++)[0] = (fdi == 0) ? ci->pfd : ci->sifd;
+	    if (!ci->pool) (fds++)[0] = (fdi == 0) ? ci->pfd : ci->sifd;
 	    ci = ci->next;
 	}
     }
@@ -718,8 +929,16 @@ SEXP NORET mc_exit(SEXP sRes)
 #ifdef MC_DEBUG
 	Dprintf("child %d is waiting for permission to exit\n", getpid());
 #endif
-	while (!child_can_exit) sleep(1);
+	/* or until the master has gone */
+	while (!child_can_exit && getppid() == mc_master_pid) sleep(1);
     }
+#ifdef HAVE_SHM_OPEN
+    if (mc_master_pid) { /* the master may not have read the last result */
+	char name[60];
+	shm_name(name, sizeof(name), mc_master_pid, mc_shmid);
+	shm_unlink(name);
+    }
+#endif
 		
 #ifdef MC_DEBUG
     Dprintf("child %d: exiting\n", getpid());
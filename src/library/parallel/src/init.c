@@ -24,6 +24,7 @@
 static const R_CallMethodDef callMethods[] = {
     {"nextStream", (DL_FUNC) &nextStream, 1},
     {"nextSubStream", (DL_FUNC) &nextSubStream, 1},
+    {"nextStreams", (DL_FUNC) &nextStreams, 3},
 #ifndef _WIN32
     {"mc_children", (DL_FUNC) &mc_children, 0},
     {"mc_close_fds", (DL_FUNC) &mc_close_fds, 1},
@@ -31,16 +32,19 @@ static const R_CallMethodDef callMethods[] = {
     {"mc_close_stdout", (DL_FUNC) &mc_close_stdout, 1},
     {"mc_exit", (DL_FUNC) &mc_exit, 1},
     {"mc_fds", (DL_FUNC) &mc_fds, 1},
-    {"mc_fork", (DL_FUNC) &mc_fork, 1},
+    {"mc_fork", (DL_FUNC) &mc_fork, 2},
     {"mc_is_child", (DL_FUNC) &mc_is_child, 0},
     {"mc_kill", (DL_FUNC) &mc_kill, 2},
     {"mc_master_fd", (DL_FUNC) &mc_master_fd, 0},
+    {"mc_pool_children", (DL_FUNC) &mc_pool_children, 0},
+    {"mc_read_job", (DL_FUNC) &mc_read_job, 0},
     {"mc_read_child", (DL_FUNC) &mc_read_child, 1},
     {"mc_read_children", (DL_FUNC) &mc_read_children, 1},
     {"mc_rm_child", (DL_FUNC) &mc_rm_child, 1},
     {"mc_send_master", (DL_FUNC) &mc_send_master, 1},
     {"mc_select_children", (DL_FUNC) &mc_select_children, 2},
     {"mc_send_child_stdin", (DL_FUNC) &mc_send_child_stdin, 2},
+    {"mc_send_child_job", (DL_FUNC) &mc_send_child_job, 2},
     {"mc_affinity", (DL_FUNC) &mc_affinity, 1},
     {"mc_interactive", (DL_FUNC) &mc_interactive, 1},
 #else
@@ -57,4 +61,6 @@ R_init_parallel(DllInfo *dll)
 {
     R_registerRoutines(dll, NULL, callMethods, NULL, NULL);
     R_useDynamicSymbols(dll, FALSE);
+    R_RegisterCCallable("parallel", "RngStream_advance",
+			(DL_FUNC) &RngStream_advance);
 }
@@ -21,6 +21,7 @@
 #define R_PARALLEL_H
 
 #include <Rinternals.h>
+#include <stdint.h>
 #ifdef ENABLE_NLS
 #include <libintl.h>
 #define _(String) dgettext ("parallel", String)
@@ -30,6 +31,8 @@
 
 SEXP nextStream(SEXP);
 SEXP nextSubStream(SEXP);
+SEXP nextStreams(SEXP, SEXP, SEXP);
+void RngStream_advance(unsigned int *, uint_least64_t, uint_least64_t);
 
 #ifndef _WIN32
 SEXP mc_children(void);
@@ -39,16 +42,19 @@ SEXP mc_close_stdout(SEXP);
 SEXP mc_create_list(SEXP);
 SEXP mc_exit(SEXP);
 SEXP mc_fds(SEXP);
-SEXP mc_fork(SEXP);
+SEXP mc_fork(SEXP, SEXP);
 SEXP mc_is_child(void);
 SEXP mc_kill(SEXP, SEXP);
 SEXP mc_master_fd(void);
+SEXP mc_pool_children(void);
+SEXP mc_read_job(void);
 SEXP mc_read_child(SEXP);
 SEXP mc_read_children(SEXP);
 SEXP mc_rm_child(SEXP);
 SEXP mc_send_master(SEXP);
 SEXP mc_select_children(SEXP, SEXP);
 SEXP mc_send_child_stdin(SEXP, SEXP);
+SEXP mc_send_child_job(SEXP, SEXP);
 SEXP mc_affinity(SEXP);
 SEXP mc_interactive(SEXP);
 #else
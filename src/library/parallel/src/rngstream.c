@@ -18,7 +18,6 @@
  */
 
 #include "parallel.h"
-#include <stdint.h>
 
 typedef uint_least64_t Uint64;
 
@@ -46,54 +45,111 @@ static Uint64 A2p127[3][3] = {
           {    2824425944,   32183930, 2093834863 }
           };
 
-SEXP nextStream(SEXP x)
+#define m1 4294967087
+#define m2 4294944443
+
+/* s <- A s mod m.  All entries are less than 2^32, so the partial
+   sums cannot overflow */
+static void matvecmod(Uint64 A[3][3], Uint64 *s, Uint64 m)
 {
-    Uint64 seed[6], nseed[6], tmp;
-    for (int i = 0; i < 6; i++) seed[i] = (unsigned int)INTEGER(x)[i+1];
+    Uint64 x[3], tmp;
     for (int i = 0; i < 3; i++) {
 	tmp = 0;
 	for(int j = 0; j < 3; j++) {
-	    tmp += A1p127[i][j] * seed[j];
-	    tmp %= 4294967087;
+	    tmp += A[i][j] * s[j];
+	    tmp %= m;
 	}
-	nseed[i] = tmp;
+	x[i] = tmp;
     }
-    for (int i = 0; i < 3; i++) {
-	tmp = 0;
-	for(int j = 0; j < 3; j++) {
-	    tmp += A2p127[i][j] * seed[j+3];
-	    tmp %= 4294944443;
+    for (int i = 0; i < 3; i++) s[i] = x[i];
+}
+
+/* C <- A B mod m: C may be A or B */
+static void matmatmod(Uint64 A[3][3], Uint64 B[3][3], Uint64 C[3][3],
+		      Uint64 m)
+{
+    Uint64 x[3][3], tmp;
+    for (int i = 0; i < 3; i++)
+	for (int k = 0; k < 3; k++) {
+	    tmp = 0;
+	    for(int j = 0; j < 3; j++) {
+		tmp += A[i][j] * B[j][k];
+		tmp %= m;
+	    }
+	    x[i][k] = tmp;
 	}
-	nseed[i+3] = tmp;
+    for (int i = 0; i < 3; i++)
+	for (int k = 0; k < 3; k++) C[i][k] = x[i][k];
+}
+
+/* B <- A^n mod m */
+static void matpowmod(Uint64 A[3][3], Uint64 n, Uint64 B[3][3], Uint64 m)
+{
+    Uint64 W[3][3];
+    for (int i = 0; i < 3; i++)
+	for (int k = 0; k < 3; k++) {
+	    W[i][k] = A[i][k];
+	    B[i][k] = (i == k);
+	}
+    while (n) {
+	if (n & 1) matmatmod(W, B, B, m);
+	n >>= 1;
+	if (n) matmatmod(W, W, W, m);
+    }
+}
+
+/* Advance the six values of an L'Ecuyer-CMRG seed (as unsigned, that
+   is .Random.seed[-1]) by 'streams' streams and then 'substreams'
+   substreams, at a cost logarithmic in the counts.  Registered as C
+   callable "RngStream_advance" for use by packages, e.g. to give each
+   thread of a parallel kernel its own stream. */
+void RngStream_advance(unsigned int *seed, Uint64 streams, Uint64 substreams)
+{
+    Uint64 s[6], A[3][3];
+    for (int i = 0; i < 6; i++) s[i] = seed[i];
+    if (streams) {
+	matpowmod(A1p127, streams, A, m1); matvecmod(A, s, m1);
+	matpowmod(A2p127, streams, A, m2); matvecmod(A, s + 3, m2);
+    }
+    if (substreams) {
+	matpowmod(A1p76, substreams, A, m1); matvecmod(A, s, m1);
+	matpowmod(A2p76, substreams, A, m2); matvecmod(A, s + 3, m2);
     }
+    for (int i = 0; i < 6; i++) seed[i] = (unsigned int) s[i];
+}
+
+static SEXP advance(SEXP x, Uint64 A1[3][3], Uint64 A2[3][3])
+{
+    Uint64 seed[6];
+    for (int i = 0; i < 6; i++) seed[i] = (unsigned int)INTEGER(x)[i+1];
+    matvecmod(A1, seed, m1);
+    matvecmod(A2, seed + 3, m2);
     SEXP ans = allocVector(INTSXP, 7);
     INTEGER(ans)[0] = INTEGER(x)[0];
-    for (int i = 0;  i < 6; i++) INTEGER(ans)[i+1] = (int) nseed[i];
+    for (int i = 0;  i < 6; i++) INTEGER(ans)[i+1] = (int) seed[i];
     return ans;
 }
 
+SEXP nextStream(SEXP x)
+{
+    return advance(x, A1p127, A2p127);
+}
+
 SEXP nextSubStream(SEXP x)
 {
-    Uint64 seed[6], nseed[6], tmp;
-    for (int i = 0; i < 6; i++) seed[i] = (unsigned int)INTEGER(x)[i+1];
-    for (int i = 0; i < 3; i++) {
-	tmp = 0;
-	for(int j = 0; j < 3; j++) {
-	    tmp += A1p76[i][j] * seed[j];
-	    tmp %= 4294967087;
-	}
-	nseed[i] = tmp;
-    }
-    for (int i = 0; i < 3; i++) {
-	tmp = 0;
-	for(int j = 0; j < 3; j++) {
-	    tmp += A2p76[i][j] * seed[j+3];
-	    tmp %= 4294944443;
-	}
-	nseed[i+3] = tmp;
+    return advance(x, A1p76, A2p76);
+}
+
+/* The seeds of the n streams (or substreams) following x, as a list */
+SEXP nextStreams(SEXP x, SEXP sn, SEXP ssub)
+{
+    int n = asInteger(sn), sub = asLogical(ssub);
+    if (n == NA_INTEGER || n < 0) error(_("invalid '%s' argument"), "n");
+    SEXP ans = PROTECT(allocVector(VECSXP, n));
+    for (int k = 0; k < n; k++) {
+	x = sub ? nextSubStream(x) : nextStream(x);
+	SET_VECTOR_ELT(ans, k, x);
     }
-    SEXP ans = allocVector(INTSXP, 7);
-    INTEGER(ans)[0] = INTEGER(x)[0];
-    for (int i = 0;  i < 6; i++) INTEGER(ans)[i+1] = (int) nseed[i];
+    UNPROTECT(1);
     return ans;
 }
@@ -1,6 +1,6 @@
 /*  R : A Computer Language for Statistical Data Analysis
  *
- *  Copyright (C) 2003-7  The R Core Team
+ *  Copyright (C) 2003-2017  The R Core Team
  *
  *  This program is free software; you can redistribute it and/or modify
  *  it under the terms of the GNU General Public License as published by
@@ -21,9 +21,14 @@
 
 #include <stdlib.h>
 #include <string.h>  // memcpy
+#include <float.h>   // DBL_EPSILON
 
 #include <R.h>
 #include "ts.h"
+#ifdef _OPENMP
+# include <omp.h>
+# include <R_ext/MathThreads.h>
+#endif
 
 void HoltWinters (double *x,
 		  int    *xl,
@@ -97,3 +102,283 @@ void HoltWinters (double *x,
 	}
     }
 }
+
+
+/* Fitting Holt-Winters models to each of many series, for
+   HoltWintersBatch().
+
+   The start values and the optimization of the smoothing parameters
+   follow HoltWinters(), except that two or three parameters are
+   found by BFGS (vmmin_work) on u with parameters sin(u)^2 rather
+   than by L-BFGS-B, which is not thread-safe.
+*/
+
+typedef struct {
+    const double *x;
+    int xl, start_time, seasonal, period, dotrend, doseasonal;
+    double par[3], l0, b0, *s0, *level, *trend, *season;
+    int ind[3], npar; /* the free parameters, in par */
+} hw_info;
+
+static double hw_sse(hw_info *hw)
+{
+    double SSE = 0.0, p[3];
+
+    for (int i = 0; i < 3; i++)
+	p[i] = (hw->par[i] < 0) ? 0 : ((hw->par[i] > 1) ? 1 : hw->par[i]);
+    HoltWinters((double *) hw->x, &hw->xl, p, p + 1, p + 2, &hw->start_time,
+		&hw->seasonal, &hw->period, &hw->dotrend, &hw->doseasonal,
+		&hw->l0, &hw->b0, hw->s0, &SSE, hw->level, hw->trend,
+		hw->season);
+    return SSE;
+}
+
+static double hw_fn1(double p, void *ex)
+{
+    hw_info *hw = (hw_info *) ex;
+    hw->par[hw->ind[0]] = p;
+    return hw_sse(hw);
+}
+
+/* with the parameters sin(u)^2, to keep them in [0, 1] */
+static double hw_fn(int n, double *u, void *ex)
+{
+    hw_info *hw = (hw_info *) ex;
+    for (int i = 0; i < n; i++) {
+	double si = sin(u[i]);
+	hw->par[hw->ind[i]] = si * si;
+    }
+    return hw_sse(hw);
+}
+
+/* by central differences, as optim() without a gradient function */
+static void hw_gr(int n, double *u, double *df, void *ex)
+{
+    const double eps = 1e-3;
+
+    for (int i = 0; i < n; i++) {
+	double ui = u[i], val1, val2;
+	u[i] = ui + eps;
+	val1 = hw_fn(n, u, ex);
+	u[i] = ui - eps;
+	val2 = hw_fn(n, u, ex);
+	df[i] = (val1 - val2) / (2 * eps);
+	u[i] = ui;
+    }
+}
+
+/* Seasonal start values, from decompose() of the first start_periods
+   periods of x: s0 is the seasonal figure, and l0 and b0 the intercept
+   and slope of the regression of the trend on 1, 2, ... */
+static void
+hw_start(const double *x, int f, int start_periods, int additive,
+	 double *l0, double *b0, double *s0, double *w)
+{
+    int wind = start_periods * f, nf = (f % 2) ? f : f + 1, o = nf / 2,
+	nt = 0, *cnt = (int *) (w + wind);
+    double sx = 0.0, sy = 0.0, sxx = 0.0, sxy = 0.0, mean = 0.0;
+
+    /* the centred moving average */
+    for (int i = 0; i < wind; i++) {
+	if (i + o - (nf - 1) < 0 || i + o >= wind) {
+	    w[i] = NA_REAL;
+	    continue;
+	}
+	double z = 0.0;
+	for (int j = 0; j < nf; j++) {
+	    double fj = ((f % 2 == 0) && (j == 0 || j == nf - 1)) ? 0.5 : 1.0;
+	    z += fj * x[i + o - j];
+	}
+	w[i] = z / f;
+	nt++;
+	sx += nt;
+	sy += w[i];
+	sxx += (double) nt * nt;
+	sxy += nt * w[i];
+    }
+    *b0 = (sxy - sx * sy / nt) / (sxx - sx * sx / nt);
+    *l0 = (sy - *b0 * sx) / nt;
+
+    /* the seasonal figure */
+    for (int i = 0; i < f; i++) {
+	s0[i] = 0.0;
+	cnt[i] = 0;
+    }
+    for (int i = 0; i < wind; i++)
+	if (!ISNAN(w[i])) {
+	    s0[i % f] += additive ? x[i] - w[i] : x[i] / w[i];
+	    cnt[i % f]++;
+	}
+    for (int i = 0; i < f; i++) mean += (s0[i] /= cnt[i]);
+    mean /= f;
+    for (int i = 0; i < f; i++)
+	s0[i] = additive ? s0[i] - mean : s0[i] / mean;
+}
+
+static size_t hw_lwork(int n, int f)
+{
+    return 3 * (size_t) n + 5 * (size_t) f + vmmin_lwork(3) + 6;
+}
+
+/* Fit the model to x[0:(xl-1)] and fill in out[ldout * (0:(ncol-1))] */
+static void
+hw_batch1(const double *x, int xl, int f, const double *par, int dotrend,
+	  int doseasonal, int additive, int start_periods,
+	  const double *optim_start, int nahead, double *out, int ldout,
+	  double *work)
+{
+    int nf = doseasonal ? f : 0,
+	ncol = 6 + dotrend + nf + nahead, fail = 0, fncount, grcount;
+    hw_info hw;
+
+    for (int i = 0; i < ncol; i++) out[(size_t) ldout * i] = NA_REAL;
+    for (int l = 0; l < xl; l++)
+	if (ISNAN(x[l]) || (doseasonal && !additive && x[l] == 0)) return;
+
+    hw.x = x;
+    hw.xl = xl;
+    hw.seasonal = additive;
+    hw.period = f;
+    hw.dotrend = dotrend;
+    hw.doseasonal = doseasonal;
+    hw.s0 = work;
+    if (doseasonal) {
+	if (start_periods < 2 || xl < start_periods * f || xl <= f) return;
+	hw.start_time = f + 1;
+	hw_start(x, f, start_periods, additive, &hw.l0, &hw.b0, hw.s0,
+		 work + nf);
+    } else {
+	if (xl < 3) return;
+	hw.start_time = 3 - !dotrend;
+	hw.l0 = dotrend ? x[1] : x[0];
+	hw.b0 = x[1] - x[0];
+	hw.s0[0] = 0.0;
+    }
+    int len = xl - hw.start_time + 1;
+    hw.level = work + f + 1;
+    hw.trend = hw.level + len + 1;
+    hw.season = hw.trend + len + 1;
+    if (!dotrend) /* but used in the level */
+	for (int i = 0; i <= len; i++) hw.trend[i] = 0.0;
+
+    /* the free parameters: alpha, beta, gamma */
+    hw.npar = 0;
+    for (int i = 0; i < 3; i++) {
+	hw.par[i] = par[i];
+	if (ISNAN(par[i]) && (i == 0 || (i == 1 && dotrend) ||
+			      (i == 2 && doseasonal))) {
+	    hw.ind[hw.npar++] = i;
+	    hw.par[i] = optim_start[i];
+	}
+	if (ISNAN(hw.par[i])) hw.par[i] = 0.0;
+    }
+    if (hw.npar == 1)
+	Brent_fmin(0.0, 1.0, hw_fn1, &hw, pow(DBL_EPSILON, 0.25));
+    else if (hw.npar > 1) {
+	double u[3], Fmin;
+	for (int i = 0; i < hw.npar; i++) {
+	    double pi = hw.par[hw.ind[i]];
+	    u[i] = asin(sqrt((pi < 0) ? 0 : ((pi > 1) ? 1 : pi)));
+	}
+	vmmin_work(hw.npar, u, &Fmin, hw_fn, hw_gr, 100, R_NegInf,
+		   sqrt(DBL_EPSILON), &hw, &fncount, &grcount, &fail,
+		   hw.season + len + f);
+	if (fail == 2) return;
+	for (int i = 0; i < hw.npar; i++) {
+	    double si = sin(u[i]);
+	    hw.par[hw.ind[i]] = si * si;
+	}
+    }
+    for (int i = 0; i < 3; i++)
+	hw.par[i] = (hw.par[i] < 0) ? 0 : ((hw.par[i] > 1) ? 1 : hw.par[i]);
+
+    /* the final fit, and the forecasts */
+    double SSE = hw_sse(&hw), a = hw.level[len],
+	b = dotrend ? hw.trend[len] : 0, *s = hw.season + len;
+    int k;
+    out[0] = hw.par[0];
+    out[(size_t) ldout] = dotrend ? hw.par[1] : 0.0;
+    out[(size_t) ldout * 2] = doseasonal ? hw.par[2] : 0.0;
+    out[(size_t) ldout * 3] = SSE;
+    out[(size_t) ldout * 4] = fail;
+    out[(size_t) ldout * 5] = a;
+    if (dotrend) out[(size_t) ldout * 6] = b;
+    k = 6 + dotrend;
+    for (int i = 0; i < nf; i++) out[(size_t) ldout * k++] = s[i];
+    for (int h = 1; h <= nahead; h++) {
+	double fc = a + h * b;
+	if (doseasonal) {
+	    if (additive) fc += s[(h - 1) % f];
+	    else fc *= s[(h - 1) % f];
+	}
+	out[(size_t) ldout * k++] = fc;
+    }
+}
+
+static R_INLINE int thread_num(void)
+{
+#ifdef _OPENMP
+    return omp_get_thread_num();
+#else
+    return 0;
+#endif
+}
+
+/* .Call(C_HoltWinters_batch, x, lengths, frequency, c(alpha, beta, gamma),
+         dotrend, doseasonal, additive, start.periods, optim.start, n.ahead)
+
+   Fits to the first lengths[j] values of each column j of the matrix x,
+   with NA in par for the parameters to be estimated.  The result has a
+   row per series with columns alpha, beta, gamma, SSE, the convergence
+   code, the final level, trend (if dotrend) and seasonal components
+   (if doseasonal) and n.ahead forecasts: all are NA if the model could
+   not be fitted.
+*/
+SEXP
+HoltWinters_batch(SEXP sx, SEXP slen, SEXP sf, SEXP spar, SEXP sdotrend,
+		  SEXP sdoseasonal, SEXP sadditive, SEXP sstart,
+		  SEXP soptim_start, SEXP snahead)
+{
+    int n = nrows(sx), m = ncols(sx), *len = INTEGER(slen), f = asInteger(sf),
+	dotrend = asLogical(sdotrend) == 1,
+	doseasonal = asLogical(sdoseasonal) == 1,
+	additive = asLogical(sadditive) == 1,
+	start_periods = asInteger(sstart), nahead = asInteger(snahead),
+	nthreads = 1;
+    double *x = REAL(sx), *par = REAL(spar), *optim_start = REAL(soptim_start),
+	*ans, *work;
+
+    if (TYPEOF(sx) != REALSXP || TYPEOF(slen) != INTSXP ||
+	LENGTH(slen) != m || TYPEOF(spar) != REALSXP || LENGTH(spar) != 3 ||
+	TYPEOF(soptim_start) != REALSXP || LENGTH(soptim_start) != 3)
+	error(_("invalid argument type"));
+    for (int j = 0; j < m; j++)
+	if (len[j] < 0 || len[j] > n)
+	    error(_("invalid '%s' argument"), "lengths");
+    if (f == NA_INTEGER || f < 1 || (doseasonal && f < 2))
+	error(_("invalid '%s' argument"), "frequency");
+    if (nahead == NA_INTEGER || nahead < 0)
+	error(_("invalid '%s' argument"), "n.ahead");
+
+    SEXP res = PROTECT(allocMatrix(REALSXP, m, 6 + dotrend +
+				   (doseasonal ? f : 0) + nahead));
+    ans = REAL(res);
+#ifdef _OPENMP
+    if (R_num_math_threads > 1 && m > 1)
+	nthreads = (R_num_math_threads < m) ? R_num_math_threads : m;
+#endif
+    size_t lwork = hw_lwork(n, f);
+    work = (double *) R_alloc(nthreads * lwork, sizeof(double));
+#ifdef _OPENMP
+# pragma omp parallel for num_threads(nthreads) schedule(dynamic) \
+    default(none) firstprivate(x, n, m, len, f, par, dotrend, doseasonal, \
+			       additive, start_periods, optim_start, nahead, \
+			       ans, work, lwork)
+#endif
+    for (int j = 0; j < m; j++)
+	hw_batch1(x + (size_t) n * j, len[j], f, par, dotrend, doseasonal,
+		  additive, start_periods, optim_start, nahead, ans + j, m,
+		  work + lwork * thread_num());
+    UNPROTECT(1);
+    return res;
+}
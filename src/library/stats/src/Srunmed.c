@@ -2,7 +2,7 @@
  *  R : A Computer Language for Statistical Data Analysis
  *  Copyright (C) 1995--2002 Martin Maechler <maechler@stat.math.ethz.ch>
  *  Copyright (C) 2003       The R Foundation
- *  Copyright (C) 2012-2016  The R Core Team
+ *  Copyright (C) 2012-2017  The R Core Team
  *
  *  This program is free software; you can redistribute it and/or modify
  *  it under the terms of the GNU General Public License as published by
@@ -20,11 +20,15 @@
  */
 
 #include "modreg.h"
+#ifdef _OPENMP
+# include <omp.h>
+# include <R_ext/MathThreads.h>
+#endif
 
 #include "Trunmed.c"
 
-static void Srunmed(double* y, double* smo, R_xlen_t n, int bw,
-		    int end_rule, int debug)
+static void Srunmed(const double* y, double* smo, R_xlen_t n, int bw,
+		    int end_rule, int debug, double *scrat)
 {
 /*
  *  Computes "Running Median" smoother with medians of 'band'
@@ -35,6 +39,7 @@ static void Srunmed(double* y, double* smo, R_xlen_t n, int bw,
  *	bw	- span of running medians (MUST be ODD !!)
  *	end_rule -- 0: Keep original data at ends {j; j < b2 | j > n-b2}
  *		 -- 1: Constant ends = median(y[1],..,y[bw]) "robust"
+ *	scrat(bw) - workspace
  *  Output:
  *	smo(n)	- smoothed responses
 
@@ -47,12 +52,6 @@ static void Srunmed(double* y, double* smo, R_xlen_t n, int bw,
     int imin, ismo, i, j, first, last, band2, kminus, kplus;
 
 
-    double *scrat = (double *) R_alloc(bw, sizeof(double));
-    /*was  malloc( (unsigned) bw * sizeof(double));*/
-
-    if(bw > n)
-	error(_("bandwidth/span of running medians is larger than n"));
-
 /* 1. Compute  'rmed' := Median of the first 'band' values
    ======================================================== */
 
@@ -192,23 +191,238 @@ static void Srunmed(double* y, double* smo, R_xlen_t n, int bw,
     }
 } /* Srunmed */
 
-SEXP runmed(SEXP x, SEXP stype, SEXP sk, SEXP end, SEXP print_level)
+/* Running quantiles, of any order, by a double heap: the values of the
+ * window are kept in a max-heap 'lo' of the r smallest and a min-heap
+ * 'hi' of the others, with the position of each window slot in its
+ * heap so that the value leaving the window can be deleted.  Then the
+ * r-th and (r+1)-th smallest are the tops of the heaps, and each step
+ * is O(log k).  Slot j % k holds x[j].  Values are compared as keys
+ * with NaN replaced by +Inf, and windows containing a NaN give NA.
+ */
+
+typedef struct {
+    int *lo, *hi, *pos, nlo, nhi, nnan;
+    double *key;
+} rq_heap;
+
+static R_INLINE void rq_set(rq_heap *h, int lo, int i, int s)
+{
+    if (lo) { h->lo[i] = s; h->pos[s] = i + 1; }
+    else { h->hi[i] = s; h->pos[s] = -(i + 1); }
+}
+
+/* should slot a be above slot b in heap lo? */
+static R_INLINE int rq_above(const rq_heap *h, int lo, int a, int b)
+{
+    return lo ? h->key[a] > h->key[b] : h->key[a] < h->key[b];
+}
+
+static void rq_up(rq_heap *h, int lo, int i)
+{
+    int *heap = lo ? h->lo : h->hi, s = heap[i];
+    while (i > 0) {
+	int p = (i - 1) / 2;
+	if (!rq_above(h, lo, s, heap[p])) break;
+	rq_set(h, lo, i, heap[p]);
+	i = p;
+    }
+    rq_set(h, lo, i, s);
+}
+
+static void rq_down(rq_heap *h, int lo, int i)
+{
+    int *heap = lo ? h->lo : h->hi, n = lo ? h->nlo : h->nhi, s = heap[i];
+    for (;;) {
+	int c = 2 * i + 1;
+	if (c >= n) break;
+	if (c + 1 < n && rq_above(h, lo, heap[c + 1], heap[c])) c++;
+	if (!rq_above(h, lo, heap[c], s)) break;
+	rq_set(h, lo, i, heap[c]);
+	i = c;
+    }
+    rq_set(h, lo, i, s);
+}
+
+static void rq_push(rq_heap *h, int lo, int s)
+{
+    int i = lo ? h->nlo++ : h->nhi++;
+    rq_set(h, lo, i, s);
+    rq_up(h, lo, i);
+}
+
+static void rq_delete(rq_heap *h, int s)
+{
+    int lo = h->pos[s] > 0, i = lo ? h->pos[s] - 1 : -h->pos[s] - 1,
+	*heap = lo ? h->lo : h->hi, n = lo ? --h->nlo : --h->nhi;
+    if (i < n) {
+	int t = heap[n];
+	rq_set(h, lo, i, t);
+	rq_up(h, lo, i);
+	rq_down(h, lo, lo ? h->pos[t] - 1 : -h->pos[t] - 1);
+    }
+}
+
+static void rq_insert(rq_heap *h, int s, double x)
+{
+    if (ISNAN(x)) {
+	h->nnan++;
+	x = R_PosInf;
+    }
+    h->key[s] = x;
+    rq_push(h, h->nlo > 0 && x <= h->key[h->lo[0]], s);
+}
+
+static void rq_remove(rq_heap *h, int s, double x)
+{
+    if (ISNAN(x)) h->nnan--;
+    rq_delete(h, s);
+}
+
+/* the quantile (type 7, as quantile()) of the m values */
+static double rq_quantile(rq_heap *h, int m, double prob)
+{
+    double index = 1 + (m - 1) * prob, lo = floor(index), g = index - lo;
+    int r = (int) lo;
+    while (h->nlo > r) {
+	int s = h->lo[0];
+	rq_delete(h, s);
+	rq_push(h, 0, s);
+    }
+    while (h->nlo < r) {
+	int s = h->hi[0];
+	rq_delete(h, s);
+	rq_push(h, 1, s);
+    }
+    if (h->nnan) return NA_REAL;
+    double q = h->key[h->lo[0]];
+    if (g > 0) q = (1 - g) * q + g * h->key[h->hi[0]];
+    return q;
+}
+
+/* The running quantile of order prob of x[0:(n-1)] in windows of k
+ * values, x[(i-k1):(i+k2)] for k1 = (k-1) %/% 2, k2 = k - 1 - k1.
+ * end_rule:  0: keep x[i] where the window is not complete,
+ *	      1: the value of the first or last complete window,
+ *	      2: the quantile of the values of the truncated window.
+ * iwork(3k), dwork(k)
+ */
+static void runquant(const double *x, R_xlen_t n, int k, double prob,
+		     int end_rule, double *y, int *iwork, double *dwork)
+{
+    rq_heap h = {iwork, iwork + k, iwork + 2 * k, 0, 0, 0, dwork};
+    int k1 = (k - 1) / 2, k2 = k - 1 - k1;
+    R_xlen_t a = 0, b = -1; /* the window is x[a:b] */
+
+    for (R_xlen_t i = 0; i < n; i++) {
+	R_xlen_t a1 = (i < k1) ? 0 : i - k1,
+	    b1 = (i + k2 >= n) ? n - 1 : i + k2;
+	for (; a < a1; a++) rq_remove(&h, (int)(a % k), x[a]);
+	while (b < b1) {
+	    b++;
+	    rq_insert(&h, (int)(b % k), x[b]);
+	}
+	if (end_rule == 2 || b - a + 1 == k)
+	    y[i] = rq_quantile(&h, (int)(b - a + 1), prob);
+    }
+    if (end_rule == 2 || k > n) return;
+    for (R_xlen_t i = 0; i < k1; i++)
+	y[i] = end_rule ? y[k1] : x[i];
+    for (R_xlen_t i = n - k2; i < n; i++)
+	y[i] = end_rule ? y[n - k2 - 1] : x[i];
+}
+
+/* Columns of a matrix are smoothed in parallel for large problems */
+#define RUNMED_THREADS_MIN 1e5
+
+static int runmed_nthreads(R_xlen_t n, int nc, int pl)
+{
+#ifdef _OPENMP
+    if (R_num_math_threads > 1 && nc > 1 && !pl &&
+	(double) n * nc >= RUNMED_THREADS_MIN)
+	return (R_num_math_threads < nc) ? R_num_math_threads : nc;
+#endif
+    return 1;
+}
+
+static R_INLINE int thread_num(void)
+{
+#ifdef _OPENMP
+    return omp_get_thread_num();
+#else
+    return 0;
+#endif
+}
+
+SEXP runmed(SEXP x, SEXP stype, SEXP sk, SEXP end, SEXP print_level,
+	    SEXP snr)
 {
     if (TYPEOF(x) != REALSXP) error("numeric 'x' required");
-    R_xlen_t n = XLENGTH(x);
+    R_xlen_t n = asInteger(snr);
     int type = asInteger(stype), k = asInteger(sk),
-	iend = asInteger(end), pl = asInteger(print_level);
-    SEXP ans = PROTECT(allocVector(REALSXP, n));
+	iend = asInteger(end), pl = asInteger(print_level), nc;
+    if (n == NA_INTEGER || n < 1 || XLENGTH(x) % n)
+	error(_("invalid '%s' argument"), "nrow");
+    nc = (int)(XLENGTH(x) / n);
+    if (k == NA_INTEGER || k < 1 || k > n)
+	error(_("bandwidth/span of running medians is larger than n"));
+    SEXP ans = PROTECT(allocVector(REALSXP, XLENGTH(x)));
+    double *rx = REAL(x), *ra = REAL(ans);
+    int nthreads = runmed_nthreads(n, nc, pl);
     if (type == 1) {
-	if (IS_LONG_VEC(x)) 
-	    error("long vectors are not supported for algorithm = \"Turlach\"");
-	int *i1 = (int *) R_alloc(k + 1, sizeof(int)), 
-	    *i2 = (int *) R_alloc(2*k + 1, sizeof(int));
-	double *d1 = (double *) R_alloc(2*k + 1, sizeof(double));
-	Trunmed(n, k, REAL(x), REAL(ans), i1, i2, d1, iend, pl);
+	int *i1 = (int *) R_alloc(nthreads * (size_t)(3*k + 2), sizeof(int));
+	double *d1 = (double *) R_alloc(nthreads * (size_t)(2*k + 1),
+					sizeof(double));
+#ifdef _OPENMP
+# pragma omp parallel for num_threads(nthreads) schedule(dynamic) \
+    default(none) firstprivate(n, nc, k, rx, ra, i1, d1, iend, pl)
+#endif
+	for (int j = 0; j < nc; j++) {
+	    int *iw = i1 + (size_t)(3*k + 2) * thread_num();
+	    Trunmed(n, k, rx + n * j, ra + n * j, iw, iw + k + 1,
+		    d1 + (size_t)(2*k + 1) * thread_num(), iend, pl);
+	}
     } else {
-	Srunmed(REAL(x), REAL(ans), n, k, iend, pl > 0);
+	double *scrat = (double *) R_alloc(nthreads * (size_t) k,
+					   sizeof(double));
+#ifdef _OPENMP
+# pragma omp parallel for num_threads(nthreads) schedule(dynamic) \
+    default(none) firstprivate(n, nc, k, rx, ra, scrat, iend, pl)
+#endif
+	for (int j = 0; j < nc; j++)
+	    Srunmed(rx + n * j, ra + n * j, n, k, iend, pl > 0,
+		    scrat + (size_t) k * thread_num());
     }
     UNPROTECT(1);
     return ans;
 }
+
+SEXP runquantile(SEXP x, SEXP snr, SEXP sk, SEXP sprob, SEXP end)
+{
+    if (TYPEOF(x) != REALSXP) error("numeric 'x' required");
+    R_xlen_t n = asInteger(snr);
+    int k = asInteger(sk), iend = asInteger(end), nc;
+    double prob = asReal(sprob);
+    if (n == NA_INTEGER || n < 1 || XLENGTH(x) % n)
+	error(_("invalid '%s' argument"), "nrow");
+    nc = (int)(XLENGTH(x) / n);
+    if (k == NA_INTEGER || k < 1)
+	error(_("invalid '%s' argument"), "k");
+    if (!R_FINITE(prob) || prob < 0 || prob > 1)
+	error(_("invalid '%s' argument"), "prob");
+    if (k > n) k = (int) n;
+    SEXP ans = PROTECT(allocVector(REALSXP, XLENGTH(x)));
+    double *rx = REAL(x), *ra = REAL(ans);
+    int nthreads = runmed_nthreads(n, nc, 0);
+    int *iwork = (int *) R_alloc(nthreads * 3 * (size_t) k, sizeof(int));
+    double *dwork = (double *) R_alloc(nthreads * (size_t) k, sizeof(double));
+#ifdef _OPENMP
+# pragma omp parallel for num_threads(nthreads) schedule(dynamic) \
+    default(none) firstprivate(n, nc, k, prob, iend, rx, ra, iwork, dwork)
+#endif
+    for (int j = 0; j < nc; j++)
+	runquant(rx + n * j, n, k, prob, iend, ra + n * j,
+		 iwork + 3 * (size_t) k * thread_num(),
+		 dwork + (size_t) k * thread_num());
+    UNPROTECT(1);
+    return ans;
+}
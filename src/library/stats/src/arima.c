@@ -1,6 +1,6 @@
 /*
  *  R : A Computer Language for Statistical Data Analysis
- *  Copyright (C) 2002-2016   The R Core Team.
+ *  Copyright (C) 2002-2017   The R Core Team.
  *
  *  This program is free software; you can redistribute it and/or modify
  *  it under the terms of the GNU General Public License as published by
@@ -23,10 +23,16 @@
 
 #include <stdlib.h> // for abs
 #include <string.h>
+#include <float.h> // for DBL_MAX
 
 #include <R.h>
+#include <R_ext/Lapack.h>
 #include "ts.h"
 #include "statsR.h" // for getListElement
+#ifdef _OPENMP
+# include <omp.h>
+# include <R_ext/MathThreads.h>
+#endif
 
 #ifndef max
 #define max(a,b) ((a < b)?(b):(a))
@@ -456,6 +462,31 @@ static void partrans(int p, double *raw, double *new)
     }
 }
 
+/* The Jacobian of partrans, J[j + p*i] = d new[j] / d raw[i] */
+static void partrans_jac(int p, const double *raw, double *J)
+{
+    double new[100], work[100], dnew[100], dwork[100];
+
+    for(int i = 0; i < p; i++) {
+	for(int j = 0; j < p; j++) {
+	    work[j] = new[j] = tanh(raw[j]);
+	    dwork[j] = dnew[j] = (j == i) ? 1 - new[j] * new[j] : 0.0;
+	}
+	for(int j = 1; j < p; j++) {
+	    double a = new[j], da = dnew[j];
+	    for(int k = 0; k < j; k++) {
+		work[k] -= a * new[j - k - 1];
+		dwork[k] -= da * new[j - k - 1] + a * dnew[j - k - 1];
+	    }
+	    for(int k = 0; k < j; k++) {
+		new[k] = work[k];
+		dnew[k] = dwork[k];
+	    }
+	}
+	for(int j = 0; j < p; j++) J[j + p * i] = dnew[j];
+    }
+}
+
 SEXP ARIMA_undoPars(SEXP sin, SEXP sarma)
 {
     int *arma = INTEGER(sarma), mp = arma[0], mq = arma[1], msp = arma[2],
@@ -472,19 +503,55 @@ SEXP ARIMA_undoPars(SEXP sin, SEXP sarma)
 }
 
 
+/* Expand the (possibly seasonal) ARMA parameters par into the
+   coefficients phi and theta of the full ARMA model, or if dpar is not
+   NULL, their derivatives in the direction dpar at par. */
+static void
+arma_expand(const int *arma, const double *par, const double *dpar,
+	    double *phi, double *theta)
+{
+    int mp = arma[0], mq = arma[1], msp = arma[2], msq = arma[3],
+	ns = arma[4], i, j, p = mp + ns * msp, q = mq + ns * msq;
+    const double *in = dpar ? dpar : par;
+
+    if (ns > 0) {
+	/* expand out seasonal ARMA models */
+	for (i = 0; i < mp; i++) phi[i] = in[i];
+	for (i = 0; i < mq; i++) theta[i] = in[i + mp];
+	for (i = mp; i < p; i++) phi[i] = 0.0;
+	for (i = mq; i < q; i++) theta[i] = 0.0;
+	for (j = 0; j < msp; j++) {
+	    phi[(j + 1) * ns - 1] += in[j + mp + mq];
+	    for (i = 0; i < mp; i++)
+		phi[(j + 1) * ns + i] -= dpar ?
+		    dpar[i] * par[j + mp + mq] + par[i] * dpar[j + mp + mq] :
+		    par[i] * par[j + mp + mq];
+	}
+	for (j = 0; j < msq; j++) {
+	    theta[(j + 1) * ns - 1] += in[j + mp + mq + msp];
+	    for (i = 0; i < mq; i++)
+		theta[(j + 1) * ns + i] += dpar ?
+		    dpar[i + mp] * par[j + mp + mq + msp] +
+		    par[i + mp] * dpar[j + mp + mq + msp] :
+		    par[i + mp] * par[j + mp + mq + msp];
+	}
+    } else {
+	for (i = 0; i < mp; i++) phi[i] = in[i];
+	for (i = 0; i < mq; i++) theta[i] = in[i + mp];
+    }
+}
+
 SEXP ARIMA_transPars(SEXP sin, SEXP sarma, SEXP strans)
 {
     int *arma = INTEGER(sarma), trans = asLogical(strans);
     int mp = arma[0], mq = arma[1], msp = arma[2], msq = arma[3],
-	ns = arma[4], i, j, p = mp + ns * msp, q = mq + ns * msq, v;
-    double *in = REAL(sin), *params = REAL(sin), *phi, *theta;
+	ns = arma[4], i, p = mp + ns * msp, q = mq + ns * msq, v;
+    double *in = REAL(sin), *params = REAL(sin);
     SEXP res, sPhi, sTheta;
 
     PROTECT(res = allocVector(VECSXP, 2));
     SET_VECTOR_ELT(res, 0, sPhi = allocVector(REALSXP, p));
     SET_VECTOR_ELT(res, 1, sTheta = allocVector(REALSXP, q));
-    phi = REAL(sPhi);
-    theta = REAL(sTheta);
     if (trans) {
 	int n = mp + mq + msp + msq;
 
@@ -494,27 +561,7 @@ SEXP ARIMA_transPars(SEXP sin, SEXP sarma, SEXP strans)
 	v = mp + mq;
 	if (msp > 0) partrans(msp, in + v, params + v);
     }
-    if (ns > 0) {
-	/* expand out seasonal ARMA models */
-	for (i = 0; i < mp; i++) phi[i] = params[i];
-	for (i = 0; i < mq; i++) theta[i] = params[i + mp];
-	for (i = mp; i < p; i++) phi[i] = 0.0;
-	for (i = mq; i < q; i++) theta[i] = 0.0;
-	for (j = 0; j < msp; j++) {
-	    phi[(j + 1) * ns - 1] += params[j + mp + mq];
-	    for (i = 0; i < mp; i++)
-		phi[(j + 1) * ns + i] -= params[i] * params[j + mp + mq];
-	}
-	for (j = 0; j < msq; j++) {
-	    theta[(j + 1) * ns - 1] += params[j + mp + mq + msp];
-	    for (i = 0; i < mq; i++)
-		theta[(j + 1) * ns + i] += params[i + mp] *
-		    params[j + mp + mq + msp];
-	}
-    } else {
-	for (i = 0; i < mp; i++) phi[i] = params[i];
-	for (i = 0; i < mq; i++) theta[i] = params[i + mp];
-    }
+    arma_expand(arma, params, NULL, REAL(sPhi), REAL(sTheta));
     UNPROTECT(1);
     return res;
 }
@@ -747,32 +794,21 @@ ARIMA_Like(SEXP sy, SEXP mod, SEXP sUP, SEXP giveResid)
     }
 }
 
-/* do differencing here */
-/* arma is p, q, sp, sq, ns, d, sd */
-SEXP
-ARIMA_CSS(SEXP sy, SEXP sarma, SEXP sPhi, SEXP sTheta,
-	  SEXP sncond, SEXP giveResid)
+/* The conditional sum of squares: w is the series (overwritten by its
+   differences) and resid the residuals, both of length n */
+static double
+arima_css(double *w, int n, const int *arma, const double *phi, int p,
+	  const double *theta, int q, int ncond, double *resid)
 {
-    SEXP res, sResid = R_NilValue;
-    double ssq = 0.0, *y = REAL(sy), tmp;
-    double *phi = REAL(sPhi), *theta = REAL(sTheta), *w, *resid;
-    int n = LENGTH(sy), *arma = INTEGER(sarma), p = LENGTH(sPhi),
-	q = LENGTH(sTheta), ncond = asInteger(sncond);
+    double ssq = 0.0, tmp;
     int ns, nu = 0;
-    Rboolean useResid = asLogical(giveResid);
 
-    w = (double *) R_alloc(n, sizeof(double));
-    for (int l = 0; l < n; l++) w[l] = y[l];
     for (int i = 0; i < arma[5]; i++)
 	for (int l = n - 1; l > 0; l--) w[l] -= w[l - 1];
     ns = arma[4];
     for (int i = 0; i < arma[6]; i++)
 	for (int l = n - 1; l >= ns; l--) w[l] -= w[l - ns];
 
-    PROTECT(sResid = allocVector(REALSXP, n));
-    resid = REAL(sResid);
-    if (useResid) for (int l = 0; l < ncond; l++) resid[l] = 0;
-
     for (int l = ncond; l < n; l++) {
 	tmp = w[l];
 	for (int j = 0; j < p; j++) tmp -= phi[j] * w[l - j - 1];
@@ -784,15 +820,39 @@ ARIMA_CSS(SEXP sy, SEXP sarma, SEXP sPhi, SEXP sTheta,
 	    ssq += tmp * tmp;
 	}
     }
+    return ssq / (double) (nu);
+}
+
+/* do differencing here */
+/* arma is p, q, sp, sq, ns, d, sd */
+SEXP
+ARIMA_CSS(SEXP sy, SEXP sarma, SEXP sPhi, SEXP sTheta,
+	  SEXP sncond, SEXP giveResid)
+{
+    SEXP res, sResid = R_NilValue;
+    double *y = REAL(sy), ssq;
+    double *phi = REAL(sPhi), *theta = REAL(sTheta), *w, *resid;
+    int n = LENGTH(sy), *arma = INTEGER(sarma), p = LENGTH(sPhi),
+	q = LENGTH(sTheta), ncond = asInteger(sncond);
+    Rboolean useResid = asLogical(giveResid);
+
+    w = (double *) R_alloc(n, sizeof(double));
+    for (int l = 0; l < n; l++) w[l] = y[l];
+
+    PROTECT(sResid = allocVector(REALSXP, n));
+    resid = REAL(sResid);
+    if (useResid) for (int l = 0; l < ncond; l++) resid[l] = 0;
+
+    ssq = arima_css(w, n, arma, phi, p, theta, q, ncond, resid);
     if (useResid) {
 	PROTECT(res = allocVector(VECSXP, 2));
-	SET_VECTOR_ELT(res, 0, ScalarReal(ssq / (double) (nu)));
+	SET_VECTOR_ELT(res, 0, ScalarReal(ssq));
 	SET_VECTOR_ELT(res, 1, sResid);
 	UNPROTECT(2);
 	return res;
     } else {
 	UNPROTECT(1);
-	return ScalarReal(ssq / (double) (nu));
+	return ScalarReal(ssq);
     }
 }
 
@@ -820,14 +880,15 @@ SEXP TSconv(SEXP a, SEXP b)
 /* based on code from AS154 */
 
 static void
-inclu2(size_t np, double *xnext, double *xrow, double ynext,
+inclu2(size_t np, int nrhs, double *xnext, double *xrow, double *ynext,
        double *d, double *rbar, double *thetab)
 {
     double cbar, sbar, di, xi, xk, rbthis, dpi;
     size_t i, k, ithisr;
 
 /*   This subroutine updates d, rbar, thetab by the inclusion
-     of xnext and ynext. */
+     of xnext and ynext[], one value for each of the nrhs columns
+     of thetab. */
 
     for (i = 0; i < np; i++) xrow[i] = xnext[i];
 
@@ -845,9 +906,12 @@ inclu2(size_t np, double *xnext, double *xrow, double ynext,
 		xrow[k] = xk - xi * rbthis;
 		rbar[ithisr++] = cbar * rbthis + sbar * xk;
 	    }
-	    xk = ynext;
-	    ynext = xk - xi * thetab[i];
-	    thetab[i] = cbar * thetab[i] + sbar * xk;
+	    for (int h = 0; h < nrhs; h++) {
+		double *th = thetab + np * h;
+		xk = ynext[h];
+		ynext[h] = xk - xi * th[i];
+		th[i] = cbar * th[i] + sbar * xk;
+	    }
 	    if (di == 0.0) return;
 	} else
 	    ithisr = ithisr + np - i - 1;
@@ -864,25 +928,37 @@ inclu2(size_t np, double *xnext, double *xrow, double ynext,
   }
 #endif
 
+/* Workspace needed by Q0_Rossignol(): in doubles, and in ints */
+static size_t Q0_Rossignol_lwork(int p, int q)
+{
+    size_t r2 = max(p + q, p + 1);
+    return (size_t)(2 * q + p + 2) + r2 * r2 + 5 * r2;
+}
+
+static size_t Q0_Rossignol_liwork(int p, int q)
+{
+    return max(p + q, p + 1);
+}
+
 /*
   Matwey V. Kornilov's implementation of algorithm by
   Dr. Raphael Rossignol
   See https://bugs.r-project.org/bugzilla3/show_bug.cgi?id=14682 for details.
+
+  P is r x r.  Returns 0, the positive 'info' from LAPACK's dgesv if
+  the system for the autocovariances is exactly singular, or -1 if its
+  reciprocal condition number (in *rcond) is less than tol > 0.
 */
-SEXP getQ0bis(SEXP sPhi, SEXP sTheta, SEXP sTol)
+static int
+Q0_Rossignol(const double *phi, int p, const double *theta, int q, double tol,
+	     double *P, double *rcond, double *work, int *iwork)
 {
-    SEXP res;
-    int p = LENGTH(sPhi), q = LENGTH(sTheta);
-    double *phi = REAL(sPhi), *theta = REAL(sTheta); // tol = REAL(sTol)[0];
-
     int i,j, r = max(p, q + 1);
 
     /* Final result is block product 
      *   Q0 = A1 SX A1^T + A1 SXZ A2^T + (A1 SXZ A2^T)^T + A2 A2^T ,
      * where A1 [i,j] = phi[i+j],
      *       A2 [i,j] = ttheta[i+j],  and SX, SXZ are defined below */
-    PROTECT(res = allocMatrix(REALSXP, r, r));
-    double *P = REAL(res);
 
     /* Clean P */
     Memzero(P, r*r);
@@ -897,18 +973,15 @@ SEXP getQ0bis(SEXP sPhi, SEXP sTheta, SEXP sTol)
 #define _rrz(j)  rrz [j]
 #endif
 
-    double *ttheta = (double *) R_alloc(q + 1, sizeof(double));
+    double *ttheta = work;
     /* Init ttheta = c(1, theta) */
     ttheta[0] = 1.;
     for (i = 1; i < q + 1; ++i) ttheta[i] = theta[i - 1];
 
     if( p > 0 ) {
-	int r2 = max(p + q, p + 1);
-	SEXP sgam = PROTECT(allocMatrix(REALSXP, r2, r2)),
-	    sg = PROTECT(allocVector(REALSXP, r2));
-	double *gam = REAL(sgam);
-	double *g = REAL(sg);
-	double *tphi = (double *) R_alloc(p + 1, sizeof(double));
+	int r2 = max(p + q, p + 1), info, one = 1;
+	double *gam = ttheta + (q + 1), *g = gam + r2 * r2,
+	    *tphi = g + r2, *rrz = tphi + (p + 1), *cwork = rrz + q;
 	/* Init tphi = c(1, -phi) */
 	tphi[0] = 1.;
 	for (i = 1; i < p + 1; ++i) tphi[i] = -phi[i - 1];
@@ -933,14 +1006,18 @@ SEXP getQ0bis(SEXP sPhi, SEXP sTheta, SEXP sTol)
 	for (i = 1; i < r2; ++i)
 	    g[i] = 0.;
 
-    /* rU = solve(Gam, g)  -> solve.default() -> .Internal(La_solve, .,)
-     * --> fiddling with R-objects -> C and then F77_CALL(.) of dgesv, dlange, dgecon
-     * FIXME: call these directly here, possibly even use 'info' instead of error(.)
-     * e.g., in case of exact singularity.
-     */
-	SEXP callS = PROTECT(lang4(install("solve.default"), sgam, sg, sTol)),
-	    su = PROTECT(eval(callS, R_BaseEnv));
-	double *u = REAL(su);
+    /* rU = solve(Gam, g), with the checks of solve.default() */
+	double anorm = 0.0;
+	if (tol > 0)
+	    anorm = F77_CALL(dlange)("1", &r2, &r2, gam, &r2, (double*) NULL);
+	F77_CALL(dgesv)(&r2, &one, gam, &r2, iwork, g, &r2, &info);
+	if (info > 0) return info;
+	if (tol > 0) {
+	    F77_CALL(dgecon)("1", &r2, gam, &r2, &anorm, rcond, cwork, iwork,
+			     &info);
+	    if (*rcond < tol) return -1;
+	}
+	double *u = g;
     /* SX = A SU A^T */
     /* A[i,j]  = ttheta[j-i] */
     /* SU[i,j] = u[abs(i-j)] */
@@ -954,12 +1031,10 @@ SEXP getQ0bis(SEXP sPhi, SEXP sTheta, SEXP sTol)
 			    for (int n = m; n - m < q + 1; ++n)
 				P[r*i + j] += phi[i + k] * phi[j + m] *
 				    _ttheta(L - k) * _ttheta(n - m) * u[abs(L - n)];
-	UNPROTECT(4);
     /* Compute correlation matrix between X and Z */
     /* forwardsolve(C1, g) */
     /* C[i,j] = tphi[i-j] */
     /* g[i] = _ttheta(i) */
-	double *rrz = (double *) R_alloc(q, sizeof(double));
 	if(q > 0) {
 	    for (i = 0; i < q; ++i) {
 		rrz[i] = _ttheta(i);
@@ -993,51 +1068,59 @@ SEXP getQ0bis(SEXP sPhi, SEXP sTheta, SEXP sTol)
 	for (j = i+1; j < r; ++j)
 	    P[r*j + i] = P[r*i + j];
 
+    return 0;
+}
+
+SEXP getQ0bis(SEXP sPhi, SEXP sTheta, SEXP sTol)
+{
+    SEXP res;
+    int p = LENGTH(sPhi), q = LENGTH(sTheta), r = max(p, q + 1), info;
+    double rcond = 0.0, tol = asReal(sTol);
+    double *work = (double *) R_alloc(Q0_Rossignol_lwork(p, q),
+				      sizeof(double));
+    int *iwork = (int *) R_alloc(Q0_Rossignol_liwork(p, q), sizeof(int));
+
+    PROTECT(res = allocMatrix(REALSXP, r, r));
+    info = Q0_Rossignol(REAL(sPhi), p, REAL(sTheta), q, tol, REAL(res),
+			&rcond, work, iwork);
+    if (info > 0)
+	error(_("Lapack routine %s: system is exactly singular: U[%d,%d] = 0"),
+	      "dgesv", info, info);
+    if (info < 0)
+	error(_("system is computationally singular: reciprocal condition number = %g"),
+	      rcond);
     UNPROTECT(1);
     return res;
 }
 
-SEXP getQ0(SEXP sPhi, SEXP sTheta)
+/* Workspace, in doubles, needed by Q0_Gardner() for nrhs right-hand
+   sides.  NB: this could overflow, so r is limited to 350 */
+static size_t Q0_Gardner_lwork(int r, int nrhs)
 {
-    SEXP res;
-    int  p = LENGTH(sPhi), q = LENGTH(sTheta);
-    double *phi = REAL(sPhi), *theta = REAL(sTheta);
+    size_t np = r * (r + 1) / 2, nrbar = np * (np - 1) / 2;
+    return (3 + nrhs) * np + nrhs + nrbar;
+}
 
-    /* thetab[np], xnext[np], xrow[np].  rbar[rbar] */
-    /* NB: nrbar could overflow */
-    int r = max(p, q + 1);
+/* Solve P = T P T' + V for the r x r symmetric P, where T is the
+   transition matrix of the ARMA part of the state space form (so
+   depends only on phi), for each of nrhs right-hand sides V given as
+   the np = r(r+1)/2 elements of their lower triangles, by column.
+   For V = (1 theta)(1 theta)', P is the covariance matrix of the
+   initial state, Q0.  P is r x r x nrhs. */
+static void
+Q0_Gardner(int r, const double *phi, int p, const double *V, int nrhs,
+	   double *P, double *work)
+{
     size_t np = r * (r + 1) / 2, nrbar = np * (np - 1) / 2, npr, npr1;
     size_t indi, indj, indn, i, j, ithisr, ind, ind1, ind2, im, jm;
-
-
-    /* This is the limit using an int index.  We could use
-       size_t and get more on a 64-bit system,
-       but there seems no practical need. */
-    if(r > 350) error(_("maximum supported lag is 350"));
-    double *xnext, *xrow, *rbar, *thetab, *V;
-    xnext = (double *) R_alloc(np, sizeof(double));
-    xrow = (double *) R_alloc(np, sizeof(double));
-    rbar = (double *) R_alloc(nrbar, sizeof(double));
-    thetab = (double *) R_alloc(np, sizeof(double));
-    V = (double *) R_alloc(np, sizeof(double));
-    for (ind = 0, j = 0; j < r; j++) {
-	double vj = 0.0;
-	if (j == 0) vj = 1.0; else if (j - 1 < q) vj = theta[j - 1];
-	for (i = j; i < r; i++) {
-	    double vi = 0.0;
-	    if (i == 0) vi = 1.0; else if (i - 1 < q) vi = theta[i - 1];
-	    V[ind++] = vi * vj;
-	}
-    }
-
-    PROTECT(res = allocMatrix(REALSXP, r, r));
-    double *P = REAL(res);
+    double *xnext = work, *xrow = xnext + np, *dd = xrow + np,
+	*ynext = dd + np, *thetab = ynext + nrhs, *rbar = thetab + np * nrhs;
 
     if (r == 1) {
-	if (p == 0) P[0] = 1.0; // PR#16419
-	else P[0] = 1.0 / (1.0 - phi[0] * phi[0]);
-	UNPROTECT(1);
-	return res;
+	for (int h = 0; h < nrhs; h++)
+	    if (p == 0) P[h] = V[h]; // PR#16419
+	    else P[h] = V[h] / (1.0 - phi[0] * phi[0]);
+	return;
     }
     if (p > 0) {
 /*      The set of equations s * vec(P0) = vec(v) is solved for
@@ -1047,10 +1130,10 @@ SEXP getQ0(SEXP sPhi, SEXP sTheta)
 
 	for (i = 0; i < nrbar; i++) rbar[i] = 0.0;
 	for (i = 0; i < np; i++) {
-	    P[i] = 0.0;
-	    thetab[i] = 0.0;
+	    dd[i] = 0.0;
 	    xnext[i] = 0.0;
 	}
+	for (i = 0; i < np * nrhs; i++) thetab[i] = 0.0;
 	ind = 0;
 	ind1 = -1;
 	npr = np - r;
@@ -1062,8 +1145,9 @@ SEXP getQ0(SEXP sPhi, SEXP sTheta)
 	    xnext[indj++] = 0.0;
 	    indi = npr1 + j;
 	    for (i = j; i < r; i++) {
-		double ynext = V[ind++];
 		double phii = (i < p) ? phi[i] : 0.0;
+		for (int h = 0; h < nrhs; h++) ynext[h] = V[ind + np * h];
+		ind++;
 		if (j != r - 1) {
 		    xnext[indj] = -phii;
 		    if (i != r - 1) {
@@ -1074,7 +1158,7 @@ SEXP getQ0(SEXP sPhi, SEXP sTheta)
 		xnext[npr] = -phii * phij;
 		if (++ind2 >= np) ind2 = 0;
 		xnext[ind2] += 1.0;
-		inclu2(np, xnext, xrow, ynext, P, rbar, thetab);
+		inclu2(np, nrhs, xnext, xrow, ynext, dd, rbar, thetab);
 		xnext[ind2] = 0.0;
 		if (i != r - 1) {
 		    xnext[indi++] = 0.0;
@@ -1083,43 +1167,792 @@ SEXP getQ0(SEXP sPhi, SEXP sTheta)
 	    }
 	}
 
-	ithisr = nrbar - 1;
-	im = np - 1;
-	for (i = 0; i < np; i++) {
-	    double bi = thetab[im];
-	    for (jm = np - 1, j = 0; j < i; j++)
-		bi -= rbar[ithisr--] * P[jm--];
-	    P[im--] = bi;
-	}
+	for (int h = 0; h < nrhs; h++) {
+	    double *Ph = P + (size_t) r * r * h, *th = thetab + np * h;
+	    ithisr = nrbar - 1;
+	    im = np - 1;
+	    for (i = 0; i < np; i++) {
+		double bi = th[im];
+		for (jm = np - 1, j = 0; j < i; j++)
+		    bi -= rbar[ithisr--] * Ph[jm--];
+		Ph[im--] = bi;
+	    }
 
 /*        now re-order p. */
 
-	ind = npr;
-	for (i = 0; i < r; i++) xnext[i] = P[ind++];
-	ind = np - 1;
-	ind1 = npr - 1;
-	for (i = 0; i < npr; i++) P[ind--] = P[ind1--];
-	for (i = 0; i < r; i++) P[i] = xnext[i];
+	    ind = npr;
+	    for (i = 0; i < r; i++) xnext[i] = Ph[ind++];
+	    ind = np - 1;
+	    ind1 = npr - 1;
+	    for (i = 0; i < npr; i++) Ph[ind--] = Ph[ind1--];
+	    for (i = 0; i < r; i++) Ph[i] = xnext[i];
+	}
     } else {
 
 /* P0 is obtained by backsubstitution for a moving average process. */
 
-	indn = np;
-	ind = np;
-	for (i = 0; i < r; i++)
-	    for (j = 0; j <= i; j++) {
-		--ind;
-		P[ind] = V[ind];
-		if (j != 0) P[ind] += P[--indn];
-	    }
+	for (int h = 0; h < nrhs; h++) {
+	    double *Ph = P + (size_t) r * r * h;
+	    const double *Vh = V + np * h;
+	    indn = np;
+	    ind = np;
+	    for (i = 0; i < r; i++)
+		for (j = 0; j <= i; j++) {
+		    --ind;
+		    Ph[ind] = Vh[ind];
+		    if (j != 0) Ph[ind] += Ph[--indn];
+		}
+	}
     }
     /* now unpack to a full matrix */
-    for (i = r - 1, ind = np; i > 0; i--)
-	for (j = r - 1; j >= i; j--)
-	    P[r * i + j] = P[--ind];
-    for (i = 0; i < r - 1; i++)
-	for (j = i + 1; j < r; j++)
-	    P[i + r * j] = P[j + r * i];
+    for (int h = 0; h < nrhs; h++) {
+	double *Ph = P + (size_t) r * r * h;
+	for (i = r - 1, ind = np; i > 0; i--)
+	    for (j = r - 1; j >= i; j--)
+		Ph[r * i + j] = Ph[--ind];
+	for (i = 0; i < r - 1; i++)
+	    for (j = i + 1; j < r; j++)
+		Ph[i + r * j] = Ph[j + r * i];
+    }
+}
+
+SEXP getQ0(SEXP sPhi, SEXP sTheta)
+{
+    SEXP res;
+    int  p = LENGTH(sPhi), q = LENGTH(sTheta);
+    double *theta = REAL(sTheta);
+    int r = max(p, q + 1);
+    size_t np = r * (r + 1) / 2, ind, i, j;
+
+    /* This is the limit using an int index.  We could use
+       size_t and get more on a 64-bit system,
+       but there seems no practical need. */
+    if(r > 350) error(_("maximum supported lag is 350"));
+    double *V = (double *) R_alloc(np, sizeof(double)),
+	*work = (double *) R_alloc(Q0_Gardner_lwork(r, 1), sizeof(double));
+    for (ind = 0, j = 0; j < r; j++) {
+	double vj = 0.0;
+	if (j == 0) vj = 1.0; else if (j - 1 < q) vj = theta[j - 1];
+	for (i = j; i < r; i++) {
+	    double vi = 0.0;
+	    if (i == 0) vi = 1.0; else if (i - 1 < q) vi = theta[i - 1];
+	    V[ind++] = vi * vj;
+	}
+    }
+
+    PROTECT(res = allocMatrix(REALSXP, r, r));
+    Q0_Gardner(r, REAL(sPhi), p, V, 1, REAL(res), work);
+    UNPROTECT(1);
+    return res;
+}
+
+
+/* The exact likelihood of an ARIMA model, as used by arima(method =
+   "ML"), computed directly from its parameters with the derivatives
+   with respect to them.
+
+   arima_ml() uses no R memory nor R errors, only the workspaces work
+   and iwork of at least arima_ml_lwork() doubles and arima_ml_liwork()
+   ints, so may be called concurrently (e.g. for many series) with
+   separate workspaces.
+
+   The state space form is that of makeARIMA(): the ARMA part in
+   companion form in the first r elements of the state and the d
+   differenced values in the rest, so T is applied by arima_Ta() and
+   arima_TPT() without forming it.
+*/
+
+static void
+arima_Ta(int r, int d, const double *phi, int p, const double *delta,
+	 const double *a, double *anew)
+{
+    for (int i = 0; i < r; i++) {
+	double tmp = (i < r - 1) ? a[i + 1] : 0.0;
+	if (i < p) tmp += phi[i] * a[0];
+	anew[i] = tmp;
+    }
+    if (d > 0) {
+	for (int i = r + 1; i < r + d; i++) anew[i] = a[i - 1];
+	double tmp = a[0];
+	for (int i = 0; i < d; i++) tmp += delta[i] * a[r + i];
+	anew[r] = tmp;
+    }
+}
+
+/* Pnew = T P T', with mm = T P */
+static void
+arima_TPT(int r, int d, const double *phi, int p, const double *delta,
+	  const double *P, double *mm, double *Pnew)
+{
+    int rd = r + d;
+
+    for (int i = 0; i < r; i++)
+	for (int j = 0; j < rd; j++) {
+	    double tmp = 0.0;
+	    if (i < p) tmp += phi[i] * P[rd * j];
+	    if (i < r - 1) tmp += P[i + 1 + rd * j];
+	    mm[i + rd * j] = tmp;
+	}
+    if (d > 0) {
+	for (int j = 0; j < rd; j++) {
+	    double tmp = P[rd * j];
+	    for (int k = 0; k < d; k++)
+		tmp += delta[k] * P[r + k + rd * j];
+	    mm[r + rd * j] = tmp;
+	}
+	for (int i = 1; i < d; i++)
+	    for (int j = 0; j < rd; j++)
+		mm[r + i + rd * j] = P[r + i - 1 + rd * j];
+    }
+
+    for (int i = 0; i < r; i++)
+	for (int j = 0; j < rd; j++) {
+	    double tmp = 0.0;
+	    if (i < p) tmp += phi[i] * mm[j];
+	    if (i < r - 1) tmp += mm[rd * (i + 1) + j];
+	    Pnew[j + rd * i] = tmp;
+	}
+    if (d > 0) {
+	for (int j = 0; j < rd; j++) {
+	    double tmp = mm[j];
+	    for (int k = 0; k < d; k++)
+		tmp += delta[k] * mm[rd * (r + k) + j];
+	    Pnew[rd * r + j] = tmp;
+	}
+	for (int i = 1; i < d; i++)
+	    for (int j = 0; j < rd; j++)
+		Pnew[rd * (r + i) + j] = mm[rd * (r + i - 1) + j];
+    }
+}
+
+size_t
+arima_ml_lwork(const int *arma, int n, int d, int ncxreg, int ngrad)
+{
+    int mp = arma[0], mq = arma[1], msp = arma[2], msq = arma[3],
+	narma = mp + mq + msp + msq, p = mp + arma[4] * msp,
+	q = mq + arma[4] * msq, r = max(p, q + 1), rd = r + d;
+    size_t rd2 = (size_t) rd * rd, lq0 = Q0_Gardner_lwork(r, max(ngrad, 1)),
+	lq0bis = Q0_Rossignol_lwork(p, q);
+
+    return 3 + 2 * (size_t) narma + mp * mp + msp * msp + (p + q) * (1 + ngrad)
+	+ n + (3 * rd + 4 * rd2) + ngrad * (3 * rd + 2 * rd2 + 2)
+	+ (size_t) r * (r + 1) / 2 * max(ngrad, 1) + (size_t) r * r * (1 + ngrad)
+	+ max(lq0, lq0bis);
+}
+
+int arima_ml_liwork(const int *arma, int ngrad)
+{
+    int p = arma[0] + arma[4] * arma[2], q = arma[1] + arma[4] * arma[3];
+    return (int) Q0_Rossignol_liwork(p, q) + ngrad;
+}
+
+/* x: the series, of length n, with NAs for missing values.
+   xreg: n x ncxreg matrix of regressors.
+   arma, delta, kappa: as in arima().
+   gardner: use Gardner et al's method for the initial state
+       covariance, otherwise Rossignol's.
+   trans: are the AR parameters transformed, as by partrans()?
+   coef: the parameters, the narma ARMA ones then ncxreg for xreg.
+   mask: which elements of coef vary; if grad is not NULL the
+       derivatives with respect to these are returned in grad.
+
+   Returns the objective minimized by arima(), or DBL_MAX if Q0 could
+   not be computed.  Otherwise work[0:2] are then the sum of squares,
+   the sum of log gains and the number of observations used, as from
+   ARIMA_Like(), followed by the filtered state at the end of the
+   series (rd) and its variance (rd x rd).
+
+   As the derivatives of Q0 solve a system like that for Q0 itself
+   they are computed by Gardner's method, so r may be at most 350 if
+   grad is not NULL.
+*/
+double
+arima_ml(const double *x, int n, const double *xreg, int ncxreg,
+	 const int *arma, const double *delta, int d, double kappa,
+	 Rboolean gardner, Rboolean trans, const double *coef,
+	 const int *mask, double *grad, double *work, int *iwork)
+{
+    int mp = arma[0], mq = arma[1], msp = arma[2], msq = arma[3],
+	narma = mp + mq + msp + msq, p = mp + arma[4] * msp,
+	q = mq + arma[4] * msq, r = max(p, q + 1), rd = r + d,
+	ngrad = 0, narmag = 0;
+    size_t np = r * (r + 1) / 2, rd2 = (size_t) rd * rd;
+
+    int *gind = iwork, *liwork;
+    if (grad)
+	for (int i = 0; i < narma + ncxreg; i++)
+	    if (mask[i]) {
+		gind[ngrad++] = i;
+		if (i < narma) narmag++;
+	    }
+    liwork = iwork + ngrad;
+
+    double *a = work + 3, *P = a + rd, *par = P + rd2, *dpar = par + narma,
+	*J1 = dpar + narma, *J2 = J1 + mp * mp, *phi = J2 + msp * msp,
+	*theta = phi + p, *dphi = theta + q, *dtheta = dphi + p * ngrad,
+	*y = dtheta + q * ngrad, *anew = y + n, *M = anew + rd,
+	*Pnew = M + rd, *mm = Pnew + rd2, *dmm = mm + rd2,
+	*da = dmm + rd2, *danew = da + rd * ngrad, *dM = danew + rd * ngrad,
+	*dP = dM + rd * ngrad, *dPnew = dP + rd2 * ngrad,
+	*dssq = dPnew + rd2 * ngrad, *dsumlog = dssq + ngrad,
+	*C = dsumlog + ngrad, *Q0 = C + np * max(ngrad, 1),
+	*qwork = Q0 + (size_t) r * r * (1 + ngrad);
+
+    /* the parameters of the full ARMA model */
+    for (int i = 0; i < narma; i++) par[i] = coef[i];
+    if (trans) {
+	if (mp > 0) partrans(mp, (double *) coef, par);
+	if (msp > 0) partrans(msp, (double *) coef + mp + mq, par + mp + mq);
+    }
+    arma_expand(arma, par, NULL, phi, theta);
+    for (int l = 0; l < n; l++) {
+	double tmp = 0.0;
+	for (int j = 0; j < ncxreg; j++)
+	    tmp += xreg[l + (size_t) n * j] * coef[narma + j];
+	y[l] = x[l] - tmp;
+    }
+
+    /* and their derivatives */
+    if (narmag > 0 && trans) {
+	if (mp > 0) partrans_jac(mp, coef, J1);
+	if (msp > 0) partrans_jac(msp, coef + mp + mq, J2);
+    }
+    for (int g = 0; g < narmag; g++) {
+	int c = gind[g], v = mp + mq;
+	for (int i = 0; i < narma; i++) dpar[i] = 0.0;
+	if (trans && c < mp)
+	    for (int i = 0; i < mp; i++) dpar[i] = J1[i + mp * c];
+	else if (trans && c >= v && c < v + msp)
+	    for (int i = 0; i < msp; i++) dpar[v + i] = J2[i + msp * (c - v)];
+	else dpar[c] = 1.0;
+	arma_expand(arma, par, dpar, dphi + p * g, dtheta + q * g);
+    }
+
+    /* Q0 */
+    if (r == 1)
+	Q0[0] = (p > 0) ? 1.0 / (1.0 - phi[0] * phi[0]) : 1.0;
+    else if (gardner) {
+	double *V = C;
+	for (int ind = 0, j = 0; j < r; j++) {
+	    double vj = (j == 0) ? 1.0 : ((j - 1 < q) ? theta[j - 1] : 0.0);
+	    for (int i = j; i < r; i++)
+		V[ind++] = vj * ((i == 0) ? 1.0 :
+				 ((i - 1 < q) ? theta[i - 1] : 0.0));
+	}
+	Q0_Gardner(r, phi, p, V, 1, Q0, qwork);
+    } else {
+	double rcond;
+	if (Q0_Rossignol(phi, p, theta, q, 0.0, Q0, &rcond, qwork, liwork))
+	    return DBL_MAX;
+    }
+
+    /* dQ0 = T dQ0 T' + dT Q0 T' + T Q0 dT' + dV, with only the first
+       column of T and the first row of R depending on the parameters */
+    if (narmag > 0) {
+	for (int g = 0; g < narmag; g++) {
+	    double *dph = dphi + p * g, *dth = dtheta + q * g, *Cg = C + np * g;
+	    int ind = 0;
+	    for (int j = 0; j < r; j++) {
+		/* (T Q0)[j, 0] and R[j], dR[j] */
+		double wj = (j < r - 1) ? Q0[j + 1] : 0.0;
+		if (j < p) wj += phi[j] * Q0[0];
+		double Rj = (j == 0) ? 1.0 : ((j - 1 < q) ? theta[j - 1] : 0.0),
+		    dRj = (j > 0 && j - 1 < q) ? dth[j - 1] : 0.0,
+		    dphj = (j < p) ? dph[j] : 0.0;
+		for (int i = j; i < r; i++) {
+		    double wi = (i < r - 1) ? Q0[i + 1] : 0.0;
+		    if (i < p) wi += phi[i] * Q0[0];
+		    double Ri = (i == 0) ? 1.0 :
+			((i - 1 < q) ? theta[i - 1] : 0.0),
+			dRi = (i > 0 && i - 1 < q) ? dth[i - 1] : 0.0,
+			dphi_i = (i < p) ? dph[i] : 0.0;
+		    Cg[ind++] = dphi_i * wj + wi * dphj + dRi * Rj + Ri * dRj;
+		}
+	    }
+	}
+	Q0_Gardner(r, phi, p, C, narmag, Q0 + r * r, qwork);
+    }
+
+    /* the Kalman filter, starting from a = 0 and Pnew = Pn */
+    for (int i = 0; i < rd; i++) a[i] = 0.0;
+    for (size_t i = 0; i < rd2; i++) Pnew[i] = 0.0;
+    for (int i = 0; i < r; i++)
+	for (int j = 0; j < r; j++) Pnew[i + rd * j] = Q0[i + r * j];
+    for (int i = r; i < rd; i++) Pnew[i + rd * i] = kappa;
+    for (int g = 0; g < ngrad; g++) {
+	double *dPg = dPnew + rd2 * g;
+	dssq[g] = dsumlog[g] = 0.0;
+	for (int i = 0; i < rd; i++) da[i + rd * g] = 0.0;
+	for (size_t i = 0; i < rd2; i++) dPg[i] = 0.0;
+	if (g < narmag)
+	    for (int i = 0; i < r; i++)
+		for (int j = 0; j < r; j++)
+		    dPg[i + rd * j] = Q0[(size_t) r * r * (1 + g) + i + r * j];
+    }
+
+    double ssq = 0.0, sumlog = 0.0;
+    int nu = 0;
+    for (int l = 0; l < n; l++) {
+	arima_Ta(r, d, phi, p, delta, a, anew);
+	for (int g = 0; g < ngrad; g++) {
+	    double *dag = danew + rd * g;
+	    arima_Ta(r, d, phi, p, delta, da + rd * g, dag);
+	    if (g < narmag)
+		for (int i = 0; i < p; i++) dag[i] += dphi[i + p * g] * a[0];
+	}
+	if (l > 0) {
+	    arima_TPT(r, d, phi, p, delta, P, mm, Pnew);
+	    /* Pnew <- Pnew + (1 theta) %o% (1 theta) */
+	    for (int i = 0; i <= q; i++) {
+		double vi = (i == 0) ? 1. : theta[i - 1];
+		for (int j = 0; j <= q; j++)
+		    Pnew[i + rd * j] += vi * ((j == 0) ? 1. : theta[j - 1]);
+	    }
+	    /* dPnew = T dP T' + dT P T' + T P dT' + dV, where
+	       (dT P T')[i, j] = dphi[i] (T P)[j, 0] */
+	    for (int g = 0; g < ngrad; g++) {
+		double *dPg = dPnew + rd2 * g, *dph = dphi + p * g,
+		    *dth = dtheta + q * g;
+		arima_TPT(r, d, phi, p, delta, dP + rd2 * g, dmm, dPg);
+		if (g >= narmag) continue;
+		for (int i = 0; i < p; i++)
+		    for (int j = 0; j < rd; j++) {
+			dPg[i + rd * j] += dph[i] * mm[j];
+			dPg[j + rd * i] += dph[i] * mm[j];
+		    }
+		for (int i = 0; i <= q; i++) {
+		    double vi = (i == 0) ? 1. : theta[i - 1],
+			dvi = (i == 0) ? 0. : dth[i - 1];
+		    for (int j = 0; j <= q; j++) {
+			double vj = (j == 0) ? 1. : theta[j - 1],
+			    dvj = (j == 0) ? 0. : dth[j - 1];
+			dPg[i + rd * j] += dvi * vj + vi * dvj;
+		    }
+		}
+	    }
+	}
+	if (!ISNAN(y[l])) {
+	    double resid = y[l] - anew[0];
+	    for (int i = 0; i < d; i++)
+		resid -= delta[i] * anew[r + i];
+
+	    for (int i = 0; i < rd; i++) {
+		double tmp = Pnew[i];
+		for (int j = 0; j < d; j++)
+		    tmp += Pnew[i + (r + j) * rd] * delta[j];
+		M[i] = tmp;
+	    }
+
+	    double gain = M[0];
+	    for (int j = 0; j < d; j++) gain += delta[j] * M[r + j];
+	    for (int g = 0; g < ngrad; g++) {
+		double *dag = danew + rd * g, *dMg = dM + rd * g,
+		    *dPng = dPnew + rd2 * g, *dPg = dP + rd2 * g;
+		double dresid = (g < narmag) ? 0.0 :
+		    -xreg[l + (size_t) n * (gind[g] - narma)];
+		dresid -= dag[0];
+		for (int i = 0; i < d; i++)
+		    dresid -= delta[i] * dag[r + i];
+		for (int i = 0; i < rd; i++) {
+		    double tmp = dPng[i];
+		    for (int j = 0; j < d; j++)
+			tmp += dPng[i + (r + j) * rd] * delta[j];
+		    dMg[i] = tmp;
+		}
+		double dgain = dMg[0];
+		for (int j = 0; j < d; j++) dgain += delta[j] * dMg[r + j];
+		if(gain < 1e4) {
+		    dssq[g] += (2 * resid * dresid - resid * resid * dgain / gain)
+			/ gain;
+		    dsumlog[g] += dgain / gain;
+		}
+		double *dag1 = da + rd * g;
+		for (int i = 0; i < rd; i++)
+		    dag1[i] = dag[i] + (dMg[i] * resid + M[i] * dresid
+				       - M[i] * resid * dgain / gain) / gain;
+		for (int i = 0; i < rd; i++)
+		    for (int j = 0; j < rd; j++)
+			dPg[i + j * rd] = dPng[i + j * rd]
+			    - (dMg[i] * M[j] + M[i] * dMg[j]
+			       - M[i] * M[j] * dgain / gain) / gain;
+	    }
+	    if(gain < 1e4) {
+		nu++;
+		ssq += resid * resid / gain;
+		sumlog += log(gain);
+	    }
+	    for (int i = 0; i < rd; i++)
+		a[i] = anew[i] + M[i] * resid / gain;
+	    for (int i = 0; i < rd; i++)
+		for (int j = 0; j < rd; j++)
+		    P[i + j * rd] = Pnew[i + j * rd] - M[i] * M[j] / gain;
+	} else {
+	    for (int i = 0; i < rd; i++) a[i] = anew[i];
+	    for (size_t i = 0; i < rd2; i++) P[i] = Pnew[i];
+	    for (int g = 0; g < ngrad; g++) {
+		for (int i = 0; i < rd; i++)
+		    da[i + rd * g] = danew[i + rd * g];
+		for (size_t i = 0; i < rd2; i++)
+		    dP[i + rd2 * g] = dPnew[i + rd2 * g];
+	    }
+	}
+    }
+
+    for (int g = 0; g < ngrad; g++)
+	grad[g] = 0.5 * (dssq[g] / ssq + dsumlog[g] / nu);
+    work[0] = ssq; work[1] = sumlog; work[2] = nu;
+    return 0.5 * (log(ssq / nu) + sumlog / nu);
+}
+
+/* .Call(C_ARIMA_ML, coef, mask, trans, grad, x, xreg, arma, Delta, kappa,
+         SS.G), for arima(): the objective, or its gradient w.r.t. coef[mask] */
+SEXP
+ARIMA_ML(SEXP scoef, SEXP smask, SEXP strans, SEXP sgrad, SEXP sx,
+	 SEXP sxreg, SEXP sarma, SEXP sDelta, SEXP skappa, SEXP sgardner)
+{
+    int *arma = INTEGER(sarma), n = LENGTH(sx), d = LENGTH(sDelta),
+	ncxreg = isNull(sxreg) ? 0 : ncols(sxreg), ngrad = 0,
+	narma = arma[0] + arma[1] + arma[2] + arma[3],
+	p = arma[0] + arma[4] * arma[2], q = arma[1] + arma[4] * arma[3];
+    Rboolean gardner = asLogical(sgardner), grad = asLogical(sgrad);
+
+    if (TYPEOF(scoef) != REALSXP || TYPEOF(sx) != REALSXP ||
+	TYPEOF(sDelta) != REALSXP || TYPEOF(smask) != LGLSXP ||
+	(ncxreg && TYPEOF(sxreg) != REALSXP))
+	error(_("invalid argument type"));
+    if (LENGTH(scoef) != narma + ncxreg || LENGTH(smask) != narma + ncxreg)
+	error(_("invalid argument type"));
+    if (ncxreg && nrows(sxreg) != n)
+	error(_("lengths of 'x' and 'xreg' do not match"));
+    if (arma[0] > 100 || arma[2] > 100)
+	error(_("can only transform 100 pars in arima0"));
+    if (grad)
+	for (int i = 0; i < narma + ncxreg; i++) ngrad += LOGICAL(smask)[i];
+    if ((gardner || ngrad) && max(p, q + 1) > 350)
+	error(_("maximum supported lag is 350"));
+
+    double *work = (double *)
+	R_alloc(arima_ml_lwork(arma, n, d, ncxreg, ngrad), sizeof(double));
+    int *iwork = (int *) R_alloc(arima_ml_liwork(arma, ngrad), sizeof(int));
+    SEXP res = PROTECT(allocVector(REALSXP, grad ? ngrad : 1));
+    double val = arima_ml(REAL(sx), n, ncxreg ? REAL(sxreg) : NULL, ncxreg,
+			  arma, REAL(sDelta), d, asReal(skappa), gardner,
+			  asLogical(strans), REAL(scoef), LOGICAL(smask),
+			  grad ? REAL(res) : NULL, work, iwork);
+    if (!grad) REAL(res)[0] = val;
+    else if (val == DBL_MAX)
+	for (int i = 0; i < ngrad; i++) REAL(res)[i] = NA_REAL;
+    UNPROTECT(1);
+    return res;
+}
+
+
+/* Fitting the same ARIMA model to each of many series, for arimaBatch().
+
+   Each fit follows arima(method = "CSS-ML" or "ML") with the
+   defaults (transformed AR parameters, BFGS with optim's default
+   controls), but uses the thread-safe vmmin_work() and arima_ml() so
+   that series can be fitted in parallel.  The MA parts are not made
+   invertible, which is left to the R code.
+*/
+
+/* is the AR polynomial with coefficients phi stationary?  Run the
+   Durbin-Levinson recursions backwards as in invpartrans() */
+static Rboolean ar_stationary(int p, const double *phi)
+{
+    double work[100], new[100];
+
+    for (int j = 0; j < p; j++) new[j] = phi[j];
+    for (int j = p - 1; j >= 0; j--) {
+	double a = new[j];
+	if (!(fabs(a) < 1)) return FALSE;
+	for (int k = 0; k < j; k++)
+	    work[k] = (new[k] + a * new[j - k - 1]) / (1 - a * a);
+	for (int k = 0; k < j; k++) new[k] = work[k];
+    }
+    return TRUE;
+}
+
+typedef struct {
+    const double *x, *xreg, *delta, *parscale;
+    const int *arma, *mask;
+    int n, ncxreg, d, ncond;
+    double kappa;
+    Rboolean gardner;
+    double *coef, *grad, *w, *resid, *phi, *theta, *work;
+    int *iwork;
+} arima_batch_info;
+
+static double arima_batch_css(int npar, double *b, void *ex)
+{
+    arima_batch_info *OS = (arima_batch_info *) ex;
+    const int *arma = OS->arma;
+    int narma = npar - OS->ncxreg, n = OS->n;
+
+    for (int i = 0; i < npar; i++) OS->coef[i] = b[i] * OS->parscale[i];
+    arma_expand(arma, OS->coef, NULL, OS->phi, OS->theta);
+    for (int l = 0; l < n; l++) {
+	double tmp = OS->x[l];
+	for (int j = 0; j < OS->ncxreg; j++)
+	    tmp -= OS->xreg[l + (size_t) n * j] * OS->coef[narma + j];
+	OS->w[l] = tmp;
+    }
+    return 0.5 * log(arima_css(OS->w, n, arma, OS->phi,
+			       arma[0] + arma[4] * arma[2], OS->theta,
+			       arma[1] + arma[4] * arma[3], OS->ncond,
+			       OS->resid));
+}
+
+/* by central differences with step eps, as optim() without a gradient
+   function */
+static void arima_batch_cssgr(int npar, double *b, double *df, void *ex)
+{
+    for (int i = 0; i < npar; i++) {
+	double bi = b[i], val1, val2;
+	b[i] = bi + eps;
+	val1 = arima_batch_css(npar, b, ex);
+	b[i] = bi - eps;
+	val2 = arima_batch_css(npar, b, ex);
+	df[i] = (val1 - val2) / (2 * eps);
+	b[i] = bi;
+    }
+}
+
+static double arima_batch_ml(int npar, double *b, void *ex)
+{
+    arima_batch_info *OS = (arima_batch_info *) ex;
+
+    for (int i = 0; i < npar; i++) OS->coef[i] = b[i] * OS->parscale[i];
+    return arima_ml(OS->x, OS->n, OS->xreg, OS->ncxreg, OS->arma, OS->delta,
+		    OS->d, OS->kappa, OS->gardner, TRUE, OS->coef, OS->mask,
+		    NULL, OS->work, OS->iwork);
+}
+
+static void arima_batch_mlgr(int npar, double *b, double *df, void *ex)
+{
+    arima_batch_info *OS = (arima_batch_info *) ex;
+
+    for (int i = 0; i < npar; i++) OS->coef[i] = b[i] * OS->parscale[i];
+    if (arima_ml(OS->x, OS->n, OS->xreg, OS->ncxreg, OS->arma, OS->delta,
+		 OS->d, OS->kappa, OS->gardner, TRUE, OS->coef, OS->mask,
+		 OS->grad, OS->work, OS->iwork) == DBL_MAX)
+	for (int i = 0; i < npar; i++) df[i] = 0.0;
+    else
+	for (int i = 0; i < npar; i++) df[i] = OS->grad[i] * OS->parscale[i];
+}
+
+static size_t
+arima_batch_lwork(const int *arma, int n, int d, int ncxreg)
+{
+    int npar = arma[0] + arma[1] + arma[2] + arma[3] + ncxreg,
+	p = arma[0] + arma[4] * arma[2], q = arma[1] + arma[4] * arma[3],
+	rd = max(p, q + 1) + d;
+
+    return 5 * (size_t) npar + vmmin_lwork(npar) + 2 * (size_t) n + p + q
+	+ rd + 2 * (size_t) rd * rd + arima_ml_lwork(arma, n, d, ncxreg, npar);
+}
+
+static int arima_batch_liwork(const int *arma, int ncxreg)
+{
+    int npar = arma[0] + arma[1] + arma[2] + arma[3] + ncxreg;
+    return npar + arima_ml_liwork(arma, npar);
+}
+
+/* Fit the model to x[0:(n-1)] and fill in out[ldout * (0:(ncol-1))],
+   as documented for ARIMA_batch().  init has stride ldinit, or is NULL */
+static void
+arima_batch1(const double *x, int n, const double *xreg, int ncxreg,
+	     const int *arma, const double *delta, int d, double kappa,
+	     Rboolean gardner, Rboolean css, const double *init, int ldinit,
+	     int maxit, int nahead, double *out, int ldout,
+	     double *work, int *iwork)
+{
+    int mp = arma[0], mq = arma[1], msp = arma[2],
+	narma = mp + mq + msp + arma[3], npar = narma + ncxreg,
+	p = mp + arma[4] * msp, q = mq + arma[4] * arma[3],
+	r = max(p, q + 1), rd = r + d, nobs = 0, fail, fncount, grcount;
+    size_t rd2 = (size_t) rd * rd;
+    double *par = work, *parscale = par + npar, *b = parscale + npar,
+	*coef = b + npar, *grad = coef + npar, *vwork = grad + npar,
+	*w = vwork + vmmin_lwork(npar), *resid = w + n, *phi = resid + n,
+	*theta = phi + p, *anew = theta + q, *Pnew = anew + rd,
+	*mm = Pnew + rd2, *mlwork = mm + rd2, Fmin;
+    int *mask = iwork, *mliwork = mask + npar;
+    Rboolean anyna = FALSE;
+    arima_batch_info OS = {x, xreg, delta, parscale, arma, mask, n, ncxreg,
+			   d, 0, kappa, gardner, coef, grad, w, resid, phi,
+			   theta, mlwork, mliwork};
+
+    for (int i = 0; i < npar + 4 + 2 * nahead; i++)
+	out[(size_t) ldout * i] = NA_REAL;
+    for (int l = 0; l < n; l++)
+	if (ISNAN(x[l])) anyna = TRUE; else nobs++;
+    if (nobs - d <= 0) return;
+
+    /* the starting values, as in arima(): the regression coefficient
+       (the mean) has scale 10 times its standard error */
+    for (int i = 0; i < npar; i++) {
+	mask[i] = 1;
+	par[i] = 0.0;
+	parscale[i] = 1.0;
+    }
+    if (ncxreg) {
+	double s = 0.0, s2 = 0.0;
+	for (int l = 0; l < n; l++) if (!ISNAN(x[l])) s += x[l];
+	par[narma] = (s /= nobs);
+	for (int l = 0; l < n; l++)
+	    if (!ISNAN(x[l])) s2 += (x[l] - s) * (x[l] - s);
+	double ses = (nobs > 1) ? sqrt(s2 / (nobs - 1) / nobs) : 0.0;
+	if (ses > 0) parscale[narma] = 10 * ses;
+    }
+    if (init)
+	for (int i = 0; i < npar; i++)
+	    if (!ISNAN(init[(size_t) ldinit * i]))
+		par[i] = init[(size_t) ldinit * i];
+
+    if (css && !anyna) {
+	OS.ncond = arma[5] + arma[6] * arma[4] + mp + arma[4] * msp;
+	for (int i = 0; i < npar; i++) b[i] = par[i] / parscale[i];
+	vmmin_work(npar, b, &Fmin, arima_batch_css, arima_batch_cssgr, 100,
+		   R_NegInf, sqrt(DBL_EPSILON), &OS, &fncount, &grcount,
+		   &fail, vwork);
+	if (fail == 0)
+	    for (int i = 0; i < npar; i++) par[i] = b[i] * parscale[i];
+	/* where arima() gives an error, start from zero instead */
+	if (!ar_stationary(mp, par) || !ar_stationary(msp, par + mp + mq))
+	    for (int i = 0; i < narma; i++) par[i] = 0.0;
+    }
+
+    /* maximum likelihood, on the transformed parameters */
+    for (int i = 0; i < npar; i++) coef[i] = par[i];
+    if (mp > 0) invpartrans(mp, coef, par);
+    if (msp > 0) invpartrans(msp, coef + mp + mq, par + mp + mq);
+    for (int i = 0; i < npar; i++) b[i] = par[i] / parscale[i];
+    vmmin_work(npar, b, &Fmin, arima_batch_ml, arima_batch_mlgr, maxit,
+	       R_NegInf, sqrt(DBL_EPSILON), &OS, &fncount, &grcount,
+	       &fail, vwork);
+    if (fail == 2 || !R_FINITE(Fmin) || Fmin == DBL_MAX) return;
+    for (int i = 0; i < npar; i++) par[i] = b[i] * parscale[i];
+    for (int i = 0; i < npar; i++) coef[i] = par[i];
+    if (mp > 0) partrans(mp, par, coef);
+    if (msp > 0) partrans(msp, par + mp + mq, coef + mp + mq);
+
+    /* the final state, and hence sigma^2 and the forecasts */
+    arima_ml(x, n, xreg, ncxreg, arma, delta, d, kappa, gardner, FALSE,
+	     coef, mask, NULL, mlwork, mliwork);
+    double nused = nobs - d, sigma2 = mlwork[0] / nused,
+	value = 2 * nused * Fmin + nused + nused * log(2 * M_PI),
+	*a = mlwork + 3, *P = a + rd;
+    for (int i = 0; i < npar; i++) out[(size_t) ldout * i] = coef[i];
+    out[(size_t) ldout * npar] = sigma2;
+    out[(size_t) ldout * (npar + 1)] = -0.5 * value;
+    out[(size_t) ldout * (npar + 2)] = value + 2 * npar + 2;
+    out[(size_t) ldout * (npar + 3)] = fail;
+
+    arma_expand(arma, coef, NULL, phi, theta);
+    for (int h = 0; h < nahead; h++) {
+	arima_Ta(r, d, phi, p, delta, a, anew);
+	for (int i = 0; i < rd; i++) a[i] = anew[i];
+	arima_TPT(r, d, phi, p, delta, P, mm, Pnew);
+	for (int i = 0; i <= q; i++) {
+	    double vi = (i == 0) ? 1. : theta[i - 1];
+	    for (int j = 0; j <= q; j++)
+		Pnew[i + rd * j] += vi * ((j == 0) ? 1. : theta[j - 1]);
+	}
+	for (size_t i = 0; i < rd2; i++) P[i] = Pnew[i];
+	/* Z = (1, 0, ..., 0, delta) */
+	double fc = a[0], v = P[0];
+	for (int i = 0; i < d; i++) {
+	    fc += delta[i] * a[r + i];
+	    v += 2 * delta[i] * P[r + i];
+	    for (int j = 0; j < d; j++)
+		v += delta[i] * delta[j] * P[r + i + rd * (r + j)];
+	}
+	for (int j = 0; j < ncxreg; j++) fc += coef[narma + j];
+	out[(size_t) ldout * (npar + 4 + h)] = fc;
+	out[(size_t) ldout * (npar + 4 + nahead + h)] = sqrt(v * sigma2);
+    }
+}
+
+static R_INLINE int thread_num(void)
+{
+#ifdef _OPENMP
+    return omp_get_thread_num();
+#else
+    return 0;
+#endif
+}
+
+/* .Call(C_ARIMA_batch, x, lengths, arma, Delta, include.mean, kappa,
+         SS.G, css, init, maxit, n.ahead)
+
+   Fits the model to the first lengths[j] values of each column j of
+   the matrix x.  The result has a row per series with columns the
+   coefficients, sigma2, loglik, aic, the optim() convergence code
+   and n.ahead forecasts and their standard errors: all are NA if the
+   model could not be fitted.  The rows of init, if not NULL, give
+   starting values for the coefficients, with NA for the default.
+*/
+SEXP
+ARIMA_batch(SEXP sx, SEXP slen, SEXP sarma, SEXP sDelta, SEXP smean,
+	    SEXP skappa, SEXP sgardner, SEXP scss, SEXP sinit, SEXP smaxit,
+	    SEXP snahead)
+{
+    int n = nrows(sx), m = ncols(sx), *arma = INTEGER(sarma),
+	d = LENGTH(sDelta), ncxreg = asLogical(smean) == 1,
+	maxit = asInteger(smaxit), nahead = asInteger(snahead),
+	npar = arma[0] + arma[1] + arma[2] + arma[3] + ncxreg,
+	p = arma[0] + arma[4] * arma[2], q = arma[1] + arma[4] * arma[3],
+	nthreads = 1, *len = INTEGER(slen), ldinit = 0;
+    double kappa = asReal(skappa), *x = REAL(sx), *delta = REAL(sDelta),
+	*init = NULL, *ans, *ones, *work;
+    Rboolean gardner = asLogical(sgardner), css = asLogical(scss);
+
+    if (TYPEOF(sx) != REALSXP || TYPEOF(sDelta) != REALSXP ||
+	TYPEOF(slen) != INTSXP || LENGTH(slen) != m)
+	error(_("invalid argument type"));
+    for (int j = 0; j < m; j++)
+	if (len[j] < 0 || len[j] > n) error(_("invalid '%s' argument"),
+					    "lengths");
+    if (!isNull(sinit)) {
+	if (TYPEOF(sinit) != REALSXP || nrows(sinit) != m ||
+	    ncols(sinit) != npar)
+	    error(_("'init' is of the wrong length"));
+	init = REAL(sinit);
+	ldinit = m;
+    }
+    if (arma[0] > 100 || arma[2] > 100)
+	error(_("can only transform 100 pars in arima0"));
+    if (max(p, q + 1) > 350) error(_("maximum supported lag is 350"));
+    if (nahead < 0 || nahead == NA_INTEGER)
+	error(_("invalid '%s' argument"), "n.ahead");
+    if (maxit == NA_INTEGER) error(_("invalid '%s' argument"), "maxit");
+
+    SEXP res = PROTECT(allocMatrix(REALSXP, m, npar + 4 + 2 * nahead));
+    ans = REAL(res);
+    ones = (double *) R_alloc(n, sizeof(double));
+    for (int l = 0; l < n; l++) ones[l] = 1.0;
+#ifdef _OPENMP
+    if (R_num_math_threads > 1 && m > 1)
+	nthreads = (R_num_math_threads < m) ? R_num_math_threads : m;
+#endif
+    size_t lwork = arima_batch_lwork(arma, n, d, ncxreg);
+    int liwork = arima_batch_liwork(arma, ncxreg), *iwork;
+    work = (double *) R_alloc(nthreads * lwork, sizeof(double));
+    iwork = (int *) R_alloc(nthreads * (size_t) liwork, sizeof(int));
+#ifdef _OPENMP
+# pragma omp parallel for num_threads(nthreads) schedule(dynamic) \
+    default(none) firstprivate(x, n, m, len, ones, ncxreg, arma, delta, d, \
+			       kappa, gardner, css, init, ldinit, maxit, \
+			       nahead, ans, work, iwork, lwork, liwork)
+#endif
+    for (int j = 0; j < m; j++) {
+	int t = thread_num();
+	arima_batch1(x + (size_t) n * j, len[j], ones, ncxreg, arma, delta, d,
+		     kappa, gardner, css, init ? init + j : NULL, ldinit,
+		     maxit, nahead, ans + j, m, work + lwork * t,
+		     iwork + (size_t) liwork * t);
+    }
     UNPROTECT(1);
     return res;
 }
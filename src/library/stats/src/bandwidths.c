@@ -1,7 +1,7 @@
 /*
  *  R : A Computer Language for Statistical Data Analysis
  *  bandwidth.c by W. N. Venables and B. D. Ripley  Copyright (C) 1994-2001
- *  Copyright (C) 2012-2014  The R Core Team
+ *  Copyright (C) 2012-2017  The R Core Team
  *
  *  This program is free software; you can redistribute it and/or modify
  *  it under the terms of the GNU General Public License as published by
@@ -18,11 +18,10 @@
  *  https://www.R-project.org/Licenses/
  */
 
-#include <stdlib.h> //abs
 #include <math.h>
 #include <Rinternals.h>
+#include "stats.h"
 
-// or include "stats.h"
 #ifdef ENABLE_NLS
 #include <libintl.h>
 #define _(String) dgettext ("stats", String)
@@ -48,7 +47,8 @@
 SEXP bw_ucv(SEXP sn, SEXP sd, SEXP cnt, SEXP sh)
 {
     double h = asReal(sh), d = asReal(sd), sum = 0.0, term, u;
-    int n = asInteger(sn), nbin = LENGTH(cnt), *x = INTEGER(cnt);
+    double n = asInteger(sn), *x = REAL(cnt);
+    int nbin = LENGTH(cnt);
     for (int i = 0; i < nbin; i++) {
 	double delta = i * d / h;
 	delta *= delta;
@@ -63,7 +63,8 @@ SEXP bw_ucv(SEXP sn, SEXP sd, SEXP cnt, SEXP sh)
 SEXP bw_bcv(SEXP sn, SEXP sd, SEXP cnt, SEXP sh)
 {
     double h = asReal(sh), d = asReal(sd), sum = 0.0, term, u;
-    int n = asInteger(sn), nbin = LENGTH(cnt), *x = INTEGER(cnt);
+    double n = asInteger(sn), *x = REAL(cnt);
+    int nbin = LENGTH(cnt);
 
     sum = 0.0;
     for (int i = 0; i < nbin; i++) {
@@ -79,7 +80,8 @@ SEXP bw_bcv(SEXP sn, SEXP sd, SEXP cnt, SEXP sh)
 SEXP bw_phi4(SEXP sn, SEXP sd, SEXP cnt, SEXP sh)
 {
     double h = asReal(sh), d = asReal(sd), sum = 0.0, term, u;
-    int n = asInteger(sn), nbin = LENGTH(cnt), *x = INTEGER(cnt);
+    double n = asInteger(sn), *x = REAL(cnt);
+    int nbin = LENGTH(cnt);
 
     for (int i = 0; i < nbin; i++) {
 	double delta = i * d / h; delta *= delta;
@@ -95,7 +97,8 @@ SEXP bw_phi4(SEXP sn, SEXP sd, SEXP cnt, SEXP sh)
 SEXP bw_phi6(SEXP sn, SEXP sd, SEXP cnt, SEXP sh)
 {
     double h = asReal(sh), d = asReal(sd), sum = 0.0, term, u;
-    int n = asInteger(sn), nbin = LENGTH(cnt), *x = INTEGER(cnt);
+    double n = asInteger(sn), *x = REAL(cnt);
+    int nbin = LENGTH(cnt);
 
     for (int i = 0; i < nbin; i++) {
 	double delta = i * d / h; delta *= delta;
@@ -109,7 +112,51 @@ SEXP bw_phi6(SEXP sn, SEXP sd, SEXP cnt, SEXP sh)
     return ScalarReal(u);
 }
 
-/* This would be impracticable for long vectors.  Better to bin x first */
+/* The counts cnt[k] of the pairs i < j of x values whose bins (of
+   width dd) are k apart.  The values are binned first, so with c[] the
+   bin counts cnt[0] = sum c(c-1)/2 and cnt[k] = sum_i c[i] c[i+k] is
+   their autocorrelation: computed directly for a moderate number of
+   bins and otherwise by the FFT, provided the counts are small enough
+   to be recovered exactly from it. */
+
+#define BW_FFT_MIN 2048
+
+static void bin_acf(const double *c, int nr, double *cnt, int nb)
+{
+    double n = 0;
+    for (int i = 0; i < nr; i++) n += c[i];
+    if (nr < BW_FFT_MIN || n * n > 1e12) {
+	for (int k = 0; k < nb && k < nr; k++) {
+	    double s = 0;
+	    for (int i = 0; i + k < nr; i++) s += c[i] * c[i + k];
+	    cnt[k] = s;
+	}
+    } else {
+	int L = 1;
+	fft_plan plan;
+	while (L < 2 * nr) L *= 2;
+	if (!fft_factor_r(L, &plan))
+	    error(_("fft factorization error"));
+	double *a = (double *) R_alloc(2 * (size_t) L, sizeof(double)),
+	    *b = a + L,
+	    *work = (double *) R_alloc(4 * (size_t) plan.maxf, sizeof(double));
+	int *iwork = (int *) R_alloc(plan.maxp, sizeof(int));
+	for (int i = 0; i < L; i++) {
+	    a[i] = (i < nr) ? c[i] : 0.;
+	    b[i] = 0.;
+	}
+	fft_work_r(&plan, a, b, 1, L, 1, -1, work, iwork);
+	for (int i = 0; i < L; i++) {
+	    a[i] = a[i] * a[i] + b[i] * b[i];
+	    b[i] = 0.;
+	}
+	fft_work_r(&plan, a, b, 1, L, 1, 1, work, iwork);
+	for (int k = 0; k < nb && k < nr; k++) cnt[k] = nearbyint(a[k] / L);
+    }
+    for (int k = nr; k < nb; k++) cnt[k] = 0.;
+    cnt[0] = (cnt[0] - n) / 2;	/* pairs in the same bin */
+}
+
 SEXP bw_den(SEXP nbin, SEXP sx)
 {
     int nb = asInteger(nbin), n = LENGTH(sx);
@@ -126,18 +173,16 @@ SEXP bw_den(SEXP nbin, SEXP sx)
     dd = rang / nb;
 
     SEXP ans = PROTECT(allocVector(VECSXP, 2)),
-	sc = SET_VECTOR_ELT(ans, 1, allocVector(INTSXP, nb));
+	sc = SET_VECTOR_ELT(ans, 1, allocVector(REALSXP, nb));
     SET_VECTOR_ELT(ans, 0, ScalarReal(dd));
-    int *cnt = INTEGER(sc);
-    for (int i = 0; i < nb; i++) cnt[i] = 0;
-
-    for (int i = 1; i < n; i++) {
-	int ii = (int)(x[i] / dd);
-	for (int j = 0; j < i; j++) {
-	    int jj = (int)(x[j] / dd);
-	    cnt[abs(ii - jj)]++;
-	}
-    }
+
+    /* the bins are those of (int)(x / dd), as they always have been:
+       that is monotone in x, so they run from those of xmin to xmax */
+    int imin = (int)(xmin / dd), nr = (int)(xmax / dd) - imin + 1;
+    double *c = (double *) R_alloc(nr, sizeof(double));
+    for (int i = 0; i < nr; i++) c[i] = 0.;
+    for (int i = 0; i < n; i++) c[(int)(x[i] / dd) - imin]++;
+    bin_acf(c, nr, REAL(sc), nb);
 
     UNPROTECT(1);
     return ans;
@@ -1,6 +1,6 @@
 /*
  *  R : A Computer Language for Statistical Data Analysis
- *  Copyright (C) 2001-2016  The R Core Team.
+ *  Copyright (C) 2001-2017  The R Core Team.
  *
  *  This program is free software; you can redistribute it and/or modify
  *  it under the terms of the GNU General Public License as published by
@@ -22,6 +22,11 @@
 #include <math.h>
 #include <Rmath.h>
 #include <R_ext/Random.h>
+#include <stdint.h>
+#ifdef _OPENMP
+# include <omp.h>
+# include <R_ext/MathThreads.h>
+#endif
 #include "stats.h" // for rcont2
 
 /* Driver routine to call RCONT2 from R, B times.
@@ -101,7 +106,144 @@ fisher_sim(int *nrow, int *ncol, int *nrowt, int *ncolt, int *n,
     return;
 }
 
-SEXP Fisher_sim(SEXP sr, SEXP sc, SEXP sB)
+/* Parallel simulation.  The tables are generated in blocks of
+   SIM_BLOCK, each from its own substream of L'Ecuyer's MRG32k3a (as
+   in package parallel's RngStreams) starting from a seed drawn from
+   R's RNG.  So the results depend on the seed, but not on the number
+   of threads, which is that set for R's numerical code. */
+
+#define SIM_BLOCK 256
+
+#define MRG_M1    4294967087
+#define MRG_M2    4294944443
+#define MRG_NORM 2.328306549295727688e-10
+#define MRG_A12   1403580
+#define MRG_A13N  810728
+#define MRG_A21   527612
+#define MRG_A23N  1370589
+
+typedef uint_least64_t Uint64;
+
+static const Uint64 A1p76[3][3] = {
+    {   82758667, 1871391091, 4127413238 },
+    { 3672831523,   69195019, 1871391091 },
+    { 3672091415, 3528743235,   69195019 }
+};
+
+static const Uint64 A2p76[3][3] = {
+    { 1511326704, 3759209742, 1610795712 },
+    { 4292754251, 1511326704, 3889917532 },
+    { 3859662829, 4292754251, 3708466080 }
+};
+
+/* s <- A s mod m, for the start of the next substream */
+static void matvecmod(const Uint64 A[3][3], Uint64 *s, Uint64 m)
+{
+    Uint64 x[3];
+    for (int i = 0; i < 3; i++) {
+	Uint64 tmp = 0;
+	for (int j = 0; j < 3; j++) {
+	    tmp += (A[i][j] * s[j]) % m;
+	    tmp %= m;
+	}
+	x[i] = tmp;
+    }
+    for (int i = 0; i < 3; i++) s[i] = x[i];
+}
+
+static double mrg_unif(void *state)
+{
+    int_least64_t *s = state, p1, p2;
+
+    p1 = (MRG_A12 * s[1] - MRG_A13N * s[0]) % MRG_M1;
+    if (p1 < 0) p1 += MRG_M1;
+    s[0] = s[1]; s[1] = s[2]; s[2] = p1;
+
+    p2 = (MRG_A21 * s[5] - MRG_A23N * s[3]) % MRG_M2;
+    if (p2 < 0) p2 += MRG_M2;
+    s[3] = s[4]; s[4] = s[5]; s[5] = p2;
+
+    return ((p1 > p2) ? (p1 - p2) : (p1 - p2 + MRG_M1)) * MRG_NORM;
+}
+
+/* The B statistics: Pearson's chi-squared when 'expected' is given,
+   otherwise minus the log-probability (less a constant) as for
+   Fisher's test. */
+static void
+sim_parallel(int nr, int nc, int *nrowt, int *ncolt, int n, int B,
+	     const double *expected, double *results, int nthreads)
+{
+    int nblock = (B + SIM_BLOCK - 1) / SIM_BLOCK, fail = 0;
+    double *fact = (double *) R_alloc(n + 1, sizeof(double));
+    fact[0] = fact[1] = 0.;
+    for(int i = 2; i <= n; i++)
+	fact[i] = fact[i - 1] + log(i);
+
+    /* the first substream from R's RNG, and those of the blocks */
+    int_least64_t *seeds = (int_least64_t *) R_alloc(6 * (size_t) nblock,
+						      sizeof(int_least64_t));
+    Uint64 s[6];
+    GetRNGstate();
+    for (int i = 0; i < 6; i++)
+	s[i] = (Uint64) (unif_rand() * ((i < 3) ? MRG_M1 : MRG_M2));
+    PutRNGstate();
+    if (!(s[0] || s[1] || s[2])) s[0] = 1;
+    if (!(s[3] || s[4] || s[5])) s[3] = 1;
+    for (int b = 0; b < nblock; b++) {
+	for (int i = 0; i < 6; i++) seeds[6*b + i] = (int_least64_t) s[i];
+	matvecmod(A1p76, s, MRG_M1);
+	matvecmod(A2p76, s + 3, MRG_M2);
+    }
+
+    size_t lwork = (size_t) nr * nc + nc;
+    int *iwork = (int *) R_alloc(nthreads * lwork, sizeof(int));
+#ifdef _OPENMP
+# pragma omp parallel for num_threads(nthreads) schedule(dynamic) \
+    default(none) firstprivate(nr, nc, nrowt, ncolt, n, B, expected, \
+			       results, nblock, fact, seeds, iwork, lwork) \
+    reduction(|:fail)
+#endif
+    for (int b = 0; b < nblock; b++) {
+#ifdef _OPENMP
+	int *observed = iwork + lwork * omp_get_thread_num();
+#else
+	int *observed = iwork;
+#endif
+	int *jwork = observed + (size_t) nr * nc,
+	    end = (b + 1) * SIM_BLOCK < B ? (b + 1) * SIM_BLOCK : B;
+	int_least64_t *st = seeds + 6*b;
+	for (int iter = b * SIM_BLOCK; iter < end; iter++) {
+	    if (rcont2_r(&nr, &nc, nrowt, ncolt, &n, fact, jwork, observed,
+			 mrg_unif, st)) {
+		fail = 1;
+		break;
+	    }
+	    double ans = 0.;
+	    for (int ii = 0; ii < nr * nc; ii++)
+		if (expected) {
+		    double e = expected[ii], o = observed[ii];
+		    ans += (o - e) * (o - e) / e;
+		} else ans -= fact[observed[ii]];
+	    results[iter] = ans;
+	}
+    }
+    if (fail)
+	error(_("rcont2: exp underflow to 0; algorithm failure"));
+}
+
+static int sim_nthreads(SEXP sparallel)
+{
+    int nthreads = 0; /* serial, from R's RNG */
+    if (asLogical(sparallel) == TRUE) {
+	nthreads = 1;
+#ifdef _OPENMP
+	if (R_num_math_threads > 1) nthreads = R_num_math_threads;
+#endif
+    }
+    return nthreads;
+}
+
+SEXP Fisher_sim(SEXP sr, SEXP sc, SEXP sB, SEXP sparallel)
 {
     sr = PROTECT(coerceVector(sr, INTSXP));
     sc = PROTECT(coerceVector(sc, INTSXP));
@@ -112,13 +254,18 @@ SEXP Fisher_sim(SEXP sr, SEXP sc, SEXP sB)
     double *fact = (double *) R_alloc(n+1, sizeof(double));
     int *jwork = (int *) R_alloc(nc, sizeof(int));
     SEXP ans = PROTECT(allocVector(REALSXP, B));
-    fisher_sim(&nr, &nc, isr, INTEGER(sc), &n, B, observed, fact, 
-	       jwork, REAL(ans));
+    int nthreads = sim_nthreads(sparallel);
+    if (nthreads)
+	sim_parallel(nr, nc, isr, INTEGER(sc), n, B, NULL, REAL(ans),
+		     nthreads);
+    else
+	fisher_sim(&nr, &nc, isr, INTEGER(sc), &n, B, observed, fact,
+		   jwork, REAL(ans));
     UNPROTECT(3);
     return ans;
 }
 
-SEXP chisq_sim(SEXP sr, SEXP sc, SEXP sB, SEXP E)
+SEXP chisq_sim(SEXP sr, SEXP sc, SEXP sB, SEXP E, SEXP sparallel)
 {
     sr = PROTECT(coerceVector(sr, INTSXP));
     sc = PROTECT(coerceVector(sc, INTSXP));
@@ -130,8 +277,13 @@ SEXP chisq_sim(SEXP sr, SEXP sc, SEXP sB, SEXP E)
     double *fact = (double *) R_alloc(n+1, sizeof(double));
     int *jwork = (int *) R_alloc(nc, sizeof(int));
     SEXP ans = PROTECT(allocVector(REALSXP, B));
-    chisqsim(&nr, &nc, isr, INTEGER(sc), &n, B, REAL(E), observed, fact,
-	     jwork, REAL(ans));
+    int nthreads = sim_nthreads(sparallel);
+    if (nthreads)
+	sim_parallel(nr, nc, isr, INTEGER(sc), n, B, REAL(E), REAL(ans),
+		     nthreads);
+    else
+	chisqsim(&nr, &nc, isr, INTEGER(sc), &n, B, REAL(E), observed, fact,
+		 jwork, REAL(ans));
     UNPROTECT(4);
     return ans;
 }
@@ -1,6 +1,6 @@
 /*
  *  R : A Computer Language for Statistical Data Analysis
- *  Copyright (C) 1995-2015	The R Core Team
+ *  Copyright (C) 1995-2017	The R Core Team
  *  Copyright (C) 2003		The R Foundation
  *
  *  This program is free software; you can redistribute it and/or modify
@@ -30,6 +30,11 @@
 
 #include <Defn.h>
 #include <Rmath.h>
+#include <R_ext/BLAS.h>
+#ifdef _OPENMP
+# include <omp.h>
+# include <R_ext/MathThreads.h>
+#endif
 
 #include "statsR.h"
 #undef _
@@ -69,107 +74,408 @@ SEXP cov(SEXP x, SEXP y, SEXP na_method, SEXP kendall)
    by a smartly optimizing compiler
 */
 
+/* Kendall's tau by Knight's (1966) algorithm, in O(n log n) rather than
+   O(n^2) time: with the pairs (x_k, y_k) sorted by x and then y, the
+   number of discordant pairs is the number of exchanges made by a merge
+   sort of the y values, and
+	S = sum_{k < l} sign(x_k - x_l) * sign(y_k - y_l)
+	  = n0 - n1 - n2 + n3 - 2 * exchanges
+   where n0 = n(n-1)/2 and n1, n2 and n3 are the numbers of pairs tied in
+   x, in y and in both.  The sums of sign(.)^2 are n0 - n1 and n0 - n2.
+   The counts are exact in double up to 2^53. */
+
+typedef struct {
+    double *x, *y, *t;	/* n values each */
+    int *ix, *it;	/* n indices each */
+} kendall_work;
+
+static void kendall_alloc(kendall_work *w, int n)
+{
+    w->x = (double *) R_alloc(3 * (size_t) n, sizeof(double));
+    w->y = w->x + n;
+    w->t = w->y + n;
+    w->ix = (int *) R_alloc(2 * (size_t) n, sizeof(int));
+    w->it = w->ix + n;
+}
+
+/* the number of pairs tied in sorted x[] */
+static double kendall_ties(int n, const double *x)
+{
+    double s = 0., r = 1.;
+    for (int k = 1 ; k < n ; k++)
+	if (x[k] == x[k-1]) r++;
+	else {
+	    s += r * (r - 1) / 2;
+	    r = 1.;
+	}
+    return s + r * (r - 1) / 2;
+}
+
+/* ix[] = the order of x[], ties by y[], by a stable bottom-up merge sort */
+static void kendall_order(int n, const double *x, const double *y,
+			  int *ix, int *it)
+{
+    for (int k = 0 ; k < n ; k++) ix[k] = k;
+    for (int w = 1 ; w < n ; w *= 2) {
+	for (int lo = 0 ; lo < n ; lo += 2 * w) {
+	    int mid = (lo + w < n) ? lo + w : n,
+		hi = (lo + 2 * w < n) ? lo + 2 * w : n, a = lo, b = mid, k = lo;
+	    while (a < mid && b < hi) {
+		int ia = ix[a], ib = ix[b];
+		if (x[ib] < x[ia] || (x[ib] == x[ia] && y[ib] < y[ia]))
+		    it[k++] = ix[b++];
+		else
+		    it[k++] = ix[a++];
+	    }
+	    while (a < mid) it[k++] = ix[a++];
+	    while (b < hi) it[k++] = ix[b++];
+	}
+	Memcpy(ix, it, n);
+    }
+}
+
+/* sort y[] by a merge sort, returning the number of exchanges */
+static double kendall_exchanges(int n, double *y, double *t)
+{
+    double swaps = 0.;
+    for (int w = 1 ; w < n ; w *= 2) {
+	for (int lo = 0 ; lo < n ; lo += 2 * w) {
+	    int mid = (lo + w < n) ? lo + w : n,
+		hi = (lo + 2 * w < n) ? lo + 2 * w : n, a = lo, b = mid, k = lo;
+	    while (a < mid && b < hi) {
+		if (y[b] < y[a]) {
+		    t[k++] = y[b++];
+		    swaps += mid - a;
+		} else
+		    t[k++] = y[a++];
+	    }
+	    while (a < mid) t[k++] = y[a++];
+	    while (b < hi) t[k++] = y[b++];
+	}
+	Memcpy(y, t, n);
+    }
+    return swaps;
+}
+
+/* S for the rows of xx[] and yy[] with ind[k] != 0 (all if ind is NULL)
+   and, if na, neither value NA; the sums of sign(.)^2 in *tx and *ty */
+static double kendall_sum(int n, double *xx, double *yy, int *ind,
+			  Rboolean na, kendall_work *w, double *tx, double *ty)
+{
+    int k, m = 0, *ix = w->ix;
+    double n0, n1 = 0., n2, n3 = 0., r1 = 1., r3 = 1., swaps;
+
+    for (k = 0 ; k < n ; k++)
+	if ((!ind || ind[k] != 0) && !(na && (ISNAN(xx[k]) || ISNAN(yy[k])))) {
+	    w->x[m] = xx[k];
+	    w->t[m++] = yy[k];
+	}
+    n0 = (double) m * (m - 1) / 2;
+    kendall_order(m, w->x, w->t, ix, w->it);
+    for (k = 1 ; k < m ; k++) {
+	int a = ix[k-1], b = ix[k];
+	if (w->x[a] == w->x[b]) {
+	    r1++;
+	    if (w->t[a] == w->t[b]) r3++;
+	    else {
+		n3 += r3 * (r3 - 1) / 2;
+		r3 = 1.;
+	    }
+	} else {
+	    n1 += r1 * (r1 - 1) / 2;
+	    n3 += r3 * (r3 - 1) / 2;
+	    r1 = r3 = 1.;
+	}
+    }
+    n1 += r1 * (r1 - 1) / 2;
+    n3 += r3 * (r3 - 1) / 2;
+    for (k = 0 ; k < m ; k++) w->y[k] = w->t[ix[k]];
+    swaps = kendall_exchanges(m, w->y, w->t);
+    n2 = kendall_ties(m, w->y);
+    if (tx) *tx = n0 - n1;
+    if (ty) *ty = n0 - n2;
+    return n0 - n1 - n2 + n3 - 2 * swaps;
+}
+
 /** Compute   Cov(xx[], yy[])  or  Cor(.,.)  with n = length(xx)
+ *  na: may xx[] or yy[] contain NAs?  If not, the tests are skipped.
  */
-#define COV_PAIRWISE_BODY						\
-	LDOUBLE sum, xmean = 0., ymean = 0., xsd, ysd, xm, ym;	\
-        int k, nobs, n1 = -1;	/* -Wall initializing */		\
-									\
-	    nobs = 0;							\
-	    if(!kendall) {						\
-		xmean = ymean = 0.;					\
-		for (k = 0 ; k < n ; k++) {				\
-		    if(!(ISNAN(xx[k]) || ISNAN(yy[k]))) {		\
-			nobs ++;					\
-			xmean += xx[k];					\
-			ymean += yy[k];					\
-		    }							\
-		}							\
-	    } else /*kendall*/						\
-		for (k = 0 ; k < n ; k++)				\
-		    if(!(ISNAN(xx[k]) || ISNAN(yy[k])))			\
-			nobs ++;					\
-									\
-	    if (nobs >= 2) {						\
-		xsd = ysd = sum = 0.;					\
-		if(!kendall) {						\
-		    xmean /= nobs;					\
-		    ymean /= nobs;					\
-		    n1 = nobs-1;					\
-		}							\
-		for(k=0; k < n; k++) {					\
-		    if(!(ISNAN(xx[k]) || ISNAN(yy[k]))) {		\
-			if(!kendall) {					\
-			    xm = xx[k] - xmean;				\
-			    ym = yy[k] - ymean;				\
-									\
-			    COV_SUM_UPDATE				\
-			}						\
-			else { /* Kendall's tau */			\
-			    for(n1=0 ; n1 < k ; n1++)			\
-				if(!(ISNAN(xx[n1]) || ISNAN(yy[n1]))) {	\
-				    xm = sign(xx[k] - xx[n1]);		\
-				    ym = sign(yy[k] - yy[n1]);		\
-									\
-				    COV_SUM_UPDATE			\
-				}					\
-			}						\
-		    }							\
-		}							\
-		if (cor) {						\
-		    if(xsd == 0. || ysd == 0.) {			\
-			*sd_0 = TRUE;					\
-			sum = NA_REAL;					\
-		    }							\
-		    else {						\
-			if(!kendall) {					\
-			    xsd /= n1;					\
-			    ysd /= n1;					\
-			    sum /= n1;					\
-			}						\
-			sum /= (SQRTL(xsd) * SQRTL(ysd));		\
-			sum = CLAMP(sum);				\
-		    }							\
-		}							\
-		else if(!kendall)					\
-		    sum /= n1;						\
-									\
-		ANS(i,j) = (double) sum;       				\
-	    }								\
-	    else							\
-		ANS(i,j) = NA_REAL
-
+#define PAIR_OK(_k_) (!na || !(ISNAN(xx[_k_]) || ISNAN(yy[_k_])))
 
-static void cov_pairwise1(int n, int ncx, double *x,
-			  double *ans, Rboolean *sd_0, Rboolean cor,
-			  Rboolean kendall)
+static double cov_pair(int n, double *xx, double *yy, Rboolean na,
+		       int *sd_0, Rboolean cor, Rboolean kendall,
+		       kendall_work *kw)
 {
-    for (int i = 0 ; i < ncx ; i++) {
-	double *xx = &x[i * n];
-	for (int j = 0 ; j <= i ; j++) {
-	    double *yy = &x[j * n];
+    LDOUBLE sum, xmean = 0., ymean = 0., xsd, ysd, xm, ym;
+    int k, nobs, n1 = -1;   /* -Wall initializing */
 
-	    COV_PAIRWISE_BODY;
+    nobs = 0;
+    if(!kendall) {
+	xmean = ymean = 0.;
+	for (k = 0 ; k < n ; k++) {
+	    if(PAIR_OK(k)) {
+		nobs ++;
+		xmean += xx[k];
+		ymean += yy[k];
+	    }
+	}
+    } else /*kendall*/
+	for (k = 0 ; k < n ; k++)
+	    if(PAIR_OK(k))
+		nobs ++;
 
-	    ANS(j,i) = ANS(i,j);
+    if (nobs >= 2) {
+	xsd = ysd = sum = 0.;
+	if(!kendall) {
+	    xmean /= nobs;
+	    ymean /= nobs;
+	    n1 = nobs-1;
+	    for(k=0; k < n; k++) {
+		if(PAIR_OK(k)) {
+		    xm = xx[k] - xmean;
+		    ym = yy[k] - ymean;
+
+		    COV_SUM_UPDATE
+		}
+	    }
+	}
+	else { /* Kendall's tau */
+	    double tx, ty;
+	    sum = kendall_sum(n, xx, yy, NULL, na, kw, &tx, &ty);
+	    xsd = tx;
+	    ysd = ty;
 	}
+	if (cor) {
+	    if(xsd == 0. || ysd == 0.) {
+		*sd_0 = TRUE;
+		sum = NA_REAL;
+	    }
+	    else {
+		if(!kendall) {
+		    xsd /= n1;
+		    ysd /= n1;
+		    sum /= n1;
+		}
+		sum /= (SQRTL(xsd) * SQRTL(ysd));
+		sum = CLAMP(sum);
+	    }
+	}
+	else if(!kendall)
+	    sum /= n1;
+
+	return (double) sum;
+    }
+    else
+	return NA_REAL;
+}
+#undef PAIR_OK
+
+/* The pairs of columns are computed in tiles of COV_BLOCK x COV_BLOCK
+   columns, which stay in cache while they are used, and in parallel
+   over the columns of tiles for large problems.  Whether a column has
+   NAs is found once, so pairs of columns without NAs skip the tests. */
+
+#define COV_BLOCK 16
+#define COV_THREADS_MIN 1e6
+
+static int cov_nthreads(int n, int ncx, int ncy)
+{
+#ifdef _OPENMP
+    if (R_num_math_threads > 1 && (double) n * ncx * ncy >= COV_THREADS_MIN)
+	return R_num_math_threads;
+#endif
+    return 1;
+}
+
+/* workspace for Kendall's tau for each of nthreads threads */
+static kendall_work *kendall_works(int n, int nthreads, Rboolean kendall)
+{
+    kendall_work *kw = NULL;
+    if (kendall) {
+	kw = (kendall_work *) R_alloc(nthreads, sizeof(kendall_work));
+	for (int t = 0 ; t < nthreads ; t++)
+	    kendall_alloc(&kw[t], n);
+    }
+    return kw;
+}
+
+static R_INLINE int thread_num(void)
+{
+#ifdef _OPENMP
+    return omp_get_thread_num();
+#else
+    return 0;
+#endif
+}
+
+static int *col_has_na(int n, int nc, double *x)
+{
+    int *has_na = (int *) R_alloc(nc, sizeof(int));
+    for (int j = 0 ; j < nc ; j++) {
+	double *z = &x[(size_t) j * n];
+	has_na[j] = 0;
+	for (int k = 0 ; k < n ; k++)
+	    if (ISNAN(z[k])) {
+		has_na[j] = 1; break;
+	    }
     }
+    return has_na;
+}
+
+static void cov_pairwise1(int n, int ncx, double *x,
+			  double *ans, Rboolean *sd_0, Rboolean cor,
+			  Rboolean kendall)
+{
+    int *has_na = col_has_na(n, ncx, x), nb = (ncx + COV_BLOCK - 1) / COV_BLOCK,
+	nthreads = cov_nthreads(n, ncx, ncx), sd0 = 0, jb;
+    kendall_work *kw = kendall_works(n, nthreads, kendall);
+
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(nthreads) default(none)	\
+    schedule(dynamic) private(jb) reduction(|:sd0)		\
+    firstprivate(n, ncx, x, ans, cor, kendall, has_na, nb, kw)
+#endif
+    for (jb = 0 ; jb < nb ; jb++)
+	for (int ib = jb ; ib < nb ; ib++)
+	    for (int i = ib * COV_BLOCK ;
+		 i < ncx && i < (ib + 1) * COV_BLOCK ; i++) {
+		double *xx = &x[(size_t) i * n];
+		for (int j = jb * COV_BLOCK ;
+		     j <= i && j < (jb + 1) * COV_BLOCK ; j++) {
+		    double *yy = &x[(size_t) j * n];
+		    ANS(i,j) = cov_pair(n, xx, yy, has_na[i] || has_na[j],
+					&sd0, cor, kendall,
+					kw ? &kw[thread_num()] : NULL);
+		    ANS(j,i) = ANS(i,j);
+		}
+	    }
+    if (sd0) *sd_0 = TRUE;
 }
 
 static void cov_pairwise2(int n, int ncx, int ncy, double *x, double *y,
 			  double *ans, Rboolean *sd_0, Rboolean cor,
 			  Rboolean kendall)
 {
-    for (int i = 0 ; i < ncx ; i++) {
-	double *xx = &x[i * n];
-	for (int j = 0 ; j < ncy ; j++) {
-	    double *yy = &y[j * n];
+    int *has_na_x = col_has_na(n, ncx, x), *has_na_y = col_has_na(n, ncy, y),
+	nbx = (ncx + COV_BLOCK - 1) / COV_BLOCK,
+	nby = (ncy + COV_BLOCK - 1) / COV_BLOCK,
+	nthreads = cov_nthreads(n, ncx, ncy), sd0 = 0, jb;
+    kendall_work *kw = kendall_works(n, nthreads, kendall);
+
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(nthreads) default(none)	\
+    schedule(dynamic) private(jb) reduction(|:sd0)		\
+    firstprivate(n, ncx, ncy, x, y, ans, cor, kendall,		\
+		 has_na_x, has_na_y, nbx, nby, kw)
+#endif
+    for (jb = 0 ; jb < nby ; jb++)
+	for (int ib = 0 ; ib < nbx ; ib++)
+	    for (int i = ib * COV_BLOCK ;
+		 i < ncx && i < (ib + 1) * COV_BLOCK ; i++) {
+		double *xx = &x[(size_t) i * n];
+		for (int j = jb * COV_BLOCK ;
+		     j < ncy && j < (jb + 1) * COV_BLOCK ; j++) {
+		    double *yy = &y[(size_t) j * n];
+		    ANS(i,j) = cov_pair(n, xx, yy, has_na_x[i] || has_na_y[j],
+					&sd0, cor, kendall,
+					kw ? &kw[thread_num()] : NULL);
+		}
+	    }
+    if (sd0) *sd_0 = TRUE;
+}
+
 
-	    COV_PAIRWISE_BODY;
+/* Covariances of the rows with ind[k] != 0 (all rows if ind is NULL)
+ * from the crossproduct of the data centred by the column means, by
+ * dsyrk (y = NULL) or dgemm: the columns are centred once, rather than
+ * for each pair, and the BLAS blocks (and perhaps threads) the
+ * computation.  Used for at least COV_GEMM_MIN pairs; columns with
+ * has_na[j] != 0 give NA.
+ */
+#define COV_GEMM_MIN 1024
+
+static double *cov_centre(int n, int nobs, int nc, double *x, double *xm,
+			  int *ind, int *has_na)
+{
+    double *xc = (double *) R_alloc((size_t) nobs * nc, sizeof(double));
+    for (int j = 0 ; j < nc ; j++) {
+	double *xx = &x[(size_t) j * n], *cc = &xc[(size_t) j * nobs],
+	    m = xm[j];
+	if (has_na && has_na[j])
+	    for (int k = 0 ; k < nobs ; k++) cc[k] = 0.;
+	else
+	    for (int k = 0, l = 0 ; k < n ; k++)
+		if (!ind || ind[k] != 0) cc[l++] = xx[k] - m;
+    }
+    return xc;
+}
+
+static void
+cov_crossprod(int n, int ncx, int ncy, double *x, double *y,
+	      double *xm, double *ym, int *ind, int *has_na_x, int *has_na_y,
+	      int n1, double *ans)
+{
+    int i, j, k, nobs = 0;
+    double alpha = 1. / n1, zero = 0., *xc, *yc;
+
+    for (k = 0 ; k < n ; k++)
+	if (!ind || ind[k] != 0) nobs++;
+    xc = cov_centre(n, nobs, ncx, x, xm, ind, has_na_x);
+    if (!y) {
+	F77_CALL(dsyrk)("U", "T", &ncx, &nobs, &alpha, xc, &nobs,
+			&zero, ans, &ncx);
+	for (i = 0 ; i < ncx ; i++)
+	    for (j = 0 ; j < i ; j++)
+		ANS(i,j) = ANS(j,i);
+	has_na_y = has_na_x;
+    } else {
+	yc = cov_centre(n, nobs, ncy, y, ym, ind, has_na_y);
+	F77_CALL(dgemm)("T", "N", &ncx, &ncy, &nobs, &alpha, xc, &nobs,
+			yc, &nobs, &zero, ans, &ncx);
+    }
+    if (has_na_x)
+	for (i = 0 ; i < ncx ; i++)
+	    if (has_na_x[i])
+		for (j = 0 ; j < ncy ; j++) ANS(i,j) = NA_REAL;
+    if (has_na_y)
+	for (j = 0 ; j < ncy ; j++)
+	    if (has_na_y[j])
+		for (i = 0 ; i < ncx ; i++) ANS(i,j) = NA_REAL;
+}
+
+
+/* Kendall's S, summed over ordered pairs of the rows with ind[k] != 0
+ * (all rows if ind is NULL), for each pair of columns, in parallel over
+ * the columns of x for large problems; columns with has_na[j] != 0 give
+ * NA.  y = NULL for x with itself.
+ */
+static void
+cov_kendall(int n, int ncx, int ncy, double *x, double *y, int *ind,
+	    int *has_na_x, int *has_na_y, double *ans)
+{
+    int nthreads = cov_nthreads(n, ncx, ncy), i;
+    kendall_work *kw = kendall_works(n, nthreads, TRUE);
+    double na = NA_REAL;
+
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(nthreads) default(none)	\
+    schedule(dynamic) private(i)				\
+    firstprivate(n, ncx, ncy, x, y, ind, has_na_x, has_na_y, ans, kw, na)
+#endif
+    for (i = 0 ; i < ncx ; i++) {
+	kendall_work *w = &kw[thread_num()];
+	double *xx = &x[(size_t) i * n];
+	for (int j = 0 ; j < (y ? ncy : i + 1) ; j++) {
+	    double *yy = y ? &y[(size_t) j * n] : &x[(size_t) j * n];
+	    if ((has_na_x && has_na_x[i]) || (has_na_y && has_na_y[j]))
+		ANS(i,j) = na;
+	    else
+		ANS(i,j) = 2 * kendall_sum(n, xx, yy, ind, FALSE, w,
+					   NULL, NULL);
+	    if (!y) ANS(j,i) = ANS(i,j);
 	}
     }
 }
-#undef COV_PAIRWISE_BODY
 
 
 /* method = "complete" or "all.obs" (only difference: na_fail):
@@ -257,33 +563,23 @@ cov_complete1(int n, int ncx, double *x, double *xm,
 	MEAN(x);/* -> xm[] */
 	n1 = nobs - 1;
     }
+    if (kendall)
+	cov_kendall(n, ncx, ncx, x, NULL, ind, NULL, NULL, ans);
+    else if ((double) ncx * ncx >= COV_GEMM_MIN)
+	cov_crossprod(n, ncx, ncx, x, NULL, xm, NULL, ind, NULL, NULL,
+		      n1, ans);
+    else
     for (i = 0 ; i < ncx ; i++) {
 	xx = &x[i * n];
-
-	if(!kendall) {
-	    xxm = xm[i];
-	    for (j = 0 ; j <= i ; j++) {
-		yy = &x[j * n];
-		yym = xm[j];
-		sum = 0.;
-		for (k = 0 ; k < n ; k++)
-		    if (ind[k] != 0)
-			sum += (xx[k] - xxm) * (yy[k] - yym);
-		ANS(j,i) = ANS(i,j) = (double)(sum / n1);
-	    }
-	}
-	else { /* Kendall's tau */
-	    for (j = 0 ; j <= i ; j++) {
-		yy = &x[j * n];
-		sum = 0.;
-		for (k = 0 ; k < n ; k++)
-		    if (ind[k] != 0)
-			for (n1 = 0 ; n1 < n ; n1++)
-			    if (ind[n1] != 0)
-				sum += sign(xx[k] - xx[n1])
-				     * sign(yy[k] - yy[n1]);
-		ANS(j,i) = ANS(i,j) = (double)sum;
-	    }
+	xxm = xm[i];
+	for (j = 0 ; j <= i ; j++) {
+	    yy = &x[j * n];
+	    yym = xm[j];
+	    sum = 0.;
+	    for (k = 0 ; k < n ; k++)
+		if (ind[k] != 0)
+		    sum += (xx[k] - xxm) * (yy[k] - yym);
+	    ANS(j,i) = ANS(i,j) = (double)(sum / n1);
 	}
     }
 
@@ -318,6 +614,12 @@ cov_na_1(int n, int ncx, double *x, double *xm,
 	MEAN_(x, has_na);/* -> xm[] */
 	n1 = n - 1;
     }
+    if (kendall)
+	cov_kendall(n, ncx, ncx, x, NULL, NULL, has_na, has_na, ans);
+    else if ((double) ncx * ncx >= COV_GEMM_MIN)
+	cov_crossprod(n, ncx, ncx, x, NULL, xm, NULL, NULL, has_na, NULL,
+		      n1, ans);
+    else
     for (i = 0 ; i < ncx ; i++) {
 	if(has_na[i]) {
 	    for (j = 0 ; j <= i ; j++)
@@ -325,34 +627,18 @@ cov_na_1(int n, int ncx, double *x, double *xm,
 	}
 	else {
 	    xx = &x[i * n];
-
-	    if(!kendall) {
-		xxm = xm[i];
-		for (j = 0 ; j <= i ; j++)
-		    if(has_na[j]) {
-			ANS(j,i) = ANS(i,j) = NA_REAL;
-		    } else {
-			yy = &x[j * n];
-			yym = xm[j];
-			sum = 0.;
-			for (k = 0 ; k < n ; k++)
-			    sum += (xx[k] - xxm) * (yy[k] - yym);
-			ANS(j,i) = ANS(i,j) = (double)(sum / n1);
-		    }
-	    }
-	    else { /* Kendall's tau */
-		for (j = 0 ; j <= i ; j++)
-		    if(has_na[j]) {
-			ANS(j,i) = ANS(i,j) = NA_REAL;
-		    } else {
-			yy = &x[j * n];
-			sum = 0.;
-			for (k = 0 ; k < n ; k++)
-			    for (n1 = 0 ; n1 < n ; n1++)
-				sum += sign(xx[k] - xx[n1]) * sign(yy[k] - yy[n1]);
-			ANS(j,i) = ANS(i,j) = (double)sum;
-		    }
-	    }
+	    xxm = xm[i];
+	    for (j = 0 ; j <= i ; j++)
+		if(has_na[j]) {
+		    ANS(j,i) = ANS(i,j) = NA_REAL;
+		} else {
+		    yy = &x[j * n];
+		    yym = xm[j];
+		    sum = 0.;
+		    for (k = 0 ; k < n ; k++)
+			sum += (xx[k] - xxm) * (yy[k] - yym);
+		    ANS(j,i) = ANS(i,j) = (double)(sum / n1);
+		}
 	}
     }
 
@@ -387,36 +673,30 @@ cov_complete2(int n, int ncx, int ncy, double *x, double *y,
 	MEAN(y);/* -> ym[] */
 	n1 = nobs - 1;
     }
+    if (kendall)
+	cov_kendall(n, ncx, ncy, x, y, ind, NULL, NULL, ans);
+    else if ((double) ncx * ncy >= COV_GEMM_MIN)
+	cov_crossprod(n, ncx, ncy, x, y, xm, ym, ind, NULL, NULL,
+		      n1, ans);
+    else
     for (i = 0 ; i < ncx ; i++) {
 	xx = &x[i * n];
-	if(!kendall) {
-	    xxm = xm[i];
-	    for (j = 0 ; j < ncy ; j++) {
-		yy = &y[j * n];
-		yym = ym[j];
-		sum = 0.;
-		for (k = 0 ; k < n ; k++)
-		    if (ind[k] != 0)
-			sum += (xx[k] - xxm) * (yy[k] - yym);
-		ANS(i,j) = (double)(sum / n1);
-	    }
-	}
-	else { /* Kendall's tau */
-	    for (j = 0 ; j < ncy ; j++) {
-		yy = &y[j * n];
-		sum = 0.;
-		for (k = 0 ; k < n ; k++)
-		    if (ind[k] != 0)
-			for (n1 = 0 ; n1 < n ; n1++)
-			    if (ind[n1] != 0)
-				sum += sign(xx[k] - xx[n1])
- 				    * sign(yy[k] - yy[n1]);
-		ANS(i,j) = (double)sum;
-	    }
+	xxm = xm[i];
+	for (j = 0 ; j < ncy ; j++) {
+	    yy = &y[j * n];
+	    yym = ym[j];
+	    sum = 0.;
+	    for (k = 0 ; k < n ; k++)
+		if (ind[k] != 0)
+		    sum += (xx[k] - xxm) * (yy[k] - yym);
+	    ANS(i,j) = (double)(sum / n1);
 	}
     }
 
     if (cor) {
+	double tx;
+	kendall_work kw;
+	if (kendall) kendall_alloc(&kw, n);
 
 #define COV_SDEV(_X_)							\
 	for (i = 0 ; i < nc##_X_ ; i++) { /* Var(X[i]) */		\
@@ -429,12 +709,9 @@ cov_complete2(int n, int ncx, int ncy, double *x, double *y,
 			sum += (xx[k] - xxm) * (xx[k] - xxm);		\
 		sum /= n1;						\
 	    }								\
-	    else { /* Kendall's tau */					\
-		for (k = 0 ; k < n ; k++)				\
-		    if (ind[k] != 0)					\
-			for (n1 = 0 ; n1 < n ; n1++)			\
-			    if (ind[n1] != 0 &&	 xx[k] != xx[n1])	\
-				sum ++; /* = sign(. - .)^2 */		\
+	    else { /* Kendall's tau: twice the pairs not tied */	\
+		kendall_sum(n, xx, xx, ind, FALSE, &kw, &tx, NULL);	\
+		sum = 2 * tx; /* = sum sign(. - .)^2 */			\
 	    }								\
 	    _X_##m [i] = (double)SQRTL(sum);				\
 	}
@@ -469,6 +746,12 @@ cov_na_2(int n, int ncx, int ncy, double *x, double *y,
 	MEAN_(y, has_na_y);/* -> ym[] */
 	n1 = n - 1;
     }
+    if (kendall)
+	cov_kendall(n, ncx, ncy, x, y, NULL, has_na_x, has_na_y, ans);
+    else if ((double) ncx * ncy >= COV_GEMM_MIN)
+	cov_crossprod(n, ncx, ncy, x, y, xm, ym, NULL, has_na_x, has_na_y,
+		      n1, ans);
+    else
     for (i = 0 ; i < ncx ; i++) {
 	if(has_na_x[i]) {
 	    for (j = 0 ; j < ncy; j++)
@@ -476,37 +759,25 @@ cov_na_2(int n, int ncx, int ncy, double *x, double *y,
 	}
 	else {
 	    xx = &x[i * n];
-	    if(!kendall) {
-		xxm = xm[i];
-		for (j = 0 ; j < ncy ; j++)
-		    if(has_na_y[j]) {
-			ANS(i,j) = NA_REAL;
-		    } else {
-			yy = &y[j * n];
-			yym = ym[j];
-			sum = 0.;
-			for (k = 0 ; k < n ; k++)
-			    sum += (xx[k] - xxm) * (yy[k] - yym);
-			ANS(i,j) = (double)(sum / n1);
-		    }
-	    }
-	    else { /* Kendall's tau */
-		for (j = 0 ; j < ncy ; j++)
-		    if(has_na_y[j]) {
-			ANS(i,j) = NA_REAL;
-		    } else {
-			yy = &y[j * n];
-			sum = 0.;
-			for (k = 0 ; k < n ; k++)
-			    for (n1 = 0 ; n1 < n ; n1++)
-				sum += sign(xx[k] - xx[n1]) * sign(yy[k] - yy[n1]);
-			ANS(i,j) = (double)sum;
-		    }
-	    }
+	    xxm = xm[i];
+	    for (j = 0 ; j < ncy ; j++)
+		if(has_na_y[j]) {
+		    ANS(i,j) = NA_REAL;
+		} else {
+		    yy = &y[j * n];
+		    yym = ym[j];
+		    sum = 0.;
+		    for (k = 0 ; k < n ; k++)
+			sum += (xx[k] - xxm) * (yy[k] - yym);
+		    ANS(i,j) = (double)(sum / n1);
+		}
 	}
     }
 
     if (cor) {
+	double tx;
+	kendall_work kw;
+	if (kendall) kendall_alloc(&kw, n);
 
 #define COV_SDEV(_X_)							\
 	for (i = 0 ; i < nc##_X_ ; i++) 				\
@@ -519,11 +790,9 @@ cov_na_2(int n, int ncx, int ncy, double *x, double *y,
 			sum += (xx[k] - xxm) * (xx[k] - xxm);		\
 		    sum /= n1;						\
 		}							\
-		else { /* Kendall's tau */				\
-		    for (k = 0 ; k < n ; k++)				\
-			for (n1 = 0 ; n1 < n ; n1++)			\
-			    if (xx[k] != xx[n1])			\
-				sum ++; /* = sign(. - .)^2 */		\
+		else { /* Kendall's tau: twice the pairs not tied */	\
+		    kendall_sum(n, xx, xx, NULL, FALSE, &kw, &tx, NULL);	\
+		    sum = 2 * tx; /* = sum sign(. - .)^2 */		\
 		}							\
 		_X_##m [i] = (double) SQRTL(sum);			\
 	    }
@@ -27,6 +27,7 @@
 
 #include <R.h>
 #include <Rmath.h>
+#include <R_ext/BLAS.h>
 #include "stats.h"
 #ifdef _OPENMP
 # include <R_ext/MathThreads.h>
@@ -39,7 +40,12 @@
 #define both_non_NA(a,b) (!ISNAN(a) && !ISNAN(b))
 #endif
 
-static double R_euclidean(double *x, int nr, int nc, int i1, int i2)
+/* The kernels take two observations, as contiguous vectors of length
+   nc: R_distance works on the transpose of x, so that each pair is
+   read with unit stride.  The _finite versions are used when x has no
+   missing or infinite values, and so need no tests per element. */
+
+static double R_euclidean(const double *x1, const double *x2, int nc)
 {
     double dev, dist;
     int count, j;
@@ -47,22 +53,30 @@ static double R_euclidean(double *x, int nr, int nc, int i1, int i2)
     count= 0;
     dist = 0;
     for(j = 0 ; j < nc ; j++) {
-	if(both_non_NA(x[i1], x[i2])) {
-	    dev = (x[i1] - x[i2]);
+	if(both_non_NA(x1[j], x2[j])) {
+	    dev = (x1[j] - x2[j]);
 	    if(!ISNAN(dev)) {
 		dist += dev * dev;
 		count++;
 	    }
 	}
-	i1 += nr;
-	i2 += nr;
     }
     if(count == 0) return NA_REAL;
     if(count != nc) dist /= ((double)count/nc);
     return sqrt(dist);
 }
 
-static double R_maximum(double *x, int nr, int nc, int i1, int i2)
+static double R_euclidean_finite(const double *x1, const double *x2, int nc)
+{
+    double dev, dist = 0;
+    for(int j = 0 ; j < nc ; j++) {
+	dev = (x1[j] - x2[j]);
+	dist += dev * dev;
+    }
+    return (nc > 0) ? sqrt(dist) : NA_REAL;
+}
+
+static double R_maximum(const double *x1, const double *x2, int nc)
 {
     double dev, dist;
     int count, j;
@@ -70,22 +84,31 @@ static double R_maximum(double *x, int nr, int nc, int i1, int i2)
     count = 0;
     dist = -DBL_MAX;
     for(j = 0 ; j < nc ; j++) {
-	if(both_non_NA(x[i1], x[i2])) {
-	    dev = fabs(x[i1] - x[i2]);
+	if(both_non_NA(x1[j], x2[j])) {
+	    dev = fabs(x1[j] - x2[j]);
 	    if(!ISNAN(dev)) {
 		if(dev > dist)
 		    dist = dev;
 		count++;
 	    }
 	}
-	i1 += nr;
-	i2 += nr;
     }
     if(count == 0) return NA_REAL;
     return dist;
 }
 
-static double R_manhattan(double *x, int nr, int nc, int i1, int i2)
+static double R_maximum_finite(const double *x1, const double *x2, int nc)
+{
+    double dev, dist = -DBL_MAX;
+    for(int j = 0 ; j < nc ; j++) {
+	dev = fabs(x1[j] - x2[j]);
+	if(dev > dist)
+	    dist = dev;
+    }
+    return (nc > 0) ? dist : NA_REAL;
+}
+
+static double R_manhattan(const double *x1, const double *x2, int nc)
 {
     double dev, dist;
     int count, j;
@@ -93,22 +116,28 @@ static double R_manhattan(double *x, int nr, int nc, int i1, int i2)
     count = 0;
     dist = 0;
     for(j = 0 ; j < nc ; j++) {
-	if(both_non_NA(x[i1], x[i2])) {
-	    dev = fabs(x[i1] - x[i2]);
+	if(both_non_NA(x1[j], x2[j])) {
+	    dev = fabs(x1[j] - x2[j]);
 	    if(!ISNAN(dev)) {
 		dist += dev;
 		count++;
 	    }
 	}
-	i1 += nr;
-	i2 += nr;
     }
     if(count == 0) return NA_REAL;
     if(count != nc) dist /= ((double)count/nc);
     return dist;
 }
 
-static double R_canberra(double *x, int nr, int nc, int i1, int i2)
+static double R_manhattan_finite(const double *x1, const double *x2, int nc)
+{
+    double dist = 0;
+    for(int j = 0 ; j < nc ; j++)
+	dist += fabs(x1[j] - x2[j]);
+    return (nc > 0) ? dist : NA_REAL;
+}
+
+static double R_canberra(const double *x1, const double *x2, int nc)
 {
     double dev, dist, sum, diff;
     int count, j;
@@ -116,9 +145,9 @@ static double R_canberra(double *x, int nr, int nc, int i1, int i2)
     count = 0;
     dist = 0;
     for(j = 0 ; j < nc ; j++) {
-	if(both_non_NA(x[i1], x[i2])) {
-	    sum = fabs(x[i1] + x[i2]);
-	    diff = fabs(x[i1] - x[i2]);
+	if(both_non_NA(x1[j], x2[j])) {
+	    sum = fabs(x1[j] + x2[j]);
+	    diff = fabs(x1[j] - x2[j]);
 	    if (sum > DBL_MIN || diff > DBL_MIN) {
 		dev = diff/sum;
 		if(!ISNAN(dev) ||
@@ -129,15 +158,13 @@ static double R_canberra(double *x, int nr, int nc, int i1, int i2)
 		}
 	    }
 	}
-	i1 += nr;
-	i2 += nr;
     }
     if(count == 0) return NA_REAL;
     if(count != nc) dist /= ((double)count/nc);
     return dist;
 }
 
-static double R_dist_binary(double *x, int nr, int nc, int i1, int i2)
+static double R_dist_binary(const double *x1, const double *x2, int nc)
 {
     int total, count, dist;
     int j;
@@ -147,20 +174,18 @@ static double R_dist_binary(double *x, int nr, int nc, int i1, int i2)
     dist = 0;
 
     for(j = 0 ; j < nc ; j++) {
-	if(both_non_NA(x[i1], x[i2])) {
-	    if(!both_FINITE(x[i1], x[i2])) {
+	if(both_non_NA(x1[j], x2[j])) {
+	    if(!both_FINITE(x1[j], x2[j])) {
 		warning(_("treating non-finite values as NA"));
 	    }
 	    else {
-		if(x[i1] != 0. || x[i2] != 0.) {
+		if(x1[j] != 0. || x2[j] != 0.) {
 		    count++;
-		    if( ! (x[i1] != 0. && x[i2] != 0.) ) dist++;
+		    if( ! (x1[j] != 0. && x2[j] != 0.) ) dist++;
 		}
 		total++;
 	    }
 	}
-	i1 += nr;
-	i2 += nr;
     }
 
     if(total == 0) return NA_REAL;
@@ -168,7 +193,7 @@ static double R_dist_binary(double *x, int nr, int nc, int i1, int i2)
     return (double) dist / count;
 }
 
-static double R_minkowski(double *x, int nr, int nc, int i1, int i2, double p)
+static double R_minkowski(const double *x1, const double *x2, int nc, double p)
 {
     double dev, dist;
     int count, j;
@@ -176,43 +201,182 @@ static double R_minkowski(double *x, int nr, int nc, int i1, int i2, double p)
     count= 0;
     dist = 0;
     for(j = 0 ; j < nc ; j++) {
-	if(both_non_NA(x[i1], x[i2])) {
-	    dev = (x[i1] - x[i2]);
+	if(both_non_NA(x1[j], x2[j])) {
+	    dev = (x1[j] - x2[j]);
 	    if(!ISNAN(dev)) {
 		dist += R_pow(fabs(dev), p);
 		count++;
 	    }
 	}
-	i1 += nr;
-	i2 += nr;
     }
     if(count == 0) return NA_REAL;
     if(count != nc) dist /= ((double)count/nc);
     return R_pow(dist, 1.0/p);
 }
 
+static double R_minkowski_finite(const double *x1, const double *x2, int nc,
+				 double p)
+{
+    double dist = 0;
+    for(int j = 0 ; j < nc ; j++)
+	dist += R_pow(fabs(x1[j] - x2[j]), p);
+    return (nc > 0) ? R_pow(dist, 1.0/p) : NA_REAL;
+}
+
 enum { EUCLIDEAN=1, MAXIMUM, MANHATTAN, CANBERRA, BINARY, MINKOWSKI };
 /* == 1,2,..., defined by order in the R function dist */
 
+/* The pairs are computed in tiles of DIST_BLOCK x DIST_BLOCK
+   observations, which stay in cache while they are used, and the tiles
+   of a column of tiles are computed by one thread: the columns are
+   handed out dynamically, as they have different numbers of tiles.
+
+   Euclidean distances of finite data with at least DIST_GEMM_MIN
+   variables are computed from the inner products of the observations,
+   ||x_i - x_j||^2 = ||x_i||^2 + ||x_j||^2 - 2 x_i'x_j, a tile of which
+   is computed by dgemm, after centring the variables.  Where this
+   cancels to less than DIST_GEMM_TOL of ||x_i||^2 + ||x_j||^2 the
+   distance is computed directly, so the relative error is no more
+   than a few times DBL_EPSILON / DIST_GEMM_TOL.  Any threading is
+   then that of the BLAS. */
+
+#define DIST_BLOCK 64
+#define DIST_GEMM_MIN 32
+#define DIST_GEMM_TOL 1e-4
+#define DIST_GEMM_NB 512
+
+typedef double (*R_distfun)(const double*, const double*, int);
+
+/* the index in d of the pair (i, j), i >= j + dc */
+static R_INLINE size_t dist_index(int i, int j, int nr, int dc)
+{
+    return (size_t) j * (nr - dc) + j - ((1 + (size_t) j) * j) / 2 + i - j - dc;
+}
+
+static void dist_tile(const double *t, int nr, int nc, double *d, int dc,
+		      int method, R_distfun distfun, double p, int finite,
+		      int i0, int i1, int j0, int j1)
+{
+    for(int j = j0 ; j < j1 ; j++) {
+	int i = (i0 > j + dc) ? i0 : j + dc;
+	if(i >= i1) continue;
+	size_t ij = dist_index(i, j, nr, dc);
+	const double *xj = t + (size_t) j * nc;
+	for( ; i < i1 ; i++) {
+	    const double *xi = t + (size_t) i * nc;
+	    if(method != MINKOWSKI)
+		d[ij++] = distfun(xi, xj, nc);
+	    else if(finite)
+		d[ij++] = R_minkowski_finite(xi, xj, nc, p);
+	    else
+		d[ij++] = R_minkowski(xi, xj, nc, p);
+	}
+    }
+}
+
+static void dist_euclidean_gemm(double *t, int nr, int nc, double *d, int dc)
+{
+    double one = 1.0, zero = 0.0,
+	*nrm = (double *) R_alloc(nr, sizeof(double)),
+	*mu = (double *) R_alloc(nc, sizeof(double)),
+	*g = (double *) R_alloc((size_t) DIST_GEMM_NB * DIST_BLOCK,
+				sizeof(double));
+
+    for(int k = 0 ; k < nc ; k++) mu[k] = 0.;
+    for(int i = 0 ; i < nr ; i++)
+	for(int k = 0 ; k < nc ; k++) mu[k] += t[(size_t) i * nc + k];
+    for(int k = 0 ; k < nc ; k++) mu[k] /= nr;
+    for(int i = 0 ; i < nr ; i++) {
+	double *xi = t + (size_t) i * nc, s = 0.;
+	for(int k = 0 ; k < nc ; k++) {
+	    xi[k] -= mu[k];
+	    s += xi[k] * xi[k];
+	}
+	nrm[i] = s;
+    }
+    for(int j0 = 0 ; j0 < nr ; j0 += DIST_BLOCK) {
+	int mj = (nr - j0 < DIST_BLOCK) ? nr - j0 : DIST_BLOCK;
+	for(int i0 = j0 ; i0 < nr ; i0 += DIST_GEMM_NB) {
+	    int mi = (nr - i0 < DIST_GEMM_NB) ? nr - i0 : DIST_GEMM_NB;
+	    F77_CALL(dgemm)("T", "N", &mi, &mj, &nc, &one, t + (size_t) i0 * nc,
+			    &nc, t + (size_t) j0 * nc, &nc, &zero, g, &mi);
+	    for(int j = j0 ; j < j0 + mj ; j++) {
+		int i = (i0 > j + dc) ? i0 : j + dc;
+		if(i >= i0 + mi) continue;
+		size_t ij = dist_index(i, j, nr, dc);
+		for( ; i < i0 + mi ; i++) {
+		    double s = nrm[i] + nrm[j],
+			d2 = s - 2 * g[(i - i0) + (size_t) (j - j0) * mi];
+		    d[ij++] = (d2 >= DIST_GEMM_TOL * s) ? sqrt(d2) :
+			R_euclidean_finite(t + (size_t) i * nc,
+					   t + (size_t) j * nc, nc);
+		}
+	    }
+	}
+    }
+}
+
+/* the distance between two observations, for clustering without
+   storing the distances (see hclust-utils.c) */
+double R_dist_pair(const double *x1, const double *x2, int nc, int method,
+		   double p)
+{
+    switch(method) {
+    case EUCLIDEAN: return R_euclidean(x1, x2, nc);
+    case MAXIMUM: return R_maximum(x1, x2, nc);
+    case MANHATTAN: return R_manhattan(x1, x2, nc);
+    case CANBERRA: return R_canberra(x1, x2, nc);
+    case BINARY: return R_dist_binary(x1, x2, nc);
+    case MINKOWSKI:
+	if(!R_FINITE(p) || p <= 0)
+	    error(_("distance(): invalid p"));
+	return R_minkowski(x1, x2, nc, p);
+    default:
+	error(_("distance(): invalid distance"));
+    }
+    return NA_REAL; /* -Wall */
+}
+
 void R_distance(double *x, int *nr, int *nc, double *d, int *diag,
 		int *method, double *p)
 {
-    int dc, i, j;
-    size_t  ij;  /* can exceed 2^31 - 1 */
-    double (*distfun)(double*, int, int, int, int) = NULL;
+    int dc, n = *nr, m = *nc, finite = 1;
+    R_distfun distfun = NULL;
 #ifdef _OPENMP
     int nthreads;
 #endif
 
+    if(*method == MINKOWSKI && (!R_FINITE(*p) || *p <= 0))
+	error(_("distance(): invalid p"));
+    if(*method < EUCLIDEAN || *method > MINKOWSKI)
+	error(_("distance(): invalid distance"));
+    dc = (*diag) ? 0 : 1; /* diag=1:  we do the diagonal */
+
+    /* the transpose, an observation per column */
+    double *t = (double *) R_alloc((size_t) n * m, sizeof(double));
+    for(int i0 = 0 ; i0 < n ; i0 += DIST_BLOCK) {
+	int i1 = (n - i0 < DIST_BLOCK) ? n : i0 + DIST_BLOCK;
+	for(int k = 0 ; k < m ; k++)
+	    for(int i = i0 ; i < i1 ; i++) {
+		double xik = x[i + (size_t) k * n];
+		t[(size_t) i * m + k] = xik;
+		if(!R_FINITE(xik)) finite = 0;
+	    }
+    }
+
     switch(*method) {
     case EUCLIDEAN:
-	distfun = R_euclidean;
+	if(finite && m >= DIST_GEMM_MIN) {
+	    dist_euclidean_gemm(t, n, m, d, dc);
+	    return;
+	}
+	distfun = finite ? R_euclidean_finite : R_euclidean;
 	break;
     case MAXIMUM:
-	distfun = R_maximum;
+	distfun = finite ? R_maximum_finite : R_maximum;
 	break;
     case MANHATTAN:
-	distfun = R_manhattan;
+	distfun = finite ? R_manhattan_finite : R_manhattan;
 	break;
     case CANBERRA:
 	distfun = R_canberra;
@@ -221,50 +385,36 @@ void R_distance(double *x, int *nr, int *nc, double *d, int *diag,
 	distfun = R_dist_binary;
 	break;
     case MINKOWSKI:
-	if(!R_FINITE(*p) || *p <= 0)
-	    error(_("distance(): invalid p"));
 	break;
-    default:
-	error(_("distance(): invalid distance"));
     }
-    dc = (*diag) ? 0 : 1; /* diag=1:  we do the diagonal */
+
+    int nb = (n + DIST_BLOCK - 1) / DIST_BLOCK, jb;
 #ifdef _OPENMP
     if (R_num_math_threads > 0)
 	nthreads = R_num_math_threads;
     else
 	nthreads = 1; /* for now */
-    if (nthreads == 1) {
-	/* do the nthreads == 1 case without any OMP overhead to see
-	   if it matters on some platforms */
-	ij = 0;
-	for(j = 0 ; j <= *nr ; j++)
-	    for(i = j+dc ; i < *nr ; i++)
-		d[ij++] = (*method != MINKOWSKI) ?
-		    distfun(x, *nr, *nc, i, j) :
-		    R_minkowski(x, *nr, *nc, i, j, *p);
-    }
-    else
-	/* This produces uneven thread workloads since the outer loop
-	   is over the subdiagonal portions of columns.  An
-	   alternative would be to use a loop on ij and to compute the
-	   i and j values from ij. */
+    if (nthreads > 1) {
 #pragma omp parallel for num_threads(nthreads) default(none)	\
-    private(i, j, ij)						\
-    firstprivate(nr, dc, d, method, distfun, nc, x, p)
-	for(j = 0 ; j <= *nr ; j++) {
-	    ij = j * (*nr - dc) + j - ((1 + j) * j) / 2;
-	    for(i = j+dc ; i < *nr ; i++)
-		d[ij++] = (*method != MINKOWSKI) ?
-		    distfun(x, *nr, *nc, i, j) :
-		    R_minkowski(x, *nr, *nc, i, j, *p);
-	}
-#else
-    ij = 0;
-    for(j = 0 ; j <= *nr ; j++)
-	for(i = j+dc ; i < *nr ; i++)
-	    d[ij++] = (*method != MINKOWSKI) ?
-		distfun(x, *nr, *nc, i, j) : R_minkowski(x, *nr, *nc, i, j, *p);
+    schedule(dynamic) private(jb)				\
+    firstprivate(n, m, nb, dc, d, method, distfun, t, p, finite)
+	for(jb = 0 ; jb < nb ; jb++)
+	    for(int ib = jb ; ib < nb ; ib++) {
+		int i0 = ib * DIST_BLOCK, j0 = jb * DIST_BLOCK;
+		dist_tile(t, n, m, d, dc, *method, distfun, *p, finite,
+			  i0, (i0 + DIST_BLOCK < n) ? i0 + DIST_BLOCK : n,
+			  j0, (j0 + DIST_BLOCK < n) ? j0 + DIST_BLOCK : n);
+	    }
+	return;
+    }
 #endif
+    for(jb = 0 ; jb < nb ; jb++)
+	for(int ib = jb ; ib < nb ; ib++) {
+	    int i0 = ib * DIST_BLOCK, j0 = jb * DIST_BLOCK;
+	    dist_tile(t, n, m, d, dc, *method, distfun, *p, finite,
+		      i0, (i0 + DIST_BLOCK < n) ? i0 + DIST_BLOCK : n,
+		      j0, (j0 + DIST_BLOCK < n) ? j0 + DIST_BLOCK : n);
+	}
 }
 
 #include <Rinternals.h>
@@ -1,7 +1,7 @@
 /*
  *  R : A Computer Language for Statistical Data Analysis
  *  Copyright (C) 1995, 1996, 1997  Robert Gentleman and Ross Ihaka
- *  Copyright (C) 1998--2013	    The R Core Team
+ *  Copyright (C) 1998--2017	    The R Core Team
  *
  *  This program is free software; you can redistribute it and/or modify
  *  it under the terms of the GNU General Public License as published by
@@ -41,6 +41,26 @@
 #define R_MSG_NA	_("NaNs produced")
 #define R_MSG_NONNUM_MATH _("Non-numeric argument to mathematical function")
 
+/* When the parameters are scalars the batch versions of some of the
+   functions (see ../../../nmath/dpq_vec.c, pgamma.c, pbeta.c and
+   qbeta.c) are used, a piece of VEC_CHUNK values at a time so that
+   their second passes over the values are in cache.  NA and NaN values of the first argument then
+   give NA and NaN as in the loops below, and other NaN results the
+   warning. */
+#define VEC_CHUNK 8192
+
+#define VEC_iterate(call) do {						\
+	for (i = 0; i < n; i += VEC_CHUNK) {				\
+	    int m = (int) ((n - i < VEC_CHUNK) ? n - i : VEC_CHUNK);	\
+	    call;							\
+	}								\
+	for (i = 0; i < n; i++)						\
+	    if (ISNAN(y[i])) {						\
+		if (ISNAN(a[i])) y[i] = ISNA(a[i]) ? NA_REAL : R_NaN;	\
+		else naflag = 1;					\
+	    }								\
+    } while (0)
+
 
 /* Mathematical Functions of Two Numeric Arguments (plus 1 int) */
 
@@ -78,7 +98,8 @@
 	else if (ISNAN(a) || ISNAN(b)) y = R_NaN;
 
 
-static SEXP math2_1(SEXP sa, SEXP sb, SEXP sI, double (*f)(double, double, int))
+static SEXP math2_1(SEXP sa, SEXP sb, SEXP sI, double (*f)(double, double, int),
+		    void (*fv)(const double *, int, double, int, double *))
 {
     SEXP sy;
     R_xlen_t i, ia, ib, n, na, nb;
@@ -92,6 +113,9 @@ static SEXP math2_1(SEXP sa, SEXP sb, SEXP sI, double (*f)(double, double, int))
     SETUP_Math2;
     m_opt = asInteger(sI);
 
+    if (fv && nb == 1 && !ISNAN(b[0]))
+	VEC_iterate(fv(a + i, m, b[0], m_opt, y + i));
+    else
     mod_iterate(na, nb, ia, ib) {
 //	if ((i+1) % NINTERRUPT) R_CheckUserInterrupt();
 	ai = a[ia];
@@ -137,11 +161,16 @@ static SEXP math2_2(SEXP sa, SEXP sb, SEXP sI1, SEXP sI2,
 
 #define DEFMATH2_1(name) \
     SEXP do_##name(SEXP sa, SEXP sb, SEXP sI) { \
-        return math2_1(sa, sb, sI, name); \
+        return math2_1(sa, sb, sI, name, NULL); \
+    }
+
+#define DEFMATH2_1V(name) \
+    SEXP do_##name(SEXP sa, SEXP sb, SEXP sI) { \
+        return math2_1(sa, sb, sI, name, name##_vec); \
     }
 
 DEFMATH2_1(dchisq)
-DEFMATH2_1(dexp)
+DEFMATH2_1V(dexp)
 DEFMATH2_1(dgeom)
 DEFMATH2_1(dpois)
 DEFMATH2_1(dt)
@@ -208,7 +237,9 @@ DEFMATH2_2(qsignrank)
     UNPROTECT(4)
 
 static SEXP math3_1(SEXP sa, SEXP sb, SEXP sc, SEXP sI,
-		    double (*f)(double, double, double, int))
+		    double (*f)(double, double, double, int),
+		    void (*fv)(const double *, int, double, double, int,
+			       double *))
 {
     SEXP sy;
     R_xlen_t i, ia, ib, ic, n, na, nb, nc;
@@ -219,6 +250,9 @@ static SEXP math3_1(SEXP sa, SEXP sb, SEXP sc, SEXP sI,
     SETUP_Math3;
     i_1 = asInteger(sI);
 
+    if (fv && nb == 1 && nc == 1 && !ISNAN(b[0]) && !ISNAN(c[0]))
+	VEC_iterate(fv(a + i, m, b[0], c[0], i_1, y + i));
+    else
     mod_iterate3 (na, nb, nc, ia, ib, ic) {
 //	if ((i+1) % NINTERRUPT) R_CheckUserInterrupt();
 	ai = a[ia];
@@ -236,7 +270,9 @@ static SEXP math3_1(SEXP sa, SEXP sb, SEXP sc, SEXP sI,
 } /* math3_1 */
 
 static SEXP math3_2(SEXP sa, SEXP sb, SEXP sc, SEXP sI, SEXP sJ,
-		    double (*f)(double, double, double, int, int))
+		    double (*f)(double, double, double, int, int),
+		    void (*fv)(const double *, int, double, double, int, int,
+			       double *))
 {
     SEXP sy;
     R_xlen_t i, ia, ib, ic, n, na, nb, nc;
@@ -248,6 +284,9 @@ static SEXP math3_2(SEXP sa, SEXP sb, SEXP sc, SEXP sI, SEXP sJ,
     i_1 = asInteger(sI);
     i_2 = asInteger(sJ);
 
+    if (fv && nb == 1 && nc == 1 && !ISNAN(b[0]) && !ISNAN(c[0]))
+	VEC_iterate(fv(a + i, m, b[0], c[0], i_1, i_2, y + i));
+    else
     mod_iterate3 (na, nb, nc, ia, ib, ic) {
 //	if ((i+1) % NINTERRUPT) R_CheckUserInterrupt();
 	ai = a[ia];
@@ -266,19 +305,24 @@ static SEXP math3_2(SEXP sa, SEXP sb, SEXP sc, SEXP sI, SEXP sJ,
 
 #define DEFMATH3_1(name) \
     SEXP do_##name(SEXP sa, SEXP sb, SEXP sc, SEXP sI) { \
-        return math3_1(sa, sb, sc, sI, name); \
+        return math3_1(sa, sb, sc, sI, name, NULL); \
+    }
+
+#define DEFMATH3_1V(name) \
+    SEXP do_##name(SEXP sa, SEXP sb, SEXP sc, SEXP sI) { \
+        return math3_1(sa, sb, sc, sI, name, name##_vec); \
     }
 
 DEFMATH3_1(dbeta)
 DEFMATH3_1(dbinom)
 DEFMATH3_1(dcauchy)
 DEFMATH3_1(df)
-DEFMATH3_1(dgamma)
+DEFMATH3_1V(dgamma)
 DEFMATH3_1(dlnorm)
 DEFMATH3_1(dlogis)
 DEFMATH3_1(dnbinom)
 DEFMATH3_1(dnbinom_mu)
-DEFMATH3_1(dnorm)
+DEFMATH3_1V(dnorm)
 DEFMATH3_1(dweibull)
 DEFMATH3_1(dunif)
 DEFMATH3_1(dnt)
@@ -287,18 +331,23 @@ DEFMATH3_1(dwilcox)
 
 #define DEFMATH3_2(name) \
     SEXP do_##name(SEXP sa, SEXP sb, SEXP sc, SEXP sI, SEXP sJ) { \
-        return math3_2(sa, sb, sc, sI, sJ, name); \
+        return math3_2(sa, sb, sc, sI, sJ, name, NULL); \
+    }
+
+#define DEFMATH3_2V(name) \
+    SEXP do_##name(SEXP sa, SEXP sb, SEXP sc, SEXP sI, SEXP sJ) { \
+        return math3_2(sa, sb, sc, sI, sJ, name, name##_vec); \
     }
 
-DEFMATH3_2(pbeta)
-DEFMATH3_2(qbeta)
+DEFMATH3_2V(pbeta)
+DEFMATH3_2V(qbeta)
 DEFMATH3_2(pbinom)
 DEFMATH3_2(qbinom)
 DEFMATH3_2(pcauchy)
 DEFMATH3_2(qcauchy)
 DEFMATH3_2(pf)
 DEFMATH3_2(qf)
-DEFMATH3_2(pgamma)
+DEFMATH3_2V(pgamma)
 DEFMATH3_2(qgamma)
 DEFMATH3_2(plnorm)
 DEFMATH3_2(qlnorm)
@@ -308,8 +357,8 @@ DEFMATH3_2(pnbinom)
 DEFMATH3_2(qnbinom)
 DEFMATH3_2(pnbinom_mu)
 DEFMATH3_2(qnbinom_mu)
-DEFMATH3_2(pnorm)
-DEFMATH3_2(qnorm)
+DEFMATH3_2V(pnorm)
+DEFMATH3_2V(qnorm)
 DEFMATH3_2(pweibull)
 DEFMATH3_2(qweibull)
 DEFMATH3_2(punif)
@@ -1,7 +1,7 @@
 /*
  *  R : A Computer Language for Statistical Data Analysis
  *  Copyright (C) 1995, 1996, 1997  Robert Gentleman and Ross Ihaka
- *  Copyright (C) 1998--2000, 2013  The R Core Team
+ *  Copyright (C) 1998--2000, 2013, 2017  The R Core Team
  *
  *  This program is free software; you can redistribute it and/or modify
  *  it under the terms of the GNU General Public License as published by
@@ -28,6 +28,7 @@
 #include <math.h>
 #include <Rmath.h> /* for imax2(.),..*/
 #include <R_ext/Applic.h>
+#include "stats.h" /* for fft_plan */
 
 /*  Fast Fourier Transform
  *
@@ -50,9 +51,9 @@
  *	if maxp is one,	 the internal nfac array was too small.	 This can only
  *	happen for series lengths which exceed 12,754,584.
  *
- * PROBLEM (see fftmx  below):	nfac[] is overwritten by fftmx() in fft_work()
- * -------  Consequence:  fft_factor() must be called way too often,
- * at least from  do_mvfft() [ ../main/fourier.c ]
+ * fftmx() below overwrites nfac[], so fft_work() works on a copy of the
+ * factorization, which fft_factor_r() and fft_work_r() keep in an
+ * fft_plan rather than in static storage.
  *
  *	The following arrays need to be allocated following the call to
  *	fft_factor and preceding the call to fft_work.
@@ -129,11 +130,7 @@ static void fftmx(double *a, double *b, int ntot, int n, int nspan, int isn,
 {
 /* called from	fft_work() */
 
-/* Design BUG:	One purpose of fft_factor() would be to compute
- * ----------	nfac[] once and for all; and fft_work() [i.e. fftmx ]
- *		could reuse the factorization.
- * However: nfac[] is `destroyed' currently in the code below
- */
+/* nfac[] is `destroyed' by the code below, so fft_work_r() passes a copy */
     double aa, aj, ajm, ajp, ak, akm, akp;
     double bb, bj, bjm, bjp, bk, bkm, bkp;
     double c1, c2=0, c3=0, c72, cd;
@@ -725,49 +722,38 @@ L570:
     if( nt >= 0) goto L_ord;
 } /* fftmx */
 
-static int old_n = 0;
-
-static int nfac[20];
-static int m_fac;
-static int kt;
-static int maxf;
-static int maxp;
-
-/* At the end of factorization,	 
+/* At the end of factorization,
  *	nfac[]	contains the factors,
- *	m_fac	contains the number of factors and 
+ *	m_fac	contains the number of factors and
  *	kt	contains the number of square factors  */
 
-/* non-API, but used by package RandomFields */
-void fft_factor(int n, int *pmaxf, int *pmaxp)
+Rboolean fft_factor_r(int n, fft_plan *plan)
 {
-/* fft_factor - factorization check and determination of memory
- *		requirements for the fft.
+/* fft_factor_r - the factorization of fft_factor() into *plan, which
+ *		  fft_work_r() does not change, so that one plan can be used
+ *		  for many transforms, also from several threads.
  *
- * On return,	*pmaxf will give the maximum factor size
- * and		*pmaxp will give the amount of integer scratch storage required.
- *
- * If *pmaxf == 0, there was an error, the error type is indicated by *pmaxp:
- *
- *  If *pmaxp == 0  There was an illegal zero parameter among nseg, n, and nspn.
- *  If *pmaxp == 1  There we more than 15 factors to ntot.  */
+ * Returns FALSE, with plan->n = plan->maxf = 0, on an error.  */
 
     int j, jj, k, sqrtk, kchanged;
+    int *nfac = plan->nfac, m_fac, kt = 0, maxf = 1, maxp = 1;
 
 	/* check series length */
 
-    if (n <= 0) {
-	old_n = 0; *pmaxf = 0; *pmaxp = 0;
-	return;
-    }
-    else old_n = n;
+    plan->n = plan->maxf = plan->maxp = 0;
+    if (n <= 0)
+	return FALSE;
 
 	/* determine the factors of n */
 
     m_fac = 0;
     k = n;/* k := remaining unfactored factor of n */
-    if (k == 1)
-	return;
+    if (k == 1) {
+	plan->n = n;
+	plan->m_fac = plan->kt = 0;
+	plan->maxf = plan->maxp = 1;
+	return TRUE;
+    }
 
 	/* extract square factors first ------------------ */
 
@@ -824,50 +810,80 @@ void fft_factor(int n, int *pmaxf, int *pmaxp)
 
     if (m_fac <= kt+1)
 	maxp = m_fac+kt+1;
-    if (m_fac+kt > 20) {		/* error - too many factors */
-	old_n = 0; *pmaxf = 0; *pmaxp = 0;
-	return;
+    if (m_fac+kt > 20)		/* error - too many factors */
+	return FALSE;
+    if (kt != 0) {
+	j = kt;
+	while(j != 0)
+	    nfac[m_fac++] = nfac[--j];
     }
-    else {
-	if (kt != 0) {
-	    j = kt;
-	    while(j != 0)
-		nfac[m_fac++] = nfac[--j];
-	}
-	maxf = nfac[m_fac-kt-1];
+    maxf = nfac[m_fac-kt-1];
 /* The last squared factor is not necessarily the largest PR#1429 */
-	if (kt > 0) maxf = imax2(nfac[kt-1], maxf);
-	if (kt > 1) maxf = imax2(nfac[kt-2], maxf);
-	if (kt > 2) maxf = imax2(nfac[kt-3], maxf);
-    }
-    *pmaxf = maxf;
-    *pmaxp = maxp;
+    if (kt > 0) maxf = imax2(nfac[kt-1], maxf);
+    if (kt > 1) maxf = imax2(nfac[kt-2], maxf);
+    if (kt > 2) maxf = imax2(nfac[kt-3], maxf);
+
+    plan->n = n;
+    plan->m_fac = m_fac;
+    plan->kt = kt;
+    plan->maxf = maxf;
+    plan->maxp = maxp;
+    return TRUE;
 }
-
 
-Rboolean fft_work(double *a, double *b, int nseg, int n, int nspn, int isn,
-		  double *work, int *iwork)
+Rboolean fft_work_r(const fft_plan *plan, double *a, double *b, int nseg,
+		    int n, int nspn, int isn, double *work, int *iwork)
 {
-    int nf, nspan, ntot;
-
-	/* check that factorization was successful */
+    int nf, nspan, ntot, maxf = plan->maxf, nfac[20];
 
-    if(old_n == 0) return FALSE;
+	/* check that factorization was successful and that the
+	   parameters match those of the factorization call */
 
-	/* check that the parameters match those of the factorization call */
-
-    if(n != old_n || nseg <= 0 || nspn <= 0 || isn == 0)
+    if(plan->n == 0 || n != plan->n || nseg <= 0 || nspn <= 0 || isn == 0)
 	return FALSE;
 
-	/* perform the transform */
+	/* perform the transform, on a copy of the factors as fftmx()
+	   changes them */
 
     nf = n;
     nspan = nf * nspn;
     ntot = nspan * nseg;
+    Memcpy(nfac, plan->nfac, 20);
 
-    fftmx(a, b, ntot, nf, nspan, isn, m_fac, kt,
+    fftmx(a, b, ntot, nf, nspan, isn, plan->m_fac, plan->kt,
 	  &work[0], &work[maxf], &work[2*(size_t)maxf], &work[3*(size_t)maxf],
 	  iwork, nfac);
 
     return TRUE;
 }
+
+/* The original interface, with the factorization kept in static
+   storage */
+
+static fft_plan plan0;
+
+/* non-API, but used by package RandomFields */
+void fft_factor(int n, int *pmaxf, int *pmaxp)
+{
+/* fft_factor - factorization check and determination of memory
+ *		requirements for the fft.
+ *
+ * On return,	*pmaxf will give the maximum factor size
+ * and		*pmaxp will give the amount of integer scratch storage required.
+ *
+ * If *pmaxf == 0, there was an error, the error type is indicated by *pmaxp:
+ *
+ *  If *pmaxp == 0  There was an illegal zero parameter among nseg, n, and nspn.
+ *  If *pmaxp == 1  There we more than 15 factors to ntot.  */
+
+    fft_factor_r(n, &plan0);
+    *pmaxf = plan0.maxf;
+    *pmaxp = plan0.maxp;
+}
+
+
+Rboolean fft_work(double *a, double *b, int nseg, int n, int nspn, int isn,
+		  double *work, int *iwork)
+{
+    return fft_work_r(&plan0, a, b, nseg, n, nspn, isn, work, iwork);
+}
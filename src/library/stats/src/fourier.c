@@ -1,7 +1,7 @@
 /*
  *  R : A Computer Language for Statistical Data Analysis
  *  Copyright (C) 1995, 1996, 1997  Robert Gentleman and Ross Ihaka
- *  Copyright (C) 1998--2013  The R Core Team
+ *  Copyright (C) 1998--2017  The R Core Team
  *
  *  This program is free software; you can redistribute it and/or modify
  *  it under the terms of the GNU General Public License as published by
@@ -19,7 +19,7 @@
  */
 
 /* These are the R interface routines to the plain FFT code
-   fft_factor() & fft_work() in fft.c. */
+   fft_factor_r() & fft_work_r() in fft.c. */
 
 #ifdef HAVE_CONFIG_H
 #include <config.h>
@@ -35,23 +35,123 @@
 #define _(String) (String)
 #endif
 
+#ifdef _OPENMP
+# include <R_ext/MathThreads.h>
+#endif
 
-void fft_factor(int n, int *pmaxf, int *pmaxp);
-Rboolean fft_work(double *a, double *b, int nseg, int n, int nspn,
-		  int isn, double *work, int *iwork);
-
+#include "stats.h"
 #include "statsR.h"
 
+/* The factorizations of the lengths of recent transforms, and the
+   twiddle factors of the last real one, are kept: spectral analysis and
+   convolution make many transforms of the same length. */
+
+#define NPLANS 4
+static fft_plan plans[NPLANS];
+static int next_plan = 0;
+
+static const fft_plan *get_plan(int n)
+{
+    int i;
+    fft_plan *plan;
+
+    for (i = 0; i < NPLANS; i++)
+	if (plans[i].n == n) return &plans[i];
+    plan = &plans[next_plan];
+    next_plan = (next_plan + 1) % NPLANS;
+    if (!fft_factor_r(n, plan))
+	error(_("fft factorization error"));
+    if ((size_t) plan->maxf > ((size_t) -1) / 4) {
+	plan->n = 0;
+	error("fft too large");
+    }
+    return plan;
+}
+
+static double *rtw = NULL;
+static int rtw_n = 0;
+
+/* cos and sin of 2 pi k/n for k = 0, ..., n/4 */
+static const double *real_twiddles(int n)
+{
+    if (n != rtw_n) {
+	int k, m = n / 4 + 1;
+	rtw_n = 0;
+	rtw = Realloc(rtw, 2 * (size_t) m, double);
+	for (k = 0; k < m; k++) {
+	    rtw[2*k] = cos(2 * M_PI * k / n);
+	    rtw[2*k+1] = sin(2 * M_PI * k / n);
+	}
+	rtw_n = n;
+    }
+    return rtw;
+}
+
+/* The transform of n (even) real values in z[].r, in place, from the
+   complex transform Z of length m = n/2 of the pairs (x[2j], x[2j+1]).
+   With w = exp(-2 pi i/n), X[0] and X[m] are Re Z[0] +/- Im Z[0], and
+   for 0 < k < m
+	X[k] = E + w^k O,   X[m-k] = conj(E - w^k O)
+   where E = (Z[k] + conj(Z[m-k]))/2 and O = (Z[k] - conj(Z[m-k]))/2i
+   are the transforms of the even and odd values.  Then X[n-k] is
+   conj(X[k]), and the inverse transform is the conjugate of X. */
+
+static void fft_real(Rcomplex *z, int n, int inv, const fft_plan *plan,
+		     const double *tw, double *work, int *iwork)
+{
+    int j, k, m = n / 2;
+    double z0r, z0i, er, ei, odr, odi, wr, wi;
+
+    for (j = 0; j < m; j++) {
+	z[j].r = z[2*j].r;
+	z[j].i = z[2*j+1].r;
+    }
+    if (m > 1)
+	fft_work_r(plan, &(z[0].r), &(z[0].i), 1, m, 1, -2, work, iwork);
+
+    z0r = z[0].r;
+    z0i = z[0].i;
+    z[0].r = z0r + z0i;
+    z[0].i = 0.0;
+    z[m].r = z0r - z0i;
+    z[m].i = 0.0;
+    for (k = 1; 2*k <= m; k++) {
+	Rcomplex a = z[k], b = z[m-k];
+	er = (a.r + b.r) / 2;
+	ei = (a.i - b.i) / 2;
+	odr = (a.i + b.i) / 2;
+	odi = (b.r - a.r) / 2;
+	wr = tw[2*k] * odr + tw[2*k+1] * odi;
+	wi = tw[2*k] * odi - tw[2*k+1] * odr;
+	z[k].r = er + wr;
+	z[k].i = ei + wi;
+	if (2*k < m) {
+	    z[m-k].r = er - wr;
+	    z[m-k].i = wi - ei;
+	}
+    }
+    for (k = 1; k < m; k++) {
+	z[n-k].r = z[k].r;
+	z[n-k].i = -z[k].i;
+    }
+    if (inv > 0)
+	for (k = 0; k < n; k++) z[k].i = -z[k].i;
+}
+
+/* Columns of mvfft() are transformed in parallel when there are at
+   least this many values */
+#define FFT_THREADS_MIN 100000
+
 /* Fourier Transform for Univariate Spatial and Time Series */
 
 SEXP fft(SEXP z, SEXP inverse)
 {
     SEXP d;
-    int i, inv, maxf, maxmaxf, maxmaxp, maxp, n, ndims, nseg, nspn;
+    int i, inv, maxmaxf, maxmaxp, n, ndims, nseg, nspn;
     double *work;
     int *iwork;
-    size_t smaxf;
-    size_t maxsize = ((size_t) -1) / 4;
+    const fft_plan *plan;
+    Rboolean real = TRUE;
 
     switch (TYPEOF(z)) {
     case INTSXP:
@@ -61,6 +161,7 @@ SEXP fft(SEXP z, SEXP inverse)
 	break;
     case CPLXSXP:
 	if (MAYBE_REFERENCED(z)) z = duplicate(z);
+	real = FALSE;
 	break;
     default:
 	error(_("non-numeric argument"));
@@ -79,16 +180,19 @@ SEXP fft(SEXP z, SEXP inverse)
     if (LENGTH(z) > 1) {
 	if (isNull(d = getAttrib(z, R_DimSymbol))) {  /* temporal transform */
 	    n = length(z);
-	    fft_factor(n, &maxf, &maxp);
-	    if (maxf == 0)
-		error(_("fft factorization error"));
-	    smaxf = maxf;
-	    if (smaxf > maxsize)
-		error("fft too large");
-	    work = (double*)R_alloc(4 * smaxf, sizeof(double));
-	    iwork = (int*)R_alloc(maxp, sizeof(int));
-	    fft_work(&(COMPLEX(z)[0].r), &(COMPLEX(z)[0].i),
-		     1, n, 1, inv, work, iwork);
+	    if (real && n % 2 == 0) { /* a complex transform of length n/2 */
+		plan = get_plan(n / 2);
+		work = (double*)R_alloc(4 * (size_t) plan->maxf, sizeof(double));
+		iwork = (int*)R_alloc(plan->maxp, sizeof(int));
+		fft_real(COMPLEX(z), n, inv, plan, real_twiddles(n),
+			 work, iwork);
+	    } else {
+		plan = get_plan(n);
+		work = (double*)R_alloc(4 * (size_t) plan->maxf, sizeof(double));
+		iwork = (int*)R_alloc(plan->maxp, sizeof(int));
+		fft_work_r(plan, &(COMPLEX(z)[0].r), &(COMPLEX(z)[0].i),
+			   1, n, 1, inv, work, iwork);
+	    }
 	}
 	else {					     /* spatial transform */
 	    maxmaxf = 1;
@@ -97,19 +201,14 @@ SEXP fft(SEXP z, SEXP inverse)
 	    /* do whole loop just for error checking and maxmax[fp] .. */
 	    for (i = 0; i < ndims; i++) {
 		if (INTEGER(d)[i] > 1) {
-		    fft_factor(INTEGER(d)[i], &maxf, &maxp);
-		    if (maxf == 0)
-			error(_("fft factorization error"));
-		    if (maxf > maxmaxf)
-			maxmaxf = maxf;
-		    if (maxp > maxmaxp)
-			maxmaxp = maxp;
+		    plan = get_plan(INTEGER(d)[i]);
+		    if (plan->maxf > maxmaxf)
+			maxmaxf = plan->maxf;
+		    if (plan->maxp > maxmaxp)
+			maxmaxp = plan->maxp;
 		}
 	    }
-	    smaxf = maxmaxf;
-	    if (smaxf > maxsize)
-		error("fft too large");
-	    work = (double*)R_alloc(4 * smaxf, sizeof(double));
+	    work = (double*)R_alloc(4 * (size_t) maxmaxf, sizeof(double));
 	    iwork = (int*)R_alloc(maxmaxp, sizeof(int));
 	    nseg = LENGTH(z);
 	    n = 1;
@@ -119,9 +218,9 @@ SEXP fft(SEXP z, SEXP inverse)
 		    nspn *= n;
 		    n = INTEGER(d)[i];
 		    nseg /= n;
-		    fft_factor(n, &maxf, &maxp);
-		    fft_work(&(COMPLEX(z)[0].r), &(COMPLEX(z)[0].i),
-			     nseg, n, nspn, inv, work, iwork);
+		    plan = get_plan(n);
+		    fft_work_r(plan, &(COMPLEX(z)[0].r), &(COMPLEX(z)[0].i),
+			       nseg, n, nspn, inv, work, iwork);
 		}
 	    }
 	}
@@ -136,11 +235,14 @@ SEXP fft(SEXP z, SEXP inverse)
 SEXP mvfft(SEXP z, SEXP inverse)
 {
     SEXP d;
-    int i, inv, maxf, maxp, n, p;
+    int inv, n, p, nt = 1, t;
     double *work;
     int *iwork;
-    size_t smaxf;
-    size_t maxsize = ((size_t) -1) / 4;
+    size_t lwork, liwork;
+    const fft_plan *plan;
+    const double *tw = NULL;
+    Rcomplex *zz;
+    Rboolean real = TRUE;
 
     d = getAttrib(z, R_DimSymbol);
     if (d == R_NilValue || length(d) > 2)
@@ -156,6 +258,7 @@ SEXP mvfft(SEXP z, SEXP inverse)
 	break;
     case CPLXSXP:
 	if (MAYBE_REFERENCED(z)) z = duplicate(z);
+	real = FALSE;
 	break;
     default:
 	error(_("non-numeric argument"));
@@ -170,18 +273,36 @@ SEXP mvfft(SEXP z, SEXP inverse)
     else inv = 2;
 
     if (n > 1) {
-	fft_factor(n, &maxf, &maxp);
-	if (maxf == 0)
-	    error(_("fft factorization error"));
-	smaxf = maxf;
-	if (smaxf > maxsize)
-	    error("fft too large");
-	work = (double*)R_alloc(4 * smaxf, sizeof(double));
-	iwork = (int*)R_alloc(maxp, sizeof(int));
-	for (i = 0; i < p; i++) {
-	    fft_factor(n, &maxf, &maxp);
-	    fft_work(&(COMPLEX(z)[i*n].r), &(COMPLEX(z)[i*n].i),
-		     1, n, 1, inv, work, iwork);
+	/* real columns of even length as for fft() */
+	real = real && n % 2 == 0;
+	plan = get_plan(real ? n / 2 : n);
+	if (real) tw = real_twiddles(n);
+#ifdef _OPENMP
+	if (R_num_math_threads > 1 && (double) n * p >= FFT_THREADS_MIN)
+	    nt = (R_num_math_threads < p) ? R_num_math_threads : p;
+#endif
+	/* workspace for each thread */
+	lwork = 4 * (size_t) plan->maxf;
+	liwork = plan->maxp;
+	work = (double*)R_alloc(nt * lwork, sizeof(double));
+	iwork = (int*)R_alloc(nt * liwork, sizeof(int));
+	zz = COMPLEX(z);
+#ifdef _OPENMP
+# pragma omp parallel for num_threads(nt) default(none) \
+    firstprivate(zz, n, p, nt, inv, real, plan, tw, work, iwork, lwork, liwork)
+#endif
+	for (t = 0; t < nt; t++) {
+	    double *w = work + t * lwork;
+	    int *iw = iwork + t * liwork;
+	    for (size_t i = (size_t) p * t / nt; i < (size_t) p * (t + 1) / nt;
+		 i++) {
+		Rcomplex *zi = zz + i * n;
+		if (real)
+		    fft_real(zi, n, inv, plan, tw, w, iw);
+		else
+		    fft_work_r(plan, &(zi[0].r), &(zi[0].i), 1, n, 1, inv,
+			       w, iw);
+	    }
 	}
     }
     UNPROTECT(1);
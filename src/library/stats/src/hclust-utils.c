@@ -19,8 +19,11 @@
  */
 
 #include <R_ext/Boolean.h>
+#include <R_ext/Utils.h>
 #include <Rinternals.h>
+#include <Rmath.h>
 #include "statsR.h"
+#include "stats.h"
 
 SEXP cutree(SEXP merge, SEXP which)
 {
@@ -111,3 +114,375 @@ SEXP cutree(SEXP merge, SEXP which)
     UNPROTECT(3);
     return(ans);
 }
+
+/* Hierarchical clustering in O(n^2) time: the nearest-neighbour chain
+   algorithm for the methods satisfying the reducibility property
+   (Ward, complete, average and McQuitty's), and SLINK (Sibson, 1973)
+   for single linkage.  SLINK needs only O(n) storage beyond the
+   dissimilarities, so it can compute them from the data as it goes,
+   as can the chain for Ward's method on the centroids of the clusters
+   (with Euclidean distances).  The merges are found in a different
+   order from that of hclust.f, and are sorted by height before being
+   converted to the form of hclust(). */
+
+enum { HC_WARD_D = 1, HC_SINGLE, HC_COMPLETE, HC_AVERAGE, HC_MCQUITTY,
+       HC_WARD_D2 = 8 }; /* codes as in hclust() */
+
+/* index of d(i, j), i < j, in a "dist" object of size n */
+static R_INLINE size_t hc_index(int i, int j, int n)
+{
+    return (size_t) n * i - ((size_t) i * (i + 1)) / 2 + j - i - 1;
+}
+
+static int hc_find(int *parent, int i)
+{
+    while(parent[i] != i) {
+	parent[i] = parent[parent[i]];
+	i = parent[i];
+    }
+    return i;
+}
+
+/* Convert the merges (a[k], b[k]) at heights h[k], k < n-1, to the
+   components merge, height and order of an "hclust" object.  a and b
+   name clusters by any of their members, and a merge must follow those
+   of its constituents when sorted by height, as it does for the
+   monotone methods here.  The sort is stable, so ties are kept in the
+   order found. */
+static SEXP hc_result(int n, int *a, int *b, double *h)
+{
+    int m = n - 1, *o = (int *) R_alloc(m, sizeof(int)),
+	*tmp = (int *) R_alloc(m, sizeof(int)),
+	*parent = (int *) R_alloc(n, sizeof(int)),
+	*id = (int *) R_alloc(n, sizeof(int));
+
+    /* bottom-up merge sort of the indices by height */
+    for(int k = 0; k < m; k++) o[k] = k;
+    for(int w = 1; w < m; w *= 2) {
+	for(int lo = 0; lo < m; lo += 2 * w) {
+	    int mid = (lo + w < m) ? lo + w : m,
+		hi = (lo + 2 * w < m) ? lo + 2 * w : m,
+		i = lo, j = mid, k = lo;
+	    while(i < mid && j < hi)
+		tmp[k++] = (h[o[j]] < h[o[i]]) ? o[j++] : o[i++];
+	    while(i < mid) tmp[k++] = o[i++];
+	    while(j < hi) tmp[k++] = o[j++];
+	}
+	for(int k = 0; k < m; k++) o[k] = tmp[k];
+    }
+
+    const char *nms[] = {"merge", "height", "order", ""};
+    SEXP ans = PROTECT(mkNamed(VECSXP, nms));
+    SEXP merge = SET_VECTOR_ELT(ans, 0, allocMatrix(INTSXP, m, 2));
+    SEXP height = SET_VECTOR_ELT(ans, 1, allocVector(REALSXP, m));
+    SEXP order = SET_VECTOR_ELT(ans, 2, allocVector(INTSXP, n));
+    int *mg = INTEGER(merge), *ord = INTEGER(order);
+
+    /* singletons are -(index), clusters the step which formed them;
+       as from hcass2, a singleton comes first, or the earlier cluster */
+    for(int i = 0; i < n; i++) {
+	parent[i] = i;
+	id[i] = -(i + 1);
+    }
+    for(int k = 0; k < m; k++) {
+	int ra = hc_find(parent, a[o[k]]), rb = hc_find(parent, b[o[k]]),
+	    x = id[ra], y = id[rb];
+	if(ra == rb) error(_("invalid merges in clustering"));
+	if((x < 0 && y < 0) ? x < y : (x > 0 && (y < 0 || y < x))) {
+	    int t = x; x = y; y = t;
+	}
+	mg[k] = x;
+	mg[k + m] = y;
+	REAL(height)[k] = h[o[k]];
+	if(ra < rb) { parent[rb] = ra; id[ra] = k + 1; }
+	else { parent[ra] = rb; id[rb] = k + 1; }
+    }
+
+    /* the order of the leaves, traversing the tree left to right */
+    int *stack = (int *) R_alloc(n, sizeof(int)), top = 0, nord = 0;
+    stack[top++] = m;
+    while(top > 0) {
+	int c = stack[--top];
+	if(c < 0) ord[nord++] = -c;
+	else {
+	    stack[top++] = mg[c - 1 + m];
+	    stack[top++] = mg[c - 1];
+	}
+    }
+    UNPROTECT(1);
+    return ans;
+}
+
+/* The dissimilarities, either from a "dist" object or computed from
+   the rows of a data matrix (held transposed, an observation per
+   column) by the distance 'metric' of dist(). */
+typedef struct {
+    int n, nc, metric;
+    const double *d, *x;
+    double p;
+} hc_diss;
+
+static R_INLINE double hc_dist(const hc_diss *D, int i, int j)
+{
+    double r;
+    if(D->d)
+	r = (i < j) ? D->d[hc_index(i, j, D->n)] : D->d[hc_index(j, i, D->n)];
+    else
+	r = R_dist_pair(D->x + (size_t) i * D->nc, D->x + (size_t) j * D->nc,
+			D->nc, D->metric, D->p);
+    if(ISNAN(r)) error(_("NA/NaN dissimilarity"));
+    return r;
+}
+
+static void hc_slink(const hc_diss *D, int *a, int *b, double *h)
+{
+    int n = D->n, *pi = (int *) R_alloc(n, sizeof(int));
+    double *lambda = (double *) R_alloc(n, sizeof(double)),
+	*M = (double *) R_alloc(n, sizeof(double));
+
+    for(int i = 0; i < n; i++) {
+	pi[i] = i;
+	lambda[i] = R_PosInf;
+	for(int j = 0; j < i; j++) M[j] = hc_dist(D, j, i);
+	for(int j = 0; j < i; j++) {
+	    if(lambda[j] >= M[j]) {
+		if(lambda[j] < M[pi[j]]) M[pi[j]] = lambda[j];
+		lambda[j] = M[j];
+		pi[j] = i;
+	    } else if(M[j] < M[pi[j]])
+		M[pi[j]] = M[j];
+	}
+	for(int j = 0; j < i; j++)
+	    if(lambda[j] >= lambda[pi[j]]) pi[j] = i;
+	if(i % 1000 == 999) R_CheckUserInterrupt();
+    }
+    /* the pointer representation: j joins pi[j] at height lambda[j] */
+    for(int j = 0; j < n - 1; j++) {
+	a[j] = j;
+	b[j] = pi[j];
+	h[j] = lambda[j];
+    }
+}
+
+/* the active clusters, with removal in constant time */
+typedef struct { int n, *act, *pos; } hc_set;
+
+static void hc_remove(hc_set *S, int i)
+{
+    int k = S->pos[i], last = S->act[--S->n];
+    S->act[k] = last;
+    S->pos[last] = k;
+}
+
+/* The height of merging clusters x and y into y: the methods are
+   monotone, but rounding could put the height a little below that of
+   the merges forming x or y, which would upset the sorting in
+   hc_result(). */
+static R_INLINE double hc_height(double hxy, double *last, int x, int y)
+{
+    if(hxy < last[x]) hxy = last[x];
+    if(hxy < last[y]) hxy = last[y];
+    return last[y] = hxy;
+}
+
+/* The nearest-neighbour chain on the (copied) dissimilarities, updated
+   by the Lance-Williams formulae as in hclust.f.  A tie with the
+   previous cluster in the chain is resolved in its favour, which
+   ensures the chain ends in a pair of reciprocal nearest neighbours. */
+static void hc_nnchain(double *d, int n, int method, const double *membr,
+		       int *a, int *b, double *h)
+{
+    int *chain = (int *) R_alloc(n, sizeof(int)), len = 0;
+    double *size = (double *) R_alloc(n, sizeof(double));
+    hc_set S = {n, (int *) R_alloc(n, sizeof(int)),
+		(int *) R_alloc(n, sizeof(int))};
+
+    double *last = (double *) R_alloc(n, sizeof(double));
+    for(int i = 0; i < n; i++) {
+	S.act[i] = S.pos[i] = i;
+	size[i] = membr[i];
+	last[i] = R_NegInf;
+    }
+#define D(i, j) d[(i) < (j) ? hc_index(i, j, n) : hc_index(j, i, n)]
+    for(int step = 0; step < n - 1; step++) {
+	if(len == 0) chain[len++] = S.act[0];
+	for(;;) {
+	    int x = chain[len - 1], y = (len > 1) ? chain[len - 2] : -1;
+	    double dmin = (y >= 0) ? D(x, y) : R_PosInf;
+	    for(int k = 0; k < S.n; k++) {
+		int z = S.act[k];
+		if(z != x && D(x, z) < dmin) {
+		    dmin = D(x, z);
+		    y = z;
+		}
+	    }
+	    if(len > 1 && y == chain[len - 2]) break;
+	    chain[len++] = y;
+	}
+	int x = chain[--len], y = chain[--len];
+	double dxy = D(x, y), sx = size[x], sy = size[y];
+	a[step] = x;
+	b[step] = y;
+	h[step] = hc_height((method == HC_WARD_D2) ? sqrt(dxy) : dxy,
+			    last, x, y);
+	/* the merged cluster takes the place of y */
+	hc_remove(&S, x);
+	for(int k = 0; k < S.n; k++) {
+	    int z = S.act[k];
+	    if(z == y) continue;
+	    double dxz = D(x, z), dyz = D(y, z), sz = size[z], r = 0.;
+	    switch(method) {
+	    case HC_WARD_D:
+	    case HC_WARD_D2:
+		r = ((sx + sz) * dxz + (sy + sz) * dyz - sz * dxy) /
+		    (sx + sy + sz);
+		break;
+	    case HC_COMPLETE:
+		r = fmax2(dxz, dyz);
+		break;
+	    case HC_AVERAGE:
+		r = (sx * dxz + sy * dyz) / (sx + sy);
+		break;
+	    case HC_MCQUITTY:
+		r = (dxz + dyz) / 2;
+		break;
+	    }
+	    D(y, z) = r;
+	}
+	size[y] = sx + sy;
+	if(step % 1000 == 999) R_CheckUserInterrupt();
+    }
+#undef D
+}
+
+/* Ward's method from the data: the Lance-Williams dissimilarity of
+   clusters A and B on squared Euclidean distances is
+   2 |A||B|/(|A|+|B|) ||c_A - c_B||^2 for centroids c_A and c_B. */
+static double hc_ward(const double *x, int nc, const double *size,
+		      int u, int z)
+{
+    const double *cu = x + (size_t) u * nc, *cz = x + (size_t) z * nc;
+    double s = 0.;
+    for(int l = 0; l < nc; l++) {
+	double dev = cu[l] - cz[l];
+	s += dev * dev;
+    }
+    return 2 * size[u] * size[z] / (size[u] + size[z]) * s;
+}
+
+static void hc_nnchain_ward(double *x, int n, int nc, const double *membr,
+			    int *a, int *b, double *h)
+{
+    int *chain = (int *) R_alloc(n, sizeof(int)), len = 0;
+    double *size = (double *) R_alloc(n, sizeof(double));
+    hc_set S = {n, (int *) R_alloc(n, sizeof(int)),
+		(int *) R_alloc(n, sizeof(int))};
+
+    double *last = (double *) R_alloc(n, sizeof(double));
+    for(int i = 0; i < n; i++) {
+	S.act[i] = S.pos[i] = i;
+	size[i] = membr[i];
+	last[i] = R_NegInf;
+    }
+#define C(i) (x + (size_t) (i) * nc)
+    for(int step = 0; step < n - 1; step++) {
+	double dmin;
+	if(len == 0) chain[len++] = S.act[0];
+	for(;;) {
+	    int u = chain[len - 1], prev = (len > 1) ? chain[len - 2] : -1,
+		v = prev;
+	    dmin = (prev >= 0) ? hc_ward(x, nc, size, u, prev) : R_PosInf;
+	    for(int k = 0; k < S.n; k++) {
+		int z = S.act[k];
+		if(z == u || z == prev) continue;
+		double s = hc_ward(x, nc, size, u, z);
+		if(s < dmin) {
+		    dmin = s;
+		    v = z;
+		}
+	    }
+	    if(len > 1 && v == prev) break;
+	    chain[len++] = v;
+	}
+	int u = chain[--len], v = chain[--len];
+	double su = size[u], sv = size[v];
+	a[step] = u;
+	b[step] = v;
+	h[step] = hc_height(sqrt(dmin), last, u, v);
+	/* the merged cluster takes the place of v */
+	hc_remove(&S, u);
+	for(int l = 0; l < nc; l++)
+	    C(v)[l] = (su * C(u)[l] + sv * C(v)[l]) / (su + sv);
+	size[v] = su + sv;
+	if(step % 1000 == 999) R_CheckUserInterrupt();
+    }
+#undef C
+}
+
+/* .Call(C_hclust_nn, d, x, method, members, metric, p): exactly one of
+   d (a "dist" object) and x (a numeric matrix) is not NULL. */
+SEXP hclust_nn(SEXP d, SEXP x, SEXP smethod, SEXP members, SEXP smetric,
+	       SEXP sp)
+{
+    int method = asInteger(smethod), n;
+    hc_diss D = {0, 0, asInteger(smetric), NULL, NULL, asReal(sp)};
+
+    if(!isNull(d)) {
+	n = asInteger(getAttrib(d, install("Size")));
+	if(TYPEOF(d) != REALSXP || n == NA_INTEGER ||
+	   XLENGTH(d) != (R_xlen_t) n * (n - 1) / 2)
+	    error(_("invalid dissimilarities"));
+	D.d = REAL(d);
+    } else {
+	if(TYPEOF(x) != REALSXP || !isMatrix(x))
+	    error(_("'x' must be a numeric matrix"));
+	n = nrows(x);
+	D.nc = ncols(x);
+	double *t = (double *) R_alloc((size_t) n * D.nc, sizeof(double));
+	for(int i = 0; i < n; i++)
+	    for(int k = 0; k < D.nc; k++)
+		t[(size_t) i * D.nc + k] = REAL(x)[i + (size_t) k * n];
+	D.x = t;
+	if(method == HC_WARD_D2)
+	    for(R_xlen_t k = 0; k < XLENGTH(x); k++)
+		if(!R_FINITE(REAL(x)[k])) error(_("NA/NaN/Inf in '%s'"), "x");
+    }
+    D.n = n;
+    if(n < 2) error(_("must have n >= 2 objects to cluster"));
+    if(TYPEOF(members) != REALSXP || LENGTH(members) != n)
+	error(_("invalid length of members"));
+
+    int *a = (int *) R_alloc(n - 1, sizeof(int)),
+	*b = (int *) R_alloc(n - 1, sizeof(int));
+    double *h = (double *) R_alloc(n - 1, sizeof(double));
+    switch(method) {
+    case HC_SINGLE:
+	hc_slink(&D, a, b, h);
+	break;
+    case HC_WARD_D2:
+	if(D.x) {
+	    hc_nnchain_ward((double *) D.x, n, D.nc, REAL(members), a, b, h);
+	    break;
+	}
+	/* else fall through */
+    case HC_WARD_D:
+    case HC_COMPLETE:
+    case HC_AVERAGE:
+    case HC_MCQUITTY:
+    {
+	if(!D.d) error(_("invalid dissimilarities"));
+	size_t len = (size_t) n * (n - 1) / 2;
+	double *dd = (double *) R_alloc(len, sizeof(double));
+	for(size_t k = 0; k < len; k++) {
+	    dd[k] = D.d[k];
+	    if(ISNAN(dd[k])) error(_("NA/NaN dissimilarity"));
+	    if(method == HC_WARD_D2) dd[k] *= dd[k];
+	}
+	hc_nnchain(dd, n, method, REAL(members), a, b, h);
+	break;
+    }
+    default:
+	error(_("invalid clustering method"));
+    }
+    return hc_result(n, a, b, h);
+}
@@ -1,6 +1,6 @@
 /*
  *  R : A Computer Language for Statistical Data Analysis
- *  Copyright (C) 2001-2016   The R Core Team.
+ *  Copyright (C) 2001-2017   The R Core Team.
  *
  *  This program is free software; you can redistribute it and/or modify
  *  it under the terms of the GNU General Public License as published by
@@ -37,6 +37,7 @@ static const R_CMethodDef CEntries[]  = {
     {"HoltWinters", (DL_FUNC) &HoltWinters, 17},
     {"kmeans_Lloyd", (DL_FUNC) &kmeans_Lloyd, 9},
     {"kmeans_MacQueen", (DL_FUNC) &kmeans_MacQueen, 9},
+    {"kmeans_Hamerly", (DL_FUNC) &kmeans_Hamerly, 9},
     {NULL, NULL, 0}
 };
 
@@ -56,6 +57,7 @@ static const R_CMethodDef CEntries[]  = {
 
 static const R_CallMethodDef CallEntries[] = {
     CALLDEF(cutree, 2),
+    CALLDEF(hclust_nn, 6),
     CALLDEF(isoreg, 1),
     CALLDEF(monoFC_m, 2),
     CALLDEF(numeric_deriv, 4),
@@ -84,6 +86,9 @@ static const R_CallMethodDef CallEntries[] = {
     CALLDEF(TSconv, 2),
     CALLDEF(getQ0, 2),
     CALLDEF(getQ0bis, 3),
+    CALLDEF(ARIMA_ML, 10),
+    CALLDEF(ARIMA_batch, 11),
+    CALLDEF(HoltWinters_batch, 10),
     CALLDEF(port_ivset, 3),
     CALLDEF(port_nlminb, 9),
     CALLDEF(port_nlsb, 7),
@@ -93,6 +98,8 @@ static const R_CallMethodDef CallEntries[] = {
     CALLDEF(binomial_dev_resids, 3),
     CALLDEF(rWishart, 3),
     CALLDEF(Cdqrls, 4),
+    CALLDEF(Cqrupdate, 5),
+    CALLDEF(Csparsels, 3),
     CALLDEF(Cdist, 4),
     CALLDEF(cor, 4),
     CALLDEF(cov, 4),
@@ -108,7 +115,8 @@ static const R_CallMethodDef CallEntries[] = {
     CALLDEF(BinDist, 5),
     CALLDEF(Rsm, 3),
     CALLDEF(tukeyline, 3),
-    CALLDEF(runmed, 5),
+    CALLDEF(runmed, 6),
+    CALLDEF(runquantile, 5),
     CALLDEF(influence, 4),
     CALLDEF(pSmirnov2x, 3),
     CALLDEF(pKolmogorov2x, 2),
@@ -136,8 +144,8 @@ static const R_CallMethodDef CallEntries[] = {
     CALLDEF(intgrt_vec, 3),
     CALLDEF(pp_sum, 2),
     CALLDEF(Fexact, 4),
-    CALLDEF(Fisher_sim, 3),
-    CALLDEF(chisq_sim, 4),
+    CALLDEF(Fisher_sim, 4),
+    CALLDEF(chisq_sim, 5),
     CALLDEF(d2x2xk, 5),
 
     CALLDEF_MATH2_1(dchisq),
@@ -254,6 +262,13 @@ static R_NativePrimitiveArgType lowesw_t[] = { REALSXP, INTSXP, REALSXP, INTSXP}
 static R_NativePrimitiveArgType lowesp_t[] = {
     INTSXP, REALSXP, REALSXP, REALSXP, REALSXP, INTSXP, REALSXP};
 
+/* y and the parameters are not changed, and rw, season, trend and work
+   are set (see stl.f), so none of those need be copied */
+static R_NativeArgStyle stl_s[] = {
+    R_ARG_IN, R_ARG_IN, R_ARG_IN, R_ARG_IN, R_ARG_IN, R_ARG_IN,
+    R_ARG_IN, R_ARG_IN, R_ARG_IN, R_ARG_IN, R_ARG_IN, R_ARG_IN,
+    R_ARG_IN_OUT, R_ARG_IN_OUT, R_ARG_OUT, R_ARG_OUT, R_ARG_OUT, R_ARG_OUT};
+
 
 static const R_FortranMethodDef FortEntries[] = {
     FDEF(lowesw),
@@ -269,7 +284,7 @@ static const R_FortranMethodDef FortEntries[] = {
     {"hcass2", (DL_FUNC) &F77_SUB(hcass2), 6},
     {"kmns", (DL_FUNC) &F77_SUB(kmns), 17},
     {"eureka", (DL_FUNC) &F77_SUB(eureka), 6},
-    {"stl", (DL_FUNC) &F77_SUB(stl), 18},
+    {"stl", (DL_FUNC) &F77_SUB(stl), 18, NULL, stl_s},
     {NULL, NULL, 0}
 };
 
@@ -280,7 +295,7 @@ static const R_ExternalMethodDef ExtEntries[] = {
     EXTDEF(doD, 2),
     EXTDEF(deriv, 5),
     EXTDEF(modelframe, 8),
-    EXTDEF(modelmatrix, 2),
+    EXTDEF(modelmatrix, 3),
     EXTDEF(termsform, 5),
     EXTDEF(do_fmin, 4),
     EXTDEF(nlm, 11),
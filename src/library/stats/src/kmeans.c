@@ -1,6 +1,6 @@
 /*
  *  R : A Computer Language for Statistical Data Analysis
- *  Copyright (C) 2004   The R Core Team.
+ *  Copyright (C) 2004-2017   The R Core Team.
  *
  *  This program is free software; you can redistribute it and/or modify
  *  it under the terms of the GNU General Public License as published by
@@ -18,6 +18,9 @@
  */
 
 #include "modreg.h" /* for declarations for registration */
+#ifdef _OPENMP
+# include <R_ext/MathThreads.h>
+#endif
 
 void kmeans_Lloyd(double *x, int *pn, int *pp, double *cen, int *pk, int *cl,
 		  int *pmaxiter, int *nc, double *wss)
@@ -71,6 +74,176 @@ void kmeans_Lloyd(double *x, int *pn, int *pp, double *cen, int *pk, int *cl,
     }
 }
 
+/* Lloyd's algorithm with Hamerly's (2010) bounds, which give the same
+   clustering with far fewer distance computations once the centres
+   settle.  Each point keeps an upper bound u on the distance to its
+   centre and a lower bound l on that to any other: when the centres
+   move these grow and shrink by the distances moved, and the point
+   cannot change cluster while u <= max(l, s), s being half the
+   distance from its centre to the nearest other.  Only O(n) bounds are
+   kept, unlike the O(nk) of Elkan's algorithm.
+
+   For large problems the assignment and update steps are done in
+   parallel on R_num_math_threads threads, the centre sums being
+   accumulated per thread over contiguous blocks of points. */
+
+#define KM_THREADS_MIN 1e5
+
+static R_INLINE double km_dist(const double *x, size_t n, int p, size_t i,
+			       const double *c)
+{
+    double dd = 0.0, tmp;
+    for(int l = 0; l < p; l++) {
+	tmp = x[i + n * l] - c[l];
+	dd += tmp * tmp;
+    }
+    return sqrt(dd);
+}
+
+void kmeans_Hamerly(double *x, int *pn, int *pp, double *cen, int *pk,
+		    int *cl, int *pmaxiter, int *nc, double *wss)
+{
+    int n = *pn, k = *pk, p = *pp, maxiter = *pmaxiter, iter, i, nt = 1;
+    size_t N = n, KP = (size_t) k * p;
+    double *ct = (double *) R_alloc(KP, sizeof(double)),
+	*cold = (double *) R_alloc(KP, sizeof(double)),
+	*s = (double *) R_alloc(k, sizeof(double)),
+	*delta = (double *) R_alloc(k, sizeof(double)),
+	*u = (double *) R_alloc(N, sizeof(double)),
+	*lb = (double *) R_alloc(N, sizeof(double));
+
+#ifdef _OPENMP
+    if(R_num_math_threads > 1 && (double) n * p * k >= KM_THREADS_MIN)
+	nt = R_num_math_threads;
+#endif
+    double *sums = (double *) R_alloc(nt * KP, sizeof(double));
+    int *cnt = (int *) R_alloc((size_t) nt * k, sizeof(int));
+
+    /* the centres a row each */
+    for(int j = 0; j < k; j++)
+	for(int l = 0; l < p; l++) ct[j * p + l] = cen[j + k * l];
+    for(int i = 0; i < n; i++) cl[i] = -1;
+
+    for(iter = 0; iter < maxiter; iter++) {
+	for(int j = 0; j < k; j++) {
+	    double sj = R_PosInf;
+	    for(int j2 = 0; j2 < k; j2++) {
+		if(j2 == j) continue;
+		double dd = 0.0, tmp;
+		for(int l = 0; l < p; l++) {
+		    tmp = ct[j * p + l] - ct[j2 * p + l];
+		    dd += tmp * tmp;
+		}
+		if(dd < sj) sj = dd;
+	    }
+	    s[j] = sqrt(sj) / 2;
+	}
+
+	/* the assignment step */
+	int changed = 0;
+	double inf = R_PosInf;
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(nt) default(none) reduction(+:changed) \
+    firstprivate(x, N, n, p, k, ct, s, u, lb, cl, iter, inf)
+#endif
+	for(i = 0; i < n; i++) {
+	    if(iter > 0) {
+		int a = cl[i] - 1;
+		double m = (s[a] > lb[i]) ? s[a] : lb[i];
+		if(u[i] <= m) continue;
+		u[i] = km_dist(x, N, p, i, ct + (size_t) a * p);
+		if(u[i] <= m) continue;
+	    }
+	    double best = inf, second = inf;
+	    int inew = 0;
+	    for(int j = 0; j < k; j++) {
+		double dd = km_dist(x, N, p, i, ct + (size_t) j * p);
+		if(dd < best) {
+		    second = best;
+		    best = dd;
+		    inew = j + 1;
+		} else if(dd < second)
+		    second = dd;
+	    }
+	    u[i] = best;
+	    lb[i] = second;
+	    if(cl[i] != inew) {
+		cl[i] = inew;
+		changed++;
+	    }
+	}
+	if(!changed) break;
+
+	/* the update step: sums over blocks of points, then the centres */
+	int t;
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(nt) default(none) \
+    firstprivate(x, N, n, p, k, KP, nt, cl, sums, cnt)
+#endif
+	for(t = 0; t < nt; t++) {
+	    double *st = sums + t * KP;
+	    int *ck = cnt + (size_t) t * k;
+	    size_t i0 = N * t / nt, i1 = N * (t + 1) / nt;
+	    for(size_t j = 0; j < KP; j++) st[j] = 0.0;
+	    for(int j = 0; j < k; j++) ck[j] = 0;
+	    for(size_t ii = i0; ii < i1; ii++) {
+		int it = cl[ii] - 1;
+		ck[it]++;
+		for(int l = 0; l < p; l++) st[it + (size_t) l * k] += x[ii + N * l];
+	    }
+	}
+	Memcpy(cold, ct, KP);
+	for(int j = 0; j < k; j++) {
+	    nc[j] = 0;
+	    for(t = 0; t < nt; t++) nc[j] += cnt[(size_t) t * k + j];
+	}
+	for(size_t j = 0; j < KP; j++) {
+	    double sj = 0.0;
+	    for(t = 0; t < nt; t++) sj += sums[t * KP + j];
+	    cen[j] = sj / nc[j % k];
+	}
+	for(int j = 0; j < k; j++)
+	    for(int l = 0; l < p; l++) ct[j * p + l] = cen[j + k * l];
+
+	/* the bounds, for the distances the centres moved */
+	double dmax = 0.0, dmax2 = 0.0;
+	int jmax = -1;
+	for(int j = 0; j < k; j++) {
+	    double dd = 0.0, tmp;
+	    for(int l = 0; l < p; l++) {
+		tmp = ct[j * p + l] - cold[j * p + l];
+		dd += tmp * tmp;
+	    }
+	    delta[j] = sqrt(dd);
+	    if(delta[j] > dmax) {
+		dmax2 = dmax;
+		dmax = delta[j];
+		jmax = j;
+	    } else if(delta[j] > dmax2)
+		dmax2 = delta[j];
+	}
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(nt) default(none) \
+    firstprivate(n, cl, u, lb, delta, dmax, dmax2, jmax)
+#endif
+	for(i = 0; i < n; i++) {
+	    int a = cl[i] - 1;
+	    u[i] += delta[a];
+	    lb[i] -= (a == jmax) ? dmax2 : dmax;
+	}
+    }
+
+    *pmaxiter = iter + 1;
+    for(int j = 0; j < k; j++) wss[j] = 0.0;
+    for(i = 0; i < n; i++) {
+	int it = cl[i] - 1;
+	for(int c = 0; c < p; c++) {
+	    double tmp = x[i + N * c] - cen[it + k * c];
+	    wss[it] += tmp * tmp;
+	}
+    }
+}
+
 void kmeans_MacQueen(double *x, int *pn, int *pp, double *cen, int *pk,
 		     int *cl, int *pmaxiter, int *nc, double *wss)
 {
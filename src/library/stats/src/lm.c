@@ -20,6 +20,8 @@
 #include <R.h>
 #include <Rinternals.h>
 #include <R_ext/Applic.h>
+#include <R_ext/Linpack.h> /* for dqrsl */
+#include <R_ext/Lapack.h>  /* for dlarfg etc and BLAS */
 
 #include "statsR.h"
 
@@ -30,6 +32,124 @@
 #define _(String) (String)
 #endif
 
+/* For large problems Cdqrls uses a blocked Householder QR in place of
+   LINPACK's dqrdc2, so that most of the work is done by level-3 BLAS
+   (dlarfb).  It keeps dqrdc2's limited column pivoting: a column whose
+   remaining norm is less than tol times its original norm is moved to
+   the end, the others keeping their order, and the rank is the number
+   not moved.  Panels of QR_NB columns are factored a column at a time;
+   a column moved out of a panel has the panel's reflectors undone
+   first, so that it is updated with the other trailing columns.  The
+   result is converted to the LINPACK form of the reflectors (as
+   dqrdc2 gives), which dqrsl and qr.qy() etc use. */
+
+#define QR_NB 32
+#define QR_BLOCKED_MIN 1e6
+
+static Rboolean use_blocked_qr(int n, int p)
+{
+    return p > QR_NB && (double) n * p >= QR_BLOCKED_MIN;
+}
+
+static void dqrdc2_blocked(double *x, int n, int p, double tol, int *rank,
+			   double *qraux, int *jpvt)
+{
+    int lup = (n < p) ? n : p, k = p, one = 1;
+    size_t N = n;
+    double *nrm0 = (double *) R_alloc(p, sizeof(double)),
+	*diag = (double *) R_alloc(p, sizeof(double)),
+	*col = (double *) R_alloc(n, sizeof(double)),
+	*T = (double *) R_alloc(QR_NB * QR_NB, sizeof(double)),
+	*work = (double *) R_alloc((size_t) p * QR_NB, sizeof(double));
+
+    for (int j = 0; j < p; j++) {
+	nrm0[j] = F77_CALL(dnrm2)(&n, x + j * N, &one);
+	if (nrm0[j] == 0.) nrm0[j] = 1.;
+	qraux[j] = 0.;
+    }
+    for (int j = 0, jend; j < lup; j = jend) {
+	jend = (j + QR_NB < lup) ? j + QR_NB : lup;
+	for (int l = j; l < jend; l++) {
+	    int m = n - l;
+	    while (l < k && F77_CALL(dnrm2)(&m, x + l + l * N, &one) <
+		   tol * nrm0[l]) {
+		/* undo this panel's reflectors and move column l to the end */
+		double *xl = x + l * N;
+		for (int i = l - 1; i >= j; i--) {
+		    int mi = n - i;
+		    F77_CALL(dlarf)("L", &mi, &one, x + i + i * N, &one,
+				    qraux + i, xl + i, &n, work);
+		}
+		Memcpy(col, xl, N);
+		memmove(xl, xl + N, (size_t) (p - l - 1) * N * sizeof(double));
+		Memcpy(x + (p - 1) * N, col, N);
+		int ip = jpvt[l];
+		double t = nrm0[l];
+		for (int i = l + 1; i < p; i++) {
+		    jpvt[i - 1] = jpvt[i];
+		    nrm0[i - 1] = nrm0[i];
+		}
+		jpvt[p - 1] = ip;
+		nrm0[p - 1] = t;
+		k--;
+		/* the column which has moved into the panel's last place
+		   needs the panel's reflectors so far */
+		for (int i = j; i < l; i++) {
+		    int mi = n - i;
+		    F77_CALL(dlarf)("L", &mi, &one, x + i + i * N, &one,
+				    qraux + i, x + i + (jend - 1) * N, &n, work);
+		}
+	    }
+	    /* the reflector for column l, with its leading 1 in place
+	       until the panel is done */
+	    double *xll = x + l + l * N;
+	    if (m > 1)
+		F77_CALL(dlarfg)(&m, xll, xll + 1, &one, qraux + l);
+	    else qraux[l] = 0.;
+	    diag[l] = *xll;
+	    *xll = 1.;
+	    int nc = jend - l - 1;
+	    if (nc > 0)
+		F77_CALL(dlarf)("L", &m, &nc, xll, &one, qraux + l,
+				xll + N, &n, work);
+	}
+	int mj = n - j, nb = jend - j, nt = p - jend;
+	if (nt > 0) {
+	    int ldt = QR_NB;
+	    F77_CALL(dlarft)("F", "C", &mj, &nb, x + j + j * N, &n,
+			     qraux + j, T, &ldt);
+	    F77_CALL(dlarfb)("L", "T", "F", "C", &mj, &nt, &nb,
+			     x + j + j * N, &n, T, &ldt,
+			     x + j + jend * N, &n, work, &nt);
+	}
+	for (int l = j; l < jend; l++) x[l + l * N] = diag[l];
+    }
+    /* LAPACK's reflector I - tau v v' with v[l] = 1 is LINPACK's
+       I - u u'/u[l] with u = tau v, and u[l] = tau stored in qraux */
+    for (int l = 0; l < lup; l++)
+	for (int i = l + 1; i < n; i++) x[i + l * N] *= qraux[l];
+    *rank = (k < n) ? k : n;
+}
+
+/* dqrls() with dqrdc2_blocked() for the decomposition */
+static void dqrls_blocked(double *x, int n, int p, double *y, int ny,
+			  double tol, double *b, double *rsd, double *qty,
+			  int *rank, int *jpvt, double *qraux)
+{
+    int k, job = 1110, info;
+    dqrdc2_blocked(x, n, p, tol, &k, qraux, jpvt);
+    for (int jj = 0; jj < ny; jj++) {
+	size_t on = (size_t) jj * n, op = (size_t) jj * p;
+	if (k > 0)
+	    F77_CALL(dqrsl)(x, &n, &n, &k, qraux, y + on, rsd + on, qty + on,
+			    b + op, rsd + on, rsd + on, &job, &info);
+	else
+	    Memcpy(rsd + on, y + on, n);
+	for (int j = k; j < p; j++) b[op + j] = 0.;
+    }
+    *rank = k;
+}
+
 /* A wrapper to replace
 
     z <- .Fortran("dqrls",
@@ -97,10 +217,16 @@ SEXP Cdqrls(SEXP x, SEXP y, SEXP tol, SEXP chk)
     SET_VECTOR_ELT(ans, 6, qraux);
     SET_VECTOR_ELT(ans, 7, tol);
 
-    work = (double *) R_alloc(2 * p, sizeof(double));
-    F77_CALL(dqrls)(REAL(qr), &n, &p, REAL(y), &ny, &rtol,
-		    REAL(coefficients), REAL(residuals), REAL(effects),
-		    &rank, INTEGER(pivot), REAL(qraux), work);
+    if (use_blocked_qr(n, p))
+	dqrls_blocked(REAL(qr), n, p, REAL(y), ny, rtol,
+		      REAL(coefficients), REAL(residuals), REAL(effects),
+		      &rank, INTEGER(pivot), REAL(qraux));
+    else {
+	work = (double *) R_alloc(2 * p, sizeof(double));
+	F77_CALL(dqrls)(REAL(qr), &n, &p, REAL(y), &ny, &rtol,
+			REAL(coefficients), REAL(residuals), REAL(effects),
+			&rank, INTEGER(pivot), REAL(qraux), work);
+    }
     SET_VECTOR_ELT(ans, 4, ScalarInteger(rank));
     for(int i = 0; i < p; i++)
 	if(ip[i] != i+1) { pivoted = 1; break; }
@@ -109,3 +235,243 @@ SEXP Cdqrls(SEXP x, SEXP y, SEXP tol, SEXP chk)
 
     return ans;
 }
+
+/* One step of fitting a linear model a block of rows at a time: the
+   QR decomposition of rbind(R, x), with R the p x p triangular factor
+   of the rows so far, gives the factor of all the rows, and applying
+   its Q' to rbind(qty, y) gives their Q'y in the first p rows and the
+   new contributions to the residual sum of squares in the rest.  So
+   only p x p and p x ny summaries are kept between blocks.  Returns
+   list(R, qty, rss) updated for the rows of x and y. */
+SEXP Cqrupdate(SEXP R, SEXP qty, SEXP rss, SEXP x, SEXP y)
+{
+    SEXP dims = getAttrib(R, R_DimSymbol);
+    if (TYPEOF(R) != REALSXP || length(dims) != 2 ||
+	INTEGER(dims)[0] != INTEGER(dims)[1])
+	error(_("invalid '%s' argument"), "R");
+    int p = INTEGER(dims)[0], ny = LENGTH(rss);
+    if (TYPEOF(qty) != REALSXP || XLENGTH(qty) != (R_xlen_t) p * ny ||
+	TYPEOF(rss) != REALSXP)
+	error(_("invalid '%s' argument"), "qty");
+    dims = getAttrib(x, R_DimSymbol);
+    if (length(dims) != 2 || INTEGER(dims)[1] != p)
+	error(_("'x' must be a matrix with %d columns"), p);
+    int m = INTEGER(dims)[0], mm = p + m, nprotect = 0;
+    if (XLENGTH(y) != (R_xlen_t) m * ny)
+	error(_("dimensions of 'x' (%d,%d) and 'y' (%d) do not match"),
+	      m, p, XLENGTH(y));
+    if (TYPEOF(x) != REALSXP) {
+	PROTECT(x = coerceVector(x, REALSXP));
+	nprotect++;
+    }
+    if (TYPEOF(y) != REALSXP) {
+	PROTECT(y = coerceVector(y, REALSXP));
+	nprotect++;
+    }
+    const double *rx = REAL(x), *ry = REAL(y);
+    for (R_xlen_t i = 0 ; i < XLENGTH(x) ; i++)
+	if(!R_FINITE(rx[i])) error(_("NA/NaN/Inf in '%s'"), "x");
+    for (R_xlen_t i = 0 ; i < XLENGTH(y) ; i++)
+	if(!R_FINITE(ry[i])) error(_("NA/NaN/Inf in '%s'"), "y");
+
+    /* the stacked matrices */
+    size_t MM = mm;
+    double *a = (double *) R_alloc(MM * p, sizeof(double)),
+	*b = (double *) R_alloc(MM * ny, sizeof(double)),
+	*tau = (double *) R_alloc(p ? p : 1, sizeof(double));
+    for (int j = 0; j < p; j++) {
+	Memcpy(a + j * MM, REAL(R) + (size_t) j * p, p);
+	Memcpy(a + j * MM + p, rx + (size_t) j * m, m);
+    }
+    for (int j = 0; j < ny; j++) {
+	Memcpy(b + j * MM, REAL(qty) + (size_t) j * p, p);
+	Memcpy(b + j * MM + p, ry + (size_t) j * m, m);
+    }
+    int info, lwork = -1;
+    double tmp;
+    if (p > 0) {
+	F77_CALL(dgeqrf)(&mm, &p, a, &mm, tau, &tmp, &lwork, &info);
+	lwork = (int) tmp;
+	F77_CALL(dormqr)("L", "T", &mm, &ny, &p, a, &mm, tau, b, &mm,
+			 &tmp, &lwork, &info);
+	if ((int) tmp > lwork) lwork = (int) tmp;
+	double *work = (double *) R_alloc(lwork, sizeof(double));
+	F77_CALL(dgeqrf)(&mm, &p, a, &mm, tau, work, &lwork, &info);
+	if (info != 0)
+	    error(_("error code %d from Lapack routine '%s'"), info, "dgeqrf");
+	F77_CALL(dormqr)("L", "T", &mm, &ny, &p, a, &mm, tau, b, &mm,
+			 work, &lwork, &info);
+	if (info != 0)
+	    error(_("error code %d from Lapack routine '%s'"), info, "dormqr");
+    }
+
+    const char *ansNms[] = {"R", "qty", "rss", ""};
+    SEXP ans = PROTECT(mkNamed(VECSXP, ansNms));
+    SEXP R2 = allocMatrix(REALSXP, p, p);
+    SET_VECTOR_ELT(ans, 0, R2);
+    double *r2 = REAL(R2);
+    for (int j = 0; j < p; j++)
+	for (int i = 0; i < p; i++)
+	    r2[i + (size_t) j * p] = (i <= j) ? a[i + j * MM] : 0.;
+    SEXP qty2 = allocVector(REALSXP, (R_xlen_t) p * ny);
+    SET_VECTOR_ELT(ans, 1, qty2);
+    SEXP rss2 = allocVector(REALSXP, ny);
+    SET_VECTOR_ELT(ans, 2, rss2);
+    for (int j = 0; j < ny; j++) {
+	double s = REAL(rss)[j];
+	Memcpy(REAL(qty2) + (size_t) j * p, b + j * MM, p);
+	for (int i = p; i < mm; i++) s += b[i + j * MM] * b[i + j * MM];
+	REAL(rss2)[j] = s;
+    }
+    UNPROTECT(nprotect + 1);
+    return ans;
+}
+
+/* Least squares for a sparse model matrix, as list(i, p, x, Dim) in
+   compressed sparse column form (see sparse_modelmatrix in model.c),
+   by the normal equations.  X'X and X'y are accumulated a row of X at
+   a time, so the work is the sum of the squares of the numbers of
+   nonzeros in the rows, and X'X is factored by a Choleski
+   decomposition with dqrdc2's limited pivoting: a column whose
+   remaining squared norm is less than tol^2 (but at least 1000 times
+   the machine epsilon) times its original squared norm is aliased (its
+   coefficient is NA) and the others keep their order.  Returns list(coefficients, residuals, fitted.values, rank,
+   pivot, R), R being the Choleski factor of the columns not aliased. */
+SEXP Csparsels(SEXP x, SEXP y, SEXP tol)
+{
+    SEXP si = getListElement(x, "i"), sp = getListElement(x, "p"),
+	sx = getListElement(x, "x"), dims = getListElement(x, "Dim");
+    if (TYPEOF(si) != INTSXP || TYPEOF(sp) != INTSXP ||
+	TYPEOF(sx) != REALSXP || TYPEOF(dims) != INTSXP || LENGTH(dims) != 2)
+	error(_("invalid sparse model matrix"));
+    int n = INTEGER(dims)[0], p = INTEGER(dims)[1], nprotect = 0;
+    const int *ci = INTEGER(si), *cp = INTEGER(sp);
+    const double *cx = REAL(sx);
+    if (LENGTH(sp) != p + 1 || cp[0] != 0 || LENGTH(si) != cp[p] ||
+	LENGTH(sx) != cp[p])
+	error(_("invalid sparse model matrix"));
+    R_xlen_t nnz = cp[p];
+    for (R_xlen_t e = 0; e < nnz; e++) {
+	if (ci[e] < 0 || ci[e] >= n)
+	    error(_("invalid sparse model matrix"));
+	if (!R_FINITE(cx[e])) error(_("NA/NaN/Inf in '%s'"), "x");
+    }
+    if (XLENGTH(y) % (n ? n : 1) != 0 || (n == 0 && XLENGTH(y)))
+	error(_("dimensions of 'x' (%d,%d) and 'y' (%d) do not match"),
+	      n, p, XLENGTH(y));
+    int ny = n ? (int) (XLENGTH(y) / n) : 0;
+    if (TYPEOF(y) != REALSXP) {
+	PROTECT(y = coerceVector(y, REALSXP));
+	nprotect++;
+    }
+    const double *ry = REAL(y);
+    for (R_xlen_t i = 0 ; i < XLENGTH(y) ; i++)
+	if(!R_FINITE(ry[i])) error(_("NA/NaN/Inf in '%s'"), "y");
+    double rtol = asReal(tol);
+    if (!R_FINITE(rtol) || rtol < 0)
+	error(_("invalid '%s' argument"), "tol");
+    size_t P = p, N = n;
+
+    /* the rows of X, with their entries in column order */
+    int *rp = (int *) R_alloc(N + 1, sizeof(int)),
+	*rk = (int *) R_alloc(nnz ? nnz : 1, sizeof(int));
+    double *rv = (double *) R_alloc(nnz ? nnz : 1, sizeof(double));
+    for (int i = 0; i <= n; i++) rp[i] = 0;
+    for (R_xlen_t e = 0; e < nnz; e++) rp[ci[e] + 1]++;
+    for (int i = 0; i < n; i++) rp[i + 1] += rp[i];
+    for (int k = 0; k < p; k++)
+	for (int e = cp[k]; e < cp[k + 1]; e++) {
+	    int pos = rp[ci[e]]++;
+	    rk[pos] = k;
+	    rv[pos] = cx[e];
+	}
+    for (int i = n; i > 0; i--) rp[i] = rp[i - 1];
+    rp[0] = 0;
+
+    /* the upper triangle of X'X, and X'y */
+    double *a = (double *) R_alloc(P * P, sizeof(double)),
+	*xty = (double *) R_alloc(P * ny, sizeof(double)),
+	*d0 = (double *) R_alloc(p, sizeof(double));
+    int *alias = (int *) R_alloc(p, sizeof(int));
+    for (size_t j = 0; j < P * P; j++) a[j] = 0.;
+    for (size_t j = 0; j < P * ny; j++) xty[j] = 0.;
+    for (int i = 0; i < n; i++) {
+	for (int e = rp[i]; e < rp[i + 1]; e++) {
+	    double *aj = a + rk[e] * P, v = rv[e];
+	    for (int f = rp[i]; f <= e; f++)
+		aj[rk[f]] += rv[f] * v;
+	    for (int j = 0; j < ny; j++)
+		xty[rk[e] + j * P] += v * ry[i + j * N];
+	}
+	if (i % 10000 == 9999) R_CheckUserInterrupt();
+    }
+
+    /* the Choleski factor R'R = X'X in place, with limited pivoting:
+       the threshold allows for the rounding error of forming X'X */
+    int rank = 0;
+    double thr = rtol * rtol;
+    if (thr < 1000 * DBL_EPSILON) thr = 1000 * DBL_EPSILON;
+    for (int j = 0; j < p; j++) d0[j] = (a[j + j * P] > 0.) ? a[j + j * P] : 1.;
+    for (int j = 0; j < p; j++) {
+	double *aj = a + j * P, d;
+	for (int i = 0; i < j; i++) {
+	    if (alias[i]) { aj[i] = 0.; continue; }
+	    double s = aj[i], *ai = a + i * P;
+	    for (int k = 0; k < i; k++) s -= ai[k] * aj[k];
+	    aj[i] = s / ai[i];
+	}
+	d = aj[j];
+	for (int k = 0; k < j; k++) d -= aj[k] * aj[k];
+	if ((alias[j] = (d < thr * d0[j]))) {
+	    for (int k = 0; k <= j; k++) aj[k] = 0.;
+	} else {
+	    aj[j] = sqrt(d);
+	    rank++;
+	}
+    }
+
+    /* solve R'z = X'y and R b = z */
+    const char *ansNms[] = {"coefficients", "residuals", "fitted.values",
+			    "rank", "pivot", "R", ""};
+    SEXP ans = PROTECT(mkNamed(VECSXP, ansNms)); nprotect++;
+    SEXP coef = SET_VECTOR_ELT(ans, 0, allocVector(REALSXP, P * ny)),
+	res = SET_VECTOR_ELT(ans, 1, allocVector(REALSXP, N * ny)),
+	fit = SET_VECTOR_ELT(ans, 2, allocVector(REALSXP, N * ny));
+    double *b = REAL(coef), *rf = REAL(fit), *rr = REAL(res);
+    for (int j = 0; j < ny; j++) {
+	double *bj = b + j * P;
+	Memcpy(bj, xty + j * P, P);
+	for (int i = 0; i < p; i++) {
+	    if (alias[i]) continue;
+	    double s = bj[i], *ai = a + i * P;
+	    for (int k = 0; k < i; k++) s -= ai[k] * bj[k];
+	    bj[i] = s / ai[i];
+	}
+	for (int i = p - 1; i >= 0; i--) {
+	    if (alias[i]) { bj[i] = 0.; continue; }
+	    double s = bj[i];
+	    for (int k = i + 1; k < p; k++) s -= a[i + k * P] * bj[k];
+	    bj[i] = s / a[i + i * P];
+	}
+	double *fj = rf + j * N;
+	for (int i = 0; i < n; i++) fj[i] = 0.;
+	for (int k = 0; k < p; k++)
+	    for (int e = cp[k]; e < cp[k + 1]; e++)
+		fj[ci[e]] += cx[e] * bj[k];
+	for (int i = 0; i < n; i++) rr[i + j * N] = ry[i + j * N] - fj[i];
+	for (int k = 0; k < p; k++)
+	    if (alias[k]) bj[k] = NA_REAL;
+    }
+    SET_VECTOR_ELT(ans, 3, ScalarInteger(rank));
+    SEXP pivot = SET_VECTOR_ELT(ans, 4, allocVector(INTSXP, p));
+    SEXP R = SET_VECTOR_ELT(ans, 5, allocMatrix(REALSXP, rank, rank));
+    int *ip = INTEGER(pivot), kk = 0;
+    for (int k = 0; k < p; k++) if (!alias[k]) ip[kk++] = k + 1;
+    for (int k = 0; k < p; k++) if (alias[k]) ip[kk++] = k + 1;
+    for (int j = 0; j < rank; j++)
+	for (int i = 0; i < rank; i++)
+	    REAL(R)[i + (size_t) j * rank] =
+		(i <= j) ? a[ip[i] - 1 + (ip[j] - 1) * P] : 0.;
+    UNPROTECT(nprotect);
+    return ans;
+}
@@ -27,6 +27,10 @@
 #include <math.h>
 #include <limits.h>
 #include <R.h>
+#ifdef _OPENMP
+# include <omp.h>
+# include <R_ext/MathThreads.h>
+#endif
 
 #ifdef ENABLE_NLS
 #include <libintl.h>
@@ -61,7 +65,17 @@ void F77_NAME(lowesl)(int*, int*, int*, double*, int*, double*, double*);
 void F77_NAME(ehg169)(int*, int*, int*, int*, int*, int*,
 		      double*, int*, double*, int*, int*, int*);
 void F77_NAME(ehg196)(int*, int*, double*, double*);
+void F77_NAME(ehg127)(double*, int*, int*, int*, double*, double*, int*,
+		      double*, double*, int*, int*, double*, double*,
+		      double*, int*, double*, double*, int*, double*,
+		      double*, double*, double*, double*, double*, double*,
+		      int*, int*, int*, double*);
 /* exported (for loessf.f) : */
+void F77_SUB(ehg127m)(double *u, int *lm, int *m, int *n, int *d, int *nf,
+		      double *f, double *x, int *psi, double *y, double *rw,
+		      int *kernel, int *k, double *dist, double *eta,
+		      double *b, int *od, double *w, double *rcond,
+		      int *sing, int *dd, int *tdeg, int *cdeg, double *s);
 void F77_SUB(ehg182)(int *i);
 void F77_SUB(ehg183a)(char *s, int *nc,int *i,int *n,int *inc);
 void F77_SUB(ehg184a)(char *s, int *nc, double *x, int *n, int *inc);
@@ -345,6 +359,119 @@ loess_grow(int *parameter, int *a, double *xi,
 }
 
 
+/* The local fits at many points: the vertices of the k-d tree (from
+   ehg139) or the points of a direct fit (from ehg136), when the
+   operator matrix L is not needed.  Each fit searches all n points for
+   the nearest nf, so for large problems the points are shared out
+   among threads, each with its own copy of ehg127's workspace. */
+
+/* Warnings from the Fortran code on other threads are given by the
+   main thread once they have finished. */
+#define LOESS_NDEFER 4
+static char loess_deferred[LOESS_NDEFER][200];
+static int loess_ndeferred;
+
+static void loess_warning(const char *msg)
+{
+#ifdef _OPENMP
+    if (omp_in_parallel()) {
+#pragma omp critical(loess_warning)
+	if (loess_ndeferred < LOESS_NDEFER) {
+	    strncpy(loess_deferred[loess_ndeferred], msg, 199);
+	    loess_deferred[loess_ndeferred++][199] = '\0';
+	}
+	return;
+    }
+#endif
+    warning("%s", msg);
+}
+
+#define LOESS_THREADS_MIN 1e6
+
+static void
+loess_fits(int l0, int l1, double *u, int lm, int *n, int *d, int *nf,
+	   double *f, double *x, int *psi, double *y, double *rw,
+	   int *kernel, int *k, double *dist, double *eta, double *b,
+	   int *od, double *w, double *rcond, int *sing, int *dd,
+	   int *tdeg, int *cdeg, double *s)
+{
+    double q[8], sigma[15], uu[15 * 15], e[15 * 15], dgamma[15],
+	qraux[15], work[15], tol;
+    for (int l = l0; l < l1; l++) {
+	for (int j = 0; j < *d; j++) q[j] = u[l + (size_t) lm * j];
+	F77_CALL(ehg127)(q, n, d, nf, f, x, psi, y, rw, kernel, k, dist,
+			 eta, b, od, w, rcond, sing, sigma, uu, e, dgamma,
+			 qraux, work, &tol, dd, tdeg, cdeg,
+			 s + (size_t) (*od + 1) * l);
+    }
+}
+
+void F77_SUB(ehg127m)(double *u, int *lm, int *m, int *n, int *d, int *nf,
+		      double *f, double *x, int *psi, double *y, double *rw,
+		      int *kernel, int *k, double *dist, double *eta,
+		      double *b, int *od, double *w, double *rcond,
+		      int *sing, int *dd, int *tdeg, int *cdeg, double *s)
+{
+    int M = *m, nthreads = 1;
+#ifdef _OPENMP
+    if (R_num_math_threads > 1 && M > 1 && (double) M * (*n) >= LOESS_THREADS_MIN)
+	nthreads = min(R_num_math_threads, M);
+#endif
+    if (nthreads == 1) {
+	loess_fits(0, M, u, *lm, n, d, nf, f, x, psi, y, rw, kernel, k,
+		   dist, eta, b, od, w, rcond, sing, dd, tdeg, cdeg, s);
+	return;
+    }
+
+    /* The first thread uses the caller's workspace, the others copies
+       starting from its permutation psi.  The points are split into
+       contiguous blocks, so the result depends only on the number of
+       threads (via the order of the nearest neighbours). */
+    size_t N = *n, NF = *nf, lwork = N + (2 + (size_t) *k) * NF;
+    const void *vmax = vmaxget();
+    int *ipsi = (int *) R_alloc(N * (nthreads - 1), sizeof(int));
+    double *work = (double *) R_alloc(lwork * (nthreads - 1), sizeof(double));
+    double *rc = (double *) R_alloc(nthreads, sizeof(double));
+    int *sg = (int *) R_alloc(2 * nthreads, sizeof(int)), *kk = sg + nthreads;
+    int lm0 = *lm, sing0 = *sing;
+    double rcond0 = *rcond;
+    for (int t = 1; t < nthreads; t++)
+	memcpy(ipsi + N * (t - 1), psi, N * sizeof(int));
+    loess_ndeferred = 0;
+#ifdef _OPENMP
+# pragma omp parallel for num_threads(nthreads) schedule(static) \
+    default(none) firstprivate(u, lm0, M, n, d, nf, f, x, psi, y, rw, \
+			       kernel, k, dist, eta, b, od, w, rcond0, \
+			       sing0, dd, tdeg, cdeg, s, N, NF, lwork, \
+			       ipsi, work, rc, sg, kk, nthreads)
+#endif
+    for (int t = 0; t < nthreads; t++) {
+	int l0 = (int) ((double) M * t / nthreads),
+	    l1 = (int) ((double) M * (t + 1) / nthreads);
+	int *tpsi = psi;
+	double *tdist = dist, *teta = eta, *tb = b, *tw = w;
+	if (t > 0) {
+	    tpsi = ipsi + N * (t - 1);
+	    tdist = work + lwork * (t - 1);
+	    teta = tdist + N;
+	    tw = teta + NF;
+	    tb = tw + NF;
+	}
+	rc[t] = rcond0; sg[t] = sing0; kk[t] = *k;
+	loess_fits(l0, l1, u, lm0, n, d, nf, f, x, tpsi, y, rw, kernel,
+		   &kk[t], tdist, teta, tb, od, tw, &rc[t], &sg[t], dd,
+		   tdeg, cdeg, s);
+    }
+    for (int t = 0; t < nthreads; t++) {
+	*rcond = min(*rcond, rc[t]);
+	*sing += sg[t] - sing0;
+    }
+    *k = kk[0];
+    vmaxset(vmax);
+    for (int i = 0; i < loess_ndeferred; i++)
+	warning("%s", loess_deferred[i]);
+}
+
 /* begin ehg's FORTRAN-callable C-codes */
 #define MSG(_m_)	msg = _(_m_) ; break ;
 
@@ -394,7 +521,7 @@ switch(*i){
      msg = msg2;
  }
 }
-warning(msg);
+loess_warning(msg);
 }
 #undef MSG
 
@@ -409,7 +536,7 @@ void F77_SUB(ehg183a)(char *s, int *nc,int *i,int *n,int *inc)
 	strcat(mess,num);
     }
     strcat(mess,"\n");
-    warning(mess);
+    loess_warning(mess);
 }
 
 void F77_SUB(ehg184a)(char *s, int *nc, double *x, int *n, int *inc)
@@ -423,5 +550,5 @@ void F77_SUB(ehg184a)(char *s, int *nc, double *x, int *n, int *inc)
 	strcat(mess,num);
     }
     strcat(mess,"\n");
-    warning(mess);
+    loess_warning(mess);
 }
@@ -231,7 +231,7 @@ c     bottom of while loop
 
       subroutine ehg127(q,n,d,nf,f,x,psi,y,rw,kernel,k,dist,eta,b,od,w,
      +     rcond,sing,sigma,u,e,dgamma,qraux,work,tol,dd,tdeg,cdeg,s)
-      integer column,d,dd,execnt,i,i3,i9,info,inorm2,j,jj,jpvt,k,kernel,
+      integer column,d,dd,i,i3,i9,info,inorm2,j,jj,jpvt,k,kernel,
      +     n,nf,od,sing,tdeg
       integer cdeg(8),psi(n)
       double precision machep,f,i1,i10,i2,i4,i5,i6,i7,i8,rcond,rho,scal,
@@ -246,18 +246,14 @@ c     bottom of while loop
       external ehg106,ehg182,ehg184,dqrdc,dqrsl,dsvdc
       external idamax, d1mach, ddot
 
-      save machep,execnt
-      data execnt /0/
 c     colnorm -> colnor
 c     E -> g
 c     MachEps -> machep
 c     V -> e
 c     X -> b
-      execnt=execnt+1
-      if(execnt.eq.1)then
-c     initialize  d1mach(4) === 1 / DBL_EPSILON === 2^52  :
-         machep=d1mach(4)
-      end if
+c     no saved state, as ehg127m() may call this on several threads
+c     d1mach(4) === 1 / DBL_EPSILON === 2^52  :
+      machep=d1mach(4)
 c     sort by distance
       do 3 i3=1,n
          dist(i3)=0
@@ -1228,7 +1224,7 @@ c     nf = min(n, floor(f * n))
      $     dist(n),eta(nf),dgamma(15),q(8),qraux(15),rw(n),s(0:od,m),
      $     u(lm,d),w(nf),work(15),x(n,d),y(n)
 
-      external ehg127,ehg182,dqrsl
+      external ehg127,ehg127m,ehg182,dqrsl
       double precision ddot
       external ddot
 
@@ -1242,6 +1238,12 @@ c     X -> b
       do 3 identi=1,n
          psi(identi)=identi
     3 continue
+c     without L, the fits at the points are independent: see ./loessc.c
+      if(ihat.eq.0)then
+         call ehg127m(u,lm,m,n,d,nf,f,x,psi,y,rw,kernel,k,dist,eta,b,
+     +        od,w,rcond,sing,dd,tdeg,cdeg,s)
+         return
+      end if
       do 4 l=1,m
          do 5 i1=1,d
             q(i1)=u(l,i1)
@@ -1348,7 +1350,7 @@ c somewhat similar to ehg136
      +     x(n,d),xi(ncmax),y(n),z(8)
       DOUBLE PRECISION phi(n)
 
-      external ehg127,ehg182,DQRSL,ehg137
+      external ehg127,ehg127m,ehg182,DQRSL,ehg137
       DOUBLE PRECISION ehg128
       external ehg128
       DOUBLE PRECISION DDOT
@@ -1373,6 +1375,12 @@ c     l2fit with trace(L)
       do 6 identi=1,n
          psi(identi)=identi
     6 continue
+c     without trace(L) or Lf, the vertex fits are independent
+      if(trl.eq.0 .and. .not.setlf)then
+         call ehg127m(v,nvmax,nv,n,d,nf,f,x,psi,y,rw,kernel,k,dist,eta,
+     +        b,od,w,rcond,sing,dd,tdeg,cdeg,s)
+         return
+      end if
       do 7 l=1,nv
          do 8 i5=1,d
             q(i5)=v(l,i5)
@@ -323,6 +323,196 @@ static SEXP ColumnNames(SEXP x)
 	return VECTOR_ELT(dn, 1);
 }
 
+/* The sparse form of the model matrix, in compressed sparse column
+   form as for class "dgCMatrix" of package Matrix: 0-based row indices
+   'i', column pointers 'p' and values 'x'.  A row of the columns of a
+   term is the product of the entries of its variables in that row, so
+   only the nonzero products are formed: for a factor these are the
+   nonzero entries of its level's row of the contrast matrix, a single
+   one for dummy coding.  A row with a missing or non-finite value in
+   one of the term's variables is formed in full, to give the same
+   NA/NaN entries as the dense matrix. */
+
+typedef struct {
+    int ncol, nrc;
+    int *v;		/* factor codes, or NULL for a numeric variable */
+    double *c;		/* the contrast matrix (nrc x ncol) or the variable */
+    int *lp, *lk;	/* the nonzero columns of each row of the contrast */
+} mmvar;
+
+static void mmvar_factor(mmvar *mv, int *v, SEXP contrast)
+{
+    int nrc = nrows(contrast), ncc = ncols(contrast), e = 0;
+    double *c = REAL(contrast);
+
+    mv->v = v; mv->c = c; mv->nrc = nrc; mv->ncol = ncc;
+    mv->lp = (int *) R_alloc(nrc + 1, sizeof(int));
+    mv->lk = (int *) R_alloc(nrc * (size_t) ncc, sizeof(int));
+    for (int l = 0; l < nrc; l++) {
+	mv->lp[l] = e;
+	for (int k = 0; k < ncc; k++)
+	    if (c[l + k * (R_xlen_t)nrc] != 0.) mv->lk[e++] = k;
+    }
+    mv->lp[nrc] = e;
+}
+
+static Rboolean mmvar_full(const mmvar *mv, R_xlen_t r, R_xlen_t n)
+{
+    if (mv->v) return mv->v[r] == NA_INTEGER;
+    for (int k = 0; k < mv->ncol; k++)
+	if (!R_FINITE(mv->c[r + k * n])) return TRUE;
+    return FALSE;
+}
+
+/* the entries (column k[], value w[]) of variable mv in row r */
+static int mmvar_entries(const mmvar *mv, R_xlen_t r, R_xlen_t n,
+			 Rboolean full, int *k, double *w)
+{
+    int m = 0;
+    if (mv->v) {
+	int l = mv->v[r];
+	if (l == NA_INTEGER)
+	    for (int kk = 0; kk < mv->ncol; kk++) {
+		k[m] = kk; w[m++] = NA_REAL;
+	    }
+	else if (full)
+	    for (int kk = 0; kk < mv->ncol; kk++) {
+		k[m] = kk; w[m++] = mv->c[l - 1 + kk * (R_xlen_t)mv->nrc];
+	    }
+	else
+	    for (int e = mv->lp[l - 1]; e < mv->lp[l]; e++, m++) {
+		k[m] = mv->lk[e];
+		w[m] = mv->c[l - 1 + k[m] * (R_xlen_t)mv->nrc];
+	    }
+    } else
+	for (int kk = 0; kk < mv->ncol; kk++) {
+	    double xv = mv->c[r + kk * n];
+	    if (full || xv != 0.) {
+		k[m] = kk; w[m++] = xv;
+	    }
+	}
+    return m;
+}
+
+static SEXP sparse_modelmatrix(int n, int nc, int intrcept, int nterms,
+			       int nVar, int rhs_response, SEXP factors,
+			       SEXP variable, SEXP nlevs, SEXP columns,
+			       SEXP contr1, SEXP contr2, SEXP count)
+{
+    SEXP ans, si = R_NilValue, sp, sx = R_NilValue, contrasts, dim;
+    int maxc = 1, maxv = 1, *ii = NULL;
+    double *xx = NULL;
+    const char *nms[] = {"i", "p", "x", "Dim", "Dimnames", ""};
+    R_xlen_t nn = n, *pos = (R_xlen_t *) R_alloc(nc + 1, sizeof(R_xlen_t));
+    mmvar *mv = (mmvar *) R_alloc(nVar, sizeof(mmvar));
+
+    for (int k = 0; k < nterms; k++)
+	if (INTEGER(count)[k] > maxc) maxc = INTEGER(count)[k];
+    for (int i = 0; i < nVar; i++)
+	if (INTEGER(columns)[i] > maxv) maxv = INTEGER(columns)[i];
+    for (int i = 0; i < nVar; i++)
+	for (int l = 1; l <= 2; l++) {
+	    SEXP ci = VECTOR_ELT(l == 1 ? contr1 : contr2, i);
+	    if (ci != R_NilValue && ncols(ci) > maxv) maxv = ncols(ci);
+	}
+    int *kb[2], *ke = (int *) R_alloc(maxv, sizeof(int));
+    double *wb[2], *we = (double *) R_alloc(maxv, sizeof(double));
+    for (int b = 0; b < 2; b++) {
+	kb[b] = (int *) R_alloc(maxc, sizeof(int));
+	wb[b] = (double *) R_alloc(maxc, sizeof(double));
+    }
+
+    PROTECT(ans = mkNamed(VECSXP, nms));
+    PROTECT(contrasts = allocVector(VECSXP, 2 * nVar));
+    sp = SET_VECTOR_ELT(ans, 1, allocVector(INTSXP, nc + 1));
+
+    /* The first pass counts the entries of each column, the second
+       fills them in: the rows of each column are then in order. */
+    for (int pass = 0; pass < 2; pass++) {
+	if (pass == 0)
+	    for (int j = 0; j <= nc; j++) pos[j] = 0;
+	else {
+	    R_xlen_t nnz = 0;
+	    for (int j = 0; j < nc; j++) {
+		R_xlen_t cj = pos[j];
+		pos[j] = nnz;
+		nnz += cj;
+	    }
+	    if (nnz > INT_MAX)
+		error(_("sparse model matrix would have %.0f nonzero entries"),
+		      (double) nnz);
+	    for (int j = 0; j < nc; j++) INTEGER(sp)[j] = (int) pos[j];
+	    INTEGER(sp)[nc] = (int) nnz;
+	    si = SET_VECTOR_ELT(ans, 0, allocVector(INTSXP, nnz));
+	    sx = SET_VECTOR_ELT(ans, 2, allocVector(REALSXP, nnz));
+	    ii = INTEGER(si); xx = REAL(sx);
+	}
+#define MM_ENTRY(j, r, val) do {			\
+	    if (pass == 0) pos[j]++;			\
+	    else {					\
+		ii[pos[j]] = (int) (r);			\
+		xx[pos[j]++] = (val);			\
+	    }						\
+	} while (0)
+
+	int jstart = intrcept;
+	if (intrcept)
+	    for (int r = 0; r < n; r++) MM_ENTRY(0, r, 1.0);
+	for (int k = 0; k < nterms; k++) {
+	    if (k == rhs_response) continue;
+	    int q = 0;
+	    for (int i = 0; i < nVar; i++) {
+		if (INTEGER(columns)[i] == 0) continue;
+		int fik = INTEGER(factors)[i + k * nVar];
+		if (!fik) continue;
+		SEXP var_i = VECTOR_ELT(variable, i);
+		if (INTEGER(nlevs)[i] > 0) {
+		    SEXP contrast = VECTOR_ELT(contrasts, i + (fik - 1) * nVar);
+		    if (contrast == R_NilValue) {
+			contrast = coerceVector(VECTOR_ELT(fik == 1 ? contr1 : contr2, i),
+						REALSXP);
+			SET_VECTOR_ELT(contrasts, i + (fik - 1) * nVar, contrast);
+		    }
+		    int adj = isLogical(var_i)?1:0;
+		    mmvar_factor(&mv[q++], INTEGER(var_i)+adj, contrast);
+		} else {
+		    mv[q].v = NULL;
+		    mv[q].c = REAL(var_i);
+		    mv[q++].ncol = ncols(var_i);
+		}
+	    }
+	    for (int r = 0; q && r < n; r++) {
+		Rboolean full = FALSE;
+		for (int t = 0; t < q && !full; t++)
+		    full = mmvar_full(&mv[t], r, nn);
+		/* the products, with the first variable varying fastest */
+		int m = 1, cur = 0, stride = 1;
+		kb[0][0] = 0; wb[0][0] = 1.0;
+		for (int t = 0; t < q && m; t++) {
+		    int e = mmvar_entries(&mv[t], r, nn, full, ke, we), m1 = 0;
+		    for (int b = 0; b < e; b++)
+			for (int a = 0; a < m; a++) {
+			    kb[1 - cur][m1] = kb[cur][a] + stride * ke[b];
+			    wb[1 - cur][m1++] = wb[cur][a] * we[b];
+			}
+		    cur = 1 - cur;
+		    m = m1;
+		    stride *= mv[t].ncol;
+		}
+		for (int a = 0; a < m; a++)
+		    MM_ENTRY(jstart + kb[cur][a], r, wb[cur][a]);
+	    }
+	    jstart += INTEGER(count)[k];
+	}
+#undef MM_ENTRY
+    }
+    dim = SET_VECTOR_ELT(ans, 3, allocVector(INTSXP, 2));
+    INTEGER(dim)[0] = n;
+    INTEGER(dim)[1] = nc;
+    UNPROTECT(2);
+    return ans;
+}
+
 SEXP modelmatrix(SEXP call, SEXP op, SEXP args, SEXP rho)
 {
     SEXP expr, factors, terms, vars, vnames, assign;
@@ -338,6 +528,9 @@ SEXP modelmatrix(SEXP call, SEXP op, SEXP args, SEXP rho)
     R_xlen_t nn;
 
     args = CDR(args);
+    int sparse = length(args) > 2 ? asLogical(CADDR(args)) : 0;
+    if (sparse == NA_INTEGER)
+	error(_("invalid '%s' argument"), "sparse");
 
     /* Get the "terms" structure and extract */
     /* the intercept and response attributes. */
@@ -668,6 +861,20 @@ SEXP modelmatrix(SEXP call, SEXP op, SEXP args, SEXP rho)
 	}
     }
 
+    if (sparse) {
+	PROTECT(x = sparse_modelmatrix(n, nc, intrcept, nterms, nVar,
+				       rhs_response, factors, variable, nlevs,
+				       columns, contr1, contr2, count));
+	PROTECT(tnames = allocVector(VECSXP, 2));
+	if (rnames != R_NilValue)
+	    SET_VECTOR_ELT(tnames, 0, coerceVector(rnames, STRSXP));
+	SET_VECTOR_ELT(tnames, 1, xnames);
+	SET_VECTOR_ELT(x, 4, tnames);
+	setAttrib(x, install("assign"), assign);
+	UNPROTECT(14);
+	return x;
+    }
+
     /* Allocate and compute the design matrix. */
 
     PROTECT(x = allocMatrix(REALSXP, n, nc));
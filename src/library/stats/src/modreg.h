@@ -69,6 +69,9 @@ void kmeans_Lloyd(double *x, int *pn, int *pp, double *cen, int *pk, int *cl,
 void kmeans_MacQueen(double *x, int *pn, int *pp, double *cen, int *pk,
 		     int *cl, int *pmaxiter, int *nc, double *wss);
 
+void kmeans_Hamerly(double *x, int *pn, int *pp, double *cen, int *pk,
+		    int *cl, int *pmaxiter, int *nc, double *wss);
+
 /* Fortran : */
 
 void F77_SUB(lowesw)(double *res, int *n, double *rw, int *pi);
@@ -1,6 +1,6 @@
 /*
  *  R : A Computer Language for Statistical Data Analysis
- *  Copyright (C) 1999-2013  The R Core Team
+ *  Copyright (C) 1999-2017  The R Core Team
  *
  *  This program is free software; you can redistribute it and/or modify
  *  it under the terms of the GNU General Public License as published by
@@ -62,8 +62,71 @@ typedef struct opt_struct
     int usebounds;
     double* lower, *upper;
     SEXP names;	     /* names for par */
+    int vectorized;  /* does fn take a matrix of parameter vectors? */
 } opt_struct, *OptStruct;
 
+/* For vectorized = TRUE, a matrix for k parameter vectors */
+static SEXP parmatrix(int n, int k, OptStruct OS)
+{
+    SEXP x = PROTECT(allocMatrix(REALSXP, n, k));
+    if(!isNull(OS->names)) {
+	SEXP dn = PROTECT(allocVector(VECSXP, 2));
+	SET_VECTOR_ELT(dn, 0, OS->names);
+	setAttrib(x, R_DimNamesSymbol, dn);
+	UNPROTECT(1);
+    }
+    UNPROTECT(1);
+    return x;
+}
+
+/* the objective at the k points in the columns of x, in one call */
+static void fminvec(int k, SEXP x, double *val, OptStruct OS)
+{
+    SEXP s;
+
+    SETCADR(OS->R_fcall, x);
+    PROTECT(s = coerceVector(eval(OS->R_fcall, OS->R_env), REALSXP));
+    if (LENGTH(s) != k)
+	error(_("objective function in optim evaluates to length %d not %d"),
+	      LENGTH(s), k);
+    for (int j = 0; j < k; j++) val[j] = REAL(s)[j]/(OS->fnscale);
+    UNPROTECT(1);
+}
+
+/* The 2n points for the numerical gradient at p in the columns of the
+   n x 2n matrix x, p[i] + eps then p[i] - eps for each i, and the
+   differences of each pair in h */
+static void grpoints(int n, double *p, double *x, double *h, OptStruct OS)
+{
+    for (int i = 0; i < n; i++) {
+	double *x1 = x + (size_t) n * 2 * i, *x2 = x1 + n,
+	    eps = OS->ndeps[i], tmp1 = p[i] + eps, tmp2 = p[i] - eps,
+	    eps1 = eps, eps2 = eps;
+	for (int k = 0; k < n; k++) x1[k] = x2[k] = p[k] * (OS->parscale[k]);
+	if (OS->usebounds) { /* as in fmingr() */
+	    if (tmp1 > OS->upper[i]) {
+		tmp1 = OS->upper[i];
+		eps1 = tmp1 - p[i];
+	    }
+	    if (tmp2 < OS->lower[i]) {
+		tmp2 = OS->lower[i];
+		eps2 = p[i] - tmp2;
+	    }
+	    h[i] = eps1 + eps2;
+	} else h[i] = 2 * eps;
+	x1[i] = tmp1 * (OS->parscale[i]);
+	x2[i] = tmp2 * (OS->parscale[i]);
+    }
+}
+
+static void grdiff(int n, const double *val, const double *h, double *df)
+{
+    for (int i = 0; i < n; i++) {
+	df[i] = (val[2 * i] - val[2 * i + 1])/h[i];
+	if(!R_FINITE(df[i]))
+	    error(("non-finite finite-difference value [%d]"), i+1);
+    }
+}
 
 
 static double fminfn(int n, double *p, void *ex)
@@ -74,6 +137,17 @@ static double fminfn(int n, double *p, void *ex)
     OptStruct OS = (OptStruct) ex;
     PROTECT_INDEX ipx;
 
+    if (OS->vectorized) {
+	PROTECT(x = parmatrix(n, 1, OS));
+	for (i = 0; i < n; i++) {
+	    if (!R_FINITE(p[i]))
+		error(_("non-finite value supplied by optim"));
+	    REAL(x)[i] = p[i] * (OS->parscale[i]);
+	}
+	fminvec(1, x, &val, OS);
+	UNPROTECT(1);
+	return val;
+    }
     PROTECT(x = allocVector(REALSXP, n));
     if(!isNull(OS->names)) setAttrib(x, R_NamesSymbol, OS->names);
     for (i = 0; i < n; i++) {
@@ -116,6 +190,16 @@ static void fmingr(int n, double *p, double *df, void *ex)
 	for (i = 0; i < n; i++)
 	    df[i] = REAL(s)[i] * (OS->parscale[i])/(OS->fnscale);
 	UNPROTECT(2);
+    } else if (OS->vectorized) { /* numerical, in one call */
+	const void *vmax = vmaxget();
+	double *val = (double *) R_alloc(2 * n, sizeof(double)),
+	    *h = (double *) R_alloc(n, sizeof(double));
+	PROTECT(x = parmatrix(n, 2 * n, OS));
+	grpoints(n, p, REAL(x), h, OS);
+	fminvec(2 * n, x, val, OS);
+	grdiff(n, val, h, df);
+	UNPROTECT(1);
+	vmaxset(vmax);
     } else { /* numerical derivatives */
 	PROTECT(x = allocVector(REALSXP, n));
 	setAttrib(x, R_NamesSymbol, OS->names);
@@ -206,6 +290,7 @@ SEXP optim(SEXP call, SEXP op, SEXP args, SEXP rho)
     opar = vect(npar);
     trace = asInteger(getListElement(options, "trace"));
     OS->fnscale = asReal(getListElement(options, "fnscale"));
+    OS->vectorized = asLogical(getListElement(options, "vectorized")) == 1;
     tmp = getListElement(options, "parscale");
     if (LENGTH(tmp) != npar)
 	error(_("'parscale' is of the wrong length"));
@@ -400,6 +485,7 @@ SEXP optimhess(SEXP call, SEXP op, SEXP args, SEXP rho)
     args = CDR(args); gr = CAR(args);
     args = CDR(args); options = CAR(args);
     OS->fnscale = asReal(getListElement(options, "fnscale"));
+    OS->vectorized = asLogical(getListElement(options, "vectorized")) == 1;
     tmp = getListElement(options, "parscale");
     if (LENGTH(tmp) != npar)
 	error(_("'parscale' is of the wrong length"));
@@ -427,17 +513,45 @@ SEXP optimhess(SEXP call, SEXP op, SEXP args, SEXP rho)
 	dpar[i] = REAL(par)[i] / (OS->parscale[i]);
     df1 = vect(npar);
     df2 = vect(npar);
-    for (i = 0; i < npar; i++) {
-	eps = OS->ndeps[i]/(OS->parscale[i]);
-	dpar[i] = dpar[i] + eps;
-	fmingr(npar, dpar, df1, (void *)OS);
-	dpar[i] = dpar[i] - 2 * eps;
-	fmingr(npar, dpar, df2, (void *)OS);
-	for (j = 0; j < npar; j++)
-	    REAL(ans)[i * npar + j] = (OS->fnscale) * (df1[j] - df2[j])/
-		(2 * eps * (OS->parscale[i]) * (OS->parscale[j]));
-	dpar[i] = dpar[i] + eps;
-    }
+    if (OS->vectorized && isNull(gr)) {
+	/* all in one call: for each i, the 2 npar points for the
+	   gradient at dpar[i] + eps then those at dpar[i] - eps */
+	size_t blk = 2 * (size_t) npar * npar;
+	double *val = vect(4 * npar * npar), *h = vect(2 * npar * npar);
+	SEXP X;
+	PROTECT(X = parmatrix(npar, 4 * npar * npar, OS));
+	for (i = 0; i < npar; i++) {
+	    eps = OS->ndeps[i]/(OS->parscale[i]);
+	    dpar[i] = dpar[i] + eps;
+	    grpoints(npar, dpar, REAL(X) + 2 * blk * i, h + 2 * npar * i, OS);
+	    dpar[i] = dpar[i] - 2 * eps;
+	    grpoints(npar, dpar, REAL(X) + 2 * blk * i + blk,
+		     h + 2 * npar * i + npar, OS);
+	    dpar[i] = dpar[i] + eps;
+	}
+	fminvec(4 * npar * npar, X, val, OS);
+	UNPROTECT(1);
+	for (i = 0; i < npar; i++) {
+	    eps = OS->ndeps[i]/(OS->parscale[i]);
+	    grdiff(npar, val + 4 * npar * i, h + 2 * npar * i, df1);
+	    grdiff(npar, val + 4 * npar * i + 2 * npar,
+		   h + 2 * npar * i + npar, df2);
+	    for (j = 0; j < npar; j++)
+		REAL(ans)[i * npar + j] = (OS->fnscale) * (df1[j] - df2[j])/
+		    (2 * eps * (OS->parscale[i]) * (OS->parscale[j]));
+	}
+    } else
+	for (i = 0; i < npar; i++) {
+	    eps = OS->ndeps[i]/(OS->parscale[i]);
+	    dpar[i] = dpar[i] + eps;
+	    fmingr(npar, dpar, df1, (void *)OS);
+	    dpar[i] = dpar[i] - 2 * eps;
+	    fmingr(npar, dpar, df2, (void *)OS);
+	    for (j = 0; j < npar; j++)
+		REAL(ans)[i * npar + j] = (OS->fnscale) * (df1[j] - df2[j])/
+		    (2 * eps * (OS->parscale[i]) * (OS->parscale[j]));
+	    dpar[i] = dpar[i] + eps;
+	}
     // now symmetrize
     for (i = 0; i < npar; i++) 
 	for (j = 0; j < i; j++) {
@@ -457,3 +571,155 @@ SEXP optimhess(SEXP call, SEXP op, SEXP args, SEXP rho)
     UNPROTECT(4);
     return ans;
 }
+
+
+/* The BFGS method of vmmin() in ../../../appl/optim.c, for all of the
+   n parameters, using work (of length vmmin_lwork(n)) rather than R
+   memory and reporting rather than signalling errors, so that it can
+   be used in threads provided fminfn and fmingr are thread-safe.
+   *fail is 0 for convergence, 1 if maxit was reached, and 2 if the
+   initial value is not finite. */
+
+#define stepredn	0.2
+#define acctol		0.0001
+#define reltest		10.0
+
+size_t vmmin_lwork(int n)
+{
+    return 4 * (size_t) n + (size_t) n * (n + 1) / 2;
+}
+
+void vmmin_work(int n, double *b, double *Fmin, optimfn fminfn,
+		optimgr fmingr, int maxit, double abstol, double reltol,
+		void *ex, int *fncount, int *grcount, int *fail, double *work)
+{
+    Rboolean accpoint, enough;
+    double *g = work, *t = g + n, *X = t + n, *c = X + n, *B = c + n;
+    int   count, funcount, gradcount;
+    double f, gradproj;
+    int   i, j, ilast, iter = 0;
+    double s, steplength;
+    double D1, D2;
+
+/* B is lower triangular, stored by rows */
+#define B_(i, j) B[(size_t) (i) * ((i) + 1) / 2 + (j)]
+
+    if (maxit <= 0) {
+	*fail = 0;
+	*Fmin = fminfn(n, b, ex);
+	*fncount = *grcount = 0;
+	return;
+    }
+
+    f = fminfn(n, b, ex);
+    if (!R_FINITE(f)) {
+	*fail = 2;
+	*Fmin = f;
+	*fncount = 1; *grcount = 0;
+	return;
+    }
+    *Fmin = f;
+    funcount = gradcount = 1;
+    fmingr(n, b, g, ex);
+    iter++;
+    ilast = gradcount;
+
+    do {
+	if (ilast == gradcount) {
+	    for (i = 0; i < n; i++) {
+		for (j = 0; j < i; j++) B_(i, j) = 0.0;
+		B_(i, i) = 1.0;
+	    }
+	}
+	for (i = 0; i < n; i++) {
+	    X[i] = b[i];
+	    c[i] = g[i];
+	}
+	gradproj = 0.0;
+	for (i = 0; i < n; i++) {
+	    s = 0.0;
+	    for (j = 0; j <= i; j++) s -= B_(i, j) * g[j];
+	    for (j = i + 1; j < n; j++) s -= B_(j, i) * g[j];
+	    t[i] = s;
+	    gradproj += s * g[i];
+	}
+
+	if (gradproj < 0.0) {	/* search direction is downhill */
+	    steplength = 1.0;
+	    accpoint = FALSE;
+	    do {
+		count = 0;
+		for (i = 0; i < n; i++) {
+		    b[i] = X[i] + steplength * t[i];
+		    if (reltest + X[i] == reltest + b[i]) /* no change */
+			count++;
+		}
+		if (count < n) {
+		    f = fminfn(n, b, ex);
+		    funcount++;
+		    accpoint = R_FINITE(f) &&
+			(f <= *Fmin + gradproj * steplength * acctol);
+		    if (!accpoint) {
+			steplength *= stepredn;
+		    }
+		}
+	    } while (!(count == n || accpoint));
+	    enough = (f > abstol) &&
+		fabs(f - *Fmin) > reltol * (fabs(*Fmin) + reltol);
+	    /* stop if value if small or if relative change is low */
+	    if (!enough) {
+		count = n;
+		*Fmin = f;
+	    }
+	    if (count < n) {/* making progress */
+		*Fmin = f;
+		fmingr(n, b, g, ex);
+		gradcount++;
+		iter++;
+		D1 = 0.0;
+		for (i = 0; i < n; i++) {
+		    t[i] = steplength * t[i];
+		    c[i] = g[i] - c[i];
+		    D1 += t[i] * c[i];
+		}
+		if (D1 > 0) {
+		    D2 = 0.0;
+		    for (i = 0; i < n; i++) {
+			s = 0.0;
+			for (j = 0; j <= i; j++)
+			    s += B_(i, j) * c[j];
+			for (j = i + 1; j < n; j++)
+			    s += B_(j, i) * c[j];
+			X[i] = s;
+			D2 += s * c[i];
+		    }
+		    D2 = 1.0 + D2 / D1;
+		    for (i = 0; i < n; i++) {
+			for (j = 0; j <= i; j++)
+			    B_(i, j) += (D2 * t[i] * t[j]
+					 - X[i] * t[j] - t[i] * X[j]) / D1;
+		    }
+		} else {	/* D1 < 0 */
+		    ilast = gradcount;
+		}
+	    } else {	/* no progress */
+		if (ilast < gradcount) {
+		    count = 0;
+		    ilast = gradcount;
+		}
+	    }
+	} else {		/* uphill search */
+	    count = 0;
+	    if (ilast == gradcount) count = n;
+	    else ilast = gradcount;
+	    /* Resets unless has just been reset */
+	}
+	if (iter >= maxit) break;
+	if (gradcount - ilast > 2 * n)
+	    ilast = gradcount;	/* periodic restart */
+    } while (count != n || ilast != gradcount);
+    *fail = (iter < maxit) ? 0 : 1;
+    *fncount = funcount;
+    *grcount = gradcount;
+#undef B_
+}
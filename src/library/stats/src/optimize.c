@@ -2,7 +2,7 @@
  *  R : A Computer Language for Statistical Data Analysis
  *  Copyright (C) 1995, 1996  Robert Gentleman and Ross Ihaka
  *  Copyright (C) 2003-2004  The R Foundation
- *  Copyright (C) 1998--2014  The R Core Team
+ *  Copyright (C) 1998--2017  The R Core Team
  *
  *  This program is free software; you can redistribute it and/or modify
  *  it under the terms of the GNU General Public License as published by
@@ -30,7 +30,7 @@
 #include <R_ext/RS.h>	       	/* for Memcpy */
 
 #include "statsR.h"
-#include "stats.h" // R_zeroin2
+#include "stats.h" // R_zeroin2, Brent_fmin
 
 #undef _
 #ifdef ENABLE_NLS
@@ -90,7 +90,6 @@
 #include <Rmath.h>
 #include <R_ext/Applic.h>
 
-static
 double Brent_fmin(double ax, double bx, double (*f)(double, void *),
 		  void *info, double tol)
 {
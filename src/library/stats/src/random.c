@@ -1,7 +1,7 @@
 /*
  *  R : A Computer Language for Statistical Data Analysis
  *  Copyright (C) 1995, 1996  Robert Gentleman and Ross Ihaka
- *  Copyright (C) 1997--2012  The R Core Team
+ *  Copyright (C) 1997--2017  The R Core Team
  *  Copyright (C) 2003--2008  The R Foundation
  *
  *  This program is free software; you can redistribute it and/or modify
@@ -27,6 +27,11 @@
 #include <R_ext/Random.h>
 #include <Rmath.h>		/* for lgammafn, rmultinom */
 #include <errno.h>
+#include <stdint.h>
+#ifdef _OPENMP
+# include <omp.h>
+# include <R_ext/MathThreads.h>
+#endif
 #include "statsR.h"
 #undef _
 #include "stats.h" // for rcont2
@@ -38,6 +43,192 @@ typedef double (*ran1) (double);
 typedef double (*ran2) (double, double);
 typedef double (*ran3) (double, double, double);
 
+/* Generation in parallel, with options(rng.parallel = TRUE) and the
+   "L'Ecuyer-CMRG" generator: the values are generated in blocks of
+   RNG_BLOCK, the k-th from the k-th stream of 2^76 values after the
+   current seed (see R_RNG_substreams in ../../../main/RNG.c), on the
+   threads set for R's numerical code.  So the values depend on the
+   seed but not on the number of threads.
+
+   The generators here are those of unif_rand() for L'Ecuyer-CMRG,
+   norm_rand() for Inversion and exp_rand() on a seed of their own. */
+
+#define RNG_BLOCK 65536
+
+typedef double (*pran) (const double *, int_least64_t *);
+
+#define m1    4294967087
+#define m2    4294944443
+#define normc 2.328306549295727688e-10
+#define a12   (int_least64_t)1403580
+#define a13n  (int_least64_t)810728
+#define a21   (int_least64_t)527612
+#define a23n  (int_least64_t)1370589
+
+static double unif_s(int_least64_t *s)
+{
+    int_least64_t p1, p2;
+
+    p1 = (a12 * s[1] - a13n * s[0]) % m1;
+    if (p1 < 0) p1 += m1;
+    s[0] = s[1]; s[1] = s[2]; s[2] = p1;
+
+    p2 = (a21 * s[5] - a23n * s[3]) % m2;
+    if (p2 < 0) p2 += m2;
+    s[3] = s[4]; s[4] = s[5]; s[5] = p2;
+
+    return ((p1 > p2) ? (p1 - p2) : (p1 - p2 + m1)) * normc;
+}
+
+static double norm_s(int_least64_t *s)
+{
+#define BIG 134217728 /* 2^27 */
+    double u1 = unif_s(s);
+    u1 = (int)(BIG*u1) + unif_s(s);
+    return qnorm5(u1/BIG, 0.0, 1.0, 1, 0);
+}
+
+static double exp_s(int_least64_t *s)
+{
+    /* q[k-1] = sum(log(2)^k / k!)  k=1,..,n, */
+    static const double q[] =
+    {
+	0.6931471805599453,
+	0.9333736875190459,
+	0.9888777961838675,
+	0.9984959252914960,
+	0.9998292811061389,
+	0.9999833164100727,
+	0.9999985691438767,
+	0.9999998906925558,
+	0.9999999924734159,
+	0.9999999995283275,
+	0.9999999999728814,
+	0.9999999999985598,
+	0.9999999999999289,
+	0.9999999999999968,
+	0.9999999999999999,
+	1.0000000000000000
+    };
+
+    double a = 0.;
+    double u = unif_s(s);
+    for (;;) {
+	u += u;
+	if (u > 1.)
+	    break;
+	a += q[0];
+    }
+    u -= 1.;
+
+    if (u <= q[0])
+	return a + u;
+
+    int i = 0;
+    double ustar = unif_s(s), umin = ustar;
+    do {
+	ustar = unif_s(s);
+	if (umin > ustar)
+	    umin = ustar;
+	i++;
+    } while (u > q[i]);
+    return a + umin * q[0];
+}
+
+/* as rnorm(), runif() and rexp() in ../../../nmath */
+static double rnorm_s(const double *par, int_least64_t *s)
+{
+    double mu = par[0], sigma = par[1];
+    if (ISNAN(mu) || !R_FINITE(sigma) || sigma < 0.)
+	return R_NaN;
+    if (sigma == 0. || !R_FINITE(mu))
+	return mu;
+    else
+	return mu + sigma * norm_s(s);
+}
+
+static double runif_s(const double *par, int_least64_t *s)
+{
+    double a = par[0], b = par[1];
+    if (!R_FINITE(a) || !R_FINITE(b) || b < a) return R_NaN;
+    return (a == b) ? a : a + (b - a) * unif_s(s);
+}
+
+static double rexp_s(const double *par, int_least64_t *s)
+{
+    double scale = par[0];
+    if (!R_FINITE(scale) || scale <= 0.0)
+	return (scale == 0.) ? 0. : R_NaN;
+    return scale * exp_s(s);
+}
+
+/* Fill rx[0:(n-1)] with fn(ra[i % na], rb[i % nb]) (rb is NULL for one
+   parameter) if generating in parallel: otherwise returns FALSE. */
+static Rboolean
+random_parallel(R_xlen_t n, double *ra, R_xlen_t na, double *rb, R_xlen_t nb,
+		pran fn, Rboolean normal, double *rx, Rboolean *naflag)
+{
+    if (asLogical(GetOption1(install("rng.parallel"))) != TRUE)
+	return FALSE;
+    R_xlen_t nblock = (n + RNG_BLOCK - 1) / RNG_BLOCK;
+    int *seeds = (int *) R_alloc(6 * nblock, sizeof(int)), nan = 0;
+    if (!R_RNG_substreams(nblock, seeds, normal))
+	return FALSE;
+#ifdef _OPENMP
+    int nthreads = 1;
+    if (R_num_math_threads > 1)
+	nthreads = (nblock < R_num_math_threads) ? (int) nblock :
+	    R_num_math_threads;
+# pragma omp parallel for num_threads(nthreads) default(none) \
+    firstprivate(n, ra, na, rb, nb, fn, rx, nblock, seeds) \
+    reduction(|:nan)
+#endif
+    for (R_xlen_t k = 0; k < nblock; k++) {
+	int_least64_t s[6];
+	double par[2];
+	R_xlen_t end = (k + 1) * RNG_BLOCK < n ? (k + 1) * RNG_BLOCK : n;
+	for (int j = 0; j < 6; j++) s[j] = (unsigned int) seeds[6*k + j];
+	for (R_xlen_t i = k * RNG_BLOCK; i < end; i++) {
+	    par[0] = ra[i % na];
+	    if (rb) par[1] = rb[i % nb];
+	    rx[i] = fn(par, s);
+	    if (ISNAN(rx[i])) nan = 1;
+	}
+    }
+    if (nan) *naflag = TRUE;
+    return TRUE;
+}
+
+/* rnorm(n, a, b) or runif(n, a, b) for a single pair of parameters
+   which use the generator: the values of n calls of rnorm(a, b) or
+   runif(a, b), from norm_rand_n() or unif_rand_n() a block at a time.
+   Otherwise returns FALSE. */
+static Rboolean
+random_bulk(R_xlen_t n, double a, double b, Rboolean normal, double *rx)
+{
+    R_xlen_t i, j, end;
+
+    if (!R_FINITE(a) || !R_FINITE(b) || (normal ? b <= 0 : b <= a))
+	return FALSE;
+    for (i = 0; i < n; ) {
+	int m = (n - i < RNG_BLOCK) ? (int) (n - i) : RNG_BLOCK;
+	if (normal) {
+	    norm_rand_n(rx + i, m);
+	    i += m;
+	} else {
+	    /* as runif(), skip 0 and 1 from user-supplied generators */
+	    unif_rand_n(rx + i, m);
+	    for (j = i, end = i + m; j < end; j++)
+		if (rx[j] > 0 && rx[j] < 1) rx[i++] = rx[j];
+	}
+    }
+    if (normal)
+	for (i = 0; i < n; i++) rx[i] = a + b * rx[i];
+    else
+	for (i = 0; i < n; i++) rx[i] = a + (b - a) * rx[i];
+    return TRUE;
+}
+
 static void fillWithNAs(SEXP x, R_xlen_t n, SEXPTYPE type) {
     R_xlen_t i;
 
@@ -81,7 +272,8 @@ static R_INLINE R_xlen_t resultLength(SEXP lengthArgument) {
 
 /* random sampling from 1 parameter families. */
 
-static R_INLINE SEXP random1(SEXP sn, SEXP sa, ran1 fn, SEXPTYPE type)
+static R_INLINE SEXP random1(SEXP sn, SEXP sa, ran1 fn, SEXPTYPE type,
+			     pran pfn)
 {
     SEXP x, a;
     R_xlen_t n, na;
@@ -119,6 +311,8 @@ static R_INLINE SEXP random1(SEXP sn, SEXP sa, ran1 fn, SEXPTYPE type)
 	    }
 	} else {
 	    double *rx = REAL(x);
+	    if (!(pfn && random_parallel(n, ra, na, NULL, 0, pfn, FALSE,
+					 rx, &naflag)))
 	    for (R_xlen_t i = 0; i < n; i++) {
 //		if ((i+1) % NINTERRUPT) R_CheckUserInterrupt();
 		rx[i] = fn(ra[i % na]);
@@ -135,16 +329,21 @@ static R_INLINE SEXP random1(SEXP sn, SEXP sa, ran1 fn, SEXPTYPE type)
 
 #define DEFRAND1_REAL(name) \
     SEXP do_##name(SEXP sn, SEXP sa) { \
-        return random1(sn, sa, name, REALSXP); \
+        return random1(sn, sa, name, REALSXP, NULL); \
     }
 
 #define DEFRAND1_INT(name) \
     SEXP do_##name(SEXP sn, SEXP sa) { \
-        return random1(sn, sa, name, INTSXP); \
+        return random1(sn, sa, name, INTSXP, NULL); \
+    }
+
+#define DEFRAND1_PAR(name) \
+    SEXP do_##name(SEXP sn, SEXP sa) { \
+        return random1(sn, sa, name, REALSXP, name##_s); \
     }
 
 DEFRAND1_REAL(rchisq)
-DEFRAND1_REAL(rexp)
+DEFRAND1_PAR(rexp)
 DEFRAND1_INT(rgeom)
 DEFRAND1_INT(rpois)
 DEFRAND1_REAL(rt)
@@ -152,7 +351,8 @@ DEFRAND1_INT(rsignrank)
 
 /* random sampling from 2 parameter families. */
 
-static R_INLINE SEXP random2(SEXP sn, SEXP sa, SEXP sb, ran2 fn, SEXPTYPE type)
+static R_INLINE SEXP random2(SEXP sn, SEXP sa, SEXP sb, ran2 fn, SEXPTYPE type,
+			     pran pfn, Rboolean normal)
 {
     SEXP x, a, b;
     R_xlen_t n, na, nb;
@@ -191,6 +391,10 @@ static R_INLINE SEXP random2(SEXP sn, SEXP sa, SEXP sb, ran2 fn, SEXPTYPE type)
 	} else {
 	    double *rx = REAL(x);
 	    errno = 0;
+	    if (!(pfn && random_parallel(n, ra, na, rb, nb, pfn, normal,
+					 rx, &naflag)) &&
+		!(pfn && na == 1 && nb == 1 &&
+		  random_bulk(n, ra[0], rb[0], normal, rx)))
 	    for (R_xlen_t i = 0; i < n; i++) {
 //		if ((i+1) % NINTERRUPT) R_CheckUserInterrupt();
 		rx[i] = fn(ra[i % na], rb[i % nb]);
@@ -207,12 +411,17 @@ static R_INLINE SEXP random2(SEXP sn, SEXP sa, SEXP sb, ran2 fn, SEXPTYPE type)
 
 #define DEFRAND2_REAL(name) \
     SEXP do_##name(SEXP sn, SEXP sa, SEXP sb) { \
-        return random2(sn, sa, sb, name, REALSXP); \
+        return random2(sn, sa, sb, name, REALSXP, NULL, FALSE); \
     }
 
 #define DEFRAND2_INT(name) \
     SEXP do_##name(SEXP sn, SEXP sa, SEXP sb) { \
-        return random2(sn, sa, sb, name, INTSXP); \
+        return random2(sn, sa, sb, name, INTSXP, NULL, FALSE); \
+    }
+
+#define DEFRAND2_PAR(name, normal) \
+    SEXP do_##name(SEXP sn, SEXP sa, SEXP sb) { \
+        return random2(sn, sa, sb, name, REALSXP, name##_s, normal); \
     }
 
 DEFRAND2_REAL(rbeta)
@@ -223,8 +432,8 @@ DEFRAND2_REAL(rgamma)
 DEFRAND2_REAL(rlnorm)
 DEFRAND2_REAL(rlogis)
 DEFRAND2_INT(rnbinom)
-DEFRAND2_REAL(rnorm)
-DEFRAND2_REAL(runif)
+DEFRAND2_PAR(rnorm, TRUE)
+DEFRAND2_PAR(runif, FALSE)
 DEFRAND2_REAL(rweibull)
 DEFRAND2_INT(rwilcox)
 DEFRAND2_REAL(rnchisq)
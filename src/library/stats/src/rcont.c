@@ -26,11 +26,17 @@
 #include <R_ext/Error.h>
 #include <R_ext/Utils.h>
 
-void
-rcont2(int *nrow, int *ncol,
-       /* vectors of row and column totals, and their sum ntotal: */
-       int *nrowt, int *ncolt, int *ntotal,
-       double *fact, int *jwork, int *matrix)
+#include "stats.h"
+
+/* The work of rcont2() and rcont2_r(): 'main' is true on R's main
+   thread, where user interrupts are checked.  Returns 0, or non-zero
+   if the algorithm failed. */
+static int
+rcont2_work(int *nrow, int *ncol,
+	    /* vectors of row and column totals, and their sum ntotal: */
+	    int *nrowt, int *ncolt, int *ntotal,
+	    double *fact, int *jwork, int *matrix,
+	    double (*unif)(void *), void *state, Rboolean main)
 {
     int j, l, m, ia, ib, ic, jc, id, ie, ii, nll, nlm, nr_1, nc_1;
     double x, y, dummy, sumprb;
@@ -67,7 +73,7 @@ rcont2(int *nrow, int *ncol,
 	    }
 
 	    /* Generate pseudo-random number */
-	    dummy = unif_rand();
+	    dummy = unif(state);
 
 	    do {/* Outer Loop */
 
@@ -79,8 +85,11 @@ rcont2(int *nrow, int *ncol,
 			- fact[id - nlm] - fact[ia - nlm] - fact[ii + nlm]);
 		if (x >= dummy)
 		    break;
-		if (x == 0.)/* MM: I haven't seen this anymore */
-		    error(_("rcont2 [%d,%d]: exp underflow to 0; algorithm failure"), l, m);
+		if (x == 0.) {/* MM: I haven't seen this anymore */
+		    if (main)
+			error(_("rcont2 [%d,%d]: exp underflow to 0; algorithm failure"), l, m);
+		    return 1;
+		}
 
 		sumprb = x;
 		y = x;
@@ -99,7 +108,7 @@ rcont2(int *nrow, int *ncol,
 		    }
 
 		    do {
-			R_CheckUserInterrupt();
+			if (main) R_CheckUserInterrupt();
 
 			/* Decrement entry in row L, column M */
 			j = (int)(nll * (double)(ii + nll));
@@ -120,7 +129,7 @@ rcont2(int *nrow, int *ncol,
 
 		} while (!lsp);
 
-		dummy = sumprb * unif_rand();
+		dummy = sumprb * unif(state);
 
 	    } while (1);
 
@@ -138,5 +147,30 @@ L160:
 
     matrix[nr_1 + nc_1 * *nrow] = ib - matrix[nr_1 + (nc_1-1) * *nrow];
 
-    return;
+    return 0;
+}
+
+static double unif_rand0(void *state)
+{
+    return unif_rand();
+}
+
+void
+rcont2(int *nrow, int *ncol, int *nrowt, int *ncolt, int *ntotal,
+       double *fact, int *jwork, int *matrix)
+{
+    rcont2_work(nrow, ncol, nrowt, ncolt, ntotal, fact, jwork, matrix,
+		unif_rand0, NULL, TRUE);
+}
+
+/* As rcont2(), but with the uniforms from unif(state) and returning
+   non-zero rather than signalling an error on failure, so it can be
+   used on other threads than the main one. */
+int
+rcont2_r(int *nrow, int *ncol, int *nrowt, int *ncolt, int *ntotal,
+	 double *fact, int *jwork, int *matrix,
+	 double (*unif)(void *), void *state)
+{
+    return rcont2_work(nrow, ncol, nrowt, ncolt, ntotal, fact, jwork,
+		       matrix, unif, state, FALSE);
 }
@@ -1,6 +1,6 @@
 /*
  *  R : A Computer Language for Statistical Data Analysis
- *  Copyright (C) 2005-12   The R Core Team
+ *  Copyright (C) 2005-2017   The R Core Team
  *
  *  This program is free software; you can redistribute it and/or modify
  *  it under the terms of the GNU General Public License as published by
@@ -30,6 +30,8 @@
 #endif
 
 #include <R_ext/RS.h>
+#include <R_ext/Boolean.h>
+#include <R_ext/Applic.h> // for optimfn, optimgr
 void
 F77_SUB(hclust)(int *n, int *len, int *iopt, int *ia, int *ib,
 		double *crit, double *membr, int *nn,
@@ -45,12 +47,36 @@ F77_SUB(kmns)(double *a, int *m, int *n, double *c, int *k,
 	      int *live, int *iter, double *wss, int *ifault);
 
 
+/* A factorization of the length of an fft, in fft.c */
+typedef struct {
+    int n, m_fac, kt, maxf, maxp;
+    int nfac[20];
+} fft_plan;
+
+Rboolean fft_factor_r(int n, fft_plan *plan);
+Rboolean fft_work_r(const fft_plan *plan, double *a, double *b, int nseg,
+		    int n, int nspn, int isn, double *work, int *iwork);
+
+double R_dist_pair(const double *x1, const double *x2, int nc, int method,
+		   double p);
+
 void rcont2(int *nrow, int *ncol, int *nrowt, int *ncolt, int *ntotal,
 	    double *fact, int *jwork, int *matrix);
+int rcont2_r(int *nrow, int *ncol, int *nrowt, int *ncolt, int *ntotal,
+	     double *fact, int *jwork, int *matrix,
+	     double (*unif)(void *), void *state);
 
 double R_zeroin2(double ax, double bx, double fa, double fb, 
 		 double (*f)(double x, void *info), void *info, 
 		 double *Tol, int *Maxit);
 
+/* thread-safe minimizers, in optimize.c and optim.c */
+double Brent_fmin(double ax, double bx, double (*f)(double, void *),
+		  void *info, double tol);
+size_t vmmin_lwork(int n);
+void vmmin_work(int n, double *b, double *Fmin, optimfn fminfn,
+		optimgr fmingr, int maxit, double abstol, double reltol,
+		void *ex, int *fncount, int *grcount, int *fail, double *work);
+
 
 #endif
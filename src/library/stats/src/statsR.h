@@ -28,8 +28,12 @@ SEXP logit_mu_eta(SEXP eta);
 SEXP binomial_dev_resids(SEXP y, SEXP mu, SEXP wt);
 
 SEXP cutree(SEXP merge, SEXP which);
+SEXP hclust_nn(SEXP d, SEXP x, SEXP method, SEXP members, SEXP metric,
+	       SEXP p);
 SEXP rWishart(SEXP ns, SEXP nuP, SEXP scal);
 SEXP Cdqrls(SEXP x, SEXP y, SEXP tol, SEXP chk);
+SEXP Cqrupdate(SEXP R, SEXP qty, SEXP rss, SEXP x, SEXP y);
+SEXP Csparsels(SEXP x, SEXP y, SEXP tol);
 SEXP Cdist(SEXP x, SEXP method, SEXP attrs, SEXP p);
 SEXP r2dtable(SEXP n, SEXP r, SEXP c);
 SEXP cor(SEXP x, SEXP y, SEXP na_method, SEXP method);
@@ -166,7 +170,9 @@ SEXP call_dqags(SEXP);
 
 SEXP Rsm(SEXP x, SEXP stype, SEXP send);
 SEXP tukeyline(SEXP x, SEXP y, SEXP call);
-SEXP runmed(SEXP x, SEXP stype, SEXP sk, SEXP end, SEXP print_level);
+SEXP runmed(SEXP x, SEXP stype, SEXP sk, SEXP end, SEXP print_level,
+	    SEXP snr);
+SEXP runquantile(SEXP x, SEXP snr, SEXP sk, SEXP sprob, SEXP end);
 SEXP influence(SEXP mqr, SEXP do_coef, SEXP e, SEXP stol);
 
 SEXP pSmirnov2x(SEXP statistic, SEXP snx, SEXP sny);
@@ -198,8 +204,8 @@ SEXP bw_phi4(SEXP sn, SEXP sd, SEXP cnt, SEXP sh);
 SEXP bw_phi6(SEXP sn, SEXP sd, SEXP cnt, SEXP sh);
 
 SEXP Fexact(SEXP x, SEXP pars, SEXP work, SEXP smult);
-SEXP Fisher_sim(SEXP sr, SEXP sc, SEXP sB);
-SEXP chisq_sim(SEXP sr, SEXP sc, SEXP sB, SEXP E);
+SEXP Fisher_sim(SEXP sr, SEXP sc, SEXP sB, SEXP sparallel);
+SEXP chisq_sim(SEXP sr, SEXP sc, SEXP sB, SEXP E, SEXP sparallel);
 SEXP d2x2xk(SEXP sK, SEXP sm, SEXP sn, SEXP st, SEXP srn);
 
 SEXP stats_signrank_free(void);
@@ -1,6 +1,6 @@
 /*
  *  R : A Computer Language for Statistical Data Analysis
- *  Copyright (C) 2001-12   The R Core Team.
+ *  Copyright (C) 2001-2017   The R Core Team.
  *
  *  This program is free software; you can redistribute it and/or modify
  *  it under the terms of the GNU General Public License as published by
@@ -33,6 +33,9 @@ void HoltWinters (double *x, int *xl, double *alpha, double *beta,
 		  int *dotrend, int *doseasonal,
 		  double *a, double *b, double *s, double *SSE, double *level, 
 		  double *trend, double *season);
+SEXP HoltWinters_batch(SEXP sx, SEXP slen, SEXP sf, SEXP spar, SEXP sdotrend,
+		       SEXP sdoseasonal, SEXP sadditive, SEXP sstart,
+		       SEXP soptim_start, SEXP snahead);
 
 void
 F77_SUB(eureka)(int *lr, double *r__, double *g,
@@ -89,6 +92,17 @@ SEXP ARIMA_CSS(SEXP sy, SEXP sarma, SEXP sPhi, SEXP sTheta, SEXP sncond,
 SEXP TSconv(SEXP a, SEXP b);
 SEXP getQ0(SEXP sPhi, SEXP sTheta);
 SEXP getQ0bis(SEXP sPhi, SEXP sTheta, SEXP sTol);
+SEXP ARIMA_ML(SEXP scoef, SEXP smask, SEXP strans, SEXP sgrad, SEXP sx,
+	      SEXP sxreg, SEXP sarma, SEXP sDelta, SEXP skappa, SEXP sgardner);
+SEXP ARIMA_batch(SEXP sx, SEXP slen, SEXP sarma, SEXP sDelta, SEXP smean,
+		 SEXP skappa, SEXP sgardner, SEXP scss, SEXP sinit, SEXP smaxit,
+		 SEXP snahead);
+size_t arima_ml_lwork(const int *arma, int n, int d, int ncxreg, int ngrad);
+int arima_ml_liwork(const int *arma, int ngrad);
+double arima_ml(const double *x, int n, const double *xreg, int ncxreg,
+		const int *arma, const double *delta, int d, double kappa,
+		Rboolean gardner, Rboolean trans, const double *coef,
+		const int *mask, double *grad, double *work, int *iwork);
 
 SEXP acf(SEXP x, SEXP lmax, SEXP sCor);
 SEXP pacf1(SEXP acf, SEXP lmax);
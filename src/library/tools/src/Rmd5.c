@@ -1,6 +1,6 @@
 /*
  *  R : A Computer Language for Statistical Data Analysis
- *  Copyright (C) 2003-7   The R Core Team.
+ *  Copyright (C) 2003-2017   The R Core Team.
  *
  *  This program is free software; you can redistribute it and/or modify
  *  it under the terms of the GNU General Public License as published by
@@ -22,39 +22,66 @@
 #include "tools.h"
 #define ROL_UNUSED
 #include "md5.h"
+#ifdef _OPENMP
+# include <R_ext/MathThreads.h>
+#endif
+
+/* hash one file into out[33]: returns 0 on success, 1 if the file
+   cannot be opened and 2 if reading it fails.  Called from several
+   threads, so no R API */
+static int md5_file(const char *path, char *out)
+{
+    FILE *fp;
+    int j, res;
+    unsigned char resblock[16];
+
+#ifdef _WIN32
+    fp = fopen(path, "rb");
+#else
+    fp = fopen(path, "r");
+#endif
+    if(!fp) return 1;
+    res = md5_stream(fp, &resblock);
+    fclose(fp);
+    if(res) return 2;
+    for(j = 0; j < 16; j++)
+	sprintf (out+2*j, "%02x", resblock[j]);
+    return 0;
+}
 
 /* .Call so manages R_alloc stack */
 SEXP Rmd5(SEXP files)
 {
     SEXP ans;
-    int i, j, nfiles = length(files), res;
-    const char *path;
-    char out[33];
-    FILE *fp;
-    unsigned char resblock[16];
+    int i, nfiles = length(files);
+    const char **paths;
+    char *out;
+    int *res;
 
     if(!isString(files)) error(_("argument 'files' must be character"));
+    /* translate all the names first, then hash the files: as that is
+       mostly reading and no R API, several files are hashed at once */
+    paths = (const char **) R_alloc(nfiles, sizeof(char *));
+    for(i = 0; i < nfiles; i++)
+	paths[i] = translateChar(STRING_ELT(files, i));
+    out = R_alloc(nfiles, 33);
+    res = (int *) R_alloc(nfiles, sizeof(int));
+#ifdef _OPENMP
+    int nthreads = (nfiles > 1 && R_num_math_threads > 1) ?
+	R_num_math_threads : 1;
+#pragma omp parallel for num_threads(nthreads) schedule(dynamic)
+#endif
+    for(i = 0; i < nfiles; i++)
+	res[i] = md5_file(paths[i], out + 33 * (size_t) i);
+
     PROTECT(ans = allocVector(STRSXP, nfiles));
     for(i = 0; i < nfiles; i++) {
-	path = translateChar(STRING_ELT(files, i));
-#ifdef _WIN32
-	fp = fopen(path, "rb");
-#else
-	fp = fopen(path, "r");
-#endif
-	if(!fp) {
+	if(res[i] == 0)
+	    SET_STRING_ELT(ans, i, mkChar(out + 33 * (size_t) i));
+	else {
+	    if(res[i] == 2)
+		warning(_("md5 failed on file '%s'"), paths[i]);
 	    SET_STRING_ELT(ans, i, NA_STRING);
-	} else {
-	    res = md5_stream(fp, &resblock);
-	    if(res) {
-		warning(_("md5 failed on file '%s'"), path);
-		SET_STRING_ELT(ans, i, NA_STRING);
-	    } else {
-		for(j = 0; j < 16; j++)
-		    sprintf (out+2*j, "%02x", resblock[j]);
-		SET_STRING_ELT(ans, i, mkChar(out));
-	    }
-	    fclose(fp);
 	}
     }
     UNPROTECT(1);
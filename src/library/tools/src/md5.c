@@ -116,7 +116,7 @@ int
 md5_stream (FILE *stream, void *resblock)
 {
   /* Important: BLOCKSIZE must be a multiple of 64.  */
-#define BLOCKSIZE 4096
+#define BLOCKSIZE 65536
   struct md5_ctx ctx;
   char buffer[BLOCKSIZE + 72];
   size_t sum;
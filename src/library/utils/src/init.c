@@ -78,11 +78,12 @@ static const R_ExternalMethodDef ExtEntries[] = {
     EXTDEF(download, 5),
 #endif
     EXTDEF(unzip, 7),
-    EXTDEF(Rprof, 8),
-    EXTDEF(Rprofmem, 3),
+    EXTDEF(Rprof, 11),
+    EXTDEF(Rprofmem, 4),
 
     EXTDEF(countfields, 6),
     EXTDEF(readtablehead, 7),
+    EXTDEF(readtablefast, 14),
     EXTDEF(typeconvert, 5),
     EXTDEF(writetable, 11),
 
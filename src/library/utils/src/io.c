@@ -211,12 +211,12 @@ strtoc(const char *nptr, char **endptr, Rboolean NA, LocalData *d, int i_exact)
 static R_INLINE int scanchar_raw(LocalData *d)
 {
     int c = (d->ttyflag) ? ConsoleGetcharWithPushBack(d->con) :
-	Rconn_fgetc(d->con);
+	Rconn_fgetc_buff(d->con);
     if(c == 0) {
 	if(d->skipNul) {
 	    do {
 		c = (d->ttyflag) ? ConsoleGetcharWithPushBack(d->con) :
-		    Rconn_fgetc(d->con);
+		    Rconn_fgetc_buff(d->con);
 	    } while(c == 0);
 	}
     }
@@ -487,54 +487,112 @@ SEXP countfields(SEXP args)
     return bns;
 }
 
-/* A struct used by typeconvert to keep track of possible types for the input */
-typedef struct typecvt_possible_types {
-    unsigned int islogical  : 1;
-    unsigned int isinteger  : 1;
-    unsigned int isreal     : 1;
-    unsigned int iscomplex  : 1;
-} Typecvt_Info;
-
-
-/* Sets fields of typeInfo, ruling out possible types based on s.
- *
- * The typeInfo struct should be initialized with all fields TRUE.
- */
-static void ruleout_types(const char *s, Typecvt_Info *typeInfo, LocalData *data,
-			  Rboolean exact)
+/* Fields treated as missing by typeconvert for every target type */
+static R_INLINE Rboolean tc_isNA(SEXP s, LocalData *d)
 {
-    int res;
-    char *endp;
+    const char *p = CHAR(s);
+    return s == NA_STRING || !*p || isNAstring(p, 1, d) || isBlankString(p);
+}
 
-    if (typeInfo->islogical) {
-	if (strcmp(s, "F") == 0 || strcmp(s, "T") == 0 ||
-	    strcmp(s, "FALSE") == 0 || strcmp(s, "TRUE") == 0) {
-	    typeInfo->isinteger = FALSE;
-	    typeInfo->isreal = FALSE;
-	    typeInfo->iscomplex = FALSE;
-	    return; // short cut
-	} else {
-	    typeInfo->islogical = FALSE;
+/* Widen the first n values converted so far in x to type 'to': the
+   type of the column is only ever widened along logical (all NA),
+   integer, double and complex. */
+static SEXP tc_widen(SEXP x, SEXPTYPE to, int n)
+{
+    SEXP y = allocVector(to, XLENGTH(x));
+    int i, v;
+    double r;
+
+    for (i = 0; i < n; i++) {
+	if (TYPEOF(x) == REALSXP) {
+	    r = REAL(x)[i];
+	    if (ISNA(r))
+		COMPLEX(y)[i].r = COMPLEX(y)[i].i = NA_REAL;
+	    else {
+		COMPLEX(y)[i].r = r; COMPLEX(y)[i].i = 0;
+	    }
+	    continue;
+	}
+	v = INTEGER(x)[i]; /* NA_LOGICAL == NA_INTEGER */
+	switch(to) {
+	case INTSXP:
+	    INTEGER(y)[i] = v;
+	    break;
+	case REALSXP:
+	    REAL(y)[i] = (v == NA_INTEGER) ? NA_REAL : v;
+	    break;
+	case CPLXSXP:
+	    if (v == NA_INTEGER)
+		COMPLEX(y)[i].r = COMPLEX(y)[i].i = NA_REAL;
+	    else {
+		COMPLEX(y)[i].r = v; COMPLEX(y)[i].i = 0;
+	    }
+	    break;
+	default:
+	    break;
 	}
     }
+    return y;
+}
 
-    if (typeInfo->isinteger) {
-	res = Strtoi(s, 10);
-	if (res == NA_INTEGER)
-	    typeInfo->isinteger = FALSE;
-    }
+/* Factor codes and sorted levels for cvec in a single hashing pass.
+   Equal strings in the same encoding share their CHARSXP, so the
+   strings are hashed by address; R_NilValue is returned if some
+   non-ASCII string has a declared encoding, when equal strings need
+   not be the same CHARSXP. */
+static SEXP tc_factor(SEXP cvec, LocalData *d)
+{
+    SEXP s, ans, levs, slevs, a;
+    int i, k, h, len = LENGTH(cvec), nlev = 0, *code, *tab, *first, *ord;
+    size_t m = 2;
+
+    while (m < 2 * (size_t) len) m <<= 1;
+    tab = (int *) R_alloc(m, sizeof(int));
+    memset(tab, 0, m * sizeof(int));
+    first = (int *) R_alloc(len, sizeof(int));
 
-    if (typeInfo->isreal) {
-	Strtod(s, &endp, TRUE, data, exact);
-	if (!isBlankString(endp))
-	    typeInfo->isreal = FALSE;
+    PROTECT(ans = allocVector(INTSXP, len));
+    code = INTEGER(ans);
+    for (i = 0; i < len; i++) {
+	s = STRING_ELT(cvec, i);
+	/* <NA> is never to be a level here */
+	if (s == NA_STRING || isNAstring(CHAR(s), 1, d)) {
+	    code[i] = NA_INTEGER;
+	    continue;
+	}
+	if (!IS_ASCII(s) && (IS_LATIN1(s) || IS_UTF8(s) || IS_BYTES(s))) {
+	    UNPROTECT(1);
+	    return R_NilValue;
+	}
+	h = (int) ((((uintptr_t) s >> 4) * 2654435761U) >> 7 & (m - 1));
+	while ((k = tab[h]) && STRING_ELT(cvec, first[k - 1]) != s)
+	    h = (int) ((h + 1) & (m - 1));
+	if (!k) {
+	    first[nlev] = i;
+	    k = tab[h] = ++nlev;
+	}
+	code[i] = k;
     }
 
-    if (typeInfo->iscomplex) {
-	strtoc(s, &endp, TRUE, data, exact);
-	if (!isBlankString(endp))
-	    typeInfo->iscomplex = FALSE;
+    /* put the levels in lexicographic order and renumber the codes */
+    PROTECT(levs = allocVector(STRSXP, nlev));
+    for (k = 0; k < nlev; k++)
+	SET_STRING_ELT(levs, k, STRING_ELT(cvec, first[k]));
+    ord = (int *) R_alloc(nlev, sizeof(int));
+    R_orderVector1(ord, nlev, levs, TRUE, FALSE);
+    PROTECT(slevs = allocVector(STRSXP, nlev));
+    for (k = 0; k < nlev; k++) {
+	SET_STRING_ELT(slevs, k, STRING_ELT(levs, ord[k]));
+	first[ord[k]] = k + 1;
     }
+    for (i = 0; i < len; i++)
+	if (code[i] != NA_INTEGER) code[i] = first[code[i] - 1];
+
+    setAttrib(ans, R_LevelsSymbol, slevs);
+    PROTECT(a = mkString("factor"));
+    setAttrib(ans, R_ClassSymbol, a);
+    UNPROTECT(4);
+    return ans;
 }
 
 
@@ -544,24 +602,28 @@ static void ruleout_types(const char *s, Typecvt_Info *typeInfo, LocalData *data
    character variable, if possible to convert it to a logical,
    integer, numeric or complex variable.  If this is not possible,
    the result is a character string if as.is == TRUE
-   or a factor if as.is == FALSE. */
+   or a factor if as.is == FALSE.
+
+   The strings are converted in a single pass: each field is parsed
+   only as the narrowest type still possible for the column, and the
+   values converted so far are widened when a field does not fit, so
+   no field is parsed more than once per type. */
 
 
 SEXP typeconvert(SEXP call, SEXP op, SEXP args, SEXP env)
 {
-    SEXP cvec, a, dup, levs, dims, names, dec, numerals;
+    SEXP cvec, a, dup, levs, dims, names, dec, numerals, s;
     SEXP rval = R_NilValue; /* -Wall */
-    int i, j, len, asIs, i_exact;
-    Rboolean done = FALSE, exact;
+    int i, j, len, asIs, i_exact, v;
+    SEXPTYPE type = LGLSXP;
+    Rboolean seen = FALSE;
     char *endp;
     const char *tmp = NULL;
+    double x;
+    Rcomplex z;
+    PROTECT_INDEX ipx;
     LocalData data = {NULL, 0, 0, '.', NULL, NO_COMCHAR, 0, NULL, FALSE,
 		      FALSE, 0, FALSE, FALSE};
-    Typecvt_Info typeInfo;      /* keep track of possible types of cvec */
-    typeInfo.islogical = TRUE;  /* we can't rule anything out initially */
-    typeInfo.isinteger = TRUE;
-    typeInfo.isreal = TRUE;
-    typeInfo.iscomplex = TRUE;
     data.NAstrings = R_NilValue;
 
     args = CDR(args);
@@ -587,21 +649,17 @@ SEXP typeconvert(SEXP call, SEXP op, SEXP args, SEXP env)
     numerals = CAD4R(args); // string, one of c("allow.loss", "warn.loss", "no.loss")
     if (isString(numerals)) {
 	tmp = CHAR(STRING_ELT(numerals, 0));
-	if(strcmp(tmp, "allow.loss") == 0) {
+	if(strcmp(tmp, "allow.loss") == 0)
 	    i_exact = FALSE;
-	    exact = FALSE;
-	} else if(strcmp(tmp, "warn.loss") == 0) {
+	else if(strcmp(tmp, "warn.loss") == 0)
 	    i_exact = NA_INTEGER;
-	    exact = FALSE;
-	} else if(strcmp(tmp, "no.loss") == 0) {
+	else if(strcmp(tmp, "no.loss") == 0)
 	    i_exact = TRUE;
-	    exact = TRUE;
-	} else // should never happen
+	else // should never happen
 	    error(_("invalid 'numerals' string: \"%s\""), tmp);
 
     } else { // (currently never happens): use default
 	i_exact = FALSE;
-	exact = FALSE;
     }
 
     cvec = CAR(args);
@@ -615,105 +673,84 @@ SEXP typeconvert(SEXP call, SEXP op, SEXP args, SEXP env)
     else
 	PROTECT(names = getAttrib(cvec, R_NamesSymbol));
 
-    /* Find the first non-NA entry (empty => NA) */
-    for (i = 0; i < len; i++) {
-	tmp = CHAR(STRING_ELT(cvec, i));
-	if (!(STRING_ELT(cvec, i) == NA_STRING || strlen(tmp) == 0
-	      || isNAstring(tmp, 1, &data) || isBlankString(tmp)))
-	    break;
-    }
-    if (i < len) { // Found non-NA entry; use it to screen:
-	ruleout_types(tmp, &typeInfo, &data, exact);
-    }
-
-    if (typeInfo.islogical) {
-	PROTECT(rval = allocVector(LGLSXP, len));
-	for (i = 0; i < len; i++) {
-	    tmp = CHAR(STRING_ELT(cvec, i));
-	    if (STRING_ELT(cvec, i) == NA_STRING || strlen(tmp) == 0
-		|| isNAstring(tmp, 1, &data) || isBlankString(tmp))
-		LOGICAL(rval)[i] = NA_LOGICAL;
-	    else {
-		if (strcmp(tmp, "F") == 0 || strcmp(tmp, "FALSE") == 0)
-		    LOGICAL(rval)[i] = 0;
-		else if(strcmp(tmp, "T") == 0 || strcmp(tmp, "TRUE") == 0)
-		    LOGICAL(rval)[i] = 1;
-		else {
-		    typeInfo.islogical = FALSE;
-		    ruleout_types(tmp, &typeInfo, &data, exact);
-		    break;
-		}
-	    }
-	}
-	if (typeInfo.islogical) done = TRUE; else UNPROTECT(1);
-    }
-
-    if (!done && typeInfo.isinteger) {
-	PROTECT(rval = allocVector(INTSXP, len));
-	for (i = 0; i < len; i++) {
-	    tmp = CHAR(STRING_ELT(cvec, i));
-	    if (STRING_ELT(cvec, i) == NA_STRING || strlen(tmp) == 0
-		|| isNAstring(tmp, 1, &data) || isBlankString(tmp))
+    /* All NA (or empty) gives logical; the first non-NA entry decides
+       between logical and the numeric types, which are then widened
+       as needed; anything else makes the result character. */
+    PROTECT_WITH_INDEX(rval = allocVector(LGLSXP, len), &ipx);
+    for (i = 0; i < len && type != STRSXP; i++) {
+	s = STRING_ELT(cvec, i);
+	if (tc_isNA(s, &data)) {
+	    switch(type) {
+	    case REALSXP:
+		REAL(rval)[i] = NA_REAL;
+		break;
+	    case CPLXSXP:
+		COMPLEX(rval)[i].r = COMPLEX(rval)[i].i = NA_REAL;
+		break;
+	    default:
 		INTEGER(rval)[i] = NA_INTEGER;
-	    else {
-		INTEGER(rval)[i] = Strtoi(tmp, 10);
-		if (INTEGER(rval)[i] == NA_INTEGER) {
-		    typeInfo.isinteger = FALSE;
-		    ruleout_types(tmp, &typeInfo, &data, exact);
-		    break;
-		}
 	    }
+	    continue;
 	}
-	if(typeInfo.isinteger) done = TRUE; else UNPROTECT(1);
-    }
-
-    if (!done && typeInfo.isreal) {
-	PROTECT(rval = allocVector(REALSXP, len));
-	for (i = 0; i < len; i++) {
-	    tmp = CHAR(STRING_ELT(cvec, i));
-	    if (STRING_ELT(cvec, i) == NA_STRING || strlen(tmp) == 0
-		|| isNAstring(tmp, 1, &data) || isBlankString(tmp))
-		REAL(rval)[i] = NA_REAL;
-	    else {
-		REAL(rval)[i] = Strtod(tmp, &endp, FALSE, &data, i_exact);
-		if (!isBlankString(endp)) {
-		    typeInfo.isreal = FALSE;
-		    ruleout_types(tmp, &typeInfo, &data, exact);
-		    break;
-		}
+	tmp = CHAR(s);
+	if (!seen) {
+	    seen = TRUE;
+	    if (strcmp(tmp, "F") && strcmp(tmp, "T") &&
+		strcmp(tmp, "FALSE") && strcmp(tmp, "TRUE")) {
+		type = INTSXP;
+		REPROTECT(rval = tc_widen(rval, type, i), ipx);
 	    }
 	}
-	if(typeInfo.isreal) done = TRUE; else UNPROTECT(1);
-    }
-
-    if (!done && typeInfo.iscomplex) {
-	PROTECT(rval = allocVector(CPLXSXP, len));
-	for (i = 0; i < len; i++) {
-	    tmp = CHAR(STRING_ELT(cvec, i));
-	    if (STRING_ELT(cvec, i) == NA_STRING || strlen(tmp) == 0
-		|| isNAstring(tmp, 1, &data) || isBlankString(tmp))
-		COMPLEX(rval)[i].r = COMPLEX(rval)[i].i = NA_REAL;
-	    else {
-		COMPLEX(rval)[i] = strtoc(tmp, &endp, FALSE, &data, i_exact);
-		if (!isBlankString(endp)) {
-		    typeInfo.iscomplex = FALSE;
-		    /* this is not needed, unless other cases are added */
-		    ruleout_types(tmp, &typeInfo, &data, exact);
-		    break;
-		}
+	switch(type) {
+	case LGLSXP:
+	    if (strcmp(tmp, "F") == 0 || strcmp(tmp, "FALSE") == 0)
+		LOGICAL(rval)[i] = 0;
+	    else if(strcmp(tmp, "T") == 0 || strcmp(tmp, "TRUE") == 0)
+		LOGICAL(rval)[i] = 1;
+	    else
+		type = STRSXP;
+	    break;
+	case INTSXP:
+	    v = Strtoi(tmp, 10);
+	    if (v != NA_INTEGER) {
+		INTEGER(rval)[i] = v;
+		break;
+	    }
+	    type = REALSXP;
+	    REPROTECT(rval = tc_widen(rval, type, i), ipx);
+	    /* fall through */
+	case REALSXP:
+	    x = Strtod(tmp, &endp, FALSE, &data, i_exact);
+	    if (isBlankString(endp)) {
+		REAL(rval)[i] = x;
+		break;
 	    }
+	    type = CPLXSXP;
+	    REPROTECT(rval = tc_widen(rval, type, i), ipx);
+	    /* fall through */
+	case CPLXSXP:
+	    z = strtoc(tmp, &endp, FALSE, &data, i_exact);
+	    if (isBlankString(endp))
+		COMPLEX(rval)[i] = z;
+	    else
+		type = STRSXP;
+	    break;
+	default:
+	    break;
 	}
-	if(typeInfo.iscomplex) done = TRUE; else UNPROTECT(1);
     }
 
-    if (!done) {
+    if (type == STRSXP) {
 	if (asIs) {
-	    PROTECT(rval = duplicate(cvec));
+	    REPROTECT(rval = duplicate(cvec), ipx);
 	    for (i = 0; i < len; i++)
 		if(isNAstring(CHAR(STRING_ELT(rval, i)), 1, &data))
 		    SET_STRING_ELT(rval, i, NA_STRING);
 	}
+	else if ((a = tc_factor(cvec, &data)) != R_NilValue)
+	    REPROTECT(rval = a, ipx);
 	else {
+	    /* mixed encodings: equal strings may differ as CHARSXPs */
 	    PROTECT(dup = duplicated(cvec, FALSE));
 	    j = 0;
 	    for (i = 0; i < len; i++) {
@@ -736,6 +773,7 @@ SEXP typeconvert(SEXP call, SEXP op, SEXP args, SEXP env)
 	     */
 	    rval = dup;
 	    SET_TYPEOF(rval, INTSXP);
+	    REPROTECT(rval, ipx);
 
 	    /* put the levels in lexicographic order */
 
@@ -748,7 +786,7 @@ SEXP typeconvert(SEXP call, SEXP op, SEXP args, SEXP env)
 	    setAttrib(rval, R_LevelsSymbol, levs);
 	    PROTECT(a = mkString("factor"));
 	    setAttrib(rval, R_ClassSymbol, a);
-	    UNPROTECT(3);
+	    UNPROTECT(4);
 	}
     }
 
@@ -954,6 +992,792 @@ no_more_lines:
     return ans2;
 }
 
+/* --------- reading delimited files on several threads --------- */
+
+/* readtablefast(file, skip, header, what, sep, quote, dec, na.strings,
+		 strip.white, blank.lines.skip, fill, comment.char,
+		 encoding, infer)
+
+   read.table() on a delimited local file without re-encoding, done
+   without a connection.  The file is mapped (or read) into memory,
+   and its records are found, split into fields and the columns
+   converted, each step on R_num_math_threads threads for files of
+   READ_THREADS_MIN bytes or more.  The result is what the scan() in
+   read.table() would give, except that the columns marked in 'infer'
+   are already logical, integer or double when type.convert() would
+   make them so: other columns are character.
+
+   Anything not handled exactly as scan() and type.convert() would
+   handle it gives NULL, and read.table() then uses scan(), which
+   signals the appropriate errors and warnings.  That includes
+   compressed files, embedded nuls, EOF within a quoted string and
+   short lines without 'fill'.  Fields with non-ASCII bytes leave
+   the column as character for type.convert(), as whether they are
+   blank depends on the locale.
+*/
+
+#if defined(HAVE_MMAP) && !defined(Win32)
+# define READTABLE_MMAP
+# include <fcntl.h>
+# include <unistd.h>
+# include <sys/mman.h>
+# include <sys/stat.h>
+#endif
+
+#ifdef _OPENMP
+# include <omp.h>
+#endif
+
+#define READ_THREADS_MIN 1048576
+#define READ_RECBLOCK 4096	/* records per splitting task */
+#define READ_ROWBLOCK 16384	/* rows per conversion task */
+#define READ_SAMPLE 1000	/* rows used to guess the column types */
+
+#define RTF_NOFIELD ((size_t) -1) /* a field added by 'fill' */
+#define RTF_BAD (-2)		/* EOF within a quoted string */
+
+/* Column types in the order type.convert() tries them: RTF_NA is a
+   column with no non-NA field seen so far */
+#define RTF_NA -1
+#define RTF_LGL 0
+#define RTF_INT 1
+#define RTF_REAL 2
+#define RTF_STR 3
+
+typedef struct {
+    const char *buf;		/* the file contents */
+    size_t len;
+    int sep, comchar;
+    char isquote[256];
+    int nc, blskip, fill;
+    const int *strip;		/* by column */
+    const int *skipcol;		/* by column: NULL in 'what' */
+    char dec;
+    int nna;
+    const char **na;		/* na.strings */
+    cetype_t enc;
+} rtf_data;
+
+typedef struct {
+    char *map;
+    size_t len;
+} rtf_info;
+
+static void rtf_cleanup(void *data)
+{
+    rtf_info *ri = data;
+    if (ri->map) {
+#ifdef READTABLE_MMAP
+	munmap(ri->map, ri->len);
+#else
+	free(ri->map);
+#endif
+	ri->map = NULL;
+    }
+}
+
+static Rboolean rtf_open(const char *path, rtf_info *ri)
+{
+#ifdef READTABLE_MMAP
+    struct stat sb;
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return FALSE;
+    if (fstat(fd, &sb) != 0 || !S_ISREG(sb.st_mode)) {
+	close(fd);
+	return FALSE;
+    }
+    ri->len = (size_t) sb.st_size;
+    if (ri->len > 0) {
+	void *p = mmap(NULL, ri->len, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (p == MAP_FAILED) {
+	    close(fd);
+	    return FALSE;
+	}
+	ri->map = p;
+    }
+    close(fd);
+    return TRUE;
+#else
+    FILE *fp = R_fopen(path, "rb");
+    long n;
+    if (!fp) return FALSE;
+    if (fseek(fp, 0, SEEK_END) != 0 || (n = ftell(fp)) < 0) {
+	fclose(fp);
+	return FALSE;
+    }
+    rewind(fp);
+    ri->len = (size_t) n;
+    if (n > 0) {
+	ri->map = malloc(n);
+	if (!ri->map || fread(ri->map, 1, n, fp) != (size_t) n) {
+	    free(ri->map);
+	    ri->map = NULL;
+	    fclose(fp);
+	    return FALSE;
+	}
+    }
+    fclose(fp);
+    return TRUE;
+#endif
+}
+
+/* The next character, with CR and CRLF mapped to LF as by Rconn_fgetc */
+static R_INLINE int rtf_getc(const rtf_data *d, size_t *pos)
+{
+    int c;
+    if (*pos >= d->len) return R_EOF;
+    c = (unsigned char) d->buf[(*pos)++];
+    if (c == '\r') {
+	if (*pos < d->len && d->buf[*pos] == '\n') (*pos)++;
+	c = '\n';
+    }
+    return c;
+}
+
+/* scanchar(FALSE, ): the same, skipping comments */
+static R_INLINE int rtf_getc_com(const rtf_data *d, size_t *pos)
+{
+    int c = rtf_getc(d, pos);
+    if (c == d->comchar)
+	do c = rtf_getc(d, pos); while (c != '\n' && c != R_EOF);
+    return c;
+}
+
+/* Read the field at *pos into out as fillBuffer() does with a
+   separator, returning its length.  *term is set to the character
+   ending the field (the separator, '\n' or R_EOF) or RTF_BAD. */
+static int rtf_field(const rtf_data *d, size_t *pos, int strip,
+		     int eatwhite, char *out, int *term)
+{
+    int c, m = 0, mm = 0;
+    size_t p = *pos;
+
+    for (;;) {
+	c = rtf_getc_com(d, &p);
+	if (c == d->sep || c == '\n' || c == R_EOF) break;
+	if (eatwhite)
+	    while (c == ' ' || c == '\t') {
+		c = rtf_getc_com(d, &p);
+		if (c == d->sep || c == '\n' || c == R_EOF) goto done;
+	    }
+	if (d->isquote[c]) {
+	    int quote = c;
+	    for (;;) {
+		while ((c = rtf_getc(d, &p)) != R_EOF && c != quote)
+		    out[m++] = (char) c;
+		if (c == R_EOF) {
+		    *term = RTF_BAD;
+		    return 0;
+		}
+		/* a doubled quote stands for itself */
+		size_t save = p;
+		if (rtf_getc(d, &p) != quote) {
+		    p = save;
+		    break;
+		}
+		out[m++] = (char) quote;
+	    }
+	    mm = m;
+	    continue;
+	}
+	if (!strip || m > 0 || !Rspace(c)) out[m++] = (char) c;
+    }
+done:
+    if (strip)
+	while (m > mm && Rspace((unsigned char) out[m - 1])) m--;
+    out[m] = '\0';
+    *term = c;
+    *pos = p;
+    return m;
+}
+
+/* Step over a line as readtablehead() reads it, returning TRUE if it
+   would keep the line. */
+static Rboolean rtf_headline(const rtf_data *d, size_t *pos, int *eof)
+{
+    int c, quote = 0;
+    Rboolean empty = TRUE, skip = FALSE, firstnonwhite = TRUE;
+
+    while ((c = rtf_getc(d, pos)) != R_EOF) {
+	if (quote) {
+	    if (c == quote) {
+		size_t save = *pos;
+		if (rtf_getc(d, pos) != quote) {
+		    *pos = save;
+		    quote = 0;
+		}
+	    }
+	} else if (!skip && firstnonwhite && d->isquote[c]) quote = c;
+	else if (Rspace(c) || c == d->sep) firstnonwhite = TRUE;
+	else firstnonwhite = FALSE;
+	if (empty && !skip && c != '\n' && c != d->comchar) empty = FALSE;
+	if (!quote && !skip && c == d->comchar) skip = TRUE;
+	if (!quote && c == '\n') break;
+    }
+    *eof = (c == R_EOF);
+    return !empty || (c != R_EOF && !d->blskip);
+}
+
+/* Split the record at pos into rows of nc fields as scanFrame() does,
+   storing the offsets of the fields in off unless that is NULL.
+   Returns the number of rows, or -1 where scan() would signal an error
+   or a warning. */
+static int rtf_record(const rtf_data *d, size_t pos, char *buf, size_t *off)
+{
+    int colsread = 0, rows = 0, m, term, nc = d->nc;
+
+    for (;;) {
+	size_t start = pos;
+	m = rtf_field(d, &pos, d->strip[colsread], d->skipcol[colsread],
+		      buf, &term);
+	if (term == RTF_BAD) return -1;
+	/* an empty first field ending the line is a blank line */
+	if (!(colsread == 0 && m == 0 &&
+	      ((d->blskip && term == '\n') || term == R_EOF))) {
+	    if (off) off[(size_t) rows * nc + colsread] = start;
+	    if (++colsread == nc) {
+		rows++;
+		colsread = 0;
+	    }
+	}
+	if (term == '\n' || term == R_EOF) break;
+    }
+    if (colsread > 0) {
+	if (!d->fill) return -1;
+	if (off)
+	    for (; colsread < nc; colsread++)
+		off[(size_t) rows * nc + colsread] = RTF_NOFIELD;
+	rows++;
+    }
+    return rows;
+}
+
+/* Count the line ends in [from, to), and the quotes if there is a
+   single quote character.  Returns FALSE for a nul or a CR CR LF,
+   which Rconn_fgetc() reads as three line ends. */
+static Rboolean rtf_count(const rtf_data *d, size_t from, size_t to,
+			  size_t *nl, size_t *nq)
+{
+    const char *s = d->buf;
+    size_t n = 0, q = 0;
+    for (size_t i = from; i < to; i++) {
+	char c = s[i];
+	if (c == '\n') n++;
+	else if (c == '\r') {
+	    if (i + 1 == d->len || s[i + 1] != '\n') n++;
+	    if (i + 2 < d->len && s[i + 1] == '\r' && s[i + 2] == '\n')
+		return FALSE;
+	} else if (c == '\0') return FALSE;
+	else if (d->isquote[(unsigned char) c]) q++;
+    }
+    *nl = n;
+    *nq = q;
+    return TRUE;
+}
+
+/* Store the starts of the records following line ends outside quotes
+   in [from, to), given whether 'from' is within a quote. */
+static size_t rtf_ends_parity(const rtf_data *d, size_t from, size_t to,
+			      int inquote, size_t *rs)
+{
+    const char *s = d->buf;
+    size_t n = 0;
+    for (size_t i = from; i < to; i++) {
+	char c = s[i];
+	if (d->isquote[(unsigned char) c]) inquote = !inquote;
+	else if (!inquote &&
+		 (c == '\n' ||
+		  (c == '\r' && (i + 1 == d->len || s[i + 1] != '\n'))))
+	    rs[n++] = i + 1;
+    }
+    return n;
+}
+
+/* The same for any quotes and comments, from the start of a record.
+   Returns -1 for EOF within a quoted string. */
+static ptrdiff_t rtf_ends(const rtf_data *d, size_t from, size_t *rs)
+{
+    int c, quote = 0, comment = 0;
+    size_t n = 0, p = from;
+    while ((c = rtf_getc(d, &p)) != R_EOF) {
+	if (quote) {
+	    if (c == quote) quote = 0;
+	} else if (c == '\n') {
+	    comment = 0;
+	    rs[n++] = p;
+	} else if (comment) ;
+	else if (c == d->comchar) comment = 1;
+	else if (c != d->sep && d->isquote[c]) quote = c;
+    }
+    return quote ? -1 : (ptrdiff_t) n;
+}
+
+/* The field of row i in column j, as a C string in buf */
+static R_INLINE int rtf_get(const rtf_data *d, const size_t *off,
+			    R_xlen_t i, int j, char *buf)
+{
+    int term;
+    size_t pos = off[(size_t) i * d->nc + j];
+    if (pos == RTF_NOFIELD) {
+	buf[0] = '\0';
+	return 0;
+    }
+    return rtf_field(d, &pos, d->strip[j], 0, buf, &term);
+}
+
+static R_INLINE Rboolean rtf_isNAstring(const rtf_data *d, const char *s)
+{
+    for (int k = 0; k < d->nna; k++)
+	if (!strcmp(d->na[k], s)) return TRUE;
+    return FALSE;
+}
+
+/* NA for type.convert(): an NA string, or blank */
+static R_INLINE Rboolean rtf_isNA(const rtf_data *d, const char *s)
+{
+    const char *p;
+    for (p = s; *p; p++)
+	if (!isspace((unsigned char) *p) || (unsigned char) *p > 127)
+	    break;
+    return *p == '\0' || rtf_isNAstring(d, s);
+}
+
+static R_INLINE Rboolean rtf_ascii(const char *s, int m)
+{
+    for (int k = 0; k < m; k++)
+	if ((unsigned char) s[k] > 127) return FALSE;
+    return TRUE;
+}
+
+static R_INLINE Rboolean rtf_isLogical(const char *s)
+{
+    return !strcmp(s, "F") || !strcmp(s, "T") ||
+	!strcmp(s, "FALSE") || !strcmp(s, "TRUE");
+}
+
+static R_INLINE Rboolean rtf_isReal(const rtf_data *d, const char *s,
+				    double *x)
+{
+    char *endp;
+    *x = R_strtod5(s, &endp, d->dec, FALSE, FALSE);
+    while (isspace((unsigned char) *endp)) endp++;
+    return *endp == '\0';
+}
+
+/* The type type.convert() needs for a non-NA field */
+static int rtf_class(const rtf_data *d, const char *s, int m)
+{
+    double x;
+    if (!rtf_ascii(s, m)) return RTF_STR;
+    if (rtf_isLogical(s)) return RTF_LGL;
+    if (Strtoi(s, 10) != NA_INTEGER) return RTF_INT;
+    if (rtf_isReal(d, s, &x)) return RTF_REAL;
+    return RTF_STR;
+}
+
+/* The type for fields of types a and b: logical fields only go with
+   logical ones, and integers with doubles */
+static R_INLINE int rtf_join(int a, int b)
+{
+    if (a == RTF_NA || a == b) return b;
+    if (b == RTF_NA) return a;
+    if (a == RTF_LGL || b == RTF_LGL) return RTF_STR;
+    return a > b ? a : b;
+}
+
+/* Convert rows [i0, i1) of column j to type t, in x.  Returns t, or
+   a wider type as soon as a field needs one.  For RTF_STR the cached
+   CHARSXPs are stored, and NULL for strings not in the cache. */
+static int rtf_convert(const rtf_data *d, const size_t *off, int j, int t,
+		       void *x, R_xlen_t i0, R_xlen_t i1, char *buf)
+{
+    for (R_xlen_t i = i0; i < i1; i++) {
+	int m = rtf_get(d, off, i, j, buf);
+	double r;
+	if (t == RTF_STR) {
+	    SEXP c;
+	    if (rtf_isNAstring(d, buf)) c = NA_STRING;
+	    else {
+		c = R_lookupCharLenCE(buf, m, d->enc);
+		if (c == R_NilValue) c = NULL;
+	    }
+	    ((SEXP *) x)[i] = c;
+	    continue;
+	}
+	if (rtf_isNA(d, buf)) {
+	    if (t == RTF_REAL) ((double *) x)[i] = NA_REAL;
+	    else ((int *) x)[i] = NA_INTEGER;
+	    continue;
+	}
+	switch (t) {
+	case RTF_NA:
+	    return rtf_class(d, buf, m);
+	case RTF_LGL:
+	    if (!rtf_isLogical(buf)) return RTF_STR;
+	    ((int *) x)[i] = buf[0] == 'T';
+	    break;
+	case RTF_INT:
+	    if (!rtf_ascii(buf, m)) return RTF_STR;
+	    if ((((int *) x)[i] = Strtoi(buf, 10)) == NA_INTEGER)
+		return rtf_isReal(d, buf, &r) ? RTF_REAL : RTF_STR;
+	    break;
+	case RTF_REAL:
+	    if (!rtf_ascii(buf, m) || !rtf_isReal(d, buf, &r))
+		return RTF_STR;
+	    ((double *) x)[i] = r;
+	    break;
+	}
+    }
+    return t;
+}
+
+static R_INLINE int rtf_thread(void)
+{
+#ifdef _OPENMP
+    return omp_get_thread_num();
+#else
+    return 0;
+#endif
+}
+
+static SEXP rtf_read(rtf_data *d, size_t start, const int *infer,
+		     int nthreads)
+{
+    SEXP ans;
+    size_t len = d->len, nl = 0, nrec, maxrec = 0, bufsize, *rs, *off;
+    R_xlen_t n = 0, nblk, nrb;
+    int nc = d->nc, nq = 0, bad = 0, *type, *done;
+    char *bufs;
+    void **x;
+
+    /* Find the record starts.  With at most one quote character and
+       no comments whether a line end is within a quoted string
+       depends only on the number of quotes before it, so the file can
+       be split into chunks. */
+    for (int c = 0; c < 256; c++) if (d->isquote[c]) nq++;
+    int nchunk = len - start >= READ_THREADS_MIN ? nthreads : 1;
+    size_t chunk = (len - start) / nchunk + 1,
+	*cnl = (size_t *) R_alloc(nchunk, sizeof(size_t)),
+	*cnq = (size_t *) R_alloc(nchunk, sizeof(size_t));
+#ifdef _OPENMP
+#pragma omp parallel for if(nchunk > 1) num_threads(nchunk) default(none) \
+    firstprivate(d, start, len, chunk, cnl, cnq, nchunk) reduction(|:bad)
+#endif
+    for (int t = 0; t < nchunk; t++) {
+	size_t from = start + t * chunk, to = from + chunk;
+	if (from > len) from = len;
+	if (to > len) to = len;
+	if (!rtf_count(d, from, to, cnl + t, cnq + t)) bad = 1;
+    }
+    if (bad) return R_NilValue;
+    for (int t = 0; t < nchunk; t++) nl += cnl[t];
+    rs = (size_t *) R_alloc(nl + 2, sizeof(size_t));
+    rs[0] = start;
+    if (nq <= 1 && d->comchar == NO_COMCHAR) {
+	size_t *base = (size_t *) R_alloc(nchunk, sizeof(size_t)),
+	    *found = (size_t *) R_alloc(nchunk, sizeof(size_t)), nquote = 0;
+	int *par = (int *) R_alloc(nchunk, sizeof(int));
+	for (int t = 0; t < nchunk; t++) {
+	    base[t] = t ? base[t - 1] + cnl[t - 1] : 1;
+	    par[t] = nquote % 2;
+	    nquote += cnq[t];
+	}
+	if (nquote % 2) return R_NilValue; /* EOF within a quoted string */
+#ifdef _OPENMP
+#pragma omp parallel for if(nchunk > 1) num_threads(nchunk) default(none) \
+    firstprivate(d, start, len, chunk, base, found, par, rs, nchunk)
+#endif
+	for (int t = 0; t < nchunk; t++) {
+	    size_t from = start + t * chunk, to = from + chunk;
+	    if (from > len) from = len;
+	    if (to > len) to = len;
+	    found[t] = rtf_ends_parity(d, from, to, par[t], rs + base[t]);
+	}
+	nrec = 1;
+	for (int t = 0; t < nchunk; t++) {
+	    memmove(rs + nrec, rs + base[t], found[t] * sizeof(size_t));
+	    nrec += found[t];
+	}
+    } else {
+	ptrdiff_t k = rtf_ends(d, start, rs + 1);
+	if (k < 0) return R_NilValue;
+	nrec = k + 1;
+    }
+    /* a line end at the end of the file starts no record */
+    if (rs[nrec - 1] == len) nrec--;
+    rs[nrec] = len;
+    for (size_t k = 0; k < nrec; k++)
+	if (rs[k + 1] - rs[k] > maxrec) maxrec = rs[k + 1] - rs[k];
+    if (maxrec >= INT_MAX) return R_NilValue;
+    bufsize = maxrec + 1;
+    bufs = R_alloc(nthreads * bufsize, sizeof(char));
+    R_CheckUserInterrupt();
+
+    /* Split the records into rows, counting them first */
+    nblk = (nrec + READ_RECBLOCK - 1) / READ_RECBLOCK;
+    R_xlen_t *brow = (R_xlen_t *) R_alloc(nblk + 1, sizeof(R_xlen_t));
+#ifdef _OPENMP
+#pragma omp parallel for if(nthreads > 1) num_threads(nthreads) \
+    default(none) firstprivate(d, rs, nrec, nblk, brow, bufs, bufsize) \
+    reduction(|:bad) schedule(dynamic)
+#endif
+    for (R_xlen_t b = 0; b < nblk; b++) {
+	char *buf = bufs + rtf_thread() * bufsize;
+	size_t k0 = b * READ_RECBLOCK, k1 = k0 + READ_RECBLOCK;
+	R_xlen_t rows = 0;
+	if (k1 > nrec) k1 = nrec;
+	for (size_t k = k0; k < k1; k++) {
+	    int r = rtf_record(d, rs[k], buf, NULL);
+	    if (r < 0) {
+		bad = 1;
+		break;
+	    }
+	    rows += r;
+	}
+	brow[b] = rows;
+    }
+    if (bad) return R_NilValue;
+    for (R_xlen_t b = 0; b < nblk; b++) {
+	R_xlen_t rows = brow[b];
+	brow[b] = n;
+	n += rows;
+    }
+    if (n > INT_MAX || (double) n * nc > R_XLEN_T_MAX) return R_NilValue;
+    off = (size_t *) R_alloc(n * nc, sizeof(size_t));
+#ifdef _OPENMP
+#pragma omp parallel for if(nthreads > 1) num_threads(nthreads) \
+    default(none) firstprivate(d, rs, nrec, nblk, brow, bufs, bufsize, off) \
+    schedule(dynamic)
+#endif
+    for (R_xlen_t b = 0; b < nblk; b++) {
+	char *buf = bufs + rtf_thread() * bufsize;
+	size_t k0 = b * READ_RECBLOCK, k1 = k0 + READ_RECBLOCK,
+	    *o = off + (size_t) brow[b] * d->nc;
+	if (k1 > nrec) k1 = nrec;
+	for (size_t k = k0; k < k1; k++)
+	    o += (size_t) rtf_record(d, rs[k], buf, o) * d->nc;
+    }
+    R_CheckUserInterrupt();
+
+    /* Guess the types of the columns to convert from the first rows */
+    type = (int *) R_alloc(nc, sizeof(int));
+    done = (int *) R_alloc(nc, sizeof(int));
+    for (int j = 0; j < nc; j++) {
+	done[j] = d->skipcol[j];
+	type[j] = infer[j] ? RTF_NA : RTF_STR;
+	for (R_xlen_t i = 0; i < n && i < READ_SAMPLE; i++) {
+	    if (done[j] || type[j] == RTF_STR) break;
+	    int m = rtf_get(d, off, i, j, bufs);
+	    if (!rtf_isNA(d, bufs))
+		type[j] = rtf_join(type[j], rtf_class(d, bufs, m));
+	}
+    }
+
+    /* Convert the columns, widening the type of any with a field not
+       of the type guessed and converting it again */
+    PROTECT(ans = allocVector(VECSXP, nc));
+    x = (void **) R_alloc(nc, sizeof(void *));
+    nrb = (n + READ_ROWBLOCK - 1) / READ_ROWBLOCK;
+    for (;;) {
+	int npend = 0, *pend = (int *) R_alloc(nc, sizeof(int)), *need;
+	for (int j = 0; j < nc; j++) {
+	    SEXP v;
+	    if (done[j]) continue;
+	    pend[npend++] = j;
+	    switch (type[j]) {
+	    case RTF_NA:
+	    case RTF_LGL:
+		v = allocVector(LGLSXP, n);
+		x[j] = LOGICAL(v);
+		break;
+	    case RTF_INT:
+		v = allocVector(INTSXP, n);
+		x[j] = INTEGER(v);
+		break;
+	    case RTF_REAL:
+		v = allocVector(REALSXP, n);
+		x[j] = REAL(v);
+		break;
+	    default:
+		v = allocVector(STRSXP, n);
+		x[j] = R_alloc(n, sizeof(SEXP));
+	    }
+	    SET_VECTOR_ELT(ans, j, v);
+	}
+	if (npend == 0) break;
+	R_xlen_t ntask = npend * nrb;
+	need = (int *) R_alloc(ntask, sizeof(int));
+#ifdef _OPENMP
+#pragma omp parallel for if(nthreads > 1) num_threads(nthreads) \
+    default(none) firstprivate(d, off, n, nrb, ntask, pend, type, x, need, \
+			       bufs, bufsize) schedule(dynamic)
+#endif
+	for (R_xlen_t task = 0; task < ntask; task++) {
+	    int j = pend[task / nrb];
+	    R_xlen_t i0 = (task % nrb) * READ_ROWBLOCK, i1 = i0 + READ_ROWBLOCK;
+	    if (i1 > n) i1 = n;
+	    need[task] = rtf_convert(d, off, j, type[j], x[j], i0, i1,
+				     bufs + rtf_thread() * bufsize);
+	}
+	for (int p = 0; p < npend; p++) {
+	    int j = pend[p], t = type[j];
+	    for (R_xlen_t b = 0; b < nrb; b++)
+		t = rtf_join(t, need[p * nrb + b]);
+	    if (t != type[j]) {
+		type[j] = t;
+		pend[p] = -1;
+		continue;
+	    }
+	    done[j] = 1;
+	    /* store the cached strings before any allocation can
+	       collect them */
+	    if (t == RTF_STR) {
+		SEXP v = VECTOR_ELT(ans, j), *cs = x[j];
+		for (R_xlen_t i = 0; i < n; i++)
+		    if (cs[i]) SET_STRING_ELT(v, i, cs[i]);
+	    }
+	}
+	for (int p = 0; p < npend; p++) {
+	    int j = pend[p];
+	    if (j < 0 || type[j] != RTF_STR) continue;
+	    SEXP v = VECTOR_ELT(ans, j), *cs = x[j];
+	    for (R_xlen_t i = 0; i < n; i++)
+		if (!cs[i]) {
+		    int m = rtf_get(d, off, i, j, bufs);
+		    SET_STRING_ELT(v, i, mkCharLenCE(bufs, m, d->enc));
+		}
+	}
+	R_CheckUserInterrupt();
+    }
+    UNPROTECT(1);
+    return ans;
+}
+
+SEXP readtablefast(SEXP args)
+{
+    SEXP file, what, sep, quotes, dec, nastrings, strip, comstr, encoding,
+	infer, ans;
+    int nskip, header, nc, nthreads = 1, *lstrip, *skipcol;
+    const char *p, *enc;
+    size_t pos = 0;
+    rtf_data d;
+    rtf_info ri = {NULL, 0};
+    RCNTXT cntxt;
+
+    args = CDR(args);
+
+    file = CAR(args);		   args = CDR(args);
+    nskip = asInteger(CAR(args));  args = CDR(args);
+    header = asLogical(CAR(args)); args = CDR(args);
+    what = CAR(args);		   args = CDR(args);
+    sep = CAR(args);		   args = CDR(args);
+    quotes = CAR(args);		   args = CDR(args);
+    dec = CAR(args);		   args = CDR(args);
+    nastrings = CAR(args);	   args = CDR(args);
+    strip = CAR(args);		   args = CDR(args);
+    d.blskip = asLogical(CAR(args)); args = CDR(args);
+    d.fill = asLogical(CAR(args)); args = CDR(args);
+    comstr = CAR(args);		   args = CDR(args);
+    encoding = CAR(args);	   args = CDR(args);
+    infer = CAR(args);
+
+    /* leave anything unusual to scan() */
+    if (!isString(file) || LENGTH(file) != 1 ||
+	TYPEOF(what) != VECSXP || (nc = LENGTH(what)) == 0 ||
+	!isString(sep) || LENGTH(sep) != 1 ||
+	!isString(quotes) || LENGTH(quotes) != 1 ||
+	!isString(dec) || LENGTH(dec) != 1 || !isString(nastrings) ||
+	!isLogical(strip) || (LENGTH(strip) != 1 && LENGTH(strip) != nc) ||
+	!isString(comstr) || LENGTH(comstr) != 1 ||
+	!isString(encoding) || LENGTH(encoding) != 1 ||
+	!isLogical(infer) || LENGTH(infer) != nc ||
+	header == NA_LOGICAL || d.blskip == NA_LOGICAL ||
+	d.fill == NA_LOGICAL || (mbcslocale && !utf8locale))
+	return R_NilValue;
+
+    p = CHAR(STRING_ELT(sep, 0));
+    if (strlen(p) != 1 || (unsigned char) p[0] > 127 ||
+	p[0] == '\n' || p[0] == '\r')
+	return R_NilValue;
+    d.sep = p[0];
+    memset(d.isquote, 0, 256);
+    for (p = CHAR(STRING_ELT(quotes, 0)); *p; p++) {
+	if ((unsigned char) *p > 127 || *p == '\n' || *p == '\r')
+	    return R_NilValue;
+	if (*p != d.sep) d.isquote[(unsigned char) *p] = 1;
+    }
+    p = CHAR(STRING_ELT(dec, 0));
+    if (strlen(p) != 1 || (unsigned char) p[0] > 127) return R_NilValue;
+    d.dec = p[0];
+    p = CHAR(STRING_ELT(comstr, 0));
+    if (strlen(p) > 1 || (unsigned char) p[0] > 127 ||
+	p[0] == '\n' || p[0] == '\r' || d.isquote[(unsigned char) p[0]])
+	return R_NilValue;
+    d.comchar = p[0] ? p[0] : NO_COMCHAR;
+    enc = CHAR(STRING_ELT(encoding, 0));
+    if (streql(enc, "UTF-8")) d.enc = CE_UTF8;
+    else if (streql(enc, "latin1")) d.enc = CE_LATIN1;
+    else if (streql(enc, "unknown")) d.enc = CE_NATIVE;
+    else return R_NilValue;
+
+    d.nc = nc;
+    lstrip = (int *) R_alloc(nc, sizeof(int));
+    skipcol = (int *) R_alloc(nc, sizeof(int));
+    for (int j = 0; j < nc; j++) {
+	SEXP w = VECTOR_ELT(what, j);
+	if (!isNull(w) && !isString(w)) return R_NilValue;
+	skipcol[j] = isNull(w);
+	lstrip[j] = LOGICAL(strip)[LENGTH(strip) == nc ? j : 0] != 0;
+    }
+    d.strip = lstrip;
+    d.skipcol = skipcol;
+    d.nna = LENGTH(nastrings);
+    d.na = (const char **) R_alloc(d.nna, sizeof(char *));
+    for (int k = 0; k < d.nna; k++)
+	d.na[k] = CHAR(STRING_ELT(nastrings, k));
+
+    if (!rtf_open(R_ExpandFileName(translateChar(STRING_ELT(file, 0))), &ri))
+	return R_NilValue;
+    begincontext(&cntxt, CTXT_CCODE, R_NilValue, R_BaseEnv, R_BaseEnv,
+		 R_NilValue, R_NilValue);
+    cntxt.cend = &rtf_cleanup;
+    cntxt.cenddata = &ri;
+    d.buf = ri.map ? ri.map : "";
+    d.len = ri.len;
+
+    /* compressed files are read by file() */
+    if ((d.len >= 2 && !memcmp(d.buf, "\x1f\x8b", 2)) ||
+	(d.len >= 3 && !memcmp(d.buf, "BZh", 3)) ||
+	(d.len >= 5 && !memcmp(d.buf, "\xFD" "7zXZ", 5)))
+	ans = R_NilValue;
+    else {
+	int eof = 0;
+	/* the lines skipped by readLines(), and then the header as
+	   read by readtablehead() */
+	if (nskip > 0 && nskip != NA_INTEGER)
+	    for (int k = 0; k < nskip; k++) {
+		int c;
+		while ((c = rtf_getc(&d, &pos)) != '\n' && c != R_EOF) ;
+		if (c == R_EOF) break;
+	    }
+	else if (!header && utf8locale && d.len >= 3 &&
+		 !memcmp(d.buf, "\xef\xbb\xbf", 3))
+	    pos = 3; /* scan() drops a BOM at the start */
+	if (header)
+	    while (!rtf_headline(&d, &pos, &eof) && !eof) ;
+#ifdef _OPENMP
+	if (d.len >= READ_THREADS_MIN && R_num_math_threads > 1)
+	    nthreads = R_num_math_threads;
+#endif
+	ans = rtf_read(&d, pos, LOGICAL(infer), nthreads);
+	if (ans != R_NilValue)
+	    setAttrib(ans, R_NamesSymbol, getAttrib(what, R_NamesSymbol));
+    }
+    endcontext(&cntxt);
+    rtf_cleanup(&ri);
+    return ans;
+}
+
 /* --------- write.table --------- */
 
 /* write.table(x, file, nr, nc, rnames, sep, eol, na, dec, quote, qstring)
@@ -1019,11 +1843,64 @@ static const char
     return EncodeElement0(x, indx, quote ? '"' : 0, dec);
 }
 
+/* The table is written a block of WT_BLOCK_ROWS rows at a time into a
+   buffer, which is then passed to the connection in a single call.
+   Each column gets a formatter chosen once: logicals, integers and
+   doubles are converted without EncodeElement0's static buffers, the
+   levels of a factor are encoded once, and character columns know
+   whether they are quoted.  The doubles are written as EncodeElement0
+   writes them at 15 significant digits.
+
+   When every column can be formatted without touching R's heap
+   (no complex or raw columns, and no strings needing translation),
+   tables of WT_THREADS_MIN cells or more are formatted a block per
+   thread on R_num_math_threads threads, and the blocks written in
+   order. */
+
+#ifdef _OPENMP
+# include <omp.h>
+#endif
+
+#define WT_BLOCK_ROWS 4096
+#define WT_THREADS_MIN 100000
+#define WT_NB 1000
+
+typedef enum {
+    WT_LGL, WT_INT, WT_REAL, WT_STR, WT_LEVELS, WT_OTHER
+} wt_kind;
+
+typedef struct wt_col {
+    wt_kind kind;
+    SEXP x;			/* the vector, or the matrix */
+    R_xlen_t off;		/* offset of the column in x */
+    Rboolean quote, rnames;
+    const char **lev;		/* encoded levels of a factor */
+    int *levlen, nlev;
+} wt_col;
+
+typedef struct wt_buf {
+    char *data;
+    size_t len, size;
+    int err;			/* 1: out of memory, 2: bad factor code */
+} wt_buf;
+
+typedef struct wt_opts {
+    const char *sep, *eol, *na;
+    size_t nsep, neol, nna;
+    char dec;
+    int qmethod;
+    Rboolean serial;
+    R_StringBuffer *strBuf;
+    const char *sdec;
+} wt_opts;
+
 typedef struct wt_info {
     Rboolean wasopen;
     Rconnection con;
     R_StringBuffer *buf;
     int savedigits;
+    wt_buf *out;
+    int nout;
 } wt_info;
 
 /* utility to cleanup e.g. after interrpts */
@@ -1033,17 +1910,195 @@ static void wt_cleanup(void *data)
     if(!ld->wasopen) ld->con->close(ld->con);
     R_FreeStringBuffer(ld->buf);
     R_print.digits = ld->savedigits;
+    for(int k = 0; k < ld->nout; k++) free(ld->out[k].data);
+    ld->nout = 0;
+}
+
+static void wt_put(wt_buf *b, const char *s, size_t n)
+{
+    if(b->len + n > b->size) {
+	size_t size = b->size ? b->size : 65536;
+	char *tmp;
+	while(size < b->len + n) size *= 2;
+	tmp = realloc(b->data, size);
+	if(!tmp) {
+	    b->err = 1;
+	    return;
+	}
+	b->data = tmp;
+	b->size = size;
+    }
+    memcpy(b->data + b->len, s, n);
+    b->len += n;
+}
+
+static void wt_int(wt_buf *b, int x)
+{
+    char digits[12], *p = digits + sizeof(digits);
+    unsigned int u = x < 0 ? -(unsigned int) x : (unsigned int) x;
+
+    do { *--p = (char) ('0' + u % 10); u /= 10; } while(u);
+    if(x < 0) *--p = '-';
+    wt_put(b, p, digits + sizeof(digits) - p);
+}
+
+/* as EncodeReal0(x, w, d, e, dec) with the w, d, e of formatReal() on x
+   alone, so without padding */
+static void wt_real(wt_buf *b, double x, char dec)
+{
+    char buff[WT_NB];
+    int w, d, e;
+
+    if(x == 0.0) x = 0.0; /* drop the sign of -0 */
+    if(!R_FINITE(x)) {
+	if(x > 0) wt_put(b, "Inf", 3); else wt_put(b, "-Inf", 4);
+	return;
+    }
+    formatReal(&x, 1, &w, &d, &e, 0);
+    if(w > WT_NB - 1) w = WT_NB - 1;
+    if(e) snprintf(buff, WT_NB, d ? "%#*.*e" : "%*.*e", w, d, x);
+    else if(d == 0 && fabs(x) < 1e15 && x == floor(x)) {
+	/* whole numbers, as encodeWholeReal() */
+	long long v = (long long) x;
+	unsigned long long u = v < 0 ? -(unsigned long long) v : v;
+	char *p = buff + sizeof(buff);
+	do { *--p = (char) ('0' + u % 10); u /= 10; } while(u);
+	if(v < 0) *--p = '-';
+	wt_put(b, p, buff + sizeof(buff) - p);
+	return;
+    } else snprintf(buff, WT_NB, "%*.*f", w, d, x);
+    if(dec != '.') {
+	char *p = strchr(buff, '.');
+	if(p) *p = dec;
+    }
+    wt_put(b, buff, strlen(buff));
+}
+
+/* as EncodeElement2() for a string */
+static void wt_string(wt_buf *b, const char *p, Rboolean quote,
+		      int qmethod)
+{
+    const char *q;
+
+    if(!quote) {
+	wt_put(b, p, strlen(p));
+	return;
+    }
+    wt_put(b, "\"", 1);
+    while((q = strchr(p, '"'))) {
+	wt_put(b, p, q - p);
+	wt_put(b, qmethod ? "\\\"" : "\"\"", 2);
+	p = q + 1;
+    }
+    wt_put(b, p, strlen(p));
+    wt_put(b, "\"", 1);
+}
+
+/* can the strings be used without translation? */
+static Rboolean wt_native(SEXP x, R_xlen_t off, R_xlen_t n)
+{
+    for(R_xlen_t i = off; i < off + n; i++) {
+	SEXP c = STRING_ELT(x, i);
+	if(IS_ASCII(c) || c == NA_STRING) continue;
+	if(IS_UTF8(c) ? !utf8locale : (IS_LATIN1(c) || IS_BYTES(c)))
+	    return FALSE;
+    }
+    return TRUE;
+}
+
+static void wt_cell(wt_buf *b, wt_col *c, R_xlen_t i, wt_opts *o)
+{
+    SEXP x = c->x;
+    R_xlen_t k = c->off + i;
+    int code;
+
+    switch(c->kind) {
+    case WT_LGL:
+	if(LOGICAL(x)[k] == NA_LOGICAL) wt_put(b, o->na, o->nna);
+	else if(LOGICAL(x)[k]) wt_put(b, "TRUE", 4);
+	else wt_put(b, "FALSE", 5);
+	break;
+    case WT_INT:
+	if(INTEGER(x)[k] == NA_INTEGER) wt_put(b, o->na, o->nna);
+	else wt_int(b, INTEGER(x)[k]);
+	break;
+    case WT_REAL:
+	if(ISNAN(REAL(x)[k])) wt_put(b, o->na, o->nna);
+	else wt_real(b, REAL(x)[k], o->dec);
+	break;
+    case WT_STR:
+	if(STRING_ELT(x, k) == NA_STRING && !c->rnames)
+	    wt_put(b, o->na, o->nna);
+	else
+	    wt_string(b, o->serial ? translateChar(STRING_ELT(x, k))
+		      : CHAR(STRING_ELT(x, k)), c->quote, o->qmethod);
+	break;
+    case WT_LEVELS:
+	/* We do not assume factors have integer levels,
+	   although they should. */
+	if(TYPEOF(x) == INTSXP) {
+	    if(INTEGER(x)[k] == NA_INTEGER) {
+		wt_put(b, o->na, o->nna);
+		break;
+	    }
+	    code = INTEGER(x)[k] - 1;
+	} else {
+	    if(ISNAN(REAL(x)[k])) {
+		wt_put(b, o->na, o->nna);
+		break;
+	    }
+	    code = (int) (REAL(x)[k] - 1);
+	}
+	if(code < 0 || code >= c->nlev) b->err = 2;
+	else wt_put(b, c->lev[code], c->levlen[code]);
+	break;
+    case WT_OTHER: /* only when serial */
+	if(isna(x, (int) k)) wt_put(b, o->na, o->nna);
+	else {
+	    const char *tmp = EncodeElement2(x, (int) k, c->quote, o->qmethod,
+					     o->strBuf, o->sdec);
+	    wt_put(b, tmp, strlen(tmp));
+	}
+	break;
+    }
+}
+
+/* append rows i0 to i1 - 1 to b */
+static void wt_rows(wt_buf *b, wt_col *cols, int ncol, int first,
+		    R_xlen_t i0, R_xlen_t i1, wt_opts *o)
+{
+    for(R_xlen_t i = i0; i < i1 && !b->err; i++) {
+	for(int j = 0; j < ncol; j++) {
+	    if(j > first) wt_put(b, o->sep, o->nsep);
+	    wt_cell(b, cols + j, i, o);
+	    if(j == 0 && first == 1) wt_put(b, o->sep, o->nsep);
+	}
+	wt_put(b, o->eol, o->neol);
+    }
+}
+
+static void wt_flush(Rconnection con, wt_buf *b)
+{
+    for(size_t pos = 0; pos < b->len; ) {
+	size_t n = b->len - pos;
+	if(n > 1073741824) n = 1073741824;
+	Rconn_printf(con, "%.*s", (int) n, b->data + pos);
+	pos += n;
+    }
+    b->len = 0;
 }
 
 SEXP writetable(SEXP call, SEXP op, SEXP args, SEXP env)
 {
     SEXP x, sep, rnames, eol, na, dec, quote, xj;
-    Rboolean wasopen, quote_rn = FALSE, *quote_col;
+    Rboolean wasopen, quote_rn = FALSE, *quote_col, parallel = TRUE;
     Rconnection con;
-    const char *csep, *ceol, *cna, *sdec, *tmp = NULL /* -Wall */;
-    SEXP *levels;
+    const char *csep, *ceol, *cna, *sdec;
     R_StringBuffer strBuf = {NULL, 0, MAXELTSIZE};
     wt_info wi;
+    wt_opts o;
+    wt_col *cols;
+    int ncol, first, nthreads = 1;
     RCNTXT cntxt;
 
     args = CDR(args);
@@ -1098,61 +2153,67 @@ SEXP writetable(SEXP call, SEXP op, SEXP args, SEXP env)
     wi.con = con;
     wi.wasopen = wasopen;
     wi.buf = &strBuf;
+    wi.nout = 0;
     begincontext(&cntxt, CTXT_CCODE, call, R_BaseEnv, R_BaseEnv,
 		 R_NilValue, R_NilValue);
     cntxt.cend = &wt_cleanup;
     cntxt.cenddata = &wi;
 
-    if(isVectorList(x)) { /* A data frame */
+    /* the row names are column 0 if present */
+    first = !isNull(rnames);
+    ncol = nc + first;
+    cols = (wt_col *) R_alloc(ncol, sizeof(wt_col));
+    if(first) {
+	cols[0].kind = WT_STR;
+	cols[0].x = rnames;
+	cols[0].off = 0;
+	cols[0].quote = quote_rn;
+	cols[0].rnames = TRUE;
+	parallel = wt_native(rnames, 0, nr);
+    }
 
-	/* handle factors internally, check integrity */
-	levels = (SEXP *) R_alloc(nc, sizeof(SEXP));
+    if(isVectorList(x)) { /* A data frame */
 	for(int j = 0; j < nc; j++) {
+	    wt_col *c = cols + first + j;
 	    xj = VECTOR_ELT(x, j);
 	    if(LENGTH(xj) != nr)
 		error(_("corrupt data frame -- length of column %d does not not match nrows"),
 		      j+1);
+	    c->x = xj;
+	    c->off = 0;
+	    c->quote = quote_col[j];
+	    c->rnames = FALSE;
 	    if(inherits(xj, "factor")) {
-		levels[j] = getAttrib(xj, R_LevelsSymbol);
-	    } else levels[j] = R_NilValue;
-	}
-
-	for(int i = 0; i < nr; i++) {
-	    if(i % 1000 == 999) R_CheckUserInterrupt();
-	    if(!isNull(rnames))
-		Rconn_printf(con, "%s%s",
-			     EncodeElement2(rnames, i, quote_rn, qmethod,
-					    &strBuf, sdec), csep);
-	    for(int j = 0; j < nc; j++) {
-		xj = VECTOR_ELT(x, j);
-		if(j > 0) Rconn_printf(con, "%s", csep);
-		if(isna(xj, i)) tmp = cna;
-		else {
-		    if(!isNull(levels[j])) {
-			/* We do not assume factors have integer levels,
-			   although they should. */
-			if(TYPEOF(xj) == INTSXP)
-			    tmp = EncodeElement2(levels[j], INTEGER(xj)[i] - 1,
-						 quote_col[j], qmethod,
-						 &strBuf, sdec);
-			else if(TYPEOF(xj) == REALSXP)
-			    tmp = EncodeElement2(levels[j],
-						 (int) (REAL(xj)[i] - 1),
-						 quote_col[j], qmethod,
-						 &strBuf, sdec);
-			else
-			    error(_("column %s claims to be a factor but does not have numeric codes"),
-				  j+1);
-		    } else {
-			tmp = EncodeElement2(xj, i, quote_col[j], qmethod,
-					     &strBuf, sdec);
-		    }
+		/* handle factors internally by encoding the levels once */
+		SEXP lev = getAttrib(xj, R_LevelsSymbol);
+		if(TYPEOF(xj) != INTSXP && TYPEOF(xj) != REALSXP)
+		    error(_("column %s claims to be a factor but does not have numeric codes"),
+			  j+1);
+		c->kind = WT_LEVELS;
+		c->nlev = length(lev);
+		c->lev = (const char **) R_alloc(c->nlev, sizeof(char *));
+		c->levlen = (int *) R_alloc(c->nlev, sizeof(int));
+		for(int k = 0; k < c->nlev; k++) {
+		    const char *tmp = EncodeElement2(lev, k, c->quote, qmethod,
+						     &strBuf, sdec);
+		    char *p = R_alloc(strlen(tmp) + 1, sizeof(char));
+		    strcpy(p, tmp);
+		    c->lev[k] = p;
+		    c->levlen[k] = (int) strlen(p);
+		}
+	    } else {
+		switch(TYPEOF(xj)) {
+		case LGLSXP: c->kind = WT_LGL; break;
+		case INTSXP: c->kind = WT_INT; break;
+		case REALSXP: c->kind = WT_REAL; break;
+		case STRSXP:
+		    c->kind = WT_STR;
+		    if(parallel) parallel = wt_native(xj, 0, nr);
+		    break;
+		default: c->kind = WT_OTHER; parallel = FALSE;
 		}
-		Rconn_printf(con, "%s", tmp);
 	    }
-	    Rconn_printf(con, "%s", ceol);
 	}
-
     } else { /* A matrix */
 
 	if(!isVectorAtomic(x))
@@ -1161,24 +2222,71 @@ SEXP writetable(SEXP call, SEXP op, SEXP args, SEXP env)
 	if(XLENGTH(x) != (R_len_t)nr * nc)
 	    error(_("corrupt matrix -- dims not not match length"));
 
-	for(int i = 0; i < nr; i++) {
-	    if(i % 1000 == 999) R_CheckUserInterrupt();
-	    if(!isNull(rnames))
-		Rconn_printf(con, "%s%s",
-			     EncodeElement2(rnames, i, quote_rn, qmethod,
-					    &strBuf, sdec), csep);
-	    for(int j = 0; j < nc; j++) {
-		if(j > 0) Rconn_printf(con, "%s", csep);
-		if(isna(x, i + j*nr)) tmp = cna;
-		else {
-		    tmp = EncodeElement2(x, i + j*nr, quote_col[j], qmethod,
-					&strBuf, sdec);
-		}
-		Rconn_printf(con, "%s", tmp);
+	for(int j = 0; j < nc; j++) {
+	    wt_col *c = cols + first + j;
+	    c->x = x;
+	    c->off = (R_xlen_t) j * nr;
+	    c->quote = quote_col[j];
+	    c->rnames = FALSE;
+	    switch(TYPEOF(x)) {
+	    case LGLSXP: c->kind = WT_LGL; break;
+	    case INTSXP: c->kind = WT_INT; break;
+	    case REALSXP: c->kind = WT_REAL; break;
+	    case STRSXP:
+		c->kind = WT_STR;
+		if(parallel) parallel = wt_native(x, c->off, nr);
+		break;
+	    default: c->kind = WT_OTHER; parallel = FALSE;
 	    }
-	    Rconn_printf(con, "%s", ceol);
 	}
+    }
 
+#ifdef _OPENMP
+    if(parallel && R_num_math_threads > 1 &&
+       (double) nr * ncol >= WT_THREADS_MIN)
+	nthreads = R_num_math_threads;
+#endif
+    o.sep = csep; o.nsep = strlen(csep);
+    o.eol = ceol; o.neol = strlen(ceol);
+    o.na = cna; o.nna = strlen(cna);
+    o.dec = sdec[0];
+    o.sdec = sdec;
+    o.qmethod = qmethod;
+    o.serial = nthreads == 1;
+    o.strBuf = &strBuf;
+    wi.out = (wt_buf *) R_alloc(nthreads, sizeof(wt_buf));
+    for(int k = 0; k < nthreads; k++) {
+	wi.out[k].data = NULL;
+	wi.out[k].len = wi.out[k].size = 0;
+	wi.out[k].err = 0;
+    }
+    wi.nout = nthreads;
+
+    for(R_xlen_t i0 = 0; i0 < nr; i0 += (R_xlen_t) nthreads * WT_BLOCK_ROWS) {
+	wt_buf *out = wi.out;
+	R_CheckUserInterrupt();
+	if(nthreads == 1) {
+	    const void *vmax = vmaxget();
+	    wt_rows(out, cols, ncol, first, i0,
+		    i0 + WT_BLOCK_ROWS < nr ? i0 + WT_BLOCK_ROWS : nr, &o);
+	    vmaxset(vmax);
+	} else {
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(nthreads) default(none) \
+    firstprivate(out, cols, ncol, first, i0, nr, nthreads) shared(o)
+#endif
+	    for(int k = 0; k < nthreads; k++) {
+		R_xlen_t s = i0 + (R_xlen_t) k * WT_BLOCK_ROWS,
+		    e = s + WT_BLOCK_ROWS < nr ? s + WT_BLOCK_ROWS : nr;
+		if(s < e) wt_rows(out + k, cols, ncol, first, s, e, &o);
+	    }
+	}
+	for(int k = 0; k < nthreads; k++) {
+	    if(out[k].err == 1)
+		error(_("cannot allocate buffer in write.table"));
+	    if(out[k].err == 2) error(_("index out of range"));
+	    wt_flush(con, out + k);
+	}
     }
     endcontext(&cntxt);
     wt_cleanup(&wi);
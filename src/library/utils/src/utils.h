@@ -33,6 +33,7 @@ SEXP countfields(SEXP args);
 SEXP flushconsole(void);
 SEXP menu(SEXP args);
 SEXP readtablehead(SEXP args);
+SEXP readtablefast(SEXP args);
 SEXP typeconvert(SEXP call, SEXP op, SEXP args, SEXP env);
 SEXP writetable(SEXP call, SEXP op, SEXP args, SEXP env);
 
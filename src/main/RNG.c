@@ -1,7 +1,7 @@
 /*
  *  R : A Computer Language for Statistical Data Analysis
  *  Copyright (C) 1995, 1996  Robert Gentleman and Ross Ihaka
- *  Copyright (C) 1997--2015  The R Core Team
+ *  Copyright (C) 1997--2017  The R Core Team
  *
  *  This program is free software; you can redistribute it and/or modify
  *  it under the terms of the GNU General Public License as published by
@@ -178,6 +178,70 @@ double unif_rand(void)
     }
 }
 
+/* A^(2^76) mod m for the two components of L'Ecuyer-CMRG, as in
+   ../library/parallel/src/rngstream.c */
+static const uint_least64_t A1p76[3][3] = {
+    {   82758667, 1871391091, 4127413238 },
+    { 3672831523,   69195019, 1871391091 },
+    { 3672091415, 3528743235,   69195019 }
+};
+
+static const uint_least64_t A2p76[3][3] = {
+    { 1511326704, 3759209742, 1610795712 },
+    { 4292754251, 1511326704, 3889917532 },
+    { 3859662829, 4292754251, 3708466080 }
+};
+
+static void MatVecModM(const uint_least64_t A[3][3], uint_least64_t *s,
+		       uint_least64_t m)
+{
+    uint_least64_t x[3];
+    for (int i = 0; i < 3; i++) {
+	x[i] = 0;
+	for (int j = 0; j < 3; j++)
+	    x[i] = (x[i] + (A[i][j] * s[j]) % m) % m;
+    }
+    for (int i = 0; i < 3; i++) s[i] = x[i];
+}
+
+/* For generating in parallel with L'Ecuyer-CMRG: the seeds of 'n'
+   streams of 2^76 values starting at the current seed are stored in
+   'seeds' (6 per stream), and the current seed is advanced to the
+   start of the next stream.  Returns FALSE, leaving the seed alone, if
+   another generator is in use or, if 'normal', if normal.kind is not
+   "Inversion", the only one with no state of its own. */
+Rboolean R_RNG_substreams(R_xlen_t n, int *seeds, Rboolean normal)
+{
+    uint_least64_t s[6];
+
+    if (RNG_kind != LECUYER_CMRG || (normal && N01_kind != INVERSION))
+	return FALSE;
+    for (int i = 0; i < 6; i++) s[i] = (unsigned int) II(i);
+    for (R_xlen_t k = 0; k < n; k++) {
+	for (int i = 0; i < 6; i++) seeds[6*k + i] = (int) s[i];
+	MatVecModM(A1p76, s, m1);
+	MatVecModM(A2p76, s + 3, m2);
+    }
+    for (int i = 0; i < 6; i++) II(i) = (Int32) s[i];
+    return TRUE;
+}
+
+static void MT_genrand_n(double *x, int n);
+
+/* n uniforms into x: the values of n calls of unif_rand(), but the
+   generator is chosen once and Mersenne-Twister works through its
+   state vector a block at a time. */
+void unif_rand_n(double *x, int n)
+{
+    switch(RNG_kind) {
+    case MERSENNE_TWISTER:
+	MT_genrand_n(x, n);
+	break;
+    default:
+	for (int i = 0; i < n; i++) x[i] = unif_rand();
+    }
+}
+
 /* we must mask global variable here, as I1-I3 hide RNG_kind
    and we want the argument */
 static void FixupSeeds(RNGtype RNG_kind, int initial)
@@ -626,44 +690,71 @@ MT_sgenrand(Int32 seed)
     (seed_array[0]&UPPER_MASK), seed_array[1], ..., seed_array[N-1]
    can take any values except all zeros.                             */
 
-static double MT_genrand(void)
+/* generate N words at one time */
+static void MT_refill(void)
 {
     Int32 y;
     static Int32 mag01[2]={0x0, MATRIX_A};
     /* mag01[x] = x * MATRIX_A  for x=0,1 */
+    int kk;
 
-    mti = dummy[0];
-
-    if (mti >= N) { /* generate N words at one time */
-	int kk;
+    if (mti == N+1)   /* if sgenrand() has not been called, */
+	MT_sgenrand(4357); /* a default initial seed is used   */
 
-	if (mti == N+1)   /* if sgenrand() has not been called, */
-	    MT_sgenrand(4357); /* a default initial seed is used   */
-
-	for (kk = 0; kk < N - M; kk++) {
-	    y = (mt[kk] & UPPER_MASK) | (mt[kk+1] & LOWER_MASK);
-	    mt[kk] = mt[kk+M] ^ (y >> 1) ^ mag01[y & 0x1];
-	}
-	for (; kk < N - 1; kk++) {
-	    y = (mt[kk] & UPPER_MASK) | (mt[kk+1] & LOWER_MASK);
-	    mt[kk] = mt[kk+(M-N)] ^ (y >> 1) ^ mag01[y & 0x1];
-	}
-	y = (mt[N-1] & UPPER_MASK) | (mt[0] & LOWER_MASK);
-	mt[N-1] = mt[M-1] ^ (y >> 1) ^ mag01[y & 0x1];
-
-	mti = 0;
+    for (kk = 0; kk < N - M; kk++) {
+	y = (mt[kk] & UPPER_MASK) | (mt[kk+1] & LOWER_MASK);
+	mt[kk] = mt[kk+M] ^ (y >> 1) ^ mag01[y & 0x1];
+    }
+    for (; kk < N - 1; kk++) {
+	y = (mt[kk] & UPPER_MASK) | (mt[kk+1] & LOWER_MASK);
+	mt[kk] = mt[kk+(M-N)] ^ (y >> 1) ^ mag01[y & 0x1];
     }
+    y = (mt[N-1] & UPPER_MASK) | (mt[0] & LOWER_MASK);
+    mt[N-1] = mt[M-1] ^ (y >> 1) ^ mag01[y & 0x1];
+
+    mti = 0;
+}
 
-    y = mt[mti++];
+static R_INLINE double MT_temper(Int32 y)
+{
     y ^= TEMPERING_SHIFT_U(y);
     y ^= TEMPERING_SHIFT_S(y) & TEMPERING_MASK_B;
     y ^= TEMPERING_SHIFT_T(y) & TEMPERING_MASK_C;
     y ^= TEMPERING_SHIFT_L(y);
-    dummy[0] = mti;
 
     return ( (double)y * 2.3283064365386963e-10 ); /* reals: [0,1)-interval */
 }
 
+static double MT_genrand(void)
+{
+    double value;
+
+    mti = dummy[0];
+    if (mti >= N) MT_refill();
+    value = MT_temper(mt[mti++]);
+    dummy[0] = mti;
+
+    return value;
+}
+
+/* n values of Mersenne-Twister, as by n calls of fixup(MT_genrand()),
+   a block of the state vector at a time */
+static void MT_genrand_n(double *x, int n)
+{
+    mti = dummy[0];
+    for (int i = 0; i < n; ) {
+	if (mti >= N) MT_refill();
+	int m = (n - i < N - mti) ? n - i : N - mti;
+	for (int j = 0; j < m; j++)
+	    x[i + j] = MT_temper(mt[mti + j]);
+	for (int j = 0; j < m; j++)
+	    x[i + j] = fixup(x[i + j]);
+	mti += m;
+	i += m;
+    }
+    dummy[0] = mti;
+}
+
 /*
    The following code was taken from earlier versions of
    http://www-cs-faculty.stanford.edu/~knuth/programs/rng.c-old
@@ -1,7 +1,7 @@
 /*
  *  R : A Computer Language for Statistical Data Analysis
  *  Copyright (C) 1995-1996 Robert Gentleman and Ross Ihaka
- *  Copyright (C) 1997-2015 The R Core Team
+ *  Copyright (C) 1997-2017 The R Core Team
  *
  *  This program is free software; you can redistribute it and/or modify
  *  it under the terms of the GNU General Public License as published by
@@ -75,9 +75,12 @@
  *  from ../appl/ROUTINES using Perl/sed).
  *
  *
- *  If speed is ever an issue in the lookup of registered symbols, we can
- *  store the registered routines in a hashtable or binary tree as they
- *  are being registered.
+ *  The results of looking up a name in a DLL, registered or by dlsym()
+ *  and including failures, are kept in a hash table (SymCache below),
+ *  so the searches are done once rather than on every call to .Call()
+ *  and friends with a character string as .NAME.  The table is
+ *  emptied whenever a DLL is added or removed or its routines are
+ *  registered.
  */
 
 #ifdef HAVE_CONFIG_H
@@ -145,6 +148,51 @@ static SEXP createRSymbolObject(SEXP sname, DL_FUNC f,
 
 static DllInfo *R_RegisterDLL(HINSTANCE handle, const char *path);
 
+/* The cache of R_dlsym() results, keyed by the DLL, the name and the
+   type of symbol asked for: open addressing with linear probing.
+   Entries refer to elements of LoadedDLL and to their registered
+   symbols, so the whole table is flushed when those change. */
+#define SYM_CACHE_SIZE 1024 /* a power of 2 */
+#define SYM_CACHE_MAX (3 * SYM_CACHE_SIZE / 4)
+
+typedef struct {
+    DllInfo *info;		/* NULL for an empty slot */
+    char *name;
+    NativeSymbolType type;	/* asked for */
+    DL_FUNC fun;		/* NULL if not found */
+    R_RegisteredNativeSymbol symbol; /* symbol.c is NULL if not registered */
+} SymCacheEntry;
+
+static SymCacheEntry SymCache[SYM_CACHE_SIZE];
+static int nSymCache = 0;
+
+static void flushSymCache(void)
+{
+    if (nSymCache == 0) return;
+    for (int i = 0; i < SYM_CACHE_SIZE; i++)
+	if (SymCache[i].info) {
+	    free(SymCache[i].name);
+	    SymCache[i].info = NULL;
+	}
+    nSymCache = 0;
+}
+
+/* Returns the entry for (info, name, type), or the empty slot it
+   would go in */
+static SymCacheEntry *
+findSymCache(DllInfo *info, const char *name, NativeSymbolType type)
+{
+    size_t h = (((size_t) info) >> 4) * 31 + (size_t) type;
+    for (const char *p = name; *p; p++)
+	h = h * 31 + (unsigned char) *p;
+    for (h &= SYM_CACHE_SIZE - 1; ; h = (h + 1) & (SYM_CACHE_SIZE - 1)) {
+	SymCacheEntry *e = SymCache + h;
+	if (e->info == NULL ||
+	    (e->info == info && e->type == type && !strcmp(e->name, name)))
+	    return e;
+    }
+}
+
 attribute_hidden OSDynSymbol Rf_osDynSymbol;
 attribute_hidden OSDynSymbol *R_osDynSymbol = &Rf_osDynSymbol;
 
@@ -181,6 +229,7 @@ Rboolean R_useDynamicSymbols(DllInfo *info, Rboolean value)
     Rboolean old;
     old = info->useDynamicLookup;
     info->useDynamicLookup = value;
+    if (old != value) flushSymCache();
     return old;
 }
 
@@ -254,6 +303,7 @@ R_registerRoutines(DllInfo *info, const R_CMethodDef * const croutines,
     */
     info->useDynamicLookup = (info->handle) ? TRUE : FALSE;
     info->forceSymbols = FALSE;
+    flushSymCache();
 
     if(croutines) {
 	for(num = 0; croutines[num].name != NULL; num++) {;}
@@ -463,6 +513,7 @@ static int DeleteDLL(const char *path)
     }
     return 0;
 found:
+    flushSymCache();
 #ifdef CACHE_DLL_SYM
     if(R_osDynSymbol->deleteCachedSymbols)
 	R_osDynSymbol->deleteCachedSymbols(&LoadedDLL[loc]);
@@ -628,6 +679,7 @@ addDLL(char *dpath, char *DLLname, HINSTANCE handle)
     }
 
     strcpy(name, DLLname);
+    flushSymCache();
     LoadedDLL[CountDLL].path = dpath;
     LoadedDLL[CountDLL].name = name;
     LoadedDLL[CountDLL].handle = handle;
@@ -756,9 +808,9 @@ R_getDLLRegisteredSymbol(DllInfo *info, const char *name,
     return((DL_FUNC) NULL);
 }
 
-DL_FUNC attribute_hidden
-R_dlsym(DllInfo *info, char const *name,
-	R_RegisteredNativeSymbol *symbol)
+static DL_FUNC
+R_dlsym0(DllInfo *info, char const *name,
+	 R_RegisteredNativeSymbol *symbol)
 {
     size_t len = strlen(name) + 4;
     char buf[len]; /* up to 3 additional underscores */
@@ -799,6 +851,37 @@ R_dlsym(DllInfo *info, char const *name,
     return f;
 }
 
+DL_FUNC attribute_hidden
+R_dlsym(DllInfo *info, char const *name,
+	R_RegisteredNativeSymbol *symbol)
+{
+    SymCacheEntry *e;
+    DL_FUNC f;
+
+    if (!symbol) return R_dlsym0(info, name, symbol);
+
+    e = findSymCache(info, name, symbol->type);
+    if (e->info == NULL) {
+	R_RegisteredNativeSymbol sym = {symbol->type, {NULL}, NULL};
+	f = R_dlsym0(info, name, &sym);
+	if (nSymCache >= SYM_CACHE_MAX) {
+	    flushSymCache();
+	    e = findSymCache(info, name, symbol->type);
+	}
+	if ((e->name = strdup(name)) == NULL) {
+	    if (sym.symbol.c) *symbol = sym;
+	    return f;
+	}
+	e->info = info;
+	e->type = symbol->type;
+	e->fun = f;
+	e->symbol = sym;
+	nSymCache++;
+    }
+    if (e->symbol.symbol.c) *symbol = e->symbol;
+    return e->fun;
+}
+
 /* R_FindSymbol checks whether one of the objects that have been
    loaded contains the symbol name and returns a pointer to that
    symbol upon success.
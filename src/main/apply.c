@@ -24,6 +24,88 @@
 #include <Defn.h>
 #include <Internal.h>
 
+/* lapply and vapply compute FUN(X[[i]]) directly, without calling
+   FUN, when X is a list of plain double vectors (without attributes)
+   and FUN is one of the base functions sum, prod, mean (with no
+   methods for doubles visible), mean.default or length, called with
+   no further arguments.  The answers are those FUN would give.  As
+   these computations neither allocate nor signal conditions, the
+   elements are taken on R_num_math_threads threads when they have
+   R_APPLY_THREADS_MIN elements or more in all. */
+#define R_APPLY_THREADS_MIN 100000
+#define APPLY_CALL -1
+#define APPLY_LENGTH -2
+
+static Rboolean isBaseMean(SEXP f, SEXP rho)
+{
+    SEXP def = findFun(install("mean.default"), R_BaseNamespace);
+    if (f == def) return TRUE;
+    if (f != findFun(install("mean"), R_BaseNamespace)) return FALSE;
+    return
+	R_LookupMethod(install("mean.double"), rho, rho,
+		       R_BaseNamespace) == R_UnboundValue &&
+	R_LookupMethod(install("mean.numeric"), rho, rho,
+		       R_BaseNamespace) == R_UnboundValue &&
+	R_LookupMethod(install("mean.default"), rho, rho,
+		       R_BaseNamespace) == def;
+}
+
+/* The PRIMVAL of do_summary for sum, mean or prod, APPLY_LENGTH for
+   length, or APPLY_CALL if FUN has to be called */
+static int directFun(SEXP XX, SEXP FUN, SEXP rho)
+{
+    if (TYPEOF(XX) != VECSXP || XLENGTH(XX) == 0) return APPLY_CALL;
+    SEXP dots = findVar(R_DotsSymbol, rho);
+    if (dots != R_MissingArg && dots != R_NilValue) return APPLY_CALL;
+
+    SEXP f = PROTECT(eval(FUN, rho));
+    int op = APPLY_CALL;
+    if (TYPEOF(f) == BUILTINSXP && PRIMFUN(f) == do_summary &&
+	(PRIMVAL(f) == 0 || PRIMVAL(f) == 4))
+	op = PRIMVAL(f);
+    else if (TYPEOF(f) == BUILTINSXP && PRIMFUN(f) == do_length)
+	op = APPLY_LENGTH;
+    else if (TYPEOF(f) == CLOSXP && isBaseMean(f, rho))
+	op = 1;
+    UNPROTECT(1);
+
+    for (R_xlen_t i = 0; op != APPLY_CALL && i < XLENGTH(XX); i++) {
+	SEXP x = VECTOR_ELT(XX, i);
+	if (op == APPLY_LENGTH) {
+	    if (!(isVectorAtomic(x) || isVectorList(x)) || OBJECT(x) ||
+		XLENGTH(x) > INT_MAX)
+		op = APPLY_CALL;
+	} else if (TYPEOF(x) != REALSXP || ATTRIB(x) != R_NilValue)
+	    op = APPLY_CALL;
+    }
+    return op;
+}
+
+/* out[i] <- FUN(XX[[i]]) for the op from directFun */
+static void directApply(int op, SEXP XX, double *out)
+{
+    R_xlen_t n = XLENGTH(XX), total = 0;
+    if (op == APPLY_LENGTH) {
+	for (R_xlen_t i = 0; i < n; i++)
+	    out[i] = (double) XLENGTH(VECTOR_ELT(XX, i));
+	return;
+    }
+    double **px = (double **) R_alloc(n, sizeof(double *));
+    R_xlen_t *nx = (R_xlen_t *) R_alloc(n, sizeof(R_xlen_t));
+    for (R_xlen_t i = 0; i < n; i++) {
+	px[i] = REAL(VECTOR_ELT(XX, i));
+	total += nx[i] = XLENGTH(VECTOR_ELT(XX, i));
+    }
+#ifdef _OPENMP
+    int nthreads = (n > 1 && total >= R_APPLY_THREADS_MIN &&
+		    R_num_math_threads > 1) ? R_num_math_threads : 1;
+#pragma omp parallel for num_threads(nthreads) schedule(dynamic) \
+    default(none) firstprivate(px, nx, n, op, out)
+#endif
+    for (R_xlen_t i = 0; i < n; i++)
+	out[i] = R_rsummary(px[i], nx[i], op);
+}
+
 /* .Internal(lapply(X, FUN)) */
 
 /* This is a special .Internal, so has unevaluated arguments.  It is
@@ -47,6 +129,19 @@ SEXP attribute_hidden do_lapply(SEXP call, SEXP op, SEXP args, SEXP rho)
     SEXP names = getAttrib(XX, R_NamesSymbol);
     if(!isNull(names)) setAttrib(ans, R_NamesSymbol, names);
 
+    int dop = directFun(XX, FUN, rho);
+    if (dop != APPLY_CALL) {
+	const void *vmax = vmaxget();
+	double *val = (double *) R_alloc(n, sizeof(double));
+	directApply(dop, XX, val);
+	for(R_xlen_t i = 0; i < n; i++)
+	    SET_VECTOR_ELT(ans, i, dop == APPLY_LENGTH ?
+			   ScalarInteger((int) val[i]) : ScalarReal(val[i]));
+	vmaxset(vmax);
+	UNPROTECT(3);
+	return ans;
+    }
+
     /* Build call: FUN(XX[[<ind>]], ...) */
 
     SEXP ind = PROTECT(allocVector(realIndx ? REALSXP : INTSXP, 1));
@@ -76,6 +171,45 @@ SEXP attribute_hidden do_lapply(SEXP call, SEXP op, SEXP args, SEXP rho)
     return ans;
 }
 
+/* Store a value of FUN of length one in ans[i] if it is atomic and of
+   type 'type' or one promoted to it without loss, as the general code
+   in do_vapply would; FALSE if that code is needed. */
+static R_INLINE Rboolean vapplyStore(SEXP ans, R_xlen_t i, SEXPTYPE type,
+				     SEXP val)
+{
+    if (!isVectorAtomic(val) || XLENGTH(val) != 1) return FALSE;
+    SEXPTYPE valType = TYPEOF(val);
+    switch (type) {
+    case REALSXP:
+	if (valType == REALSXP)
+	    REAL(ans)[i] = REAL(val)[0];
+	else if (valType == INTSXP || valType == LGLSXP) {
+	    int v = INTEGER(val)[0];
+	    REAL(ans)[i] = (v == NA_INTEGER) ? NA_REAL : v;
+	}
+	else return FALSE;
+	return TRUE;
+    case INTSXP:
+	if (valType != INTSXP && valType != LGLSXP) return FALSE;
+	INTEGER(ans)[i] = INTEGER(val)[0];
+	return TRUE;
+    case LGLSXP:
+	if (valType != LGLSXP) return FALSE;
+	LOGICAL(ans)[i] = LOGICAL(val)[0];
+	return TRUE;
+    case RAWSXP:
+	if (valType != RAWSXP) return FALSE;
+	RAW(ans)[i] = RAW(val)[0];
+	return TRUE;
+    case STRSXP:
+	if (valType != STRSXP) return FALSE;
+	SET_STRING_ELT(ans, i, STRING_ELT(val, 0));
+	return TRUE;
+    default:
+	return FALSE;
+    }
+}
+
 /* .Internal(vapply(X, FUN, FUN.VALUE, USE.NAMES)) */
 
 /* This is a special .Internal */
@@ -127,11 +261,24 @@ SEXP attribute_hidden do_vapply(SEXP call, SEXP op, SEXP args, SEXP rho)
 						: R_NamesSymbol),
 			   &index);
     }
+    int dop = APPLY_CALL;
+    if (commonLen == 1 && (commonType == REALSXP || commonType == INTSXP))
+	dop = directFun(XX, FUN, rho);
+    if (dop != APPLY_CALL && (dop == APPLY_LENGTH || commonType == REALSXP)) {
+	const void *vmax = vmaxget();
+	double *val = (double *) R_alloc(n, sizeof(double));
+	directApply(dop, XX, val);
+	for(i = 0; i < n; i++) {
+	    if (commonType == REALSXP) REAL(ans)[i] = val[i];
+	    else INTEGER(ans)[i] = (int) val[i];
+	}
+	vmaxset(vmax);
+    }
     /* The R level code has ensured that XX is a vector.
        If it is atomic we can speed things up slightly by
        using the evaluated version.
     */
-    {
+    else {
 	SEXP ind, tmp;
 	/* Build call: FUN(XX[[<ind>]], ...) */
 
@@ -156,6 +303,11 @@ SEXP attribute_hidden do_vapply(SEXP call, SEXP op, SEXP args, SEXP rho)
 	    if (realIndx) REAL(ind)[0] = (double)(i + 1);
 	    else INTEGER(ind)[0] = (int)(i + 1);
 	    val = R_forceAndCall(R_fcall, 1, rho);
+	    /* The common case of a length-one answer is stored
+	       without duplication or coercion (its names are not
+	       used) */
+	    if (commonLen == 1 && vapplyStore(ans, i, commonType, val))
+		continue;
 	    if (MAYBE_REFERENCED(val))
 		val = lazy_duplicate(val); // Need to duplicate? Copying again anyway
 	    PROTECT_WITH_INDEX(val, &indx);
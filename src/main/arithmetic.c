@@ -362,6 +362,77 @@ static R_INLINE double R_integer_divide(int x, int y)
 	return (double) x / (double) y;
 }
 
+/* Loops over the common cases of operands of equal length or with a
+   scalar operand are written so that the compiler can vectorize them:
+   with OpenMP 4.0 'omp simd' tells it there are no dependencies
+   between iterations (the answer may share storage with an operand,
+   but then only at the same index).  The flag variable named in
+   SIMD_ITERATE_OR_CHECK is or-reduced over all iterations. */
+
+#if defined(_OPENMP) && _OPENMP >= 201307
+# define R_DO_PRAGMA(x) _Pragma(#x)
+# define R_OMP_SIMD R_DO_PRAGMA(omp simd)
+# define R_OMP_SIMD_OR(flag) R_DO_PRAGMA(omp simd reduction(|:flag))
+#else
+# define R_OMP_SIMD
+# define R_OMP_SIMD_OR(flag)
+#endif
+
+#define SIMD_ITERATE_CHECK(ncheck, n, i, loop_body) do {		\
+	for (R_xlen_t __start__ = 0; __start__ < n; __start__ += ncheck) { \
+	    R_xlen_t __end__ = n - __start__ > ncheck ?			\
+		__start__ + ncheck : n;					\
+	    R_OMP_SIMD							\
+	    for (i = __start__; i < __end__; i++) { loop_body }	\
+	    if (__end__ < n) R_CheckUserInterrupt();			\
+	}								\
+    } while (0)
+
+#define SIMD_ITERATE_OR_CHECK(ncheck, n, i, flag, loop_body) do {	\
+	for (R_xlen_t __start__ = 0; __start__ < n; __start__ += ncheck) { \
+	    R_xlen_t __end__ = n - __start__ > ncheck ?			\
+		__start__ + ncheck : n;					\
+	    R_OMP_SIMD_OR(flag)						\
+	    for (i = __start__; i < __end__; i++) { loop_body }	\
+	    if (__end__ < n) R_CheckUserInterrupt();			\
+	}								\
+    } while (0)
+
+/* Branch-free versions of R_integer_plus, R_integer_minus and
+   R_integer_times for these loops.  They set z to the same value, and
+   ovf to non-zero where those would set *pnaflag.  The sums and
+   products are formed in unsigned arithmetic, where wrap-around is
+   defined, and checked afterwards. */
+
+#define INTEGER_PLUS_LANE(z, x, y, ovf) do {				\
+	int __x = (x), __y = (y);					\
+	int __z = (int) ((unsigned int) __x + (unsigned int) __y);	\
+	int __na = (__x == NA_INTEGER) | (__y == NA_INTEGER);		\
+	int __bad = (((__x ^ __z) & (__y ^ __z)) < 0) |			\
+	    (__z == NA_INTEGER);					\
+	ovf |= __bad & !__na;						\
+	z = (__na | __bad) ? NA_INTEGER : __z;				\
+    } while (0)
+
+#define INTEGER_MINUS_LANE(z, x, y, ovf) do {				\
+	int __x = (x), __y = (y);					\
+	int __z = (int) ((unsigned int) __x - (unsigned int) __y);	\
+	int __na = (__x == NA_INTEGER) | (__y == NA_INTEGER);		\
+	int __bad = (((__x ^ __y) & (__x ^ __z)) < 0) |			\
+	    (__z == NA_INTEGER);					\
+	ovf |= __bad & !__na;						\
+	z = (__na | __bad) ? NA_INTEGER : __z;				\
+    } while (0)
+
+#define INTEGER_TIMES_LANE(z, x, y, ovf) do {				\
+	int __x = (x), __y = (y);					\
+	int __z = (int) ((unsigned int) __x * (unsigned int) __y);	\
+	int __na = (__x == NA_INTEGER) | (__y == NA_INTEGER);		\
+	int __bad = !GOODIPROD(__x, __y, __z) | (__z == NA_INTEGER);	\
+	ovf |= __bad & !__na;						\
+	z = (__na | __bad) ? NA_INTEGER : __z;				\
+    } while (0)
+
 static R_INLINE SEXP ScalarValue1(SEXP x)
 {
     if (NO_REFERENCES(x))
@@ -516,6 +587,40 @@ SEXP attribute_hidden do_arith(SEXP call, SEXP op, SEXP args, SEXP env)
     } \
 } while (0)
 
+/* Copy attributes from the longer argument(s) of a binary operation
+   to its result 'ans', with s1's taking precedence over s2's.  'ans'
+   may be the reused space of either argument (see
+   R_allocOrReuseVector); if it is s1 and s2 has attributes, s1's are
+   set aside so that s2's can be copied first. */
+void attribute_hidden R_binaryMostAttrib(SEXP ans, SEXP s1, SEXP s2,
+					 R_xlen_t n)
+{
+    R_xlen_t n1 = XLENGTH(s1), n2 = XLENGTH(s2);
+
+    if (ans == s1 && n == n2 && ATTRIB(s2) != R_NilValue) {
+	/* copyMostAttrib also skips names, dim and dimnames; those are
+	   set by R_binary from what it saved beforehand. */
+	SEXP a1 = PROTECT(ATTRIB(s1));
+	int obj = OBJECT(s1), s4 = IS_S4_OBJECT(s1);
+	SET_ATTRIB(ans, R_NilValue);
+	SET_OBJECT(ans, 0);
+	UNSET_S4_OBJECT(ans);
+	copyMostAttrib(s2, ans);
+	for (SEXP a = a1; a != R_NilValue; a = CDR(a))
+	    if (TAG(a) != R_NamesSymbol && TAG(a) != R_DimSymbol &&
+		TAG(a) != R_DimNamesSymbol)
+		setAttrib(ans, TAG(a), CAR(a));
+	if (obj) SET_OBJECT(ans, 1);
+	if (s4) SET_S4_OBJECT(ans);
+	UNPROTECT(1);
+	return;
+    }
+    if (ans != s2 && n == n2 && ATTRIB(s2) != R_NilValue)
+	copyMostAttrib(s2, ans);
+    if (ans != s1 && n == n1 && ATTRIB(s1) != R_NilValue)
+	copyMostAttrib(s1, ans); /* Done 2nd so s1's attrs overwrite s2's */
+}
+
 SEXP attribute_hidden R_binary(SEXP call, SEXP op, SEXP x, SEXP y)
 {
     SEXP klass, dims, tsp, xnames, ynames, val;
@@ -806,31 +911,59 @@ static SEXP integer_binary(ARITHOP_TYPE code, SEXP s1, SEXP s2, SEXP lcall)
     if (n == 0) return(ans);
     PROTECT(ans);
 
+#define INTEGER_SIMD_LOOPS(LANE) do {				\
+	int *pa = INTEGER(ans), *px = INTEGER(s1), *py = INTEGER(s2);	\
+	int ovf = 0;							\
+	if (n1 == n2)							\
+	    SIMD_ITERATE_OR_CHECK(NINTERRUPT, n, i, ovf,		\
+				  LANE(pa[i], px[i], py[i], ovf););	\
+	else if (n2 == 1) {						\
+	    x2 = py[0];							\
+	    SIMD_ITERATE_OR_CHECK(NINTERRUPT, n, i, ovf,		\
+				  LANE(pa[i], px[i], x2, ovf););	\
+	}								\
+	else {								\
+	    x1 = px[0];							\
+	    SIMD_ITERATE_OR_CHECK(NINTERRUPT, n, i, ovf,		\
+				  LANE(pa[i], x1, py[i], ovf););	\
+	}								\
+	if (ovf) naflag = TRUE;						\
+    } while (0)
+
     switch (code) {
     case PLUSOP:
-	MOD_ITERATE2_CHECK(NINTERRUPT, n, n1, n2, i, i1, i2, {
-		x1 = INTEGER(s1)[i1];
-		x2 = INTEGER(s2)[i2];
-		INTEGER(ans)[i] = R_integer_plus(x1, x2, &naflag);
-	    });
+	if (n1 == n2 || n1 == 1 || n2 == 1)
+	    INTEGER_SIMD_LOOPS(INTEGER_PLUS_LANE);
+	else
+	    MOD_ITERATE2_CHECK(NINTERRUPT, n, n1, n2, i, i1, i2, {
+		    x1 = INTEGER(s1)[i1];
+		    x2 = INTEGER(s2)[i2];
+		    INTEGER(ans)[i] = R_integer_plus(x1, x2, &naflag);
+		});
 	if (naflag)
 	    warningcall(lcall, INTEGER_OVERFLOW_WARNING);
 	break;
     case MINUSOP:
-	MOD_ITERATE2_CHECK(NINTERRUPT, n, n1, n2, i, i1, i2, {
-		x1 = INTEGER(s1)[i1];
-		x2 = INTEGER(s2)[i2];
-		INTEGER(ans)[i] = R_integer_minus(x1, x2, &naflag);
-	    });
+	if (n1 == n2 || n1 == 1 || n2 == 1)
+	    INTEGER_SIMD_LOOPS(INTEGER_MINUS_LANE);
+	else
+	    MOD_ITERATE2_CHECK(NINTERRUPT, n, n1, n2, i, i1, i2, {
+		    x1 = INTEGER(s1)[i1];
+		    x2 = INTEGER(s2)[i2];
+		    INTEGER(ans)[i] = R_integer_minus(x1, x2, &naflag);
+		});
 	if (naflag)
 	    warningcall(lcall, INTEGER_OVERFLOW_WARNING);
 	break;
     case TIMESOP:
-	MOD_ITERATE2_CHECK(NINTERRUPT, n, n1, n2, i, i1, i2, {
-		x1 = INTEGER(s1)[i1];
-		x2 = INTEGER(s2)[i2];
-		INTEGER(ans)[i] = R_integer_times(x1, x2, &naflag);
-	    });
+	if (n1 == n2 || n1 == 1 || n2 == 1)
+	    INTEGER_SIMD_LOOPS(INTEGER_TIMES_LANE);
+	else
+	    MOD_ITERATE2_CHECK(NINTERRUPT, n, n1, n2, i, i1, i2, {
+		    x1 = INTEGER(s1)[i1];
+		    x2 = INTEGER(s2)[i2];
+		    INTEGER(ans)[i] = R_integer_times(x1, x2, &naflag);
+		});
 	if (naflag)
 	    warningcall(lcall, INTEGER_OVERFLOW_WARNING);
 	break;
@@ -885,10 +1018,7 @@ static SEXP integer_binary(ARITHOP_TYPE code, SEXP s1, SEXP s2, SEXP lcall)
 
     /* Copy attributes from longer argument. */
 
-    if (ans != s2 && n == n2 && ATTRIB(s2) != R_NilValue)
-	copyMostAttrib(s2, ans);
-    if (ans != s1 && n == n1 && ATTRIB(s1) != R_NilValue)
-	copyMostAttrib(s1, ans); /* Done 2nd so s1's attrs overwrite s2's */
+    R_binaryMostAttrib(ans, s1, s2, n);
 
     return ans;
 }
@@ -918,14 +1048,14 @@ static SEXP real_binary(ARITHOP_TYPE code, SEXP s1, SEXP s2)
 	    double *dy = REAL(s2);
 	    if (n2 == 1) {
 		double tmp = dy[0];
-		R_ITERATE_CHECK(NINTERRUPT, n, i, da[i] = dx[i] + tmp;);
+		SIMD_ITERATE_CHECK(NINTERRUPT, n, i, da[i] = dx[i] + tmp;);
 	    }
 	    else if (n1 == 1) {
 		double tmp = dx[0];
-		R_ITERATE_CHECK(NINTERRUPT, n, i, da[i] = tmp + dy[i];);
+		SIMD_ITERATE_CHECK(NINTERRUPT, n, i, da[i] = tmp + dy[i];);
 	    }
 	    else if (n1 == n2)
-		R_ITERATE_CHECK(NINTERRUPT, n, i, da[i] = dx[i] + dy[i];);
+		SIMD_ITERATE_CHECK(NINTERRUPT, n, i, da[i] = dx[i] + dy[i];);
 	    else
 		MOD_ITERATE2_CHECK(NINTERRUPT, n, n1, n2, i, i1, i2,
 				  da[i] = dx[i1] + dy[i2];);
@@ -944,14 +1074,14 @@ static SEXP real_binary(ARITHOP_TYPE code, SEXP s1, SEXP s2)
 	    double *dy = REAL(s2);
 	    if (n2 == 1) {
 		double tmp = dy[0];
-		R_ITERATE_CHECK(NINTERRUPT, n, i, da[i] = dx[i] - tmp;);
+		SIMD_ITERATE_CHECK(NINTERRUPT, n, i, da[i] = dx[i] - tmp;);
 	    }
 	    else if (n1 == 1) {
 		double tmp = dx[0];
-		R_ITERATE_CHECK(NINTERRUPT, n, i, da[i] = tmp - dy[i];);
+		SIMD_ITERATE_CHECK(NINTERRUPT, n, i, da[i] = tmp - dy[i];);
 	    }
 	    else if (n1 == n2)
-		R_ITERATE_CHECK(NINTERRUPT, n, i, da[i] = dx[i] - dy[i];);
+		SIMD_ITERATE_CHECK(NINTERRUPT, n, i, da[i] = dx[i] - dy[i];);
 	    else
 		MOD_ITERATE2_CHECK(NINTERRUPT, n, n1, n2, i, i1, i2,
 				  da[i] = dx[i1] - dy[i2];);
@@ -970,14 +1100,14 @@ static SEXP real_binary(ARITHOP_TYPE code, SEXP s1, SEXP s2)
 	    double *dy = REAL(s2);
 	    if (n2 == 1) {
 		double tmp = dy[0];
-		R_ITERATE_CHECK(NINTERRUPT, n, i, da[i] = dx[i] * tmp;);
+		SIMD_ITERATE_CHECK(NINTERRUPT, n, i, da[i] = dx[i] * tmp;);
 	    }
 	    else if (n1 == 1) {
 		double tmp = REAL(s1)[0];
-		R_ITERATE_CHECK(NINTERRUPT, n, i, da[i] = tmp * dy[i];);
+		SIMD_ITERATE_CHECK(NINTERRUPT, n, i, da[i] = tmp * dy[i];);
 	    }
 	    else if (n1 == n2)
-		R_ITERATE_CHECK(NINTERRUPT, n, i, da[i] = dx[i] * dy[i];);
+		SIMD_ITERATE_CHECK(NINTERRUPT, n, i, da[i] = dx[i] * dy[i];);
 	    else
 		MOD_ITERATE2_CHECK(NINTERRUPT, n, n1, n2, i, i1, i2,
 				  da[i] = dx[i1] * dy[i2];);
@@ -996,14 +1126,14 @@ static SEXP real_binary(ARITHOP_TYPE code, SEXP s1, SEXP s2)
 	    double *dy = REAL(s2);
 	    if (n2 == 1) {
 		double tmp = dy[0];
-		R_ITERATE_CHECK(NINTERRUPT, n, i, da[i] = dx[i] / tmp;);
+		SIMD_ITERATE_CHECK(NINTERRUPT, n, i, da[i] = dx[i] / tmp;);
 	    }
 	    else if (n1 == 1) {
 		double tmp = dx[0];
-		R_ITERATE_CHECK(NINTERRUPT, n, i, da[i] = tmp / dy[i];);
+		SIMD_ITERATE_CHECK(NINTERRUPT, n, i, da[i] = tmp / dy[i];);
 	    }
 	    else if (n1 == n2)
-		R_ITERATE_CHECK(NINTERRUPT, n, i, da[i] = dx[i] / dy[i];);
+		SIMD_ITERATE_CHECK(NINTERRUPT, n, i, da[i] = dx[i] / dy[i];);
 	    else
 		MOD_ITERATE2_CHECK(NINTERRUPT, n, n1, n2, i, i1, i2,
 				  da[i] = dx[i1] / dy[i2];);
@@ -1080,10 +1210,7 @@ static SEXP real_binary(ARITHOP_TYPE code, SEXP s1, SEXP s2)
 
     /* Copy attributes from longer argument. */
 
-    if (ans != s2 && n == n2 && ATTRIB(s2) != R_NilValue)
-	copyMostAttrib(s2, ans);
-    if (ans != s1 && n == n1 && ATTRIB(s1) != R_NilValue)
-	copyMostAttrib(s1, ans); /* Done 2nd so s1's attrs overwrite s2's */
+    R_binaryMostAttrib(ans, s1, s2, n);
 
     return ans;
 }
@@ -1091,6 +1218,42 @@ static SEXP real_binary(ARITHOP_TYPE code, SEXP s1, SEXP s2)
 
 /* Mathematical Functions of One Argument */
 
+/* math1() and math2() use R_num_math_threads threads for vectors of
+   at least R_MATH_THREADS_MIN elements, but only for functions which
+   cannot signal warnings or errors (the condition system is not
+   thread-safe): the C library functions and the simple rounding ones
+   from nmath, not the gamma and beta families. */
+
+#define R_MATH_THREADS_MIN 100000
+
+#ifdef _OPENMP
+static int math1_nthreads(R_xlen_t n, double (*f)(double))
+{
+    if (n < R_MATH_THREADS_MIN || R_num_math_threads <= 1)
+	return 1;
+    if (f == floor || f == ceil || f == sqrt || f == sign || f == trunc ||
+	f == exp || f == expm1 || f == log1p || f == R_log ||
+	f == cos || f == sin || f == tan || f == acos || f == asin ||
+	f == atan || f == cosh || f == sinh || f == tanh ||
+	f == acosh || f == asinh || f == atanh)
+	return R_num_math_threads;
+    return 1;
+}
+#endif
+
+#define MATH1_ELT(i) do {						\
+	double x = a[i]; /* in case y == a */				\
+	/* This code assumes that ISNAN(x) implies ISNAN(f(x)), so we	\
+	   only need to check ISNAN(x) if ISNAN(f(x)) is true. */	\
+	y[i] = f(x);							\
+	if (ISNAN(y[i])) {						\
+	    if (ISNAN(x))						\
+		y[i] = x; /* make sure the incoming NaN is preserved */	\
+	    else							\
+		naflag = 1;						\
+	}								\
+    } while (0)
+
 static SEXP math1(SEXP sa, double(*f)(double), SEXP lcall)
 {
     SEXP sy;
@@ -1108,18 +1271,18 @@ static SEXP math1(SEXP sa, double(*f)(double), SEXP lcall)
     a = REAL(sa);
     y = REAL(sy);
     naflag = 0;
-    for (i = 0; i < n; i++) {
-	double x = a[i]; /* in case y == a */
-	/* This code assumes that ISNAN(x) implies ISNAN(f(x)), so we
-	   only need to check ISNAN(x) if ISNAN(f(x)) is true. */
-	y[i] = f(x);
-	if (ISNAN(y[i])) {
-	    if (ISNAN(x))
-		y[i] = x; /* make sure the incoming NaN is preserved */
-	    else
-		naflag = 1;
-	}
+#ifdef _OPENMP
+    int nthreads = math1_nthreads(n, f);
+    if (nthreads > 1) {
+#pragma omp parallel for num_threads(nthreads) default(none) \
+    firstprivate(a, y, f, n) reduction(|:naflag)
+	for (i = 0; i < n; i++)
+	    MATH1_ELT(i);
     }
+    else
+#endif
+    for (i = 0; i < n; i++)
+	MATH1_ELT(i);
     /* These are primitives, so need to use the call */
     if(naflag) warningcall(lcall, R_MSG_NA);
 
@@ -1286,7 +1449,8 @@ static SEXP math2(SEXP sa, SEXP sb, double (*f)(double, double),
     n = (na < nb) ? nb : na;				\
     PROTECT(sa = coerceVector(sa, REALSXP));		\
     PROTECT(sb = coerceVector(sb, REALSXP));		\
-    PROTECT(sy = allocVector(REALSXP, n));		\
+    PROTECT(sy = (n == na && NO_REFERENCES(sa)) ?	\
+	    sa : allocVector(REALSXP, n));		\
     a = REAL(sa);					\
     b = REAL(sb);					\
     y = REAL(sy);					\
@@ -1294,6 +1458,27 @@ static SEXP math2(SEXP sa, SEXP sb, double (*f)(double, double),
 
     SETUP_Math2;
 
+#ifdef _OPENMP
+    int nthreads = 1;
+    if (n >= R_MATH_THREADS_MIN && R_num_math_threads > 1 &&
+	(f == fround || f == fprec || f == atan2 || f == logbase))
+	nthreads = R_num_math_threads;
+    if (nthreads > 1) {
+#pragma omp parallel for num_threads(nthreads) default(none) \
+    private(ai, bi) firstprivate(a, b, y, f, n, na, nb, R_NaReal, R_NaN) \
+    reduction(|:naflag)
+	for (i = 0; i < n; i++) {
+	    ai = a[na == n ? i : i % na];
+	    bi = b[nb == n ? i : i % nb];
+	    if_NA_Math2_set(y[i], ai, bi)
+	    else {
+		y[i] = f(ai, bi);
+		if (ISNAN(y[i])) naflag = 1;
+	    }
+	}
+    }
+    else
+#endif
     MOD_ITERATE2(n, na, nb, i, ia, ib, {
 //	if ((i+1) % NINTERRUPT == 0) R_CheckUserInterrupt();
 	ai = a[ia];
@@ -1307,7 +1492,9 @@ static SEXP math2(SEXP sa, SEXP sb, double (*f)(double, double),
 
 #define FINISH_Math2					\
     if(naflag) warning(R_MSG_NA);			\
-    if (n == na)  SHALLOW_DUPLICATE_ATTRIB(sy, sa);	\
+    if (n == na) {					\
+	if (sy != sa) SHALLOW_DUPLICATE_ATTRIB(sy, sa);	\
+    }							\
     else if (n == nb) SHALLOW_DUPLICATE_ATTRIB(sy, sb);	\
     UNPROTECT(3)
 
@@ -2169,3 +2356,403 @@ CCODE R_get_arith_function(int which)
     default: error("bad arith function index"); return NULL;
     }
 }
+
+
+/* Fused evaluation of vectorized arithmetic.
+
+   With the compiler option fuseArith, the byte code compiler compiles
+   an expression such as a * x + b * y - c, built from base arithmetic
+   and comparison operators and elementary math functions with
+   variables and constants as operands, into
+
+       .Internal(fusedArith(quote(a * x + b * y - c), a, x, b, y, c))
+
+   If the operands are numeric vectors without attributes, all of the
+   same length or of length one, and no step would do integer
+   arithmetic, the whole expression is evaluated in one pass over
+   blocks of FUSED_BLOCK elements and only the result is allocated.
+   Otherwise the operators are applied one at a time, as the byte code
+   would have done.  Either way the operands have been evaluated before
+   any of the operations is done.  The compiler only does this when
+   the operators have their base definitions, and decides what is an
+   operator the same way as fusedParse() below. */
+
+#define FUSED_BLOCK 256
+#define FUSED_MAX_NODES 64
+
+typedef enum {
+    F_LEAF, F_NEG, F_ADD, F_SUB, F_MUL, F_DIV, F_POW,
+    F_EQ, F_NE, F_LT, F_LE, F_GE, F_GT, F_MATH1
+} fop_t;
+
+static const struct {
+    const char *name;
+    fop_t op;
+    int nargs;			/* 0 for either 1 or 2 */
+    double (*f)(double);
+} fusedOps[] = {
+    {"+", F_ADD, 2, NULL}, {"-", F_SUB, 0, NULL}, {"*", F_MUL, 2, NULL},
+    {"/", F_DIV, 2, NULL}, {"^", F_POW, 2, NULL},
+    {"==", F_EQ, 2, NULL}, {"!=", F_NE, 2, NULL}, {"<", F_LT, 2, NULL},
+    {"<=", F_LE, 2, NULL}, {">=", F_GE, 2, NULL}, {">", F_GT, 2, NULL},
+    {"(", F_LEAF, 1, NULL},
+    {"exp", F_MATH1, 1, exp}, {"sqrt", F_MATH1, 1, sqrt},
+    {"log", F_MATH1, 1, R_log}, {"floor", F_MATH1, 1, floor},
+    {"ceiling", F_MATH1, 1, ceil}, {"sign", F_MATH1, 1, sign},
+    {"expm1", F_MATH1, 1, expm1}, {"log1p", F_MATH1, 1, log1p},
+    {"cos", F_MATH1, 1, cos}, {"sin", F_MATH1, 1, sin},
+    {"tan", F_MATH1, 1, tan}, {"acos", F_MATH1, 1, acos},
+    {"asin", F_MATH1, 1, asin}, {"atan", F_MATH1, 1, atan},
+    {"cosh", F_MATH1, 1, cosh}, {"sinh", F_MATH1, 1, sinh},
+    {"tanh", F_MATH1, 1, tanh}, {"acosh", F_MATH1, 1, acosh},
+    {"asinh", F_MATH1, 1, asinh}, {"atanh", F_MATH1, 1, atanh},
+    {NULL, F_LEAF, 0, NULL}
+};
+
+static SEXP fusedOpSyms[sizeof(fusedOps) / sizeof(fusedOps[0])];
+
+typedef struct {
+    fop_t op;
+    int a, b;			/* operand nodes */
+    SEXPTYPE type;		/* of the value */
+    double (*f)(double);
+    SEXP call, value;		/* value for leaves */
+    double *out;
+    int naflag;
+} fnode_t;
+
+typedef struct {
+    int nnodes;
+    SEXP args;			/* the operands not yet used */
+    fnode_t nodes[FUSED_MAX_NODES];
+} fused_t;
+
+/* Add the nodes for 'e' in postorder and return the index of its
+   root, or -1 if there are too many nodes or too few operands. */
+static int fusedParse(fused_t *fx, SEXP e)
+{
+    int a = -1, b = -1, k = -1;
+
+    if (TYPEOF(e) == LANGSXP && TYPEOF(CAR(e)) == SYMSXP) {
+	int nargs = length(CDR(e));
+	for (int i = 0; fusedOps[i].name != NULL; i++)
+	    if (fusedOpSyms[i] == CAR(e)) {
+		if ((fusedOps[i].nargs == 0 ? nargs >= 1 && nargs <= 2 :
+		     nargs == fusedOps[i].nargs) &&
+		    TAG(CDR(e)) == R_NilValue &&
+		    (nargs == 1 || TAG(CDDR(e)) == R_NilValue))
+		    k = i;
+		break;
+	    }
+    }
+    if (k >= 0 && fusedOps[k].op == F_LEAF) /* parentheses */
+	return fusedParse(fx, CADR(e));
+    if (k >= 0) {
+	if ((a = fusedParse(fx, CADR(e))) < 0)
+	    return -1;
+	if (length(CDR(e)) == 2 && (b = fusedParse(fx, CADDR(e))) < 0)
+	    return -1;
+    }
+    if (fx->nnodes == FUSED_MAX_NODES)
+	return -1;
+    fnode_t *nd = fx->nodes + fx->nnodes;
+    memset(nd, 0, sizeof(fnode_t));
+    nd->call = e;
+    nd->a = a;
+    nd->b = b;
+    if (k < 0) {
+	if (fx->args == R_NilValue)
+	    return -1;
+	nd->op = F_LEAF;
+	nd->value = CAR(fx->args);
+	fx->args = CDR(fx->args);
+    }
+    else {
+	nd->op = fusedOps[k].op == F_SUB && b < 0 ? F_NEG : fusedOps[k].op;
+	nd->f = fusedOps[k].f;
+    }
+    return fx->nnodes++;
+}
+
+/* Set the types of the nodes and the common length *pn of the
+   operands; FALSE if the fused evaluation cannot be used. */
+static Rboolean fusedCheck(fused_t *fx, R_xlen_t *pn)
+{
+    R_xlen_t n = 1;
+
+    for (int i = 0; i < fx->nnodes; i++) {
+	fnode_t *nd = fx->nodes + i;
+	if (nd->op != F_LEAF)
+	    continue;
+	SEXP x = nd->value;
+	if ((TYPEOF(x) != REALSXP && TYPEOF(x) != INTSXP &&
+	     TYPEOF(x) != LGLSXP) || ATTRIB(x) != R_NilValue)
+	    return FALSE;
+	R_xlen_t len = XLENGTH(x);
+	if (len == 0 || (len > 1 && n > 1 && len != n))
+	    return FALSE;
+	if (len > 1)
+	    n = len;
+	nd->type = TYPEOF(x);
+    }
+    if (fx->nodes[fx->nnodes - 1].op == F_LEAF)
+	return FALSE;
+
+    for (int i = 0; i < fx->nnodes; i++) {
+	fnode_t *nd = fx->nodes + i;
+	SEXPTYPE ta = nd->a >= 0 ? fx->nodes[nd->a].type : NILSXP;
+	SEXPTYPE tb = nd->b >= 0 ? fx->nodes[nd->b].type : NILSXP;
+	switch (nd->op) {
+	case F_LEAF: break;
+	case F_NEG:
+	    /* - on integers and logicals gives an integer result */
+	    if (ta != REALSXP)
+		return FALSE;
+	    nd->type = REALSXP;
+	    break;
+	case F_ADD:
+	case F_SUB:
+	case F_MUL:
+	    /* so does integer arithmetic, which can overflow */
+	    if (ta != REALSXP && tb != REALSXP)
+		return FALSE;
+	    nd->type = REALSXP;
+	    break;
+	case F_DIV:
+	case F_POW:
+	case F_MATH1:
+	    nd->type = REALSXP;
+	    break;
+	default:
+	    nd->type = LGLSXP;
+	}
+    }
+    *pn = n;
+    return TRUE;
+}
+
+/* Apply the operators one at a time. */
+static SEXP fusedSlow(fused_t *fx, int i, SEXP rho)
+{
+    fnode_t *nd = fx->nodes + i;
+    if (nd->op == F_LEAF)
+	return nd->value;
+
+    SEXP args = R_NilValue;
+    if (nd->b >= 0)
+	args = CONS_NR(fusedSlow(fx, nd->b, rho), args);
+    PROTECT(args);
+    args = CONS_NR(fusedSlow(fx, nd->a, rho), args);
+    UNPROTECT(1);
+    PROTECT(args);
+    SEXP op = SYMVALUE(CAR(nd->call)), ans;
+    if (TYPEOF(op) == SPECIALSXP) /* log */
+	ans = do_log_builtin(nd->call, op, args, rho);
+    else
+	ans = PRIMFUN(op)(nd->call, op, args, rho);
+    UNPROTECT(1);
+    return ans;
+}
+
+#define FUSED_RELOP(OP) do {						\
+	for (int k = 0; k < m; k++)					\
+	    out[k] = ISNAN(pa[k]) || ISNAN(pb[k]) ? NA_REAL :		\
+		(double) (pa[k] OP pb[k]);				\
+    } while (0)
+
+static void fusedBlock(fused_t *fx, R_xlen_t start, int m, SEXP ans)
+{
+    for (int i = 0; i < fx->nnodes; i++) {
+	fnode_t *nd = fx->nodes + i;
+	double *out = nd->out, *pa, *pb = NULL;
+	Rboolean root = i == fx->nnodes - 1;
+	if (root && TYPEOF(ans) == REALSXP)
+	    out = REAL(ans) + start;
+	if (nd->op == F_LEAF) {
+	    SEXP x = nd->value;
+	    if (XLENGTH(x) == 1)
+		continue;	/* filled in once */
+	    if (TYPEOF(x) == REALSXP)
+		nd->out = REAL(x) + start;
+	    else {
+		int *px = INTEGER(x) + start;
+		for (int k = 0; k < m; k++)
+		    out[k] = px[k] == NA_INTEGER ? NA_REAL : px[k];
+	    }
+	    continue;
+	}
+	pa = fx->nodes[nd->a].out;
+	if (nd->b >= 0)
+	    pb = fx->nodes[nd->b].out;
+	switch (nd->op) {
+	case F_LEAF: break;
+	case F_NEG: for (int k = 0; k < m; k++) out[k] = - pa[k]; break;
+	case F_ADD: for (int k = 0; k < m; k++) out[k] = pa[k] + pb[k]; break;
+	case F_SUB: for (int k = 0; k < m; k++) out[k] = pa[k] - pb[k]; break;
+	case F_MUL: for (int k = 0; k < m; k++) out[k] = pa[k] * pb[k]; break;
+	case F_DIV: for (int k = 0; k < m; k++) out[k] = pa[k] / pb[k]; break;
+	case F_POW:
+	    for (int k = 0; k < m; k++) out[k] = R_POW(pa[k], pb[k]);
+	    break;
+	case F_EQ: FUSED_RELOP(==); break;
+	case F_NE: FUSED_RELOP(!=); break;
+	case F_LT: FUSED_RELOP(<); break;
+	case F_LE: FUSED_RELOP(<=); break;
+	case F_GE: FUSED_RELOP(>=); break;
+	case F_GT: FUSED_RELOP(>); break;
+	case F_MATH1:
+	    for (int k = 0; k < m; k++) {
+		double x = pa[k], y = nd->f(x);
+		if (ISNAN(y)) {
+		    if (ISNAN(x))
+			y = x;
+		    else
+			nd->naflag = 1;
+		}
+		out[k] = y;
+	    }
+	    break;
+	}
+	if (root && TYPEOF(ans) == LGLSXP) {
+	    int *pl = LOGICAL(ans) + start;
+	    for (int k = 0; k < m; k++)
+		pl[k] = ISNAN(out[k]) ? NA_LOGICAL : (int) out[k];
+	}
+    }
+}
+
+/* Set up the block buffers of the nodes, with those of scalar leaves
+   filled in once; they are allocated with R_alloc. */
+static void fusedBuffers(fused_t *fx)
+{
+    double *buf = (double *) R_alloc((size_t) fx->nnodes * FUSED_BLOCK,
+				     sizeof(double));
+    for (int i = 0; i < fx->nnodes; i++) {
+	fnode_t *nd = fx->nodes + i;
+	nd->out = buf + (size_t) i * FUSED_BLOCK;
+	if (nd->op == F_LEAF && XLENGTH(nd->value) == 1) {
+	    double v = TYPEOF(nd->value) == REALSXP ? REAL(nd->value)[0] :
+		INTEGER(nd->value)[0] == NA_INTEGER ? NA_REAL :
+		INTEGER(nd->value)[0];
+	    for (int k = 0; k < FUSED_BLOCK; k++)
+		nd->out[k] = v;
+	}
+    }
+}
+
+static void fusedWarnings(fused_t *fx)
+{
+    for (int i = 0; i < fx->nnodes; i++)
+	if (fx->nodes[i].naflag)
+	    warningcall(fx->nodes[i].call, R_MSG_NA);
+}
+
+/* any(e) and all(e) for a comparison e, compiled with fuseArith into
+
+       .Internal(fusedAnyAll(quote(any(e)), <operands of e>))
+
+   In the fused case the blocks of the comparison are scanned as they
+   are computed, and the scan stops at the first block deciding the
+   result, unless a math function in e could still warn about NaNs.
+   Otherwise the comparison is done as by fusedArith and its value
+   passed to any() or all(), which may dispatch on it. */
+static SEXP fusedAnyAll(fused_t *fx, Rboolean fused, R_xlen_t n,
+			SEXP call, SEXP env)
+{
+    static SEXP R_AllSymbol = NULL;
+    if (R_AllSymbol == NULL)
+	R_AllSymbol = install("all");
+    Rboolean isall = CAR(call) == R_AllSymbol;
+    fnode_t *root = fx->nodes + fx->nnodes - 1;
+
+    if (! fused || root->type != LGLSXP) {
+	SEXP args = PROTECT(CONS(fusedSlow(fx, fx->nnodes - 1, env),
+				 R_NilValue));
+	SEXP fun = R_Primitive(isall ? "all" : "any");
+	SEXP ans = do_logic3(call, fun, args, env);
+	UNPROTECT(1);
+	return ans;
+    }
+
+    Rboolean canstop = TRUE;
+    for (int i = 0; i < fx->nnodes; i++)
+	if (fx->nodes[i].op == F_MATH1)
+	    canstop = FALSE;
+    /* all() is decided by a FALSE and any() by a TRUE */
+    double target = isall ? 0.0 : 1.0;
+    int hit = 0, hasna = 0;
+    const void *vmax = vmaxget();
+    fusedBuffers(fx);
+    for (R_xlen_t start = 0; start < n; start += FUSED_BLOCK) {
+	int m = n - start < FUSED_BLOCK ? (int) (n - start) : FUSED_BLOCK;
+	fusedBlock(fx, start, m, R_NilValue);
+	if (! hit) {
+	    double *out = root->out;
+	    int bhit = 0, bna = 0;
+	    for (int k = 0; k < m; k++) {
+		bhit |= out[k] == target;
+		bna |= ISNAN(out[k]);
+	    }
+	    hit = bhit;
+	    hasna |= bna;
+	    if (hit && canstop)
+		break;
+	}
+	if ((start / FUSED_BLOCK + 1) % (NINTERRUPT / FUSED_BLOCK) == 0)
+	    R_CheckUserInterrupt();
+    }
+    vmaxset(vmax);
+    fusedWarnings(fx);
+    if (hit)
+	return ScalarLogical(isall ? FALSE : TRUE);
+    else if (hasna)
+	return ScalarLogical(NA_LOGICAL);
+    else
+	return ScalarLogical(isall ? TRUE : FALSE);
+}
+
+SEXP attribute_hidden do_fusedarith(SEXP call, SEXP op, SEXP args, SEXP env)
+{
+    fused_t fx;
+    R_xlen_t n;
+
+    if (fusedOpSyms[0] == NULL)
+	for (int i = 0; fusedOps[i].name != NULL; i++)
+	    fusedOpSyms[i] = install(fusedOps[i].name);
+
+    SEXP expr = args == R_NilValue ? R_NilValue : CAR(args);
+    SEXP anycall = R_NilValue;
+    if (PRIMVAL(op) == 1) { /* fusedAnyAll */
+	anycall = expr;
+	if (TYPEOF(anycall) != LANGSXP || length(anycall) != 2)
+	    error(_("invalid '%s' argument"), "call");
+	expr = CADR(anycall);
+    }
+    if (TYPEOF(expr) != LANGSXP)
+	error(_("invalid '%s' argument"), "expr");
+    fx.nnodes = 0;
+    fx.args = CDR(args);
+    if (fusedParse(&fx, expr) < 0 || fx.args != R_NilValue)
+	error(_("operands do not match the expression"));
+
+    Rboolean fused = fusedCheck(&fx, &n);
+    if (anycall != R_NilValue)
+	return fusedAnyAll(&fx, fused, n, anycall, env);
+    if (! fused)
+	return fusedSlow(&fx, fx.nnodes - 1, env);
+
+    fnode_t *root = fx.nodes + fx.nnodes - 1;
+    SEXP ans = PROTECT(allocVector(root->type, n));
+    const void *vmax = vmaxget();
+    fusedBuffers(&fx);
+    for (R_xlen_t start = 0; start < n; start += FUSED_BLOCK) {
+	int m = n - start < FUSED_BLOCK ? (int) (n - start) : FUSED_BLOCK;
+	fusedBlock(&fx, start, m, ans);
+	if ((start / FUSED_BLOCK + 1) % (NINTERRUPT / FUSED_BLOCK) == 0)
+	    R_CheckUserInterrupt();
+    }
+    vmaxset(vmax);
+    fusedWarnings(&fx);
+    UNPROTECT(1);
+    return ans;
+}
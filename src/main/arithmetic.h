@@ -83,10 +83,9 @@ static R_INLINE SEXP R_allocOrReuseVector(SEXP s1, SEXP s2,
             return s2;
 	}
         else
-            /* Can use 1st arg's space only if 2nd arg has no attributes, else
-               we may not get attributes of result right. */
-            if (n == n1 && TYPEOF(s1) == type && NO_REFERENCES(s1)
-		&& ATTRIB(s2) == R_NilValue)
+            /* Can use 1st arg's space too; if 2nd arg has attributes
+               R_binaryMostAttrib puts them under the 1st arg's. */
+            if (n == n1 && TYPEOF(s1) == type && NO_REFERENCES(s1))
                 return s1;
     }
     else if (n == n1 && TYPEOF(s1) == type && NO_REFERENCES(s1))
@@ -95,6 +94,8 @@ static R_INLINE SEXP R_allocOrReuseVector(SEXP s1, SEXP s2,
     return allocVector(type, n);
 }
 
+void R_binaryMostAttrib(SEXP ans, SEXP s1, SEXP s2, R_xlen_t n);
+
 #if defined(HAVE_TANPI) || defined(HAVE___TANPI)
 // we document that tanpi(0.5) is NaN, but TS 18661-4:2015
 // does not require this and the Solaris and OS X versions give Inf.
@@ -413,7 +413,7 @@ SEXP attribute_hidden do_drop(SEXP call, SEXP op, SEXP args, SEXP rho)
 	for (i = 0; i < n; i++)
 	    if (INTEGER(xdims)[i] == 1) shorten = 1;
 	if (shorten) {
-	    if (MAYBE_REFERENCED(x)) x = duplicate(x);
+	    if (MAYBE_REFERENCED(x)) x = shallow_duplicate(x);
 	    x = DropDims(x);
 	}
     }
@@ -582,33 +582,230 @@ SEXP attribute_hidden do_rowscols(SEXP call, SEXP op, SEXP args, SEXP rho)
     return ans;
 }
 
+/* The built-in matrix product, used for options(matprod = "internal")
+   and for "default" when R_num_math_threads > 1 and the product has
+   at least R_MATPROD_THREADS_MIN multiply-adds.  The reference BLAS is
+   single-threaded and unblocked: here the columns of the result are
+   shared out between R_num_math_threads threads in chunks of MP_NC
+   (or the rows, if there are too few columns), and the inner dimension
+   is taken in blocks of MP_KC so the operands stay in cache.  The
+   inner loops are simple enough for the compiler to vectorize.  NaNs
+   propagate as in any sum of products, and the result does not depend
+   on the number of threads. */
+
+#define R_MATPROD_THREADS_MIN 1e6
+#define MP_KC 256
+#define MP_MC 512
+#define MP_NC 32
+
+static Rboolean use_internal_matprod(int m, int n, int k)
+{
+    switch (R_Matprod) {
+    case MATPROD_INTERNAL:
+	return TRUE;
+    case MATPROD_BLAS:
+	return FALSE;
+    default:
+#ifdef _OPENMP
+	return R_num_math_threads > 1 &&
+	    (double) m * n * k >= R_MATPROD_THREADS_MIN;
+#else
+	return FALSE;
+#endif
+    }
+}
+
+/* z[i0:i1, j0:j1] of x y (or x t(y) if ty) for m x k x, with rows
+   i > j not needed if upper */
+static void mp_nn(const double *x, R_xlen_t ldx, const double *y,
+		  R_xlen_t ldy, Rboolean ty, int k, int i0, int i1,
+		  int j0, int j1, Rboolean upper, double *z, R_xlen_t ldz)
+{
+#define MP_Y(p, j) (ty ? y[(j) + (p) * ldy] : y[(p) + (j) * ldy])
+    for (int j = j0; j < j1; j++)
+	for (int i = i0; i < i1; i++) z[i + j * ldz] = 0.;
+    for (int p0 = 0; p0 < k; p0 += MP_KC) {
+	int p1 = (p0 + MP_KC < k) ? p0 + MP_KC : k;
+	for (int r0 = i0; r0 < i1; r0 += MP_MC) {
+	    int r1 = (r0 + MP_MC < i1) ? r0 + MP_MC : i1;
+	    for (int j = j0; j < j1; j += 4) {
+		int nj = (j + 4 < j1) ? 4 : j1 - j,
+		    re = (upper && j + nj < r1) ? j + nj : r1;
+		if (re <= r0) continue;
+		if (nj == 4) {
+		    double *z0 = z + j * ldz, *z1 = z0 + ldz,
+			*z2 = z1 + ldz, *z3 = z2 + ldz;
+		    for (int p = p0; p < p1; p++) {
+			const double *a = x + p * ldx;
+			double b0 = MP_Y(p, j), b1 = MP_Y(p, j + 1),
+			    b2 = MP_Y(p, j + 2), b3 = MP_Y(p, j + 3);
+			for (int i = r0; i < re; i++) {
+			    double ai = a[i];
+			    z0[i] += ai * b0;
+			    z1[i] += ai * b1;
+			    z2[i] += ai * b2;
+			    z3[i] += ai * b3;
+			}
+		    }
+		} else
+		    for (int jj = j; jj < j + nj; jj++) {
+			double *zj = z + jj * ldz;
+			for (int p = p0; p < p1; p++) {
+			    const double *a = x + p * ldx;
+			    double b = MP_Y(p, jj);
+			    for (int i = r0; i < re; i++) zj[i] += a[i] * b;
+			}
+		    }
+	    }
+	}
+    }
+#undef MP_Y
+}
+
+/* z[i0:i1, j0:j1] of t(x) y for k x m x, with rows i > j not needed
+   if upper.  Both operands are read down their columns, four of each
+   at a time. */
+static void mp_tn(const double *x, R_xlen_t ldx, const double *y,
+		  R_xlen_t ldy, int k, int i0, int i1, int j0, int j1,
+		  Rboolean upper, double *z, R_xlen_t ldz)
+{
+    for (int j = j0; j < j1; j++)
+	for (int i = i0; i < i1; i++) z[i + j * ldz] = 0.;
+    for (int p0 = 0; p0 < k; p0 += MP_KC) {
+	int pn = (p0 + MP_KC < k) ? MP_KC : k - p0;
+	for (int j = j0; j < j1; j += 4) {
+	    int nj = (j + 4 < j1) ? 4 : j1 - j,
+		re = (upper && j + nj < i1) ? j + nj : i1;
+	    const double *b[4];
+	    for (int c = 0; c < nj; c++) b[c] = y + p0 + (j + c) * ldy;
+	    for (int i = i0; i < re; i += 4) {
+		int ni = (i + 4 < re) ? 4 : re - i;
+		const double *a[4];
+		for (int r = 0; r < ni; r++) a[r] = x + p0 + (i + r) * ldx;
+		if (ni == 4 && nj == 4) {
+		    double s00 = 0., s01 = 0., s02 = 0., s03 = 0.,
+			s10 = 0., s11 = 0., s12 = 0., s13 = 0.,
+			s20 = 0., s21 = 0., s22 = 0., s23 = 0.,
+			s30 = 0., s31 = 0., s32 = 0., s33 = 0.;
+		    for (int p = 0; p < pn; p++) {
+			double a0 = a[0][p], a1 = a[1][p], a2 = a[2][p],
+			    a3 = a[3][p], b0 = b[0][p], b1 = b[1][p],
+			    b2 = b[2][p], b3 = b[3][p];
+			s00 += a0 * b0; s01 += a0 * b1;
+			s02 += a0 * b2; s03 += a0 * b3;
+			s10 += a1 * b0; s11 += a1 * b1;
+			s12 += a1 * b2; s13 += a1 * b3;
+			s20 += a2 * b0; s21 += a2 * b1;
+			s22 += a2 * b2; s23 += a2 * b3;
+			s30 += a3 * b0; s31 += a3 * b1;
+			s32 += a3 * b2; s33 += a3 * b3;
+		    }
+		    double *zz = z + i + j * ldz;
+		    zz[0] += s00; zz[1] += s10; zz[2] += s20; zz[3] += s30;
+		    zz += ldz;
+		    zz[0] += s01; zz[1] += s11; zz[2] += s21; zz[3] += s31;
+		    zz += ldz;
+		    zz[0] += s02; zz[1] += s12; zz[2] += s22; zz[3] += s32;
+		    zz += ldz;
+		    zz[0] += s03; zz[1] += s13; zz[2] += s23; zz[3] += s33;
+		} else
+		    for (int r = 0; r < ni; r++)
+			for (int c = 0; c < nj; c++) {
+			    double s = 0.;
+			    for (int p = 0; p < pn; p++)
+				s += a[r][p] * b[c][p];
+			    z[i + r + (j + c) * ldz] += s;
+			}
+	    }
+	}
+    }
+}
+
+/* z (m x n) = op(x) op(y), where op(x) is t(x) if tx and op(y) is t(y)
+   if ty (not both): only the upper triangle is formed and then copied
+   if upper. */
+static void internal_matprod(const double *x, int ldx, Rboolean tx,
+			     const double *y, int ldy, Rboolean ty,
+			     int m, int n, int k, Rboolean upper, double *z)
+{
+    int nthreads = 1;
+#ifdef _OPENMP
+    if (R_num_math_threads > 1 && (double) m * n * k >= R_MATPROD_THREADS_MIN)
+	nthreads = R_num_math_threads;
+#endif
+    R_xlen_t ldz = m;
+    int nchunks = (n + MP_NC - 1) / MP_NC;
+
+    if (nchunks >= nthreads || upper) {
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(nthreads) schedule(dynamic) \
+    default(none) firstprivate(x, ldx, tx, y, ldy, ty, m, n, k, upper, \
+			       z, ldz, nchunks)
+#endif
+	for (int c = 0; c < nchunks; c++) {
+	    int j0 = c * MP_NC, j1 = (j0 + MP_NC < n) ? j0 + MP_NC : n,
+		i1 = (upper && j1 < m) ? j1 : m;
+	    if (tx)
+		mp_tn(x, ldx, y, ldy, k, 0, i1, j0, j1, upper, z, ldz);
+	    else
+		mp_nn(x, ldx, y, ldy, ty, k, 0, i1, j0, j1, upper, z, ldz);
+	}
+    } else {
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(nthreads) schedule(static) \
+    default(none) firstprivate(x, ldx, tx, y, ldy, ty, m, n, k, z, ldz, \
+			       nthreads)
+#endif
+	for (int t = 0; t < nthreads; t++) {
+	    int i0 = (int) ((double) m * t / nthreads),
+		i1 = (int) ((double) m * (t + 1) / nthreads);
+	    if (tx)
+		mp_tn(x, ldx, y, ldy, k, i0, i1, 0, n, FALSE, z, ldz);
+	    else
+		mp_nn(x, ldx, y, ldy, ty, k, i0, i1, 0, n, FALSE, z, ldz);
+	}
+    }
+    if (upper)
+	for (int i = 1; i < m; i++)
+	    for (int j = 0; j < i; j++) z[i + ldz * j] = z[j + ldz * i];
+}
+
+/* Does x[0:n] contain a NaN?  The test is done a block at a time,
+   without a branch per element, so that it vectorizes. */
+static Rboolean hasNaN(const double *x, R_xlen_t n)
+{
+    for (R_xlen_t i0 = 0; i0 < n; i0 += 1024) {
+	R_xlen_t i1 = (i0 + 1024 < n) ? i0 + 1024 : n;
+	int nan = 0;
+	for (R_xlen_t i = i0; i < i1; i++)
+	    nan |= ISNAN(x[i]);
+	if (nan) return TRUE;
+    }
+    return FALSE;
+}
+
 static void matprod(double *x, int nrx, int ncx,
 		    double *y, int nry, int ncy, double *z)
 {
     char *transa = "N", *transb = "N";
     double one = 1.0, zero = 0.0;
-    LDOUBLE sum;
-    Rboolean have_na = FALSE;
     R_xlen_t NRX = nrx, NRY = nry;
 
     if (nrx > 0 && ncx > 0 && nry > 0 && ncy > 0) {
-	/* Don't trust the BLAS to handle NA/NaNs correctly: PR#4582
-	 * The test is only O(n) here.
+	if (R_Matprod == MATPROD_BLAS) {
+	    F77_CALL(dgemm)(transa, transb, &nrx, &ncy, &ncx, &one,
+			    x, &nrx, y, &nry, &zero, z, &nrx);
+	    return;
+	}
+	/* Don't trust the BLAS to handle NA/NaNs correctly: PR#4582.
+	 * The built-in kernel propagates them, so is used if there are
+	 * any, and then no scan is needed when it would be used anyway.
 	 */
-	for (R_xlen_t i = 0; i < NRX*ncx; i++)
-	    if (ISNAN(x[i])) {have_na = TRUE; break;}
-	if (!have_na)
-	    for (R_xlen_t i = 0; i < NRY*ncy; i++)
-		if (ISNAN(y[i])) {have_na = TRUE; break;}
-	if (have_na) {
-	    for (int i = 0; i < nrx; i++)
-		for (int k = 0; k < ncy; k++) {
-		    sum = 0.0;
-		    for (int j = 0; j < ncx; j++)
-			sum += x[i + j * NRX] * y[j + k * NRY];
-		    z[i + k * NRX] = (double) sum;
-		}
-	} else
+	if (use_internal_matprod(nrx, ncy, ncx) ||
+	    hasNaN(x, NRX*ncx) || hasNaN(y, NRY*ncy))
+	    internal_matprod(x, nrx, FALSE, y, nry, FALSE, nrx, ncy, ncx,
+			     FALSE, z);
+	else
 	    F77_CALL(dgemm)(transa, transb, &nrx, &ncy, &ncx, &one,
 			    x, &nrx, y, &nry, &zero, z, &nrx);
     } else /* zero-extent operations should return zeroes */
@@ -667,6 +864,10 @@ static void symcrossprod(double *x, int nr, int nc, double *z)
     double one = 1.0, zero = 0.0;
     R_xlen_t NC = nc;
     if (nr > 0 && nc > 0) {
+	if (use_internal_matprod(nc, nc, nr)) {
+	    internal_matprod(x, nr, TRUE, x, nr, FALSE, nc, nc, nr, TRUE, z);
+	    return;
+	}
 	F77_CALL(dsyrk)(uplo, trans, &nc, &nr, &one, x, &nr, &zero, z, &nc);
 	for (int i = 1; i < nc; i++)
 	    for (int j = 0; j < i; j++) z[i + NC *j] = z[j + NC * i];
@@ -682,8 +883,12 @@ static void crossprod(double *x, int nrx, int ncx,
     char *transa = "T", *transb = "N";
     double one = 1.0, zero = 0.0;
     if (nrx > 0 && ncx > 0 && nry > 0 && ncy > 0) {
-	F77_CALL(dgemm)(transa, transb, &ncx, &ncy, &nrx, &one,
-			x, &nrx, y, &nry, &zero, z, &ncx);
+	if (use_internal_matprod(ncx, ncy, nrx))
+	    internal_matprod(x, nrx, TRUE, y, nry, FALSE, ncx, ncy, nrx,
+			     FALSE, z);
+	else
+	    F77_CALL(dgemm)(transa, transb, &ncx, &ncy, &nrx, &one,
+			    x, &nrx, y, &nry, &zero, z, &ncx);
     } else { /* zero-extent operations should return zeroes */
 	R_xlen_t NCX = ncx;
 	for(R_xlen_t i = 0; i < NCX*ncy; i++) z[i] = 0;
@@ -711,6 +916,10 @@ static void symtcrossprod(double *x, int nr, int nc, double *z)
     char *trans = "N", *uplo = "U";
     double one = 1.0, zero = 0.0;
     if (nr > 0 && nc > 0) {
+	if (use_internal_matprod(nr, nr, nc)) {
+	    internal_matprod(x, nr, FALSE, x, nr, TRUE, nr, nr, nc, TRUE, z);
+	    return;
+	}
 	F77_CALL(dsyrk)(uplo, trans, &nr, &nc, &one, x, &nr, &zero, z, &nr);
 	for (int i = 1; i < nr; i++)
 	    for (int j = 0; j < i; j++) z[i + nr *j] = z[j + nr * i];
@@ -727,8 +936,12 @@ static void tcrossprod(double *x, int nrx, int ncx,
     char *transa = "N", *transb = "T";
     double one = 1.0, zero = 0.0;
     if (nrx > 0 && ncx > 0 && nry > 0 && ncy > 0) {
-	F77_CALL(dgemm)(transa, transb, &nrx, &nry, &ncx, &one,
-			x, &nrx, y, &nry, &zero, z, &nrx);
+	if (use_internal_matprod(nrx, nry, ncx))
+	    internal_matprod(x, nrx, FALSE, y, nry, TRUE, nrx, nry, ncx,
+			     FALSE, z);
+	else
+	    F77_CALL(dgemm)(transa, transb, &nrx, &nry, &ncx, &one,
+			    x, &nrx, y, &nry, &zero, z, &nrx);
     } else { /* zero-extent operations should return zeroes */
 	R_xlen_t NRX = nrx;
 	for(R_xlen_t i = 0; i < NRX*nry; i++) z[i] = 0;
@@ -1069,6 +1282,71 @@ SEXP attribute_hidden do_matprod(SEXP call, SEXP op, SEXP args, SEXP rho)
 }
 #undef YDIMS_ET_CETERA
 
+/* Permutation of the elements of an atomic array, as used by t() and
+   aperm().  Dimension k of the result r has extent isr[k] and stride
+   astr[k] in a, and dimension q of r is the first of a, so that r is
+   contiguous along its first dimension and a along r's dimension q.
+   For each index of the remaining dimensions the copy is a 2-d
+   transpose between these two, done in R_PERM_TILE x R_PERM_TILE
+   tiles so both sides stay in cache, with the tiles shared out
+   between R_num_math_threads threads for arrays of at least
+   R_PERM_THREADS_MIN elements. */
+
+#define R_PERM_TILE 32
+#define R_PERM_THREADS_MIN 1000000
+
+#define PERM_TILE(type) do {					\
+	const type *pa = (const type *) a + ao;			\
+	type *pr = (type *) r + ro;				\
+	for (R_xlen_t j = j0; j < j1; j++)			\
+	    for (R_xlen_t i = i0; i < i1; i++)			\
+		pr[i + j * rsq] = pa[i * as0 + j];		\
+    } while (0)
+
+static void permute_atomic(const void *a, void *r, size_t size, int n,
+			   const int *isr, const R_xlen_t *astr, int q)
+{
+    R_xlen_t len = 1, rsq = 1;
+    for (int k = 0; k < n; k++) len *= isr[k];
+    if (len == 0) return;
+    for (int k = 0; k < q; k++) rsq *= isr[k];
+    R_xlen_t n0 = isr[0], nq = q ? isr[q] : 1, as0 = astr[0],
+	nouter = len / (n0 * nq),
+	ntile = (n0 + R_PERM_TILE - 1) / R_PERM_TILE;
+
+#ifdef _OPENMP
+    int nthreads = 1;
+    if (R_num_math_threads > 1 && len >= R_PERM_THREADS_MIN)
+	nthreads = R_num_math_threads;
+#pragma omp parallel for num_threads(nthreads) schedule(static) \
+    default(none) firstprivate(a, r, size, n, isr, astr, q, rsq, n0, nq, \
+			       as0, nouter, ntile)
+#endif
+    for (R_xlen_t w = 0; w < nouter * ntile; w++) {
+	R_xlen_t o = w / ntile, ao = 0, ro = 0, rs = 1,
+	    i0 = (w % ntile) * R_PERM_TILE,
+	    i1 = (i0 + R_PERM_TILE < n0) ? i0 + R_PERM_TILE : n0;
+	/* offsets of index o of the dimensions other than 0 and q */
+	for (int k = 0; k < n; rs *= isr[k++])
+	    if (k != 0 && k != q) {
+		R_xlen_t ik = o % isr[k];
+		o /= isr[k];
+		ao += ik * astr[k];
+		ro += ik * rs;
+	    }
+	for (R_xlen_t j0 = 0; j0 < nq; j0 += R_PERM_TILE) {
+	    R_xlen_t j1 = (j0 + R_PERM_TILE < nq) ? j0 + R_PERM_TILE : nq;
+	    switch (size) {
+	    case sizeof(Rbyte): PERM_TILE(Rbyte); break;
+	    case sizeof(int): PERM_TILE(int); break;
+	    case sizeof(double): PERM_TILE(double); break;
+	    case sizeof(Rcomplex): PERM_TILE(Rcomplex); break;
+	    }
+	}
+    }
+}
+#undef PERM_TILE
+
 SEXP attribute_hidden do_transpose(SEXP call, SEXP op, SEXP args, SEXP rho)
 {
     SEXP a, r, dims, dimnames, dimnamesnames = R_NilValue,
@@ -1120,28 +1398,22 @@ SEXP attribute_hidden do_transpose(SEXP call, SEXP op, SEXP args, SEXP rho)
     PROTECT(dimnamesnames);
     PROTECT(r = allocVector(TYPEOF(a), len));
     R_xlen_t i, j, l_1 = len-1;
+    int tdim[2] = {ncol, nrow};
+    R_xlen_t tstride[2] = {nrow, 1};
     switch (TYPEOF(a)) {
     case LGLSXP:
     case INTSXP:
-	// filling in columnwise, "accessing row-wise":
-	for (i = 0, j = 0; i < len; i++, j += nrow) {
-	    if (j > l_1) j -= l_1;
-	    INTEGER(r)[i] = INTEGER(a)[j];
-	}
+	permute_atomic(INTEGER(a), INTEGER(r), sizeof(int), 2, tdim, tstride, 1);
 	break;
     case REALSXP:
-	for (i = 0, j = 0; i < len; i++, j += nrow) {
-	    if (j > l_1) j -= l_1;
-	    REAL(r)[i] = REAL(a)[j];
-	}
+	permute_atomic(REAL(a), REAL(r), sizeof(double), 2, tdim, tstride, 1);
 	break;
     case CPLXSXP:
-	for (i = 0, j = 0; i < len; i++, j += nrow) {
-	    if (j > l_1) j -= l_1;
-	    COMPLEX(r)[i] = COMPLEX(a)[j];
-	}
+	permute_atomic(COMPLEX(a), COMPLEX(r), sizeof(Rcomplex), 2,
+		       tdim, tstride, 1);
 	break;
     case STRSXP:
+	// filling in columnwise, "accessing row-wise":
 	for (i = 0, j = 0; i < len; i++, j += nrow) {
 	    if (j > l_1) j -= l_1;
 	    SET_STRING_ELT(r, i, STRING_ELT(a,j));
@@ -1154,10 +1426,7 @@ SEXP attribute_hidden do_transpose(SEXP call, SEXP op, SEXP args, SEXP rho)
 	}
 	break;
     case RAWSXP:
-	for (i = 0, j = 0; i < len; i++, j += nrow) {
-	    if (j > l_1) j -= l_1;
-	    RAW(r)[i] = RAW(a)[j];
-	}
+	permute_atomic(RAW(a), RAW(r), sizeof(Rbyte), 2, tdim, tstride, 1);
 	break;
     default:
 	UNPROTECT(2); /* r, dimnamesnames */
@@ -1290,36 +1559,25 @@ SEXP attribute_hidden do_aperm(SEXP call, SEXP op, SEXP args, SEXP rho)
 
     for (i = 0; i < n; iip[i++] = 0);
 
+    /* the dimension of r which is the first of a */
+    int q = 0;
+    for (i = 0; i < n; i++) if (pp[i] == 0) q = i;
+
     R_xlen_t li, lj;
     switch (TYPEOF(a)) {
 
     case INTSXP:
-	for (lj = 0, li = 0; li < len; li++) {
-	    INTEGER(r)[li] = INTEGER(a)[lj];
-	    CLICKJ;
-	}
-	break;
-
     case LGLSXP:
-	for (lj = 0, li = 0; li < len; li++) {
-	    LOGICAL(r)[li] = LOGICAL(a)[lj];
-	    CLICKJ;
-	}
+	permute_atomic(INTEGER(a), INTEGER(r), sizeof(int), n, isr, stride, q);
 	break;
 
     case REALSXP:
-	for (lj = 0, li = 0; li < len; li++) {
-	    REAL(r)[li] = REAL(a)[lj];
-	    CLICKJ;
-	}
+	permute_atomic(REAL(a), REAL(r), sizeof(double), n, isr, stride, q);
 	break;
 
     case CPLXSXP:
-	for (lj = 0, li = 0; li < len; li++) {
-	    COMPLEX(r)[li].r = COMPLEX(a)[lj].r;
-	    COMPLEX(r)[li].i = COMPLEX(a)[lj].i;
-	    CLICKJ;
-	}
+	permute_atomic(COMPLEX(a), COMPLEX(r), sizeof(Rcomplex), n,
+		       isr, stride, q);
 	break;
 
     case STRSXP:
@@ -1337,10 +1595,7 @@ SEXP attribute_hidden do_aperm(SEXP call, SEXP op, SEXP args, SEXP rho)
 	break;
 
     case RAWSXP:
-	for (lj = 0, li = 0; li < len; li++) {
-	    RAW(r)[li] = RAW(a)[lj];
-	    CLICKJ;
-	}
+	permute_atomic(RAW(a), RAW(r), sizeof(Rbyte), n, isr, stride, q);
 	break;
 
     default:
@@ -1396,6 +1651,54 @@ SEXP attribute_hidden do_aperm(SEXP call, SEXP op, SEXP args, SEXP rho)
 }
 
 /* colSums(x, n, p, na.rm) and friends */
+/* rowSums() and rowMeans() of rows i0 to i1-1 (at most RS_BLOCK) of
+   the n x p matrix px, accumulated column by column in local arrays
+   that stay in cache.  The non-missing values are counted rather than
+   branched on, so the inner loops are straight-line code. */
+#define RS_BLOCK 1024
+#define R_ROWSUM_THREADS_MIN 1e6
+
+static void rowsum_block(const void *px, int type, R_xlen_t n, R_xlen_t p,
+			 R_xlen_t i0, R_xlen_t i1, Rboolean keepNA, int OP,
+			 double *ans)
+{
+    LDOUBLE sum[RS_BLOCK];
+    int cnt[RS_BLOCK];
+    R_xlen_t m = i1 - i0;
+
+    for (R_xlen_t i = 0; i < m; i++) {
+	sum[i] = 0.;
+	cnt[i] = 0;
+    }
+    for (R_xlen_t j = 0; j < p; j++) {
+	if (type == REALSXP) {
+	    const double *rx = (const double *) px + i0 + n * j;
+	    if (keepNA)
+		for (R_xlen_t i = 0; i < m; i++) sum[i] += rx[i];
+	    else
+		for (R_xlen_t i = 0; i < m; i++) {
+		    double v = rx[i];
+		    int ok = !ISNAN(v);
+		    sum[i] += ok ? v : 0.;
+		    cnt[i] += ok;
+		}
+	} else { /* NA_LOGICAL == NA_INTEGER */
+	    const int *ix = (const int *) px + i0 + n * j;
+	    for (R_xlen_t i = 0; i < m; i++) {
+		int v = ix[i], ok = v != NA_INTEGER;
+		sum[i] += ok ? v : 0;
+		cnt[i] += ok;
+	    }
+	}
+    }
+    for (R_xlen_t i = 0; i < m; i++) {
+	LDOUBLE s = sum[i];
+	if (keepNA && type != REALSXP && cnt[i] < p) s = NA_REAL;
+	else if (OP == 3) s /= keepNA ? p : cnt[i];
+	ans[i0 + i] = (double) s;
+    }
+}
+
 SEXP attribute_hidden do_colsum(SEXP call, SEXP op, SEXP args, SEXP rho)
 {
     SEXP x, ans = R_NilValue;
@@ -1445,28 +1748,31 @@ SEXP attribute_hidden do_colsum(SEXP call, SEXP op, SEXP args, SEXP rho)
 	    {
 		double *rx = REAL(x) + (R_xlen_t)n*j;
 		if (keepNA)
-		    for (sum = 0., i = 0; i < n; i++) sum += *rx++;
-		else {
-		    for (cnt = 0, sum = 0., i = 0; i < n; i++, rx++)
-			if (!ISNAN(*rx)) {cnt++; sum += *rx;}
-			else if (keepNA) {sum = NA_REAL; break;} // unused
-		}
+		    for (sum = 0., i = 0; i < n; i++) sum += rx[i];
+		else
+		    for (cnt = 0, sum = 0., i = 0; i < n; i++) {
+			double v = rx[i];
+			int ok = !ISNAN(v);
+			sum += ok ? v : 0.;
+			cnt += ok;
+		    }
 		break;
 	    }
 	    case INTSXP:
-	    {
-		int *ix = INTEGER(x) + (R_xlen_t)n*j;
-		for (cnt = 0, sum = 0., i = 0; i < n; i++, ix++)
-		    if (*ix != NA_INTEGER) {cnt++; sum += *ix;}
-		    else if (keepNA) {sum = NA_REAL; break;}
-		break;
-	    }
 	    case LGLSXP:
 	    {
-		int *ix = LOGICAL(x) + (R_xlen_t)n*j;
-		for (cnt = 0, sum = 0., i = 0; i < n; i++, ix++)
-		    if (*ix != NA_LOGICAL) {cnt++; sum += *ix;}
-		    else if (keepNA) {sum = NA_REAL; break;}
+		/* NA_LOGICAL == NA_INTEGER */
+		int *ix = INTEGER(x) + (R_xlen_t)n*j;
+		if (keepNA) {
+		    for (sum = 0., i = 0; i < n; i++)
+			if (ix[i] != NA_INTEGER) sum += ix[i];
+			else {sum = NA_REAL; break;}
+		} else
+		    for (cnt = 0, sum = 0., i = 0; i < n; i++) {
+			int ok = ix[i] != NA_INTEGER;
+			sum += ok ? ix[i] : 0;
+			cnt += ok;
+		    }
 		break;
 	    }
 	    }
@@ -1477,73 +1783,26 @@ SEXP attribute_hidden do_colsum(SEXP call, SEXP op, SEXP args, SEXP rho)
     else { /* rows */
 	PROTECT(ans = allocVector(REALSXP, n));
 
-	/* allocate scratch storage to allow accumulating by columns
-	   to improve cache hits */
-	int *Cnt = NULL;
-	LDOUBLE *rans;
-	if(n <= 10000) {
-	    R_CheckStack2(n * sizeof(LDOUBLE));
-	    rans = (LDOUBLE *) alloca(n * sizeof(LDOUBLE));
-	    Memzero(rans, n);
-	} else rans = Calloc(n, LDOUBLE);
-	if (!keepNA && OP == 3) Cnt = Calloc(n, int);
-
-	for (R_xlen_t j = 0; j < p; j++) {
-	    LDOUBLE *ra = rans;
-	    switch (type) {
-	    case REALSXP:
-	    {
-		double *rx = REAL(x) + (R_xlen_t)n * j;
-		if (keepNA)
-		    for (R_xlen_t i = 0; i < n; i++) *ra++ += *rx++;
-		else
-		    for (R_xlen_t i = 0; i < n; i++, ra++, rx++)
-			if (!ISNAN(*rx)) {
-			    *ra += *rx;
-			    if (OP == 3) Cnt[i]++;
-			}
-		break;
-	    }
-	    case INTSXP:
-	    {
-		int *ix = INTEGER(x) + (R_xlen_t)n * j;
-		for (R_xlen_t i = 0; i < n; i++, ra++, ix++)
-		    if (keepNA) {
-			if (*ix != NA_INTEGER) *ra += *ix;
-			else *ra = NA_REAL;
-		    }
-		    else if (*ix != NA_INTEGER) {
-			*ra += *ix;
-			if (OP == 3) Cnt[i]++;
-		    }
-		break;
-	    }
-	    case LGLSXP:
-	    {
-		int *ix = LOGICAL(x) + (R_xlen_t)n * j;
-		for (R_xlen_t i = 0; i < n; i++, ra++, ix++)
-		    if (keepNA) {
-			if (*ix != NA_LOGICAL) *ra += *ix;
-			else *ra = NA_REAL;
-		    }
-		    else if (*ix != NA_LOGICAL) {
-			*ra += *ix;
-			if (OP == 3) Cnt[i]++;
-		    }
-		break;
-	    }
-	    }
-	}
-	if (OP == 3) {
-	    if (keepNA)
-		for (R_xlen_t i = 0; i < n; i++) rans[i] /= p;
-	    else
-		for (R_xlen_t i = 0; i < n; i++) rans[i] /= Cnt[i];
+	const void *px = (type == REALSXP) ? (const void *) REAL(x)
+	    : (const void *) INTEGER(x);
+	double *rans = REAL(ans);
+	int nthreads = 1;
+#ifdef _OPENMP
+	if (R_num_math_threads > 1 && (double) n * p >= R_ROWSUM_THREADS_MIN)
+	    nthreads = R_num_math_threads;
+#endif
+	/* enough blocks for all the threads */
+	R_xlen_t bs = (n + nthreads - 1) / nthreads;
+	if (bs > RS_BLOCK) bs = RS_BLOCK;
+	R_xlen_t nblocks = bs ? (n + bs - 1) / bs : 0;
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(nthreads) schedule(static) \
+    default(none) firstprivate(px, type, n, p, keepNA, OP, rans, bs, nblocks)
+#endif
+	for (R_xlen_t b = 0; b < nblocks; b++) {
+	    R_xlen_t i0 = b * bs, i1 = (i0 + bs < n) ? i0 + bs : n;
+	    rowsum_block(px, type, n, p, i0, i1, keepNA, OP, rans);
 	}
-	for (R_xlen_t i = 0; i < n; i++) REAL(ans)[i] = (double) rans[i];
-
-	if (!keepNA && OP == 3) Free(Cnt);
-	if(n > 10000) Free(rans);
     }
 
     UNPROTECT(1);
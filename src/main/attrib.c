@@ -105,13 +105,25 @@ SEXP attribute_hidden getAttrib0(SEXP vec, SEXP name)
 
     if (name == R_NamesSymbol) {
 	if(isVector(vec) || isList(vec) || isLanguage(vec)) {
-	    s = getAttrib(vec, R_DimSymbol);
-	    if(TYPEOF(s) == INTSXP && LENGTH(s) == 1) {
-		s = getAttrib(vec, R_DimNamesSymbol);
-		if(!isNull(s)) {
-		    SET_NAMED(VECTOR_ELT(s, 0), 2);
-		    return VECTOR_ELT(s, 0);
-		}
+	    /* find dim, dimnames and names in a single pass over the
+	       attributes rather than one for each */
+	    SEXP dim = R_NilValue, dimnames = R_NilValue, names = R_NilValue;
+	    for (s = ATTRIB(vec); s != R_NilValue; s = CDR(s)) {
+		if (TAG(s) == R_DimSymbol) dim = CAR(s);
+		else if (TAG(s) == R_DimNamesSymbol) dimnames = CAR(s);
+		else if (TAG(s) == R_NamesSymbol) names = CAR(s);
+	    }
+	    if(TYPEOF(dim) == INTSXP && LENGTH(dim) == 1 &&
+	       dimnames != R_NilValue) {
+		if (TYPEOF(dimnames) == LISTSXP)
+		    error("old list is no longer allowed for dimnames attribute");
+		SET_NAMED(dimnames, 2);
+		SET_NAMED(VECTOR_ELT(dimnames, 0), 2);
+		return VECTOR_ELT(dimnames, 0);
+	    }
+	    if (isVector(vec)) {
+		if (names != R_NilValue) SET_NAMED(names, 2);
+		return names;
 	    }
 	}
 	if (isList(vec) || isLanguage(vec)) {
@@ -465,7 +477,7 @@ static SEXP commentgets(SEXP vec, SEXP comment)
 SEXP attribute_hidden do_commentgets(SEXP call, SEXP op, SEXP args, SEXP env)
 {
     checkArity(op, args);
-    if (MAYBE_SHARED(CAR(args))) SETCAR(args, duplicate(CAR(args)));
+    if (MAYBE_SHARED(CAR(args))) SETCAR(args, shallow_duplicate(CAR(args)));
     if (length(CADR(args)) == 0) SETCADR(args, R_NilValue);
     setAttrib(CAR(args), R_CommentSymbol, CADR(args));
     SET_NAMED(CAR(args), 0);
@@ -1254,7 +1266,7 @@ SEXP attribute_hidden do_levelsgets(SEXP call, SEXP op, SEXP args, SEXP env)
 	warningcall(call, "duplicated levels in factors are deprecated");
 /* TODO errorcall(call, _("duplicated levels are not allowed in factors anymore")); */
     args = ans;
-    if (MAYBE_SHARED(CAR(args))) SETCAR(args, duplicate(CAR(args)));
+    if (MAYBE_SHARED(CAR(args))) SETCAR(args, shallow_duplicate(CAR(args)));
     setAttrib(CAR(args), R_LevelsSymbol, CADR(args));
     UNPROTECT(1);
     return CAR(args);
@@ -711,6 +711,141 @@ static SEXP ExtractOptionals(SEXP ans, int *recurse, int *usenames, SEXP call)
 }
 
 
+/* When every element of a list or pairlist of arguments is NULL or an
+   atomic vector of one type, and no names are wanted or there are
+   none to be had, the answer is just the elements laid end to end.
+   HomogeneousType() returns that type, with the total length in *len,
+   or NILSXP if the general code is needed.  Lists whose answers have
+   R_UNLIST_THREADS_MIN or more elements are copied on
+   R_num_math_threads threads, each filling an equal block of the
+   answer from whichever elements overlap it. */
+#define R_UNLIST_THREADS_MIN 1000000
+
+static R_INLINE int unlist_nthreads(R_xlen_t n)
+{
+#ifdef _OPENMP
+    if (n >= R_UNLIST_THREADS_MIN && R_num_math_threads > 1)
+	return R_num_math_threads;
+#endif
+    return 1;
+}
+
+static R_INLINE size_t AtomicEltSize(SEXPTYPE type)
+{
+    switch (type) {
+    case LGLSXP:
+    case INTSXP:
+	return sizeof(int);
+    case REALSXP:
+	return sizeof(double);
+    case CPLXSXP:
+	return sizeof(Rcomplex);
+    case RAWSXP:
+	return sizeof(Rbyte);
+    default:
+	return 0;
+    }
+}
+
+static SEXPTYPE HomogeneousType(SEXP x, int usenames, R_xlen_t *len)
+{
+    SEXPTYPE type = NILSXP;
+    Rboolean list = TYPEOF(x) == VECSXP;
+    R_xlen_t i, n = list ? XLENGTH(x) : 0;
+    SEXP t = x, u;
+
+    if (list && usenames && getAttrib(x, R_NamesSymbol) != R_NilValue)
+	return NILSXP;
+    *len = 0;
+    for (i = 0; list ? i < n : t != R_NilValue; i++) {
+	if (list)
+	    u = VECTOR_ELT(x, i);
+	else {
+	    if (usenames && TAG(t) != R_NilValue) return NILSXP;
+	    u = CAR(t);
+	    t = CDR(t);
+	}
+	if (u == R_NilValue) continue;
+	if (type == NILSXP) {
+	    type = TYPEOF(u);
+	    if (type != STRSXP && AtomicEltSize(type) == 0) return NILSXP;
+	}
+	else if (TYPEOF(u) != type) return NILSXP;
+	if (usenames && getAttrib(u, R_NamesSymbol) != R_NilValue)
+	    return NILSXP;
+	*len += XLENGTH(u);
+    }
+    return type;
+}
+
+static SEXP HomogeneousAnswer(SEXP x, SEXPTYPE type, R_xlen_t len)
+{
+    SEXP ans = PROTECT(allocVector(type, len)), t, u;
+    Rboolean list = TYPEOF(x) == VECSXP;
+    R_xlen_t i, k, m, n = list ? XLENGTH(x) : 0, pos = 0;
+    size_t size = AtomicEltSize(type);
+    int nthreads = list && type != STRSXP ? unlist_nthreads(len) : 1;
+
+    if (nthreads > 1) {
+	const void *vmax = vmaxget();
+	R_xlen_t *from = (R_xlen_t *) R_alloc(n + 1, sizeof(R_xlen_t));
+	const char **src = (const char **) R_alloc(n, sizeof(char *));
+	char *dst = (char *) DATAPTR(ans);
+	int b;
+
+	for (i = 0; i < n; i++) {
+	    u = VECTOR_ELT(x, i);
+	    from[i] = pos;
+	    src[i] = (const char *) DATAPTR(u);
+	    pos += xlength(u);
+	}
+	from[n] = pos;
+#ifdef _OPENMP
+# pragma omp parallel for num_threads(nthreads) default(none) \
+    private(i, k, m) shared(n, len, from, src, dst, size, nthreads)
+#endif
+	for (b = 0; b < nthreads; b++) {
+	    R_xlen_t lo = len / nthreads * b,
+		hi = b == nthreads - 1 ? len : len / nthreads * (b + 1);
+	    /* the first element ending after lo */
+	    for (i = 0, k = n; i < k; ) {
+		m = i + (k - i) / 2;
+		if (from[m + 1] <= lo) i = m + 1; else k = m;
+	    }
+	    for (; i < n && from[i] < hi; i++) {
+		R_xlen_t s = from[i] > lo ? from[i] : lo,
+		    e = from[i + 1] < hi ? from[i + 1] : hi;
+		if (e > s)
+		    memcpy(dst + s * size, src[i] + (s - from[i]) * size,
+			   (e - s) * size);
+	    }
+	}
+	vmaxset(vmax);
+	UNPROTECT(1);
+	return ans;
+    }
+
+    for (i = 0, t = x; list ? i < n : t != R_NilValue; i++) {
+	if (list)
+	    u = VECTOR_ELT(x, i);
+	else {
+	    u = CAR(t);
+	    t = CDR(t);
+	}
+	if (u == R_NilValue) continue;
+	m = XLENGTH(u);
+	if (type == STRSXP)
+	    for (k = 0; k < m; k++)
+		SET_STRING_ELT(ans, pos + k, STRING_ELT(u, k));
+	else if (m > 0)
+	    memcpy((char *) DATAPTR(ans) + pos * size, DATAPTR(u), m * size);
+	pos += m;
+    }
+    UNPROTECT(1);
+    return ans;
+}
+
+
 /* The change to lists based on dotted pairs has meant that it was
    necessary to separate the internal code for "c" and "unlist".
    Although the functions are quite similar, they operate on very
@@ -759,6 +894,14 @@ SEXP attribute_hidden do_c_dflt(SEXP call, SEXP op, SEXP args, SEXP env)
        _but_ `recursive' might be the only argument */
     PROTECT(args = ExtractOptionals(args, &recurse, &usenames, call));
 
+    R_xlen_t len;
+    SEXPTYPE type = HomogeneousType(args, usenames, &len);
+    if (type != NILSXP) {
+	ans = HomogeneousAnswer(args, type, len);
+	UNPROTECT(1);
+	return ans;
+    }
+
     /* Determine the type of the returned value. */
     /* The strategy here is appropriate because the */
     /* object being operated on is a pair based list. */
@@ -875,6 +1018,16 @@ SEXP attribute_hidden do_unlist(SEXP call, SEXP op, SEXP args, SEXP env)
     data.ans_length = 0;
     data.ans_nnames = 0;
 
+    if (TYPEOF(args) == VECSXP) {
+	R_xlen_t len;
+	SEXPTYPE type = HomogeneousType(args, usenames, &len);
+	if (type != NILSXP) {
+	    ans = HomogeneousAnswer(args, type, len);
+	    UNPROTECT(1);
+	    return ans;
+	}
+    }
+
     if (isNewList(args)) {
 	n = xlength(args);
 	if (usenames && getAttrib(args, R_NamesSymbol) != R_NilValue)
@@ -404,6 +404,7 @@ SEXP attribute_hidden do_parentenvgets(SEXP call, SEXP op, SEXP args, SEXP rho)
 	error(_("'parent' is not an environment"));
 
     SET_ENCLOS(env, parent);
+    R_EnvEpoch++; /* invalidate cached lookups */
 
     return( CAR(args) );
 }
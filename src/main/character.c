@@ -88,6 +88,29 @@ abbreviate chartr make.names strtrim tolower toupper give error.
 #include "RBufferUtils.h"
 static R_StringBuffer cbuff = {NULL, 0, MAXELTSIZE};
 
+/* Map the bytes of an ASCII string through map[], for tolower(),
+   toupper() and chartr().  A negative entry marks a character whose
+   image is not ASCII (such as 'i' in Turkish locales): then NULL is
+   returned and the caller does the general conversion.  A string
+   which the map leaves unchanged is returned as it is. */
+static SEXP mapASCII(SEXP el, const int *map)
+{
+    const char *s = CHAR(el);
+    int j, len = LENGTH(el);
+
+    for (j = 0; j < len; j++)
+	if (map[(unsigned char) s[j]] != s[j]) break;
+    if (j == len) return el;
+    char *buf = R_AllocStringBuffer(len + 1, &cbuff);
+    memcpy(buf, s, j);
+    for (; j < len; j++) {
+	int c = map[(unsigned char) s[j]];
+	if (c < 0) return NULL;
+	buf[j] = (char) c;
+    }
+    return mkCharLenCE(buf, len, CE_NATIVE);
+}
+
 /* Functions to perform analogues of the standard C string library. */
 /* Most are vectorized */
 
@@ -143,7 +166,9 @@ int R_nchar(SEXP string, nchar_type type_,
 	return LENGTH(string);
 	break;
     case Chars:
-	if (IS_UTF8(string)) {
+	if (IS_ASCII(string))
+	    return LENGTH(string);
+	else if (IS_UTF8(string)) {
 	    const char *p = CHAR(string);
 	    if (!utf8Valid(p)) {
 		if (!allowNA)
@@ -255,6 +280,11 @@ SEXP attribute_hidden do_nchar(SEXP call, SEXP op, SEXP args, SEXP env)
     int *s_ = INTEGER(s);
     for (R_xlen_t i = 0; i < len; i++) {
 	SEXP sxi = STRING_ELT(x, i);
+	if (sxi != NA_STRING && type_ != Width &&
+	    (type_ == Bytes || IS_ASCII(sxi))) {
+	    s_[i] = LENGTH(sxi);
+	    continue;
+	}
 	char msg_i[20]; sprintf(msg_i, "element %ld", (long)i+1);
 	s_[i] = R_nchar(sxi, type_, allowNA, keepNA, msg_i);
     }
@@ -328,6 +358,15 @@ do_substr(SEXP call, SEXP op, SEXP args, SEXP env)
 	    }
 	    cetype_t ienc = getCharCE(el);
 	    const char *ss = CHAR(el);
+	    if (IS_ASCII(el)) { /* one byte per char: no copy needed */
+		int slen = LENGTH(el);
+		if (start < 1) start = 1;
+		if (stop > slen) stop = slen;
+		SET_STRING_ELT(s, i, start > stop ? R_BlankString :
+			       mkCharLenCE(ss + start - 1, stop - start + 1,
+					   ienc));
+		continue;
+	    }
 	    size_t slen = strlen(ss); /* FIXME -- should handle embedded nuls */
 	    char *buf = R_AllocStringBuffer(slen+1, &cbuff);
 	    if (start < 1) start = 1;
@@ -931,9 +970,9 @@ SEXP attribute_hidden do_tolower(SEXP call, SEXP op, SEXP args, SEXP env)
 {
     SEXP x, y;
     R_xlen_t i, n;
-    int ul;
+    int ul, amap[128];
     char *p;
-    SEXP el;
+    SEXP el, t;
     cetype_t ienc;
     Rboolean use_UTF8 = FALSE;
     const void *vmax;
@@ -960,11 +999,17 @@ SEXP attribute_hidden do_tolower(SEXP call, SEXP op, SEXP args, SEXP env)
 	wchar_t * wc;
 	char * cbuf;
 
+	for (j = 0; j < 128; j++) {
+	    wint_t wj = towctrans(j, tr);
+	    amap[j] = wj < 128 ? (int) wj : -1;
+	}
 	vmax = vmaxget();
 	/* the translated string need not be the same length in bytes */
 	for (i = 0; i < n; i++) {
 	    el = STRING_ELT(x, i);
 	    if (el == NA_STRING) SET_STRING_ELT(y, i, NA_STRING);
+	    else if (IS_ASCII(el) && (t = mapASCII(el, amap)) != NULL)
+		SET_STRING_ELT(y, i, t);
 	    else {
 		const char *xi;
 		ienc = getCharCE(el);
@@ -1005,10 +1050,17 @@ SEXP attribute_hidden do_tolower(SEXP call, SEXP op, SEXP args, SEXP env)
 	R_FreeStringBufferL(&cbuff);
     } else {
 	char *xi;
+	for (int j = 0; j < 128; j++) {
+	    int cj = ul ? toupper(j) : tolower(j);
+	    amap[j] = (cj >= 0 && cj < 128) ? cj : -1;
+	}
 	vmax = vmaxget();
 	for (i = 0; i < n; i++) {
-	    if (STRING_ELT(x, i) == NA_STRING)
+	    el = STRING_ELT(x, i);
+	    if (el == NA_STRING)
 		SET_STRING_ELT(y, i, NA_STRING);
+	    else if (IS_ASCII(el) && (t = mapASCII(el, amap)) != NULL)
+		SET_STRING_ELT(y, i, t);
 	    else {
 		xi = CallocCharBuf(strlen(CHAR(STRING_ELT(x, i))));
 		strcpy(xi, translateChar(STRING_ELT(x, i)));
@@ -1019,6 +1071,7 @@ SEXP attribute_hidden do_tolower(SEXP call, SEXP op, SEXP args, SEXP env)
 	    }
 	    vmaxset(vmax);
 	}
+	R_FreeStringBufferL(&cbuff);
     }
     SHALLOW_DUPLICATE_ATTRIB(y, x);
     /* This copied the class, if any */
@@ -1270,10 +1323,11 @@ static R_INLINE int xtable_key_comp(const void *a, const void *b)
 
 SEXP attribute_hidden do_chartr(SEXP call, SEXP op, SEXP args, SEXP env)
 {
-    SEXP old, _new, x, y;
+    SEXP old, _new, x, y, t;
     R_xlen_t i, n;
     char *cbuf;
     SEXP el;
+    int amap[128];
     cetype_t ienc;
     Rboolean use_UTF8 = FALSE;
     const void *vmax;
@@ -1394,12 +1448,20 @@ SEXP attribute_hidden do_chartr(SEXP call, SEXP op, SEXP args, SEXP env)
 	ISORT(xtable, xtable_cnt, xtable_t , xtable_comp);
 	COMPRESS(xtable, &xtable_cnt, xtable_t, xtable_comp);
 
+	for (j = 0; j < 128; j++) {
+	    wchar_t wj = (wchar_t) j;
+	    BSEARCH(tbl, &wj, xtable, xtable_cnt, xtable_t, xtable_key_comp);
+	    amap[j] = !tbl ? j : (tbl->c_new < 128 ? (int) tbl->c_new : -1);
+	}
+
 	PROTECT(y = allocVector(STRSXP, n));
 	vmax = vmaxget();
 	for (i = 0; i < n; i++) {
 	    el = STRING_ELT(x,i);
 	    if (el == NA_STRING)
 		SET_STRING_ELT(y, i, NA_STRING);
+	    else if (IS_ASCII(el) && (t = mapASCII(el, amap)) != NULL)
+		SET_STRING_ELT(y, i, t);
 	    else {
 		ienc = getCharCE(el);
 		if (use_UTF8 && ienc == CE_UTF8) {
@@ -1477,12 +1539,18 @@ SEXP attribute_hidden do_chartr(SEXP call, SEXP op, SEXP args, SEXP env)
 	tr_free_spec(trs_new);
 	Free(trs_old_ptr); Free(trs_new_ptr);
 
+	for (int j = 0; j < 128; j++)
+	    amap[j] = xtable[j] < 128 ? xtable[j] : -1;
+
 	n = LENGTH(x);
 	PROTECT(y = allocVector(STRSXP, n));
 	vmax = vmaxget();
 	for (i = 0; i < n; i++) {
-	    if (STRING_ELT(x,i) == NA_STRING)
+	    el = STRING_ELT(x, i);
+	    if (el == NA_STRING)
 		SET_STRING_ELT(y, i, NA_STRING);
+	    else if (IS_ASCII(el) && (t = mapASCII(el, amap)) != NULL)
+		SET_STRING_ELT(y, i, t);
 	    else {
 		const char *xi = translateChar(STRING_ELT(x, i));
 		cbuf = CallocCharBuf(strlen(xi));
@@ -1494,6 +1562,7 @@ SEXP attribute_hidden do_chartr(SEXP call, SEXP op, SEXP args, SEXP env)
 	    }
 	}
 	vmaxset(vmax);
+	R_FreeStringBufferL(&cbuff);
     }
 
     SHALLOW_DUPLICATE_ATTRIB(y, x);
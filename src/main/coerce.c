@@ -1033,13 +1033,13 @@ static SEXP coerceVectorList(SEXP v, SEXPTYPE type)
     /* expression -> list, new in R 2.4.0 */
     if (type == VECSXP && TYPEOF(v) == EXPRSXP) {
 	/* This is sneaky but saves us rewriting a lot of the duplicate code */
-	rval = MAYBE_REFERENCED(v) ? duplicate(v) : v;
+	rval = MAYBE_REFERENCED(v) ? shallow_duplicate(v) : v;
 	SET_TYPEOF(rval, VECSXP);
 	return rval;
     }
 
     if (type == EXPRSXP && TYPEOF(v) == VECSXP) {
-	rval = MAYBE_REFERENCED(v) ? duplicate(v) : v;
+	rval = MAYBE_REFERENCED(v) ? shallow_duplicate(v) : v;
 	SET_TYPEOF(rval, EXPRSXP);
 	return rval;
     }
@@ -2110,6 +2110,9 @@ static Rboolean anyNA(SEXP call, SEXP op, SEXP args, SEXP env)
     }
 
     R_xlen_t i, n = xlength(x);
+    int sorted = R_KnownSorted(x);
+    if (sorted != UNKNOWN_SORTEDNESS) /* any NAs are at one end */
+	return R_SortedAnyNA(x, sorted);
     switch (xT) {
     case REALSXP:
     {
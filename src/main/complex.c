@@ -258,10 +258,7 @@ SEXP attribute_hidden complex_binary(ARITHOP_TYPE code, SEXP s1, SEXP s2)
 
     /* Copy attributes from longer argument. */
 
-    if (ans != s2 && n == n2 && ATTRIB(s2) != R_NilValue)
-	copyMostAttrib(s2, ans);
-    if (ans != s1 && n == n1 && ATTRIB(s1) != R_NilValue)
-	copyMostAttrib(s1, ans); /* Done 2nd so s1's attrs overwrite s2's */
+    R_binaryMostAttrib(ans, s1, s2, n);
 
     return ans;
 }
@@ -509,6 +509,83 @@ void init_con(Rconnection new, const char *description, int enc,
     new->id = current_id;
     new->ex_ptr = NULL;
     new->status = NA_INTEGER;
+    new->buff = NULL;
+    new->buff_len = new->buff_stored_len = new->buff_pos = 0;
+}
+
+/* ------------------- read-ahead buffers --------------------- */
+
+/* Text-mode reading of a regular file by a file() or gzfile()
+   connection without re-encoding is done a block at a time through
+   con->read into con->buff, rather than by a call of con->fgetc per
+   byte.  The read and seek methods of those classes allow for the
+   bytes read ahead. */
+
+#ifdef HAVE_SYS_STAT_H
+# include <sys/stat.h>
+#endif
+
+#define RBUFFCON_LEN_DEFAULT 65536
+
+/* len is the size asked for by the 'buffer' argument, 0 for the default */
+static void set_buffer(Rconnection con, size_t len)
+{
+    if(!len) len = RBUFFCON_LEN_DEFAULT;
+    if(con->canread && !con->canwrite && con->text && !con->inconv &&
+       !con->buff) {
+	con->buff = (unsigned char *) malloc(len);
+	if(con->buff) con->buff_len = len;
+    }
+    con->buff_stored_len = con->buff_pos = 0;
+}
+
+static void free_buffer(Rconnection con)
+{
+    free(con->buff);
+    con->buff = NULL;
+    con->buff_len = con->buff_stored_len = con->buff_pos = 0;
+}
+
+/* the number of bytes read ahead but not yet consumed */
+static R_INLINE size_t buff_unread(Rconnection con)
+{
+    return con->buff_stored_len - con->buff_pos;
+}
+
+static size_t buff_drain(Rconnection con, void *ptr, size_t n)
+{
+    if(n > buff_unread(con)) n = buff_unread(con);
+    memcpy(ptr, con->buff + con->buff_pos, n);
+    con->buff_pos += n;
+    return n;
+}
+
+/* refill an empty buffer, returning the number of bytes now in it */
+static size_t buff_fill(Rconnection con)
+{
+    size_t n;
+    con->buff_stored_len = con->buff_pos = 0;
+    n = con->read(con->buff, 1, con->buff_len, con);
+    if(n > con->buff_len) n = 0; /* an error */
+    return con->buff_stored_len = n;
+}
+
+static int buff_fgetc(Rconnection con)
+{
+    if(con->buff_pos >= con->buff_stored_len && !buff_fill(con))
+	return R_EOF;
+    return con->buff[con->buff_pos++];
+}
+
+static Rboolean is_regular_file(const char *name, FILE *fp)
+{
+#ifdef HAVE_SYS_STAT_H
+    struct stat sb;
+    return (fp ? fstat(fileno(fp), &sb) : stat(name, &sb)) == 0 &&
+	S_ISREG(sb.st_mode);
+#else
+    return FALSE;
+#endif
 }
 
 /* ------------------- file connections --------------------- */
@@ -536,6 +613,8 @@ typedef struct fileconn {
     OFF_T rpos, wpos;
     Rboolean last_was_write;
     Rboolean raw;
+    size_t bufsize; /* from the 'buffer' argument, 0 for the default */
+    char *vbuf;
 #ifdef Win32
     Rboolean anon_file;
     char name[PATH_MAX+1];
@@ -586,6 +665,11 @@ static Rboolean file_open(Rconnection con)
 	warning(_("cannot open file '%s': %s"), name, strerror(errno));
 	return FALSE;
     }
+    /* a larger stdio buffer for latency-bound (e.g. network) file systems:
+       glibc ignores the size unless the buffer is supplied */
+    if(this->bufsize > 0 && strcmp(name, "stdin") &&
+       (this->vbuf = (char *) malloc(this->bufsize)))
+	setvbuf(fp, this->vbuf, _IOFBF, this->bufsize);
     if(temp) {
 	/* This will fail on Windows, so arrange to remove in
 	 * file_close.  An alternative strategy would be to manipulate
@@ -618,6 +702,13 @@ static Rboolean file_open(Rconnection con)
     else con->text = TRUE;
     con->save = -1000;
     set_iconv(con);
+    if(con->blocking && is_regular_file(name, fp))
+	set_buffer(con, this->bufsize);
+#ifdef POSIX_FADV_SEQUENTIAL
+    /* ask the OS to read ahead more aggressively */
+    if(this->bufsize > 0 && con->canread && !con->canwrite)
+	(void) posix_fadvise(fileno(fp), 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
 
 #ifdef HAVE_FCNTL
     if(!con->blocking) {
@@ -636,6 +727,9 @@ static void file_close(Rconnection con)
     if(con->isopen && strcmp(con->description, "stdin"))
 	con->status = fclose(this->fp);
     con->isopen = FALSE;
+    free_buffer(con);
+    free(this->vbuf);
+    this->vbuf = NULL;
 #ifdef Win32
     if(this->anon_file) unlink(this->name);
 #endif
@@ -676,8 +770,8 @@ static double file_seek(Rconnection con, double where, int origin, int rw)
     OFF_T pos;
     int whence = SEEK_SET;
 
-    /* make sure both positions are set */
-    pos = f_tell(fp);
+    /* make sure both positions are set, allowing for read-ahead */
+    pos = f_tell(fp) - (OFF_T) buff_unread(con);
     if(this->last_was_write) this->wpos = pos; else this->rpos = pos;
     if(rw == 1) {
 	if(!con->canread) error(_("connection is not open for reading"));
@@ -702,6 +796,8 @@ static double file_seek(Rconnection con, double where, int origin, int rw)
 	    break;
     default: whence = SEEK_SET;
     }
+    if(whence == SEEK_CUR) where -= (double) buff_unread(con);
+    con->buff_stored_len = con->buff_pos = 0;
     f_seek(fp, (OFF_T) where, whence);
     if(this->last_was_write) this->wpos = f_tell(this->fp);
     else this->rpos = f_tell(this->fp);
@@ -755,6 +851,10 @@ static size_t file_read(void *ptr, size_t size, size_t nitems,
 	this->last_was_write = FALSE;
 	f_seek(this->fp, this->rpos, SEEK_SET);
     }
+    if(buff_unread(con)) {
+	size_t n = buff_drain(con, ptr, size * nitems);
+	return (n + fread((char *) ptr + n, 1, size * nitems - n, fp)) / size;
+    }
     return fread(ptr, size, nitems, fp);
 }
 
@@ -807,6 +907,8 @@ static Rconnection newfile(const char *description, int enc, const char *mode,
 	error(_("allocation of file connection failed"));
     }
     ((Rfileconn)(new->private))->raw = raw;
+    ((Rfileconn)(new->private))->bufsize = 0;
+    ((Rfileconn)(new->private))->vbuf = NULL;
     return new;
 }
 
@@ -1428,6 +1530,14 @@ SEXP attribute_hidden do_pipe(SEXP call, SEXP op, SEXP args, SEXP env)
 
 #include "gzio.h"
 
+/* getOption("compress.threads"): the number of threads to use for gzip
+   and xz compression by file connections and the lazy-load DB. */
+static int compressThreads(void)
+{
+    int n = asInteger(GetOption1(install("compress.threads")));
+    return (n == NA_INTEGER || n < 1) ? 1 : n;
+}
+
 /* needs to be declared before con_close1 */
 typedef struct gzconn {
     Rconnection con;
@@ -1445,6 +1555,7 @@ typedef struct gzconn {
 typedef struct gzfileconn {
     void *fp;
     int compress;
+    size_t bufsize; /* from the 'buffer' argument, 0 for the default */
 } *Rgzfileconn;
 
 static Rboolean gzfile_open(Rconnection con)
@@ -1459,18 +1570,24 @@ static Rboolean gzfile_open(Rconnection con)
     else if (con->mode[0] == 'a') snprintf(mode, 6, "ab%1d", gzcon->compress);
     else strcpy(mode, "rb");
     errno = 0; /* precaution */
-    fp = R_gzopen(R_ExpandFileName(con->description), mode);
+    fp = R_gzopen_buf(R_ExpandFileName(con->description), mode,
+		      gzcon->bufsize);
     if(!fp) {
 	warning(_("cannot open compressed file '%s', probable reason '%s'"),
 		R_ExpandFileName(con->description), strerror(errno));
 	return FALSE;
     }
+#ifdef _OPENMP
+    R_gzsetthreads(fp, compressThreads());
+#endif
     ((Rgzfileconn)(con->private))->fp = fp;
     con->isopen = TRUE;
     con->canwrite = (con->mode[0] == 'w' || con->mode[0] == 'a');
     con->canread = !con->canwrite;
     con->text = strchr(con->mode, 'b') ? FALSE : TRUE;
     set_iconv(con);
+    if(is_regular_file(R_ExpandFileName(con->description), NULL))
+	set_buffer(con, gzcon->bufsize);
     con->save = -1000;
     return TRUE;
 }
@@ -1479,6 +1596,7 @@ static void gzfile_close(Rconnection con)
 {
     R_gzclose(((Rgzfileconn)(con->private))->fp);
     con->isopen = FALSE;
+    free_buffer(con);
 }
 
 static int gzfile_fgetc_internal(Rconnection con)
@@ -1494,7 +1612,7 @@ static int gzfile_fgetc_internal(Rconnection con)
 static double gzfile_seek(Rconnection con, double where, int origin, int rw)
 {
     gzFile  fp = ((Rgzfileconn)(con->private))->fp;
-    Rz_off_t pos = R_gztell(fp);
+    Rz_off_t pos = R_gztell(fp) - (Rz_off_t) buff_unread(con);
     int res, whence = SEEK_SET;
 
     if (ISNA(where)) return (double) pos;
@@ -1504,6 +1622,8 @@ static double gzfile_seek(Rconnection con, double where, int origin, int rw)
     case 3: error(_("whence = \"end\" is not implemented for gzfile connections"));
     default: whence = SEEK_SET;
     }
+    if(whence == SEEK_CUR) where -= (double) buff_unread(con);
+    con->buff_stored_len = con->buff_pos = 0;
     res = R_gzseek(fp, (z_off_t) where, whence);
     if(res == -1)
 	warning(_("seek on a gzfile connection returned an internal error"));
@@ -1522,6 +1642,11 @@ static size_t gzfile_read(void *ptr, size_t size, size_t nitems,
     /* uses 'unsigned' for len */
     if ((double) size * (double) nitems > UINT_MAX)
 	error(_("too large a block specified"));
+    if(buff_unread(con)) {
+	size_t n = buff_drain(con, ptr, size * nitems);
+	int m = R_gzread(fp, (char *) ptr + n, (unsigned int)(size*nitems - n));
+	return (n + (m > 0 ? m : 0))/size;
+    }
     return R_gzread(fp, ptr, (unsigned int)(size*nitems))/size;
 }
 
@@ -1570,6 +1695,7 @@ static Rconnection newgzfile(const char *description, const char *mode,
 	error(_("allocation of gzfile connection failed"));
     }
     ((Rgzfileconn)new->private)->compress = compress;
+    ((Rgzfileconn)new->private)->bufsize = 0;
     return new;
 }
 
@@ -1808,6 +1934,15 @@ static Rboolean xzfile_open(Rconnection con)
 	xz->filters[0].options = &(xz->opt_lzma);
 	xz->filters[1].id = LZMA_VLI_UNKNOWN;
 
+#if LZMA_VERSION >= 50020022U /* 5.2.2 */
+	int nthreads = compressThreads();
+	if (nthreads > 1) {
+	    lzma_mt mt = { .threads = (uint32_t) nthreads,
+			   .filters = xz->filters,
+			   .check = LZMA_CHECK_CRC32 };
+	    ret = lzma_stream_encoder_mt(strm, &mt);
+	} else
+#endif
 	ret = lzma_stream_encoder(strm, xz->filters, LZMA_CHECK_CRC32);
 	if (ret != LZMA_OK) {
 	    warning(_("cannot initialize lzma encoder, error %d"), ret);
@@ -1973,7 +2108,391 @@ newxzfile(const char *description, const char *mode, int type, int compress)
     return new;
 }
 
-/* op 0 is gzfile, 1 is bzfile, 2 is xv/lzma */
+/* zstd and lz4 frame file connections: these need the optional
+   libraries found by configure */
+
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#include <zstd_errors.h>
+
+typedef struct zstdfileconn {
+    FILE *fp;
+    ZSTD_CCtx *cctx;
+    ZSTD_DStream *dctx;
+    int compress;
+    ZSTD_inBuffer in; /* buffered input when reading */
+    Rboolean eof;
+    unsigned char buf[BUFSIZE];
+} *Rzstdfileconn;
+
+static Rboolean zstdfile_open(Rconnection con)
+{
+    Rzstdfileconn zs = con->private;
+    char mode[] = "rb";
+
+    con->canwrite = (con->mode[0] == 'w' || con->mode[0] == 'a');
+    con->canread = !con->canwrite;
+    mode[0] = con->mode[0];
+    errno = 0; /* precaution */
+    zs->fp = R_fopen(R_ExpandFileName(con->description), mode);
+    if(!zs->fp) {
+	warning(_("cannot open compressed file '%s', probable reason '%s'"),
+		R_ExpandFileName(con->description), strerror(errno));
+	return FALSE;
+    }
+    if(con->canread) {
+	zs->dctx = ZSTD_createDStream();
+	if(!zs->dctx || ZSTD_isError(ZSTD_initDStream(zs->dctx))) {
+	    warning(_("cannot initialize zstd decoder"));
+	    fclose(zs->fp);
+	    return FALSE;
+	}
+	zs->in.src = zs->buf;
+	zs->in.size = zs->in.pos = 0;
+	zs->eof = FALSE;
+    } else {
+	zs->cctx = ZSTD_createCCtx();
+	if(!zs->cctx ||
+	   ZSTD_isError(ZSTD_CCtx_setParameter(zs->cctx,
+					       ZSTD_c_compressionLevel,
+					       zs->compress))) {
+	    warning(_("cannot initialize zstd encoder"));
+	    fclose(zs->fp);
+	    return FALSE;
+	}
+	/* fails harmlessly if libzstd was built without threads */
+	int nthreads = compressThreads();
+	if (nthreads > 1)
+	    ZSTD_CCtx_setParameter(zs->cctx, ZSTD_c_nbWorkers, nthreads);
+    }
+    con->isopen = TRUE;
+    con->text = strchr(con->mode, 'b') ? FALSE : TRUE;
+    set_iconv(con);
+    con->save = -1000;
+    return TRUE;
+}
+
+static void zstdfile_close(Rconnection con)
+{
+    Rzstdfileconn zs = con->private;
+
+    if(con->canwrite) {
+	unsigned char buf[BUFSIZE];
+	ZSTD_inBuffer in = { NULL, 0, 0 };
+	size_t left;
+	do {
+	    ZSTD_outBuffer out = { buf, BUFSIZE, 0 };
+	    left = ZSTD_compressStream2(zs->cctx, &out, &in, ZSTD_e_end);
+	    if (ZSTD_isError(left)) {
+		warning("zstd encoding error '%s'", ZSTD_getErrorName(left));
+		break;
+	    }
+	    if (fwrite(buf, 1, out.pos, zs->fp) != out.pos)
+		error("fwrite error");
+	} while (left);
+	ZSTD_freeCCtx(zs->cctx);
+	zs->cctx = NULL;
+    } else {
+	ZSTD_freeDStream(zs->dctx);
+	zs->dctx = NULL;
+    }
+    fclose(zs->fp);
+    con->isopen = FALSE;
+}
+
+static size_t zstdfile_read(void *ptr, size_t size, size_t nitems,
+			    Rconnection con)
+{
+    Rzstdfileconn zs = con->private;
+    ZSTD_outBuffer out = { ptr, size*nitems, 0 };
+
+    if (!out.size) return 0;
+
+    while (out.pos < out.size) {
+	size_t before = out.pos, res;
+	if (zs->in.pos == zs->in.size && !zs->eof) {
+	    zs->in.size = fread(zs->buf, 1, BUFSIZE, zs->fp);
+	    zs->in.pos = 0;
+	    if (zs->in.size == 0) zs->eof = TRUE;
+	}
+	res = ZSTD_decompressStream(zs->dctx, &out, &zs->in);
+	if (ZSTD_isError(res)) {
+	    warning("zstd decoding error '%s'", ZSTD_getErrorName(res));
+	    break;
+	}
+	if (zs->eof && out.pos == before) break;
+    }
+    return out.pos/size;
+}
+
+static int zstdfile_fgetc_internal(Rconnection con)
+{
+    char buf[1];
+    size_t size = zstdfile_read(buf, 1, 1, con);
+
+    return (size < 1) ? R_EOF : (buf[0] % 256);
+}
+
+static size_t zstdfile_write(const void *ptr, size_t size, size_t nitems,
+			     Rconnection con)
+{
+    Rzstdfileconn zs = con->private;
+    ZSTD_inBuffer in = { ptr, size*nitems, 0 };
+    unsigned char buf[BUFSIZE];
+
+    if (!in.size) return 0;
+
+    while (in.pos < in.size) {
+	ZSTD_outBuffer out = { buf, BUFSIZE, 0 };
+	size_t res = ZSTD_compressStream2(zs->cctx, &out, &in,
+					  ZSTD_e_continue);
+	if (ZSTD_isError(res)) {
+	    warning("zstd encoding error '%s'", ZSTD_getErrorName(res));
+	    return 0;
+	}
+	if (fwrite(buf, 1, out.pos, zs->fp) != out.pos)
+	    error("fwrite error");
+    }
+    return nitems;
+}
+#endif
+
+#ifdef HAVE_LZ4
+#include <lz4frame.h>
+#include <lz4hc.h>
+
+typedef struct lz4fileconn {
+    FILE *fp;
+    LZ4F_cctx *cctx;
+    LZ4F_dctx *dctx;
+    LZ4F_preferences_t prefs;
+    int compress;
+    unsigned char *obuf; /* compressed output when writing */
+    size_t ocap;
+    size_t pos, size; /* buffered input when reading */
+    Rboolean eof;
+    unsigned char buf[BUFSIZE];
+} *Rlz4fileconn;
+
+static Rboolean lz4file_open(Rconnection con)
+{
+    Rlz4fileconn lz = con->private;
+    char mode[] = "rb";
+
+    con->canwrite = (con->mode[0] == 'w' || con->mode[0] == 'a');
+    con->canread = !con->canwrite;
+    mode[0] = con->mode[0];
+    errno = 0; /* precaution */
+    lz->fp = R_fopen(R_ExpandFileName(con->description), mode);
+    if(!lz->fp) {
+	warning(_("cannot open compressed file '%s', probable reason '%s'"),
+		R_ExpandFileName(con->description), strerror(errno));
+	return FALSE;
+    }
+    if(con->canread) {
+	if(LZ4F_isError(LZ4F_createDecompressionContext(&lz->dctx,
+							 LZ4F_VERSION))) {
+	    warning(_("cannot initialize lz4 decoder"));
+	    fclose(lz->fp);
+	    return FALSE;
+	}
+	lz->pos = lz->size = 0;
+	lz->eof = FALSE;
+    } else {
+	size_t res;
+	memset(&lz->prefs, 0, sizeof(lz->prefs));
+	lz->prefs.compressionLevel = lz->compress;
+	lz->prefs.frameInfo.contentChecksumFlag = LZ4F_contentChecksumEnabled;
+	/* room for a header, the compression of BUFSIZE bytes or the end */
+	lz->ocap = LZ4F_compressBound(BUFSIZE, &lz->prefs) + LZ4F_HEADER_SIZE_MAX;
+	lz->obuf = malloc(lz->ocap);
+	if(!lz->obuf ||
+	   LZ4F_isError(LZ4F_createCompressionContext(&lz->cctx,
+						       LZ4F_VERSION))) {
+	    warning(_("cannot initialize lz4 encoder"));
+	    free(lz->obuf); lz->obuf = NULL;
+	    fclose(lz->fp);
+	    return FALSE;
+	}
+	res = LZ4F_compressBegin(lz->cctx, lz->obuf, lz->ocap, &lz->prefs);
+	if(LZ4F_isError(res) || fwrite(lz->obuf, 1, res, lz->fp) != res) {
+	    warning(_("cannot initialize lz4 encoder"));
+	    LZ4F_freeCompressionContext(lz->cctx);
+	    free(lz->obuf); lz->obuf = NULL;
+	    fclose(lz->fp);
+	    return FALSE;
+	}
+    }
+    con->isopen = TRUE;
+    con->text = strchr(con->mode, 'b') ? FALSE : TRUE;
+    set_iconv(con);
+    con->save = -1000;
+    return TRUE;
+}
+
+static void lz4file_close(Rconnection con)
+{
+    Rlz4fileconn lz = con->private;
+
+    if(con->canwrite) {
+	size_t res = LZ4F_compressEnd(lz->cctx, lz->obuf, lz->ocap, NULL);
+	if (LZ4F_isError(res))
+	    warning("lz4 encoding error '%s'", LZ4F_getErrorName(res));
+	else if (fwrite(lz->obuf, 1, res, lz->fp) != res)
+	    error("fwrite error");
+	LZ4F_freeCompressionContext(lz->cctx);
+	free(lz->obuf); lz->obuf = NULL;
+    } else
+	LZ4F_freeDecompressionContext(lz->dctx);
+    fclose(lz->fp);
+    con->isopen = FALSE;
+}
+
+static size_t lz4file_read(void *ptr, size_t size, size_t nitems,
+			   Rconnection con)
+{
+    Rlz4fileconn lz = con->private;
+    size_t s = size*nitems, given = 0;
+    unsigned char *p = ptr;
+
+    if (!s) return 0;
+
+    while (given < s) {
+	size_t dsize = s - given, ssize, res;
+	if (lz->pos == lz->size && !lz->eof) {
+	    lz->size = fread(lz->buf, 1, BUFSIZE, lz->fp);
+	    lz->pos = 0;
+	    if (lz->size == 0) lz->eof = TRUE;
+	}
+	ssize = lz->size - lz->pos;
+	res = LZ4F_decompress(lz->dctx, p + given, &dsize,
+			      lz->buf + lz->pos, &ssize, NULL);
+	if (LZ4F_isError(res)) {
+	    warning("lz4 decoding error '%s'", LZ4F_getErrorName(res));
+	    break;
+	}
+	lz->pos += ssize;
+	given += dsize;
+	if (lz->eof && dsize == 0) break;
+    }
+    return given/size;
+}
+
+static int lz4file_fgetc_internal(Rconnection con)
+{
+    char buf[1];
+    size_t size = lz4file_read(buf, 1, 1, con);
+
+    return (size < 1) ? R_EOF : (buf[0] % 256);
+}
+
+static size_t lz4file_write(const void *ptr, size_t size, size_t nitems,
+			    Rconnection con)
+{
+    Rlz4fileconn lz = con->private;
+    size_t s = size*nitems, done = 0;
+    const unsigned char *p = ptr;
+
+    if (!s) return 0;
+
+    while (done < s) {
+	size_t this = s - done < BUFSIZE ? s - done : BUFSIZE;
+	size_t res = LZ4F_compressUpdate(lz->cctx, lz->obuf, lz->ocap,
+					 p + done, this, NULL);
+	if (LZ4F_isError(res)) {
+	    warning("lz4 encoding error '%s'", LZ4F_getErrorName(res));
+	    return 0;
+	}
+	if (fwrite(lz->obuf, 1, res, lz->fp) != res)
+	    error("fwrite error");
+	done += this;
+    }
+    return nitems;
+}
+#endif
+
+/* op 3 is zstd, 4 is lz4 */
+static Rconnection
+newzfile(const char *description, const char *mode, int type, int compress)
+{
+    Rconnection new;
+    const char *class = (type == 3) ? "zstdfile" : "lz4file";
+    size_t psize = 0;
+
+    new = (Rconnection) malloc(sizeof(struct Rconn));
+    if(!new) error(_("allocation of %s connection failed"), class);
+    new->class = (char *) malloc(strlen(class) + 1);
+    if(!new->class) {
+	free(new);
+	error(_("allocation of %s connection failed"), class);
+    }
+    strcpy(new->class, class);
+    new->description = (char *) malloc(strlen(description) + 1);
+    if(!new->description) {
+	free(new->class); free(new);
+	error(_("allocation of %s connection failed"), class);
+    }
+    init_con(new, description, CE_NATIVE, mode);
+
+    new->canseek = FALSE;
+    new->vfprintf = &dummy_vfprintf;
+    new->fgetc = &dummy_fgetc;
+    new->seek = &null_seek;
+    new->fflush = &null_fflush;
+    if (type == 3) {
+#ifdef HAVE_ZSTD
+	new->open = &zstdfile_open;
+	new->close = &zstdfile_close;
+	new->fgetc_internal = &zstdfile_fgetc_internal;
+	new->read = &zstdfile_read;
+	new->write = &zstdfile_write;
+	psize = sizeof(struct zstdfileconn);
+#endif
+    } else {
+#ifdef HAVE_LZ4
+	new->open = &lz4file_open;
+	new->close = &lz4file_close;
+	new->fgetc_internal = &lz4file_fgetc_internal;
+	new->read = &lz4file_read;
+	new->write = &lz4file_write;
+	psize = sizeof(struct lz4fileconn);
+#endif
+    }
+    new->private = (void *) malloc(psize);
+    if(!new->private) {
+	free(new->description); free(new->class); free(new);
+	error(_("allocation of %s connection failed"), class);
+    }
+    memset(new->private, 0, psize);
+#ifdef HAVE_ZSTD
+    if (type == 3) ((Rzstdfileconn) new->private)->compress = compress;
+#endif
+#ifdef HAVE_LZ4
+    if (type == 4) ((Rlz4fileconn) new->private)->compress = compress;
+#endif
+    return new;
+}
+
+/* op 0 is gzfile, 1 is bzfile, 2 is xv/lzma, 3 is zstd, 4 is lz4 */
+/* The 'buffer' argument of file() and gzfile(): a size in bytes for
+   the stdio and read-ahead buffers, 0 for the defaults. */
+static size_t asBufferSize(SEXP sbuf)
+{
+    double b = asReal(sbuf);
+    if(!R_FINITE(b) || b < 0 || b > INT_MAX)
+	error(_("invalid '%s' argument"), "buffer");
+    return (size_t) b;
+}
+
+/* This is ignored for the other classes file() can create. */
+static void set_bufsize(Rconnection con, size_t size)
+{
+    if(streql(con->class, "file"))
+	((Rfileconn)con->private)->bufsize = size;
+    else if(streql(con->class, "gzfile"))
+	((Rgzfileconn)con->private)->bufsize = size;
+}
+
 SEXP attribute_hidden do_gzfile(SEXP call, SEXP op, SEXP args, SEXP env)
 {
     SEXP sfile, sopen, ans, class, enc;
@@ -1982,6 +2501,7 @@ SEXP attribute_hidden do_gzfile(SEXP call, SEXP op, SEXP args, SEXP env)
     Rconnection con = NULL;
     int type = PRIMVAL(op);
     int subtype = 0;
+    size_t bufsize = 0;
 
     checkArity(op, args);
     sfile = CAR(args);
@@ -2002,11 +2522,18 @@ SEXP attribute_hidden do_gzfile(SEXP call, SEXP op, SEXP args, SEXP env)
 	if(compress == NA_LOGICAL || compress < 0 || compress > 9)
 	    error(_("invalid '%s' argument"), "compress");
     }
+    if(type == 0) bufsize = asBufferSize(CAD4R(args));
     if(type == 2) {
 	compress = asInteger(CADDDR(args));
 	if(compress == NA_LOGICAL || abs(compress) > 9)
 	    error(_("invalid '%s' argument"), "compress");
     }
+    if(type > 2) {
+	compress = asInteger(CADDDR(args));
+	if(compress == NA_LOGICAL || compress < 0 ||
+	   compress > (type == 3 ? 22 : 12))
+	    error(_("invalid '%s' argument"), "compress");
+    }
     open = CHAR(STRING_ELT(sopen, 0)); /* ASCII */
     if (type == 0 && (!open[0] || open[0] == 'r')) {
 	/* check magic no */
@@ -2024,14 +2551,25 @@ SEXP attribute_hidden do_gzfile(SEXP call, SEXP op, SEXP args, SEXP env)
 		if(!memcmp(buf, "]\0\0\200\0", 5)) {
 		    type = 2; subtype = 1;
 		}
+		if(!memcmp(buf, "\x28\xb5\x2f\xfd", 4)) type = 3;
+		if(!memcmp(buf, "\x04\x22\x4d\x18", 4)) type = 4;
 		if((buf[0] == '\x89') && !strncmp(buf+1, "LZO", 3))
 		    error(_("this is a %s-compressed file which this build of R does not support"), "lzop");
 	    }
 	}
     }
+#ifndef HAVE_ZSTD
+    if (type == 3)
+	error(_("this build of R does not support %s compression"), "zstd");
+#endif
+#ifndef HAVE_LZ4
+    if (type == 4)
+	error(_("this build of R does not support %s compression"), "lz4");
+#endif
     switch(type) {
     case 0:
 	con = newgzfile(file, strlen(open) ? open : "rb", compress);
+	set_bufsize(con, bufsize);
 	break;
     case 1:
 	con = newbzfile(file, strlen(open) ? open : "rb", compress);
@@ -2039,6 +2577,10 @@ SEXP attribute_hidden do_gzfile(SEXP call, SEXP op, SEXP args, SEXP env)
     case 2:
 	con = newxzfile(file, strlen(open) ? open : "rb", subtype, compress);
 	break;
+    case 3:
+    case 4:
+	con = newzfile(file, strlen(open) ? open : "rb", type, compress);
+	break;
     }
     ncon = NextConnection();
     Connections[ncon] = con;
@@ -2071,6 +2613,12 @@ SEXP attribute_hidden do_gzfile(SEXP call, SEXP op, SEXP args, SEXP env)
     case 2:
 	SET_STRING_ELT(class, 0, mkChar("xzfile"));
 	break;
+    case 3:
+	SET_STRING_ELT(class, 0, mkChar("zstdfile"));
+	break;
+    case 4:
+	SET_STRING_ELT(class, 0, mkChar("lz4file"));
+	break;
     }
     SET_STRING_ELT(class, 1, mkChar("connection"));
     classgets(ans, class);
@@ -3445,9 +3993,9 @@ int Rconn_fgetc(Rconnection con)
 	    con->save = -1000;
 	    return c;
 	}
-	c = con->fgetc(con);
+	c = con->buff ? buff_fgetc(con) : con->fgetc(con);
 	if (c == '\r') {
-	    c = con->fgetc(con);
+	    c = con->buff ? buff_fgetc(con) : con->fgetc(con);
 	    if (c != '\n') {
 		con->save = (c != '\r') ? c : '\n';
 		return('\n');
@@ -3482,7 +4030,7 @@ int Rconn_getline(Rconnection con, char *buf, int bufsize)
 {
     int c, nbuf = -1;
 
-    while((c = Rconn_fgetc(con)) != R_EOF) {
+    while((c = Rconn_fgetc_buff(con)) != R_EOF) {
 	if(nbuf+1 >= bufsize) error(_("line longer than buffer size"));
 	if(c != '\n'){
 	    buf[++nbuf] = (char) c;
@@ -3522,10 +4070,74 @@ static void con_cleanup(void *data)
 
 /* readLines(con = stdin(), n = 1, ok = TRUE, warn = TRUE) */
 #define BUF_SIZE 1000
+/* readLines() collects up to READLINES_BATCH lines in a buffer of
+   READLINES_BATCH_BYTES bytes and makes their CHARSXPs together with
+   R_mkCharLenCEVec(), which hashes large batches on several threads. */
+#define READLINES_BATCH 16384
+#define READLINES_BATCH_BYTES 1048576
+
+/* The loop over Rconn_fgetc() in do_readLines(), for a connection with
+   a read-ahead buffer and nothing saved or pushed back: the bytes up to
+   the next CR or LF are found by memchr() and copied as a block.  As in
+   Rconn_fgetc(), CR and CRLF end a line too.  Returns '\n' or R_EOF. */
+static int buff_readline(Rconnection con, char **pbuf, int *pbuf_size,
+			 int *pnbuf, int skipNul)
+{
+    char *buf = *pbuf;
+    int buf_size = *pbuf_size, nbuf = 0, c = R_EOF;
+
+    while(con->buff_pos < con->buff_stored_len || buff_fill(con)) {
+	unsigned char *p = con->buff + con->buff_pos,
+	    *end = con->buff + con->buff_stored_len, *q, *r;
+	size_t len;
+
+	q = memchr(p, '\n', end - p);
+	r = memchr(p, '\r', (q ? q : end) - p);
+	if(r) q = r;
+	len = (q ? q : end) - p;
+	if(nbuf + (double) len >= INT_MAX)
+	    error(_("line longer than buffer size"));
+	while(nbuf + (int) len >= buf_size) { /* space for the terminator */
+	    char *tmp = (char *) realloc(buf, 2 * (size_t) buf_size);
+	    if(!tmp) {
+		free(buf);
+		error(_("cannot allocate buffer in readLines"));
+	    }
+	    buf = tmp;
+	    buf_size *= 2;
+	}
+	if(skipNul) {
+	    for(size_t k = 0; k < len; k++)
+		if(p[k]) buf[nbuf++] = (char) p[k];
+	} else {
+	    memcpy(buf + nbuf, p, len);
+	    nbuf += (int) len;
+	}
+	con->buff_pos += len;
+	if(q) {
+	    con->buff_pos++;
+	    if(*q == '\r') {
+		c = buff_fgetc(con);
+		if(c != '\n') con->save = (c != '\r') ? c : '\n';
+	    }
+	    c = '\n';
+	    break;
+	}
+    }
+    *pbuf = buf;
+    *pbuf_size = buf_size;
+    *pnbuf = nbuf;
+    return c;
+}
+
 SEXP attribute_hidden do_readLines(SEXP call, SEXP op, SEXP args, SEXP env)
 {
     SEXP ans = R_NilValue, ans2;
     int ok, warn, skipNul, c, nbuf, buf_size = BUF_SIZE;
+    char *batch;
+    const char **bptr;
+    int *blen, nbatch = 0, batchused = 0;
+    R_xlen_t batch0 = 0;
     int oenc = CE_NATIVE;
     Rconnection con = NULL;
     Rboolean wasopen;
@@ -3579,6 +4191,15 @@ SEXP attribute_hidden do_readLines(SEXP call, SEXP op, SEXP args, SEXP env)
     if(con->UTF8out || streql(encoding, "UTF-8")) oenc = CE_UTF8;
     else if(streql(encoding, "latin1")) oenc = CE_LATIN1;
 
+#define FLUSH_LINES							\
+    if (nbatch) {							\
+	R_mkCharLenCEVec(ans, batch0, bptr, blen, nbatch, oenc);	\
+	nbatch = batchused = 0;						\
+    }
+
+    batch = R_alloc(READLINES_BATCH_BYTES, sizeof(char));
+    bptr = (const char **) R_alloc(READLINES_BATCH, sizeof(char *));
+    blen = (int *) R_alloc(READLINES_BATCH, sizeof(int));
     buf = (char *) malloc(buf_size);
     if(!buf)
 	error(_("cannot allocate buffer in readLines"));
@@ -3589,6 +4210,7 @@ SEXP attribute_hidden do_readLines(SEXP call, SEXP op, SEXP args, SEXP env)
 	if(nread >= nn) {
 	    double dnn = 2.* nn;
 	    if (dnn > R_XLEN_T_MAX) error("too many items");
+	    FLUSH_LINES
 	    ans2 = allocVector(STRSXP, 2*nn);
 	    for(i = 0; i < nn; i++)
 		SET_STRING_ELT(ans2, i, STRING_ELT(ans, i));
@@ -3597,33 +4219,50 @@ SEXP attribute_hidden do_readLines(SEXP call, SEXP op, SEXP args, SEXP env)
 	    PROTECT(ans = ans2);
 	}
 	nbuf = 0;
-	while((c = Rconn_fgetc(con)) != R_EOF) {
-	    if(nbuf == buf_size-1) {  /* need space for the terminator */
-		buf_size *= 2;
-		char *tmp = (char *) realloc(buf, buf_size);
-		if(!buf) {
-		    free(buf);
-		    error(_("cannot allocate buffer in readLines"));
-		} else buf = tmp;
+	if(con->buff && con->save == -1000 && con->save2 == -1000 &&
+	   con->nPushBack <= 0)
+	    c = buff_readline(con, &buf, &buf_size, &nbuf, skipNul);
+	else
+	    while((c = Rconn_fgetc_buff(con)) != R_EOF) {
+		if(nbuf == buf_size-1) {  /* need space for the terminator */
+		    buf_size *= 2;
+		    char *tmp = (char *) realloc(buf, buf_size);
+		    if(!buf) {
+			free(buf);
+			error(_("cannot allocate buffer in readLines"));
+		    } else buf = tmp;
+		}
+		if(skipNul && c == '\0') continue;
+		if(c != '\n') buf[nbuf++] = (char) c; else break;
 	    }
-	    if(skipNul && c == '\0') continue;
-	    if(c != '\n') buf[nbuf++] = (char) c; else break;
-	}
 	buf[nbuf] = '\0';
 	/* Remove UTF-8 BOM */
 	const char *qbuf = buf;
 	if (nread == 0 && utf8locale &&
 	    !memcmp(buf, "\xef\xbb\xbf", 3)) qbuf = buf + 3;
-	SET_STRING_ELT(ans, nread, mkCharCE(qbuf, oenc));
+	int len = (int) strlen(qbuf);
+	if (len > READLINES_BATCH_BYTES - batchused) FLUSH_LINES
+	if (len > READLINES_BATCH_BYTES)
+	    SET_STRING_ELT(ans, nread, mkCharLenCE(qbuf, len, oenc));
+	else {
+	    if (!nbatch) batch0 = nread;
+	    memcpy(batch + batchused, qbuf, len);
+	    bptr[nbatch] = batch + batchused;
+	    blen[nbatch++] = len;
+	    batchused += len;
+	    if (nbatch == READLINES_BATCH) FLUSH_LINES
+	}
 	if (warn && strlen(buf) < nbuf)
 	    warning(_("line %d appears to contain an embedded nul"), nread + 1);
 	if(c == R_EOF) goto no_more_lines;
     }
+    FLUSH_LINES
     if(!wasopen) {endcontext(&cntxt); con->close(con);}
     UNPROTECT(1);
     free(buf);
     return ans;
 no_more_lines:
+    FLUSH_LINES
     if(!wasopen) {endcontext(&cntxt); con->close(con);}
     if(nbuf > 0) { /* incomplete last line */
 	if(con->text && !con->blocking) {
@@ -3646,6 +4285,7 @@ no_more_lines:
     UNPROTECT(2);
     return ans2;
 }
+#undef FLUSH_LINES
 
 /* writeLines(text, con = stdout(), sep = "\n", useBytes) */
 SEXP attribute_hidden do_writelines(SEXP call, SEXP op, SEXP args, SEXP env)
@@ -3732,6 +4372,58 @@ static void swapb(void *result, int size)
     }
 }
 
+/* Reverse the bytes of each of n items of size bytes at p, with
+   fixed-width loops the compiler can vectorize for the usual sizes. */
+static void swapbytes(void *p, int size, R_xlen_t n)
+{
+    char *q = p;
+    R_xlen_t i;
+
+    switch(size) {
+    case 1:
+	break;
+    case 2:
+	for(i = 0; i < n; i++, q += 2) {
+	    uint16_t x;
+	    memcpy(&x, q, 2);
+	    x = (uint16_t) ((x << 8) | (x >> 8));
+	    memcpy(q, &x, 2);
+	}
+	break;
+    case 4:
+	for(i = 0; i < n; i++, q += 4) {
+	    uint32_t x;
+	    memcpy(&x, q, 4);
+#ifdef __GNUC__
+	    x = __builtin_bswap32(x);
+#else
+	    x = (x >> 24) | ((x >> 8) & 0xff00) | ((x << 8) & 0xff0000) |
+		(x << 24);
+#endif
+	    memcpy(q, &x, 4);
+	}
+	break;
+    case 8:
+	for(i = 0; i < n; i++, q += 8) {
+	    uint64_t x;
+	    memcpy(&x, q, 8);
+#ifdef __GNUC__
+	    x = __builtin_bswap64(x);
+#else
+	    x = ((x & 0xff00ff00ff00ff00ULL) >> 8) |
+		((x & 0x00ff00ff00ff00ffULL) << 8);
+	    x = ((x & 0xffff0000ffff0000ULL) >> 16) |
+		((x & 0x0000ffff0000ffffULL) << 16);
+	    x = (x >> 32) | (x << 32);
+#endif
+	    memcpy(q, &x, 8);
+	}
+	break;
+    default:
+	for(i = 0; i < n; i++, q += size) swapb(q, size);
+    }
+}
+
 static SEXP readOneString(Rconnection con)
 {
     char buf[10001], *p;
@@ -3882,11 +4574,7 @@ SEXP attribute_hidden do_readbin(SEXP call, SEXP op, SEXP args, SEXP env)
 		pp += n1 * size;
 	    }
 	}
-	if(swap)
-	    for(i = 0; i < m; i++) {
-		swapb(&(COMPLEX(ans)[i].r), sizeof(double));
-		swapb(&(COMPLEX(ans)[i].i), sizeof(double));
-	    }
+	if(swap) swapbytes(p, sizeof(double), 2 * m);
     } else {
 	if (!strcmp(what, "integer") || !strcmp(what, "int")) {
 	    sizedef = sizeof(int); mode = 1;
@@ -3973,77 +4661,81 @@ SEXP attribute_hidden do_readbin(SEXP call, SEXP op, SEXP args, SEXP env)
 		    pp += n1 * size;
 		}
 	    }
-	    if(swap && size > 1)
-		for(i = 0; i < m; i++) swapb((char *)p+i*size, size);
+	    if(swap) swapbytes(p, size, m);
 	} else {
-	    R_xlen_t s;
-	    union {
-		signed char sch;
-		unsigned char uch;
-		signed short ssh;
-		unsigned short ush;
-		long l;
-		long long ll;
-		float f;
-#if HAVE_LONG_DOUBLE
-		long double ld;
-#endif
-	    } u;
-	    if (size > sizeof u)
-		error(_("size %d is unknown on this machine"), size);
-	    if(mode == 1) { /* integer result */
-		for(i = 0, m = 0; i < n; i++) {
-		    s = isRaw ? rawRead((char*) &u, size, 1, bytes, nbytes, &np)
-			: (int) con->read((char*) &u, size, 1, con);
-		    if (s < 0) error("error reading from the connection");
-		    if(s) m++; else break;
-		    if(swap && size > 1) swapb((char *) &u, size);
+	    /* Read BLOCK items at a time and convert them */
+	    char *buf = R_alloc(BLOCK, size), *q;
+	    R_xlen_t m0;
+	    for(m = 0; m < n; m += m0) {
+		size_t n1 = (n - m < BLOCK) ? n - m : BLOCK;
+		m0 = isRaw ? rawRead(buf, size, n1, bytes, nbytes, &np)
+		    : (R_xlen_t) con->read(buf, size, n1, con);
+		if (m0 < 0) error("error reading from the connection");
+		if(swap) swapbytes(buf, size, m0);
+		q = buf;
+		if(mode == 1) { /* integer result */
+		    int *ip = (int *) p + m;
 		    switch(size) {
 		    case sizeof(signed char):
 			if(signd)
-			    INTEGER(ans)[i] = u.sch;
+			    for(i = 0; i < m0; i++) ip[i] = ((signed char *) q)[i];
 			else
-			    INTEGER(ans)[i] = u.uch;
+			    for(i = 0; i < m0; i++) ip[i] = ((unsigned char *) q)[i];
 			break;
 		    case sizeof(short):
-			if(signd)
-			    INTEGER(ans)[i] = u.ssh;
-			else
-			    INTEGER(ans)[i] = u.ush;
+			for(i = 0; i < m0; i++, q += size) {
+			    unsigned short us;
+			    memcpy(&us, q, size);
+			    ip[i] = signd ? (short) us : us;
+			}
 			break;
 #if SIZEOF_LONG == 8
 		    case sizeof(long):
-			INTEGER(ans)[i] = (int) u.l;
+			for(i = 0; i < m0; i++, q += size) {
+			    long l;
+			    memcpy(&l, q, size);
+			    ip[i] = (int) l;
+			}
 			break;
 #elif SIZEOF_LONG_LONG == 8
 		    case sizeof(_lli_t):
-			INTEGER(ans)[i] = (int) u.ll;
+			for(i = 0; i < m0; i++, q += size) {
+			    _lli_t ll;
+			    memcpy(&ll, q, size);
+			    ip[i] = (int) ll;
+			}
 			break;
 #endif
 		    default:
 			error(_("size %d is unknown on this machine"), size);
 		    }
-		}
-	    } else if (mode == 2) { /* double result */
-		for(i = 0, m = 0; i < n; i++) {
-		    s = isRaw ? rawRead((char*) &u, size, 1, bytes, nbytes, &np)
-			: (int) con->read((char*) &u, size, 1, con);
-		    if (s < 0) error("error reading from the connection");
-		    if(s) m++; else break;
-		    if(swap && size > 1) swapb((char *) &u, size);
+		} else if (mode == 2) { /* double result */
+		    double *dp = (double *) p + m;
 		    switch(size) {
 		    case sizeof(float):
-			REAL(ans)[i] = u.f;
+			for(i = 0; i < m0; i++, q += size) {
+			    float f;
+			    memcpy(&f, q, size);
+			    dp[i] = f;
+			}
 			break;
 #if HAVE_LONG_DOUBLE && (SIZEOF_LONG_DOUBLE > SIZEOF_DOUBLE)
 		    case sizeof(long double):
-			REAL(ans)[i] = (double) u.ld;
+			for(i = 0; i < m0; i++, q += size) {
+			    long double ld;
+			    memcpy(&ld, q, size);
+			    dp[i] = (double) ld;
+			}
 			break;
 #endif
 		    default:
 			error(_("size %d is unknown on this machine"), size);
 		    }
 		}
+		if(m0 < n1) {
+		    m += m0;
+		    break;
+		}
 	    }
 	}
     }
@@ -4054,13 +4746,82 @@ SEXP attribute_hidden do_readbin(SEXP call, SEXP op, SEXP args, SEXP env)
     return ans;
 }
 
+#define WBLOCK 65536
+
+/* Convert items [i0, i0 + nb) of an integer, logical or double vector
+   to size bytes each at buf, for writeBin with a non-native size. */
+static void writeConvert(SEXP object, int size, R_xlen_t i0, R_xlen_t nb,
+			 char *buf)
+{
+    R_xlen_t i;
+
+    if(TYPEOF(object) == REALSXP) {
+	const double *x = REAL(object) + i0;
+	switch (size) {
+	case sizeof(float):
+	    for (i = 0; i < nb; i++, buf += size) {
+		float f1 = (float) x[i];
+		memcpy(buf, &f1, size);
+	    }
+	    break;
+#if HAVE_LONG_DOUBLE && (SIZEOF_LONG_DOUBLE > SIZEOF_DOUBLE)
+	case sizeof(long double):
+	{
+	    /* some systems have problems with memcpy from
+	       the address of an automatic long double,
+	       e.g. ix86/x86_64 Linux with gcc4 */
+	    static long double ld1;
+	    for (i = 0; i < nb; i++, buf += size) {
+		ld1 = (long double) x[i];
+		memcpy(buf, &ld1, size);
+	    }
+	    break;
+	}
+#endif
+	default:
+	    error(_("size %d is unknown on this machine"), size);
+	}
+    } else {
+	const int *x = INTEGER(object) + i0;
+	switch (size) {
+#if SIZEOF_LONG == 8
+	case sizeof(long):
+	    for (i = 0; i < nb; i++, buf += size) {
+		long l1 = (long) x[i];
+		memcpy(buf, &l1, size);
+	    }
+	    break;
+#elif SIZEOF_LONG_LONG == 8
+	case sizeof(_lli_t):
+	    for (i = 0; i < nb; i++, buf += size) {
+		_lli_t ll1 = (_lli_t) x[i];
+		memcpy(buf, &ll1, size);
+	    }
+	    break;
+#endif
+	case 2:
+	    for (i = 0; i < nb; i++, buf += size) {
+		short s1 = (short) x[i];
+		memcpy(buf, &s1, size);
+	    }
+	    break;
+	case 1:
+	    for (i = 0; i < nb; i++)
+		buf[i] = (signed char) x[i];
+	    break;
+	default:
+	    error(_("size %d is unknown on this machine"), size);
+	}
+    }
+}
+
 /* writeBin(object, con, size, swap, useBytes) */
 SEXP attribute_hidden do_writebin(SEXP call, SEXP op, SEXP args, SEXP env)
 {
     SEXP object, ans = R_NilValue;
-    int i, j, size, swap, len, useBytes;
+    int size, swap, useBytes;
+    R_xlen_t i, len;
     const char *s;
-    char *buf;
     Rboolean wasopen = TRUE, isRaw = FALSE;
     Rconnection con = NULL;
     RCNTXT cntxt;
@@ -4086,17 +4847,14 @@ SEXP attribute_hidden do_writebin(SEXP call, SEXP op, SEXP args, SEXP env)
     useBytes = asLogical(CAD4R(args));
     if(useBytes == NA_LOGICAL)
 	error(_("invalid '%s' argument"), "useBytes");
-    len = LENGTH(object);
+    len = XLENGTH(object);
     if(len == 0) {
 	if(isRaw) return allocVector(RAWSXP, 0); else return R_NilValue;
     }
-    /* RAW vectors are limited to 2^31 - 1 bytes */
-    if((double)len *size > INT_MAX) {
-	if(isRaw)
-	    error(_("only 2^31-1 bytes can be written to a raw vector"));
-	else
-	    error(_("only 2^31-1 bytes can be written in a single writeBin() call"));
-    }
+    /* RAW vectors are limited to 2^31 - 1 bytes: connections are
+       written a block at a time */
+    if(isRaw && (double)len *size > INT_MAX)
+	error(_("only 2^31-1 bytes can be written to a raw vector"));
 
     if(!wasopen) {
 	/* Documented behaviour */
@@ -4194,110 +4952,59 @@ SEXP attribute_hidden do_writebin(SEXP call, SEXP op, SEXP args, SEXP env)
 	default:
 	    UNIMPLEMENTED_TYPE("writeBin", object);
 	}
-	buf = R_chk_calloc(len, size);
+	/* Items of the native size are written straight from the vector
+	   unless they need swapping; others are converted (and swapped)
+	   WBLOCK at a time into buf. */
+	const char *data = NULL;
+	char *buf = NULL;
+	R_xlen_t i0, nb, block;
 	switch(TYPEOF(object)) {
 	case LGLSXP:
 	case INTSXP:
-	    switch (size) {
-	    case sizeof(int):
-		memcpy(buf, INTEGER(object), size * len);
-		break;
-#if SIZEOF_LONG == 8
-	    case sizeof(long):
-	    {
-		long l1;
-		for (i = 0, j = 0; i < len; i++, j += size) {
-		    l1 = (long) INTEGER(object)[i];
-		    memcpy(buf + j, &l1, size);
-		}
-		break;
-	    }
-#elif SIZEOF_LONG_LONG == 8
-	    case sizeof(_lli_t):
-	    {
-		_lli_t ll1;
-		for (i = 0, j = 0; i < len; i++, j += size) {
-		    ll1 = (_lli_t) INTEGER(object)[i];
-		    memcpy(buf + j, &ll1, size);
-		}
-		break;
-	    }
-#endif
-	    case 2:
-	    {
-		short s1;
-		for (i = 0, j = 0; i < len; i++, j += size) {
-		    s1 = (short) INTEGER(object)[i];
-		    memcpy(buf + j, &s1, size);
-		}
-		break;
-	    }
-	    case 1:
-		for (i = 0; i < len; i++)
-		    buf[i] = (signed char) INTEGER(object)[i];
-		break;
-	    default:
-		error(_("size %d is unknown on this machine"), size);
-	    }
+	    if(size == sizeof(int)) data = (const char *) INTEGER(object);
 	    break;
 	case REALSXP:
-	    switch (size) {
-	    case sizeof(double):
-		memcpy(buf, REAL(object), size * len);
-		break;
-	    case sizeof(float):
-	    {
-		float f1;
-		for (i = 0, j = 0; i < len; i++, j += size) {
-		    f1 = (float) REAL(object)[i];
-		    memcpy(buf+j, &f1, size);
-		}
-		break;
-	    }
-#if HAVE_LONG_DOUBLE && (SIZEOF_LONG_DOUBLE > SIZEOF_DOUBLE)
-	    case sizeof(long double):
-	    {
-		/* some systems have problems with memcpy from
-		   the address of an automatic long double,
-		   e.g. ix86/x86_64 Linux with gcc4 */
-		static long double ld1;
-		for (i = 0, j = 0; i < len; i++, j += size) {
-		    ld1 = (long double) REAL(object)[i];
-		    memcpy(buf+j, &ld1, size);
-		}
-		break;
-	    }
-#endif
-	    default:
-		error(_("size %d is unknown on this machine"), size);
-	    }
+	    if(size == sizeof(double)) data = (const char *) REAL(object);
 	    break;
 	case CPLXSXP:
-	    memcpy(buf, COMPLEX(object), size * len);
+	    data = (const char *) COMPLEX(object);
 	    break;
 	case RAWSXP:
-	    memcpy(buf, RAW(object), len); /* size = 1 */
+	    data = (const char *) RAW(object);
 	    break;
 	}
-
-	if(swap && size > 1) {
-	    if (TYPEOF(object) == CPLXSXP)
-		for(i = 0; i < len; i++) {
-		    int sz = size/2;
-		    swapb(buf+sz*2*i, sz);
-		    swapb(buf+sz*(2*i+1), sz);
-		}
-	    else
-		for(i = 0; i < len; i++) swapb(buf+size*i, size);
-	}
-
-	/* write it now */
-	if(isRaw) { /* We checked size*len < 2^31-1 above */
+	if(isRaw) {
+	    /* We checked size*len < 2^31-1 above */
 	    PROTECT(ans = allocVector(RAWSXP, size*len));
-	    memcpy(RAW(ans), buf, size*len);
+	    block = len;
 	} else {
-	    size_t nwrite = con->write(buf, size, len, con);
-	    if(nwrite < len) warning(_("problem writing to connection"));
+	    block = (len < WBLOCK) ? len : WBLOCK;
+	    if(!data || swap) buf = R_chk_calloc(block, size);
+	}
+	for(i0 = 0; i0 < len; i0 += nb) {
+	    const char *src;
+	    char *out = isRaw ? (char *) RAW(ans) + i0 * size : buf;
+	    nb = (len - i0 < block) ? len - i0 : block;
+	    if(data && !swap && !isRaw)
+		src = data + i0 * size;
+	    else {
+		if(data) memcpy(out, data + i0 * size, nb * size);
+		else writeConvert(object, size, i0, nb, out);
+		if(swap) {
+		    if(TYPEOF(object) == CPLXSXP)
+			swapbytes(out, size/2, 2 * nb);
+		    else
+			swapbytes(out, size, nb);
+		}
+		src = out;
+	    }
+	    if(!isRaw) {
+		size_t nwrite = con->write(src, size, nb, con);
+		if(nwrite < nb) {
+		    warning(_("problem writing to connection"));
+		    break;
+		}
+	    }
 	}
 	Free(buf);
     }
@@ -4967,6 +5674,7 @@ SEXP attribute_hidden do_url(SEXP call, SEXP op, SEXP args, SEXP env)
     SEXP scmd, sopen, ans, class, enc;
     char *class2 = "url";
     const char *url, *open;
+    size_t bufsize = 0;
     int ncon, block, raw = 0, defmeth,
 	meth = 0, // 0: "default" | "internal" | "wininet", 1: "libcurl"
 	winmeth;  // 0: "internal", 1: "wininet" (Windows only)
@@ -5048,6 +5756,8 @@ SEXP attribute_hidden do_url(SEXP call, SEXP op, SEXP args, SEXP env)
 	raw = asLogical(CAD4R(CDR(args)));
 	if(raw == NA_LOGICAL)
 	    error(_("invalid '%s' argument"), "raw");
+	// --------- buffer
+	bufsize = asBufferSize(CAD4R(CDDR(args)));
     }
 
     if(!meth) {
@@ -5133,6 +5843,12 @@ SEXP attribute_hidden do_url(SEXP call, SEXP op, SEXP args, SEXP env)
 			    { ztype = 2; subtype = 1;}
 			    if(!memcmp(buf, "]\0\0\200\0", 5))
 			    { ztype = 2; subtype = 1;}
+#ifdef HAVE_ZSTD
+			    if(!memcmp(buf, "\x28\xb5\x2f\xfd", 4)) ztype = 3;
+#endif
+#ifdef HAVE_LZ4
+			    if(!memcmp(buf, "\x04\x22\x4d\x18", 4)) ztype = 4;
+#endif
 			}
 		    }
 		    switch(ztype) {
@@ -5148,6 +5864,10 @@ SEXP attribute_hidden do_url(SEXP call, SEXP op, SEXP args, SEXP env)
 		    case 2:
 			con = newxzfile(url, strlen(open) ? open : "rt", subtype, compress);
 			break;
+		    case 3:
+		    case 4:
+			con = newzfile(url, strlen(open) ? open : "rt", ztype, compress);
+			break;
 		    }
 		} else
 		    con = newfile(url, ienc, strlen(open) ? open : "r", raw);
@@ -5160,6 +5880,7 @@ SEXP attribute_hidden do_url(SEXP call, SEXP op, SEXP args, SEXP env)
 
     Connections[ncon] = con;
     con->blocking = block;
+    if(PRIMVAL(op) == 1) set_bufsize(con, bufsize);
     strncpy(con->encname, CHAR(STRING_ELT(enc, 0)), 100); /* ASCII */
     con->encname[100 - 1] = '\0';
 
@@ -5602,6 +6323,26 @@ SEXP R_compress1(SEXP in)
     buf = (Bytef *) R_alloc(outlen + 4, sizeof(Bytef));
     /* we want this to be system-independent */
     *((unsigned int *)buf) = (unsigned int) uiSwap(inlen);
+#ifdef _OPENMP
+    /* Large values are compressed in parallel to the same zlib format */
+    int nthreads = compressThreads();
+    if (nthreads > 1 && inlen >= 2 * PGZ_BLOCK) {
+	Bytef *out;
+	long n = R_pdeflate(RAW(in), inlen, NULL, 0, Z_DEFAULT_COMPRESSION,
+			    Z_DEFAULT_STRATEGY, 1, nthreads, &out);
+	if (n >= 0 && n + 6 <= outlen) {
+	    uLong adler = adler32(adler32(0L, Z_NULL, 0), RAW(in), inlen);
+	    buf[4] = 0x78; buf[5] = 0x9c; /* zlib header for the default level */
+	    memcpy(buf + 6, out, n);
+	    for (int i = 0; i < 4; i++)
+		buf[6 + n + i] = (Bytef) (adler >> (24 - 8 * i));
+	    outlen = n + 6;
+	    res = Z_OK;
+	} else
+	    res = compress(buf + 4, &outlen, (Bytef *)RAW(in), inlen);
+	if (n >= 0) free(out);
+    } else
+#endif
     res = compress(buf + 4, &outlen, (Bytef *)RAW(in), inlen);
     if(res != Z_OK) error("internal error %d in R_compress1", res);
     ans = allocVector(RAWSXP, outlen + 4);
@@ -5715,6 +6456,42 @@ SEXP R_decompress2(SEXP in, Rboolean *err)
 }
 
 
+/* The descriptor a connection can be waited on with select(), or -1.
+   Other than sockets, that is only possible on Unix-alikes, for the
+   descriptors of file(), pipe() and fifo() connections. */
+static int con_fd(Rconnection con)
+{
+    if (!con->isopen) return -1;
+    if (streql(con->class, "sockconn"))
+	return ((Rsockconn) con->private)->fd;
+#ifndef Win32
+    if (streql(con->class, "file") || streql(con->class, "pipe"))
+	return fileno(((Rfileconn) con->private)->fp);
+# if defined(HAVE_MKFIFO) && defined(HAVE_FCNTL_H)
+    if (streql(con->class, "fifo"))
+	return ((Rfifoconn) con->private)->fd;
+# endif
+#endif
+    return -1;
+}
+
+/* Is input waiting in the connection itself, rather than its
+   descriptor? */
+static Rboolean con_has_input(Rconnection con)
+{
+    if (con->nPushBack > 0 || con->save != -1000 || con->save2 != -1000 ||
+	buff_unread(con) > 0)
+	return TRUE;
+    if (streql(con->class, "sockconn")) {
+	Rsockconn scp = con->private;
+	return scp->pstart < scp->pend;
+    }
+    return FALSE;
+}
+
+/* socketSelect(): this waits in R_SocketWaitMultiple(), which also
+   services the input handlers of the event loop, so waiting for
+   non-blocking connections does not stop event processing. */
 SEXP attribute_hidden do_sockselect(SEXP call, SEXP op, SEXP args, SEXP rho)
 {
     Rboolean immediate = FALSE;
@@ -5740,11 +6517,15 @@ SEXP attribute_hidden do_sockselect(SEXP call, SEXP op, SEXP args, SEXP rho)
 
     for (i = 0; i < nsock; i++) {
 	Rconnection conn = getConnection(asInteger(VECTOR_ELT(insock, i)));
-	Rsockconn scp = conn->private;
-	if (strcmp(conn->class, "sockconn") != 0)
-	    error(_("not a socket connection"));
-	INTEGER(insockfd)[i] = scp->fd;
-	if (! LOGICAL(write)[i] && scp->pstart < scp->pend) {
+	int fd = con_fd(conn);
+	if (fd < 0)
+#ifdef Win32
+	    error(_("not an open socket connection"));
+#else
+	    error(_("not an open socket, file, pipe or fifo connection"));
+#endif
+	INTEGER(insockfd)[i] = fd;
+	if (! LOGICAL(write)[i] && con_has_input(conn)) {
 	    LOGICAL(val)[i] = TRUE;
 	    immediate = TRUE;
 	}
@@ -5821,6 +6602,83 @@ SEXP R_compress3(SEXP in, Rboolean *err)
     return ans;
 }
 
+/* zstd ('S') and lz4 ('4') use the same header as R_compress3, and are
+   decompressed by R_decompress3 */
+
+#define LAZYLOAD_ZSTD_LEVEL 9
+
+attribute_hidden
+SEXP R_compress4(SEXP in)
+{
+#ifdef HAVE_ZSTD
+    const void *vmax = vmaxget();
+    unsigned int inlen;
+    size_t outlen, res;
+    unsigned char *buf;
+    SEXP ans;
+
+    if(TYPEOF(in) != RAWSXP)
+	error("R_compress4 requires a raw vector");
+    inlen = LENGTH(in);
+    outlen = ZSTD_compressBound(inlen);
+    buf = (unsigned char *) R_alloc(outlen + 5, sizeof(unsigned char));
+    /* we want this to be system-independent */
+    *((unsigned int *)buf) = (unsigned int) uiSwap(inlen);
+    buf[4] = 'S';
+    res = ZSTD_compress(buf + 5, outlen, RAW(in), inlen, LAZYLOAD_ZSTD_LEVEL);
+    if (ZSTD_isError(res)) error("internal error in R_compress4");
+    if (res >= inlen) {
+	/* don't allow it to expand */
+	res = inlen;
+	buf[4] = '0';
+	memcpy(buf + 5, RAW(in), inlen);
+    }
+    ans = allocVector(RAWSXP, res + 5);
+    memcpy(RAW(ans), buf, res + 5);
+    vmaxset(vmax);
+    return ans;
+#else
+    error(_("this build of R does not support %s compression"), "zstd");
+    return R_NilValue; /* -Wall */
+#endif
+}
+
+attribute_hidden
+SEXP R_compress5(SEXP in)
+{
+#ifdef HAVE_LZ4
+    const void *vmax = vmaxget();
+    int inlen, outlen, res;
+    unsigned char *buf;
+    SEXP ans;
+
+    if(TYPEOF(in) != RAWSXP)
+	error("R_compress5 requires a raw vector");
+    inlen = LENGTH(in);
+    outlen = LZ4_compressBound(inlen);
+    if (outlen <= 0) error("R_compress5 input is too large");
+    buf = (unsigned char *) R_alloc(outlen + 5, sizeof(unsigned char));
+    /* we want this to be system-independent */
+    *((unsigned int *)buf) = (unsigned int) uiSwap(inlen);
+    buf[4] = '4';
+    res = LZ4_compress_HC((const char *) RAW(in), (char *) buf + 5, inlen,
+			  outlen, LZ4HC_CLEVEL_DEFAULT);
+    if (res <= 0 || res >= inlen) {
+	/* don't allow it to expand */
+	res = inlen;
+	buf[4] = '0';
+	memcpy(buf + 5, RAW(in), inlen);
+    }
+    ans = allocVector(RAWSXP, res + 5);
+    memcpy(RAW(ans), buf, res + 5);
+    vmaxset(vmax);
+    return ans;
+#else
+    error(_("this build of R does not support %s compression"), "lz4");
+    return R_NilValue; /* -Wall */
+#endif
+}
+
 attribute_hidden
 SEXP R_decompress3(SEXP in, Rboolean *err)
 {
@@ -5874,6 +6732,25 @@ SEXP R_decompress3(SEXP in, Rboolean *err)
 	    *err = TRUE;
 	    return R_NilValue;
 	}
+#ifdef HAVE_ZSTD
+    } else if (type == 'S') {
+	size_t res = ZSTD_decompress(buf, outlen, p + 5, inlen - 5);
+	if(ZSTD_isError(res) || res != outlen) {
+	    warning("internal error in R_decompress3 for zstd");
+	    *err = TRUE;
+	    return R_NilValue;
+	}
+#endif
+#ifdef HAVE_LZ4
+    } else if (type == '4') {
+	int res = LZ4_decompress_safe((const char *)(p + 5), (char *) buf,
+				      inlen - 5, outlen);
+	if(res < 0 || (unsigned int) res != outlen) {
+	    warning("internal error in R_decompress3 for lz4");
+	    *err = TRUE;
+	    return R_NilValue;
+	}
+#endif
     } else if (type == '0') {
 	buf = p + 5;
     } else {
@@ -5960,6 +6837,23 @@ do_memCompress(SEXP call, SEXP op, SEXP args, SEXP env)
 	memcpy(RAW(ans), buf, outlen);
 	break;
     }
+    case 5: /* zstd */
+    {
+#ifdef HAVE_ZSTD
+	unsigned char *buf;
+	size_t inlen = XLENGTH(from), outlen = ZSTD_compressBound(inlen);
+	buf = (unsigned char *) R_alloc(outlen, sizeof(unsigned char));
+	outlen = ZSTD_compress(buf, outlen, RAW(from), inlen, 3);
+	if (ZSTD_isError(outlen))
+	    error("internal error '%s' in memCompress",
+		  ZSTD_getErrorName(outlen));
+	ans = allocVector(RAWSXP, outlen);
+	memcpy(RAW(ans), buf, outlen);
+#else
+	error(_("this build of R does not support %s compression"), "zstd");
+#endif
+	break;
+    }
     default:
 	break;
     }
@@ -5986,6 +6880,8 @@ do_memDecompress(SEXP call, SEXP op, SEXP args, SEXP env)
 	    type = 4; subtype = 1;
 	} else if(!memcmp(p, "]\0\0\200\0", 5)) {
 	    type = 4; subtype = 1;
+	} else if(!memcmp(p, "\x28\xB5\x2F\xFD", 4)) {
+	    type = 6;
 	} else {
 	    warning(_("unknown compression, assuming none"));
 	    type = 1;
@@ -6081,6 +6977,36 @@ do_memDecompress(SEXP call, SEXP op, SEXP args, SEXP env)
 	memcpy(RAW(ans), buf, outlen);
 	break;
     }
+    case 6: /* zstd */
+    {
+#ifdef HAVE_ZSTD
+	unsigned char *buf;
+	size_t inlen = XLENGTH(from), outlen, res;
+	unsigned long long csize = ZSTD_getFrameContentSize(RAW(from), inlen);
+	if (csize == ZSTD_CONTENTSIZE_ERROR)
+	    error("internal error in memDecompress(%d)", type);
+	outlen = (csize == ZSTD_CONTENTSIZE_UNKNOWN) ? 3*inlen : (size_t) csize;
+	while(1) {
+	    buf = (unsigned char *) R_alloc(outlen ? outlen : 1,
+					    sizeof(unsigned char));
+	    res = ZSTD_decompress(buf, outlen, RAW(from), inlen);
+	    if (ZSTD_isError(res) &&
+		ZSTD_getErrorCode(res) == ZSTD_error_dstSize_tooSmall) {
+		outlen *= 2;
+		continue;
+	    }
+	    if (ZSTD_isError(res))
+		error("internal error '%s' in memDecompress(%d)",
+		      ZSTD_getErrorName(res), type);
+	    break;
+	}
+	ans = allocVector(RAWSXP, res);
+	memcpy(RAW(ans), buf, res);
+#else
+	error(_("this build of R does not support %s compression"), "zstd");
+#endif
+	break;
+    }
     default:
 	break;
     }
@@ -1,7 +1,7 @@
 /*
  *  R : A Computer Language for Statistical Data Analysis
  *  Copyright (C) 1995, 1996  Robert Gentleman and Ross Ihaka
- *  Copyright (C) 1998-2014   The R Core Team.
+ *  Copyright (C) 1998-2017   The R Core Team.
  *
  *  This program is free software; you can redistribute it and/or modify
  *  it under the terms of the GNU General Public License as published by
@@ -50,6 +50,7 @@
  *			non-local return (i.e. an error)
  *	cenddata	a void pointer to data for cend to use
  *	vmax		the current setting of the R_alloc stack
+ *	arenamark	the current mark of the R_ArenaAlloc arenas
  *	srcref		the srcref at the time of the call
  *
  *  Context types can be one of:
@@ -168,6 +169,7 @@ static void R_restore_globals(RCNTXT *cptr)
     R_GCEnabled = cptr->gcenabled;
     R_EvalDepth = cptr->evaldepth;
     vmaxset(cptr->vmax);
+    R_ArenaPop(cptr->arenamark);
     R_interrupts_suspended = cptr->intsusp;
     R_HandlerStack = cptr->handlerstack;
     R_RestartStack = cptr->restartstack;
@@ -184,6 +186,10 @@ static void R_restore_globals(RCNTXT *cptr)
     R_BCNodeStackTop = cptr->nodestack;
 #ifdef BC_INT_STACK
     R_BCIntStackTop = cptr->intstack;
+#endif
+#if defined(R_MEMORY_PROFILING) || defined(R_PROFILING)
+    R_BCpc = cptr->bcpc;
+    R_BCbody = cptr->bcbody;
 #endif
     R_Srcref = cptr->srcref;
 }
@@ -209,6 +215,11 @@ void attribute_hidden NORET R_jumpctxt(RCNTXT * targetcptr, int mask, SEXP val)
     Rboolean savevis = R_Visible;
     RCNTXT *cptr;
 
+    /* leaf closures cannot be returned to by a jump: eval.c only runs
+       closures as such when no jump to them can happen */
+    if (targetcptr->nojump)
+	error(_("cannot return from this function by a jump"));
+
     /* find the target for the first jump -- either an intermediate
        context with an on.exit action to run or the final target if
        there are no intermediate on.exit actions */
@@ -242,6 +253,7 @@ void begincontext(RCNTXT * cptr, int flags,
 		  SEXP syscall, SEXP env, SEXP sysp,
 		  SEXP promargs, SEXP callfun)
 {
+    R_PERF_COUNT(PERF_CONTEXT);
     cptr->cstacktop = R_PPStackTop;
     cptr->gcenabled = R_GCEnabled;
     cptr->evaldepth = R_EvalDepth;
@@ -254,6 +266,7 @@ void begincontext(RCNTXT * cptr, int flags,
     cptr->promargs = promargs;
     cptr->callfun = callfun;
     cptr->vmax = vmaxget();
+    cptr->arenamark = R_ArenaPush();
     cptr->intsusp = R_interrupts_suspended;
     cptr->handlerstack = R_HandlerStack;
     cptr->restartstack = R_RestartStack;
@@ -261,6 +274,10 @@ void begincontext(RCNTXT * cptr, int flags,
     cptr->nodestack = R_BCNodeStackTop;
 #ifdef BC_INT_STACK
     cptr->intstack = R_BCIntStackTop;
+#endif
+#if defined(R_MEMORY_PROFILING) || defined(R_PROFILING)
+    cptr->bcpc = R_BCpc;
+    cptr->bcbody = R_BCbody;
 #endif
     cptr->srcref = R_Srcref;
     cptr->browserfinish = R_GlobalContext->browserfinish;
@@ -268,6 +285,7 @@ void begincontext(RCNTXT * cptr, int flags,
     cptr->returnValue = NULL;
     cptr->jumptarget = NULL;
     cptr->jumpmask = 0;
+    cptr->nojump = FALSE;
 
     R_GlobalContext = cptr;
 }
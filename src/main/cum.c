@@ -25,11 +25,78 @@
 #include <Defn.h>
 #include <Internal.h>
 
+/* Vectors of R_CUM_THREADS_MIN or more elements are scanned on
+   R_num_math_threads threads in two passes: each thread first reduces
+   one contiguous block, the block results are combined in order into
+   the value carried into each block, and then each thread fills in its
+   block starting from that value.  Elements after the first NA (or the
+   first integer overflow) are left as NA, as in the sequential loops.
+   Maxima and minima, and integer sums, are the same as sequentially;
+   double sums and products may differ in the last bit, but do not
+   depend on the scheduling. */
+#define R_CUM_THREADS_MIN 1000000
+#define R_CUM_MAX_THREADS 64
+
+static R_INLINE int cum_nthreads(R_xlen_t n)
+{
+#ifdef _OPENMP
+    if (n >= R_CUM_THREADS_MIN && R_num_math_threads > 1)
+	return R_num_math_threads < R_CUM_MAX_THREADS ?
+	    R_num_math_threads : R_CUM_MAX_THREADS;
+#endif
+    return 1;
+}
+
+#define CUM_BLOCK_FROM(n, nthreads, t) ((n) / (nthreads) * (t))
+#define CUM_BLOCK_TO(n, nthreads, t)					\
+    ((t) == (nthreads) - 1 ? (n) : CUM_BLOCK_FROM(n, nthreads, (t) + 1))
+
 static SEXP cumsum(SEXP x, SEXP s)
 {
     LDOUBLE sum = 0.;
     double *rx = REAL(x), *rs = REAL(s);
-    for (R_xlen_t i = 0 ; i < XLENGTH(x) ; i++) {
+    R_xlen_t n = XLENGTH(x);
+#ifdef _OPENMP
+    int nthreads = cum_nthreads(n);
+    if (nthreads > 1) {
+	LDOUBLE part[R_CUM_MAX_THREADS];
+	R_xlen_t stop[R_CUM_MAX_THREADS], last = n;
+#pragma omp parallel for num_threads(nthreads) default(none) \
+    firstprivate(rx, n, nthreads) shared(part, stop)
+	for (int t = 0; t < nthreads; t++) {
+	    R_xlen_t i, to = CUM_BLOCK_TO(n, nthreads, t);
+	    LDOUBLE bsum = 0.;
+	    for (i = CUM_BLOCK_FROM(n, nthreads, t); i < to; i++) {
+		if (ISNAN(rx[i])) break;
+		bsum += rx[i];
+	    }
+	    part[t] = bsum;
+	    stop[t] = i;
+	}
+	for (int t = 0; t < nthreads; t++) {
+	    LDOUBLE p = part[t];
+	    part[t] = sum;
+	    sum += p;
+	    if (stop[t] < CUM_BLOCK_TO(n, nthreads, t)) {
+		last = stop[t];
+		break;
+	    }
+	}
+#pragma omp parallel for num_threads(nthreads) default(none) \
+    firstprivate(rx, rs, n, nthreads, last) shared(part)
+	for (int t = 0; t < nthreads; t++) {
+	    R_xlen_t to = CUM_BLOCK_TO(n, nthreads, t);
+	    if (to > last) to = last;
+	    LDOUBLE bsum = part[t];
+	    for (R_xlen_t i = CUM_BLOCK_FROM(n, nthreads, t); i < to; i++) {
+		bsum += rx[i];
+		rs[i] = (double) bsum;
+	    }
+	}
+	return s;
+    }
+#endif
+    for (R_xlen_t i = 0 ; i < n ; i++) {
 	if (ISNAN(rx[i])) break;
 	sum += rx[i];
 	rs[i] = (double) sum;
@@ -37,15 +104,81 @@ static SEXP cumsum(SEXP x, SEXP s)
     return s;
 }
 
+#define ICUMSUM_OVERFLOW(sum) ((sum) > INT_MAX || (sum) < 1 + INT_MIN)
+
 /* We need to ensure that overflow gives NA here */
 static SEXP icumsum(SEXP x, SEXP s)
 {
     int *ix = INTEGER(x), *is = INTEGER(s);
     double sum = 0.0;
-    for (R_xlen_t i = 0 ; i < XLENGTH(x) ; i++) {
+    R_xlen_t n = XLENGTH(x);
+#ifdef _OPENMP
+    int nthreads = cum_nthreads(n);
+    /* the block sums are exact in 64 bits for blocks of fewer than
+       2^32 elements */
+    if (nthreads > 1 && n / nthreads < 4294967296.0) {
+	int64_t part[R_CUM_MAX_THREADS], total = 0;
+	R_xlen_t stop[R_CUM_MAX_THREADS], last = n, ovf = n;
+	int used = nthreads;
+#pragma omp parallel for num_threads(nthreads) default(none) \
+    firstprivate(ix, n, nthreads, R_NaInt) shared(part, stop)
+	for (int t = 0; t < nthreads; t++) {
+	    R_xlen_t i, to = CUM_BLOCK_TO(n, nthreads, t);
+	    int64_t bsum = 0;
+	    for (i = CUM_BLOCK_FROM(n, nthreads, t); i < to; i++) {
+		if (ix[i] == NA_INTEGER) break;
+		bsum += ix[i];
+	    }
+	    part[t] = bsum;
+	    stop[t] = i;
+	}
+	/* once the total carried in is out of range, the running sum
+	   has overflowed in an earlier block */
+	for (int t = 0; t < nthreads; t++) {
+	    int64_t p = part[t];
+	    part[t] = total;
+	    total += p;
+	    if (stop[t] < CUM_BLOCK_TO(n, nthreads, t)) {
+		last = stop[t];
+		used = t + 1;
+		break;
+	    }
+	    if (ICUMSUM_OVERFLOW(total)) {
+		used = t + 1;
+		break;
+	    }
+	}
+	for (int t = 0; t < used; t++)
+	    stop[t] = n;
+#pragma omp parallel for num_threads(nthreads) default(none) \
+    firstprivate(ix, is, n, nthreads, last, used) shared(part, stop)
+	for (int t = 0; t < used; t++) {
+	    R_xlen_t to = CUM_BLOCK_TO(n, nthreads, t);
+	    if (to > last) to = last;
+	    int64_t bsum = part[t];
+	    for (R_xlen_t i = CUM_BLOCK_FROM(n, nthreads, t); i < to; i++) {
+		bsum += ix[i];
+		if (ICUMSUM_OVERFLOW(bsum)) {
+		    stop[t] = i;
+		    break;
+		}
+		is[i] = (int) bsum;
+	    }
+	}
+	for (int t = 0; t < used; t++)
+	    if (stop[t] < ovf) ovf = stop[t];
+	if (ovf < n) {
+	    for (R_xlen_t i = ovf; i < last; i++)
+		is[i] = NA_INTEGER;
+	    warning(_("integer overflow in 'cumsum'; use 'cumsum(as.numeric(.))'"));
+	}
+	return s;
+    }
+#endif
+    for (R_xlen_t i = 0 ; i < n ; i++) {
 	if (ix[i] == NA_INTEGER) break;
 	sum += ix[i];
-	if(sum > INT_MAX || sum < 1 + INT_MIN) { /* INT_MIN is NA_INTEGER */
+	if(ICUMSUM_OVERFLOW(sum)) { /* INT_MIN is NA_INTEGER */
 	    warning(_("integer overflow in 'cumsum'; use 'cumsum(as.numeric(.))'"));
 	    break;
 	}
@@ -72,8 +205,40 @@ static SEXP cumprod(SEXP x, SEXP s)
 {
     LDOUBLE prod;
     double *rx = REAL(x), *rs = REAL(s);
+    R_xlen_t n = XLENGTH(x);
     prod = 1.0;
-    for (R_xlen_t i = 0 ; i < XLENGTH(x) ; i++) {
+#ifdef _OPENMP
+    int nthreads = cum_nthreads(n);
+    if (nthreads > 1) {
+	LDOUBLE part[R_CUM_MAX_THREADS];
+#pragma omp parallel for num_threads(nthreads) default(none) \
+    firstprivate(rx, n, nthreads) shared(part)
+	for (int t = 0; t < nthreads; t++) {
+	    R_xlen_t to = CUM_BLOCK_TO(n, nthreads, t);
+	    LDOUBLE bprod = 1.0;
+	    for (R_xlen_t i = CUM_BLOCK_FROM(n, nthreads, t); i < to; i++)
+		bprod *= rx[i];
+	    part[t] = bprod;
+	}
+	for (int t = 0; t < nthreads; t++) {
+	    LDOUBLE p = part[t];
+	    part[t] = prod;
+	    prod *= p;
+	}
+#pragma omp parallel for num_threads(nthreads) default(none) \
+    firstprivate(rx, rs, n, nthreads) shared(part)
+	for (int t = 0; t < nthreads; t++) {
+	    R_xlen_t to = CUM_BLOCK_TO(n, nthreads, t);
+	    LDOUBLE bprod = part[t];
+	    for (R_xlen_t i = CUM_BLOCK_FROM(n, nthreads, t); i < to; i++) {
+		bprod *= rx[i];
+		rs[i] = (double) bprod;
+	    }
+	}
+	return s;
+    }
+#endif
+    for (R_xlen_t i = 0 ; i < n ; i++) {
 	prod *= rx[i];
 	rs[i] = (double) prod;
     }
@@ -96,60 +261,150 @@ static SEXP ccumprod(SEXP x, SEXP s)
     return s;
 }
 
-static SEXP cummax(SEXP x, SEXP s)
-{
-    double max, *rx = REAL(x), *rs = REAL(s);
-    max = R_NegInf;
-    for (R_xlen_t i = 0 ; i < XLENGTH(x) ; i++) {
-	if(ISNAN(rx[i]) || ISNAN(max))
-	    max = max + rx[i];  /* propagate NA and NaN */
-	else
-	    max = (max > rx[i]) ? max : rx[i];
-	rs[i] = max;
-    }
-    return s;
+/* The running maximum (or minimum) keeps the last of tied elements,
+   which only matters for the sign of zero; the rule is associative,
+   so the parallel scan gives the same values.  Elements from the
+   first NaN on are done by the sequential loop, which propagates the
+   NA or NaN. */
+#define RCUM_EXTREME(NAME, INIT, BETTER)				\
+static void NAME##_from(double *rx, double *rs, R_xlen_t from,		\
+			R_xlen_t n, double ext)				\
+{									\
+    for (R_xlen_t i = from ; i < n ; i++) {				\
+	if (ISNAN(rx[i]) || ISNAN(ext))					\
+	    ext = ext + rx[i];  /* propagate NA and NaN */		\
+	else								\
+	    ext = BETTER(ext, rx[i]) ? ext : rx[i];			\
+	rs[i] = ext;							\
+    }									\
+}									\
+									\
+static SEXP NAME(SEXP x, SEXP s)					\
+{									\
+    double *rx = REAL(x), *rs = REAL(s);				\
+    R_xlen_t n = XLENGTH(x);						\
+    RCUM_EXTREME_PARALLEL(NAME, INIT, BETTER);				\
+    NAME##_from(rx, rs, 0, n, INIT);					\
+    return s;								\
 }
 
-static SEXP cummin(SEXP x, SEXP s)
-{
-    double min, *rx = REAL(x), *rs = REAL(s);
-    min = R_PosInf; /* always positive, not NA */
-    for (R_xlen_t i = 0 ; i < XLENGTH(x) ; i++ ) {
-	if (ISNAN(rx[i]) || ISNAN(min))
-	    min = min + rx[i];  /* propagate NA and NaN */
-	else
-	    min = (min < rx[i]) ? min : rx[i];
-	rs[i] = min;
-    }
-    return s;
-}
+#ifdef _OPENMP
+# define RCUM_EXTREME_PARALLEL(NAME, INIT, BETTER) do {			\
+	int nthreads = cum_nthreads(n);					\
+	if (nthreads > 1) {						\
+	    double part[R_CUM_MAX_THREADS], init = INIT, ext = init;	\
+	    R_xlen_t stop[R_CUM_MAX_THREADS], last = n;			\
+	    _Pragma("omp parallel for num_threads(nthreads) default(none) \
+		     firstprivate(rx, n, nthreads, init) shared(part, stop)") \
+	    for (int t = 0; t < nthreads; t++) {			\
+		R_xlen_t i, to = CUM_BLOCK_TO(n, nthreads, t);		\
+		double bext = init;					\
+		for (i = CUM_BLOCK_FROM(n, nthreads, t); i < to; i++) { \
+		    if (ISNAN(rx[i])) break;				\
+		    bext = BETTER(bext, rx[i]) ? bext : rx[i];		\
+		}							\
+		part[t] = bext;						\
+		stop[t] = i;						\
+	    }								\
+	    for (int t = 0; t < nthreads; t++) {			\
+		double p = part[t];					\
+		part[t] = ext;						\
+		ext = BETTER(ext, p) ? ext : p;				\
+		if (stop[t] < CUM_BLOCK_TO(n, nthreads, t)) {		\
+		    last = stop[t];					\
+		    break;						\
+		}							\
+	    }								\
+	    _Pragma("omp parallel for num_threads(nthreads) default(none) \
+		     firstprivate(rx, rs, n, nthreads, last) shared(part)") \
+	    for (int t = 0; t < nthreads; t++) {			\
+		R_xlen_t to = CUM_BLOCK_TO(n, nthreads, t);		\
+		if (to > last) to = last;				\
+		double bext = part[t];					\
+		for (R_xlen_t i = CUM_BLOCK_FROM(n, nthreads, t); i < to; i++) \
+		    rs[i] = bext = BETTER(bext, rx[i]) ? bext : rx[i];	\
+	    }								\
+	    if (last < n)						\
+		NAME##_from(rx, rs, last, n, last > 0 ? rs[last - 1] : init); \
+	    return s;							\
+	}								\
+    } while (0)
+#else
+# define RCUM_EXTREME_PARALLEL(NAME, INIT, BETTER) do {} while (0)
+#endif
 
-static SEXP icummax(SEXP x, SEXP s)
-{
-    int *ix = INTEGER(x);
-    if(ix[0] == NA_INTEGER)
-	return s; // all NA
-    int *is = INTEGER(s), max = ix[0];
-    is[0] = max;
-    for (R_xlen_t i = 1 ; i < XLENGTH(x) ; i++) {
-	if(ix[i] == NA_INTEGER) break;
-	is[i] = max = (max > ix[i]) ? max : ix[i];
-    }
-    return s;
-}
+#define RCUM_MAX_BETTER(a, b) ((a) > (b))
+#define RCUM_MIN_BETTER(a, b) ((a) < (b))
 
-static SEXP icummin(SEXP x, SEXP s)
-{
-    int *ix = INTEGER(x), *is = INTEGER(s);
-    int min = ix[0];
-    is[0] = min;
-    for (R_xlen_t i = 1 ; i < XLENGTH(x) ; i++ ) {
-	if(ix[i] == NA_INTEGER) break;
-	is[i] = min = (min < ix[i]) ? min : ix[i];
-    }
-    return s;
+RCUM_EXTREME(cummax, R_NegInf, RCUM_MAX_BETTER)
+RCUM_EXTREME(cummin, R_PosInf, RCUM_MIN_BETTER)
+
+/* Integer maxima and minima stop at the first NA; the combination is
+   exact, so the parallel scan gives the same values. */
+#define ICUM_EXTREME(NAME, BETTER)					\
+static SEXP NAME(SEXP x, SEXP s)					\
+{									\
+    int *ix = INTEGER(x), *is = INTEGER(s);				\
+    R_xlen_t n = XLENGTH(x);						\
+    if(ix[0] == NA_INTEGER)						\
+	return s; /* all NA */						\
+    ICUM_EXTREME_PARALLEL(BETTER);					\
+    int ext = ix[0];							\
+    is[0] = ext;							\
+    for (R_xlen_t i = 1 ; i < n ; i++) {				\
+	if(ix[i] == NA_INTEGER) break;					\
+	is[i] = ext = BETTER(ext, ix[i]) ? ext : ix[i];			\
+    }									\
+    return s;								\
 }
 
+#ifdef _OPENMP
+# define ICUM_EXTREME_PARALLEL(BETTER) do {				\
+	int nthreads = cum_nthreads(n);					\
+	if (nthreads > 1) {						\
+	    int part[R_CUM_MAX_THREADS], ext = ix[0];			\
+	    R_xlen_t stop[R_CUM_MAX_THREADS], last = n;			\
+	    _Pragma("omp parallel for num_threads(nthreads) default(none) \
+		     firstprivate(ix, n, nthreads, R_NaInt) shared(part, stop)")	\
+	    for (int t = 0; t < nthreads; t++) {			\
+		R_xlen_t i = CUM_BLOCK_FROM(n, nthreads, t),		\
+		    to = CUM_BLOCK_TO(n, nthreads, t);			\
+		int bext = ix[0];					\
+		for (; i < to; i++) {					\
+		    if (ix[i] == NA_INTEGER) break;			\
+		    bext = BETTER(bext, ix[i]) ? bext : ix[i];		\
+		}							\
+		part[t] = bext;						\
+		stop[t] = i;						\
+	    }								\
+	    for (int t = 0; t < nthreads; t++) {			\
+		int p = part[t];					\
+		part[t] = ext;						\
+		ext = BETTER(ext, p) ? ext : p;				\
+		if (stop[t] < CUM_BLOCK_TO(n, nthreads, t)) {		\
+		    last = stop[t];					\
+		    break;						\
+		}							\
+	    }								\
+	    _Pragma("omp parallel for num_threads(nthreads) default(none) \
+		     firstprivate(ix, is, n, nthreads, last) shared(part)") \
+	    for (int t = 0; t < nthreads; t++) {			\
+		R_xlen_t to = CUM_BLOCK_TO(n, nthreads, t);		\
+		if (to > last) to = last;				\
+		int bext = part[t];					\
+		for (R_xlen_t i = CUM_BLOCK_FROM(n, nthreads, t); i < to; i++) \
+		    is[i] = bext = BETTER(bext, ix[i]) ? bext : ix[i];	\
+	    }								\
+	    return s;							\
+	}								\
+    } while (0)
+#else
+# define ICUM_EXTREME_PARALLEL(BETTER) do {} while (0)
+#endif
+
+ICUM_EXTREME(icummax, RCUM_MAX_BETTER)
+ICUM_EXTREME(icummin, RCUM_MIN_BETTER)
+
 SEXP attribute_hidden do_cum(SEXP call, SEXP op, SEXP args, SEXP env)
 {
     SEXP s, t, ans;
@@ -1,6 +1,6 @@
 /*
  *  R : A Computer Language for Statistical Data Analysis
- *  Copyright (C) 2000-2016  The R Core Team.
+ *  Copyright (C) 2000-2017  The R Core Team.
  *
  *  This program is free software; you can redistribute it and/or modify
  *  it under the terms of the GNU General Public License as published by
@@ -728,6 +728,7 @@ SEXP attribute_hidden do_asPOSIXlt(SEXP call, SEXP op, SEXP args, SEXP env)
     for(int i = 0; i < nans; i++)
 	SET_STRING_ELT(ansnames, i, mkChar(ltnames[i]));
 
+    SEXP zone = NULL; // the last zone name, usually the same again
     for(R_xlen_t i = 0; i < n; i++) {
 	stm dummy, *ptm = &dummy;
 	double d = REAL(x)[i];
@@ -744,7 +745,8 @@ SEXP attribute_hidden do_asPOSIXlt(SEXP call, SEXP op, SEXP args, SEXP env)
 	    // or ptm->tm_zone
 	    if(valid && ptm->tm_isdst >= 0)
 		p = R_tzname[ptm->tm_isdst];
-	    SET_STRING_ELT(VECTOR_ELT(ans, 9), i, mkChar(p));
+	    if(!zone || strcmp(CHAR(zone), p)) zone = mkChar(p);
+	    SET_STRING_ELT(VECTOR_ELT(ans, 9), i, zone);
 #ifdef HAVE_TM_GMTOFF
 	    INTEGER(VECTOR_ELT(ans, 10))[i] =
 		valid ? (int)ptm->tm_gmtoff : NA_INTEGER;
@@ -1028,6 +1030,108 @@ SEXP attribute_hidden do_formatPOSIXlt(SEXP call, SEXP op, SEXP args, SEXP env)
 }
 
 
+/* Formats made up only of %Y %m %d %e %H %M %S %OS and %%, white
+   space and other ASCII characters are compiled into a list of steps
+   which is run directly on ASCII inputs, with the same results as
+   R_strptime().  That avoids re-interpreting the format for each
+   element, and in a multibyte locale converting both strings to wide
+   characters. */
+#define MAX_STRPTIME_STEPS 64
+typedef struct {
+    char op; /* ' ' for white space, 'c' for a literal, 'O' for %OS,
+		else the conversion character */
+    char c;
+} strptime_step;
+
+static int compile_strptime(const char *fmt, strptime_step *steps)
+{
+    int n = 0;
+    while (*fmt) {
+	if (n == MAX_STRPTIME_STEPS || (unsigned char) *fmt > 127) return -1;
+	if (isspace((int)*fmt)) {
+	    steps[n++].op = ' ';
+	    fmt++;
+	} else if (*fmt != '%') {
+	    steps[n].op = 'c';
+	    steps[n++].c = *fmt++;
+	} else {
+	    switch (*++fmt) {
+	    case '%':
+		steps[n].op = 'c';
+		steps[n++].c = '%';
+		fmt++;
+		break;
+	    case 'Y': case 'm': case 'd': case 'e': case 'H': case 'M': case 'S':
+		steps[n++].op = *fmt++;
+		break;
+	    case 'O':
+		if (fmt[1] != 'S') return -1;
+		steps[n++].op = 'O';
+		fmt += 2;
+		break;
+	    default:
+		return -1;
+	    }
+	}
+    }
+    return n;
+}
+
+static const char *
+run_strptime(const char *rp, const strptime_step *steps, int nsteps,
+	     stm *tm, double *psecs)
+{
+    Rboolean want_xday = FALSE;
+
+    for (int k = 0; k < nsteps; k++) {
+	int val = 0, from = 0, to, width = 2;
+	switch (steps[k].op) {
+	case ' ':
+	    while (isspace((int)*rp)) rp++;
+	    continue;
+	case 'c':
+	    if (*rp++ != steps[k].c) return NULL;
+	    continue;
+	case 'O':
+	{
+	    char *end;
+	    double sval = strtod(rp, &end);
+	    if (sval >= 0.0 && sval <= 61.0) {
+		tm->tm_sec = (int) sval;
+		*psecs = sval;
+	    }
+	    rp = end;
+	    continue;
+	}
+	case 'Y': to = 9999; width = 4; break;
+	case 'm': from = 1; to = 12; break;
+	case 'd': case 'e': from = 1; to = 31; break;
+	case 'H': to = 24; break;
+	case 'M': to = 59; break;
+	default: to = 61; break; /* 'S' */
+	}
+	/* as get_number() */
+	while (*rp == ' ') rp++;
+	if (*rp < '0' || *rp > '9') return NULL;
+	do val = 10 * val + (*rp++ - '0');
+	while (--width > 0 && *rp >= '0' && *rp <= '9');
+	if (val < from || val > to) return NULL;
+	switch (steps[k].op) {
+	case 'Y': tm->tm_year = val - 1900; want_xday = TRUE; break;
+	case 'm': tm->tm_mon = val - 1; want_xday = TRUE; break;
+	case 'd': case 'e': tm->tm_mday = val; want_xday = TRUE; break;
+	case 'H': tm->tm_hour = val; break;
+	case 'M': tm->tm_min = val; break;
+	default: tm->tm_sec = val; break;
+	}
+    }
+    if (want_xday) {
+	day_of_the_week(tm);
+	day_of_the_year(tm);
+    }
+    return rp;
+}
+
 SEXP attribute_hidden do_strptime(SEXP call, SEXP op, SEXP args, SEXP env)
 {
     SEXP x, sformat, ans, ansnames, klass, stz, tzone = R_NilValue;
@@ -1098,7 +1202,15 @@ SEXP attribute_hidden do_strptime(SEXP call, SEXP op, SEXP args, SEXP env)
 	SET_STRING_ELT(ansnames, i, mkChar(ltnames[i]));
 
 
+    strptime_step steps[MAX_STRPTIME_STEPS];
+    int nsteps = -1;
+    SEXP lastfmt = NULL, zone = NULL;
     for(R_xlen_t i = 0; i < N; i++) {
+	SEXP xi = STRING_ELT(x, i%n), fmt = STRING_ELT(sformat, i%m);
+	if(fmt != lastfmt) {
+	    lastfmt = fmt;
+	    nsteps = IS_ASCII(fmt) ? compile_strptime(CHAR(fmt), steps) : -1;
+	}
 	/* for glibc's sake. That only sets some unspecified fields,
 	   sometimes. */
 	memset(&tm, 0, sizeof(stm));
@@ -1110,10 +1222,12 @@ SEXP attribute_hidden do_strptime(SEXP call, SEXP op, SEXP args, SEXP env)
 	tm.tm_isdst = -1;
 #endif
 	offset = NA_INTEGER;
-	invalid = STRING_ELT(x, i%n) == NA_STRING ||
-	    !R_strptime(translateChar(STRING_ELT(x, i%n)),
-			translateChar(STRING_ELT(sformat, i%m)),
-			&tm, &psecs, &offset);
+	if(xi == NA_STRING) invalid = 1;
+	else if(nsteps >= 0 && IS_ASCII(xi))
+	    invalid = !run_strptime(CHAR(xi), steps, nsteps, &tm, &psecs);
+	else
+	    invalid = !R_strptime(translateChar(xi), translateChar(fmt),
+				  &tm, &psecs, &offset);
 	if(!invalid) {
 	    /* Solaris sets missing fields to 0 */
 	    if(tm.tm_mday == 0) tm.tm_mday = NA_INTEGER;
@@ -1156,7 +1270,8 @@ SEXP attribute_hidden do_strptime(SEXP call, SEXP op, SEXP args, SEXP env)
 #endif
 		    p = R_tzname[tm.tm_isdst];
 	    }
-	    SET_STRING_ELT(VECTOR_ELT(ans, 9), i, mkChar(p));
+	    if(!zone || strcmp(CHAR(zone), p)) zone = mkChar(p);
+	    SET_STRING_ELT(VECTOR_ELT(ans, 9), i, zone);
 #ifdef HAVE_TM_GMTOFF
 	    INTEGER(VECTOR_ELT(ans, 10))[i] =
 		invalid ? NA_INTEGER : (int)tm.tm_gmtoff;
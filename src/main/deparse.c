@@ -1,7 +1,7 @@
 /*
  *  R : A Computer Language for Statistical Data Analysis
  *  Copyright (C) 1995, 1996  Robert Gentleman and Ross Ihaka
- *  Copyright (C) 1997--2016  The R Core Team
+ *  Copyright (C) 1997--2017  The R Core Team
  *
  *  This program is free software; you can redistribute it and/or modify
  *  it under the terms of the GNU General Public License as published by
@@ -130,6 +130,7 @@ typedef struct {
     Rboolean active;
     int isS4;
     Rboolean fnarg; /* fn argument, so parenthesize = as assignment */
+    PROTECT_INDEX strvecIndex; /* strvec is grown by writeline() */
 } LocalParseData;
 
 static SEXP deparse1WithCutoff(SEXP call, Rboolean abbrev, int cutoff,
@@ -220,19 +221,25 @@ static SEXP deparse1WithCutoff(SEXP call, Rboolean abbrev, int cutoff,
     savedigits = R_print.digits;
     R_print.digits = DBL_DIG;/* MAX precision */
 
-    svec = R_NilValue;
-    if (nlines > 0) {
-	localData.linenumber = localData.maxlines = nlines;
-    } else {
-	deparse2(call, svec, &localData);/* just to determine linenumber..*/
-	localData.active = TRUE;
-	if(R_BrowseLines > 0 && localData.linenumber > R_BrowseLines) {
-	    localData.linenumber = localData.maxlines = R_BrowseLines + 1;
-	    need_ellipses = TRUE;
-	}
-    }
-    PROTECT(svec = allocVector(STRSXP, localData.linenumber));
+    /* Rather than deparsing twice, first to count the lines, the
+       lines are collected in a vector which writeline() doubles in
+       length as needed, and which is shortened at the end. */
+    if (nlines > 0)
+	localData.maxlines = nlines;
+    else if(R_BrowseLines > 0) /* enough to know if "  ..." is needed */
+	localData.maxlines = R_BrowseLines + 1;
+    PROTECT_WITH_INDEX(svec = allocVector(STRSXP, nlines > 0 ? nlines : 8),
+		       &localData.strvecIndex);
     deparse2(call, svec, &localData);
+    svec = localData.strvec;
+    if (nlines <= 0 && R_BrowseLines > 0 &&
+	localData.linenumber > R_BrowseLines) {
+	localData.linenumber = R_BrowseLines + 1;
+	need_ellipses = TRUE;
+    }
+    if(localData.linenumber < LENGTH(svec))
+	REPROTECT(svec = lengthgets(svec, localData.linenumber),
+		  localData.strvecIndex);
     if (abbrev) {
 	char data[14];
 	strncpy(data, CHAR(STRING_ELT(svec, 0)), 10);
@@ -242,11 +249,6 @@ static SEXP deparse1WithCutoff(SEXP call, Rboolean abbrev, int cutoff,
     } else if(need_ellipses) {
 	SET_STRING_ELT(svec, R_BrowseLines, mkChar("  ..."));
     }
-    if(nlines > 0 && localData.linenumber < nlines) {
-	UNPROTECT(1); /* old svec value */
-	PROTECT(svec);
-	svec = lengthgets(svec, localData.linenumber);
-    }
     UNPROTECT(1);
     PROTECT(svec); /* protect from warning() allocating, PR#14356 */
     R_print.digits = savedigits;
@@ -1265,8 +1267,12 @@ static void deparse2buff(SEXP s, LocalParseData *d)
 
 static void writeline(LocalParseData *d)
 {
-    if (d->strvec != R_NilValue && d->linenumber < d->maxlines)
+    if (d->strvec != R_NilValue && d->linenumber < d->maxlines) {
+	if (d->linenumber >= LENGTH(d->strvec))
+	    REPROTECT(d->strvec = lengthgets(d->strvec, 2 * LENGTH(d->strvec)),
+		      d->strvecIndex);
 	SET_STRING_ELT(d->strvec, d->linenumber, mkChar(d->buffer.data));
+    }
     d->linenumber++;
     if (d->linenumber >= d->maxlines) d->active = FALSE;
     /* reset */
@@ -1284,10 +1290,13 @@ static void print2buff(const char *strng, LocalParseData *d)
 	printtab2buff(d->indent, d);	/*if at the start of a line tab over */
     }
     tlen = strlen(strng);
-    R_AllocStringBuffer(0, &(d->buffer));
-    bufflen = strlen(d->buffer.data);
-    R_AllocStringBuffer(bufflen + tlen, &(d->buffer));
-    strcat(d->buffer.data, strng);
+    bufflen = d->len; /* == strlen(d->buffer.data) */
+    /* grow geometrically, so long lines take linear time */
+    if (bufflen + tlen >= d->buffer.bufsize)
+	R_AllocStringBuffer((bufflen + tlen > 2 * d->buffer.bufsize) ?
+			    bufflen + tlen : 2 * d->buffer.bufsize,
+			    &(d->buffer));
+    memcpy(d->buffer.data + bufflen, strng, tlen + 1);
     d->len += (int) tlen;
 }
 
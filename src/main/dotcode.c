@@ -1,7 +1,7 @@
 /*
  *  R : A Computer Language for Statistical Data Analysis
  *  Copyright (C) 1995  Robert Gentleman and Ross Ihaka
- *  Copyright (C) 1997--2014  The R Core Team
+ *  Copyright (C) 1997--2017  The R Core Team
  *  Copyright (C) 2003	      The R Foundation
  *
  *  This program is free software; you can redistribute it and/or modify
@@ -180,7 +180,10 @@ DL_FUNC R_dotCallFn(SEXP op, SEXP call, int nargs) {
     R_RegisteredNativeSymbol symbol = {R_CALL_SYM, {NULL}, NULL};
     DL_FUNC fun = NULL;
     checkValidSymbolId(op, call, &fun, &symbol, NULL);
-    /* should check arg count here as well */
+    /* leave a wrong number of arguments to be reported by do_dotcall */
+    if (symbol.symbol.call && symbol.symbol.call->numArgs > -1 &&
+	symbol.symbol.call->numArgs != nargs)
+	return NULL;
     return fun;
 }
 
@@ -1482,6 +1485,9 @@ SEXP attribute_hidden do_dotCode(SEXP call, SEXP op, SEXP args, SEXP env)
 		      na+1, symName);
 	}
 	int nprotect = 0, targetType =  checkTypes ? checkTypes[na] : 0;
+	/* Registered R_ARG_IN arguments are not returned, so need not
+	   be copied, and the values of R_ARG_OUT arguments are not used */
+	R_NativeArgStyle style = argStyles ? argStyles[na] : R_ARG_IN_OUT;
 	R_xlen_t n;
 	s = CAR(pa);
 	/* start with return value a copy of the inputs, as that is
@@ -1520,10 +1526,11 @@ SEXP attribute_hidden do_dotCode(SEXP call, SEXP op, SEXP args, SEXP env)
 		ptr += NG;
 		memcpy(ptr, RAW(s), n);
 		cargs[na] = (void *) ptr;
-	    } else if (MAYBE_REFERENCED(s)) {
+	    } else if (MAYBE_REFERENCED(s) && style != R_ARG_IN) {
 		n = XLENGTH(s);
 		SEXP ss = allocVector(t, n);
-		memcpy(RAW(ss), RAW(s), n * sizeof(Rbyte));
+		if (style != R_ARG_OUT)
+		    memcpy(RAW(ss), RAW(s), n * sizeof(Rbyte));
 		SET_VECTOR_ELT(ans, na, ss);
 		cargs[na] = (void*) RAW(ss);
 #ifdef R_MEMORY_PROFILING
@@ -1535,7 +1542,7 @@ SEXP attribute_hidden do_dotCode(SEXP call, SEXP op, SEXP args, SEXP env)
 	case INTSXP:
 	    n = XLENGTH(s);
 	    int *iptr = INTEGER(s);
-	    if (!naok)
+	    if (!naok && style != R_ARG_OUT)
 		for (R_xlen_t i = 0 ; i < n ; i++)
 		    if(iptr[i] == NA_INTEGER)
 			error(_("NAs in foreign function call (arg %d)"), na + 1);
@@ -1545,9 +1552,10 @@ SEXP attribute_hidden do_dotCode(SEXP call, SEXP op, SEXP args, SEXP env)
 		ptr += NG;
 		memcpy(ptr, INTEGER(s), n * sizeof(int));
 		cargs[na] = (void*) ptr;
-	    } else if (MAYBE_REFERENCED(s)) {
+	    } else if (MAYBE_REFERENCED(s) && style != R_ARG_IN) {
 		SEXP ss = allocVector(t, n);
-		memcpy(INTEGER(ss), INTEGER(s), n * sizeof(int));
+		if (style != R_ARG_OUT)
+		    memcpy(INTEGER(ss), INTEGER(s), n * sizeof(int));
 		SET_VECTOR_ELT(ans, na, ss);
 		cargs[na] = (void*) INTEGER(ss);
 #ifdef R_MEMORY_PROFILING
@@ -1558,7 +1566,7 @@ SEXP attribute_hidden do_dotCode(SEXP call, SEXP op, SEXP args, SEXP env)
 	case REALSXP:
 	    n = XLENGTH(s);
 	    double *rptr = REAL(s);
-	    if (!naok)
+	    if (!naok && style != R_ARG_OUT)
 		for (R_xlen_t i = 0 ; i < n ; i++)
 		    if(!R_FINITE(rptr[i]))
 			error(_("NA/NaN/Inf in foreign function call (arg %d)"), na + 1);
@@ -1575,9 +1583,10 @@ SEXP attribute_hidden do_dotCode(SEXP call, SEXP op, SEXP args, SEXP env)
 		ptr += NG;
 		memcpy(ptr, REAL(s), n * sizeof(double));
 		cargs[na] = (void*) ptr;
-	    } else if (MAYBE_REFERENCED(s)) {
+	    } else if (MAYBE_REFERENCED(s) && style != R_ARG_IN) {
 		SEXP ss  = allocVector(t, n);
-		memcpy(REAL(ss), REAL(s), n * sizeof(double));
+		if (style != R_ARG_OUT)
+		    memcpy(REAL(ss), REAL(s), n * sizeof(double));
 		SET_VECTOR_ELT(ans, na, ss);
 		cargs[na] = (void*) REAL(ss);
 #ifdef R_MEMORY_PROFILING
@@ -1588,7 +1597,7 @@ SEXP attribute_hidden do_dotCode(SEXP call, SEXP op, SEXP args, SEXP env)
 	case CPLXSXP:
 	    n = XLENGTH(s);
 	    Rcomplex *zptr = COMPLEX(s);
-	    if (!naok)
+	    if (!naok && style != R_ARG_OUT)
 		for (R_xlen_t i = 0 ; i < n ; i++)
 		    if(!R_FINITE(zptr[i].r) || !R_FINITE(zptr[i].i))
 			error(_("complex NA/NaN/Inf in foreign function call (arg %d)"), na + 1);
@@ -1598,9 +1607,10 @@ SEXP attribute_hidden do_dotCode(SEXP call, SEXP op, SEXP args, SEXP env)
 		ptr += NG;
 		memcpy(ptr, COMPLEX(s), n * sizeof(Rcomplex));
 		cargs[na] = (void*) ptr;
-	    } else if (MAYBE_REFERENCED(s)) {
+	    } else if (MAYBE_REFERENCED(s) && style != R_ARG_IN) {
 		SEXP ss = allocVector(t, n);
-		memcpy(COMPLEX(ss), COMPLEX(s), n * sizeof(Rcomplex));
+		if (style != R_ARG_OUT)
+		    memcpy(COMPLEX(ss), COMPLEX(s), n * sizeof(Rcomplex));
 		SET_VECTOR_ELT(ans, na, ss);
 		cargs[na] = (void*) COMPLEX(ss);
 #ifdef R_MEMORY_PROFILING
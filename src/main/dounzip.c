@@ -104,24 +104,27 @@ static void setFileTime(const char *fn, tm_unz tmu_date)
 #endif
 
 #define BUF_SIZE 4096
+
+/* Work out in outname where the current member of uf (or filename, if
+   non-NULL) is to be extracted to, and make the directories needed.
+   *isfile is set to 0 for a directory entry, which is created here. */
 static int
-extract_one(unzFile uf, const char *const dest, const char * const filename,
-	    SEXP names, int *nnames, int overwrite, int junk, int setTime)
+extract_name(unzFile uf, const char *const dest, const char * const filename,
+	     int overwrite, int junk, char *outname, int *isfile,
+	     unz_file_info64 *file_info)
 {
     int err = UNZ_OK;
-    FILE *fout;
-    char  outname[PATH_MAX], dirs[PATH_MAX], buf[BUF_SIZE], *p, *pp;
+    char dirs[PATH_MAX], *p, *pp;
     char *fn, fn0[PATH_MAX];
 
-    err = unzOpenCurrentFile(uf);
-    if (err != UNZ_OK) return err;
+    *isfile = 0;
     if (strlen(dest) > PATH_MAX - 1) return 1;
     strcpy(outname, dest);
     strcat(outname, FILESEP);
-    unz_file_info64 file_info;
     char filename_inzip[PATH_MAX];
-    err = unzGetCurrentFileInfo64(uf, &file_info, filename_inzip,
+    err = unzGetCurrentFileInfo64(uf, file_info, filename_inzip,
 				  sizeof(filename_inzip), NULL, 0, NULL, 0);
+    if (err != UNZ_OK) return err;
     fn = filename_inzip; /* might be UTF-8 ... */
     if (filename) {
 	if (strlen(dest) + strlen(filename) > PATH_MAX - 2) return 1;
@@ -136,6 +139,7 @@ extract_one(unzFile uf, const char *const dest, const char * const filename,
 	p = Rf_strrchr(fn, '/');
 	if (p) fn = p+1;
     }
+    if (strlen(outname) + strlen(fn) > PATH_MAX - 1) return 1;
     strcat(outname, fn);
 
 #ifdef Win32
@@ -171,32 +175,165 @@ extract_one(unzFile uf, const char *const dest, const char * const filename,
 	if (!overwrite && R_FileExists(outname)) {
 	    warning(_(" not overwriting file '%s"), outname);
 	}
-	fout = R_fopen(outname, "wb");
-	int serrno = errno;
-	if (!fout) {
-	    unzCloseCurrentFile(uf);
-	    error(_("cannot open file '%s': %s"), outname, strerror(serrno));
-	    return 3;		/* not reached */
-	}
-	while (1) {
-	    err = unzReadCurrentFile(uf, buf, BUF_SIZE);
-	    /* Rprintf("read %d bytes\n", err); */
-	    if (err <= 0) break;
-	    if (fwrite(buf, err, 1, fout) != 1) { err = -200; break; }
-	    if (err < BUF_SIZE) { err = 0; break; }
-	}
-	fclose(fout);
-	SET_STRING_ELT(names, (*nnames)++, mkChar(outname));
+	*isfile = 1;
     }
+    return err;
+}
+
+/* Copy the current member of uf to outname.  This uses no R API, as
+   it is run on several threads by zipunzip_parallel.  Returns 3, with
+   errno in *serrno, if outname cannot be opened. */
+static int extract_copy(unzFile uf, const char *outname, int *serrno)
+{
+    int err;
+    FILE *fout;
+    char buf[BUF_SIZE];
+
+    err = unzOpenCurrentFile(uf);
+    if (err != UNZ_OK) return err;
+    fout = R_fopen(outname, "wb");
+    if (!fout) {
+	*serrno = errno;
+	unzCloseCurrentFile(uf);
+	return 3;
+    }
+    while (1) {
+	err = unzReadCurrentFile(uf, buf, BUF_SIZE);
+	/* Rprintf("read %d bytes\n", err); */
+	if (err <= 0) break;
+	if (fwrite(buf, err, 1, fout) != 1) { err = -200; break; }
+	if (err < BUF_SIZE) { err = 0; break; }
+    }
+    fclose(fout);
     unzCloseCurrentFile(uf);
+    return err;
+}
+
+static void
+extract_time(const char *outname, unz_file_info64 *file_info)
+{
 #ifdef Win32
-    if (setTime) setFileTime(outname, file_info.dosDate);
+    setFileTime(outname, file_info->dosDate);
 #else
-    if (setTime) setFileTime(outname, file_info.tmu_date);
+    setFileTime(outname, file_info->tmu_date);
 #endif
+}
+
+static int
+extract_one(unzFile uf, const char *const dest, const char * const filename,
+	    SEXP names, int *nnames, int overwrite, int junk, int setTime)
+{
+    int err, isfile, serrno = 0;
+    char outname[PATH_MAX];
+    unz_file_info64 file_info;
+
+    err = extract_name(uf, dest, filename, overwrite, junk, outname,
+		       &isfile, &file_info);
+    if (err == UNZ_OK && isfile) {
+	err = extract_copy(uf, outname, &serrno);
+	if (err == 3)
+	    error(_("cannot open file '%s': %s"), outname, strerror(serrno));
+	SET_STRING_ELT(names, (*nnames)++, mkChar(outname));
+    }
+    if (setTime) extract_time(outname, &file_info);
     return err;
 }
 
+/* Extraction of several members, with the copying done on nthreads
+   threads each with its own handle on the zip file: the names and
+   directories are worked out first, and the results reported in order
+   afterwards.  Members of 4GB or more are copied on the main thread, as
+   unzReadCurrentFile may warn about them. */
+#define ZIPJOB_BIG(job) ((job)->info.uncompressed_size >= 4294967295U)
+
+typedef struct {
+    char *outname;
+    int isfile, err, serrno;
+    unz64_file_pos pos;
+    unz_file_info64 info;
+} zipjob;
+
+static int
+zipunzip_parallel(unzFile uf, const char *zipname, const char *dest,
+		  int nfiles, const char **files, int nentry, SEXP *pnames,
+		  int *nnames, int overwrite, int junk, int setTime,
+		  int nthreads)
+{
+    int i, njobs, err = UNZ_OK;
+    int n = nfiles ? nfiles : nentry;
+    zipjob *jobs = (zipjob *) R_alloc(n, sizeof(zipjob));
+    char outname[PATH_MAX];
+    SEXP names = *pnames;
+
+    for (njobs = 0; njobs < n; njobs++) {
+	zipjob *job = jobs + njobs;
+	if (nfiles)
+	    err = unzLocateFileIndexed(uf, zipname, files[njobs]);
+	else if (njobs > 0)
+	    err = unzGoToNextFile(uf);
+	if (err != UNZ_OK) break;
+	unzGetFilePos64(uf, &job->pos);
+	err = extract_name(uf, dest, nfiles ? files[njobs] : NULL,
+			   overwrite, junk, outname, &job->isfile, &job->info);
+	job->err = err;
+	job->serrno = 0;
+	job->outname = R_alloc(strlen(outname) + 1, sizeof(char));
+	strcpy(job->outname, outname);
+	if (err != UNZ_OK) {
+	    njobs++;
+	    break;
+	}
+#ifdef Win32
+	R_ProcessEvents();
+#else
+	R_CheckUserInterrupt();
+#endif
+    }
+
+#ifdef _OPENMP
+#pragma omp parallel num_threads(nthreads)
+#endif
+    {
+	unzFile tuf = unzOpen64(zipname);
+#ifdef _OPENMP
+#pragma omp for schedule(dynamic)
+#endif
+	for (int k = 0; k < njobs; k++) {
+	    zipjob *job = jobs + k;
+	    if (!job->isfile || job->err != UNZ_OK || ZIPJOB_BIG(job))
+		continue;
+	    job->err = tuf ? unzGoToFilePos64(tuf, &job->pos) : 1;
+	    if (job->err == UNZ_OK)
+		job->err = extract_copy(tuf, job->outname, &job->serrno);
+	}
+	if (tuf) unzClose(tuf);
+    }
+    for (i = 0; i < njobs; i++) {
+	zipjob *job = jobs + i;
+	if (!job->isfile || job->err != UNZ_OK || !ZIPJOB_BIG(job)) continue;
+	job->err = unzGoToFilePos64(uf, &job->pos);
+	if (job->err == UNZ_OK)
+	    job->err = extract_copy(uf, job->outname, &job->serrno);
+    }
+
+    if (njobs > LENGTH(names)) {
+	names = allocVector(STRSXP, njobs);
+	UNPROTECT(1);
+	PROTECT(names);
+	*pnames = names;
+    }
+    for (i = 0; i < njobs; i++) {
+	zipjob *job = jobs + i;
+	if (job->err == 3)
+	    error(_("cannot open file '%s': %s"), job->outname,
+		  strerror(job->serrno));
+	if (job->isfile)
+	    SET_STRING_ELT(names, (*nnames)++, mkChar(job->outname));
+	if (setTime) extract_time(job->outname, &job->info);
+	if (job->err != UNZ_OK) return job->err;
+    }
+    return err;
+}
 
 static int
 zipunzip(const char *zipname, const char *dest, int nfiles, const char **files,
@@ -205,12 +342,19 @@ zipunzip(const char *zipname, const char *dest, int nfiles, const char **files,
     int   i, err = UNZ_OK;
     unzFile uf;
     SEXP names = *pnames;
+    unz_global_info64 gi;
 
     uf = unzOpen64(zipname);
     if (!uf) return 1;
+    unzGetGlobalInfo64(uf, &gi);
+    if (R_num_math_threads > 1 && (nfiles ? nfiles : gi.number_entry) > 1) {
+	err = zipunzip_parallel(uf, zipname, dest, nfiles, files,
+				(int) gi.number_entry, pnames, nnames,
+				overwrite, junk, setTime, R_num_math_threads);
+	unzClose(uf);
+	return err;
+    }
     if (nfiles == 0) { /* all files */
-	unz_global_info64 gi;
-	unzGetGlobalInfo64(uf, &gi);
 	for (i = 0; i < gi.number_entry; i++) {
 	    if (i > 0) if ((err = unzGoToNextFile(uf)) != UNZ_OK) break;
 	    if (*nnames+1 >= LENGTH(names)) {
@@ -230,7 +374,8 @@ zipunzip(const char *zipname, const char *dest, int nfiles, const char **files,
 	}
     } else {
 	for (i = 0; i < nfiles; i++) {
-	    if ((err = unzLocateFile(uf, files[i], 1)) != UNZ_OK) break;
+	    if ((err = unzLocateFileIndexed(uf, zipname, files[i])) != UNZ_OK)
+		break;
 	    if ((err = extract_one(uf, dest, files[i], names, nnames,
 				   overwrite, junk, setTime)) != UNZ_OK) break;
 #ifdef Win32
@@ -422,7 +567,7 @@ static Rboolean unz_open(Rconnection con)
 	warning(_("cannot open zip file '%s'"), path);
 	return FALSE;
     }
-    if (unzLocateFile(uf, p+1, 1) != UNZ_OK) {
+    if (unzLocateFileIndexed(uf, path, p+1) != UNZ_OK) {
 	warning(_("cannot locate file '%s' in zip file '%s'"), p+1, path);
 	unzClose(uf);
 	return FALSE;
@@ -465,6 +610,23 @@ static size_t unz_read(void *ptr, size_t size, size_t nitems,
     return unzReadCurrentFile(uf, ptr, (unsigned int)(size*nitems))/size;
 }
 
+static double unz_seek(Rconnection con, double where, int origin, int rw)
+{
+    unzFile uf = ((Runzconn)(con->private))->uf;
+    double pos = (double) unzTellCurrentFile(uf);
+
+    if(ISNA(where)) return pos;
+    switch(origin) {
+    case 2: where += pos; break;
+    case 3: where += (double) unzSizeCurrentFile(uf); break;
+    default: break;
+    }
+    if(where < 0) where = 0;
+    if(unzSeekCurrentFile(uf, (ZPOS64_T) where) != UNZ_OK)
+	warning(_("seek on the 'unz' connection failed"));
+    return pos;
+}
+
 static int NORET null_vfprintf(Rconnection con, const char *format, va_list ap)
 {
     error(_("printing not enabled for this connection"));
@@ -476,11 +638,6 @@ static size_t NORET null_write(const void *ptr, size_t size, size_t nitems,
     error(_("write not enabled for this connection"));
 }
 
-static double NORET null_seek(Rconnection con, double where, int origin, int rw)
-{
-    error(_("seek not enabled for this connection"));
-}
-
 static int null_fflush(Rconnection con)
 {
     return 0;
@@ -511,7 +668,7 @@ R_newunz(const char *description, const char *const mode)
     new->vfprintf = &null_vfprintf;
     new->fgetc_internal = &unz_fgetc_internal;
     new->fgetc = &dummy_fgetc;
-    new->seek = &null_seek;
+    new->seek = &unz_seek;
     new->fflush = &null_fflush;
     new->read = &unz_read;
     new->write = &null_write;
@@ -1621,6 +1778,150 @@ extern int ZEXPORT unzLocateFile (unzFile file, const char *szFileName, int iCas
 // comprehensive file read to put the file I need in a memory.
 */
 
+static int unzGetFilePos64(unzFile file, unz64_file_pos* file_pos)
+{
+    unz64_s* s;
+
+    if (file == NULL || file_pos == NULL)
+	return UNZ_PARAMERROR;
+    s = (unz64_s*)file;
+    if (!s->current_file_ok)
+	return UNZ_END_OF_LIST_OF_FILE;
+
+    file_pos->pos_in_zip_directory  = s->pos_in_central_dir;
+    file_pos->num_of_file           = s->num_file;
+
+    return UNZ_OK;
+}
+
+static int unzGoToFilePos64(unzFile file, const unz64_file_pos* file_pos)
+{
+    unz64_s* s;
+    int err;
+
+    if (file == NULL || file_pos == NULL)
+	return UNZ_PARAMERROR;
+    s = (unz64_s*)file;
+
+    /* jump to the right spot */
+    s->pos_in_central_dir = file_pos->pos_in_zip_directory;
+    s->num_file           = file_pos->num_of_file;
+
+    /* set the current file */
+    err = unz64local_GetCurrentFileInfoInternal(file,&s->cur_file_info,
+					       &s->cur_file_info_internal,
+					       NULL,0,NULL,0,NULL,0);
+    /* return results */
+    s->current_file_ok = (err == UNZ_OK);
+    return err;
+}
+
+/* R ADDITION: the directory cache suggested above, for the zipfile
+   used last.  Its entries are sorted by name (and then position), so
+   a member of a large zipfile is found by a binary search rather than
+   by reading the central directory up to it. */
+typedef struct {
+    char *name;
+    unz64_file_pos pos;
+} zipentry;
+
+static struct {
+    char *path;
+    time_t mtime;
+    ZPOS64_T central_pos, nentry;
+    zipentry *entries;
+} zipindex = {NULL, 0, 0, 0, NULL};
+
+static int zipentry_cmp(const void *a, const void *b)
+{
+    const zipentry *x = a, *y = b;
+    int c = strcmp(x->name, y->name);
+    if (c) return c;
+    return (x->pos.num_of_file > y->pos.num_of_file) -
+	(x->pos.num_of_file < y->pos.num_of_file);
+}
+
+static void zipindex_free(void)
+{
+    if (zipindex.entries)
+	for (ZPOS64_T i = 0; i < zipindex.nentry; i++)
+	    free(zipindex.entries[i].name);
+    free(zipindex.entries);
+    free(zipindex.path);
+    zipindex.entries = NULL;
+    zipindex.path = NULL;
+    zipindex.nentry = 0;
+}
+
+static int zipindex_build(unz64_s* s, const char *zipname, time_t mtime)
+{
+    ZPOS64_T i, n = s->gi.number_entry;
+    int err;
+
+    zipindex_free();
+    zipindex.entries = (zipentry *) calloc(n ? n : 1, sizeof(zipentry));
+    zipindex.path = (char *) malloc(strlen(zipname) + 1);
+    if (!zipindex.entries || !zipindex.path) {
+	zipindex_free();
+	return UNZ_INTERNALERROR;
+    }
+    strcpy(zipindex.path, zipname);
+    zipindex.nentry = n;
+    err = unzGoToFirstFile((unzFile) s);
+    for (i = 0; i < n && err == UNZ_OK; i++) {
+	char name[UNZ_MAXFILENAMEINZIP+1];
+	err = unzGetCurrentFileInfo64((unzFile) s, NULL, name,
+				      sizeof(name)-1, NULL, 0, NULL, 0);
+	if (err != UNZ_OK) break;
+	unzGetFilePos64((unzFile) s, &zipindex.entries[i].pos);
+	zipindex.entries[i].name = (char *) malloc(strlen(name) + 1);
+	if (!zipindex.entries[i].name) {
+	    err = UNZ_INTERNALERROR;
+	    break;
+	}
+	strcpy(zipindex.entries[i].name, name);
+	if (i < n - 1) err = unzGoToNextFile((unzFile) s);
+    }
+    if (err != UNZ_OK) {
+	zipindex_free();
+	return err;
+    }
+    qsort(zipindex.entries, n, sizeof(zipentry), zipentry_cmp);
+    zipindex.mtime = mtime;
+    zipindex.central_pos = s->central_pos;
+    return UNZ_OK;
+}
+
+static int unzLocateFileIndexed(unzFile file, const char *zipname,
+				const char *szFileName)
+{
+    unz64_s* s = (unz64_s*)file;
+    struct stat sb;
+    ZPOS64_T lo = 0, hi;
+
+    if (file == NULL)
+	return UNZ_PARAMERROR;
+    if (stat(zipname, &sb) != 0)
+	return unzLocateFile(file, szFileName, 1);
+    if (!zipindex.path || strcmp(zipindex.path, zipname) ||
+	zipindex.mtime != sb.st_mtime ||
+	zipindex.central_pos != s->central_pos ||
+	zipindex.nentry != s->gi.number_entry)
+	if (zipindex_build(s, zipname, sb.st_mtime) != UNZ_OK)
+	    return unzLocateFile(file, szFileName, 1);
+
+    /* the first entry not before szFileName */
+    hi = zipindex.nentry;
+    while (lo < hi) {
+	ZPOS64_T mid = lo + (hi - lo) / 2;
+	if (strcmp(zipindex.entries[mid].name, szFileName) < 0) lo = mid + 1;
+	else hi = mid;
+    }
+    if (lo == zipindex.nentry || strcmp(zipindex.entries[lo].name, szFileName))
+	return UNZ_END_OF_LIST_OF_FILE;
+    return unzGoToFilePos64(file, &zipindex.entries[lo].pos);
+}
+
 
 /*
 // Unzip Helper Functions - should be here?
@@ -2136,6 +2437,60 @@ static int unzCloseCurrentFile (unzFile file)
     return err;
 }
 
+/* R ADDITION: random access within the current file */
+static ZPOS64_T unzTellCurrentFile (unzFile file)
+{
+    unz64_s* s = (unz64_s*)file;
+    if (s == NULL || s->pfile_in_zip_read == NULL) return 0;
+    return s->pfile_in_zip_read->total_out_64;
+}
+
+static ZPOS64_T unzSizeCurrentFile (unzFile file)
+{
+    unz64_s* s = (unz64_s*)file;
+    if (s == NULL || !s->current_file_ok) return 0;
+    return s->cur_file_info.uncompressed_size;
+}
+
+static int unzSeekCurrentFile (unzFile file, ZPOS64_T pos)
+{
+    unz64_s* s = (unz64_s*)file;
+    file_in_zip64_read_info_s* p;
+    ZPOS64_T size;
+    char buf[UNZ_BUFSIZE];
+
+    if (s == NULL || (p = s->pfile_in_zip_read) == NULL)
+	return UNZ_PARAMERROR;
+    size = s->cur_file_info.uncompressed_size;
+    if (pos > size) pos = size;
+
+    if (p->compression_method == 0 &&
+	s->cur_file_info.compressed_size == size) {
+	/* the data of a stored file starts this far back */
+	ZPOS64_T start = p->pos_in_zipfile -
+	    (s->cur_file_info.compressed_size - p->rest_read_compressed);
+	p->pos_in_zipfile = start + pos;
+	p->rest_read_compressed = p->rest_read_uncompressed = size - pos;
+	p->stream.avail_in = 0;
+	p->total_out_64 = pos;
+	p->raw = 1; /* no CRC check on closing */
+	return UNZ_OK;
+    }
+
+    if (pos < p->total_out_64) {
+	int err = unzOpenCurrentFile(file);
+	if (err != UNZ_OK) return err;
+	p = s->pfile_in_zip_read;
+    }
+    while (p->total_out_64 < pos) {
+	ZPOS64_T n = pos - p->total_out_64;
+	int res = unzReadCurrentFile(file, buf,
+				     (unsigned) (n < UNZ_BUFSIZE ? n : UNZ_BUFSIZE));
+	if (res <= 0) return res < 0 ? res : UNZ_EOF;
+    }
+    return UNZ_OK;
+}
+
 
 #ifdef Win32
 # define f_seek fseeko64
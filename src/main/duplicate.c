@@ -2,7 +2,7 @@
  *  R : A Computer Langage for Statistical Data Analysis
  *  Copyright (C) 1995, 1996  Robert Gentleman and Ross Ihaka
  *            (C) 2004  The R Foundation
- *  Copyright (C) 1998-2015 The R Core Team.
+ *  Copyright (C) 1998-2017 The R Core Team.
  *
  *  This program is free software; you can redistribute it and/or modify
  *  it under the terms of the GNU General Public License as published by
@@ -131,6 +131,7 @@ SEXP duplicate(SEXP s){
 #ifdef R_PROFILING
     duplicate_counter++;
 #endif
+    R_PERF_COUNT(PERF_DUPLICATE);
     t = duplicate1(s, TRUE);
 #ifdef R_MEMORY_PROFILING
     if (RTRACE(s) && !(TYPEOF(s) == CLOSXP || TYPEOF(s) == BUILTINSXP ||
@@ -150,6 +151,7 @@ SEXP shallow_duplicate(SEXP s)
 #ifdef R_PROFILING
     duplicate_counter++;
 #endif
+    R_PERF_COUNT(PERF_DUPLICATE);
     t = duplicate1(s, FALSE);
 #ifdef R_MEMORY_PROFILING
     if (RTRACE(s) && !(TYPEOF(s) == CLOSXP || TYPEOF(s) == BUILTINSXP ||
@@ -285,14 +287,8 @@ static SEXP duplicate1(SEXP s, Rboolean deep)
 	return s;
     case CLOSXP:
 	PROTECT(s);
-	if (R_jit_enabled > 1 && TYPEOF(BODY(s)) != BCODESXP) {
-	    int old_enabled = R_jit_enabled;
-	    SEXP new_s;
-	    R_jit_enabled = 0;
-	    new_s = R_cmpfun(s);
-	    SET_BODY(s, BODY(new_s));
-	    R_jit_enabled = old_enabled;
-	}
+	if (R_jit_enabled > 1 && TYPEOF(BODY(s)) != BCODESXP)
+	    R_jitClosure(s);
 	PROTECT(t = allocSExp(CLOSXP));
 	SET_FORMALS(t, FORMALS(s));
 	SET_BODY(t, BODY(s));
@@ -477,8 +473,7 @@ void attribute_hidden \
 xcopy##TNAME##WithRecycle(VALTYPE *dst, VALTYPE *src, R_xlen_t dstart, R_xlen_t n, R_xlen_t nsrc) { \
 							\
     if (nsrc >= n) { /* no recycle needed */		\
-	for(R_xlen_t i = 0; i < n; i++)		\
-	    dst[dstart + i] = src[i];			\
+	memcpy(dst + dstart, src, n * sizeof(VALTYPE));	\
 	return;					\
     }							\
     if (nsrc == 1) {					\
@@ -534,6 +529,12 @@ void attribute_hidden xfill##TNAME##MatrixWithRecycle(VALTYPE *dst, VALTYPE *src
     R_xlen_t dstart, R_xlen_t drows, R_xlen_t srows,		\
     R_xlen_t cols, R_xlen_t nsrc) {				\
 								\
+    if (nsrc == srows * cols) { /* a matrix: copy by column */	\
+	for(R_xlen_t j = 0; j < cols; j++)			\
+	    memcpy(dst + dstart + j * drows, src + j * srows,	\
+		   srows * sizeof(VALTYPE));			\
+	return;							\
+    }								\
     FILL_MATRIX_ITERATE(dstart, drows, srows, cols, nsrc)	\
 	dst[didx] = src[sidx];					\
 }
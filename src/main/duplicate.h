@@ -22,25 +22,26 @@
 
 /*    
 FILL_MATRIX_ITERATE
-Iterator macro to fill a matrix from a vector with re-use of vector
+Iterator macro to fill a matrix from a vector with re-use of vector.
+It goes down the columns, so that both dst and src are read and
+written in storage order.
 
-    for(R_xlen_t i = 0; i < srows; i++) {
-        R_xlen_t sidx = i;
-        for(R_xlen_t j = 0; j < cols; j++, sidx += srows) {
-            if (sidx >= nsrc) sidx -= nsrc;
+    R_xlen_t sidx = 0;
+    for(R_xlen_t j = 0; j < cols; j++) {
+        for(R_xlen_t i = 0; i < srows; i++) {
             didx = dstart + i + (j * drows);
             ... "dst[didx] = src[sidx]"
+            if (++sidx >= nsrc) sidx = 0;
         }
     }
 */
 
 #define FILL_MATRIX_ITERATE(dstart, drows, srows, cols, nsrc) 		\
-    for(R_xlen_t i = 0, sidx = 0; i < srows; i++, sidx = i)		\
-        for(R_xlen_t j = 0, didx = dstart + i; j < cols;		\
-            j++, 							\
-            sidx += srows,						\
-            (sidx >= nsrc) ? sidx -= nsrc : 0,				\
-            didx += drows)
+    for(R_xlen_t j = 0, sidx = 0; j < cols; j++)			\
+        for(R_xlen_t i = 0, didx = dstart + j * (drows); i < srows;	\
+            i++, 							\
+            didx++,							\
+            (++sidx >= nsrc) ? sidx = 0 : 0)
 
 void xcopyComplexWithRecycle(Rcomplex *dst, Rcomplex *src, R_xlen_t dstart, R_xlen_t n, R_xlen_t nsrc);
 void xcopyIntegerWithRecycle(int *dst, int *src, R_xlen_t dstart, R_xlen_t n, R_xlen_t nsrc);
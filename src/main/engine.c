@@ -1,6 +1,6 @@
 /*
  *  R : A Computer Language for Statistical Data Analysis
- *  Copyright (C) 2001-2015  The R Core Team.
+ *  Copyright (C) 2001-2017  The R Core Team.
  *
  *  This program is free software; you can redistribute it and/or modify
  *  it under the terms of the GNU General Public License as published by
@@ -57,6 +57,384 @@ static int numGraphicsSystems = 0;
 
 static GESystemDesc* registeredSystems[MAX_GRAPHICS_SYSTEMS];
 
+/****************************************************************
+ * Device-level record of the display list
+ ****************************************************************
+ *
+ * As well as the display list of graphics system calls, the engine
+ * keeps (for each device with the display list on) a flat record of
+ * the calls it has made to the device since GEinitDisplayList: the
+ * clip regions, the primitives in device coordinates and the
+ * graphics contexts they were drawn with.  Redrawing a device of the
+ * same size (e.g. when an X11 window is exposed) just repeats these
+ * calls, without going back through the graphics systems.
+ *
+ * Each call is a primHeader followed by its data (the x then the y
+ * coordinates, then int or char data) padded to a multiple of 8
+ * bytes.  A graphics context is stored only when it changes.
+ *
+ * The record is abandoned (until the next GEinitDisplayList) if the
+ * device draws with the display list off, if the display list is
+ * replaced by a snapshot or a copy, or if it gets too large.
+ */
+
+#define PRIM_MAX_BYTES (64 * 1024 * 1024)
+
+typedef enum {
+    PRIM_GC, PRIM_CLIP, PRIM_NEWPAGE, PRIM_LINE, PRIM_POLYLINE, PRIM_POLYGON,
+    PRIM_CIRCLE, PRIM_RECT, PRIM_PATH, PRIM_RASTER, PRIM_TEXT, PRIM_TEXTUTF8,
+    PRIM_POINTS
+} primType;
+
+typedef struct {
+    int type;
+    int n, np;     /* number of points (raster width); polygons (raster
+		      height, pch) */
+    int flag;      /* winding, interpolate */
+    size_t size;   /* bytes of data following */
+    double v[6];   /* scalar arguments */
+} primHeader;
+
+typedef struct {
+    pGEDevDesc dd;
+    Rboolean valid;
+    double left, right, bottom, top;
+    char *buf;
+    size_t len, alloc;
+    size_t lastgc; /* offset of the current gc record's data */
+} primRecord;
+
+static primRecord *devPrims[R_MaxDevices];
+
+static void primFree(primRecord *pr)
+{
+    free(pr->buf);
+    pr->buf = NULL;
+    pr->len = pr->alloc = 0;
+    pr->valid = FALSE;
+}
+
+static void primReset(pGEDevDesc dd)
+{
+    int i = GEdeviceNumber(dd);
+    primRecord *pr;
+
+    if (i <= 0 || i >= R_MaxDevices) return;
+    if (!devPrims[i]) {
+	devPrims[i] = (primRecord *) calloc(1, sizeof(primRecord));
+	if (!devPrims[i]) return;
+    }
+    pr = devPrims[i];
+    pr->dd = dd;
+    pr->len = 0;
+    pr->lastgc = 0;
+    pr->valid = dd->displayListOn;
+    pr->left = dd->dev->left;
+    pr->right = dd->dev->right;
+    pr->bottom = dd->dev->bottom;
+    pr->top = dd->dev->top;
+}
+
+static void primInvalidate(pGEDevDesc dd)
+{
+    int i;
+    for (i = 1; i < R_MaxDevices; i++)
+	if (devPrims[i] && devPrims[i]->dd == dd) primFree(devPrims[i]);
+}
+
+/* The record for dd if calls to it are being recorded */
+static primRecord *primCurrent(pGEDevDesc dd)
+{
+    int i = GEdeviceNumber(dd);
+    primRecord *pr;
+
+    if (i <= 0 || i >= R_MaxDevices) return NULL;
+    pr = devPrims[i];
+    if (!pr || !pr->valid || pr->dd != dd) return NULL;
+    if (!dd->displayListOn) {
+	primFree(pr);
+	return NULL;
+    }
+    return pr;
+}
+
+static Rboolean gcEqual(const pGEcontext a, const pGEcontext b)
+{
+    return a->col == b->col && a->fill == b->fill && a->gamma == b->gamma &&
+	a->lwd == b->lwd && a->lty == b->lty && a->lend == b->lend &&
+	a->ljoin == b->ljoin && a->lmitre == b->lmitre && a->cex == b->cex &&
+	a->ps == b->ps && a->lineheight == b->lineheight &&
+	a->fontface == b->fontface && !strcmp(a->fontfamily, b->fontfamily);
+}
+
+/* Append a header for 'size' bytes of data, returning the data or
+   NULL (having abandoned the record) if there is no room */
+static char *primAppend(primRecord *pr, int type, size_t size)
+{
+    size_t need;
+    primHeader *h;
+
+    size = (size + 7) & ~((size_t) 7);
+    need = pr->len + sizeof(primHeader) + size;
+    if (need > PRIM_MAX_BYTES) {
+	primFree(pr);
+	return NULL;
+    }
+    if (need > pr->alloc) {
+	size_t alloc = pr->alloc ? pr->alloc : 4096;
+	char *tmp;
+	while (alloc < need) alloc *= 2;
+	tmp = (char *) realloc(pr->buf, alloc);
+	if (!tmp) {
+	    primFree(pr);
+	    return NULL;
+	}
+	pr->buf = tmp;
+	pr->alloc = alloc;
+    }
+    h = (primHeader *)(pr->buf + pr->len);
+    memset(h, 0, sizeof(primHeader));
+    h->type = type;
+    h->size = size;
+    pr->len = need;
+    return (char *)(h + 1);
+}
+
+/* Start a record of a call with the given gc (or none) */
+static primHeader *primStart(primRecord *pr, int type, size_t size,
+			     const pGEcontext gc)
+{
+    char *p;
+
+    if (gc && (!pr->lastgc ||
+	       !gcEqual(gc, (pGEcontext)(pr->buf + pr->lastgc)))) {
+	if (!(p = primAppend(pr, PRIM_GC, sizeof(R_GE_gcontext))))
+	    return NULL;
+	memcpy(p, gc, sizeof(R_GE_gcontext));
+	pr->lastgc = p - pr->buf;
+    }
+    if (!(p = primAppend(pr, type, size))) return NULL;
+    return (primHeader *) p - 1;
+}
+
+static void primXY(primHeader *h, int n, double *x, double *y)
+{
+    double *p = (double *)(h + 1);
+    h->n = n;
+    memcpy(p, x, n * sizeof(double));
+    memcpy(p + n, y, n * sizeof(double));
+}
+
+/* The device calls made by the engine, recording them */
+
+static void devClip(double x0, double x1, double y0, double y1,
+		    pGEDevDesc dd)
+{
+    primRecord *pr = primCurrent(dd);
+    primHeader *h;
+    if (pr && (h = primStart(pr, PRIM_CLIP, 0, NULL))) {
+	h->v[0] = x0; h->v[1] = x1; h->v[2] = y0; h->v[3] = y1;
+    }
+    dd->dev->clip(x0, x1, y0, y1, dd->dev);
+}
+
+static void devNewPage(const pGEcontext gc, pGEDevDesc dd)
+{
+    primRecord *pr = primCurrent(dd);
+    if (pr) primStart(pr, PRIM_NEWPAGE, 0, gc);
+    dd->dev->newPage(gc, dd->dev);
+}
+
+static void devLine(double x1, double y1, double x2, double y2,
+		    const pGEcontext gc, pGEDevDesc dd)
+{
+    primRecord *pr = primCurrent(dd);
+    primHeader *h;
+    if (pr && (h = primStart(pr, PRIM_LINE, 0, gc))) {
+	h->v[0] = x1; h->v[1] = y1; h->v[2] = x2; h->v[3] = y2;
+    }
+    dd->dev->line(x1, y1, x2, y2, gc, dd->dev);
+}
+
+static void devPolyline(int n, double *x, double *y,
+			const pGEcontext gc, pGEDevDesc dd)
+{
+    primRecord *pr = primCurrent(dd);
+    primHeader *h;
+    if (pr && (h = primStart(pr, PRIM_POLYLINE, 2 * n * sizeof(double), gc)))
+	primXY(h, n, x, y);
+    dd->dev->polyline(n, x, y, gc, dd->dev);
+}
+
+static void devPolygon(int n, double *x, double *y,
+		       const pGEcontext gc, pGEDevDesc dd)
+{
+    primRecord *pr = primCurrent(dd);
+    primHeader *h;
+    if (pr && (h = primStart(pr, PRIM_POLYGON, 2 * n * sizeof(double), gc)))
+	primXY(h, n, x, y);
+    dd->dev->polygon(n, x, y, gc, dd->dev);
+}
+
+static void devCircle(double x, double y, double r,
+		      const pGEcontext gc, pGEDevDesc dd)
+{
+    primRecord *pr = primCurrent(dd);
+    primHeader *h;
+    if (pr && (h = primStart(pr, PRIM_CIRCLE, 0, gc))) {
+	h->v[0] = x; h->v[1] = y; h->v[2] = r;
+    }
+    dd->dev->circle(x, y, r, gc, dd->dev);
+}
+
+static void devRect(double x0, double y0, double x1, double y1,
+		    const pGEcontext gc, pGEDevDesc dd)
+{
+    primRecord *pr = primCurrent(dd);
+    primHeader *h;
+    if (pr && (h = primStart(pr, PRIM_RECT, 0, gc))) {
+	h->v[0] = x0; h->v[1] = y0; h->v[2] = x1; h->v[3] = y1;
+    }
+    dd->dev->rect(x0, y0, x1, y1, gc, dd->dev);
+}
+
+static void devPath(double *x, double *y, int npoly, int *nper,
+		    Rboolean winding, const pGEcontext gc, pGEDevDesc dd)
+{
+    primRecord *pr = primCurrent(dd);
+    primHeader *h;
+    if (pr) {
+	int i, n = 0;
+	for (i = 0; i < npoly; i++) n += nper[i];
+	h = primStart(pr, PRIM_PATH,
+		      2 * n * sizeof(double) + npoly * sizeof(int), gc);
+	if (h) {
+	    primXY(h, n, x, y);
+	    memcpy((double *)(h + 1) + 2 * n, nper, npoly * sizeof(int));
+	    h->np = npoly;
+	    h->flag = winding;
+	}
+    }
+    dd->dev->path(x, y, npoly, nper, winding, gc, dd->dev);
+}
+
+static void devRaster(unsigned int *raster, int w, int h,
+		      double x, double y, double width, double height,
+		      double angle, Rboolean interpolate,
+		      const pGEcontext gc, pGEDevDesc dd)
+{
+    primRecord *pr = primCurrent(dd);
+    primHeader *ph;
+    if (pr && (ph = primStart(pr, PRIM_RASTER,
+			      (size_t) w * h * sizeof(unsigned int), gc))) {
+	memcpy(ph + 1, raster, (size_t) w * h * sizeof(unsigned int));
+	ph->n = w; ph->np = h; ph->flag = interpolate;
+	ph->v[0] = x; ph->v[1] = y; ph->v[2] = width; ph->v[3] = height;
+	ph->v[4] = angle;
+    }
+    dd->dev->raster(raster, w, h, x, y, width, height,
+		    angle, interpolate, gc, dd->dev);
+}
+
+static void primPoints(int n, double *x, double *y, int pch, double size,
+		       const pGEcontext gc, pGEDevDesc dd)
+{
+    primRecord *pr = primCurrent(dd);
+    primHeader *h;
+    if (pr && (h = primStart(pr, PRIM_POINTS, 2 * n * sizeof(double), gc))) {
+	primXY(h, n, x, y);
+	h->np = pch;
+	h->v[0] = size;
+    }
+}
+
+static void devText(double x, double y, const char *str, double rot,
+		    double hadj, Rboolean utf8, const pGEcontext gc,
+		    pGEDevDesc dd)
+{
+    primRecord *pr = primCurrent(dd);
+    primHeader *h;
+    size_t n = strlen(str) + 1;
+    if (pr && (h = primStart(pr, utf8 ? PRIM_TEXTUTF8 : PRIM_TEXT, n, gc))) {
+	memcpy(h + 1, str, n);
+	h->v[0] = x; h->v[1] = y; h->v[2] = rot; h->v[3] = hadj;
+    }
+    if (utf8)
+	dd->dev->textUTF8(x, y, str, rot, hadj, gc, dd->dev);
+    else
+	dd->dev->text(x, y, str, rot, hadj, gc, dd->dev);
+}
+
+/* Repeat the recorded calls, if there is a record for a device of
+   the current size: returns FALSE if the display list must be replayed */
+static Rboolean primReplay(pGEDevDesc dd)
+{
+    int i = GEdeviceNumber(dd);
+    primRecord *pr;
+    pDevDesc dev = dd->dev;
+    pGEcontext gc = NULL;
+    size_t off;
+
+    if (i <= 0 || i >= R_MaxDevices) return FALSE;
+    pr = devPrims[i];
+    if (!pr || !pr->valid || pr->dd != dd || !dd->displayListOn ||
+	pr->left != dev->left || pr->right != dev->right ||
+	pr->bottom != dev->bottom || pr->top != dev->top)
+	return FALSE;
+
+    if (dev->mode) dev->mode(1, dev);
+    for (off = 0; off < pr->len;
+	 off += sizeof(primHeader) + ((primHeader *)(pr->buf + off))->size) {
+	primHeader *h = (primHeader *)(pr->buf + off);
+	double *v = h->v, *x = (double *)(h + 1), *y = x + h->n;
+	switch (h->type) {
+	case PRIM_GC:
+	    gc = (pGEcontext)(h + 1);
+	    break;
+	case PRIM_CLIP:
+	    dev->clip(v[0], v[1], v[2], v[3], dev);
+	    break;
+	case PRIM_NEWPAGE:
+	    dev->newPage(gc, dev);
+	    break;
+	case PRIM_LINE:
+	    dev->line(v[0], v[1], v[2], v[3], gc, dev);
+	    break;
+	case PRIM_POLYLINE:
+	    dev->polyline(h->n, x, y, gc, dev);
+	    break;
+	case PRIM_POLYGON:
+	    dev->polygon(h->n, x, y, gc, dev);
+	    break;
+	case PRIM_CIRCLE:
+	    dev->circle(v[0], v[1], v[2], gc, dev);
+	    break;
+	case PRIM_RECT:
+	    dev->rect(v[0], v[1], v[2], v[3], gc, dev);
+	    break;
+	case PRIM_PATH:
+	    dev->path(x, y, h->np, (int *)(y + h->n), h->flag, gc, dev);
+	    break;
+	case PRIM_RASTER:
+	    dev->raster((unsigned int *)(h + 1), h->n, h->np,
+			v[0], v[1], v[2], v[3], v[4], h->flag, gc, dev);
+	    break;
+	case PRIM_TEXT:
+	    dev->text(v[0], v[1], (const char *)(h + 1), v[2], v[3], gc, dev);
+	    break;
+	case PRIM_TEXTUTF8:
+	    dev->textUTF8(v[0], v[1], (const char *)(h + 1), v[2], v[3],
+			  gc, dev);
+	    break;
+	case PRIM_POINTS:
+	    dev->points(h->n, x, y, h->np, v[0], gc, dev);
+	    break;
+	}
+    }
+    if (dev->mode) dev->mode(0, dev);
+    return TRUE;
+}
+
 
 /****************************************************************
  * GEdestroyDevDesc
@@ -79,6 +457,12 @@ void GEdestroyDevDesc(pGEDevDesc dd)
     int i;
     if (dd != NULL) {
 	for (i = 0; i < MAX_GRAPHICS_SYSTEMS; i++) unregisterOne(dd, i);
+	for (i = 1; i < R_MaxDevices; i++)
+	    if (devPrims[i] && devPrims[i]->dd == dd) {
+		primFree(devPrims[i]);
+		free(devPrims[i]);
+		devPrims[i] = NULL;
+	    }
 	free(dd->dev);
 	dd->dev = NULL;
 	free(dd);
@@ -615,7 +999,7 @@ void GESetClip(double x1, double y1, double x2, double y2, pGEDevDesc dd)
 	y1 = fmin2(y1, dy1);
 	y2 = fmax2(y2, dy2);
     }
-    d->clip(x1, x2, y1, y2, dd->dev);
+    devClip(x1, x2, y1, y2, dd);
     /*
      * Record the current clip rect settings so that calls to
      * getClipRect get the up-to-date values.
@@ -767,7 +1151,7 @@ void GELine(double x1, double y1, double x2, double y2,
 	clip_ok = clipLine(&x1, &y1, &x2, &y2, 0, dd);
     }
     if (clip_ok)
-	dd->dev->line(x1, y1, x2, y2, gc, dd->dev);
+	devLine(x1, y1, x2, y2, gc, dd);
 }
 
 /****************************************************************
@@ -810,7 +1194,7 @@ static void CScliplines(int n, double *x, double *y,
 		yy[0] = y1;
 		xx[1] = x2;
 		yy[1] = y2;
-		dd->dev->polyline(2, xx, yy, gc, dd->dev);
+		devPolyline(2, xx, yy, gc, dd);
 	    }
 	    else if (ind1) {
 		xx[0] = x1;
@@ -819,21 +1203,21 @@ static void CScliplines(int n, double *x, double *y,
 		yy[1] = y2;
 		count = 2;
 		if (i == n - 1)
-		    dd->dev->polyline(count, xx, yy, gc, dd->dev);
+		    devPolyline(count, xx, yy, gc, dd);
 	    }
 	    else if (ind2) {
 		xx[count] = x2;
 		yy[count] = y2;
 		count++;
 		if (count > 1)
-		    dd->dev->polyline(count, xx, yy, gc, dd->dev);
+		    devPolyline(count, xx, yy, gc, dd);
 	    }
 	    else {
 		xx[count] = x2;
 		yy[count] = y2;
 		count++;
 		if (i == n - 1 && count > 1)
-		    dd->dev->polyline(count, xx, yy, gc, dd->dev);
+		    devPolyline(count, xx, yy, gc, dd);
 	    }
 	}
 	x1 = x[i];
@@ -1077,7 +1461,7 @@ static void clipPolygon(int n, double *x, double *y,
 	    xc = (double*) R_alloc(npts, sizeof(double));
 	    yc = (double*) R_alloc(npts, sizeof(double));
 	    npts = clipPoly(x, y, n, 1, toDevice, xc, yc, dd);
-	    dd->dev->polygon(npts, xc, yc, gc, dd->dev);
+	    devPolygon(npts, xc, yc, gc, dd);
 	}
     }
     vmaxset(vmax);
@@ -1227,7 +1611,7 @@ void GECircle(double x, double y, double radius, const pGEcontext gc, pGEDevDesc
 	 * boundary so the circle is entirely within the device; the
 	 * device will perform the clipping to the current clipping rect.
 	 */
-	dd->dev->circle(x, y, radius, gc, dd->dev);
+	devCircle(x, y, radius, gc, dd);
 	break;
     case -1: /* Total clipping; draw nothing */
 	/*
@@ -1251,7 +1635,7 @@ void GECircle(double x, double y, double radius, const pGEcontext gc, pGEDevDesc
 	 * device and just draw a circle.
 	 */
 	if (dd->dev->canClip) {
-	    dd->dev->circle(x, y, radius, gc, dd->dev);
+	    devCircle(x, y, radius, gc, dd);
 	}
 	else {
 	    vmax = vmaxget();
@@ -1272,7 +1656,7 @@ void GECircle(double x, double y, double radius, const pGEcontext gc, pGEDevDesc
 		    ycc = (double*)R_alloc(npts, sizeof(double));
 		    npts = clipPoly(xc, yc, result, 1, !dd->dev->canClip,
 					xcc, ycc, dd);
-		    dd->dev->polygon(npts, xcc, ycc, gc, dd->dev);
+		    devPolygon(npts, xcc, ycc, gc, dd);
 		}
 	    }
 	    vmaxset(vmax);
@@ -1337,11 +1721,11 @@ void GERect(double x0, double y0, double x1, double y1,
     case 0:  /* rectangle totally clipped; draw nothing */
 	break;
     case 1:  /* rectangle totally inside;  draw all */
-	dd->dev->rect(x0, y0, x1, y1, gc, dd->dev);
+	devRect(x0, y0, x1, y1, gc, dd);
 	break;
     case 2:  /* rectangle intersects clip region;  use polygon clipping */
 	if (dd->dev->canClip)
-	    dd->dev->rect(x0, y0, x1, y1, gc, dd->dev);
+	    devRect(x0, y0, x1, y1, gc, dd);
 	else {
 	    vmax = vmaxget();
 	    xc = (double*)R_alloc(5, sizeof(double));
@@ -1363,7 +1747,7 @@ void GERect(double x0, double y0, double x1, double y1,
 		    xcc = (double*)R_alloc(npts, sizeof(double));
 		    ycc = (double*)R_alloc(npts, sizeof(double));
 		    npts = clipPoly(xc, yc, 4, 1, !dd->dev->canClip, xcc, ycc, dd);
-		    dd->dev->polygon(npts, xcc, ycc, gc, dd->dev);
+		    devPolygon(npts, xcc, ycc, gc, dd);
 		}
 	    }
 	    vmaxset(vmax);
@@ -1401,7 +1785,7 @@ void GEPath(double *x, double *y,
             }
         }
         if (draw) {
-            dd->dev->path(x, y, npoly, nper, winding, gc, dd->dev);
+            devPath(x, y, npoly, nper, winding, gc, dd);
         } else {
 	    error(_("Invalid graphics path"));
         }
@@ -1432,8 +1816,8 @@ void GERaster(unsigned int *raster, int w, int h,
      * rectangular clipping regions) */
     
     if (width != 0 && height != 0) {
-        dd->dev->raster(raster, w, h, x, y, width, height,
-                        angle, interpolate, gc, dd->dev);
+        devRaster(raster, w, h, x, y, width, height,
+                  angle, interpolate, gc, dd);
     }
 }
 
@@ -1517,23 +1901,20 @@ static void clipText(double x, double y, const char *str, cetype_t enc,
 {
     int result = clipTextCode(x, y, str, enc, width, height, rot, hadj,
 			      gc, toDevice, dd);
-    void (*textfn)(double x, double y, const char *str, double rot,
-		   double hadj, const pGEcontext gc, pDevDesc dd);
     /* This guards against uninitialized values, e.g. devices installed
        in earlier versions of R */
-    textfn = (dd->dev->hasTextUTF8 ==TRUE) && enc == CE_UTF8 ?
-	dd->dev->textUTF8 : dd->dev->text;
+    Rboolean utf8 = (dd->dev->hasTextUTF8 ==TRUE) && enc == CE_UTF8;
 
     switch (result) {
     case 0:  /* text totally clipped; draw nothing */
 	break;
     case 1:  /* text totally inside;  draw all */
-	textfn(x, y, str, rot, hadj, gc, dd->dev);
+	devText(x, y, str, rot, hadj, utf8, gc, dd);
 	break;
     case 2:  /* text intersects clip region
 		act according to value of clipToDevice */
 	if (toDevice) /* Device will do clipping */
-	    textfn(x, y, str, rot, hadj, gc, dd->dev);
+	    devText(x, y, str, rot, hadj, utf8, gc, dd);
 	else /* don't draw anything; this could be made less crude :) */
 	    ;
     }
@@ -2315,6 +2696,175 @@ void GESymbol(double x, double y, int pch, double size,
     }
 }
 
+/****************************************************************
+ * GEPoints
+ ****************************************************************
+ */
+
+/* Draw a run of filled symbols (pch 15, 16, 19 and 20) as a raster
+ * image of the clipping region, with one cell per device unit, if
+ * options("points.raster") asks for this for runs of n points.
+ *
+ * The number of symbols covering each cell is found by binning the
+ * points and spreading the counts over the symbol's footprint, and
+ * the cell gets the symbol colour composited that many times, as
+ * drawing the symbols one at a time without anti-aliasing would.
+ */
+#define MAX_RASTER_POINTS_DIM 4096
+
+static Rboolean pointsRaster(int n, double *x, double *y, int pch,
+			     double size, const pGEcontext gc, pGEDevDesc dd)
+{
+    pDevDesc dev = dd->dev;
+    SEXP opt = GetOption1(install("points.raster"));
+    double thresh, cx0, cy0, cx1, cy1, cw, ch, rx, ry, lw, a, ybot, ytop;
+    int W, H, px, py, Wp, i, j, k, nmask;
+    int *cnt, *m, *mx, *my;
+    unsigned int *image;
+    rcolor col = gc->col;
+
+    if (isNull(opt) || !(pch == 15 || pch == 16 || pch == 19 || pch == 20))
+	return FALSE;
+    thresh = asReal(opt);
+    if (ISNAN(thresh) || n < thresh || !dev->raster || dev->haveRaster == 1 ||
+	R_ALPHA(col) == 0 || !R_FINITE(gc->lwd) || gc->lwd < 0)
+	return FALSE;
+
+    getClipRect(&cx0, &cy0, &cx1, &cy1, dd);
+    if (!(cx1 - cx0 <= MAX_RASTER_POINTS_DIM &&
+	  cy1 - cy0 <= MAX_RASTER_POINTS_DIM))
+	return FALSE;
+    W = (int) ceil(cx1 - cx0);
+    H = (int) ceil(cy1 - cy0);
+    if (W < 1 || H < 1) return FALSE;
+    cw = (cx1 - cx0) / W;
+    ch = (cy1 - cy0) / H;
+
+    /* the footprint of the symbol, in cells about its centre */
+    lw = (pch >= 19) ? fabs(toDeviceWidth(gc->lwd / 96, GE_INCHES, dd)) : 0;
+    rx = ((pch == 20) ? SMALL : RADIUS) * size + lw / 2;
+    ry = (pch == 15) ? fabs(rx * dev->ipr[0] / dev->ipr[1]) : rx;
+    rx /= cw;
+    ry /= ch;
+    if (!(rx <= 256 && ry <= 256)) return FALSE;
+    px = (int) rx;
+    py = (int) ry;
+    mx = (int *) R_alloc((2 * px + 1) * (2 * py + 1), sizeof(int));
+    my = (int *) R_alloc((2 * px + 1) * (2 * py + 1), sizeof(int));
+    nmask = 0;
+    for (j = -py; j <= py; j++)
+	for (i = -px; i <= px; i++)
+	    if (pch == 15 || (i == 0 && j == 0) ||
+		(i / rx) * (i / rx) + (j / ry) * (j / ry) <= 1) {
+		mx[nmask] = i;
+		my[nmask++] = j;
+	    }
+
+    /* counts of the points in each cell, with a margin of the
+       footprint's size for points just outside the region */
+    Wp = W + 2 * px;
+    cnt = (int *) R_alloc((size_t) Wp * (H + 2 * py), sizeof(int));
+    memset(cnt, 0, (size_t) Wp * (H + 2 * py) * sizeof(int));
+    for (k = 0; k < n; k++) {
+	double fi = floor((x[k] - cx0) / cw), fj = floor((y[k] - cy0) / ch);
+	if (fi >= -px && fi < W + px && fj >= -py && fj < H + py)
+	    cnt[(int)(fi + px) + (size_t) Wp * (int)(fj + py)]++;
+    }
+
+    /* the number of symbols covering each cell */
+    m = (int *) R_alloc((size_t) W * H, sizeof(int));
+    memset(m, 0, (size_t) W * H * sizeof(int));
+    for (j = 0; j < H + 2 * py; j++)
+	for (i = 0; i < Wp; i++) {
+	    int c = cnt[i + (size_t) Wp * j];
+	    if (c == 0) continue;
+	    for (k = 0; k < nmask; k++) {
+		int ci = i - px + mx[k], cj = j - py + my[k];
+		if (ci >= 0 && ci < W && cj >= 0 && cj < H)
+		    m[ci + (size_t) W * cj] += c;
+	    }
+	}
+
+    /* the image, by row from the top of the device */
+    image = (unsigned int *) R_alloc((size_t) W * H, sizeof(unsigned int));
+    a = R_ALPHA(col) / 255.;
+    for (j = 0; j < H; j++) {
+	int row = (dev->bottom < dev->top) ? H - 1 - j : j;
+	for (i = 0; i < W; i++) {
+	    int c = m[i + (size_t) W * j];
+	    unsigned int alpha = (c == 0) ? 0 : (a == 1) ? 255 :
+		(unsigned int)(255 * (1 - pow(1 - a, c)) + 0.5);
+	    image[i + (size_t) W * row] = (alpha == 0) ? 0 :
+		R_RGBA(R_RED(col), R_GREEN(col), R_BLUE(col), alpha);
+	}
+    }
+    ybot = (dev->bottom < dev->top) ? cy0 : cy1;
+    ytop = (dev->bottom < dev->top) ? cy1 : cy0;
+    GERaster(image, W, H, cx0, ybot, cx1 - cx0, ytop - ybot, 0, FALSE,
+	     gc, dd);
+    return TRUE;
+}
+
+/* Draw the symbol 'pch' at each of the n points (x[i], y[i]) in
+ * device coordinates, as n calls to GESymbol would.
+ *
+ * If the device has a points() entry point, the symbols which lie
+ * wholly within the clipping region are passed to it in one call;
+ * the others (and all of them, if it declines) are drawn one at a
+ * time by GESymbol.
+ */
+void GEPoints(int n, double *x, double *y, int pch, double size,
+	      const pGEcontext gc, pGEDevDesc dd)
+{
+    R_GE_gcontext gc1;
+    int i, nin = 0;
+    double cx0 = 0, cy0 = 0, cx1 = 0, cy1 = 0, ex = 0, ey = 0;
+    Rboolean batch = FALSE;
+    const void *vmax = vmaxget();
+
+#define INSIDE(i) (cx0 <= x[i] - ex && x[i] + ex <= cx1 && \
+		   cy0 <= y[i] - ey && y[i] + ey <= cy1)
+
+    if (n > 1 && R_FINITE(size) && size > 0 &&
+	pointsRaster(n, x, y, pch, size, gc, dd)) {
+	vmaxset(vmax);
+	return;
+    }
+
+    /* (the checks on size and lwd are left to GESymbol) */
+    if (dd->dev->points && 0 <= pch && pch <= 25 && n > 1 &&
+	R_FINITE(size) && size > 0 && R_FINITE(gc->lwd) && gc->lwd >= 0) {
+	double *xin, *yin,
+	    lw = fabs(toDeviceWidth(gc->lwd / 96, GE_INCHES, dd));
+	/* a bound on the half-width and half-height of any of the
+	   symbols 0:25 (at most 0.6 * size) and their borders */
+	lw = lw * fmax2(1., gc->lmitre) / 2 + 1;
+	ex = size + lw;
+	ey = fabs(size * dd->dev->ipr[0] / dd->dev->ipr[1]) + lw;
+	getClipRect(&cx0, &cy0, &cx1, &cy1, dd);
+	xin = (double *) R_alloc(n, sizeof(double));
+	yin = (double *) R_alloc(n, sizeof(double));
+	for (i = 0; i < n; i++)
+	    if (INSIDE(i)) {
+		xin[nin] = x[i];
+		yin[nin++] = y[i];
+	    }
+	if (nin > 0 &&
+	    dd->dev->points(nin, xin, yin, pch, size, gc, dd->dev)) {
+	    primPoints(nin, xin, yin, pch, size, gc, dd);
+	    batch = TRUE;
+	}
+    }
+    for (i = 0; i < n; i++) {
+	if (batch && INSIDE(i)) continue;
+	/* GESymbol may change the colours in its gc */
+	gc1 = *gc;
+	GESymbol(x[i], y[i], pch, size, &gc1, dd);
+    }
+#undef INSIDE
+    vmaxset(vmax);
+}
+
 /****************************************************************
  * GEPretty
  ****************************************************************
@@ -2628,7 +3178,7 @@ void GEStrMetric(const char *str, cetype_t enc, const pGEcontext gc,
 
 void GENewPage(const pGEcontext gc, pGEDevDesc dd)
 {
-    dd->dev->newPage(gc, dd->dev);
+    devNewPage(gc, dd);
 }
 
 /****************************************************************
@@ -2730,6 +3280,7 @@ void GEinitDisplayList(pGEDevDesc dd)
 	if (dd->gesd[i] != NULL)
 	    (dd->gesd[i]->callback)(GE_SaveState, dd, R_NilValue);
     dd->displayList = dd->DLlastElt = R_NilValue;
+    primReset(dd);
 }
 
 /****************************************************************
@@ -2758,6 +3309,12 @@ void GEplayDisplayList(pGEDevDesc dd)
     theList = dd->displayList;
     if (theList == R_NilValue) return;
 
+    /* If the device is the size it was drawn at, repeat the calls
+       made to it: otherwise replay the display list, recording it
+       afresh at the new size */
+    if (primReplay(dd)) return;
+    primReset(dd);
+
     /* Get each graphics system to restore state required for
      * replaying the display list
      */
@@ -2793,6 +3350,7 @@ void GEplayDisplayList(pGEDevDesc dd)
 	selectDevice(savedDevice);
 	savePalette(FALSE);
     }
+    if (!plotok) primInvalidate(dd);
     UNPROTECT(1);
 }
 
@@ -2814,6 +3372,7 @@ void GEcopyDisplayList(int fromDevice)
     if(!isNull(tmp)) tmp = duplicate(tmp);
     dd->displayList = tmp;
     dd->DLlastElt = lastElt(dd->displayList);
+    primInvalidate(dd);
     /* Get each registered graphics system to copy system state
      * information from the "from" device to the current device
      */
@@ -2920,6 +3479,7 @@ void GEplaySnapshot(SEXP snapshot, pGEDevDesc dd)
      */
     dd->displayList = duplicate(VECTOR_ELT(snapshot, 0));
     dd->DLlastElt = lastElt(dd->displayList);
+    primInvalidate(dd);
     GEplayDisplayList(dd);
     if (!dd->displayListOn) GEinitDisplayList(dd);
     UNPROTECT(1);
@@ -1,7 +1,7 @@
 /*
  *  R : A Computer Language for Statistical Data Analysis
  *  Copyright (C) 1995, 1996  Robert Gentleman and Ross Ihaka
- *  Copyright (C) 1999-2015  The R Core Team.
+ *  Copyright (C) 1999-2017  The R Core Team.
  *
  *  This program is free software; you can redistribute it and/or modify
  *  it under the terms of the GNU General Public License as published by
@@ -178,8 +178,15 @@ Rboolean R_envHasNoSpecialSymbols (SEXP env)
 
   Hash Tables
 
-  We use a basic separate chaining algorithm.	A hash table consists
-  of SEXP (vector) which contains a number of SEXPs (lists).
+  We use open addressing with linear probing.  A hash table consists
+  of a SEXP (vector) each element of which is either R_NilValue or a
+  single binding cell, a CONS with the symbol as its TAG and a CDR of
+  R_NilValue.  Code walking a table as a vector of chains therefore
+  still works, but only the functions below may add or remove cells.
+  HASHPRI is the number of cells in the table, which is kept below
+  HASHMAXLOAD times its size so that every probe sequence ends at an
+  empty slot.  Cells are removed by shifting later cells of their
+  probe sequence back, so no deleted markers are needed.
 
   The only non-static function is R_NewHashedEnv, which allows code to
   request a hashed environment.  All others are static to allow
@@ -188,12 +195,20 @@ Rboolean R_envHasNoSpecialSymbols (SEXP env)
 
 #define HASHSIZE(x)	     LENGTH(x)
 #define HASHPRI(x)	     TRUELENGTH(x)
-#define HASHTABLEGROWTHRATE  1.2
+#define HASHTABLEGROWTHRATE  2
+#define HASHMAXLOAD	     0.7
 #define HASHMINSIZE	     29
 #define SET_HASHPRI(x,v)     SET_TRUELENGTH(x,v)
 
 #define IS_HASHED(x)	     (HASHTAB(x) != R_NilValue)
 
+/* The home slot of hash value 'h' in 'table'.  Similar names give
+   similar hash values, which would form long runs of occupied slots,
+   so these are scrambled by a multiplicative hash first. */
+#define HASHSLOT(h, table) \
+    ((int) (((uint64_t) ((unsigned int) (h) * 2654435769U) \
+	     * HASHSIZE(table)) >> 32))
+
 /*----------------------------------------------------------------------
 
   String Hashing
@@ -223,38 +238,78 @@ int attribute_hidden R_Newhashpjw(const char *s)
     return h;
 }
 
+static int hashIndex(SEXP symbol, SEXP table)
+{
+    SEXP c = PRINTNAME(symbol);
+    if( !HASHASH(c) ) {
+	SET_HASHVALUE(c, R_Newhashpjw(CHAR(c)));
+	SET_HASHASH(c, 1);
+    }
+    return HASHSLOT(HASHVALUE(c), table);
+}
+
+/*----------------------------------------------------------------------
+
+  R_HashProbe
+
+  Returns the index of the slot holding the binding of 'symbol' in
+  'table', or of the empty slot where it would be added.  'hashcode'
+  is the index of the symbol's home slot.
+
+*/
+
+static R_INLINE int R_HashProbe(int hashcode, SEXP symbol, SEXP table)
+{
+    int size = HASHSIZE(table);
+    SEXP cell;
+
+    while ((cell = VECTOR_ELT(table, hashcode)) != R_NilValue &&
+	   TAG(cell) != symbol)
+	if (++hashcode == size) hashcode = 0;
+    return hashcode;
+}
+
+/* Adds 'cell', whose symbol is not yet bound in 'table'. */
+static void R_HashInsertCell(SEXP table, SEXP cell)
+{
+    int i = R_HashProbe(hashIndex(TAG(cell), table), TAG(cell), table);
+    SETCDR(cell, R_NilValue);
+    SET_VECTOR_ELT(table, i, cell);
+    SET_HASHPRI(table, HASHPRI(table) + 1);
+}
+
 /*----------------------------------------------------------------------
 
   R_HashSet
 
   Hashtable set function.  Sets 'symbol' in 'table' to be 'value'.
   'hashcode' must be provided by user.	Allocates some memory for list
-  entries.
+  entries.  The caller must check with R_HashIsFull whether the
+  table needs to grow afterwards.
 
 */
 
 static void R_HashSet(int hashcode, SEXP symbol, SEXP table, SEXP value,
 		      Rboolean frame_locked)
 {
-    SEXP chain;
-
-    /* Grab the chain from the hashtable */
-    chain = VECTOR_ELT(table, hashcode);
+    SEXP cell;
+    int i = R_HashProbe(hashcode, symbol, table);
 
-    /* Search for the value in the chain */
-    for (; !ISNULL(chain); chain = CDR(chain))
-	if (TAG(chain) == symbol) {
-	    SET_BINDING_VALUE(chain, value);
-	    SET_MISSING(chain, 0);	/* Over-ride for new value */
-	    return;
-	}
+    cell = VECTOR_ELT(table, i);
+    if (!ISNULL(cell)) {
+	SET_BINDING_VALUE(cell, value);
+	SET_MISSING(cell, 0);	/* Over-ride for new value */
+	return;
+    }
     if (frame_locked)
 	error(_("cannot add bindings to a locked environment"));
-    if (ISNULL(chain))
-	SET_HASHPRI(table, HASHPRI(table) + 1);
-    /* Add the value into the chain */
-    SET_VECTOR_ELT(table, hashcode, CONS(value, VECTOR_ELT(table, hashcode)));
-    SET_TAG(VECTOR_ELT(table, hashcode), symbol);
+    R_EnvEpoch++; /* invalidate cached lookups */
+    /* Add the value in the empty slot */
+    PROTECT(cell = CONS(value, R_NilValue));
+    SET_TAG(cell, symbol);
+    SET_VECTOR_ELT(table, i, cell);
+    SET_HASHPRI(table, HASHPRI(table) + 1);
+    UNPROTECT(1);
     return;
 }
 
@@ -272,28 +327,13 @@ static void R_HashSet(int hashcode, SEXP symbol, SEXP table, SEXP value,
 
 static SEXP R_HashGet(int hashcode, SEXP symbol, SEXP table)
 {
-    SEXP chain;
-
-    /* Grab the chain from the hashtable */
-    chain = VECTOR_ELT(table, hashcode);
-    /* Retrieve the value from the chain */
-    for (; chain != R_NilValue ; chain = CDR(chain))
-	if (TAG(chain) == symbol) return BINDING_VALUE(chain);
-    /* If not found */
-    return R_UnboundValue;
+    SEXP cell = VECTOR_ELT(table, R_HashProbe(hashcode, symbol, table));
+    return ISNULL(cell) ? R_UnboundValue : BINDING_VALUE(cell);
 }
 
 static Rboolean R_HashExists(int hashcode, SEXP symbol, SEXP table)
 {
-    SEXP chain;
-
-    /* Grab the chain from the hashtable */
-    chain = VECTOR_ELT(table, hashcode);
-    /* Find the binding in the chain */
-    for (; chain != R_NilValue ; chain = CDR(chain))
-	if (TAG(chain) == symbol) return TRUE;
-    /* If not found */
-    return FALSE;
+    return !ISNULL(VECTOR_ELT(table, R_HashProbe(hashcode, symbol, table)));
 }
 
 
@@ -310,15 +350,7 @@ static Rboolean R_HashExists(int hashcode, SEXP symbol, SEXP table)
 
 static SEXP R_HashGetLoc(int hashcode, SEXP symbol, SEXP table)
 {
-    SEXP chain;
-
-    /* Grab the chain from the hashtable */
-    chain = VECTOR_ELT(table, hashcode);
-    /* Retrieve the value from the chain */
-    for (; !ISNULL(chain); chain = CDR(chain))
-	if (TAG(chain) == symbol) return chain;
-    /* If not found */
-    return R_NilValue;
+    return VECTOR_ELT(table, R_HashProbe(hashcode, symbol, table));
 }
 
 
@@ -370,32 +402,45 @@ SEXP R_NewHashedEnv(SEXP enclos, SEXP size)
 
   R_HashDelete
 
-  Hash table delete function.  Symbols are not removed from the table.
-  They have their value set to 'R_UnboundValue'.
+  Hash table delete function.  'hashcode' is the hash value of the
+  symbol's name, not its slot.  The binding of 'symbol' is removed from
+  the table and later cells in its probe sequence are moved back to
+  fill the gap.  The removed cell has its value set to
+  'R_UnboundValue' and is locked in case it is cached.  Returns TRUE if
+  there was a binding.
 
 */
 
-static SEXP DeleteItem(SEXP symbol, SEXP lst)
+static Rboolean R_HashDelete(int hashcode, SEXP symbol, SEXP table)
 {
-    if (lst != R_NilValue) {
-	SETCDR(lst, DeleteItem(symbol, CDR(lst)));
-	if (TAG(lst) == symbol) {
-	    SETCAR(lst, R_UnboundValue); /* in case binding is cached */
-	    LOCK_BINDING(lst);           /* in case binding is cached */
-	    lst = CDR(lst);
-	}
-    }
-    return lst;
-}
+    int size = HASHSIZE(table), i, j, k;
+    SEXP cell;
 
-static void R_HashDelete(int hashcode, SEXP symbol, SEXP table)
-{
-    SEXP list = DeleteItem(symbol,
-			   VECTOR_ELT(table, hashcode % HASHSIZE(table)));
-    if (list == R_NilValue)
-	SET_HASHPRI(table, HASHPRI(table) - 1);
-    SET_VECTOR_ELT(table, hashcode % HASHSIZE(table), list);
-    return;
+    i = R_HashProbe(HASHSLOT(hashcode, table), symbol, table);
+    cell = VECTOR_ELT(table, i);
+    if (ISNULL(cell))
+	return FALSE;
+    R_EnvEpoch++;
+    SETCAR(cell, R_UnboundValue); /* in case binding is cached */
+    LOCK_BINDING(cell);           /* in case binding is cached */
+    SET_VECTOR_ELT(table, i, R_NilValue);
+    SET_HASHPRI(table, HASHPRI(table) - 1);
+
+    /* A cell can fill the gap at i unless its home slot k lies
+       cyclically in (i, j]. */
+    for (j = i + 1; ; j++) {
+	if (j == size) j = 0;
+	cell = VECTOR_ELT(table, j);
+	if (ISNULL(cell))
+	    break;
+	k = hashIndex(TAG(cell), table);
+	if (i <= j ? (i < k && k <= j) : (i < k || k <= j))
+	    continue;
+	SET_VECTOR_ELT(table, i, cell);
+	SET_VECTOR_ELT(table, j, R_NilValue);
+	i = j;
+    }
+    return TRUE;
 }
 
 
@@ -406,54 +451,35 @@ static void R_HashDelete(int hashcode, SEXP symbol, SEXP table)
 
   Hash table resizing function Increase the size of the hash table by
   the growth_rate of the table.	 The vector is reallocated, however
-  the lists with in the hash table have their pointers shuffled around
-  so that they are not reallocated.
+  the cells in the hash table are moved to the new one so that they
+  are not reallocated.
 
 */
 
-static SEXP R_HashResize(SEXP table)
+static SEXP R_HashResizeTo(SEXP table, int size)
 {
-    SEXP new_table, chain, new_chain, tmp_chain;
-    int counter, new_hashcode;
+    SEXP new_table, cell;
+    int counter;
 
     /* Do some checking */
     if (TYPEOF(table) != VECSXP)
 	error("first argument ('table') not of type VECSXP, from R_HashResize");
 
-    /* This may have to change.	 The growth rate should
-       be independent of the size (not implemented yet) */
-    /* hash_grow = HASHSIZE(table); */
-
     /* Allocate the new hash table */
-    new_table = R_NewHashTable((int)(HASHSIZE(table) * HASHTABLEGROWTHRATE));
+    PROTECT(table);
+    new_table = R_NewHashTable(size);
     for (counter = 0; counter < length(table); counter++) {
-	chain = VECTOR_ELT(table, counter);
-	while (!ISNULL(chain)) {
-	    new_hashcode = R_Newhashpjw(CHAR(PRINTNAME(TAG(chain)))) %
-		HASHSIZE(new_table);
-	    new_chain = VECTOR_ELT(new_table, new_hashcode);
-	    /* If using a primary slot then increase HASHPRI */
-	    if (ISNULL(new_chain))
-		SET_HASHPRI(new_table, HASHPRI(new_table) + 1);
-	    tmp_chain = chain;
-	    chain = CDR(chain);
-	    SETCDR(tmp_chain, new_chain);
-	    SET_VECTOR_ELT(new_table, new_hashcode,  tmp_chain);
-#ifdef MIKE_DEBUG
-	    fprintf(stdout, "HASHSIZE = %d\nHASHPRI = %d\ncounter = %d\nHASHCODE = %d\n",
-		    HASHSIZE(table), HASHPRI(table), counter, new_hashcode);
-#endif
-	}
+	cell = VECTOR_ELT(table, counter);
+	if (!ISNULL(cell))
+	    R_HashInsertCell(new_table, cell);
     }
-    /* Some debugging statements */
-#ifdef MIKE_DEBUG
-    fprintf(stdout, "Resized O.K.\n");
-    fprintf(stdout, "Old size: %d, New size: %d\n",
-	    HASHSIZE(table), HASHSIZE(new_table));
-    fprintf(stdout, "Old pri: %d, New pri: %d\n",
-	    HASHPRI(table), HASHPRI(new_table));
-#endif
+    UNPROTECT(1);
     return new_table;
+}
+
+static SEXP R_HashResize(SEXP table)
+{
+    return R_HashResizeTo(table, (int)(HASHSIZE(table) * HASHTABLEGROWTHRATE));
 } /* end R_HashResize */
 
 
@@ -482,6 +508,24 @@ static int R_HashSizeCheck(SEXP table)
     return resize;
 }
 
+/* The same for environment hash tables, which must keep free slots. */
+static R_INLINE int R_HashIsFull(SEXP table)
+{
+    return (double) HASHPRI(table) > (double) HASHSIZE(table) * HASHMAXLOAD;
+}
+
+/* Makes room for 'n' more bindings in the hash table of 'rho', if it
+   has one, so that adding them needs no further resizing. */
+static void R_HashReserve(SEXP rho, R_xlen_t n)
+{
+    SEXP table = HASHTAB(rho);
+    if (TYPEOF(table) == VECSXP) {
+	double size = (HASHPRI(table) + (double) n) / HASHMAXLOAD + 1;
+	if (size > HASHSIZE(table) && size < INT_MAX)
+	    SET_HASHTAB(rho, R_HashResizeTo(table, (int) size));
+    }
+}
+
 
 
 /*----------------------------------------------------------------------
@@ -491,39 +535,63 @@ static int R_HashSizeCheck(SEXP table)
   Hashing for environment frames.  This function ensures that the
   first frame in the given environment has been hashed.	 Ultimately
   all enironments should be created in hashed form.  At that point
-  this function will be redundant.
+  this function will be redundant.  The hash table is replaced by a
+  larger one if it cannot take all the bindings.
 
 */
 
 static SEXP R_HashFrame(SEXP rho)
 {
-    int hashcode;
-    SEXP frame, chain, tmp_chain, table;
+    SEXP frame, cell, table;
+    int size;
 
     /* Do some checking */
     if (TYPEOF(rho) != ENVSXP)
 	error("first argument ('table') not of type ENVSXP, from R_HashVector2Hash");
     table = HASHTAB(rho);
     frame = FRAME(rho);
+    size = (int) ((HASHPRI(table) + length(frame)) / HASHMAXLOAD) + 1;
+    if (size > HASHSIZE(table)) {
+	SET_HASHTAB(rho, R_NewHashTable(size));
+	for (int i = 0; i < HASHSIZE(table); i++)
+	    if (!ISNULL(cell = VECTOR_ELT(table, i)))
+		R_HashInsertCell(HASHTAB(rho), cell);
+	table = HASHTAB(rho);
+    }
     while (!ISNULL(frame)) {
-	if( !HASHASH(PRINTNAME(TAG(frame))) ) {
-	    SET_HASHVALUE(PRINTNAME(TAG(frame)),
-			  R_Newhashpjw(CHAR(PRINTNAME(TAG(frame)))));
-	    SET_HASHASH(PRINTNAME(TAG(frame)), 1);
-	}
-	hashcode = HASHVALUE(PRINTNAME(TAG(frame))) % HASHSIZE(table);
-	chain = VECTOR_ELT(table, hashcode);
-	/* If using a primary slot then increase HASHPRI */
-	if (ISNULL(chain)) SET_HASHPRI(table, HASHPRI(table) + 1);
-	tmp_chain = frame;
+	cell = frame;
 	frame = CDR(frame);
-	SETCDR(tmp_chain, chain);
-	SET_VECTOR_ELT(table, hashcode, tmp_chain);
+	R_HashInsertCell(table, cell);
     }
     SET_FRAME(rho, R_NilValue);
     return rho;
 }
 
+/* Serialized environments keep the chained layout of hash tables used
+   by earlier versions of R, so that those can read them.  This returns
+   such a table holding copies of the cells of 'table'. */
+SEXP attribute_hidden R_HashTableChains(SEXP table)
+{
+    SEXP chains, cell, copy;
+    int i, k, size;
+
+    if (TYPEOF(table) != VECSXP)
+	return table;
+    size = HASHSIZE(table);
+    PROTECT(table);
+    PROTECT(chains = allocVector(VECSXP, size));
+    for (i = 0; i < size; i++)
+	if (!ISNULL(cell = VECTOR_ELT(table, i))) {
+	    k = HASHVALUE(PRINTNAME(TAG(cell))) % size;
+	    copy = CONS(CAR(cell), VECTOR_ELT(chains, k));
+	    SET_TAG(copy, TAG(cell));
+	    SETLEVELS(copy, LEVELS(cell));
+	    SET_VECTOR_ELT(chains, k, copy);
+	}
+    UNPROTECT(2);
+    return chains;
+}
+
 
 /* ---------------------------------------------------------------------
 
@@ -686,21 +754,12 @@ void attribute_hidden InitGlobalEnv()
 }
 
 #ifdef USE_GLOBAL_CACHE
-static int hashIndex(SEXP symbol, SEXP table)
-{
-    SEXP c = PRINTNAME(symbol);
-    if( !HASHASH(c) ) {
-	SET_HASHVALUE(c, R_Newhashpjw(CHAR(c)));
-	SET_HASHASH(c, 1);
-    }
-    return HASHVALUE(c) % HASHSIZE(table);
-}
-
 static void R_FlushGlobalCache(SEXP sym)
 {
     SEXP entry = R_HashGetLoc(hashIndex(sym, R_GlobalCache), sym,
 			      R_GlobalCache);
     if (entry != R_NilValue) {
+	R_PERF_COUNT(PERF_GLOBAL_CACHE_FLUSH);
 	SETCAR(entry, R_UnboundValue);
 #ifdef FAST_BASE_CACHE_LOOKUP
 	UNSET_BASE_SYM_CACHED(sym);
@@ -747,8 +806,7 @@ static void R_AddGlobalCache(SEXP symbol, SEXP place)
     else
 	UNSET_BASE_SYM_CACHED(symbol);
 #endif
-    if (oldpri != HASHPRI(R_GlobalCache) &&
-	HASHPRI(R_GlobalCache) > 0.85 * HASHSIZE(R_GlobalCache)) {
+    if (oldpri != HASHPRI(R_GlobalCache) && R_HashIsFull(R_GlobalCache)) {
 	R_GlobalCache = R_HashResize(R_GlobalCache);
 	SETCAR(R_GlobalCachePreserve, R_GlobalCache);
     }
@@ -800,6 +858,7 @@ static SEXP RemoveFromList(SEXP thing, SEXP list, int *found)
     }
     else if (TAG(list) == thing) {
 	*found = 1;
+	R_EnvEpoch++;
 	SETCAR(list, R_UnboundValue); /* in case binding is cached */
 	LOCK_BINDING(list);           /* in case binding is cached */
 	SEXP rest = CDR(list);
@@ -812,6 +871,7 @@ static SEXP RemoveFromList(SEXP thing, SEXP list, int *found)
 	while (next != R_NilValue) {
 	    if (TAG(next) == thing) {
 		*found = 1;
+		R_EnvEpoch++;
 		SETCAR(next, R_UnboundValue); /* in case binding is cached */
 		LOCK_BINDING(next);           /* in case binding is cached */
 		SETCDR(last, CDR(next));
@@ -830,7 +890,6 @@ static SEXP RemoveFromList(SEXP thing, SEXP list, int *found)
 
 void attribute_hidden unbindVar(SEXP symbol, SEXP rho)
 {
-    int hashcode;
     SEXP c;
 
     if (rho == R_BaseNamespace)
@@ -859,8 +918,7 @@ void attribute_hidden unbindVar(SEXP symbol, SEXP rho)
 	    SET_HASHVALUE(c, R_Newhashpjw(CHAR(c)));
 	    SET_HASHASH(c, 1);
 	}
-	hashcode = HASHVALUE(c) % HASHSIZE(HASHTAB(rho));
-	R_HashDelete(hashcode, symbol, HASHTAB(rho));
+	R_HashDelete(HASHVALUE(c), symbol, HASHTAB(rho));
 	/* we have no record here if deletion worked */
 	if (rho == R_GlobalEnv) R_DirtyImage = 1;
     }
@@ -931,7 +989,7 @@ static SEXP findVarLocInFrame(SEXP rho, SEXP symbol, Rboolean *canCache)
 	    SET_HASHVALUE(c, R_Newhashpjw(CHAR(c)));
 	    SET_HASHASH(c,  1);
 	}
-	hashcode = HASHVALUE(c) % HASHSIZE(HASHTAB(rho));
+	hashcode = HASHSLOT(HASHVALUE(c), HASHTAB(rho));
 	/* Will return 'R_NilValue' if not found */
 	return R_HashGetLoc(hashcode, symbol, HASHTAB(rho));
     }
@@ -1037,7 +1095,7 @@ SEXP findVarInFrame3(SEXP rho, SEXP symbol, Rboolean doGet)
 	    SET_HASHVALUE(c, R_Newhashpjw(CHAR(c)));
 	    SET_HASHASH(c, 1);
 	}
-	hashcode = HASHVALUE(c) % HASHSIZE(HASHTAB(rho));
+	hashcode = HASHSLOT(HASHVALUE(c), HASHTAB(rho));
 	/* Will return 'R_UnboundValue' if not found */
 	return(R_HashGet(hashcode, symbol, HASHTAB(rho)));
     }
@@ -1086,7 +1144,7 @@ static Rboolean existsVarInFrame(SEXP rho, SEXP symbol)
 	    SET_HASHVALUE(c, R_Newhashpjw(CHAR(c)));
 	    SET_HASHASH(c, 1);
 	}
-	hashcode = HASHVALUE(c) % HASHSIZE(HASHTAB(rho));
+	hashcode = HASHSLOT(HASHVALUE(c), HASHTAB(rho));
 	/* Will return 'R_UnboundValue' if not found */
 	return R_HashExists(hashcode, symbol, HASHTAB(rho));
     }
@@ -1201,6 +1259,86 @@ static SEXP findGlobalVar(SEXP symbol)
     }
     return R_UnboundValue;
 }
+
+/* Lookup caching for hashed frames other than global ones, such as
+   namespaces and their imports.  A direct mapped table keyed by the
+   symbol and the environment a search starts from records where the
+   search ends: the binding cell, the symbol if the binding is in
+   base, R_GlobalEnv if the search continues from the global
+   environment (which has its own cache) or R_UnboundValue if the
+   symbol is not bound.  Searches are only cached if they only pass
+   through hashed frames and base.
+
+   Entries carry the value of R_EnvEpoch when they were made, and are
+   valid only while it has not changed.  It is incremented when a
+   binding is added to or removed from a hashed frame or base, when
+   an enclosure is changed by 'parent.env<-', attach or detach, and by
+   each garbage collection, so the table does not refer to dead cells
+   or environments. */
+
+#define LOOKUP_CACHE_SIZE 4096
+
+typedef struct {
+    SEXP symbol, env, cell;
+    unsigned int epoch;
+} lookup_cache_t;
+
+static lookup_cache_t lookup_cache[LOOKUP_CACHE_SIZE];
+
+/* The end of the search for 'symbol' from the hashed frame 'rho', as
+   above, or R_NilValue if the search cannot be cached. */
+static SEXP lookupCacheCell(SEXP symbol, SEXP rho)
+{
+    lookup_cache_t *c = lookup_cache +
+	(((uintptr_t) symbol >> 3) ^ ((uintptr_t) rho >> 5)) %
+	LOOKUP_CACHE_SIZE;
+    if (c->symbol == symbol && c->env == rho && c->epoch == R_EnvEpoch)
+	return c->cell;
+
+    SEXP cell = R_UnboundValue;
+    for (SEXP e = rho; e != R_EmptyEnv; e = ENCLOS(e)) {
+	if (e == R_GlobalEnv) {
+	    cell = R_GlobalEnv;
+	    break;
+	}
+	else if (e == R_BaseEnv || e == R_BaseNamespace) {
+	    if (SYMVALUE(symbol) != R_UnboundValue) {
+		cell = symbol;
+		break;
+	    }
+	}
+	else if (TYPEOF(HASHTAB(e)) != VECSXP || IS_USER_DATABASE(e))
+	    return R_NilValue;
+	else {
+	    SEXP loc = R_HashGetLoc(hashIndex(symbol, HASHTAB(e)), symbol,
+				    HASHTAB(e));
+	    if (loc != R_NilValue) {
+		cell = loc;
+		break;
+	    }
+	}
+    }
+    c->symbol = symbol;
+    c->env = rho;
+    c->cell = cell;
+    c->epoch = R_EnvEpoch;
+    return cell;
+}
+
+#define CACHED_LOOKUP_OK(rho) \
+    ((rho) != R_GlobalEnv && TYPEOF(HASHTAB(rho)) == VECSXP)
+
+static R_INLINE SEXP lookupCacheValue(SEXP symbol, SEXP cell)
+{
+    if (cell == R_GlobalEnv)
+	return findGlobalVar(symbol);
+    else if (cell == R_UnboundValue)
+	return R_UnboundValue;
+    else if (TYPEOF(cell) == SYMSXP)
+	return SYMBOL_BINDING_VALUE(symbol);
+    else
+	return BINDING_VALUE(cell);
+}
 #endif
 
 SEXP findVar(SEXP symbol, SEXP rho)
@@ -1218,6 +1356,11 @@ SEXP findVar(SEXP symbol, SEXP rho)
        will also handle all frames if rho is a global frame other than
        R_GlobalEnv */
     while (rho != R_GlobalEnv && rho != R_EmptyEnv) {
+	if (CACHED_LOOKUP_OK(rho)) {
+	    SEXP cell = lookupCacheCell(symbol, rho);
+	    if (cell != R_NilValue)
+		return lookupCacheValue(symbol, cell);
+	}
 	vl = findVarInFrame3(rho, symbol, TRUE /* get rather than exists */);
 	if (vl != R_UnboundValue) return (vl);
 	rho = ENCLOS(rho);
@@ -1438,6 +1581,25 @@ SEXP findFun(SEXP symbol, SEXP rho)
     while (rho != R_EmptyEnv) {
 	/* This is not really right.  Any variable can mask a function */
 #ifdef USE_GLOBAL_CACHE
+	if (CACHED_LOOKUP_OK(rho)) {
+	    /* use the cached search if it ends with a function */
+	    SEXP cell = lookupCacheCell(symbol, rho);
+	    if (cell == R_GlobalEnv) {
+		rho = R_GlobalEnv;
+		continue;
+	    }
+	    if (cell != R_NilValue && cell != R_UnboundValue) {
+		vl = lookupCacheValue(symbol, cell);
+		if (TYPEOF(vl) == PROMSXP) {
+		    PROTECT(vl);
+		    vl = eval(vl, rho);
+		    UNPROTECT(1);
+		}
+		if (TYPEOF(vl) == CLOSXP || TYPEOF(vl) == BUILTINSXP ||
+		    TYPEOF(vl) == SPECIALSXP)
+		    return vl;
+	    }
+	}
 	if (rho == R_GlobalEnv)
 #ifdef FAST_BASE_CACHE_LOOKUP
 	    if (BASE_SYM_CACHED(symbol))
@@ -1538,10 +1700,10 @@ void defineVar(SEXP symbol, SEXP value, SEXP rho)
 		SET_HASHVALUE(c, R_Newhashpjw(CHAR(c)));
 		SET_HASHASH(c, 1);
 	    }
-	    hashcode = HASHVALUE(c) % HASHSIZE(HASHTAB(rho));
+	    hashcode = HASHSLOT(HASHVALUE(c), HASHTAB(rho));
 	    R_HashSet(hashcode, symbol, HASHTAB(rho), value,
 		      FRAME_IS_LOCKED(rho));
-	    if (R_HashSizeCheck(HASHTAB(rho)))
+	    if (R_HashIsFull(HASHTAB(rho)))
 		SET_HASHTAB(rho, R_HashResize(HASHTAB(rho)));
 	}
     }
@@ -1656,7 +1818,7 @@ static SEXP setVarInFrame(SEXP rho, SEXP symbol, SEXP value)
 	    SET_HASHVALUE(c, R_Newhashpjw(CHAR(c)));
 	    SET_HASHASH(c, 1);
 	}
-	hashcode = HASHVALUE(c) % HASHSIZE(HASHTAB(rho));
+	hashcode = HASHSLOT(HASHVALUE(c), HASHTAB(rho));
 	frame = R_HashGetLoc(hashcode, symbol, HASHTAB(rho));
 	if (frame != R_NilValue) {
 	    SET_BINDING_VALUE(frame, value);
@@ -1716,6 +1878,8 @@ void gsetVar(SEXP symbol, SEXP value, SEXP rho)
 #ifdef USE_GLOBAL_CACHE
     R_FlushGlobalCache(symbol);
 #endif
+    if (SYMVALUE(symbol) == R_UnboundValue)
+	R_EnvEpoch++;
     SET_SYMBOL_BINDING_VALUE(symbol, value);
 }
 
@@ -1761,31 +1925,84 @@ SEXP attribute_hidden do_assign(SEXP call, SEXP op, SEXP args, SEXP rho)
 }
 
 
+/* Copies all the bindings of 'from' to 'envir' with the values
+   as.list(from, all.names = TRUE) would give.  The binding cells are
+   collected first, as forcing promises could change 'from'. */
+static void copyBindings(SEXP from, SEXP envir)
+{
+    SEXP cells, chain;
+    int i, n = 0;
+
+    if (HASHTAB(from) != R_NilValue) {
+	SEXP table = HASHTAB(from);
+	PROTECT(cells = allocVector(VECSXP, HASHPRI(table)));
+	for (i = 0; i < HASHSIZE(table); i++)
+	    for (chain = VECTOR_ELT(table, i); chain != R_NilValue;
+		 chain = CDR(chain))
+		SET_VECTOR_ELT(cells, n++, chain);
+    }
+    else {
+	PROTECT(cells = allocVector(VECSXP, length(FRAME(from))));
+	for (chain = FRAME(from); chain != R_NilValue; chain = CDR(chain))
+	    SET_VECTOR_ELT(cells, n++, chain);
+    }
+    R_HashReserve(envir, n);
+    for (i = 0; i < n; i++) {
+	SEXP cell = VECTOR_ELT(cells, i), value = CAR(cell);
+	if (value == R_UnboundValue) continue; /* removed meanwhile */
+	if (TYPEOF(value) == PROMSXP) {
+	    PROTECT(value);
+	    value = eval(value, R_GlobalEnv);
+	    UNPROTECT(1);
+	}
+	PROTECT(value = lazy_duplicate(value));
+	defineVar(TAG(cell), value, envir);
+	UNPROTECT(1);
+    }
+    UNPROTECT(1);
+}
+
 /**
  * do_list2env : .Internal(list2env(x, envir))
   */
 SEXP attribute_hidden do_list2env(SEXP call, SEXP op, SEXP args, SEXP rho)
 {
-    SEXP x, xnms, envir;
+    SEXP x, xnms, envir, xenv;
     int n;
     checkArity(op, args);
 
-    if (TYPEOF(CAR(args)) != VECSXP)
-	error(_("first argument must be a named list"));
     x = CAR(args);
+    envir = CADR(args);
+    if (TYPEOF(envir) != ENVSXP)
+	error(_("'envir' argument must be an environment"));
+    if (TYPEOF(xenv = x) == ENVSXP ||
+	TYPEOF((xenv = simple_as_environment(x))) == ENVSXP) {
+	if (xenv != R_BaseEnv && xenv != R_BaseNamespace &&
+	    !IS_USER_DATABASE(xenv)) {
+	    copyBindings(xenv, envir);
+	    return envir;
+	}
+	/* no frame to copy from */
+	SEXP expr = PROTECT(lang3(install("as.list.environment"), xenv,
+				  R_TrueValue));
+	x = eval(expr, R_BaseEnv);
+	UNPROTECT(1);
+    }
+    PROTECT(x);
+    if (TYPEOF(x) != VECSXP)
+	error(_("first argument must be a named list or an environment"));
     n = LENGTH(x);
     xnms = getAttrib(x, R_NamesSymbol);
     if (n && (TYPEOF(xnms) != STRSXP || LENGTH(xnms) != n))
 	error(_("names(x) must be a character vector of the same length as x"));
-    envir = CADR(args);
-    if (TYPEOF(envir) != ENVSXP)
-	error(_("'envir' argument must be an environment"));
 
+    R_HashReserve(envir, n);
     for(int i = 0; i < n; i++) {
 	SEXP name = installTrChar(STRING_ELT(xnms, i));
 	defineVar(name, VECTOR_ELT(x, i), envir);
     }
 
+    UNPROTECT(1);
     return envir;
 }
 
@@ -1825,14 +2042,9 @@ static int RemoveVariable(SEXP name, int hashcode, SEXP env)
     }
 
     if (IS_HASHED(env)) {
-	SEXP hashtab = HASHTAB(env);
-	int idx = hashcode % HASHSIZE(hashtab);
-	list = RemoveFromList(name, VECTOR_ELT(hashtab, idx), &found);
+	found = R_HashDelete(hashcode, name, HASHTAB(env));
 	if (found) {
 	    if(env == R_GlobalEnv) R_DirtyImage = 1;
-	    if (list == R_NilValue)
-		SET_HASHPRI(hashtab, HASHPRI(hashtab) - 1);
-	    SET_VECTOR_ELT(hashtab, idx, list);
 #ifdef USE_GLOBAL_CACHE
 	    if (IS_GLOBAL_FRAME(env))
 		R_FlushGlobalCache(name);
@@ -2379,10 +2591,6 @@ SEXP attribute_hidden do_attach(SEXP call, SEXP op, SEXP args, SEXP env)
 	SET_HASHTAB(s, R_NewHashTable(hsize));
 	s = R_HashFrame(s);
 
-	/* FIXME: A little inefficient */
-	while (R_HashSizeCheck(HASHTAB(s)))
-	    SET_HASHTAB(s, R_HashResize(HASHTAB(s)));
-
     } else { /* is a user object */
 	/* Having this here (rather than below) means that the onAttach routine
 	   is called before the table is attached. This may not be necessary or
@@ -2399,6 +2607,7 @@ SEXP attribute_hidden do_attach(SEXP call, SEXP op, SEXP args, SEXP env)
     for (t = R_GlobalEnv; ENCLOS(t) != R_BaseEnv && pos > 2; t = ENCLOS(t))
 	pos--;
 
+    R_EnvEpoch++;
     if (ENCLOS(t) == R_BaseEnv) {
 	SET_ENCLOS(t, s);
 	SET_ENCLOS(s, R_BaseEnv);
@@ -2460,6 +2669,7 @@ SEXP attribute_hidden do_detach(SEXP call, SEXP op, SEXP args, SEXP env)
     else {
 	PROTECT(s = ENCLOS(t));
 	x = ENCLOS(s);
+	R_EnvEpoch++;
 	SET_ENCLOS(t, x);
 	isSpecial = IS_USER_DATABASE(s);
 	if(isSpecial) {
@@ -2635,7 +2845,7 @@ static int BuiltinSize(int all, int intern)
     int count = 0;
     SEXP s;
     int j;
-    for (j = 0; j < HSIZE; j++) {
+    for (j = 0; j < R_SymbolTableSize; j++) {
 	for (s = R_SymbolTable[j]; s != R_NilValue; s = CDR(s)) {
 	    if (intern) {
 		if (INTERNAL(CAR(s)) != R_NilValue)
@@ -2656,7 +2866,7 @@ BuiltinNames(int all, int intern, SEXP names, int *indx)
 {
     SEXP s;
     int j;
-    for (j = 0; j < HSIZE; j++) {
+    for (j = 0; j < R_SymbolTableSize; j++) {
 	for (s = R_SymbolTable[j]; s != R_NilValue; s = CDR(s)) {
 	    if (intern) {
 		if (INTERNAL(CAR(s)) != R_NilValue)
@@ -2671,38 +2881,35 @@ BuiltinNames(int all, int intern, SEXP names, int *indx)
     }
 }
 
+/* The symbols are collected first, as forcing promises can install
+   new symbols and so rearrange the symbol table. */
 static void
 BuiltinValues(int all, int intern, SEXP values, int *indx)
 {
     SEXP s, vl;
-    int j;
-    for (j = 0; j < HSIZE; j++) {
+    int j, start = *indx;
+    for (j = 0; j < R_SymbolTableSize; j++) {
 	for (s = R_SymbolTable[j]; s != R_NilValue; s = CDR(s)) {
 	    if (intern) {
-		if (INTERNAL(CAR(s)) != R_NilValue) {
-		    vl = SYMVALUE(CAR(s));
-		    if (TYPEOF(vl) == PROMSXP) {
-			PROTECT(vl);
-			vl = eval(vl, R_BaseEnv);
-			UNPROTECT(1);
-		    }
-		    SET_VECTOR_ELT(values, (*indx)++, lazy_duplicate(vl));
-		}
+		if (INTERNAL(CAR(s)) != R_NilValue)
+		    SET_VECTOR_ELT(values, (*indx)++, CAR(s));
 	    }
 	    else {
 		if ((all || CHAR(PRINTNAME(CAR(s)))[0] != '.')
-		    && SYMVALUE(CAR(s)) != R_UnboundValue) {
-		    vl = SYMVALUE(CAR(s));
-		    if (TYPEOF(vl) == PROMSXP) {
-			PROTECT(vl);
-			vl = eval(vl, R_BaseEnv);
-			UNPROTECT(1);
-		    }
-		    SET_VECTOR_ELT(values, (*indx)++, lazy_duplicate(vl));
-		}
+		    && SYMVALUE(CAR(s)) != R_UnboundValue)
+		    SET_VECTOR_ELT(values, (*indx)++, CAR(s));
 	    }
 	}
     }
+    for (j = start; j < *indx; j++) {
+	vl = SYMVALUE(VECTOR_ELT(values, j));
+	if (TYPEOF(vl) == PROMSXP) {
+	    PROTECT(vl);
+	    vl = eval(vl, R_BaseEnv);
+	    UNPROTECT(1);
+	}
+	SET_VECTOR_ELT(values, j, lazy_duplicate(vl));
+    }
 }
 
 // .Internal(ls(envir, all.names, sorted)) :
@@ -3135,7 +3342,7 @@ void R_LockEnvironment(SEXP env, Rboolean bindings)
 	if (bindings) {
 	    SEXP s;
 	    int j;
-	    for (j = 0; j < HSIZE; j++)
+	    for (j = 0; j < R_SymbolTableSize; j++)
 		for (s = R_SymbolTable[j]; s != R_NilValue; s = CDR(s))
 		    if(SYMVALUE(CAR(s)) != R_UnboundValue)
 			LOCK_BINDING(CAR(s));
@@ -3413,18 +3620,30 @@ SEXP attribute_hidden do_mkUnbound(SEXP call, SEXP op, SEXP args, SEXP rho)
     return R_NilValue;
 }
 
+/* Hash tables are read in the chained layout written by
+   R_HashTableChains, so rebuild them. */
 void R_RestoreHashCount(SEXP rho)
 {
-    if (IS_HASHED(rho)) {
-	SEXP table;
+    if (IS_HASHED(rho) && TYPEOF(HASHTAB(rho)) == VECSXP) {
+	SEXP table, new_table, chain, next;
 	int i, count, size;
 
 	table = HASHTAB(rho);
 	size = HASHSIZE(table);
 	for (i = 0, count = 0; i < size; i++)
-	    if (VECTOR_ELT(table, i) != R_NilValue)
+	    for (chain = VECTOR_ELT(table, i); chain != R_NilValue;
+		 chain = CDR(chain))
 		count++;
-	SET_HASHPRI(table, count);
+	if (size < (int) (count / HASHMAXLOAD) + 1)
+	    size = (int) (count / HASHMAXLOAD) + 1;
+	new_table = R_NewHashTable(size);
+	for (i = 0; i < HASHSIZE(table); i++)
+	    for (chain = VECTOR_ELT(table, i); chain != R_NilValue;
+		 chain = next) {
+		next = CDR(chain);
+		R_HashInsertCell(new_table, chain);
+	    }
+	SET_HASHTAB(rho, new_table);
     }
 }
 
@@ -3763,6 +3982,7 @@ static void R_StringHash_resize(unsigned int newsize)
     unsigned int newsize, newpri;
 #endif
 
+    R_PERF_COUNT(PERF_STRING_RESIZE);
     /* Allocate the new hash table.  This could fail to allocate
        enough memory, and ideally we would recover from that and
        carry over with a table that was getting full.
@@ -3808,12 +4028,35 @@ static void R_StringHash_resize(unsigned int newsize)
    a new CHARSXP is created, added to the cache and then returned. */
 
 
-SEXP mkCharLenCE(const char *name, int len, cetype_t enc)
+/* The CHARSXP in the cache for 'name' with encoding bits 'need_enc',
+   or R_NilValue.  This only reads the cache and does not allocate. */
+static R_INLINE SEXP findCachedChar(const char *name, int len, int need_enc,
+				    unsigned int hashcode)
+{
+    SEXP chain = VECTOR_ELT(R_StringHash, hashcode);
+    R_PERF_COUNT(PERF_STRING_LOOKUP);
+    for (; !ISNULL(chain) ; chain = CXTAIL(chain)) {
+	SEXP val = CXHEAD(chain);
+	if (TYPEOF(val) != CHARSXP) break; /* sanity check */
+	if (need_enc == (ENC_KNOWN(val) | IS_BYTES(val)) &&
+	    LENGTH(val) == len &&  /* quick pretest */
+	    (!len || (memcmp(CHAR(val), name, len) == 0))) // called with len = 0
+	    return val;
+    }
+    return R_NilValue;
+}
+
+/* Like mkCharLenCE, but only returns a string already in the cache,
+   or R_NilValue if there is none or the arguments are invalid.  It
+   neither allocates nor signals errors, so it may be called from
+   other threads while the main thread is not evaluating R code, for
+   example from within an OpenMP parallel region.  The result is
+   not protected, so it must be stored or protected by the main thread
+   before anything it runs can allocate. */
+SEXP R_lookupCharLenCE(const char *name, int len, cetype_t enc)
 {
-    SEXP cval, chain;
-    unsigned int hashcode;
     int need_enc;
-    Rboolean embedNul = FALSE, is_ascii = TRUE;
+    Rboolean is_ascii = TRUE;
 
     switch(enc){
     case CE_NATIVE:
@@ -3824,30 +4067,12 @@ SEXP mkCharLenCE(const char *name, int len, cetype_t enc)
     case CE_ANY:
 	break;
     default:
-	error(_("unknown encoding: %d"), enc);
+	return R_NilValue;
     }
     for (int slen = 0; slen < len; slen++) {
 	if ((unsigned int) name[slen] > 127) is_ascii = FALSE;
-	if (!name[slen]) embedNul = TRUE;
-    }
-    if (embedNul) {
-	SEXP c;
-	/* This is tricky: we want to make a reasonable job of
-	   representing this string, and EncodeString() is the most
-	   comprehensive */
-	c = allocCharsxp(len);
-	memcpy(CHAR_RW(c), name, len);
-	switch(enc) {
-	case CE_UTF8: SET_UTF8(c); break;
-	case CE_LATIN1: SET_LATIN1(c); break;
-	case CE_BYTES: SET_BYTES(c); break;
-	default: break;
-	}
-	if (is_ascii) SET_ASCII(c);
-	error(_("embedded nul in string: '%s'"),
-	      EncodeString(c, 0, 0, Rprt_adj_none));
+	if (!name[slen]) return R_NilValue;
     }
-
     if (enc && is_ascii) enc = CE_NATIVE;
     switch(enc) {
     case CE_UTF8: need_enc = UTF8_MASK; break;
@@ -3855,65 +4080,227 @@ SEXP mkCharLenCE(const char *name, int len, cetype_t enc)
     case CE_BYTES: need_enc = BYTES_MASK; break;
     default: need_enc = 0;
     }
+    return findCachedChar(name, len, need_enc,
+			  char_hash(name, len) & char_hash_mask);
+}
 
-    hashcode = char_hash(name, len) & char_hash_mask;
+/* Look for bytes above 127 and for nuls in name[0 .. len), eight
+   bytes at a time: the high bits of the words are or-ed together, as
+   are the high bits of (w - 0x0101...) & ~w, which are set only if w
+   has a zero byte.  The words are copied with memcpy as name need not
+   be aligned. */
+#define ONES_8 ((uint64_t) 0x0101010101010101ULL)
+#define HIGHS_8 (ONES_8 * 0x80)
 
-    /* Search for a cached value */
-    cval = R_NilValue;
+static R_INLINE void
+scanChars(const char *name, int len, Rboolean *ascii, Rboolean *nul)
+{
+    uint64_t high = 0, zero = 0, w;
+    int i = 0;
+
+    for (; i + 8 <= len; i += 8) {
+	memcpy(&w, name + i, 8);
+	high |= w;
+	zero |= (w - ONES_8) & ~w;
+    }
+    for (; i < len; i++) {
+	high |= (unsigned char) name[i];
+	if (!name[i]) zero = HIGHS_8;
+    }
+    *ascii = (high & HIGHS_8) ? FALSE : TRUE;
+    *nul = (zero & HIGHS_8) ? TRUE : FALSE;
+}
+
+static R_INLINE int encMask(cetype_t enc)
+{
+    switch(enc) {
+    case CE_UTF8: return UTF8_MASK;
+    case CE_LATIN1: return LATIN1_MASK;
+    case CE_BYTES: return BYTES_MASK;
+    default: return 0;
+    }
+}
+
+/* Add a new CHARSXP for name to the cache, given the full hash of name
+   and with enc already reduced to CE_NATIVE for ASCII strings. */
+static SEXP newCachedChar(const char *name, int len, cetype_t enc,
+			  Rboolean is_ascii, unsigned int hash)
+{
+    SEXP cval, chain;
+    unsigned int hashcode = hash & char_hash_mask;
+
+    R_PERF_COUNT(PERF_STRING_NEW);
+    PROTECT(cval = allocCharsxp(len));
+    memcpy(CHAR_RW(cval), name, len);
+    switch(enc) {
+    case CE_NATIVE:
+	break;          /* don't set encoding */
+    case CE_UTF8:
+	SET_UTF8(cval);
+	break;
+    case CE_LATIN1:
+	SET_LATIN1(cval);
+	break;
+    case CE_BYTES:
+	SET_BYTES(cval);
+	break;
+    default:
+	error("unknown encoding mask: %d", enc);
+    }
+    if (is_ascii) SET_ASCII(cval);
+    SET_CACHED(cval);  /* Mark it */
+    /* add the new value to the cache */
     chain = VECTOR_ELT(R_StringHash, hashcode);
-    for (; !ISNULL(chain) ; chain = CXTAIL(chain)) {
-	SEXP val = CXHEAD(chain);
-	if (TYPEOF(val) != CHARSXP) break; /* sanity check */
-	if (need_enc == (ENC_KNOWN(val) | IS_BYTES(val)) &&
-	    LENGTH(val) == len &&  /* quick pretest */
-	    (!len || (memcmp(CHAR(val), name, len) == 0))) { // called with len = 0
-	    cval = val;
-	    break;
-	}
+    if (ISNULL(chain))
+	SET_HASHPRI(R_StringHash, HASHPRI(R_StringHash) + 1);
+    /* this is a destrictive modification */
+    chain = SET_CXTAIL(cval, chain);
+    SET_VECTOR_ELT(R_StringHash, hashcode, chain);
+
+    /* resize the hash table if necessary with the new entry still
+       protected.
+       Maximum possible power of two is 2^30 for a VECSXP.
+       FIXME: this has changed with long vectors.
+    */
+    if (R_HashSizeCheck(R_StringHash)
+	&& char_hash_size < 1073741824 /* 2^30 */)
+	R_StringHash_resize(char_hash_size * 2);
+
+    UNPROTECT(1);
+    return cval;
+}
+
+static void checkCharEnc(cetype_t enc)
+{
+    switch(enc){
+    case CE_NATIVE:
+    case CE_UTF8:
+    case CE_LATIN1:
+    case CE_BYTES:
+    case CE_SYMBOL:
+    case CE_ANY:
+	break;
+    default:
+	error(_("unknown encoding: %d"), enc);
     }
-    if (cval == R_NilValue) {
-	/* no cached value; need to allocate one and add to the cache */
-	PROTECT(cval = allocCharsxp(len));
-	memcpy(CHAR_RW(cval), name, len);
-	switch(enc) {
-	case CE_NATIVE:
-	    break;          /* don't set encoding */
-	case CE_UTF8:
-	    SET_UTF8(cval);
-	    break;
-	case CE_LATIN1:
-	    SET_LATIN1(cval);
-	    break;
-	case CE_BYTES:
-	    SET_BYTES(cval);
-	    break;
-	default:
-	    error("unknown encoding mask: %d", enc);
-	}
-	if (is_ascii) SET_ASCII(cval);
-	SET_CACHED(cval);  /* Mark it */
-	/* add the new value to the cache */
-	chain = VECTOR_ELT(R_StringHash, hashcode);
-	if (ISNULL(chain))
-	    SET_HASHPRI(R_StringHash, HASHPRI(R_StringHash) + 1);
-	/* this is a destrictive modification */
-	chain = SET_CXTAIL(cval, chain);
-	SET_VECTOR_ELT(R_StringHash, hashcode, chain);
-
-	/* resize the hash table if necessary with the new entry still
-	   protected.
-	   Maximum possible power of two is 2^30 for a VECSXP.
-	   FIXME: this has changed with long vectors.
-	*/
-	if (R_HashSizeCheck(R_StringHash)
-	    && char_hash_size < 1073741824 /* 2^30 */)
-	    R_StringHash_resize(char_hash_size * 2);
+}
 
-	UNPROTECT(1);
+static void NORET embeddedNulError(const char *name, int len, cetype_t enc,
+				    Rboolean is_ascii)
+{
+    SEXP c;
+    /* This is tricky: we want to make a reasonable job of
+       representing this string, and EncodeString() is the most
+       comprehensive */
+    c = allocCharsxp(len);
+    memcpy(CHAR_RW(c), name, len);
+    switch(enc) {
+    case CE_UTF8: SET_UTF8(c); break;
+    case CE_LATIN1: SET_LATIN1(c); break;
+    case CE_BYTES: SET_BYTES(c); break;
+    default: break;
     }
+    if (is_ascii) SET_ASCII(c);
+    error(_("embedded nul in string: '%s'"),
+	  EncodeString(c, 0, 0, Rprt_adj_none));
+}
+
+SEXP mkCharLenCE(const char *name, int len, cetype_t enc)
+{
+    SEXP cval;
+    unsigned int hash;
+    Rboolean embedNul = FALSE, is_ascii = TRUE;
+
+    checkCharEnc(enc);
+    scanChars(name, len, &is_ascii, &embedNul);
+    if (embedNul) embeddedNulError(name, len, enc, is_ascii);
+
+    if (enc && is_ascii) enc = CE_NATIVE;
+    hash = char_hash(name, len);
+
+    /* Search for a cached value */
+    cval = findCachedChar(name, len, encMask(enc), hash & char_hash_mask);
+    if (cval == R_NilValue)
+	/* no cached value; need to allocate one and add to the cache */
+	cval = newCachedChar(name, len, enc, is_ascii, hash);
     return cval;
 }
 
+/* Set elements offset, ..., offset + n - 1 of the character vector ans
+   to the CHARSXPs for the lens[i] bytes at names[i], all in encoding
+   enc, as mkCharLenCE() would.  The strings are all scanned and hashed
+   first and then looked up, and before any of those not found are
+   added the cache is grown once to take them, rather than as they are
+   added.  As the strings may repeat, that growth is limited to a
+   factor of four.  Scanning and hashing touch nothing shared, so for
+   batches of at least R_MKCHARVEC_THREADS_MIN bytes they are done on
+   R_num_math_threads threads. */
+#define R_MKCHARVEC_THREADS_MIN 65536
+
+void attribute_hidden
+R_mkCharLenCEVec(SEXP ans, R_xlen_t offset, const char **names,
+	       const int *lens, int n, cetype_t enc)
+{
+    const void *vmax = vmaxget();
+    unsigned int *hash = (unsigned int *) R_alloc(n, sizeof(unsigned int));
+    char *ascii = R_alloc(n, sizeof(char)), *miss = R_alloc(n, sizeof(char));
+    int i, nmiss = 0;
+
+    checkCharEnc(enc);
+#ifdef _OPENMP
+    int nthreads = 1;
+    if (R_num_math_threads > 1) {
+	double bytes = 0;
+	for (i = 0; i < n; i++) bytes += lens[i];
+	if (bytes >= R_MKCHARVEC_THREADS_MIN)
+	    nthreads = R_num_math_threads;
+    }
+    /* miss[i] notes an embedded nul until the lookups */
+#pragma omp parallel for if(nthreads > 1) num_threads(nthreads) \
+    default(none) firstprivate(names, lens, n, hash, ascii, miss)
+#endif
+    for (i = 0; i < n; i++) {
+	Rboolean embedNul, is_ascii;
+	scanChars(names[i], lens[i], &is_ascii, &embedNul);
+	miss[i] = (char) embedNul;
+	ascii[i] = (char) is_ascii;
+	hash[i] = char_hash(names[i], lens[i]);
+    }
+    for (i = 0; i < n; i++)
+	if (miss[i]) embeddedNulError(names[i], lens[i], enc, ascii[i]);
+
+    for (i = 0; i < n; i++) {
+	cetype_t ienc = (enc && ascii[i]) ? CE_NATIVE : enc;
+	SEXP cval = findCachedChar(names[i], lens[i], encMask(ienc),
+				   hash[i] & char_hash_mask);
+	miss[i] = cval == R_NilValue;
+	if (miss[i]) nmiss++;
+	else SET_STRING_ELT(ans, offset + i, cval);
+    }
+
+    if (nmiss) {
+	unsigned int newsize = char_hash_size;
+	while (newsize < 1073741824 /* 2^30 */ &&
+	       newsize < 4 * (double) char_hash_size &&
+	       (double) HASHPRI(R_StringHash) + nmiss > newsize * 0.85)
+	    newsize *= 2;
+	if (newsize > char_hash_size) R_StringHash_resize(newsize);
+
+	for (i = 0; i < n; i++) {
+	    if (!miss[i]) continue;
+	    cetype_t ienc = (enc && ascii[i]) ? CE_NATIVE : enc;
+	    /* an earlier string in this batch may have added it */
+	    SEXP cval = findCachedChar(names[i], lens[i], encMask(ienc),
+				       hash[i] & char_hash_mask);
+	    if (cval == R_NilValue)
+		cval = newCachedChar(names[i], lens[i], ienc, ascii[i],
+				     hash[i]);
+	    SET_STRING_ELT(ans, offset + i, cval);
+	}
+    }
+    vmaxset(vmax);
+}
+
 
 #ifdef DEBUG_SHOW_CHARSXP_CACHE
 /* Call this from gdb with
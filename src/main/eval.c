@@ -1,7 +1,7 @@
 /*
  *  R : A Computer Language for Statistical Data Analysis
  *  Copyright (C) 1995, 1996	Robert Gentleman and Ross Ihaka
- *  Copyright (C) 1998--2015	The R Core Team.
+ *  Copyright (C) 1998--2017	The R Core Team.
  *
  *  This program is free software; you can redistribute it and/or modify
  *  it under the terms of the GNU General Public License as published by
@@ -32,19 +32,25 @@
 #include <Fileio.h>
 #include <R_ext/Print.h>
 
+#ifdef HAVE_LINUX_PERF_EVENT_H
+# include <linux/perf_event.h>	/* for byte code profiling */
+# include <sys/ioctl.h>
+# include <sys/syscall.h>
+# include <unistd.h>
+# include <errno.h>
+#endif
+
 
 #define ARGUSED(x) LEVELS(x)
 
 static SEXP bcEval(SEXP, SEXP, Rboolean);
-
-/* BC_PROILFING needs to be enabled at build time. It is not enabled
-   by default as enabling it disabled the more efficient threaded code
-   implementation of the byte code interpreter. */
-#ifdef BC_PROFILING
-static Rboolean bc_profiling = FALSE;
-#endif
+static SEXP promiseArgs1(SEXP, SEXP, SEXP);
+static Rboolean leafClosure(SEXP);
 
 static int R_Profiling = 0;
+static int R_Trace_Profiling = 0;	/* Rprof(mode = "trace") */
+static int traceEnter(SEXP call, SEXP op);
+static void traceExit(int k);
 
 #ifdef R_PROFILING
 
@@ -98,6 +104,9 @@ static int R_Profiling = 0;
 #  include <sys/time.h>
 # endif
 # include <signal.h>
+# ifdef HAVE_EXECINFO_H
+#  include <execinfo.h>		/* for backtrace */
+# endif
 #endif /* not Win32 */
 
 static FILE *R_ProfileOutfile = NULL;
@@ -109,6 +118,31 @@ static size_t R_Srcfile_bufcount;                  /* how big is the array above
 static SEXP R_Srcfiles_buffer = NULL;              /* a big RAWSXP to use as a buffer for filenames and pointers to them */
 static int R_Profiling_Error;		   /* record errors here */
 
+/* Binary profiles, Rprof(binary = TRUE).  Nothing is formatted or
+   allocated when a sample is taken: the names of the frames are
+   interned in preallocated hash tables, and a stack is a node of a
+   tree of (parent, frame) pairs, also interned.  A new node, and each
+   sample (the innermost node and the byte code offset), is a record
+   of four ints buffered in profBuf and written out when it is full.
+   The frame names follow the records when profiling ends, so native
+   frames are only looked up then.  The format is described in ?Rprof.
+ */
+#define PROF_FRAMES (1 << 14)	/* slots each for R and native frames */
+#define PROF_NODES  (1 << 20)	/* slots for stack nodes */
+#define PROF_POOL   (1 << 20)	/* bytes for the names of R frames */
+#define PROF_DEPTH  2000	/* frames of a stack kept, innermost first */
+#define PROF_NATIVE 64		/* native frames of a stack kept */
+#define PROF_BUF    4096	/* records buffered */
+
+static int R_Binary_Profiling = 0;		   /* 1, or 2 with native frames */
+static int *profNames;		/* offset of an R frame's name in profPool, or -1 */
+static char *profPool;
+static size_t profPoolUsed;
+static void **profAddrs;	/* the address of a native frame, or NULL */
+static int *profNodes;		/* (parent, frame) of a node, frame -1 if unused */
+static int profBuf[4 * PROF_BUF];
+static int profBufUsed;
+
 #ifdef Win32
 HANDLE MainThread;
 HANDLE ProfileEvent;
@@ -180,6 +214,66 @@ static void lineprof(char* buf, SEXP srcref)
     }
 }
 
+/* The name of the function called as 'fun', as shown in profiles */
+static void profItem(SEXP fun, char *itembuf)
+{
+    if (TYPEOF(fun) == SYMSXP) {
+	snprintf(itembuf, PROFITEMMAX-1, "%s", CHAR(PRINTNAME(fun)));
+
+    } else if ((CAR(fun) == R_DoubleColonSymbol ||
+		CAR(fun) == R_TripleColonSymbol ||
+		CAR(fun) == R_DollarSymbol) &&
+	       TYPEOF(CADR(fun)) == SYMSXP &&
+	       TYPEOF(CADDR(fun)) == SYMSXP) {
+	/* Function accessed via ::, :::, or $. Both args must be
+	   symbols. It is possible to use strings with these
+	   functions, as in "base"::"list", but that's a very rare
+	   case so we won't bother handling it. */
+	snprintf(itembuf, PROFITEMMAX-1, "%s%s%s",
+		 CHAR(PRINTNAME(CADR(fun))),
+		 CHAR(PRINTNAME(CAR(fun))),
+		 CHAR(PRINTNAME(CADDR(fun))));
+
+    } else if (CAR(fun) == R_Bracket2Symbol &&
+	       TYPEOF(CADR(fun)) == SYMSXP &&
+	       ((TYPEOF(CADDR(fun)) == SYMSXP ||
+		 TYPEOF(CADDR(fun)) == STRSXP ||
+		 TYPEOF(CADDR(fun)) == INTSXP ||
+		 TYPEOF(CADDR(fun)) == REALSXP) &&
+		length(CADDR(fun)) > 0)) {
+	/* Function accessed via [[. The first arg must be a symbol
+	   and the second can be a symbol, string, integer, or
+	   real. */
+	SEXP arg1 = CADR(fun);
+	SEXP arg2 = CADDR(fun);
+	char arg2buf[PROFITEMMAX];
+
+	if (TYPEOF(arg2) == SYMSXP) {
+	    snprintf(arg2buf, PROFITEMMAX-1, "%s", CHAR(PRINTNAME(arg2)));
+
+	} else if (TYPEOF(arg2) == STRSXP) {
+	    snprintf(arg2buf, PROFITEMMAX-1, "\"%s\"", CHAR(STRING_ELT(arg2, 0)));
+
+	} else if (TYPEOF(arg2) == INTSXP) {
+	    snprintf(arg2buf, PROFITEMMAX-1, "%d", INTEGER(arg2)[0]);
+
+	} else if (TYPEOF(arg2) == REALSXP) {
+	    snprintf(arg2buf, PROFITEMMAX-1, "%.0f", REAL(arg2)[0]);
+
+	} else {
+	    /* Shouldn't get here, but just in case. */
+	    arg2buf[0] = '\0';
+	}
+
+	snprintf(itembuf, PROFITEMMAX-1, "%s[[%s]]",
+		 CHAR(PRINTNAME(arg1)),
+		 arg2buf);
+
+    } else {
+	sprintf(itembuf, "<Anonymous>");
+    }
+}
+
 /* FIXME: This should be done wih a proper configure test, also making
    sure that the pthreads library is linked in. LT */
 #ifndef Win32
@@ -193,6 +287,153 @@ static pthread_t R_profiled_thread;
 # endif
 #endif
 
+static void profRecord(int tag, int a, int b, int c)
+{
+    int *r = profBuf + 4 * profBufUsed;
+    r[0] = tag; r[1] = a; r[2] = b; r[3] = c;
+    if (++profBufUsed == PROF_BUF) {
+	fwrite(profBuf, 4 * sizeof(int), profBufUsed, R_ProfileOutfile);
+	profBufUsed = 0;
+    }
+}
+
+/* The id of the frame called 'name', or -1 if the tables are full */
+static int profFrame(const char *name)
+{
+    unsigned int h = 2166136261U; /* FNV-1a */
+    for (const char *p = name; *p; p++)
+	h = (h ^ (unsigned char) *p) * 16777619U;
+    for (int i = 0; i < PROF_FRAMES; i++) {
+	int k = (h + i) & (PROF_FRAMES - 1);
+	if (profNames[k] < 0) {
+	    size_t len = strlen(name) + 1;
+	    if (profPoolUsed + len > PROF_POOL) break;
+	    memcpy(profPool + profPoolUsed, name, len);
+	    profNames[k] = (int) profPoolUsed;
+	    profPoolUsed += len;
+	    return k;
+	}
+	if (!strcmp(profPool + profNames[k], name)) return k;
+    }
+    R_Profiling_Error = 3;
+    return -1;
+}
+
+/* Native frames have ids PROF_FRAMES and up */
+static int profNative(void *addr)
+{
+    unsigned int h = (unsigned int) ((uintptr_t) addr >> 2) * 2654435761U;
+    for (int i = 0; i < PROF_FRAMES; i++) {
+	int k = (h + i) & (PROF_FRAMES - 1);
+	if (profAddrs[k] == NULL) profAddrs[k] = addr;
+	if (profAddrs[k] == addr) return PROF_FRAMES + k;
+    }
+    R_Profiling_Error = 3;
+    return -1;
+}
+
+/* The id of the node for 'frame' called from 'parent' (-1 for the
+   top level), recording it if new */
+static int profNode(int parent, int frame)
+{
+    unsigned int h = (unsigned int) parent * 2654435761U ^
+	(unsigned int) frame * 40503U;
+    for (int i = 0; i < PROF_NODES; i++) {
+	int k = (h + i) & (PROF_NODES - 1), *e = profNodes + 2 * k;
+	if (e[1] < 0) {
+	    e[0] = parent;
+	    e[1] = frame;
+	    profRecord(1, k, parent, frame);
+	    return k;
+	}
+	if (e[0] == parent && e[1] == frame) return k;
+    }
+    R_Profiling_Error = 3;
+    return -1;
+}
+
+/* Record a sample whose innermost 'nnative' frames are native ones */
+static void binprof(void **native, int nnative)
+{
+    static int frames[PROF_NATIVE + 1 + PROF_DEPTH];
+    char itembuf[PROFITEMMAX];
+    RCNTXT *cptr;
+    int n = 0, node = -1, pc = -1;
+
+    for (int i = 0; i < nnative; i++)
+	frames[n++] = profNative(native[i]);
+    if (R_GC_Profiling && R_gc_running())
+	frames[n++] = profFrame("<GC>");
+    for (cptr = R_GlobalContext; cptr && n < PROF_NATIVE + 1 + PROF_DEPTH;
+	 cptr = cptr->nextcontext)
+	if ((cptr->callflag & (CTXT_FUNCTION | CTXT_BUILTIN))
+	    && TYPEOF(cptr->call) == LANGSXP) {
+	    profItem(CAR(cptr->call), itembuf);
+	    frames[n++] = profFrame(itembuf);
+	}
+    if (n == 0) return;
+    while (n > 0) {
+	if (frames[--n] < 0 || (node = profNode(node, frames[n])) < 0)
+	    return; /* out of space */
+    }
+    if (R_BCbody != NULL) pc = R_BCCurrentPC(R_BCbody);
+    profRecord(2, node, pc, 0);
+}
+
+/* Write out the buffered records and the names of the frames */
+static void R_EndBinaryProfiling(void)
+{
+    int nf = 0, nbytes = 0;
+    char **names;
+    size_t i;
+
+    if (profBufUsed)
+	fwrite(profBuf, 4 * sizeof(int), profBufUsed, R_ProfileOutfile);
+    profBufUsed = 0;
+    names = (char **) calloc(2 * PROF_FRAMES, sizeof(char *));
+    if (names == NULL) R_Suicide("out of memory ending Rprof");
+    for (i = 0; i < PROF_FRAMES; i++)
+	if (profNames[i] >= 0)
+	    names[i] = strdup(profPool + profNames[i]);
+#ifdef HAVE_EXECINFO_H
+    for (i = 0; i < PROF_FRAMES; i++)
+	if (profAddrs[i]) {
+	    /* "file(symbol+offset) [address]" with glibc: keep the symbol */
+	    char **sym = backtrace_symbols(profAddrs + i, 1), *p, *q;
+	    if (sym == NULL) break;
+	    p = strchr(sym[0], '(');
+	    q = p ? strpbrk(p + 1, "+)") : NULL;
+	    if (q && q > p + 1) {
+		*q = '\0';
+		names[PROF_FRAMES + i] = strdup(p + 1);
+	    } else
+		names[PROF_FRAMES + i] = strdup(sym[0]);
+	    free(sym);
+	}
+#endif
+    for (i = 0; i < 2 * PROF_FRAMES; i++)
+	if (names[i]) {
+	    nf++;
+	    nbytes += (int) strlen(names[i]) + 1;
+	}
+    profRecord(3, nf, nbytes, 0);
+    fwrite(profBuf, 4 * sizeof(int), profBufUsed, R_ProfileOutfile);
+    profBufUsed = 0;
+    for (i = 0; i < 2 * PROF_FRAMES; i++)
+	if (names[i]) {
+	    int id = (int) i;
+	    fwrite(&id, sizeof(int), 1, R_ProfileOutfile);
+	}
+    for (i = 0; i < 2 * PROF_FRAMES; i++)
+	if (names[i]) {
+	    fwrite(names[i], 1, strlen(names[i]) + 1, R_ProfileOutfile);
+	    free(names[i]);
+	}
+    free(names);
+    free(profNames); free(profPool); free(profAddrs); free(profNodes);
+    R_Binary_Profiling = 0;
+}
+
 static void doprof(int sig)  /* sig is ignored in Windows */
 {
     RCNTXT *cptr;
@@ -212,6 +453,24 @@ static void doprof(int sig)  /* sig is ignored in Windows */
     }
 #endif /* Win32 */
 
+    if (R_Binary_Profiling) {
+	void *native[PROF_NATIVE + 2];
+	int nnative = 0;
+#ifdef HAVE_EXECINFO_H
+	/* skip doprof() and the signal trampoline */
+	if (R_Binary_Profiling > 1 &&
+	    (nnative = backtrace(native, PROF_NATIVE + 2) - 2) < 0)
+	    nnative = 0;
+#endif
+	binprof(native + 2, nnative);
+#ifdef Win32
+	ResumeThread(MainThread);
+#else
+	signal(SIGPROF, doprof);
+#endif /* not Win32 */
+	return;
+    }
+
     if (R_Mem_Profiling){
 	    get_current_mem(&smallv, &bigv, &nodes);
 	    if((len = strlen(buf)) < PROFLINEMAX)
@@ -237,62 +496,7 @@ static void doprof(int sig)  /* sig is ignored in Windows */
 
 		char itembuf[PROFITEMMAX];
 
-		if (TYPEOF(fun) == SYMSXP) {
-		    snprintf(itembuf, PROFITEMMAX-1, "%s", CHAR(PRINTNAME(fun)));
-
-		} else if ((CAR(fun) == R_DoubleColonSymbol ||
-			    CAR(fun) == R_TripleColonSymbol ||
-			    CAR(fun) == R_DollarSymbol) &&
-			   TYPEOF(CADR(fun)) == SYMSXP &&
-			   TYPEOF(CADDR(fun)) == SYMSXP) {
-		    /* Function accessed via ::, :::, or $. Both args must be
-		       symbols. It is possible to use strings with these
-		       functions, as in "base"::"list", but that's a very rare
-		       case so we won't bother handling it. */
-		    snprintf(itembuf, PROFITEMMAX-1, "%s%s%s",
-			     CHAR(PRINTNAME(CADR(fun))),
-			     CHAR(PRINTNAME(CAR(fun))),
-			     CHAR(PRINTNAME(CADDR(fun))));
-
-		} else if (CAR(fun) == R_Bracket2Symbol &&
-			   TYPEOF(CADR(fun)) == SYMSXP &&
-			   ((TYPEOF(CADDR(fun)) == SYMSXP ||
-			     TYPEOF(CADDR(fun)) == STRSXP ||
-			     TYPEOF(CADDR(fun)) == INTSXP ||
-			     TYPEOF(CADDR(fun)) == REALSXP) &&
-			    length(CADDR(fun)) > 0)) {
-		    /* Function accessed via [[. The first arg must be a symbol
-		       and the second can be a symbol, string, integer, or
-		       real. */
-		    SEXP arg1 = CADR(fun);
-		    SEXP arg2 = CADDR(fun);
-		    char arg2buf[PROFITEMMAX];
-
-		    if (TYPEOF(arg2) == SYMSXP) {
-			snprintf(arg2buf, PROFITEMMAX-1, "%s", CHAR(PRINTNAME(arg2)));
-
-		    } else if (TYPEOF(arg2) == STRSXP) {
-			snprintf(arg2buf, PROFITEMMAX-1, "\"%s\"", CHAR(STRING_ELT(arg2, 0)));
-
-		    } else if (TYPEOF(arg2) == INTSXP) {
-			snprintf(arg2buf, PROFITEMMAX-1, "%d", INTEGER(arg2)[0]);
-
-		    } else if (TYPEOF(arg2) == REALSXP) {
-			snprintf(arg2buf, PROFITEMMAX-1, "%.0f", REAL(arg2)[0]);
-
-		    } else {
-			/* Shouldn't get here, but just in case. */
-			arg2buf[0] = '\0';
-		    }
-
-		    snprintf(itembuf, PROFITEMMAX-1, "%s[[%s]]",
-			     CHAR(PRINTNAME(arg1)),
-			     arg2buf);
-
-		} else {
-		    sprintf(itembuf, "<Anonymous>");
-		}
-
+		profItem(fun, itembuf);
 		strcat(buf, itembuf);
 		strcat(buf, "\" ");
 		if (R_Line_Profiling)
@@ -338,8 +542,167 @@ static void doprof_null(int sig)
 #endif /* not Win32 */
 
 
+/* Deterministic tracing, Rprof(mode = "trace").  Closures (keyed by
+   the symbol they are called by, as in sampled profiles) and builtins
+   (keyed by the primitive) have their calls counted and timed in an
+   open-addressing hash table.  Neither kind of key is ever garbage
+   collected.  The calls in progress are kept on a stack with the C
+   stack address at which they were entered: when a later call is
+   entered at the same or a shallower address, those above it were
+   left by a long jump, and are finished then.  A function's total
+   time only counts its outermost activation, so recursion is not
+   counted twice; its self time excludes the calls it makes.
+*/
+typedef struct {
+    SEXP key;
+    double calls, total, self;
+    int active;
+} traceEntry;
+
+typedef struct {
+    int slot;
+    uintptr_t cstack;
+    double start, child;
+} traceFrame;
+
+static traceEntry *traceTab;
+static int traceSize, traceUsed;
+static traceFrame *traceStack;
+static int traceTop, traceStackSize;
+
+static int traceSlot(SEXP key)
+{
+    for (;;) {
+	int k = (int) (((uintptr_t) key >> 3) * 2654435761U) & (traceSize - 1);
+	for (; traceTab[k].key != NULL; k = (k + 1) & (traceSize - 1))
+	    if (traceTab[k].key == key) return k;
+	if (2 * (traceUsed + 1) <= traceSize) {
+	    traceTab[k].key = key;
+	    traceUsed++;
+	    return k;
+	}
+	/* grow the table: the stack refers to slots, so renumber them */
+	traceEntry *old = traceTab;
+	int oldsize = traceSize;
+	traceTab = (traceEntry *) calloc(2 * oldsize, sizeof(traceEntry));
+	if (traceTab == NULL) R_Suicide("out of memory in Rprof tracing");
+	traceSize = 2 * oldsize;
+	for (int i = 0; i < oldsize; i++)
+	    if (old[i].key != NULL) {
+		int j = (int) (((uintptr_t) old[i].key >> 3) * 2654435761U)
+		    & (traceSize - 1);
+		while (traceTab[j].key != NULL) j = (j + 1) & (traceSize - 1);
+		traceTab[j] = old[i];
+		for (int f = 0; f < traceTop; f++)
+		    if (traceStack[f].slot == i) traceStack[f].slot = -1 - j;
+	    }
+	for (int f = 0; f < traceTop; f++)
+	    traceStack[f].slot = -1 - traceStack[f].slot;
+	free(old);
+    }
+}
+
+static void tracePop(double now)
+{
+    traceFrame *f = traceStack + --traceTop;
+    traceEntry *e = traceTab + f->slot;
+    double elapsed = now - f->start;
+    e->self += elapsed - f->child;
+    if (--e->active == 0) e->total += elapsed;
+    if (traceTop > 0) traceStack[traceTop - 1].child += elapsed;
+}
+
+static int traceEnter(SEXP call, SEXP op)
+{
+    char here;
+    uintptr_t cstack = (uintptr_t) &here;
+    SEXP key = op;
+    double now = currentTime();
+
+    if (TYPEOF(op) == CLOSXP) {
+	key = CAR(call);
+	if (TYPEOF(key) != SYMSXP) {
+	    char itembuf[PROFITEMMAX];
+	    profItem(key, itembuf);
+	    key = install(itembuf);
+	}
+    }
+    while (traceTop > 0 &&
+	   (R_CStackDir > 0 ? traceStack[traceTop - 1].cstack <= cstack :
+	    traceStack[traceTop - 1].cstack >= cstack))
+	tracePop(now);
+    if (traceTop == traceStackSize) {
+	traceFrame *new = (traceFrame *)
+	    realloc(traceStack, 2 * traceStackSize * sizeof(traceFrame));
+	if (new == NULL) R_Suicide("out of memory in Rprof tracing");
+	traceStack = new;
+	traceStackSize *= 2;
+    }
+    traceFrame *f = traceStack + traceTop;
+    f->slot = traceSlot(key);
+    f->cstack = cstack;
+    f->child = 0;
+    traceTab[f->slot].calls++;
+    traceTab[f->slot].active++;
+    f->start = currentTime();
+    return traceTop++;
+}
+
+static void traceExit(int k)
+{
+    if (!R_Trace_Profiling || k >= traceTop) return;
+    double now = currentTime();
+    while (traceTop > k) tracePop(now);
+}
+
+static void R_InitTracing(SEXP filename)
+{
+    R_ProfileOutfile = RC_fopen(filename, "w", TRUE);
+    if (R_ProfileOutfile == NULL)
+	error(_("Rprof: cannot open profile file '%s'"),
+	      translateChar(filename));
+    traceSize = 1024;
+    traceUsed = traceTop = 0;
+    traceStackSize = 256;
+    traceTab = (traceEntry *) calloc(traceSize, sizeof(traceEntry));
+    traceStack = (traceFrame *) malloc(traceStackSize * sizeof(traceFrame));
+    if (traceTab == NULL || traceStack == NULL) {
+	free(traceTab); free(traceStack);
+	fclose(R_ProfileOutfile);
+	R_ProfileOutfile = NULL;
+	error(_("cannot allocate the tables for Rprof"));
+    }
+    R_Trace_Profiling = 1;
+}
+
+/* Write out the table: tab-separated, one line per function */
+static void R_EndTracing(void)
+{
+    double now = currentTime();
+    R_Trace_Profiling = 0;
+    while (traceTop > 0) tracePop(now);
+    fprintf(R_ProfileOutfile,
+	    "function\ttype\tcalls\ttotal.time\tself.time\n");
+    for (int i = 0; i < traceSize; i++) {
+	SEXP key = traceTab[i].key;
+	if (key == NULL) continue;
+	fprintf(R_ProfileOutfile, "%s\t%s\t%.0f\t%.6f\t%.6f\n",
+		TYPEOF(key) == SYMSXP ? CHAR(PRINTNAME(key)) : PRIMNAME(key),
+		TYPEOF(key) == SYMSXP ? "closure" : "builtin",
+		traceTab[i].calls, traceTab[i].total, traceTab[i].self);
+    }
+    fclose(R_ProfileOutfile);
+    R_ProfileOutfile = NULL;
+    free(traceTab); free(traceStack);
+    traceTab = NULL; traceStack = NULL;
+}
+
 static void R_EndProfiling(void)
 {
+    if (R_Trace_Profiling) {
+	R_EndTracing();
+	return;
+    }
 #ifdef Win32
     SetEvent(ProfileEvent);
     CloseHandle(MainThread);
@@ -354,6 +717,7 @@ static void R_EndProfiling(void)
     signal(SIGPROF, doprof_null);
 
 #endif /* not Win32 */
+    if(R_ProfileOutfile && R_Binary_Profiling) R_EndBinaryProfiling();
     if(R_ProfileOutfile) fclose(R_ProfileOutfile);
     R_ProfileOutfile = NULL;
     R_Profiling = 0;
@@ -361,14 +725,17 @@ static void R_EndProfiling(void)
 	R_ReleaseObject(R_Srcfiles_buffer);
 	R_Srcfiles_buffer = NULL;
     }
-    if (R_Profiling_Error)
+    if (R_Profiling_Error == 3)
+	warning(_("samples skipped by Rprof as its tables of stacks are full"));
+    else if (R_Profiling_Error)
 	warning(_("source files skipped by Rprof; please increase '%s'"),
 		R_Profiling_Error == 1 ? "numfiles" : "bufsize");
 }
 
 static void R_InitProfiling(SEXP filename, int append, double dinterval,
 			    int mem_profiling, int gc_profiling,
-			    int line_profiling, int numfiles, int bufsize)
+			    int line_profiling, int numfiles, int bufsize,
+			    int binary, int native, int trace)
 {
 #ifndef Win32
     struct itimerval itv;
@@ -380,17 +747,56 @@ static void R_InitProfiling(SEXP filename, int append, double dinterval,
 
     interval = (int)(1e6 * dinterval + 0.5);
     if(R_ProfileOutfile != NULL) R_EndProfiling();
-    R_ProfileOutfile = RC_fopen(filename, append ? "a" : "w", TRUE);
+    if(trace) {
+	R_InitTracing(filename);
+	return;
+    }
+    R_ProfileOutfile = RC_fopen(filename,
+				binary ? "wb" : (append ? "a" : "w"), TRUE);
     if (R_ProfileOutfile == NULL)
 	error(_("Rprof: cannot open profile file '%s'"),
 	      translateChar(filename));
-    if(mem_profiling)
-	fprintf(R_ProfileOutfile, "memory profiling: ");
-    if(gc_profiling)
-	fprintf(R_ProfileOutfile, "GC profiling: ");
-    if(line_profiling)
-	fprintf(R_ProfileOutfile, "line profiling: ");
-    fprintf(R_ProfileOutfile, "sample.interval=%d\n", interval);
+    R_Binary_Profiling = 0;
+    if (binary) {
+	int hdr[4] = {1, interval, gc_profiling, native};
+#ifndef HAVE_EXECINFO_H
+	if (native) {
+	    warning(_("native frames are not available on this platform"));
+	    hdr[3] = native = 0;
+	}
+#else
+	if (native) {
+	    void *dummy[1];
+	    backtrace(dummy, 1); /* loads libgcc outside the handler */
+	}
+#endif
+	profNames = (int *) malloc(PROF_FRAMES * sizeof(int));
+	profPool = (char *) malloc(PROF_POOL);
+	profAddrs = (void **) calloc(PROF_FRAMES, sizeof(void *));
+	profNodes = (int *) malloc(2 * PROF_NODES * sizeof(int));
+	if (!profNames || !profPool || !profAddrs || !profNodes) {
+	    free(profNames); free(profPool); free(profAddrs); free(profNodes);
+	    fclose(R_ProfileOutfile);
+	    R_ProfileOutfile = NULL;
+	    error(_("cannot allocate the tables for Rprof"));
+	}
+	for (int i = 0; i < PROF_FRAMES; i++) profNames[i] = -1;
+	for (int i = 0; i < 2 * PROF_NODES; i++) profNodes[i] = -1;
+	profPoolUsed = 0;
+	profBufUsed = 0;
+	fwrite("RPROFBIN", 1, 8, R_ProfileOutfile);
+	fwrite(hdr, sizeof(int), 4, R_ProfileOutfile);
+	mem_profiling = line_profiling = 0;
+	R_Binary_Profiling = native ? 2 : 1;
+    } else {
+	if(mem_profiling)
+	    fprintf(R_ProfileOutfile, "memory profiling: ");
+	if(gc_profiling)
+	    fprintf(R_ProfileOutfile, "GC profiling: ");
+	if(line_profiling)
+	    fprintf(R_ProfileOutfile, "line profiling: ");
+	fprintf(R_ProfileOutfile, "sample.interval=%d\n", interval);
+    }
 
     R_Mem_Profiling=mem_profiling;
     if (mem_profiling)
@@ -442,14 +848,8 @@ SEXP do_Rprof(SEXP args)
     SEXP filename;
     int append_mode, mem_profiling, gc_profiling, line_profiling;
     double dinterval;
-    int numfiles, bufsize;
+    int numfiles, bufsize, binary, native, trace;
 
-#ifdef BC_PROFILING
-    if (bc_profiling) {
-	warning("cannot use R profiling while byte code profiling");
-	return R_NilValue;
-    }
-#endif
     if (!isString(filename = CAR(args)) || (LENGTH(filename)) != 1)
 	error(_("invalid '%s' argument"), "filename");
 					      args = CDR(args);
@@ -461,14 +861,24 @@ SEXP do_Rprof(SEXP args)
     numfiles = asInteger(CAR(args));	      args = CDR(args);
     if (numfiles < 0)
 	error(_("invalid '%s' argument"), "numfiles");
-    bufsize = asInteger(CAR(args));
+    bufsize = asInteger(CAR(args));	      args = CDR(args);
     if (bufsize < 0)
 	error(_("invalid '%s' argument"), "bufsize");
+    binary = asLogical(CAR(args));	      args = CDR(args);
+    native = asLogical(CAR(args));	      args = CDR(args);
+    trace = asLogical(CAR(args));
+    if (binary == NA_LOGICAL)
+	error(_("invalid '%s' argument"), "binary");
+    if (native == NA_LOGICAL)
+	error(_("invalid '%s' argument"), "native");
+    if (trace == NA_LOGICAL)
+	error(_("invalid '%s' argument"), "mode");
 
     filename = STRING_ELT(filename, 0);
     if (LENGTH(filename))
 	R_InitProfiling(filename, append_mode, dinterval, mem_profiling,
-			gc_profiling, line_profiling, numfiles, bufsize);
+			gc_profiling, line_profiling, numfiles, bufsize,
+			binary, binary && native, trace);
     else
 	R_EndProfiling();
     return R_NilValue;
@@ -479,6 +889,9 @@ SEXP do_Rprof(SEXP args)
     error(_("R profiling is not available on this system"));
     return R_NilValue;		/* -Wall */
 }
+
+static int traceEnter(SEXP call, SEXP op) { return -1; }
+static void traceExit(int k) { }
 #endif /* not R_PROFILING */
 
 /* NEEDED: A fixup is needed in browser, because it can trap errors,
@@ -701,8 +1114,10 @@ SEXP eval(SEXP e, SEXP rho)
 	    int save = R_PPStackTop, flag = PRIMPRINT(op);
 	    const void *vmax = vmaxget();
 	    RCNTXT cntxt;
+	    int traced;
 	    PROTECT(tmp = evalList(CDR(e), rho, e, 0));
 	    if (flag < 2) R_Visible = flag != 1;
+	    traced = R_Trace_Profiling ? traceEnter(e, op) : -1;
 	    /* We used to insert a context only if profiling,
 	       but helps for tracebacks on .C etc. */
 	    if (R_Profiling || (PPINFO(op).kind == PP_FOREIGN)) {
@@ -716,6 +1131,7 @@ SEXP eval(SEXP e, SEXP rho)
 	    } else {
 		tmp = PRIMFUN(op) (e, op, tmp, rho);
 	    }
+	    if (traced >= 0) traceExit(traced);
 #ifdef CHECK_VISIBILITY
 	    if(flag < 2 && R_Visible == flag) {
 		char *nm = PRIMNAME(op);
@@ -728,7 +1144,7 @@ SEXP eval(SEXP e, SEXP rho)
 	    vmaxset(vmax);
 	}
 	else if (TYPEOF(op) == CLOSXP) {
-	    PROTECT(tmp = promiseArgs(CDR(e), rho));
+	    PROTECT(tmp = promiseArgs1(CDR(e), rho, op));
 	    tmp = applyClosure(e, op, tmp, rho, R_NilValue);
 	    UNPROTECT(1);
 	}
@@ -798,6 +1214,11 @@ static void checkCompilerOptions(int jitEnabled)
 
 static int R_disable_bytecode = 0;
 
+/* JIT compilation counts, reported by compiler::jitStats() */
+static struct {
+    double compiled, failed, deferred, iterations, loops, kernels, cached;
+} jit_stats;
+
 void attribute_hidden R_init_jit_enabled(void)
 {
     /* Need to force the lazy loading promise to avoid recursive
@@ -816,6 +1237,17 @@ void attribute_hidden R_init_jit_enabled(void)
 	}
     }
 
+    char *threshold = getenv("R_JIT_THRESHOLD");
+    if (threshold != NULL) {
+	int val = atoi(threshold);
+	if (val > 0)
+	    R_jit_threshold = val;
+    }
+
+    char *kernels = getenv("R_ENABLE_LOOP_KERNELS");
+    if (kernels != NULL)
+	R_loop_kernels = atoi(kernels) > 0;
+
     if (R_compile_pkgs <= 0) {
 	char *compile = getenv("R_COMPILE_PKGS");
 	if (compile != NULL) {
@@ -844,6 +1276,7 @@ SEXP attribute_hidden R_cmpfun(SEXP fun)
     int old_visible = R_Visible;
     SEXP packsym, funsym, call, fcall, val;
 
+    R_PERF_COUNT(PERF_JIT_COMPILE);
     packsym = install("compiler");
     funsym = install("tryCmpfun");
 
@@ -874,19 +1307,217 @@ static SEXP R_compileExpr(SEXP expr, SEXP rho)
     return val;
 }
 
+/* If the environment variable R_JIT_CACHE_DIR names a directory, code
+   compiled by the JIT is saved there and looked up again before
+   compiling, so scripts run by source() or Rscript need not be
+   recompiled in each session.  Entries are keyed by a 64-bit FNV-1a
+   hash of the serialized formals and body of a closure, or the loop
+   expression, with the optimization level; the serialization header
+   records the R version.  Environments other than the global, base,
+   package and namespace ones are hashed by the names bound in them and
+   their enclosures (see jitHashHook).  As when the JIT
+   compiles, the code reflects which base functions were masked when
+   it was first compiled.  Files are written under a temporary name
+   and renamed, so concurrent sessions can share a directory. */
+
+#define JIT_CACHE_CLOSURE 1
+#define JIT_CACHE_LOOP 2
+
+static void jitHashBytes(R_outpstream_t stream, void *buf, int length)
+{
+    uint64_t *h = (uint64_t *) stream->data;
+    unsigned char *p = buf;
+    for (int i = 0; i < length; i++) {
+	*h ^= p[i];
+	*h *= 1099511628211ULL;
+    }
+}
+
+static void jitHashChar(R_outpstream_t stream, int c)
+{
+    unsigned char b = (unsigned char) c;
+    jitHashBytes(stream, &b, 1);
+}
+
+#define JIT_PLAIN_ENV(e) (TYPEOF(e) == ENVSXP && (e) != R_GlobalEnv && \
+			  (e) != R_BaseEnv && (e) != R_EmptyEnv &&	\
+			  ! R_IsNamespaceEnv(e) && ! R_IsPackageEnv(e))
+
+/* The compiler does not inline a base function whose name is bound in
+   a local frame, so an environment is hashed as the names bound in it
+   and in its enclosures, frame by frame, up to the first global,
+   package or namespace one, which ends the key. */
+static SEXP jitHashHook(SEXP s, SEXP data)
+{
+    if (TYPEOF(s) != ENVSXP)
+	return mkString(type2char(TYPEOF(s)));
+
+    SEXP frames = R_NilValue, env, val;
+    PROTECT_INDEX ipx;
+    PROTECT_WITH_INDEX(frames, &ipx);
+    R_xlen_t n = 0;
+    for (env = s; JIT_PLAIN_ENV(env); env = ENCLOS(env)) {
+	REPROTECT(frames = CONS(R_lsInternal3(env, TRUE, TRUE), frames), ipx);
+	n += XLENGTH(CAR(frames)) + 1;
+    }
+    SEXP last;
+    if (R_IsNamespaceEnv(env))
+	last = R_NamespaceEnvSpec(env);
+    else if (R_IsPackageEnv(env))
+	last = R_PackageEnvName(env);
+    else
+	last = R_NilValue;
+    PROTECT(last = isString(last) ? last :
+	    mkString(env == R_GlobalEnv ? "R_GlobalEnv" :
+		     type2char(TYPEOF(env))));
+
+    /* the frames are in reverse order, which is as good for a key */
+    PROTECT(val = allocVector(STRSXP, n + XLENGTH(last)));
+    R_xlen_t k = 0;
+    for (; frames != R_NilValue; frames = CDR(frames)) {
+	SEXP names = CAR(frames);
+	for (R_xlen_t i = 0; i < XLENGTH(names); i++)
+	    SET_STRING_ELT(val, k++, STRING_ELT(names, i));
+	SET_STRING_ELT(val, k++, R_BlankString);
+    }
+    for (R_xlen_t i = 0; i < XLENGTH(last); i++)
+	SET_STRING_ELT(val, k++, STRING_ELT(last, i));
+    UNPROTECT(3);
+    return val;
+}
+
+static int jitOptimizeLevel(void)
+{
+    int old_visible = R_Visible;
+    SEXP fcall, call;
+    PROTECT(fcall = lang3(R_TripleColonSymbol, install("compiler"),
+			  install("getCompilerOption")));
+    PROTECT(call = lang2(fcall, mkString("optimize")));
+    int val = asInteger(eval(call, R_GlobalEnv));
+    UNPROTECT(2);
+    R_Visible = old_visible;
+    return val;
+}
+
+/* Set 'path' to the cache file for 'body' and return TRUE, or return
+   FALSE if there is no cache directory. */
+static Rboolean jitCachePath(char *path, int kind, SEXP formals, SEXP body,
+			     SEXP rho)
+{
+    const char *dir = getenv("R_JIT_CACHE_DIR");
+    if (dir == NULL || dir[0] == '\0')
+	return FALSE;
+
+    SEXP key = PROTECT(allocVector(VECSXP, 5));
+    SET_VECTOR_ELT(key, 0, ScalarInteger(kind));
+    SET_VECTOR_ELT(key, 1, formals);
+    SET_VECTOR_ELT(key, 2, body);
+    SET_VECTOR_ELT(key, 3, rho);
+    SET_VECTOR_ELT(key, 4, ScalarInteger(jitOptimizeLevel()));
+
+    uint64_t h = 14695981039346656037ULL;
+    struct R_outpstream_st out;
+    R_InitOutPStream(&out, (R_pstream_data_t) &h, R_pstream_xdr_format, 2,
+		     jitHashChar, jitHashBytes, jitHashHook, R_NilValue);
+    R_Serialize(key, &out);
+    UNPROTECT(1);
+
+    snprintf(path, PATH_MAX, "%s/%016llx.Rbc", R_ExpandFileName(dir),
+	     (unsigned long long) h);
+    return TRUE;
+}
+
+typedef struct {
+    FILE *fp;
+    SEXP code;
+} jit_cache_io_t;
+
+static void jitCacheRead(void *data)
+{
+    jit_cache_io_t *io = data;
+    io->code = R_LoadFromFile(io->fp, 0);
+}
+
+static void jitCacheWrite(void *data)
+{
+    jit_cache_io_t *io = data;
+    R_SaveToFileV(io->code, io->fp, FALSE, 0);
+}
+
+/* The byte code for 'expr' cached in 'path', or R_NilValue.  Files
+   not written by jitCacheSave are skipped before R_LoadFromFile
+   complains, and code compiled from another expression, as after a
+   hash collision or from a foreign file, is a miss. */
+static SEXP jitCacheLoad(const char *path, SEXP expr)
+{
+    jit_cache_io_t io = { NULL, R_NilValue };
+    char magic[5];
+    if ((io.fp = R_fopen(path, "rb")) == NULL)
+	return R_NilValue;
+    if (fread(magic, 1, 5, io.fp) != 5 || strncmp(magic, "RDX2\n", 5)) {
+	fclose(io.fp);
+	return R_NilValue;
+    }
+    rewind(io.fp);
+    Rboolean ok = R_ToplevelExec(jitCacheRead, &io);
+    fclose(io.fp);
+    if (! ok || TYPEOF(io.code) != BCODESXP)
+	return R_NilValue;
+    PROTECT(io.code);
+    SEXP consts = BCODE_CONSTS(io.code);
+    ok = TYPEOF(consts) == VECSXP && LENGTH(consts) > 0 &&
+	R_compute_identical(VECTOR_ELT(consts, 0), expr, 0);
+    UNPROTECT(1);
+    return ok ? io.code : R_NilValue;
+}
+
+static void jitCacheSave(const char *path, SEXP code)
+{
+    char dir[PATH_MAX], *tmp;
+    strncpy(dir, path, PATH_MAX - 1);
+    dir[PATH_MAX - 1] = '\0';
+    char *slash = strrchr(dir, '/');
+    if (slash == NULL)
+	return;
+    *slash = '\0';
+
+    PROTECT(code);
+    tmp = R_tmpnam2("jit", dir, ".tmp");
+    jit_cache_io_t io = { R_fopen(tmp, "wb"), code };
+    if (io.fp != NULL) {
+	Rboolean ok = R_ToplevelExec(jitCacheWrite, &io);
+	fclose(io.fp);
+	if (! ok || rename(tmp, path) != 0)
+	    remove(tmp);
+    }
+    free(tmp);
+    UNPROTECT(1);
+}
+
 static Rboolean R_compileAndExecute(SEXP call, SEXP rho)
 {
     int old_enabled = R_jit_enabled;
     SEXP code;
     Rboolean ans = FALSE;
+    char path[PATH_MAX];
 
     R_jit_enabled = 0;
     PROTECT(call);
     PROTECT(rho);
-    PROTECT(code = R_compileExpr(call, rho));
+    Rboolean cache = jitCachePath(path, JIT_CACHE_LOOP, R_NilValue, call, rho);
+    code = cache ? jitCacheLoad(path, call) : R_NilValue;
+    if (code != R_NilValue)
+	jit_stats.cached++;
+    else {
+	code = R_compileExpr(call, rho);
+	if (cache && TYPEOF(code) == BCODESXP)
+	    jitCacheSave(path, code);
+    }
+    PROTECT(code);
     R_jit_enabled = old_enabled;
 
     if (TYPEOF(code) == BCODESXP) {
+	jit_stats.loops++;
 	bcEval(code, rho, TRUE);
 	ans = TRUE;
     }
@@ -895,11 +1526,138 @@ static Rboolean R_compileAndExecute(SEXP call, SEXP rho)
     return ans;
 }
 
+/* Closures are only compiled by the JIT once they are hot: each call
+   of a closure and each iteration of a loop it runs while interpreted
+   add one to its heat, and it is compiled at the call which brings
+   the heat to R_jit_threshold.  A threshold of one compiles closures
+   on first use.  The heat is kept in a direct-mapped table keyed by
+   the closure and its body, so closures sharing a slot just lose
+   their counts, and a closure allocated where a dead one with the
+   same body was continues its count.  After a failed compilation the
+   heat is set well below zero so it is retried only much later. */
+
+#define JIT_HEAT_SIZE 4096
+#define JIT_HEAT_MAX (INT_MAX / 2)
+#define JIT_FAILED_HEAT (-1000)
+
+typedef struct {
+    SEXP fun, body;
+    int heat;
+} jit_heat_t;
+
+static jit_heat_t jit_heat[JIT_HEAT_SIZE];
+
+static R_INLINE jit_heat_t *jitHeat(SEXP fun)
+{
+    jit_heat_t *h = jit_heat + ((uintptr_t) fun >> 4) % JIT_HEAT_SIZE;
+    if (h->fun != fun || h->body != BODY(fun)) {
+	h->fun = fun;
+	h->body = BODY(fun);
+	h->heat = 0;
+    }
+    return h;
+}
+
+/* Compile closure 'fun' in place if it has become hot.  The caller
+   has checked that it is not compiled yet. */
+void attribute_hidden R_jitClosure(SEXP fun)
+{
+    jit_heat_t *h = jitHeat(fun);
+    if (++h->heat < R_jit_threshold) {
+	jit_stats.deferred++;
+	return;
+    }
+
+    int old_enabled = R_jit_enabled;
+    SEXP newfun, code;
+    char path[PATH_MAX];
+    R_jit_enabled = 0;
+    PROTECT(fun);
+    Rboolean cache = jitCachePath(path, JIT_CACHE_CLOSURE, FORMALS(fun),
+				  BODY(fun), CLOENV(fun));
+    code = cache ? jitCacheLoad(path, BODY(fun)) : R_NilValue;
+    if (code != R_NilValue) {
+	R_jit_enabled = old_enabled;
+	SET_BODY(fun, code);
+	jit_stats.cached++;
+	UNPROTECT(1);
+	return;
+    }
+    newfun = R_cmpfun(fun);
+    R_jit_enabled = old_enabled;
+    if (TYPEOF(BODY(newfun)) == BCODESXP) {
+	PROTECT(newfun);
+	if (cache)
+	    jitCacheSave(path, BODY(newfun));
+	SET_BODY(fun, BODY(newfun));
+	jit_stats.compiled++;
+	UNPROTECT(1);
+    }
+    else {
+	jitHeat(fun)->heat = JIT_FAILED_HEAT;
+	jit_stats.failed++;
+    }
+    UNPROTECT(1);
+}
+
+/* The heat counter of the interpreted closure whose frame is 'rho',
+   for loops to add their iterations to, or NULL. */
+static jit_heat_t *jitLoopHeat(SEXP rho)
+{
+    if (R_jit_enabled <= 0 || R_jit_threshold <= 1)
+	return NULL;
+    for (RCNTXT *c = R_GlobalContext;
+	 c != NULL && c->callflag != CTXT_TOPLEVEL; c = c->nextcontext)
+	if ((c->callflag & CTXT_FUNCTION) && c->cloenv == rho) {
+	    SEXP fun = c->callfun;
+	    if (TYPEOF(fun) == CLOSXP && TYPEOF(BODY(fun)) != BCODESXP)
+		return jitHeat(fun);
+	    return NULL;
+	}
+    return NULL;
+}
+
+#define JIT_LOOP_ITERATION(h) do {				\
+	if ((h) != NULL && (h)->heat < JIT_HEAT_MAX) {		\
+	    (h)->heat++;					\
+	    jit_stats.iterations++;				\
+	}							\
+    } while (0)
+
+SEXP attribute_hidden do_jitstats(SEXP call, SEXP op, SEXP args, SEXP rho)
+{
+    checkArity(op, args);
+    int reset = asLogical(CAR(args));
+    const char *names[] = {"level", "threshold", "compiled", "failed",
+			   "deferred", "iterations", "loops", "kernels",
+			   "cached", ""};
+    SEXP ans = PROTECT(mkNamed(VECSXP, names));
+    SET_VECTOR_ELT(ans, 0, ScalarInteger(R_jit_enabled));
+    SET_VECTOR_ELT(ans, 1, ScalarInteger(R_jit_threshold));
+    SET_VECTOR_ELT(ans, 2, ScalarReal(jit_stats.compiled));
+    SET_VECTOR_ELT(ans, 3, ScalarReal(jit_stats.failed));
+    SET_VECTOR_ELT(ans, 4, ScalarReal(jit_stats.deferred));
+    SET_VECTOR_ELT(ans, 5, ScalarReal(jit_stats.iterations));
+    SET_VECTOR_ELT(ans, 6, ScalarReal(jit_stats.loops));
+    SET_VECTOR_ELT(ans, 7, ScalarReal(jit_stats.kernels));
+    SET_VECTOR_ELT(ans, 8, ScalarReal(jit_stats.cached));
+    if (reset == TRUE)
+	memset(&jit_stats, 0, sizeof(jit_stats));
+    UNPROTECT(1);
+    return ans;
+}
+
 SEXP attribute_hidden do_enablejit(SEXP call, SEXP op, SEXP args, SEXP rho)
 {
     int old = R_jit_enabled, new;
     checkArity(op, args);
     new = asInteger(CAR(args));
+    if (CADR(args) != R_NilValue) {
+	int threshold = asInteger(CADR(args));
+	if (threshold == NA_INTEGER || threshold < 1)
+	    error(_("invalid '%s' argument"), "threshold");
+	R_jit_threshold = threshold;
+    }
     if (new >= 0) {
 	if (new > 0)
 	    loadCompilerNamespace();
@@ -910,6 +1668,17 @@ SEXP attribute_hidden do_enablejit(SEXP call, SEXP op, SEXP args, SEXP rho)
     return ScalarInteger(old);
 }
 
+SEXP attribute_hidden do_enableloopkernels(SEXP call, SEXP op, SEXP args,
+					   SEXP rho)
+{
+    int old = R_loop_kernels, new;
+    checkArity(op, args);
+    new = asLogical(CAR(args));
+    if (new != NA_LOGICAL)
+	R_loop_kernels = new;
+    return ScalarLogical(old);
+}
+
 SEXP attribute_hidden do_compilepkgs(SEXP call, SEXP op, SEXP args, SEXP rho)
 {
     int old = R_compile_pkgs, new;
@@ -967,6 +1736,7 @@ SEXP applyClosure(SEXP call, SEXP op, SEXP arglist, SEXP rho, SEXP suppliedvars)
     volatile SEXP body, newrho;
     SEXP f, a, tmp, savesrc;
     RCNTXT cntxt;
+    int traced;
 
     /* formals = list of formal parameters */
     /* actuals = values to be bound to formals */
@@ -986,15 +1756,12 @@ SEXP applyClosure(SEXP call, SEXP op, SEXP arglist, SEXP rho, SEXP suppliedvars)
     savedrho = CLOENV(op);
 
     if (R_jit_enabled > 0 && TYPEOF(body) != BCODESXP) {
-	int old_enabled = R_jit_enabled;
-	SEXP newop;
-	R_jit_enabled = 0;
-	newop = R_cmpfun(op);
-	body = BODY(newop);
-	SET_BODY(op, body);
-	R_jit_enabled = old_enabled;
+	R_jitClosure(op);
+	body = BODY(op);
     }
 
+    traced = R_Trace_Profiling ? traceEnter(call, op) : -1;
+
     /*  Set up a context with the call in it so error has access to it */
 
     begincontext(&cntxt, CTXT_RETURN, call, savedrho, rho, arglist, op);
@@ -1004,7 +1771,7 @@ SEXP applyClosure(SEXP call, SEXP op, SEXP arglist, SEXP rho, SEXP suppliedvars)
 	contains the matched pairs.  Ideally this environment sould be
 	hashed.  */
 
-    PROTECT(actuals = matchArgs(formals, arglist, call));
+    PROTECT(actuals = matchArgsCached(formals, arglist, call));
     PROTECT(newrho = NewEnvironment(formals, actuals, savedrho));
 
     /* Turn on reference counting for the binding cells so local
@@ -1119,9 +1886,14 @@ SEXP applyClosure(SEXP call, SEXP op, SEXP arglist, SEXP rho, SEXP suppliedvars)
 #undef  HASHING
 
     /*  Set a longjmp target which will catch any explicit returns
-	from the function body.  */
+	from the function body, unless it is a leaf closure.  */
 
-    if ((SETJMP(cntxt.cjmpbuf))) {
+    if (RDEBUG(newrho) == 0 && TYPEOF(body) == BCODESXP &&
+	leafClosure(op)) {
+	cntxt.nojump = TRUE;
+	PROTECT(tmp = eval(body, newrho));
+    }
+    else if ((SETJMP(cntxt.cjmpbuf))) {
 	if (R_ReturnedValue == R_RestartToken) {
 	    cntxt.callflag = CTXT_RETURN;  /* turn restart off */
 	    R_ReturnedValue = R_NilValue;  /* remove restart token */
@@ -1141,6 +1913,7 @@ SEXP applyClosure(SEXP call, SEXP op, SEXP arglist, SEXP rho, SEXP suppliedvars)
 	Rprintf("exiting from: ");
 	PrintCall(call, rho);
     }
+    if (traced >= 0) traceExit(traced);
     UNPROTECT(4);
     return (tmp);
 }
@@ -1158,13 +1931,8 @@ static SEXP R_execClosure(SEXP call, SEXP op, SEXP arglist, SEXP rho,
     body = BODY(op);
 
     if (R_jit_enabled > 0 && TYPEOF(body) != BCODESXP) {
-	int old_enabled = R_jit_enabled;
-	SEXP newop;
-	R_jit_enabled = 0;
-	newop = R_cmpfun(op);
-	body = BODY(newop);
-	SET_BODY(op, body);
-	R_jit_enabled = old_enabled;
+	R_jitClosure(op);
+	body = BODY(op);
     }
 
     begincontext(&cntxt, CTXT_RETURN, call, newrho, rho, arglist, op);
@@ -1223,9 +1991,14 @@ static SEXP R_execClosure(SEXP call, SEXP op, SEXP arglist, SEXP rho,
 #undef  HASHING
 
     /*  Set a longjmp target which will catch any explicit returns
-	from the function body.  */
+	from the function body, unless it is a leaf closure.  */
 
-    if ((SETJMP(cntxt.cjmpbuf))) {
+    if (RDEBUG(newrho) == 0 && TYPEOF(body) == BCODESXP &&
+	leafClosure(op)) {
+	cntxt.nojump = TRUE;
+	PROTECT(tmp = eval(body, newrho));
+    }
+    else if ((SETJMP(cntxt.cjmpbuf))) {
 	if (R_ReturnedValue == R_RestartToken) {
 	    cntxt.callflag = CTXT_RETURN;  /* turn restart off */
 	    R_ReturnedValue = R_NilValue;  /* remove restart token */
@@ -1629,6 +2402,7 @@ SEXP attribute_hidden do_for(SEXP call, SEXP op, SEXP args, SEXP rho)
     INCREMENT_REFCNT(val);
 
     PROTECT_WITH_INDEX(v = R_NilValue, &vpi);
+    jit_heat_t *heat = jitLoopHeat(rho);
 
     begincontext(&cntxt, CTXT_LOOP, R_NilValue, rho, R_BaseEnv, R_NilValue,
 		 R_NilValue);
@@ -1637,6 +2411,7 @@ SEXP attribute_hidden do_for(SEXP call, SEXP op, SEXP args, SEXP rho)
     case CTXT_NEXT: goto for_next;
     }
     for (i = 0; i < n; i++) {
+	JIT_LOOP_ITERATION(heat);
 
 	switch (val_type) {
 
@@ -1724,11 +2499,13 @@ SEXP attribute_hidden do_while(SEXP call, SEXP op, SEXP args, SEXP rho)
 
     body = CADR(args);
     bgn = BodyHasBraces(body);
+    jit_heat_t *heat = jitLoopHeat(rho);
 
     begincontext(&cntxt, CTXT_LOOP, R_NilValue, rho, R_BaseEnv, R_NilValue,
 		 R_NilValue);
     if (SETJMP(cntxt.cjmpbuf) != CTXT_BREAK) {
 	while (asLogicalNoNA(eval(CAR(args), rho), call)) {
+	    JIT_LOOP_ITERATION(heat);
 	    if (RDEBUG(rho) && !bgn && !R_GlobalContext->browserfinish) {
 		SrcrefPrompt("debug", R_Srcref);
 		PrintValue(body);
@@ -1763,11 +2540,13 @@ SEXP attribute_hidden do_repeat(SEXP call, SEXP op, SEXP args, SEXP rho)
 	return R_NilValue;
 
     body = CAR(args);
+    jit_heat_t *heat = jitLoopHeat(rho);
 
     begincontext(&cntxt, CTXT_LOOP, R_NilValue, rho, R_BaseEnv, R_NilValue,
 		 R_NilValue);
     if (SETJMP(cntxt.cjmpbuf) != CTXT_BREAK) {
 	for (;;) {
+	    JIT_LOOP_ITERATION(heat);
 	    eval(body, rho);
 	}
     }
@@ -2359,24 +3138,476 @@ SEXP attribute_hidden evalListKeepMissing(SEXP el, SEXP rho)
 	    COPY_TAG(ev, el);
 	    tail = ev;
 	}
-	el = CDR(el);
+	el = CDR(el);
+    }
+
+    if (head!=R_NilValue)
+	UNPROTECT(1);
+
+    return head;
+}
+
+
+/* Promise elision.  A closure argument which is a symbol bound in the
+   caller's frame to a value, or to a forced promise, can be passed as
+   that value when this cannot be told from a promise.  That is the
+   case when the other arguments of the call are constants or local
+   variables with values, so forcing them cannot change the variable,
+   and the callee's compiled body and default arguments call only base
+   primitives, none of which look at promises or can assign in the
+   caller's frame before the argument would be forced.  (Calls from
+   byte code make their promises one at a time, without seeing the
+   other arguments, so always make them.)  The body must not use
+   'substitute', 'missing', '.Internal', '<<-', 'function' or '~', nor
+   assign with '$<-' or '[[<-', which work on environments.  Like
+   base function inlining by the compiler this assumes the base
+   functions are not masked, and as the compiler does, it takes calls
+   of a formal argument or of a variable assigned in the body to be
+   calls of that local variable.  The result of the check is kept in
+   the byte code object. */
+
+#define STRICT_ARGS_CHECKED_MASK (1 << 12)
+#define STRICT_ARGS_MASK (1 << 13)
+
+static SEXP strictRejectSyms[20];
+static int strictRejectCount = 0;
+static SEXP ReturnSym, IfSym, ForSym, WhileSym, RepeatSym;
+
+static Rboolean strictLocal(SEXP sym, SEXP locals)
+{
+    for (; locals != R_NilValue; locals = CDR(locals))
+	if (CAR(locals) == sym)
+	    return TRUE;
+    return FALSE;
+}
+
+/* The variable the call 'e' assigns by '<-', '=' or 'for', or
+   R_NilValue. */
+static SEXP assignedVar(SEXP e)
+{
+    SEXP fun = CAR(e), var = R_NilValue;
+    if (fun == asymSymbol[1] || fun == asymSymbol[3]) {
+	for (var = CADR(e); TYPEOF(var) == LANGSXP; var = CADR(var));
+	if (isString(var) && LENGTH(var) > 0)
+	    var = installTrChar(STRING_ELT(var, 0));
+    }
+    else if (fun == ForSym)
+	var = CADR(e);
+    return TYPEOF(var) == SYMSXP ? var : R_NilValue;
+}
+
+/* Add the variables assigned in 'e', by '<-', '=' or 'for', to the
+   list 'locals'. */
+static SEXP strictLocals(SEXP e, SEXP locals)
+{
+    if (TYPEOF(e) != LANGSXP)
+	return locals;
+    PROTECT_INDEX ipx;
+    PROTECT_WITH_INDEX(locals, &ipx);
+    SEXP var = assignedVar(e);
+    if (var != R_NilValue && ! strictLocal(var, locals))
+	REPROTECT(locals = CONS(var, locals), ipx);
+    for (SEXP a = CDR(e); a != R_NilValue; a = CDR(a))
+	REPROTECT(locals = strictLocals(CAR(a), locals), ipx);
+    UNPROTECT(1);
+    return locals;
+}
+
+static Rboolean strictPrimitive(SEXP fun, SEXP locals)
+{
+    if (TYPEOF(fun) != SYMSXP || strictLocal(fun, locals))
+	return FALSE;
+    SEXP def = SYMVALUE(fun);
+    if (TYPEOF(def) != BUILTINSXP && TYPEOF(def) != SPECIALSXP)
+	return FALSE;
+    for (int i = 0; i < strictRejectCount; i++)
+	if (fun == strictRejectSyms[i])
+	    return FALSE;
+    return TRUE;
+}
+
+static Rboolean strictExpr(SEXP e, SEXP locals)
+{
+    if (TYPEOF(e) != LANGSXP)
+	return TRUE;
+    SEXP fun = CAR(e);
+    if (! strictPrimitive(fun, locals))
+	return FALSE;
+    if ((fun == asymSymbol[1] || fun == asymSymbol[3]) &&
+	TYPEOF(CADR(e)) == LANGSXP)
+	/* the replacement functions of a complex assignment */
+	for (SEXP lhs = CADR(e); TYPEOF(lhs) == LANGSXP; lhs = CADR(lhs)) {
+	    SEXP f = CAR(lhs);
+	    if (TYPEOF(f) != SYMSXP || f == R_DollarSymbol ||
+		f == R_Bracket2Symbol)
+		return FALSE;
+	    char buf[128];
+	    snprintf(buf, 128, "%s<-", CHAR(PRINTNAME(f)));
+	    if (! strictPrimitive(install(buf), locals))
+		return FALSE;
+	}
+    for (SEXP a = CDR(e); a != R_NilValue; a = CDR(a))
+	if (! strictExpr(CAR(a), locals))
+	    return FALSE;
+    return TRUE;
+}
+
+/* Leaf closures.  A strict closure whose body only uses 'return'
+   directly in its statements, and whose byte code does not return by
+   a jump, cannot be the target of a jump from code it calls, except
+   from methods called by dispatch, which can evaluate 'return' in its
+   frame (e.g. by do.call(envir = parent.frame())).  So the body must
+   also not call a primitive which may dispatch, other than on values
+   which cannot be objects: constants, the results of arithmetic,
+   comparison and logic on such values and of seq_len(), and local
+   variables only ever assigned such values.  Such a closure is run
+   without setting a longjmp target for its context; R_jumpctxt
+   signals an error should a jump to it happen all the same. */
+
+#define LEAF_CLOSURE_MASK (1 << 14)
+
+static SEXP leafNoDispatchSyms[16], leafArithSyms[20], SeqLenSym;
+static int leafNoDispatchCount = 0, leafArithCount = 0;
+
+static Rboolean leafSymIn(SEXP sym, SEXP *syms, int n)
+{
+    for (int i = 0; i < n; i++)
+	if (sym == syms[i])
+	    return TRUE;
+    return FALSE;
+}
+
+/* Whether the value of 'e' cannot be an object, given the list
+   'nonobj' of local variables which cannot have objects as values. */
+static Rboolean nonObjectExpr(SEXP e, SEXP nonobj)
+{
+    switch (TYPEOF(e)) {
+    case NILSXP: case LGLSXP: case INTSXP: case REALSXP: case CPLXSXP:
+    case STRSXP: case RAWSXP:
+	return TRUE;
+    case SYMSXP:
+	return strictLocal(e, nonobj);
+    case LANGSXP:
+	if (CAR(e) == SeqLenSym)
+	    return TRUE;
+	if (! leafSymIn(CAR(e), leafArithSyms, leafArithCount))
+	    return FALSE;
+	for (SEXP a = CDR(e); a != R_NilValue; a = CDR(a))
+	    if (! nonObjectExpr(CAR(a), nonobj))
+		return FALSE;
+	return TRUE;
+    default:
+	return FALSE;
+    }
+}
+
+/* Whether the assignment 'e' cannot give its variable an object: the
+   value, and for x[i] <- v also the indices, cannot be objects, nor
+   can the variable itself. */
+static Rboolean nonObjectAssign(SEXP e, SEXP nonobj)
+{
+    if (CAR(e) == ForSym)
+	return nonObjectExpr(CADDR(e), nonobj);
+    if (! nonObjectExpr(CADDR(e), nonobj))
+	return FALSE;
+    for (SEXP lhs = CADR(e); TYPEOF(lhs) == LANGSXP; lhs = CADR(lhs)) {
+	if (CAR(lhs) != R_BracketSymbol && CAR(lhs) != R_Bracket2Symbol)
+	    return FALSE;
+	for (SEXP a = CDR(lhs); a != R_NilValue; a = CDR(a))
+	    if (! nonObjectExpr(CAR(a), nonobj))
+		return FALSE;
+    }
+    return TRUE;
+}
+
+/* Whether all assignments in 'e' to 'var' are as above. */
+static Rboolean nonObjectVar(SEXP e, SEXP var, SEXP nonobj)
+{
+    if (TYPEOF(e) != LANGSXP)
+	return TRUE;
+    if (assignedVar(e) == var && ! nonObjectAssign(e, nonobj))
+	return FALSE;
+    for (SEXP a = CDR(e); a != R_NilValue; a = CDR(a))
+	if (! nonObjectVar(CAR(a), var, nonobj))
+	    return FALSE;
+    return TRUE;
+}
+
+/* Whether 'e' refers to or assigns 'var'. */
+static Rboolean leafMentions(SEXP e, SEXP var)
+{
+    if (e == var)
+	return TRUE;
+    if (TYPEOF(e) != LANGSXP)
+	return FALSE;
+    if (assignedVar(e) == var)
+	return TRUE;
+    for (; e != R_NilValue; e = CDR(e))
+	if (leafMentions(CAR(e), var))
+	    return TRUE;
+    return FALSE;
+}
+
+/* Whether the first statement of the body 'expr' to mention 'var'
+   assigns it, so it is never looked up in the enclosing environments:
+   either 'var <- value' or a 'for' loop over 'var', which need not
+   assign it, so then no later statement may mention it. */
+static Rboolean leafAssignedFirst(SEXP expr, SEXP var)
+{
+    if (TYPEOF(expr) != LANGSXP || CAR(expr) != R_BraceSymbol)
+	return FALSE;
+    SEXP s = CDR(expr);
+    while (s != R_NilValue && ! leafMentions(CAR(s), var))
+	s = CDR(s);
+    if (s == R_NilValue || TYPEOF(CAR(s)) != LANGSXP)
+	return FALSE;
+    SEXP e = CAR(s);
+    if ((CAR(e) == asymSymbol[1] || CAR(e) == asymSymbol[3]) &&
+	CADR(e) == var)
+	return ! leafMentions(CADDR(e), var);
+    if (CAR(e) == ForSym && CADR(e) == var &&
+	! leafMentions(CADDR(e), var)) {
+	for (s = CDR(s); s != R_NilValue; s = CDR(s))
+	    if (leafMentions(CAR(s), var))
+		return FALSE;
+	return TRUE;
+    }
+    return FALSE;
+}
+
+/* The variables assigned in 'expr' which are not formals and cannot
+   have objects as values.  They must be assigned before they are
+   used, as above.  Starting from all of them, those with an
+   assignment which might give an object are dropped until none is. */
+static SEXP nonObjectLocals(SEXP expr, SEXP formals)
+{
+    SEXP nonobj, keep = R_NilValue;
+    PROTECT_INDEX ipx, kpx;
+    PROTECT_WITH_INDEX(nonobj = strictLocals(expr, R_NilValue), &ipx);
+    PROTECT_WITH_INDEX(keep, &kpx);
+    for (Rboolean changed = TRUE; changed; ) {
+	changed = FALSE;
+	REPROTECT(keep = R_NilValue, kpx);
+	for (SEXP v = nonobj; v != R_NilValue; v = CDR(v)) {
+	    SEXP var = CAR(v);
+	    Rboolean formal = FALSE;
+	    for (SEXP f = formals; f != R_NilValue; f = CDR(f))
+		if (TAG(f) == var)
+		    formal = TRUE;
+	    if (! formal && leafAssignedFirst(expr, var) &&
+		nonObjectVar(expr, var, nonobj))
+		REPROTECT(keep = CONS(var, keep), kpx);
+	    else
+		changed = TRUE;
+	}
+	REPROTECT(nonobj = keep, ipx);
+    }
+    UNPROTECT(2);
+    return nonobj;
+}
+
+/* Whether 'e' calls primitives which may dispatch only on values
+   which cannot be objects. */
+static Rboolean leafNoDispatch(SEXP e, SEXP nonobj)
+{
+    if (TYPEOF(e) != LANGSXP)
+	return TRUE;
+    SEXP fun = CAR(e), args = CDR(e);
+    if ((fun == asymSymbol[1] || fun == asymSymbol[3]) &&
+	TYPEOF(CADR(e)) == LANGSXP) {
+	/* x[i] <- v calls `[` and `[<-` on x */
+	if (! nonObjectAssign(e, nonobj))
+	    return FALSE;
+	for (SEXP lhs = CADR(e); TYPEOF(lhs) == LANGSXP; lhs = CADR(lhs))
+	    for (SEXP a = CDDR(lhs); a != R_NilValue; a = CDR(a))
+		if (! leafNoDispatch(CAR(a), nonobj))
+		    return FALSE;
+	return leafNoDispatch(CADDR(e), nonobj);
+    }
+    if (! leafSymIn(fun, leafNoDispatchSyms, leafNoDispatchCount))
+	for (SEXP a = args; a != R_NilValue; a = CDR(a))
+	    if (! nonObjectExpr(CAR(a), nonobj))
+		return FALSE;
+    for (SEXP a = args; a != R_NilValue; a = CDR(a))
+	if (! leafNoDispatch(CAR(a), nonobj))
+	    return FALSE;
+    return TRUE;
+}
+
+static Rboolean leafExpr(SEXP e, Rboolean stmt)
+{
+    if (TYPEOF(e) != LANGSXP)
+	return TRUE;
+    SEXP fun = CAR(e), args = CDR(e);
+    if (fun == ReturnSym)
+	return stmt && (args == R_NilValue || leafExpr(CAR(args), FALSE));
+    else if (fun == R_BraceSymbol) {
+	for (; args != R_NilValue; args = CDR(args))
+	    if (! leafExpr(CAR(args), stmt))
+		return FALSE;
+	return TRUE;
+    }
+    else if (fun == IfSym || fun == ForSym ||
+	     fun == WhileSym) {
+	/* the condition or sequence, and for 'for' the variable */
+	int n = fun == ForSym ? 2 : 1;
+	for (; n > 0 && args != R_NilValue; n--, args = CDR(args))
+	    if (! leafExpr(CAR(args), FALSE))
+		return FALSE;
+    }
+    else if (fun != RepeatSym)
+	stmt = FALSE;
+    for (; args != R_NilValue; args = CDR(args))
+	if (! leafExpr(CAR(args), stmt))
+	    return FALSE;
+    return TRUE;
+}
+
+static Rboolean bcReturnsByJump(SEXP body);
+
+static void checkClosureBody(SEXP formals, SEXP body)
+{
+    if (strictRejectCount == 0) {
+	const char *names[] = {
+	    "substitute", "missing", ".Internal", "<<-", "function",
+	    "~", "UseMethod", "standardGeneric", "forceAndCall",
+	    "browser", "on.exit", ".Call", ".External", ".External2",
+	    ".C", ".Fortran", ".Call.graphics", ".External.graphics",
+	    NULL };
+	for (int i = 0; names[i] != NULL; i++)
+	    strictRejectSyms[strictRejectCount++] = install(names[i]);
+	ReturnSym = install("return");
+	IfSym = install("if");
+	ForSym = install("for");
+	WhileSym = install("while");
+	RepeatSym = install("repeat");
+	SeqLenSym = install("seq_len");
+	const char *nodispatch[] = {
+	    "{", "(", "if", "for", "while", "repeat", "break", "next",
+	    "return", "<-", "=", "&&", "||", "seq_len", NULL };
+	for (int i = 0; nodispatch[i] != NULL; i++)
+	    leafNoDispatchSyms[leafNoDispatchCount++] =
+		install(nodispatch[i]);
+	const char *arith[] = {
+	    "+", "-", "*", "/", "^", "%%", "%/%", "==", "!=", "<", ">",
+	    "<=", ">=", "!", "&", "|", "(", NULL };
+	for (int i = 0; arith[i] != NULL; i++)
+	    leafArithSyms[leafArithCount++] = install(arith[i]);
+    }
+    int levels = LEVELS(body) | STRICT_ARGS_CHECKED_MASK;
+    SEXP expr = bytecodeExpr(body), locals = R_NilValue;
+    PROTECT_INDEX ipx;
+    PROTECT_WITH_INDEX(locals, &ipx);
+    for (SEXP f = formals; f != R_NilValue; f = CDR(f))
+	REPROTECT(locals = CONS(TAG(f), locals), ipx);
+    for (SEXP f = formals; f != R_NilValue; f = CDR(f))
+	REPROTECT(locals = strictLocals(CAR(f), locals), ipx);
+    REPROTECT(locals = strictLocals(expr, locals), ipx);
+    /* default arguments are evaluated in the frame too */
+    Rboolean strict = strictExpr(expr, locals), leaf = TRUE;
+    for (SEXP f = formals; strict && f != R_NilValue; f = CDR(f)) {
+	strict = strictExpr(CAR(f), locals);
+	leaf = leaf && leafExpr(CAR(f), FALSE);
+    }
+    if (strict) {
+	levels |= STRICT_ARGS_MASK;
+	if (leaf && leafExpr(expr, TRUE) && ! bcReturnsByJump(body)) {
+	    SEXP nonobj = PROTECT(nonObjectLocals(expr, formals));
+	    for (SEXP f = formals; leaf && f != R_NilValue; f = CDR(f))
+		leaf = leafNoDispatch(CAR(f), nonobj);
+	    if (leaf && leafNoDispatch(expr, nonobj))
+		levels |= LEAF_CLOSURE_MASK;
+	    UNPROTECT(1);
+	}
+    }
+    UNPROTECT(1);
+    SETLEVELS(body, levels);
+}
+
+/* Whether 'fun' is a closure its callers may pass values to in place
+   of promises for symbol arguments. */
+static R_INLINE Rboolean strictArgsClosure(SEXP fun)
+{
+    SEXP body = BODY(fun);
+    if (TYPEOF(body) != BCODESXP || RDEBUG(fun) || RTRACE(fun))
+	return FALSE;
+    if (! (LEVELS(body) & STRICT_ARGS_CHECKED_MASK))
+	checkClosureBody(FORMALS(fun), body);
+    return (LEVELS(body) & STRICT_ARGS_MASK) != 0;
+}
+
+/* Whether 'fun' is a leaf closure, as above. */
+static Rboolean leafClosure(SEXP fun)
+{
+    return strictArgsClosure(fun) &&
+	(LEVELS(BODY(fun)) & LEAF_CLOSURE_MASK) != 0;
+}
+
+/* The value 'sym' is bound to in the function frame 'rho', if it is
+   forced and not missing, or R_NilValue. */
+static SEXP localValue(SEXP sym, SEXP rho)
+{
+    if (sym == R_DotsSymbol || DDVAL(sym) || rho == R_GlobalEnv ||
+	rho == R_BaseEnv || rho == R_BaseNamespace)
+	return R_NilValue;
+    R_varloc_t loc = R_findVarLocInFrame(rho, sym);
+    if (R_VARLOC_IS_NULL(loc) || IS_ACTIVE_BINDING(loc.cell))
+	return R_NilValue;
+    SEXP value = CAR(loc.cell);
+    if (TYPEOF(value) == PROMSXP)
+	value = PRVALUE(value);
+    if (value == R_UnboundValue || value == R_MissingArg ||
+	TYPEOF(value) == PROMSXP || TYPEOF(value) == DOTSXP)
+	return R_NilValue;
+    return value;
+}
+
+/* As localValue, for passing in place of a promise, so shared. */
+static SEXP forcedLocalValue(SEXP sym, SEXP rho)
+{
+    SEXP value = localValue(sym, rho);
+    if (value != R_NilValue)
+	SET_NAMED(value, 2);
+    return value;
+}
+
+/* Whether evaluating the arguments 'el' of a call from 'rho' cannot
+   change any variable: the callee may force them in any order, so a
+   value can be passed for one only if the others are constants,
+   missing or local variables with values, not promises. */
+static Rboolean sideEffectFreeArgs(SEXP el, SEXP rho)
+{
+    for (; el != R_NilValue; el = CDR(el)) {
+	SEXP arg = CAR(el);
+	if (arg == R_MissingArg)
+	    continue;
+	else if (TYPEOF(arg) == SYMSXP) {
+	    if (localValue(arg, rho) == R_NilValue)
+		return FALSE;
+	}
+	else if (! isVectorAtomic(arg) && arg != R_NilValue)
+	    return FALSE;
     }
-
-    if (head!=R_NilValue)
-	UNPROTECT(1);
-
-    return head;
+    return TRUE;
 }
 
-
 /* Create a promise to evaluate each argument.	Although this is most */
 /* naturally attacked with a recursive algorithm, we use the iterative */
 /* form below because it is does not cause growth of the pointer */
 /* protection stack, and because it is a little more efficient. */
 
 SEXP attribute_hidden promiseArgs(SEXP el, SEXP rho)
+{
+    return promiseArgs1(el, rho, NULL);
+}
+
+/* As promiseArgs, but for a call of the closure 'fun', which takes
+   constants as they are, and values of symbols as above. */
+static SEXP promiseArgs1(SEXP el, SEXP rho, SEXP fun)
 {
     SEXP ans, h, tail;
+    Rboolean strict = fun != NULL && strictArgsClosure(fun) &&
+	sideEffectFreeArgs(el, rho);
 
     PROTECT(ans = tail = CONS(R_NilValue, R_NilValue));
 
@@ -2413,7 +3644,20 @@ SEXP attribute_hidden promiseArgs(SEXP el, SEXP rho)
 	    COPY_TAG(tail, el);
 	}
 	else {
-	    SETCDR(tail, CONS(mkPROMISE(CAR(el), rho), R_NilValue));
+	    SEXP arg = CAR(el), value = R_NilValue;
+	    if (fun != NULL) {
+		if (TYPEOF(arg) == SYMSXP) {
+		    if (strict)
+			value = forcedLocalValue(arg, rho);
+		}
+		else if (isVectorAtomic(arg)) {
+		    value = arg;
+		    MARK_NOT_MUTABLE(value);
+		}
+	    }
+	    if (value == R_NilValue)
+		value = mkPROMISE(arg, rho);
+	    SETCDR(tail, CONS(value, R_NilValue));
 	    tail = CDR(tail);
 	    COPY_TAG(tail, el);
 	}
@@ -3058,7 +4302,7 @@ int DispatchGroup(const char* group, SEXP call, SEXP op, SEXP args, SEXP rho,
 }
 
 /* start of bytecode section */
-static int R_bcVersion = 8;
+static int R_bcVersion = 9;
 static int R_bcMinVersion = 6;
 
 static SEXP R_AddSym = NULL;
@@ -3080,7 +4324,7 @@ static SEXP R_NotSym = NULL;
 static SEXP R_CSym = NULL;
 static SEXP R_LogSym = NULL;
 
-#if defined(__GNUC__) && ! defined(BC_PROFILING) && (! defined(NO_THREADED_CODE))
+#if defined(__GNUC__) && (! defined(NO_THREADED_CODE))
 # define THREADED_CODE
 #endif
 
@@ -3235,6 +4479,11 @@ enum {
   COLON_OP,
   SEQALONG_OP,
   SEQLEN_OP,
+  GETVAR_VECSUBSET_OP,
+  GETVAR_VECSUBSET2_OP,
+  VAR_VECSUBASSIGN_OP,
+  VAR_VECSUBASSIGN2_OP,
+  GETVAR_DOLLAR_OP,
   OPCOUNT
 };
 
@@ -3698,10 +4947,16 @@ static SEXP cmp_arith2(SEXP call, int opval, SEXP opsym, SEXP x, SEXP y,
     } while(0)
 #endif
 
+/* Logical scalars take part in arithmetic as integers; NA_LOGICAL is
+   NA_INTEGER, so the NA checks apply to them unchanged.  No box is
+   returned for a logical, so none is reused for the integer result. */
+#define LOGICAL_AS_INTEGER(type) ((type) == LGLSXP ? INTSXP : (type))
+
 #define FastUnary(op, opsym) do {					\
 	scalar_value_t vx;						\
 	SEXP sa = NULL;							\
 	int typex = bcStackScalarEx(R_BCNodeStackTop - 1, &vx, &sa);	\
+	typex = LOGICAL_AS_INTEGER(typex);				\
 	if (typex == REALSXP) {						\
 	    SKIP_OP();							\
 	    SETSTACK_REAL_EX(-1, op vx.dval, sa);			\
@@ -3715,6 +4970,39 @@ static SEXP cmp_arith2(SEXP call, int opval, SEXP opsym, SEXP x, SEXP y,
 	Arith1(opsym);							\
     } while (0)
 
+/* the element-wise logical operators on logical scalars, with the NA
+   rules of do_logic */
+#define FastNot() do {							\
+	scalar_value_t vx;						\
+	if (bcStackScalar(R_BCNodeStackTop - 1, &vx) == LGLSXP) {	\
+	    SKIP_OP();							\
+	    SETSTACK_LOGICAL(-1, vx.ival == NA_LOGICAL ?		\
+			     NA_LOGICAL : ! vx.ival);			\
+	    NEXT();							\
+	}								\
+	Builtin1(do_logic, R_NotSym, rho);				\
+    } while (0)
+
+#define R_AND(x, y) \
+    ((x) == FALSE || (y) == FALSE ? FALSE :			\
+     (x) == NA_LOGICAL || (y) == NA_LOGICAL ? NA_LOGICAL : TRUE)
+#define R_OR(x, y) \
+    ((x) == TRUE || (y) == TRUE ? TRUE :			\
+     (x) == NA_LOGICAL || (y) == NA_LOGICAL ? NA_LOGICAL : FALSE)
+
+#define FastLogic2(fun, opsym) do {					\
+	scalar_value_t vx;						\
+	scalar_value_t vy;						\
+	if (bcStackScalar(R_BCNodeStackTop - 2, &vx) == LGLSXP &&	\
+	    bcStackScalar(R_BCNodeStackTop - 1, &vy) == LGLSXP) {	\
+	    SKIP_OP();							\
+	    SETSTACK_LOGICAL(-2, fun(vx.ival, vy.ival));		\
+	    R_BCNodeStackTop--;						\
+	    NEXT();							\
+	}								\
+	Builtin2(do_logic, opsym, rho);					\
+    } while (0)
+
 # define FastBinary(op,opval,opsym) do { \
     scalar_value_t vx; \
     scalar_value_t vy; \
@@ -3722,6 +5010,8 @@ static SEXP cmp_arith2(SEXP call, int opval, SEXP opsym, SEXP x, SEXP y,
     SEXP sb = NULL; \
     int typex = bcStackScalarEx(R_BCNodeStackTop - 2, &vx, &sa);	\
     int typey = bcStackScalarEx(R_BCNodeStackTop - 1, &vy, &sb);	\
+    typex = LOGICAL_AS_INTEGER(typex); \
+    typey = LOGICAL_AS_INTEGER(typey); \
     if (typex == REALSXP) { \
 	if (typey == REALSXP) \
 	    DO_FAST_BINOP(op, vx.dval, vy.dval, sa ? sa : sb);	\
@@ -4089,7 +5379,9 @@ static struct { void *addr; int argc; } opinfo[OPCOUNT];
 #define LASTOP } value = R_NilValue; goto done
 #define INITIALIZE_MACHINE() if (body == NULL) goto init
 
-#define NEXT() (__extension__ ({goto *(*pc++).v;}))
+#define NEXT() (__extension__ ({ \
+  if (bc_opprof) bcProfStep(bcProfOpcode((*pc).v)); \
+  goto *(*pc++).v; }))
 #define GETOP() (*pc++).i
 #define SKIP_OP() (pc++)
 
@@ -4099,11 +5391,7 @@ typedef int BCODE;
 
 #define OP(name,argc) case name##_OP
 
-#ifdef BC_PROFILING
-#define BEGIN_MACHINE  loop: current_opcode = *pc; switch(*pc++)
-#else
-#define BEGIN_MACHINE  loop: switch(*pc++)
-#endif
+#define BEGIN_MACHINE  loop: if (bc_opprof) bcProfStep(*pc); switch(*pc++)
 #define LASTOP  default: error(_("bad opcode"))
 #define INITIALIZE_MACHINE()
 
@@ -4114,6 +5402,144 @@ typedef int BCODE;
 #define BCCODE(e) INTEGER(BCODE_CODE(e))
 #endif
 
+/* Opcode profiling, .Internal(bcprofstart(counters)).  When enabled,
+   each instruction dispatched is counted for its opcode and for the
+   function whose byte code is running, and optionally the hardware
+   counters read since the previous instruction are added to the
+   previous opcode and function.  This works with threaded code: the
+   opcode is found from the address of its label.  When disabled the
+   cost is a test of bc_opprof per instruction.  Reading the counters
+   is a system call per instruction, so the absolute numbers are
+   dominated by that: compare opcodes and functions with each other.
+
+   The functions are keyed as in Rprof(mode = "trace") by the symbol
+   of the call of the closure whose body is being run, or by
+   "<other>" for promises and top-level code.  Their entries are
+   appended to bcProfFuns, so their indices stay valid as the hash
+   table is grown.
+*/
+#define BCPROF_MAXCNT 4
+#define BCPROF_NCOL (1 + BCPROF_MAXCNT)
+
+static int bc_opprof = 0, bcProfNcnt = 0;
+static double bcProfOps[OPCOUNT][BCPROF_NCOL];
+static struct { SEXP key; double v[BCPROF_NCOL]; } *bcProfFuns;
+static int bcProfNfun, bcProfMaxfun, *bcProfHash, bcProfHashSize;
+static int bcProfOp = -1, bcProfFun = -1;
+
+#ifdef HAVE_LINUX_PERF_EVENT_H
+static int bcProfFd = -1;
+static uint64_t bcProfLast[BCPROF_MAXCNT];
+#endif
+
+#ifdef THREADED_CODE
+#define BCPROF_ADDRS 1024
+static struct { void *addr; int op; } bcProfAddrs[BCPROF_ADDRS];
+
+static int bcProfOpcode(void *addr)
+{
+    int k = (int) (((uintptr_t) addr >> 2) * 2654435761U) & (BCPROF_ADDRS - 1);
+    while (bcProfAddrs[k].addr != addr) {
+	if (bcProfAddrs[k].addr == NULL) return -1;
+	k = (k + 1) & (BCPROF_ADDRS - 1);
+    }
+    return bcProfAddrs[k].op;
+}
+#endif
+
+/* Add the counters read since the last instruction to it */
+static void bcProfCharge(void)
+{
+#ifdef HAVE_LINUX_PERF_EVENT_H
+    if (bcProfNcnt > 0) {
+	uint64_t buf[1 + BCPROF_MAXCNT];
+	if (read(bcProfFd, buf, sizeof(buf)) > 0)
+	    for (int i = 0; i < bcProfNcnt; i++) {
+		double d = (double) (buf[1 + i] - bcProfLast[i]);
+		bcProfLast[i] = buf[1 + i];
+		if (bcProfOp >= 0) bcProfOps[bcProfOp][1 + i] += d;
+		if (bcProfFun >= 0) bcProfFuns[bcProfFun].v[1 + i] += d;
+	    }
+    }
+#endif
+}
+
+static void bcProfStep(int op)
+{
+    bcProfCharge();
+    if (op < 0 || op >= OPCOUNT) op = -1;
+    else bcProfOps[op][0]++;
+    if (bcProfFun >= 0) bcProfFuns[bcProfFun].v[0]++;
+    bcProfOp = op;
+}
+
+static int bcProfFunction(SEXP rho)
+{
+    RCNTXT *cptr = R_GlobalContext;
+    SEXP key = install("<other>");
+    int k, i;
+
+    if (cptr && (cptr->callflag & CTXT_FUNCTION) && cptr->cloenv == rho &&
+	TYPEOF(cptr->call) == LANGSXP) {
+	key = CAR(cptr->call);
+	if (TYPEOF(key) != SYMSXP) {
+#ifdef R_PROFILING
+	    char itembuf[PROFITEMMAX];
+	    profItem(key, itembuf);
+	    key = install(itembuf);
+#else
+	    key = install("<Anonymous>");
+#endif
+	}
+    }
+    k = (int) (((uintptr_t) key >> 3) * 2654435761U) & (bcProfHashSize - 1);
+    for (; (i = bcProfHash[k]) >= 0; k = (k + 1) & (bcProfHashSize - 1))
+	if (bcProfFuns[i].key == key) return i;
+    if (bcProfNfun == bcProfMaxfun) {
+	void *new = realloc(bcProfFuns, 2 * bcProfMaxfun * sizeof(*bcProfFuns));
+	if (new == NULL) return -1;
+	bcProfFuns = new;
+	bcProfMaxfun *= 2;
+    }
+    i = bcProfNfun++;
+    memset(bcProfFuns + i, 0, sizeof(*bcProfFuns));
+    bcProfFuns[i].key = key;
+    bcProfHash[k] = i;
+    if (2 * bcProfNfun > bcProfHashSize) { /* grow the hash table */
+	int *new = (int *) malloc(2 * bcProfHashSize * sizeof(int));
+	if (new != NULL) {
+	    free(bcProfHash);
+	    bcProfHash = new;
+	    bcProfHashSize *= 2;
+	    for (k = 0; k < bcProfHashSize; k++) bcProfHash[k] = -1;
+	    for (int j = 0; j < bcProfNfun; j++) {
+		k = (int) (((uintptr_t) bcProfFuns[j].key >> 3) * 2654435761U)
+		    & (bcProfHashSize - 1);
+		while (bcProfHash[k] >= 0) k = (k + 1) & (bcProfHashSize - 1);
+		bcProfHash[k] = j;
+	    }
+	}
+    }
+    return i;
+}
+
+/* Called as bcEval starts and ends running 'rho' */
+static void bcProfEnter(SEXP rho, int *oldfun, int *oldop)
+{
+    bcProfCharge();
+    *oldfun = bcProfFun;
+    *oldop = bcProfOp;
+    bcProfOp = -1;
+    bcProfFun = bcProfFunction(rho);
+}
+
+static void bcProfLeave(int oldfun, int oldop)
+{
+    bcProfCharge();
+    bcProfFun = oldfun;
+    bcProfOp = oldop;
+}
+
 static R_INLINE SEXP BINDING_VALUE(SEXP loc)
 {
     if (loc != R_NilValue && ! IS_ACTIVE_BINDING(loc))
@@ -4182,10 +5608,27 @@ static R_INLINE SEXP BINDING_VALUE(SEXP loc)
 #  define CACHEIDX(i) (i)
 # endif
 
+/* With the cache on the stack each cache index also has a slot
+   recording a symbol's absence from an unhashed frame.  Bindings are
+   only added to such frames by consing them onto the front, so a
+   symbol not found in the frame is still not there as long as the
+   frame starts with the same cell.  The slot holds that first cell.
+   This saves searching the frame again for variables and functions
+   found in enclosing environments.  With a cache smaller than the
+   constant pool an index is shared by several symbols, so then the
+   slots are set to R_UnboundValue and not used. */
 # define CACHE_ON_STACK
 # ifdef CACHE_ON_STACK
 typedef R_bcstack_t * R_binding_cache_t;
-#  define VCACHE(i) GETSTACK_SXPVAL_PTR(vcache + (i))
+#  define VCACHE(i) GETSTACK_SXPVAL_PTR(vcache + 2 * (i))
+#  define NCACHE(i) GETSTACK_SXPVAL_PTR(vcache + 2 * (i) + 1)
+#  define NOT_IN_CACHED_FRAME(rho, vcache, sidx) \
+    (vcache && FRAME(rho) != R_NilValue && \
+     NCACHE(CACHEIDX(sidx)) == FRAME(rho))
+#  define SET_NOT_IN_CACHED_FRAME(rho, vcache, sidx) do { \
+	if (vcache && NCACHE(CACHEIDX(sidx)) != R_UnboundValue) \
+	    NCACHE(CACHEIDX(sidx)) = FRAME(rho); \
+    } while (0)
 #  define GET_CACHED_BINDING_CELL(vcache, sidx) \
     (vcache ? VCACHE(CACHEIDX(sidx)) : R_NilValue)
 #  define GET_SMALLCACHE_BINDING_CELL(vcache, sidx) \
@@ -4202,6 +5645,8 @@ typedef SEXP R_binding_cache_t;
 
 #  define SET_CACHED_BINDING(vcache, sidx, cell) \
     do { if (vcache) SET_VECTOR_ELT(vcache, CACHEIDX(sidx), cell); } while (0)
+#  define NOT_IN_CACHED_FRAME(rho, vcache, sidx) FALSE
+#  define SET_NOT_IN_CACHED_FRAME(rho, vcache, sidx) do { } while (0)
 # endif
 #else
 typedef void *R_binding_cache_t;
@@ -4209,6 +5654,8 @@ typedef void *R_binding_cache_t;
 # define GET_SMALLCACHE_BINDING_CELL(vcache, sidx) R_NilValue
 
 # define SET_CACHED_BINDING(vcache, sidx, cell)
+# define NOT_IN_CACHED_FRAME(rho, vcache, sidx) FALSE
+# define SET_NOT_IN_CACHED_FRAME(rho, vcache, sidx) do { } while (0)
 #endif
 
 static R_INLINE SEXP GET_BINDING_CELL_CACHE(SEXP symbol, SEXP rho,
@@ -4221,12 +5668,17 @@ static R_INLINE SEXP GET_BINDING_CELL_CACHE(SEXP symbol, SEXP rho,
        R_NilValue is not needed. */
     if (TAG(cell) == symbol && CAR(cell) != R_UnboundValue)
 	return cell;
+    else if (NOT_IN_CACHED_FRAME(rho, vcache, idx))
+	return R_NilValue;
     else {
 	SEXP ncell = GET_BINDING_CELL(symbol, rho);
 	if (ncell != R_NilValue)
 	    SET_CACHED_BINDING(vcache, idx, ncell);
-	else if (cell != R_NilValue && CAR(cell) == R_UnboundValue)
-	    SET_CACHED_BINDING(vcache, idx, R_NilValue);
+	else {
+	    if (cell != R_NilValue && CAR(cell) == R_UnboundValue)
+		SET_CACHED_BINDING(vcache, idx, R_NilValue);
+	    SET_NOT_IN_CACHED_FRAME(rho, vcache, idx);
+	}
 	return ncell;
     }
 }
@@ -4302,6 +5754,19 @@ static R_INLINE SEXP getvar(SEXP symbol, SEXP rho,
     return value;
 }
 
+/* Under TYPED_STACK GETVAR pushes the values of integer and double
+   for() loop variables unboxed, so the box only becomes shared, and a
+   new one is needed for the next iteration, if the body passes the
+   variable on as an object, for example as an argument to a closure. */
+#ifdef TYPED_STACK
+# define LOOP_VALUE_MASK (1 << 11)
+# define IS_LOOP_VALUE(x) ((x)->sxpinfo.gp & LOOP_VALUE_MASK)
+# define SET_LOOP_VALUE(x) ((x)->sxpinfo.gp |= LOOP_VALUE_MASK)
+#else
+# define IS_LOOP_VALUE(x) FALSE
+# define SET_LOOP_VALUE(x) do { } while (0)
+#endif
+
 #define INLINE_GETVAR
 #ifdef INLINE_GETVAR
 /* Try to handle the most common case as efficiently as possible.  If
@@ -4324,10 +5789,19 @@ static R_INLINE SEXP getvar(SEXP symbol, SEXP rho,
 	case REALSXP: \
 	case INTSXP: \
 	case LGLSXP: \
+	    R_Visible = TRUE; \
+	    if (IS_LOOP_VALUE(value) && type != LGLSXP && \
+		IS_SIMPLE_SCALAR(value, type)) { \
+		/* leave the loop variable unshared */ \
+		if (type == REALSXP) \
+		    BCNPUSH_REAL(REAL(value)[0]); \
+		else \
+		    BCNPUSH_INTEGER(INTEGER(value)[0]); \
+		NEXT(); \
+	    } \
 	    /* may be ok to skip this test: */ \
 	    if (NAMED(value) == 0) \
 		SET_NAMED(value, 1); \
-	    R_Visible = TRUE; \
 	    BCNPUSH(value); \
 	    NEXT(); \
 	} \
@@ -4584,11 +6058,6 @@ static int tryAssignDispatch(char *generic, SEXP call, SEXP lhs, SEXP rhs,
 } while (0)
 #define isNumericOnly(x) (isNumeric(x) && ! isLogical(x))
 
-#ifdef BC_PROFILING
-#define NO_CURRENT_OPCODE -1
-static int current_opcode = NO_CURRENT_OPCODE;
-static int opcode_counts[OPCOUNT];
-#endif
 
 #define BC_COUNT_DELTA 1000
 
@@ -4702,6 +6171,93 @@ static R_INLINE SEXP mkVector1(SEXP s)
      (TAG(ATTRIB(vec)) == R_DimSymbol &&	\
       CDR(ATTRIB(vec)) == R_NilValue))
 
+#if defined(TYPED_STACK) && defined(COMPACT_INTSEQ)
+/* Copy the contiguous range x[n1:n2] of a vector, where n1 and n2 are
+   both valid indices.  Used for subsetting with a compact integer
+   sequence so that the index vector is never allocated. */
+static void copyRangeSubset(SEXP ans, SEXP x, R_xlen_t n1, R_xlen_t n2)
+{
+    R_xlen_t n = XLENGTH(ans), i;
+    int step = n1 <= n2 ? 1 : -1;
+    switch (TYPEOF(x)) {
+    case REALSXP:
+	if (step == 1)
+	    memcpy(REAL(ans), REAL(x) + n1 - 1, n * sizeof(double));
+	else
+	    for (i = 0; i < n; i++) REAL(ans)[i] = REAL(x)[n1 - 1 - i];
+	break;
+    case INTSXP:
+	if (step == 1)
+	    memcpy(INTEGER(ans), INTEGER(x) + n1 - 1, n * sizeof(int));
+	else
+	    for (i = 0; i < n; i++) INTEGER(ans)[i] = INTEGER(x)[n1 - 1 - i];
+	break;
+    case LGLSXP:
+	if (step == 1)
+	    memcpy(LOGICAL(ans), LOGICAL(x) + n1 - 1, n * sizeof(int));
+	else
+	    for (i = 0; i < n; i++) LOGICAL(ans)[i] = LOGICAL(x)[n1 - 1 - i];
+	break;
+    case CPLXSXP:
+	for (i = 0; i < n; i++)
+	    COMPLEX(ans)[i] = COMPLEX(x)[n1 - 1 + step * i];
+	break;
+    case RAWSXP:
+	for (i = 0; i < n; i++)
+	    RAW(ans)[i] = RAW(x)[n1 - 1 + step * i];
+	break;
+    case STRSXP:
+	for (i = 0; i < n; i++)
+	    SET_STRING_ELT(ans, i, STRING_ELT(x, n1 - 1 + step * i));
+	break;
+    }
+}
+
+/* x[n1:n2] for a compact integer sequence index on the stack: handled
+   here for atomic vectors with no attributes other than names or the
+   dim of a matrix or array when the whole range is within the vector; anything else returns
+   FALSE and the sequence is materialized as usual. */
+static R_INLINE Rboolean VECSUBSET_INTSEQ(R_bcstack_t *sv, SEXP vec,
+					  R_bcstack_t *si)
+{
+    if (si->tag != INTSEQSXP)
+	return FALSE;
+    switch (TYPEOF(vec)) {
+    case REALSXP: case INTSXP: case LGLSXP: case CPLXSXP:
+    case RAWSXP: case STRSXP: break;
+    default: return FALSE;
+    }
+    SEXP names = R_NilValue, attr = ATTRIB(vec);
+    if (attr != R_NilValue) {
+	if (CDR(attr) != R_NilValue)
+	    return FALSE;
+	if (TAG(attr) == R_NamesSymbol) {
+	    names = CAR(attr);
+	    if (TYPEOF(names) != STRSXP || XLENGTH(names) != XLENGTH(vec))
+		return FALSE;
+	}
+	else if (TAG(attr) != R_DimSymbol || LENGTH(CAR(attr)) < 2)
+	    return FALSE; /* 1-d arrays keep their dim */
+    }
+    int *seqinfo = INTEGER(si->u.sxpval);
+    R_xlen_t n1 = seqinfo[0], n2 = seqinfo[1], nx = XLENGTH(vec);
+    if (n1 < 1 || n2 < 1 || n1 > nx || n2 > nx)
+	return FALSE;
+    R_xlen_t n = (n1 <= n2 ? n2 - n1 : n1 - n2) + 1;
+    SEXP ans = PROTECT(allocVector(TYPEOF(vec), n));
+    copyRangeSubset(ans, vec, n1, n2);
+    if (names != R_NilValue) {
+	SEXP nn = PROTECT(allocVector(STRSXP, n));
+	copyRangeSubset(nn, names, n1, n2);
+	setAttrib(ans, R_NamesSymbol, nn);
+	UNPROTECT(1); /* nn */
+    }
+    UNPROTECT(1); /* ans */
+    SETSTACK_PTR(sv, ans);
+    return TRUE;
+}
+#endif
+
 static R_INLINE void VECSUBSET_PTR(R_bcstack_t *sx, R_bcstack_t *si,
 				   R_bcstack_t *sv, SEXP rho,
 				   SEXP consts, int callidx,
@@ -4709,6 +6265,10 @@ static R_INLINE void VECSUBSET_PTR(R_bcstack_t *sx, R_bcstack_t *si,
 {
     SEXP idx, args, value;
     SEXP vec = GETSTACK_PTR(sx);
+#if defined(TYPED_STACK) && defined(COMPACT_INTSEQ)
+    if (! subset2 && VECSUBSET_INTSEQ(sv, vec, si))
+	return;
+#endif
     R_xlen_t i = bcStackIndex(si) - 1;
 
     if (i >= 0 && (subset2 || FAST_VECELT_OK(vec)))
@@ -4934,7 +6494,7 @@ static R_INLINE void VECSUBASSIGN_PTR(R_bcstack_t *sx, R_bcstack_t *srhs,
     SEXP vec = GETSTACK_PTR(sx);
 
     if (MAYBE_SHARED(vec)) {
-	vec = duplicate(vec);
+	vec = shallow_duplicate(vec);
 	SETSTACK_PTR(sx, vec);
     }
     else if (NAMED(vec) == 1)
@@ -4969,6 +6529,120 @@ static R_INLINE void VECSUBASSIGN_PTR(R_bcstack_t *sx, R_bcstack_t *srhs,
 	R_BCNodeStackTop -= 2;						\
     } while (0)
 
+/* Superinstructions for x[i], x[[i]], x[i] <- v, x[[i]] <- v and
+   x$name, where x and an index that is not a constant are local
+   variables.  The compiler emits them in front of the ordinary
+   instruction sequence, and they jump past it if they can do the
+   operation on a plain vector.  Otherwise they change nothing, not
+   even by forcing promises, and the ordinary sequence does the work,
+   including signaling any errors. */
+
+static R_INLINE SEXP FUSED_GETVAR(SEXP symbol, SEXP rho,
+				  R_binding_cache_t vcache, int sidx)
+{
+    SEXP cell = GET_BINDING_CELL_CACHE(symbol, rho, vcache, sidx);
+    if (cell == R_NilValue || IS_ACTIVE_BINDING(cell))
+	return NULL;
+    SEXP value = CAR(cell);
+    if (TYPEOF(value) == PROMSXP) {
+	value = PRVALUE(value);
+	if (value == R_UnboundValue)
+	    return NULL;
+	SET_NAMED(value, 2);
+    }
+    else if (TYPEOF(value) == SYMSXP) /* R_UnboundValue, R_MissingArg */
+	return NULL;
+    else if (NAMED(value) == 0 && value != R_NilValue)
+	SET_NAMED(value, 1);
+    return value;
+}
+
+/* the zero-based index, or -1 */
+static R_INLINE R_xlen_t FUSED_INDEX(SEXP consts, int iidx, SEXP rho,
+				     R_binding_cache_t vcache)
+{
+    SEXP idx = VECTOR_ELT(consts, iidx);
+    if (TYPEOF(idx) == SYMSXP) {
+	SEXP cell = GET_BINDING_CELL_CACHE(idx, rho, vcache, iidx);
+	if (cell == R_NilValue || IS_ACTIVE_BINDING(cell))
+	    return -1;
+	idx = CAR(cell);
+	if (TYPEOF(idx) == PROMSXP)
+	    idx = PRVALUE(idx);
+    }
+    R_bcstack_t si;
+    SETSTACK_PTR(&si, idx);
+    return bcStackIndex(&si) - 1;
+}
+
+static R_INLINE void FAST_VECELT_PTR(R_bcstack_t *sv, SEXP vec, R_xlen_t i,
+				     Rboolean subset2, Rboolean *done)
+{
+    *done = TRUE;
+    DO_FAST_VECELT(sv, vec, i, subset2);
+    *done = FALSE;
+}
+
+static R_INLINE Rboolean FUSED_VECSUBSET(SEXP consts, int xidx, int iidx,
+					 SEXP rho, R_binding_cache_t vcache,
+					 Rboolean subset2)
+{
+    SEXP x = FUSED_GETVAR(VECTOR_ELT(consts, xidx), rho, vcache, xidx);
+    if (x == NULL || OBJECT(x) || ! (subset2 || FAST_VECELT_OK(x)))
+	return FALSE;
+    R_xlen_t i = FUSED_INDEX(consts, iidx, rho, vcache);
+    if (i < 0)
+	return FALSE;
+    Rboolean done;
+    BCNSTACKCHECK(1);
+    FAST_VECELT_PTR(R_BCNodeStackTop, x, i, subset2, &done);
+    if (done)
+	R_BCNodeStackTop++;
+    return done;
+}
+
+/* the right hand side value is on the stack and stays there as the
+   value of the assignment */
+static R_INLINE Rboolean FUSED_VECSUBASSIGN(SEXP consts, int xidx, int iidx,
+					    SEXP rho, R_binding_cache_t vcache)
+{
+    SEXP cell = GET_BINDING_CELL_CACHE(VECTOR_ELT(consts, xidx), rho,
+				       vcache, xidx);
+    if (cell == R_NilValue || BINDING_IS_LOCKED(cell) ||
+	IS_ACTIVE_BINDING(cell))
+	return FALSE;
+    /* values STARTASSIGN would have to make local are left to it */
+    SEXP x = CAR(cell);
+#ifdef SWITCH_TO_REFCNT
+    if (REFCNT(x) != 1 || OBJECT(x))
+#else
+    if (NAMED(x) != 1 || OBJECT(x))
+#endif
+	return FALSE;
+    R_xlen_t i = FUSED_INDEX(consts, iidx, rho, vcache);
+    scalar_value_t v;
+    int typev = bcStackScalar(R_BCNodeStackTop - 1, &v);
+    return setElementFromScalar(x, i, typev, &v);
+}
+
+#define DO_FUSED_VECSUBSET(sub2) do {					\
+	int xidx = GETOP();						\
+	int iidx = GETOP();						\
+	int label = GETOP();						\
+	if (FUSED_VECSUBSET(constants, xidx, iidx, rho, vcache, sub2)) { \
+	    R_Visible = TRUE;						\
+	    pc = codebase + label;					\
+	}								\
+    } while (0)
+
+#define DO_FUSED_VECSUBASSIGN() do {					\
+	int xidx = GETOP();						\
+	int iidx = GETOP();						\
+	int label = GETOP();						\
+	if (FUSED_VECSUBASSIGN(constants, xidx, iidx, rho, vcache))	\
+	    pc = codebase + label;					\
+    } while (0)
+
 static R_INLINE void MATSUBASSIGN_PTR(R_bcstack_t *sx, R_bcstack_t *srhs,
 				      R_bcstack_t *si, R_bcstack_t *sj,
 				      R_bcstack_t *sv,
@@ -4979,7 +6653,7 @@ static R_INLINE void MATSUBASSIGN_PTR(R_bcstack_t *sx, R_bcstack_t *srhs,
     SEXP mat = GETSTACK_PTR(sx);
 
     if (MAYBE_SHARED(mat)) {
-	mat = duplicate(mat);
+	mat = shallow_duplicate(mat);
 	SETSTACK_PTR(sx, mat);
     }
     else if (NAMED(mat) == 1)
@@ -5036,7 +6710,7 @@ static R_INLINE void SUBASSIGN_N_PTR(R_bcstack_t *sx, int rank,
     SEXP x = GETSTACK_PTR(sx);
 
     if (MAYBE_SHARED(x)) {
-	x = duplicate(x);
+	x = shallow_duplicate(x);
 	SETSTACK_PTR(sx, x);
     }
     else if (NAMED(x) == 1)
@@ -5133,6 +6807,7 @@ static R_INLINE void checkForMissings(SEXP args, SEXP call)
 	(var) = allocVector(TYPEOF(seq), 1);		\
 	SETSTACK(pos, var);				\
 	SET_NAMED(var, 1);				\
+	SET_LOOP_VALUE(var);				\
     }							\
 } while (0)
 
@@ -5158,6 +6833,39 @@ static R_INLINE Rboolean GETSTACK_LOGICAL_NO_NA_PTR(R_bcstack_t *s, int callidx,
     }
 }
 
+#ifdef TYPED_STACK
+/* Superassignment of an immediate value, as SETVAR does it for local
+   variables: if the variable is found in an enclosing function frame
+   holding an unshared simple scalar of the same type, the value is
+   copied into it rather than boxed.  The search gives up at the
+   global environment and at classed environments (which may be user
+   databases), leaving those to setVar. */
+static R_INLINE Rboolean SETVAR2_IMMEDIATE(SEXP symbol, SEXP rho,
+					   R_bcstack_t *s)
+{
+    for (; rho != R_GlobalEnv && rho != R_EmptyEnv &&
+	     rho != R_BaseEnv && rho != R_BaseNamespace &&
+	     ! OBJECT(rho); rho = ENCLOS(rho)) {
+	R_varloc_t loc = R_findVarLocInFrame(rho, symbol);
+	if (R_VARLOC_IS_NULL(loc))
+	    continue;
+	SEXP cell = loc.cell;
+	if (BINDING_IS_LOCKED(cell) || IS_ACTIVE_BINDING(cell))
+	    return FALSE;
+	SEXP x = CAR(cell);
+	if (NOT_SHARED(x) && IS_SIMPLE_SCALAR(x, s->tag)) {
+	    switch (s->tag) {
+	    case REALSXP: REAL(x)[0] = s->u.dval; return TRUE;
+	    case INTSXP: INTEGER(x)[0] = s->u.ival; return TRUE;
+	    case LGLSXP: LOGICAL(x)[0] = s->u.ival; return TRUE;
+	    }
+	}
+	return FALSE;
+    }
+    return FALSE;
+}
+#endif
+
 static SEXP bcEval(SEXP body, SEXP rho, Rboolean useCache)
 {
   SEXP value = R_NilValue, constants;
@@ -5167,8 +6875,10 @@ static SEXP bcEval(SEXP body, SEXP rho, Rboolean useCache)
 #ifdef BC_INT_STACK
   IStackval *olditop = R_BCIntStackTop;
 #endif
-#ifdef BC_PROFILING
-  int old_current_opcode = current_opcode;
+  int old_prof_fun = -1, old_prof_op = -1;
+#if defined(R_MEMORY_PROFILING) || defined(R_PROFILING)
+  void *oldbcpc = R_BCpc;
+  SEXP oldbcbody = R_BCbody;
 #endif
 #ifdef THREADED_CODE
   int which = 0;
@@ -5202,6 +6912,12 @@ static SEXP bcEval(SEXP body, SEXP rho, Rboolean useCache)
       }
   }
 
+#if defined(R_MEMORY_PROFILING) || defined(R_PROFILING)
+  R_BCpc = &pc;
+  R_BCbody = body;
+#endif
+  if (bc_opprof) bcProfEnter(rho, &old_prof_fun, &old_prof_op);
+
   R_binding_cache_t vcache = NULL;
   Rboolean smallcache = TRUE;
 #ifdef USE_BINDING_CACHE
@@ -5216,11 +6932,12 @@ static SEXP bcEval(SEXP body, SEXP rho, Rboolean useCache)
 # ifdef CACHE_ON_STACK
       /* initialize binding cache on the stack */
       vcache = R_BCNodeStackTop;
-      if (R_BCNodeStackTop + n > R_BCNodeStackEnd)
+      if (R_BCNodeStackTop + 2 * n > R_BCNodeStackEnd)
 	  nodeStackOverflow();
       while (n > 0) {
 	  SETSTACK(0, R_NilValue);
-	  R_BCNodeStackTop++;
+	  SETSTACK(1, smallcache ? R_NilValue : R_UnboundValue);
+	  R_BCNodeStackTop += 2;
 	  n--;
       }
 # else
@@ -5271,7 +6988,8 @@ static SEXP bcEval(SEXP body, SEXP rho, Rboolean useCache)
 	Rboolean iscompact = FALSE;
 	SEXP seq = getForLoopSeq(-1, &iscompact);
 	int callidx = GETOP();
-	SEXP symbol = VECTOR_ELT(constants, GETOP());
+	int sidx = GETOP();
+	SEXP symbol = VECTOR_ELT(constants, sidx);
 	int label = GETOP();
 
 	/* if we are iterating over a factor, coerce to character first */
@@ -5281,7 +6999,8 @@ static SEXP bcEval(SEXP body, SEXP rho, Rboolean useCache)
 	}
 
 	defineVar(symbol, R_NilValue, rho);
-	BCNPUSH(GET_BINDING_CELL(symbol, rho));
+	/* caching the cell lets GETVAR find the loop value directly */
+	BCNPUSH(GET_BINDING_CELL_CACHE(symbol, rho, vcache, sidx));
 
 	value = allocVector(INTSXP, 2);
 	INTEGER(value)[0] = -1;
@@ -5315,11 +7034,39 @@ static SEXP bcEval(SEXP body, SEXP rho, Rboolean useCache)
 	case RAWSXP:
 	    value = allocVector(TYPEOF(seq), 1);
 	    SET_NAMED(value, 1);
+	    SET_LOOP_VALUE(value);
 	    BCNPUSH(value);
 	    break;
 	default: BCNPUSH(R_NilValue);
 	}
 
+	/* run as much of the loop as possible as a kernel; STEPFOR does
+	   the rest, if any, in the usual way */
+	if (R_loop_kernels && TYPEOF(seq) == INTSXP) {
+	    int *loopinfo = INTEGER(GETSTACK_SXPVAL(-2));
+	    int done = R_RunLoopKernel(VECTOR_ELT(constants, callidx), rho,
+				       seq, iscompact, loopinfo[1]);
+	    if (done > 0) {
+		SEXP cell = GETSTACK(-3);
+		int i = done - 1;
+		loopinfo[0] = i;
+		value = GETSTACK(-1);
+#ifdef COMPACT_INTSEQ
+		if (iscompact) {
+		    int n1 = INTEGER(seq)[0];
+		    int n2 = INTEGER(seq)[1];
+		    INTEGER(value)[0] = n1 <= n2 ? n1 + i : n1 - i;
+		}
+		else
+#endif
+		INTEGER(value)[0] = INTEGER(seq)[i];
+		if (CAR(cell) == R_UnboundValue ||
+		    ! SET_BINDING_VALUE(cell, value))
+		    defineVar(BINDING_SYMBOL(cell), value, rho);
+		jit_stats.kernels++;
+	    }
+	}
+
 	BC_CHECK_SIGINT();
 	pc = codebase + label;
 	NEXT();
@@ -5417,10 +7164,10 @@ static SEXP bcEval(SEXP body, SEXP rho, Rboolean useCache)
     OP(SETVAR, 1):
       {
 	int sidx = GETOP();
-	SEXP loc;
-	if (smallcache)
-	    loc = GET_SMALLCACHE_BINDING_CELL(vcache, sidx);
-	else {
+	SEXP loc = smallcache ?
+	    GET_SMALLCACHE_BINDING_CELL(vcache, sidx) : R_NilValue;
+	if (loc == R_NilValue) {
+	    /* not cached, or not yet, as for new variables */
 	    SEXP symbol = VECTOR_ELT(constants, sidx);
 	    loc = GET_BINDING_CELL_CACHE(symbol, rho, vcache, sidx);
 	}
@@ -5458,8 +7205,20 @@ static SEXP bcEval(SEXP body, SEXP rho, Rboolean useCache)
     OP(GETFUN, 1):
       {
 	/* get the function */
-	SEXP symbol = VECTOR_ELT(constants, GETOP());
-	value = findFun(symbol, rho);
+	int sidx = GETOP();
+	SEXP symbol = VECTOR_ELT(constants, sidx);
+	SEXP cell = vcache != NULL && FRAME(rho) != R_NilValue ?
+	    GET_BINDING_CELL_CACHE(symbol, rho, vcache, sidx) : rho;
+	value = cell != R_NilValue && cell != rho && !IS_ACTIVE_BINDING(cell) ?
+	    CAR(cell) : R_NilValue;
+	switch (TYPEOF(value)) {
+	case CLOSXP:
+	case BUILTINSXP:
+	case SPECIALSXP: break;
+	default:
+	    /* skip this frame if the symbol is known not to be in it */
+	    value = findFun(symbol, cell == R_NilValue ? ENCLOS(rho) : rho);
+	}
 	if(RTRACE(value)) {
 	  Rprintf("trace: ");
 	  PrintValue(symbol);
@@ -5601,13 +7360,15 @@ static SEXP bcEval(SEXP body, SEXP rho, Rboolean useCache)
 	SEXP fun = CALL_FRAME_FUN();
 	SEXP call = VECTOR_ELT(constants, GETOP());
 	SEXP args = CALL_FRAME_ARGS();
-	int flag;
+	int flag, traced;
 	switch (TYPEOF(fun)) {
 	case BUILTINSXP:
 	  checkForMissings(args, call);
 	  flag = PRIMPRINT(fun);
 	  R_Visible = flag != 1;
+	  traced = R_Trace_Profiling ? traceEnter(call, fun) : -1;
 	  value = PRIMFUN(fun) (call, fun, args, rho);
+	  if (traced >= 0) traceExit(traced);
 	  if (flag < 2) R_Visible = flag != 1;
 	  break;
 	case SPECIALSXP:
@@ -5629,12 +7390,13 @@ static SEXP bcEval(SEXP body, SEXP rho, Rboolean useCache)
 	SEXP fun = CALL_FRAME_FUN();
 	SEXP call = VECTOR_ELT(constants, GETOP());
 	SEXP args = CALL_FRAME_ARGS();
-	int flag;
+	int flag, traced;
 	const void *vmax = vmaxget();
 	if (TYPEOF(fun) != BUILTINSXP)
 	  error(_("not a BUILTIN function"));
 	flag = PRIMPRINT(fun);
 	R_Visible = flag != 1;
+	traced = R_Trace_Profiling ? traceEnter(call, fun) : -1;
 	if (R_Profiling && IS_TRUE_BUILTIN(fun)) {
 	    RCNTXT cntxt;
 	    SEXP oldref = R_Srcref;
@@ -5647,6 +7409,7 @@ static SEXP bcEval(SEXP body, SEXP rho, Rboolean useCache)
 	} else {
 	    value = PRIMFUN(fun) (call, fun, args, rho);
 	}
+	if (traced >= 0) traceExit(traced);
 	if (flag < 2) R_Visible = flag != 1;
 	vmaxset(vmax);
 	POP_CALL_FRAME(value);
@@ -5695,9 +7458,9 @@ static SEXP bcEval(SEXP body, SEXP rho, Rboolean useCache)
     OP(LE, 1): FastRelop2(<=, LEOP, R_LeSym);
     OP(GE, 1): FastRelop2(>=, GEOP, R_GeSym);
     OP(GT, 1): FastRelop2(>, GTOP, R_GtSym);
-    OP(AND, 1): Builtin2(do_logic, R_AndSym, rho);
-    OP(OR, 1): Builtin2(do_logic, R_OrSym, rho);
-    OP(NOT, 1): Builtin1(do_logic, R_NotSym, rho);
+    OP(AND, 1): FastLogic2(R_AND, R_AndSym);
+    OP(OR, 1): FastLogic2(R_OR, R_OrSym);
+    OP(NOT, 1): FastNot();
     OP(DOTSERR, 0): error(_("'...' used in an incorrect context"));
     OP(STARTASSIGN, 1):
       {
@@ -5874,6 +7637,11 @@ static SEXP bcEval(SEXP body, SEXP rho, Rboolean useCache)
     OP(SETVAR2, 1):
       {
 	SEXP symbol = VECTOR_ELT(constants, GETOP());
+#ifdef TYPED_STACK
+	R_bcstack_t *s = R_BCNodeStackTop - 1;
+	if (s->tag && SETVAR2_IMMEDIATE(symbol, ENCLOS(rho), s))
+	    NEXT();
+#endif
 	value = GETSTACK(-1);
 	if (MAYBE_REFERENCED(value)) {
 	    value = duplicate(value);
@@ -6123,6 +7891,24 @@ static SEXP bcEval(SEXP body, SEXP rho, Rboolean useCache)
     OP(COLON, 1): DO_COLON(); NEXT();
     OP(SEQALONG, 1): DO_SEQ_ALONG(); NEXT();
     OP(SEQLEN, 1): DO_SEQ_LEN(); NEXT();
+    OP(GETVAR_VECSUBSET, 3): DO_FUSED_VECSUBSET(FALSE); NEXT();
+    OP(GETVAR_VECSUBSET2, 3): DO_FUSED_VECSUBSET(TRUE); NEXT();
+    /* [<- and [[<- are the same for atomic vectors and scalar values */
+    OP(VAR_VECSUBASSIGN, 3): DO_FUSED_VECSUBASSIGN(); NEXT();
+    OP(VAR_VECSUBASSIGN2, 3): DO_FUSED_VECSUBASSIGN(); NEXT();
+    OP(GETVAR_DOLLAR, 3):
+      {
+	int xidx = GETOP();
+	SEXP symbol = VECTOR_ELT(constants, GETOP());
+	int label = GETOP();
+	SEXP x = FUSED_GETVAR(VECTOR_ELT(constants, xidx), rho, vcache, xidx);
+	if (x != NULL && ! isObject(x)) {
+	    R_Visible = TRUE;
+	    BCNPUSH(R_subset3_dflt(x, PRINTNAME(symbol), R_NilValue));
+	    pc = codebase + label;
+	}
+	NEXT();
+      }
     LASTOP;
   }
 
@@ -6131,12 +7917,25 @@ static SEXP bcEval(SEXP body, SEXP rho, Rboolean useCache)
 #ifdef BC_INT_STACK
   R_BCIntStackTop = olditop;
 #endif
-#ifdef BC_PROFILING
-  current_opcode = old_current_opcode;
+  if (bc_opprof) bcProfLeave(old_prof_fun, old_prof_op);
+#if defined(R_MEMORY_PROFILING) || defined(R_PROFILING)
+  R_BCpc = oldbcpc;
+  R_BCbody = oldbcbody;
 #endif
   return value;
 }
 
+#if defined(R_MEMORY_PROFILING) || defined(R_PROFILING)
+/* The offset of the instruction being executed in 'body', or -1 if
+   'body' is not the byte code being run by the innermost bcEval. */
+int attribute_hidden R_BCCurrentPC(SEXP body)
+{
+    if (R_BCpc == NULL || body != R_BCbody)
+	return -1;
+    return (int) (*((BCODE **) R_BCpc) - BCCODE(body));
+}
+#endif
+
 #ifdef THREADED_CODE
 SEXP R_bcEncode(SEXP bytes)
 {
@@ -6216,9 +8015,27 @@ SEXP R_bcDecode(SEXP code) {
 
     return bytes;
 }
+
+/* Whether the code of closure body 'body' has a RETURNJMP instruction. */
+static Rboolean bcReturnsByJump(SEXP body)
+{
+    SEXP code = BCODE_CODE(body);
+    int m = (sizeof(BCODE) + sizeof(int) - 1) / sizeof(int);
+    int n = LENGTH(code) / m;
+    BCODE *pc = (BCODE *) INTEGER(code);
+
+    for (int i = 1; i < n;) {
+	int op = findOp(pc[i].v);
+	if (op == RETURNJMP_OP)
+	    return TRUE;
+	i += opinfo[op].argc + 1;
+    }
+    return FALSE;
+}
 #else
 SEXP R_bcEncode(SEXP x) { return x; }
 SEXP R_bcDecode(SEXP x) { return duplicate(x); }
+static Rboolean bcReturnsByJump(SEXP body) { return TRUE; }
 #endif
 
 SEXP attribute_hidden do_mkcode(SEXP call, SEXP op, SEXP args, SEXP rho)
@@ -6483,100 +8300,154 @@ SEXP attribute_hidden do_getconst(SEXP call, SEXP op, SEXP args, SEXP env)
     return ans;
 }
 
-#ifdef BC_PROFILING
+/* A list of a matrix with a row per opcode and one per function, and
+   the names of the functions.  The columns are the instruction count
+   and the counters. */
 SEXP do_bcprofcounts(SEXP call, SEXP op, SEXP args, SEXP env)
 {
-    SEXP val;
-    int i;
+    SEXP ans, ops, funs, names;
+    int ncol = 1 + bcProfNcnt;
 
     checkArity(op, args);
-    val = allocVector(INTSXP, OPCOUNT);
-    for (i = 0; i < OPCOUNT; i++)
-	INTEGER(val)[i] = opcode_counts[i];
-    return val;
+    PROTECT(ans = allocVector(VECSXP, 3));
+    ops = allocMatrix(REALSXP, OPCOUNT, ncol);
+    SET_VECTOR_ELT(ans, 0, ops);
+    for (int i = 0; i < OPCOUNT; i++)
+	for (int j = 0; j < ncol; j++)
+	    REAL(ops)[i + j * OPCOUNT] = bcProfOps[i][j];
+    funs = allocMatrix(REALSXP, bcProfNfun, ncol);
+    SET_VECTOR_ELT(ans, 1, funs);
+    names = allocVector(STRSXP, bcProfNfun);
+    SET_VECTOR_ELT(ans, 2, names);
+    for (int i = 0; i < bcProfNfun; i++) {
+	SET_STRING_ELT(names, i, PRINTNAME(bcProfFuns[i].key));
+	for (int j = 0; j < ncol; j++)
+	    REAL(funs)[i + j * bcProfNfun] = bcProfFuns[i].v[j];
+    }
+    UNPROTECT(1);
+    return ans;
 }
 
-static void dobcprof(int sig)
+static void bcProfFree(void)
 {
-    if (current_opcode >= 0 && current_opcode < OPCOUNT)
-	opcode_counts[current_opcode]++;
-    signal(SIGPROF, dobcprof);
+    free(bcProfFuns); free(bcProfHash);
+    bcProfFuns = NULL; bcProfHash = NULL;
+    bcProfNfun = 0;
+#ifdef HAVE_LINUX_PERF_EVENT_H
+    if (bcProfFd >= 0) close(bcProfFd); /* closes the group */
+    bcProfFd = -1;
+#endif
+}
+
+#ifdef HAVE_LINUX_PERF_EVENT_H
+static const struct { const char *name; int type; long long config; }
+bcProfEvents[] = {
+    {"cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+    {"instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+    {"cache.misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+    {"branch.misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+    {NULL, 0, 0}
+};
+
+/* Open the counters as a group read at once */
+static int bcProfOpenCounters(SEXP counters)
+{
+    int n = LENGTH(counters), leader = -1;
+    for (int i = 0; i < n; i++) {
+	const char *nm = CHAR(STRING_ELT(counters, i));
+	struct perf_event_attr pe;
+	int e, fd;
+	for (e = 0; bcProfEvents[e].name; e++)
+	    if (!strcmp(nm, bcProfEvents[e].name)) break;
+	if (!bcProfEvents[e].name) {
+	    if (leader >= 0) close(leader);
+	    error(_("unknown counter '%s'"), nm);
+	}
+	memset(&pe, 0, sizeof(pe));
+	pe.size = sizeof(pe);
+	pe.type = bcProfEvents[e].type;
+	pe.config = bcProfEvents[e].config;
+	pe.disabled = leader < 0;
+	pe.exclude_kernel = 1;
+	pe.exclude_hv = 1;
+	pe.read_format = PERF_FORMAT_GROUP;
+	fd = (int) syscall(__NR_perf_event_open, &pe, 0, -1, leader, 0);
+	if (fd < 0) {
+	    if (leader >= 0) close(leader);
+	    error(_("cannot open counter '%s': %s"), nm, strerror(errno));
+	}
+	if (leader < 0) leader = fd;
+    }
+    if (leader >= 0) {
+	ioctl(leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+	ioctl(leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    }
+    return leader;
 }
+#endif
 
 SEXP do_bcprofstart(SEXP call, SEXP op, SEXP args, SEXP env)
 {
-    struct itimerval itv;
-    int interval;
-    double dinterval = 0.02;
-    int i;
+    SEXP counters = CAR(args);
 
     checkArity(op, args);
-    if (R_Profiling)
-	error(_("profile timer in use"));
-    if (bc_profiling)
+    if (bc_opprof)
 	error(_("already byte code profiling"));
+    if (!isString(counters) || LENGTH(counters) > BCPROF_MAXCNT)
+	error(_("invalid '%s' argument"), "counters");
+    bcProfFree();
+#ifdef HAVE_LINUX_PERF_EVENT_H
+    if (LENGTH(counters) > 0) {
+	bcProfFd = bcProfOpenCounters(counters);
+	uint64_t buf[1 + BCPROF_MAXCNT];
+	if (read(bcProfFd, buf, sizeof(buf)) > 0)
+	    for (int i = 0; i < LENGTH(counters); i++)
+		bcProfLast[i] = buf[1 + i];
+    }
+#else
+    if (LENGTH(counters) > 0)
+	error(_("hardware counters are not available on this platform"));
+#endif
+    bcProfNcnt = LENGTH(counters);
 
-    /* according to man setitimer, it waits until the next clock
-       tick, usually 10ms, so avoid too small intervals here */
-    interval = 1e6 * dinterval + 0.5;
-
-    /* initialize the profile data */
-    current_opcode = NO_CURRENT_OPCODE;
-    for (i = 0; i < OPCOUNT; i++)
-	opcode_counts[i] = 0;
-
-    signal(SIGPROF, dobcprof);
-
-    itv.it_interval.tv_sec = 0;
-    itv.it_interval.tv_usec = interval;
-    itv.it_value.tv_sec = 0;
-    itv.it_value.tv_usec = interval;
-    if (setitimer(ITIMER_PROF, &itv, NULL) == -1)
-	error(_("setting profile timer failed"));
-
-    bc_profiling = TRUE;
-
+#ifdef THREADED_CODE
+    memset(bcProfAddrs, 0, sizeof(bcProfAddrs));
+    for (int i = 0; i < OPCOUNT; i++) {
+	int k = (int) (((uintptr_t) opinfo[i].addr >> 2) * 2654435761U)
+	    & (BCPROF_ADDRS - 1);
+	while (bcProfAddrs[k].addr != NULL) k = (k + 1) & (BCPROF_ADDRS - 1);
+	bcProfAddrs[k].addr = opinfo[i].addr;
+	bcProfAddrs[k].op = i;
+    }
+#endif
+    memset(bcProfOps, 0, sizeof(bcProfOps));
+    bcProfMaxfun = bcProfHashSize = 64;
+    bcProfFuns = malloc(bcProfMaxfun * sizeof(*bcProfFuns));
+    bcProfHash = (int *) malloc(bcProfHashSize * sizeof(int));
+    if (bcProfFuns == NULL || bcProfHash == NULL) {
+	bcProfFree();
+	error(_("cannot allocate the tables for byte code profiling"));
+    }
+    for (int k = 0; k < bcProfHashSize; k++) bcProfHash[k] = -1;
+    bcProfNfun = 0;
+    bcProfOp = bcProfFun = -1;
+    bc_opprof = 1;
     return R_NilValue;
 }
 
-static void dobcprof_null(int sig)
-{
-    signal(SIGPROF, dobcprof_null);
-}
-
 SEXP do_bcprofstop(SEXP call, SEXP op, SEXP args, SEXP env)
 {
-    struct itimerval itv;
-
     checkArity(op, args);
-    if (! bc_profiling)
+    if (! bc_opprof)
 	error(_("not byte code profiling"));
-
-    itv.it_interval.tv_sec = 0;
-    itv.it_interval.tv_usec = 0;
-    itv.it_value.tv_sec = 0;
-    itv.it_value.tv_usec = 0;
-    setitimer(ITIMER_PROF, &itv, NULL);
-    signal(SIGPROF, dobcprof_null);
-
-    bc_profiling = FALSE;
-
+    bcProfCharge();
+    bc_opprof = 0;
+#ifdef HAVE_LINUX_PERF_EVENT_H
+    if (bcProfFd >= 0) close(bcProfFd);
+    bcProfFd = -1;
+#endif
     return R_NilValue;
 }
-#else
-SEXP NORET do_bcprofcounts(SEXP call, SEXP op, SEXP args, SEXP env) {
-    checkArity(op, args);
-    error(_("byte code profiling is not supported in this build"));
-}
-SEXP NORET do_bcprofstart(SEXP call, SEXP op, SEXP args, SEXP env) {
-    checkArity(op, args);
-    error(_("byte code profiling is not supported in this build"));
-}
-SEXP NORET do_bcprofstop(SEXP call, SEXP op, SEXP args, SEXP env) {
-    checkArity(op, args);
-    error(_("byte code profiling is not supported in this build"));
-}
-#endif
 
 /* end of byte code section */
 
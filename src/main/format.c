@@ -221,6 +221,18 @@ scientific(double *x, int *sgn, int *kpower, int *nsig, int *roundingwidens)
 	    *roundingwidens = 0;
             return;
         }
+	/* Whole numbers with at most R_print.digits digits (counts,
+	   identifiers, ...) need no scaling or rounding: read the
+	   exponent and significant digits off the integer. */
+	if (r < tbl[R_print.digits + 1] && r == floor(r)) {
+	    long long v = (long long) r;
+	    for (kp = 0; v % 10 == 0; v /= 10) kp++;
+	    for (j = 0; v; v /= 10) j++;
+	    *kpower = kp + j - 1;
+	    *nsig = j;
+	    *roundingwidens = 0;
+	    return;
+	}
         kp = (int) floor(log10(r)) - R_print.digits + 1;/* r = |x|; 10^(kp + digits - 1) <= r */
 #if defined(HAVE_LONG_DOUBLE) && (SIZEOF_LONG_DOUBLE > SIZEOF_DOUBLE)
         long double r_prec = r;
@@ -67,7 +67,7 @@
 /*
  *  R : A Computer Langage for Statistical Data Analysis
  *  Copyright (C) 1995, 1996, 1997  Robert Gentleman and Ross Ihaka
- *  Copyright (C) 1997--2015  The R Core Team
+ *  Copyright (C) 1997--2017  The R Core Team
  *  Copyright (C) 2009--2011  Romain Francois
  *
  *  This program is free software; you can redistribute it and/or modify
@@ -3522,6 +3522,7 @@ void R_InitSrcRefState(void)
     } else
         ParseState.prevState = NULL;
     ParseState.keepSrcRefs = FALSE;
+    ParseState.keepParseData = TRUE;
     ParseState.didAttach = FALSE;
     PROTECT_WITH_INDEX(ParseState.SrcFile = R_NilValue, &(ParseState.SrcFileProt));
     PROTECT_WITH_INDEX(ParseState.Original = R_NilValue, &(ParseState.OriginalProt));
@@ -3575,6 +3576,7 @@ void R_FinalizeSrcRefState(void)
 static void UseSrcRefState(SrcRefState *state)
 {
     ParseState.keepSrcRefs = state->keepSrcRefs;
+    ParseState.keepParseData = state->keepParseData;
     ParseState.SrcFile = state->SrcFile;
     ParseState.Original = state->Original;
     ParseState.SrcFileProt = state->SrcFileProt;
@@ -3595,6 +3597,7 @@ static void PutSrcRefState(SrcRefState *state)
 {
     if (state) {
 	state->keepSrcRefs = ParseState.keepSrcRefs;
+	state->keepParseData = ParseState.keepParseData;
 	state->SrcFile = ParseState.SrcFile;
 	state->Original = ParseState.Original;
 	state->SrcFileProt = ParseState.SrcFileProt;
@@ -3710,6 +3713,8 @@ SEXP R_Parse1Buffer(IoBuffer *buffer, int gencode, ParseStatus *status)
     	keepSource = asLogical(GetOption1(install("keep.source")));
     	if (keepSource) {
     	    ParseState.keepSrcRefs = TRUE;
+	    ParseState.keepParseData =
+		asLogical(GetOption1(install("keep.parse.data")));
     	    REPROTECT(ParseState.SrcFile = NewEnvironment(R_NilValue, R_NilValue, R_EmptyEnv), ParseState.SrcFileProt);
 	    REPROTECT(ParseState.Original = ParseState.SrcFile, ParseState.OriginalProt);
 	    PROTECT_WITH_INDEX(SrcRefs = R_NilValue, &srindex);
@@ -3771,6 +3776,8 @@ static SEXP R_Parse(int n, ParseStatus *status, SEXP srcfile)
     
     if (isEnvironment(ParseState.SrcFile)) {
     	ParseState.keepSrcRefs = TRUE;
+	ParseState.keepParseData =
+	    asLogical(GetOption1(install("keep.parse.data")));
 	PROTECT_WITH_INDEX(SrcRefs = R_NilValue, &srindex);
     }
     
@@ -3787,7 +3794,7 @@ static SEXP R_Parse(int n, ParseStatus *status, SEXP srcfile)
 	    break;
 	case PARSE_INCOMPLETE:
 	case PARSE_ERROR:
-	    if (ParseState.keepSrcRefs) 
+	    if (ParseState.keepSrcRefs && ParseState.keepParseData)
 	        finalizeData();
 	    R_PPStackTop = savestack;
 	    R_FinalizeSrcRefState();	    
@@ -3806,7 +3813,8 @@ finish:
     for (n = 0 ; n < LENGTH(rval) ; n++, t = CDR(t))
 	SET_VECTOR_ELT(rval, n, CAR(t));
     if (ParseState.keepSrcRefs) {
-	finalizeData();
+	if (ParseState.keepParseData)
+	    finalizeData();
 	rval = attachSrcrefs(rval);
     }
     R_PPStackTop = savestack;    /* UNPROTECT lots! */
@@ -3903,6 +3911,8 @@ SEXP R_ParseBuffer(IoBuffer *buffer, int n, ParseStatus *status, SEXP prompt,
     
     if (isEnvironment(ParseState.SrcFile)) {
     	ParseState.keepSrcRefs = TRUE;
+	ParseState.keepParseData =
+	    asLogical(GetOption1(install("keep.parse.data")));
 	PROTECT_WITH_INDEX(SrcRefs = R_NilValue, &srindex);
     }
     
@@ -3952,7 +3962,8 @@ finish:
     for (n = 0 ; n < LENGTH(rval) ; n++, t = CDR(t))
 	SET_VECTOR_ELT(rval, n, CAR(t));
     if (ParseState.keepSrcRefs) {
-	finalizeData();
+	if (ParseState.keepParseData)
+	    finalizeData();
 	rval = attachSrcrefs(rval);
     }
     R_PPStackTop = savestack; /* UNPROTECT lots! */
@@ -5389,7 +5400,8 @@ static int yylex(void)
 		xxparsesave = yylloc.first_parsed;
 		SavedLval = yylval;
 		setlastloc();
-		if (yytext[0]) /* unrecord the pushed back token if not null */
+		/* unrecord the pushed back token if not null */
+		if (yytext[0] && ParseState.keepSrcRefs && ParseState.keepParseData)
 		    ParseState.data_count--;
 		return '\n';
 	    }
@@ -5545,7 +5557,8 @@ static void record_( int first_parsed, int first_column, int last_parsed, int la
 		colon = 0 ;
 	}
 	
-	if (!ParseState.keepSrcRefs || id == NA_INTEGER) return;
+	if (!ParseState.keepSrcRefs || !ParseState.keepParseData
+	    || id == NA_INTEGER) return;
 	
 	// don't care about zero sized things
 	if( !yytext[0] ) return ;
@@ -5584,6 +5597,9 @@ static void record_( int first_parsed, int first_column, int last_parsed, int la
  */
 static void recordParents( int parent, yyltype * childs, int nchilds){
 	
+	if (!ParseState.keepSrcRefs || !ParseState.keepParseData)
+	    return;
+
 	if( parent > ID_COUNT ){
 		growID(parent) ;
 	}
@@ -5615,7 +5631,8 @@ static void modif_token( yyltype* loc, int tok ){
 	
 	int id = loc->id ;
 	
-	if (!ParseState.keepSrcRefs || id < 0 || id > ID_COUNT) 
+	if (!ParseState.keepSrcRefs || !ParseState.keepParseData
+	    || id < 0 || id > ID_COUNT) 
 	    return;
 	    
 	if( tok == SYMBOL_FUNCTION_CALL ){
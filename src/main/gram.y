@@ -2,7 +2,7 @@
 /*
  *  R : A Computer Langage for Statistical Data Analysis
  *  Copyright (C) 1995, 1996, 1997  Robert Gentleman and Ross Ihaka
- *  Copyright (C) 1997--2015  The R Core Team
+ *  Copyright (C) 1997--2017  The R Core Team
  *  Copyright (C) 2009--2011  Romain Francois
  *
  *  This program is free software; you can redistribute it and/or modify
@@ -1184,6 +1184,7 @@ void R_InitSrcRefState(void)
     } else
         ParseState.prevState = NULL;
     ParseState.keepSrcRefs = FALSE;
+    ParseState.keepParseData = TRUE;
     ParseState.didAttach = FALSE;
     PROTECT_WITH_INDEX(ParseState.SrcFile = R_NilValue, &(ParseState.SrcFileProt));
     PROTECT_WITH_INDEX(ParseState.Original = R_NilValue, &(ParseState.OriginalProt));
@@ -1237,6 +1238,7 @@ void R_FinalizeSrcRefState(void)
 static void UseSrcRefState(SrcRefState *state)
 {
     ParseState.keepSrcRefs = state->keepSrcRefs;
+    ParseState.keepParseData = state->keepParseData;
     ParseState.SrcFile = state->SrcFile;
     ParseState.Original = state->Original;
     ParseState.SrcFileProt = state->SrcFileProt;
@@ -1257,6 +1259,7 @@ static void PutSrcRefState(SrcRefState *state)
 {
     if (state) {
 	state->keepSrcRefs = ParseState.keepSrcRefs;
+	state->keepParseData = ParseState.keepParseData;
 	state->SrcFile = ParseState.SrcFile;
 	state->Original = ParseState.Original;
 	state->SrcFileProt = ParseState.SrcFileProt;
@@ -1372,6 +1375,8 @@ SEXP R_Parse1Buffer(IoBuffer *buffer, int gencode, ParseStatus *status)
     	keepSource = asLogical(GetOption1(install("keep.source")));
     	if (keepSource) {
     	    ParseState.keepSrcRefs = TRUE;
+	    ParseState.keepParseData =
+		asLogical(GetOption1(install("keep.parse.data")));
     	    REPROTECT(ParseState.SrcFile = NewEnvironment(R_NilValue, R_NilValue, R_EmptyEnv), ParseState.SrcFileProt);
 	    REPROTECT(ParseState.Original = ParseState.SrcFile, ParseState.OriginalProt);
 	    PROTECT_WITH_INDEX(SrcRefs = R_NilValue, &srindex);
@@ -1433,6 +1438,8 @@ static SEXP R_Parse(int n, ParseStatus *status, SEXP srcfile)
     
     if (isEnvironment(ParseState.SrcFile)) {
     	ParseState.keepSrcRefs = TRUE;
+	ParseState.keepParseData =
+	    asLogical(GetOption1(install("keep.parse.data")));
 	PROTECT_WITH_INDEX(SrcRefs = R_NilValue, &srindex);
     }
     
@@ -1449,7 +1456,7 @@ static SEXP R_Parse(int n, ParseStatus *status, SEXP srcfile)
 	    break;
 	case PARSE_INCOMPLETE:
 	case PARSE_ERROR:
-	    if (ParseState.keepSrcRefs) 
+	    if (ParseState.keepSrcRefs && ParseState.keepParseData)
 	        finalizeData();
 	    R_PPStackTop = savestack;
 	    R_FinalizeSrcRefState();	    
@@ -1468,7 +1475,8 @@ finish:
     for (n = 0 ; n < LENGTH(rval) ; n++, t = CDR(t))
 	SET_VECTOR_ELT(rval, n, CAR(t));
     if (ParseState.keepSrcRefs) {
-	finalizeData();
+	if (ParseState.keepParseData)
+	    finalizeData();
 	rval = attachSrcrefs(rval);
     }
     R_PPStackTop = savestack;    /* UNPROTECT lots! */
@@ -1565,6 +1573,8 @@ SEXP R_ParseBuffer(IoBuffer *buffer, int n, ParseStatus *status, SEXP prompt,
     
     if (isEnvironment(ParseState.SrcFile)) {
     	ParseState.keepSrcRefs = TRUE;
+	ParseState.keepParseData =
+	    asLogical(GetOption1(install("keep.parse.data")));
 	PROTECT_WITH_INDEX(SrcRefs = R_NilValue, &srindex);
     }
     
@@ -1614,7 +1624,8 @@ finish:
     for (n = 0 ; n < LENGTH(rval) ; n++, t = CDR(t))
 	SET_VECTOR_ELT(rval, n, CAR(t));
     if (ParseState.keepSrcRefs) {
-	finalizeData();
+	if (ParseState.keepParseData)
+	    finalizeData();
 	rval = attachSrcrefs(rval);
     }
     R_PPStackTop = savestack; /* UNPROTECT lots! */
@@ -3051,7 +3062,8 @@ static int yylex(void)
 		xxparsesave = yylloc.first_parsed;
 		SavedLval = yylval;
 		setlastloc();
-		if (yytext[0]) /* unrecord the pushed back token if not null */
+		/* unrecord the pushed back token if not null */
+		if (yytext[0] && ParseState.keepSrcRefs && ParseState.keepParseData)
 		    ParseState.data_count--;
 		return '\n';
 	    }
@@ -3207,7 +3219,8 @@ static void record_( int first_parsed, int first_column, int last_parsed, int la
 		colon = 0 ;
 	}
 	
-	if (!ParseState.keepSrcRefs || id == NA_INTEGER) return;
+	if (!ParseState.keepSrcRefs || !ParseState.keepParseData
+	    || id == NA_INTEGER) return;
 	
 	// don't care about zero sized things
 	if( !yytext[0] ) return ;
@@ -3246,6 +3259,9 @@ static void record_( int first_parsed, int first_column, int last_parsed, int la
  */
 static void recordParents( int parent, yyltype * childs, int nchilds){
 	
+	if (!ParseState.keepSrcRefs || !ParseState.keepParseData)
+	    return;
+
 	if( parent > ID_COUNT ){
 		growID(parent) ;
 	}
@@ -3277,7 +3293,8 @@ static void modif_token( yyltype* loc, int tok ){
 	
 	int id = loc->id ;
 	
-	if (!ParseState.keepSrcRefs || id < 0 || id > ID_COUNT) 
+	if (!ParseState.keepSrcRefs || !ParseState.keepParseData
+	    || id < 0 || id > ID_COUNT) 
 	    return;
 	    
 	if( tok == SYMBOL_FUNCTION_CALL ){
@@ -65,6 +65,7 @@ strsplit grep [g]sub [g]regexpr
 #include <ctype.h>
 #include <wchar.h>
 #include <wctype.h>    /* for wctrans_t */
+#include <locale.h>    /* for setlocale */
 
 /* As from TRE 0.8.0, tre.h replaces regex.h */
 #include <tre/tre.h>
@@ -125,6 +126,357 @@ static SEXP mkCharW(const wchar_t *wc)
     return ans;
 }
 
+/* Compiled regular expressions are cached so that a pattern used over
+   and over, e.g. by grepl() on one record at a time, is compiled only
+   once.  An entry is keyed by the pattern's CHARSXP, how it was
+   translated, whether it is for PCRE, and the compilation flags.
+   Translation and PCRE's character tables depend on LC_CTYPE, so the
+   cache is emptied when that changes.
+
+   The entries are external pointers, kept most recently used first in
+   R_RegexCache, which are freed by their finalizers.  So an entry
+   dropped from the cache, perhaps by R code run from a warning while
+   the pattern is in use, stays valid for as long as the caller keeps
+   it protected.
+
+   PCRE patterns are always studied, with JIT compilation where PCRE
+   supports it unless the environment variable R_PCRE_USE_JIT is set
+   to false. */
+#define REGEX_CACHE_SIZE 16
+#define R_PCRE_JIT_STACK_MAX (64 * 1024 * 1024)
+
+typedef enum { RX_BYTES, RX_NATIVE, RX_UTF8, RX_WCHAR } rx_mode;
+
+typedef struct {
+    rx_mode mode;
+    Rboolean perl;
+    int cflags;
+    pcre *re_pcre;
+    pcre_extra *re_pe;
+    const unsigned char *tables;
+    regex_t reg;
+} RegexCacheEntry;
+
+static SEXP R_RegexCache = NULL;
+static char *regexCacheLocale = NULL;
+#ifdef PCRE_STUDY_JIT_COMPILE
+static pcre_jit_stack *jit_stack = NULL;
+#endif
+
+#define REGEX_ENTRY(rx) ((RegexCacheEntry *) R_ExternalPtrAddr(rx))
+
+static rx_mode regexMode(Rboolean useBytes, Rboolean use_WC, Rboolean use_UTF8)
+{
+    if (useBytes) return RX_BYTES;
+    else if (use_WC) return RX_WCHAR;
+    else if (use_UTF8) return RX_UTF8;
+    else return RX_NATIVE;
+}
+
+static void finalizeRegex(SEXP rx)
+{
+    RegexCacheEntry *e = REGEX_ENTRY(rx);
+    if (!e) return;
+    if (e->perl) {
+#ifdef PCRE_STUDY_JIT_COMPILE
+	if (e->re_pe) pcre_free_study(e->re_pe);
+#else
+	if (e->re_pe) pcre_free(e->re_pe);
+#endif
+	pcre_free(e->re_pcre);
+	pcre_free((void *)e->tables);
+    } else
+	tre_regfree(&e->reg);
+    free(e);
+    R_ClearExternalPtr(rx);
+}
+
+static Rboolean usePCRE_JIT(void)
+{
+    static int use_JIT = -1;
+    if (use_JIT < 0) {
+	char *p = getenv("R_PCRE_USE_JIT");
+	use_JIT = !(p && StringFalse(p));
+    }
+    return use_JIT;
+}
+
+/* Compile pattern pat, translated to spat, or find it in the cache.
+   The caller must protect the result while it uses the entry. */
+static SEXP
+compiledRegex(SEXP pat, const char *spat, rx_mode mode, Rboolean perl,
+	      int cflags)
+{
+    const char *loc = setlocale(LC_CTYPE, NULL);
+    RegexCacheEntry *e;
+    SEXP rx;
+    int i;
+
+    if (!R_RegexCache) {
+	R_RegexCache = allocVector(VECSXP, REGEX_CACHE_SIZE);
+	R_PreserveObject(R_RegexCache);
+    }
+    if (!loc) loc = "";
+    if (!regexCacheLocale || strcmp(loc, regexCacheLocale)) {
+	for (i = 0; i < REGEX_CACHE_SIZE; i++)
+	    SET_VECTOR_ELT(R_RegexCache, i, R_NilValue);
+	free(regexCacheLocale);
+	regexCacheLocale = strdup(loc);
+    }
+
+    for (i = 0; i < REGEX_CACHE_SIZE; i++) {
+	rx = VECTOR_ELT(R_RegexCache, i);
+	if (rx == R_NilValue) break;
+	e = REGEX_ENTRY(rx);
+	if (EXTPTR_PROT(rx) == pat && e->mode == mode && e->perl == perl &&
+	    e->cflags == cflags)
+	    break;
+    }
+    if (i == REGEX_CACHE_SIZE || VECTOR_ELT(R_RegexCache, i) == R_NilValue) {
+	if (i == REGEX_CACHE_SIZE) i--;
+	e = (RegexCacheEntry *) malloc(sizeof(RegexCacheEntry));
+	if (!e) error(_("allocation of regular expression cache entry failed"));
+	e->mode = mode;
+	e->perl = perl;
+	e->cflags = cflags;
+	e->re_pe = NULL;
+	if (perl) {
+	    int erroffset, options = 0;
+	    const char *errorptr;
+	    // PCRE docs say this is not needed, but it is on Windows
+	    e->tables = pcre_maketables();
+	    e->re_pcre = pcre_compile(spat, cflags, &errorptr, &erroffset,
+				      e->tables);
+	    if (!e->re_pcre) {
+		pcre_free((void *)e->tables);
+		free(e);
+		if (errorptr)
+		    warning(_("PCRE pattern compilation error\n\t'%s'\n\tat '%s'\n"),
+			    errorptr, spat+erroffset);
+		error(_("invalid regular expression '%s'"), spat);
+	    }
+#ifdef PCRE_STUDY_JIT_COMPILE
+	    if (usePCRE_JIT()) options |= PCRE_STUDY_JIT_COMPILE;
+#endif
+	    e->re_pe = pcre_study(e->re_pcre, options, &errorptr);
+	    if (errorptr)
+		warning(_("PCRE pattern study error\n\t'%s'\n"), errorptr);
+#ifdef PCRE_STUDY_JIT_COMPILE
+	    if (e->re_pe && (options & PCRE_STUDY_JIT_COMPILE)) {
+		if (!jit_stack)
+		    jit_stack = pcre_jit_stack_alloc(32 * 1024,
+						     R_PCRE_JIT_STACK_MAX);
+		if (jit_stack)
+		    pcre_assign_jit_stack(e->re_pe, NULL, jit_stack);
+	    }
+#endif
+	} else {
+	    int rc;
+	    if (mode != RX_WCHAR)
+		rc = tre_regcompb(&e->reg, spat, cflags);
+	    else
+		rc = tre_regwcomp(&e->reg, wtransChar(pat), cflags);
+	    if (rc) {
+		regex_t reg = e->reg;
+		free(e);
+		reg_report(rc, &reg, spat);
+	    }
+	}
+	rx = R_MakeExternalPtr(e, R_NilValue, pat);
+	R_RegisterCFinalizer(rx, finalizeRegex);
+    } else
+	rx = VECTOR_ELT(R_RegexCache, i);
+
+    /* move the entry to the front */
+    for (; i > 0; i--)
+	SET_VECTOR_ELT(R_RegexCache, i, VECTOR_ELT(R_RegexCache, i - 1));
+    SET_VECTOR_ELT(R_RegexCache, 0, rx);
+    return rx;
+}
+
+/* Find the first occurrence of the plen bytes at pat in the len bytes
+   at s, returning a pointer to it or NULL.  This is the search used
+   for fixed = TRUE: memchr(), which C libraries vectorise, skips to
+   candidates for the first byte, and the last byte is checked before
+   the rest of the pattern is compared. */
+static const char *
+findBytes(const char *s, size_t len, const char *pat, size_t plen)
+{
+    if (plen == 0) return s;
+    if (plen > len) return NULL;
+    const char *last = s + (len - plen);
+    char first = pat[0], lastc = pat[plen - 1];
+    while (s <= last) {
+	s = memchr(s, first, last - s + 1);
+	if (!s) return NULL;
+	if (s[plen - 1] == lastc &&
+	    (plen <= 2 || !memcmp(s + 1, pat + 1, plen - 2)))
+	    return s;
+	s++;
+    }
+    return NULL;
+}
+
+/* As findBytes(), for a valid UTF-8 pattern in a UTF-8 string, only
+   accepting matches which start at a character boundary.  Returns the
+   byte offset of the match or -1, with *ichar set to its offset in
+   characters. */
+static int
+findUTF8(const char *target, int len, const char *pat, int plen, int *ichar)
+{
+    int ib = 0, i = 0;
+    const char *m;
+
+    while ((m = findBytes(target + ib, len - ib, pat, plen))) {
+	int mb = (int) (m - target);
+	while (ib < mb) {
+	    int used = utf8clen(target[ib]);
+	    if (used <= 0) return -1;
+	    ib += used;
+	    i++;
+	}
+	if (ib == mb) {
+	    *ichar = i;
+	    return ib;
+	}
+    }
+    return -1;
+}
+
+
+/* Number of characters in the nb bytes at s */
+static int
+countChars(const char *s, int nb, Rboolean useBytes, Rboolean use_UTF8)
+{
+    int n = 0;
+    if (useBytes || !(use_UTF8 || mbcslocale)) return nb;
+    if (use_UTF8) {
+	for (int k = 0; k < nb; k++)
+	    if ((s[k] & 0xC0) != 0x80) n++;
+    } else {
+	mbstate_t mb_st;
+	mbs_init(&mb_st);
+	for (int k = 0, used; k < nb; k += used, n++) {
+	    used = (int) Mbrtowc(NULL, s + k, MB_CUR_MAX, &mb_st);
+	    if (used <= 0) break;
+	}
+    }
+    return n;
+}
+
+/* strsplit(offsets = TRUE): rather than the tokens themselves, return
+   for each element of x a two-column integer matrix of the first and
+   last character of each token, as substring() takes them.  Only
+   fixed and empty splits are supported, so nothing but the answer
+   needs to be allocated. */
+static SEXP
+strsplitOffsets(SEXP x, SEXP tok, Rboolean useBytes, Rboolean use_UTF8)
+{
+    R_xlen_t i, itok, len = XLENGTH(x), tlen = XLENGTH(tok);
+    const char *buf, *split;
+    int nwarn = 0;
+    SEXP ans = PROTECT(allocVector(VECSXP, len));
+    const void *vmax = vmaxget(), *vmax2;
+
+    for (itok = 0; itok < tlen; itok++) {
+	SEXP this = STRING_ELT(tok, itok);
+	int slen = 0, splitChars = 0;
+
+	if (this == NA_STRING)
+	    split = NULL;
+	else if (useBytes)
+	    split = CHAR(this);
+	else if (use_UTF8) {
+	    split = translateCharUTF8(this);
+	    if (!utf8Valid(split))
+		error(_("'split' string %d is invalid UTF-8"), itok+1);
+	} else {
+	    split = translateChar(this);
+	    if (mbcslocale && !mbcsValid(split))
+		error(_("'split' string %d is invalid in this locale"),
+		      itok+1);
+	}
+	if (split) {
+	    slen = (int) strlen(split);
+	    splitChars = countChars(split, slen, useBytes, use_UTF8);
+	}
+
+	vmax2 = vmaxget();
+	for (i = itok; i < len; i += tlen) {
+	    SEXP el = STRING_ELT(x, i), t;
+	    int *pt, nb, nc, ntok, j;
+
+	    buf = NULL;
+	    if (el == NA_STRING) ;
+	    else if (useBytes)
+		buf = CHAR(el);
+	    else if (use_UTF8) {
+		buf = translateCharUTF8(el);
+		if (!utf8Valid(buf)) {
+		    if(nwarn++ < NWARN)
+			warning(_("input string %d is invalid UTF-8"), i+1);
+		    buf = NULL;
+		}
+	    } else {
+		buf = translateChar(el);
+		if (mbcslocale && !mbcsValid(buf)) {
+		    if(nwarn++ < NWARN)
+			warning(_("input string %d is invalid in this locale"), i+1);
+		    buf = NULL;
+		}
+	    }
+	    if (!buf) {
+		t = allocMatrix(INTSXP, 1, 2);
+		INTEGER(t)[0] = INTEGER(t)[1] = NA_INTEGER;
+		SET_VECTOR_ELT(ans, i, t);
+		vmaxset(vmax2);
+		continue;
+	    }
+
+	    nb = (int) strlen(buf);
+	    nc = countChars(buf, nb, useBytes, use_UTF8);
+	    if (!split) { /* NA split: the whole string */
+		t = allocMatrix(INTSXP, 1, 2);
+		INTEGER(t)[0] = 1; INTEGER(t)[1] = nc;
+	    } else if (!slen) { /* empty split: single characters */
+		t = allocMatrix(INTSXP, nc, 2);
+		pt = INTEGER(t);
+		for (j = 0; j < nc; j++) pt[j] = pt[nc + j] = j + 1;
+	    } else {
+		const char *bufp, *ebuf = buf + nb, *laststart = buf;
+		for (ntok = 0, bufp = buf;
+		     (bufp = findBytes(bufp, ebuf - bufp, split, slen));
+		     bufp += slen) {
+		    ntok++;
+		    laststart = bufp + slen;
+		}
+		if (laststart < ebuf) ntok++;
+		t = allocMatrix(INTSXP, ntok, 2);
+		pt = INTEGER(t);
+		int cpos = 0; /* characters before laststart */
+		laststart = buf;
+		for (j = 0; j < ntok; j++) {
+		    bufp = findBytes(laststart, ebuf - laststart, split, slen);
+		    if (!bufp) bufp = ebuf;
+		    pt[j] = cpos + 1;
+		    cpos += countChars(laststart, (int) (bufp - laststart),
+				       useBytes, use_UTF8);
+		    pt[ntok + j] = cpos;
+		    cpos += splitChars;
+		    laststart = bufp + slen;
+		}
+	    }
+	    SET_VECTOR_ELT(ans, i, t);
+	    vmaxset(vmax2);
+	}
+	vmaxset(vmax);
+    }
+
+    if (getAttrib(x, R_NamesSymbol) != R_NilValue)
+	namesgets(ans, getAttrib(x, R_NamesSymbol));
+    UNPROTECT(1);
+    return ans;
+}
 
 /* strsplit is going to split the strings in the first argument into
  * tokens depending on the second argument. The characters of the second
@@ -138,7 +490,7 @@ SEXP attribute_hidden do_strsplit(SEXP call, SEXP op, SEXP args, SEXP env)
     SEXP args0 = args, ans, tok, x;
     R_xlen_t i, itok, len, tlen;
     size_t j, ntok;
-    int fixed_opt, perl_opt, useBytes;
+    int fixed_opt, perl_opt, useBytes, offsets_opt;
     char *pt = NULL; wchar_t *wpt = NULL;
     const char *buf, *split = "", *bufp;
     const unsigned char *tables = NULL;
@@ -151,14 +503,18 @@ SEXP attribute_hidden do_strsplit(SEXP call, SEXP op, SEXP args, SEXP env)
     tok = CAR(args); args = CDR(args);
     fixed_opt = asLogical(CAR(args)); args = CDR(args);
     perl_opt = asLogical(CAR(args)); args = CDR(args);
-    useBytes = asLogical(CAR(args));
+    useBytes = asLogical(CAR(args)); args = CDR(args);
+    offsets_opt = asLogical(CAR(args));
     if (fixed_opt == NA_INTEGER) fixed_opt = 0;
     if (perl_opt == NA_INTEGER) perl_opt = 0;
     if (useBytes == NA_INTEGER) useBytes = 0;
+    if (offsets_opt == NA_INTEGER) offsets_opt = 0;
     if (fixed_opt && perl_opt) {
 	warning(_("argument '%s' will be ignored"), "perl = TRUE");
 	perl_opt = 0;
     }
+    if (offsets_opt && !fixed_opt)
+	error(_("'%s' requires '%s'"), "offsets = TRUE", "fixed = TRUE");
 
     if (!isString(x) || !isString(tok)) error(_("non-character argument"));
 
@@ -198,6 +554,9 @@ SEXP attribute_hidden do_strsplit(SEXP call, SEXP op, SEXP args, SEXP env)
 	}
     }
 
+    if (offsets_opt)
+	return strsplitOffsets(x, tok, useBytes, use_UTF8);
+
     /* group by token for efficiency with PCRE/TRE versions */
     PROTECT(ans = allocVector(VECSXP, len));
     vmax = vmaxget();
@@ -328,14 +687,18 @@ SEXP attribute_hidden do_strsplit(SEXP call, SEXP op, SEXP args, SEXP env)
 		/* find out how many splits there will be */
 		size_t ntok = 0;
 		/* This is UTF-8 safe since it compares whole strings */
-		laststart = buf;
 		ebuf = buf + strlen(buf);
-		for (bufp = buf; bufp < ebuf; bufp++) {
-		    if ((slen == 1 && *bufp != *split) ||
-			(slen > 1 && strncmp(bufp, split, slen))) continue;
-		    ntok++;
-		    bufp += MAX(slen - 1, 0);
-		    laststart = bufp+1;
+		if (slen) {
+		    laststart = buf;
+		    for (bufp = buf;
+			 (bufp = findBytes(bufp, ebuf - bufp, split, slen));
+			 bufp += slen) {
+			ntok++;
+			laststart = bufp + slen;
+		    }
+		} else {
+		    ntok = ebuf - buf;
+		    laststart = ebuf;
 		}
 		bufp = laststart;
 		SET_VECTOR_ELT(ans, i,
@@ -348,24 +711,19 @@ SEXP attribute_hidden do_strsplit(SEXP call, SEXP op, SEXP args, SEXP env)
 		       strings, but <MBCS-FIXME> it would be more
 		       efficient to skip along by chars.
 		    */
-		    for (; bufp < ebuf; bufp++) {
-			if ((slen == 1 && *bufp != *split) ||
-			    (slen > 1 && strncmp(bufp, split, slen))) continue;
-			if (slen) {
-			    strncpy(pt, laststart, bufp - laststart);
-			    pt[bufp - laststart] = '\0';
-			} else {
-			    pt[0] = *bufp; pt[1] ='\0';
-			}
-			bufp += MAX(slen-1, 0);
-			laststart = bufp+1;
-			if (use_UTF8)
-			    SET_STRING_ELT(t, j, mkCharCE(pt, CE_UTF8));
-			else
-			    SET_STRING_ELT(t, j, markKnown(pt, STRING_ELT(x, i)));
-			break;
+		    if (slen) {
+			bufp = findBytes(bufp, ebuf - bufp, split, slen);
+			memcpy(pt, laststart, bufp - laststart);
+			pt[bufp - laststart] = '\0';
+			bufp += slen;
+		    } else {
+			pt[0] = *bufp++; pt[1] ='\0';
 		    }
-		    bufp = laststart;
+		    laststart = bufp;
+		    if (use_UTF8)
+			SET_STRING_ELT(t, j, mkCharCE(pt, CE_UTF8));
+		    else
+			SET_STRING_ELT(t, j, markKnown(pt, STRING_ELT(x, i)));
 		}
 		if (*bufp) {
 		    if (use_UTF8)
@@ -644,38 +1002,21 @@ SEXP attribute_hidden do_strsplit(SEXP call, SEXP op, SEXP args, SEXP env)
 
 /* Used by grep[l] and [g]regexpr, with return value the match
    position in characters */
-/* This could be faster for plen > 1, but uses in R are for small strings */
 static int fgrep_one(const char *pat, const char *target,
 		     Rboolean useBytes, Rboolean use_UTF8, int *next)
 {
     int plen = (int) strlen(pat), len = (int) strlen(target);
     int i = -1;
-    const char *p;
 
     if (plen == 0) {
 	if (next != NULL) *next = 1;
 	return 0;
     }
-    if (plen == 1 && (useBytes || !(mbcslocale || use_UTF8))) {
-	/* a single byte is a common case */
-	for (i = 0, p = target; *p; p++, i++)
-	    if (*p == pat[0]) {
-		if (next != NULL) *next = i + 1;
-		return i;
-	    }
-	return -1;
-    }
-    if (!useBytes && use_UTF8) {	
-        int ib, used;
-	for (ib = 0, i = 0; ib <= len-plen; i++) {
-	    if (strncmp(pat, target+ib, plen) == 0) {
-		if (next != NULL) *next = ib + plen;
-		return i;
-	    }
-	    used = utf8clen(target[ib]);
-	    if (used <= 0) break;
-	    ib += used;
-	}
+    if (!useBytes && use_UTF8) {
+	int ib = findUTF8(target, len, pat, plen, &i);
+	if (ib < 0) return -1;
+	if (next != NULL) *next = ib + plen;
+	return i;
     } else if (!useBytes && mbcslocale) { /* skip along by chars */
 	mbstate_t mb_st;
 	int ib, used;
@@ -689,12 +1030,14 @@ static int fgrep_one(const char *pat, const char *target,
 	    if (used <= 0) break;
 	    ib += used;
 	}
-    } else
-	for (i = 0; i <= len-plen; i++)
-	    if (strncmp(pat, target+i, plen) == 0) {
-		if (next != NULL) *next = i + plen;
-		return i;
-	    }
+    } else {
+	const char *m = findBytes(target, len, pat, plen);
+	if (m) {
+	    i = (int) (m - target);
+	    if (next != NULL) *next = i + plen;
+	    return i;
+	}
+    }
     return -1;
 }
 
@@ -706,24 +1049,11 @@ static int fgrep_one_bytes(const char *pat, const char *target, int len,
 			   Rboolean useBytes, Rboolean use_UTF8)
 {
     int i = -1, plen = (int) strlen(pat);
-    const char *p;
 
     if (plen == 0) return 0;
-    if (plen == 1 && (useBytes || !(mbcslocale || use_UTF8))) {
-	/* a single byte is a common case */
-	for (i = 0, p = target; *p; p++, i++)
-	    if (*p == pat[0]) return i;
-	return -1;
-    }
-    if (!useBytes && use_UTF8) { /* not really needed */
-	int ib, used;
-	for (ib = 0, i = 0; ib <= len-plen; i++) {
-	    if (strncmp(pat, target+ib, plen) == 0) return ib;
-	    used = utf8clen(target[ib]);
-	    if (used <= 0) break;
-	    ib += used;
-	}
-    } else if (!useBytes && mbcslocale) { /* skip along by chars */
+    if (!useBytes && use_UTF8) /* not really needed */
+	return findUTF8(target, len, pat, plen, &i);
+    else if (!useBytes && mbcslocale) { /* skip along by chars */
 	mbstate_t mb_st;
 	int ib, used;
 	mbs_init(&mb_st);
@@ -733,15 +1063,70 @@ static int fgrep_one_bytes(const char *pat, const char *target, int len,
 	    if (used <= 0) break;
 	    ib += used;
 	}
-    } else
-	for (i = 0; i <= len-plen; i++)
-	    if (strncmp(pat, target+i, plen) == 0) return i;
+    } else {
+	const char *m = findBytes(target, len, pat, plen);
+	if (m) return (int) (m - target);
+    }
     return -1;
 }
 
+/* grep() and grepl() match byte strings (including all-ASCII input)
+   against fixed or PCRE patterns on R_num_math_threads threads when x
+   has R_GREP_THREADS_MIN or more elements: nothing there allocates or
+   can signal an R error.  Each thread uses its own copy of the
+   pcre_extra block on the machine stack rather than the shared JIT
+   stack; the rare elements that exceed it are marked NA and redone
+   afterwards on the main thread.  TRE matching, translation and the
+   wchar_t modes stay serial. */
+#define R_GREP_THREADS_MIN 100000
+
+static R_INLINE int grep_nthreads(R_xlen_t n)
+{
+#ifdef _OPENMP
+    if (n >= R_GREP_THREADS_MIN && R_num_math_threads > 1)
+	return R_num_math_threads;
+#endif
+    return 1;
+}
+
+#ifdef _OPENMP
+static void grep_parallel(SEXP text, int *ind, R_xlen_t n, const char *spat,
+			  int fixed_opt, pcre *re_pcre, pcre_extra *re_pe,
+			  int nthreads)
+{
+#pragma omp parallel num_threads(nthreads) default(none) \
+    firstprivate(text, ind, n, spat, fixed_opt, re_pcre, re_pe, \
+		 R_NaString, R_NaInt)
+    {
+	pcre_extra pe, *ppe = re_pe;
+	int ov[3];
+	if (re_pe) {
+	    pe = *re_pe;
+#ifdef PCRE_STUDY_JIT_COMPILE
+	    pcre_assign_jit_stack(&pe, NULL, NULL);
+#endif
+	    ppe = &pe;
+	}
+#pragma omp for
+	for (R_xlen_t i = 0; i < n; i++) {
+	    SEXP el = STRING_ELT(text, i);
+	    if (el == NA_STRING) ind[i] = 0;
+	    else if (fixed_opt)
+		ind[i] = fgrep_one(spat, CHAR(el), TRUE, FALSE, NULL) >= 0;
+	    else {
+		int rc = pcre_exec(re_pcre, ppe, CHAR(el), LENGTH(el),
+				   0, 0, ov, 0);
+		ind[i] = rc >= 0 ? 1 :
+		    (rc == PCRE_ERROR_NOMATCH ? 0 : NA_LOGICAL);
+	    }
+	}
+    }
+}
+#endif
+
 SEXP attribute_hidden do_grep(SEXP call, SEXP op, SEXP args, SEXP env)
 {
-    SEXP pat, text, ind, ans;
+    SEXP pat, text, ind, ans, rx = R_NilValue;
     regex_t reg;
     R_xlen_t i, j, n;
     int nmatches = 0, ov[3], rc;
@@ -749,10 +1134,9 @@ SEXP attribute_hidden do_grep(SEXP call, SEXP op, SEXP args, SEXP env)
     const char *spat = NULL;
     pcre *re_pcre = NULL /* -Wall */;
     pcre_extra *re_pe = NULL;
-    const unsigned char *tables = NULL /* -Wall */;
     Rboolean use_UTF8 = FALSE, use_WC = FALSE;
     const void *vmax;
-    int nwarn = 0;
+    int nwarn = 0, nthreads;
 
     checkArity(op, args);
     pat = CAR(args); args = CDR(args);
@@ -855,38 +1239,38 @@ SEXP attribute_hidden do_grep(SEXP call, SEXP op, SEXP args, SEXP env)
 
     if (fixed_opt) ;
     else if (perl_opt) {
-	int cflags = 0, erroffset;
-	const char *errorptr;
+	int cflags = 0;
 	if (igcase_opt) cflags |= PCRE_CASELESS;
 	if (!useBytes && use_UTF8) cflags |= PCRE_UTF8;
-	// PCRE docs say this is not needed, but it is on Windows
-	tables = pcre_maketables();
-	re_pcre = pcre_compile(spat, cflags, &errorptr, &erroffset, tables);
-	if (!re_pcre) {
-	    if (errorptr)
-		warning(_("PCRE pattern compilation error\n\t'%s'\n\tat '%s'\n"),
-			errorptr, spat+erroffset);
-	    error(_("invalid regular expression '%s'"), spat);
-	    if (n > 10) {
-		re_pe = pcre_study(re_pcre, 0, &errorptr);
-		if (errorptr)
-		    warning(_("PCRE pattern study error\n\t'%s'\n"), errorptr);
-	    }
-	}
+	rx = compiledRegex(STRING_ELT(pat, 0), spat,
+			   regexMode(useBytes, use_WC, use_UTF8), TRUE, cflags);
+	re_pcre = REGEX_ENTRY(rx)->re_pcre;
+	re_pe = REGEX_ENTRY(rx)->re_pe;
     } else {
 	int cflags = REG_NOSUB | REG_EXTENDED;
 	if (igcase_opt) cflags |= REG_ICASE;
-	if (!use_WC)
-	    rc = tre_regcompb(&reg, spat, cflags);
-	else
-	    rc = tre_regwcomp(&reg, wtransChar(STRING_ELT(pat, 0)), cflags);
-	if (rc) reg_report(rc, &reg, spat);
+	rx = compiledRegex(STRING_ELT(pat, 0), spat,
+			   regexMode(useBytes, use_WC, use_UTF8), FALSE, cflags);
+	reg = REGEX_ENTRY(rx)->reg;
     }
+    PROTECT(rx);
 
     PROTECT(ind = allocVector(LGLSXP, n));
     vmax = vmaxget();
+    nthreads = grep_nthreads(n);
+#ifdef _OPENMP
+    if (nthreads > 1 && useBytes && (fixed_opt || perl_opt))
+	grep_parallel(text, LOGICAL(ind), n, spat, fixed_opt, re_pcre, re_pe,
+		      nthreads);
+    else
+#endif
+	nthreads = 1;
     for (i = 0 ; i < n ; i++) {
 //	if ((i+1) % NINTERRUPT == 0) R_CheckUserInterrupt();
+	if (nthreads > 1 && LOGICAL(ind)[i] != NA_LOGICAL) {
+	    if (invert ^ LOGICAL(ind)[i]) nmatches++;
+	    continue;
+	}
 	LOGICAL(ind)[i] = 0;
 	if (STRING_ELT(text, i) != NA_STRING) {
 	    const char *s = NULL;
@@ -926,14 +1310,7 @@ SEXP attribute_hidden do_grep(SEXP call, SEXP op, SEXP args, SEXP env)
 	vmaxset(vmax);
 	if (invert ^ LOGICAL(ind)[i]) nmatches++;
     }
-
-    if (fixed_opt);
-    else if (perl_opt) {
-	if (re_pe) pcre_free(re_pe);
-	pcre_free(re_pcre);
-	pcre_free((void *)tables);
-    } else
-	tre_regfree(&reg);
+    UNPROTECT_PTR(rx);
 
     if (PRIMVAL(op)) {/* grepl case */
 	UNPROTECT(1); /* ind */
@@ -980,57 +1357,12 @@ SEXP attribute_hidden do_grep(SEXP call, SEXP op, SEXP args, SEXP env)
 /* fixed, single binary search, no error checking; -1 = no match, otherwise offset
    NOTE: all offsets here (in & out) are 0-based !! */
 static R_size_t fgrepraw1(SEXP pat, SEXP text, R_size_t offset) {
-    Rbyte *haystack = RAW(text), *needle = RAW(pat);
+    const char *haystack = (const char *) RAW(text), *res;
     R_size_t n = LENGTH(text);
-    switch (LENGTH(pat)) { /* it may be silly but we optimize small needle
-			      searches, because they can be used to match
-			      single UTF8 chars (up to 3 bytes) */
-    case 1:
-	{
-	    Rbyte c = needle[0];
-	    while (offset < n) {
-		if (haystack[offset] == c)
-		    return offset;
-		offset++;
-	    }
-	    return (R_size_t) -1;
-	}
-    case 2:
-	{
-	    n--;
-	    while (offset < n) {
-		if (haystack[offset] == needle[0] && haystack[offset + 1] == needle[1])
-		    return offset;
-		offset++;
-	    }
-	    return (R_size_t) -1;
-	}
-    case 3:
-	{
-	    n -= 2;
-	    while (offset < n) {
-		if (haystack[offset    ] == needle[0] &&
-		    haystack[offset + 1] == needle[1] &&
-		    haystack[offset + 2] == needle[2])
-		    return offset;
-		offset++;
-	    }
-	    return (R_size_t) -1;
-	}
-    default:
-	{
-	    R_size_t ncmp = LENGTH(pat);
-	    n -= ncmp;
-	    ncmp--;
-	    while (offset < n) {
-		if (haystack[offset] == needle[0] &&
-		    !memcmp(haystack + offset + 1, needle + 1, ncmp))
-		    return offset;
-		offset++;
-	    }
-	}
-    }
-    return -1;
+    if (offset >= n) return (R_size_t) -1;
+    res = findBytes(haystack + offset, n - offset,
+		    (const char *) RAW(pat), LENGTH(pat));
+    return res ? (R_size_t) (res - haystack) : (R_size_t) -1;
 }
 
 /* grepRaw(pattern, text, offset, ignore.case, fixed, value, all, invert) */
@@ -1486,11 +1818,11 @@ static int wcount_subs(const wchar_t *repl)
 
 SEXP attribute_hidden do_gsub(SEXP call, SEXP op, SEXP args, SEXP env)
 {
-    SEXP pat, rep, text, ans;
+    SEXP pat, rep, text, ans, rx = R_NilValue;
     regex_t reg;
     regmatch_t regmatch[10];
     R_xlen_t i, n;
-    int j, ns, nns, nmatch, offset, rc;
+    int j, ns, nns, nmatch, offset;
     int global, igcase_opt, perl_opt, fixed_opt, useBytes, eflags, last_end;
     char *u, *cbuf;
     const char *spat = NULL, *srep = NULL, *s = NULL;
@@ -1499,7 +1831,6 @@ SEXP attribute_hidden do_gsub(SEXP call, SEXP op, SEXP args, SEXP env)
     const wchar_t *wrep = NULL;
     pcre *re_pcre = NULL;
     pcre_extra *re_pe  = NULL;
-    const unsigned char *tables = NULL;
     const void *vmax = vmaxget();
 
     checkArity(op, args);
@@ -1609,39 +1940,29 @@ SEXP attribute_hidden do_gsub(SEXP call, SEXP op, SEXP args, SEXP env)
 	if (!patlen) error(_("zero-length pattern"));
 	replen = strlen(srep);
     } else if (perl_opt) {
-	int cflags = 0, erroffset;
-	const char *errorptr;
+	int cflags = 0;
 	if (use_UTF8) cflags |= PCRE_UTF8;
 	if (igcase_opt) cflags |= PCRE_CASELESS;
-	// PCRE docs say this is not needed, but it is on Windows
-	tables = pcre_maketables();
-	re_pcre = pcre_compile(spat, cflags, &errorptr, &erroffset, tables);
-	if (!re_pcre) {
-	    if (errorptr)
-		warning(_("PCRE pattern compilation error\n\t'%s'\n\tat '%s'\n"),
-			errorptr, spat+erroffset);
-	    error(_("invalid regular expression '%s'"), spat);
-	}
-	if (n > 10) {
-	    re_pe = pcre_study(re_pcre, 0, &errorptr);
-	    if (errorptr)
-		warning(_("PCRE pattern study error\n\t'%s'\n"), errorptr);
-	}
+	rx = compiledRegex(STRING_ELT(pat, 0), spat,
+			   regexMode(useBytes, use_WC, use_UTF8), TRUE, cflags);
+	re_pcre = REGEX_ENTRY(rx)->re_pcre;
+	re_pe = REGEX_ENTRY(rx)->re_pe;
 	replen = strlen(srep);
     } else {
 	int cflags = REG_EXTENDED;
 	if (igcase_opt) cflags |= REG_ICASE;
-	if (!use_WC) {
-	    rc =  tre_regcompb(&reg, spat, cflags);
-	    if (rc) reg_report(rc, &reg, spat);
+	rx = compiledRegex(STRING_ELT(pat, 0),
+			   use_WC ? CHAR(STRING_ELT(pat, 0)) : spat,
+			   regexMode(useBytes, use_WC, use_UTF8), FALSE, cflags);
+	reg = REGEX_ENTRY(rx)->reg;
+	if (!use_WC)
 	    replen = strlen(srep);
-	} else {
-	    rc  = tre_regwcomp(&reg, wtransChar(STRING_ELT(pat, 0)), cflags);
-	    if (rc) reg_report(rc, &reg, CHAR(STRING_ELT(pat, 0)));
+	else {
 	    wrep = wtransChar(STRING_ELT(rep, 0));
 	    replen = wcslen(wrep);
 	}
     }
+    PROTECT(rx);
 
     PROTECT(ans = allocVector(STRSXP, n));
     vmax = vmaxget();
@@ -1908,12 +2229,7 @@ SEXP attribute_hidden do_gsub(SEXP call, SEXP op, SEXP args, SEXP env)
 	vmaxset(vmax);
     }
 
-    if (fixed_opt) ;
-    else if (perl_opt) {
-	if (re_pe) pcre_free(re_pe);
-	pcre_free(re_pcre);
-	pcre_free((void *)tables);
-    } else tre_regfree(&reg);
+    UNPROTECT_PTR(rx);
     SHALLOW_DUPLICATE_ATTRIB(ans, text);
     /* This copied the class, if any */
     UNPROTECT(1);
@@ -2304,7 +2620,7 @@ static SEXP gregexpr_BadStringAns(void)
 
 SEXP attribute_hidden do_regexpr(SEXP call, SEXP op, SEXP args, SEXP env)
 {
-    SEXP pat, text, ans;
+    SEXP pat, text, ans, rx = R_NilValue;
     regex_t reg;
     regmatch_t regmatch[10];
     R_xlen_t i, n;
@@ -2313,7 +2629,6 @@ SEXP attribute_hidden do_regexpr(SEXP call, SEXP op, SEXP args, SEXP env)
     const char *s = NULL;
     pcre *re_pcre = NULL /* -Wall */;
     pcre_extra *re_pe = NULL;
-    const unsigned char *tables = NULL /* -Wall */;
     Rboolean use_UTF8 = FALSE, use_WC = FALSE;
     const void *vmax;
     int capture_count, *ovector = NULL, ovector_size = 0, /* -Wall */
@@ -2407,24 +2722,13 @@ SEXP attribute_hidden do_regexpr(SEXP call, SEXP op, SEXP args, SEXP env)
 
     if (fixed_opt) ;
     else if (perl_opt) {
-	int cflags = 0, erroffset;
-	const char *errorptr;
+	int cflags = 0;
 	if (igcase_opt) cflags |= PCRE_CASELESS;
 	if (!useBytes && use_UTF8) cflags |= PCRE_UTF8;
-	// PCRE docs say this is not needed, but it is on Windows
-	tables = pcre_maketables();
-	re_pcre = pcre_compile(spat, cflags, &errorptr, &erroffset, tables);
-	if (!re_pcre) {
-	    if (errorptr)
-		warning(_("PCRE pattern compilation error\n\t'%s'\n\tat '%s'\n"),
-			errorptr, spat+erroffset);
-	    error(_("invalid regular expression '%s'"), spat);
-	}
-	if (n > 10) {
-	    re_pe = pcre_study(re_pcre, 0, &errorptr);
-	    if (errorptr)
-		warning(_("PCRE pattern study error\n\t'%s'\n"), errorptr);
-	}
+	rx = compiledRegex(STRING_ELT(pat, 0), spat,
+			   regexMode(useBytes, use_WC, use_UTF8), TRUE, cflags);
+	re_pcre = REGEX_ENTRY(rx)->re_pcre;
+	re_pe = REGEX_ENTRY(rx)->re_pe;
 	/* also extract info for named groups */
 	pcre_fullinfo(re_pcre, re_pe, PCRE_INFO_NAMECOUNT, &name_count);
 	pcre_fullinfo(re_pcre, re_pe, PCRE_INFO_NAMEENTRYSIZE, &name_entry_size);
@@ -2448,12 +2752,11 @@ SEXP attribute_hidden do_regexpr(SEXP call, SEXP op, SEXP args, SEXP env)
     } else {
 	int cflags = REG_EXTENDED;
 	if (igcase_opt) cflags |= REG_ICASE;
-	if (!use_WC)
-	    rc = tre_regcompb(&reg, spat, cflags);
-	else
-	    rc = tre_regwcomp(&reg, wtransChar(STRING_ELT(pat, 0)), cflags);
-	if (rc) reg_report(rc, &reg, spat);
+	rx = compiledRegex(STRING_ELT(pat, 0), spat,
+			   regexMode(useBytes, use_WC, use_UTF8), FALSE, cflags);
+	reg = REGEX_ENTRY(rx)->reg;
     }
+    PROTECT(rx);
 
     if (PRIMVAL(op) == 0) { /* regexpr */
 	SEXP matchlen, capture_start, capturelen;
@@ -2597,15 +2900,11 @@ SEXP attribute_hidden do_regexpr(SEXP call, SEXP op, SEXP args, SEXP env)
 	}
     }
 
-    if (fixed_opt) ;
-    else if (perl_opt) {
-	if (re_pe) pcre_free(re_pe);
-	pcre_free(re_pcre);
-	pcre_free((void *)tables);
+    if (perl_opt && !fixed_opt) {
 	UNPROTECT(1);
 	free(ovector);
-    } else
-	tre_regfree(&reg);
+    }
+    UNPROTECT_PTR(rx);
 
     UNPROTECT(1);
     return ans;
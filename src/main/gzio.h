@@ -55,6 +55,82 @@
 
 #define Z_BUFSIZE 16384
 
+/* R ADDITION: block-parallel deflate, as in pigz.  The input is cut
+   into blocks of PGZ_BLOCK bytes which are compressed independently,
+   each primed with the last PGZ_DICT bytes of the block before it and
+   ended by a sync flush (the last by Z_FINISH), so their concatenation
+   is a single raw deflate stream. */
+#define PGZ_BLOCK 131072
+#define PGZ_DICT 32768
+
+/* Compress the len bytes at in, preceded by the dictlen bytes at dict,
+   to a malloc-ed buffer returned in *out, using up to nthreads threads.
+   If last, the stream is ended.  Returns the compressed size, or -1 on
+   failure. */
+static long R_pdeflate(const Bytef *in, size_t len, const Bytef *dict,
+		       uInt dictlen, int level, int strategy, int last,
+		       int nthreads, Bytef **out)
+{
+    size_t nb = (len + PGZ_BLOCK - 1) / PGZ_BLOCK, bound, total = 0;
+    size_t *sizes;
+    Bytef *buf;
+    int ok = 1;
+
+    if (nb == 0) nb = 1;
+    bound = compressBound(PGZ_BLOCK) + 64;
+    buf = (Bytef *) malloc(nb * bound);
+    sizes = (size_t *) malloc(nb * sizeof(size_t));
+    if (!buf || !sizes) {
+	free(buf); free(sizes);
+	return -1;
+    }
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(nthreads) schedule(dynamic) \
+    reduction(&&:ok)
+#endif
+    for (size_t b = 0; b < nb; b++) {
+	z_stream z;
+	size_t start = b * PGZ_BLOCK;
+	uInt blen = (uInt) (len - start < PGZ_BLOCK ? len - start : PGZ_BLOCK);
+	int flush = (last && b == nb - 1) ? Z_FINISH : Z_SYNC_FLUSH, res;
+
+	z.zalloc = (alloc_func) 0;
+	z.zfree = (free_func) 0;
+	z.opaque = (voidpf) 0;
+	if (deflateInit2(&z, level, Z_DEFLATED, -MAX_WBITS, MAX_MEM_LEVEL,
+			 strategy) != Z_OK) {
+	    ok = 0;
+	    continue;
+	}
+	if (b > 0)
+	    deflateSetDictionary(&z, in + start - PGZ_DICT, PGZ_DICT);
+	else if (dictlen)
+	    deflateSetDictionary(&z, dict, dictlen);
+	z.next_in = (Bytef *) in + start;
+	z.avail_in = blen;
+	z.next_out = buf + b * bound;
+	z.avail_out = (uInt) bound;
+	res = deflate(&z, flush);
+	if (flush == Z_FINISH ? res != Z_STREAM_END
+	    : (res != Z_OK || z.avail_in != 0 || z.avail_out == 0))
+	    ok = 0;
+	sizes[b] = bound - z.avail_out;
+	deflateEnd(&z);
+    }
+    if (ok)
+	for (size_t b = 0; b < nb; b++) {
+	    memmove(buf + total, buf + b * bound, sizes[b]);
+	    total += sizes[b];
+	}
+    free(sizes);
+    if (!ok) {
+	free(buf);
+	return -1;
+    }
+    *out = buf;
+    return (long) total;
+}
+
 typedef struct gz_stream {
     z_stream stream;
     int      z_err;   /* error code for last stream operation */
@@ -67,6 +143,16 @@ typedef struct gz_stream {
     Rz_off_t  start;  /* start of compressed data in file (header skipped) */
     Rz_off_t  in;     /* bytes into deflate or inflate */
     Rz_off_t  out;    /* bytes out of deflate or inflate */
+    int      level, strategy;
+    int      threads; /* > 1 to compress with R_pdeflate */
+    Byte     *pin;    /* input waiting for R_pdeflate */
+    size_t   pcount;
+    Byte     pdict[PGZ_DICT]; /* the input before pin */
+    uInt     pdictlen;
+    char     *vbuf;   /* stdio buffer for file, if not the default */
+    Byte     *pout;   /* members inflated by pgz_fill, when reading */
+    size_t   *psize;  /* their compressed and inflated sizes */
+    size_t   plen, ppos;
 } gz_stream;
 
 
@@ -97,12 +183,16 @@ static int destroy (gz_stream *s)
         if (s->mode == 'w') err = deflateEnd(&(s->stream));
         else if (s->mode == 'r') err = inflateEnd(&(s->stream));
     }
+    free(s->pin);
+    free(s->pout);
+    free(s->psize);
     if (s->file != NULL && fclose(s->file)) {
 #ifdef ESPIPE
         if (errno != ESPIPE) /* fclose is broken for pipes in HP/UX */
 #endif
             err = Z_ERRNO;
     }
+    free(s->vbuf);
     if (s->z_err < 0) err = s->z_err;
 
     if(s) free(s);
@@ -181,7 +271,10 @@ static void check_header(gz_stream *s)
     s->z_err = s->z_eof ? Z_DATA_ERROR : Z_OK;
 }
 
-gzFile R_gzopen (const char *path, const char *mode)
+/* R ADDITION: bufsize > 0 gives the file a stdio buffer of that size
+   and, when reading, advises the OS that it will be read sequentially. */
+static gzFile R_gzopen_buf (const char *path, const char *mode,
+			    size_t bufsize)
 {
     int err;
     int level = Z_DEFAULT_COMPRESSION; /* compression level */
@@ -209,6 +302,14 @@ gzFile R_gzopen (const char *path, const char *mode)
     s->out = 0;
     s->crc = crc32(0L, Z_NULL, 0);
     s->transparent = 0;
+    s->threads = 1;
+    s->pin = NULL;
+    s->pcount = 0;
+    s->pdictlen = 0;
+    s->vbuf = NULL;
+    s->pout = NULL;
+    s->psize = NULL;
+    s->plen = s->ppos = 0;
     s->mode = '\0';
     do {
         if (*p == 'r') s->mode = 'r';
@@ -220,6 +321,8 @@ gzFile R_gzopen (const char *path, const char *mode)
         else *m++ = *p; /* copy the mode */
     } while (*p++ && m != fmode + sizeof(fmode));
     if (s->mode == '\0') return destroy(s), (gzFile) Z_NULL;
+    s->level = level;
+    s->strategy = strategy;
 
     if (s->mode == 'w') {
         err = deflateInit2(&(s->stream), level,
@@ -241,6 +344,14 @@ gzFile R_gzopen (const char *path, const char *mode)
     errno = 0;
     s->file = fopen(path, fmode);
     if (s->file == NULL) return destroy(s), (gzFile) Z_NULL;
+    if (bufsize > 0) {
+	if ((s->vbuf = (char *) malloc(bufsize)))
+	    setvbuf(s->file, s->vbuf, _IOFBF, bufsize);
+#ifdef POSIX_FADV_SEQUENTIAL
+	if (s->mode == 'r')
+	    (void) posix_fadvise(fileno(s->file), 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+    }
 
     if (s->mode == 'w') {
         /* Write a very simple .gz header */
@@ -255,6 +366,11 @@ gzFile R_gzopen (const char *path, const char *mode)
     return (gzFile) s;
 }
 
+gzFile R_gzopen (const char *path, const char *mode)
+{
+    return R_gzopen_buf(path, mode, 0);
+}
+
 static void z_putLong (FILE *file, uLong x)
 {
     int n;
@@ -277,6 +393,147 @@ static uLong getLong (gz_stream *s)
     return x;
 }
 
+/* R ADDITION: block-parallel inflate of BGZF files (as written by
+   bgzip and samtools).  Each of their gzip members records its own
+   size in a 'BC' subfield of the extra field and inflates to at most
+   64KB, so a batch of PGZ_MEMBERS members per thread can be read and
+   inflated independently.  Reading falls back to the serial code at
+   the first member which is not BGZF. */
+#define PGZ_MEMBERS 8
+#define BGZF_MAX 65536
+
+/* the size of the member whose header (n bytes of it) is at h, or 0 if
+   it is not a BGZF member */
+static size_t bgzf_size(const Byte *h, size_t n)
+{
+    size_t xlen, i, slen;
+
+    if (n < 12 || h[0] != gz_magic[0] || h[1] != gz_magic[1] ||
+	h[2] != Z_DEFLATED || h[3] != EXTRA_FIELD) return 0;
+    xlen = h[10] | (h[11] << 8);
+    if (n < 12 + xlen) return 0;
+    for (i = 12; i + 4 <= 12 + xlen; i += 4 + slen) {
+	slen = h[i+2] | (h[i+3] << 8);
+	if (h[i] == 'B' && h[i+1] == 'C' && slen == 2 && i + 6 <= 12 + xlen)
+	    return (size_t) (h[i+4] | (h[i+5] << 8)) + 1;
+    }
+    return 0;
+}
+
+static uLong pgz_getLong (const Byte *p)
+{
+    return (uLong) p[0] | ((uLong) p[1] << 8) | ((uLong) p[2] << 16) |
+	((uLong) p[3] << 24);
+}
+
+/* Go back n bytes to the start of a member which is not BGZF, and read
+   the rest of the file serially. */
+static int pgz_serial(gz_stream *s, size_t n)
+{
+    free(s->pin); free(s->pout); free(s->psize);
+    s->pin = s->pout = NULL;
+    s->psize = NULL;
+    s->plen = s->ppos = 0;
+    s->threads = 1;
+    if (f_seek(s->file, -(Rz_off_t) n, SEEK_CUR)) {
+	s->z_err = Z_ERRNO;
+	return -1;
+    }
+    s->stream.avail_in = 0;
+    s->stream.next_in = s->buffer;
+    inflateReset(&(s->stream));
+    s->crc = crc32(0L, Z_NULL, 0);
+    check_header(s);
+    return 0;
+}
+
+/* Read the next batch of members into s->pin and inflate them into
+   s->pout.  Returns 1 if any were read, 0 at the end of the file or on
+   falling back to serial reading, -1 on error. */
+static int pgz_fill(gz_stream *s)
+{
+    size_t cap = (size_t) s->threads * PGZ_MEMBERS, nm = 0, total = 0;
+    int ok = 1;
+
+    s->plen = s->ppos = 0;
+    while (nm < cap) {
+	Byte *in = s->pin + nm * BGZF_MAX;
+	size_t n = fread(in, 1, 12, s->file), hl, size;
+
+	if (n == 0) {
+	    if (ferror(s->file)) {
+		s->z_err = Z_ERRNO;
+		return -1;
+	    }
+	    s->z_eof = 1;
+	    break;
+	}
+	/* only read an extra field which FLG has, and which leaves room
+	   in the slot for at least the trailer: anything else is not
+	   BGZF, and bgzf_size() rejects it */
+	hl = 0;
+	if (n == 12 && in[3] == EXTRA_FIELD)
+	    hl = 12 + (in[10] | (in[11] << 8));
+	if (hl > 12 && hl + 8 <= BGZF_MAX)
+	    n += fread(in + 12, 1, hl - 12, s->file);
+	size = bgzf_size(in, n);
+	if (!size) {
+	    if (nm == 0) return pgz_serial(s, n);
+	    if (f_seek(s->file, -(Rz_off_t) n, SEEK_CUR)) return -1;
+	    break; /* inflate this batch first */
+	}
+	if (size < hl + 8 ||
+	    fread(in + hl, 1, size - hl, s->file) != size - hl) {
+	    s->z_err = Z_DATA_ERROR;
+	    return -1;
+	}
+	s->psize[2*nm] = size;
+	nm++;
+    }
+    if (nm == 0) return 0;
+
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(s->threads) schedule(dynamic) \
+    reduction(&&:ok)
+#endif
+    for (size_t k = 0; k < nm; k++) {
+	z_stream z;
+	Byte *in = s->pin + k * BGZF_MAX, *out = s->pout + k * BGZF_MAX;
+	size_t size = s->psize[2*k], hl = 12 + (in[10] | (in[11] << 8));
+	uLong isize = pgz_getLong(in + size - 4);
+
+	z.zalloc = (alloc_func) 0;
+	z.zfree = (free_func) 0;
+	z.opaque = (voidpf) 0;
+	s->psize[2*k+1] = 0;
+	if (isize > BGZF_MAX || inflateInit2(&z, -MAX_WBITS) != Z_OK) {
+	    ok = 0;
+	    continue;
+	}
+	z.next_in = in + hl;
+	z.avail_in = (uInt) (size - hl - 8);
+	z.next_out = out;
+	z.avail_out = BGZF_MAX;
+	if (inflate(&z, Z_FINISH) != Z_STREAM_END ||
+	    BGZF_MAX - z.avail_out != isize ||
+	    crc32(0L, out, (uInt) isize) != pgz_getLong(in + size - 8))
+	    ok = 0;
+	inflateEnd(&z);
+	s->psize[2*k+1] = isize;
+    }
+    if (!ok) {
+	s->z_err = Z_DATA_ERROR;
+	return -1;
+    }
+    for (size_t k = 0; k < nm; k++) {
+	memmove(s->pout + total, s->pout + k * BGZF_MAX, s->psize[2*k+1]);
+	total += s->psize[2*k+1];
+	s->in += s->psize[2*k];
+    }
+    s->plen = total;
+    return 1;
+}
+
 static int R_gzread (gzFile file, voidp buf, unsigned len)
 {
     gz_stream *s = (gz_stream*) file;
@@ -294,6 +551,34 @@ static int R_gzread (gzFile file, voidp buf, unsigned len)
     }
     if (s->z_err == Z_STREAM_END) return 0;  /* EOF */
 
+    if (s->pout) { /* R ADDITION: see pgz_fill */
+	unsigned done = 0;
+	while (done < len) {
+	    size_t n = s->plen - s->ppos;
+	    if (n == 0) {
+		int res = s->z_eof ? 0 : pgz_fill(s);
+		if (res < 0) {
+		    if(s->z_err == Z_ERRNO) warning("error reading the file");
+		    else warning("invalid or incomplete compressed data");
+		    return done ? (int) done : -1;
+		}
+		if (res == 0) break;
+		continue;
+	    }
+	    if (n > len - done) n = len - done;
+	    memcpy((Byte *) buf + done, s->pout + s->ppos, n);
+	    s->ppos += n;
+	    done += (unsigned) n;
+	}
+	s->out += done;
+	if (done < len && !s->pout && s->z_err == Z_OK) {
+	    /* fell back to serial reading */
+	    int res = R_gzread(file, (Byte *) buf + done, len - done);
+	    if (res > 0) done += res;
+	}
+	return (int) done;
+    }
+
     next_out = (Byte*) buf;
     s->stream.next_out = (Bytef*) buf;
     s->stream.avail_out = len;
@@ -388,12 +673,91 @@ char *R_gzgets(gzFile file, char *buf, int len)
 }
 
 
+#ifdef _OPENMP
+/* R ADDITION: inflate a BGZF file using nthreads threads, which must
+   be set before anything is read. */
+static int pgz_read_init (gz_stream *s, int nthreads)
+{
+    size_t cap = (size_t) nthreads * PGZ_MEMBERS, n;
+    Byte h[18];
+    Rz_off_t pos = f_tell(s->file);
+
+    if (s->transparent || s->out > 0 || pos < 0 ||
+	f_seek(s->file, 0, SEEK_SET)) return 1;
+    n = fread(h, 1, sizeof(h), s->file);
+    if (!bgzf_size(h, n) ||
+	!(s->pin = (Byte *) malloc(cap * BGZF_MAX)) ||
+	!(s->pout = (Byte *) malloc(cap * BGZF_MAX)) ||
+	!(s->psize = (size_t *) malloc(2 * cap * sizeof(size_t)))) {
+	free(s->pin); free(s->pout);
+	s->pin = s->pout = NULL;
+	f_seek(s->file, pos, SEEK_SET);
+	return 1;
+    }
+    f_seek(s->file, 0, SEEK_SET);
+    s->stream.avail_in = 0;
+    s->threads = nthreads;
+    return nthreads;
+}
+
+/* R ADDITION: compress using nthreads threads, which must be set
+   before anything is written, or inflate a BGZF file with them.
+   Returns the number used. */
+static int R_gzsetthreads (gzFile file, int nthreads)
+{
+    gz_stream *s = (gz_stream*) file;
+
+    if (s != NULL && s->mode == 'r' && nthreads > 1)
+	return pgz_read_init(s, nthreads);
+    if (s == NULL || s->mode != 'w' || s->in > 0 || nthreads < 2)
+	return 1;
+    s->pin = (Byte *) malloc((size_t) nthreads * PGZ_BLOCK);
+    if (!s->pin) return 1;
+    s->threads = nthreads;
+    return nthreads;
+}
+#endif
+
+/* R ADDITION: compress and write the input in s->pin */
+static int pgz_flush (gz_stream *s, int last)
+{
+    Bytef *out;
+    long n = R_pdeflate(s->pin, s->pcount, s->pdict, s->pdictlen,
+			s->level, s->strategy, last, s->threads, &out);
+
+    if (n < 0) return s->z_err = Z_STREAM_ERROR;
+    if (fwrite(out, 1, n, s->file) != (size_t) n) s->z_err = Z_ERRNO;
+    free(out);
+    s->out += n;
+    if (s->pcount >= PGZ_DICT) {
+	memcpy(s->pdict, s->pin + s->pcount - PGZ_DICT, PGZ_DICT);
+	s->pdictlen = PGZ_DICT;
+    }
+    s->pcount = 0;
+    return s->z_err;
+}
+
 static int R_gzwrite (gzFile file, voidpc buf, unsigned len)
 {
     gz_stream *s = (gz_stream*) file;
 
     if (s == NULL || s->mode != 'w') return Z_STREAM_ERROR;
 
+    if (s->pin) {
+	size_t cap = (size_t) s->threads * PGZ_BLOCK, done = 0;
+	while (done < len && s->z_err == Z_OK) {
+	    size_t this = len - done;
+	    if (this > cap - s->pcount) this = cap - s->pcount;
+	    memcpy(s->pin + s->pcount, (const Byte *) buf + done, this);
+	    s->pcount += this;
+	    done += this;
+	    if (s->pcount == cap) pgz_flush(s, 0);
+	}
+	s->in += done;
+	s->crc = crc32(s->crc, (const Bytef *) buf, (uInt) done);
+	return (int) done;
+    }
+
     s->stream.next_in = (Bytef*) buf;
     s->stream.avail_in = len;
 
@@ -472,6 +836,10 @@ static int int_gzrewind (gzFile file)
     if (!s->transparent) (void) inflateReset(&s->stream);
     s->in = 0;
     s->out = 0;
+    if (s->pout) { /* R ADDITION: see pgz_fill */
+	s->plen = s->ppos = 0;
+	return f_seek(s->file, 0, SEEK_SET);
+    }
     return f_seek(s->file, s->start, SEEK_SET);
 }
 
@@ -539,7 +907,10 @@ int R_gzclose (gzFile file)
     gz_stream *s = (gz_stream*) file;
     if (s == NULL) return Z_STREAM_ERROR;
     if (s->mode == 'w') {
-        if (gz_flush (file, Z_FINISH) != Z_OK) 
+	if (s->pin) {
+	    if (pgz_flush (s, 1) != Z_OK)
+		return destroy((gz_stream*) file);
+	} else if (gz_flush (file, Z_FINISH) != Z_OK)
 	    return destroy((gz_stream*) file);
         z_putLong (s->file, s->crc);
         z_putLong (s->file, (uLong) (s->in & 0xffffffff));
@@ -74,6 +74,19 @@ SEXP attribute_hidden do_identical(SEXP call, SEXP op, SEXP args, SEXP env)
     return ScalarLogical(R_compute_identical(x, y, flags));
 }
 
+/* Elements with the same bits are identical however numbers are
+   compared, and strings with the same CHARSXP are too, so blocks of
+   elements are compared with memcmp and only those of a block that
+   differs are gone through one by one. */
+#define IDENTICAL_BLOCK 1024
+#define FOR_DIFFERING_BLOCKS(i, n, xp, yp)				\
+    for(R_xlen_t __b__ = 0, __e__; __b__ < n; __b__ = __e__)		\
+	if((__e__ = n - __b__ < IDENTICAL_BLOCK ?			\
+	    n : __b__ + IDENTICAL_BLOCK),					\
+	   memcmp(xp + __b__, yp + __b__,				\
+		  (__e__ - __b__) * sizeof(*(xp))) == 0) ;		\
+	else for(R_xlen_t i = __b__; i < __e__; i++)
+
 #define NUM_EQ		(!(flags & 1))
 #define SINGLE_NA       (!(flags & 2))
 #define ATTR_AS_SET     (!(flags & 4))
@@ -101,6 +114,10 @@ R_compute_identical(SEXP x, SEXP y, int flags)
 	return Seql(x, y);
     }
 
+    /* vectors of different lengths differ whatever their attributes */
+    if(isVector(x) && XLENGTH(x) != XLENGTH(y))
+	return FALSE;
+
     ax = ATTRIB(x); ay = ATTRIB(y);
     if (!ATTR_AS_SET) {
 	if(!R_compute_identical(ax, ay, flags)) return FALSE;
@@ -120,29 +137,29 @@ R_compute_identical(SEXP x, SEXP y, int flags)
 	if(TYPEOF(ax) != LISTSXP || TYPEOF(ay) != LISTSXP) {
 	    warning(_("ignoring non-pairlist attributes"));
 	} else {
-	    SEXP elx, ely;
+	    SEXP elx, ely, from = ay;
 	    if(length(ax) != length(ay)) return FALSE;
-	    /* They are the same length and should have
-	       unique non-empty non-NA tags */
+	    /* They are the same length and should have unique
+	       non-empty non-NA tags, which are symbols and so equal
+	       only if they are the same.  They are usually in the same
+	       order, so each is looked for after the previous match. */
 	    for(elx = ax; elx != R_NilValue; elx = CDR(elx)) {
-		const char *tx = CHAR(PRINTNAME(TAG(elx)));
-		for(ely = ay; ely != R_NilValue; ely = CDR(ely))
-		    if(streql(tx, CHAR(PRINTNAME(TAG(ely))))) {
-			/* We need to treat row.names specially here */
-			if(streql(tx, "row.names")) {
-			    PROTECT(atrx = getAttrib(x, R_RowNamesSymbol));
-			    PROTECT(atry = getAttrib(y, R_RowNamesSymbol));
-			    if(!R_compute_identical(atrx, atry, flags)) {
-				UNPROTECT(2);
-				return FALSE;
-			    } else
-				UNPROTECT(2);
-			} else
-			    if(!R_compute_identical(CAR(elx), CAR(ely), flags))
-				return FALSE;
-			break;
-		    }
-		if(ely == R_NilValue) return FALSE;
+		SEXP tx = TAG(elx);
+		for(ely = from; TAG(ely) != tx; ) {
+		    ely = CDR(ely) == R_NilValue ? ay : CDR(ely);
+		    if(ely == from) return FALSE;
+		}
+		from = CDR(ely) == R_NilValue ? ay : CDR(ely);
+		if(R_compute_identical(CAR(elx), CAR(ely), flags))
+		    continue;
+		/* We need to treat row.names specially here: compact
+		   ones are identical to the integers they stand for */
+		if(tx != R_RowNamesSymbol) return FALSE;
+		PROTECT(atrx = getAttrib(x, R_RowNamesSymbol));
+		PROTECT(atry = getAttrib(y, R_RowNamesSymbol));
+		Rboolean same = R_compute_identical(atrx, atry, flags);
+		UNPROTECT(2);
+		if(!same) return FALSE;
 	    }
 	}
     }
@@ -166,7 +183,7 @@ R_compute_identical(SEXP x, SEXP y, int flags)
 	else {
 	    double *xp = REAL(x), *yp = REAL(y);
 	    int ne_strict = NUM_EQ | (SINGLE_NA << 1);
-	    for(R_xlen_t i = 0; i < n; i++)
+	    FOR_DIFFERING_BLOCKS(i, n, xp, yp)
 		if(neWithNaN(xp[i], yp[i], ne_strict)) return FALSE;
 	}
 	return TRUE;
@@ -178,7 +195,7 @@ R_compute_identical(SEXP x, SEXP y, int flags)
 	else {
 	    Rcomplex *xp = COMPLEX(x), *yp = COMPLEX(y);
 	    int ne_strict = NUM_EQ | (SINGLE_NA << 1);
-	    for(R_xlen_t i = 0; i < n; i++)
+	    FOR_DIFFERING_BLOCKS(i, n, xp, yp)
 		if(neWithNaN(xp[i].r, yp[i].r, ne_strict) ||
 		   neWithNaN(xp[i].i, yp[i].i, ne_strict))
 		    return FALSE;
@@ -187,9 +204,10 @@ R_compute_identical(SEXP x, SEXP y, int flags)
     }
     case STRSXP:
     {
-	R_xlen_t i, n = XLENGTH(x);
+	R_xlen_t n = XLENGTH(x);
+	SEXP *xp = STRING_PTR(x), *yp = STRING_PTR(y);
 	if(n != XLENGTH(y)) return FALSE;
-	for(i = 0; i < n; i++) {
+	FOR_DIFFERING_BLOCKS(i, n, xp, yp) {
 	    /* This special-casing for NAs is not needed */
 	    Rboolean na1 = (STRING_ELT(x, i) == NA_STRING),
 		na2 = (STRING_ELT(y, i) == NA_STRING);
@@ -29,6 +29,41 @@
 /* interval at which to check interrupts, a guess */
 // #define NINTERRUPT 10000000
 
+#if defined(_OPENMP) && _OPENMP >= 201307
+# define R_DO_PRAGMA(x) _Pragma(#x)
+# define R_OMP_SIMD R_DO_PRAGMA(omp simd)
+#else
+# define R_OMP_SIMD
+#endif
+
+/* Branch-free & and | of two logical values, for loops the compiler
+   can vectorize */
+#define AND_LANE(x1, x2)						\
+    ((((x1) == 0) | ((x2) == 0)) ? 0 :					\
+     ((((x1) == NA_LOGICAL) | ((x2) == NA_LOGICAL)) ? NA_LOGICAL : 1))
+#define OR_LANE(x1, x2)							\
+    (((((x1) != NA_LOGICAL) & ((x1) != 0)) |				\
+      (((x2) != NA_LOGICAL) & ((x2) != 0))) ? 1 :			\
+     ((((x1) == 0) & ((x2) == 0)) ? 0 : NA_LOGICAL))
+
+#define LOGIC_SIMD_LOOP(LANE) do {					\
+	int *pa = LOGICAL(ans), *px = LOGICAL(s1), *py = LOGICAL(s2);	\
+	if (n1 == n2) {							\
+	    R_OMP_SIMD							\
+	    for (i = 0; i < n; i++) pa[i] = LANE(px[i], py[i]);		\
+	}								\
+	else if (n2 == 1) {						\
+	    x2 = py[0];							\
+	    R_OMP_SIMD							\
+	    for (i = 0; i < n; i++) pa[i] = LANE(px[i], x2);		\
+	}								\
+	else {								\
+	    x1 = px[0];							\
+	    R_OMP_SIMD							\
+	    for (i = 0; i < n; i++) pa[i] = LANE(x1, py[i]);		\
+	}								\
+    } while (0)
+
 
 static SEXP lunary(SEXP, SEXP, SEXP);
 static SEXP lbinary(SEXP, SEXP, SEXP);
@@ -301,7 +336,24 @@ static SEXP binaryLogic(int code, SEXP s1, SEXP s2)
 	ans = allocVector(LGLSXP, 0);
 	return ans;
     }
-    ans = allocVector(LGLSXP, n);
+    /* An unshared operand without attributes is reused for the
+       result, so that a chain of comparisons and logical operators
+       needs fewer temporaries; the loops only read each element
+       before writing the same one. */
+    if (n == n1 && NO_REFERENCES(s1) && ATTRIB(s1) == R_NilValue)
+	ans = s1;
+    else if (n == n2 && NO_REFERENCES(s2) && ATTRIB(s2) == R_NilValue)
+	ans = s2;
+    else
+	ans = allocVector(LGLSXP, n);
+
+    if ((code == 1 || code == 2) && (n1 == n2 || n1 == 1 || n2 == 1)) {
+	if (code == 1)
+	    LOGIC_SIMD_LOOP(AND_LANE);
+	else
+	    LOGIC_SIMD_LOOP(OR_LANE);
+	return ans;
+    }
 
     switch (code) {
     case 1:		/* & : AND */
@@ -0,0 +1,615 @@
+/*
+ *  R : A Computer Language for Statistical Data Analysis
+ *  Copyright (C) 2026	The R Core Team.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, a copy is available at
+ *  https://www.R-project.org/Licenses/
+ */
+
+/* Loop kernels for the byte code engine.
+
+   A compiled for() loop over an integer sequence whose body only does
+   double precision arithmetic on scalar variables and on elements of
+   vectors indexed by the loop variable, such as
+
+       for (i in seq_along(x)) y[i] <- a * x[i] + y[i]
+
+   spends nearly all its time in instruction dispatch, variable lookup
+   and boxing.  When such a loop is started, R_RunLoopKernel translates
+   its body into a short sequence of typed instructions on unboxed
+   double registers, checks once that the variables have the types,
+   sizes and sharing the translation assumes, and runs the iterations:
+   the guards cannot fail later as the body can neither call functions
+   nor change the bindings or lengths of the vectors.  If anything does
+   not fit, nothing is done and bcEval runs the loop as usual.  A
+   pending interrupt ends the kernel early, and bcEval continues with
+   the remaining iterations.
+
+   The translation assumes the operators have their base definitions,
+   as the compiler does when it inlines them; loops in frames which
+   define any of them are left alone. */
+
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <Defn.h>
+#include "arithmetic.h"
+
+#define KERNEL_MIN_ITERATIONS 32
+#define KERNEL_MAX_CODE 64
+#define KERNEL_MAX_VARS 16
+#define KERNEL_MAX_REGS 64
+#define KERNEL_MAX_OPS 12
+
+/* register 0 holds the value of the loop variable */
+#define INDEX_REG 0
+
+typedef enum {
+    K_CONST,	/* r[dst] = val */
+    K_LOADR,	/* r[dst] = REAL(var)[i + off - 1] */
+    K_LOADI,	/* r[dst] = INTEGER(var)[i + off - 1], as a double */
+    K_STORE,	/* REAL(var)[i + off - 1] = r[a] */
+    K_MOVE,	/* r[dst] = r[a] */
+    K_NEG,
+    K_ADD,
+    K_SUB,
+    K_MUL,
+    K_DIV,
+    K_POW
+} kop_t;
+
+typedef struct {
+    kop_t op;
+    int dst, a, b, var, off;
+    double val;
+} kinstr_t;
+
+typedef struct {
+    SEXP sym, value, cell; /* cell is the local binding if written */
+    Rboolean vector, written;
+    int reg;			/* for scalars */
+    int minoff, maxoff;		/* for vectors */
+    void *data;
+} kvar_t;
+
+typedef struct {
+    SEXP lsym, rho;
+    int ncode, nvars, nregs, nops;
+    Rboolean wrote;
+    kinstr_t code[KERNEL_MAX_CODE];
+    kvar_t vars[KERNEL_MAX_VARS];
+    SEXP ops[KERNEL_MAX_OPS];
+} kernel_t;
+
+static SEXP R_AddSym = NULL;
+static SEXP R_SubSym, R_MulSym, R_DivSym, R_ExptSym, R_ParenSym;
+static SEXP R_AssignSym, R_EqAssignSym, R_SubassignSym, R_Subassign2Sym;
+
+static void initKernelSymbols(void)
+{
+    R_AddSym = install("+");
+    R_SubSym = install("-");
+    R_MulSym = install("*");
+    R_DivSym = install("/");
+    R_ExptSym = install("^");
+    R_ParenSym = install("(");
+    R_AssignSym = install("<-");
+    R_EqAssignSym = install("=");
+    R_SubassignSym = install("[<-");
+    R_Subassign2Sym = install("[[<-");
+}
+
+/* operand types */
+#define K_FAIL 0
+#define K_INT 1
+#define K_DBL 2
+
+static Rboolean noteOp(kernel_t *k, SEXP fun)
+{
+    for (int i = 0; i < k->nops; i++)
+	if (k->ops[i] == fun)
+	    return TRUE;
+    if (k->nops == KERNEL_MAX_OPS)
+	return FALSE;
+    k->ops[k->nops++] = fun;
+    return TRUE;
+}
+
+static kinstr_t *emit(kernel_t *k, kop_t op)
+{
+    if (k->ncode == KERNEL_MAX_CODE)
+	return NULL;
+    kinstr_t *c = k->code + k->ncode++;
+    memset(c, 0, sizeof(kinstr_t));
+    c->op = op;
+    return c;
+}
+
+static int newReg(kernel_t *k)
+{
+    return k->nregs < KERNEL_MAX_REGS ? k->nregs++ : -1;
+}
+
+static SEXP kernelLookup(kernel_t *k, SEXP sym, SEXP rho);
+
+/* The value of promise 'p', or R_UnboundValue if it is not yet forced
+   and forcing it might do more than look up variables.  Promises are
+   only forced before any variable is written to, where this is not
+   distinguishable from forcing them in the first iteration. */
+static SEXP kernelPromiseValue(kernel_t *k, SEXP p)
+{
+    if (PRVALUE(p) != R_UnboundValue)
+	return PRVALUE(p);
+    if (k->wrote || PRSEEN(p))
+	return R_UnboundValue;
+    SEXP code = R_PromiseExpr(p), val;
+    switch (TYPEOF(code)) {
+    case PROMSXP:
+	/* as made for arguments passed on in ... */
+	val = kernelPromiseValue(k, code);
+	break;
+    case SYMSXP:
+	val = kernelLookup(k, code, PRENV(p));
+	if (val == R_MissingArg)
+	    val = R_UnboundValue;
+	break;
+    case LANGSXP:
+    case DOTSXP:
+    case BCODESXP:
+	val = R_UnboundValue;
+	break;
+    default:
+	val = code;
+    }
+    if (val == R_UnboundValue)
+	return val;
+    eval(p, R_BaseEnv);
+    return PRVALUE(p);
+}
+
+/* The value of 'sym' as findVar would find it, or R_UnboundValue if
+   finding it might run R code: active bindings, user databases and
+   promises as above. */
+static SEXP kernelLookup(kernel_t *k, SEXP sym, SEXP rho)
+{
+    SEXP value = R_UnboundValue;
+
+    for (; rho != R_EmptyEnv; rho = ENCLOS(rho)) {
+	if (rho == R_BaseEnv || rho == R_BaseNamespace) {
+	    if (IS_ACTIVE_BINDING(sym))
+		return R_UnboundValue;
+	    value = SYMVALUE(sym);
+	    break;
+	}
+	if (OBJECT(rho))
+	    return R_UnboundValue;
+	R_varloc_t loc = R_findVarLocInFrame(rho, sym);
+	if (! R_VARLOC_IS_NULL(loc)) {
+	    if (IS_ACTIVE_BINDING(loc.cell))
+		return R_UnboundValue;
+	    value = CAR(loc.cell);
+	    break;
+	}
+    }
+
+    if (TYPEOF(value) == PROMSXP)
+	value = kernelPromiseValue(k, value);
+    return value;
+}
+
+/* Find or add the variable 'sym' and return its index, or -1 if it
+   cannot be used the way asked for. */
+static int kernelVar(kernel_t *k, SEXP sym, Rboolean vector, Rboolean write)
+{
+    int i;
+    kvar_t *v = NULL;
+
+    if (sym == k->lsym)
+	return -1;
+    for (i = 0; i < k->nvars; i++)
+	if (k->vars[i].sym == sym) {
+	    v = k->vars + i;
+	    break;
+	}
+    if (v == NULL) {
+	if (k->nvars == KERNEL_MAX_VARS)
+	    return -1;
+	v = k->vars + k->nvars++;
+	memset(v, 0, sizeof(kvar_t));
+	v->sym = sym;
+	v->vector = vector;
+	v->minoff = INT_MAX;
+	v->maxoff = INT_MIN;
+	v->value = kernelLookup(k, sym, k->rho);
+	if (v->value == R_UnboundValue)
+	    return -1;
+	if (! vector && (v->reg = newReg(k)) < 0)
+	    return -1;
+    }
+    else if (v->vector != vector)
+	return -1;
+
+    SEXP x = v->value;
+    if (write && ! v->written) {
+	/* must be the same object in a local binding, possibly as the
+	   value of an argument; assignments replace the promise */
+	R_varloc_t loc = R_findVarLocInFrame(k->rho, sym);
+	if (R_VARLOC_IS_NULL(loc) ||
+	    BINDING_IS_LOCKED(loc.cell) || IS_ACTIVE_BINDING(loc.cell))
+	    return -1;
+	SEXP b = CAR(loc.cell);
+	if (b != x && ! (TYPEOF(b) == PROMSXP && PRVALUE(b) == x))
+	    return -1;
+	if (TYPEOF(x) != REALSXP || OBJECT(x))
+	    return -1;
+	if (! vector && (XLENGTH(x) != 1 || ATTRIB(x) != R_NilValue))
+	    return -1;
+	v->cell = loc.cell;
+	v->written = TRUE;
+    }
+    else if (! write) {
+	if (TYPEOF(x) != REALSXP && TYPEOF(x) != INTSXP)
+	    return -1;
+	/* as for the byte code fast paths, x[i] must not give a result
+	   with attributes */
+	if (vector ? ! (ATTRIB(x) == R_NilValue ||
+			(TAG(ATTRIB(x)) == R_DimSymbol &&
+			 CDR(ATTRIB(x)) == R_NilValue)) :
+	    (XLENGTH(x) != 1 || ATTRIB(x) != R_NilValue))
+	    return -1;
+    }
+    return (int) (v - k->vars);
+}
+
+/* an index expression: i, i + c, c + i or i - c for an integral
+   constant c; returns FALSE if 'e' is not of this form */
+static Rboolean kernelIndex(kernel_t *k, SEXP e, int *off)
+{
+    if (e == k->lsym) {
+	*off = 0;
+	return TRUE;
+    }
+    if (TYPEOF(e) == LANGSXP && CAR(e) == R_ParenSym &&
+	length(e) == 2 && noteOp(k, R_ParenSym))
+	return kernelIndex(k, CADR(e), off);
+    if (TYPEOF(e) != LANGSXP || length(e) != 3 ||
+	(CAR(e) != R_AddSym && CAR(e) != R_SubSym))
+	return FALSE;
+    SEXP x = CADR(e), y = CADDR(e);
+    if (CAR(e) == R_AddSym && y == k->lsym) {
+	y = x;
+	x = k->lsym;
+    }
+    if (x != k->lsym || XLENGTH(y) != 1 || ATTRIB(y) != R_NilValue)
+	return FALSE;
+    double c;
+    if (TYPEOF(y) == REALSXP)
+	c = REAL(y)[0];
+    else if (TYPEOF(y) == INTSXP && INTEGER(y)[0] != NA_INTEGER)
+	c = INTEGER(y)[0];
+    else
+	return FALSE;
+    if (c != (int) c || fabs(c) > 1e6)
+	return FALSE;
+    *off = CAR(e) == R_AddSym ? (int) c : - (int) c;
+    return noteOp(k, CAR(e));
+}
+
+/* x[ix] or x[[ix]] for a vector variable x */
+static Rboolean kernelElement(kernel_t *k, SEXP e, Rboolean write,
+			      int *var, int *off)
+{
+    if (TYPEOF(e) != LANGSXP ||
+	(CAR(e) != R_BracketSymbol && CAR(e) != R_Bracket2Symbol) ||
+	length(e) != 3 || TAG(CDR(e)) != R_NilValue ||
+	TAG(CDDR(e)) != R_NilValue || TYPEOF(CADR(e)) != SYMSXP)
+	return FALSE;
+    if (! kernelIndex(k, CADDR(e), off) || ! noteOp(k, CAR(e)))
+	return FALSE;
+    if ((*var = kernelVar(k, CADR(e), TRUE, write)) < 0)
+	return FALSE;
+    kvar_t *v = k->vars + *var;
+    if (*off < v->minoff) v->minoff = *off;
+    if (*off > v->maxoff) v->maxoff = *off;
+    return TRUE;
+}
+
+/* Translate expression 'e', placing its value in register *reg, and
+   return its type, or K_FAIL. */
+static int kernelExpr(kernel_t *k, SEXP e, int *reg)
+{
+    kinstr_t *c;
+
+    switch (TYPEOF(e)) {
+    case REALSXP:
+    case INTSXP:
+	if (XLENGTH(e) != 1 || ATTRIB(e) != R_NilValue)
+	    return K_FAIL;
+	if (TYPEOF(e) == INTSXP && INTEGER(e)[0] == NA_INTEGER)
+	    return K_FAIL;
+	if ((*reg = newReg(k)) < 0 || (c = emit(k, K_CONST)) == NULL)
+	    return K_FAIL;
+	c->dst = *reg;
+	c->val = TYPEOF(e) == REALSXP ? REAL(e)[0] : INTEGER(e)[0];
+	return TYPEOF(e) == REALSXP ? K_DBL : K_INT;
+    case SYMSXP:
+	if (e == k->lsym) {
+	    *reg = INDEX_REG;
+	    return K_INT;
+	}
+	else {
+	    int i = kernelVar(k, e, FALSE, FALSE);
+	    if (i < 0)
+		return K_FAIL;
+	    *reg = k->vars[i].reg;
+	    return TYPEOF(k->vars[i].value) == REALSXP ? K_DBL : K_INT;
+	}
+    case LANGSXP:
+	break;
+    default:
+	return K_FAIL;
+    }
+
+    SEXP fun = CAR(e);
+    int nargs = length(e) - 1;
+    int var, off, a, b, ta, tb;
+
+    if (fun == R_BracketSymbol || fun == R_Bracket2Symbol) {
+	if (! kernelElement(k, e, FALSE, &var, &off))
+	    return K_FAIL;
+	Rboolean real = TYPEOF(k->vars[var].value) == REALSXP;
+	if ((*reg = newReg(k)) < 0 ||
+	    (c = emit(k, real ? K_LOADR : K_LOADI)) == NULL)
+	    return K_FAIL;
+	c->dst = *reg;
+	c->var = var;
+	c->off = off;
+	return real ? K_DBL : K_INT;
+    }
+
+    if (TYPEOF(fun) != SYMSXP || nargs < 1 || nargs > 2 ||
+	TAG(CDR(e)) != R_NilValue ||
+	(nargs == 2 && TAG(CDDR(e)) != R_NilValue) || ! noteOp(k, fun))
+	return K_FAIL;
+
+    if (fun == R_ParenSym && nargs == 1)
+	return kernelExpr(k, CADR(e), reg);
+
+    if (nargs == 1) {
+	if (fun != R_AddSym && fun != R_SubSym)
+	    return K_FAIL;
+	if ((ta = kernelExpr(k, CADR(e), &a)) == K_FAIL)
+	    return K_FAIL;
+	if (fun == R_AddSym) {
+	    *reg = a;
+	    return ta;
+	}
+	if ((*reg = newReg(k)) < 0 || (c = emit(k, K_NEG)) == NULL)
+	    return K_FAIL;
+	c->dst = *reg;
+	c->a = a;
+	return ta;
+    }
+
+    kop_t op;
+    if (fun == R_AddSym) op = K_ADD;
+    else if (fun == R_SubSym) op = K_SUB;
+    else if (fun == R_MulSym) op = K_MUL;
+    else if (fun == R_DivSym) op = K_DIV;
+    else if (fun == R_ExptSym) op = K_POW;
+    else return K_FAIL;
+
+    if ((ta = kernelExpr(k, CADR(e), &a)) == K_FAIL ||
+	(tb = kernelExpr(k, CADDR(e), &b)) == K_FAIL)
+	return K_FAIL;
+    /* integer +, - and * give integer results, which can overflow */
+    if (ta == K_INT && tb == K_INT && op != K_DIV && op != K_POW)
+	return K_FAIL;
+    if ((*reg = newReg(k)) < 0 || (c = emit(k, op)) == NULL)
+	return K_FAIL;
+    c->dst = *reg;
+    c->a = a;
+    c->b = b;
+    return K_DBL;
+}
+
+static Rboolean kernelStatement(kernel_t *k, SEXP s)
+{
+    if (TYPEOF(s) != LANGSXP)
+	return FALSE;
+    SEXP fun = CAR(s);
+    if (fun == R_BraceSymbol) {
+	if (! noteOp(k, fun))
+	    return FALSE;
+	for (SEXP t = CDR(s); t != R_NilValue; t = CDR(t))
+	    if (! kernelStatement(k, CAR(t)))
+		return FALSE;
+	return TRUE;
+    }
+    if ((fun != R_AssignSym && fun != R_EqAssignSym) || length(s) != 3 ||
+	! noteOp(k, fun))
+	return FALSE;
+
+    SEXP lhs = CADR(s);
+    int reg, var, off;
+    if (kernelExpr(k, CADDR(s), &reg) != K_DBL)
+	return FALSE;
+    kinstr_t *c;
+    if (TYPEOF(lhs) == SYMSXP) {
+	if ((var = kernelVar(k, lhs, FALSE, TRUE)) < 0 ||
+	    (c = emit(k, K_MOVE)) == NULL)
+	    return FALSE;
+	c->dst = k->vars[var].reg;
+	c->a = reg;
+    }
+    else {
+	if (! kernelElement(k, lhs, TRUE, &var, &off))
+	    return FALSE;
+	/* `[<-` and `[[<-` on the left are part of the assignment */
+	if (! noteOp(k, CAR(lhs) == R_BracketSymbol ?
+		     R_SubassignSym : R_Subassign2Sym))
+	    return FALSE;
+	if ((c = emit(k, K_STORE)) == NULL)
+	    return FALSE;
+	c->var = var;
+	c->off = off;
+	c->a = reg;
+    }
+    k->wrote = TRUE;
+    return TRUE;
+}
+
+/* is any of the operators used defined in a function frame? */
+static Rboolean kernelOpsShadowed(kernel_t *k)
+{
+    for (SEXP env = k->rho;
+	 env != R_GlobalEnv && env != R_EmptyEnv && env != R_BaseEnv &&
+	     env != R_BaseNamespace && ! R_IsNamespaceEnv(env);
+	 env = ENCLOS(env))
+	for (int i = 0; i < k->nops; i++)
+	    if (findVarInFrame3(env, k->ops[i], FALSE) != R_UnboundValue)
+		return TRUE;
+    return FALSE;
+}
+
+/* Run the loop 'call' (for (sym in ...) body) in frame 'rho' over
+   'seq', an integer vector or, if 'iscompact', the two ends of a
+   compact sequence, with 'n' elements.  Returns the number of
+   iterations done, zero if the loop is not a kernel.  The loop
+   variable is left to the caller. */
+int attribute_hidden R_RunLoopKernel(SEXP call, SEXP rho, SEXP seq,
+				     Rboolean iscompact, int n)
+{
+    if (n < KERNEL_MIN_ITERATIONS || TYPEOF(seq) != INTSXP ||
+	length(call) != 4 || TYPEOF(CADR(call)) != SYMSXP ||
+	rho == R_BaseEnv || rho == R_BaseNamespace || OBJECT(rho))
+	return 0;
+    if (R_AddSym == NULL)
+	initKernelSymbols();
+
+    int lo, hi, n1 = 0, step = 1;
+    const int *pseq = NULL;
+    if (iscompact) {
+	n1 = INTEGER(seq)[0];
+	int n2 = INTEGER(seq)[1];
+	step = n1 <= n2 ? 1 : -1;
+	lo = n1 <= n2 ? n1 : n2;
+	hi = n1 <= n2 ? n2 : n1;
+    }
+    else {
+	pseq = INTEGER(seq);
+	lo = INT_MAX;
+	hi = INT_MIN;
+	for (int i = 0; i < n; i++) {
+	    if (pseq[i] == NA_INTEGER)
+		return 0;
+	    if (pseq[i] < lo) lo = pseq[i];
+	    if (pseq[i] > hi) hi = pseq[i];
+	}
+    }
+
+    kernel_t k;
+    k.lsym = CADR(call);
+    k.rho = rho;
+    k.ncode = k.nvars = k.nops = 0;
+    k.nregs = INDEX_REG + 1;
+    k.wrote = FALSE;
+    if (! kernelStatement(&k, CADDDR(call)) || ! k.wrote ||
+	kernelOpsShadowed(&k))
+	return 0;
+
+    /* bounds, and the data of the vectors: written vectors which may be
+       shared are duplicated now rather than on the first assignment */
+    for (int i = 0; i < k.nvars; i++) {
+	kvar_t *v = k.vars + i;
+	if (! v->vector)
+	    continue;
+	if ((double) lo + v->minoff < 1 ||
+	    (double) hi + v->maxoff > XLENGTH(v->value))
+	    return 0;
+    }
+    for (int i = 0; i < k.nvars; i++) {
+	kvar_t *v = k.vars + i;
+	if (v->vector && v->written &&
+	    (MAYBE_SHARED(v->value) || CAR(v->cell) != v->value)) {
+	    v->value = duplicate(v->value);
+	    SETCAR(v->cell, v->value);
+	}
+	if (v->vector)
+	    v->data = TYPEOF(v->value) == REALSXP ?
+		(void *) REAL(v->value) : (void *) INTEGER(v->value);
+    }
+
+    double r[KERNEL_MAX_REGS];
+    for (int i = 0; i < k.nvars; i++) {
+	kvar_t *v = k.vars + i;
+	if (! v->vector)
+	    r[v->reg] = TYPEOF(v->value) == REALSXP ? REAL(v->value)[0] :
+		INTEGER(v->value)[0] == NA_INTEGER ? NA_REAL :
+		INTEGER(v->value)[0];
+    }
+
+    int done;
+    for (done = 0; done < n; done++) {
+	int iv = iscompact ? n1 + step * done : pseq[done];
+	r[INDEX_REG] = iv;
+	for (kinstr_t *c = k.code, *end = k.code + k.ncode; c < end; c++) {
+	    R_xlen_t ix;
+	    int ival;
+	    switch (c->op) {
+	    case K_CONST: r[c->dst] = c->val; break;
+	    case K_LOADR:
+		ix = (R_xlen_t) iv + c->off - 1;
+		r[c->dst] = ((double *) k.vars[c->var].data)[ix];
+		break;
+	    case K_LOADI:
+		ix = (R_xlen_t) iv + c->off - 1;
+		ival = ((int *) k.vars[c->var].data)[ix];
+		r[c->dst] = ival == NA_INTEGER ? NA_REAL : ival;
+		break;
+	    case K_STORE:
+		ix = (R_xlen_t) iv + c->off - 1;
+		((double *) k.vars[c->var].data)[ix] = r[c->a];
+		break;
+	    case K_MOVE: r[c->dst] = r[c->a]; break;
+	    case K_NEG: r[c->dst] = - r[c->a]; break;
+	    case K_ADD: r[c->dst] = r[c->a] + r[c->b]; break;
+	    case K_SUB: r[c->dst] = r[c->a] - r[c->b]; break;
+	    case K_MUL: r[c->dst] = r[c->a] * r[c->b]; break;
+	    case K_DIV: r[c->dst] = r[c->a] / r[c->b]; break;
+	    case K_POW: r[c->dst] = R_POW(r[c->a], r[c->b]); break;
+	    }
+	}
+	/* leave the interrupt, and the rest of the loop, to bcEval */
+	if (R_interrupts_pending) {
+	    done++;
+	    break;
+	}
+    }
+
+    /* store the scalars */
+    for (int i = 0; i < k.nvars; i++) {
+	kvar_t *v = k.vars + i;
+	if (v->vector || ! v->written)
+	    continue;
+	if (NOT_SHARED(v->value) && CAR(v->cell) == v->value)
+	    REAL(v->value)[0] = r[v->reg];
+	else {
+	    SEXP val = ScalarReal(r[v->reg]);
+	    SETCAR(v->cell, val);
+	}
+    }
+    return done;
+}
@@ -847,9 +847,14 @@ void setup_Rmainloop(void)
     R_Toplevel.sysparent = R_BaseEnv;
     R_Toplevel.conexit = R_NilValue;
     R_Toplevel.vmax = NULL;
+    R_Toplevel.arenamark = NULL;
     R_Toplevel.nodestack = R_BCNodeStackTop;
 #ifdef BC_INT_STACK
     R_Toplevel.intstack = R_BCIntStackTop;
+#endif
+#ifdef R_MEMORY_PROFILING
+    R_Toplevel.bcpc = NULL;
+    R_Toplevel.bcbody = NULL;
 #endif
     R_Toplevel.cend = NULL;
     R_Toplevel.cenddata = NULL;
@@ -184,7 +184,14 @@ SEXP attribute_hidden matchArgExact(SEXP tag, SEXP * list)
 /* MULTIPLE_MATCHES was added by RI in Jan 2005 but never activated:
    code in R-2-8-branch */
 
-SEXP attribute_hidden matchArgs(SEXP formals, SEXP supplied, SEXP call)
+/* If 'fmap' is not NULL, the index in 'supplied' of the argument
+   matched to each formal is recorded there, MATCH_NONE for an
+   unmatched formal and MATCH_DOTS for a ... formal. */
+#define MATCH_NONE -1
+#define MATCH_DOTS -2
+
+static SEXP matchArgs_int(SEXP formals, SEXP supplied, SEXP call,
+			  signed char *fmap)
 {
     Rboolean seendots;
     int i, arg_i = 0;
@@ -233,6 +240,7 @@ SEXP attribute_hidden matchArgs(SEXP formals, SEXP supplied, SEXP call)
 		    if(CAR(b) != R_MissingArg) SET_MISSING(a, 0);
 		    SET_ARGUSED(b, 2);
 		    fargused[arg_i] = 2;
+		    if (fmap) fmap[arg_i] = (signed char) (i - 1);
 		}
 	    }
 	}
@@ -256,6 +264,7 @@ SEXP attribute_hidden matchArgs(SEXP formals, SEXP supplied, SEXP call)
 		/* Record where ... value goes */
 		dots = a;
 		seendots = TRUE;
+		if (fmap) fmap[arg_i] = MATCH_DOTS;
 	    } else {
 		for (b = supplied, i = 1; b != R_NilValue; b = CDR(b), i++) {
 		    if (ARGUSED(b) != 2 && TAG(b) != R_NilValue &&
@@ -275,6 +284,7 @@ SEXP attribute_hidden matchArgs(SEXP formals, SEXP supplied, SEXP call)
 			if (CAR(b) != R_MissingArg) SET_MISSING(a, 0);
 			SET_ARGUSED(b, 1);
 			fargused[arg_i] = 1;
+			if (fmap) fmap[arg_i] = (signed char) (i - 1);
 		    }
 		}
 	    }
@@ -295,6 +305,8 @@ SEXP attribute_hidden matchArgs(SEXP formals, SEXP supplied, SEXP call)
     a = actuals;
     b = supplied;
     seendots = FALSE;
+    arg_i = 0;
+    i = 0;
 
     while (f != R_NilValue && b != R_NilValue && !seendots) {
 	if (TAG(f) == R_DotsSymbol) {
@@ -302,11 +314,13 @@ SEXP attribute_hidden matchArgs(SEXP formals, SEXP supplied, SEXP call)
 	    seendots = TRUE;
 	    f = CDR(f);
 	    a = CDR(a);
+	    arg_i++;
 	} else if (CAR(a) != R_MissingArg) {
 	    /* Already matched by tag */
 	    /* skip to next formal */
 	    f = CDR(f);
 	    a = CDR(a);
+	    arg_i++;
 	} else if (ARGUSED(b) || TAG(b) != R_NilValue) {
 	    /* This value used or tagged , skip to next value */
 	    /* The second test above is needed because we */
@@ -314,14 +328,18 @@ SEXP attribute_hidden matchArgs(SEXP formals, SEXP supplied, SEXP call)
 	    /* matches. */
 	    /* The formal being considered remains the same */
 	    b = CDR(b);
+	    i++;
 	} else {
 	    /* We have a positional match */
 	    SETCAR(a, CAR(b));
 	    if(CAR(b) != R_MissingArg) SET_MISSING(a, 0);
 	    SET_ARGUSED(b, 1);
+	    if (fmap) fmap[arg_i] = (signed char) i;
 	    b = CDR(b);
+	    i++;
 	    f = CDR(f);
 	    a = CDR(a);
+	    arg_i++;
 	}
     }
 
@@ -387,6 +405,170 @@ SEXP attribute_hidden matchArgs(SEXP formals, SEXP supplied, SEXP call)
     return(actuals);
 }
 
+SEXP attribute_hidden matchArgs(SEXP formals, SEXP supplied, SEXP call)
+{
+    return matchArgs_int(formals, supplied, call, NULL);
+}
+
+
+/* matchArgsCached is matchArgs for closure calls.  The result of
+   matching depends only on the tags of the formals and of the
+   supplied arguments, so it is recorded as a plan mapping each formal
+   to the supplied argument it gets.  The plan is kept with the formals
+   (held in a preserved vector, so they can be compared by address)
+   and the supplied tags (symbols, which are never collected).  With a
+   matching plan the actuals are built in a single pass.
+
+   Plans are looked up first by call site, which almost always calls
+   the same function with the same tags, and then by the formals of
+   the closure, which catches calls from sites with no stable call
+   (do.call, method dispatch) or calling many functions.  The call and
+   the formals only pick a slot: keys sharing a slot just cause
+   misses.  Matches that raised a warning, or could, are not cached. */
+
+#define MATCH_CACHE_SIZE 512
+#define MATCH_CACHE_MAX_FORMALS 32
+#define MATCH_CACHE_MAX_SUPPLIED 16
+
+typedef struct {
+    SEXP key; /* the call, or the formals */
+    int nformals, nsupplied;
+    unsigned int used; /* supplied args matched to named formals */
+    SEXP tags[MATCH_CACHE_MAX_SUPPLIED];
+    signed char fmap[MATCH_CACHE_MAX_FORMALS];
+} match_plan_t;
+
+/* by call site, then by formals; the formals of each entry are in the
+   corresponding element of match_cache_formals */
+static match_plan_t match_cache[2 * MATCH_CACHE_SIZE];
+static SEXP match_cache_formals = NULL;
+
+static R_INLINE int match_cache_slot(SEXP key)
+{
+    return (int) (((uintptr_t) key >> 4) % MATCH_CACHE_SIZE);
+}
+
+static R_INLINE Rboolean planMatches(int slot, SEXP key, SEXP formals,
+				     SEXP supplied, int nsupplied)
+{
+    match_plan_t *e = match_cache + slot;
+    if (e->key != key || e->nsupplied != nsupplied ||
+	VECTOR_ELT(match_cache_formals, slot) != formals)
+	return FALSE;
+    int i = 0;
+    for (SEXP b = supplied; b != R_NilValue; b = CDR(b), i++)
+	if (TAG(b) != e->tags[i])
+	    return FALSE;
+    return TRUE;
+}
+
+static R_INLINE void storePlan(int slot, SEXP key, SEXP formals,
+			       match_plan_t *plan)
+{
+    match_cache[slot] = *plan;
+    match_cache[slot].key = key;
+    SET_VECTOR_ELT(match_cache_formals, slot, formals);
+}
+
+static SEXP replayMatch(match_plan_t *e, SEXP supplied)
+{
+    SEXP sv[MATCH_CACHE_MAX_SUPPLIED], a, b, actuals = R_NilValue;
+    int i, ndots = 0;
+
+    for (b = supplied, i = 0; b != R_NilValue; b = CDR(b), i++) {
+	sv[i] = b;
+	if ((e->used >> i) & 1)
+	    SET_ARGUSED(b, 1);
+	else {
+	    SET_ARGUSED(b, 0);
+	    ndots++;
+	}
+    }
+
+    for (i = 0; i < e->nformals; i++) {
+	actuals = CONS_NR(R_MissingArg, actuals);
+	SET_MISSING(actuals, 1);
+    }
+    PROTECT(actuals);
+
+    for (a = actuals, i = 0; a != R_NilValue; a = CDR(a), i++) {
+	int k = e->fmap[i];
+	if (k >= 0) {
+	    SETCAR(a, CAR(sv[k]));
+	    if (CAR(sv[k]) != R_MissingArg) SET_MISSING(a, 0);
+	}
+	else if (k == MATCH_DOTS) {
+	    SET_MISSING(a, 0);
+	    if (ndots) {
+		SEXP d = allocList(ndots), f = d;
+		SET_TYPEOF(d, DOTSXP);
+		for (b = supplied; b != R_NilValue; b = CDR(b))
+		    if (! ARGUSED(b)) {
+			SETCAR(f, CAR(b));
+			SET_TAG(f, TAG(b));
+			f = CDR(f);
+		    }
+		SETCAR(a, d);
+	    }
+	}
+    }
+    UNPROTECT(1);
+    return actuals;
+}
+
+SEXP attribute_hidden matchArgsCached(SEXP formals, SEXP supplied, SEXP call)
+{
+    int nformals = 0, nsupplied = 0, i;
+    SEXP f, b;
+    match_plan_t plan;
+
+    if (R_warn_partial_match_args)
+	return matchArgs(formals, supplied, call);
+
+    for (f = formals; f != R_NilValue; f = CDR(f))
+	if (++nformals > MATCH_CACHE_MAX_FORMALS)
+	    return matchArgs(formals, supplied, call);
+    for (b = supplied; b != R_NilValue; b = CDR(b))
+	if (++nsupplied > MATCH_CACHE_MAX_SUPPLIED)
+	    return matchArgs(formals, supplied, call);
+
+    if (match_cache_formals == NULL) {
+	match_cache_formals = allocVector(VECSXP, 2 * MATCH_CACHE_SIZE);
+	R_PreserveObject(match_cache_formals);
+    }
+
+    /* plans are copied out, as finalizers run by an allocation in
+       replayMatch may reuse the slots */
+    int site = match_cache_slot(call);
+    if (planMatches(site, call, formals, supplied, nsupplied)) {
+	plan = match_cache[site];
+	return replayMatch(&plan, supplied);
+    }
+    int fslot = MATCH_CACHE_SIZE + match_cache_slot(formals);
+    if (planMatches(fslot, formals, formals, supplied, nsupplied)) {
+	plan = match_cache[fslot];
+	storePlan(site, call, formals, &plan);
+	return replayMatch(&plan, supplied);
+    }
+
+    for (i = 0; i < nformals; i++)
+	plan.fmap[i] = MATCH_NONE;
+    SEXP actuals = matchArgs_int(formals, supplied, call, plan.fmap);
+
+    /* matching succeeded: record the plan */
+    plan.nformals = nformals;
+    plan.nsupplied = nsupplied;
+    plan.used = 0;
+    for (b = supplied, i = 0; b != R_NilValue; b = CDR(b), i++) {
+	plan.tags[i] = TAG(b);
+	if (ARGUSED(b))
+	    plan.used |= 1U << i;
+    }
+    storePlan(site, call, formals, &plan);
+    storePlan(fslot, formals, formals, &plan);
+    return actuals;
+}
+
 
 /* patchArgsByActuals - patch promargs (given as 'supplied') to be promises
    for the respective actuals in the given environment 'cloenv'.  This is
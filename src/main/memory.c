@@ -1,7 +1,7 @@
 /*
  *  R : A Computer Language for Statistical Data Analysis
  *  Copyright (C) 1995, 1996  Robert Gentleman and Ross Ihaka
- *  Copyright (C) 1998--2015  The R Core Team.
+ *  Copyright (C) 1998--2017  The R Core Team.
  *
  *  This program is free software; you can redistribute it and/or modify
  *  it under the terms of the GNU General Public License as published by
@@ -237,6 +237,19 @@ static Rboolean gc_inhibit_release = FALSE;
 #ifdef R_MEMORY_PROFILING
 static void R_ReportAllocation(R_size_t);
 static void R_ReportNewPage();
+
+/* Sampling of all allocations by Rprofmem(interval = ): one node is
+   sampled each time the total size allocated reaches the interval. */
+static R_size_t R_MemSampleInterval = R_SIZE_T_MAX;
+static R_size_t R_MemSampleBytes = 0;
+static void R_SampleAllocation(SEXP, R_size_t);
+static void R_SweepMemSamples(void);
+# define SAMPLE_ALLOCATION(s, size) do { \
+    if ((R_MemSampleBytes += (size)) >= R_MemSampleInterval) \
+	R_SampleAllocation(s, size); \
+} while (0)
+#else
+# define SAMPLE_ALLOCATION(s, size) do {} while (0)
 #endif
 
 #define GC_PROT(X) do { \
@@ -268,18 +281,22 @@ static SEXPREC UnmarkedNodeTemplate;
    memory; much less frequent releasing and larger increments to
    increase speed). */
 
-/* There are three levels of collections.  Level 0 collects only the
-   youngest generation, level 1 collects the two youngest generations,
-   and level 2 collects all generations.  Higher level collections
-   occur at least after specified numbers of lower level ones.  After
-   LEVEL_0_FREQ level zero collections a level 1 collection is done;
-   after every LEVEL_1_FREQ level 1 collections a level 2 collection
-   occurs.  Thus, roughly, every LEVEL_0_FREQ-th collection is a level
-   1 collection and every (LEVEL_0_FREQ * LEVEL_1_FREQ)-th collection
-   is a level 2 collection.  */
+/* With the default of two old generations there are three levels of
+   collections.  Level 0 collects only the youngest generation, level
+   1 collects the two youngest generations, and level 2 collects all
+   generations.  Higher level collections occur at least after
+   specified numbers of lower level ones.  After LEVEL_0_FREQ level
+   zero collections a level 1 collection is done; after every
+   LEVEL_1_FREQ level 1 collections a level 2 collection occurs.
+   Thus, roughly, every LEVEL_0_FREQ-th collection is a level 1
+   collection and every (LEVEL_0_FREQ * LEVEL_1_FREQ)-th collection is
+   a level 2 collection.  When a third old generation is enabled (see
+   init_gc_generation_settings) a level 3 collection, the only full
+   one, is done after every LEVEL_2_FREQ level 2 collections. */
 #define LEVEL_0_FREQ 20
 #define LEVEL_1_FREQ 5
-static int collect_counts_max[] = { LEVEL_0_FREQ, LEVEL_1_FREQ };
+#define LEVEL_2_FREQ 5
+static int collect_counts_max[] = { LEVEL_0_FREQ, LEVEL_1_FREQ, LEVEL_2_FREQ };
 
 /* When a level N collection fails to produce at least MinFreeFrac *
    R_NSize free nodes and MinFreeFrac * R_VSize free vector space, the
@@ -462,6 +479,9 @@ static R_size_t R_V_maxused=0;
 #if NUM_NODE_CLASSES > 8
 # error NUM_NODE_CLASSES must be at most 8
 #endif
+#if NUM_NODE_CLASSES != R_GC_EVENT_CLASSES
+# error R_GC_EVENT_CLASSES in R_ext/Memory.h must match NUM_NODE_CLASSES
+#endif
 
 #define LARGE_NODE_CLASS  (NUM_NODE_CLASSES - 1)
 #define CUSTOM_NODE_CLASS (NUM_NODE_CLASSES - 2)
@@ -470,22 +490,43 @@ static R_size_t R_V_maxused=0;
 /* the number of VECREC's in nodes of the small node classes */
 static int NodeClassSize[NUM_SMALL_NODE_CLASSES] = { 0, 1, 2, 4, 8, 16 };
 
+/* The small node class used for a vector of a given size in VECREC
+   units, so allocVector need not search NodeClassSize.  Size zero
+   vectors get a class 1 node, as for size one. */
+#define SMALL_VEC_MAX_SIZE 16
+static const char SizeNodeClass[SMALL_VEC_MAX_SIZE + 1] = {
+    1, 1, 2, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 5, 5, 5, 5
+};
+
 #define NODE_CLASS(s) ((s)->sxpinfo.gccls)
 #define SET_NODE_CLASS(s,v) (((s)->sxpinfo.gccls) = (v))
 
 
-/* Node Generations. */
+/* Node Generations.  Space is reserved for MAX_NUM_OLD_GENERATIONS
+   old generations; the number actually used, num_old_generations, is
+   set at start-up.  A node in old generation g that survives a
+   collection of that generation is normally promoted to generation g
+   + 1.  Setting promotion_age[g] to a value k > 1 instead keeps it in
+   generation g until it has survived k such collections, so that
+   medium-lived objects do not end up in the oldest generation where
+   they can only be reclaimed by a full collection.  The age is kept
+   in the sxpinfo gcage field. */
 
-#define NUM_OLD_GENERATIONS 2
+#define MAX_NUM_OLD_GENERATIONS 3
 
-/* sxpinfo allocates one bit for the old generation count, so only 1
-   or 2 is allowed */
-#if NUM_OLD_GENERATIONS > 2 || NUM_OLD_GENERATIONS < 1
-# error number of old generations must be 1 or 2
+/* sxpinfo allocates two bits for the old generation count, so at most
+   4 are possible; collect_counts_max provides settings for 3 */
+#if MAX_NUM_OLD_GENERATIONS > 3 || MAX_NUM_OLD_GENERATIONS < 1
+# error number of old generations must be between 1 and 3
 #endif
 
+/* sxpinfo allocates three bits for the age */
+#define MAX_PROMOTION_AGE 8
+
 #define NODE_GENERATION(s) ((s)->sxpinfo.gcgen)
 #define SET_NODE_GENERATION(s,g) ((s)->sxpinfo.gcgen=(g))
+#define NODE_AGE(s) ((s)->sxpinfo.gcage)
+#define SET_NODE_AGE(s,a) ((s)->sxpinfo.gcage=(a))
 
 #define NODE_GEN_IS_YOUNGER(s,g) \
   (! NODE_IS_MARKED(s) || NODE_GENERATION(s) < (g))
@@ -493,9 +534,56 @@ static int NodeClassSize[NUM_SMALL_NODE_CLASSES] = { 0, 1, 2, 4, 8, 16 };
   (NODE_IS_MARKED(x) && \
    (! NODE_IS_MARKED(y) || NODE_GENERATION(x) > NODE_GENERATION(y)))
 
+static int num_old_generations = 2;
+static int promotion_age[MAX_NUM_OLD_GENERATIONS] = { 1, 1, 1 };
+static Rboolean gc_age_promotion = FALSE; /* some promotion_age[g] > 1 */
+
 static int num_old_gens_to_collect = 0;
-static int gen_gc_counts[NUM_OLD_GENERATIONS + 1];
-static int collect_counts[NUM_OLD_GENERATIONS];
+static int gen_gc_counts[MAX_NUM_OLD_GENERATIONS + 1];
+static int collect_counts[MAX_NUM_OLD_GENERATIONS];
+
+/* The number of old generations and the ages at which nodes are
+   promoted can be set by environment variables read at start-up.
+   R_GC_NUM_OLD_GENS is 1, 2 (the default) or 3.  R_GC_PROMOTE_AGE is
+   a comma-separated list giving for each old generation but the
+   oldest the number of collections of that generation a node must
+   survive before it is promoted; a single value is used for all
+   generations. */
+static void init_gc_generation_settings()
+{
+    char *arg;
+    int gen;
+
+    arg = getenv("R_GC_NUM_OLD_GENS");
+    if (arg != NULL) {
+	int n = atoi(arg);
+	if (1 <= n && n <= MAX_NUM_OLD_GENERATIONS)
+	    num_old_generations = n;
+    }
+
+    arg = getenv("R_GC_PROMOTE_AGE");
+    if (arg != NULL) {
+	char *p = arg, *endp;
+	int age = 1;
+	for (gen = 0; gen < MAX_NUM_OLD_GENERATIONS - 1; gen++) {
+	    if (*p) {
+		long val = strtol(p, &endp, 10);
+		if (endp == p)
+		    break;
+		if (1 <= val && val <= MAX_PROMOTION_AGE)
+		    age = (int) val;
+		p = (*endp == ',') ? endp + 1 : endp;
+	    }
+	    promotion_age[gen] = age;
+	}
+    }
+
+#ifndef EXPEL_OLD_TO_NEW
+    for (gen = 0; gen < num_old_generations - 1; gen++)
+	if (promotion_age[gen] > 1)
+	    gc_age_promotion = TRUE;
+#endif
+}
 
 
 /* Node Pages.  Non-vector nodes and small vector nodes are allocated
@@ -548,13 +636,14 @@ typedef union PAGE_HEADER {
    both counts.*/
 /*#define EXPEL_OLD_TO_NEW*/
 static struct {
-    SEXP Old[NUM_OLD_GENERATIONS], New, Free;
-    SEXPREC OldPeg[NUM_OLD_GENERATIONS], NewPeg;
+    SEXP Old[MAX_NUM_OLD_GENERATIONS], New, Free;
+    SEXPREC OldPeg[MAX_NUM_OLD_GENERATIONS], NewPeg;
 #ifndef EXPEL_OLD_TO_NEW
-    SEXP OldToNew[NUM_OLD_GENERATIONS];
-    SEXPREC OldToNewPeg[NUM_OLD_GENERATIONS];
+    SEXP OldToNew[MAX_NUM_OLD_GENERATIONS];
+    SEXPREC OldToNewPeg[MAX_NUM_OLD_GENERATIONS];
 #endif
-    int OldCount[NUM_OLD_GENERATIONS], AllocCount, PageCount;
+    int OldCount[MAX_NUM_OLD_GENERATIONS], AllocCount, PageCount;
+    int InUse; /* nodes allocated and not known to be free */
     PAGE_HEADER *pages;
 } R_GenHeap[NUM_NODE_CLASSES];
 
@@ -716,6 +805,15 @@ static R_size_t R_NodesInUse = 0;
 
 /* Node Allocation. */
 
+/* Free nodes are taken from the front of the New list.  The header of
+   the next free node is fetched ahead of time, since it will be
+   written by the next allocation of its class. */
+#if defined(__GNUC__)
+# define PREFETCH_NODE(s) __builtin_prefetch(s, 1, 3)
+#else
+# define PREFETCH_NODE(s)
+#endif
+
 #define CLASS_GET_FREE_NODE(c,s) do { \
   SEXP __n__ = R_GenHeap[c].Free; \
   if (__n__ == R_GenHeap[c].New) { \
@@ -723,7 +821,10 @@ static R_size_t R_NodesInUse = 0;
     __n__ = R_GenHeap[c].Free; \
   } \
   R_GenHeap[c].Free = NEXT_NODE(__n__); \
+  PREFETCH_NODE(R_GenHeap[c].Free); \
+  R_GenHeap[c].InUse++; \
   R_NodesInUse++; \
+  SAMPLE_ALLOCATION(__n__, NODE_SIZE(c)); \
   (s) = __n__; \
 } while (0)
 
@@ -756,7 +857,7 @@ static void DEBUG_CHECK_NODE_COUNTS(char *where)
 		REprintf("Inconsistent class assignment for node!\n");
 	}
 	for (gen = 0, OldCount = 0, OldToNewCount = 0;
-	     gen < NUM_OLD_GENERATIONS;
+	     gen < num_old_generations;
 	     gen++) {
 	    for (s = NEXT_NODE(R_GenHeap[i].Old[gen]);
 		 s != R_GenHeap[i].Old[gen];
@@ -791,7 +892,7 @@ static void DEBUG_GC_SUMMARY(int full_gc)
     REprintf("\n%s, VSize = %lu", full_gc ? "Full" : "Minor",
 	     R_SmallVallocSize + R_LargeVallocSize);
     for (i = 1; i < NUM_NODE_CLASSES; i++) {
-	for (gen = 0, OldCount = 0; gen < NUM_OLD_GENERATIONS; gen++)
+	for (gen = 0, OldCount = 0; gen < num_old_generations; gen++)
 	    OldCount += R_GenHeap[i].OldCount[gen];
 	REprintf(", class %d: %d", i, OldCount);
     }
@@ -826,7 +927,7 @@ static void DEBUG_RELEASE_PRINT(int rel_pages, int maxrel_pages, int i)
 	int gen, n;
 	REprintf("Class: %d, pages = %d, maxrel = %d, released = %d\n", i,
 		 R_GenHeap[i].PageCount, maxrel_pages, rel_pages);
-	for (gen = 0, n = 0; gen < NUM_OLD_GENERATIONS; gen++)
+	for (gen = 0, n = 0; gen < num_old_generations; gen++)
 	    n += R_GenHeap[i].OldCount[gen];
 	REprintf("Allocated = %d, in use = %d\n", R_GenHeap[i].AllocCount, n);
     }
@@ -927,7 +1028,7 @@ static void TryToReleasePages(void)
 	    int maxrel, maxrel_pages, rel_pages, gen;
 
 	    maxrel = R_GenHeap[i].AllocCount;
-	    for (gen = 0; gen < NUM_OLD_GENERATIONS; gen++)
+	    for (gen = 0; gen < num_old_generations; gen++)
 		maxrel -= (1.0 + R_MaxKeepFrac) * R_GenHeap[i].OldCount[gen];
 	    maxrel_pages = maxrel > 0 ? maxrel / page_count : 0;
 
@@ -965,10 +1066,104 @@ static void TryToReleasePages(void)
     else release_count--;
 }
 
+/* Page Compaction.  Nodes cannot be moved, as compiled code holds
+   pointers to them that the collector does not know about.  Instead,
+   for gc(compact = TRUE), every page with no live nodes is released
+   and the free list is rebuilt with the free nodes of the fullest
+   pages first.  Sparsely used pages are then the last to be allocated
+   from, and so are likely to have emptied and be released by later
+   collections.  This must follow a full collection: as for SortNodes,
+   the live nodes are then exactly the marked ones. */
+
+#if defined(__GLIBC__)
+# include <malloc.h> /* for malloc_trim */
+#endif
+
+static Rboolean gc_compact_requested = FALSE;
+
+typedef struct {
+    PAGE_HEADER *page;
+    int live;
+} PAGE_USE;
+
+static int page_use_cmp(const void *a, const void *b)
+{
+    return ((const PAGE_USE *) b)->live - ((const PAGE_USE *) a)->live;
+}
+
+static void CompactPages(void)
+{
+    SEXP s;
+    int i;
+
+    for (i = 0; i < NUM_SMALL_NODE_CLASSES; i++) {
+	PAGE_HEADER *page, *next, **last;
+	PAGE_USE *use;
+	int node_size = NODE_SIZE(i);
+	int page_count = (R_PAGE_SIZE - sizeof(PAGE_HEADER)) / node_size;
+	int j, k, npages = 0;
+
+	for (page = R_GenHeap[i].pages, last = &R_GenHeap[i].pages;
+	     page != NULL; page = next) {
+	    char *data = PAGE_DATA(page);
+	    int live = 0;
+
+	    next = page->next;
+	    for (j = 0; j < page_count; j++, data += node_size)
+		if (NODE_IS_MARKED((SEXP) data)) {
+		    live = 1;
+		    break;
+		}
+	    if (live) {
+		*last = page;
+		last = &page->next;
+		npages++;
+	    }
+	    else ReleasePage(page, i);
+	}
+	*last = NULL;
+
+	use = npages > 0 ? malloc(npages * sizeof(PAGE_USE)) : NULL;
+	if (use != NULL) {
+	    for (page = R_GenHeap[i].pages, k = 0; page != NULL;
+		 page = page->next, k++) {
+		char *data = PAGE_DATA(page);
+		use[k].page = page;
+		use[k].live = 0;
+		for (j = 0; j < page_count; j++, data += node_size)
+		    if (NODE_IS_MARKED((SEXP) data))
+			use[k].live++;
+	    }
+	    qsort(use, npages, sizeof(PAGE_USE), page_use_cmp);
+
+	    SET_NEXT_NODE(R_GenHeap[i].New, R_GenHeap[i].New);
+	    SET_PREV_NODE(R_GenHeap[i].New, R_GenHeap[i].New);
+	    for (k = 0; k < npages; k++) {
+		char *data = PAGE_DATA(use[k].page);
+		for (j = 0; j < page_count; j++, data += node_size) {
+		    s = (SEXP) data;
+		    if (! NODE_IS_MARKED(s))
+			SNAP_NODE(s, R_GenHeap[i].New);
+		}
+	    }
+	    free(use);
+	}
+	R_GenHeap[i].Free = NEXT_NODE(R_GenHeap[i].New);
+    }
+#if defined(__GLIBC__)
+    /* the pages are small, so give the space back explicitly */
+    malloc_trim(0);
+#endif
+}
+
 /* compute size in VEC units so result will fit in LENGTH field for FREESXPs */
 static R_INLINE R_size_t getVecSizeInVEC(SEXP s)
 {
     R_size_t size;
+    /* a growable vector was allocated for its true length (the bit is
+       CACHED_MASK on a CHARSXP, whose TRUELENGTH sorting may borrow) */
+    if (TYPEOF(s) != CHARSXP && IS_GROWABLE(s))
+	SETLENGTH(s, XTRUELENGTH(s));
     switch (TYPEOF(s)) {	/* get size in bytes */
     case CHARSXP:
 	size = XLENGTH(s) + 1;
@@ -998,6 +1193,171 @@ static R_INLINE R_size_t getVecSizeInVEC(SEXP s)
     return BYTE2VEC(size);
 }
 
+/* Placement of large vectors.  By default large vectors are obtained
+   from malloc.  The environment variable R_LARGE_VEC_POLICY, read at
+   start-up, can instead ask for vectors of at least LARGE_VEC_MAP_MIN
+   bytes to be mapped directly with mmap.  The policy is a
+   comma-separated list of
+
+     firsttouch  map each vector afresh, so that its pages are placed
+                 on the NUMA node of the thread that first touches
+                 them rather than reused from the malloc heap;
+     hugepage    also align the mapping and advise the kernel to back
+                 it by transparent huge pages;
+     interleave  also interleave the pages across the NUMA nodes the
+                 process may use.
+
+   Whether a vector is mapped depends only on its size, so it can be
+   released without recording how it was obtained. */
+#if defined(HAVE_MMAP) && !defined(Win32)
+# define LARGE_VEC_MMAP
+# include <sys/mman.h>
+# if !defined(MAP_ANONYMOUS) && defined(MAP_ANON)
+#  define MAP_ANONYMOUS MAP_ANON
+# endif
+# if defined(__linux__)
+#  include <unistd.h>
+#  include <sys/syscall.h>
+#  if defined(SYS_mbind) && defined(SYS_get_mempolicy)
+#   define LARGE_VEC_MBIND
+#   ifndef MPOL_INTERLEAVE
+#    define MPOL_INTERLEAVE 3
+#   endif
+#   ifndef MPOL_F_MEMS_ALLOWED
+#    define MPOL_F_MEMS_ALLOWED (1 << 2)
+#   endif
+#  endif
+# endif
+#endif
+
+#define LVEC_FIRSTTOUCH 1
+#define LVEC_HUGEPAGE   2
+#define LVEC_INTERLEAVE 4
+
+#define LARGE_VEC_MAP_MIN (2 * 1024 * 1024) /* also the huge page size */
+
+static int large_vec_policy = 0;
+static R_size_t large_vec_mapped = 0;       /* vectors mapped */
+static R_size_t large_vec_mapped_bytes = 0;
+
+#ifdef LARGE_VEC_MBIND
+# define LVEC_MAX_NODES 1024
+static unsigned long
+large_vec_nodemask[LVEC_MAX_NODES / (8 * sizeof(unsigned long))];
+#endif
+
+static void init_large_vec_policy()
+{
+#ifdef LARGE_VEC_MMAP
+    char *arg = getenv("R_LARGE_VEC_POLICY");
+    if (arg == NULL)
+	return;
+    for (char *p = arg; *p; ) {
+	size_t n = strcspn(p, ",");
+	if (n == 10 && strncmp(p, "firsttouch", n) == 0)
+	    large_vec_policy |= LVEC_FIRSTTOUCH;
+# ifdef MADV_HUGEPAGE
+	else if (n == 8 && strncmp(p, "hugepage", n) == 0)
+	    large_vec_policy |= LVEC_HUGEPAGE;
+# endif
+# ifdef LARGE_VEC_MBIND
+	else if (n == 10 && strncmp(p, "interleave", n) == 0)
+	    large_vec_policy |= LVEC_INTERLEAVE;
+# endif
+	p += n;
+	if (*p == ',') p++;
+    }
+# ifdef LARGE_VEC_MBIND
+    if ((large_vec_policy & LVEC_INTERLEAVE) &&
+	syscall(SYS_get_mempolicy, NULL, large_vec_nodemask,
+		(unsigned long) LVEC_MAX_NODES, NULL,
+		(unsigned long) MPOL_F_MEMS_ALLOWED) != 0)
+	large_vec_policy &= ~LVEC_INTERLEAVE;
+# endif
+    if (large_vec_policy)
+	large_vec_policy |= LVEC_FIRSTTOUCH;
+#endif
+}
+
+static const char *large_vec_policy_name()
+{
+    switch (large_vec_policy) {
+    case LVEC_FIRSTTOUCH: return "firsttouch";
+    case LVEC_FIRSTTOUCH | LVEC_HUGEPAGE: return "hugepage";
+    case LVEC_FIRSTTOUCH | LVEC_INTERLEAVE: return "interleave";
+    case LVEC_FIRSTTOUCH | LVEC_HUGEPAGE | LVEC_INTERLEAVE:
+	return "hugepage,interleave";
+    default: return "default";
+    }
+}
+
+#ifdef LARGE_VEC_MMAP
+static R_INLINE size_t large_vec_map_size(size_t bytes)
+{
+    size_t align = (large_vec_policy & LVEC_HUGEPAGE) ?
+	LARGE_VEC_MAP_MIN : (size_t) sysconf(_SC_PAGESIZE);
+    return (bytes + align - 1) / align * align;
+}
+
+static void *large_vec_map(size_t bytes)
+{
+    size_t len = large_vec_map_size(bytes);
+    size_t extra = (large_vec_policy & LVEC_HUGEPAGE) ? LARGE_VEC_MAP_MIN : 0;
+    if (len + extra < len)
+	return NULL;
+    char *p = mmap(NULL, len + extra, PROT_READ | PROT_WRITE,
+		   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED)
+	return NULL;
+    if (extra) {
+	/* trim the mapping to a huge page boundary */
+	uintptr_t a = (uintptr_t) p;
+	size_t head = (LARGE_VEC_MAP_MIN - a % LARGE_VEC_MAP_MIN)
+	    % LARGE_VEC_MAP_MIN;
+	if (head)
+	    munmap(p, head);
+	if (extra - head)
+	    munmap(p + head + len, extra - head);
+	p += head;
+    }
+# ifdef MADV_HUGEPAGE
+    if (large_vec_policy & LVEC_HUGEPAGE)
+	madvise(p, len, MADV_HUGEPAGE);
+# endif
+# ifdef LARGE_VEC_MBIND
+    if (large_vec_policy & LVEC_INTERLEAVE)
+	syscall(SYS_mbind, p, len, MPOL_INTERLEAVE, large_vec_nodemask,
+		(unsigned long) LVEC_MAX_NODES + 1, 0U);
+# endif
+    large_vec_mapped++;
+    large_vec_mapped_bytes += len;
+    return p;
+}
+#endif
+
+static R_INLINE void *large_vec_alloc(size_t bytes)
+{
+#ifdef LARGE_VEC_MMAP
+    if (large_vec_policy && bytes >= LARGE_VEC_MAP_MIN)
+	return large_vec_map(bytes);
+#endif
+    return malloc(bytes);
+}
+
+static R_INLINE void large_vec_free(void *ptr, size_t bytes)
+{
+#ifdef LARGE_VEC_MMAP
+    if (large_vec_policy && bytes >= LARGE_VEC_MAP_MIN) {
+	size_t len = large_vec_map_size(bytes);
+	munmap(ptr, len);
+	large_vec_mapped--;
+	large_vec_mapped_bytes -= len;
+	return;
+    }
+#endif
+    free(ptr);
+}
+
 static void custom_node_free(void *ptr);
 
 static void ReleaseLargeFreeVectors()
@@ -1020,14 +1380,16 @@ static void ReleaseLargeFreeVectors()
 		UNSNAP_NODE(s);
 		R_GenHeap[node_class].AllocCount--;
 		if (node_class == LARGE_NODE_CLASS) {
+		    R_size_t bytes = sizeof(SEXPREC_ALIGN) + size * sizeof(VECREC);
 		    R_LargeVallocSize -= size;
 #ifdef LONG_VECTOR_SUPPORT
 		    if (IS_LONG_VEC(s))
-			free(((char *) s) - sizeof(R_long_vec_hdr_t));
+			large_vec_free(((char *) s) - sizeof(R_long_vec_hdr_t),
+				       bytes + sizeof(R_long_vec_hdr_t));
 		    else
-			free(s);
+			large_vec_free(s, bytes);
 #else
-		    free(s);
+		    large_vec_free(s, bytes);
 #endif
 		} else {
 #ifdef LONG_VECTOR_SUPPORT
@@ -1101,6 +1463,7 @@ static void AdjustHeapSize(R_size_t size_needed)
     else \
       MARK_NODE(an__n__); \
     SET_NODE_GENERATION(an__n__, an__g__); \
+    SET_NODE_AGE(an__n__, 0); \
     UNSNAP_NODE(an__n__); \
     SET_NEXT_NODE(an__n__, forwarded_nodes); \
     forwarded_nodes = an__n__; \
@@ -1210,6 +1573,11 @@ static SEXP R_weak_refs = NULL;
 #define CLEAR_FINALIZE_ON_EXIT(s) ((s)->sxpinfo.gp &= ~FINALIZE_ON_EXIT_MASK)
 #define FINALIZE_ON_EXIT(s) ((s)->sxpinfo.gp & FINALIZE_ON_EXIT_MASK)
 
+#define THREADSAFE_FINALIZER_MASK 4
+
+#define SET_THREADSAFE_FINALIZER(s) ((s)->sxpinfo.gp |= THREADSAFE_FINALIZER_MASK)
+#define THREADSAFE_FINALIZER(s) ((s)->sxpinfo.gp & THREADSAFE_FINALIZER_MASK)
+
 #define WEAKREF_SIZE 4
 #define WEAKREF_KEY(w) VECTOR_ELT(w, 0)
 #define SET_WEAKREF_KEY(w, k) SET_VECTOR_ELT(w, 0, k)
@@ -1247,6 +1615,7 @@ static SEXP NewWeakRef(SEXP key, SEXP val, SEXP fin, Rboolean onexit)
 	SET_WEAKREF_FINALIZER(w, fin);
 	SET_WEAKREF_NEXT(w, R_weak_refs);
 	CLEAR_READY_TO_FINALIZE(w);
+	w->sxpinfo.gp &= ~THREADSAFE_FINALIZER_MASK;
 	if (onexit)
 	    SET_FINALIZE_ON_EXIT(w);
 	else
@@ -1426,10 +1795,165 @@ static Rboolean RunFinalizers(void)
     return finalizer_run;
 }
 
+/* The Finalizer Thread.  C finalizers registered as thread-safe are
+   run on a separate thread as soon as the collection that found their
+   objects unreachable is over, instead of at the next point where
+   the evaluator checks for pending finalizers.  This suits finalizers
+   which may block, such as ones closing network connections.  The
+   objects are external pointers, and the finalizers may only use the
+   external pointer address (R_ExternalPtrAddr, R_ClearExternalPtr):
+   they must not allocate, signal errors or use any other part of R.
+
+   Keys are kept in a ring buffer, which is a root of the collector,
+   until their finalizer has returned.  The thread needs POSIX threads,
+   which -fopenmp brings in where OpenMP is used; elsewhere, or if the
+   queue is full, these finalizers run on the main thread as others
+   do. */
+
+#if defined(_OPENMP) && !defined(Win32)
+# define FINALIZER_THREAD
+# include <pthread.h>
+# include <signal.h>
+#endif
+
+#define FINALIZER_QUEUE_SIZE 256 /* must be a power of 2 */
+
+#ifdef FINALIZER_THREAD
+static struct {
+    SEXP key;
+    R_CFinalizer_t fun;
+} fin_queue[FINALIZER_QUEUE_SIZE];
+
+/* counters of entries queued, taken by the thread and finished; the
+   keys of entries between fin_done and fin_tail are roots */
+static unsigned int fin_tail = 0, fin_head = 0, fin_done = 0;
+
+static pthread_mutex_t fin_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t fin_queued = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t fin_finished = PTHREAD_COND_INITIALIZER;
+static enum { FIN_THREAD_NONE, FIN_THREAD_RUNNING, FIN_THREAD_FAILED }
+    fin_thread_state = FIN_THREAD_NONE;
+
+static void *finalizer_thread(void *arg)
+{
+    pthread_mutex_lock(&fin_mutex);
+    for (;;) {
+	while (fin_head == fin_tail)
+	    pthread_cond_wait(&fin_queued, &fin_mutex);
+	unsigned int i = fin_head++ % FINALIZER_QUEUE_SIZE;
+	SEXP key = fin_queue[i].key;
+	R_CFinalizer_t fun = fin_queue[i].fun;
+	pthread_mutex_unlock(&fin_mutex);
+	fun(key);
+	pthread_mutex_lock(&fin_mutex);
+	fin_done++;
+	pthread_cond_broadcast(&fin_finished);
+    }
+    return NULL;
+}
+
+/* A forked child does not have the thread, and the finalizers queued
+   belong to the parent's resources. */
+static void finalizer_thread_atfork_child(void)
+{
+    pthread_mutex_init(&fin_mutex, NULL);
+    pthread_cond_init(&fin_queued, NULL);
+    pthread_cond_init(&fin_finished, NULL);
+    fin_head = fin_done = fin_tail;
+    fin_thread_state = FIN_THREAD_NONE;
+}
+
+static Rboolean StartFinalizerThread(void)
+{
+    static Rboolean atfork_registered = FALSE;
+    pthread_t thread;
+    pthread_attr_t attr;
+    sigset_t all, old;
+    int res;
+
+    if (fin_thread_state != FIN_THREAD_NONE)
+	return fin_thread_state == FIN_THREAD_RUNNING;
+    if (! atfork_registered) {
+	pthread_atfork(NULL, NULL, finalizer_thread_atfork_child);
+	atfork_registered = TRUE;
+    }
+    /* signals such as SIGINT are for the main thread */
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    res = pthread_create(&thread, &attr, finalizer_thread, NULL);
+    pthread_attr_destroy(&attr);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    fin_thread_state = res == 0 ? FIN_THREAD_RUNNING : FIN_THREAD_FAILED;
+    return res == 0;
+}
+
+/* Called after a collection: move the thread-safe finalizers found
+   ready to the queue. */
+static void QueueThreadSafeFinalizers(void)
+{
+    SEXP s, next, last = R_NilValue;
+    Rboolean queued = FALSE;
+
+    for (s = R_weak_refs; s != R_NilValue; s = next) {
+	next = WEAKREF_NEXT(s);
+	if (IS_READY_TO_FINALIZE(s) && THREADSAFE_FINALIZER(s)) {
+	    if (! queued) {
+		if (! StartFinalizerThread())
+		    return;
+		pthread_mutex_lock(&fin_mutex);
+		queued = TRUE;
+	    }
+	    if (fin_tail - fin_done == FINALIZER_QUEUE_SIZE)
+		break; /* the rest run on the main thread */
+	    unsigned int i = fin_tail++ % FINALIZER_QUEUE_SIZE;
+	    fin_queue[i].key = WEAKREF_KEY(s);
+	    fin_queue[i].fun = GetCFinalizer(WEAKREF_FINALIZER(s));
+	    SET_WEAKREF_KEY(s, R_NilValue);
+	    SET_WEAKREF_FINALIZER(s, R_NilValue);
+	    if (last == R_NilValue)
+		R_weak_refs = next;
+	    else
+		SET_WEAKREF_NEXT(last, next);
+	}
+	else last = s;
+    }
+    if (queued) {
+	pthread_cond_signal(&fin_queued);
+	pthread_mutex_unlock(&fin_mutex);
+    }
+}
+
+static void WaitForFinalizerThread(void)
+{
+    if (fin_thread_state != FIN_THREAD_RUNNING)
+	return;
+    pthread_mutex_lock(&fin_mutex);
+    while (fin_done != fin_tail)
+	pthread_cond_wait(&fin_finished, &fin_mutex);
+    pthread_mutex_unlock(&fin_mutex);
+}
+#endif
+
+void R_RegisterThreadSafeCFinalizer(SEXP s, R_CFinalizer_t fun,
+				    Rboolean onexit)
+{
+    SEXP w;
+
+    if (TYPEOF(s) != EXTPTRSXP)
+	error(_("thread-safe finalizers can only be registered for external pointers"));
+    w = R_MakeWeakRefC(s, R_NilValue, fun, onexit);
+    SET_THREADSAFE_FINALIZER(w);
+}
+
 void R_RunExitFinalizers(void)
 {
     SEXP s;
 
+#ifdef FINALIZER_THREAD
+    WaitForFinalizerThread();
+#endif
     for (s = R_weak_refs; s != R_NilValue; s = WEAKREF_NEXT(s))
 	if (FINALIZE_ON_EXIT(s))
 	    SET_READY_TO_FINALIZE(s);
@@ -1486,6 +2010,41 @@ SEXP attribute_hidden do_regFinaliz(SEXP call, SEXP op, SEXP args, SEXP rho)
 
 /* The Generational Collector. */
 
+/* When all surviving nodes of a collected generation are promoted
+   together the relative order of generations is preserved and no
+   old-to-new references are created by the collection.  With age
+   based promotion a node can be promoted while some of its children
+   are not; such nodes are put on the OldToNew list of their
+   generation after their children have been forwarded.  This is only
+   needed if some node was held back in the current collection. */
+static Rboolean gc_promotion_held_back = FALSE;
+
+#ifndef EXPEL_OLD_TO_NEW
+#define NOTE_YOUNGER_CHILD(__n__, __g__) do { \
+    SEXP ny__n__ = (__n__); \
+    if (ny__n__ && NODE_GENERATION(ny__n__) < (__g__)) \
+	has_younger = TRUE; \
+} while (0)
+
+static void RememberOldToNew(SEXP s)
+{
+    int gen = NODE_GENERATION(s);
+    if (gen > 0) {
+	Rboolean has_younger = FALSE;
+	DO_CHILDREN(s, NOTE_YOUNGER_CHILD, gen);
+	if (has_younger) {
+	    UNSNAP_NODE(s);
+	    SNAP_NODE(s, R_GenHeap[NODE_CLASS(s)].OldToNew[gen]);
+	}
+    }
+}
+#define REMEMBER_OLD_TO_NEW(s) do { \
+    if (gc_promotion_held_back) RememberOldToNew(s); \
+} while (0)
+#else
+#define REMEMBER_OLD_TO_NEW(s)
+#endif
+
 #define PROCESS_NODES() do { \
     while (forwarded_nodes != NULL) { \
 	s = forwarded_nodes; \
@@ -1493,20 +2052,826 @@ SEXP attribute_hidden do_regFinaliz(SEXP call, SEXP op, SEXP args, SEXP rho)
 	SNAP_NODE(s, R_GenHeap[NODE_CLASS(s)].Old[NODE_GENERATION(s)]); \
 	R_GenHeap[NODE_CLASS(s)].OldCount[NODE_GENERATION(s)]++; \
 	FORWARD_CHILDREN(s); \
+	REMEMBER_OLD_TO_NEW(s); \
     } \
 } while (0)
 
+/* Parallel marking.  For full collections of large heaps the main
+   marking pass can be shared among gc_num_threads OpenMP threads (set
+   by the environment variable R_GC_THREADS at start-up).  Marking
+   can then not use the node links as the forwarding stack, and nodes
+   cannot be unsnapped from the New lists concurrently, so:
+
+   - each thread keeps a private mark stack, and hands packets of its
+     work to a shared pool when some other thread is idle;
+   - nodes are marked by an atomic fetch-or on the sxpinfo word
+     holding the mark bit, so each node is claimed by one thread;
+   - small nodes are snapped into per-thread Old/OldToNew lists, which
+     leaves the New lists of the small node classes inconsistent;
+     these are rebuilt from the pages afterwards;
+   - large and custom nodes are not moved while marking but recorded,
+     and moved sequentially once marking is complete;
+   - the elements of long vector lists are processed in chunks which
+     can be handed to other threads.
+
+   The remaining passes (weak references, finalizers, the CHARSXP
+   cache) are short and stay sequential. */
+#if defined(_OPENMP) && !defined(PROTECTCHECK) && !defined(EXPEL_OLD_TO_NEW)
+# define PARALLEL_MARK
+# include <omp.h>
+# ifdef HAVE_SCHED_H
+#  include <sched.h> /* for sched_yield */
+# endif
+
+static int gc_num_threads = 1;
+#endif
+
+static void init_gc_thread_settings()
+{
+#ifdef PARALLEL_MARK
+    char *arg = getenv("R_GC_THREADS");
+    if (arg != NULL) {
+	int n = atoi(arg);
+	if (n >= 1 && n <= 1024)
+	    gc_num_threads = n;
+    }
+#endif
+}
+
+#ifdef PARALLEL_MARK
+#define PAR_MARK_MIN_NODES 1000000  /* heap size to use parallel marking */
+#define PAR_MARK_CHUNK 1024         /* vector elements per work item */
+#define PAR_MARK_PACKET 256         /* work items handed over at a time */
+#define PAR_MARK_DONATE_FREQ 64     /* nodes between checks for idlers */
+
+typedef struct {
+    SEXP node;
+    R_xlen_t start;  /* next element to forward for chunked vectors */
+} par_mark_item;
+
+typedef struct par_mark_packet {
+    struct par_mark_packet *next;
+    int n;
+    par_mark_item items[PAR_MARK_PACKET];
+} par_mark_packet;
+
+typedef struct {
+    par_mark_item *stack;
+    size_t top, size;
+    SEXP *deferred;
+    size_t ndeferred, deferred_size;
+    SEXPREC OldPeg[NUM_SMALL_NODE_CLASSES][MAX_NUM_OLD_GENERATIONS];
+    SEXPREC OldToNewPeg[NUM_SMALL_NODE_CLASSES][MAX_NUM_OLD_GENERATIONS];
+    int OldCount[NUM_SMALL_NODE_CLASSES][MAX_NUM_OLD_GENERATIONS];
+} par_mark_thread;
+
+static par_mark_thread *par_mark_threads = NULL;
+static par_mark_packet *par_mark_pool = NULL;
+static int par_mark_pool_size = 0;
+static int par_mark_idle = 0;
+static omp_lock_t par_mark_lock;
+static unsigned int par_mark_bit = 0;
+
+static void par_mark_oom(void)
+{
+    R_Suicide("couldn't allocate memory for parallel GC mark stack");
+}
+
+static void *par_mark_grow(void *p, size_t *size, size_t elsize)
+{
+    size_t newsize = *size ? 2 * *size : 4096;
+    void *q = realloc(p, newsize * elsize);
+    if (q == NULL) par_mark_oom();
+    *size = newsize;
+    return q;
+}
+
+static R_INLINE void par_mark_push(par_mark_thread *t, SEXP s, R_xlen_t start)
+{
+    if (t->top == t->size)
+	t->stack = par_mark_grow(t->stack, &t->size, sizeof(par_mark_item));
+    t->stack[t->top].node = s;
+    t->stack[t->top].start = start;
+    t->top++;
+}
+
+/* Claim an unmarked node; returns non-zero if this thread marked it. */
+static R_INLINE int par_mark_claim(SEXP s)
+{
+    unsigned int *word = (unsigned int *) &(s->sxpinfo), old;
+#pragma omp atomic capture
+    { old = *word; *word |= par_mark_bit; }
+    return ! (old & par_mark_bit);
+}
+
+#define PAR_FORWARD_NODE(__n__, __t__) do { \
+    SEXP pf__n__ = (__n__); \
+    if (pf__n__ && ! NODE_IS_MARKED(pf__n__) && par_mark_claim(pf__n__)) \
+	par_mark_push(__t__, pf__n__, 0); \
+} while (0)
+
+static void par_mark_forward_elts(par_mark_thread *t, SEXP s,
+				  R_xlen_t start)
+{
+    R_xlen_t n = XLENGTH(s), end = start + PAR_MARK_CHUNK;
+    if (end < n)
+	par_mark_push(t, s, end);
+    else
+	end = n;
+    for (R_xlen_t i = start; i < end; i++)
+	PAR_FORWARD_NODE(STRING_ELT(s, i), t);
+}
+
+/* Move a marked node whose children have all been marked to its
+   generation's list, or to OldToNew if age based promotion has left
+   some of them younger. */
+static void par_mark_finish_node(par_mark_thread *t, SEXP s)
+{
+    int cls = NODE_CLASS(s), gen = NODE_GENERATION(s);
+    if (cls >= NUM_SMALL_NODE_CLASSES) {
+	if (t->ndeferred == t->deferred_size)
+	    t->deferred = par_mark_grow(t->deferred, &t->deferred_size,
+					sizeof(SEXP));
+	t->deferred[t->ndeferred++] = s;
+	return;
+    }
+    t->OldCount[cls][gen]++;
+    if (gc_promotion_held_back && gen > 0) {
+	Rboolean has_younger = FALSE;
+	DO_CHILDREN(s, NOTE_YOUNGER_CHILD, gen);
+	if (has_younger) {
+	    SNAP_NODE(s, &(t->OldToNewPeg[cls][gen]));
+	    return;
+	}
+    }
+    SNAP_NODE(s, &(t->OldPeg[cls][gen]));
+}
+
+static void par_mark_process(par_mark_thread *t, par_mark_item item)
+{
+    SEXP s = item.node;
+    if (item.start > 0) {
+	par_mark_forward_elts(t, s, item.start);
+	return;
+    }
+    switch (TYPEOF(s)) {
+    case STRSXP:
+    case EXPRSXP:
+    case VECSXP:
+	if (XLENGTH(s) > PAR_MARK_CHUNK) {
+	    /* the node is large, so it is finished after marking, by
+	       which time all its elements have been forwarded */
+	    if (HAS_GENUINE_ATTRIB(s))
+		PAR_FORWARD_NODE(ATTRIB(s), t);
+	    par_mark_finish_node(t, s);
+	    par_mark_forward_elts(t, s, 0);
+	    return;
+	}
+    default:
+	break;
+    }
+    DO_CHILDREN(s, PAR_FORWARD_NODE, t);
+    par_mark_finish_node(t, s);
+}
+
+/* Hand the top entries of a thread's stack to the shared pool. */
+static void par_mark_donate(par_mark_thread *t)
+{
+    par_mark_packet *p = malloc(sizeof(par_mark_packet));
+    if (p == NULL) par_mark_oom();
+    p->n = PAR_MARK_PACKET;
+    t->top -= PAR_MARK_PACKET;
+    memcpy(p->items, t->stack + t->top,
+	   PAR_MARK_PACKET * sizeof(par_mark_item));
+    omp_set_lock(&par_mark_lock);
+    p->next = par_mark_pool;
+    par_mark_pool = p;
+#pragma omp atomic
+    par_mark_pool_size++;
+    omp_unset_lock(&par_mark_lock);
+}
+
+/* Take a packet from the pool, if there is one.  The idle count is
+   only changed while holding the pool lock, so a thread that sees
+   all threads idle and an empty pool knows marking is complete. */
+static Rboolean par_mark_take(par_mark_thread *t, Rboolean idle,
+			      Rboolean *done)
+{
+    par_mark_packet *p = NULL;
+    if (idle) {
+	int nidle, npool;
+#pragma omp atomic read
+	nidle = par_mark_idle;
+#pragma omp atomic read
+	npool = par_mark_pool_size;
+	if (npool == 0 && nidle < gc_num_threads)
+	    return FALSE;
+    }
+    omp_set_lock(&par_mark_lock);
+    if (par_mark_pool != NULL) {
+	p = par_mark_pool;
+	par_mark_pool = p->next;
+#pragma omp atomic
+	par_mark_pool_size--;
+	if (idle) {
+#pragma omp atomic
+	    par_mark_idle--;
+	}
+    }
+    else if (! idle) {
+#pragma omp atomic
+	par_mark_idle++;
+    }
+    else if (par_mark_idle == gc_num_threads)
+	*done = TRUE;
+    omp_unset_lock(&par_mark_lock);
+    if (p == NULL) return FALSE;
+    for (int i = 0; i < p->n; i++) {
+	if (t->top == t->size)
+	    t->stack = par_mark_grow(t->stack, &t->size,
+				     sizeof(par_mark_item));
+	t->stack[t->top++] = p->items[i];
+    }
+    free(p);
+    return TRUE;
+}
+
+static void par_mark_worker(par_mark_thread *t)
+{
+    Rboolean idle = FALSE, done = FALSE;
+    int count = 0;
+    while (! done) {
+	while (t->top > 0) {
+	    par_mark_process(t, t->stack[--t->top]);
+	    if (++count == PAR_MARK_DONATE_FREQ) {
+		int nidle, npool;
+		count = 0;
+#pragma omp atomic read
+		nidle = par_mark_idle;
+#pragma omp atomic read
+		npool = par_mark_pool_size;
+		if (nidle > npool && t->top >= 2 * PAR_MARK_PACKET)
+		    par_mark_donate(t);
+	    }
+	}
+	if (par_mark_take(t, idle, &done))
+	    idle = FALSE;
+	else if (! idle)
+	    idle = TRUE;
+#ifdef HAVE_SCHED_H
+	else
+	    sched_yield();
+#endif
+    }
+}
+
+static void par_mark_init_lists(par_mark_thread *t)
+{
+    for (int i = 0; i < NUM_SMALL_NODE_CLASSES; i++)
+	for (int gen = 0; gen < MAX_NUM_OLD_GENERATIONS; gen++) {
+	    SEXP peg = &(t->OldPeg[i][gen]);
+	    SET_NEXT_NODE(peg, peg);
+	    SET_PREV_NODE(peg, peg);
+	    peg = &(t->OldToNewPeg[i][gen]);
+	    SET_NEXT_NODE(peg, peg);
+	    SET_PREV_NODE(peg, peg);
+	    t->OldCount[i][gen] = 0;
+	}
+    t->top = 0;
+    t->ndeferred = 0;
+}
+
+/* Rebuild the New list of a small node class from its pages: after
+   parallel marking the unmarked nodes are exactly the free ones. */
+static void par_mark_rebuild_new(int i)
+{
+    SEXP peg = R_GenHeap[i].New;
+    int node_size = NODE_SIZE(i);
+    int page_count = (R_PAGE_SIZE - sizeof(PAGE_HEADER)) / node_size;
+    SET_NEXT_NODE(peg, peg);
+    SET_PREV_NODE(peg, peg);
+    for (PAGE_HEADER *page = R_GenHeap[i].pages; page != NULL;
+	 page = page->next) {
+	char *data = PAGE_DATA(page);
+	for (int j = 0; j < page_count; j++, data += node_size) {
+	    SEXP s = (SEXP) data;
+	    if (! NODE_IS_MARKED(s))
+		SNAP_NODE(s, peg);
+	}
+    }
+}
+
+static Rboolean par_mark_init(void)
+{
+    if (par_mark_threads == NULL) {
+	SEXPREC tmp;
+	memset(&tmp, 0, sizeof(tmp));
+	MARK_NODE(&tmp);
+	memcpy(&par_mark_bit, &(tmp.sxpinfo), sizeof(unsigned int));
+	if (par_mark_bit == 0)
+	    return FALSE; /* mark bit not in the first word */
+	par_mark_threads = calloc(gc_num_threads, sizeof(par_mark_thread));
+	if (par_mark_threads == NULL)
+	    return FALSE;
+	omp_init_lock(&par_mark_lock);
+    }
+    return TRUE;
+}
+
+/* Replaces PROCESS_NODES for the main marking pass.  The nodes on
+   forwarded_nodes have been marked and unsnapped. */
+static void ParallelProcessNodes(SEXP forwarded_nodes)
+{
+    int nt = gc_num_threads, k;
+    SEXP s;
+
+    for (k = 0; k < nt; k++)
+	par_mark_init_lists(par_mark_threads + k);
+
+    /* deal out the roots; large nodes go back to their New lists so
+       that they are all moved in the same way */
+    for (k = 0; forwarded_nodes != NULL; k = (k + 1) % nt) {
+	s = forwarded_nodes;
+	forwarded_nodes = NEXT_NODE(forwarded_nodes);
+	if (NODE_CLASS(s) >= NUM_SMALL_NODE_CLASSES)
+	    SNAP_NODE(s, R_GenHeap[NODE_CLASS(s)].New);
+	par_mark_push(par_mark_threads + k, s, 0);
+    }
+
+    par_mark_idle = 0;
+    par_mark_pool_size = 0;
+#pragma omp parallel num_threads(nt) default(shared)
+    {
+	int id = omp_get_thread_num(), nrun = omp_get_num_threads();
+	/* if the team is smaller than requested the first thread takes
+	   over the work of the missing ones */
+	if (id == 0 && nrun < nt) {
+	    par_mark_thread *t0 = par_mark_threads;
+	    for (int j = nrun; j < nt; j++) {
+		par_mark_thread *t = par_mark_threads + j;
+		for (size_t m = 0; m < t->top; m++)
+		    par_mark_push(t0, t->stack[m].node, t->stack[m].start);
+		t->top = 0;
+	    }
+	    par_mark_idle = nt - nrun;
+	}
+#pragma omp barrier
+	par_mark_worker(par_mark_threads + id);
+    }
+
+    for (k = 0; k < nt; k++) {
+	par_mark_thread *t = par_mark_threads + k;
+	for (int i = 0; i < NUM_SMALL_NODE_CLASSES; i++)
+	    for (int gen = 0; gen < num_old_generations; gen++) {
+		if (NEXT_NODE(&(t->OldPeg[i][gen])) != &(t->OldPeg[i][gen]))
+		    BULK_MOVE(&(t->OldPeg[i][gen]), R_GenHeap[i].Old[gen]);
+		if (NEXT_NODE(&(t->OldToNewPeg[i][gen])) !=
+		    &(t->OldToNewPeg[i][gen]))
+		    BULK_MOVE(&(t->OldToNewPeg[i][gen]),
+			      R_GenHeap[i].OldToNew[gen]);
+		R_GenHeap[i].OldCount[gen] += t->OldCount[i][gen];
+	    }
+    }
+    for (int i = 0; i < NUM_SMALL_NODE_CLASSES; i++)
+	par_mark_rebuild_new(i);
+    for (k = 0; k < nt; k++) {
+	par_mark_thread *t = par_mark_threads + k;
+	for (size_t j = 0; j < t->ndeferred; j++) {
+	    s = t->deferred[j];
+	    UNSNAP_NODE(s);
+	    SNAP_NODE(s, R_GenHeap[NODE_CLASS(s)].Old[NODE_GENERATION(s)]);
+	    R_GenHeap[NODE_CLASS(s)].OldCount[NODE_GENERATION(s)]++;
+	    REMEMBER_OLD_TO_NEW(s);
+	}
+    }
+}
+#endif /* PARALLEL_MARK */
+
+/* Forward all roots onto the forwarding list. */
+static SEXP ForwardRoots(SEXP forwarded_nodes)
+{
+    int i;
+    RCNTXT *ctxt;
+
+    FORWARD_NODE(R_NilValue);	           /* Builtin constants */
+    FORWARD_NODE(NA_STRING);
+    FORWARD_NODE(R_BlankString);
+    FORWARD_NODE(R_BlankScalarString);
+    FORWARD_NODE(R_UnboundValue);
+    FORWARD_NODE(R_RestartToken);
+    FORWARD_NODE(R_MissingArg);
+
+    FORWARD_NODE(R_GlobalEnv);	           /* Global environment */
+    FORWARD_NODE(R_BaseEnv);
+    FORWARD_NODE(R_EmptyEnv);
+    FORWARD_NODE(R_Warnings);	           /* Warnings, if any */
+    FORWARD_NODE(R_ReturnedValue);
+
+    FORWARD_NODE(R_HandlerStack);          /* Condition handler stack */
+    FORWARD_NODE(R_RestartStack);          /* Available restarts stack */
+
+    FORWARD_NODE(R_Srcref);                /* Current source reference */
+
+    FORWARD_NODE(R_TrueValue);
+    FORWARD_NODE(R_FalseValue);
+    FORWARD_NODE(R_LogicalNAValue);
+
+    FORWARD_NODE(R_print.na_string);
+    FORWARD_NODE(R_print.na_string_noquote);
+
+    if (R_SymbolTable != NULL)             /* in case of GC during startup */
+	for (i = 0; i < R_SymbolTableSize; i++) /* Symbol table */
+	    FORWARD_NODE(R_SymbolTable[i]);
+
+    if (R_CurrentExpr != NULL)	           /* Current expression */
+	FORWARD_NODE(R_CurrentExpr);
+
+    for (i = 0; i < R_MaxDevices; i++) {   /* Device display lists */
+	pGEDevDesc gdd = GEgetDevice(i);
+	if (gdd) {
+	    FORWARD_NODE(gdd->displayList);
+	    FORWARD_NODE(gdd->savedSnapshot);
+	    if (gdd->dev)
+		FORWARD_NODE(gdd->dev->eventEnv);
+	}
+    }
+
+    for (ctxt = R_GlobalContext ; ctxt != NULL ; ctxt = ctxt->nextcontext) {
+	FORWARD_NODE(ctxt->conexit);       /* on.exit expressions */
+	FORWARD_NODE(ctxt->promargs);	   /* promises supplied to closure */
+	FORWARD_NODE(ctxt->callfun);       /* the closure called */
+	FORWARD_NODE(ctxt->sysparent);     /* calling environment */
+	FORWARD_NODE(ctxt->call);          /* the call */
+	FORWARD_NODE(ctxt->cloenv);        /* the closure environment */
+	FORWARD_NODE(ctxt->handlerstack);  /* the condition handler stack */
+	FORWARD_NODE(ctxt->restartstack);  /* the available restarts stack */
+	FORWARD_NODE(ctxt->srcref);	   /* the current source reference */
+	FORWARD_NODE(ctxt->returnValue);   /* For on.exit calls */
+    }
+
+    FORWARD_NODE(R_PreciousList);
+
+    for (i = 0; i < R_PPStackTop; i++)	   /* Protected pointers */
+	FORWARD_NODE(R_PPStack[i]);
+
+    FORWARD_NODE(R_VStack);		   /* R_alloc stack */
+
+    for (R_bcstack_t *sp = R_BCNodeStackBase; sp < R_BCNodeStackTop; sp++)
+#ifdef TYPED_STACK
+	if (sp->tag == 0 || IS_PARTIAL_SXP_TAG(sp->tag))
+	    FORWARD_NODE(sp->u.sxpval);
+#else
+	FORWARD_NODE(*sp);
+#endif
+
+    FORWARD_NODE(R_CachedScalarReal);
+    FORWARD_NODE(R_CachedScalarInteger);
+
+#ifdef FINALIZER_THREAD
+    if (fin_thread_state == FIN_THREAD_RUNNING) {
+	/* objects queued for, or being finalized on, the finalizer thread */
+	pthread_mutex_lock(&fin_mutex);
+	for (unsigned int k = fin_done; k != fin_tail; k++)
+	    FORWARD_NODE(fin_queue[k % FINALIZER_QUEUE_SIZE].key);
+	pthread_mutex_unlock(&fin_mutex);
+    }
+#endif
+
+    return forwarded_nodes;
+}
+
+/* Incremental full collections.  When options(gc.pause.target) is
+   set to a positive number of milliseconds and the last full
+   collection took longer than that, a full collection is instead
+   spread over a cycle of shorter pauses (slices), with the mutator
+   running in between:
+
+   - In the unmark phase the nodes of the old generations are
+     unmarked, promoted as for a full collection, and moved to the
+     front of the New lists, ahead of the Free pointer so that they
+     are not reused.
+
+   - In the mark phase the roots are forwarded onto a gray list, which
+     is doubly linked so that the write barrier can take nodes off it,
+     and gray nodes are processed until the slice's time is up.
+     Processed nodes are counted as in PROCESS_NODES and put on the
+     OldToNew list of their generation if they have younger children.
+
+   - The cycle ends with a stop-the-world pause which processes the
+     OldToNew lists, reforwards the roots and completes the marking,
+     and then does everything a full collection does after marking.
+
+   Nodes allocated during the cycle are unmarked, and a marked node
+   into which a pointer to an unmarked one is stored is moved to an
+   OldToNew list by the existing write barrier, so nothing that is
+   reachable at the end of the cycle can be missed.  Unreachable nodes
+   are not reclaimed until the cycle ends, so each cycle is allowed
+   INC_GC_SLACK of the heap size as allocation headroom.  The work for
+   the cycle is estimated as twice the number of old nodes, once for
+   unmarking and once for marking, and after each slice the mutator
+   is allowed a share of the remaining headroom in proportion to the
+   work done in the slice.  If the headroom runs out anyway, or a full
+   collection is requested by gc() or an allocation failure, the cycle
+   is finished at once. */
+#if !defined(PROTECTCHECK) && !defined(EXPEL_OLD_TO_NEW)
+# define INCREMENTAL_GC
+#endif
+
+#ifdef INCREMENTAL_GC
+#define INC_GC_SLACK 0.25
+#define INC_GC_CHECK 1024  /* nodes processed between clock checks */
+
+enum { INC_GC_IDLE, INC_GC_UNMARK, INC_GC_MARK };
+static int gc_inc_phase = INC_GC_IDLE;
+
+static SEXPREC GrayPeg;
+#define GRAY_NODES (&GrayPeg)
+
+static R_size_t gc_inc_NSize, gc_inc_VSize;   /* triggers at start of cycle */
+static R_size_t gc_inc_NLimit, gc_inc_VLimit; /* limits for the cycle */
+static R_size_t gc_inc_work, gc_inc_work_done; /* in nodes */
+static double gc_inc_work_time;               /* seconds spent on the cycle */
+#endif
+
+static double gc_full_time = 0.0;  /* seconds taken by last full collection */
+static Rboolean gc_full_requested = FALSE;
+
+#ifdef INCREMENTAL_GC
+# define GC_CYCLE_IN_PROGRESS() (gc_inc_phase != INC_GC_IDLE)
+#else
+# define GC_CYCLE_IN_PROGRESS() FALSE
+#endif
+
+#ifdef INCREMENTAL_GC
+#define INC_FORWARD_NODE(s) do { \
+  SEXP if__n__ = (s); \
+  if (if__n__ && ! NODE_IS_MARKED(if__n__)) { \
+    MARK_NODE(if__n__); \
+    UNSNAP_NODE(if__n__); \
+    SNAP_NODE(if__n__, GRAY_NODES); \
+  } \
+} while (0)
+
+#define INC_FC_FORWARD_NODE(__n__,__dummy__) INC_FORWARD_NODE(__n__)
+
+#define SLICE_EXPIRED(n, deadline) \
+    (++(n) % INC_GC_CHECK == 0 && (deadline) > 0 && \
+     currentTime() > (deadline))
+
+/* Unmark and promote the nodes of the old generations, as at the
+   start of a full collection.  Returns TRUE when all are done.  The
+   nodes are taken from the front of the lists, and the OldToNew lists
+   are drained too, since the write barrier can move nodes there. */
+static Rboolean UnmarkOldNodes(double deadline)
+{
+    int n = 0;
+    for (int gen = 0; gen < num_old_generations; gen++)
+	for (int i = 0; i < NUM_NODE_CLASSES; i++)
+	    for (int j = 0; j < 2; j++) {
+		SEXP peg = j == 0 ?
+		    R_GenHeap[i].Old[gen] : R_GenHeap[i].OldToNew[gen];
+		while (NEXT_NODE(peg) != peg) {
+		    SEXP s = NEXT_NODE(peg);
+		    if (gen < num_old_generations - 1) {
+			if (! gc_age_promotion ||
+			    NODE_AGE(s) + 1 >= promotion_age[gen]) {
+			    SET_NODE_GENERATION(s, gen + 1);
+			    SET_NODE_AGE(s, 0);
+			}
+			else
+			    SET_NODE_AGE(s, NODE_AGE(s) + 1);
+		    }
+		    UNMARK_NODE(s);
+		    UNSNAP_NODE(s);
+		    SNAP_NODE(s, NEXT_NODE(R_GenHeap[i].New));
+		    if (SLICE_EXPIRED(n, deadline)) {
+			gc_inc_work_done += n;
+			return FALSE;
+		    }
+		}
+	    }
+    gc_inc_work_done += n;
+    return TRUE;
+}
+
+/* Move the roots onto the gray list to start the mark phase. */
+static void GrayRoots(void)
+{
+    SEXP forwarded_nodes = ForwardRoots(NULL);
+    while (forwarded_nodes != NULL) {
+	SEXP s = forwarded_nodes;
+	forwarded_nodes = NEXT_NODE(forwarded_nodes);
+	SNAP_NODE(s, GRAY_NODES);
+    }
+}
+
+/* Process gray nodes until none are left (returning TRUE) or the
+   deadline has passed. A deadline of zero means no limit. */
+static Rboolean ProcessGrayNodes(double deadline)
+{
+    int n = 0;
+    while (NEXT_NODE(GRAY_NODES) != GRAY_NODES) {
+	SEXP s = NEXT_NODE(GRAY_NODES);
+	UNSNAP_NODE(s);
+	SNAP_NODE(s, R_GenHeap[NODE_CLASS(s)].Old[NODE_GENERATION(s)]);
+	R_GenHeap[NODE_CLASS(s)].OldCount[NODE_GENERATION(s)]++;
+	DO_CHILDREN(s, INC_FC_FORWARD_NODE, 0);
+	RememberOldToNew(s);
+	if (SLICE_EXPIRED(n, deadline)) {
+	    gc_inc_work_done += n;
+	    return FALSE;
+	}
+    }
+    gc_inc_work_done += n;
+    return TRUE;
+}
+
+/* Run a slice of the current cycle.  Returns TRUE if the mutator can
+   continue, with new triggers set for the next slice, and FALSE if
+   the cycle has to be finished now. */
+static Rboolean IncrementalSlice(R_size_t size_needed)
+{
+    R_size_t vused = R_SmallVallocSize + R_LargeVallocSize;
+    if (R_GCPauseTarget <= 0 || R_NodesInUse >= gc_inc_NLimit ||
+	vused + size_needed >= gc_inc_VLimit)
+	return FALSE;
+
+    double start = currentTime();
+    double deadline = start + R_GCPauseTarget / 1000.0;
+    R_size_t done = gc_inc_work_done;
+    if (gc_inc_phase == INC_GC_UNMARK && UnmarkOldNodes(deadline)) {
+	gc_inc_phase = INC_GC_MARK;
+	GrayRoots();
+    }
+    Rboolean marked =
+	gc_inc_phase == INC_GC_MARK && ProcessGrayNodes(deadline);
+    gc_inc_work_time += currentTime() - start;
+    if (marked)
+	return FALSE;
+
+    /* share out the headroom in proportion to the work done */
+    double d = (double) (gc_inc_work_done - done);
+    double left = gc_inc_work > gc_inc_work_done ?
+	(double) (gc_inc_work - gc_inc_work_done) : 0.0;
+    double share = d / (d + (left > d ? left : d) + 1.0);
+    R_NSize = R_NodesInUse + 1 +
+	(R_size_t) (share * (gc_inc_NLimit - R_NodesInUse));
+    R_VSize = vused + size_needed + 1 +
+	(R_size_t) (share * (gc_inc_VLimit - vused - size_needed));
+    return TRUE;
+}
+
+/* Start a cycle in place of a full collection if a pause target is
+   set which the last full collection did not meet. */
+static Rboolean StartIncrementalCycle(R_size_t size_needed)
+{
+    if (R_GCPauseTarget <= 0 || gc_full_time * 1000.0 <= R_GCPauseTarget)
+	return FALSE;
+
+    R_size_t nslack = (R_size_t) (INC_GC_SLACK * R_NSize);
+    R_size_t vslack = (R_size_t) (INC_GC_SLACK * R_VSize);
+    if (R_MaxNSize - R_NSize < nslack ||
+	R_MaxVSize - R_VSize < vslack ||
+	size_needed >= vslack)
+	return FALSE;
+
+    gc_inc_NSize = R_NSize;
+    gc_inc_VSize = R_VSize;
+    gc_inc_NLimit = R_NSize + nslack;
+    gc_inc_VLimit = R_VSize + vslack;
+    gc_inc_work = gc_inc_work_done = 0;
+    gc_inc_work_time = 0;
+
+    for (int gen = 0; gen < num_old_generations; gen++)
+	for (int i = 0; i < NUM_NODE_CLASSES; i++) {
+	    gc_inc_work += 2 * R_GenHeap[i].OldCount[gen];
+	    R_GenHeap[i].OldCount[gen] = 0;
+	}
+    gc_inc_phase = INC_GC_UNMARK;
+    return TRUE;
+}
+
+/* Complete the marking for the current cycle, leaving the state as at
+   the end of the main processing loop of a full collection. */
+static void FinishIncrementalMarking(void)
+{
+    SEXP s, forwarded_nodes = NULL;
+
+    if (gc_inc_phase == INC_GC_UNMARK)
+	UnmarkOldNodes(0);
+    gc_inc_phase = INC_GC_MARK;
+
+    /* nodes the write barrier has seen pointers stored into */
+    for (int gen = 0; gen < num_old_generations; gen++)
+	for (int i = 0; i < NUM_NODE_CLASSES; i++)
+	    for (s = NEXT_NODE(R_GenHeap[i].OldToNew[gen]);
+		 s != R_GenHeap[i].OldToNew[gen];
+		 s = NEXT_NODE(s))
+		FORWARD_CHILDREN(s);
+    forwarded_nodes = ForwardRoots(forwarded_nodes);
+
+    gc_promotion_held_back = TRUE;
+    ProcessGrayNodes(0);
+    PROCESS_NODES();
+}
+#endif
+
+/* GC event hooks, and the log of recent collections kept for
+   gc.events().  Both are fed from gc_event, which RunGenCollect fills
+   in; the per-class counts of nodes in use are kept up to date for
+   this whether events are wanted or not. */
+
+#define MAX_GC_EVENT_HOOKS 16
+static struct {
+    R_GCEventHook hook;
+    void *data;
+} gc_event_hooks[MAX_GC_EVENT_HOOKS];
+static int gc_num_event_hooks = 0;
+
+static R_GCEvent gc_event;
+static R_GCEvent *gc_event_log = NULL;
+static int gc_event_log_size = 0;
+static int gc_event_log_count = 0; /* events held, at most the size */
+static int gc_event_log_next = 0;  /* slot for the next event */
+
+#define GC_EVENTS_WANTED() (gc_num_event_hooks > 0 || gc_event_log_size > 0)
+
+void R_AddGCEventHook(R_GCEventHook hook, void *data)
+{
+    if (gc_num_event_hooks == MAX_GC_EVENT_HOOKS)
+	error(_("too many GC event hooks"));
+    gc_event_hooks[gc_num_event_hooks].hook = hook;
+    gc_event_hooks[gc_num_event_hooks].data = data;
+    gc_num_event_hooks++;
+}
+
+void R_RemoveGCEventHook(R_GCEventHook hook, void *data)
+{
+    for (int i = 0; i < gc_num_event_hooks; i++)
+	if (gc_event_hooks[i].hook == hook && gc_event_hooks[i].data == data) {
+	    for (gc_num_event_hooks--; i < gc_num_event_hooks; i++)
+		gc_event_hooks[i] = gc_event_hooks[i + 1];
+	    return;
+	}
+}
+
+/* Record the outcome of a collection of 'level' old generations;
+   large_before is the large vector heap size when it started.  A
+   slice of an incremental cycle (level -1) frees nothing. */
+static void RecordGCEvent(int level, R_size_t large_before)
+{
+    gc_event.level = level;
+    for (int i = 0; i < NUM_NODE_CLASSES; i++)
+	gc_event.freed[i] = 0;
+    if (level >= 0) {
+	for (int i = 0; i < NUM_NODE_CLASSES; i++) {
+	    int live = 0;
+	    for (int gen = 0; gen < num_old_generations; gen++)
+		live += R_GenHeap[i].OldCount[gen];
+	    gc_event.freed[i] = (double) (R_GenHeap[i].InUse - live) *
+		(i < NUM_SMALL_NODE_CLASSES ? NODE_SIZE(i) :
+		 sizeof(SEXPREC_ALIGN));
+	    R_GenHeap[i].InUse = live;
+	}
+	gc_event.freed[LARGE_NODE_CLASS] +=
+	    (double) (large_before - R_LargeVallocSize) * sizeof(VECREC);
+    }
+    gc_event.large = (double) R_LargeVallocSize * sizeof(VECREC);
+    gc_event.nsize = (double) R_NSize * sizeof(SEXPREC);
+    gc_event.vsize = (double) R_VSize * sizeof(VECREC);
+}
+
+static void ReportGCEvent(double elapsed)
+{
+    gc_event.number = gc_count;
+    gc_event.elapsed = elapsed;
+    for (int i = 0; i < gc_num_event_hooks; i++)
+	gc_event_hooks[i].hook(&gc_event, gc_event_hooks[i].data);
+    if (gc_event_log_size > 0) {
+	gc_event_log[gc_event_log_next++] = gc_event;
+	if (gc_event_log_next == gc_event_log_size)
+	    gc_event_log_next = 0;
+	if (gc_event_log_count < gc_event_log_size)
+	    gc_event_log_count++;
+    }
+}
+
 static void RunGenCollect(R_size_t size_needed)
 {
     int i, gen, gens_collected;
-    RCNTXT *ctxt;
     SEXP s;
     SEXP forwarded_nodes;
+    Rboolean full_requested = gc_full_requested;
+    Rboolean compact = gc_compact_requested;
+    double start_time = R_GCPauseTarget > 0 ? currentTime() : 0;
+    Rboolean inc_finished = FALSE;
+    R_size_t large_before = R_LargeVallocSize;
 
     bad_sexp_type_seen = 0;
+    gc_full_requested = gc_compact_requested = FALSE;
 
     /* determine number of generations to collect */
-    while (num_old_gens_to_collect < NUM_OLD_GENERATIONS) {
+    while (num_old_gens_to_collect < num_old_generations) {
 	if (collect_counts[num_old_gens_to_collect]-- <= 0) {
 	    collect_counts[num_old_gens_to_collect] =
 		collect_counts_max[num_old_gens_to_collect];
@@ -1516,7 +2881,24 @@ static void RunGenCollect(R_size_t size_needed)
     }
 
 #ifdef PROTECTCHECK
-    num_old_gens_to_collect = NUM_OLD_GENERATIONS;
+    num_old_gens_to_collect = num_old_generations;
+#endif
+
+#ifdef INCREMENTAL_GC
+    if (! GC_CYCLE_IN_PROGRESS() && ! full_requested &&
+	num_old_gens_to_collect == num_old_generations)
+	StartIncrementalCycle(size_needed);
+    if (GC_CYCLE_IN_PROGRESS()) {
+	if (! full_requested && IncrementalSlice(size_needed)) {
+	    RecordGCEvent(-1, large_before);
+	    return;
+	}
+	FinishIncrementalMarking();
+	gens_collected = num_old_gens_to_collect = num_old_generations;
+	inc_finished = TRUE;
+	forwarded_nodes = NULL;
+	goto marked;
+    }
 #endif
 
  again:
@@ -1544,15 +2926,26 @@ static void RunGenCollect(R_size_t size_needed)
     DEBUG_CHECK_NODE_COUNTS("at start");
 
     /* unmark all marked nodes in old generations to be collected and
-       move to New space */
+       move to New space; nodes that have reached their promotion age
+       move up one generation */
+    gc_promotion_held_back = FALSE;
     for (gen = 0; gen < num_old_gens_to_collect; gen++) {
 	for (i = 0; i < NUM_NODE_CLASSES; i++) {
 	    R_GenHeap[i].OldCount[gen] = 0;
 	    s = NEXT_NODE(R_GenHeap[i].Old[gen]);
 	    while (s != R_GenHeap[i].Old[gen]) {
 		SEXP next = NEXT_NODE(s);
-		if (gen < NUM_OLD_GENERATIONS - 1)
-		    SET_NODE_GENERATION(s, gen + 1);
+		if (gen < num_old_generations - 1) {
+		    if (! gc_age_promotion ||
+			NODE_AGE(s) + 1 >= promotion_age[gen]) {
+			SET_NODE_GENERATION(s, gen + 1);
+			SET_NODE_AGE(s, 0);
+		    }
+		    else {
+			SET_NODE_AGE(s, NODE_AGE(s) + 1);
+			gc_promotion_held_back = TRUE;
+		    }
+		}
 		UNMARK_NODE(s);
 		s = next;
 	    }
@@ -1565,7 +2958,7 @@ static void RunGenCollect(R_size_t size_needed)
 
 #ifndef EXPEL_OLD_TO_NEW
     /* scan nodes in uncollected old generations with old-to-new pointers */
-    for (gen = num_old_gens_to_collect; gen < NUM_OLD_GENERATIONS; gen++)
+    for (gen = num_old_gens_to_collect; gen < num_old_generations; gen++)
 	for (i = 0; i < NUM_NODE_CLASSES; i++)
 	    for (s = NEXT_NODE(R_GenHeap[i].OldToNew[gen]);
 		 s != R_GenHeap[i].OldToNew[gen];
@@ -1574,83 +2967,22 @@ static void RunGenCollect(R_size_t size_needed)
 #endif
 
     /* forward all roots */
-    FORWARD_NODE(R_NilValue);	           /* Builtin constants */
-    FORWARD_NODE(NA_STRING);
-    FORWARD_NODE(R_BlankString);
-    FORWARD_NODE(R_BlankScalarString);
-    FORWARD_NODE(R_UnboundValue);
-    FORWARD_NODE(R_RestartToken);
-    FORWARD_NODE(R_MissingArg);
-
-    FORWARD_NODE(R_GlobalEnv);	           /* Global environment */
-    FORWARD_NODE(R_BaseEnv);
-    FORWARD_NODE(R_EmptyEnv);
-    FORWARD_NODE(R_Warnings);	           /* Warnings, if any */
-    FORWARD_NODE(R_ReturnedValue);
-
-    FORWARD_NODE(R_HandlerStack);          /* Condition handler stack */
-    FORWARD_NODE(R_RestartStack);          /* Available restarts stack */
-
-    FORWARD_NODE(R_Srcref);                /* Current source reference */
-
-    FORWARD_NODE(R_TrueValue);
-    FORWARD_NODE(R_FalseValue);
-    FORWARD_NODE(R_LogicalNAValue);
-
-    FORWARD_NODE(R_print.na_string);
-    FORWARD_NODE(R_print.na_string_noquote);
-
-    if (R_SymbolTable != NULL)             /* in case of GC during startup */
-	for (i = 0; i < HSIZE; i++)        /* Symbol table */
-	    FORWARD_NODE(R_SymbolTable[i]);
-
-    if (R_CurrentExpr != NULL)	           /* Current expression */
-	FORWARD_NODE(R_CurrentExpr);
-
-    for (i = 0; i < R_MaxDevices; i++) {   /* Device display lists */
-	pGEDevDesc gdd = GEgetDevice(i);
-	if (gdd) {
-	    FORWARD_NODE(gdd->displayList);
-	    FORWARD_NODE(gdd->savedSnapshot);
-	    if (gdd->dev)
-		FORWARD_NODE(gdd->dev->eventEnv);
-	}
-    }
+    forwarded_nodes = ForwardRoots(forwarded_nodes);
 
-    for (ctxt = R_GlobalContext ; ctxt != NULL ; ctxt = ctxt->nextcontext) {
-	FORWARD_NODE(ctxt->conexit);       /* on.exit expressions */
-	FORWARD_NODE(ctxt->promargs);	   /* promises supplied to closure */
-	FORWARD_NODE(ctxt->callfun);       /* the closure called */
-	FORWARD_NODE(ctxt->sysparent);     /* calling environment */
-	FORWARD_NODE(ctxt->call);          /* the call */
-	FORWARD_NODE(ctxt->cloenv);        /* the closure environment */
-	FORWARD_NODE(ctxt->handlerstack);  /* the condition handler stack */
-	FORWARD_NODE(ctxt->restartstack);  /* the available restarts stack */
-	FORWARD_NODE(ctxt->srcref);	   /* the current source reference */
-	FORWARD_NODE(ctxt->returnValue);   /* For on.exit calls */
+    /* main processing loop */
+#ifdef PARALLEL_MARK
+    if (gc_num_threads > 1 && gens_collected == num_old_generations &&
+	R_NodesInUse >= PAR_MARK_MIN_NODES && par_mark_init()) {
+	ParallelProcessNodes(forwarded_nodes);
+	forwarded_nodes = NULL;
     }
-
-    FORWARD_NODE(R_PreciousList);
-
-    for (i = 0; i < R_PPStackTop; i++)	   /* Protected pointers */
-	FORWARD_NODE(R_PPStack[i]);
-
-    FORWARD_NODE(R_VStack);		   /* R_alloc stack */
-
-    for (R_bcstack_t *sp = R_BCNodeStackBase; sp < R_BCNodeStackTop; sp++)
-#ifdef TYPED_STACK
-	if (sp->tag == 0 || IS_PARTIAL_SXP_TAG(sp->tag))
-	    FORWARD_NODE(sp->u.sxpval);
-#else
-	FORWARD_NODE(*sp);
+    else
 #endif
-
-    FORWARD_NODE(R_CachedScalarReal);
-    FORWARD_NODE(R_CachedScalarInteger);
-
-    /* main processing loop */
     PROCESS_NODES();
 
+#ifdef INCREMENTAL_GC
+ marked:
+#endif
     /* identify weakly reachable nodes */
     {
 	Rboolean recheck_weak_refs;
@@ -1757,6 +3089,12 @@ static void RunGenCollect(R_size_t size_needed)
 	PROCESS_NODES();
 #endif
 
+#ifdef R_MEMORY_PROFILING
+    /* note which sampled nodes have survived; the unmarked ones are
+       about to be freed */
+    R_SweepMemSamples();
+#endif
+
     /* release large vector allocations */
     ReleaseLargeFreeVectors();
 
@@ -1782,7 +3120,7 @@ static void RunGenCollect(R_size_t size_needed)
     /* update heap statistics */
     R_Collected = R_NSize;
     R_SmallVallocSize = 0;
-    for (gen = 0; gen < NUM_OLD_GENERATIONS; gen++) {
+    for (gen = 0; gen < num_old_generations; gen++) {
 	for (i = 1; i < NUM_SMALL_NODE_CLASSES; i++)
 	    R_SmallVallocSize += R_GenHeap[i].OldCount[gen] * NodeClassSize[i];
 	for (i = 0; i < NUM_NODE_CLASSES; i++)
@@ -1790,7 +3128,18 @@ static void RunGenCollect(R_size_t size_needed)
     }
     R_NodesInUse = R_NSize - R_Collected;
 
-    if (num_old_gens_to_collect < NUM_OLD_GENERATIONS) {
+#ifdef INCREMENTAL_GC
+    if (inc_finished) {
+	/* drop the triggers back from the cycle's allowances; R_Collected
+	   stays relative to the size at the start of this collection */
+	R_size_t vused = R_SmallVallocSize + R_LargeVallocSize + size_needed;
+	R_NSize = R_NodesInUse > gc_inc_NSize ? R_NodesInUse : gc_inc_NSize;
+	R_VSize = vused > gc_inc_VSize ? vused : gc_inc_VSize;
+	gc_inc_phase = INC_GC_IDLE;
+    }
+#endif
+
+    if (num_old_gens_to_collect < num_old_generations) {
 	if (R_Collected < R_MinFreeFrac * R_NSize ||
 	    VHEAP_FREE() < size_needed + R_MinFreeFrac * R_VSize) {
 	    num_old_gens_to_collect++;
@@ -1803,10 +3152,20 @@ static void RunGenCollect(R_size_t size_needed)
 
     gen_gc_counts[gens_collected]++;
 
-    if (gens_collected == NUM_OLD_GENERATIONS) {
+    if (gens_collected == num_old_generations) {
+	if (R_GCPauseTarget > 0) {
+	    gc_full_time = currentTime() - start_time;
+#ifdef INCREMENTAL_GC
+	    if (inc_finished)
+		gc_full_time += gc_inc_work_time;
+#endif
+	}
 	/**** do some adjustment for intermediate collections? */
 	AdjustHeapSize(size_needed);
-	TryToReleasePages();
+	if (compact)
+	    CompactPages();
+	else
+	    TryToReleasePages();
 	DEBUG_CHECK_NODE_COUNTS("after heap adjustment");
     }
     else if (gens_collected > 0) {
@@ -1814,16 +3173,21 @@ static void RunGenCollect(R_size_t size_needed)
 	DEBUG_CHECK_NODE_COUNTS("after heap adjustment");
     }
 #ifdef SORT_NODES
-    if (gens_collected == NUM_OLD_GENERATIONS)
+    /* sorting sweeps the whole heap, which would defeat the purpose of
+       an incremental cycle */
+    if (gens_collected == num_old_generations && ! inc_finished &&
+	! compact)
 	SortNodes();
 #endif
 
+    RecordGCEvent(gens_collected, large_before);
+
     if (gc_reporting) {
 	REprintf("Garbage collection %d = %d", gc_count, gen_gc_counts[0]);
-	for (i = 0; i < NUM_OLD_GENERATIONS; i++)
+	for (i = 0; i < num_old_generations; i++)
 	    REprintf("+%d", gen_gc_counts[i + 1]);
 	REprintf(" (level %d) ... ", gens_collected);
-	DEBUG_GC_SUMMARY(gens_collected == NUM_OLD_GENERATIONS);
+	DEBUG_GC_SUMMARY(gens_collected == num_old_generations);
     }
 }
 
@@ -1933,14 +3297,16 @@ void attribute_hidden get_current_mem(size_t *smallvsize,
 SEXP attribute_hidden do_gc(SEXP call, SEXP op, SEXP args, SEXP rho)
 {
     SEXP value;
-    int ogc, reset_max;
+    int ogc, reset_max, compact;
     R_size_t onsize = R_NSize /* can change during collection */;
 
     checkArity(op, args);
     ogc = gc_reporting;
     gc_reporting = asLogical(CAR(args));
     reset_max = asLogical(CADR(args));
-    num_old_gens_to_collect = NUM_OLD_GENERATIONS;
+    compact = asLogical(CADDR(args));
+    num_old_gens_to_collect = num_old_generations;
+    gc_compact_requested = compact == TRUE;
     R_gc();
 #ifndef IMMEDIATE_FINALIZERS
     R_RunPendingFinalizers();
@@ -2003,6 +3369,9 @@ void attribute_hidden InitMemory()
 
     init_gctorture();
     init_gc_grow_settings();
+    init_gc_generation_settings();
+    init_gc_thread_settings();
+    init_large_vec_policy();
 
     gc_reporting = R_Verbose;
     R_StandardPPStackSize = R_PPStackSize;
@@ -2020,7 +3389,7 @@ void attribute_hidden InitMemory()
     UNMARK_NODE(&UnmarkedNodeTemplate);
 
     for (i = 0; i < NUM_NODE_CLASSES; i++) {
-      for (gen = 0; gen < NUM_OLD_GENERATIONS; gen++) {
+      for (gen = 0; gen < MAX_NUM_OLD_GENERATIONS; gen++) {
 	R_GenHeap[i].Old[gen] = &R_GenHeap[i].OldPeg[gen];
 	SET_PREV_NODE(R_GenHeap[i].Old[gen], R_GenHeap[i].Old[gen]);
 	SET_NEXT_NODE(R_GenHeap[i].Old[gen], R_GenHeap[i].Old[gen]);
@@ -2041,6 +3410,11 @@ void attribute_hidden InitMemory()
     for (i = 0; i < NUM_NODE_CLASSES; i++)
 	R_GenHeap[i].Free = NEXT_NODE(R_GenHeap[i].New);
 
+#ifdef INCREMENTAL_GC
+    SET_PREV_NODE(GRAY_NODES, GRAY_NODES);
+    SET_NEXT_NODE(GRAY_NODES, GRAY_NODES);
+#endif
+
     SET_NODE_CLASS(&UnmarkedNodeTemplate, 0);
     orig_R_NSize = R_NSize;
     orig_R_VSize = R_VSize;
@@ -2192,6 +3566,87 @@ char *S_realloc(char *p, long new, long old, int size)
     return q;
 }
 
+/* Scratch arenas.  R_ArenaAlloc hands out memory from chunks
+   obtained with malloc, outside the heap, by bumping a pointer, so
+   scratch space used by C code adds nothing for the collector to
+   trace.  R_ArenaPush returns a mark and R_ArenaPop(mark) releases
+   everything allocated since; marks must be popped in the reverse
+   order to that in which they were pushed.  Each context records the
+   mark in force when it is begun and a jump to it pops back to that
+   mark, so scratch space is reclaimed on error or interrupt as for
+   R_alloc.  The most recently emptied chunk is kept for reuse. */
+
+typedef struct R_arena_chunk {
+    struct R_arena_chunk *prev;
+    char *top;    /* next free byte */
+    char *end;    /* end of the chunk */
+    union { double d; long double ld; void *p; } data;
+} R_arena_chunk;
+
+#define ARENA_CHUNK_SIZE 65536
+#define ARENA_ALIGN 16 /* enough for long double */
+
+static R_arena_chunk *R_ArenaChunks = NULL;
+static R_arena_chunk *R_ArenaSpare = NULL;
+
+#define ARENA_DATA(c) ((char *) &(c)->data)
+#define ARENA_IN_CHUNK(c, p) \
+    (ARENA_DATA(c) <= (char *) (p) && (char *) (p) <= (c)->end)
+
+void *R_ArenaPush(void)
+{
+    return R_ArenaChunks ? R_ArenaChunks->top : NULL;
+}
+
+void R_ArenaPop(void *mark)
+{
+    while (R_ArenaChunks && ! ARENA_IN_CHUNK(R_ArenaChunks, mark)) {
+	R_arena_chunk *c = R_ArenaChunks;
+	R_ArenaChunks = c->prev;
+	if (c->end - ARENA_DATA(c) == ARENA_CHUNK_SIZE) {
+	    free(R_ArenaSpare);
+	    R_ArenaSpare = c;
+	}
+	else free(c);
+    }
+    if (R_ArenaChunks)
+	R_ArenaChunks->top = mark;
+}
+
+void *R_ArenaAlloc(size_t nelem, int eltsize)
+{
+    /* doubles are a precaution against integer overflow on 32-bit */
+    double dsize = (double) nelem * eltsize;
+    if (dsize <= 0)
+	return NULL;
+    if (dsize > R_SIZE_T_MAX - sizeof(R_arena_chunk) - ARENA_ALIGN)
+	error(_("cannot allocate memory block of size %0.1f Gb"),
+	      dsize/R_pow_di(1024.0, 3));
+    size_t size = (nelem * eltsize + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+
+    R_arena_chunk *c = R_ArenaChunks;
+    if (c == NULL || (size_t) (c->end - c->top) < size) {
+	size_t csize = size > ARENA_CHUNK_SIZE ? size : ARENA_CHUNK_SIZE;
+	if (csize == ARENA_CHUNK_SIZE && R_ArenaSpare) {
+	    c = R_ArenaSpare;
+	    R_ArenaSpare = NULL;
+	}
+	else {
+	    c = malloc(sizeof(R_arena_chunk) + csize);
+	    if (c == NULL)
+		error(_("cannot allocate memory block of size %0.1f Mb"),
+		      dsize/R_pow_di(1024.0, 2));
+	}
+	c->top = ARENA_DATA(c);
+	c->end = c->top + csize;
+	c->prev = R_ArenaChunks;
+	R_ArenaChunks = c;
+    }
+    void *p = c->top;
+    c->top += size;
+    return p;
+}
+
 /* "allocSExp" allocate a SEXPREC */
 /* call gc if necessary */
 
@@ -2333,6 +3788,7 @@ SEXP NewEnvironment(SEXP namelist, SEXP valuelist, SEXP rho)
 SEXP attribute_hidden mkPROMISE(SEXP expr, SEXP rho)
 {
     SEXP s;
+    R_PERF_COUNT(PERF_PROMISE);
     if (FORCE_GC || NO_FREE_NODES()) {
 	PROTECT(expr);
 	PROTECT(rho);
@@ -2393,6 +3849,231 @@ static void custom_node_free(void *ptr) {
     }
 }
 
+/* Vectors backed by a file with mmap(), allocated with allocVector3
+   and a custom allocator.  The header of the node (the allocator copy
+   and the SEXPREC, with the long vector header if needed) is placed at
+   the end of an anonymous page, and the file is mapped with MAP_FIXED
+   directly after it so the data of the vector are the file contents.
+   Since such a node is in CUSTOM_NODE_CLASS it does not count towards
+   the vector heap, and when it is collected the mapping is removed.
+   Read-only vectors are mapped PROT_READ and marked not mutable, so R
+   code always copies them before modifying them; writable ones are
+   mapped shared so changes made in place go to the file.  Vectors made
+   by R_mmapVectorAt (for unserialize) map part of a file starting at
+   any offset, privately: changes are copy-on-write and never reach
+   the file. */
+
+#ifdef LARGE_VEC_MMAP
+# include <errno.h>
+# include <fcntl.h>
+# include <unistd.h>
+# include <sys/stat.h>
+
+typedef struct {
+    int fd;
+    int readonly;
+    int private;     /* mapped copy-on-write */
+    off_t offset;    /* of the data in the file */
+    size_t bytes;    /* the file data mapped */
+    char *base;      /* start of the whole mapping */
+    size_t maplen;   /* and its length */
+    char file[1];    /* the (expanded) file name, as given */
+} mmapvec_info_t;
+
+static void *mmapvec_alloc(R_allocator_t *allocator, size_t size)
+{
+    mmapvec_info_t *info = (mmapvec_info_t *) allocator->data;
+    size_t page = (size_t) sysconf(_SC_PAGESIZE);
+    size_t data = (info->bytes + sizeof(VECREC) - 1) / sizeof(VECREC)
+	* sizeof(VECREC);
+    size_t hdr = size - data;
+    if (hdr > page)
+	return NULL;
+    /* mappings must start on a page boundary in the file */
+    size_t skip = (size_t) (info->offset % page);
+    size_t len = page + (skip + info->bytes + page - 1) / page * page;
+    char *p = mmap(NULL, len, PROT_READ | PROT_WRITE,
+		   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED)
+	return NULL;
+    int prot = info->readonly ? PROT_READ : PROT_READ | PROT_WRITE;
+    int flags = info->private ? MAP_PRIVATE : MAP_SHARED;
+    if (mmap(p + page, skip + info->bytes, prot, flags | MAP_FIXED,
+	     info->fd, info->offset - (off_t) skip) == MAP_FAILED) {
+	munmap(p, len);
+	return NULL;
+    }
+    info->base = p;
+    info->maplen = len;
+    /* with an offset the header may run into the first file page,
+       which is only done for private mappings so the file is left
+       alone */
+    return p + page + skip - hdr;
+}
+
+static void mmapvec_free(R_allocator_t *allocator, void *ptr)
+{
+    mmapvec_info_t *info = (mmapvec_info_t *) allocator->data;
+    munmap(info->base, info->maplen);
+    free(info);
+}
+
+static void mmapvec_cleanup(void *data)
+{
+    mmapvec_info_t *info = (mmapvec_info_t *) data;
+    close(info->fd);
+    free(info);
+}
+#endif
+
+static SEXP mmapVector(const char *file, SEXPTYPE type, R_xlen_t length,
+		       double offset, Rboolean readonly, Rboolean private)
+{
+#ifdef LARGE_VEC_MMAP
+    size_t eltsize;
+    switch (type) {
+    case LGLSXP:
+    case INTSXP: eltsize = sizeof(int); break;
+    case REALSXP: eltsize = sizeof(double); break;
+    case CPLXSXP: eltsize = sizeof(Rcomplex); break;
+    case RAWSXP: eltsize = 1; break;
+    default:
+	error(_("cannot map vectors of type '%s'"), type2char(type));
+    }
+    const char *path = R_ExpandFileName(file);
+    int fd = open(path, (readonly || private) ? O_RDONLY : O_RDWR);
+    if (fd < 0)
+	error(_("cannot open file '%s': %s"), file, strerror(errno));
+    struct stat sb;
+    if (fstat(fd, &sb) != 0 || ! S_ISREG(sb.st_mode)) {
+	close(fd);
+	error(_("'%s' is not a regular file"), file);
+    }
+    if (length < 0)
+	length = (R_xlen_t) ((sb.st_size - offset) / eltsize);
+    if (offset + (double) length * eltsize > (double) sb.st_size) {
+	close(fd);
+	error(_("file '%s' is too short for %.0f elements"), file,
+	      (double) length);
+    }
+    if (length > R_XLEN_T_MAX) {
+	close(fd);
+	error(_("file '%s' is too long for a vector"), file);
+    }
+    if (length == 0) {
+	close(fd);
+	return allocVector(type, 0);
+    }
+    mmapvec_info_t *info = malloc(sizeof(mmapvec_info_t) + strlen(path));
+    if (info == NULL) {
+	close(fd);
+	error(_("cannot allocate memory for mapping file '%s'"), file);
+    }
+    info->fd = fd;
+    info->readonly = readonly;
+    info->private = private;
+    info->offset = (off_t) offset;
+    info->bytes = (size_t) length * eltsize;
+    info->base = NULL;
+    strcpy(info->file, path);
+    R_allocator_t allocator = { mmapvec_alloc, mmapvec_free, NULL, info };
+    SEXP ans;
+    /* allocVector3 signals an error if mapping fails, so release the
+       file and the information then; the file is only needed open
+       while mapping */
+    RCNTXT cntxt;
+    begincontext(&cntxt, CTXT_CCODE, R_NilValue, R_BaseEnv, R_BaseEnv,
+		 R_NilValue, R_NilValue);
+    cntxt.cend = &mmapvec_cleanup;
+    cntxt.cenddata = info;
+    ans = allocVector3(type, length, &allocator);
+    endcontext(&cntxt);
+    close(fd);
+    info->fd = -1;
+    if (readonly)
+	MARK_NOT_MUTABLE(ans);
+    return ans;
+#else
+    error(_("memory-mapped vectors are not supported on this platform"));
+    return R_NilValue; /* -Wall */
+#endif
+}
+
+SEXP R_mmapVector(const char *file, SEXPTYPE type, R_xlen_t length,
+		  Rboolean readonly)
+{
+    if (type != INTSXP && type != REALSXP && type != RAWSXP)
+	error(_("cannot map vectors of type '%s'"), type2char(type));
+    return mmapVector(file, type, length, 0, readonly, FALSE);
+}
+
+/* A private mapping of length elements of the given type starting at
+   offset in file, or NULL if vectors of that type cannot be mapped
+   here: the caller then reads the data itself */
+SEXP attribute_hidden R_mmapVectorAt(const char *file, SEXPTYPE type,
+				     R_xlen_t length, double offset)
+{
+#ifdef LARGE_VEC_MMAP
+    switch (type) {
+    case LGLSXP: case INTSXP: case REALSXP: case CPLXSXP: case RAWSXP:
+	break;
+    default:
+	return NULL;
+    }
+    return mmapVector(file, type, length, offset, FALSE, TRUE);
+#else
+    return NULL;
+#endif
+}
+
+#ifdef LARGE_VEC_MMAP
+static R_INLINE mmapvec_info_t *mmapvec_info(SEXP x)
+{
+    if (NODE_CLASS(x) != CUSTOM_NODE_CLASS)
+	return NULL;
+    void *mem = x;
+# ifdef LONG_VECTOR_SUPPORT
+    if (IS_LONG_VEC(x))
+	mem = ((char *) x) - sizeof(R_long_vec_hdr_t);
+# endif
+    R_allocator_t *allocator = ((R_allocator_t *) mem) - 1;
+    if (allocator->mem_alloc != mmapvec_alloc)
+	return NULL;
+    return (mmapvec_info_t *) allocator->data;
+}
+#endif
+
+/* The file a vector created by R_mmapVector maps, or NULL if it is
+   not such a vector */
+const char attribute_hidden *R_mmapVectorFile(SEXP x, Rboolean *readonly)
+{
+#ifdef LARGE_VEC_MMAP
+    mmapvec_info_t *info = mmapvec_info(x);
+    if (info != NULL && !info->private) {
+	*readonly = info->readonly;
+	return info->file;
+    }
+#endif
+    return NULL;
+}
+
+SEXP attribute_hidden do_mmapvector(SEXP call, SEXP op, SEXP args, SEXP env)
+{
+    checkArity(op, args);
+    SEXP file = CAR(args);
+    if (!isString(file) || LENGTH(file) != 1 || STRING_ELT(file, 0) == NA_STRING)
+	error(_("invalid '%s' argument"), "file");
+    SEXPTYPE type = str2type(CHAR(asChar(CADR(args))));
+    double dlen = asReal(CADDR(args));
+    if (!ISNA(dlen) && (ISNAN(dlen) || dlen < 0 || dlen > R_XLEN_T_MAX))
+	error(_("invalid '%s' argument"), "length");
+    int readonly = asLogical(CADDDR(args));
+    if (readonly == NA_LOGICAL)
+	error(_("invalid '%s' argument"), "readonly");
+    return R_mmapVector(translateChar(STRING_ELT(file, 0)), type,
+			ISNA(dlen) ? -1 : (R_xlen_t) dlen, readonly);
+}
+
 /* All vector objects must be a multiple of sizeof(SEXPREC_ALIGN)
    bytes so that alignment is preserved for all objects */
 
@@ -2554,20 +4235,13 @@ SEXP allocVector3(SEXPTYPE type, R_xlen_t length, R_allocator_t *allocator)
 	node_class = CUSTOM_NODE_CLASS;
 	alloc_size = size;
     } else {
-	if (size <= NodeClassSize[1]) {
-	    node_class = 1;
-	    alloc_size = NodeClassSize[1];
+	if (size <= SMALL_VEC_MAX_SIZE) {
+	    node_class = SizeNodeClass[size];
+	    alloc_size = NodeClassSize[node_class];
 	}
 	else {
 	    node_class = LARGE_NODE_CLASS;
 	    alloc_size = size;
-	    for (i = 2; i < NUM_SMALL_NODE_CLASSES; i++) {
-		if (size <= NodeClassSize[i]) {
-		    node_class = i;
-		    alloc_size = NodeClassSize[i];
-		    break;
-		}
-	    }
 	}
     }
 
@@ -2606,7 +4280,7 @@ SEXP allocVector3(SEXPTYPE type, R_xlen_t length, R_allocator_t *allocator)
 	    if (size < (R_SIZE_T_MAX / sizeof(VECREC)) - hdrsize) { /*** not sure this test is quite right -- why subtract the header? LT */
 		mem = allocator ?
 		    custom_node_alloc(allocator, hdrsize + size * sizeof(VECREC)) :
-		    malloc(hdrsize + size * sizeof(VECREC));
+		    large_vec_alloc(hdrsize + size * sizeof(VECREC));
 		if (mem == NULL) {
 		    /* If we are near the address space limit, we
 		       might be short of address space.  So return
@@ -2614,7 +4288,7 @@ SEXP allocVector3(SEXPTYPE type, R_xlen_t length, R_allocator_t *allocator)
 		    R_gc_full(alloc_size);
 		    mem = allocator ?
 			custom_node_alloc(allocator, hdrsize + size * sizeof(VECREC)) :
-			malloc(hdrsize + size * sizeof(VECREC));
+			large_vec_alloc(hdrsize + size * sizeof(VECREC));
 		}
 		if (mem != NULL) {
 #ifdef LONG_VECTOR_SUPPORT
@@ -2661,8 +4335,10 @@ SEXP allocVector3(SEXPTYPE type, R_xlen_t length, R_allocator_t *allocator)
 	    SET_NODE_CLASS(s, node_class);
 	    if (!allocator) R_LargeVallocSize += size;
 	    R_GenHeap[node_class].AllocCount++;
+	    R_GenHeap[node_class].InUse++;
 	    R_NodesInUse++;
 	    SNAP_NODE(s, R_GenHeap[node_class].New);
+	    SAMPLE_ALLOCATION(s, hdrsize + size * sizeof(VECREC));
 	}
 	ATTRIB(s) = R_NilValue;
 	TYPEOF(s) = type;
@@ -2795,12 +4471,14 @@ SEXP allocFormalsList6(SEXP sym1, SEXP sym2, SEXP sym3, SEXP sym4,
 
 void R_gc(void)
 {
+    gc_full_requested = TRUE;
     R_gc_internal(0);
 }
 
 static void R_gc_full(R_size_t size_needed)
 {
-    num_old_gens_to_collect = NUM_OLD_GENERATIONS;
+    num_old_gens_to_collect = num_old_generations;
+    gc_full_requested = TRUE;
     R_gc_internal(size_needed);
 }
 
@@ -2855,6 +4533,63 @@ static void gc_end_timing(void)
     }
 }
 
+/* .Internal(gc.events(size)): the logged events as a list of columns,
+   oldest first, then start a new log of 'size' events unless NULL */
+SEXP attribute_hidden do_gcevents(SEXP call, SEXP op, SEXP args, SEXP env)
+{
+    static const char *names[] = {
+	"number", "level", "elapsed",
+	"freed.nodes", "freed.vec8", "freed.vec16", "freed.vec32",
+	"freed.vec64", "freed.vec128", "freed.custom", "freed.large",
+	"large", "nsize", "vsize"
+    };
+    int ncols = (int) (sizeof(names) / sizeof(names[0]));
+    int size = 0;
+
+    checkArity(op, args);
+    if (CAR(args) != R_NilValue) {
+	size = asInteger(CAR(args));
+	if (size == NA_INTEGER || size < 0)
+	    error(_("invalid '%s' argument"), "size");
+    }
+
+    int n = gc_event_log_count;
+    int first = gc_event_log_next - n + gc_event_log_size;
+    SEXP ans = PROTECT(allocVector(VECSXP, ncols));
+    SEXP nms = PROTECT(allocVector(STRSXP, ncols));
+    for (int j = 0; j < ncols; j++) {
+	SET_STRING_ELT(nms, j, mkChar(names[j]));
+	SET_VECTOR_ELT(ans, j, allocVector(j < 2 ? INTSXP : REALSXP, n));
+    }
+    for (int k = 0; k < n; k++) {
+	R_GCEvent *e = gc_event_log + (first + k) % gc_event_log_size;
+	INTEGER(VECTOR_ELT(ans, 0))[k] = e->number;
+	INTEGER(VECTOR_ELT(ans, 1))[k] = e->level;
+	REAL(VECTOR_ELT(ans, 2))[k] = e->elapsed;
+	for (int i = 0; i < R_GC_EVENT_CLASSES; i++)
+	    REAL(VECTOR_ELT(ans, 3 + i))[k] = e->freed[i];
+	REAL(VECTOR_ELT(ans, 11))[k] = e->large;
+	REAL(VECTOR_ELT(ans, 12))[k] = e->nsize;
+	REAL(VECTOR_ELT(ans, 13))[k] = e->vsize;
+    }
+    setAttrib(ans, R_NamesSymbol, nms);
+
+    if (CAR(args) != R_NilValue) {
+	R_GCEvent *log = NULL;
+	if (size > 0) {
+	    log = malloc(size * sizeof(R_GCEvent));
+	    if (log == NULL)
+		error(_("cannot allocate log of %d GC events"), size);
+	}
+	free(gc_event_log);
+	gc_event_log = log;
+	gc_event_log_size = size;
+	gc_event_log_count = gc_event_log_next = 0;
+    }
+    UNPROTECT(2);
+    return ans;
+}
+
 #define R_MAX(a,b) (a) < (b) ? (b) : (a)
 
 static void R_gc_internal(R_size_t size_needed)
@@ -2884,15 +4619,24 @@ static void R_gc_internal(R_size_t size_needed)
 #endif
 
     gc_count++;
+    R_PERF_COUNT(PERF_GC);
+    R_EnvEpoch++; /* lookup caches may refer to dead objects */
 
     R_N_maxused = R_MAX(R_N_maxused, R_NodesInUse);
     R_V_maxused = R_MAX(R_V_maxused, R_VSize - VHEAP_FREE());
 
     BEGIN_SUSPEND_INTERRUPTS {
+	double start = GC_EVENTS_WANTED() ? currentTime() : 0;
 	R_in_gc = TRUE;
 	gc_start_timing();
 	RunGenCollect(size_needed);
+#ifdef FINALIZER_THREAD
+	if (R_finalizers_pending)
+	    QueueThreadSafeFinalizers();
+#endif
 	gc_end_timing();
+	if (GC_EVENTS_WANTED())
+	    ReportGCEvent(currentTime() - start);
 	R_in_gc = FALSE;
     } END_SUSPEND_INTERRUPTS;
 
@@ -2905,7 +4649,7 @@ static void R_gc_internal(R_size_t size_needed)
 	first_bad_sexp_type_line = bad_sexp_type_line;
     }
 
-    if (gc_reporting) {
+    if (gc_reporting && ! GC_CYCLE_IN_PROGRESS()) {
 	ncells = onsize - R_Collected;
 	nfrac = (100.0 * ncells) / R_NSize;
 	/* We try to make this consistent with the results returned by gc */
@@ -2917,6 +4661,19 @@ static void R_gc_internal(R_size_t size_needed)
 	vcells = 0.1*ceil(10*vcells * vsfac/Mega);
 	REprintf("%.1f Mbytes of vectors used (%d%%)\n",
 		 vcells, (int) (vfrac + 0.5));
+	REprintf("Nodes in old generations:");
+	for (int gen = 0; gen < num_old_generations; gen++) {
+	    R_size_t count = 0;
+	    for (int i = 0; i < NUM_NODE_CLASSES; i++)
+		count += R_GenHeap[i].OldCount[gen];
+	    REprintf(" %lu", (unsigned long) count);
+	}
+	REprintf("\n");
+	if (large_vec_policy)
+	    REprintf("%.1f Mbytes in %lu mapped large vectors (policy %s)\n",
+		     0.1*ceil(10. * large_vec_mapped_bytes/Mega),
+		     (unsigned long) large_vec_mapped,
+		     large_vec_policy_name());
     }
 
 #ifdef IMMEDIATE_FINALIZERS
@@ -3019,9 +4776,9 @@ SEXP attribute_hidden do_memoryprofile(SEXP call, SEXP op, SEXP args, SEXP env)
       int gen;
 
       /* run a full GC to make sure that all stuff in use is in Old space */
-      num_old_gens_to_collect = NUM_OLD_GENERATIONS;
+      num_old_gens_to_collect = num_old_generations;
       R_gc();
-      for (gen = 0; gen < NUM_OLD_GENERATIONS; gen++) {
+      for (gen = 0; gen < num_old_generations; gen++) {
 	for (i = 0; i < NUM_NODE_CLASSES; i++) {
 	  SEXP s;
 	  for (s = NEXT_NODE(R_GenHeap[i].Old[gen]);
@@ -3038,6 +4795,37 @@ SEXP attribute_hidden do_memoryprofile(SEXP call, SEXP op, SEXP args, SEXP env)
     return ans;
 }
 
+/* perfStats(reset): the counts of interpreter events kept in
+   R_PerfStats (see Defn.h) since the start of the session or the last
+   reset, optionally resetting them. */
+static const char * const PerfStatsNames[PERF_NCOUNTERS] = {
+    "duplicate", "promise", "context", "jit.compile", "gc",
+    "string.lookup", "string.new", "string.resize", "global.cache.flush"
+};
+
+SEXP attribute_hidden do_perfstats(SEXP call, SEXP op, SEXP args, SEXP env)
+{
+    SEXP ans, nms;
+    int i, reset;
+
+    checkArity(op, args);
+    reset = asLogical(CAR(args));
+    if (reset == NA_LOGICAL)
+	error(_("invalid '%s' argument"), "reset");
+    PROTECT(ans = allocVector(REALSXP, PERF_NCOUNTERS));
+    PROTECT(nms = allocVector(STRSXP, PERF_NCOUNTERS));
+    for (i = 0; i < PERF_NCOUNTERS; i++)
+	SET_STRING_ELT(nms, i, mkChar(PerfStatsNames[i]));
+    setAttrib(ans, R_NamesSymbol, nms);
+    /* making the names counts too, so take the snapshot last */
+    for (i = 0; i < PERF_NCOUNTERS; i++) {
+	REAL(ans)[i] = (double) R_PerfStats[i];
+	if (reset) R_PerfStats[i] = 0;
+    }
+    UNPROTECT(2);
+    return ans;
+}
+
 /* "protect" push a single argument onto R_PPStack */
 
 /* In handling a stack overflow we have to be careful not to use
@@ -3732,11 +5520,16 @@ void attribute_hidden (SET_ASCII)(SEXP x) { SET_ASCII(x); }
 int  (ENC_KNOWN)(SEXP x) { return ENC_KNOWN(x); }
 void attribute_hidden (SET_CACHED)(SEXP x) { SET_CACHED(x); }
 int  (IS_CACHED)(SEXP x) { return IS_CACHED(x); }
+int  attribute_hidden (SORTED)(SEXP x) { return SORTED(x); }
+void attribute_hidden (SET_SORTED)(SEXP x, int v) { SET_SORTED(x, v); }
 
 /*******************************************/
 /* Non-sampling memory use profiler
    reports all large vector heap
-   allocations and all calls to GetNewPage */
+   allocations and all calls to GetNewPage,
+   or with a sampling interval writes a
+   binary profile of a sample of all
+   allocations */
 /*******************************************/
 
 #ifndef R_MEMORY_PROFILING
@@ -3789,8 +5582,189 @@ static void R_ReportNewPage(void)
     return;
 }
 
+/* The sampling profile.  After a header of the bytes "RPM1" and the
+   sampling interval as a double, it is a sequence of records, each a
+   one-byte tag followed by native ints and doubles:
+
+     'N' id len chars	the function name with that id
+     'A' id size weight pc depth name-id...
+			 a node of 'size' bytes was sampled, standing for
+			 'weight' bytes allocated; pc is the position in
+			 the byte code of the innermost closure, or -1.
+			 The stack is given innermost first.
+     'D' id type gcs	sample 'id' was found unused, of type 'type',
+			 having survived 'gcs' collections
+     'L' id type gcs	the same for a sample still in use at the end
+
+   Function name 0 is "<Anonymous>".  Sampled nodes are not protected:
+   they are checked after the marking phase of each collection, before
+   the unmarked ones are reused.  summaryRprofmem() in utils reads
+   these files. */
+
+#define MEM_SAMPLE_MAX_DEPTH 100
+
+static Rboolean R_IsMemSampling = FALSE;
+static int R_MemSampleCount;
+
+static struct {
+    SEXP s;
+    int id, gcs;
+} *R_MemSamples = NULL;
+static int R_MemSamplesUsed = 0, R_MemSamplesSize = 0;
+
+/* function names seen, a hash table of PRINTNAME's with their ids */
+static SEXP *R_MemSampleNames = NULL;
+static int *R_MemSampleNameIds = NULL;
+static int R_MemSampleNamesSize = 0, R_MemSampleNamesUsed = 0;
+
+static void R_MemSampleWriteInts(int *x, int n)
+{
+    fwrite(x, sizeof(int), n, R_MemReportingOutfile);
+}
+
+static int R_MemSampleHash(SEXP name, int size)
+{
+    return (int) (((uintptr_t) name >> 4) & (size - 1));
+}
+
+static int R_MemSampleNameId(SEXP name)
+{
+    int h, id;
+
+    if (R_MemSampleNamesUsed >= R_MemSampleNamesSize / 2) {
+	int size = R_MemSampleNamesSize ? 2 * R_MemSampleNamesSize : 256;
+	SEXP *names = calloc(size, sizeof(SEXP));
+	int *ids = malloc(size * sizeof(int));
+	if (names == NULL || ids == NULL) {
+	    free(names);
+	    free(ids);
+	    return 0;
+	}
+	for (int i = 0; i < R_MemSampleNamesSize; i++)
+	    if (R_MemSampleNames[i] != NULL) {
+		h = R_MemSampleHash(R_MemSampleNames[i], size);
+		while (names[h] != NULL) h = (h + 1) & (size - 1);
+		names[h] = R_MemSampleNames[i];
+		ids[h] = R_MemSampleNameIds[i];
+	    }
+	free(R_MemSampleNames);
+	free(R_MemSampleNameIds);
+	R_MemSampleNames = names;
+	R_MemSampleNameIds = ids;
+	R_MemSampleNamesSize = size;
+    }
+
+    h = R_MemSampleHash(name, R_MemSampleNamesSize);
+    while (R_MemSampleNames[h] != NULL) {
+	if (R_MemSampleNames[h] == name)
+	    return R_MemSampleNameIds[h];
+	h = (h + 1) & (R_MemSampleNamesSize - 1);
+    }
+    id = ++R_MemSampleNamesUsed;
+    R_MemSampleNames[h] = name;
+    R_MemSampleNameIds[h] = id;
+
+    int rec[2] = { id, (int) strlen(CHAR(name)) };
+    fputc('N', R_MemReportingOutfile);
+    R_MemSampleWriteInts(rec, 2);
+    fwrite(CHAR(name), 1, rec[1], R_MemReportingOutfile);
+    return id;
+}
+
+static void R_SampleAllocation(SEXP s, R_size_t size)
+{
+    static int stack[MEM_SAMPLE_MAX_DEPTH];
+    double sizes[2];
+    int rec[3], depth = 0;
+    Rboolean closure_seen = FALSE;
+    RCNTXT *cptr;
+
+    sizes[0] = (double) size;
+    sizes[1] = (double) R_MemSampleBytes;
+    R_MemSampleBytes = 0;
+    if (! R_IsMemSampling)
+	return;
+
+    if (R_MemSamplesUsed == R_MemSamplesSize) {
+	int n = R_MemSamplesSize ? 2 * R_MemSamplesSize : 1024;
+	void *new = realloc(R_MemSamples, n * sizeof(*R_MemSamples));
+	if (new == NULL) return; /* skip this sample */
+	R_MemSamples = new;
+	R_MemSamplesSize = n;
+    }
+
+    rec[0] = R_MemSampleCount++;
+    rec[1] = -1;
+    for (cptr = R_GlobalContext;
+	 cptr != NULL && depth < MEM_SAMPLE_MAX_DEPTH;
+	 cptr = cptr->nextcontext)
+	if ((cptr->callflag & (CTXT_FUNCTION | CTXT_BUILTIN))
+	    && TYPEOF(cptr->call) == LANGSXP) {
+	    SEXP fun = CAR(cptr->call);
+	    if ((cptr->callflag & CTXT_FUNCTION) && ! closure_seen) {
+		closure_seen = TRUE;
+		if (TYPEOF(BODY(cptr->callfun)) == BCODESXP)
+		    rec[1] = R_BCCurrentPC(BODY(cptr->callfun));
+	    }
+	    stack[depth++] = TYPEOF(fun) == SYMSXP ?
+		R_MemSampleNameId(PRINTNAME(fun)) : 0;
+	}
+    rec[2] = depth;
+
+    fputc('A', R_MemReportingOutfile);
+    R_MemSampleWriteInts(rec, 1);
+    fwrite(sizes, sizeof(double), 2, R_MemReportingOutfile);
+    R_MemSampleWriteInts(rec + 1, 2);
+    R_MemSampleWriteInts(stack, depth);
+
+    R_MemSamples[R_MemSamplesUsed].s = s;
+    R_MemSamples[R_MemSamplesUsed].id = rec[0];
+    R_MemSamples[R_MemSamplesUsed].gcs = 0;
+    R_MemSamplesUsed++;
+}
+
+static void R_WriteMemSample(int tag, int i)
+{
+    int rec[3] = { R_MemSamples[i].id, TYPEOF(R_MemSamples[i].s),
+		   R_MemSamples[i].gcs };
+    fputc(tag, R_MemReportingOutfile);
+    R_MemSampleWriteInts(rec, 3);
+}
+
+static void R_SweepMemSamples(void)
+{
+    int i, j;
+
+    for (i = 0, j = 0; i < R_MemSamplesUsed; i++) {
+	if (NODE_IS_MARKED(R_MemSamples[i].s)) {
+	    R_MemSamples[i].gcs++;
+	    R_MemSamples[j++] = R_MemSamples[i];
+	}
+	else R_WriteMemSample('D', i);
+    }
+    R_MemSamplesUsed = j;
+}
+
+static void R_EndMemSampling(void)
+{
+    for (int i = 0; i < R_MemSamplesUsed; i++)
+	R_WriteMemSample('L', i);
+    free(R_MemSamples);
+    free(R_MemSampleNames);
+    free(R_MemSampleNameIds);
+    R_MemSamples = NULL;
+    R_MemSampleNames = NULL;
+    R_MemSampleNameIds = NULL;
+    R_MemSamplesUsed = R_MemSamplesSize = 0;
+    R_MemSampleNamesUsed = R_MemSampleNamesSize = 0;
+    R_MemSampleInterval = R_SIZE_T_MAX;
+    R_IsMemSampling = FALSE;
+}
+
 static void R_EndMemReporting()
 {
+    if (R_IsMemSampling)
+	R_EndMemSampling();
     if(R_MemReportingOutfile != NULL) {
 	/* does not fclose always flush? */
 	fflush(R_MemReportingOutfile);
@@ -3802,12 +5776,24 @@ static void R_EndMemReporting()
 }
 
 static void R_InitMemReporting(SEXP filename, int append,
-			       R_size_t threshold)
+			       R_size_t threshold, R_size_t interval)
 {
     if(R_MemReportingOutfile != NULL) R_EndMemReporting();
-    R_MemReportingOutfile = RC_fopen(filename, append ? "a" : "w", TRUE);
+    R_MemReportingOutfile = RC_fopen(filename,
+				     interval > 0 ? (append ? "ab" : "wb") :
+				     (append ? "a" : "w"), TRUE);
     if (R_MemReportingOutfile == NULL)
 	error(_("Rprofmem: cannot open output file '%s'"), filename);
+    if (interval > 0) {
+	double dinterval = (double) interval;
+	fwrite("RPM1", 1, 4, R_MemReportingOutfile);
+	fwrite(&dinterval, sizeof(double), 1, R_MemReportingOutfile);
+	R_MemSampleCount = 0;
+	R_MemSampleBytes = 0;
+	R_MemSampleInterval = interval;
+	R_IsMemSampling = TRUE;
+	return;
+    }
     R_MemReportingThreshold = threshold;
     R_IsMemReporting = 1;
     return;
@@ -3816,7 +5802,7 @@ static void R_InitMemReporting(SEXP filename, int append,
 SEXP do_Rprofmem(SEXP args)
 {
     SEXP filename;
-    R_size_t threshold;
+    R_size_t threshold, interval;
     int append_mode;
 
     if (!isString(CAR(args)) || (LENGTH(CAR(args))) != 1)
@@ -3824,8 +5810,12 @@ SEXP do_Rprofmem(SEXP args)
     append_mode = asLogical(CADR(args));
     filename = STRING_ELT(CAR(args), 0);
     threshold = (R_size_t) REAL(CADDR(args))[0];
+    double dinterval = asReal(CADDDR(args));
+    if (!R_FINITE(dinterval) || dinterval < 0)
+	error(_("invalid '%s' argument"), "interval");
+    interval = (R_size_t) dinterval;
     if (strlen(CHAR(filename)))
-	R_InitMemReporting(filename, append_mode, threshold);
+	R_InitMemReporting(filename, append_mode, threshold, interval);
     else
 	R_EndMemReporting();
     return R_NilValue;
@@ -1,7 +1,7 @@
 /*
  *  R : A Computer Language for Statistical Data Analysis
  *  Copyright (C) 1995, 1996  Robert Gentleman and Ross Ihaka
- *  Copyright (C) 1997--2016  The R Core Team
+ *  Copyright (C) 1997--2017  The R Core Team
  *  Copyright (C) 2003--2016  The R Foundation
  *
  *  This program is free software; you can redistribute it and/or modify
@@ -252,6 +252,14 @@ FUNTAB R_FunTab[] =
 {"pmax",	do_pmin,	1,	11,	-1,	{PP_FUNCALL, PREC_FN,	0}},
 {"which.max",	do_first_min,	1,	11,	1,	{PP_FUNCALL, PREC_FN,	0}},
 {"match",	do_match,	0,	11,	4,	{PP_FUNCALL, PREC_FN,	0}},
+{"hashIndex",	do_hashindex,	0,	11,	1,	{PP_FUNCALL, PREC_FN,	0}},
+{"hashIndexTable",do_hashindex,	1,	11,	1,	{PP_FUNCALL, PREC_FN,	0}},
+{"hashIndexDuplicated",do_hashindex,2,	11,	1,	{PP_FUNCALL, PREC_FN,	0}},
+{"hashIndexAnyDuplicated",do_hashindex,3,11,	1,	{PP_FUNCALL, PREC_FN,	0}},
+{"matchRows",	do_matchrows,	0,	11,	5,	{PP_FUNCALL, PREC_FN,	0}},
+{"duplicatedRows",do_matchrows,	1,	11,	3,	{PP_FUNCALL, PREC_FN,	0}},
+{"anyDuplicatedRows",do_matchrows,2,	11,	3,	{PP_FUNCALL, PREC_FN,	0}},
+{"joinRows",	do_joinrows,	0,	11,	6,	{PP_FUNCALL, PREC_FN,	0}},
 {"pmatch",	do_pmatch,	0,	11,	4,	{PP_FUNCALL, PREC_FN,	0}},
 {"charmatch",	do_charmatch,	0,	11,	3,	{PP_FUNCALL, PREC_FN,	0}},
 {"match.call",	do_matchcall,	0,	11,	4,	{PP_FUNCALL, PREC_FN,	0}},
@@ -475,6 +483,7 @@ FUNTAB R_FunTab[] =
 
 {"sample",	do_sample,	0,	11,	4,	{PP_FUNCALL, PREC_FN,	0}},
 {"sample2",	do_sample2,	0,	11,	2,	{PP_FUNCALL, PREC_FN,	0}},
+{"aliasTable",	do_aliastable,	0,	11,	1,	{PP_FUNCALL, PREC_FN,	0}},
 
 {"RNGkind",	do_RNGkind,	0,	11,	2,	{PP_FUNCALL, PREC_FN,	0}},
 {"set.seed",	do_setseed,	0,	111,	3,	{PP_FUNCALL, PREC_FN,	0}},
@@ -488,6 +497,8 @@ FUNTAB R_FunTab[] =
 
 {"mean",	do_summary,	1,	11,	1,	{PP_FUNCALL, PREC_FN,	0}},
 {"range",	do_range,	0,	1,	-1,	{PP_FUNCALL, PREC_FN,	0}},
+{"summaryStats",do_summarystats,0,	11,	5,	{PP_FUNCALL, PREC_FN,	0}},
+{"groupAggregate",do_groupaggregate,0,	11,	5,	{PP_FUNCALL, PREC_FN,	0}},
 
 /* Note that the number of arguments in this group only applies
    to the default method */
@@ -527,7 +538,7 @@ FUNTAB R_FunTab[] =
 {"startsWith",	do_startsWith,  0,	11,	2,	{PP_FUNCALL, PREC_FN,	0}},
 {"endsWith",	do_startsWith,  1,	11,	2,	{PP_FUNCALL, PREC_FN,	0}},
 {"substr<-",	do_substrgets,	1,	11,	4,	{PP_FUNCALL, PREC_FN,	0}},
-{"strsplit",	do_strsplit,	1,	11,	5,	{PP_FUNCALL, PREC_FN,	0}},
+{"strsplit",	do_strsplit,	1,	11,	6,	{PP_FUNCALL, PREC_FN,	0}},
 {"abbreviate",	do_abbrev,	1,	11,	3,	{PP_FUNCALL, PREC_FN,	0}},
 {"make.names",	do_makenames,	0,	11,	2,	{PP_FUNCALL, PREC_FN,	0}},
 {"pcre_config", do_pcre_config,	1,	11,	0,	{PP_FUNCALL, PREC_FN,	0}},
@@ -668,8 +679,8 @@ FUNTAB R_FunTab[] =
 {"saveToConn",	do_saveToConn,	0,	111,	6,	{PP_FUNCALL, PREC_FN,	0}},
 {"load",	do_load,	0,	111,	2,	{PP_FUNCALL, PREC_FN,	0}},
 {"loadFromConn2",do_loadFromConn2,0,	111,	3,	{PP_FUNCALL, PREC_FN,	0}},
-{"serializeToConn",	do_serializeToConn,	0,	111,	5,	{PP_FUNCALL, PREC_FN,	0}},
-{"unserializeFromConn",	do_unserializeFromConn,	0,	11,	2,	{PP_FUNCALL, PREC_FN,	0}},
+{"serializeToConn",	do_serializeToConn,	0,	111,	6,	{PP_FUNCALL, PREC_FN,	0}},
+{"unserializeFromConn",	do_unserializeFromConn,	0,	11,	3,	{PP_FUNCALL, PREC_FN,	0}},
 {"deparse",	do_deparse,	0,	11,	5,	{PP_FUNCALL, PREC_FN,	0}},
 {"dput",	do_dput,	0,	111,	3,	{PP_FUNCALL, PREC_FN,	0}},
 {"dump",	do_dump,	0,	111,	5,	{PP_FUNCALL, PREC_FN,	0}},
@@ -678,11 +689,14 @@ FUNTAB R_FunTab[] =
 {"print.default",do_printdefault,0,	111,	9,	{PP_FUNCALL, PREC_FN,	0}},
 {"print.function",do_printfunction,0,	111,	-1,	{PP_FUNCALL, PREC_FN,	0}},
 {"prmatrix",	do_prmatrix,	0,	111,	6,	{PP_FUNCALL, PREC_FN,	0}},
-{"gc",		do_gc,		0,	11,	2,	{PP_FUNCALL, PREC_FN,	0}},
+{"gc",		do_gc,		0,	11,	3,	{PP_FUNCALL, PREC_FN,	0}},
 {"gcinfo",	do_gcinfo,	0,	11,	1,	{PP_FUNCALL, PREC_FN,	0}},
+{"gc.events",	do_gcevents,	0,	11,	1,	{PP_FUNCALL, PREC_FN,	0}},
 {"gctorture",	do_gctorture,	0,	111,	1,	{PP_FUNCALL, PREC_FN,	0}},
 {"gctorture2",	do_gctorture2,	0,	11,	3,	{PP_FUNCALL, PREC_FN,	0}},
 {"memory.profile",do_memoryprofile, 0,	11,	0,	{PP_FUNCALL, PREC_FN,	0}},
+{"perfStats",	do_perfstats,	0,	11,	1,	{PP_FUNCALL, PREC_FN,	0}},
+{"mmapVector",	do_mmapvector,	0,	11,	4,	{PP_FUNCALL, PREC_FN,	0}},
 {"split",	do_split,	0,	11,	2,	{PP_FUNCALL, PREC_FN,	0}},
 {"is.loaded",	do_isloaded,	0,	11,	-1,	{PP_FOREIGN, PREC_FN,	0}},
 {"recordGraphics", do_recordGraphics, 0, 211,     3,      {PP_FOREIGN, PREC_FN,	0}},
@@ -710,6 +724,8 @@ FUNTAB R_FunTab[] =
 {"is.unsorted",	do_isunsorted,	0,	11,	2,	{PP_FUNCALL, PREC_FN,	0}},
 {"psort",	do_psort,	0,	11,	2,	{PP_FUNCALL, PREC_FN,	0}},
 {"qsort",	do_qsort,	0,	11,	2,	{PP_FUNCALL, PREC_FN,	0}},
+{"setSorted",	do_setsorted,	0,	11,	3,	{PP_FUNCALL, PREC_FN,	0}},
+{"isKnownSorted",do_isknownsorted,0,	11,	3,	{PP_FUNCALL, PREC_FN,	0}},
 {"radixsort",	do_radixsort,	0,	11,	-1,	{PP_FUNCALL, PREC_FN,	0}},
 {"order",	do_order,	0,	11,	-1,	{PP_FUNCALL, PREC_FN,	0}},
 {"rank",	do_rank,	0,	11,	3,	{PP_FUNCALL, PREC_FN,	0}},
@@ -824,7 +840,11 @@ FUNTAB R_FunTab[] =
 {"growconst", do_growconst,     0,      11,     1,      {PP_FUNCALL, PREC_FN, 0}},
 {"putconst", do_putconst,       0,      11,     3,      {PP_FUNCALL, PREC_FN, 0}},
 {"getconst", do_getconst,       0,      11,     2,      {PP_FUNCALL, PREC_FN, 0}},
-{"enableJIT",    do_enablejit,  0,      11,     1,      {PP_FUNCALL, PREC_FN, 0}},
+{"enableJIT",    do_enablejit,  0,      11,     2,      {PP_FUNCALL, PREC_FN, 0}},
+{"jitStats",	do_jitstats,	0,	11,	1,	{PP_FUNCALL, PREC_FN, 0}},
+{"enableLoopKernels", do_enableloopkernels, 0, 11, 1,	{PP_FUNCALL, PREC_FN, 0}},
+{"fusedArith",	do_fusedarith,	0,	11,	-1,	{PP_FUNCALL, PREC_FN,	0}},
+{"fusedAnyAll",	do_fusedarith,	1,	11,	-1,	{PP_FUNCALL, PREC_FN,	0}},
 {"compilePKGS", do_compilepkgs, 0,      11,     1,      {PP_FUNCALL, PREC_FN, 0}},
 
 {"setNumMathThreads", do_setnumthreads,      0,      11,     1,      {PP_FUNCALL, PREC_FN, 0}},
@@ -847,13 +867,15 @@ FUNTAB R_FunTab[] =
 {"isSeekable",	do_isseekable,	0,      11,     1,      {PP_FUNCALL, PREC_FN,	0}},
 {"close",	do_close,	0,      111,     2,      {PP_FUNCALL, PREC_FN,	0}},
 {"flush",	do_flush,	0,      111,     1,      {PP_FUNCALL, PREC_FN,	0}},
-{"file",	do_url,		1,      11,     6,      {PP_FUNCALL, PREC_FN,	0}},
+{"file",	do_url,		1,      11,     7,      {PP_FUNCALL, PREC_FN,	0}},
 {"url",		do_url,		0,      11,     5,      {PP_FUNCALL, PREC_FN,	0}},
 {"pipe",	do_pipe,	0,      11,     3,      {PP_FUNCALL, PREC_FN,	0}},
 {"fifo",	do_fifo,	0,      11,     4,      {PP_FUNCALL, PREC_FN,	0}},
-{"gzfile",	do_gzfile,	0,      11,     4,      {PP_FUNCALL, PREC_FN,	0}},
+{"gzfile",	do_gzfile,	0,      11,     5,      {PP_FUNCALL, PREC_FN,	0}},
 {"bzfile",	do_gzfile,	1,      11,     4,      {PP_FUNCALL, PREC_FN,	0}},
 {"xzfile",	do_gzfile,	2,      11,     4,      {PP_FUNCALL, PREC_FN,	0}},
+{"zstdfile",	do_gzfile,	3,      11,     4,      {PP_FUNCALL, PREC_FN,	0}},
+{"lz4file",	do_gzfile,	4,      11,     4,      {PP_FUNCALL, PREC_FN,	0}},
 {"unz",		do_unz,		0,      11,     3,      {PP_FUNCALL, PREC_FN,	0}},
 {"seek",	do_seek,	0,      11,     4,      {PP_FUNCALL, PREC_FN,	0}},
 {"truncate",	do_truncate,	0,      11,     1,      {PP_FUNCALL, PREC_FN,	0}},
@@ -940,6 +962,7 @@ FUNTAB R_FunTab[] =
 {"La_rg_cmplx",do_lapack,	41,	11,	2,	{PP_FUNCALL, PREC_FN,	0}},
 {"La_rs",	do_lapack,	5,	11,	2,	{PP_FUNCALL, PREC_FN,	0}},
 {"La_rs_cmplx",	do_lapack,	51,	11,	2,	{PP_FUNCALL, PREC_FN,	0}},
+{"La_rs_batch",	do_lapack,	52,	11,	2,	{PP_FUNCALL, PREC_FN,	0}},
 {"La_dlange",	do_lapack,	6,	11,	2,	{PP_FUNCALL, PREC_FN,	0}},
 {"La_dgecon",	do_lapack,	7,	11,	2,	{PP_FUNCALL, PREC_FN,	0}},
 {"La_dtrcon",	do_lapack,	8,	11,	2,	{PP_FUNCALL, PREC_FN,	0}},
@@ -948,8 +971,11 @@ FUNTAB R_FunTab[] =
 {"La_solve_cmplx",do_lapack,    11,	11,	2,	{PP_FUNCALL, PREC_FN,	0}},
 {"La_solve",	do_lapack,	100,	11,	3,	{PP_FUNCALL, PREC_FN,	0}},
 {"La_qr",	do_lapack,	101,	11,	1,	{PP_FUNCALL, PREC_FN,	0}},
+{"La_solve_batch",do_lapack,	102,	11,	2,	{PP_FUNCALL, PREC_FN,	0}},
+{"La_qr_batch",	do_lapack,	103,	11,	1,	{PP_FUNCALL, PREC_FN,	0}},
 {"La_chol",	do_lapack,	200,	11,	3,	{PP_FUNCALL, PREC_FN,	0}},
 {"La_chol2inv",	do_lapack,	201,	11,	2,	{PP_FUNCALL, PREC_FN,	0}},
+{"La_chol_batch",do_lapack,	202,	11,	1,	{PP_FUNCALL, PREC_FN,	0}},
 
 {"qr_coef_real",do_lapack,	300,	11,	2,	{PP_FUNCALL, PREC_FN,	0}},
 {"qr_qy_real",	do_lapack,	301,	11,	3,	{PP_FUNCALL, PREC_FN,	0}},
@@ -962,7 +988,7 @@ FUNTAB R_FunTab[] =
 {"La_version",	do_lapack,	1000,	11,	0,	{PP_FUNCALL, PREC_FN,	0}},
 
 {"bcprofcounts",do_bcprofcounts,0,	11,	0,	{PP_FUNCALL, PREC_FN,	0}},
-{"bcprofstart",	do_bcprofstart,	0,	11,	0,	{PP_FUNCALL, PREC_FN,	0}},
+{"bcprofstart",	do_bcprofstart,	0,	11,	1,	{PP_FUNCALL, PREC_FN,	0}},
 {"bcprofstop",	do_bcprofstop,	0,	11,	0,	{PP_FUNCALL, PREC_FN,	0}},
 
 {"eSoftVersion",do_eSoftVersion, 0,	11,	0,	{PP_FUNCALL, PREC_FN,	0}},
@@ -1142,7 +1168,8 @@ SEXP attribute_hidden installDDVAL(int n) {
 void attribute_hidden InitNames()
 {
     /* allocate the symbol table */
-    if (!(R_SymbolTable = (SEXP *) calloc(HSIZE, sizeof(SEXP))))
+    R_SymbolTableSize = HSIZE;
+    if (!(R_SymbolTable = (SEXP *) calloc(R_SymbolTableSize, sizeof(SEXP))))
 	R_Suicide("couldn't allocate memory for symbol table");
 
     /* R_UnboundValue */
@@ -1174,7 +1201,7 @@ void attribute_hidden InitNames()
     MARK_NOT_MUTABLE(R_BlankScalarString);
 
     /* Initialize the symbol Table */
-    for (int i = 0; i < HSIZE; i++) R_SymbolTable[i] = R_NilValue;
+    for (int i = 0; i < R_SymbolTableSize; i++) R_SymbolTable[i] = R_NilValue;
 
     /* Set up a set of globals so that a symbol table search can be
        avoided when matching something like dim or dimnames. */
@@ -1193,6 +1220,40 @@ void attribute_hidden InitNames()
 }
 
 
+/* The symbol table is a vector of chains, which is doubled in size
+   when there are more symbols than chains.  The links are moved to
+   the new table, so no R memory is allocated. */
+
+static int R_SymbolCount = 0;
+
+static void growSymbolTable(void)
+{
+    int newsize = 2 * R_SymbolTableSize;
+    SEXP *table, sym, next;
+
+    if (R_SymbolTableSize > INT_MAX / 2 ||
+	!(table = (SEXP *) malloc(newsize * sizeof(SEXP))))
+	return; /* not fatal: carry on with longer chains */
+    for (int i = 0; i < newsize; i++) table[i] = R_NilValue;
+    for (int i = 0; i < R_SymbolTableSize; i++)
+	for (sym = R_SymbolTable[i]; sym != R_NilValue; sym = next) {
+	    int j = HASHVALUE(PRINTNAME(CAR(sym))) % newsize;
+	    next = CDR(sym);
+	    SETCDR(sym, table[j]);
+	    table[j] = sym;
+	}
+    free(R_SymbolTable);
+    R_SymbolTable = table;
+    R_SymbolTableSize = newsize;
+}
+
+static R_INLINE void addSymbol(SEXP sym, int i)
+{
+    R_SymbolTable[i] = CONS(sym, R_SymbolTable[i]);
+    if (++R_SymbolCount > R_SymbolTableSize)
+	growSymbolTable();
+}
+
 /*  install - probe the symbol table */
 /*  If "name" is not found, it is installed in the symbol table.
     The symbol corresponding to the string "name" is returned. */
@@ -1203,10 +1264,11 @@ SEXP install(const char *name)
     int i, hashcode;
 
     hashcode = R_Newhashpjw(name);
-    i = hashcode % HSIZE;
+    i = hashcode % R_SymbolTableSize;
     /* Check to see if the symbol is already present;  if it is, return it. */
     for (sym = R_SymbolTable[i]; sym != R_NilValue; sym = CDR(sym))
-	if (strcmp(name, CHAR(PRINTNAME(CAR(sym)))) == 0) return (CAR(sym));
+	if (HASHVALUE(PRINTNAME(CAR(sym))) == hashcode &&
+	    strcmp(name, CHAR(PRINTNAME(CAR(sym)))) == 0) return (CAR(sym));
     /* Create a new symbol node and link it into the table. */
     if (*name == '\0')
 	error(_("attempt to use zero-length variable name"));
@@ -1216,7 +1278,9 @@ SEXP install(const char *name)
     SET_HASHVALUE(PRINTNAME(sym), hashcode);
     SET_HASHASH(PRINTNAME(sym), 1);
 
-    R_SymbolTable[i] = CONS(sym, R_SymbolTable[i]);
+    PROTECT(sym);
+    addSymbol(sym, i);
+    UNPROTECT(1);
     return (sym);
 }
 
@@ -1232,10 +1296,12 @@ SEXP installChar(SEXP charSXP)
     } else {
 	hashcode = HASHVALUE(charSXP);
     }
-    i = hashcode % HSIZE;
+    i = hashcode % R_SymbolTableSize;
     /* Check to see if the symbol is already present;  if it is, return it. */
     for (sym = R_SymbolTable[i]; sym != R_NilValue; sym = CDR(sym))
-	if (strcmp(CHAR(charSXP), CHAR(PRINTNAME(CAR(sym)))) == 0) return (CAR(sym));
+	if (HASHVALUE(PRINTNAME(CAR(sym))) == hashcode &&
+	    strcmp(CHAR(charSXP), CHAR(PRINTNAME(CAR(sym)))) == 0)
+	    return (CAR(sym));
     /* Create a new symbol node and link it into the table. */
     int len = LENGTH(charSXP);
     if (len == 0)
@@ -1256,7 +1322,9 @@ SEXP installChar(SEXP charSXP)
 	UNPROTECT(1);
     }
 
-    R_SymbolTable[i] = CONS(sym, R_SymbolTable[i]);
+    PROTECT(sym);
+    addSymbol(sym, i);
+    UNPROTECT(1);
     return (sym);
 }
 
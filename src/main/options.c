@@ -1,7 +1,7 @@
 /*
  *  R : A Computer Language for Statistical Data Analysis
  *  Copyright (C) 1995, 1996  Robert Gentleman and Ross Ihaka
- *  Copyright (C) 1998-2015   The R Core Team.
+ *  Copyright (C) 1998-2017   The R Core Team.
  *
  *  This program is free software; you can redistribute it and/or modify
  *  it under the terms of the GNU General Public License as published by
@@ -55,6 +55,7 @@
  *	"verbose"
  *	"keep.source"
  *	"keep.source.pkgs"
+ *	"keep.parse.data"
  *	"browserNLdisabled"
 
  *	"de.cellwidth"		../unix/X11/ & ../gnuwin32/dataentry.c
@@ -64,6 +65,10 @@
 
  *	"timeout"		./connections.c
 
+ *	"gc.pause.target"	./memory.c
+
+ *	"matprod"		./array.c
+
  *	"check.bounds"
  *	"error"
  *	"error.messages"
@@ -244,9 +249,9 @@ void attribute_hidden InitOptions(void)
     char *p;
 
 #ifdef HAVE_RL_COMPLETION_MATCHES
-    PROTECT(v = val = allocList(17));
+    PROTECT(v = val = allocList(19));
 #else
-    PROTECT(v = val = allocList(16));
+    PROTECT(v = val = allocList(18));
 #endif
 
     SET_TAG(v, install("prompt"));
@@ -296,6 +301,10 @@ void attribute_hidden InitOptions(void)
     SETCAR(v, ScalarLogical(R_KeepSource));
     v = CDR(v);
 
+    SET_TAG(v, install("keep.parse.data"));
+    SETCAR(v, ScalarLogical(TRUE));
+    v = CDR(v);
+
     SET_TAG(v, install("warning.length"));
     SETCAR(v, ScalarInteger(1000));
     v = CDR(v);
@@ -319,6 +328,11 @@ void attribute_hidden InitOptions(void)
     SETCAR(v, ScalarLogical(R_CBoundsCheck));
     v = CDR(v);
 
+    SET_TAG(v, install("matprod"));
+    SETCAR(v, mkString("default"));
+    R_Matprod = MATPROD_DEFAULT;
+    v = CDR(v);
+
 #ifdef HAVE_RL_COMPLETION_MATCHES
     /* value from Rf_initialize_R */
     SET_TAG(v, install("rl_word_breaks"));
@@ -641,6 +655,15 @@ SEXP attribute_hidden do_options(SEXP call, SEXP op, SEXP args, SEXP rho)
 		R_DisableNLinBrowser = k;
 		SET_VECTOR_ELT(value, i, SetOption(tag, ScalarLogical(k)));
 	    }
+	    else if (streql(CHAR(namei), "gc.pause.target")) {
+		double x = isNull(argi) ? 0 : asReal(argi);
+		if (!(isNull(argi) || (isNumeric(argi) && LENGTH(argi) == 1))
+		    || !R_FINITE(x) || x < 0)
+		    error(_("invalid value for '%s'"), CHAR(namei));
+		R_GCPauseTarget = x;
+		SET_VECTOR_ELT(value, i,
+			       SetOption(tag, isNull(argi) ? argi : ScalarReal(x)));
+	    }
 	    else if (streql(CHAR(namei), "CBoundsCheck")) {
 		if (TYPEOF(argi) != LGLSXP || LENGTH(argi) != 1)
 		    error(_("invalid value for '%s'"), CHAR(namei));
@@ -648,6 +671,17 @@ SEXP attribute_hidden do_options(SEXP call, SEXP op, SEXP args, SEXP rho)
 		R_CBoundsCheck = k;
 		SET_VECTOR_ELT(value, i, SetOption(tag, ScalarLogical(k)));
 	    }
+	    else if (streql(CHAR(namei), "matprod")) {
+		const char *s;
+		if (TYPEOF(argi) != STRSXP || LENGTH(argi) != 1)
+		    error(_("invalid value for '%s'"), CHAR(namei));
+		s = CHAR(STRING_ELT(argi, 0));
+		if (streql(s, "default")) R_Matprod = MATPROD_DEFAULT;
+		else if (streql(s, "internal")) R_Matprod = MATPROD_INTERNAL;
+		else if (streql(s, "blas")) R_Matprod = MATPROD_BLAS;
+		else error(_("invalid value for '%s'"), CHAR(namei));
+		SET_VECTOR_ELT(value, i, SetOption(tag, duplicate(argi)));
+	    }
 	    else {
 		SET_VECTOR_ELT(value, i, SetOption(tag, duplicate(argi)));
 	    }
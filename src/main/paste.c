@@ -56,7 +56,7 @@ SEXP attribute_hidden do_paste(SEXP call, SEXP op, SEXP args, SEXP env)
     R_xlen_t i, j, k, maxlen, nx, pwidth;
     const char *s, *cbuf, *csep=NULL, *u_csep=NULL;
     char *buf;
-    Rboolean allKnown, anyKnown, use_UTF8, use_Bytes,
+    Rboolean allKnown, anyKnown, use_UTF8, use_Bytes, allASCII,
 	sepASCII = TRUE, sepUTF8 = FALSE, sepBytes = FALSE, sepKnown = FALSE,
 	use_sep = (PRIMVAL(op) == 0);
     const void *vmax;
@@ -140,6 +140,10 @@ SEXP attribute_hidden do_paste(SEXP call, SEXP op, SEXP args, SEXP env)
 	    use_Bytes = sepBytes;
 	}
 
+	/* If all the pieces are ASCII (as NA_STRING is), they need no
+	   translation and their lengths are known, so the result is
+	   sized and copied in the same sweep as the checks. */
+	allASCII = sepASCII || nx == 1;
 	pwidth = 0;
 	for (j = 0; j < nx; j++) {
 	    k = XLENGTH(VECTOR_ELT(x, j));
@@ -147,8 +151,33 @@ SEXP attribute_hidden do_paste(SEXP call, SEXP op, SEXP args, SEXP env)
 		SEXP cs = STRING_ELT(VECTOR_ELT(x, j), i % k);
 		if(IS_UTF8(cs)) use_UTF8 = TRUE;
 		if(IS_BYTES(cs)) use_Bytes = TRUE;
+		if(allASCII) {
+		    if(IS_ASCII(cs) || cs == NA_STRING) pwidth += LENGTH(cs);
+		    else allASCII = FALSE;
+		}
+	    }
+	}
+	if (allASCII) {
+	    pwidth += (nx - 1) * sepw;
+	    if (pwidth > INT_MAX)
+		error(_("result would exceed 2^31-1 bytes"));
+	    cbuf = buf = R_AllocStringBuffer(pwidth, &cbuff);
+	    for (j = 0; j < nx; j++) {
+		k = XLENGTH(VECTOR_ELT(x, j));
+		if (k > 0) {
+		    SEXP cs = STRING_ELT(VECTOR_ELT(x, j), i % k);
+		    memcpy(buf, CHAR(cs), LENGTH(cs));
+		    buf += LENGTH(cs);
+		}
+		if (sepw != 0 && j != nx - 1) {
+		    memcpy(buf, csep, sepw);
+		    buf += sepw;
+		}
 	    }
+	    SET_STRING_ELT(ans, i, mkCharLenCE(cbuf, (int) pwidth, CE_NATIVE));
+	    continue;
 	}
+	pwidth = 0;
 	if (use_Bytes) use_UTF8 = FALSE;
 	vmax = vmaxget();
 	for (j = 0; j < nx; j++) {
@@ -238,7 +267,7 @@ SEXP attribute_hidden do_paste(SEXP call, SEXP op, SEXP args, SEXP env)
 		pwidth += strlen(translateCharUTF8(STRING_ELT(ans, i)));
 		vmaxset(vmax);
 	    } else /* already translated */
-		pwidth += strlen(CHAR(STRING_ELT(ans, i)));
+		pwidth += LENGTH(STRING_ELT(ans, i));
 	pwidth += (nx - 1) * sepw;
 	if (pwidth > INT_MAX)
 	    error(_("result would exceed 2^31-1 bytes"));
@@ -249,15 +278,19 @@ SEXP attribute_hidden do_paste(SEXP call, SEXP op, SEXP args, SEXP env)
 		strcpy(buf, csep);
 		buf += sepw;
 	    }
-	    if(use_UTF8)
+	    if(use_UTF8) {
 		s = translateCharUTF8(STRING_ELT(ans, i));
-	    else /* already translated */
+		strcpy(buf, s);
+		while (*buf)
+		    buf++;
+	    } else { /* already translated */
 		s = CHAR(STRING_ELT(ans, i));
-	    strcpy(buf, s);
-	    while (*buf)
-		buf++;
-	    allKnown = allKnown &&
-		(strIsASCII(s) || (ENC_KNOWN(STRING_ELT(ans, i)) > 0));
+		memcpy(buf, s, LENGTH(STRING_ELT(ans, i)));
+		buf += LENGTH(STRING_ELT(ans, i));
+		*buf = '\0';
+	    }
+	    allKnown = allKnown && (IS_ASCII(STRING_ELT(ans, i)) ||
+				    (ENC_KNOWN(STRING_ELT(ans, i)) > 0));
 	    anyKnown = anyKnown || (ENC_KNOWN(STRING_ELT(ans, i)) > 0);
 	    if(use_UTF8) vmaxset(vmax);
 	}
@@ -174,6 +174,29 @@ const char *EncodeReal(double x, int w, int d, int e, char cdec)
     return EncodeReal0(x, w, d, e, dec);
 }
 
+/* Write the whole number x, |x| < 1e15, right-justified in a field of
+   width w exactly as "%w.0f" would, but without the C library's
+   floating-point conversion.  Used for the common case of integer-valued
+   doubles in fixed notation. */
+static void encodeWholeReal(char *buff, double x, int w)
+{
+    char digits[20], *p = digits + sizeof(digits) - 1;
+    long long v = (long long) x;
+    unsigned long long u = v < 0 ? -(unsigned long long) v : v;
+    int n, pad;
+
+    *p = '\0';
+    do { *--p = (char) ('0' + u % 10); u /= 10; } while (u);
+    if (v < 0) *--p = '-';
+    n = (int) (digits + sizeof(digits) - 1 - p);
+    pad = min(w, (NB-1)) - n;
+    if (pad < 0) pad = 0;
+    memset(buff, ' ', pad);
+    memcpy(buff + pad, p, n + 1);
+}
+
+#define WHOLE_REAL(x) (fabs(x) < 1e15 && (x) == floor(x))
+
 const char *EncodeReal0(double x, int w, int d, int e, const char *dec)
 {
     static char buff[NB], buff2[2*NB];
@@ -197,6 +220,8 @@ const char *EncodeReal0(double x, int w, int d, int e, const char *dec)
 	    snprintf(buff, NB, fmt, x);
 	}
     }
+    else if (d == 0 && WHOLE_REAL(x))
+	encodeWholeReal(buff, x, w);
     else { /* e = 0 */
 	sprintf(fmt,"%%%d.%df", min(w, (NB-1)), d);
 	snprintf(buff, NB, fmt, x);
@@ -240,6 +265,8 @@ static const char
 	    snprintf(buff, NB, fmt, x);
 	}
     }
+    else if (d == 0 && WHOLE_REAL(x))
+	encodeWholeReal(buff, x, w);
     else { /* e = 0 */
 	sprintf(fmt,"%%%d.%df", min(w, (NB-1)), d);
 	snprintf(buff, NB, fmt, x);
@@ -29,29 +29,9 @@
 #include <Defn.h>
 #include <Internal.h>
 
-// gs = groupsizes e.g.23, 12, 87, 2, 1, 34,...
-static int *gs[2] = { NULL };
-//two vectors flip flopped:flip and 1 - flip
-static int flip = 0;
-//allocated stack size
-static int gsalloc[2] = { 0 };
-static int gsngrp[2] = { 0 };
-//max grpn so far
-static int gsmax[2] = { 0 };
-//max size of stack, set by do_radixsort to nrows
-static int gsmaxalloc = 0;
-//switched off for last arg unless retGrp==TRUE
-static Rboolean stackgrps = TRUE;
-// TRUE for setkey, FALSE for by=
-static Rboolean sortStr = TRUE;
-// used by do_radixsort and [i|d|c]sort to reorder order.
-// not needed if narg==1
-static int *newo = NULL;
-// =1, 0, -1 for TRUE, NA, FALSE respectively.
-// Value rewritten inside do_radixsort().
-static int nalast = -1;
-// =1, -1 for ascending and descending order respectively
-static int order = 1;
+#ifdef _OPENMP
+# include <omp.h>
+#endif
 
 //replaced n < 200 with n < N_SMALL.Easier to change later
 #define N_SMALL 200
@@ -59,129 +39,241 @@ static int order = 1;
 // (see setRange for details)
 #define N_RANGE 100000
 
-static SEXP *saveds = NULL;
-static R_len_t *savedtl = NULL, nalloc = 0, nsaved = 0;
-
-static void savetl_init()
+/* All the working state of one sort, so that do_radixsort is
+   reentrant and the threaded passes can give each thread its own
+   (the workers below).  Only the setting of dround is global. */
+typedef struct radix_state {
+    // gs = groupsizes e.g.23, 12, 87, 2, 1, 34,...
+    int *gs[2];
+    //two vectors flip flopped:flip and 1 - flip
+    int flip;
+    //allocated stack size
+    int gsalloc[2];
+    int gsngrp[2];
+    //max grpn so far
+    int gsmax[2];
+    //max size of stack, set by do_radixsort to nrows
+    int gsmaxalloc;
+    //switched off for last arg unless retGrp==TRUE
+    Rboolean stackgrps;
+    // TRUE for setkey, FALSE for by=
+    Rboolean sortStr;
+    // TRUE to sort strings as Scollate() does, by their collation keys
+    Rboolean collate;
+    // used by do_radixsort and [i|d|c]sort to reorder order.
+    // not needed if narg==1
+    int *newo;
+    // =1, 0, -1 for TRUE, NA, FALSE respectively.
+    // Value rewritten inside do_radixsort().
+    int nalast;
+    // =1, -1 for ascending and descending order respectively
+    int order;
+
+    // CHARSXP truelengths to restore
+    SEXP *saveds;
+    R_len_t *savedtl, nalloc, nsaved;
+
+    int range, off;          // used by both icount and do_radixsort
+    unsigned int *counts;    // N_RANGE + 1 counts for icount
+
+    // 4 are used for iradix, 8 for dradix and i64radix
+    unsigned int radixcounts[8][257];
+    int skip[8];
+    /* iradix and iradix_r interact and are called repetitively.
+       counts are set back to 0 after each use, to benefit from skipped
+       radix. */
+    void *radix_xsub;
+    size_t radix_xsuballoc;
+    int *otmp, otmp_alloc;
+    void *xtmp;
+    int xtmp_alloc;
+    unsigned long long dmask1, dmask2;
+    void *xsub;              // a group of a later argument in do_radixsort
+    int xsuballoc;
+
+    // strings: only ever sorted by the main thread
+    int *cradix_counts, cradix_counts_alloc, maxlen;
+    SEXP *cradix_xtmp;
+    int cradix_xtmp_alloc;
+    SEXP *ustr;
+    int ustr_alloc, ustr_n;
+    // collate: the key of ustr[i] is the ckeylen[i] bytes at
+    // ckeys + ckeyoff[i] (ckeylen[i] == -1 for NA) while cradix_r
+    // runs, and TRUELENGTH(ustr[i]) is -i-1
+    char *ckeys;
+    size_t ckeys_alloc, *ckeyoff;
+    int *ckeylen, ckey_alloc;
+    int *csort_otmp, csort_otmp_alloc;
+
+    /* If gsout is not NULL, push() records each group size at the
+       position in o of the group's first element, gsout[gspos],
+       rather than on the stack.  That lets threads sort disjoint
+       parts of o in any order; gscollect() then stacks the groups. */
+    int *gsout, gspos;
+    Rboolean worker;         // one of the threads' states, below
+    int nworkers;
+    struct radix_state *workers;
+} radix_state;
+
+static void savetl_init(radix_state *s)
 {
-    if (nsaved || nalloc || saveds || savedtl)
+    if (s->nsaved || s->nalloc || s->saveds || s->savedtl)
 	error("Internal error: savetl_init checks failed (%d %d %p %p).",
-	      nsaved, nalloc, saveds, savedtl);
-    nsaved = 0;
-    nalloc = 100;
-    saveds = (SEXP *) malloc(nalloc * sizeof(SEXP));
-    if (saveds == NULL)
+	      s->nsaved, s->nalloc, s->saveds, s->savedtl);
+    s->nsaved = 0;
+    s->nalloc = 100;
+    s->saveds = (SEXP *) malloc(s->nalloc * sizeof(SEXP));
+    if (s->saveds == NULL)
 	error("Could not allocate saveds in savetl_init");
-    savedtl = (R_len_t *) malloc(nalloc * sizeof(R_len_t));
-    if (savedtl == NULL) {
-	free(saveds);
+    s->savedtl = (R_len_t *) malloc(s->nalloc * sizeof(R_len_t));
+    if (s->savedtl == NULL) {
+	free(s->saveds);
 	error("Could not allocate saveds in savetl_init");
     }
 }
 
-static void savetl_end()
+static void savetl_end(radix_state *s)
 {
     // Can get called if nothing has been saved yet (nsaved == 0), or
     // even if _init() has not been called yet (pointers NULL). Such as
     // to clear up before error. Also, it might be that nothing needed
     // to be saved anyway.
-    for (int i = 0; i < nsaved; i++)
-	SET_TRUELENGTH(saveds[i], savedtl[i]);
-    free(saveds);  // does nothing on NULL input
-    free(savedtl);
-    nsaved = nalloc = 0;
-    saveds = NULL;
-    savedtl = NULL;
+    for (int i = 0; i < s->nsaved; i++)
+	SET_TRUELENGTH(s->saveds[i], s->savedtl[i]);
+    free(s->saveds);  // does nothing on NULL input
+    free(s->savedtl);
+    s->nsaved = s->nalloc = 0;
+    s->saveds = NULL;
+    s->savedtl = NULL;
 }
 
 
-static void savetl(SEXP s)
+static void savetl(radix_state *s, SEXP x)
 {
-    if (nsaved >= nalloc) {
-	nalloc *= 2;
+    if (s->nsaved >= s->nalloc) {
+	s->nalloc *= 2;
 	char *tmp;
-	tmp = (char *) realloc(saveds, nalloc * sizeof(SEXP));
+	tmp = (char *) realloc(s->saveds, s->nalloc * sizeof(SEXP));
 	if (tmp == NULL) {
-	    savetl_end();
+	    savetl_end(s);
 	    error("Could not realloc saveds in savetl");
 	}
-	saveds = (SEXP *) tmp;
-	tmp = (char *) realloc(savedtl, nalloc * sizeof(R_len_t));
+	s->saveds = (SEXP *) tmp;
+	tmp = (char *) realloc(s->savedtl, s->nalloc * sizeof(R_len_t));
 	if (tmp == NULL) {
-	    savetl_end();
+	    savetl_end(s);
 	    error("Could not realloc savedtl in savetl");
 	}
-	savedtl = (R_len_t *) tmp;
+	s->savedtl = (R_len_t *) tmp;
     }
-    saveds[nsaved] = s;
-    savedtl[nsaved] = TRUELENGTH(s);
-    nsaved++;
+    s->saveds[s->nsaved] = x;
+    s->savedtl[s->nsaved] = TRUELENGTH(x);
+    s->nsaved++;
 }
 
+static void radix_free(radix_state *s);
+
 // http://gcc.gnu.org/onlinedocs/cpp/Swallowing-the-Semicolon.html#Swallowing-the-Semicolon
-#define Error(...) do {savetl_end(); error(__VA_ARGS__);} while(0)
+#define Error(...) do {radix_free(s); error(__VA_ARGS__);} while(0)
 #undef warning
 // since it can be turned to error via warn = 2
 #define warning(...) Do not use warning in this file
 /* use malloc/realloc (not Calloc/Realloc) so we can trap errors
-   and call savetl_end() before the error(). */
+   and call savetl_end() before the error(). Error() is only used by
+   the main thread: the workers' memory is allocated for them. */
 
-static void growstack(int newlen)
+static void growstack(radix_state *s, int newlen)
 {
     // no link to icount range restriction,
     // just 100,000 seems a good minimum at 0.4MB
     if (newlen == 0) newlen = 100000;
-    if (newlen > gsmaxalloc) newlen = gsmaxalloc;
-    gs[flip] = realloc(gs[flip], newlen * sizeof(int));
-    if (gs[flip] == NULL)
+    if (newlen > s->gsmaxalloc) newlen = s->gsmaxalloc;
+    s->gs[s->flip] = realloc(s->gs[s->flip], newlen * sizeof(int));
+    if (s->gs[s->flip] == NULL)
 	Error("Failed to realloc working memory stack to %d*4bytes (flip=%d)",
-	      newlen, flip);
-    gsalloc[flip] = newlen;
+	      newlen, s->flip);
+    s->gsalloc[s->flip] = newlen;
 }
 
-static void push(int x)
+static void push(radix_state *s, int x)
 {
-    if (!stackgrps || x == 0)
+    if (!s->stackgrps || x == 0)
 	return;
-    if (gsalloc[flip] == gsngrp[flip])
-	growstack(gsngrp[flip] * 2);
-    gs[flip][gsngrp[flip]++] = x;
-    if (x > gsmax[flip])
-	gsmax[flip] = x;
+    if (s->gsout) {
+	s->gsout[s->gspos] = x;
+	s->gspos += x;
+	return;
+    }
+    if (s->gsalloc[s->flip] == s->gsngrp[s->flip])
+	growstack(s, s->gsngrp[s->flip] * 2);
+    s->gs[s->flip][s->gsngrp[s->flip]++] = x;
+    if (x > s->gsmax[s->flip])
+	s->gsmax[s->flip] = x;
 }
 
-static void mpush(int x, int n)
+static void mpush(radix_state *s, int x, int n)
 {
-    if (!stackgrps || x == 0)
+    if (!s->stackgrps || x == 0)
+	return;
+    if (s->gsout) {
+	for (int i = 0; i < n; i++, s->gspos += x)
+	    s->gsout[s->gspos] = x;
 	return;
-    if (gsalloc[flip] < gsngrp[flip] + n)
-	growstack((gsngrp[flip] + n) * 2);
+    }
+    if (s->gsalloc[s->flip] < s->gsngrp[s->flip] + n)
+	growstack(s, (s->gsngrp[s->flip] + n) * 2);
     for (int i = 0; i < n; i++)
-	gs[flip][gsngrp[flip]++] = x;
-    if (x > gsmax[flip])
-	gsmax[flip] = x;
+	s->gs[s->flip][s->gsngrp[s->flip]++] = x;
+    if (x > s->gsmax[s->flip])
+	s->gsmax[s->flip] = x;
+}
+
+// so that [i|d|c]sorted can take back the groups they pushed
+static R_INLINE int gsmark(radix_state *s)
+{
+    return s->gsout ? s->gspos : s->gsngrp[s->flip];
+}
+
+static R_INLINE void gsrewind(radix_state *s, int mark)
+{
+    if (s->gsout)
+	s->gspos = mark;
+    else
+	s->gsngrp[s->flip] = mark;
 }
 
-static void flipflop()
+/* Start recording the groups of the next n elements of o by position
+   (see gsout above), or stack the groups so recorded.  The groups
+   cover the n elements, so they can be walked from the first. */
+static void gsposition(radix_state *s, int n)
 {
-    flip = 1 - flip;
-    gsngrp[flip] = 0;
-    gsmax[flip] = 0;
-    if (gsalloc[flip] < gsalloc[1 - flip])
-	growstack(gsalloc[1 - flip] * 2);
+    if (!s->stackgrps)
+	return;
+    s->gsout = (int *) malloc(n * sizeof(int));
+    if (s->gsout == NULL)
+	Error("Failed to allocate working memory for gsout. Requested %d * %d bytes",
+	      n, sizeof(int));
+    s->gspos = 0;
 }
 
-static void gsfree()
+static void gscollect(radix_state *s, int n)
 {
-    free(gs[0]);
-    free(gs[1]);
-    gs[0] = NULL;
-    gs[1] = NULL;
-    flip = 0;
-    gsalloc[0] = gsalloc[1] = 0;
-    gsngrp[0] = gsngrp[1] = 0;
-    gsmax[0] = gsmax[1] = 0;
-    gsmaxalloc = 0;
+    int *g = s->gsout;
+    if (g == NULL)
+	return;
+    s->gsout = NULL;
+    for (int i = 0; i < n; i += g[i])
+	push(s, g[i]);
+    free(g);
+}
+
+static void flipflop(radix_state *s)
+{
+    s->flip = 1 - s->flip;
+    s->gsngrp[s->flip] = 0;
+    s->gsmax[s->flip] = 0;
+    if (s->gsalloc[s->flip] < s->gsalloc[1 - s->flip])
+	growstack(s, s->gsalloc[1 - s->flip] * 2);
 }
 
 #ifdef TIMING_ON
@@ -198,13 +290,12 @@ static int nblock[NBLOCK];
 #define TEND(i)
 #endif
 
-static int range, off; // used by both icount and do_radixsort
-static void setRange(int *x, int n)
+static void setRange(radix_state *s, int *x, int n)
 {
     int xmin = NA_INTEGER, xmax = NA_INTEGER;
     double overflow;
 
-    off = (nalast == 1) ? 0 : 1;   // nalast^decreasing ? 0 : 1;
+    s->off = (s->nalast == 1) ? 0 : 1;   // nalast^decreasing ? 0 : 1;
     // off = 0 will store values starting from index 0. NAs will go last.
     // off = 1 will store values starting from index 1. NAs will be at 0th index.
     int i = 0;
@@ -221,51 +312,58 @@ static void setRange(int *x, int n)
     }
     // all NAs, nothing to do
     if (xmin == NA_INTEGER) {
-	range = NA_INTEGER;
+	s->range = NA_INTEGER;
 	return;
     }
     // ex: x=c(-2147483647L, NA_integer_, 1L) results in overflowing int range.
     overflow = (double) xmax - (double) xmin + 1;
     // detect and force iradix here, since icount is out of the picture
     if (overflow > INT_MAX) {
-	range = INT_MAX;
+	s->range = INT_MAX;
 	return;
     }
 
-    range = xmax - xmin + 1;
+    s->range = xmax - xmin + 1;
     // so that  off+order*x[i]  (below in icount)
     // => (x[i]-xmin)+0|1  or  (xmax-x[i])+0|1
-    off = order == 1 ? -xmin + off : xmax + off;
+    s->off = s->order == 1 ? -xmin + s->off : xmax + s->off;
 
     return;
 }
 
 // x*order results in integer overflow when -1*NA,
 // so careful to avoid that here :
-static inline int icheck(int x)
+static inline int icheck(radix_state *s, int x)
 {
     // if nalast == 1, NAs must go last.
-    return ((nalast != 1) ? ((x != NA_INTEGER) ? x*order : x) :
-	    ((x != NA_INTEGER) ? (x*order) - 1 : INT_MAX));
+    return ((s->nalast != 1) ? ((x != NA_INTEGER) ? x*s->order : x) :
+	    ((x != NA_INTEGER) ? (x*s->order) - 1 : INT_MAX));
 }
 
 
-static void icount(int *x, int *o, int n)
+static void icount(radix_state *s, int *x, int *o, int n)
 /* Counting sort:
    1. Places the ordering into o directly, overwriting whatever was there
    2. Doesn't change x
    3. Pushes group sizes onto stack
 */
 {
-    int napos = (nalast == 1) ? range : 0;  // take care of 'nalast' argument
-    // static is IMPORTANT, counting sort is called repetitively.
-    static unsigned int counts[N_RANGE + 1] = { 0 };
+    int napos = (s->nalast == 1) ? s->range : 0;  // take care of 'nalast' argument
+    // kept in s, IMPORTANT, counting sort is called repetitively.
+    unsigned int *counts = s->counts;
     /* counts are set back to 0 at the end efficiently. 1e5 = 0.4MB i.e
        tiny. We'll only use the front part of it, as large as range. So it's
        just reserving space, not using it. Have defined N_RANGE to be 100000.*/
-    if (range > N_RANGE)
+    if (s->range > N_RANGE)
 	Error("Internal error: range = %d; isorted cannot handle range > %d",
-	      range, N_RANGE);
+	      s->range, N_RANGE);
+    if (counts == NULL) {
+	// the workers' are allocated in advance
+	counts = s->counts = calloc(N_RANGE + 1, sizeof(unsigned int));
+	if (counts == NULL)
+	    Error("Failed to allocate working memory for counts. Requested %d * %d bytes",
+		  N_RANGE + 1, sizeof(unsigned int));
+    }
     for (int i = 0; i < n; i++) {
 	// For nalast=NA case, we won't remove/skip NAs, rather set 'o' indices
 	// to 0. subset will skip them. We can't know how many NAs to skip
@@ -273,18 +371,18 @@ static void icount(int *x, int *o, int n)
 	if (x[i] == NA_INTEGER)
 	    counts[napos]++;
 	else
-	    counts[off + order * x[i]]++;
+	    counts[s->off + s->order * x[i]]++;
     }
     
     int tmp = 0;
-    for (int i = 0; i <= range; i++) 
+    for (int i = 0; i <= s->range; i++) 
         /* no point in adding tmp < n && i <= range, since range includes max, 
            need to go to max, unlike 256 loops elsewhere in radixsort.c */
     {
 	if (counts[i]) {
 	    // cumulate but not through 0's.
 	    // Helps resetting zeros when n < range, below.
-	    push(counts[i]);
+	    push(s, counts[i]);
 	    counts[i] = (tmp += counts[i]);
 	}
     }
@@ -292,10 +390,10 @@ static void icount(int *x, int *o, int n)
 	// This way na.last=TRUE/FALSE cases will have just a
 	// single if-check overhead.
 	o[--counts[(x[i] == NA_INTEGER) ? napos :
-		   off + order * x[i]]] = (int) (i + 1);
+		   s->off + s->order * x[i]]] = (int) (i + 1);
     }
     // nalast = 1, -1 are both taken care already.
-    if (nalast == 0)
+    if (s->nalast == 0)
 	// nalast = 0 is dealt with separately as it just sets o to 0
 	for (int i = 0; i < n; i++)
 	    o[i] = (x[o[i] - 1] == NA_INTEGER) ? 0 : o[i];
@@ -303,20 +401,20 @@ static void icount(int *x, int *o, int n)
 
     /* counts were cumulated above so leaves non zero.
        Faster to clear up now ready for next time. */
-    if (n < range) {
+    if (n < s->range) {
 	/* Many zeros in counts already. Loop through n instead,
 	   doesn't matter if we set to 0 several times on any repeats */
 	counts[napos] = 0;
 	for (int i = 0; i < n; i++) {
 	    if (x[i] != NA_INTEGER)
-		counts[off + order * x[i]] = 0;
+		counts[s->off + s->order * x[i]] = 0;
 	}
     } else
-	memset(counts, 0, (range + 1) * sizeof(int));
+	memset(counts, 0, (s->range + 1) * sizeof(int));
     return;
 }
 
-static void iinsert(int *x, int *o, int n)
+static void iinsert(radix_state *s, int *x, int *o, int n)
 /*  orders both x and o by reference in-place. Fast for small vectors,
     low overhead.  don't be tempted to binsearch backwards here, have
     to shift anyway; many memmove would have overhead and do the same
@@ -343,10 +441,10 @@ static void iinsert(int *x, int *o, int n)
 	if (x[i] == x[i - 1])
 	    tt++;
 	else {
-	    push(tt + 1);
+	    push(s, tt + 1);
 	    tt = 0;
 	}
-    push(tt + 1);
+    push(s, tt + 1);
 }
 
 /*
@@ -380,46 +478,34 @@ static void iinsert(int *x, int *o, int n)
   there is wide random access in each LSD radix pass, though.
 */
 
-// 4 are used for iradix, 8 for dradix and i64radix
-static unsigned int radixcounts[8][257] = { {0} };
-
-static int skip[8];
-/* global because iradix and iradix_r interact and are called repetitively.
-   counts are set back to 0 after each use, to benefit from skipped radix. */
-static void *radix_xsub = NULL;
-static size_t radix_xsuballoc = 0;
-
-static int *otmp = NULL, otmp_alloc = 0;
-static void alloc_otmp(int n)
+static void alloc_otmp(radix_state *s, int n)
 {
-    if (otmp_alloc >= n)
+    if (s->otmp_alloc >= n)
 	return;
-    otmp = (int *) realloc(otmp, n * sizeof(int));
-    if (otmp == NULL)
+    s->otmp = (int *) realloc(s->otmp, n * sizeof(int));
+    if (s->otmp == NULL)
 	Error("Failed to allocate working memory for otmp. Requested %d * %d bytes",
 	      n, sizeof(int));
-    otmp_alloc = n;
+    s->otmp_alloc = n;
 }
 
 // TO DO: save xtmp if possible, see allocs in do_radixsort
-static void *xtmp = NULL;
-static int xtmp_alloc = 0;
 // TO DO: currently always the largest type (double) but
 //        could be int if that's all that's needed
-static void alloc_xtmp(int n)
+static void alloc_xtmp(radix_state *s, int n)
 {
-    if (xtmp_alloc >= n)
+    if (s->xtmp_alloc >= n)
 	return;
-    xtmp = (double *) realloc(xtmp, n * sizeof(double));
-    if (xtmp == NULL)
+    s->xtmp = (double *) realloc(s->xtmp, n * sizeof(double));
+    if (s->xtmp == NULL)
 	Error("Failed to allocate working memory for xtmp. Requested %d * %d bytes",
 	      n, sizeof(double));
-    xtmp_alloc = n;
+    s->xtmp_alloc = n;
 }
 
-static void iradix_r(int *xsub, int *osub, int n, int radix);
+static void iradix_r(radix_state *s, int *xsub, int *osub, int n, int radix);
 
-static void iradix(int *x, int *o, int n)
+static void iradix(radix_state *s, int *x, int *o, int n)
 /* As icount :
    Places the ordering into o directly, overwriting whatever was there
    Doesn't change x
@@ -432,27 +518,27 @@ static void iradix(int *x, int *o, int n)
 	/* parallel histogramming pass; i.e. count occurrences of
 	   0:255 in each byte.  Sequential so almost negligible. */
 	// relies on overflow behaviour. And shouldn't -INT_MIN be up in iradix?
-	thisx = (unsigned int) (icheck(x[i])) - INT_MIN;
+	thisx = (unsigned int) (icheck(s, x[i])) - INT_MIN;
 	// unrolled since inside n-loop
-	radixcounts[0][thisx & 0xFF]++;
-	radixcounts[1][thisx >> 8 & 0xFF]++;
-	radixcounts[2][thisx >> 16 & 0xFF]++;
-	radixcounts[3][thisx >> 24 & 0xFF]++;
+	s->radixcounts[0][thisx & 0xFF]++;
+	s->radixcounts[1][thisx >> 8 & 0xFF]++;
+	s->radixcounts[2][thisx >> 16 & 0xFF]++;
+	s->radixcounts[3][thisx >> 24 & 0xFF]++;
     }
     for (int radix = 0; radix < 4; radix++) {
 	/* any(count == n) => all radix must have been that value =>
 	   last x (still thisx) was that value */
 	int i = thisx >> (radix*8) & 0xFF;
-	skip[radix] = radixcounts[radix][i] == n;
+	s->skip[radix] = s->radixcounts[radix][i] == n;
 	// clear it now, the other counts must be 0 already
-	if (skip[radix])
-	    radixcounts[radix][i] = 0;
+	if (s->skip[radix])
+	    s->radixcounts[radix][i] = 0;
     }
 
     int radix = 3;  // MSD
-    while (radix >= 0 && skip[radix]) radix--;
+    while (radix >= 0 && s->skip[radix]) radix--;
     if (radix == -1) { // All radix are skipped; one number repeated n times.
-	if (nalast == 0 && x[0] == NA_INTEGER)
+	if (s->nalast == 0 && x[0] == NA_INTEGER)
 	    // all values are identical. return 0 if nalast=0 & all NA
 	    // because of 'return', have to take care of it here.
 	    for (int i = 0; i < n; i++)
@@ -460,17 +546,17 @@ static void iradix(int *x, int *o, int n)
 	else
 	    for (int i = 0; i < n; i++)
 		o[i] = (i + 1);
-	push(n);
+	push(s, n);
 	return;
     }
     for (int i = radix - 1; i >= 0; i--) {
-	if (!skip[i])
-	    memset(radixcounts[i], 0, 257 * sizeof(unsigned int));
+	if (!s->skip[i])
+	    memset(s->radixcounts[i], 0, 257 * sizeof(unsigned int));
 	/* clear the counts as we only needed the parallel pass for skip[]
 	   and we're going to use radixcounts again below. Can't use parallel
 	   lower counts in MSD radix, unlike LSD. */
     }
-    thiscounts = radixcounts[radix];
+    thiscounts = s->radixcounts[radix];
     shift = radix * 8;
 
     itmp = thiscounts[0];
@@ -485,31 +571,31 @@ static void iradix(int *x, int *o, int n)
 	}
     }
     for (int i = n - 1; i >= 0; i--) {
-	thisx = ((unsigned int) (icheck(x[i])) - INT_MIN) >> shift & 0xFF;
+	thisx = ((unsigned int) (icheck(s, x[i])) - INT_MIN) >> shift & 0xFF;
 	o[--thiscounts[thisx]] = i + 1;
     }
 
-    if (radix_xsuballoc < maxgrpn) {
+    if (s->radix_xsuballoc < maxgrpn) {
         // The largest group according to the first non-skipped radix,
         // so could be big (if radix is needed on first arg)
         // TO DO: could include extra bits to divide the first radix
         // up more. Often the MSD has groups in just 0-4 out of 256.
         // free'd at the end of do_radixsort once we're done calling iradix
         // repetitively
-        radix_xsub = (int *) realloc(radix_xsub, maxgrpn * sizeof(double));
-        if (!radix_xsub)
+        s->radix_xsub = (int *) realloc(s->radix_xsub, maxgrpn * sizeof(double));
+        if (!s->radix_xsub)
             Error("Failed to realloc working memory %d*8bytes (xsub in iradix), radix=%d",
                   maxgrpn, radix);
-        radix_xsuballoc = maxgrpn;
+        s->radix_xsuballoc = maxgrpn;
     }
 
     // TO DO: can we leave this to do_radixsort and remove these calls??
-    alloc_otmp(maxgrpn);
+    alloc_otmp(s, maxgrpn);
     // TO DO: doesn't need to be sizeof(double) always, see inside
-    alloc_xtmp(maxgrpn);
+    alloc_xtmp(s, maxgrpn);
 
     nextradix = radix - 1;
-    while (nextradix >= 0 && skip[nextradix]) nextradix--;
+    while (nextradix >= 0 && s->skip[nextradix]) nextradix--;
     if (thiscounts[0] != 0)
 	Error("Internal error. thiscounts[0]=%d but should have been decremented to 0. dradix=%d",
 	      thiscounts[0], radix);
@@ -520,19 +606,19 @@ static void iradix(int *x, int *o, int n)
         // undo cumulate; i.e. diff
         thisgrpn = thiscounts[i] - itmp;
         if (thisgrpn == 1 || nextradix == -1) {
-            push(thisgrpn);
+            push(s, thisgrpn);
         } else {
             for (int j = 0; j < thisgrpn; j++)
                 // this is why this xsub here can't be the same memory as
                 // xsub in do_radixsort.
-                ((int *)radix_xsub)[j] = icheck(x[o[itmp+j]-1]);
+                ((int *)s->radix_xsub)[j] = icheck(s, x[o[itmp+j]-1]);
             // changes xsub and o by reference recursively.
-            iradix_r(radix_xsub, o+itmp, thisgrpn, nextradix);
+            iradix_r(s, s->radix_xsub, o+itmp, thisgrpn, nextradix);
         }
         itmp = thiscounts[i];
         thiscounts[i] = 0;
     }
-    if (nalast == 0) // nalast = 1, -1 are both taken care already.
+    if (s->nalast == 0) // nalast = 1, -1 are both taken care already.
 	// nalast = 0 is dealt with separately as it just sets o to 0
 	for (int i = 0; i < n; i++)
 	    o[i] = (x[o[i] - 1] == NA_INTEGER) ? 0 : o[i];
@@ -540,7 +626,7 @@ static void iradix(int *x, int *o, int n)
     // modified by reference unlike iinsert or iradix_r
 }
 
-static void iradix_r(int *xsub, int *osub, int n, int radix)
+static void iradix_r(radix_state *s, int *xsub, int *osub, int n, int radix)
 // xsub is a recursive offset into xsub working memory above in
 // iradix, reordered by reference.  osub is a an offset into the main
 // answer o, reordered by reference.  radix iterates 3,2,1,0
@@ -554,12 +640,12 @@ static void iradix_r(int *xsub, int *osub, int n, int radix)
     // unlikely.  when nalast==0, iinsert will be called only from
     // within iradix.
     if (n < N_SMALL) {
-	iinsert(xsub, osub, n);
+	iinsert(s, xsub, osub, n);
 	return;
     }
 
     shift = radix * 8;
-    thiscounts = radixcounts[radix];
+    thiscounts = s->radixcounts[radix];
 
     for (int i = 0; i < n; i++) {
 	thisx = (unsigned int) xsub[i] - INT_MIN; // sequential in xsub
@@ -573,14 +659,14 @@ static void iradix_r(int *xsub, int *osub, int n, int radix)
     for (int i = n - 1; i >= 0; i--) {
 	thisx = ((unsigned int) xsub[i] - INT_MIN) >> shift & 0xFF;
 	j = --thiscounts[thisx];
-	otmp[j] = osub[i];
-	((int *) xtmp)[j] = xsub[i];
+	s->otmp[j] = osub[i];
+	((int *) s->xtmp)[j] = xsub[i];
     }
-    memcpy(osub, otmp, n * sizeof(int));
-    memcpy(xsub, xtmp, n * sizeof(int));
+    memcpy(osub, s->otmp, n * sizeof(int));
+    memcpy(xsub, s->xtmp, n * sizeof(int));
 
     nextradix = radix - 1;
-    while (nextradix >= 0 && skip[nextradix]) nextradix--;
+    while (nextradix >= 0 && s->skip[nextradix]) nextradix--;
     /* TO DO: If nextradix == -1 AND no further args from do_radixsort AND
        !retGrp, we're done. We have o. Remember to memset thiscounts
        before returning. */
@@ -595,9 +681,9 @@ static void iradix_r(int *xsub, int *osub, int n, int radix)
 	    continue;
 	thisgrpn = thiscounts[i] - itmp;        // undo cummulate; i.e. diff
 	if (thisgrpn == 1 || nextradix == -1) {
-	    push(thisgrpn);
+	    push(s, thisgrpn);
 	} else {
-	    iradix_r(xsub+itmp, osub+itmp, thisgrpn, nextradix);
+	    iradix_r(s, xsub+itmp, osub+itmp, thisgrpn, nextradix);
 	}
 	itmp = thiscounts[i];
 	thiscounts[i] = 0;
@@ -609,13 +695,11 @@ static void iradix_r(int *xsub, int *osub, int n, int radix)
 // + replaced tolerance with rounding s.f.
 
 static int dround = 2;
-static unsigned long long dmask1;
-static unsigned long long dmask2;
 
-static void setNumericRounding(int dround)
+static void setNumericRounding(radix_state *s, int dround)
 {
-    dmask1 = dround ? 1 << (8 * dround - 1) : 0;
-    dmask2 = 0xffffffffffffffff << dround * 8;
+    s->dmask1 = dround ? 1 << (8 * dround - 1) : 0;
+    s->dmask2 = 0xffffffffffffffff << dround * 8;
 }
 
 SEXP attribute_hidden do_setNumericRounding(SEXP droundArg)
@@ -625,7 +709,6 @@ SEXP attribute_hidden do_setNumericRounding(SEXP droundArg)
     if (INTEGER(droundArg)[0] < 0 || INTEGER(droundArg)[0] > 2)
 	error("Must be 2 (default) or 1 or 0");
     dround = INTEGER(droundArg)[0];
-    setNumericRounding(dround);
     return R_NilValue;
 }
 
@@ -634,17 +717,16 @@ SEXP attribute_hidden do_getNumericRounding()
     return ScalarInteger(dround);
 }
 
-static union {
-    double d;
-    unsigned long long ull;
-} u;
-
 static
-unsigned long long dtwiddle(void *p, int i, int order)
+unsigned long long dtwiddle(radix_state *s, void *p, int i, int order)
 {
+    union {
+	double d;
+	unsigned long long ull;
+    } u;
     u.d = order * ((double *)p)[i]; // take care of 'order' at the beginning
     if (R_FINITE(u.d)) {
-	u.ull = (u.d != 0.0) ? u.ull + ((u.ull & dmask1) << 1) : 0;
+	u.ull = (u.d != 0.0) ? u.ull + ((u.ull & s->dmask1) << 1) : 0;
     } else if (ISNAN(u.d)) {
 	/* 1. NA twiddled to all bits 0, sorts first.  R's value 1954 cleared.
 
@@ -664,28 +746,25 @@ unsigned long long dtwiddle(void *p, int i, int order)
 	   in exponent
 	*/
 	u.ull = (ISNA(u.d) ? 0 : (1ULL << 51));
-	return (nalast == 1 ? ~u.ull : u.ull);
+	return (s->nalast == 1 ? ~u.ull : u.ull);
     }
     unsigned long long mask = (u.ull & 0x8000000000000000) ?
 	// always flip sign bit and if negative (sign bit was set)
 	// flip other bits too
 	0xffffffffffffffff : 0x8000000000000000;
-    return ((u.ull ^ mask) & dmask2);
+    return ((u.ull ^ mask) & s->dmask2);
 }
 
 static Rboolean dnan(void *p, int i)
 {
-    u.d = ((double *) p)[i];
-    return (ISNAN(u.d));
+    return (ISNAN(((double *) p)[i]));
 }
 
-static unsigned long long (*twiddle) (void *, int, int);
-static Rboolean(*is_nan) (void *, int);
 // the size of the arg type (4 or 8). Just 8 currently until iradix is
 // merged in.
 static size_t colSize = 8;
 
-static void dradix_r(unsigned char *xsub, int *osub, int n, int radix);
+static void dradix_r(radix_state *s, unsigned char *xsub, int *osub, int n, int radix);
 
 #ifdef WORDS_BIGENDIAN
 #define RADIX_BYTE colSize - radix - 1
@@ -693,7 +772,7 @@ static void dradix_r(unsigned char *xsub, int *osub, int n, int radix);
 #define RADIX_BYTE radix
 #endif
 
-static void dradix(unsigned char *x, int *o, int n)
+static void dradix(radix_state *s, unsigned char *x, int *o, int n)
 {
     int radix, nextradix, itmp, thisgrpn, maxgrpn;
     unsigned int *thiscounts;
@@ -701,26 +780,26 @@ static void dradix(unsigned char *x, int *o, int n)
     // see comments in iradix for structure.  This follows the same.
     // TO DO: merge iradix in here (almost ready)
     for (int i = 0; i < n; i++) {
-	thisx = twiddle(x, i, order);
+	thisx = dtwiddle(s, x, i, s->order);
 	for (radix = 0; radix < colSize; radix++)
 	    // if dround == 2 then radix 0 and 1 will be all 0 here and skipped.
 	    /* on little endian, 0 is the least significant bits (the right)
 	       and 7 is the most including sign (the left); i.e. reversed. */
-	    radixcounts[radix][((unsigned char *)&thisx)[RADIX_BYTE]]++;
+	    s->radixcounts[radix][((unsigned char *)&thisx)[RADIX_BYTE]]++;
     }
     for (radix = 0; radix < colSize; radix++) {
 	// thisx is the last x after loop above
 	int i = ((unsigned char *) &thisx)[RADIX_BYTE];
-	skip[radix] = radixcounts[radix][i] == n;
+	s->skip[radix] = s->radixcounts[radix][i] == n;
 	// clear it now, the other counts must be 0 already
-	if (skip[radix])
-	    radixcounts[radix][i] = 0;
+	if (s->skip[radix])
+	    s->radixcounts[radix][i] = 0;
     }
     radix = (int) colSize - 1;  // MSD
-    while (radix >= 0 && skip[radix]) radix--;
+    while (radix >= 0 && s->skip[radix]) radix--;
     if (radix == -1) {
 	// All radix are skipped; i.e. one number repeated n times.
-	if (nalast == 0 && is_nan(x, 0))
+	if (s->nalast == 0 && dnan(x, 0))
 	    // all values are identical. return 0 if nalast=0 & all NA
 	    // because of 'return', have to take care of it here.
 	    for (int i = 0; i < n; i++)
@@ -728,16 +807,16 @@ static void dradix(unsigned char *x, int *o, int n)
 	else
 	    for (int i = 0; i < n; i++)
 		o[i] = (i + 1);
-	push(n);
+	push(s, n);
 	return;
     }
     for (int i = radix - 1; i >= 0; i--) {
 	// clear the lower radix counts, we only did them to know
 	// skip. will be reused within each group
-	if (!skip[i])
-	    memset(radixcounts[i], 0, 257 * sizeof(unsigned int));
+	if (!s->skip[i])
+	    memset(s->radixcounts[i], 0, 257 * sizeof(unsigned int));
     }
-    thiscounts = radixcounts[radix];
+    thiscounts = s->radixcounts[radix];
     itmp = thiscounts[0];
     maxgrpn = itmp;
     for (int i = 1; itmp < n && i < 256; i++) {
@@ -749,11 +828,11 @@ static void dradix(unsigned char *x, int *o, int n)
 	}
     }
     for (int i = n - 1; i >= 0; i--) {
-	thisx = twiddle(x, i, order);
+	thisx = dtwiddle(s, x, i, s->order);
 	o[ --thiscounts[((unsigned char *)&thisx)[RADIX_BYTE]] ] = i + 1;
     }
 
-    if (radix_xsuballoc < maxgrpn) {
+    if (s->radix_xsuballoc < maxgrpn) {
         // TO DO: centralize this alloc
         // The largest group according to the first non-skipped radix,
         // so could be big (if radix is needed on first arg) TO DO:
@@ -761,18 +840,18 @@ static void dradix(unsigned char *x, int *o, int n)
         // more. Often the MSD has groups in just 0-4 out of 256.
         // free'd at the end of do_radixsort once we're done calling iradix
         // repetitively
-        radix_xsub = (double *) realloc(radix_xsub, maxgrpn * sizeof(double));
-        if (!radix_xsub)
+        s->radix_xsub = (double *) realloc(s->radix_xsub, maxgrpn * sizeof(double));
+        if (!s->radix_xsub)
             Error("Failed to realloc working memory %d*8bytes (xsub in dradix), radix=%d",
                   maxgrpn, radix);
-        radix_xsuballoc = maxgrpn;
+        s->radix_xsuballoc = maxgrpn;
     }
 
-    alloc_otmp(maxgrpn);   // TO DO: leave to do_radixsort and remove these?
-    alloc_xtmp(maxgrpn);
+    alloc_otmp(s, maxgrpn);   // TO DO: leave to do_radixsort and remove these?
+    alloc_xtmp(s, maxgrpn);
 
     nextradix = radix - 1;
-    while (nextradix >= 0 && skip[nextradix])
+    while (nextradix >= 0 && s->skip[nextradix])
 	nextradix--;
     if (thiscounts[0] != 0)
 	Error("Logical error. thiscounts[0]=%d but should have been decremented to 0. dradix=%d",
@@ -784,34 +863,34 @@ static void dradix(unsigned char *x, int *o, int n)
             continue;
         thisgrpn = thiscounts[i] - itmp;  // undo cummulate; i.e. diff
         if (thisgrpn == 1 || nextradix == -1) {
-            push(thisgrpn);
+            push(s, thisgrpn);
         } else {
             if (colSize == 4) { // ready for merging in iradix ...
                 error("Not yet used, still using iradix instead");
                 for (int j = 0; j < thisgrpn; j++)
-                    ((int *)radix_xsub)[j] = (int)twiddle(x, o[itmp+j]-1, order);
+                    ((int *)s->radix_xsub)[j] = (int)dtwiddle(s, x, o[itmp+j]-1, s->order);
                 // this is why this xsub here can't be the same memory
                 // as xsub in do_radixsort
             } else 
 		for (int j = 0; j < thisgrpn; j++)
-		    ((unsigned long long *)radix_xsub)[j] =
-			twiddle(x, o[itmp+j]-1, order);
+		    ((unsigned long long *)s->radix_xsub)[j] =
+			dtwiddle(s, x, o[itmp+j]-1, s->order);
 	    // changes xsub and o by reference recursively.
-	    dradix_r(radix_xsub, o+itmp, thisgrpn, nextradix);
+	    dradix_r(s, s->radix_xsub, o+itmp, thisgrpn, nextradix);
 	}
 	itmp = thiscounts[i];
 	thiscounts[i] = 0;
     }
-    if (nalast == 0) // nalast = 1, -1 are both taken care already.
+    if (s->nalast == 0) // nalast = 1, -1 are both taken care already.
 	for (int i = 0; i < n; i++)
-	    o[i] = is_nan(x, o[i] - 1) ? 0 : o[i];
+	    o[i] = dnan(x, o[i] - 1) ? 0 : o[i];
     // nalast = 0 is dealt with separately as it just sets o to 0
     // at those indices where x is NA. x[o[i]-1] because x is not
     // modified by reference unlike iinsert or iradix_r
 
 }
 
-static void dinsert(unsigned long long *x, int *o, int n)
+static void dinsert(radix_state *s, unsigned long long *x, int *o, int n)
 // orders both x and o by reference in-place. Fast for small vectors,
 // low overhead.  don't be tempted to binsearch backwards here, have
 // to shift anyway; many memmove would have overhead and do the same
@@ -838,13 +917,13 @@ static void dinsert(unsigned long long *x, int *o, int n)
 	if (x[i] == x[i - 1])
 	    tt++;
 	else {
-	    push(tt + 1);
+	    push(s, tt + 1);
 	    tt = 0;
 	}
-    push(tt + 1);
+    push(s, tt + 1);
 }
 
-static void dradix_r(unsigned char *xsub, int *osub, int n, int radix)
+static void dradix_r(radix_state *s, unsigned char *xsub, int *osub, int n, int radix)
 /* xsub is a recursive offset into xsub working memory above in
    dradix, reordered by reference.  osub is a an offset into the main
    answer o, reordered by reference.  dradix iterates
@@ -858,11 +937,11 @@ static void dradix_r(unsigned char *xsub, int *osub, int n, int radix)
 	   based on sum(1:50)=1275 worst -vs- 256 cummulate + 256 memset +
 	   allowance since reverse order is unlikely */
 	// order=1 here because it's already taken care of in iradix
-	dinsert((void *)xsub, osub, n);
+	dinsert(s, (void *)xsub, osub, n);
 
 	return;
     }
-    thiscounts = radixcounts[radix];
+    thiscounts = s->radixcounts[radix];
     p = xsub + RADIX_BYTE;
     for (int i = 0; i < n; i++) {
 	thiscounts[*p]++;
@@ -878,23 +957,23 @@ static void dradix_r(unsigned char *xsub, int *osub, int n, int radix)
 	error("Not yet used, still using iradix instead");
 	for (int i = n - 1; i >= 0; i--) {
 	    int j = --thiscounts[*(p + RADIX_BYTE)];
-	    otmp[j] = osub[i];
-	    ((int *) xtmp)[j] = *(int *) p;
+	    s->otmp[j] = osub[i];
+	    ((int *) s->xtmp)[j] = *(int *) p;
 	    p -= colSize;
 	}
     } else {
 	for (int i = n - 1; i >= 0; i--) {
 	    int j = --thiscounts[*(p + RADIX_BYTE)];
-	    otmp[j] = osub[i];
-	    ((unsigned long long *) xtmp)[j] = *(unsigned long long *) p;
+	    s->otmp[j] = osub[i];
+	    ((unsigned long long *) s->xtmp)[j] = *(unsigned long long *) p;
 	    p -= colSize;
 	}
     }
-    memcpy(osub, otmp, n * sizeof(int));
-    memcpy(xsub, xtmp, n * colSize);
+    memcpy(osub, s->otmp, n * sizeof(int));
+    memcpy(xsub, s->xtmp, n * colSize);
 
     nextradix = radix - 1;
-    while (nextradix >= 0 && skip[nextradix])
+    while (nextradix >= 0 && s->skip[nextradix])
 	nextradix--;
     // TO DO: If nextradix==-1 and no further args from do_radixsort,
     // we're done. We have o. Remember to memset thiscounts before
@@ -910,9 +989,9 @@ static void dradix_r(unsigned char *xsub, int *osub, int n, int radix)
 	    continue;
 	thisgrpn = thiscounts[i] - itmp;        // undo cummulate; i.e. diff
 	if (thisgrpn == 1 || nextradix == -1)
-	    push(thisgrpn);
+	    push(s, thisgrpn);
 	else
-	    dradix_r(xsub + itmp * colSize, osub + itmp, thisgrpn,
+	    dradix_r(s, xsub + itmp * colSize, osub + itmp, thisgrpn,
 		     nextradix);
 	itmp = thiscounts[i];
 	thiscounts[i] = 0;
@@ -924,22 +1003,16 @@ static void dradix_r(unsigned char *xsub, int *osub, int n, int radix)
 // be suitable. Fixed precision such as 1.10, 1.15, 1.20, 1.25, 1.30
 // ... do use all bits so dradix skipping may not help.
 
-static int *cradix_counts = NULL;
-static int cradix_counts_alloc = 0;
-static int maxlen = 1;
-static SEXP *cradix_xtmp = NULL;
-static int cradix_xtmp_alloc = 0;
-
 // same as StrCmp but also takes into account 'decreasing' and 'na.last' args.
-static int StrCmp2(SEXP x, SEXP y)
+static int StrCmp2(radix_state *s, SEXP x, SEXP y)
 {
     // same cached pointer (including NA_STRING == NA_STRING)
     if (x == y) return 0;
     // if x=NA, nalast=1 ? then x > y else x < y (Note: nalast == 0 is
     // already taken care of in 'csorted', won't be 0 here)
-    if (x == NA_STRING) return nalast;
-    if (y == NA_STRING) return -nalast;     // if y=NA, nalast=1 ? then y > x
-    return order*strcmp(CHAR(x), CHAR(y));  // same as explanation in StrCmp
+    if (x == NA_STRING) return s->nalast;
+    if (y == NA_STRING) return -s->nalast;     // if y=NA, nalast=1 ? then y > x
+    return s->order*strcmp(CHAR(x), CHAR(y));  // same as explanation in StrCmp
 }
 
 static int StrCmp(SEXP x, SEXP y)            // also used by bmerge and chmatch
@@ -977,7 +1050,34 @@ static void checkEncodings(SEXP x)
     */
 }
 
-static void cradix_r(SEXP * xsub, int n, int radix)
+// Buckets of cradix_r: 0 for NA, 1 for the end of the string and
+// byte + 1 for the bytes, none of which is 0.
+#define CRADIX_NBKT 257
+
+static R_INLINE int cradix_bucket(radix_state *s, SEXP x, int radix)
+{
+    if (x == NA_STRING)
+	return 0;
+    if (s->collate) {
+	int k = -TRUELENGTH(x) - 1;
+	return radix < s->ckeylen[k] ?
+	    (unsigned char) s->ckeys[s->ckeyoff[k] + radix] + 1 : 1;
+    }
+    return radix < LENGTH(x) ? (unsigned char) CHAR(x)[radix] + 1 : 1;
+}
+
+// compares the collation keys of ustr[i] and ustr[j] as strcmp does
+static int ckey_cmp(radix_state *s, int i, int j)
+{
+    int li = s->ckeylen[i], lj = s->ckeylen[j];
+    if (li < 0 || lj < 0)
+	return li < 0 ? (lj < 0 ? 0 : -1) : 1;
+    int c = memcmp(s->ckeys + s->ckeyoff[i], s->ckeys + s->ckeyoff[j],
+		   li < lj ? li : lj);
+    return c ? c : li - lj;
+}
+
+static void cradix_r(radix_state *s, SEXP * xsub, int n, int radix)
 // xsub is a unique set of CHARSXP, to be ordered by reference
 
 // First time, radix == 0, and xsub == x. Then recursively moves SEXP together
@@ -1008,7 +1108,9 @@ static void cradix_r(SEXP * xsub, int n, int radix)
     // TO DO?: if (n<N_SMALL = 200) insert sort, then loop through groups via ==
     if (n <= 1) return;
     if (n == 2) {
-	if (StrCmp(xsub[1], xsub[0]) < 0) {
+	if ((s->collate ?
+	     ckey_cmp(s, -TRUELENGTH(xsub[1]) - 1, -TRUELENGTH(xsub[0]) - 1) :
+	     StrCmp(xsub[1], xsub[0])) < 0) {
 	    stmp = xsub[0];
 	    xsub[0] = xsub[1];
 	    xsub[1] = stmp;
@@ -1019,47 +1121,43 @@ static void cradix_r(SEXP * xsub, int n, int radix)
     // CHAR) or using StrCmp. But 256 is narrow, so quick and not too
     // much an issue.
 
-    thiscounts = cradix_counts + radix * 256;
+    thiscounts = s->cradix_counts + radix * CRADIX_NBKT;
     for (int i = 0; i < n; i++) {
-	thisx = xsub[i] == NA_STRING ?
-	    0 : (radix < LENGTH(xsub[i]) ?
-		 (unsigned char) (CHAR(xsub[i])[radix]) : 1);
+	thisx = cradix_bucket(s, xsub[i], radix);
 	thiscounts[ thisx ]++;   // 0 for NA,  1 for ""
     }
     // this also catches when subx has shorter strings than the rest,
     // thiscounts[0] == n and we'll recurse very quickly through to the
     // overall maxlen with no 256 overhead each time
-    if (thiscounts[thisx] == n && radix < maxlen - 1) {
-	cradix_r(xsub, n, radix + 1);
+    if (thiscounts[thisx] == n && radix < s->maxlen - 1) {
+	cradix_r(s, xsub, n, radix + 1);
 	thiscounts[thisx] = 0;  // the rest must be 0 already, save the memset
 	return;
     }
     itmp = thiscounts[0];
-    for (int i = 1; i < 256; i++)
+    for (int i = 1; i < CRADIX_NBKT; i++)
 	// don't cummulate through 0s, important below
 	if (thiscounts[i])
 	    thiscounts[i] = (itmp += thiscounts[i]);
     for (int i = n - 1; i >= 0; i--) {
-	thisx = xsub[i] == NA_STRING ?
-	    0 : (radix < LENGTH(xsub[i]) ?
-		 (unsigned char) (CHAR(xsub[i])[radix]) : 1);
+	thisx = cradix_bucket(s, xsub[i], radix);
 	int j = --thiscounts[thisx];
-	cradix_xtmp[j] = xsub[i];
+	s->cradix_xtmp[j] = xsub[i];
     }
-    memcpy(xsub, cradix_xtmp, n * sizeof(SEXP));
-    if (radix == maxlen - 1) {
-	memset(thiscounts, 0, 256 * sizeof(int));
+    memcpy(xsub, s->cradix_xtmp, n * sizeof(SEXP));
+    if (radix == s->maxlen - 1) {
+	memset(thiscounts, 0, CRADIX_NBKT * sizeof(int));
 	return;
     }
     if (thiscounts[0] != 0)
 	Error("Logical error. counts[0]=%d in cradix but should have been decremented to 0. radix=%d",
 	      thiscounts[0], radix);
     itmp = 0;
-    for (int i = 1; i < 256; i++) {
+    for (int i = 1; i < CRADIX_NBKT; i++) {
 	if (thiscounts[i] == 0)
 	    continue;
 	thisgrpn = thiscounts[i] - itmp;        // undo cummulate; i.e. diff
-	cradix_r(xsub + itmp, thisgrpn, radix + 1);
+	cradix_r(s, xsub + itmp, thisgrpn, radix + 1);
 	itmp = thiscounts[i];
 	// set to 0 now since we're here, saves memset
 	// afterwards. Important to clear! Also more portable for
@@ -1067,13 +1165,10 @@ static void cradix_r(SEXP * xsub, int n, int radix)
 	thiscounts[i] = 0;
     }
     if (itmp < n - 1)
-	cradix_r(xsub + itmp, n - itmp, radix + 1);     // final group
+	cradix_r(s, xsub + itmp, n - itmp, radix + 1);     // final group
 }
 
-static SEXP *ustr = NULL;
-static int ustr_alloc = 0, ustr_n = 0;
-
-static void cgroup(SEXP * x, int *o, int n)
+static void cgroup(radix_state *s, SEXP * x, int *o, int n)
 // As icount :
 //   Places the ordering into o directly, overwriting whatever was there
 //   Doesn't change x
@@ -1085,77 +1180,76 @@ static void cgroup(SEXP * x, int *o, int n)
 // cleared each time.
 {
     // savetl_init() is called once at the start of do_radixsort
-    if (ustr_n != 0)
+    if (s->ustr_n != 0)
 	Error
 	    ("Internal error. ustr isn't empty when starting cgroup: ustr_n=%d, ustr_alloc=%d",
-	     ustr_n, ustr_alloc);
+	     s->ustr_n, s->ustr_alloc);
     for (int i = 0; i < n; i++) {
-	SEXP s = x[i];
-	if (TRUELENGTH(s) < 0) {        // this case first as it's the most frequent
-	    SET_TRUELENGTH(s, TRUELENGTH(s) - 1);
+	SEXP xs = x[i];
+	if (TRUELENGTH(xs) < 0) {        // this case first as it's the most frequent
+	    SET_TRUELENGTH(xs, TRUELENGTH(xs) - 1);
 	    // use negative counts so as to detect R's own (positive)
 	    // usage of tl on CHARSXP
 	    continue;
 	}
-	if (TRUELENGTH(s) > 0) {
+	if (TRUELENGTH(xs) > 0) {
 	    // Save any of R's own usage of tl (assumed positive, so
 	    // we can both count and save in one scan), to restore
 	    // afterwards. From R 2.14.0, tl is initialized to 0,
 	    // prior to that it was random so this step saved too much.
-	    savetl(s);
-	    SET_TRUELENGTH(s, 0);
+	    savetl(s, xs);
+	    SET_TRUELENGTH(xs, 0);
 	}
-	if (ustr_alloc <= ustr_n) {
+	if (s->ustr_alloc <= s->ustr_n) {
 	    // 10000 = 78k of 8byte pointers. Small initial guess,
 	    // negligible time to alloc.
-	    ustr_alloc = (ustr_alloc == 0) ? 10000 : ustr_alloc*2;
-	    if (ustr_alloc > n)
-		ustr_alloc = n;
-	    ustr = realloc(ustr, ustr_alloc * sizeof(SEXP));
-	    if (ustr == NULL)
-		Error("Unable to realloc %d * %d bytes in cgroup", ustr_alloc,
+	    s->ustr_alloc = (s->ustr_alloc == 0) ? 10000 : s->ustr_alloc*2;
+	    if (s->ustr_alloc > n)
+		s->ustr_alloc = n;
+	    s->ustr = realloc(s->ustr, s->ustr_alloc * sizeof(SEXP));
+	    if (s->ustr == NULL)
+		Error("Unable to realloc %d * %d bytes in cgroup", s->ustr_alloc,
 		      sizeof(SEXP));
 	}
-	SET_TRUELENGTH(s, -1);
-	ustr[ustr_n++] = s;
+	SET_TRUELENGTH(xs, -1);
+	s->ustr[s->ustr_n++] = xs;
     }
     // TO DO: the same string in different encodings will be
     // considered different here. Sweep through ustr and merge counts
     // where equal (sort needed therefore, unfortunately?, only if
     // there are any marked encodings present)
     int cumsum = 0;
-    for (int i = 0; i < ustr_n; i++) {      // 0.000
-	push(-TRUELENGTH(ustr[i]));
-	SET_TRUELENGTH(ustr[i], cumsum += -TRUELENGTH(ustr[i]));
+    for (int i = 0; i < s->ustr_n; i++) {      // 0.000
+	push(s, -TRUELENGTH(s->ustr[i]));
+	SET_TRUELENGTH(s->ustr[i], cumsum += -TRUELENGTH(s->ustr[i]));
     }
-    int *target = (o[0] != -1) ? newo : o;
+    int *target = (o[0] != -1) ? s->newo : o;
     for (int i = n - 1; i >= 0; i--) {
-	SEXP s = x[i];           // 0.400 (page fetches on string cache)
-	int k = TRUELENGTH(s) - 1;
-	SET_TRUELENGTH(s, k);
+	SEXP xs = x[i];           // 0.400 (page fetches on string cache)
+	int k = TRUELENGTH(xs) - 1;
+	SET_TRUELENGTH(xs, k);
 	target[k] = i + 1;      // 0.800 (random access to o)
     }
     // The cummulate meant counts are left non zero, so reset for next
     // time (0.00s).
-    for (int i = 0; i < ustr_n; i++)
-	SET_TRUELENGTH(ustr[i], 0);
-    ustr_n = 0;
+    for (int i = 0; i < s->ustr_n; i++)
+	SET_TRUELENGTH(s->ustr[i], 0);
+    s->ustr_n = 0;
 }
 
-static int *csort_otmp = NULL, csort_otmp_alloc = 0;
-static void alloc_csort_otmp(int n)
+static void alloc_csort_otmp(radix_state *s, int n)
 {
-    if (csort_otmp_alloc >= n)
+    if (s->csort_otmp_alloc >= n)
 	return;
-    csort_otmp = (int *) realloc(csort_otmp, n * sizeof(int));
-    if (csort_otmp == NULL)
+    s->csort_otmp = (int *) realloc(s->csort_otmp, n * sizeof(int));
+    if (s->csort_otmp == NULL)
 	Error
 	    ("Failed to allocate working memory for csort_otmp. Requested %d * %d bytes",
 	     n, sizeof(int));
-    csort_otmp_alloc = n;
+    s->csort_otmp_alloc = n;
 }
 
-static void csort(SEXP * x, int *o, int n)
+static void csort(radix_state *s, SEXP * x, int *o, int n)
 /*
    As icount :
    Places the ordering into o directly, overwriting whatever was there
@@ -1168,8 +1262,8 @@ static void csort(SEXP * x, int *o, int n)
        otmp (and xtmp).  alloc_csort_otmp(n) is called from do_radixsort for
        either n=nrow if 1st arg, or n=maxgrpn if onwards args */
     for (int i = 0; i < n; i++)
-	csort_otmp[i] = (x[i] == NA_STRING) ? NA_INTEGER : -TRUELENGTH(x[i]);
-    if (nalast == 0 && n == 2) {
+	s->csort_otmp[i] = (x[i] == NA_STRING) ? NA_INTEGER : -TRUELENGTH(x[i]);
+    if (s->nalast == 0 && n == 2) {
         // special case for nalast == 0. n == 1 is handled inside
         // do_radixsort. at least 1 will be NA here else use o from caller
         // directly (not 1st arg)
@@ -1177,31 +1271,31 @@ static void csort(SEXP * x, int *o, int n)
             for (int i = 0; i < n; i++)
                 o[i] = i + 1;
         for (int i = 0;  i < n; i++)
-            if (csort_otmp[i] == NA_INTEGER)
+            if (s->csort_otmp[i] == NA_INTEGER)
                 o[i] = 0;
-        push(1); push(1);
+        push(s, 1); push(s, 1);
         return; 
     }
-    if (n < N_SMALL && nalast != 0) { // TO DO: calibrate() N_SMALL=200
+    if (n < N_SMALL && s->nalast != 0) { // TO DO: calibrate() N_SMALL=200
         if (o[0] == -1)
             for (int i = 0; i < n; i++)
                 o[i] = i + 1;
         // else use o from caller directly (not 1st arg)
         for (int i = 0; i < n; i++)
-            csort_otmp[i] = icheck(csort_otmp[i]);
-        iinsert(csort_otmp, o, n);
+            s->csort_otmp[i] = icheck(s, s->csort_otmp[i]);
+        iinsert(s, s->csort_otmp, o, n);
     } else {
-	setRange(csort_otmp, n);
-	if (range == NA_INTEGER)
+	setRange(s, s->csort_otmp, n);
+	if (s->range == NA_INTEGER)
 	    Error("Internal error. csort's otmp contains all-NA");
-	int *target = (o[0] != -1) ? newo : o;
-	if (range <= N_RANGE)
+	int *target = (o[0] != -1) ? s->newo : o;
+	if (s->range <= N_RANGE)
 	    // TO DO: calibrate(). radix was faster (9.2s
 	    // "range<=10000" instead of 11.6s "range<=N_RANGE &&
 	    // range<n") for run(7) where range=N_RANGE n=10000000
-	    icount(csort_otmp, target, n);
+	    icount(s, s->csort_otmp, target, n);
 	else
-	    iradix(csort_otmp, target, n);
+	    iradix(s, s->csort_otmp, target, n);
     }
     // all i* push onto stack. Using their counts may be faster here
     // than thrashing SEXP fetches over several passes as cgroup does
@@ -1209,49 +1303,125 @@ static void csort(SEXP * x, int *o, int n)
     // the sort in csort_pre).
 }
 
-static void csort_pre(SEXP * x, int n)
+// The errors which making collation keys could give, before any
+// TRUELENGTH is changed: "bytes" strings cannot be translated, and
+// the collator is set up by making the key of one string.
+static void ckeys_check(SEXP x)
+{
+    if (TYPEOF(x) != STRSXP)
+	return;
+    R_xlen_t n = XLENGTH(x), first = -1;
+    for (R_xlen_t i = 0; i < n; i++) {
+	SEXP xs = STRING_ELT(x, i);
+	if (xs == NA_STRING)
+	    continue;
+	if (IS_BYTES(xs))
+	    error(_("strings with \"bytes\" encoding cannot be collated"));
+	if (first < 0)
+	    first = i;
+    }
+    if (first >= 0) {
+	char key[1];
+	const void *vmax = vmaxget();
+	Scollate_key(STRING_ELT(x, first), key, 1);
+	vmaxset(vmax);
+    }
+}
+
+static void ckeys_make(radix_state *s)
+// Makes the collation keys of all of ustr (not just the new strings,
+// whose TRUELENGTH no longer tells where their keys are) for
+// cradix_r, and sets maxlen to the longest key
+{
+    int un = s->ustr_n;
+    if (s->ckey_alloc < un) {
+	s->ckeyoff = (size_t *) realloc(s->ckeyoff, un * sizeof(size_t));
+	s->ckeylen = (int *) realloc(s->ckeylen, un * sizeof(int));
+	if (!s->ckeyoff || !s->ckeylen)
+	    Error("Failed to alloc the collation keys of %d strings", un);
+	s->ckey_alloc = un;
+    }
+    if (s->ckeys_alloc < 16 * (size_t) un + 1024) {
+	s->ckeys_alloc = 16 * (size_t) un + 1024;
+	s->ckeys = (char *) realloc(s->ckeys, s->ckeys_alloc);
+	if (!s->ckeys)
+	    Error("Failed to alloc the collation keys of %d strings", un);
+    }
+    size_t off = 0;
+    for (int i = 0; i < un; i++) {
+	SEXP xs = s->ustr[i];
+	SET_TRUELENGTH(xs, -i - 1);
+	s->ckeyoff[i] = off;
+	if (xs == NA_STRING) {
+	    s->ckeylen[i] = -1;
+	    continue;
+	}
+	const void *vmax = vmaxget();
+	for (;;) {
+	    size_t room = s->ckeys_alloc - off;
+	    if (room > INT_MAX) room = INT_MAX;
+	    int len = Scollate_key(xs, s->ckeys + off, (int) room);
+	    if (len < 0)
+		Error("Failed to make the collation key of '%s'", CHAR(xs));
+	    if (len < (int) room) {
+		s->ckeylen[i] = len;
+		off += len;
+		if (len > s->maxlen) s->maxlen = len;
+		break;
+	    }
+	    s->ckeys_alloc = 2 * s->ckeys_alloc + len;
+	    s->ckeys = (char *) realloc(s->ckeys, s->ckeys_alloc);
+	    if (!s->ckeys)
+		Error("Failed to realloc the collation keys. Requested %.0f bytes",
+		      (double) s->ckeys_alloc);
+	}
+	vmaxset(vmax);
+    }
+}
+
+static void csort_pre(radix_state *s, SEXP * x, int n)
 // Finds ustr and sorts it.  Runs once for each arg (if
 // sortStr == TRUE), then ustr is used by csort within each group ustr
 // is grown on each character arg, to save sorting the same strings
 // again if several args contain the same strings
 {
-    SEXP s;
+    SEXP xs;
     int old_un, new_un;
     // savetl_init() is called once at the start of do_radixsort
-    old_un = ustr_n;
+    old_un = s->ustr_n;
     for (int i = 0; i < n; i++) {
-	s = x[i];
+	xs = x[i];
 	// this case first as it's the most frequent. Already in ustr,
 	// this negative is its ordering.
-	if (TRUELENGTH(s) < 0)
+	if (TRUELENGTH(xs) < 0)
 	    continue;
 	// Save any of R's own usage of tl (assumed positive, so we
 	// can both count and save in one scan), to restore
 	// afterwards. From R 2.14.0, tl is initialized to 0, prior to
 	// that it was random so this step saved too much.
-	if (TRUELENGTH(s) > 0) {
-	    savetl(s);
-	    SET_TRUELENGTH(s, 0);
+	if (TRUELENGTH(xs) > 0) {
+	    savetl(s, xs);
+	    SET_TRUELENGTH(xs, 0);
 	}
-	if (ustr_alloc <= ustr_n) {
+	if (s->ustr_alloc <= s->ustr_n) {
 	    // 10000 = 78k of 8byte pointers. Small initial guess,
 	    // negligible time to alloc.
-	    ustr_alloc = (ustr_alloc == 0) ? 10000 : ustr_alloc*2;
-	    if (ustr_alloc > old_un+n)
-		ustr_alloc = old_un + n;
-	    ustr = realloc(ustr, ustr_alloc * sizeof(SEXP));
-	    if (ustr == NULL)
+	    s->ustr_alloc = (s->ustr_alloc == 0) ? 10000 : s->ustr_alloc*2;
+	    if (s->ustr_alloc > old_un+n)
+		s->ustr_alloc = old_un + n;
+	    s->ustr = realloc(s->ustr, s->ustr_alloc * sizeof(SEXP));
+	    if (s->ustr == NULL)
 		Error("Failed to realloc ustr. Requested %d * %d bytes",
-		      ustr_alloc, sizeof(SEXP));
+		      s->ustr_alloc, sizeof(SEXP));
 	}
-	SET_TRUELENGTH(s, -1);  // this -1 will become its ordering later below
-	ustr[ustr_n++] = s;
+	SET_TRUELENGTH(xs, -1);  // this -1 will become its ordering later below
+	s->ustr[s->ustr_n++] = xs;
 	// length on CHARSXP is the nchar of char * (excluding \0),
 	// and treats marked encodings as if ascii.
-	if (s != NA_STRING && LENGTH(s) > maxlen)
-	    maxlen = LENGTH(s);
+	if (!s->collate && xs != NA_STRING && LENGTH(xs) > s->maxlen)
+	    s->maxlen = LENGTH(xs);
     }
-    new_un = ustr_n;
+    new_un = s->ustr_n;
     if (new_un == old_un)
 	return;
     // No new strings observed, seen them all before in previous
@@ -1261,27 +1431,40 @@ static void csort_pre(SEXP * x, int n)
 
     // TODO: just sort new ones and merge them in.  These allocs are
     // here, to save them being in the recursive cradix_r()
-    if (cradix_counts_alloc < maxlen) {
-	cradix_counts_alloc = maxlen + 10;   // +10 to save too many reallocs
-	cradix_counts = (int *)realloc(cradix_counts,
-				       cradix_counts_alloc * 256 * sizeof(int));
-	if (!cradix_counts)
+    if (s->collate)
+	ckeys_make(s);
+    if (s->cradix_counts_alloc < s->maxlen) {
+	s->cradix_counts_alloc = s->maxlen + 10;   // +10 to save too many reallocs
+	s->cradix_counts = (int *)realloc(s->cradix_counts,
+				       s->cradix_counts_alloc * CRADIX_NBKT * sizeof(int));
+	if (!s->cradix_counts)
 	    Error("Failed to alloc cradix_counts");
-	memset(cradix_counts, 0, cradix_counts_alloc * 256 * sizeof(int));
+	memset(s->cradix_counts, 0,
+	       s->cradix_counts_alloc * CRADIX_NBKT * sizeof(int));
     }
-    if (cradix_xtmp_alloc < ustr_n) {
-        cradix_xtmp = (SEXP *) realloc(cradix_xtmp,  ustr_n * sizeof(SEXP));
+    if (s->cradix_xtmp_alloc < s->ustr_n) {
+        s->cradix_xtmp = (SEXP *) realloc(s->cradix_xtmp,  s->ustr_n * sizeof(SEXP));
         // TO DO: Reuse the one we have in do_radixsort.
         // Does it need to be n length?
-        if (!cradix_xtmp)
+        if (!s->cradix_xtmp)
             Error("Failed to alloc cradix_tmp");
-        cradix_xtmp_alloc = ustr_n;
+        s->cradix_xtmp_alloc = s->ustr_n;
     }
     // sorts ustr in-place by reference save ordering in the
     // CHARSXP. negative so as to distinguish with R's own usage.
-    cradix_r(ustr, ustr_n, 0);
-    for (int i = 0; i < ustr_n; i++)
-	SET_TRUELENGTH(ustr[i], -i - 1);
+    cradix_r(s, s->ustr, s->ustr_n, 0);
+    if (s->collate) {
+	// strings of equal collation keys tie, as for Scollate()
+	for (int i = 0, r = 0, prev = -1; i < s->ustr_n; i++) {
+	    int k = -TRUELENGTH(s->ustr[i]) - 1;
+	    if (i == 0 || ckey_cmp(s, k, prev) != 0)
+		r = i + 1;
+	    prev = k;
+	    SET_TRUELENGTH(s->ustr[i], -r);
+	}
+    } else
+	for (int i = 0; i < s->ustr_n; i++)
+	    SET_TRUELENGTH(s->ustr[i], -i - 1);
 }
 
 // functions to test vectors for sortedness: isorted, dsorted and csorted
@@ -1301,7 +1484,7 @@ static void csort_pre(SEXP * x, int n)
 // order = 1 is ascending and order=-1 is descending; also takes care
 // of na.last argument with check through 'icheck' Relies on
 // NA_INTEGER == INT_MIN, checked in init.c
-static int isorted(int *x, int n)
+static int isorted(radix_state *s, int *x, int n)
 {
     int i = 1, j = 0;
     // when nalast = NA,
@@ -1309,47 +1492,47 @@ static int isorted(int *x, int n)
     // any NAs ? return 0 = unsorted and leave it
     //   to sort routines to replace o's with 0's
     // no NAs ? continue to check rest of isorted - the same routine as usual
-    if (nalast == 0) {
+    if (s->nalast == 0) {
 	for (int k = 0; k < n; k++)
 	    if (x[k] != NA_INTEGER)
 		j++;
 	if (j == 0) {
-	    push(n);
+	    push(s, n);
 	    return (-2);
 	}
 	if (j != n)
 	    return (0);
     }
     if (n <= 1) {
-	push(n);
+	push(s, n);
 	return (1);
     }
-    if (icheck(x[1]) < icheck(x[0])) {
+    if (icheck(s, x[1]) < icheck(s, x[0])) {
 	i = 2;
-	while (i < n && icheck(x[i]) < icheck(x[i - 1]))
+	while (i < n && icheck(s, x[i]) < icheck(s, x[i - 1]))
 	    i++;
 	// strictly opposite to expected 'order', no ties;
 	if (i == n) {
-	    mpush(1, n);
+	    mpush(s, 1, n);
 	    return (-1);
 	}
 	// e.g. no more than one NA at the beginning/end (for order=-1/1)
 	else return (0);
     }
-    int old = gsngrp[flip];
+    int old = gsmark(s);
     int tt = 1;
     for (int i = 1; i < n; i++) {
-	if (icheck(x[i]) < icheck(x[i - 1])) {
-	    gsngrp[flip] = old;
+	if (icheck(s, x[i]) < icheck(s, x[i - 1])) {
+	    gsrewind(s, old);
 	    return (0);
 	}
 	if (x[i] == x[i - 1])
 	    tt++;
 	else {
-	    push(tt); tt = 1;
+	    push(s, tt); tt = 1;
 	}
     }
-    push(tt);
+    push(s, tt);
     // same as 'order', NAs at the beginning for order=1, at end for
     // order=-1, possibly with ties
     return(1);
@@ -1357,11 +1540,11 @@ static int isorted(int *x, int n)
 
 // order=1 is ascending and -1 is descending
 // also accounts for nalast=0 (=NA), =1 (TRUE), -1 (FALSE) (in twiddle)
-static int dsorted(double *x, int n)
+static int dsorted(radix_state *s, double *x, int n)
 {
     int i = 1, j = 0;
     unsigned long long prev, this;
-    if (nalast == 0) {
+    if (s->nalast == 0) {
 	// when nalast = NA,
 	// all NAs ? return special value to replace all o's values with '0'
 	// any NAs ? return 0 = unsorted and leave it to sort routines to
@@ -1369,30 +1552,30 @@ static int dsorted(double *x, int n)
 	// no NAs  ? continue to check the rest of isorted -
 	//           the same routine as usual
 	for (int k = 0; k < n; k++)
-	    if (!is_nan(x, k))
+	    if (!dnan(x, k))
 		j++;
 	if (j == 0) {
-	    push(n);
+	    push(s, n);
 	    return (-2);
 	}
 	if (j != n)
 	    return (0);
     }
     if (n <= 1) {
-	push(n);
+	push(s, n);
 	return (1);
     }
-    prev = twiddle(x, 0, order);
-    this = twiddle(x, 1, order);
+    prev = dtwiddle(s, x, 0, s->order);
+    this = dtwiddle(s, x, 1, s->order);
     if (this < prev) {
 	i = 2;
 	prev = this;
-	while (i < n && (this = twiddle(x, i, order)) < prev) {
+	while (i < n && (this = dtwiddle(s, x, i, s->order)) < prev) {
 	    i++;
 	    prev = this;
 	}
 	if (i == n) {
-	    mpush(1, n);
+	    mpush(s, 1, n);
 	    return (-1);
 	}
 	// strictly opposite of expected 'order', no ties; e.g. no
@@ -1401,26 +1584,26 @@ static int dsorted(double *x, int n)
 	// TO DO: improve to be stable for ties in reverse
 	else return(0);
     }
-    int old = gsngrp[flip];
+    int old = gsmark(s);
     int tt = 1;
     for (int i = 1; i < n; i++) {
 	// TO DO: once we get past -Inf, NA and NaN at the bottom, and
 	//        +Inf at the top, the middle only need be twiddled
 	//        for tolerance (worth it?)
-	this = twiddle(x, i, order);
+	this = dtwiddle(s, x, i, s->order);
 	if (this < prev) {
-	    gsngrp[flip] = old;
+	    gsrewind(s, old);
 	    return (0);
 	}
 	if (this == prev)
 	    tt++;
 	else {
-	    push(tt);
+	    push(s, tt);
 	    tt = 1;
 	}
 	prev = this;
     }
-    push(tt);
+    push(s, tt);
     // exactly as expected in 'order' (1=increasing, -1=decreasing),
     // possibly with ties
     return (1);
@@ -1428,10 +1611,10 @@ static int dsorted(double *x, int n)
 
 // order=1 is ascending and -1 is descending
 // also accounts for nalast=0 (=NA), =1 (TRUE), -1 (FALSE)
-static int csorted(SEXP *x, int n)
+static int csorted(radix_state *s, SEXP *x, int n)
 {
     int i = 1, j = 0, tmp;
-    if (nalast == 0) {
+    if (s->nalast == 0) {
 	// when nalast = NA,
 	// all NAs ? return special value to replace all o's values with '0'
 	// any NAs ? return 0 = unsorted and leave it to sort routines
@@ -1442,22 +1625,25 @@ static int csorted(SEXP *x, int n)
 	    if (x[k] != NA_STRING)
 		j++;
 	if (j == 0) {
-	    push(n);
+	    push(s, n);
 	    return (-2);
 	}
 	if (j != n)
 	    return (0);
     }
     if (n <= 1) {
-	push(n);
+	push(s, n);
 	return (1);
     }
-    if (StrCmp2(x[1], x[0]) < 0) {
+    // the collation keys are only made by csort_pre
+    if (s->collate)
+	return (0);
+    if (StrCmp2(s, x[1], x[0]) < 0) {
 	i = 2;
-	while (i < n && StrCmp2(x[i], x[i - 1]) < 0)
+	while (i < n && StrCmp2(s, x[i], x[i - 1]) < 0)
 	    i++;
 	if (i == n) {
-	    mpush(1, n);
+	    mpush(s, 1, n);
 	    return (-1);
 	}
 	// strictly opposite of expected 'order', no ties;
@@ -1465,109 +1651,675 @@ static int csorted(SEXP *x, int n)
 	else
 	    return (0);
     }
-    int old = gsngrp[flip];
+    int old = gsmark(s);
     int tt = 1;
     for (int i = 1; i < n; i++) {
-	tmp = StrCmp2(x[i], x[i - 1]);
+	tmp = StrCmp2(s, x[i], x[i - 1]);
 	if (tmp < 0) {
-	    gsngrp[flip] = old;
+	    gsrewind(s, old);
 	    return (0);
 	}
 	if (tmp == 0)
 	    tt++;
 	else {
-	    push(tt);
+	    push(s, tt);
 	    tt = 1;
 	}
     }
-    push(tt);
+    push(s, tt);
     // exactly as expected in 'order', possibly with ties
     return (1);
 }
 
-static void isort(int *x, int *o, int n)
+/* Threaded sorting.
+
+   Vectors of R_RADIX_THREADS_MIN or more integers or doubles are
+   sorted on R_num_math_threads threads.  Each thread counts the values
+   (for icount) or the bytes at the radix of one contiguous block; the
+   counts give each thread where its elements of each bucket go, and
+   the threads then scatter their blocks forwards, so that ties keep
+   their order as in the sequential passes.  Buckets which are still
+   that large are split again in the same way, and the others are
+   sorted by iradix_r or dradix_r, a bucket at a time, by threads with
+   states of their own, the workers.  Groups of later arguments are
+   likewise sorted in parallel, see grpsort_par.
+
+   The workers record groups by position (see gsout), so the result
+   does not depend on which thread sorted what.  Strings are always
+   sorted by the main thread, as they are ordered through the
+   truelengths of their CHARSXPs. */
+#define R_RADIX_THREADS_MIN 1000000
+#define R_RADIX_MAX_THREADS 64
+
+static R_INLINE int radix_nthreads(int n)
+{
+#ifdef _OPENMP
+    if (n >= R_RADIX_THREADS_MIN && R_num_math_threads > 1)
+	return R_num_math_threads < R_RADIX_MAX_THREADS ?
+	    R_num_math_threads : R_RADIX_MAX_THREADS;
+#endif
+    return 1;
+}
+
+/* The threads for sorting n elements by s: only the main thread
+   starts threads, and only where the groups go to gsout or are not
+   needed. */
+static int radix_threads(radix_state *s, int n)
+{
+    if (s->worker || (s->stackgrps && s->gsout == NULL))
+	return 1;
+    return radix_nthreads(n);
+}
+
+#define RADIX_BLOCK_FROM(n, nthreads, t) \
+    ((int) ((double) (n) * (t) / (nthreads)))
+#define RADIX_BLOCK_TO(n, nthreads, t) RADIX_BLOCK_FROM(n, nthreads, (t) + 1)
+
+// the byte at radix of key i, as in iradix_r (size 4) and dradix_r (8)
+#define RADIX_KEY(keys, i, size, radix) ((size) == 4 ?			\
+	((unsigned int) ((int *) (keys))[i] - INT_MIN) >> (radix) * 8 & 0xFF : \
+	(keys)[(size_t) (i) * 8 + RADIX_BYTE])
+
+/* Make the workers, or pass them the settings of s for the next
+   threaded region.  Returns the number of workers. */
+static int radix_workers(radix_state *s, int nthreads)
+{
+    if (s->workers == NULL) {
+	s->workers = (radix_state *) calloc(nthreads, sizeof(radix_state));
+	if (s->workers == NULL)
+	    Error("Failed to allocate the states of %d threads", nthreads);
+	s->nworkers = nthreads;
+	for (int t = 0; t < nthreads; t++) {
+	    radix_state *w = s->workers + t;
+	    w->worker = TRUE;
+	    w->counts = calloc(N_RANGE + 1, sizeof(unsigned int));
+	    if (w->counts == NULL)
+		Error("Failed to allocate working memory for counts. Requested %d * %d bytes",
+		      N_RANGE + 1, sizeof(unsigned int));
+	}
+    }
+    for (int t = 0; t < s->nworkers; t++) {
+	radix_state *w = s->workers + t;
+	w->nalast = s->nalast;
+	w->order = s->order;
+	w->stackgrps = s->stackgrps;
+	w->dmask1 = s->dmask1;
+	w->dmask2 = s->dmask2;
+	w->gsout = s->gsout;
+	memcpy(w->skip, s->skip, sizeof(s->skip));
+    }
+    return s->nworkers < nthreads ? s->nworkers : nthreads;
+}
+
+/* Make sure the working memory of worker w takes a group of n
+   elements, so that the sequential code it runs allocates nothing.
+   Called from the threads, so only returns FALSE on failure. */
+static Rboolean radix_reserve(radix_state *w, int n)
+{
+    void *p;
+    if (w->otmp_alloc < n) {
+	if (!(p = realloc(w->otmp, n * sizeof(int)))) return FALSE;
+	w->otmp = p;
+	w->otmp_alloc = n;
+    }
+    if (w->xtmp_alloc < n) {
+	if (!(p = realloc(w->xtmp, n * sizeof(double)))) return FALSE;
+	w->xtmp = p;
+	w->xtmp_alloc = n;
+    }
+    if (w->radix_xsuballoc < n) {
+	if (!(p = realloc(w->radix_xsub, n * sizeof(double)))) return FALSE;
+	w->radix_xsub = p;
+	w->radix_xsuballoc = n;
+    }
+    if (w->xsuballoc < n) {
+	if (!(p = realloc(w->xsub, n * sizeof(double)))) return FALSE;
+	w->xsub = p;
+	if (!(p = realloc(w->newo, n * sizeof(int)))) return FALSE;
+	w->newo = p;
+	w->xsuballoc = n;
+    }
+    return TRUE;
+}
+
+/* Free the working memory of s, first restoring the truelengths of
+   the CHARSXPs: at the end of do_radixsort and before its errors. */
+static void radix_free(radix_state *s)
+{
+    for (int i = 0; i < s->ustr_n; i++)
+	SET_TRUELENGTH(s->ustr[i], 0);
+    s->ustr_n = 0;
+    savetl_end(s);
+    free(s->ustr);          s->ustr = NULL;
+    free(s->gs[0]);         s->gs[0] = NULL;
+    free(s->gs[1]);         s->gs[1] = NULL;
+    free(s->radix_xsub);    s->radix_xsub = NULL;
+    free(s->xsub);          s->xsub = NULL;
+    free(s->newo);          s->newo = NULL;
+    free(s->xtmp);          s->xtmp = NULL;
+    free(s->otmp);          s->otmp = NULL;
+    free(s->counts);        s->counts = NULL;
+    free(s->csort_otmp);    s->csort_otmp = NULL;
+    free(s->cradix_counts); s->cradix_counts = NULL;
+    free(s->cradix_xtmp);   s->cradix_xtmp = NULL;
+    free(s->ckeys);         s->ckeys = NULL;
+    free(s->ckeyoff);       s->ckeyoff = NULL;
+    free(s->ckeylen);       s->ckeylen = NULL;
+    if (s->workers) {
+	for (int t = 0; t < s->nworkers; t++) {
+	    s->workers[t].gsout = NULL;  // that of s
+	    radix_free(s->workers + t);
+	}
+	free(s->workers);
+	s->workers = NULL;
+    }
+    free(s->gsout);         s->gsout = NULL;
+}
+
+/* icount on nthreads threads */
+static void icount_par(radix_state *s, int *x, int *o, int n, int nthreads)
+{
+    int napos = (s->nalast == 1) ? s->range : 0, nalast = s->nalast;
+    int off = s->off, order = s->order, nc = s->range + 1;
+    unsigned int *counts = calloc((size_t) nthreads * nc, sizeof(unsigned int));
+    if (counts == NULL)
+	Error("Failed to allocate working memory for counts. Requested %d * %d bytes",
+	      nthreads * nc, sizeof(unsigned int));
+
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(nthreads) default(none) \
+    firstprivate(x, n, nthreads, counts, nc, napos, off, order, R_NaInt)
+#endif
+    for (int t = 0; t < nthreads; t++) {
+	unsigned int *c = counts + (size_t) t * nc;
+	for (int i = RADIX_BLOCK_FROM(n, nthreads, t);
+	     i < RADIX_BLOCK_TO(n, nthreads, t); i++)
+	    c[(x[i] == NA_INTEGER) ? napos : off + order * x[i]]++;
+    }
+    // push the groups, and turn the counts into the threads' positions
+    unsigned int pos = 0;
+    for (int v = 0; v < nc; v++) {
+	unsigned int grpn = 0;
+	for (int t = 0; t < nthreads; t++) {
+	    unsigned int c = counts[(size_t) t * nc + v];
+	    counts[(size_t) t * nc + v] = pos + grpn;
+	    grpn += c;
+	}
+	if (grpn)
+	    push(s, grpn);
+	pos += grpn;
+    }
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(nthreads) default(none) \
+    firstprivate(x, o, n, nthreads, counts, nc, napos, off, order, R_NaInt)
+#endif
+    for (int t = 0; t < nthreads; t++) {
+	unsigned int *c = counts + (size_t) t * nc;
+	int from = RADIX_BLOCK_FROM(n, nthreads, t),
+	    to = RADIX_BLOCK_TO(n, nthreads, t);
+	for (int i = from; i < to; i++)
+	    o[c[(x[i] == NA_INTEGER) ? napos : off + order * x[i]]++] = i + 1;
+    }
+    // nalast = 0 sets o to 0 where x is NA, as in icount
+    if (nalast == 0) {
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(nthreads) default(none) \
+    firstprivate(x, o, n, R_NaInt)
+#endif
+	for (int i = 0; i < n; i++)
+	    o[i] = (x[o[i] - 1] == NA_INTEGER) ? 0 : o[i];
+    }
+    free(counts);
+}
+
+/* One threaded MSD pass over the n keys of size 4 or 8 and the
+   matching o at radix, then the buckets as in iradix_r and dradix_r.
+   ktmp and otmp have room for n keys and n ints.  Returns FALSE if
+   memory ran out. */
+static Rboolean radix_pass(radix_state *s, unsigned char *keys, int *o,
+			   int n, int size, int radix, unsigned char *ktmp,
+			   int *otmp, int nthreads)
+{
+    unsigned int (*counts)[256] = calloc(nthreads, sizeof(*counts));
+    int start[257], task[256], ntask = 0, nextradix, base = s->gspos;
+    Rboolean failed = FALSE;
+    if (counts == NULL)
+	return FALSE;
+
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(nthreads) default(none) \
+    firstprivate(keys, n, size, radix, nthreads, counts)
+#endif
+    for (int t = 0; t < nthreads; t++) {
+	unsigned int *c = counts[t];
+	for (int i = RADIX_BLOCK_FROM(n, nthreads, t);
+	     i < RADIX_BLOCK_TO(n, nthreads, t); i++)
+	    c[RADIX_KEY(keys, i, size, radix)]++;
+    }
+    int pos = 0;
+    for (int b = 0; b < 256; b++) {
+	start[b] = pos;
+	for (int t = 0; t < nthreads; t++) {
+	    unsigned int c = counts[t][b];
+	    counts[t][b] = pos;
+	    pos += c;
+	}
+    }
+    start[256] = n;
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(nthreads) default(none) \
+    firstprivate(keys, o, n, size, radix, nthreads, counts, ktmp, otmp)
+#endif
+    for (int t = 0; t < nthreads; t++) {
+	unsigned int *c = counts[t];
+	int from = RADIX_BLOCK_FROM(n, nthreads, t),
+	    to = RADIX_BLOCK_TO(n, nthreads, t);
+	for (int i = from; i < to; i++) {
+	    int j = c[RADIX_KEY(keys, i, size, radix)]++;
+	    otmp[j] = o[i];
+	    memcpy(ktmp + (size_t) j * size, keys + (size_t) i * size, size);
+	}
+    }
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(nthreads) default(none) \
+    firstprivate(keys, o, n, size, nthreads, ktmp, otmp)
+#endif
+    for (int t = 0; t < nthreads; t++) {
+	int from = RADIX_BLOCK_FROM(n, nthreads, t),
+	    to = RADIX_BLOCK_TO(n, nthreads, t);
+	memcpy(o + from, otmp + from, (to - from) * sizeof(int));
+	memcpy(keys + (size_t) from * size, ktmp + (size_t) from * size,
+	       (size_t) (to - from) * size);
+    }
+    free(counts);
+
+    nextradix = radix - 1;
+    while (nextradix >= 0 && s->skip[nextradix]) nextradix--;
+    for (int b = 0; b < 256 && !failed; b++) {
+	int thisgrpn = start[b + 1] - start[b];
+	if (thisgrpn == 0)
+	    continue;
+	s->gspos = base + start[b];
+	if (thisgrpn == 1 || nextradix == -1)
+	    push(s, thisgrpn);
+	else if (thisgrpn >= R_RADIX_THREADS_MIN)
+	    failed = !radix_pass(s, keys + (size_t) start[b] * size,
+				 o + start[b], thisgrpn, size, nextradix,
+				 ktmp, otmp, nthreads);
+	else
+	    task[ntask++] = b;
+    }
+    radix_state *workers = s->workers;
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(nthreads) schedule(dynamic) \
+    default(none) firstprivate(keys, o, size, nextradix, base, workers, ntask) \
+    shared(start, task) reduction(|:failed)
+#endif
+    for (int k = 0; k < ntask; k++) {
+	int b = task[k], thisgrpn = start[b + 1] - start[b];
+	radix_state *w = workers;
+#ifdef _OPENMP
+	w += omp_get_thread_num();
+#endif
+	if (failed || !radix_reserve(w, thisgrpn)) {
+	    failed = TRUE;
+	    continue;
+	}
+	w->gspos = base + start[b];
+	if (size == 4)
+	    iradix_r(w, (int *) keys + start[b], o + start[b], thisgrpn,
+		     nextradix);
+	else
+	    dradix_r(w, keys + (size_t) start[b] * size, o + start[b],
+		     thisgrpn, nextradix);
+    }
+    s->gspos = base + n;
+    return !failed;
+}
+
+/* iradix (size 4, x int) or dradix (size 8, x double) on nthreads
+   threads */
+static void radix_par(radix_state *s, void *x, int *o, int n, int size,
+		      int nthreads)
+{
+    unsigned char *keys = malloc((size_t) n * size),
+	*ktmp = malloc((size_t) n * size);
+    int *otmp = malloc(n * sizeof(int)), radix;
+    unsigned int (*counts)[8][256] = calloc(nthreads, sizeof(*counts));
+    if (!keys || !ktmp || !otmp || !counts) {
+	free(keys); free(ktmp); free(otmp); free(counts);
+	Error("Failed to allocate working memory for %d keys in radix_par", n);
+    }
+
+    /* the keys, and the counts of all their bytes for skip */
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(nthreads) default(none) \
+    firstprivate(s, x, o, n, size, nthreads, keys, counts, colSize, R_NaInt)
+#endif
+    for (int t = 0; t < nthreads; t++) {
+	unsigned int (*c)[256] = counts[t];
+	int from = RADIX_BLOCK_FROM(n, nthreads, t),
+	    to = RADIX_BLOCK_TO(n, nthreads, t);
+	if (size == 4)
+	    for (int i = from; i < to; i++) {
+		int k = icheck(s, ((int *) x)[i]);
+		unsigned int thisx = (unsigned int) k - INT_MIN;
+		((int *) keys)[i] = k;
+		o[i] = i + 1;
+		c[0][thisx & 0xFF]++;
+		c[1][thisx >> 8 & 0xFF]++;
+		c[2][thisx >> 16 & 0xFF]++;
+		c[3][thisx >> 24 & 0xFF]++;
+	    }
+	else
+	    for (int i = from; i < to; i++) {
+		unsigned long long k = dtwiddle(s, x, i, s->order);
+		((unsigned long long *) keys)[i] = k;
+		o[i] = i + 1;
+		for (int radix = 0; radix < colSize; radix++)
+		    c[radix][((unsigned char *) &k)[RADIX_BYTE]]++;
+	    }
+    }
+    for (radix = 0; radix < size; radix++) {
+	s->skip[radix] = FALSE;
+	for (int b = 0; b < 256; b++) {
+	    unsigned int grpn = 0;
+	    for (int t = 0; t < nthreads; t++)
+		grpn += counts[t][radix][b];
+	    if (grpn == n)
+		s->skip[radix] = TRUE;
+	}
+    }
+    free(counts);
+
+    radix = size - 1;  // MSD
+    while (radix >= 0 && s->skip[radix]) radix--;
+    if (radix == -1) {
+	// All radix are skipped; one number repeated n times.
+	push(s, n);
+    } else {
+	nthreads = radix_workers(s, nthreads);
+	if (!radix_pass(s, keys, o, n, size, radix, ktmp, otmp, nthreads)) {
+	    free(keys); free(ktmp); free(otmp);
+	    Error("Failed to allocate working memory for the threads in radix_par");
+	}
+    }
+    free(keys); free(ktmp); free(otmp);
+
+    if (s->nalast == 0) { // nalast = 1, -1 are both taken care already.
+	if (size == 4) {
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(nthreads) default(none) \
+    firstprivate(x, o, n, R_NaInt)
+#endif
+	    for (int i = 0; i < n; i++)
+		o[i] = (((int *) x)[o[i] - 1] == NA_INTEGER) ? 0 : o[i];
+	} else {
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(nthreads) default(none) \
+    firstprivate(x, o, n)
+#endif
+	    for (int i = 0; i < n; i++)
+		o[i] = dnan(x, o[i] - 1) ? 0 : o[i];
+	}
+    }
+}
+
+static void isort(radix_state *s, int *x, int *o, int n)
 {
     if (n <= 2) {
 	// nalast = 0 and n == 2 (check bottom of this file for explanation)
-	if (nalast == 0 && n == 2) {
+	if (s->nalast == 0 && n == 2) {
 	    for (int i = 0; i < n; i++)
 		if (x[i] == NA_INTEGER)
 		    o[i] = 0;
                 else o[i] = i + 1;
-	    push(1); push(1);
+	    push(s, 1); push(s, 1);
 	    return;
 	} else Error("Internal error: isort received n=%d. isorted should have dealt with this (e.g. as a reverse sorted vector) already",n);
     }
-    if (n < N_SMALL && o[0] != -1 && nalast != 0) {
+    if (n < N_SMALL && o[0] != -1 && s->nalast != 0) {
         // see comment above in iradix_r on N_SMALL=200.
         /* if not o[0] then can't just populate with 1:n here, since x
            is changed by ref too (so would need to be copied). */
         /* pushes inside too. Changes x and o by reference, so not
            suitable in first arg when o hasn't been populated yet
            and x is an actual argument (hence check on o[0]). */
-        if (order != 1 || nalast != -1)
+        if (s->order != 1 || s->nalast != -1)
             // so that default case, i.e., order=1, nalast=FALSE will
             // not be affected (ex: `setkey`)
             for (int i = 0; i < n; i++)
-                x[i] = icheck(x[i]);
-        iinsert(x, o, n);
+                x[i] = icheck(s, x[i]);
+        iinsert(s, x, o, n);
     } else {
         /* Tighter range (e.g. copes better with a few abormally large
            values in some groups), but also, when setRange was once at
            arg level that caused an extra scan of (long) x
            first. 10,000 calls to setRange takes just 0.04s
            i.e. negligible. */
-        setRange(x, n);
-        if (range == NA_INTEGER)
+        setRange(s, x, n);
+        if (s->range == NA_INTEGER)
             Error("Internal error: isort passed all-NA. isorted should have caught this before this point");
-        int *target = (o[0] != -1) ? newo : o;
+        int *target = (o[0] != -1) ? s->newo : o;
+        int nthreads = radix_threads(s, n);
         // was range < 10000 for subgroups, but 1e5 for the first
         // arg, tried to generalise here.  1e4 rather than 1e5 here
         // because iterated was (thisgrpn < 200 || range > 20000) then
         // radix a short vector with large range can bite icount when
         // iterated (BLOCK 4 and 6)
-        if (range <= N_RANGE && range <= n) {
-            icount(x, target, n);
+        if (s->range <= N_RANGE && s->range <= n) {
+            if (nthreads > 1)
+                icount_par(s, x, target, n, nthreads);
+            else
+                icount(s, x, target, n);
         } else {
-            iradix(x, target, n);
+            if (nthreads > 1)
+                radix_par(s, x, target, n, sizeof(int), nthreads);
+            else
+                iradix(s, x, target, n);
         }
     }
 }
 
-static void dsort(double *x, int *o, int n)
+static void dsort(radix_state *s, double *x, int *o, int n)
 {
     if (n <= 2) {
-	if (nalast == 0 && n == 2) {
+	if (s->nalast == 0 && n == 2) {
 	    // don't have to twiddle here.. at least one will be NA
 	    // and 'n' WILL BE 2.
 	    for (int i = 0; i < n; i++)
-		if (is_nan(x, i))
+		if (dnan(x, i))
 		    o[i] = 0;
                 else o[i] = i + 1;
-	    push(1); push(1);
+	    push(s, 1); push(s, 1);
 	    return;
 	}
 	Error("Internal error: dsort received n=%d. dsorted should have dealt with this (e.g. as a reverse sorted vector) already",n);
     }
-    if (n < N_SMALL && o[0] != -1 && nalast != 0) {
+    if (n < N_SMALL && o[0] != -1 && s->nalast != 0) {
 	// see comment above in iradix_r re N_SMALL=200,  and isort for o[0]
 	for (int i = 0; i < n; i++)
-	    ((unsigned long long *)x)[i] = twiddle(x, i, order);
+	    ((unsigned long long *)x)[i] = dtwiddle(s, x, i, s->order);
 	// have to twiddle here anyways, can't speed up default case
 	// like in isort
-	dinsert((unsigned long long *)x, o, n);
+	dinsert(s, (unsigned long long *)x, o, n);
     } else {
-	dradix((unsigned char *) x, (o[0] != -1) ? newo : o, n);
+	int *target = (o[0] != -1) ? s->newo : o;
+	int nthreads = radix_threads(s, n);
+	if (nthreads > 1)
+	    radix_par(s, x, target, n, sizeof(double), nthreads);
+	else
+	    dradix(s, (unsigned char *) x, target, n);
+    }
+}
+
+/* Sort a group of thisgrpn elements of o by the next argument x, as
+   the loop over the groups in do_radixsort.  Returns FALSE if the
+   group's part of o changed. */
+static Rboolean grpsort(radix_state *s, SEXP x, int *osub, int thisgrpn,
+			int (*f)(), void (*g)())
+{
+    void *xd = DATAPTR(x), *xsub = s->xsub;
+    int tmp;
+    if (thisgrpn == 1) {
+	Rboolean sorted = TRUE;
+	if (s->nalast == 0) {
+	    // this edge case had to be taken care of
+	    // here.. (see the bottom of this file for
+	    // more explanation)
+	    switch (TYPEOF(x)) {
+	    case INTSXP:
+		if (INTEGER(x)[osub[0] - 1] == NA_INTEGER) {
+		    sorted = FALSE;
+		    osub[0] = 0;
+		}
+		break;
+	    case LGLSXP:
+		if (LOGICAL(x)[osub[0] - 1] == NA_LOGICAL) {
+		    sorted = FALSE;
+		    osub[0] = 0;
+		}
+		break;
+	    case REALSXP:
+		if (ISNAN(REAL(x)[osub[0] - 1])) {
+		    sorted = FALSE;
+		    osub[0] = 0;
+		}
+		break;
+	    case STRSXP:
+		if (STRING_ELT(x, osub[0] - 1) == NA_STRING) {
+		    sorted = FALSE;
+		    osub[0] = 0;
+		} break;
+	    default :
+		Error("Internal error: previous default should have caught unsupported type");
+	    }
+	}
+	push(s, 1);
+	return sorted;
+    }
+    // ** TO DO **: if isSorted, we can just point xsub
+    //        into x directly. If (*f)() returns 0,
+    //        though, will have to copy x at that point
+    //        When doing this, xsub could be allocated at
+    //        that point for the first time.
+    if (TYPEOF(x) == STRSXP)
+	for (int j = 0; j < thisgrpn; j++)
+	    ((SEXP *) xsub)[j] = ((SEXP *) xd)[osub[j] - 1];
+    else if (TYPEOF(x) == REALSXP)
+	for (int j = 0; j < thisgrpn; j++)
+	    ((double *) xsub)[j] = ((double *) xd)[osub[j] - 1];
+    else
+	for (int j = 0; j < thisgrpn; j++)
+	    ((int *) xsub)[j] = ((int *) xd)[osub[j] - 1];
+
+    // continue; // BASELINE short circuit timing
+    // point. Up to here is the cost of creating xsub.
+    // [i|d|c]sorted(); very low cost, sequential
+    tmp = (*f)(s, xsub, thisgrpn);
+    if (tmp) {
+	// *sorted will have already push()'d the groups
+	if (tmp == -1) {
+	    for (int k = 0; k < thisgrpn / 2; k++) {
+		// reverse the order in-place using no
+		// function call or working memory
+		// isorted only returns -1 for
+		// _strictly_ decreasing order,
+		// otherwise ties wouldn't be stable
+		tmp = osub[k];
+		osub[k] = osub[thisgrpn - 1 - k];
+		osub[thisgrpn - 1 - k] = tmp;
+	    }
+	    return FALSE;
+	} else if (s->nalast == 0 && tmp == -2) {
+	    // all NAs, replace osub[.] with 0s.
+	    for (int k = 0; k < thisgrpn; k++) osub[k] = 0;
+	    return FALSE;
+	}
+	return TRUE;
+    }
+    // nalast=NA will result in newo[0] = 0. So had to change to -1.
+    s->newo[0] = -1;
+    // may update osub directly, or if not will put the
+    // result in newo
+    (*g)(s, xsub, osub, thisgrpn);
+
+    if (s->newo[0] != -1) {
+	if (s->nalast != 0)
+	    for (int j = 0; j < thisgrpn; j++)
+		// reuse xsub to reorder osub
+		((int *) xsub)[j] = osub[s->newo[j] - 1];
+	else
+	    for (int j = 0; j < thisgrpn; j++)
+		// final nalast case to handle!
+		((int *) xsub)[j] = (s->newo[j] == 0) ? 0 :
+		    osub[s->newo[j] - 1];
+	memcpy(osub, xsub, thisgrpn * sizeof(int));
     }
+    return FALSE;
+}
+
+/* The groups of the n elements of o, as left on the stack by the
+   previous arguments, sorted by x (not a character vector) on nthreads
+   threads: those of R_RADIX_THREADS_MIN or more elements in turn by
+   threaded passes, and the others in parallel by the workers.
+   Returns FALSE if o changed. */
+static Rboolean grpsort_par(radix_state *s, SEXP x, int *o, int n,
+			    int (*f)(), void (*g)(), int nthreads)
+{
+    int ngrp = s->gsngrp[1 - s->flip], *gs = s->gs[1 - s->flip];
+    int *start = (int *) malloc(ngrp * sizeof(int));
+    Rboolean sorted = TRUE, failed = FALSE;
+    if (start == NULL)
+	Error("Failed to allocate working memory for %d groups", ngrp);
+    for (int grp = 0, i = 0; grp < ngrp; i += gs[grp++])
+	start[grp] = i;
+    gsposition(s, n);
+
+    for (int grp = 0; grp < ngrp; grp++)
+	if (gs[grp] >= R_RADIX_THREADS_MIN) {
+	    s->gspos = start[grp];
+	    if (!grpsort(s, x, o + start[grp], gs[grp], f, g))
+		sorted = FALSE;
+	}
+    nthreads = radix_workers(s, nthreads);
+    radix_state *workers = s->workers;
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(nthreads) schedule(dynamic, 64) \
+    default(none) firstprivate(x, o, f, g, ngrp, gs, start, workers) \
+    reduction(&:sorted) reduction(|:failed)
+#endif
+    for (int grp = 0; grp < ngrp; grp++) {
+	int thisgrpn = gs[grp];
+	radix_state *w = workers;
+#ifdef _OPENMP
+	w += omp_get_thread_num();
+#endif
+	if (thisgrpn >= R_RADIX_THREADS_MIN)
+	    continue;
+	if (failed || !radix_reserve(w, thisgrpn)) {
+	    failed = TRUE;
+	    continue;
+	}
+	w->gspos = start[grp];
+	if (!grpsort(w, x, o + start[grp], thisgrpn, f, g))
+	    sorted = FALSE;
+    }
+    free(start);
+    if (failed)
+	Error("Failed to allocate working memory for the threads in grpsort_par");
+    gscollect(s, n);
+    return sorted;
 }
 
 SEXP attribute_hidden do_radixsort(SEXP call, SEXP op, SEXP args, SEXP rho)
 {
-    int n = -1, narg = 0, ngrp, tmp, *osub, thisgrpn;
+    int n = -1, narg = 0, ngrp, tmp, nthreads;
     R_xlen_t nl = n;
     Rboolean isSorted = TRUE, retGrp;
     void *xd;
     int *o = NULL;
+    radix_state state, *s = &state;
 
     /* ML: FIXME: Here are just two of the dangerous assumptions here */
     if (sizeof(int) != 4) {
@@ -1577,11 +2329,14 @@ SEXP attribute_hidden do_radixsort(SEXP call, SEXP op, SEXP args, SEXP rho)
         error("radix sort assumes sizeof(double) == 8");
     }
 
+    memset(s, 0, sizeof(radix_state));
+    s->maxlen = 1;  // Minimum needed to count "" and NA
+
     /* (ML) Controls the precision of numeric vector sorting; may want
        to make this a parameter */
-    setNumericRounding(dround);
+    setNumericRounding(s, dround);
 
-    nalast = (asLogical(CAR(args)) == NA_LOGICAL) ? 0 :
+    s->nalast = (asLogical(CAR(args)) == NA_LOGICAL) ? 0 :
 	(asLogical(CAR(args)) == TRUE) ? 1 : -1; // 1=TRUE, -1=FALSE, 0=NA
     args = CDR(args);
     SEXP decreasing = CAR(args);
@@ -1595,7 +2350,9 @@ SEXP attribute_hidden do_radixsort(SEXP call, SEXP op, SEXP args, SEXP rho)
        abuses the CHARSXP table to group strings without hashing
        them. Only makes sense when retGrp=TRUE.
     */
-    sortStr = asLogical(CAR(args));
+    s->sortStr = asLogical(CAR(args));
+    /* 2L to sort strings as Scollate() does, rather than by their bytes. */
+    s->collate = s->sortStr == TRUE && asInteger(CAR(args)) == 2;
     args = CDR(args);
 
     if (args == R_NilValue)
@@ -1616,7 +2373,7 @@ SEXP attribute_hidden do_radixsort(SEXP call, SEXP op, SEXP args, SEXP rho)
 	if (LOGICAL(decreasing)[i] == NA_LOGICAL)
 	    error(_("'decreasing' elements must be TRUE or FALSE"));
     }
-    order = asLogical(decreasing) ? -1 : 1;
+    s->order = asLogical(decreasing) ? -1 : 1;
 
     SEXP x = CAR(args);
     args = CDR(args);
@@ -1630,7 +2387,7 @@ SEXP attribute_hidden do_radixsort(SEXP call, SEXP op, SEXP args, SEXP rho)
     // upper limit for stack size (all size 1 groups). We'll detect
     // and avoid that limit, but if just one non-1 group (say 2), that
     // can't be avoided.
-    gsmaxalloc = n;
+    s->gsmaxalloc = n;
 
     // once for the result, needs to be length n.
 
@@ -1644,26 +2401,33 @@ SEXP attribute_hidden do_radixsort(SEXP call, SEXP op, SEXP args, SEXP rho)
     o[0] = -1;
     xd = DATAPTR(x);
 
-    stackgrps = narg > 1 || retGrp;
+    s->stackgrps = narg > 1 || retGrp;
 
-    if (TYPEOF(x) == STRSXP) {
+    if (s->collate) {
+	ckeys_check(x);
+	for (SEXP ap = args; ap != R_NilValue; ap = CDR(ap))
+	    ckeys_check(CAR(ap));
+    } else if (TYPEOF(x) == STRSXP) {
         checkEncodings(x);
     }
     
-    savetl_init();   // from now on use Error not error.
+    savetl_init(s);   // from now on use Error not error.
+
+    // the groups of a long numeric first arg are found by position
+    nthreads = radix_nthreads(n);
+    if (nthreads > 1 && TYPEOF(x) != STRSXP)
+	gsposition(s, n);
 
     switch (TYPEOF(x)) {
     case INTSXP:
     case LGLSXP:
-	tmp = isorted(xd, n);
+	tmp = isorted(s, xd, n);
 	break;
     case REALSXP :
-	twiddle = &dtwiddle;
-	is_nan  = &dnan;
-	tmp = dsorted(xd, n);
+	tmp = dsorted(s, xd, n);
 	break;
     case STRSXP :
-	tmp = csorted(xd, n);
+	tmp = csorted(s, xd, n);
 	break;
     default :
         Error("First arg is type '%s', not yet supported",
@@ -1682,7 +2446,7 @@ SEXP attribute_hidden do_radixsort(SEXP call, SEXP op, SEXP args, SEXP rho)
 	    isSorted = FALSE;
 	    for (int i = 0; i < n; i++)
 		o[i] = n - i;
-	} else if (nalast == 0 && tmp == -2) {
+	} else if (s->nalast == 0 && tmp == -2) {
 	    // happens only when nalast=NA/0. Means all NAs, replace
 	    // with 0's therefore!
 	    isSorted = FALSE;
@@ -1694,53 +2458,54 @@ SEXP attribute_hidden do_radixsort(SEXP call, SEXP op, SEXP args, SEXP rho)
 	switch (TYPEOF(x)) {
 	case INTSXP:
 	case LGLSXP:
-	    isort(xd, o, n);
+	    isort(s, xd, o, n);
 	    break;
 	case REALSXP :
-	    dsort(xd, o, n);
+	    dsort(s, xd, o, n);
 	    break;
 	case STRSXP :
-	    if (sortStr) {
-		csort_pre(xd, n);
-		alloc_csort_otmp(n);
-		csort(xd, o, n);
+	    if (s->sortStr) {
+		csort_pre(s, xd, n);
+		alloc_csort_otmp(s, n);
+		csort(s, xd, o, n);
 	    } else
-		cgroup(xd, o, n);
+		cgroup(s, xd, o, n);
 	    break;
 	default:
 	    Error
 		("Internal error: previous default should have caught unsupported type");
 	}
     }
+    gscollect(s, n);
     
-    int maxgrpn = gsmax[flip];   // biggest group in the first arg
-    void *xsub = NULL;           // local
+    int maxgrpn = s->gsmax[s->flip];   // biggest group in the first arg
     int (*f) ();
     void (*g) ();
     
-    if (narg > 1 && gsngrp[flip] < n) {
+    if (narg > 1 && s->gsngrp[s->flip] < n) {
         // double is the largest type, 8
-        xsub = (void *) malloc(maxgrpn * sizeof(double));
-        if (xsub == NULL)
+        s->xsub = (void *) malloc(maxgrpn * sizeof(double));
+        if (s->xsub == NULL)
             Error("Couldn't allocate xsub in do_radixsort, requested %d * %d bytes.",
                   maxgrpn, sizeof(double));
-        // global variable, used by isort, dsort, sort and cgroup
-        newo = (int *) malloc(maxgrpn * sizeof(int));
-        if (newo == NULL)
+        // used by isort, dsort, sort and cgroup
+        s->newo = (int *) malloc(maxgrpn * sizeof(int));
+        if (s->newo == NULL)
             Error("Couldn't allocate newo in do_radixsort, requested %d * %d bytes.",
                   maxgrpn, sizeof(int));
+        s->xsuballoc = maxgrpn;
     }
 
     for (int col = 2; col <= narg; col++) {
 	x = CAR(args);
 	args = CDR(args);
 	xd = DATAPTR(x);
-	ngrp = gsngrp[flip];
-	if (ngrp == n && nalast != 0)
+	ngrp = s->gsngrp[s->flip];
+	if (ngrp == n && s->nalast != 0)
 	    break;
-	flipflop();
-	stackgrps = col != narg || retGrp;
-	order = LOGICAL(decreasing)[col - 1] ? -1 : 1;
+	flipflop(s);
+	s->stackgrps = col != narg || retGrp;
+	s->order = LOGICAL(decreasing)[col - 1] ? -1 : 1;
 	switch (TYPEOF(x)) {
 	case INTSXP:
 	case LGLSXP:
@@ -1748,16 +2513,14 @@ SEXP attribute_hidden do_radixsort(SEXP call, SEXP op, SEXP args, SEXP rho)
 	    g = &isort;
 	    break;
 	case REALSXP:
-	    twiddle = &dtwiddle;
-	    is_nan = &dnan;
 	    f = &dsorted;
 	    g = &dsort;
 	    break;
 	case STRSXP:
 	    f = &csorted;
-	    if (sortStr) {
-		csort_pre(xd, n);
-		alloc_csort_otmp(gsmax[1 - flip]);
+	    if (s->sortStr) {
+		csort_pre(s, xd, n);
+		alloc_csort_otmp(s, s->gsmax[1 - s->flip]);
 		g = &csort;
 	    }
 	    // no increasing/decreasing order required if sortStr = FALSE,
@@ -1769,136 +2532,43 @@ SEXP attribute_hidden do_radixsort(SEXP call, SEXP op, SEXP args, SEXP rho)
 	    Error("Arg %d is type '%s', not yet supported",
 		  col, type2char(TYPEOF(x)));
 	}
+	if (nthreads > 1 && TYPEOF(x) != STRSXP && ngrp > 1) {
+	    if (!grpsort_par(s, x, o, n, f, g, nthreads))
+		isSorted = FALSE;
+	    continue;
+	}
 	int i = 0;
 	for (int grp = 0; grp < ngrp; grp++) {
-	    thisgrpn = gs[1 - flip][grp];
-	    if (thisgrpn == 1) {
-		if (nalast == 0) {
-		    // this edge case had to be taken care of
-		    // here.. (see the bottom of this file for
-		    // more explanation)
-		    switch (TYPEOF(x)) {
-		    case INTSXP:
-			if (INTEGER(x)[o[i] - 1] == NA_INTEGER) {
-			    isSorted = FALSE;
-			    o[i] = 0;
-			}
-			break;
-		    case LGLSXP:
-			if (LOGICAL(x)[o[i] - 1] == NA_LOGICAL) {
-			    isSorted = FALSE;
-			    o[i] = 0;
-			}
-			break;
-		    case REALSXP:
-			if (ISNAN(REAL(x)[o[i] - 1])) {
-			    isSorted = FALSE;
-			    o[i] = 0;
-			}
-			break;
-		    case STRSXP:
-			if (STRING_ELT(x, o[i] - 1) == NA_STRING) {
-			    isSorted = FALSE;
-			    o[i] = 0;
-                        } break;
-                    default :
-                        Error("Internal error: previous default should have caught unsupported type");
-                    }
-                }
-                i++;
-                push(1);
-                continue;
-            }
-            osub = o+i;
-            // ** TO DO **: if isSorted, we can just point xsub
-            //        into x directly. If (*f)() returns 0,
-            //        though, will have to copy x at that point
-            //        When doing this, xsub could be allocated at
-            //        that point for the first time.
-            if (TYPEOF(x) == STRSXP)
-                for (int j = 0; j < thisgrpn; j++)
-                    ((SEXP *) xsub)[j] = ((SEXP *) xd)[o[i++] - 1];
-            else if (TYPEOF(x) == REALSXP)
-                for (int j = 0; j < thisgrpn; j++)
-                    ((double *) xsub)[j] = ((double *) xd)[o[i++] - 1];
-            else
-                for (int j = 0; j < thisgrpn; j++)
-                    ((int *) xsub)[j] = ((int *) xd)[o[i++] - 1];
-                
-            // continue; // BASELINE short circuit timing
-            // point. Up to here is the cost of creating xsub.
-            // [i|d|c]sorted(); very low cost, sequential
-            tmp = (*f)(xsub, thisgrpn);
-            if (tmp) {
-                // *sorted will have already push()'d the groups
-                if (tmp == -1) {
-		    isSorted = FALSE;
-		    for (int k = 0; k < thisgrpn / 2; k++) {
-			// reverse the order in-place using no
-			// function call or working memory
-			// isorted only returns -1 for
-			// _strictly_ decreasing order,
-			// otherwise ties wouldn't be stable
-			tmp = osub[k];
-			osub[k] = osub[thisgrpn - 1 - k];
-			osub[thisgrpn - 1 - k] = tmp;
-		    }
-		} else if (nalast == 0 && tmp == -2) {
-		    // all NAs, replace osub[.] with 0s.
-		    isSorted = FALSE;
-		    for (int k = 0; k < thisgrpn; k++) osub[k] = 0;
-		}
-		continue;
-	    }
-	    isSorted = FALSE;
-	    // nalast=NA will result in newo[0] = 0. So had to change to -1.
-	    newo[0] = -1;
-	    // may update osub directly, or if not will put the
-	    // result in global newo
-	    (*g)(xsub, osub, thisgrpn);
-
-	    if (newo[0] != -1) {
-		if (nalast != 0)
-		    for (int j = 0; j < thisgrpn; j++)
-			// reuse xsub to reorder osub
-			((int *) xsub)[j] = osub[newo[j] - 1];
-		else
-		    for (int j = 0; j < thisgrpn; j++)
-			// final nalast case to handle!
-			((int *) xsub)[j] = (newo[j] == 0) ? 0 :
-			    osub[newo[j] - 1];
-		memcpy(osub, xsub, thisgrpn * sizeof(int));
-	    }
+	    int thisgrpn = s->gs[1 - s->flip][grp];
+	    if (!grpsort(s, x, o + i, thisgrpn, f, g))
+		isSorted = FALSE;
+	    i += thisgrpn;
 	}
     }
 
-    if (!sortStr && ustr_n != 0)
+    if (!s->sortStr && s->ustr_n != 0)
         Error("Internal error: at the end of do_radixsort sortStr == FALSE but ustr_n !=0 [%d]",
-              ustr_n);
-    for(int i = 0; i < ustr_n; i++)
-        SET_TRUELENGTH(ustr[i], 0);
-    maxlen = 1;  // reset global. Minimum needed to count "" and NA
-    ustr_n = 0;
-    savetl_end();
-    free(ustr);
-    ustr = NULL;
-    ustr_alloc = 0;
+              s->ustr_n);
+    for(int i = 0; i < s->ustr_n; i++)
+        SET_TRUELENGTH(s->ustr[i], 0);
+    s->ustr_n = 0;
+    savetl_end(s);
 
     if (retGrp) {
         int maxgrpn = NA_INTEGER;
-        ngrp = gsngrp[flip];
+        ngrp = s->gsngrp[s->flip];
         setAttrib(ans, install("ends"), x = allocVector(INTSXP, ngrp));
         if (ngrp > 0) {
-            INTEGER(x)[0] = gs[flip][0];
+            INTEGER(x)[0] = s->gs[s->flip][0];
             for (int i = 1; i < ngrp; i++)
-                INTEGER(x)[i] = INTEGER(x)[i - 1] + gs[flip][i];
-            maxgrpn = gsmax[flip];
+                INTEGER(x)[i] = INTEGER(x)[i - 1] + s->gs[s->flip][i];
+            maxgrpn = s->gsmax[s->flip];
         }
         setAttrib(ans, install("maxgrpn"), ScalarInteger(maxgrpn));
         setAttrib(ans, R_ClassSymbol, mkString("grouping"));
     }
 
-    Rboolean dropZeros = !retGrp && !isSorted && nalast == 0;
+    Rboolean dropZeros = !retGrp && !isSorted && s->nalast == 0;
     if (dropZeros) {
         int zeros = 0;
         for (int i = 0; i < n; i++) {
@@ -1916,16 +2586,7 @@ SEXP attribute_hidden do_radixsort(SEXP call, SEXP op, SEXP args, SEXP rho)
         }
     }
     
-    gsfree();
-    free(radix_xsub);          radix_xsub=NULL;    radix_xsuballoc=0;
-    free(xsub); free(newo);    xsub=newo=NULL;
-    free(xtmp);                xtmp=NULL;          xtmp_alloc=0;
-    free(otmp);                otmp=NULL;          otmp_alloc=0;
-    free(csort_otmp);          csort_otmp=NULL;    csort_otmp_alloc=0;
-
-    free(cradix_counts);       cradix_counts=NULL; cradix_counts_alloc=0;
-    free(cradix_xtmp);         cradix_xtmp=NULL;   cradix_xtmp_alloc=0;
-    // TO DO: use xtmp already got
+    radix_free(s);
 
     UNPROTECT(1);
     return ans;
@@ -1,7 +1,7 @@
 /*
  *  R : A Computer Language for Statistical Data Analysis
  *  Copyright (C) 1995, 1996  Robert Gentleman and Ross Ihaka
- *  Copyright (C) 1997--2015  The R Core Team
+ *  Copyright (C) 1997--2017  The R Core Team
  *  Copyright (C) 2003--2008  The R Foundation
  *
  *  This program is free software; you can redistribute it and/or modify
@@ -30,6 +30,11 @@
 #include <R_ext/RS.h>		/* for Calloc() */
 #include <Rmath.h>		/* for rxxx functions */
 #include <errno.h>
+#include <stdint.h>
+#ifdef _OPENMP
+# include <omp.h>
+# include <R_ext/MathThreads.h>
+#endif
 
 /* Code down to do_random3 (inclusive) can be removed once the byte
   compiler knows how to optimize to .External rather than .Internal */
@@ -341,29 +346,16 @@ static void ProbSampleReplace(int n, double *p, int *perm, int nans, int *ans)
    Ripley (1987).
  */
 
-#define SMALL 10000
-static void
-walker_ProbSampleReplace(int n, double *p, int *a, int nans, int *ans)
+/* Create the alias tables a[] and q[], using HL[n] as workspace.
+   The idea is that for HL[0] ... L-1 label the entries with q < 1
+   and L ... H[n-1] label those >= 1.
+   By rounding error we could have q[i] < 1. or > 1. for all entries.
+ */
+static void walker_table(int n, double *p, int *a, double *q, int *HL)
 {
-    double *q, rU;
     int i, j, k;
-    int *HL, *H, *L;
+    int *H, *L;
 
-    /* Create the alias tables.
-       The idea is that for HL[0] ... L-1 label the entries with q < 1
-       and L ... H[n-1] label those >= 1.
-       By rounding error we could have q[i] < 1. or > 1. for all entries.
-     */
-    if(n <= SMALL) {
-	R_CheckStack2(n *(sizeof(int) + sizeof(double)));
-	/* might do this repeatedly, so speed matters */
-	HL = (int *) alloca(n * sizeof(int));
-	q = (double *) alloca(n * sizeof(double));
-    } else {
-	/* Slow enough anyway not to risk overflow */
-	HL = Calloc(n, int);
-	q = Calloc(n, double);
-    }
     H = HL - 1; L = HL + n;
     for (i = 0; i < n; i++) {
 	q[i] = p[i] * n;
@@ -380,13 +372,39 @@ walker_ProbSampleReplace(int n, double *p, int *a, int nans, int *ans)
 	}
     }
     for (i = 0; i < n; i++) q[i] += i;
+}
+
+static void walker_sample(int n, int *a, double *q, int nans, int *ans)
+{
+    double rU;
+    int i, k;
 
-    /* generate sample */
     for (i = 0; i < nans; i++) {
 	rU = unif_rand() * n;
 	k = (int) rU;
 	ans[i] = (rU < q[k]) ? k+1 : a[k]+1;
     }
+}
+
+#define SMALL 10000
+static void
+walker_ProbSampleReplace(int n, double *p, int *a, int nans, int *ans)
+{
+    double *q;
+    int *HL;
+
+    if(n <= SMALL) {
+	R_CheckStack2(n *(sizeof(int) + sizeof(double)));
+	/* might do this repeatedly, so speed matters */
+	HL = (int *) alloca(n * sizeof(int));
+	q = (double *) alloca(n * sizeof(double));
+    } else {
+	/* Slow enough anyway not to risk overflow */
+	HL = Calloc(n, int);
+	q = Calloc(n, double);
+    }
+    walker_table(n, p, a, q, HL);
+    walker_sample(n, a, q, nans, ans);
     if(n > SMALL) {
 	Free(HL);
 	Free(q);
@@ -396,6 +414,49 @@ walker_ProbSampleReplace(int n, double *p, int *a, int nans, int *ans)
 
 /* Unequal probability sampling; without-replacement case */
 
+/* For large n, the same draws with the probabilities p[] (in descending
+   order) kept in a Fenwick tree, so that finding the item at which the
+   cumulative mass exceeds rT, and removing it, take O(log n) rather
+   than O(n) steps.  The masses are summed in a different order, so a
+   draw can differ from the linear search only by rounding error. */
+#define SMALL_NOREPLACE 200
+static void ProbSampleNoReplaceTree(int n, double *p, int *perm,
+				    int nans, int *ans)
+{
+    double rT, totalmass = 1, *tree = (double *) R_alloc(n + 1, sizeof(double));
+    int i, j, k, top;
+
+    /* tree[k] is the sum of p[k - (k & -k)] ... p[k-1] */
+    tree[0] = 0;
+    for (k = 1; k <= n; k++) tree[k] = p[k-1];
+    for (k = 1; k <= n; k++) {
+	j = k + (k & -k);
+	if (j <= n) tree[j] += tree[k];
+    }
+    for (top = 1; 2 * top <= n; top *= 2) ;
+
+    for (i = 0; i < nans; i++) {
+	rT = totalmass * unif_rand();
+	/* the first j (from 0) with p[0] + ... + p[j] >= rT */
+	for (j = 0, k = top; k > 0; k /= 2)
+	    if (j + k <= n && tree[j + k] < rT) {
+		j += k;
+		rT -= tree[j];
+	    }
+	/* as the linear search, take the last item remaining if rounding
+	   error leaves rT beyond the total, and an item remaining */
+	if (j >= n) j = n - 1;
+	while (j >= 0 && perm[j] == 0) j--;
+	if (j < 0)
+	    for (j = 0; perm[j] == 0; j++) ;
+	ans[i] = perm[j];
+	perm[j] = 0;
+	totalmass -= p[j];
+	for (k = j + 1; k <= n; k += k & -k) tree[k] -= p[j];
+	p[j] = 0;
+    }
+}
+
 static void ProbSampleNoReplace(int n, double *p, int *perm,
 				int nans, int *ans)
 {
@@ -410,6 +471,11 @@ static void ProbSampleNoReplace(int n, double *p, int *perm,
     /* Order element identities in parallel */
     revsort(p, perm, n);
 
+    if (n > SMALL_NOREPLACE && nans > 1) {
+	ProbSampleNoReplaceTree(n, p, perm, nans, ans);
+	return;
+    }
+
     /* Compute the sample */
     totalmass = 1;
     for (i = 0, n1 = n-1; i < nans; i++, n1--) {
@@ -455,6 +521,124 @@ static R_INLINE double ru()
     return (floor(U*unif_rand()) + unif_rand())/U;
 }
 
+/* Random permutations in parallel, with options(rng.parallel = TRUE)
+   and the "L'Ecuyer-CMRG" generator, by MergeShuffle (Bacher, Bodini,
+   Hollender and Lumbroso, 2015): blocks of SHUFFLE_BLOCK values are
+   shuffled by Fisher-Yates, and then adjacent shuffled runs merged
+   pairwise by random riffles, each from a stream of its own (see
+   R_RNG_substreams in RNG.c).  So the result depends on the seed but
+   not on the number of threads. */
+
+#define SHUFFLE_BLOCK 65536
+
+#define m1    4294967087
+#define m2    4294944443
+#define normc 2.328306549295727688e-10
+#define a12   (int_least64_t)1403580
+#define a13n  (int_least64_t)810728
+#define a21   (int_least64_t)527612
+#define a23n  (int_least64_t)1370589
+
+/* unif_rand() for L'Ecuyer-CMRG on the state s */
+static R_INLINE double unif_s(int_least64_t *s)
+{
+    int_least64_t p1, p2;
+
+    p1 = (a12 * s[1] - a13n * s[0]) % m1;
+    if (p1 < 0) p1 += m1;
+    s[0] = s[1]; s[1] = s[2]; s[2] = p1;
+
+    p2 = (a21 * s[5] - a23n * s[3]) % m2;
+    if (p2 < 0) p2 += m2;
+    s[3] = s[4]; s[4] = s[5]; s[5] = p2;
+
+    return ((p1 > p2) ? (p1 - p2) : (p1 - p2 + m1)) * normc;
+}
+
+static R_INLINE void seed_s(int_least64_t *s, const int *seeds)
+{
+    for (int j = 0; j < 6; j++) s[j] = (unsigned int) seeds[j];
+}
+
+/* Merge the uniformly shuffled x[start:(mid-1)] and x[mid:(end-1)] into
+   a uniformly shuffled x[start:(end-1)] */
+static void merge_shuffle(int *x, int start, int mid, int end,
+			  int_least64_t *s)
+{
+    int i = start, j = mid, t;
+
+    for (;; i++) {
+	if (unif_s(s) < 0.5) {
+	    if (j == end) break;
+	    t = x[i]; x[i] = x[j]; x[j] = t;
+	    j++;
+	} else if (i == j) break;
+    }
+    for (; i < end; i++) {
+	int m = start + (int)((double)(i - start + 1) * unif_s(s));
+	t = x[i]; x[i] = x[m]; x[m] = t;
+    }
+}
+
+/* Fill y[0:(k-1)] with the first k values of a random permutation of
+   1:n if generating in parallel: otherwise returns FALSE. */
+static Rboolean shuffle_parallel(int n, int k, int *y)
+{
+    if (n <= SHUFFLE_BLOCK ||
+	asLogical(GetOption1(install("rng.parallel"))) != TRUE)
+	return FALSE;
+    int nblock = (int)(((R_xlen_t) n + SHUFFLE_BLOCK - 1) / SHUFFLE_BLOCK);
+    /* a stream for each block and each of the nblock - 1 merges */
+    int *seeds = (int *) R_alloc(6 * (2 * (size_t) nblock - 1), sizeof(int));
+    if (!R_RNG_substreams(2 * (R_xlen_t) nblock - 1, seeds, FALSE))
+	return FALSE;
+    int *x = (k == n) ? y : (int *) R_alloc(n, sizeof(int));
+#ifdef _OPENMP
+    int nthreads = 1;
+    if (R_num_math_threads > 1)
+	nthreads = (nblock < R_num_math_threads) ? nblock : R_num_math_threads;
+# pragma omp parallel for num_threads(nthreads) default(none) \
+    firstprivate(n, x, nblock, seeds)
+#endif
+    for (int b = 0; b < nblock; b++) {
+	int_least64_t s[6];
+	int start = b * SHUFFLE_BLOCK,
+	    end = (n - start < SHUFFLE_BLOCK) ? n : start + SHUFFLE_BLOCK;
+	seed_s(s, seeds + 6 * b);
+	for (int i = start; i < end; i++) x[i] = i + 1;
+	for (int i = end - 1; i > start; i--) {
+	    int j = start + (int)((double)(i - start + 1) * unif_s(s)), t;
+	    t = x[i]; x[i] = x[j]; x[j] = t;
+	}
+    }
+    /* merges of runs of w blocks, the pairs of each level in parallel */
+    int next = nblock;
+    for (int w = 1; w < nblock; w *= 2) {
+	int npair = (nblock + 2 * w - 1) / (2 * w);
+	int first = next;
+	next += (nblock - w + 2 * w - 1) / (2 * w); /* pairs with a right run */
+#ifdef _OPENMP
+# pragma omp parallel for num_threads(nthreads) default(none) \
+    firstprivate(n, x, nblock, seeds, w, npair, first)
+#endif
+	for (int k = 0; k < npair; k++) {
+	    int b = 2 * w * k;
+	    if (b + w >= nblock) continue; /* no right run */
+	    int_least64_t s[6];
+	    R_xlen_t mid = (R_xlen_t)(b + w) * SHUFFLE_BLOCK,
+		end = (R_xlen_t)(b + 2 * w) * SHUFFLE_BLOCK;
+	    seed_s(s, seeds + 6 * (first + k));
+	    merge_shuffle(x, b * SHUFFLE_BLOCK, (int) mid,
+			  (end < n) ? (int) end : n, s);
+	}
+    }
+    if (x != y)
+	for (int i = 0; i < k; i++) y[i] = x[i];
+    return TRUE;
+}
+
+#define SAMPLE_BLOCK 1024
+
 /* do_sample - probability sampling with/without replacement.
    .Internal(sample(n, size, replace, prob))
 */
@@ -482,6 +666,22 @@ SEXP attribute_hidden do_sample(SEXP call, SEXP op, SEXP args, SEXP rho)
 	if (!replace && k > n)
 	    error(_("cannot take a sample larger than the population when 'replace = FALSE'"));
 	PROTECT(y = allocVector(INTSXP, k));
+	if (isNewList(prob)) { /* from aliasTable() */
+	    SEXP q, a;
+	    if (!replace)
+		error(_("an alias table can only be used with 'replace = TRUE'"));
+	    if (length(prob) != 2 ||
+		TYPEOF(q = VECTOR_ELT(prob, 0)) != REALSXP ||
+		TYPEOF(a = VECTOR_ELT(prob, 1)) != INTSXP ||
+		XLENGTH(q) != XLENGTH(a))
+		error(_("invalid alias table"));
+	    if (XLENGTH(q) != n)
+		error(_("incorrect number of probabilities"));
+	    walker_sample(n, INTEGER(a), REAL(q), k, INTEGER(y));
+	    PutRNGstate();
+	    UNPROTECT(1);
+	    return y;
+	}
 	prob = coerceVector(prob, REALSXP);
 	if (MAYBE_REFERENCED(prob)) prob = duplicate(prob);
 	PROTECT(prob);
@@ -533,14 +733,25 @@ SEXP attribute_hidden do_sample(SEXP call, SEXP op, SEXP args, SEXP rho)
 	    int n = (int) dn;
 	    PROTECT(y = allocVector(INTSXP, k));
 	    int *iy = INTEGER(y);
+	    /* one uniform per value in either case, taken from
+	       unif_rand_n() a block at a time */
+	    double u[SAMPLE_BLOCK];
 	    /* avoid allocation for a single sample */
 	    if (replace || k < 2) {
-		for (int i = 0; i < k; i++) iy[i] = (int)(dn * unif_rand() + 1);
-	    } else {
+		for (int i = 0; i < k; i += SAMPLE_BLOCK) {
+		    int m = (k - i < SAMPLE_BLOCK) ? (int) k - i : SAMPLE_BLOCK;
+		    unif_rand_n(u, m);
+		    for (int j = 0; j < m; j++) iy[i + j] = (int)(dn * u[j] + 1);
+		}
+	    } else if (!(2 * (R_xlen_t) k >= n &&
+			 shuffle_parallel(n, (int) k, iy))) {
 		int *x = (int *)R_alloc(n, sizeof(int));
 		for (int i = 0; i < n; i++) x[i] = i;
 		for (int i = 0; i < k; i++) {
-		    int j = (int)(n * unif_rand());
+		    if (i % SAMPLE_BLOCK == 0)
+			unif_rand_n(u, (k - i < SAMPLE_BLOCK) ? (int) k - i :
+				    SAMPLE_BLOCK);
+		    int j = (int)(n * u[i % SAMPLE_BLOCK]);
 		    iy[i] = x[j] + 1;
 		    x[j] = x[--n];
 		}
@@ -551,3 +762,28 @@ SEXP attribute_hidden do_sample(SEXP call, SEXP op, SEXP args, SEXP rho)
     UNPROTECT(1);
     return y;
 }
+
+/* .Internal(aliasTable(prob)): the tables of Walker's alias method for
+   sampling with replacement with probabilities prob, for repeated use
+   by sample() */
+SEXP attribute_hidden do_aliastable(SEXP call, SEXP op, SEXP args, SEXP rho)
+{
+    checkArity(op, args);
+    SEXP prob = coerceVector(CAR(args), REALSXP);
+    if (MAYBE_REFERENCED(prob)) prob = duplicate(prob);
+    PROTECT(prob);
+    if (XLENGTH(prob) > INT_MAX)
+	error(_("invalid '%s' argument"), "prob");
+    int n = LENGTH(prob);
+    FixupProb(REAL(prob), n, 0, TRUE);
+    SEXP ans = PROTECT(allocVector(VECSXP, 2)),
+	q = allocVector(REALSXP, n), a = allocVector(INTSXP, n);
+    SET_VECTOR_ELT(ans, 0, q);
+    SET_VECTOR_ELT(ans, 1, a);
+    int *ia = INTEGER(a);
+    for (int i = 0; i < n; i++) ia[i] = i;
+    walker_table(n, REAL(prob), ia, REAL(q),
+		 (int *) R_alloc(n, sizeof(int)));
+    UNPROTECT(2);
+    return ans;
+}
@@ -32,6 +32,75 @@
 /* interval at which to check interrupts, a guess */
 #define NINTERRUPT 10000000
 
+/* As in arithmetic.c, the common cases of operands of equal length or
+   with a scalar operand are done by branch-free loops the compiler can
+   vectorize, with 'omp simd' from OpenMP 4.0 where available. */
+
+#if defined(_OPENMP) && _OPENMP >= 201307
+# define R_DO_PRAGMA(x) _Pragma(#x)
+# define R_OMP_SIMD R_DO_PRAGMA(omp simd)
+#else
+# define R_OMP_SIMD
+#endif
+
+#define SIMD_ITERATE_CHECK(ncheck, n, i, loop_body) do {		\
+	for (R_xlen_t __start__ = 0; __start__ < n; __start__ += ncheck) { \
+	    R_xlen_t __end__ = n - __start__ > ncheck ?			\
+		__start__ + ncheck : n;					\
+	    R_OMP_SIMD							\
+	    for (i = __start__; i < __end__; i++) { loop_body }	\
+	    if (__end__ < n) R_CheckUserInterrupt();			\
+	}								\
+    } while (0)
+
+/* NaN is the only value not equal to itself: unlike ISNAN this does
+   not stop the loops vectorizing */
+#define REAL_NA_LANE(x) ((x) != (x))
+#define INTEGER_NA_LANE(x) ((x) == NA_INTEGER)
+
+#define RELOP_SIMD_LOOP(TYPE, PTR, NA_LANE, OP) do {			\
+	int *pa = LOGICAL(ans);						\
+	TYPE *px = PTR(s1), *py = PTR(s2);				\
+	if (n1 == n2)							\
+	    SIMD_ITERATE_CHECK(NINTERRUPT, n, i, {			\
+		    TYPE __x = px[i];					\
+		    TYPE __y = py[i];					\
+		    pa[i] = (NA_LANE(__x) | NA_LANE(__y)) ? NA_LOGICAL :	\
+			(__x OP __y);					\
+		});							\
+	else if (n2 == 1) {						\
+	    TYPE __y = py[0];						\
+	    if (NA_LANE(__y))						\
+		SIMD_ITERATE_CHECK(NINTERRUPT, n, i, pa[i] = NA_LOGICAL;); \
+	    else							\
+		SIMD_ITERATE_CHECK(NINTERRUPT, n, i, {			\
+			TYPE __x = px[i];				\
+			pa[i] = NA_LANE(__x) ? NA_LOGICAL : (__x OP __y); \
+		    });							\
+	}								\
+	else {								\
+	    TYPE __x = px[0];						\
+	    if (NA_LANE(__x))						\
+		SIMD_ITERATE_CHECK(NINTERRUPT, n, i, pa[i] = NA_LOGICAL;); \
+	    else							\
+		SIMD_ITERATE_CHECK(NINTERRUPT, n, i, {			\
+			TYPE __y = py[i];				\
+			pa[i] = NA_LANE(__y) ? NA_LOGICAL : (__x OP __y); \
+		    });							\
+	}								\
+    } while (0)
+
+#define RELOP_SIMD_LOOPS(TYPE, PTR, NA_LANE) do {			\
+	switch (code) {							\
+	case EQOP: RELOP_SIMD_LOOP(TYPE, PTR, NA_LANE, ==); break;	\
+	case NEOP: RELOP_SIMD_LOOP(TYPE, PTR, NA_LANE, !=); break;	\
+	case LTOP: RELOP_SIMD_LOOP(TYPE, PTR, NA_LANE, <); break;	\
+	case GTOP: RELOP_SIMD_LOOP(TYPE, PTR, NA_LANE, >); break;	\
+	case LEOP: RELOP_SIMD_LOOP(TYPE, PTR, NA_LANE, <=); break;	\
+	case GEOP: RELOP_SIMD_LOOP(TYPE, PTR, NA_LANE, >=); break;	\
+	}								\
+    } while (0)
+
 static SEXP integer_relop(RELOP_TYPE code, SEXP s1, SEXP s2);
 static SEXP real_relop(RELOP_TYPE code, SEXP s1, SEXP s2);
 static SEXP complex_relop(RELOP_TYPE code, SEXP s1, SEXP s2, SEXP call);
@@ -336,6 +405,12 @@ static SEXP integer_relop(RELOP_TYPE code, SEXP s1, SEXP s2)
     PROTECT(s2);
     ans = allocVector(LGLSXP, n);
 
+    if (n > 0 && (n1 == n2 || n1 == 1 || n2 == 1)) {
+	RELOP_SIMD_LOOPS(int, INTEGER, INTEGER_NA_LANE);
+	UNPROTECT(2);
+	return ans;
+    }
+
     switch (code) {
     case EQOP:
 	MOD_ITERATE2(n, n1, n2, i, i1, i2, {
@@ -421,6 +496,12 @@ static SEXP real_relop(RELOP_TYPE code, SEXP s1, SEXP s2)
     PROTECT(s2);
     ans = allocVector(LGLSXP, n);
 
+    if (n > 0 && (n1 == n2 || n1 == 1 || n2 == 1)) {
+	RELOP_SIMD_LOOPS(double, REAL, REAL_NA_LANE);
+	UNPROTECT(2);
+	return ans;
+    }
+
     switch (code) {
     case EQOP:
 	MOD_ITERATE2(n, n1, n2, i, i1, i2, {
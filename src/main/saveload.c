@@ -2279,14 +2279,14 @@ SEXP attribute_hidden do_saveToConn(SEXP call, SEXP op, SEXP args, SEXP env)
 	error(_("connection not open for writing"));
 
     if (ascii) {
-	magic = "RDA2\n";
+	magic = version >= 4 ? "RDA4\n" : "RDA2\n";
 	type = (ascii == NA_LOGICAL) ?
 	    R_pstream_asciihex_format : R_pstream_ascii_format;
     }
     else {
 	if (con->text)
 	    error(_("cannot save XDR format to a text-mode connection"));
-	magic = "RDX2\n";
+	magic = version >= 4 ? "RDX4\n" : "RDX2\n";
 	type = R_pstream_xdr_format;
     }
 
@@ -2371,7 +2371,9 @@ SEXP attribute_hidden do_loadFromConn2(SEXP call, SEXP op, SEXP args, SEXP env)
     if (count == 0) error(_("no input is available"));
     if (strncmp((char*)buf, "RDA2\n", 5) == 0 ||
 	strncmp((char*)buf, "RDB2\n", 5) == 0 ||
-	strncmp((char*)buf, "RDX2\n", 5) == 0) {
+	strncmp((char*)buf, "RDX2\n", 5) == 0 ||
+	strncmp((char*)buf, "RDA4\n", 5) == 0 ||
+	strncmp((char*)buf, "RDX4\n", 5) == 0) {
 	R_InitConnInPStream(&in, con, R_pstream_any_format, NULL, NULL);
 	/* PROTECT is paranoia: some close() method might allocate */
 	R_InitReadItemDepth = R_ReadItemDepth = -asInteger(CADDR(args));
@@ -212,12 +212,12 @@ strtoraw (const char *nptr, char **endptr)
 static R_INLINE int scanchar_raw(LocalData *d)
 {
     int c = (d->ttyflag) ? ConsoleGetcharWithPushBack(d->con) :
-	Rconn_fgetc(d->con);
+	Rconn_fgetc_buff(d->con);
     if(c == 0) {
 	if(d->skipNul) {
 	    do {
 		c = (d->ttyflag) ? ConsoleGetcharWithPushBack(d->con) :
-		    Rconn_fgetc(d->con);
+		    Rconn_fgetc_buff(d->con);
 	    } while(c == 0);
 	} else d->embedWarn = TRUE;
     }
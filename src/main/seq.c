@@ -175,6 +175,95 @@ SEXP attribute_hidden do_colon(SEXP call, SEXP op, SEXP args, SEXP rho)
     return seq_colon(n1, n2, call);
 }
 
+/* Atomic vectors are replicated by filling in one period, the elements
+   of x each repeated 'each' times, and then copying the filled part
+   after itself until the result is full, so doubling the length copied
+   by each memcpy.  Long periods are filled in on R_num_math_threads
+   threads. */
+#define R_REP_THREADS_MIN 1000000
+
+static R_INLINE int rep_nthreads(R_xlen_t n)
+{
+#ifdef _OPENMP
+    if (n >= R_REP_THREADS_MIN && R_num_math_threads > 1)
+	return R_num_math_threads;
+#endif
+    return 1;
+}
+
+#ifdef _OPENMP
+# define REP_EACH_PARALLEL_FOR						\
+    _Pragma("omp parallel for num_threads(nthreads) default(none) \
+	     firstprivate(pa, px, nfill, each, nruns)")
+#else
+# define REP_EACH_PARALLEL_FOR
+#endif
+
+#define REP_EACH_FUN(NAME, TYPE)					\
+static void NAME(TYPE *pa, TYPE *px, R_xlen_t nfill, int each,		\
+		 int nthreads)						\
+{									\
+    R_xlen_t nruns = (nfill + each - 1) / each;				\
+    REP_EACH_PARALLEL_FOR						\
+    for (R_xlen_t i = 0; i < nruns; i++) {				\
+	TYPE v = px[i];							\
+	R_xlen_t from = i * each, to = from + each;			\
+	if (to > nfill) to = nfill;					\
+	for (R_xlen_t k = from; k < to; k++)				\
+	    pa[k] = v;							\
+    }									\
+}
+
+REP_EACH_FUN(rep_each_int, int)
+REP_EACH_FUN(rep_each_real, double)
+REP_EACH_FUN(rep_each_cplx, Rcomplex)
+REP_EACH_FUN(rep_each_raw, Rbyte)
+
+/* fill a, of length len, with 'x' each repeated 'each' times and
+   recycled; returns FALSE, doing nothing, if 'x' is not atomic */
+static Rboolean rep_atomic(SEXP a, SEXP x, R_xlen_t len, int each)
+{
+    R_xlen_t lx = xlength(x), nfill = lx * each;
+    size_t size;
+
+    if (nfill > len) nfill = len;
+    int nthreads = rep_nthreads(nfill);
+    switch (TYPEOF(x)) {
+    case LGLSXP:
+    case INTSXP:
+	size = sizeof(int);
+	if (each > 1)
+	    rep_each_int(INTEGER(a), INTEGER(x), nfill, each, nthreads);
+	break;
+    case REALSXP:
+	size = sizeof(double);
+	if (each > 1)
+	    rep_each_real(REAL(a), REAL(x), nfill, each, nthreads);
+	break;
+    case CPLXSXP:
+	size = sizeof(Rcomplex);
+	if (each > 1)
+	    rep_each_cplx(COMPLEX(a), COMPLEX(x), nfill, each, nthreads);
+	break;
+    case RAWSXP:
+	size = sizeof(Rbyte);
+	if (each > 1)
+	    rep_each_raw(RAW(a), RAW(x), nfill, each, nthreads);
+	break;
+    default:
+	return FALSE;
+    }
+    char *p = (char *) DATAPTR(a);
+    if (each == 1 && nfill > 0)
+	memcpy(p, DATAPTR(x), nfill * size);
+    for (R_xlen_t done = nfill; done < len; ) {
+	R_xlen_t n = done < len - done ? done : len - done;
+	memcpy(p + done * size, p, n * size);
+	done += n;
+    }
+    return TRUE;
+}
+
 /* rep.int(x, times) for a vector times */
 static SEXP rep2(SEXP s, SEXP ncopy)
 {
@@ -268,37 +357,12 @@ static SEXP rep3(SEXP s, R_xlen_t ns, R_xlen_t na)
 
     PROTECT(a = allocVector(TYPEOF(s), na));
 
+    if (rep_atomic(a, s, na, 1)) {
+	UNPROTECT(1);
+	return a;
+    }
+
     switch (TYPEOF(s)) {
-    case LGLSXP:
-	MOD_ITERATE1(na, ns, i, j, {
-//	    if ((i+1) % NINTERRUPT == 0) R_CheckUserInterrupt();
-	    LOGICAL(a)[i] = LOGICAL(s)[j];
-	});
-	break;
-    case INTSXP:
-	MOD_ITERATE1(na, ns, i, j, {
-//	    if ((i+1) % NINTERRUPT == 0) R_CheckUserInterrupt();
-	    INTEGER(a)[i] = INTEGER(s)[j];
-	});
-	break;
-    case REALSXP:
-	MOD_ITERATE1(na, ns, i, j,  {
-//	    if ((i+1) % NINTERRUPT == 0) R_CheckUserInterrupt();
-	    REAL(a)[i] = REAL(s)[j];
-	});
-	break;
-    case CPLXSXP:
-	MOD_ITERATE1(na, ns, i, j, {
-//	    if ((i+1) % NINTERRUPT == 0) R_CheckUserInterrupt();
-	    COMPLEX(a)[i] = COMPLEX(s)[j];
-	});
-	break;
-    case RAWSXP:
-	MOD_ITERATE1(na, ns, i, j, {
-//	    if ((i+1) % NINTERRUPT == 0) R_CheckUserInterrupt();
-	    RAW(a)[i] = RAW(s)[j];
-	});
-	break;
     case STRSXP:
 	MOD_ITERATE1(na, ns, i, j, {
 //	    if ((i+1) % NINTERRUPT == 0) R_CheckUserInterrupt();
@@ -443,73 +507,49 @@ static SEXP rep4(SEXP x, SEXP times, R_xlen_t len, int each, R_xlen_t nt)
     if (each == 1 && nt == 1) return rep3(x, lx, len);
 
     PROTECT(a = allocVector(TYPEOF(x), len));
+    if (nt == 1 && rep_atomic(a, x, len, each)) {
+	UNPROTECT(1);
+	return a;
+    }
 
     switch (TYPEOF(x)) {
-    case LGLSXP:
-	if(nt == 1)
-	    for(i = 0; i < len; i++) {
-//		if ((i+1) % NINTERRUPT == 0) R_CheckUserInterrupt();
-		LOGICAL(a)[i] = LOGICAL(x)[(i/each) % lx];
-	    }
-	else {
-	    for(i = 0, k = 0, k2 = 0; i < lx; i++) {
-//		if ((i+1) % NINTERRUPT == 0) R_CheckUserInterrupt();
-		for(j = 0, sum = 0; j < each; j++) sum += INTEGER(times)[k++];
-		for(k3 = 0; k3 < sum; k3++) {
-		    LOGICAL(a)[k2++] = LOGICAL(x)[i];
-		    if(k2 == len) goto done;
-		}
+    case LGLSXP: /* nt > 1 */
+	for(i = 0, k = 0, k2 = 0; i < lx; i++) {
+//	    if ((i+1) % NINTERRUPT == 0) R_CheckUserInterrupt();
+	    for(j = 0, sum = 0; j < each; j++) sum += INTEGER(times)[k++];
+	    for(k3 = 0; k3 < sum; k3++) {
+		LOGICAL(a)[k2++] = LOGICAL(x)[i];
+		if(k2 == len) goto done;
 	    }
 	}
 	break;
-    case INTSXP:
-	if(nt == 1)
-	    for(i = 0; i < len; i++) {
-//		if ((i+1) % NINTERRUPT == 0) R_CheckUserInterrupt();
-		INTEGER(a)[i] = INTEGER(x)[(i/each) % lx];
-	    }
-	else {
-	    for(i = 0, k = 0, k2 = 0; i < lx; i++) {
-//		if ((i+1) % NINTERRUPT == 0) R_CheckUserInterrupt();
-		for(j = 0, sum = 0; j < each; j++) sum += INTEGER(times)[k++];
-		for(k3 = 0; k3 < sum; k3++) {
-		    INTEGER(a)[k2++] = INTEGER(x)[i];
-		    if(k2 == len) goto done;
-		}
+    case INTSXP: /* nt > 1 */
+	for(i = 0, k = 0, k2 = 0; i < lx; i++) {
+//	    if ((i+1) % NINTERRUPT == 0) R_CheckUserInterrupt();
+	    for(j = 0, sum = 0; j < each; j++) sum += INTEGER(times)[k++];
+	    for(k3 = 0; k3 < sum; k3++) {
+		INTEGER(a)[k2++] = INTEGER(x)[i];
+		if(k2 == len) goto done;
 	    }
 	}
 	break;
-    case REALSXP:
-	if(nt == 1)
-	    for(i = 0; i < len; i++) {
-//		if ((i+1) % NINTERRUPT == 0) R_CheckUserInterrupt();
-		REAL(a)[i] = REAL(x)[(i/each) % lx];
-	    }
-	else {
-	    for(i = 0, k = 0, k2 = 0; i < lx; i++) {
-//		if ((i+1) % NINTERRUPT == 0) R_CheckUserInterrupt();
-		for(j = 0, sum = 0; j < each; j++) sum += INTEGER(times)[k++];
-		for(k3 = 0; k3 < sum; k3++) {
-		    REAL(a)[k2++] = REAL(x)[i];
-		    if(k2 == len) goto done;
-		}
+    case REALSXP: /* nt > 1 */
+	for(i = 0, k = 0, k2 = 0; i < lx; i++) {
+//	    if ((i+1) % NINTERRUPT == 0) R_CheckUserInterrupt();
+	    for(j = 0, sum = 0; j < each; j++) sum += INTEGER(times)[k++];
+	    for(k3 = 0; k3 < sum; k3++) {
+		REAL(a)[k2++] = REAL(x)[i];
+		if(k2 == len) goto done;
 	    }
 	}
 	break;
-    case CPLXSXP:
-	if(nt == 1)
-	    for(i = 0; i < len; i++) {
-//		if ((i+1) % NINTERRUPT == 0) R_CheckUserInterrupt();
-		COMPLEX(a)[i] = COMPLEX(x)[(i/each) % lx];
-	    }
-	else {
-	    for(i = 0, k = 0, k2 = 0; i < lx; i++) {
-//		if ((i+1) % NINTERRUPT == 0) R_CheckUserInterrupt();
-		for(j = 0, sum = 0; j < each; j++) sum += INTEGER(times)[k++];
-		for(k3 = 0; k3 < sum; k3++) {
-		    COMPLEX(a)[k2++] = COMPLEX(x)[i];
-		    if(k2 == len) goto done;
-		}
+    case CPLXSXP: /* nt > 1 */
+	for(i = 0, k = 0, k2 = 0; i < lx; i++) {
+//	    if ((i+1) % NINTERRUPT == 0) R_CheckUserInterrupt();
+	    for(j = 0, sum = 0; j < each; j++) sum += INTEGER(times)[k++];
+	    for(k3 = 0; k3 < sum; k3++) {
+		COMPLEX(a)[k2++] = COMPLEX(x)[i];
+		if(k2 == len) goto done;
 	    }
 	}
 	break;
@@ -548,20 +588,13 @@ static SEXP rep4(SEXP x, SEXP times, R_xlen_t len, int each, R_xlen_t nt)
 	    }
 	}
 	break;
-    case RAWSXP:
-	if(nt == 1)
-	    for(i = 0; i < len; i++) {
-//		if ((i+1) % NINTERRUPT == 0) R_CheckUserInterrupt();
-		RAW(a)[i] = RAW(x)[(i/each) % lx];
-	    }
-	else {
-	    for(i = 0, k = 0, k2 = 0; i < lx; i++) {
-//		if ((i+1) % NINTERRUPT == 0) R_CheckUserInterrupt();
-		for(j = 0, sum = 0; j < each; j++) sum += INTEGER(times)[k++];
-		for(k3 = 0; k3 < sum; k3++) {
-		    RAW(a)[k2++] = RAW(x)[i];
-		    if(k2 == len) goto done;
-		}
+    case RAWSXP: /* nt > 1 */
+	for(i = 0, k = 0, k2 = 0; i < lx; i++) {
+//	    if ((i+1) % NINTERRUPT == 0) R_CheckUserInterrupt();
+	    for(j = 0, sum = 0; j < each; j++) sum += INTEGER(times)[k++];
+	    for(k3 = 0; k3 < sum; k3++) {
+		RAW(a)[k2++] = RAW(x)[i];
+		if(k2 == len) goto done;
 	    }
 	}
 	break;
@@ -29,6 +29,7 @@
 #include <Rmath.h>
 #include <Fileio.h>
 #include <Rversion.h>
+#include <Rconnections.h>
 #include <R_ext/RS.h>           /* for CallocCharBuf, Free */
 #include <errno.h>
 #include <ctype.h>		/* for isspace */
@@ -161,6 +162,7 @@
 static void OutStringVec(R_outpstream_t stream, SEXP s, SEXP ref_table);
 static void WriteItem (SEXP s, SEXP ref_table, R_outpstream_t stream);
 static SEXP ReadItem(SEXP ref_table, R_inpstream_t stream);
+static SEXP ReadItemFlags(SEXP ref_table, R_inpstream_t stream, int flags);
 static void WriteBC(SEXP s, SEXP ref_table, R_outpstream_t stream);
 static SEXP ReadBC(SEXP ref_table, R_inpstream_t stream);
 
@@ -201,6 +203,175 @@ static int Rsnprintf(char *buf, int size, const char *format, ...)
 }
 
 
+/*
+ * Bulk Data Transfer
+ *
+ * OutBulk and InBulk write and read the n items of size bytes at p
+ * with as few OutBytes/InBytes calls as their int byte counts allow.
+ * If swap is non-zero the data are little-endian units of swap bytes
+ * in the stream: on big-endian platforms those are byte-swapped
+ * through a buffer, a chunk at a time.
+ */
+
+#define BULK_BUFSIZE 65536
+
+#ifdef WORDS_BIGENDIAN
+static void swapBytes(unsigned char *p, size_t nbytes, int swap)
+{
+    for (size_t k = 0; k < nbytes; k += swap)
+	for (int j = 0; j < swap / 2; j++) {
+	    unsigned char t = p[k + j];
+	    p[k + j] = p[k + swap - 1 - j];
+	    p[k + swap - 1 - j] = t;
+	}
+}
+#endif
+
+static void OutBulk(R_outpstream_t stream, void *p, R_xlen_t n, int size,
+		    int swap)
+{
+    char *q = p;
+    R_xlen_t done, this, chunk = INT_MAX / size;
+#ifdef WORDS_BIGENDIAN
+    static unsigned char buf[BULK_BUFSIZE];
+    if (swap) chunk = BULK_BUFSIZE / size;
+#endif
+    for (done = 0; done < n; done += this) {
+	this = (n - done < chunk) ? n - done : chunk;
+#ifdef WORDS_BIGENDIAN
+	if (swap) {
+	    memcpy(buf, q + done * size, this * size);
+	    swapBytes(buf, this * size, swap);
+	    stream->OutBytes(stream, buf, (int)(this * size));
+	    continue;
+	}
+#endif
+	stream->OutBytes(stream, q + done * size, (int)(this * size));
+    }
+}
+
+static void InBulk(R_inpstream_t stream, void *p, R_xlen_t n, int size,
+		   int swap)
+{
+    char *q = p;
+    R_xlen_t done, this, chunk = INT_MAX / size;
+    for (done = 0; done < n; done += this) {
+	this = (n - done < chunk) ? n - done : chunk;
+	stream->InBytes(stream, q + done * size, (int)(this * size));
+#ifdef WORDS_BIGENDIAN
+	if (swap)
+	    swapBytes((unsigned char *) q + done * size, this * size, swap);
+#endif
+    }
+}
+
+
+/*
+ * Aligned Vector Data
+ *
+ * In the little-endian binary format the data of atomic vectors of at
+ * least ALIGN_MIN bytes follow a pad byte giving the number of zero
+ * bytes (less than ALIGN_DATA) after it.  Streams set up by
+ * CountOutPStream know how much they have written, and pad so the data
+ * start at a multiple of ALIGN_DATA bytes from the start of the file or
+ * buffer; others write no padding.  When reading a file with mmap = TRUE
+ * the stream's InBytes is InBytesConnMmap, and aligned data are mapped
+ * from the file rather than read.
+ */
+
+#define ALIGN_DATA 64
+#define ALIGN_MIN 65536
+
+typedef struct counted_outpstream_st {
+    struct R_outpstream_st stream; /* must be first */
+    void (*OutBytes)(R_outpstream_t, void *, int);
+    double count;
+} *counted_outpstream_t;
+
+static void OutBytesCounted(R_outpstream_t stream, void *buf, int length)
+{
+    counted_outpstream_t cs = (counted_outpstream_t) stream;
+    cs->OutBytes(stream, buf, length);
+    cs->count += length;
+}
+
+static void CountOutPStream(counted_outpstream_t cs, double start)
+{
+    cs->OutBytes = cs->stream.OutBytes;
+    cs->stream.OutBytes = OutBytesCounted;
+    cs->count = start;
+}
+
+static void InBytesConnMmap(R_inpstream_t stream, void *buf, int length);
+static void OutBytesNull(R_outpstream_t stream, void *buf, int length);
+
+/* Is this the stream of a sizing pass, which discards its output? */
+static R_INLINE Rboolean IsSizingPStream(R_outpstream_t stream)
+{
+    return stream->OutBytes == OutBytesCounted &&
+	((counted_outpstream_t) stream)->OutBytes == OutBytesNull;
+}
+
+static R_INLINE int vecEltSize(SEXPTYPE type)
+{
+    switch (type) {
+    case LGLSXP:
+    case INTSXP: return sizeof(int);
+    case REALSXP: return sizeof(double);
+    case CPLXSXP: return sizeof(Rcomplex);
+    case RAWSXP: return 1;
+    default: return 0;
+    }
+}
+
+static R_INLINE Rboolean
+IsAlignedVec(R_pstream_format_t type, SEXPTYPE vtype, R_xlen_t length)
+{
+    return type == R_pstream_binary_le_format &&
+	(double) length * vecEltSize(vtype) >= ALIGN_MIN;
+}
+
+static void OutAlignPad(R_outpstream_t stream)
+{
+    unsigned char buf[ALIGN_DATA];
+    int pad = 0;
+    if (stream->OutBytes == OutBytesCounted) {
+	double next = ((counted_outpstream_t) stream)->count + 1;
+	pad = (ALIGN_DATA - (int) fmod(next, ALIGN_DATA)) % ALIGN_DATA;
+    }
+    memset(buf, 0, sizeof(buf));
+    buf[0] = (unsigned char) pad;
+    stream->OutBytes(stream, buf, pad + 1);
+}
+
+/* Skip the padding; then return the data mapped from the file if that
+   can be done, or NULL for the caller to read them */
+static SEXP InAlignedVec(R_inpstream_t stream, SEXPTYPE type,
+			 R_xlen_t length)
+{
+    unsigned char buf[ALIGN_DATA];
+    stream->InBytes(stream, buf, 1);
+    if (buf[0] >= ALIGN_DATA)
+	error(_("invalid padding in serialized data"));
+    if (buf[0] > 0)
+	stream->InBytes(stream, buf, buf[0]);
+#ifndef WORDS_BIGENDIAN
+    if (stream->InBytes == InBytesConnMmap) {
+	Rconnection con = (Rconnection) stream->data;
+	double pos = con->seek(con, NA_REAL, 1, 1);
+	if (pos >= 0 && fmod(pos, sizeof(double)) == 0) {
+	    SEXP s = R_mmapVectorAt(con->description, type, length, pos);
+	    if (s != NULL) {
+		con->seek(con, pos + (double) length * vecEltSize(type), 1, 1);
+		return s;
+	    }
+	}
+    }
+#endif
+    return NULL;
+}
+
+
 /*
  * Basic Output Routines
  */
@@ -220,6 +391,9 @@ static void OutInteger(R_outpstream_t stream, int i)
     case R_pstream_binary_format:
 	stream->OutBytes(stream, &i, sizeof(int));
 	break;
+    case R_pstream_binary_le_format:
+	OutBulk(stream, &i, 1, sizeof(int), sizeof(int));
+	break;
     case R_pstream_xdr_format:
 	R_XDREncodeInteger(i, buf);
 	stream->OutBytes(stream, buf, R_XDR_INTEGER_SIZE);
@@ -267,6 +441,9 @@ static void OutReal(R_outpstream_t stream, double d)
     case R_pstream_binary_format:
 	stream->OutBytes(stream, &d, sizeof(double));
 	break;
+    case R_pstream_binary_le_format:
+	OutBulk(stream, &d, 1, sizeof(double), sizeof(double));
+	break;
     case R_pstream_xdr_format:
 	R_XDREncodeDouble(d, buf);
 	stream->OutBytes(stream, buf, R_XDR_DOUBLE_SIZE);
@@ -292,6 +469,7 @@ static void OutByte(R_outpstream_t stream, Rbyte i)
 	stream->OutBytes(stream, buf, (int)strlen(buf));
 	break;
     case R_pstream_binary_format:
+    case R_pstream_binary_le_format:
     case R_pstream_xdr_format:
 	stream->OutBytes(stream, &i, 1);
 	break;
@@ -380,6 +558,9 @@ static int InInteger(R_inpstream_t stream)
     case R_pstream_binary_format:
 	stream->InBytes(stream, &i, sizeof(int));
 	return i;
+    case R_pstream_binary_le_format:
+	InBulk(stream, &i, 1, sizeof(int), sizeof(int));
+	return i;
     case R_pstream_xdr_format:
 	stream->InBytes(stream, buf, R_XDR_INTEGER_SIZE);
 	return R_XDRDecodeInteger(buf);
@@ -423,6 +604,9 @@ static double InReal(R_inpstream_t stream)
     case R_pstream_binary_format:
 	stream->InBytes(stream, &d, sizeof(double));
 	return d;
+    case R_pstream_binary_le_format:
+	InBulk(stream, &d, 1, sizeof(double), sizeof(double));
+	return d;
     case R_pstream_xdr_format:
 	stream->InBytes(stream, buf, R_XDR_DOUBLE_SIZE);
 	return R_XDRDecodeDouble(buf);
@@ -522,8 +706,8 @@ static void InString(R_inpstream_t stream, char *buf, int length)
 /*
  * Format Header Reading and Writing
  *
- * The header starts with one of three characters, A for ascii, B for
- * binary, or X for xdr.
+ * The header starts with one of four characters, A for ascii, B for
+ * native binary, L for little-endian binary, or X for xdr.
  */
 
 static void OutFormat(R_outpstream_t stream)
@@ -537,6 +721,8 @@ static void OutFormat(R_outpstream_t stream)
     case R_pstream_asciihex_format:
 	stream->OutBytes(stream, "A\n", 2); break;
     case R_pstream_binary_format: stream->OutBytes(stream, "B\n", 2); break;
+    case R_pstream_binary_le_format:
+	stream->OutBytes(stream, "L\n", 2); break;
     case R_pstream_xdr_format:    stream->OutBytes(stream, "X\n", 2); break;
     case R_pstream_any_format:
 	error(_("must specify ascii, binary, or xdr format"));
@@ -552,6 +738,7 @@ static void InFormat(R_inpstream_t stream)
     switch (buf[0]) {
     case 'A': type = R_pstream_ascii_format; break;
     case 'B': type = R_pstream_binary_format; break;
+    case 'L': type = R_pstream_binary_le_format; break;
     case 'X': type = R_pstream_xdr_format; break;
     case '\n':
 	/* GROSS HACK: ASCII unserialize may leave a trailing newline
@@ -585,52 +772,101 @@ static void InFormat(R_inpstream_t stream)
  *
  * Hashing functions for hashing reference objects during writing.
  * Objects are entered, and the order in which they are encountered is
- * recorded.  GashGet returns this number, a positive integer, if the
- * object was seen before, and zero if not.  A fixed hash table size
- * is used; this is not ideal but seems adequate for now.  The hash
- * table representation consists of a (R_NilValue . vector) pair.  The
- * hash buckets are in the vector.  This indirect representation
- * should allow resizing the table at some point.
+ * recorded.  HashGet returns this number, a positive integer, if the
+ * object was seen before, and zero if not.  The table uses open
+ * addressing with linear probing: the representation is a (values .
+ * keys) pair of an integer vector and a generic vector of the same
+ * power of two size, with R_NilValue marking empty key slots (it is
+ * never entered, being written as a special value).  The number of
+ * entries is kept in the TRUELENGTH of the keys, and the table is
+ * doubled when it becomes half full, so serializing objects with
+ * millions of environments stays linear.
  */
 
 #define HASHSIZE 1099
+#define REFHASH_INITIAL_SIZE 1024
 
 #define PTRHASH(obj) (((R_size_t) (obj)) >> 2)
 
 #define HASH_TABLE_COUNT(ht) TRUELENGTH(CDR(ht))
 #define SET_HASH_TABLE_COUNT(ht, val) SET_TRUELENGTH(CDR(ht), val)
 
-#define HASH_TABLE_SIZE(ht) LENGTH(CDR(ht))
+#define HASH_TABLE_SIZE(ht) XLENGTH(CDR(ht))
 
-#define HASH_BUCKET(ht, pos) VECTOR_ELT(CDR(ht), pos)
-#define SET_HASH_BUCKET(ht, pos, val) SET_VECTOR_ELT(CDR(ht), pos, val)
+#define HASH_KEY(ht, pos) VECTOR_ELT(CDR(ht), pos)
+#define HASH_VALUE(ht, pos) INTEGER(CAR(ht))[pos]
 
-static SEXP MakeHashTable(void)
+/* scramble the pointer bits, as the low ones are shared by aligned
+   allocations and the table size is a power of two */
+static R_INLINE R_size_t RefHash(SEXP obj, R_size_t mask)
+{
+    R_size_t h = PTRHASH(obj);
+    h ^= h >> 16;
+    h *= 0x45d9f3b;
+    h ^= h >> 16;
+    return h & mask;
+}
+
+static SEXP MakeRefHashTable(R_xlen_t size)
 {
-    SEXP val = CONS(R_NilValue, allocVector(VECSXP, HASHSIZE));
+    SEXP keys = PROTECT(allocVector(VECSXP, size));
+    SEXP val = CONS(allocVector(INTSXP, size), keys);
     SET_HASH_TABLE_COUNT(val, 0);
+    UNPROTECT(1);
     return val;
 }
 
+static SEXP MakeHashTable(void)
+{
+    return MakeRefHashTable(REFHASH_INITIAL_SIZE);
+}
+
+static void HashResize(SEXP ht)
+{
+    R_xlen_t i, oldsize = HASH_TABLE_SIZE(ht), newsize = 2 * oldsize;
+    R_size_t mask = newsize - 1;
+    SEXP table = PROTECT(MakeRefHashTable(newsize));
+    for (i = 0; i < oldsize; i++) {
+	SEXP key = HASH_KEY(ht, i);
+	if (key != R_NilValue) {
+	    R_size_t pos = RefHash(key, mask);
+	    while (HASH_KEY(table, pos) != R_NilValue)
+		pos = (pos + 1) & mask;
+	    SET_VECTOR_ELT(CDR(table), pos, key);
+	    HASH_VALUE(table, pos) = HASH_VALUE(ht, i);
+	}
+    }
+    SET_HASH_TABLE_COUNT(table, HASH_TABLE_COUNT(ht));
+    SETCAR(ht, CAR(table));
+    SETCDR(ht, CDR(table));
+    UNPROTECT(1);
+}
+
 static void HashAdd(SEXP obj, SEXP ht)
 {
-    R_size_t pos = PTRHASH(obj) % HASH_TABLE_SIZE(ht);
+    R_size_t mask = HASH_TABLE_SIZE(ht) - 1;
+    R_size_t pos = RefHash(obj, mask);
     int count = HASH_TABLE_COUNT(ht) + 1;
-    SEXP val = ScalarInteger(count);
-    SEXP cell = CONS(val, HASH_BUCKET(ht, pos));
 
+    while (HASH_KEY(ht, pos) != R_NilValue)
+	pos = (pos + 1) & mask;
+    SET_VECTOR_ELT(CDR(ht), pos, obj);
+    HASH_VALUE(ht, pos) = count;
     SET_HASH_TABLE_COUNT(ht, count);
-    SET_HASH_BUCKET(ht, pos, cell);
-    SET_TAG(cell, obj);
+    if (2 * (R_xlen_t) count > HASH_TABLE_SIZE(ht))
+	HashResize(ht);
 }
 
 static int HashGet(SEXP item, SEXP ht)
 {
-    R_size_t pos = PTRHASH(item) % HASH_TABLE_SIZE(ht);
-    SEXP cell;
-    for (cell = HASH_BUCKET(ht, pos); cell != R_NilValue; cell = CDR(cell))
-	if (item == TAG(cell))
-	    return INTEGER(CAR(cell))[0];
+    R_size_t mask = HASH_TABLE_SIZE(ht) - 1;
+    R_size_t pos = RefHash(item, mask);
+    SEXP key;
+    while ((key = HASH_KEY(ht, pos)) != R_NilValue) {
+	if (key == item)
+	    return HASH_VALUE(ht, pos);
+	pos = (pos + 1) & mask;
+    }
     return 0;
 }
 
@@ -675,6 +911,18 @@ static int HashGet(SEXP item, SEXP ht)
 #define ATTRLANGSXP       240
 #define ATTRLISTSXP       239
 
+/* When options(serialize.mmap = TRUE) is set, vectors created by
+   mmapVector() are written as the file they map, with their type,
+   length and attributes, rather than their contents; reading them maps
+   the file again, read-only, and only if the option is set there too.
+   Otherwise their contents are written as for any other vector. */
+#define MMAPVECSXP        238
+
+static Rboolean MmapRefs(void)
+{
+    return asLogical(GetOption1(install("serialize.mmap"))) == TRUE;
+}
+
 /*
  * Type/Flag Packing and Unpacking
  *
@@ -852,6 +1100,10 @@ OutIntegerVec(R_outpstream_t stream, SEXP s, R_xlen_t length)
 {
     switch (stream->type) {
     case R_pstream_xdr_format:
+	if (IsSizingPStream(stream)) {
+	    OutBulk(stream, INTEGER(s), length, sizeof(int), 0);
+	    break;
+	}
     {
 	static char buf[CHUNK_SIZE * sizeof(int)];
 	R_xlen_t done, this;
@@ -868,16 +1120,11 @@ OutIntegerVec(R_outpstream_t stream, SEXP s, R_xlen_t length)
 	break;
     }
     case R_pstream_binary_format:
-    {
-	/* write in chunks to avoid overflowing ints */
-	R_xlen_t done, this;
-	for (done = 0; done < length; done += this) {
-	    this = min2(CHUNK_SIZE, length - done);
-	    stream->OutBytes(stream, INTEGER(s) + done,
-			     (int)(sizeof(int) * this));
-	}
+	OutBulk(stream, INTEGER(s), length, sizeof(int), 0);
+	break;
+    case R_pstream_binary_le_format:
+	OutBulk(stream, INTEGER(s), length, sizeof(int), sizeof(int));
 	break;
-    }
     default:
 	for (R_xlen_t cnt = 0; cnt < length; cnt++)
 	    OutInteger(stream, INTEGER(s)[cnt]);
@@ -889,6 +1136,10 @@ OutRealVec(R_outpstream_t stream, SEXP s, R_xlen_t length)
 {
     switch (stream->type) {
     case R_pstream_xdr_format:
+	if (IsSizingPStream(stream)) {
+	    OutBulk(stream, REAL(s), length, sizeof(double), 0);
+	    break;
+	}
     {
 	static char buf[CHUNK_SIZE * sizeof(double)];
 	R_xlen_t done, this;
@@ -905,15 +1156,11 @@ OutRealVec(R_outpstream_t stream, SEXP s, R_xlen_t length)
 	break;
     }
     case R_pstream_binary_format:
-    {
-	R_xlen_t done, this;
-	for (done = 0; done < length; done += this) {
-	    this = min2(CHUNK_SIZE, length - done);
-	    stream->OutBytes(stream, REAL(s) + done,
-			     (int)(sizeof(double) * this));
-	}
+	OutBulk(stream, REAL(s), length, sizeof(double), 0);
+	break;
+    case R_pstream_binary_le_format:
+	OutBulk(stream, REAL(s), length, sizeof(double), sizeof(double));
 	break;
-    }
     default:
 	for (R_xlen_t cnt = 0; cnt < length; cnt++)
 	    OutReal(stream, REAL(s)[cnt]);
@@ -925,6 +1172,10 @@ OutComplexVec(R_outpstream_t stream, SEXP s, R_xlen_t length)
 {
     switch (stream->type) {
     case R_pstream_xdr_format:
+	if (IsSizingPStream(stream)) {
+	    OutBulk(stream, COMPLEX(s), length, sizeof(Rcomplex), 0);
+	    break;
+	}
     {
 	static char buf[CHUNK_SIZE * sizeof(Rcomplex)];
 	R_xlen_t done, this;
@@ -944,15 +1195,11 @@ OutComplexVec(R_outpstream_t stream, SEXP s, R_xlen_t length)
 	break;
     }
     case R_pstream_binary_format:
-    {
-	R_xlen_t done, this;
-	for (done = 0; done < length; done += this) {
-	    this = min2(CHUNK_SIZE, length - done);
-	    stream->OutBytes(stream, COMPLEX(s) + done,
-			     (int)(sizeof(Rcomplex) * this));
-	}
+	OutBulk(stream, COMPLEX(s), length, sizeof(Rcomplex), 0);
+	break;
+    case R_pstream_binary_le_format:
+	OutBulk(stream, COMPLEX(s), length, sizeof(Rcomplex), sizeof(double));
 	break;
-    }
     default:
 	for (R_xlen_t cnt = 0; cnt < length; cnt++)
 	    OutComplex(stream, COMPLEX(s)[cnt]);
@@ -1016,7 +1263,9 @@ static void WriteItem (SEXP s, SEXP ref_table, R_outpstream_t stream)
 	    OutInteger(stream, R_EnvironmentIsLocked(s) ? 1 : 0);
 	    WriteItem(ENCLOS(s), ref_table, stream);
 	    WriteItem(FRAME(s), ref_table, stream);
-	    WriteItem(HASHTAB(s), ref_table, stream);
+	    WriteItem(PROTECT(R_HashTableChains(HASHTAB(s))), ref_table,
+		      stream);
+	    UNPROTECT(1);
 	    WriteItem(ATTRIB(s), ref_table, stream);
 	}
     }
@@ -1035,6 +1284,20 @@ static void WriteItem (SEXP s, SEXP ref_table, R_outpstream_t stream)
 	   field the content of that field must not be serialized, so
 	   we treat it as not there. */
 	hasattr = (TYPEOF(s) != CHARSXP && ATTRIB(s) != R_NilValue);
+	Rboolean readonly;
+	const char *mfile = R_mmapVectorFile(s, &readonly);
+	if (mfile != NULL && MmapRefs()) {
+	    flags = PackFlags(MMAPVECSXP, LEVELS(s), OBJECT(s), hasattr, FALSE);
+	    OutInteger(stream, flags);
+	    OutInteger(stream, TYPEOF(s));
+	    OutInteger(stream, (int) strlen(mfile));
+	    OutString(stream, mfile, (int) strlen(mfile));
+	    OutInteger(stream, readonly);
+	    WriteLENGTH(stream, s);
+	    if (hasattr)
+		WriteItem(ATTRIB(s), ref_table, stream);
+	    return;
+	}
 	flags = PackFlags(TYPEOF(s), LEVELS(s), OBJECT(s),
 			  hasattr, hastag);
 	OutInteger(stream, flags);
@@ -1083,23 +1346,36 @@ static void WriteItem (SEXP s, SEXP ref_table, R_outpstream_t stream)
 	case INTSXP:
 	    len = XLENGTH(s);
 	    WriteLENGTH(stream, s);
+	    if (IsAlignedVec(stream->type, TYPEOF(s), len))
+		OutAlignPad(stream);
 	    OutIntegerVec(stream, s, len);
 	    break;
 	case REALSXP:
 	    len = XLENGTH(s);
 	    WriteLENGTH(stream, s);
+	    if (IsAlignedVec(stream->type, TYPEOF(s), len))
+		OutAlignPad(stream);
 	    OutRealVec(stream, s, len);
 	    break;
 	case CPLXSXP:
 	    len = XLENGTH(s);
 	    WriteLENGTH(stream, s);
+	    if (IsAlignedVec(stream->type, TYPEOF(s), len))
+		OutAlignPad(stream);
 	    OutComplexVec(stream, s, len);
 	    break;
 	case STRSXP:
 	    len = XLENGTH(s);
 	    WriteLENGTH(stream, s);
-	    for (R_xlen_t ix = 0; ix < len; ix++)
-		WriteItem(STRING_ELT(s, ix), ref_table, stream);
+	    for (R_xlen_t ix = 0; ix < len; ix++) {
+		SEXP c = STRING_ELT(s, ix);
+		WriteItem(c, ref_table, stream);
+		/* from version 4 a string is written in full only the
+		   first time it is an element, and referenced after */
+		if (stream->version >= 4 && c != NA_STRING &&
+		    HashGet(c, ref_table) == 0)
+		    HashAdd(c, ref_table);
+	    }
 	    break;
 	case VECSXP:
 	case EXPRSXP:
@@ -1114,17 +1390,14 @@ static void WriteItem (SEXP s, SEXP ref_table, R_outpstream_t stream)
 	case RAWSXP:
 	    len = XLENGTH(s);
 	    WriteLENGTH(stream, s);
+	    if (IsAlignedVec(stream->type, RAWSXP, len))
+		OutAlignPad(stream);
 	    switch (stream->type) {
 	    case R_pstream_xdr_format:
 	    case R_pstream_binary_format:
-	    {
-		R_xlen_t done, this;
-		for (done = 0; done < len; done += this) {
-		    this = min2(CHUNK_SIZE, len - done);
-		    stream->OutBytes(stream, RAW(s) + done, (int) this);
-		}
+	    case R_pstream_binary_le_format:
+		OutBulk(stream, RAW(s), len, 1, 0);
 		break;
-	    }
 	    default:
 		for (R_xlen_t ix = 0; ix < len; ix++)
 		    OutByte(stream, RAW(s)[ix]);
@@ -1309,6 +1582,13 @@ void R_Serialize(SEXP s, R_outpstream_t stream)
 	OutInteger(stream, R_VERSION);
 	OutInteger(stream, R_Version(2,3,0));
 	break;
+    /* version 3 is not used: upstream R uses it for a different
+       layout, with the native encoding after the version numbers */
+    case 4:
+	OutInteger(stream, version);
+	OutInteger(stream, R_VERSION);
+	OutInteger(stream, R_Version(3,4,0));
+	break;
     default: error(_("version %d not supported"), version);
     }
 
@@ -1327,13 +1607,17 @@ static char lastname[8192];
 
 #define INITIAL_REFREAD_TABLE_SIZE 128
 
-static SEXP MakeReadRefTable(void)
+/* The CDR records whether the strings of character vectors are added
+   to the table, as they are in version 4 streams */
+static SEXP MakeReadRefTable(int version)
 {
     SEXP data = allocVector(VECSXP, INITIAL_REFREAD_TABLE_SIZE);
     SET_TRUELENGTH(data, 0);
-    return CONS(data, R_NilValue);
+    return CONS(data, version >= 4 ? R_TrueValue : R_NilValue);
 }
 
+#define READ_REFS_STRINGS(table) (CDR(table) != R_NilValue)
+
 static SEXP GetReadRef(SEXP table, int index)
 {
     int i = index - 1;
@@ -1381,6 +1665,98 @@ static SEXP InStringVec(R_inpstream_t stream, SEXP ref_table)
     return s;
 }
 
+/* The elements of the character vector s of length len.  For long
+   vectors the strings are read into a buffer and interned in batches
+   of one encoding by R_mkCharLenCEVec, which can scan and hash a batch
+   on several threads; NAs, strings too long for the buffer and
+   anything unusual are read one at a time. */
+
+#define STRBATCH_MIN 64
+#define STRBATCH 4096
+#define STRBATCH_BYTES 262144
+
+static void InStrings(SEXP ref_table, R_inpstream_t stream, SEXP s,
+		      R_xlen_t len)
+{
+    R_xlen_t i;
+    Rboolean refs = READ_REFS_STRINGS(ref_table);
+    if (len < STRBATCH_MIN) {
+	for (i = 0; i < len; i++) {
+	    int flags = InInteger(stream);
+	    SET_STRING_ELT(s, i, ReadItemFlags(ref_table, stream, flags));
+	    if (refs && DECODE_TYPE(flags) == CHARSXP &&
+		STRING_ELT(s, i) != NA_STRING)
+		AddReadRef(ref_table, STRING_ELT(s, i));
+	}
+	return;
+    }
+
+    const void *vmax = vmaxget();
+    char *buf = R_alloc(STRBATCH_BYTES, 1);
+    const char **names = (const char **) R_alloc(STRBATCH, sizeof(char *));
+    int *lens = (int *) R_alloc(STRBATCH, sizeof(int));
+    int n = 0, used = 0;
+    cetype_t benc = CE_NATIVE;
+
+#define FLUSH_STRINGS do {						\
+	if (n > 0) R_mkCharLenCEVec(s, i - n, names, lens, n, benc);	\
+	if (refs)							\
+	    for (R_xlen_t k = i - n; k < i; k++)			\
+		AddReadRef(ref_table, STRING_ELT(s, k));		\
+	n = 0; used = 0;						\
+    } while (0)
+
+    for (i = 0; i < len; i++) {
+	int flags, levs, objf, hasattr, hastag, length;
+	SEXPTYPE type;
+	flags = InInteger(stream);
+	UnpackFlags(flags, &type, &levs, &objf, &hasattr, &hastag);
+	if (type != CHARSXP || hasattr) {
+	    FLUSH_STRINGS;
+	    SET_STRING_ELT(s, i, ReadItemFlags(ref_table, stream, flags));
+	    if (refs && type == CHARSXP && STRING_ELT(s, i) != NA_STRING)
+		AddReadRef(ref_table, STRING_ELT(s, i));
+	    continue;
+	}
+	length = InInteger(stream);
+	if (length < 0 || length > STRBATCH_BYTES) {
+	    FLUSH_STRINGS;
+	    if (length == -1)
+		SET_STRING_ELT(s, i, NA_STRING);
+	    else if (length < 0)
+		error(_("invalid string length in serialized data"));
+	    else {
+		cetype_t enc = CE_NATIVE;
+		char *cbuf = CallocCharBuf(length);
+		InString(stream, cbuf, length);
+		if (levs & UTF8_MASK) enc = CE_UTF8;
+		else if (levs & LATIN1_MASK) enc = CE_LATIN1;
+		else if (levs & BYTES_MASK) enc = CE_BYTES;
+		SET_STRING_ELT(s, i, mkCharLenCE(cbuf, length, enc));
+		Free(cbuf);
+		if (refs)
+		    AddReadRef(ref_table, STRING_ELT(s, i));
+	    }
+	    continue;
+	}
+	cetype_t enc = CE_NATIVE;
+	if (levs & UTF8_MASK) enc = CE_UTF8;
+	else if (levs & LATIN1_MASK) enc = CE_LATIN1;
+	else if (levs & BYTES_MASK) enc = CE_BYTES;
+	if (n == STRBATCH || used + length > STRBATCH_BYTES ||
+	    (n > 0 && enc != benc))
+	    FLUSH_STRINGS;
+	benc = enc;
+	InString(stream, buf + used, length);
+	names[n] = buf + used;
+	lens[n++] = length;
+	used += length;
+    }
+    FLUSH_STRINGS;
+#undef FLUSH_STRINGS
+    vmaxset(vmax);
+}
+
 /* use static buffer to reuse storage */
 static R_INLINE void
 InIntegerVec(R_inpstream_t stream, SEXP obj, R_xlen_t length)
@@ -1403,15 +1779,11 @@ InIntegerVec(R_inpstream_t stream, SEXP obj, R_xlen_t length)
 	break;
     }
     case R_pstream_binary_format:
-    {
-	R_xlen_t done, this;
-	for (done = 0; done < length; done += this) {
-	    this = min2(CHUNK_SIZE, length - done);
-	    stream->InBytes(stream, INTEGER(obj) + done,
-			    (int)(sizeof(int) * this));
-	}
+	InBulk(stream, INTEGER(obj), length, sizeof(int), 0);
+	break;
+    case R_pstream_binary_le_format:
+	InBulk(stream, INTEGER(obj), length, sizeof(int), sizeof(int));
 	break;
-    }
     default:
 	for (R_xlen_t cnt = 0; cnt < length; cnt++)
 	    INTEGER(obj)[cnt] = InInteger(stream);
@@ -1439,15 +1811,11 @@ InRealVec(R_inpstream_t stream, SEXP obj, R_xlen_t length)
 	break;
     }
     case R_pstream_binary_format:
-    {
-	R_xlen_t done, this;
-	for (done = 0; done < length; done += this) {
-	    this = min2(CHUNK_SIZE, length - done);
-	    stream->InBytes(stream, REAL(obj) + done,
-			    (int)(sizeof(double) * this));
-	}
+	InBulk(stream, REAL(obj), length, sizeof(double), 0);
+	break;
+    case R_pstream_binary_le_format:
+	InBulk(stream, REAL(obj), length, sizeof(double), sizeof(double));
 	break;
-    }
     default:
 	for (R_xlen_t cnt = 0; cnt < length; cnt++)
 	    REAL(obj)[cnt] = InReal(stream);
@@ -1478,15 +1846,11 @@ InComplexVec(R_inpstream_t stream, SEXP obj, R_xlen_t length)
 	break;
     }
     case R_pstream_binary_format:
-    {
-	R_xlen_t done, this;
-	for (done = 0; done < length; done += this) {
-	    this = min2(CHUNK_SIZE, length - done);
-	    stream->InBytes(stream, COMPLEX(obj) + done,
-			    (int)(sizeof(Rcomplex) * this));
-	}
+	InBulk(stream, COMPLEX(obj), length, sizeof(Rcomplex), 0);
+	break;
+    case R_pstream_binary_le_format:
+	InBulk(stream, COMPLEX(obj), length, sizeof(Rcomplex), sizeof(double));
 	break;
-    }
     default:
 	for (R_xlen_t cnt = 0; cnt < length; cnt++)
 	    COMPLEX(obj)[cnt] = InComplex(stream);
@@ -1532,15 +1896,20 @@ static SEXP R_FindNamespace1(SEXP info)
 
 
 static SEXP ReadItem (SEXP ref_table, R_inpstream_t stream)
+{
+    return ReadItemFlags(ref_table, stream, InInteger(stream));
+}
+
+/* The item whose packed flags have already been read */
+static SEXP ReadItemFlags(SEXP ref_table, R_inpstream_t stream, int flags)
 {
     SEXPTYPE type;
     SEXP s;
     R_xlen_t len, count;
-    int flags, levs, objf, hasattr, hastag, length;
+    int levs, objf, hasattr, hastag, length;
 
     R_assert(TYPEOF(ref_table) == LISTSXP && TYPEOF(CAR(ref_table)) == VECSXP);
 
-    flags = InInteger(stream);
     UnpackFlags(flags, &type, &levs, &objf, &hasattr, &hastag);
 
     switch(type) {
@@ -1706,16 +2075,31 @@ static SEXP ReadItem (SEXP ref_table, R_inpstream_t stream)
 	case LGLSXP:
 	case INTSXP:
 	    len = ReadLENGTH(stream);
+	    if (IsAlignedVec(stream->type, type, len) &&
+		(s = InAlignedVec(stream, type, len)) != NULL) {
+		PROTECT(s);
+		break;
+	    }
 	    PROTECT(s = allocVector(type, len));
 	    InIntegerVec(stream, s, len);
 	    break;
 	case REALSXP:
 	    len = ReadLENGTH(stream);
+	    if (IsAlignedVec(stream->type, type, len) &&
+		(s = InAlignedVec(stream, type, len)) != NULL) {
+		PROTECT(s);
+		break;
+	    }
 	    PROTECT(s = allocVector(type, len));
 	    InRealVec(stream, s, len);
 	    break;
 	case CPLXSXP:
 	    len = ReadLENGTH(stream);
+	    if (IsAlignedVec(stream->type, type, len) &&
+		(s = InAlignedVec(stream, type, len)) != NULL) {
+		PROTECT(s);
+		break;
+	    }
 	    PROTECT(s = allocVector(type, len));
 	    InComplexVec(stream, s, len);
 	    break;
@@ -1723,8 +2107,7 @@ static SEXP ReadItem (SEXP ref_table, R_inpstream_t stream)
 	    len = ReadLENGTH(stream);
 	    PROTECT(s = allocVector(type, len));
 	    R_ReadItemDepth++;
-	    for (count = 0; count < len; ++count)
-		SET_STRING_ELT(s, count, ReadItem(ref_table, stream));
+	    InStrings(ref_table, stream, s, len);
 	    R_ReadItemDepth--;
 	    break;
 	case VECSXP:
@@ -1748,18 +2131,33 @@ static SEXP ReadItem (SEXP ref_table, R_inpstream_t stream)
 	    error(_("this version of R cannot read generic function references"));
 	case RAWSXP:
 	    len = ReadLENGTH(stream);
-	    PROTECT(s = allocVector(type, len));
-	    {
-		R_xlen_t done, this;
-		for (done = 0; done < len; done += this) {
-		    this = min2(CHUNK_SIZE, len - done);
-		    stream->InBytes(stream, RAW(s) + done, (int) this);
-		}
+	    if (IsAlignedVec(stream->type, type, len) &&
+		(s = InAlignedVec(stream, type, len)) != NULL) {
+		PROTECT(s);
+		break;
 	    }
+	    PROTECT(s = allocVector(type, len));
+	    InBulk(stream, RAW(s), len, 1, 0);
 	    break;
 	case S4SXP:
 	    PROTECT(s = allocS4Object());
 	    break;
+	case MMAPVECSXP:
+	    {
+		SEXPTYPE vtype = InInteger(stream);
+		length = InInteger(stream);
+		char cbuf[length+1];
+		InString(stream, cbuf, length);
+		cbuf[length] = '\0';
+		InInteger(stream); /* the writer's readonly flag */
+		len = ReadLENGTH(stream);
+		if (!MmapRefs())
+		    error(_("input refers to the mapped file '%s': set options(serialize.mmap = TRUE) to map it"), cbuf);
+		/* never writable: the stream may not be trusted */
+		PROTECT(s = R_mmapVector(cbuf, vtype, len, TRUE));
+		type = vtype;
+	    }
+	    break;
 	default:
 	    s = R_NilValue; /* keep compiler happy */
 	    error(_("ReadItem: unknown type %i, perhaps written by later version of R"), type);
@@ -1913,6 +2311,7 @@ SEXP R_Unserialize(R_inpstream_t stream)
     release_version = InInteger(stream);
     switch (version) {
     case 2: break;
+    case 4: break;
     default:
 	if (version != 2) {
 	    int vw, pw, sw;
@@ -1929,7 +2328,7 @@ SEXP R_Unserialize(R_inpstream_t stream)
     }
 
     /* Read the actual object back */
-    PROTECT(ref_table = MakeReadRefTable());
+    PROTECT(ref_table = MakeReadRefTable(version));
     obj =  ReadItem(ref_table, stream);
     UNPROTECT(1);
 
@@ -2027,8 +2426,6 @@ R_InitFileInPStream(R_inpstream_t stream, FILE *fp,
  * Persistent Connection Streams
  */
 
-#include <Rconnections.h>
-
 static void CheckInConn(Rconnection con)
 {
     if (! con->isopen)
@@ -2076,6 +2473,12 @@ static void InBytesConn(R_inpstream_t stream, void *buf, int length)
     }
 }
 
+/* as InBytesConn, but marks a stream whose vector data may be mapped */
+static void InBytesConnMmap(R_inpstream_t stream, void *buf, int length)
+{
+    InBytesConn(stream, buf, length);
+}
+
 static int InCharConn(R_inpstream_t stream)
 {
     char buf[1];
@@ -2147,6 +2550,78 @@ void R_InitConnInPStream(R_inpstream_t stream,  Rconnection con,
 		    InCharConn, InBytesConn, phook, pdata);
 }
 
+/*
+ * Persistent Buffered Binary Connection Streams
+ */
+
+/**** should eventually come from a public header file */
+size_t R_WriteConnection(Rconnection con, void *buf, size_t n);
+
+#define BCONBUFSIZ 65536
+
+typedef struct bconbuf_st {
+    Rconnection con;
+    int count;
+    unsigned char buf[BCONBUFSIZ];
+} *bconbuf_t;
+
+static void flush_bcon_buffer(bconbuf_t bb)
+{
+    if (bb->count == 0)
+	return;
+    if (R_WriteConnection(bb->con, bb->buf, bb->count) != bb->count)
+	error(_("error writing to connection"));
+    bb->count = 0;
+}
+
+static void OutCharBB(R_outpstream_t stream, int c)
+{
+    bconbuf_t bb = stream->data;
+    if (bb->count >= BCONBUFSIZ)
+	flush_bcon_buffer(bb);
+    bb->buf[bb->count++] = (char) c;
+}
+
+static void OutBytesBB(R_outpstream_t stream, void *buf, int length)
+{
+    bconbuf_t bb = stream->data;
+    if (bb->count + length > BCONBUFSIZ)
+	flush_bcon_buffer(bb);
+    if (length <= BCONBUFSIZ) {
+	memcpy(bb->buf + bb->count, buf, length);
+	bb->count += length;
+    }
+    else if (R_WriteConnection(bb->con, buf, length) != length)
+	error(_("error writing to connection"));
+}
+
+static void InitBConOutPStream(R_outpstream_t stream, bconbuf_t bb,
+			       Rconnection con,
+			       R_pstream_format_t type, int version,
+			       SEXP (*phook)(SEXP, SEXP), SEXP pdata)
+{
+    bb->count = 0;
+    bb->con = con;
+    R_InitOutPStream(stream, (R_pstream_data_t) bb, type, version,
+		     OutCharBB, OutBytesBB, phook, pdata);
+}
+
+/* Binary output to connections goes through a buffer of fixed size, so
+   the connection gets a few large writes rather than one per item;
+   flush_bcon_buffer must be called at the end */
+static void InitConnOutPStreamBuffered(R_outpstream_t stream, bconbuf_t bb,
+				       Rconnection con,
+				       R_pstream_format_t type, int version,
+				       SEXP (*phook)(SEXP, SEXP), SEXP pdata)
+{
+    R_InitConnOutPStream(stream, con, type, version, phook, pdata);
+    bb->count = 0;
+    bb->con = con;
+    if (type != R_pstream_ascii_format && type != R_pstream_asciihex_format)
+	InitBConOutPStream(stream, bb, con, type, version, phook, pdata);
+}
+
+
 /* ought to quote the argument, but it should only be an ENVSXP or STRSXP */
 static SEXP CallHook(SEXP x, SEXP fun)
 {
@@ -2169,13 +2644,14 @@ static void con_cleanup(void *data)
 SEXP attribute_hidden
 do_serializeToConn(SEXP call, SEXP op, SEXP args, SEXP env)
 {
-    /* serializeToConn(object, conn, ascii, version, hook) */
+    /* serializeToConn(object, conn, ascii, version, hook, xdr) */
 
     SEXP object, fun;
     Rboolean ascii, wasopen;
     int version;
     Rconnection con;
-    struct R_outpstream_st out;
+    struct counted_outpstream_st out;
+    struct bconbuf_st bbs;
     R_pstream_format_t type;
     SEXP (*hook)(SEXP, SEXP);
     RCNTXT cntxt;
@@ -2190,6 +2666,8 @@ do_serializeToConn(SEXP call, SEXP op, SEXP args, SEXP env)
     ascii = INTEGER(CADDR(args))[0];
     if (ascii == NA_LOGICAL) type = R_pstream_asciihex_format;
     else if (ascii) type = R_pstream_ascii_format;
+    else if (asLogical(CAR(nthcdr(args, 5))) == FALSE)
+	type = R_pstream_binary_le_format;
     else type = R_pstream_xdr_format;
 
     if (CADDDR(args) == R_NilValue)
@@ -2226,8 +2704,11 @@ do_serializeToConn(SEXP call, SEXP op, SEXP args, SEXP env)
     if(!con->canwrite)
 	error(_("connection not open for writing"));
 
-    R_InitConnOutPStream(&out, con, type, version, hook, fun);
-    R_Serialize(object, &out);
+    InitConnOutPStreamBuffered(&out.stream, &bbs, con, type, version,
+			       hook, fun);
+    CountOutPStream(&out, con->canseek ? con->seek(con, NA_REAL, 1, 2) : 0);
+    R_Serialize(object, &out.stream);
+    flush_bcon_buffer(&bbs);
     if(!wasopen) {endcontext(&cntxt); con->close(con);}
 
     return R_NilValue;
@@ -2239,13 +2720,14 @@ do_serializeToConn(SEXP call, SEXP op, SEXP args, SEXP env)
 SEXP attribute_hidden
 do_unserializeFromConn(SEXP call, SEXP op, SEXP args, SEXP env)
 {
-    /* unserializeFromConn(conn, hook) */
+    /* unserializeFromConn(conn, hook, mmap) */
 
     struct R_inpstream_st in;
     Rconnection con;
     SEXP fun, ans;
     SEXP (*hook)(SEXP, SEXP);
     Rboolean wasopen;
+    int map;
     RCNTXT cntxt;
 
     checkArity(op, args);
@@ -2255,6 +2737,10 @@ do_unserializeFromConn(SEXP call, SEXP op, SEXP args, SEXP env)
     fun = CADR(args);
     hook = fun != R_NilValue ? CallHook : NULL;
 
+    map = asLogical(CADDR(args));
+    if (map == NA_LOGICAL)
+	error(_("invalid '%s' argument"), "mmap");
+
     /* Now we need to do some sanity checking of the arguments.
        A filename will already have been opened, so anything
        not open was specified as a connection directly.
@@ -2275,6 +2761,10 @@ do_unserializeFromConn(SEXP call, SEXP op, SEXP args, SEXP env)
     if(!con->canread) error(_("connection not open for reading"));
 
     R_InitConnInPStream(&in, con, R_pstream_any_format, hook, fun);
+    /* only uncompressed files can be mapped */
+    if (map && streql(con->class, "file") && con->canseek && !con->text
+	&& con->description[0])
+	in.InBytes = InBytesConnMmap;
     PROTECT(ans = R_Unserialize(&in)); /* paranoia about next line */
     if(!wasopen) {endcontext(&cntxt); con->close(con);}
     UNPROTECT(1);
@@ -2282,60 +2772,6 @@ do_unserializeFromConn(SEXP call, SEXP op, SEXP args, SEXP env)
 }
 
 
-/*
- * Persistent Buffered Binary Connection Streams
- */
-
-/**** should eventually come from a public header file */
-size_t R_WriteConnection(Rconnection con, void *buf, size_t n);
-
-#define BCONBUFSIZ 4096
-
-typedef struct bconbuf_st {
-    Rconnection con;
-    int count;
-    unsigned char buf[BCONBUFSIZ];
-} *bconbuf_t;
-
-static void flush_bcon_buffer(bconbuf_t bb)
-{
-    if (R_WriteConnection(bb->con, bb->buf, bb->count) != bb->count)
-	error(_("error writing to connection"));
-    bb->count = 0;
-}
-
-static void OutCharBB(R_outpstream_t stream, int c)
-{
-    bconbuf_t bb = stream->data;
-    if (bb->count >= BCONBUFSIZ)
-	flush_bcon_buffer(bb);
-    bb->buf[bb->count++] = (char) c;
-}
-
-static void OutBytesBB(R_outpstream_t stream, void *buf, int length)
-{
-    bconbuf_t bb = stream->data;
-    if (bb->count + length > BCONBUFSIZ)
-	flush_bcon_buffer(bb);
-    if (length <= BCONBUFSIZ) {
-	memcpy(bb->buf + bb->count, buf, length);
-	bb->count += length;
-    }
-    else if (R_WriteConnection(bb->con, buf, length) != length)
-	error(_("error writing to connection"));
-}
-
-static void InitBConOutPStream(R_outpstream_t stream, bconbuf_t bb,
-			       Rconnection con,
-			       R_pstream_format_t type, int version,
-			       SEXP (*phook)(SEXP, SEXP), SEXP pdata)
-{
-    bb->count = 0;
-    bb->con = con;
-    R_InitOutPStream(stream, (R_pstream_data_t) bb, type, version,
-		     OutCharBB, OutBytesBB, phook, pdata);
-}
-
 /* only for use by serialize(), with binary write to a socket connection */
 static SEXP
 R_serializeb(SEXP object, SEXP icon, SEXP xdr, SEXP Sversion, SEXP fun)
@@ -2355,7 +2791,8 @@ R_serializeb(SEXP object, SEXP icon, SEXP xdr, SEXP Sversion, SEXP fun)
     hook = fun != R_NilValue ? CallHook : NULL;
 
     InitBConOutPStream(&out, &bbs, con,
-		       asLogical(xdr) ? R_pstream_xdr_format : R_pstream_binary_format,
+		       asLogical(xdr) ? R_pstream_xdr_format :
+		       R_pstream_binary_format,
 		       version, hook, fun);
     R_Serialize(object, &out);
     flush_bcon_buffer(&bbs);
@@ -2487,10 +2924,57 @@ static SEXP CloseMemOutPStream(R_outpstream_t stream)
     return val;
 }
 
+/* A sizing pass serializes to a counted stream which discards the
+   output: binary serialization to a raw vector does this first, and
+   then writes into the result directly, so it never holds the
+   serialization twice or grows a buffer.  It is not used with a hook,
+   which might not give the same results twice. */
+
+static void OutCharNull(R_outpstream_t stream, int c) {}
+
+static void OutBytesNull(R_outpstream_t stream, void *buf, int length) {}
+
+static void OutBytesFixed(R_outpstream_t stream, void *buf, int length)
+{
+    membuf_t mb = stream->data;
+    if (mb->count + (R_size_t) length > mb->size)
+	error(_("serialization changed size"));
+    memcpy(mb->buf + mb->count, buf, length);
+    mb->count += length;
+}
+
+static SEXP R_serializeSized(SEXP object, R_pstream_format_t type,
+			     int version)
+{
+    struct counted_outpstream_st out;
+    struct membuf_st mbs;
+    SEXP val;
+
+    R_InitOutPStream(&out.stream, NULL, type, version,
+		     OutCharNull, OutBytesNull, NULL, R_NilValue);
+    CountOutPStream(&out, 0);
+    R_Serialize(object, &out.stream);
+    if (out.count > R_XLEN_T_MAX)
+	error(_("serialization is too large to store in a raw vector"));
+
+    PROTECT(val = allocVector(RAWSXP, (R_xlen_t) out.count));
+    mbs.count = 0;
+    mbs.size = (R_size_t) out.count;
+    mbs.buf = RAW(val);
+    R_InitOutPStream(&out.stream, (R_pstream_data_t) &mbs, type, version,
+		     OutCharNull, OutBytesFixed, NULL, R_NilValue);
+    CountOutPStream(&out, 0);
+    R_Serialize(object, &out.stream);
+    if (mbs.count != mbs.size)
+	error(_("serialization changed size"));
+    UNPROTECT(1);
+    return val;
+}
+
 static SEXP
 R_serialize(SEXP object, SEXP icon, SEXP ascii, SEXP Sversion, SEXP fun)
 {
-    struct R_outpstream_st out;
+    struct counted_outpstream_st out;
     R_pstream_format_t type;
     SEXP (*hook)(SEXP, SEXP);
     int version;
@@ -2512,7 +2996,10 @@ R_serialize(SEXP object, SEXP icon, SEXP ascii, SEXP Sversion, SEXP fun)
     default: type = R_pstream_xdr_format; break;
     }
 
-    if (icon == R_NilValue) {
+    if (icon == R_NilValue && hook == NULL &&
+	(type == R_pstream_xdr_format || type == R_pstream_binary_format))
+	return R_serializeSized(object, type, version);
+    else if (icon == R_NilValue) {
 	RCNTXT cntxt;
 	struct membuf_st mbs;
 	SEXP val;
@@ -2523,10 +3010,11 @@ R_serialize(SEXP object, SEXP icon, SEXP ascii, SEXP Sversion, SEXP fun)
 	cntxt.cend = &free_mem_buffer;
 	cntxt.cenddata = &mbs;
 
-	InitMemOutPStream(&out, &mbs, type, version, hook, fun);
-	R_Serialize(object, &out);
+	InitMemOutPStream(&out.stream, &mbs, type, version, hook, fun);
+	CountOutPStream(&out, 0);
+	R_Serialize(object, &out.stream);
 
-	PROTECT(val = CloseMemOutPStream(&out));
+	PROTECT(val = CloseMemOutPStream(&out.stream));
 
 	/* end the context after anything that could raise an error but before
 	   calling OutTerm so it doesn't get called twice */
@@ -2537,8 +3025,11 @@ R_serialize(SEXP object, SEXP icon, SEXP ascii, SEXP Sversion, SEXP fun)
     }
     else {
 	Rconnection con = getConnection(asInteger(icon));
-	R_InitConnOutPStream(&out, con, type, 0, hook, fun);
-	R_Serialize(object, &out);
+	struct bconbuf_st bbs;
+	InitConnOutPStreamBuffered(&out.stream, &bbs, con, type, 0, hook, fun);
+	CountOutPStream(&out, con->canseek ? con->seek(con, NA_REAL, 1, 2) : 0);
+	R_Serialize(object, &out.stream);
+	flush_bcon_buffer(&bbs);
 	return R_NilValue;
     }
 }
@@ -2581,11 +3072,27 @@ SEXP attribute_hidden R_unserialize(SEXP icon, SEXP fun)
    Returns an integer vector of the initial offset of the string in
    the file and the length of the vector. */
 
+#ifdef Win32
+# define f_seek fseeko64
+# define f_tell ftello64
+# define OFF_T off64_t
+#elif defined(HAVE_OFF_T) && defined(HAVE_FSEEKO)
+# define f_seek fseeko
+# define f_tell ftello
+# define OFF_T off_t
+#else
+# define f_seek fseek
+# define f_tell ftell
+# define OFF_T long
+#endif
+
+/* Keys are integer vectors unless the position needs more than an int
+   (as in indexed save() files over 2GB), when they are doubles */
 static SEXP appendRawToFile(SEXP file, SEXP bytes)
 {
     FILE *fp;
     size_t len, out;
-    long pos;  // what ftell gives: won't work for > 2GB files
+    OFF_T pos;
     SEXP val;
 
     if (! IS_PROPER_STRING(file))
@@ -2603,29 +3110,113 @@ static SEXP appendRawToFile(SEXP file, SEXP bytes)
 	error( _("cannot open file '%s': %s"), CHAR(STRING_ELT(file, 0)),
 	       strerror(errno));
     }
-    fseek(fp, 0, SEEK_END);
+    f_seek(fp, 0, SEEK_END);
 #endif
 
     len = LENGTH(bytes);
-    pos = ftell(fp);
+    pos = f_tell(fp);
     out = fwrite(RAW(bytes), 1, len, fp);
     fclose(fp);
 
     if (out != len) error(_("write failed"));
     if (pos == -1) error(_("could not determine file position"));
 
-    val = allocVector(INTSXP, 2);
-    INTEGER(val)[0] = (int) pos;
-    INTEGER(val)[1] = (int) len;
+    if (pos > INT_MAX) {
+	val = allocVector(REALSXP, 2);
+	REAL(val)[0] = (double) pos;
+	REAL(val)[1] = (double) len;
+    } else {
+	val = allocVector(INTSXP, 2);
+	INTEGER(val)[0] = (int) pos;
+	INTEGER(val)[1] = (int) len;
+    }
     return val;
 }
 
-/* Interface to cache the pkg.rdb files */
+/* Interface to cache the pkg.rdb files.  Where mmap() is available
+   the files are mapped whatever their size, so only the pages used are
+   read and they are shared with other processes using the same file,
+   including forked children.  Files of up to PREFETCH_LIMIT bytes are
+   prefetched when mapped, as a package's database is mostly needed once
+   it is loaded.  Each fetch checks that the file has not been replaced
+   or rewritten (as by makeLazyLoadDB) since it was mapped, and maps it
+   again if it has.  Elsewhere files of less than LEN_LIMIT bytes are
+   read into memory. */
+
+#if defined(HAVE_MMAP) && !defined(Win32)
+# define LAZYLOAD_MMAP
+# include <fcntl.h>
+# include <unistd.h>
+# include <sys/mman.h>
+# include <sys/stat.h>
+# define PREFETCH_LIMIT 16*1048576
+#endif
 
 #define NC 100
 static int used = 0;
 static char names[NC][PATH_MAX];
 static char *ptr[NC];
+#ifdef LAZYLOAD_MMAP
+static size_t maplen[NC];
+static struct stat mapstat[NC];
+
+static void unmapDBfile(int i)
+{
+    if (ptr[i] != NULL) munmap(ptr[i], maplen[i]);
+    ptr[i] = NULL;
+    strcpy(names[i], "");
+}
+
+static Rboolean sameDBfile(struct stat *a, struct stat *b)
+{
+    return a->st_dev == b->st_dev && a->st_ino == b->st_ino &&
+	a->st_size == b->st_size && a->st_mtime == b->st_mtime;
+}
+
+/* Copy len bytes at offset in cfile to dest from its mapping, mapping
+   it first if need be.  FALSE if it cannot be mapped. */
+static Rboolean readRawMapped(const char *cfile, OFF_T offset, int len,
+			      Rbyte *dest)
+{
+    struct stat sb;
+    int i, icache = -1;
+
+    if (strlen(cfile) >= PATH_MAX || stat(cfile, &sb) != 0)
+	return FALSE;
+    for (i = 0; i < used; i++)
+	if (strcmp(cfile, names[i]) == 0) {icache = i; break;}
+    if (icache >= 0 && !sameDBfile(&sb, &mapstat[icache]))
+	unmapDBfile(icache);
+    else if (icache < 0) {
+	for (i = 0; i < used; i++)
+	    if (strcmp("", names[i]) == 0) {icache = i; break;}
+	if (icache < 0 && used < NC) icache = used++;
+	if (icache < 0) return FALSE;
+    }
+    if (strcmp(cfile, names[icache]) != 0) {
+	char *p = NULL;
+	if (sb.st_size > 0) {
+	    int fd = open(cfile, O_RDONLY);
+	    if (fd < 0) return FALSE;
+	    p = mmap(NULL, (size_t) sb.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	    close(fd);
+	    if (p == MAP_FAILED) return FALSE;
+# ifdef MADV_WILLNEED
+	    if (sb.st_size <= PREFETCH_LIMIT)
+		madvise(p, (size_t) sb.st_size, MADV_WILLNEED);
+# endif
+	}
+	strcpy(names[icache], cfile);
+	ptr[icache] = p;
+	maplen[icache] = (size_t) sb.st_size;
+	mapstat[icache] = sb;
+    }
+    if ((double) offset + len > (double) maplen[icache])
+	error(_("read failed on %s"), cfile);
+    if (len > 0) memcpy(dest, ptr[icache] + offset, len);
+    return TRUE;
+}
+#endif
 
 SEXP attribute_hidden
 do_lazyLoadDBflush(SEXP call, SEXP op, SEXP args, SEXP env)
@@ -2638,8 +3229,12 @@ do_lazyLoadDBflush(SEXP call, SEXP op, SEXP args, SEXP env)
     /* fprintf(stderr, "flushing file %s", cfile); */
     for (i = 0; i < used; i++)
 	if(strcmp(cfile, names[i]) == 0) {
+#ifdef LAZYLOAD_MMAP
+	    unmapDBfile(i);
+#else
 	    strcpy(names[i], "");
 	    free(ptr[i]);
+#endif
 	    /* fprintf(stderr, " found at pos %d in cache", i); */
 	    break;
 	}
@@ -2656,20 +3251,33 @@ do_lazyLoadDBflush(SEXP call, SEXP op, SEXP args, SEXP env)
 static SEXP readRawFromFile(SEXP file, SEXP key)
 {
     FILE *fp;
-    int offset, len, in, i, icache = -1;
-    long filelen;
+    OFF_T offset;
+    int len, in;
     SEXP val;
     const char *cfile = CHAR(STRING_ELT(file, 0));
 
     if (! IS_PROPER_STRING(file))
 	error(_("not a proper file name"));
-    if (TYPEOF(key) != INTSXP || LENGTH(key) != 2)
+    if (TYPEOF(key) == INTSXP && LENGTH(key) == 2) {
+	offset = INTEGER(key)[0];
+	len = INTEGER(key)[1];
+    } else if (TYPEOF(key) == REALSXP && LENGTH(key) == 2 &&
+	       R_FINITE(REAL(key)[0]) && REAL(key)[1] <= INT_MAX) {
+	offset = (OFF_T) REAL(key)[0];
+	len = (int) REAL(key)[1];
+    } else
+	error(_("bad offset/length argument"));
+    if (offset < 0 || len < 0)
 	error(_("bad offset/length argument"));
-
-    offset = INTEGER(key)[0];
-    len = INTEGER(key)[1];
 
     val = allocVector(RAWSXP, len);
+#ifdef LAZYLOAD_MMAP
+    if (readRawMapped(cfile, offset, len, RAW(val)))
+	return val;
+#else
+    OFF_T filelen;
+    int i, icache = -1;
+
     /* Do we have this database cached? */
     for (i = 0; i < used; i++)
 	if(strcmp(cfile, names[i]) == 0) {icache = i; break;}
@@ -2686,29 +3294,29 @@ static SEXP readRawFromFile(SEXP file, SEXP key)
     if(icache >= 0) {
 	if ((fp = R_fopen(cfile, "rb")) == NULL)
 	    error(_("cannot open file '%s': %s"), cfile, strerror(errno));
-	if (fseek(fp, 0, SEEK_END) != 0) {
+	if (f_seek(fp, 0, SEEK_END) != 0) {
 	    fclose(fp);
 	    error(_("seek failed on %s"), cfile);
 	}
-	filelen = ftell(fp);
+	filelen = f_tell(fp);
 	if (filelen < LEN_LIMIT) {
 	    char *p;
 	    /* fprintf(stderr, "adding file '%s' at pos %d in cache, length %d\n",
 	       cfile, icache, filelen); */
-	    p = (char *) malloc(filelen);
+	    p = (char *) malloc((size_t) filelen);
 	    if (p) {
 		strcpy(names[icache], cfile);
 		ptr[icache] = p;
-		if (fseek(fp, 0, SEEK_SET) != 0) {
+		if (f_seek(fp, 0, SEEK_SET) != 0) {
 		    fclose(fp);
 		    error(_("seek failed on %s"), cfile);
 		}
-		in = (int) fread(p, 1, filelen, fp);
+		in = (int) fread(p, 1, (size_t) filelen, fp);
 		fclose(fp);
 		if (filelen != in) error(_("read failed on %s"), cfile);
 		memcpy(RAW(val), p+offset, len);
 	    } else {
-		if (fseek(fp, offset, SEEK_SET) != 0) {
+		if (f_seek(fp, offset, SEEK_SET) != 0) {
 		    fclose(fp);
 		    error(_("seek failed on %s"), cfile);
 		}
@@ -2718,7 +3326,7 @@ static SEXP readRawFromFile(SEXP file, SEXP key)
 	    }
 	    return val;
 	} else {
-	    if (fseek(fp, offset, SEEK_SET) != 0) {
+	    if (f_seek(fp, offset, SEEK_SET) != 0) {
 		fclose(fp);
 		error(_("seek failed on %s"), cfile);
 	    }
@@ -2728,10 +3336,11 @@ static SEXP readRawFromFile(SEXP file, SEXP key)
 	    return val;
 	}
     }
+#endif
 
     if ((fp = R_fopen(cfile, "rb")) == NULL)
 	error(_("cannot open file '%s': %s"), cfile, strerror(errno));
-    if (fseek(fp, offset, SEEK_SET) != 0) {
+    if (f_seek(fp, offset, SEEK_SET) != 0) {
 	fclose(fp);
 	error(_("seek failed on %s"), cfile);
     }
@@ -2795,6 +3404,8 @@ SEXP R_compress2(SEXP in);
 SEXP R_decompress2(SEXP in, Rboolean *err);
 SEXP R_compress3(SEXP in);
 SEXP R_decompress3(SEXP in, Rboolean *err);
+SEXP R_compress4(SEXP in);
+SEXP R_compress5(SEXP in);
 
 /* Serializes and, optionally, compresses a value and appends the
    result to a file.  Returns the key position/length key for
@@ -2810,7 +3421,11 @@ R_lazyLoadDBinsertValue(SEXP value, SEXP file, SEXP ascii,
 
     value = R_serialize(value, R_NilValue, ascii, R_NilValue, hook);
     PROTECT_WITH_INDEX(value, &vpi);
-    if (compress == 3)
+    if (compress == 5)
+	REPROTECT(value = R_compress5(value), vpi);
+    else if (compress == 4)
+	REPROTECT(value = R_compress4(value), vpi);
+    else if (compress == 3)
 	REPROTECT(value = R_compress3(value), vpi);
     else if (compress == 2)
 	REPROTECT(value = R_compress2(value), vpi);
@@ -2842,7 +3457,8 @@ do_lazyLoadDBfetch(SEXP call, SEXP op, SEXP args, SEXP env)
     compressed = asInteger(compsxp);
 
     PROTECT_WITH_INDEX(val = readRawFromFile(file, key), &vpi);
-    if (compressed == 3)
+    /* the zstd and lz4 formats are handled by R_decompress3 */
+    if (compressed >= 3)
 	REPROTECT(val = R_decompress3(val, &err), vpi);
     else if (compressed == 2)
 	REPROTECT(val = R_decompress2(val, &err), vpi);
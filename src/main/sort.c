@@ -80,6 +80,38 @@ static int scmp(SEXP x, SEXP y, Rboolean nalast)
     return Scollate(x, y);
 }
 
+/* The sortedness recorded for x by sort() (see SORTED in Defn.h), or
+   UNKNOWN_SORTEDNESS for types which never have it.  Strings are not
+   recorded, as their order depends on the collation of the locale. */
+int R_KnownSorted(SEXP x)
+{
+    switch (TYPEOF(x)) {
+    case LGLSXP:
+    case INTSXP:
+    case REALSXP:
+	return SORTED(x);
+    default:
+	return UNKNOWN_SORTEDNESS;
+    }
+}
+
+/* Whether x, of known sortedness 'sorted', has NAs: they are all at one
+   end, so only that element need be looked at. */
+Rboolean R_SortedAnyNA(SEXP x, int sorted)
+{
+    R_xlen_t n = XLENGTH(x), i = KNOWN_NA_1ST(sorted) ? 0 : n - 1;
+    if (n == 0) return FALSE;
+    switch (TYPEOF(x)) {
+    case LGLSXP:
+    case INTSXP:
+	return INTEGER(x)[i] == NA_INTEGER;
+    case REALSXP:
+	return ISNAN(REAL(x)[i]);
+    default:
+	return TRUE;
+    }
+}
+
 Rboolean isUnsorted(SEXP x, Rboolean strictly)
 {
     R_xlen_t n, i;
@@ -87,6 +119,16 @@ Rboolean isUnsorted(SEXP x, Rboolean strictly)
     if (!isVectorAtomic(x))
 	error(_("only atomic vectors can be tested to be sorted"));
     n = XLENGTH(x);
+    int sorted = R_KnownSorted(x);
+    if (n >= 2 && sorted != UNKNOWN_SORTEDNESS && !R_SortedAnyNA(x, sorted)) {
+	/* an increasing vector is sorted, unless strictly and with ties;
+	   a decreasing one is not, unless all its elements are equal */
+	if (KNOWN_INCR(sorted) && !strictly)
+	    return FALSE;
+	if (KNOWN_DECR(sorted))
+	    return TYPEOF(x) == REALSXP ? REAL(x)[0] > REAL(x)[n - 1] || strictly
+		: INTEGER(x)[0] > INTEGER(x)[n - 1] || strictly;
+    }
     if(n >= 2)
 	switch (TYPEOF(x)) {
 
@@ -190,6 +232,51 @@ SEXP attribute_hidden do_isunsorted(SEXP call, SEXP op, SEXP args, SEXP rho)
     return ScalarLogical(NA_LOGICAL);
 }
 
+/* .Internal(setSorted(x, decreasing, na.last)): record that x is sorted,
+   as sort(x, decreasing, na.last) leaves it. */
+SEXP attribute_hidden do_setsorted(SEXP call, SEXP op, SEXP args, SEXP rho)
+{
+    checkArity(op, args);
+    SEXP x = CAR(args);
+    int decreasing = asLogical(CADR(args)), nalast = asLogical(CADDR(args));
+    if(decreasing == NA_LOGICAL)
+	error(_("'decreasing' must be TRUE or FALSE"));
+    switch (TYPEOF(x)) {
+    case LGLSXP:
+    case INTSXP:
+    case REALSXP:
+	if (OBJECT(x))
+	    break;
+	MARK_NOT_MUTABLE(x);
+	if (nalast == FALSE)
+	    SET_SORTED(x, decreasing ? SORTED_DECR_NA_1ST : SORTED_INCR_NA_1ST);
+	else
+	    SET_SORTED(x, decreasing ? SORTED_DECR : SORTED_INCR);
+	break;
+    default:
+	break;
+    }
+    return x;
+}
+
+/* .Internal(isKnownSorted(x, decreasing, na.last)): is x known to be
+   what sort(x, decreasing, na.last) would give? */
+SEXP attribute_hidden do_isknownsorted(SEXP call, SEXP op, SEXP args,
+				       SEXP rho)
+{
+    checkArity(op, args);
+    SEXP x = CAR(args);
+    int decreasing = asLogical(CADR(args)), nalast = asLogical(CADDR(args));
+    int sorted = R_KnownSorted(x);
+    if (sorted == UNKNOWN_SORTEDNESS || OBJECT(x) ||
+	(decreasing == TRUE ? !KNOWN_DECR(sorted) : !KNOWN_INCR(sorted)))
+	return ScalarLogical(FALSE);
+    if (R_SortedAnyNA(x, sorted) &&
+	(nalast == NA_LOGICAL || nalast == KNOWN_NA_1ST(sorted)))
+	return ScalarLogical(FALSE);
+    return ScalarLogical(TRUE);
+}
+
 
 			/*--- Part II: Complete (non-partial) Sorting ---*/
 
@@ -478,13 +565,39 @@ void sortVector(SEXP s, Rboolean decreasing)
 
    NOTA BENE:  k < n  required, and *not* checked here but in do_psort();
 	       -----  infinite loop possible otherwise!
+
+   This is an introselect: quickselect with the median of x[L], x[k] and
+   x[R] as the pivot, finishing with a Shellsort of what is left should
+   that take more than about 2 log2(n) rounds, so the worst case is not
+   quadratic.
  */
 #define psort_body						\
     Rboolean nalast=TRUE;					\
-    R_xlen_t L, R, i, j;					\
+    R_xlen_t L, R, i, j, h, t;					\
+    int rounds = 8;						\
 								\
+    for (h = hi - lo + 1; h > 1; h /= 2) rounds += 2;		\
     for (L = lo, R = hi; L < R; ) {				\
+	if (--rounds < 0) {					\
+	    x += L;						\
+	    R -= L;						\
+	    for (t = 0; incs[t] > R; t++);			\
+	    for (h = incs[t]; t < NI; h = incs[++t])		\
+		for (i = h; i <= R; i++) {			\
+		    v = x[i];					\
+		    j = i;					\
+		    while (j >= h && TYPE_CMP(x[j - h], v, nalast) > 0)	\
+			{ x[j] = x[j - h]; j -= h; }		\
+		    x[j] = v;					\
+		}						\
+	    break;						\
+	}							\
 	v = x[k];						\
+	if (TYPE_CMP(x[L], x[R], nalast) > 0) {			\
+	    w = x[L]; x[L] = x[R]; x[R] = w;			\
+	}							\
+	if (TYPE_CMP(v, x[L], nalast) < 0) v = x[L];		\
+	else if (TYPE_CMP(x[R], v, nalast) < 0) v = x[R];	\
 	for(i = L, j = R; i <= j;) {				\
 	    while (TYPE_CMP(x[i], v, nalast) < 0) i++;		\
 	    while (TYPE_CMP(v, x[j], nalast) < 0) j--;		\
@@ -528,6 +641,108 @@ static void sPsort2(SEXP *x, R_xlen_t lo, R_xlen_t hi, R_xlen_t k)
 #undef TYPE_CMP
 }
 
+/* Ranges of R_PSORT_THREADS_MIN or more integers or doubles are
+   partitioned on R_num_math_threads threads: each thread counts the
+   elements of its block below, equal to and above the pivot, and then
+   copies them to their places in a buffer, which is copied back.  The
+   pivot is the median of nine elements spread over the range.  Once k
+   falls in a range below the threshold, it is finished by the serial
+   introselect above.  Without the memory for the buffer, the whole
+   selection is serial. */
+#define R_PSORT_THREADS_MIN 1000000
+#define R_PSORT_MAX_THREADS 64
+
+static R_INLINE int psort_nthreads(R_xlen_t n)
+{
+#ifdef _OPENMP
+    if (n >= R_PSORT_THREADS_MIN && R_num_math_threads > 1)
+	return R_num_math_threads < R_PSORT_MAX_THREADS ?
+	    R_num_math_threads : R_PSORT_MAX_THREADS;
+#endif
+    return 1;
+}
+
+#define PSORT_BLOCK_FROM(n, nthreads, t) ((n) / (nthreads) * (t))
+#define PSORT_BLOCK_TO(n, nthreads, t)					\
+    ((t) == (nthreads) - 1 ? (n) : PSORT_BLOCK_FROM(n, nthreads, (t) + 1))
+
+#ifdef _OPENMP
+# define PSORT_PARALLEL(NAME, TYPE, TYPE_CMP, SERIAL)			\
+static Rboolean NAME(TYPE *x, R_xlen_t lo, R_xlen_t hi, R_xlen_t k)	\
+{									\
+    int nthreads = psort_nthreads(hi - lo + 1);				\
+    if (nthreads <= 1) return FALSE;					\
+    TYPE *buf = (TYPE *) malloc((hi - lo + 1) * sizeof(TYPE));		\
+    if (buf == NULL) return FALSE;					\
+    R_xlen_t cnt[R_PSORT_MAX_THREADS][3];				\
+    while (hi - lo + 1 >= R_PSORT_THREADS_MIN) {			\
+	R_xlen_t n = hi - lo + 1, less = 0, same = 0;			\
+	TYPE *xl = x + lo, v, smp[9];				\
+	for (int i = 0; i < 9; i++) {					\
+	    int j = i;							\
+	    for (v = xl[n / 9 * i + n / 18];				\
+		 j > 0 && TYPE_CMP(smp[j - 1], v, TRUE) > 0; j--)	\
+		smp[j] = smp[j - 1];					\
+	    smp[j] = v;							\
+	}								\
+	v = smp[4];							\
+	_Pragma("omp parallel for num_threads(nthreads) default(none) \
+		 firstprivate(xl, n, nthreads, v) shared(cnt)")		\
+	for (int t = 0; t < nthreads; t++) {				\
+	    R_xlen_t c[3] = {0, 0, 0};					\
+	    for (R_xlen_t i = PSORT_BLOCK_FROM(n, nthreads, t);	\
+		 i < PSORT_BLOCK_TO(n, nthreads, t); i++)		\
+		c[TYPE_CMP(xl[i], v, TRUE) + 1]++;			\
+	    cnt[t][0] = c[0]; cnt[t][1] = c[1]; cnt[t][2] = c[2];	\
+	}								\
+	for (int t = 0; t < nthreads; t++) {				\
+	    less += cnt[t][0];						\
+	    same += cnt[t][1];						\
+	}								\
+	R_xlen_t pos[3] = {0, less, less + same};			\
+	for (int t = 0; t < nthreads; t++)				\
+	    for (int c = 0; c < 3; c++) {				\
+		R_xlen_t m = cnt[t][c];					\
+		cnt[t][c] = pos[c];					\
+		pos[c] += m;						\
+	    }								\
+	_Pragma("omp parallel for num_threads(nthreads) default(none) \
+		 firstprivate(xl, buf, n, nthreads, v) shared(cnt)")	\
+	for (int t = 0; t < nthreads; t++) {				\
+	    R_xlen_t c[3] = {cnt[t][0], cnt[t][1], cnt[t][2]};		\
+	    for (R_xlen_t i = PSORT_BLOCK_FROM(n, nthreads, t);	\
+		 i < PSORT_BLOCK_TO(n, nthreads, t); i++) {		\
+		TYPE w = xl[i];						\
+		buf[c[TYPE_CMP(w, v, TRUE) + 1]++] = w;			\
+	    }								\
+	}								\
+	_Pragma("omp parallel for num_threads(nthreads) default(none) \
+		 firstprivate(xl, buf, n, nthreads)")			\
+	for (int t = 0; t < nthreads; t++) {				\
+	    R_xlen_t from = PSORT_BLOCK_FROM(n, nthreads, t);		\
+	    memcpy(xl + from, buf + from,				\
+		   (PSORT_BLOCK_TO(n, nthreads, t) - from) * sizeof(TYPE)); \
+	}								\
+	if (k < lo + less) hi = lo + less - 1;				\
+	else if (k >= lo + less + same) lo += less + same;		\
+	else { lo = hi = k; break; }					\
+    }									\
+    free(buf);								\
+    if (lo < hi) SERIAL(x, lo, hi, k);					\
+    return TRUE;							\
+}
+#else
+# define PSORT_PARALLEL(NAME, TYPE, TYPE_CMP, SERIAL)			\
+static R_INLINE Rboolean NAME(TYPE *x, R_xlen_t lo, R_xlen_t hi,	\
+			      R_xlen_t k)				\
+{									\
+    return FALSE;							\
+}
+#endif
+
+PSORT_PARALLEL(iPsort_par, int, icmp, iPsort2)
+PSORT_PARALLEL(rPsort_par, double, rcmp, rPsort2)
+
 
 /* Needed for mistaken decision to put these in the API */
 void iPsort(int *x, int n, int k)
@@ -552,10 +767,12 @@ static void Psort(SEXP x, R_xlen_t lo, R_xlen_t hi, R_xlen_t k)
     switch (TYPEOF(x)) {
     case LGLSXP:
     case INTSXP:
-	iPsort2(INTEGER(x), lo, hi, k);
+	if (!iPsort_par(INTEGER(x), lo, hi, k))
+	    iPsort2(INTEGER(x), lo, hi, k);
 	break;
     case REALSXP:
-	rPsort2(REAL(x), lo, hi, k);
+	if (!rPsort_par(REAL(x), lo, hi, k))
+	    rPsort2(REAL(x), lo, hi, k);
 	break;
     case CPLXSXP:
 	cPsort2(COMPLEX(x), lo, hi, k);
@@ -1,7 +1,7 @@
 /*
  *  R : A Computer Langage for Statistical Data Analysis
  *  Copyright (C) 1995, 1996  Robert Gentleman and Ross Ihaka
- *  Copyright (C) 2006-2015 The R Core Team
+ *  Copyright (C) 2006-2017 The R Core Team
  *
  *  This program is free software; you can redistribute it and/or modify
  *  it under the terms of the GNU General Public License as published by
@@ -28,7 +28,7 @@
 
 SEXP attribute_hidden do_split(SEXP call, SEXP op, SEXP args, SEXP env)
 {
-    SEXP x, f, counts, vec, nm, nmj;
+    SEXP x, f, vec, nm;
     Rboolean have_names;
 
     checkArity(op, args);
@@ -48,65 +48,89 @@ SEXP attribute_hidden do_split(SEXP call, SEXP op, SEXP args, SEXP env)
 	warning(_("data length is not a multiple of split variable"));
     nm = getAttrib(x, R_NamesSymbol);
     have_names = nm != R_NilValue;
-    PROTECT(counts = allocVector(INTSXP, nlevs));
-    for (int i = 0; i < nlevs; i++) INTEGER(counts)[i] = 0;
+    const int *pf = INTEGER(f);
+    /* the group sizes, and then the positions reached in each group */
+    R_xlen_t *pos = (R_xlen_t *) R_alloc(nlevs, sizeof(R_xlen_t));
+    for (int j = 0; j < nlevs; j++) pos[j] = 0;
     R_xlen_t i, i1;
     MOD_ITERATE1(nobs, nfac, i, i1, {
-	int j = INTEGER(f)[i1];
+	int j = pf[i1];
 	if (j != NA_INTEGER) {
 	    /* protect against malformed factors */
 	    if (j > nlevs || j < 1) error(_("factor has bad level"));
-	    INTEGER(counts)[j - 1]++;
+	    pos[j - 1]++;
 	}
     });
     /* Allocate a generic vector to hold the results. */
     /* The i-th element will hold the split-out data */
     /* for the ith group. */
     PROTECT(vec = allocVector(VECSXP, nlevs));
-    for (R_xlen_t i = 0;  i < nlevs; i++) {
-	SET_VECTOR_ELT(vec, i, allocVector(TYPEOF(x), INTEGER(counts)[i]));
-	setAttrib(VECTOR_ELT(vec, i), R_LevelsSymbol,
-		  getAttrib(x, R_LevelsSymbol));
+    SEXP levs = getAttrib(x, R_LevelsSymbol);
+    for (int j = 0;  j < nlevs; j++) {
+	SET_VECTOR_ELT(vec, j, allocVector(TYPEOF(x), pos[j]));
+	setAttrib(VECTOR_ELT(vec, j), R_LevelsSymbol, levs);
 	if(have_names)
-	    setAttrib(VECTOR_ELT(vec, i), R_NamesSymbol,
-		      allocVector(STRSXP, INTEGER(counts)[i]));
+	    setAttrib(VECTOR_ELT(vec, j), R_NamesSymbol,
+		      allocVector(STRSXP, pos[j]));
     }
-    for (int i = 0; i < nlevs; i++) INTEGER(counts)[i] = 0;
-    MOD_ITERATE1(nobs, nfac, i, i1, {
-	int j = INTEGER(f)[i1];
-	if (j != NA_INTEGER) {
-	    int k = INTEGER(counts)[j - 1];
-	    switch (TYPEOF(x)) {
-	    case LGLSXP:
-	    case INTSXP:
-		INTEGER(VECTOR_ELT(vec, j - 1))[k] = INTEGER(x)[i];
-		break;
-	    case REALSXP:
-		REAL(VECTOR_ELT(vec, j - 1))[k] = REAL(x)[i];
-		break;
-	    case CPLXSXP:
-		COMPLEX(VECTOR_ELT(vec, j - 1))[k] = COMPLEX(x)[i];
-		break;
-	    case STRSXP:
-		SET_STRING_ELT(VECTOR_ELT(vec, j - 1), k, STRING_ELT(x, i));
-		break;
-	    case VECSXP:
-		SET_VECTOR_ELT(VECTOR_ELT(vec, j - 1), k, VECTOR_ELT(x, i));
-		break;
-	    case RAWSXP:
-		RAW(VECTOR_ELT(vec, j - 1))[k] = RAW(x)[i];
-		break;
-	    default:
-		UNIMPLEMENTED_TYPE("split", x);
-	    }
-	    if(have_names) {
-		nmj = getAttrib(VECTOR_ELT(vec, j - 1), R_NamesSymbol);
-		SET_STRING_ELT(nmj, k, STRING_ELT(nm, i));
-	    }
-	    INTEGER(counts)[j - 1] += 1;
+
+    /* Copy the elements through a pointer into each group, with a
+       loop for each type, rather than looking up the group's vector
+       and switching on the type for every element. */
+#define SPLIT_COPY(ctype, PTR) do {						ctype **p = (ctype **) R_alloc(nlevs, sizeof(ctype *));		const ctype *px = PTR(x);						for (int j = 0; j < nlevs; j++)						    p[j] = PTR(VECTOR_ELT(vec, j));					MOD_ITERATE1(nobs, nfac, i, i1, {					    int j = pf[i1];							    if (j != NA_INTEGER) *(p[j - 1]++) = px[i];				});								    } while (0)
+
+    switch (TYPEOF(x)) {
+    case LGLSXP:
+    case INTSXP:
+	SPLIT_COPY(int, INTEGER);
+	break;
+    case REALSXP:
+	SPLIT_COPY(double, REAL);
+	break;
+    case CPLXSXP:
+	SPLIT_COPY(Rcomplex, COMPLEX);
+	break;
+    case RAWSXP:
+	SPLIT_COPY(Rbyte, RAW);
+	break;
+    case STRSXP:
+	for (int j = 0; j < nlevs; j++) pos[j] = 0;
+	MOD_ITERATE1(nobs, nfac, i, i1, {
+	    int j = pf[i1];
+	    if (j != NA_INTEGER)
+		SET_STRING_ELT(VECTOR_ELT(vec, j - 1), pos[j - 1]++,
+			       STRING_ELT(x, i));
+	});
+	break;
+    case VECSXP:
+	for (int j = 0; j < nlevs; j++) pos[j] = 0;
+	MOD_ITERATE1(nobs, nfac, i, i1, {
+	    int j = pf[i1];
+	    if (j != NA_INTEGER)
+		SET_VECTOR_ELT(VECTOR_ELT(vec, j - 1), pos[j - 1]++,
+			       VECTOR_ELT(x, i));
+	});
+	break;
+    default:
+	MOD_ITERATE1(nobs, nfac, i, i1, {
+	    if (pf[i1] != NA_INTEGER) UNIMPLEMENTED_TYPE("split", x);
+	});
+    }
+#undef SPLIT_COPY
+
+    if(have_names) {
+	SEXP *pnm = (SEXP *) R_alloc(nlevs, sizeof(SEXP));
+	for (int j = 0; j < nlevs; j++) {
+	    pnm[j] = getAttrib(VECTOR_ELT(vec, j), R_NamesSymbol);
+	    pos[j] = 0;
 	}
-    });
+	MOD_ITERATE1(nobs, nfac, i, i1, {
+	    int j = pf[i1];
+	    if (j != NA_INTEGER)
+		SET_STRING_ELT(pnm[j - 1], pos[j - 1]++, STRING_ELT(nm, i));
+	});
+    }
     setAttrib(vec, R_NamesSymbol, getAttrib(f, R_LevelsSymbol));
-    UNPROTECT(2);
+    UNPROTECT(1);
     return vec;
 }
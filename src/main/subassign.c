@@ -106,84 +106,198 @@ static R_INLINE void SET_VECTOR_ELT_NR(SEXP x, R_xlen_t i, SEXP v)
 
 /* EnlargeVector() takes a vector "x" and changes its length to "newlen".
    This allows to assign values "past the end" of the vector or list.
-   Note that, unlike S, we only extend as much as is necessary.
+   Unlike S, the new vector is allocated with some room to spare and
+   marked growable, so that a further enlargement of an unshared vector
+   (as in a loop doing x[length(x) + 1] <- v) happens in place, and the
+   total cost of n such steps is O(n) rather than O(n^2).  The spare
+   room is a fraction of the length, 5% by default or as set by the
+   environment variable R_EXPAND_FRAC (between 1 and 2).
 */
-static SEXP EnlargeVector(SEXP x, R_xlen_t newlen)
+
+static void FillNA(SEXP x, R_xlen_t from, R_xlen_t to)
 {
-    R_xlen_t i, len;
-    SEXP newx, names, newnames;
+    R_xlen_t i;
+    switch(TYPEOF(x)) {
+    case LGLSXP:
+    case INTSXP:
+	for (i = from; i < to; i++)
+	    INTEGER(x)[i] = NA_INTEGER;
+	break;
+    case REALSXP:
+	for (i = from; i < to; i++)
+	    REAL(x)[i] = NA_REAL;
+	break;
+    case CPLXSXP:
+	for (i = from; i < to; i++) {
+	    COMPLEX(x)[i].r = NA_REAL;
+	    COMPLEX(x)[i].i = NA_REAL;
+	}
+	break;
+    case STRSXP:
+	for (i = from; i < to; i++)
+	    SET_STRING_ELT(x, i, NA_STRING); /* was R_BlankString  < 1.6.0 */
+	break;
+    case EXPRSXP:
+    case VECSXP:
+	for (i = from; i < to; i++)
+	    SET_VECTOR_ELT(x, i, R_NilValue);
+	break;
+    case RAWSXP:
+	for (i = from; i < to; i++)
+	    RAW(x)[i] = (Rbyte) 0;
+	break;
+    default:
+	UNIMPLEMENTED_TYPE("EnlargeVector", x);
+    }
+}
 
-    /* Sanity Checks */
-    if (!isVector(x))
-	error(_("attempt to enlarge non-vector"));
+static double expandFrac(void)
+{
+    static double expand = 0;
+    if (expand == 0) {
+	char *p = getenv("R_EXPAND_FRAC");
+	double v = p ? R_atof(p) : 1.05;
+	expand = (v >= 1 && v <= 2) ? v : 1.05;
+    }
+    return expand;
+}
 
-    /* Enlarge the vector itself. */
-    len = xlength(x);
-    if (LOGICAL(GetOption1(install("check.bounds")))[0])
-	warning(_("assignment outside vector/list limits (extending from %d to %d)"),
-		len, newlen);
+/* Grow the data of "x" to "newlen", in place if allowed and there is
+   room, and fill the new elements with NAs.  Attributes are left to the
+   caller. */
+static SEXP GrowVector(SEXP x, R_xlen_t newlen, Rboolean inplace)
+{
+    R_xlen_t i, len = XLENGTH(x), newtruelen;
+    SEXP newx;
+
+    if (inplace && !MAYBE_SHARED(x) && IS_GROWABLE(x) &&
+	XTRUELENGTH(x) >= newlen) {
+	SETLENGTH(x, newlen);
+	FillNA(x, len, newlen);
+	return x;
+    }
+
+    /* Keep short vectors short, as they cannot change in place. */
+    newtruelen = (R_xlen_t) (newlen * expandFrac());
+    if (newlen <= R_LEN_T_MAX && newtruelen > R_LEN_T_MAX)
+	newtruelen = R_LEN_T_MAX;
+    if (newtruelen < newlen)
+	newtruelen = newlen;
     PROTECT(x);
-    PROTECT(newx = allocVector(TYPEOF(x), newlen));
+    PROTECT(newx = allocVector(TYPEOF(x), newtruelen));
 
     /* Copy the elements into place. */
     switch(TYPEOF(x)) {
     case LGLSXP:
     case INTSXP:
-	for (i = 0; i < len; i++)
-	    INTEGER(newx)[i] = INTEGER(x)[i];
-	for (i = len; i < newlen; i++)
-	    INTEGER(newx)[i] = NA_INTEGER;
+	memcpy(INTEGER(newx), INTEGER(x), len * sizeof(int));
 	break;
     case REALSXP:
-	for (i = 0; i < len; i++)
-	    REAL(newx)[i] = REAL(x)[i];
-	for (i = len; i < newlen; i++)
-	    REAL(newx)[i] = NA_REAL;
+	memcpy(REAL(newx), REAL(x), len * sizeof(double));
 	break;
     case CPLXSXP:
-	for (i = 0; i < len; i++)
-	    COMPLEX(newx)[i] = COMPLEX(x)[i];
-	for (i = len; i < newlen; i++) {
-	    COMPLEX(newx)[i].r = NA_REAL;
-	    COMPLEX(newx)[i].i = NA_REAL;
-	}
+	memcpy(COMPLEX(newx), COMPLEX(x), len * sizeof(Rcomplex));
 	break;
     case STRSXP:
 	for (i = 0; i < len; i++)
 	    SET_STRING_ELT(newx, i, STRING_ELT(x, i));
-	for (i = len; i < newlen; i++)
-	    SET_STRING_ELT(newx, i, NA_STRING); /* was R_BlankString  < 1.6.0 */
 	break;
     case EXPRSXP:
     case VECSXP:
 	for (i = 0; i < len; i++)
 	    SET_VECTOR_ELT_NR(newx, i, VECTOR_ELT(x, i));
-	for (i = len; i < newlen; i++)
-	    SET_VECTOR_ELT(newx, i, R_NilValue);
 	break;
     case RAWSXP:
-	for (i = 0; i < len; i++)
-	    RAW(newx)[i] = RAW(x)[i];
-	for (i = len; i < newlen; i++)
-	    RAW(newx)[i] = (Rbyte) 0;
+	memcpy(RAW(newx), RAW(x), len * sizeof(Rbyte));
 	break;
     default:
 	UNIMPLEMENTED_TYPE("EnlargeVector", x);
     }
+    /* The spare elements of a list or character vector are left as
+       allocVector() set them, so the GC can scan them. */
+    FillNA(newx, len, newlen);
+    if (newtruelen > newlen) {
+	SET_GROWABLE_BIT(newx);
+	SET_TRUELENGTH(newx, newtruelen);
+	SETLENGTH(newx, newlen);
+    }
+    UNPROTECT(2);
+    return newx;
+}
+
+/* The names of x, without marking them as getAttrib() does, so that
+   they can be grown in place.  One-dimensional arrays are left to
+   getAttrib(). */
+static SEXP getNames(SEXP x)
+{
+    SEXP attr;
+
+    for (attr = ATTRIB(x); attr != R_NilValue; attr = CDR(attr))
+	if (TAG(attr) == R_DimSymbol)
+	    return getAttrib(x, R_NamesSymbol);
+    for (attr = ATTRIB(x); attr != R_NilValue; attr = CDR(attr))
+	if (TAG(attr) == R_NamesSymbol)
+	    return CAR(attr);
+    return R_NilValue;
+}
+
+static SEXP EnlargeNames(SEXP names, R_xlen_t len, R_xlen_t newlen,
+			 Rboolean inplace)
+{
+    R_xlen_t i;
+    SEXP newnames;
+
+    if (TYPEOF(names) != STRSXP || XLENGTH(names) != len)
+	error(_("bad names attribute"));
+    PROTECT(newnames = GrowVector(names, newlen, inplace));
+    for (i = len; i < newlen; i++)
+	SET_STRING_ELT(newnames, i, R_BlankString);
+    UNPROTECT(1);
+    return newnames;
+}
+
+static SEXP EnlargeVector(SEXP x, R_xlen_t newlen)
+{
+    R_xlen_t len;
+    SEXP newx, names, newnames;
 
-    /* Adjust the attribute list. */
-    names = getAttrib(x, R_NamesSymbol);
+    /* Sanity Checks */
+    if (!isVector(x))
+	error(_("attempt to enlarge non-vector"));
+
+    /* Enlarge the vector itself. */
+    len = xlength(x);
+    if (LOGICAL(GetOption1(install("check.bounds")))[0])
+	warning(_("assignment outside vector/list limits (extending from %d to %d)"),
+		len, newlen);
+    PROTECT(x);
+    names = getNames(x);
+    PROTECT(names);
+
+    /* An array loses its dim and dimnames, so is never grown in place. */
+    newx = GrowVector(x, newlen, getAttrib(x, R_DimSymbol) == R_NilValue);
+    if (newx == x) {
+	if (!isNull(names)) {
+	    PROTECT(newnames = EnlargeNames(names, len, newlen, TRUE));
+	    if (newnames != names)
+		setAttrib(x, R_NamesSymbol, newnames);
+	    UNPROTECT(1);
+	}
+	UNPROTECT(2);
+	return x;
+    }
+    PROTECT(newx);
+
+    /* Adjust the attribute list.  The names stay with x if it is
+       shared. */
     if (!isNull(names)) {
-	PROTECT(newnames = allocVector(STRSXP, newlen));
-	for (i = 0; i < len; i++)
-	    SET_STRING_ELT(newnames, i, STRING_ELT(names, i));
-	for (i = len; i < newlen; i++)
-	    SET_STRING_ELT(newnames, i, R_BlankString);
+	PROTECT(newnames = EnlargeNames(names, len, newlen,
+					!MAYBE_SHARED(x)));
 	setAttrib(newx, R_NamesSymbol, newnames);
 	UNPROTECT(1);
     }
     copyMostAttrib(x, newx);
-    UNPROTECT(2);
+    UNPROTECT(3);
     return newx;
 }
 
@@ -594,6 +708,11 @@ static SEXP VectorAssign(SEXP call, SEXP rho, SEXP x, SEXP s, SEXP y)
     /* case 1013:  logical   <- integer	  */
     case 1313:	/* integer   <- integer	  */
 
+	/* a contiguous range, as x[a:b], is replaced as a block */
+	if (ny == n && (ii = R_contiguousSubscript(indx, nx)) >= 0) {
+	    memcpy(INTEGER(x) + ii, INTEGER(y), n * sizeof(int));
+	    break;
+	}
 	MOD_ITERATE1(n, ny, i, iny, {
 	    ii = gi(indx, i);
 	    if (ii == NA_INTEGER) continue;
@@ -621,6 +740,10 @@ static SEXP VectorAssign(SEXP call, SEXP rho, SEXP x, SEXP s, SEXP y)
     /* case 1314:  integer   <- real	  */
     case 1414:	/* real	     <- real	  */
 
+	if (ny == n && (ii = R_contiguousSubscript(indx, nx)) >= 0) {
+	    memcpy(REAL(x) + ii, REAL(y), n * sizeof(double));
+	    break;
+	}
 	MOD_ITERATE1(n, ny, i, iny, {
 	    ii = gi(indx, i);
 	    if (ii == NA_INTEGER) continue;
@@ -671,6 +794,10 @@ static SEXP VectorAssign(SEXP call, SEXP rho, SEXP x, SEXP s, SEXP y)
     /* case 1415:  real	     <- complex	  */
     case 1515:	/* complex   <- complex	  */
 
+	if (ny == n && (ii = R_contiguousSubscript(indx, nx)) >= 0) {
+	    memcpy(COMPLEX(x) + ii, COMPLEX(y), n * sizeof(Rcomplex));
+	    break;
+	}
 	MOD_ITERATE1(n, ny, i, iny, {
 	    ii = gi(indx, i);
 	    if (ii == NA_INTEGER) continue;
@@ -754,6 +881,10 @@ static SEXP VectorAssign(SEXP call, SEXP rho, SEXP x, SEXP s, SEXP y)
 
     case 2424:	/* raw   <- raw	  */
 
+	if (ny == n && (ii = R_contiguousSubscript(indx, nx)) >= 0) {
+	    memcpy(RAW(x) + ii, RAW(y), n * sizeof(Rbyte));
+	    break;
+	}
 	MOD_ITERATE1(n, ny, i, iny, {
 	    ii = gi(indx, i);
 	    if (ii == NA_INTEGER) continue;
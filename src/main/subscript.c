@@ -489,11 +489,164 @@ static SEXP nullSubscript(R_xlen_t n)
 }
 
 
+/* Kernels for the positions selected by a logical vector, used by
+   logicalSubscript() and which().  'nonzero' selects all non-zero
+   elements, with NA giving an NA position, rather than just the TRUE
+   ones.  Counting is a vectorizable compare-and-add.  The positions
+   are extracted from 64-bit masks of whole words of 64 elements, so
+   runs of unselected elements cost one mask each, and the selected
+   ones are found by counting trailing zeros.  Vectors of
+   R_LGL_THREADS_MIN or more elements are split into one contiguous
+   block per thread, each writing its positions after those of the
+   earlier blocks. */
+#if defined(_OPENMP) && _OPENMP >= 201307
+# define R_DO_PRAGMA(x) _Pragma(#x)
+# define R_OMP_SIMD(...) R_DO_PRAGMA(omp simd __VA_ARGS__)
+#else
+# define R_OMP_SIMD(...)
+#endif
+
+#define R_LGL_THREADS_MIN 1000000
+#define R_LGL_MAX_THREADS 64
+
+static R_INLINE int lgl_nthreads(R_xlen_t n)
+{
+#ifdef _OPENMP
+    if (n >= R_LGL_THREADS_MIN && R_num_math_threads > 1)
+	return R_num_math_threads < R_LGL_MAX_THREADS ?
+	    R_num_math_threads : R_LGL_MAX_THREADS;
+#endif
+    return 1;
+}
+
+#ifdef __GNUC__
+# define LGL_CTZ(m) __builtin_ctzll(m)
+#else
+static R_INLINE int LGL_CTZ(uint64_t m)
+{
+    int k = 0;
+    for (; !(m & 1); m >>= 1) k++;
+    return k;
+}
+#endif
+
+static R_INLINE uint64_t lgl_mask(const int *x, int len, Rboolean nonzero)
+{
+    uint64_t m = 0;
+    if (nonzero)
+	for (int k = 0; k < len; k++) m |= (uint64_t) (x[k] != 0) << k;
+    else
+	for (int k = 0; k < len; k++) m |= (uint64_t) (x[k] == TRUE) << k;
+    return m;
+}
+
+static R_xlen_t lgl_count_block(const int *x, R_xlen_t from, R_xlen_t to,
+				Rboolean nonzero)
+{
+    R_xlen_t count = 0;
+    if (nonzero) {
+	R_OMP_SIMD(reduction(+:count))
+	for (R_xlen_t i = from; i < to; i++) count += x[i] != 0;
+    } else {
+	R_OMP_SIMD(reduction(+:count))
+	for (R_xlen_t i = from; i < to; i++) count += x[i] == TRUE;
+    }
+    return count;
+}
+
+#define LGL_EXTRACT(ans, NA, CAST) do {					\
+	for (R_xlen_t i = from; i < to; i += 64) {			\
+	    uint64_t m = lgl_mask(x + i, to - i < 64 ? (int) (to - i) : 64, \
+				  nonzero);				\
+	    while (m) {							\
+		R_xlen_t j = i + LGL_CTZ(m);				\
+		m &= m - 1;						\
+		ans[count++] = x[j] == NA_LOGICAL ? NA : (CAST) (offset + j + 1); \
+	    }								\
+	}								\
+    } while (0)
+
+static R_xlen_t lgl_which_block(const int *x, R_xlen_t from, R_xlen_t to,
+				R_xlen_t offset, Rboolean nonzero,
+				int *ians, double *dans)
+{
+    R_xlen_t count = 0;
+    if (ians) LGL_EXTRACT(ians, NA_INTEGER, int);
+    else LGL_EXTRACT(dans, NA_REAL, double);
+    return count;
+}
+
+/* number of the selected elements of x[0:(n-1)] */
+R_xlen_t attribute_hidden R_lglCount(const int *x, R_xlen_t n,
+				     Rboolean nonzero)
+{
+#ifdef _OPENMP
+    int nthreads = lgl_nthreads(n);
+    if (nthreads > 1) {
+	R_xlen_t part[R_LGL_MAX_THREADS], count = 0;
+#pragma omp parallel for num_threads(nthreads) default(none) \
+    firstprivate(x, n, nthreads, nonzero) shared(part)
+	for (int t = 0; t < nthreads; t++) {
+	    R_xlen_t from = n / nthreads * t;
+	    R_xlen_t to = t == nthreads - 1 ? n : from + n / nthreads;
+	    part[t] = lgl_count_block(x, from, to, nonzero);
+	}
+	for (int t = 0; t < nthreads; t++) count += part[t];
+	return count;
+    }
+#endif
+    return lgl_count_block(x, 0, n, nonzero);
+}
+
+/* write the 1-based positions, plus 'offset', of the selected elements
+   of x[0:(n-1)] to ians, or to dans if ians is NULL */
+void attribute_hidden R_lglWhich(const int *x, R_xlen_t n, R_xlen_t offset,
+				 Rboolean nonzero, int *ians, double *dans)
+{
+#ifdef _OPENMP
+    int nthreads = lgl_nthreads(n);
+    if (nthreads > 1) {
+	R_xlen_t start[R_LGL_MAX_THREADS], count = 0;
+#pragma omp parallel for num_threads(nthreads) default(none) \
+    firstprivate(x, n, nthreads, nonzero) shared(start)
+	for (int t = 0; t < nthreads; t++) {
+	    R_xlen_t from = n / nthreads * t;
+	    R_xlen_t to = t == nthreads - 1 ? n : from + n / nthreads;
+	    start[t] = lgl_count_block(x, from, to, nonzero);
+	}
+	for (int t = 0; t < nthreads; t++) {
+	    R_xlen_t c = start[t];
+	    start[t] = count;
+	    count += c;
+	}
+#pragma omp parallel for num_threads(nthreads) default(none) \
+    firstprivate(x, n, nthreads, offset, nonzero, ians, dans) shared(start)
+	for (int t = 0; t < nthreads; t++) {
+	    R_xlen_t from = n / nthreads * t;
+	    R_xlen_t to = t == nthreads - 1 ? n : from + n / nthreads;
+	    lgl_which_block(x, from, to, offset, nonzero,
+			    ians ? ians + start[t] : NULL,
+			    dans ? dans + start[t] : NULL);
+	}
+	return;
+    }
+#endif
+    R_xlen_t count = 0;
+    for (R_xlen_t from = 0; from < n; from += NINTERRUPT) {
+	R_xlen_t to = n - from < NINTERRUPT ? n : from + NINTERRUPT;
+	if (from > 0) R_CheckUserInterrupt();
+	count += lgl_which_block(x, from, to, offset, nonzero,
+				 ians ? ians + count : NULL,
+				 dans ? dans + count : NULL);
+    }
+}
+
 static SEXP
 logicalSubscript(SEXP s, R_xlen_t ns, R_xlen_t nx, R_xlen_t *stretch, SEXP call)
 {
-    R_xlen_t count, i, nmax, i1, i2;
-    int canstretch;
+    R_xlen_t count, nmax, nrep, nrem, c1;
+    int canstretch, *ians = NULL;
+    double *dans = NULL;
     SEXP indx;
     canstretch = *stretch > 0;
     if (!canstretch && ns > nx) {
@@ -502,103 +655,44 @@ logicalSubscript(SEXP s, R_xlen_t ns, R_xlen_t nx, R_xlen_t *stretch, SEXP call)
     nmax = (ns > nx) ? ns : nx;
     *stretch = (ns > nx) ? ns : 0;
     if (ns == 0) return(allocVector(INTSXP, 0));
+
+    /* we only need to scan s once even if we recycle: the positions
+       for later recycling chunks are those for the first shifted by
+       the chunk offset, and for the last incomplete chunk (if any) a
+       prefix of them */
+    const int *ps = LOGICAL(s);
+    nrep = nmax / ns;
+    nrem = nmax % ns;
+    c1 = R_lglCount(ps, ns, TRUE);
+    count = c1 * nrep + (nrem > 0 ? R_lglCount(ps, nrem, TRUE) : 0);
 #ifdef LONG_VECTOR_SUPPORT
     if (nmax > R_SHORT_LEN_MAX) {
-	if (ns == nmax) { /* no recycling - use fast single-index code */
-	    const void *vmax = vmaxget();
-	    double *buf = (double *) R_alloc(nmax, sizeof(double));
-	    count = 0;
-	    R_ITERATE_CHECK(NINTERRUPT, nmax, i,                    \
-		if (LOGICAL(s)[i]) {                                \
-		    if (LOGICAL(s)[i] == NA_LOGICAL)		    \
-			buf[count++] = NA_REAL;		    \
-		    else					    \
-			buf[count++] = (double)(i + 1);	    \
-		});
-	    PROTECT(indx = allocVector(REALSXP, count));
-	    memcpy(REAL(indx), buf, sizeof(double) * count);
-	    vmaxset(vmax);
-	    UNPROTECT(1);
-	    return indx;
-	}
-	count = 0;
-	/* we only need to scan s once even if we recycle,
-	   just remember the total count as well as
-	   the count for the last incomplete chunk (if any) */
-	i1 = (ns < nmax) ? (nmax % ns) : 0;
-	if (i1 > 0) { /* last recycling chunk is incomplete -
-			 we have to get the truncated count as well */
-	    R_xlen_t rem = 0;
-	    for (i = 0; i < ns; i++) {
-		if (i == i1) rem = count;
-		if (LOGICAL(s)[i]) count++;
-	    }
-	    count = count * (nmax / ns) + rem;
-	} else { /* nested recycling, total is sufficient */
-	    for (i = 0; i < ns; i++)
-		if (LOGICAL(s)[i]) count++;
-	    count *= nmax / ns;
-	}
 	PROTECT(indx = allocVector(REALSXP, count));
-	count = 0;
-	MOD_ITERATE_CHECK(NINTERRUPT, nmax, ns, nmax, i, i1, i2, \
-	    if (LOGICAL(s)[i1]) {				 \
-		if (LOGICAL(s)[i1] == NA_LOGICAL)		 \
-		    REAL(indx)[count++] = NA_REAL;		 \
-		else						 \
-		    REAL(indx)[count++] = (double)(i + 1);	 \
-	    });
-
-	UNPROTECT(1);
-	return indx;
-    }
+	dans = REAL(indx);
+    } else
 #endif
-// else --- the same code for  non-long vectors --------------------------
-    if (ns == nmax) {  /* no recycling - use fast single-index code */
-	const void *vmax = vmaxget();
-	int *buf = (int *) R_alloc(nmax, sizeof(int));
-	count = 0;
-	R_ITERATE_CHECK(NINTERRUPT, nmax, i,                    \
-	    if (LOGICAL(s)[i]) {                                \
-		if (LOGICAL(s)[i] == NA_LOGICAL)	        \
-		    buf[count++] = NA_INTEGER;		\
-		else                                            \
-		    buf[count++] = (int)(i + 1);		\
-	    });
+    {
 	PROTECT(indx = allocVector(INTSXP, count));
-	memcpy(INTEGER(indx), buf, sizeof(int) * count);
-	vmaxset(vmax);
-	UNPROTECT(1);
-	return indx;
+	ians = INTEGER(indx);
     }
-
-    count = 0;
-    /* we only need to scan s once even if we recycle,
-       just remember the total count as well as
-       the count for the last incomplete chunk (if any) */
-    i1 = (ns < nmax) ? (nmax % ns) : 0;
-    if (i1 > 0) { /* last recycling chunk is incomplete -
-		     we have to get the truncated count as well */
-	R_xlen_t rem = 0;
-	for (i = 0; i < ns; i++) {
-	    if (i == i1) rem = count;
-	    if (LOGICAL(s)[i]) count++;
+    R_lglWhich(ps, ns, 0, TRUE, ians, dans);
+    for (R_xlen_t k = c1, chunk = ns, done = 0; k < count; chunk += ns) {
+	R_xlen_t m = count - k < c1 ? count - k : c1;
+	if (ians) {
+	    int shift = (int) chunk;
+	    for (R_xlen_t j = 0; j < m; j++) {
+		int v = ians[j];
+		ians[k + j] = v == NA_INTEGER ? NA_INTEGER : v + shift;
+	    }
+	} else
+	    for (R_xlen_t j = 0; j < m; j++)
+		dans[k + j] = dans[j] + (double) chunk; /* NA stays NA */
+	k += m;
+	if ((done += ns) >= NINTERRUPT) {
+	    R_CheckUserInterrupt();
+	    done = 0;
 	}
-	count = count * (nmax / ns) + rem;
-    } else { /* nested recycling, total is sufficient */
-	for (i = 0; i < ns; i++)
-	    if (LOGICAL(s)[i]) count++;
-	count *= nmax / ns;
-    }
-    PROTECT(indx = allocVector(INTSXP, count));
-    count = 0;
-    MOD_ITERATE_CHECK(NINTERRUPT, nmax, ns, nmax, i, i1, i2,	\
-	if (LOGICAL(s)[i1]) {				\
-	    if (LOGICAL(s)[i1] == NA_LOGICAL)			\
-		INTEGER(indx)[count++] = NA_INTEGER;		\
-	    else						\
-		INTEGER(indx)[count++] = (int)(i + 1);		\
-	});
+    }
 
     UNPROTECT(1);
     return indx;
@@ -916,6 +1010,34 @@ arraySubscript(int dim, SEXP s, SEXP dims, AttrGetter dng,
     return int_arraySubscript(dim, s, dims, x, R_NilValue);
 }
 
+/* If the subscript indx, as made by makeSubscript, is the range
+   from + 1, ..., from + n of a vector of length nx, returns from, so
+   that the elements can be copied as a block, and otherwise -1.  This
+   stops at the first element out of line, so costs little when the
+   range is not contiguous. */
+R_xlen_t attribute_hidden R_contiguousSubscript(SEXP indx, R_xlen_t nx)
+{
+    R_xlen_t n = XLENGTH(indx), i;
+    if (n == 0) return -1;
+    if (TYPEOF(indx) == INTSXP) {
+	const int *pi = INTEGER(indx);
+	R_xlen_t from = pi[0];
+	if (pi[0] == NA_INTEGER || from < 1 || from - 1 + n > nx) return -1;
+	for (i = 1; i < n; i++)
+	    if (pi[i] != from + i) return -1;
+	return from - 1;
+    }
+    if (TYPEOF(indx) == REALSXP) {
+	const double *pr = REAL(indx);
+	double from = pr[0];
+	if (!R_FINITE(from) || from < 1 || from - 1 + n > nx) return -1;
+	for (i = 1; i < n; i++)
+	    if (pr[i] != from + i) return -1;
+	return (R_xlen_t) from - 1;
+    }
+    return -1;
+}
+
 /* Subscript creation.  The first thing we do is check to see */
 /* if there are any user supplied NULL's, these result in */
 /* returning a vector of length 0. */
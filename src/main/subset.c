@@ -73,6 +73,30 @@ static SEXP ExtractSubset(SEXP x, SEXP result, SEXP indx, SEXP call)
     if (x == R_NilValue)
 	return x;
 
+    /* a contiguous range, as x[a:b], is copied as a block */
+    if (mode != LANGSXP && (ii = R_contiguousSubscript(indx, nx)) >= 0)
+	switch (mode) {
+	case LGLSXP:
+	case INTSXP:
+	    memcpy(INTEGER(result), INTEGER(x) + ii, n * sizeof(int));
+	    return result;
+	case REALSXP:
+	    memcpy(REAL(result), REAL(x) + ii, n * sizeof(double));
+	    return result;
+	case CPLXSXP:
+	    memcpy(COMPLEX(result), COMPLEX(x) + ii, n * sizeof(Rcomplex));
+	    return result;
+	case RAWSXP:
+	    memcpy(RAW(result), RAW(x) + ii, n * sizeof(Rbyte));
+	    return result;
+	case STRSXP:
+	    for (i = 0; i < n; i++)
+		SET_STRING_ELT(result, i, STRING_ELT(x, ii + i));
+	    return result;
+	default:
+	    break;
+	}
+
     for (i = 0; i < n; i++) {
 	switch(mi) {
 	case REALSXP:
@@ -242,7 +266,8 @@ static SEXP MatrixSubset(SEXP x, SEXP s, SEXP call, int drop)
 {
     SEXP attr, result, sr, sc, dim;
     int nr, nc, nrs, ncs;
-    R_xlen_t i, j, ii, jj, ij, iijj;
+    R_xlen_t i, j, ii, jj, ij, iijj, from;
+    Rboolean colna;
 
     nr = nrows(x);
     nc = ncols(x);
@@ -264,18 +289,59 @@ static SEXP MatrixSubset(SEXP x, SEXP s, SEXP call, int drop)
     PROTECT(result);
     for (i = 0; i < nrs; i++) {
 	ii = INTEGER(sr)[i];
-	if (ii != NA_INTEGER) {
-	    if (ii < 1 || ii > nr)
-		errorcall(call, R_MSG_subs_o_b);
-	    ii--;
-	}
+	if (ii != NA_INTEGER && (ii < 1 || ii > nr))
+	    errorcall(call, R_MSG_subs_o_b);
+    }
+    for (j = 0, colna = FALSE; j < ncs; j++) {
+	jj = INTEGER(sc)[j];
+	if (jj == NA_INTEGER)
+	    colna = TRUE;
+	else if (jj < 1 || jj > nc)
+	    errorcall(call, R_MSG_subs_o_b);
+    }
+
+    /* A range of rows, such as all of them in m[, j], is a block of
+       each selected column, so is copied as such. */
+    from = colna ? -1 : R_contiguousSubscript(sr, nr);
+    if (from >= 0 && TYPEOF(x) != VECSXP && TYPEOF(x) != EXPRSXP) {
 	for (j = 0; j < ncs; j++) {
 	    jj = INTEGER(sc)[j];
-	    if (jj != NA_INTEGER) {
-		if (jj < 1 || jj > nc)
-		    errorcall(call, R_MSG_subs_o_b);
-		jj--;
+	    ij = j * (R_xlen_t) nrs;
+	    iijj = from + (jj - 1) * (R_xlen_t) nr;
+	    switch (TYPEOF(x)) {
+	    case LGLSXP:
+	    case INTSXP:
+		memcpy(INTEGER(result) + ij, INTEGER(x) + iijj,
+		       nrs * sizeof(int));
+		break;
+	    case REALSXP:
+		memcpy(REAL(result) + ij, REAL(x) + iijj,
+		       nrs * sizeof(double));
+		break;
+	    case CPLXSXP:
+		memcpy(COMPLEX(result) + ij, COMPLEX(x) + iijj,
+		       nrs * sizeof(Rcomplex));
+		break;
+	    case STRSXP:
+		for (i = 0; i < nrs; i++)
+		    SET_STRING_ELT(result, ij + i, STRING_ELT(x, iijj + i));
+		break;
+	    case RAWSXP:
+		memcpy(RAW(result) + ij, RAW(x) + iijj, nrs * sizeof(Rbyte));
+		break;
+	    default:
+		errorcall(call, _("matrix subscripting not handled for this type"));
+		break;
 	    }
+	}
+    }
+    /* Otherwise go down the columns, to read x in storage order. */
+    else for (j = 0; j < ncs; j++) {
+	jj = INTEGER(sc)[j];
+	if (jj != NA_INTEGER) jj--;
+	for (i = 0; i < nrs; i++) {
+	    ii = INTEGER(sr)[i];
+	    if (ii != NA_INTEGER) ii--;
 	    ij = i + j * nrs;
 	    if (ii == NA_INTEGER || jj == NA_INTEGER) {
 		switch (TYPEOF(x)) {
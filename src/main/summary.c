@@ -25,8 +25,12 @@
 #include <Defn.h>
 #include <Internal.h>
 #include <R_ext/Itermacros.h>
+#include <R_ext/RS.h>  /* for Calloc/Free */
 
 #include <float.h> // for DBL_MAX
+#ifdef _OPENMP
+# include <omp.h>
+#endif
 
 #include "duplicate.h"
 
@@ -47,34 +51,187 @@
 #define DbgP3(s,a,b)
 #endif
 
-#ifdef LONG_INT
-static Rboolean isum(int *x, R_xlen_t n, int *value, Rboolean narm, SEXP call)
+#if defined(_OPENMP) && _OPENMP >= 201307
+# define R_DO_PRAGMA(x) _Pragma(#x)
+# define R_OMP_SIMD(...) R_DO_PRAGMA(omp simd __VA_ARGS__)
+#else
+# define R_OMP_SIMD(...)
+#endif
+
+/* Sums and extremes of double vectors of R_SUM_THREADS_MIN or more
+   elements are formed on R_num_math_threads threads, each taking one
+   contiguous block, and the partial results are combined in order so
+   the result does not depend on the scheduling. */
+#define R_SUM_THREADS_MIN 1000000
+#define R_SUM_MAX_THREADS 64
+
+static R_INLINE int sum_nthreads(R_xlen_t n)
 {
-    LONG_INT s = 0;  // at least 64-bit
-    Rboolean updated = FALSE;
-#ifdef LONG_VECTOR_SUPPORT
-    int ii = R_INT_MIN; // need > 2^32 entries to overflow.
+#ifdef _OPENMP
+    if (n >= R_SUM_THREADS_MIN && R_num_math_threads > 1)
+	return R_num_math_threads < R_SUM_MAX_THREADS ?
+	    R_num_math_threads : R_SUM_MAX_THREADS;
 #endif
+    return 1;
+}
 
-    for (R_xlen_t i = 0; i < n; i++) {
-	if (x[i] != NA_INTEGER) {
-	    if(!updated) updated = TRUE;
-	    s += x[i];
-#ifdef LONG_VECTOR_SUPPORT
-	    if (ii++ > 1000) {
-		ii = 0;
-		if (s > 9000000000000000L || s < -9000000000000000L) {
-		    if(!updated) updated = TRUE;
-		    *value = NA_INTEGER;
-		    warningcall(call, _("integer overflow - use sum(as.numeric(.))"));
-		    return updated;
-		}
-	    }
+/* Sum of x[i] - shift, of the non-NaN elements only if narm, in four
+   accumulators so successive additions need not wait for each other.
+   *nused is set to the number of elements summed. */
+static LDOUBLE rsum_block(const double *x, R_xlen_t n, LDOUBLE shift,
+			  Rboolean narm, R_xlen_t *nused)
+{
+    LDOUBLE s0 = 0., s1 = 0., s2 = 0., s3 = 0.;
+    R_xlen_t i = 0, m = n;
+
+    if (narm) {
+	m = 0;
+#define RSUM_NARM(s, v) if (!ISNAN(v)) { s += (v) - shift; m++; }
+	for (; i + 4 <= n; i += 4) {
+	    RSUM_NARM(s0, x[i]);
+	    RSUM_NARM(s1, x[i + 1]);
+	    RSUM_NARM(s2, x[i + 2]);
+	    RSUM_NARM(s3, x[i + 3]);
+	}
+	for (; i < n; i++)
+	    RSUM_NARM(s0, x[i]);
+#undef RSUM_NARM
+    }
+    else {
+	for (; i + 4 <= n; i += 4) {
+	    s0 += x[i] - shift;
+	    s1 += x[i + 1] - shift;
+	    s2 += x[i + 2] - shift;
+	    s3 += x[i + 3] - shift;
+	}
+	for (; i < n; i++)
+	    s0 += x[i] - shift;
+    }
+    *nused = m;
+    return (s0 + s1) + (s2 + s3);
+}
+
+static LDOUBLE rsum_ld(const double *x, R_xlen_t n, LDOUBLE shift,
+		       Rboolean narm, R_xlen_t *nused)
+{
+#ifdef _OPENMP
+    int nthreads = sum_nthreads(n);
+    if (nthreads > 1) {
+	LDOUBLE part[R_SUM_MAX_THREADS], s = 0.;
+	R_xlen_t mpart[R_SUM_MAX_THREADS], m = 0;
+#pragma omp parallel for num_threads(nthreads) default(none) \
+    firstprivate(x, n, shift, narm, nthreads) shared(part, mpart)
+	for (int t = 0; t < nthreads; t++) {
+	    R_xlen_t from = n / nthreads * t,
+		to = t == nthreads - 1 ? n : from + n / nthreads;
+	    part[t] = rsum_block(x + from, to - from, shift, narm, mpart + t);
+	}
+	for (int t = 0; t < nthreads; t++) {
+	    s += part[t];
+	    m += mpart[t];
+	}
+	*nused = m;
+	return s;
+    }
 #endif
-	} else if (!narm) {
-	    if(!updated) updated = TRUE;
+    return rsum_block(x, n, shift, narm, nused);
+}
+
+/* Minimum (or maximum if max is TRUE) of x[0:n], n > 0, in four
+   independent accumulators.  Returns FALSE if there are NaNs, or if the
+   result is zero, whose sign depends on which of the zeros comes first;
+   the caller then uses an element-by-element loop. */
+static Rboolean rminmax_block(const double *x, R_xlen_t n, Rboolean max,
+			      double *value)
+{
+    double s0 = x[0], s1 = x[0], s2 = x[0], s3 = x[0];
+    R_xlen_t i = 0;
+    int nan = 0;
+
+#define RMINMAX_LOOP(BETTER) do {					\
+	for (; i + 4 <= n; i += 4) {					\
+	    nan |= (x[i] != x[i]) | (x[i + 1] != x[i + 1]) |		\
+		(x[i + 2] != x[i + 2]) | (x[i + 3] != x[i + 3]);	\
+	    s0 = BETTER(x[i], s0) ? x[i] : s0;				\
+	    s1 = BETTER(x[i + 1], s1) ? x[i + 1] : s1;			\
+	    s2 = BETTER(x[i + 2], s2) ? x[i + 2] : s2;			\
+	    s3 = BETTER(x[i + 3], s3) ? x[i + 3] : s3;			\
+	}								\
+	for (; i < n; i++) {						\
+	    nan |= x[i] != x[i];					\
+	    s0 = BETTER(x[i], s0) ? x[i] : s0;				\
+	}								\
+	s0 = BETTER(s1, s0) ? s1 : s0;					\
+	s2 = BETTER(s3, s2) ? s3 : s2;					\
+	s0 = BETTER(s2, s0) ? s2 : s0;					\
+    } while (0)
+#define RMIN_BETTER(a, b) ((a) < (b))
+#define RMAX_BETTER(a, b) ((a) > (b))
+
+    if (max) RMINMAX_LOOP(RMAX_BETTER);
+    else RMINMAX_LOOP(RMIN_BETTER);
+    *value = s0;
+    return !nan && s0 != 0.;
+}
+
+static Rboolean rminmax_fast(const double *x, R_xlen_t n, Rboolean max,
+			     double *value)
+{
+#ifdef _OPENMP
+    int nthreads = sum_nthreads(n);
+    if (nthreads > 1) {
+	double part[R_SUM_MAX_THREADS];
+	Rboolean ok[R_SUM_MAX_THREADS];
+#pragma omp parallel for num_threads(nthreads) default(none) \
+    firstprivate(x, n, max, nthreads) shared(part, ok)
+	for (int t = 0; t < nthreads; t++) {
+	    R_xlen_t from = n / nthreads * t,
+		to = t == nthreads - 1 ? n : from + n / nthreads;
+	    ok[t] = rminmax_block(x + from, to - from, max, part + t);
+	}
+	double s = part[0];
+	for (int t = 0; t < nthreads; t++) {
+	    if (!ok[t]) return FALSE;
+	    if (max ? part[t] > s : part[t] < s) s = part[t];
+	}
+	*value = s;
+	return TRUE;
+    }
+#endif
+    return rminmax_block(x, n, max, value);
+}
+
+#ifdef LONG_INT
+/* isum() adds blocks of ISUM_BLOCK elements in a loop that can be
+   vectorized, counting the NAs.  A block adds less than 2^43 in
+   absolute value, so checking the total after each block catches
+   overflow of the 64-bit sum. */
+#define ISUM_BLOCK 4096
+static Rboolean isum(int *x, R_xlen_t n, int *value, Rboolean narm, SEXP call)
+{
+    LONG_INT s = 0;  // at least 64-bit
+    R_xlen_t nna = 0;
+
+    for (R_xlen_t i = 0; i < n; i += ISUM_BLOCK) {
+	const int *xi = x + i;
+	int m = (n - i < ISUM_BLOCK) ? (int) (n - i) : ISUM_BLOCK, bna = 0;
+	LONG_INT bs = 0;
+	R_OMP_SIMD(reduction(+:bs, bna))
+	for (int j = 0; j < m; j++) {
+	    int na = xi[j] == NA_INTEGER;
+	    bna += na;
+	    bs += na ? 0 : xi[j];
+	}
+	if (bna && !narm) {
 	    *value = NA_INTEGER;
-	    return updated;
+	    return TRUE;
+	}
+	nna += bna;
+	s += bs;
+	if (s > 9000000000000000L || s < -9000000000000000L) {
+	    *value = NA_INTEGER;
+	    warningcall(call, _("integer overflow - use sum(as.numeric(.))"));
+	    return TRUE;
 	}
     }
     if(s > INT_MAX || s < R_INT_MIN){
@@ -83,7 +240,7 @@ static Rboolean isum(int *x, R_xlen_t n, int *value, Rboolean narm, SEXP call)
     }
     else *value = (int) s;
 
-    return updated;
+    return nna < n;
 }
 #else
 /* Version from R 3.0.0: should never be used with a C99/C11 compiler */
@@ -114,20 +271,14 @@ static Rboolean isum(int *x, R_xlen_t n, int *value, Rboolean narm, SEXP call)
 
 static Rboolean rsum(double *x, R_xlen_t n, double *value, Rboolean narm)
 {
-    LDOUBLE s = 0.0;
-    Rboolean updated = FALSE;
+    R_xlen_t nused;
+    LDOUBLE s = rsum_ld(x, n, 0., narm, &nused);
 
-    for (R_xlen_t i = 0; i < n; i++) {
-	if (!narm || !ISNAN(x[i])) {
-	    if(!updated) updated = TRUE;
-	    s += x[i];
-	}
-    }
     if(s > DBL_MAX) *value = R_PosInf;
     else if (s < -DBL_MAX) *value = R_NegInf;
     else *value = (double) s;
 
-    return updated;
+    return nused > 0;
 }
 
 static Rboolean csum(Rcomplex *x, R_xlen_t n, Rcomplex *value, Rboolean narm)
@@ -173,6 +324,9 @@ static Rboolean imin(int *x, R_xlen_t n, int *value, Rboolean narm)
 
 static Rboolean rmin(double *x, R_xlen_t n, double *value, Rboolean narm)
 {
+    if (n > 0 && rminmax_fast(x, n, FALSE, value))
+	return TRUE;
+
     double s = 0.0; /* -Wall */
     Rboolean updated = FALSE;
 
@@ -242,6 +396,9 @@ static Rboolean imax(int *x, R_xlen_t n, int *value, Rboolean narm)
 
 static Rboolean rmax(double *x, R_xlen_t n, double *value, Rboolean narm)
 {
+    if (n > 0 && rminmax_fast(x, n, TRUE, value))
+	return TRUE;
+
     double s = 0.0 /* -Wall */;
     Rboolean updated = FALSE;
 
@@ -318,22 +475,63 @@ static Rboolean iprod(int *x, R_xlen_t n, double *value, Rboolean narm)
 
 static Rboolean rprod(double *x, R_xlen_t n, double *value, Rboolean narm)
 {
-    LDOUBLE s = 1.0;
+    LDOUBLE s0 = 1.0, s1 = 1.0;
+    R_xlen_t i = 0;
     Rboolean updated = FALSE;
 
-    for (R_xlen_t i = 0; i < n; i++) {
-	if (!narm || !ISNAN(x[i])) {
-	    if(!updated) updated = TRUE;
-	    s *= x[i];
+    if (narm) {
+	for (; i < n; i++)
+	    if (!ISNAN(x[i])) {
+		if(!updated) updated = TRUE;
+		s0 *= x[i];
+	    }
+    }
+    else {
+	/* two accumulators, so successive multiplications overlap */
+	for (; i + 2 <= n; i += 2) {
+	    s0 *= x[i];
+	    s1 *= x[i + 1];
 	}
+	if (i < n) s0 *= x[i];
+	updated = n > 0;
     }
-    if(s > DBL_MAX) *value = R_PosInf;
-    else if (s < -DBL_MAX) *value = R_NegInf;
-    else *value = (double) s;
+    s0 *= s1;
+    if(s0 > DBL_MAX) *value = R_PosInf;
+    else if (s0 < -DBL_MAX) *value = R_NegInf;
+    else *value = (double) s0;
 
     return updated;
 }
 
+/* sum(x) (op 0), mean(x) (op 1) or prod(x) (op 4) of a double vector
+   as do_summary computes them, for the direct path of vapply and
+   lapply.  This may be called on several threads, so it neither
+   allocates nor signals. */
+double attribute_hidden R_rsummary(double *x, R_xlen_t n, int op)
+{
+    R_xlen_t nused;
+    double value = 0.;
+    LDOUBLE s, t;
+
+    switch (op) {
+    case 0:
+	rsum(x, n, &value, FALSE);
+	return 0. + value;
+    case 1:
+	s = rsum_ld(x, n, 0., FALSE, &nused);
+	s /= n;
+	if(R_FINITE((double)s)) {
+	    t = rsum_ld(x, n, s, FALSE, &nused);
+	    s += t/n;
+	}
+	return (double) s;
+    default:
+	value = 1.;
+	rprod(x, n, &value, FALSE);
+	return 1. * value;
+    }
+}
+
 static Rboolean cprod(Rcomplex *x, R_xlen_t n, Rcomplex *value, Rboolean narm)
 {
     LDOUBLE sr = 1.0, si = 0.0;
@@ -410,7 +608,7 @@ SEXP attribute_hidden do_summary(SEXP call, SEXP op, SEXP args, SEXP env)
     checkArity(op, args);
     if(PRIMVAL(op) == 1) { /* mean */
 	LDOUBLE s = 0., si = 0., t = 0., ti = 0.;
-	R_xlen_t i, n = XLENGTH(CAR(args));
+	R_xlen_t i, nused, n = XLENGTH(CAR(args));
 	SEXP x = CAR(args);
 	switch(TYPEOF(x)) {
 	case LGLSXP:
@@ -428,10 +626,10 @@ SEXP attribute_hidden do_summary(SEXP call, SEXP op, SEXP args, SEXP env)
 	    break;
 	case REALSXP:
 	    PROTECT(ans = allocVector(REALSXP, 1));
-	    for (i = 0; i < n; i++) s += REAL(x)[i];
+	    s = rsum_ld(REAL(x), n, 0., FALSE, &nused);
 	    s /= n;
 	    if(R_FINITE((double)s)) {
-		for (i = 0; i < n; i++) t += (REAL(x)[i] - s);
+		t = rsum_ld(REAL(x), n, s, FALSE, &nused);
 		s += t/n;
 	    }
 	    REAL(ans)[0] = (double) s;
@@ -905,25 +1103,17 @@ SEXP attribute_hidden do_first_min(SEXP call, SEXP op, SEXP args, SEXP rho)
 SEXP attribute_hidden do_which(SEXP call, SEXP op, SEXP args, SEXP rho)
 {
     SEXP v, v_nms, ans, ans_nms = R_NilValue;
-    int i, j = 0, len, *buf;
+    int i, len;
 
     checkArity(op, args);
     v = CAR(args);
     if (!isLogical(v))
 	error(_("argument to 'which' is not logical"));
     len = length(v);
-    buf = (int *) R_alloc(len, sizeof(int));
-
-    for (i = 0; i < len; i++) {
-	if (LOGICAL(v)[i] == TRUE) {
-	    buf[j] = i + 1;
-	    j++;
-	}
-    }
 
-    len = j;
-    PROTECT(ans = allocVector(INTSXP, len));
-    if(len) memcpy(INTEGER(ans), buf, sizeof(int) * len);
+    PROTECT(ans = allocVector(INTSXP, R_lglCount(LOGICAL(v), len, FALSE)));
+    R_lglWhich(LOGICAL(v), len, 0, FALSE, INTEGER(ans), NULL);
+    len = LENGTH(ans);
 
     if ((v_nms = getAttrib(v, R_NamesSymbol)) != R_NilValue) {
 	PROTECT(ans_nms = allocVector(STRSXP, len));
@@ -1104,3 +1294,518 @@ SEXP attribute_hidden do_pmin(SEXP call, SEXP op, SEXP args, SEXP rho)
     UNPROTECT(1);
     return ans;
 }
+
+typedef struct {
+    R_xlen_t n, nna;
+    LDOUBLE sum, sq, dsum, dsq; /* dsum, dsq: sums of deviations from
+				   and squared deviations from shift */
+    double min, max, shift;
+} sstats_t;
+
+/* .Internal(summaryStats(x, stats, group, ngroups, na.rm)) forms the
+   statistics with codes 'stats' (positions in the choices of R's
+   summaryStats()) of the elements of the numeric vector x in a single
+   pass, for each of the groups 1..ngroups given by the integer vector
+   'group', or for all of x if that is NULL.  The result is an ngroups
+   by length(stats) matrix, without dimnames.
+*/
+SEXP attribute_hidden do_summarystats(SEXP call, SEXP op, SEXP args, SEXP env)
+{
+    checkArity(op, args);
+    SEXP x = CAR(args), stats = CADR(args), group = CADDR(args);
+    int ng = asInteger(CADDDR(args)), narm = asLogical(CAD4R(args));
+    R_xlen_t n = XLENGTH(x);
+
+    if (!isNumeric(x))
+	error(_("'x' must be numeric"));
+    if (TYPEOF(stats) != INTSXP)
+	error(_("invalid '%s' argument"), "stats");
+    if (isNull(group))
+	ng = 1;
+    else if (TYPEOF(group) != INTSXP || XLENGTH(group) != n)
+	error(_("incorrect length for 'group'"));
+    if (ng == NA_INTEGER || ng < 0)
+	error(_("invalid '%s' argument"), "ngroups");
+    if (narm == NA_LOGICAL)
+	error(_("invalid '%s' value"), "na.rm");
+
+    int nstats = LENGTH(stats), *st = INTEGER(stats);
+    Rboolean dosq = FALSE, dovar = FALSE, dominmax = FALSE;
+    for (int k = 0; k < nstats; k++)
+	switch (st[k]) {
+	case 1: case 2: case 3: case 4: break;
+	case 5: dosq = TRUE; break;
+	case 6: dovar = TRUE; break;
+	case 7: case 8: dominmax = TRUE; break;
+	default: error(_("invalid '%s' argument"), "stats");
+	}
+
+    /* Not R_alloc, which does not align for long doubles.  Nothing
+       below can raise an error before the Free. */
+    SEXP ans = PROTECT(allocMatrix(REALSXP, ng, nstats));
+    sstats_t *acc = Calloc(ng, sstats_t);
+    for (int g = 0; g < ng; g++) {
+	acc[g].n = acc[g].nna = 0;
+	acc[g].sum = acc[g].sq = 0.;
+	acc[g].min = R_PosInf; acc[g].max = R_NegInf;
+	acc[g].dsum = acc[g].dsq = acc[g].shift = 0.;
+    }
+
+    /* The variance is found from the sums of the deviations from the
+       first value, which unlike the sum of squares does not lose
+       accuracy for data whose mean is large compared to their spread.
+       Without groups the statistics are kept in a local copy, which the
+       compiler can hold in registers. */
+#define SSTATS_ADD(a, v) do {						\
+	(a).n++;							\
+	(a).sum += v;							\
+	if (dosq) (a).sq += (LDOUBLE) v * v;				\
+	if (dominmax) {							\
+	    if ((a).n == 1 || v < (a).min) (a).min = v;			\
+	    if ((a).n == 1 || v > (a).max) (a).max = v;			\
+	}								\
+	if (dovar) {							\
+	    if ((a).n == 1) (a).shift = v;				\
+	    LDOUBLE d = v - (a).shift;					\
+	    (a).dsum += d;						\
+	    (a).dsq += d * d;						\
+	}								\
+    } while (0)
+#define SSTATS_LOOP(ISNA, GET) do {					\
+	if (isNull(group)) {						\
+	    sstats_t a = acc[0];					\
+	    for (R_xlen_t i = 0; i < n; i++) {				\
+		if (ISNA) a.nna++;					\
+		else {							\
+		    double v = GET;					\
+		    SSTATS_ADD(a, v);					\
+		}							\
+	    }								\
+	    acc[0] = a;							\
+	}								\
+	else {								\
+	    const int *gp = INTEGER(group);				\
+	    for (R_xlen_t i = 0; i < n; i++) {				\
+		int g = gp[i];						\
+		if (g == NA_INTEGER || g < 1 || g > ng) continue;	\
+		if (ISNA) acc[g - 1].nna++;				\
+		else {							\
+		    double v = GET;					\
+		    SSTATS_ADD(acc[g - 1], v);				\
+		}							\
+	    }								\
+	}								\
+    } while (0)
+
+    if (TYPEOF(x) == REALSXP) {
+	const double *px = REAL(x);
+	SSTATS_LOOP(ISNAN(px[i]), px[i]);
+    }
+    else {
+	const int *px = (TYPEOF(x) == LGLSXP) ? LOGICAL(x) : INTEGER(x);
+	SSTATS_LOOP(px[i] == NA_INTEGER, (double) px[i]);
+    }
+#undef SSTATS_LOOP
+#undef SSTATS_ADD
+
+    double *pa = REAL(ans);
+    for (int k = 0; k < nstats; k++)
+	for (int g = 0; g < ng; g++) {
+	    sstats_t *a = acc + g;
+	    double val;
+	    if (st[k] > 2 && !narm && a->nna > 0)
+		val = NA_REAL;
+	    else switch (st[k]) {
+	    case 1: val = (double) a->n; break;
+	    case 2: val = (double) a->nna; break;
+	    case 3: val = (double) a->sum; break;
+	    case 4: val = a->n ? (double) (a->sum / a->n) : R_NaN; break;
+	    case 5: val = (double) a->sq; break;
+	    case 6:
+		val = a->n > 1 ? (double) ((a->dsq - a->dsum * a->dsum / a->n)
+					   / (a->n - 1)) : NA_REAL;
+		break;
+	    case 7: val = a->min; break;
+	    default: val = a->max; break;
+	    }
+	    pa[g + (R_xlen_t) ng * k] = val;
+	}
+    Free(acc);
+    UNPROTECT(1);
+    return ans;
+}
+
+/* .Internal(groupAggregate(x, group, ngroups, fun, na.rm)) applies
+   sum (fun = 1), mean (2), min (3), max (4) or length (5) to the
+   elements of x in each of the groups with codes 1..ngroups in the
+   integer vector 'group' (NA codes are skipped), for tapply() and
+   aggregate().  x is a numeric or logical vector, or a list of them
+   (and NULLs), done on several threads if there are enough.
+
+   The value for each group is formed exactly as FUN would form it from
+   the elements of the group in turn: in particular, sums of doubles use
+   the accumulators rsum_block() and mean would use for each element.
+   Where FUN would warn, that is for integer overflow in sum and for
+   min and max of groups with only NAs, the result for that vector is
+   NULL and the caller should apply FUN itself.  Empty groups give
+   FUN(x[0]), or NA for min and max.
+*/
+
+enum { GAGG_SUM = 1, GAGG_MEAN, GAGG_MIN, GAGG_MAX, GAGG_LENGTH };
+
+typedef struct {
+    LDOUBLE *s;		/* four accumulators per group */
+    LDOUBLE *m;		/* means */
+    R_xlen_t *pos;	/* elements used so far */
+    R_xlen_t *cnt;	/* elements to use */
+    double *d;
+    int *iv;
+    char *state;
+} gagg_work_t;
+
+/* The accumulator rsum_block() would use for element p of N. */
+#define GAGG_LANE(p, N) ((p) < (N) - (N) % 4 ? (p) % 4 : 0)
+#define GAGG_SKIP(g) ((g) == NA_INTEGER)
+
+static Rboolean gagg_real(const double *x, const int *gp, R_xlen_t n,
+			  int ng, const R_xlen_t *size, int fun,
+			  Rboolean narm, gagg_work_t *w, double *ans)
+{
+    LDOUBLE *s = w->s;
+    R_xlen_t *pos = w->pos, *cnt = w->cnt;
+
+    switch (fun) {
+    case GAGG_SUM:
+	for (int g = 0; g < ng; g++) {
+	    s[4*g] = s[4*g + 1] = s[4*g + 2] = s[4*g + 3] = 0.;
+	    pos[g] = 0;
+	}
+	for (R_xlen_t i = 0; i < n; i++) {
+	    int g = gp[i];
+	    if (GAGG_SKIP(g)) continue;
+	    g--;
+	    R_xlen_t p = pos[g]++;
+	    if (!narm || !ISNAN(x[i]))
+		s[4*g + GAGG_LANE(p, size[g])] += x[i] - (LDOUBLE) 0.;
+	}
+	for (int g = 0; g < ng; g++) {
+	    LDOUBLE t = (s[4*g] + s[4*g + 1]) + (s[4*g + 2] + s[4*g + 3]);
+	    double v;
+	    if(t > DBL_MAX) v = R_PosInf;
+	    else if (t < -DBL_MAX) v = R_NegInf;
+	    else v = (double) t;
+	    ans[g] = 0. + v; /* as do_summary */
+	}
+	return TRUE;
+
+    case GAGG_MEAN:
+	/* mean.default drops the NAs if narm, so the positions are
+	   those among the other elements */
+	for (int g = 0; g < ng; g++) {
+	    s[4*g] = s[4*g + 1] = s[4*g + 2] = s[4*g + 3] = 0.;
+	    pos[g] = 0;
+	    cnt[g] = narm ? 0 : size[g];
+	}
+	if (narm)
+	    for (R_xlen_t i = 0; i < n; i++)
+		if (!GAGG_SKIP(gp[i]) && !ISNAN(x[i])) cnt[gp[i] - 1]++;
+	for (int pass = 0; pass < 2; pass++) {
+	    for (R_xlen_t i = 0; i < n; i++) {
+		int g = gp[i];
+		if (GAGG_SKIP(g) || (narm && ISNAN(x[i]))) continue;
+		g--;
+		if (pass && !R_FINITE((double) w->m[g])) continue;
+		R_xlen_t p = pos[g]++;
+		s[4*g + GAGG_LANE(p, cnt[g])] += x[i] - (pass ? w->m[g] : 0.);
+	    }
+	    for (int g = 0; g < ng; g++) {
+		LDOUBLE t = (s[4*g] + s[4*g + 1]) + (s[4*g + 2] + s[4*g + 3]);
+		if (!pass)
+		    w->m[g] = t / cnt[g];
+		else if (R_FINITE((double) w->m[g]))
+		    w->m[g] += t / cnt[g];
+		s[4*g] = s[4*g + 1] = s[4*g + 2] = s[4*g + 3] = 0.;
+		pos[g] = 0;
+	    }
+	}
+	for (int g = 0; g < ng; g++) ans[g] = (double) w->m[g];
+	return TRUE;
+
+    case GAGG_MIN:
+    case GAGG_MAX:
+    {
+	/* as rmin() and rmax(), and then do_summary */
+	double *d = w->d;
+	char *upd = w->state;
+	Rboolean max = fun == GAGG_MAX;
+	for (int g = 0; g < ng; g++) {
+	    d[g] = 0.;
+	    upd[g] = 0;
+	}
+	for (R_xlen_t i = 0; i < n; i++) {
+	    int g = gp[i];
+	    if (GAGG_SKIP(g)) continue;
+	    g--;
+	    if (ISNAN(x[i])) {
+		if (!narm) {
+		    if (!ISNA(d[g])) d[g] = x[i];
+		    upd[g] = 1;
+		}
+	    }
+	    else if (!upd[g] || (max ? x[i] > d[g] : x[i] < d[g])) {
+		d[g] = x[i];
+		upd[g] = 1;
+	    }
+	}
+	for (int g = 0; g < ng; g++) {
+	    if (size[g] == 0) ans[g] = NA_REAL;
+	    else if (!upd[g]) return FALSE;
+	    else if (ISNAN(d[g]) && !ISNA(d[g]))
+		ans[g] = (max ? R_NegInf : R_PosInf) + d[g];
+	    else ans[g] = d[g];
+	}
+	return TRUE;
+    }
+    }
+    return FALSE;
+}
+
+static Rboolean gagg_int(const int *x, const int *gp, R_xlen_t n,
+			 int ng, const R_xlen_t *size, int fun,
+			 Rboolean narm, gagg_work_t *w, SEXP ans)
+{
+    char *state = w->state;
+
+    switch (fun) {
+    case GAGG_SUM:
+    {
+#ifdef LONG_INT
+	/* state: 1 if the group has an NA (and !narm) */
+	LONG_INT *s = (LONG_INT *) w->s;
+	for (int g = 0; g < ng; g++) {
+	    s[g] = 0;
+	    state[g] = 0;
+	}
+	for (R_xlen_t i = 0; i < n; i++) {
+	    int g = gp[i];
+	    if (GAGG_SKIP(g)) continue;
+	    g--;
+	    if (x[i] != NA_INTEGER) s[g] += x[i];
+	    else if (!narm) state[g] = 1;
+	}
+	int *ia = INTEGER(ans);
+	for (int g = 0; g < ng; g++) {
+	    if (state[g]) ia[g] = NA_INTEGER;
+	    else if (s[g] > INT_MAX || s[g] < R_INT_MIN) return FALSE;
+	    else ia[g] = (int) s[g];
+	}
+	return TRUE;
+#else
+	return FALSE;
+#endif
+    }
+
+    case GAGG_MEAN:
+    {
+	/* as mean.default: narm drops the NAs, otherwise any gives NA */
+	LDOUBLE *s = w->s;
+	R_xlen_t *cnt = w->cnt;
+	for (int g = 0; g < ng; g++) {
+	    s[g] = 0.;
+	    cnt[g] = 0;
+	    state[g] = 0;
+	}
+	for (R_xlen_t i = 0; i < n; i++) {
+	    int g = gp[i];
+	    if (GAGG_SKIP(g)) continue;
+	    g--;
+	    if (x[i] != NA_INTEGER) {
+		s[g] += x[i];
+		cnt[g]++;
+	    }
+	    else if (!narm) state[g] = 1;
+	}
+	double *ra = REAL(ans);
+	for (int g = 0; g < ng; g++)
+	    ra[g] = state[g] ? R_NaReal : (double) (s[g] / cnt[g]);
+	return TRUE;
+    }
+
+    case GAGG_MIN:
+    case GAGG_MAX:
+    {
+	/* as imin() and imax(); state: 1 updated, 2 NA */
+	int *iv = w->iv;
+	Rboolean max = fun == GAGG_MAX;
+	for (int g = 0; g < ng; g++) {
+	    iv[g] = 0;
+	    state[g] = 0;
+	}
+	for (R_xlen_t i = 0; i < n; i++) {
+	    int g = gp[i];
+	    if (GAGG_SKIP(g)) continue;
+	    g--;
+	    if (state[g] == 2) continue;
+	    if (x[i] != NA_INTEGER) {
+		if (!state[g] || (max ? iv[g] < x[i] : iv[g] > x[i])) {
+		    iv[g] = x[i];
+		    state[g] = 1;
+		}
+	    }
+	    else if (!narm) {
+		iv[g] = NA_INTEGER;
+		state[g] = 2;
+	    }
+	}
+	int *ia = INTEGER(ans);
+	for (int g = 0; g < ng; g++) {
+	    if (size[g] == 0) ia[g] = NA_INTEGER;
+	    else if (!state[g]) return FALSE;
+	    else ia[g] = iv[g];
+	}
+	return TRUE;
+    }
+    }
+    return FALSE;
+}
+
+static SEXPTYPE gagg_type(SEXP x, int fun)
+{
+    switch (TYPEOF(x)) {
+    case LGLSXP:
+    case INTSXP:
+	return fun == GAGG_MEAN ? REALSXP : INTSXP;
+    case REALSXP:
+	return fun == GAGG_LENGTH ? INTSXP : REALSXP;
+    default:
+	return NILSXP;
+    }
+}
+
+static Rboolean gagg_column(SEXP x, SEXP ans, const int *gp, R_xlen_t n,
+			    int ng, const R_xlen_t *size, int fun,
+			    Rboolean narm, gagg_work_t *w)
+{
+    if (fun == GAGG_LENGTH) {
+	for (int g = 0; g < ng; g++) INTEGER(ans)[g] = (int) size[g];
+	return TRUE;
+    }
+    if (TYPEOF(x) == REALSXP)
+	return gagg_real(REAL(x), gp, n, ng, size, fun, narm, w, REAL(ans));
+    else
+	return gagg_int(TYPEOF(x) == LGLSXP ? LOGICAL(x) : INTEGER(x),
+			gp, n, ng, size, fun, narm, w, ans);
+}
+
+SEXP attribute_hidden do_groupaggregate(SEXP call, SEXP op, SEXP args,
+					SEXP env)
+{
+    checkArity(op, args);
+    SEXP x = CAR(args), group = CADR(args);
+    int ng = asInteger(CADDR(args)), fun = asInteger(CADDDR(args)),
+	narm = asLogical(CAD4R(args));
+    Rboolean islist = TYPEOF(x) == VECSXP;
+    R_xlen_t n = XLENGTH(group);
+
+    if (TYPEOF(group) != INTSXP)
+	error(_("invalid '%s' argument"), "group");
+    if (ng == NA_INTEGER || ng < 0)
+	error(_("invalid '%s' argument"), "ngroups");
+    if (fun == NA_INTEGER || fun < GAGG_SUM || fun > GAGG_LENGTH)
+	error(_("invalid '%s' argument"), "fun");
+    if (narm == NA_LOGICAL)
+	error(_("invalid '%s' value"), "na.rm");
+    int ncol = islist ? LENGTH(x) : 1;
+    for (int j = 0; j < ncol; j++) {
+	SEXP xj = islist ? VECTOR_ELT(x, j) : x;
+	if (xj != R_NilValue && XLENGTH(xj) != n)
+	    error(_("arguments must have same length"));
+    }
+
+    const int *gp = INTEGER(group);
+    R_xlen_t *size = (R_xlen_t *) R_alloc(ng, sizeof(R_xlen_t)), maxsize = 0;
+    for (int g = 0; g < ng; g++) size[g] = 0;
+    for (R_xlen_t i = 0; i < n; i++) {
+	int g = gp[i];
+	if (g == NA_INTEGER) continue;
+	if (g < 1 || g > ng)
+	    error(_("invalid '%s' argument"), "group");
+	size[g - 1]++;
+    }
+    for (int g = 0; g < ng; g++)
+	if (size[g] > maxsize) maxsize = size[g];
+
+    SEXP ans = PROTECT(islist ? allocVector(VECSXP, ncol) : R_NilValue);
+    for (int j = 0; j < ncol; j++) {
+	SEXP xj = islist ? VECTOR_ELT(x, j) : x;
+	SEXPTYPE type = gagg_type(xj, fun);
+	/* sum() and mean() would use threads for groups this large */
+	if (type == NILSXP || maxsize > INT_MAX ||
+	    (TYPEOF(xj) == REALSXP && fun <= GAGG_MEAN &&
+	     sum_nthreads(maxsize) > 1))
+	    continue;
+	SEXP aj = allocVector(type, ng);
+	if (islist) SET_VECTOR_ELT(ans, j, aj);
+	else {
+	    UNPROTECT(1);
+	    PROTECT(ans = aj);
+	}
+    }
+    if (!islist && ans == R_NilValue) {
+	UNPROTECT(1);
+	return R_NilValue;
+    }
+
+    /* Each thread needs its own workspace; nothing below raises an
+       error until these are freed. */
+    int nthreads = 1;
+#ifdef _OPENMP
+    if (ncol > 1 && (double) n * ncol >= R_SUM_THREADS_MIN &&
+	R_num_math_threads > 1)
+	nthreads = R_num_math_threads < ncol ? R_num_math_threads : ncol;
+#endif
+    gagg_work_t *work = Calloc(nthreads, gagg_work_t);
+    for (int t = 0; t < nthreads; t++) {
+	/* s also holds LONG_INT sums */
+	work[t].s = Calloc(4 * (size_t) ng + 1, LDOUBLE);
+	work[t].m = Calloc((size_t) ng + 1, LDOUBLE);
+	work[t].pos = Calloc((size_t) ng + 1, R_xlen_t);
+	work[t].cnt = Calloc((size_t) ng + 1, R_xlen_t);
+	work[t].d = Calloc((size_t) ng + 1, double);
+	work[t].iv = Calloc((size_t) ng + 1, int);
+	work[t].state = Calloc((size_t) ng + 1, char);
+    }
+    char *ok = (char *) R_alloc(ncol, sizeof(char));
+
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(nthreads) schedule(dynamic) \
+    default(none) firstprivate(x, ans, gp, n, ng, size, fun, narm, \
+			       islist, ncol, work, ok, R_NilValue)
+#endif
+    for (int j = 0; j < ncol; j++) {
+	SEXP xj = islist ? VECTOR_ELT(x, j) : x,
+	    aj = islist ? VECTOR_ELT(ans, j) : ans;
+	int t = 0;
+#ifdef _OPENMP
+	t = omp_get_thread_num();
+#endif
+	ok[j] = aj != R_NilValue &&
+	    gagg_column(xj, aj, gp, n, ng, size, fun, narm, work + t);
+    }
+
+    for (int t = 0; t < nthreads; t++) {
+	Free(work[t].s); Free(work[t].m); Free(work[t].pos);
+	Free(work[t].cnt); Free(work[t].d); Free(work[t].iv);
+	Free(work[t].state);
+    }
+    Free(work);
+
+    if (!islist) {
+	UNPROTECT(1);
+	return ok[0] ? ans : R_NilValue;
+    }
+    for (int j = 0; j < ncol; j++)
+	if (!ok[j]) SET_VECTOR_ELT(ans, j, R_NilValue);
+    UNPROTECT(1);
+    return ans;
+}
@@ -27,6 +27,7 @@
 #define R_USE_SIGNALS 1
 #include <Defn.h>
 #include <Internal.h>
+#include <R_ext/RS.h>	/* for Calloc/Free */
 
 #define NIL -1
 #define ARGUSED(x) LEVELS(x)
@@ -36,6 +37,7 @@
 #define NINTERRUPT 1000000
 
 typedef size_t hlen;
+typedef uint64_t hcode;
 
 /* Hash function and equality test for keys */
 typedef struct _HashData HashData;
@@ -47,23 +49,26 @@ struct _HashData {
 #ifdef LONG_VECTOR_SUPPORT
     Rboolean isLong;
 #endif
-    hlen (*hash)(SEXP, R_xlen_t, HashData *);
+    hcode (*hash)(SEXP, R_xlen_t, HashData *);
     int (*equal)(SEXP, R_xlen_t, SEXP, R_xlen_t);
     SEXP HashTable;
 
     int nomatch;
     Rboolean useUTF8;
     Rboolean useCache;
+    int P; /* log2 of the number of partitions, see hashPartitioned() */
 };
 
 
 /*
-   Integer keys are hashed via a random number generator
-   based on Knuth's recommendations.  The high order K bits
-   are used as the hash code.
+   Keys are hashed to 64-bit codes by mixing their bits with the
+   finalizer of MurmurHash3, so that keys differing in any bits give
+   unrelated codes.  The high order K bits of the code are the slot,
+   and the low order 32 bits are kept in the table with the index, so
+   that most probes of other keys are rejected without calling the
+   equality function.
 
-   NB: lots of this code relies on M being a power of two and
-   on silent integer overflow mod 2^32.
+   NB: lots of this code relies on M being a power of two.
 
    <FIXME> Integer keys are wasteful for logical and raw vectors, but
    the tables are small in that case.  It would be much easier to
@@ -71,114 +76,94 @@ struct _HashData {
 */
 
 /*  Currently the hash table is implemented as a (signed) integer
-    array.  So there are two 31-bit restrictions, the length of the
-    array and the values.  The values are initially NIL (-1).  O-based
-    indices are inserted by isDuplicated, and invalidated by setting
-    to NA_INTEGER.
+    array of 2M elements, holding for slot i a 0-based index in element
+    2i and its tag in element 2i+1.  So there are two 31-bit
+    restrictions, the length of the array and the values.  The indices
+    are initially NIL (-1).  O-based indices are inserted by
+    isDuplicated, and invalidated by setting to NA_INTEGER.
 */
 
-static hlen scatter(unsigned int key, HashData *d)
+#define HSLOT(code, d) ((hlen) ((code) >> (64 - (d)->K)))
+#define HTAG(code) ((int) (uint32_t) (code))
+
+static R_INLINE hcode scatter(uint64_t key)
+{
+    key ^= key >> 33;
+    key *= 0xff51afd7ed558ccdULL;
+    key ^= key >> 33;
+    key *= 0xc4ceb9fe1a85ec53ULL;
+    key ^= key >> 33;
+    return key;
+}
+
+static R_INLINE uint64_t double_bits(double x)
 {
-    return 3141592653U * key >> (32 - d->K);
+    uint64_t u;
+    memcpy(&u, &x, sizeof(u));
+    return u;
 }
 
-static hlen lhash(SEXP x, R_xlen_t indx, HashData *d)
+/* logical and raw tables have a slot for each value */
+static hcode lhash(SEXP x, R_xlen_t indx, HashData *d)
 {
-    if (LOGICAL(x)[indx] == NA_LOGICAL) return 2U;
-    return (hlen) LOGICAL(x)[indx];
+    if (LOGICAL(x)[indx] == NA_LOGICAL) return (hcode) 2U << 62;
+    return (hcode) LOGICAL(x)[indx] << 62;
 }
 
-static hlen ihash(SEXP x, R_xlen_t indx, HashData *d)
+static hcode ihash(SEXP x, R_xlen_t indx, HashData *d)
 {
     if (INTEGER(x)[indx] == NA_INTEGER) return 0;
-    return scatter((unsigned int) (INTEGER(x)[indx]), d);
+    return scatter((unsigned int) (INTEGER(x)[indx]));
 }
 
-/* We use unions here because Solaris gcc -O2 has trouble with
-   casting + incrementing pointers.  We use tests here, but R currently
-   assumes int is 4 bytes and double is 8 bytes.
- */
-union foo {
-    double d;
-    unsigned int u[2];
-};
+/* we want all NaNs except NA equal, and all NAs equal, and
+   there is a problem with signed 0s under IEC60559 */
+static R_INLINE double unify_double(double x)
+{
+    if (!ISNAN(x)) return (x == 0.0) ? 0.0 : x;
+    return R_IsNA(x) ? NA_REAL : R_NaN;
+}
 
-static hlen rhash(SEXP x, R_xlen_t indx, HashData *d)
+static hcode rhash(SEXP x, R_xlen_t indx, HashData *d)
 {
-    /* There is a problem with signed 0s under IEC60559 */
-    double tmp = (REAL(x)[indx] == 0.0) ? 0.0 : REAL(x)[indx];
-    /* need to use both 32-byte chunks or endianness is an issue */
-    /* we want all NaNs except NA equal, and all NAs equal */
-    if (R_IsNA(tmp)) tmp = NA_REAL;
-    else if (R_IsNaN(tmp)) tmp = R_NaN;
-#if 2*SIZEOF_INT == SIZEOF_DOUBLE
-    {
-	union foo tmpu;
-	tmpu.d = tmp;
-	return scatter(tmpu.u[0] + tmpu.u[1], d);
-    }
-#else
-    return scatter(*((unsigned int *) (&tmp)), d);
-#endif
+    return scatter(double_bits(unify_double(REAL(x)[indx])));
 }
 
 static Rcomplex unify_complex_na(Rcomplex z) {
     Rcomplex ans;
-    ans.r = (z.r == 0.0) ? 0.0 : z.r;
-    ans.i = (z.i == 0.0) ? 0.0 : z.i;
-    /* we want all NaNs except NA equal, and all NAs equal */
-    if (R_IsNA(ans.r)) ans.r = NA_REAL;
-    else if (R_IsNaN(ans.r)) ans.r = R_NaN;
-    if (R_IsNA(ans.i)) ans.i = NA_REAL;
-    else if (R_IsNaN(ans.i)) ans.i = R_NaN;
+    ans.r = unify_double(z.r);
+    ans.i = unify_double(z.i);
     return ans;
 }
 
-static hlen chash(SEXP x, R_xlen_t indx, HashData *d)
+static hcode chash(SEXP x, R_xlen_t indx, HashData *d)
 {
     Rcomplex tmp = unify_complex_na(COMPLEX(x)[indx]);
-
-#if 2*SIZEOF_INT == SIZEOF_DOUBLE
-    {
-	unsigned int u;
-	union foo tmpu;
-	tmpu.d = tmp.r;
-	u = tmpu.u[0] ^ tmpu.u[1];
-	tmpu.d = tmp.i;
-	u ^= tmpu.u[0] ^ tmpu.u[1];
-	return scatter(u, d);
-    }
-#else
-	return scatter((*((unsigned int *)(&tmp.r)) ^
-			(*((unsigned int *)(&tmp.i)))), d);
-#endif
+    /* Symmetric in the two parts, as the XOR of their words was
+       before: which values with NA or NaN parts match depends on
+       this, as cplx_eq() is only consulted for equal codes. */
+    return scatter(double_bits(tmp.r)) + scatter(double_bits(tmp.i));
 }
 
-/* Hash CHARSXP by address.  Hash values are int, For 64bit pointers,
- * we do (upper ^ lower) */
-static hlen cshash(SEXP x, R_xlen_t indx, HashData *d)
+/* Hash CHARSXP by address. */
+static hcode cshash(SEXP x, R_xlen_t indx, HashData *d)
 {
-    intptr_t z = (intptr_t) STRING_ELT(x, indx);
-    unsigned int z1 = (unsigned int)(z & 0xffffffff), z2 = 0;
-#if SIZEOF_LONG == 8
-    z2 = (unsigned int)(z/0x100000000L);
-#endif
-    return scatter(z1 ^ z2, d);
+    return scatter((uint64_t) (uintptr_t) STRING_ELT(x, indx));
 }
 
-static hlen shash(SEXP x, R_xlen_t indx, HashData *d)
+/* FNV-1a of the UTF-8 bytes */
+static hcode shash(SEXP x, R_xlen_t indx, HashData *d)
 {
-    unsigned int k;
-    const char *p;
+    uint64_t k = 14695981039346656037ULL;
+    const unsigned char *p;
     const void *vmax = vmaxget();
     if(!d->useUTF8 && d->useCache) return cshash(x, indx, d);
     /* Not having d->useCache really should not happen anymore. */
-    p = translateCharUTF8(STRING_ELT(x, indx));
-    k = 0;
-    while (*p++)
-	k = 11 * k + (unsigned int) *p; /* was 8 but 11 isn't a power of 2 */
+    p = (const unsigned char *) translateCharUTF8(STRING_ELT(x, indx));
+    while (*p)
+	k = (k ^ *p++) * 1099511628211ULL;
     vmaxset(vmax); /* discard any memory used by translateChar */
-    return scatter(k, d);
+    return scatter(k);
 }
 
 static int lequal(SEXP x, R_xlen_t i, SEXP y, R_xlen_t j)
@@ -204,7 +189,6 @@ static int requal(SEXP x, R_xlen_t i, SEXP y, R_xlen_t j)
     else if (R_IsNaN(REAL(x)[i]) && R_IsNaN(REAL(y)[j])) return 1;
     else return 0;
 }
-
 /* This is differentiating {NA,1}, {NA,0}, {NA, NaN}, {NA, NA},
  * but R's print() and format()  render all as "NA" */
 static int cplx_eq(Rcomplex x, Rcomplex y)
@@ -241,9 +225,9 @@ static int sequal(SEXP x, R_xlen_t i, SEXP y, R_xlen_t j)
     return Seql(STRING_ELT(x, i), STRING_ELT(y, j));
 }
 
-static hlen rawhash(SEXP x, R_xlen_t indx, HashData *d)
+static hcode rawhash(SEXP x, R_xlen_t indx, HashData *d)
 {
-    return (hlen) RAW(x)[indx];
+    return (hcode) RAW(x)[indx] << 56;
 }
 
 static int rawequal(SEXP x, R_xlen_t i, SEXP y, R_xlen_t j)
@@ -252,10 +236,10 @@ static int rawequal(SEXP x, R_xlen_t i, SEXP y, R_xlen_t j)
     return (RAW(x)[i] == RAW(y)[j]);
 }
 
-static hlen vhash(SEXP x, R_xlen_t indx, HashData *d)
+static hcode vhash(SEXP x, R_xlen_t indx, HashData *d)
 {
     int i;
-    unsigned int key;
+    hcode key;
     SEXP _this = VECTOR_ELT(x, indx);
 
     key = OBJECT(_this) + 2*TYPEOF(_this) + 100U*(unsigned int) length(_this);
@@ -294,7 +278,7 @@ static hlen vhash(SEXP x, R_xlen_t indx, HashData *d)
 	break;
     case RAWSXP:
 	for(i = 0; i < LENGTH(_this); i++) {
-	    key ^= scatter((unsigned int)rawhash(_this, i, d), d);
+	    key ^= rawhash(_this, i, d);
 	    key *= 97;
 	}
 	break;
@@ -307,7 +291,7 @@ static hlen vhash(SEXP x, R_xlen_t indx, HashData *d)
     default:
 	break;
     }
-    return scatter(key, d);
+    return scatter(key);
 }
 
 static int vequal(SEXP x, R_xlen_t i, SEXP y, R_xlen_t j)
@@ -352,12 +336,13 @@ static void HashTableSetup(SEXP x, HashData *d, R_xlen_t nmax)
 {
     d->useUTF8 = FALSE;
     d->useCache = TRUE;
+    d->P = 0;
     switch (TYPEOF(x)) {
     case LGLSXP:
 	d->hash = lhash;
 	d->equal = lequal;
 	d->nmax = d->M = 4;
-	d->K = 2; /* unused */
+	d->K = 2; /* the slot is the value, see lhash() */
 	break;
     case INTSXP:
     {
@@ -391,7 +376,7 @@ static void HashTableSetup(SEXP x, HashData *d, R_xlen_t nmax)
 	d->hash = rawhash;
 	d->equal = rawequal;
 	d->nmax = d->M = 256;
-	d->K = 8; /* unused */
+	d->K = 8; /* the slot is the value, see rawhash() */
 	break;
     case VECSXP:
 	d->hash = vhash;
@@ -404,47 +389,69 @@ static void HashTableSetup(SEXP x, HashData *d, R_xlen_t nmax)
 #ifdef LONG_VECTOR_SUPPORT
     d->isLong = IS_LONG_VEC(x);
     if (d->isLong) {
-	d->HashTable = allocVector(REALSXP, (R_xlen_t) d->M);
-	for (R_xlen_t i = 0; i < d->M; i++) REAL(d->HashTable)[i] = NIL;
+	d->HashTable = allocVector(REALSXP, 2 * (R_xlen_t) d->M);
+	for (R_xlen_t i = 0; i < 2 * (R_xlen_t) d->M; i++)
+	    REAL(d->HashTable)[i] = NIL;
     } else
 #endif
     {
-	d->HashTable = allocVector(INTSXP, (R_xlen_t) d->M);
-	for (R_xlen_t i = 0; i < d->M; i++) INTEGER(d->HashTable)[i] = NIL;
+	d->HashTable = allocVector(INTSXP, 2 * (R_xlen_t) d->M);
+	for (R_xlen_t i = 0; i < 2 * (R_xlen_t) d->M; i++)
+	    INTEGER(d->HashTable)[i] = NIL;
     }
 }
 
 /* Open address hashing */
 /* Collision resolution is by linear probing */
 /* The table is guaranteed large so this is sufficient */
+/* Slot i has its index in h[2*i] and its tag in h[2*i+1]: equal() is
+   only called for entries whose tag matches */
+
+/* A partitioned table is 2^P tables of M / 2^P slots, probing wraps
+   around within each; the high P bits of the hash choose the table */
+static R_INLINE hlen nextSlot(hlen i, HashData *d)
+{
+    if (d->P == 0) return (i + 1) % d->M;
+    hlen size = d->M >> d->P;
+    return (i & ~(size - 1)) + ((i + 1) & (size - 1));
+}
+
+static R_INLINE int isDuplicatedCode(SEXP x, R_xlen_t indx, hcode code,
+				     HashData *d)
+{
+    int *h = INTEGER(d->HashTable), tag = HTAG(code);
+    hlen i = HSLOT(code, d);
+    while (h[2*i] != NIL) {
+	if (h[2*i+1] == tag && d->equal(x, h[2*i], x, indx))
+	    return h[2*i] >= 0 ? 1 : 0;
+	i = nextSlot(i, d);
+    }
+    if (d->nmax-- < 0) error("hash table is full");
+    h[2*i] = (int) indx;
+    h[2*i+1] = tag;
+    return 0;
+}
 
 static int isDuplicated(SEXP x, R_xlen_t indx, HashData *d)
 {
 #ifdef LONG_VECTOR_SUPPORT
     if (d->isLong) {
 	double *h = REAL(d->HashTable);
-	hlen i = d->hash(x, indx, d);
-	while (h[i] != NIL) {
-	    if (d->equal(x, (R_xlen_t) h[i], x, indx))
-		return h[i] >= 0 ? 1 : 0;
-	    i = (i + 1) % d->M;
-	}
-	if (d->nmax-- < 0) error("hash table is full");
-	h[i] = (double) indx;
-    } else
-#endif
-    {
-	int *h = INTEGER(d->HashTable);
-	hlen i = d->hash(x, indx, d);
-	while (h[i] != NIL) {
-	    if (d->equal(x, h[i], x, indx))
-		return h[i] >= 0 ? 1 : 0;
-	    i = (i + 1) % d->M;
+	hcode code = d->hash(x, indx, d);
+	double tag = HTAG(code);
+	hlen i = HSLOT(code, d);
+	while (h[2*i] != NIL) {
+	    if (h[2*i+1] == tag && d->equal(x, (R_xlen_t) h[2*i], x, indx))
+		return h[2*i] >= 0 ? 1 : 0;
+	    i = nextSlot(i, d);
 	}
 	if (d->nmax-- < 0) error("hash table is full");
-	h[i] = (int) indx;
+	h[2*i] = (double) indx;
+	h[2*i+1] = tag;
+	return 0;
     }
-    return 0;
+#endif
+    return isDuplicatedCode(x, indx, d->hash(x, indx, d), d);
 }
 
 static void removeEntry(SEXP table, SEXP x, R_xlen_t indx, HashData *d)
@@ -452,27 +459,190 @@ static void removeEntry(SEXP table, SEXP x, R_xlen_t indx, HashData *d)
 #ifdef LONG_VECTOR_SUPPORT
     if (d->isLong) {
 	double *h = REAL(d->HashTable);
-	hlen i = d->hash(x, indx, d);
-	while (h[i] >= 0) {
-	    if (d->equal(table, (R_xlen_t) h[i], x, indx)) {
-		h[i] = NA_INTEGER;  /* < 0, only index values are inserted */
+	hcode code = d->hash(x, indx, d);
+	double tag = HTAG(code);
+	hlen i = HSLOT(code, d);
+	while (h[2*i] >= 0) {
+	    if (h[2*i+1] == tag && d->equal(table, (R_xlen_t) h[2*i], x, indx)) {
+		h[2*i] = NA_INTEGER;  /* < 0, only index values are inserted */
 		return;
 	    }
-	    i = (i + 1) % d->M;
+	    i = nextSlot(i, d);
 	}
     } else
 #endif
     {
 	int *h = INTEGER(d->HashTable);
-	hlen i = d->hash(x, indx, d);
-	while (h[i] >= 0) {
-	    if (d->equal(table, h[i], x, indx)) {
-		h[i] = NA_INTEGER;  /* < 0, only index values are inserted */
+	hcode code = d->hash(x, indx, d);
+	int tag = HTAG(code);
+	hlen i = HSLOT(code, d);
+	while (h[2*i] >= 0) {
+	    if (h[2*i+1] == tag && d->equal(table, h[2*i], x, indx)) {
+		h[2*i] = NA_INTEGER;  /* < 0, only index values are inserted */
 		return;
 	    }
-	    i = (i + 1) % d->M;
+	    i = nextSlot(i, d);
+	}
+    }
+}
+
+#ifdef __GNUC__
+# define HASH_PREFETCH(p) __builtin_prefetch(p)
+#else
+# define HASH_PREFETCH(p)
+#endif
+#define HASH_BLOCK 16
+
+/* Insert the n elements of x in order, or in reverse for from_last,
+   setting v[i] (if v is not NULL) to isDuplicated(x, i, d).  The codes
+   of a block of elements are computed first and their slots
+   prefetched, so the cache misses of a large table overlap rather
+   than being taken in turn. */
+static void hashInsertAll(SEXP x, R_xlen_t n, HashData *d, int *v,
+			  Rboolean from_last)
+{
+#ifdef LONG_VECTOR_SUPPORT
+    if (d->isLong) {
+	for (R_xlen_t k = 0; k < n; k++) {
+	    R_xlen_t i = from_last ? n - 1 - k : k;
+	    int dup = isDuplicated(x, i, d);
+	    if (v) v[i] = dup;
+	}
+	return;
+    }
+#endif
+    hcode code[HASH_BLOCK];
+    int *h = INTEGER(d->HashTable);
+    for (R_xlen_t k = 0; k < n; k += HASH_BLOCK) {
+	int nb = (n - k < HASH_BLOCK) ? (int) (n - k) : HASH_BLOCK;
+	for (int b = 0; b < nb; b++) {
+	    R_xlen_t i = from_last ? n - 1 - k - b : k + b;
+	    code[b] = d->hash(x, i, d);
+	    HASH_PREFETCH(h + 2 * HSLOT(code[b], d));
+	}
+	for (int b = 0; b < nb; b++) {
+	    R_xlen_t i = from_last ? n - 1 - k - b : k + b;
+	    int dup = isDuplicatedCode(x, i, code[b], d);
+	    if (v) v[i] = dup;
+	}
+    }
+}
+
+/* Tables for vectors of R_HASH_THREADS_MIN or more elements are built
+   and probed on R_num_math_threads threads.  To build one, the table
+   is partitioned by the high bits of the hash code: each thread scans
+   all of x in order, or in reverse for fromLast, and inserts the
+   elements hashing into its own partition.  Equal elements hash to
+   the same partition, so each is found to be a duplicate or not just
+   as by the sequential loop, and the table holds the same first
+   occurrences.  This is only done where the hash and equality
+   functions are safe to call from several threads, and where their
+   results do not depend on re-encoding strings. */
+#define R_HASH_THREADS_MIN 1000000
+
+static R_INLINE int hash_nthreads(R_xlen_t n)
+{
+#ifdef _OPENMP
+    if (n >= R_HASH_THREADS_MIN && R_num_math_threads > 1)
+	return R_num_math_threads;
+#endif
+    return 1;
+}
+
+#ifdef _OPENMP
+static Rboolean hashThreadSafe(SEXP x, HashData *d)
+{
+    switch (TYPEOF(x)) {
+    case LGLSXP:
+    case INTSXP:
+    case REALSXP:
+    case CPLXSXP:
+    case RAWSXP:
+	return TRUE;
+    case STRSXP:
+	/* strings are compared by address unless in known encodings */
+	if (d->useUTF8 || !d->useCache) return FALSE;
+	for (R_xlen_t i = 0; i < XLENGTH(x); i++)
+	    if (ENC_KNOWN(STRING_ELT(x, i))) return FALSE;
+	return TRUE;
+    default:
+	return FALSE;
+    }
+}
+#endif
+
+/* Insert the elements of x into the empty table d, setting v[i] (if v
+   is not NULL) as isDuplicated() would.  Returns FALSE, with the table
+   still empty, if this is not done in parallel. */
+static Rboolean hashPartitioned(SEXP x, HashData *d, int *v,
+				Rboolean from_last)
+{
+#ifdef _OPENMP
+    R_xlen_t n = XLENGTH(x);
+    int nthreads = hash_nthreads(n), P = 0, full = 0;
+
+    if (nthreads < 2 || d->M < (hlen) n) return FALSE;
+# ifdef LONG_VECTOR_SUPPORT
+    if (d->isLong) return FALSE;
+# endif
+    switch (TYPEOF(x)) {
+    case INTSXP:
+    case REALSXP:
+    case CPLXSXP:
+    case STRSXP:
+	break;
+    default:
+	return FALSE;
+    }
+    if (!hashThreadSafe(x, d)) return FALSE;
+    while ((2 << P) <= nthreads && P < d->K - 10) P++;
+    if (P == 0) return FALSE;
+
+    int nparts = 1 << P, shift = d->K - P, *h = INTEGER(d->HashTable);
+    hlen size = d->M >> P;
+    d->P = P;
+#pragma omp parallel for num_threads(nparts) default(none) \
+    firstprivate(x, d, v, h, n, nparts, shift, size, from_last) \
+    reduction(|:full)
+    for (int t = 0; t < nparts; t++) {
+	hlen used = 0;
+	for (R_xlen_t k = 0; k < n; k++) {
+	    R_xlen_t i = from_last ? n - 1 - k : k;
+	    hcode code = d->hash(x, i, d);
+	    hlen j = HSLOT(code, d);
+	    int tag = HTAG(code);
+	    if ((j >> shift) != (hlen) t) continue;
+	    int dup = 0;
+	    while (h[2*j] != NIL) {
+		if (h[2*j+1] == tag && d->equal(x, h[2*j], x, i)) {
+		    dup = 1;
+		    break;
+		}
+		j = nextSlot(j, d);
+	    }
+	    if (v) v[i] = dup;
+	    if (!dup) {
+		/* keep a free slot to end probes; start again sequentially
+		   if a partition is this unevenly loaded */
+		if (++used == size) {
+		    full = 1;
+		    break;
+		}
+		h[2*j] = (int) i;
+		h[2*j+1] = tag;
+	    }
 	}
     }
+    if (full) {
+	for (hlen i = 0; i < 2 * d->M; i++) h[i] = NIL;
+	d->P = 0;
+	return FALSE;
+    }
+    d->nmax -= n;
+    return TRUE;
+#else
+    return FALSE;
+#endif
 }
 
 #define DUPLICATED_INIT						\
@@ -493,6 +663,45 @@ static void removeEntry(SEXP table, SEXP x, R_xlen_t indx, HashData *d)
 	}							\
     }
 
+/* Equal elements of a vector of known sortedness are next to each
+   other, so it needs no hashing.  NaNs are left to the hash table, as
+   NA and NaN need not be grouped. */
+static Rboolean sortedAdjacent(SEXP x)
+{
+    int sorted = R_KnownSorted(x);
+    return sorted != UNKNOWN_SORTEDNESS &&
+	(TYPEOF(x) != REALSXP || !R_SortedAnyNA(x, sorted));
+}
+
+#define SORTED_EQ(i, j) (TYPEOF(x) == REALSXP ?			\
+			 REAL(x)[i] == REAL(x)[j] : INTEGER(x)[i] == INTEGER(x)[j])
+
+static void sortedDuplicated(SEXP x, int *v, Rboolean from_last)
+{
+    R_xlen_t n = XLENGTH(x);
+    if (n == 0) return;
+    if (from_last) {
+	for (R_xlen_t i = 0; i < n - 1; i++) v[i] = SORTED_EQ(i, i + 1);
+	v[n - 1] = 0;
+    } else {
+	v[0] = 0;
+	for (R_xlen_t i = 1; i < n; i++) v[i] = SORTED_EQ(i, i - 1);
+    }
+}
+
+static R_xlen_t sortedAnyDuplicated(SEXP x, Rboolean from_last)
+{
+    R_xlen_t n = XLENGTH(x);
+    if (from_last) {
+	for (R_xlen_t i = n - 2; i >= 0; i--)
+	    if (SORTED_EQ(i, i + 1)) return i + 1;
+    } else {
+	for (R_xlen_t i = 1; i < n; i++)
+	    if (SORTED_EQ(i, i - 1)) return i + 1;
+    }
+    return 0;
+}
+
 /* used in scan() */
 SEXP duplicated(SEXP x, Rboolean from_last)
 {
@@ -501,6 +710,11 @@ SEXP duplicated(SEXP x, Rboolean from_last)
 
     if (!isVector(x)) error(_("'duplicated' applies only to vectors"));
     R_xlen_t i, n = XLENGTH(x);
+    if (sortedAdjacent(x)) {
+	ans = allocVector(LGLSXP, n);
+	sortedDuplicated(x, LOGICAL(ans), from_last);
+	return ans;
+    }
     DUPLICATED_INIT;
 
     PROTECT(data.HashTable);
@@ -508,16 +722,8 @@ SEXP duplicated(SEXP x, Rboolean from_last)
 
     v = LOGICAL(ans);
 
-    if(from_last)
-	for (i = n-1; i >= 0; i--) {
-//	    if ((i+1) % NINTERRUPT == 0) R_CheckUserInterrupt();
-	    v[i] = isDuplicated(x, i, &data);
-	}
-    else
-	for (i = 0; i < n; i++) {
-//	    if ((i+1) % NINTERRUPT == 0) R_CheckUserInterrupt();
-	    v[i] = isDuplicated(x, i, &data);
-	}
+    if (!hashPartitioned(x, &data, v, from_last))
+	hashInsertAll(x, n, &data, v, from_last);
 
     UNPROTECT(2);
     return ans;
@@ -530,6 +736,11 @@ static SEXP Duplicated(SEXP x, Rboolean from_last, int nmax)
 
     if (!isVector(x)) error(_("'duplicated' applies only to vectors"));
     R_xlen_t i, n = XLENGTH(x);
+    if (sortedAdjacent(x)) {
+	ans = allocVector(LGLSXP, n);
+	sortedDuplicated(x, LOGICAL(ans), from_last);
+	return ans;
+    }
     DUPLICATED_INIT;
 
     PROTECT(data.HashTable);
@@ -537,16 +748,8 @@ static SEXP Duplicated(SEXP x, Rboolean from_last, int nmax)
 
     v = LOGICAL(ans);
 
-    if(from_last)
-	for (i = n-1; i >= 0; i--) {
-//	    if ((i+1) % NINTERRUPT == 0) R_CheckUserInterrupt();
-	    v[i] = isDuplicated(x, i, &data);
-	}
-    else
-	for (i = 0; i < n; i++) {
-//	    if ((i+1) % NINTERRUPT == 0) R_CheckUserInterrupt();
-	    v[i] = isDuplicated(x, i, &data);
-	}
+    if (!hashPartitioned(x, &data, v, from_last))
+	hashInsertAll(x, n, &data, v, from_last);
 
     UNPROTECT(2);
     return ans;
@@ -560,6 +763,8 @@ R_xlen_t any_duplicated(SEXP x, Rboolean from_last)
 
     if (!isVector(x)) error(_("'duplicated' applies only to vectors"));
     R_xlen_t i, n = XLENGTH(x);
+    if (sortedAdjacent(x))
+	return sortedAnyDuplicated(x, from_last);
 
     DUPLICATED_INIT;
     PROTECT(data.HashTable);
@@ -591,16 +796,8 @@ static SEXP duplicated3(SEXP x, SEXP incomp, Rboolean from_last, int nmax)
 
     v = LOGICAL(ans);
 
-    if(from_last)
-	for (i = n-1; i >= 0; i--) {
-//	    if ((i+1) % NINTERRUPT == 0) R_CheckUserInterrupt();
-	    v[i] = isDuplicated(x, i, &data);
-	}
-    else
-	for (i = 0; i < n; i++) {
-//	    if ((i+1) % NINTERRUPT == 0) R_CheckUserInterrupt();
-	    v[i] = isDuplicated(x, i, &data);
-	}
+    if (!hashPartitioned(x, &data, v, from_last))
+	hashInsertAll(x, n, &data, v, from_last);
 
     if(length(incomp)) {
 	PROTECT(incomp = coerceVector(incomp, TYPEOF(x)));
@@ -771,6 +968,10 @@ SEXP attribute_hidden do_duplicated(SEXP call, SEXP op, SEXP args, SEXP env)
     default:
 	UNIMPLEMENTED_TYPE("duplicated", x);
     }
+    if (sortedAdjacent(x)) { /* so is the result */
+	MARK_NOT_MUTABLE(ans);
+	SET_SORTED(ans, R_KnownSorted(x));
+    }
     UNPROTECT(2);
     return ans;
 }
@@ -778,11 +979,8 @@ SEXP attribute_hidden do_duplicated(SEXP call, SEXP op, SEXP args, SEXP env)
 /* Build a hash table, ignoring information on duplication */
 static void DoHashing(SEXP table, HashData *d)
 {
-    R_xlen_t i, n = XLENGTH(table);
-    for (i = 0; i < n; i++) {
-//	if ((i+1) % NINTERRUPT == 0) R_CheckUserInterrupt();
-	(void) isDuplicated(table, i, d);
-    }
+    if (!hashPartitioned(table, d, NULL, FALSE))
+	hashInsertAll(table, XLENGTH(table), d, NULL, FALSE);
 }
 
 /* invalidate entries: normally few */
@@ -791,30 +989,68 @@ static void UndoHashing(SEXP x, SEXP table, HashData *d)
     for (R_xlen_t i = 0; i < XLENGTH(x); i++) removeEntry(table, x, i, d);
 }
 
+static R_INLINE int LookupCode(SEXP table, SEXP x, R_xlen_t indx,
+			       hcode code, HashData *d)
+{
+    int *h = INTEGER(d->HashTable), tag = HTAG(code);
+    hlen i = HSLOT(code, d);
+    while (h[2*i] != NIL) {
+	if (h[2*i+1] == tag && d->equal(table, h[2*i], x, indx))
+	    return h[2*i] >= 0 ? h[2*i] + 1 : d->nomatch;
+	i = nextSlot(i, d);
+    }
+    return d->nomatch;
+}
+
 static int Lookup(SEXP table, SEXP x, R_xlen_t indx, HashData *d)
 {
+    return LookupCode(table, x, indx, d->hash(x, indx, d), d);
+}
+
+/* Look up x[from], ..., x[to - 1]: the codes of a block of elements
+   are computed first and their slots prefetched, so the cache misses
+   of a large table overlap rather than being taken in turn. */
+static void LookupBlock(SEXP table, SEXP x, R_xlen_t from, R_xlen_t to,
+			int *pa, HashData *d)
+{
+    hcode code[HASH_BLOCK];
     int *h = INTEGER(d->HashTable);
-    hlen i = d->hash(x, indx, d);
-    while (h[i] != NIL) {
-	if (d->equal(table, h[i], x, indx))
-	    return h[i] >= 0 ? h[i] + 1 : d->nomatch;
-	i = (i + 1) % d->M;
+    for (R_xlen_t i = from; i < to; i += HASH_BLOCK) {
+	int nb = (to - i < HASH_BLOCK) ? (int) (to - i) : HASH_BLOCK;
+	for (int k = 0; k < nb; k++) {
+	    code[k] = d->hash(x, i + k, d);
+	    HASH_PREFETCH(h + 2 * HSLOT(code[k], d));
+	}
+	for (int k = 0; k < nb; k++)
+	    pa[i + k] = LookupCode(table, x, i + k, code[k], d);
     }
-    return d->nomatch;
 }
 
 /* Now do the table lookup */
 static SEXP HashLookup(SEXP table, SEXP x, HashData *d)
 {
     SEXP ans;
-    R_xlen_t i, n;
+    R_xlen_t n;
 
     n = XLENGTH(x);
     PROTECT(ans = allocVector(INTSXP, n));
-    for (i = 0; i < n; i++) {
-//	if ((i+1) % NINTERRUPT == 0) R_CheckUserInterrupt();
-	INTEGER(ans)[i] = Lookup(table, x, i, d);
+    int *pa = INTEGER(ans);
+#ifdef _OPENMP
+    int nthreads = hash_nthreads(n);
+    if (nthreads > 1 && hashThreadSafe(x, d) &&
+	(TYPEOF(table) != STRSXP || hashThreadSafe(table, d))) {
+# pragma omp parallel for num_threads(nthreads) default(none) \
+    firstprivate(table, x, d, pa, n, nthreads)
+	for (int t = 0; t < nthreads; t++) {
+	    R_xlen_t from = n / nthreads * t,
+		to = (t == nthreads - 1) ? n : from + n / nthreads;
+	    LookupBlock(table, x, from, to, pa, d);
+	}
+	UNPROTECT(1);
+	return ans;
     }
+#endif
+    LookupBlock(table, x, 0, n, pa, d);
     UNPROTECT(1);
     return ans;
 }
@@ -836,7 +1072,628 @@ static SEXP match_transform(SEXP s, SEXP env)
     return duplicate(s);
 }
 
+/* Persistent hash indices.  hashIndex(table) hashes a table once, so
+   that match(x, index), x %in% index and the duplicated(), unique()
+   and anyDuplicated() methods for the index do not hash it again.
+
+   An index is an external pointer of class "hashIndex".  Its
+   protected value is the table, and its tag a list of the table as
+   transformed and coerced for matching and of the hash table.  The
+   table is marked as not mutable, so changing it from R code makes a
+   copy and the index goes on describing the values it was built from.
+   The HashData holds function pointers and is not serialized: an
+   index which has been saved and loaded again is rebuilt when first
+   used. */
+
+SEXP match5(SEXP, SEXP, int, SEXP, SEXP);
+
+typedef struct {
+    HashData d;
+    SEXPTYPE type;
+    R_xlen_t n, ndistinct;
+} HashIndex;
+
+static Rboolean isHashIndex(SEXP x)
+{
+    return TYPEOF(x) == EXTPTRSXP && inherits(x, "hashIndex");
+}
+
+static void hashIndexFinalizer(SEXP index)
+{
+    HashIndex *h = (HashIndex *) R_ExternalPtrAddr(index);
+    if (h) {
+	Free(h);
+	R_ClearExternalPtr(index);
+    }
+}
+
+/* as in match5(), for the strings of one of its arguments */
+static void stringHashFlags(SEXP x, Rboolean *useBytes, Rboolean *useUTF8,
+			    Rboolean *useCache)
+{
+    *useBytes = FALSE;
+    *useUTF8 = FALSE;
+    *useCache = TRUE;
+    for(R_xlen_t i = 0; i < XLENGTH(x); i++) {
+	SEXP s = STRING_ELT(x, i);
+	if(IS_BYTES(s)) {
+	    *useBytes = TRUE;
+	    *useUTF8 = FALSE;
+	    break;
+	}
+	if(ENC_KNOWN(s)) {
+	    *useUTF8 = TRUE;
+	}
+	if(!IS_CACHED(s)) {
+	    *useCache = FALSE;
+	    break;
+	}
+    }
+}
+
+static HashIndex *getHashIndex(SEXP index, SEXP env)
+{
+    HashIndex *h = (HashIndex *) R_ExternalPtrAddr(index);
+    if (h) return h;
+
+    HashData data;
+    SEXP table = R_ExternalPtrProtected(index), tr;
+    R_xlen_t n = xlength(table), nd = 0;
+    /* match_transform() would duplicate a plain table */
+    PROTECT(tr = OBJECT(table) ? match_transform(table, env) : table);
+    if (TYPEOF(tr) >= STRSXP) tr = coerceVector(tr, STRSXP);
+    PROTECT(tr);
+    if (IS_LONG_VEC(tr))
+	error(_("long vectors are not supported for hash indices"));
+    data.HashTable = R_NilValue;
+    if (n > 0) {
+	data.nomatch = 0;
+	HashTableSetup(tr, &data, NA_INTEGER);
+	if (TYPEOF(tr) == STRSXP) {
+	    Rboolean useBytes;
+	    stringHashFlags(tr, &useBytes, &data.useUTF8, &data.useCache);
+	}
+	PROTECT(data.HashTable);
+	for (R_xlen_t i = 0; i < n; i++)
+	    if (!isDuplicated(tr, i, &data)) nd++;
+    } else PROTECT(data.HashTable);
+    SEXP tag = PROTECT(allocVector(VECSXP, 2));
+    SET_VECTOR_ELT(tag, 0, tr);
+    SET_VECTOR_ELT(tag, 1, data.HashTable);
+    R_SetExternalPtrTag(index, tag);
+    UNPROTECT(4);
+
+    h = Calloc(1, HashIndex);
+    h->d = data;
+    h->type = TYPEOF(tr);
+    h->n = n;
+    h->ndistinct = nd;
+    R_SetExternalPtrAddr(index, h);
+    return h;
+}
+
+static SEXP hashIndexMatch(SEXP index, SEXP ix, int nmatch, SEXP incomp,
+			   SEXP env)
+{
+    HashIndex *h = getHashIndex(index, env);
+    SEXP x, ans, table = R_ExternalPtrProtected(index);
+    SEXPTYPE type;
+    Rboolean reuse;
+
+    /* incomparables would change the hash table */
+    if (h->n == 0 || incomp)
+	return match5(table, ix, nmatch, incomp, env);
+
+    PROTECT(x = match_transform(ix, env));
+    if(TYPEOF(x) >= STRSXP || h->type >= STRSXP) type = STRSXP;
+    else type = TYPEOF(x) < h->type ? h->type : TYPEOF(x);
+    reuse = type == h->type;
+    if (reuse) {
+	PROTECT(x = coerceVector(x, type));
+	if (type == STRSXP) {
+	    /* the table was hashed by address unless it needed UTF-8 */
+	    Rboolean useBytes, useUTF8, useCache;
+	    stringHashFlags(x, &useBytes, &useUTF8, &useCache);
+	    reuse = !useBytes && useCache && (!useUTF8 || h->d.useUTF8);
+	}
+	UNPROTECT(1);
+    }
+    if (!reuse) {
+	UNPROTECT(1);
+	return match5(table, ix, nmatch, NULL, env);
+    }
+    PROTECT(x);
+    HashData data = h->d;
+    data.nomatch = nmatch;
+    ans = HashLookup(VECTOR_ELT(R_ExternalPtrTag(index), 0), x, &data);
+    UNPROTECT(2);
+    return ans;
+}
+
+/* .Internal(hashIndex(table))		  [op=0]
+   .Internal(hashIndexTable(index))	  [op=1]
+   .Internal(hashIndexDuplicated(index))  [op=2]
+   .Internal(hashIndexAnyDuplicated(index)) [op=3]
+*/
+SEXP attribute_hidden do_hashindex(SEXP call, SEXP op, SEXP args, SEXP env)
+{
+    SEXP index = CAR(args), ans;
+
+    checkArity(op, args);
+    if (PRIMVAL(op) == 0) {
+	if (!isVector(index) && !isNull(index))
+	    error(_("'table' must be a vector"));
+	if (isHashIndex(index)) return index;
+	MARK_NOT_MUTABLE(index);
+	PROTECT(ans = R_MakeExternalPtr(NULL, R_NilValue, index));
+	R_RegisterCFinalizerEx(ans, hashIndexFinalizer, TRUE);
+	setAttrib(ans, R_ClassSymbol, mkString("hashIndex"));
+	getHashIndex(ans, env);
+	UNPROTECT(1);
+	return ans;
+    }
+
+    if (!isHashIndex(index))
+	error(_("'%s' is not a hash index"), "index");
+    if (PRIMVAL(op) == 1)
+	return R_ExternalPtrProtected(index);
+
+    HashIndex *h = getHashIndex(index, env);
+    SEXP tr = VECTOR_ELT(R_ExternalPtrTag(index), 0);
+    HashData data = h->d;
+    R_xlen_t i, n = h->n;
+    data.nomatch = 0;
+    /* the hash table holds the first of each set of equal elements */
+    if (PRIMVAL(op) == 2) {
+	PROTECT(ans = allocVector(LGLSXP, n));
+	int *v = LOGICAL(ans);
+	for (i = 0; i < n; i++)
+	    v[i] = Lookup(tr, tr, i, &data) != i + 1;
+	UNPROTECT(1);
+	return ans;
+    }
+    if (h->ndistinct < n)
+	for (i = 0; i < n; i++)
+	    if (Lookup(tr, tr, i, &data) != i + 1)
+		return ScalarInteger((int) i + 1);
+    return ScalarInteger(0);
+}
+
+/* Matching rows.  The keys are lists of atomic vectors of length n,
+   the columns, and key i is the tuple of their i-th elements, so that
+   several columns are matched together without pasting them into
+   strings.  Elements are compared as by match() and duplicated() of
+   the columns. */
+
+static hcode rowhash(SEXP x, R_xlen_t indx, HashData *d)
+{
+    hcode key = 0;
+    for (int j = 0; j < LENGTH(x); j++) {
+	SEXP col = VECTOR_ELT(x, j);
+	hcode h;
+	switch (TYPEOF(col)) {
+	case LGLSXP: h = lhash(col, indx, d); break;
+	case INTSXP: h = ihash(col, indx, d); break;
+	case REALSXP: h = rhash(col, indx, d); break;
+	case CPLXSXP: h = chash(col, indx, d); break;
+	case STRSXP: h = shash(col, indx, d); break;
+	case RAWSXP: h = rawhash(col, indx, d); break;
+	default: h = 0;
+	}
+	key = scatter(key ^ h) + j;
+    }
+    return scatter(key);
+}
+
+static int rowequal(SEXP x, R_xlen_t i, SEXP y, R_xlen_t j)
+{
+    if (i < 0 || j < 0) return 0;
+    for (int k = 0; k < LENGTH(x); k++) {
+	SEXP cx = VECTOR_ELT(x, k), cy = VECTOR_ELT(y, k);
+	int eq;
+	switch (TYPEOF(cx)) {
+	case LGLSXP: eq = lequal(cx, i, cy, j); break;
+	case INTSXP: eq = iequal(cx, i, cy, j); break;
+	case REALSXP: eq = requal(cx, i, cy, j); break;
+	case CPLXSXP: eq = cequal(cx, i, cy, j); break;
+	case STRSXP: eq = sequal(cx, i, cy, j); break;
+	case RAWSXP: eq = rawequal(cx, i, cy, j); break;
+	default: eq = 0;
+	}
+	if (!eq) return 0;
+    }
+    return 1;
+}
+
+/* The columns of x transformed as by match(), in a new list */
+static SEXP rowColumns(SEXP x, R_xlen_t n, SEXP env, const char *what)
+{
+    if (TYPEOF(x) != VECSXP)
+	error(_("'%s' must be a list"), what);
+    int ncol = LENGTH(x);
+    SEXP ans = PROTECT(allocVector(VECSXP, ncol));
+    for (int j = 0; j < ncol; j++) {
+	SEXP col = match_transform(VECTOR_ELT(x, j), env);
+	SET_VECTOR_ELT(ans, j, col);
+	if (!isVectorAtomic(col) || XLENGTH(col) != n)
+	    error(_("the columns of '%s' must be atomic vectors of length %lld"),
+		  what, (long long) n);
+    }
+    UNPROTECT(1);
+    return ans;
+}
+
+/* Coerce each pair of columns to a common type, as match() does */
+static void rowCommonTypes(SEXP x, SEXP table)
+{
+    for (int j = 0; j < LENGTH(x); j++) {
+	SEXP cx = VECTOR_ELT(x, j), ct = VECTOR_ELT(table, j);
+	SEXPTYPE type;
+	if (TYPEOF(cx) >= STRSXP || TYPEOF(ct) >= STRSXP) type = STRSXP;
+	else type = TYPEOF(cx) < TYPEOF(ct) ? TYPEOF(ct) : TYPEOF(cx);
+	SET_VECTOR_ELT(x, j, coerceVector(cx, type));
+	SET_VECTOR_ELT(table, j, coerceVector(ct, type));
+    }
+}
+
+static void HashTableSetupRows(SEXP x, SEXP y, R_xlen_t n, HashData *d)
+{
+    d->hash = rowhash;
+    d->equal = rowequal;
+    d->useUTF8 = FALSE;
+    d->useCache = TRUE;
+    d->P = 0;
+    Rboolean bytes = FALSE;
+    for (int k = 0; k < 2; k++) {
+	SEXP z = k ? y : x;
+	if (z == R_NilValue) continue;
+	for (int j = 0; j < LENGTH(z); j++) {
+	    SEXP col = VECTOR_ELT(z, j);
+	    Rboolean useBytes, useUTF8, useCache;
+	    if (TYPEOF(col) != STRSXP) continue;
+	    stringHashFlags(col, &useBytes, &useUTF8, &useCache);
+	    if (useBytes) bytes = TRUE;
+	    if (useUTF8) d->useUTF8 = TRUE;
+	    if (!useCache) d->useCache = FALSE;
+	}
+    }
+    if (bytes) d->useUTF8 = FALSE;
+    MKsetup(n, d, NA_INTEGER);
+#ifdef LONG_VECTOR_SUPPORT
+    d->isLong = n > R_SHORT_LEN_MAX;
+    if (d->isLong) {
+	d->HashTable = allocVector(REALSXP, 2 * (R_xlen_t) d->M);
+	for (R_xlen_t i = 0; i < 2 * (R_xlen_t) d->M; i++)
+	    REAL(d->HashTable)[i] = NIL;
+    } else
+#endif
+    {
+	d->HashTable = allocVector(INTSXP, 2 * (R_xlen_t) d->M);
+	for (R_xlen_t i = 0; i < 2 * (R_xlen_t) d->M; i++)
+	    INTEGER(d->HashTable)[i] = NIL;
+    }
+}
+
+/* .Internal(matchRows(x, table, nx, ntable, nomatch)),
+   .Internal(duplicatedRows(x, nx, fromLast)) and
+   .Internal(anyDuplicatedRows(x, nx, fromLast)) */
+SEXP attribute_hidden do_matchrows(SEXP call, SEXP op, SEXP args, SEXP env)
+{
+    SEXP x, table, ans;
+    HashData data;
+    R_xlen_t i, n;
+
+    checkArity(op, args);
+    if (PRIMVAL(op) == 0) {
+	n = (R_xlen_t) asReal(CADDR(args));
+	R_xlen_t nt = (R_xlen_t) asReal(CADDDR(args));
+	int nomatch = asInteger(CAD4R(args));
+	PROTECT(x = rowColumns(CAR(args), n, env, "x"));
+	PROTECT(table = rowColumns(CADR(args), nt, env, "table"));
+	if (LENGTH(x) != LENGTH(table))
+	    error(_("'x' and 'table' must have the same number of columns"));
+	if (nt > R_SHORT_LEN_MAX)
+	    error(_("long vectors not supported yet: %s:%d"), __FILE__, __LINE__);
+	rowCommonTypes(x, table);
+	PROTECT(ans = allocVector(INTSXP, n));
+	if (nt == 0) {
+	    for (i = 0; i < n; i++) INTEGER(ans)[i] = nomatch;
+	} else {
+	    HashTableSetupRows(x, table, nt, &data);
+	    PROTECT(data.HashTable);
+	    data.nomatch = nomatch;
+	    hashInsertAll(table, nt, &data, NULL, FALSE);
+	    LookupBlock(table, x, 0, n, INTEGER(ans), &data);
+	    UNPROTECT(1);
+	}
+	UNPROTECT(3);
+	return ans;
+    }
+
+    n = (R_xlen_t) asReal(CADR(args));
+    int from_last = asLogical(CADDR(args));
+    if (from_last == NA_LOGICAL)
+	error(_("'fromLast' must be TRUE or FALSE"));
+    PROTECT(x = rowColumns(CAR(args), n, env, "x"));
+    HashTableSetupRows(x, R_NilValue, n, &data);
+    PROTECT(data.HashTable);
+    if (PRIMVAL(op) == 1) {
+	PROTECT(ans = allocVector(LGLSXP, n));
+	hashInsertAll(x, n, &data, LOGICAL(ans), from_last);
+	UNPROTECT(1);
+    } else {
+	R_xlen_t result = 0;
+	for (R_xlen_t k = 0; k < n; k++) {
+	    i = from_last ? n - 1 - k : k;
+	    if (isDuplicated(x, i, &data)) { result = i + 1; break; }
+	}
+	ans = (result <= INT_MAX) ? ScalarInteger((int) result)
+	    : ScalarReal((double) result);
+    }
+    UNPROTECT(2);
+    return ans;
+}
+
+/* Joining rows.  The matching pairs of rows of x and y are found by
+   one of two strategies and then put in a canonical order, so that the
+   strategy only affects the speed: the pairs by row of x, each with
+   its rows of y in order (and by itself if it has none and all_x),
+   followed by the rows of y matching no row of x if all_y.
+
+   The hash join hashes the smaller of x and y and looks up the rows of
+   the other, so that a large y is streamed through rather than hashed.
+   The rows of the hashed side with equal keys are chained, first to
+   last, from the first of them, which is what the lookups give.
+
+   The merge join walks x and y in the order of their single integer
+   key, the order of rows with equal keys kept: with NAs last that is
+   the rows' own order for keys known to be sorted, so such keys are
+   joined without sorting or hashing. */
+
+typedef struct {
+    int *px, *py;	/* the matching pairs, 0-based */
+    R_xlen_t n;
+} JoinPairs;
+
+static void joinHash(SEXP x, SEXP y, int nx, int ny, JoinPairs *jp)
+{
+    Rboolean buildx = nx < ny;
+    SEXP b = buildx ? x : y, p = buildx ? y : x;
+    int nb = buildx ? nx : ny, np = buildx ? ny : nx;
+    HashData data;
+    HashTableSetupRows(b, p, nb, &data);
+    PROTECT(data.HashTable);
+    data.nomatch = 0;
+    hashInsertAll(b, nb, &data, NULL, FALSE);
+
+    int *first = (int *) R_alloc(nb, sizeof(int)),
+	*next = (int *) R_alloc(nb, sizeof(int)),
+	*last = (int *) R_alloc(nb, sizeof(int)),
+	*size = (int *) R_alloc(nb, sizeof(int)),
+	*m = (int *) R_alloc(np, sizeof(int));
+    LookupBlock(b, b, 0, nb, first, &data);
+    for (int i = 0; i < nb; i++) {
+	int h = first[i] - 1;
+	next[i] = -1;
+	if (h == i) {
+	    size[i] = 1;
+	    last[i] = i;
+	} else {
+	    size[h]++;
+	    next[last[h]] = i;
+	    last[h] = i;
+	}
+    }
+    LookupBlock(b, p, 0, np, m, &data);
+    UNPROTECT(1);
+
+    double dn = 0;
+    for (int j = 0; j < np; j++)
+	if (m[j]) dn += size[m[j] - 1];
+    if (dn > R_XLEN_T_MAX)
+	error(_("number of rows in the result exceeds maximum vector length"));
+    jp->n = (R_xlen_t) dn;
+    jp->px = (int *) R_alloc(jp->n, sizeof(int));
+    jp->py = (int *) R_alloc(jp->n, sizeof(int));
+    R_xlen_t k = 0;
+    for (int j = 0; j < np; j++)
+	if (m[j])
+	    for (int i = m[j] - 1; i >= 0; i = next[i], k++) {
+		jp->px[k] = buildx ? i : j;
+		jp->py[k] = buildx ? j : i;
+	    }
+}
+
+/* whether the order of x, with NAs last, is known to be 1:n */
+static Rboolean knownIncr(SEXP x)
+{
+    int sorted = R_KnownSorted(x);
+    return sorted == SORTED_INCR ||
+	(sorted == SORTED_INCR_NA_1ST && !R_SortedAnyNA(x, sorted));
+}
+
+static void joinMerge(SEXP cx, SEXP cy, int nx, int ny, JoinPairs *jp)
+{
+    const int *vx = INTEGER(cx), *vy = INTEGER(cy);
+    int *ox = (int *) R_alloc(nx, sizeof(int)),
+	*oy = (int *) R_alloc(ny, sizeof(int));
+    if (knownIncr(cx))
+	for (int i = 0; i < nx; i++) ox[i] = i;
+    else R_orderVector1(ox, nx, cx, TRUE, FALSE);
+    if (knownIncr(cy))
+	for (int j = 0; j < ny; j++) oy[j] = j;
+    else R_orderVector1(oy, ny, cy, TRUE, FALSE);
+
+    /* 1. count, 2. store the pairs */
+    for (int pass = 0; pass < 2; pass++) {
+	double dn = 0;
+	R_xlen_t k = 0;
+	for (int i = 0, j = 0, ni, nj; i < nx && j < ny; ) {
+	    int v = vx[ox[i]], w = vy[oy[j]];
+	    /* compare as the order did, NA being the largest key */
+	    if (v != w) {
+		if (v == NA_INTEGER || (w != NA_INTEGER && v > w)) j++;
+		else i++;
+		continue;
+	    }
+	    for (ni = i + 1; ni < nx && vx[ox[ni]] == v; ni++);
+	    for (nj = j + 1; nj < ny && vy[oy[nj]] == v; nj++);
+	    if (pass == 0)
+		dn += (double) (ni - i) * (nj - j);
+	    else
+		for (int i0 = i; i0 < ni; i0++)
+		    for (int j0 = j; j0 < nj; j0++, k++) {
+			jp->px[k] = ox[i0];
+			jp->py[k] = oy[j0];
+		    }
+	    i = ni;
+	    j = nj;
+	}
+	if (pass == 0) {
+	    if (dn > R_XLEN_T_MAX)
+		error(_("number of rows in the result exceeds maximum vector length"));
+	    jp->n = (R_xlen_t) dn;
+	    jp->px = (int *) R_alloc(jp->n, sizeof(int));
+	    jp->py = (int *) R_alloc(jp->n, sizeof(int));
+	}
+    }
+}
+
+/* .Internal(joinRows(x, y, nx, ny, type, method)): type is 0 to 3 for
+   inner, left, right and full joins, method 0 to 2 for choosing the
+   strategy, hashing and merging. */
+SEXP attribute_hidden do_joinrows(SEXP call, SEXP op, SEXP args, SEXP env)
+{
+    SEXP x, y, ans, ansx, ansy;
+    JoinPairs jp;
+
+    checkArity(op, args);
+    R_xlen_t dnx = (R_xlen_t) asReal(CADDR(args)),
+	dny = (R_xlen_t) asReal(CADDDR(args));
+    int type = asInteger(CAD4R(args)), method = asInteger(CAD4R(CDR(args)));
+    if (type == NA_INTEGER || type < 0 || type > 3)
+	error(_("invalid '%s' argument"), "type");
+    if (method == NA_INTEGER || method < 0 || method > 2)
+	error(_("invalid '%s' argument"), "method");
+    Rboolean all_x = type == 1 || type == 3, all_y = type == 2 || type == 3;
+    PROTECT(x = rowColumns(CAR(args), dnx, env, "x"));
+    PROTECT(y = rowColumns(CADR(args), dny, env, "y"));
+    if (LENGTH(x) != LENGTH(y))
+	error(_("'x' and 'y' must have the same number of columns"));
+    if (LENGTH(x) == 0)
+	error(_("there must be at least one key column"));
+    if (dnx > R_SHORT_LEN_MAX || dny > R_SHORT_LEN_MAX)
+	error(_("long vectors not supported yet: %s:%d"), __FILE__, __LINE__);
+    int nx = (int) dnx, ny = (int) dny;
+    rowCommonTypes(x, y);
+
+    SEXP cx = VECTOR_ELT(x, 0), cy = VECTOR_ELT(y, 0);
+    Rboolean intkey = LENGTH(x) == 1 &&
+	(TYPEOF(cx) == INTSXP || TYPEOF(cx) == LGLSXP);
+    if (method == 2 && !intkey)
+	error(_("method \"sort\" needs a single integer or logical key"));
+    if (method == 0)
+	method = intkey && knownIncr(cx) && knownIncr(cy) ? 2 : 1;
+    if (nx == 0 || ny == 0)
+	jp.n = 0;
+    else if (method == 2)
+	joinMerge(cx, cy, nx, ny, &jp);
+    else
+	joinHash(x, y, nx, ny, &jp);
+
+    /* the canonical order: a counting sort of the pairs by row of x */
+    int *start = (int *) R_alloc((size_t) nx + 1, sizeof(int));
+    char *ymatched = R_alloc(ny, sizeof(char));
+    R_xlen_t n = 0, k;
+    memset(start, 0, ((size_t) nx + 1) * sizeof(int));
+    memset(ymatched, 0, ny);
+    for (k = 0; k < jp.n; k++) {
+	start[jp.px[k] + 1]++;
+	ymatched[jp.py[k]] = 1;
+    }
+    R_xlen_t *pos = (R_xlen_t *) R_alloc((size_t) nx + 1, sizeof(R_xlen_t));
+    for (int i = 0; i < nx; i++) {
+	pos[i] = n;
+	n += (start[i + 1] == 0 && all_x) ? 1 : start[i + 1];
+    }
+    R_xlen_t nmatched = n;
+    if (all_y)
+	for (int j = 0; j < ny; j++) n += !ymatched[j];
+
+    const char *nms[] = {"xi", "yi", ""};
+    PROTECT(ans = mkNamed(VECSXP, nms));
+    ansx = allocVector(INTSXP, n);    SET_VECTOR_ELT(ans, 0, ansx);
+    ansy = allocVector(INTSXP, n);    SET_VECTOR_ELT(ans, 1, ansy);
+    int *ax = INTEGER(ansx), *ay = INTEGER(ansy);
+    if (all_x)
+	for (int i = 0; i < nx; i++)
+	    if (start[i + 1] == 0) {
+		ax[pos[i]] = i + 1;
+		ay[pos[i]] = NA_INTEGER;
+	    }
+    for (k = 0; k < jp.n; k++) {
+	R_xlen_t at = pos[jp.px[k]]++;
+	ax[at] = jp.px[k] + 1;
+	ay[at] = jp.py[k] + 1;
+    }
+    if (all_y)
+	for (int j = 0; j < ny; j++)
+	    if (!ymatched[j]) {
+		ax[nmatched] = NA_INTEGER;
+		ay[nmatched++] = j + 1;
+	    }
+    UNPROTECT(3);
+    return ans;
+}
+
 // workhorse of R's match() and hence also  " ix %in% itable "
+/* match() by binary search in a table of known sortedness (see SORTED
+   in Defn.h), for x short enough that hashing the table would cost
+   more.  The table is logical, integer or double and x of its type. */
+#define T_NA(i) (rt ? ISNAN(rt[i]) : it[i] == NA_INTEGER)
+#define T_VAL(i) (rt ? rt[i] : (double) it[i])
+static SEXP sortedMatch(SEXP table, SEXP x, int nmatch, int sorted)
+{
+    R_xlen_t n = XLENGTH(x), nt = XLENGTH(table), lo, hi, mid, a, b;
+    const double *rt = TYPEOF(table) == REALSXP ? REAL(table) : NULL;
+    const int *it = rt ? NULL : INTEGER(table);
+    Rboolean decr = KNOWN_DECR(sorted), na1st = KNOWN_NA_1ST(sorted);
+
+    /* the NAs are at one end: the others are table[a:(b-1)] */
+    for (lo = 0, hi = nt; lo < hi; ) {
+	mid = lo + (hi - lo) / 2;
+	if (na1st ? T_NA(mid) : !T_NA(mid)) lo = mid + 1; else hi = mid;
+    }
+    a = na1st ? lo : 0;
+    b = na1st ? nt : lo;
+
+    SEXP ans = allocVector(INTSXP, n);
+    int *pa = INTEGER(ans);
+    for (R_xlen_t i = 0; i < n; i++) {
+	double v = rt ? REAL(x)[i] : INTEGER(x)[i];
+	pa[i] = nmatch;
+	if (rt ? ISNAN(v) : INTEGER(x)[i] == NA_INTEGER) {
+	    /* all NAs match, and all NaNs but NA */
+	    for (R_xlen_t j = na1st ? 0 : b; j < (na1st ? a : nt); j++)
+		if (!rt || R_IsNA(v) == R_IsNA(rt[j])) {
+		    pa[i] = (int) (j + 1);
+		    break;
+		}
+	    continue;
+	}
+	/* the first element not before v */
+	for (lo = a, hi = b; lo < hi; ) {
+	    mid = lo + (hi - lo) / 2;
+	    if (decr ? T_VAL(mid) > v : T_VAL(mid) < v) lo = mid + 1;
+	    else hi = mid;
+	}
+	if (lo < b && T_VAL(lo) == v) pa[i] = (int) (lo + 1);
+    }
+    return ans;
+}
+#undef T_NA
+#undef T_VAL
+
 SEXP match5(SEXP itable, SEXP ix, int nmatch, SEXP incomp, SEXP env)
 {
     SEXP ans, x, table;
@@ -847,6 +1704,8 @@ SEXP match5(SEXP itable, SEXP ix, int nmatch, SEXP incomp, SEXP env)
 
     /* handle zero length arguments */
     if (n == 0) return allocVector(INTSXP, 0);
+    if (isHashIndex(itable))
+	return hashIndexMatch(itable, ix, nmatch, incomp, env);
     if (length(itable) == 0) {
 	ans = allocVector(INTSXP, n);
 	for (R_xlen_t i = 0; i < n; i++) INTEGER(ans)[i] = nmatch;
@@ -855,6 +1714,17 @@ SEXP match5(SEXP itable, SEXP ix, int nmatch, SEXP incomp, SEXP env)
 
     int nprot = 0;
     PROTECT(x	  = match_transform(ix,	    env)); nprot++;
+
+    /* A sorted table is searched rather than copied and hashed. */
+    int sorted = R_KnownSorted(itable);
+    R_xlen_t nt = XLENGTH(itable);
+    if (!incomp && sorted != UNKNOWN_SORTEDNESS && nt <= INT_MAX &&
+	TYPEOF(x) <= TYPEOF(itable) && (double) n * log2((double) nt) < nt) {
+	PROTECT(x = coerceVector(x, TYPEOF(itable))); nprot++;
+	ans = sortedMatch(itable, x, nmatch, sorted);
+	UNPROTECT(nprot);
+	return ans;
+    }
     PROTECT(table = match_transform(itable, env)); nprot++;
     /* or should we use PROTECT_WITH_INDEX and REPROTECT below ? */
 
@@ -993,7 +1863,8 @@ SEXP attribute_hidden do_match(SEXP call, SEXP op, SEXP args, SEXP env)
     checkArity(op, args);
 
     if ((!isVector(CAR(args)) && !isNull(CAR(args)))
-	|| (!isVector(CADR(args)) && !isNull(CADR(args))))
+	|| (!isVector(CADR(args)) && !isNull(CADR(args))
+	    && !isHashIndex(CADR(args))))
 	error(_("'match' requires vector arguments"));
 
     int nomatch = asInteger(CADDR(args));
@@ -1454,15 +2325,23 @@ rowsum(SEXP x, SEXP g, SEXP uniqueg, SEXP snarm, SEXP rn)
     data.nomatch = 0;
 
     n = LENGTH(g);
-    ng = length(uniqueg);
     narm = asLogical(snarm);
     if(narm == NA_LOGICAL) error("'na.rm' must be TRUE or FALSE");
     if(isMatrix(x)) p = ncols(x); else p = 1;
 
-    HashTableSetup(uniqueg, &data, NA_INTEGER);
-    PROTECT(data.HashTable);
-    DoHashing(uniqueg, &data);
-    PROTECT(matches = HashLookup(uniqueg, g, &data));
+    /* A NULL 'uniqueg' means 'g' already holds the group numbers, as
+       found by orderGroups(), and 'rn' names the groups. */
+    if(isNull(uniqueg)) {
+	ng = length(rn);
+	PROTECT(data.HashTable = R_NilValue);
+	PROTECT(matches = g);
+    } else {
+	ng = length(uniqueg);
+	HashTableSetup(uniqueg, &data, NA_INTEGER);
+	PROTECT(data.HashTable);
+	DoHashing(uniqueg, &data);
+	PROTECT(matches = HashLookup(uniqueg, g, &data));
+    }
 
     PROTECT(ans = allocMatrix(TYPEOF(x), ng, p));
 
@@ -1526,14 +2405,21 @@ rowsum_df(SEXP x, SEXP g, SEXP uniqueg, SEXP snarm, SEXP rn)
 
     R_xlen_t n = XLENGTH(g);
     p = LENGTH(x);
-    R_xlen_t ng = XLENGTH(uniqueg);
+    R_xlen_t ng;
     narm = asLogical(snarm);
     if(narm == NA_LOGICAL) error("'na.rm' must be TRUE or FALSE");
 
-    HashTableSetup(uniqueg, &data, NA_INTEGER);
-    PROTECT(data.HashTable);
-    DoHashing(uniqueg, &data);
-    PROTECT(matches = HashLookup(uniqueg, g, &data));
+    if(isNull(uniqueg)) { /* group numbers, as in rowsum() */
+	ng = xlength(rn);
+	PROTECT(data.HashTable = R_NilValue);
+	PROTECT(matches = g);
+    } else {
+	ng = XLENGTH(uniqueg);
+	HashTableSetup(uniqueg, &data, NA_INTEGER);
+	PROTECT(data.HashTable);
+	DoHashing(uniqueg, &data);
+	PROTECT(matches = HashLookup(uniqueg, g, &data));
+    }
 
     PROTECT(ans = allocVector(VECSXP, p));
 
@@ -1600,13 +2486,16 @@ SEXP attribute_hidden do_rowsum(SEXP call, SEXP op, SEXP args, SEXP env)
 static int isDuplicated2(SEXP x, int indx, HashData *d)
 {
     int *h = INTEGER(d->HashTable);
-    hlen i = d->hash(x, indx, d);
-    while (h[i] != NIL) {
-	if (d->equal(x, h[i], x, indx))
-	    return h[i] + 1;
+    hcode code = d->hash(x, indx, d);
+    int tag = HTAG(code);
+    hlen i = HSLOT(code, d);
+    while (h[2*i] != NIL) {
+	if (h[2*i+1] == tag && d->equal(x, h[2*i], x, indx))
+	    return h[2*i] + 1;
 	i = (i + 1) % d->M;
     }
-    h[i] = indx;
+    h[2*i] = indx;
+    h[2*i+1] = tag;
     return 0;
 }
 
@@ -1622,7 +2511,7 @@ static SEXP duplicated2(SEXP x, HashData *d)
 
     int *h = INTEGER(d->HashTable);
     int *v = INTEGER(ans);
-    for (i = 0; i < d->M; i++) h[i] = NIL;
+    for (i = 0; i < 2 * d->M; i++) h[i] = NIL;
     for (i = 0; i < n; i++) {
 //	if ((i+1) % NINTERRUPT == 0) R_CheckUserInterrupt();
 	v[i] = isDuplicated2(x, i, d);
@@ -1708,12 +2597,14 @@ static void HashTableSetup1(SEXP x, HashData *d)
 {
     d->hash = cshash;
     d->equal = csequal;
+    d->P = 0;
 #ifdef LONG_VECTOR_SUPPORT
     d->isLong = FALSE;
 #endif
     MKsetup(LENGTH(x), d, NA_INTEGER);
-    d->HashTable = allocVector(INTSXP, (R_xlen_t) d->M);
-    for (R_xlen_t i = 0; i < d->M; i++) INTEGER(d->HashTable)[i] = NIL;
+    d->HashTable = allocVector(INTSXP, 2 * (R_xlen_t) d->M);
+    for (R_xlen_t i = 0; i < 2 * (R_xlen_t) d->M; i++)
+	INTEGER(d->HashTable)[i] = NIL;
 }
 
 /* used in utils */
@@ -178,6 +178,29 @@ static int unzLocateFile OF((unzFile file,
   UNZ_END_OF_LIST_OF_FILE if the file is not found
 */
 
+typedef struct unz64_file_pos_s
+{
+    ZPOS64_T pos_in_zip_directory;   /* offset in zip file directory */
+    ZPOS64_T num_of_file;            /* # of file */
+} unz64_file_pos;
+
+static int unzGetFilePos64 OF((unzFile file, unz64_file_pos* file_pos));
+static int unzGoToFilePos64 OF((unzFile file,
+				const unz64_file_pos* file_pos));
+/*
+  Get the position of the current file in the central directory, and
+  make the file at such a position the current file.
+*/
+
+/* R ADDITION */
+static int unzLocateFileIndexed OF((unzFile file, const char *zipname,
+				    const char *szFileName));
+/*
+  As unzLocateFile with case-sensitive matching, for the zipfile opened
+  from path zipname, using an index of its central directory which is
+  kept for the zipfile last used.
+*/
+
 
 
 /* ****************************************** */
@@ -235,6 +258,18 @@ static int unzReadCurrentFile OF((unzFile file,
     (UNZ_ERRNO for IO error, or zLib error for uncompress error)
 */
 
+/* R ADDITIONS */
+static ZPOS64_T unzTellCurrentFile OF((unzFile file));
+static ZPOS64_T unzSizeCurrentFile OF((unzFile file));
+static int unzSeekCurrentFile OF((unzFile file, ZPOS64_T pos));
+/*
+  The position in and the uncompressed size of the current file, and
+  move to position pos in it (opened by unzOpenCurrentFile).  A stored
+  file is positioned directly; a compressed one is inflated from its
+  start (or the current position) up to pos.  The CRC of a stored file
+  is not checked once it has been seeked.
+*/
+
 
 #ifdef __cplusplus
 }
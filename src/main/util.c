@@ -1380,8 +1380,10 @@ SEXP attribute_hidden do_validUTF8(SEXP call, SEXP op, SEXP args, SEXP rho)
     R_xlen_t n = XLENGTH(x);
     SEXP ans = allocVector(LGLSXP, n); // no allocation below
     int *lans = LOGICAL(ans);
-    for (R_xlen_t i = 0; i < n; i++)
-	lans[i] = utf8Valid(CHAR(STRING_ELT(x, i)));
+    for (R_xlen_t i = 0; i < n; i++) {
+	SEXP p = STRING_ELT(x, i);
+	lans[i] = IS_ASCII(p) || valid_utf8(CHAR(p), LENGTH(p)) == 0;
+    }
     return ans;
 }
 
@@ -1397,7 +1399,8 @@ SEXP attribute_hidden do_validEnc(SEXP call, SEXP op, SEXP args, SEXP rho)
     for (R_xlen_t i = 0; i < n; i++) {
 	SEXP p = STRING_ELT(x, i);
 	if (IS_BYTES(p) || IS_LATIN1(p)) lans[i] = 1;
-	else if (IS_UTF8(p) || utf8locale) lans[i] = utf8Valid(CHAR(p));
+	else if (IS_UTF8(p) || utf8locale)
+	    lans[i] = IS_ASCII(p) || valid_utf8(CHAR(p), LENGTH(p)) == 0;
 	else if(mbcslocale) lans[i] = mbcsValid(CHAR(p));
 	else lans[i] = 1;
     }
@@ -1867,6 +1870,9 @@ UCollationResult ucol_strcollIter(const UCollator *coll,
 				  UCharIterator *tIter,
 				  UErrorCode *status);
 void uiter_setUTF8(UCharIterator *iter, const char *s, int32_t length);
+int32_t ucol_nextSortKeyPart(const UCollator *coll, UCharIterator *iter,
+			     uint32_t state[2], uint8_t *dest, int32_t count,
+			     UErrorCode *status);
 
 void uloc_setDefault(const char* localeID, UErrorCode* status);
 
@@ -2042,10 +2048,7 @@ SEXP attribute_hidden do_ICUget(SEXP call, SEXP op, SEXP args, SEXP rho)
     return mkString(ans);
 }
 
-/* Caller has to manage the R_alloc stack */
-/* NB: strings can have equal collation weight without being identical */
-attribute_hidden
-int Scollate(SEXP a, SEXP b)
+static void collationInit(void)
 {
     if (!collationLocaleSet) {
 	int errsv = errno;      /* OSX may set errno in the operations below. */
@@ -2068,6 +2071,14 @@ int Scollate(SEXP a, SEXP b)
 	}
 	errno = errsv;
     }
+}
+
+/* Caller has to manage the R_alloc stack */
+/* NB: strings can have equal collation weight without being identical */
+attribute_hidden
+int Scollate(SEXP a, SEXP b)
+{
+    collationInit();
     if (collator == NULL)
 	return collationLocaleSet == 2 ?
 	    strcmp(translateChar(a), translateChar(b)) :
@@ -2084,6 +2095,38 @@ int Scollate(SEXP a, SEXP b)
     return result;
 }
 
+/* Puts into buf the collation key of a, a string without nul bytes
+   which compares by strcmp() as a does by Scollate(), and returns its
+   length.  When that is not less than size, buf does not hold all the
+   key and the call has to be repeated with a larger buffer.  Returns -1 if
+   ICU cannot make the key.  Caller has to manage the R_alloc stack. */
+attribute_hidden
+int Scollate_key(SEXP a, char *buf, int size)
+{
+    collationInit();
+    if (collator == NULL) {
+	const char *as = translateChar(a);
+	if (collationLocaleSet == 2) {
+	    int len = (int) strlen(as);
+	    if (len < size) memcpy(buf, as, len);
+	    return len;
+	}
+	return (int) strxfrm(buf, as, size);
+    }
+
+    UCharIterator aIter;
+    uint32_t state[2] = {0, 0};
+    const char *as = translateCharUTF8(a);
+    uiter_setUTF8(&aIter, as, (int) strlen(as));
+    UErrorCode status = U_ZERO_ERROR;
+    int len = ucol_nextSortKeyPart(collator, &aIter, state, (uint8_t *) buf,
+				   size, &status);
+    if (U_FAILURE(status)) return -1;
+    if (len == size) return size;
+    while (len > 0 && buf[len - 1] == 0) len--;
+    return len;
+}
+
 #else /* not USE_ICU */
 
 SEXP attribute_hidden do_ICUset(SEXP call, SEXP op, SEXP args, SEXP rho)
@@ -2119,6 +2162,28 @@ int Scollate(SEXP a, SEXP b)
 	return strcoll(translateChar(a), translateChar(b));
 }
 
+/* wcsxfrm() weights are written as three bytes of 1 to 64 each, so
+   that the key has no nul bytes and sorts as the weights do */
+int Scollate_key(SEXP a, char *buf, int size)
+{
+    const char *as = translateCharUTF8(a);
+    R_CheckStack2(sizeof(wchar_t) * (1 + strlen(as)));
+    wchar_t w[strlen(as)+1];
+    utf8towcs(w, as, strlen(as) + 1);
+    size_t n = wcsxfrm(NULL, w, 0);
+    R_CheckStack2(sizeof(wchar_t) * (1 + n));
+    wchar_t k[n + 1];
+    wcsxfrm(k, w, n + 1);
+    if (3 * n < size)
+	for (size_t i = 0; i < n; i++) {
+	    unsigned int c = (unsigned int) k[i] & 0xFFFF;
+	    *buf++ = (char) (1 + (c >> 12));
+	    *buf++ = (char) (1 + ((c >> 6) & 63));
+	    *buf++ = (char) (1 + (c & 63));
+	}
+    return (int) (3 * n);
+}
+
 # else
 attribute_hidden
 int Scollate(SEXP a, SEXP b)
@@ -2126,6 +2191,12 @@ int Scollate(SEXP a, SEXP b)
     return strcoll(translateChar(a), translateChar(b));
 }
 
+attribute_hidden
+int Scollate_key(SEXP a, char *buf, int size)
+{
+    return (int) strxfrm(buf, translateChar(a), size);
+}
+
 # endif
 #endif
 
@@ -71,7 +71,17 @@ valid_utf8(const char *string, size_t length) // R change int->size_t
     for (p = string; length-- > 0; p++) {
 	int ab, c, d;
 	c = (unsigned char)*p;
-	if (c < 128) continue;                /* ASCII character */
+	if (c < 128) {                        /* ASCII character */
+	    /* R change: skip runs of ASCII eight bytes at a time */
+	    uint64_t w;
+	    while (length >= 8) {
+		memcpy(&w, p + 1, 8);
+		if (w & 0x8080808080808080ULL) break;
+		p += 8;
+		length -= 8;
+	    }
+	    continue;
+	}
 	if (c < 0xc0) return 1;               /* Isolated 10xx xxxx byte */
 	if (c >= 0xfe) return 1;             /* Invalid 0xfe or 0xff bytes */
 
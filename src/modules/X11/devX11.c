@@ -2843,6 +2843,7 @@ Rf_setX11DeviceData(pDevDesc dd, double gamma_fac, pX11Desc xd)
 	dd->polyline = Cairo_Polyline;
 	dd->polygon = Cairo_Polygon;
         dd->path = Cairo_Path;
+	dd->points = Cairo_Points;
         dd->raster = Cairo_Raster;
         dd->cap = Cairo_Cap;
 	dd->hasTextUTF8 = TRUE;
@@ -1,6 +1,6 @@
 /*
  *  R : A Computer Language for Statistical Data Analysis
- *  Copyright (C) 2009-2015 The R Core Team.
+ *  Copyright (C) 2009-2017 The R Core Team.
  *
  *  This program is free software; you can redistribute it and/or modify
  *  it under the terms of the GNU General Public License as published by
@@ -33,8 +33,10 @@
 #define LINE_BUF_SIZE 1024
 
 /* maximum number of active workers (parallel connections)
- * when exceeded the server closes new connections */
-#define MAX_WORKERS 32
+ * when exceeded the server answers new connections with 503
+ * and closes them. On unix each worker is an input handler, so
+ * this has to stay well below FD_SETSIZE */
+#define MAX_WORKERS 256
 
 
 /* --- Rhttpd implementation --- */
@@ -305,8 +307,11 @@ static void finalize_worker(httpd_conn_t *c)
     }
 }
 
+static int send_response(SOCKET s, const char *buf, size_t len);
+
 /* adds a worker to the worker list and returns 0. If the list is
- * full, the worker is finalized and returns -1.
+ * full, the client is told to retry later, the worker is finalized
+ * and returns -1.
  * Note that we don't need locking, because add_worker is guaranteed
  * to be called by the same thread (server thread).
   */
@@ -322,8 +327,12 @@ static int add_worker(httpd_conn_t *c) {
 	    workers[i] = c;
 	    return 0;
 	}
-    /* FIXME: ok no more space for a new worker - what do we do now?
-     * for now we just drop it on the floor .. */
+    /* no more space for a new worker - rather than just dropping the
+     * connection let the client know that it can retry */
+    {
+	const char *busy = "HTTP/1.0 503 Service Unavailable\r\nConnection: close\r\nRetry-After: 1\r\nContent-length: 0\r\n\r\n";
+	send_response(c->sock, busy, strlen(busy));
+    }
     finalize_worker(c);
     free(c);
     return -1;
@@ -1208,8 +1217,12 @@ int in_R_HTTPDCreate(const char *ip, int port)
 	}
     }
 
-    /* setup listen */
-    if (listen(srv_sock, 8))
+    /* setup listen - with a backlog large enough for bursts of
+       concurrent clients */
+#ifndef SOMAXCONN
+#define SOMAXCONN 128
+#endif
+    if (listen(srv_sock, SOMAXCONN))
 	Rf_error("cannot listen to TCP port %d", port);
 
 #ifndef _WIN32
@@ -1,6 +1,6 @@
 /*
  *  R : A Computer Language for Statistical Data Analysis
- *  Copyright (C) 2015 The R Core Team
+ *  Copyright (C) 2015-2017 The R Core Team
  *
  *  This program is free software; you can redistribute it and/or modify
  *  it under the terms of the GNU General Public License as published by
@@ -168,9 +168,30 @@ static int curlMultiCheckerrs(CURLM *mhnd)
     return retval;
 }
 
+/*
+  A share handle kept for the session, so DNS look-ups, TLS sessions
+  and (libcurl >= 7.57.0) open connections are re-used by later
+  handles, including those of later calls.  No locking is needed as
+  all handles are used from the R thread.
+*/
+static CURLSH *curlShare(void)
+{
+    static CURLSH *shr = NULL;
+    if (!shr && (shr = curl_share_init())) {
+	curl_share_setopt(shr, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+	curl_share_setopt(shr, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+#if LIBCURL_VERSION_NUM >= 0x073900
+	curl_share_setopt(shr, CURLSHOPT_SHARE, CURL_LOCK_DATA_CONNECT);
+#endif
+    }
+    return shr;
+}
+
 static void curlCommon(CURL *hnd, int redirect, int verify)
 {
     const char *capath = getenv("CURL_CA_BUNDLE");
+    CURLSH *shr = curlShare();
+    if (shr) curl_easy_setopt(hnd, CURLOPT_SHARE, shr);
     if (verify) {
 	if (capath && capath[0])
 	    curl_easy_setopt(hnd, CURLOPT_CAINFO, capath);
@@ -442,6 +463,14 @@ in_do_curlDownload(SEXP call, SEXP op, SEXP args, SEXP rho)
 
     CURLM *mhnd = curl_multi_init();
     int still_running, repeats = 0, n_err = 0;
+#if LIBCURL_VERSION_NUM >= 0x071e00
+    /* limit the number of simultaneous connections: further transfers
+       are queued by libcurl until a connection becomes free */
+    int maxconn =
+	asInteger(GetOption1(install("download.file.max.connections")));
+    if (maxconn != NA_INTEGER && maxconn > 0)
+	curl_multi_setopt(mhnd, CURLMOPT_MAX_TOTAL_CONNECTIONS, (long) maxconn);
+#endif
     CURL **hnd[nurls];
     FILE *out[nurls];
 
@@ -110,6 +110,25 @@ static ssize_t sock_read_helper(Rconnection con, void *ptr, size_t size)
 
     con->incomplete = FALSE;
     do {
+	/* large reads go straight into ptr once the buffer is empty */
+	if (size >= sizeof(this->inbuf) && this->pstart == this->pend) {
+	    do
+		res = R_SockRead(this->fd, ptr, size, con->blocking,
+				 this->timeout);
+	    while (-res == EINTR);
+	    if (! con->blocking && -res == EAGAIN) {
+		con->incomplete = TRUE;
+		return nread;
+	    }
+	    else if (res == 0) /* should mean EOF */
+		return nread;
+	    else if (res < 0) return res;
+	    ptr = ((char *) ptr) + res;
+	    size -= res;
+	    nread += res;
+	    continue;
+	}
+
 	/* read data into the buffer if it's empty and size > 0 */
 	if (size > 0 && this->pstart == this->pend) {
 	    this->pstart = this->pend = this->inbuf;
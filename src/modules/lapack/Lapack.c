@@ -1296,6 +1296,358 @@ static SEXP det_ge_real(SEXP Ain, SEXP logarithm)
     return val;
 }
 
+/* ------------------------------------------------------------ */
+
+/* Batched versions of La_solve, La_chol, La_qr and La_rs, for the
+   slices a[, , k] of a 3-d array.  The slices are shared out in
+   contiguous runs between R_num_math_threads threads when there is
+   at least R_BATCH_THREADS_MIN of work, each thread with its own
+   workspace.  Slices of order up to R_BATCH_SMALL are solved and
+   factorized by the inline kernels below, which avoid the set-up
+   costs of LAPACK for small matrices.  As error() cannot be called
+   in the threads, failures are recorded per slice and the first is
+   reported afterwards. */
+
+#define R_BATCH_SMALL 16
+#define R_BATCH_THREADS_MIN 1e5
+
+static int batch_threads(double work)
+{
+#ifdef _OPENMP
+    if (R_num_math_threads > 1 && work >= R_BATCH_THREADS_MIN)
+	return R_num_math_threads;
+#endif
+    return 1;
+}
+
+/* The dims of a numeric 3-d array */
+static int *batch_dims(SEXP A, const char *what)
+{
+    SEXP adims = getAttrib(A, R_DimSymbol);
+    if (!(TYPEOF(A) == REALSXP || TYPEOF(A) == INTSXP ||
+	  TYPEOF(A) == LGLSXP) || LENGTH(adims) != 3)
+	error(_("'%s' must be a numeric 3-d array"), what);
+    if (TYPEOF(adims) != INTSXP) error("non-integer dims");
+    return INTEGER(adims);
+}
+
+/* First failed slice, as its 1-based index, or 0 */
+static R_xlen_t batch_failed(const int *info, R_xlen_t N)
+{
+    for (R_xlen_t s = 0; s < N; s++)
+	if (info[s]) return s + 1;
+    return 0;
+}
+
+/* Solve a x = b in place for n x n a and n x p b by Gaussian
+   elimination with partial pivoting, leaving the LU factors in a.
+   Returns 0 or, as dgesv, the index of the first zero pivot. */
+static int small_gesv(int n, int p, double *a, double *b)
+{
+    for (int k = 0; k < n; k++) {
+	int piv = k;
+	double amax = fabs(a[k + k * n]);
+	for (int i = k + 1; i < n; i++)
+	    if (fabs(a[i + k * n]) > amax) {
+		amax = fabs(a[i + k * n]);
+		piv = i;
+	    }
+	if (amax == 0.) return k + 1;
+	if (piv != k) {
+	    for (int j = 0; j < n; j++) {
+		double tmp = a[k + j * n];
+		a[k + j * n] = a[piv + j * n]; a[piv + j * n] = tmp;
+	    }
+	    for (int j = 0; j < p; j++) {
+		double tmp = b[k + j * n];
+		b[k + j * n] = b[piv + j * n]; b[piv + j * n] = tmp;
+	    }
+	}
+	double r = 1. / a[k + k * n];
+	for (int i = k + 1; i < n; i++) a[i + k * n] *= r;
+	for (int j = k + 1; j < n; j++) {
+	    double akj = a[k + j * n];
+	    for (int i = k + 1; i < n; i++) a[i + j * n] -= a[i + k * n] * akj;
+	}
+	for (int j = 0; j < p; j++) {
+	    double bkj = b[k + j * n];
+	    for (int i = k + 1; i < n; i++) b[i + j * n] -= a[i + k * n] * bkj;
+	}
+    }
+    for (int j = 0; j < p; j++) {
+	double *bj = b + j * n;
+	for (int k = n - 1; k >= 0; k--) {
+	    bj[k] /= a[k + k * n];
+	    for (int i = 0; i < k; i++) bj[i] -= a[i + k * n] * bj[k];
+	}
+    }
+    return 0;
+}
+
+/* Upper-triangular Cholesky factor of n x n a in place, using only
+   the upper triangle.  Returns 0 or, as dpotrf, the order of the
+   first leading minor which is not positive definite. */
+static int small_potrf(int n, double *a)
+{
+    for (int j = 0; j < n; j++) {
+	double s = a[j + j * n];
+	for (int k = 0; k < j; k++) s -= a[k + j * n] * a[k + j * n];
+	if (!(s > 0.)) return j + 1;
+	double rjj = sqrt(s);
+	a[j + j * n] = rjj;
+	for (int i = j + 1; i < n; i++) {
+	    double t = a[j + i * n];
+	    for (int k = 0; k < j; k++) t -= a[k + j * n] * a[k + i * n];
+	    a[j + i * n] = t / rjj;
+	}
+    }
+    return 0;
+}
+
+/* solve(a[, , k], b[, , k]) for all k: b is an n x p x N array, an
+   n x N matrix of single right-hand sides or NULL for the inverses */
+static SEXP La_solve_batch(SEXP A, SEXP Bin)
+{
+    int *Adims = batch_dims(A, "a"), n = Adims[0], N = Adims[2], p;
+    if (Adims[1] != n)
+	error(_("'a' (%d x %d x %d) must have square slices"),
+	      n, Adims[1], N);
+    if (n == 0) error(_("'a' is 0-diml"));
+    SEXP B;
+    if (isNull(Bin)) {
+	p = n;
+	B = PROTECT(alloc3DArray(REALSXP, n, n, N));
+	double *rb = REAL(B);
+	size_t nn = (size_t) n * n;
+	Memzero(rb, nn * N);
+	for (R_xlen_t s = 0; s < N; s++)
+	    for (int i = 0; i < n; i++) rb[s * nn + i * (n + 1)] = 1.;
+    } else {
+	SEXP bdims = getAttrib(Bin, R_DimSymbol);
+	if (!(TYPEOF(Bin) == REALSXP || TYPEOF(Bin) == INTSXP ||
+	      TYPEOF(Bin) == LGLSXP))
+	    error(_("'b' must be a numeric array"));
+	int *bd = INTEGER(bdims);
+	if (LENGTH(bdims) == 3 && bd[0] == n && bd[2] == N) p = bd[1];
+	else if (LENGTH(bdims) == 2 && bd[0] == n && bd[1] == N) p = 1;
+	else error(_("'b' must be a %d x p x %d array or a %d x %d matrix"),
+		   n, N, n, N);
+	B = PROTECT(isReal(Bin) ? duplicate(Bin) : coerceVector(Bin, REALSXP));
+    }
+    SEXP Ar = PROTECT(coerceVector(A, REALSXP));
+    const double *ra = REAL(Ar);
+    double *rb = REAL(B);
+    int *info = (int *) R_alloc(N, sizeof(int));
+    int nthreads = batch_threads((double) n * n * (n + p) * N);
+    size_t ws = (size_t) n * n + n; /* a copy of a, and the pivots */
+    double *work = (double *) R_alloc(ws * nthreads, sizeof(double));
+
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(nthreads) schedule(static) \
+    default(none) firstprivate(ra, rb, info, work, ws, n, p, N, nthreads)
+#endif
+    for (int t = 0; t < nthreads; t++) {
+	R_xlen_t s0 = (R_xlen_t) ((double) N * t / nthreads),
+	    s1 = (R_xlen_t) ((double) N * (t + 1) / nthreads);
+	double *a = work + t * ws;
+	int *ipiv = (int *) (a + (size_t) n * n);
+	for (R_xlen_t s = s0; s < s1; s++) {
+	    double *b = rb + s * (size_t) n * p;
+	    memcpy(a, ra + s * (size_t) n * n, (size_t) n * n * sizeof(double));
+	    if (n <= R_BATCH_SMALL)
+		info[s] = small_gesv(n, p, a, b);
+	    else {
+		int nn = n, pp = p;
+		F77_CALL(dgesv)(&nn, &pp, a, &nn, ipiv, b, &nn, info + s);
+	    }
+	}
+    }
+    R_xlen_t bad = batch_failed(info, N);
+    if (bad)
+	error(_("slice %d: system is exactly singular: U[%d,%d] = 0"),
+	      (int) bad, info[bad - 1], info[bad - 1]);
+    UNPROTECT(2); /* Ar, B */
+    return B;
+}
+
+/* chol(a[, , k]) for all k */
+static SEXP La_chol_batch(SEXP A)
+{
+    int *Adims = batch_dims(A, "a"), n = Adims[0], N = Adims[2];
+    if (Adims[1] != n) error(_("'a' must have square slices"));
+    if (n <= 0) error(_("'a' must have dims > 0"));
+    SEXP ans = PROTECT(isReal(A) ? duplicate(A) : coerceVector(A, REALSXP));
+    double *rans = REAL(ans);
+    int *info = (int *) R_alloc(N, sizeof(int));
+    int nthreads = batch_threads((double) n * n * n * N);
+
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(nthreads) schedule(static) \
+    default(none) firstprivate(rans, info, n, N, nthreads)
+#endif
+    for (int t = 0; t < nthreads; t++) {
+	R_xlen_t s0 = (R_xlen_t) ((double) N * t / nthreads),
+	    s1 = (R_xlen_t) ((double) N * (t + 1) / nthreads);
+	for (R_xlen_t s = s0; s < s1; s++) {
+	    double *a = rans + s * (size_t) n * n;
+	    for (int j = 0; j < n; j++) /* zero the lower triangle */
+		for (int i = j+1; i < n; i++) a[i + (size_t) n * j] = 0.;
+	    if (n <= R_BATCH_SMALL)
+		info[s] = small_potrf(n, a);
+	    else {
+		int nn = n;
+		F77_CALL(dpotrf)("Upper", &nn, a, &nn, info + s);
+	    }
+	}
+    }
+    R_xlen_t bad = batch_failed(info, N);
+    if (bad)
+	error(_("slice %d: the leading minor of order %d is not positive definite"),
+	      (int) bad, info[bad - 1]);
+    UNPROTECT(1);
+    return ans;
+}
+
+/* qr(a[, , k], LAPACK = TRUE) for all k */
+static SEXP La_qr_batch(SEXP A)
+{
+    int *Adims = batch_dims(A, "a"), m = Adims[0], n = Adims[1],
+	N = Adims[2], k = m < n ? m : n;
+    SEXP qr = PROTECT(isReal(A) ? duplicate(A) : coerceVector(A, REALSXP));
+    SEXP tau = PROTECT(allocMatrix(REALSXP, k, N));
+    SEXP jpvt = PROTECT(allocMatrix(INTSXP, n, N));
+    double *rqr = REAL(qr), *rtau = REAL(tau), tmp;
+    int *ip = INTEGER(jpvt), *info = (int *) R_alloc(N, sizeof(int));
+    for (R_xlen_t i = 0; i < XLENGTH(jpvt); i++) ip[i] = 0;
+    int lwork = -1, info0;
+    F77_CALL(dgeqp3)(&m, &n, rqr, &m, ip, rtau, &tmp, &lwork, &info0);
+    if (info0 < 0)
+	error(_("error code %d from Lapack routine '%s'"), info0, "dgeqp3");
+    lwork = (int) tmp;
+    int nthreads = batch_threads((double) m * n * k * N);
+    double *work = (double *) R_alloc((size_t) lwork * nthreads, sizeof(double));
+
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(nthreads) schedule(static) \
+    default(none) firstprivate(rqr, rtau, ip, info, work, lwork, m, n, k, \
+			       N, nthreads)
+#endif
+    for (int t = 0; t < nthreads; t++) {
+	R_xlen_t s0 = (R_xlen_t) ((double) N * t / nthreads),
+	    s1 = (R_xlen_t) ((double) N * (t + 1) / nthreads);
+	int mm = m, nn = n, lw = lwork;
+	for (R_xlen_t s = s0; s < s1; s++)
+	    F77_CALL(dgeqp3)(&mm, &nn, rqr + s * (size_t) m * n, &mm,
+			     ip + s * (size_t) n, rtau + s * (size_t) k,
+			     work + t * (size_t) lwork, &lw, info + s);
+    }
+    R_xlen_t bad = batch_failed(info, N);
+    if (bad)
+	error(_("slice %d: error code %d from Lapack routine '%s'"),
+	      (int) bad, info[bad - 1], "dgeqp3");
+    SEXP val = PROTECT(allocVector(VECSXP, 4));
+    SEXP nm = PROTECT(allocVector(STRSXP, 4));
+    SET_STRING_ELT(nm, 0, mkChar("qr"));
+    SET_STRING_ELT(nm, 1, mkChar("rank"));
+    SET_STRING_ELT(nm, 2, mkChar("qraux"));
+    SET_STRING_ELT(nm, 3, mkChar("pivot"));
+    setAttrib(val, R_NamesSymbol, nm);
+    SET_VECTOR_ELT(val, 0, qr);
+    SET_VECTOR_ELT(val, 1, ScalarInteger(k));
+    SET_VECTOR_ELT(val, 2, tau);
+    SET_VECTOR_ELT(val, 3, jpvt);
+    UNPROTECT(5);
+    return val;
+}
+
+/* eigen(x[, , k], symmetric = TRUE) for all k, the values of each
+   slice in decreasing order */
+static SEXP La_rs_batch(SEXP x, SEXP only_values)
+{
+    int *xdims = batch_dims(x, "x"), n = xdims[0], N = xdims[2];
+    if (xdims[1] != n) error(_("'x' must have square slices"));
+    if (n == 0) error(_("'x' is 0-diml"));
+    int ov = asLogical(only_values);
+    if (ov == NA_LOGICAL) error(_("invalid '%s' argument"), "only.values");
+    SEXP xr = PROTECT(coerceVector(x, REALSXP));
+    const double *rx = REAL(xr);
+    for (R_xlen_t i = 0; i < XLENGTH(xr); i++)
+	if (!R_FINITE(rx[i])) error(_("infinite or missing values in 'x'"));
+
+    SEXP values = PROTECT(allocMatrix(REALSXP, n, N)), z = R_NilValue;
+    double *rvalues = REAL(values), *rz = NULL;
+    if (!ov) {
+	z = PROTECT(alloc3DArray(REALSXP, n, n, N));
+	rz = REAL(z);
+    } else PROTECT(z);
+
+    char jobv[2] = "N", uplo[2] = "L", range[2] = "A";
+    if (!ov) jobv[0] = 'V';
+    double vl = 0.0, vu = 0.0, abstol = 0.0, tmp;
+    int il, iu, m, lwork = -1, liwork = -1, itmp, info0;
+    double *a = (double *) R_alloc((size_t) n * n, sizeof(double));
+    memcpy(a, rx, (size_t) n * n * sizeof(double));
+    int *isuppz = (int *) R_alloc(2 * (size_t) n, sizeof(int));
+    F77_CALL(dsyevr)(jobv, range, uplo, &n, a, &n, &vl, &vu, &il, &iu,
+		     &abstol, &m, rvalues, rz, &n, isuppz,
+		     &tmp, &lwork, &itmp, &liwork, &info0);
+    if (info0 != 0)
+	error(_("error code %d from Lapack routine '%s'"), info0, "dsyevr");
+    lwork = (int) tmp;
+    liwork = itmp;
+
+    int nthreads = batch_threads((double) n * n * n * N);
+    /* a copy of the slice, its values and vectors, and LAPACK workspace */
+    size_t ws = 2 * (size_t) n * n + n + lwork,
+	iws = 2 * (size_t) n + liwork;
+    double *work = (double *) R_alloc(ws * nthreads, sizeof(double));
+    int *iwork = (int *) R_alloc(iws * nthreads, sizeof(int)),
+	*info = (int *) R_alloc(N, sizeof(int));
+
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(nthreads) schedule(static) \
+    default(none) firstprivate(rx, rvalues, rz, info, work, ws, iwork, iws, \
+			       lwork, liwork, jobv, range, uplo, vl, vu, \
+			       abstol, n, N, ov, nthreads)
+#endif
+    for (int t = 0; t < nthreads; t++) {
+	R_xlen_t s0 = (R_xlen_t) ((double) N * t / nthreads),
+	    s1 = (R_xlen_t) ((double) N * (t + 1) / nthreads);
+	size_t nn = (size_t) n * n;
+	double *a = work + t * ws, *vec = a + nn, *val = vec + nn,
+	    *w = val + n;
+	int *isuppz = iwork + t * iws, *iw = isuppz + 2 * n;
+	int nt = n, lw = lwork, liw = liwork, il, iu, m;
+	for (R_xlen_t s = s0; s < s1; s++) {
+	    memcpy(a, rx + s * nn, nn * sizeof(double));
+	    F77_CALL(dsyevr)(jobv, range, uplo, &nt, a, &nt, &vl, &vu,
+			     &il, &iu, &abstol, &m, val, vec, &nt, isuppz,
+			     w, &lw, iw, &liw, info + s);
+	    /* reverse to decreasing order */
+	    for (int j = 0; j < n; j++) {
+		rvalues[s * n + j] = val[n - 1 - j];
+		if (!ov)
+		    memcpy(rz + s * nn + (size_t) j * n,
+			   vec + (size_t) (n - 1 - j) * n, n * sizeof(double));
+	    }
+	}
+    }
+    R_xlen_t bad = batch_failed(info, N);
+    if (bad)
+	error(_("slice %d: error code %d from Lapack routine '%s'"),
+	      (int) bad, info[bad - 1], "dsyevr");
+
+    SEXP ret = PROTECT(allocVector(VECSXP, 2)),
+	nm = PROTECT(allocVector(STRSXP, 2));
+    SET_STRING_ELT(nm, 0, mkChar("values"));
+    SET_STRING_ELT(nm, 1, mkChar("vectors"));
+    setAttrib(ret, R_NamesSymbol, nm);
+    SET_VECTOR_ELT(ret, 0, values);
+    SET_VECTOR_ELT(ret, 1, z);
+    UNPROTECT(5);
+    return ret;
+}
+
 static SEXP mod_do_lapack(SEXP call, SEXP op, SEXP args, SEXP env)
 {
     SEXP ans = R_NilValue;
@@ -1308,6 +1660,7 @@ static SEXP mod_do_lapack(SEXP call, SEXP op, SEXP args, SEXP env)
     case 41: ans = La_rg_cmplx(CAR(args), CADR(args)); break;
     case 5: ans = La_rs(CAR(args), CADR(args)); break;
     case 51: ans = La_rs_cmplx(CAR(args), CADR(args)); break;
+    case 52: ans = La_rs_batch(CAR(args), CADR(args)); break;
     case 6: ans = La_dlange(CAR(args), CADR(args)); break;
     case 7: ans = La_dgecon(CAR(args), CADR(args)); break;
     case 8: ans = La_dtrcon(CAR(args), CADR(args)); break;
@@ -1317,9 +1670,12 @@ static SEXP mod_do_lapack(SEXP call, SEXP op, SEXP args, SEXP env)
 
     case 100: ans = La_solve(CAR(args), CADR(args), CADDR(args)); break;
     case 101: ans = La_qr(CAR(args)); break;
+    case 102: ans = La_solve_batch(CAR(args), CADR(args)); break;
+    case 103: ans = La_qr_batch(CAR(args)); break;
 
     case 200: ans = La_chol(CAR(args), CADR(args), CADDR(args)); break;
     case 201: ans = La_chol2inv(CAR(args), CADR(args)); break;
+    case 202: ans = La_chol_batch(CAR(args)); break;
 
     case 300: ans = qr_coef_real(CAR(args), CADR(args)); break;
     case 301: ans = qr_qy_real(CAR(args), CADR(args), CADDR(args)); break;
@@ -0,0 +1,203 @@
+/*
+ *  Mathlib : A C Library of Special Functions
+ *  Copyright (C) 2017 The R Core Team
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, a copy is available at
+ *  https://www.R-project.org/Licenses/
+ *
+ *  SYNOPSIS
+ *
+ *	void dnorm_vec(const double *x, int n, double mu, double sigma,
+ *		       int give_log, double *y)
+ *	void pnorm_vec(const double *x, int n, double mu, double sigma,
+ *		       int lower_tail, int log_p, double *y)
+ *	void qnorm_vec(const double *p, int n, double mu, double sigma,
+ *		       int lower_tail, int log_p, double *y)
+ *	void dexp_vec(const double *x, int n, double scale,
+ *		      int give_log, double *y)
+ *	void dgamma_vec(const double *x, int n, double shape, double scale,
+ *			int give_log, double *y)
+ *
+ *  DESCRIPTION
+ *
+ *	Batch versions of the density, distribution and quantile
+ *	functions for n values of the first argument and the same
+ *	parameters: y[i] is exactly the value of the scalar function
+ *	for x[i] (or p[i]).  y must not overlap the input.
+ *
+ *	The parameters are checked, and quantities depending only on
+ *	them are computed, once.  Where the computation is arithmetic
+ *	only (the log densities and the central region of qnorm) the
+ *	loops are written so the compiler can vectorize them: other
+ *	cases are left to the scalar functions.
+ */
+
+#include "nmath.h"
+#include "dpq.h"
+
+#if defined(_OPENMP) && _OPENMP >= 201307
+# define R_DO_PRAGMA(x) _Pragma(#x)
+# define R_OMP_SIMD R_DO_PRAGMA(omp simd)
+#else
+# define R_OMP_SIMD
+#endif
+
+void dnorm_vec(const double *x, int n, double mu, double sigma,
+	       int give_log, double *y)
+{
+    int i;
+
+    if (!R_FINITE(mu) || !R_FINITE(sigma) || sigma <= 0) {
+	for (i = 0; i < n; i++) y[i] = dnorm(x[i], mu, sigma, give_log);
+	return;
+    }
+    if (give_log) {
+	double lsigma = log(sigma);
+	/* infinite z, and z so large that z*z overflows, give -Inf */
+	R_OMP_SIMD
+	for (i = 0; i < n; i++) {
+	    double z = (x[i] - mu) / sigma;
+	    y[i] = -(M_LN_SQRT_2PI + 0.5 * z * z + lsigma);
+	}
+	for (i = 0; i < n; i++)
+	    if (ISNAN(x[i])) y[i] = x[i] + mu + sigma;
+    } else {
+	for (i = 0; i < n; i++) {
+	    double z = fabs((x[i] - mu) / sigma);
+	    y[i] = (z < 5) ? M_1_SQRT_2PI * exp(-0.5 * z * z) / sigma :
+		dnorm(x[i], mu, sigma, 0);
+	}
+    }
+}
+
+void pnorm_vec(const double *x, int n, double mu, double sigma,
+	       int lower_tail, int log_p, double *y)
+{
+    int i, i_tail = lower_tail ? 0 : 1;
+    double p, cp;
+
+    if (!R_FINITE(mu) || !R_FINITE(sigma) || sigma <= 0) {
+	for (i = 0; i < n; i++)
+	    y[i] = pnorm(x[i], mu, sigma, lower_tail, log_p);
+	return;
+    }
+    for (i = 0; i < n; i++) {
+	if (ISNAN(x[i])) {
+	    y[i] = x[i] + mu + sigma;
+	    continue;
+	}
+	p = (x[i] - mu) / sigma;
+	if (!R_FINITE(p))
+	    y[i] = (x[i] < mu) ? R_DT_0 : R_DT_1;
+	else {
+	    pnorm_both(p, &p, &cp, i_tail, log_p);
+	    y[i] = lower_tail ? p : cp;
+	}
+    }
+}
+
+/* AS 241 for 0.075 <= p <= 0.925, q = p - 0.5, as in qnorm5() */
+static R_INLINE double qnorm_central(double q)
+{
+    double r = .180625 - q * q;
+    return
+            q * (((((((r * 2509.0809287301226727 +
+                       33430.575583588128105) * r + 67265.770927008700853) * r +
+                     45921.953931549871457) * r + 13731.693765509461125) * r +
+                   1971.5909503065514427) * r + 133.14166789178437745) * r +
+                 3.387132872796366608)
+            / (((((((r * 5226.495278852854561 +
+                     28729.085735721942674) * r + 39307.89580009271061) * r +
+                   21213.794301586595867) * r + 5394.1960214247511077) * r +
+                 687.1870074920579083) * r + 42.313330701600911252) * r + 1.);
+}
+
+void qnorm_vec(const double *p, int n, double mu, double sigma,
+	       int lower_tail, int log_p, double *y)
+{
+    int i;
+
+    if (!R_FINITE(mu) || !R_FINITE(sigma) || sigma <= 0 || log_p) {
+	for (i = 0; i < n; i++)
+	    y[i] = qnorm(p[i], mu, sigma, lower_tail, log_p);
+	return;
+    }
+    if (lower_tail) {
+	R_OMP_SIMD
+	for (i = 0; i < n; i++)
+	    y[i] = mu + sigma * qnorm_central(p[i] - 0.5);
+    } else {
+	R_OMP_SIMD
+	for (i = 0; i < n; i++)
+	    y[i] = mu + sigma * qnorm_central((0.5 - p[i] + 0.5) - 0.5);
+    }
+    /* the tails, the boundaries and NaNs */
+    for (i = 0; i < n; i++)
+	if (!(fabs(R_D_Lval(p[i]) - 0.5) <= .425))
+	    y[i] = qnorm(p[i], mu, sigma, lower_tail, log_p);
+}
+
+void dexp_vec(const double *x, int n, double scale, int give_log, double *y)
+{
+    int i;
+
+    if (!R_FINITE(scale) || scale <= 0) {
+	for (i = 0; i < n; i++) y[i] = dexp(x[i], scale, give_log);
+	return;
+    }
+    if (give_log) {
+	double lscale = log(scale);
+	R_OMP_SIMD
+	for (i = 0; i < n; i++)
+	    y[i] = (-x[i] / scale) - lscale;
+	for (i = 0; i < n; i++)
+	    if (!(x[i] >= 0.))
+		y[i] = ISNAN(x[i]) ? x[i] + scale : ML_NEGINF;
+    } else {
+	for (i = 0; i < n; i++)
+	    y[i] = ISNAN(x[i]) ? x[i] + scale :
+		(x[i] < 0.) ? 0. : exp(-x[i] / scale) / scale;
+    }
+}
+
+void dgamma_vec(const double *x, int n, double shape, double scale,
+		int give_log, double *y)
+{
+    int i;
+
+    if (!R_FINITE(shape) || shape <= 0 || !R_FINITE(scale) || scale <= 0) {
+	for (i = 0; i < n; i++) y[i] = dgamma(x[i], shape, scale, give_log);
+	return;
+    }
+    /* dpois_raw(xs, x/scale) with the terms depending only on xs,
+       the Stirling error and the factor of R_D_fexp(), computed once */
+    double xs = (shape < 1) ? shape : shape - 1,
+	st = stirlerr(xs),
+	f = give_log ? -0.5 * log(M_2PI * xs) : sqrt(M_2PI * xs),
+	lscale = log(scale);
+    for (i = 0; i < n; i++) {
+	double xi = x[i], lambda = xi / scale, pr;
+	if (ISNAN(xi) || xi <= 0 || !R_FINITE(lambda) ||
+	    xs <= lambda * DBL_MIN || lambda < xs * DBL_MIN) {
+	    y[i] = dgamma(xi, shape, scale, give_log);
+	    continue;
+	}
+	pr = give_log ? f + (-st - bd0(xs, lambda)) :
+	    exp(-st - bd0(xs, lambda)) / f;
+	if (shape < 1)
+	    y[i] = give_log ?  pr + log(shape/xi) : pr*shape/xi;
+	else
+	    y[i] = give_log ? pr - lscale : pr/scale;
+    }
+}
@@ -197,6 +197,8 @@ int R_finite(double);
 #define pnbeta_raw   	Rf_pnbeta_raw
 #define pnbeta2       	Rf_pnbeta2
 #define bratio       	Rf_bratio
+#define bratio_c       	Rf_bratio_c
+#define pbeta_raw_c   	Rf_pbeta_raw_c
 
 	/* Chebyshev Series */
 
@@ -226,6 +228,14 @@ int	Rf_i1mach(int);
 /* From toms708.c */
 void attribute_hidden bratio(double a, double b, double x, double y,
 	    		     double *w, double *w1, int *ierr, int log_p);
+/* log(beta(a, b)) computed by bratio_c() for repeated use with the same
+   a and b: initialize lbeta to NaN */
+typedef struct { double a, b, lbeta; } bratio_cache;
+void attribute_hidden bratio_c(double a, double b, double x, double y,
+			       double *w, double *w1, int *ierr, int log_p,
+			       bratio_cache *bc);
+double	attribute_hidden pbeta_raw_c(double, double, double, int, int,
+				     bratio_cache *);
 
 
 #endif /* MATHLIB_PRIVATE_H */
@@ -1,6 +1,6 @@
 /*
  *  Mathlib : A C Library of Special Functions
- *  Copyright (C) 2006 The R Core Team
+ *  Copyright (C) 2006-2017 The R Core Team
  *
  *  This program is free software; you can redistribute it and/or modify
  *  it under the terms of the GNU General Public License as published by
@@ -22,6 +22,8 @@
  *
  * double pbeta_raw(double x, double a, double b, int lower_tail, int log_p)
  * double pbeta	   (double x, double a, double b, int lower_tail, int log_p)
+ * void pbeta_vec(const double *x, int n, double a, double b,
+ *		  int lower_tail, int log_p, double *y)
  *
  *  DESCRIPTION
  *
@@ -39,6 +41,14 @@
 
 attribute_hidden
 double pbeta_raw(double x, double a, double b, int lower_tail, int log_p)
+{
+    return pbeta_raw_c(x, a, b, lower_tail, log_p, NULL);
+}
+
+/* pbeta_raw(), with log(beta(a, b)) kept in *bc (see bratio_c()) */
+attribute_hidden
+double pbeta_raw_c(double x, double a, double b, int lower_tail, int log_p,
+		   bratio_cache *bc)
 {
     // treat limit cases correctly here:
     if(a == 0 || b == 0 || !R_FINITE(a) || !R_FINITE(b)) {
@@ -57,7 +67,7 @@ double pbeta_raw(double x, double a, double b, int lower_tail, int log_p)
     double x1 = 0.5 - x + 0.5, w, wc;
     int ierr;
     //====
-    bratio(a, b, x, x1, &w, &wc, &ierr, log_p); /* -> ./toms708.c */
+    bratio_c(a, b, x, x1, &w, &wc, &ierr, log_p, bc); /* -> ./toms708.c */
     //====
     // ierr in {10,14} <==> bgrat() error code ierr-10 in 1:4; for 1 and 4, warned *there*
     if(ierr && ierr != 11 && ierr != 14)
@@ -82,3 +92,27 @@ double pbeta(double x, double a, double b, int lower_tail, int log_p)
 
     return pbeta_raw(x, a, b, lower_tail, log_p);
 }
+
+/* y[i] = pbeta(x[i], a, b, lower_tail, log_p), with the parameters
+   checked and log(beta(a, b)) computed once */
+void pbeta_vec(const double *x, int n, double a, double b,
+	       int lower_tail, int log_p, double *y)
+{
+    bratio_cache bc = { a, b, ML_NAN };
+
+    if (ISNAN(a) || ISNAN(b) || a < 0 || b < 0) {
+	for (int i = 0; i < n; i++)
+	    y[i] = pbeta(x[i], a, b, lower_tail, log_p);
+	return;
+    }
+    for (int i = 0; i < n; i++) {
+	if (ISNAN(x[i]))
+	    y[i] = x[i] + a + b;
+	else if (x[i] <= 0)
+	    y[i] = R_DT_0;
+	else if (x[i] >= 1)
+	    y[i] = R_DT_1;
+	else
+	    y[i] = pbeta_raw_c(x[i], a, b, lower_tail, log_p, &bc);
+    }
+}
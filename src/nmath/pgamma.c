@@ -2,7 +2,7 @@
  *  Mathlib : A C Library of Special Functions
  *  Copyright (C) 2005-6 Morten Welinder <terra@gnome.org>
  *  Copyright (C) 2005-10 The R Foundation
- *  Copyright (C) 2006-2015 The R Core Team
+ *  Copyright (C) 2006-2017 The R Core Team
  *
  *  This program is free software; you can redistribute it and/or modify
  *  it under the terms of the GNU General Public License as published by
@@ -24,6 +24,8 @@
  *
  *	double pgamma (double x, double alph, double scale,
  *		       int lower_tail, int log_p)
+ *	void pgamma_vec (const double *x, int n, double alph, double scale,
+ *			 int lower_tail, int log_p, double *y)
  *
  *	double log1pmx	(double x)
  *	double lgamma1p (double a)
@@ -276,13 +278,33 @@ double logspace_sum (const double* logx, int n)
 
 
 
+/* The functions of alph alone used below, computed once by pgamma_vec()
+ * for many x and the same alph (and NULL for single values) */
+typedef struct {
+    double lg1p;	/* lgamma1p(alph) */
+    double lg;		/* lgammafn(alph), for alph <= 1 */
+    double st0, st1;	/* stirlerr(alph), stirlerr(alph - 1) for alph > 1 */
+} pgamma_alph;
+
+/* dpois_raw(x, lambda, give_log) for x > 0, given st = stirlerr(x) */
+static double
+dpois_raw_st (double x, double lambda, double st, int give_log)
+{
+    if (lambda == 0 || !R_FINITE(lambda)) return R_D__0;
+    if (x <= lambda * DBL_MIN) return R_D_exp(-lambda);
+    if (lambda < x * DBL_MIN)
+	return R_D_exp(-lambda + x*log(lambda) -lgammafn(x+1));
+    return R_D_fexp( M_2PI*x, -st-bd0(x,lambda) );
+}
+
 /* dpois_wrap (x__1, lambda) := dpois(x__1 - 1, lambda);  where
  * dpois(k, L) := exp(-L) L^k / gamma(k+1)  {the usual Poisson probabilities}
  *
  * and  dpois*(.., give_log = TRUE) :=  log( dpois*(..) )
 */
 static double
-dpois_wrap (double x_plus_1, double lambda, int give_log)
+dpois_wrap (double x_plus_1, double lambda, int give_log,
+	    const pgamma_alph *pc)
 {
 #ifdef DEBUG_p
     REprintf (" dpois_wrap(x+1=%.14g, lambda=%.14g, log=%d)\n",
@@ -291,11 +313,13 @@ dpois_wrap (double x_plus_1, double lambda, int give_log)
     if (!R_FINITE(lambda))
 	return R_D__0;
     if (x_plus_1 > 1)
-	return dpois_raw (x_plus_1 - 1, lambda, give_log);
+	return pc ? dpois_raw_st (x_plus_1 - 1, lambda, pc->st1, give_log)
+	    : dpois_raw (x_plus_1 - 1, lambda, give_log);
     if (lambda > fabs(x_plus_1 - 1) * M_cutoff)
-	return R_D_exp(-lambda - lgammafn(x_plus_1));
+	return R_D_exp(-lambda - (pc ? pc->lg : lgammafn(x_plus_1)));
     else {
-	double d = dpois_raw (x_plus_1, lambda, give_log);
+	double d = pc ? dpois_raw_st (x_plus_1, lambda, pc->st0, give_log)
+	    : dpois_raw (x_plus_1, lambda, give_log);
 #ifdef DEBUG_p
 	REprintf ("  -> d=dpois_raw(..)=%.14g\n", d);
 #endif
@@ -309,7 +333,8 @@ dpois_wrap (double x_plus_1, double lambda, int give_log)
  * Abramowitz and Stegun 6.5.29 [right]
  */
 static double
-pgamma_smallx (double x, double alph, int lower_tail, int log_p)
+pgamma_smallx (double x, double alph, int lower_tail, int log_p,
+	       const pgamma_alph *pc)
 {
     double sum = 0, c = alph, n = 0, term;
 
@@ -336,18 +361,19 @@ pgamma_smallx (double x, double alph, int lower_tail, int log_p)
 	double f1 = log_p ? log1p (sum) : 1 + sum;
 	double f2;
 	if (alph > 1) {
-	    f2 = dpois_raw (alph, x, log_p);
+	    f2 = pc ? dpois_raw_st (alph, x, pc->st0, log_p)
+		: dpois_raw (alph, x, log_p);
 	    f2 = log_p ? f2 + x : f2 * exp (x);
 	} else if (log_p)
-	    f2 = alph * log (x) - lgamma1p (alph);
+	    f2 = alph * log (x) - (pc ? pc->lg1p : lgamma1p (alph));
 	else
-	    f2 = pow (x, alph) / exp (lgamma1p (alph));
+	    f2 = pow (x, alph) / exp (pc ? pc->lg1p : lgamma1p (alph));
 #ifdef DEBUG_p
     REprintf (" (f1,f2)= (%g,%g)\n", f1,f2);
 #endif
 	return log_p ? f1 + f2 : f1 * f2;
     } else {
-	double lf2 = alph * log (x) - lgamma1p (alph);
+	double lf2 = alph * log (x) - (pc ? pc->lg1p : lgamma1p (alph));
 #ifdef DEBUG_p
 	REprintf (" 1:%.14g  2:%.14g\n", alph * log (x), lgamma1p (alph));
 	REprintf (" sum=%.14g  log(1+sum)=%.14g	 lf2=%.14g\n",
@@ -641,7 +667,9 @@ ppois_asymp (double x, double lambda, int lower_tail, int log_p)
 } /* ppois_asymp() */
 
 
-double pgamma_raw (double x, double alph, int lower_tail, int log_p)
+static double
+pgamma_raw_c (double x, double alph, int lower_tail, int log_p,
+	      const pgamma_alph *pc)
 {
 /* Here, assume that  (x,alph) are not NA  &  alph > 0 . */
 
@@ -654,11 +682,11 @@ double pgamma_raw (double x, double alph, int lower_tail, int log_p)
     R_P_bounds_01(x, 0., ML_POSINF);
 
     if (x < 1) {
-	res = pgamma_smallx (x, alph, lower_tail, log_p);
+	res = pgamma_smallx (x, alph, lower_tail, log_p, pc);
     } else if (x <= alph - 1 && x < 0.8 * (alph + 50)) {
 	/* incl. large alph compared to x */
 	double sum = pd_upper_series (x, alph, log_p);/* = x/alph + o(x/alph) */
-	double d = dpois_wrap (alph, x, log_p);
+	double d = dpois_wrap (alph, x, log_p, pc);
 #ifdef DEBUG_p
 	REprintf(" alph 'large': sum=pd_upper*()= %.12g, d=dpois_w(*)= %.12g\n",
 		 sum, d);
@@ -672,7 +700,7 @@ double pgamma_raw (double x, double alph, int lower_tail, int log_p)
     } else if (alph - 1 < x && alph < 0.8 * (x + 50)) {
 	/* incl. large x compared to alph */
 	double sum;
-	double d = dpois_wrap (alph, x, log_p);
+	double d = dpois_wrap (alph, x, log_p, pc);
 #ifdef DEBUG_p
 	REprintf(" x 'large': d=dpois_w(*)= %.14g ", d);
 #endif
@@ -714,11 +742,16 @@ double pgamma_raw (double x, double alph, int lower_tail, int log_p)
 #ifdef DEBUG_p
 	REprintf(" very small res=%.14g; -> recompute via log\n", res);
 #endif
-	return exp (pgamma_raw (x, alph, lower_tail, 1));
+	return exp (pgamma_raw_c (x, alph, lower_tail, 1, pc));
     } else
 	return res;
 }
 
+double pgamma_raw (double x, double alph, int lower_tail, int log_p)
+{
+    return pgamma_raw_c (x, alph, lower_tail, log_p, NULL);
+}
+
 
 double pgamma(double x, double alph, double scale, int lower_tail, int log_p)
 {
@@ -737,6 +770,30 @@ double pgamma(double x, double alph, double scale, int lower_tail, int log_p)
 	return (x <= 0) ? R_DT_0: R_DT_1; /* <= assert  pgamma(0,0) ==> 0 */
     return pgamma_raw (x, alph, lower_tail, log_p);
 }
+
+void pgamma_vec(const double *x, int n, double alph, double scale,
+		int lower_tail, int log_p, double *y)
+{
+    if (ISNAN(alph) || ISNAN(scale) || alph <= 0. || scale <= 0.) {
+	for (int i = 0; i < n; i++)
+	    y[i] = pgamma(x[i], alph, scale, lower_tail, log_p);
+	return;
+    }
+    pgamma_alph pc;
+    pc.lg1p = lgamma1p (alph);
+    pc.st0 = stirlerr (alph);
+    pc.st1 = (alph > 1) ? stirlerr (alph - 1) : ML_NAN;
+    pc.lg = (alph <= 1) ? lgammafn (alph) : ML_NAN;
+    for (int i = 0; i < n; i++) {
+	double xs = x[i] / scale;
+	if (ISNAN(x[i]))
+	    y[i] = x[i] + alph + scale;
+	else if (ISNAN(xs))
+	    y[i] = xs;
+	else
+	    y[i] = pgamma_raw_c (xs, alph, lower_tail, log_p, &pc);
+    }
+}
 /* From: terra@gnome.org (Morten Welinder)
  * To: R-bugs@biostat.ku.dk
  * Cc: maechler@stat.math.ethz.ch
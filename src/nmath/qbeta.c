@@ -1,7 +1,7 @@
 /*
  *  R : A Computer Language for Statistical Data Analysis
  *  Copyright (C) 1995, 1996  Robert Gentleman and Ross Ihaka
- *  Copyright (C) 1998--2015  The R Core Team
+ *  Copyright (C) 1998--2017  The R Core Team
  *  based on code (C) 1979 and later Royal Statistical Society
  *
  *  This program is free software; you can redistribute it and/or modify
@@ -50,7 +50,8 @@
 //attribute_hidden 
 static void
 qbeta_raw(double alpha, double p, double q, int lower_tail, int log_p,
-	  int swap_01, double log_q_cut, int n_N, double* qb);
+	  int swap_01, double log_q_cut, int n_N, double* qb,
+	  double logbeta, bratio_cache *bc);
 
 double qbeta(double alpha, double p, double q, int lower_tail, int log_p)
 {
@@ -65,10 +66,34 @@ double qbeta(double alpha, double p, double q, int lower_tail, int log_p)
 
     double qbet[2];// = { qbeta(), 1 - qbeta() }
     qbeta_raw(alpha, p, q, lower_tail, log_p,
-	      MLOGICAL_NA, USE_LOG_X_CUTOFF, n_NEWTON_FREE, qbet);
+	      MLOGICAL_NA, USE_LOG_X_CUTOFF, n_NEWTON_FREE, qbet, ML_NAN, NULL);
     return qbet[0];
 }
 
+/* y[i] = qbeta(alpha[i], p, q, lower_tail, log_p), with lbeta(p, q) and
+   the log(beta(p, q)) of pbeta_raw() computed once */
+void qbeta_vec(const double *alpha, int n, double p, double q,
+	       int lower_tail, int log_p, double *y)
+{
+    if (ISNAN(p) || ISNAN(q) || p < 0. || q < 0.) {
+	for (int i = 0; i < n; i++)
+	    y[i] = qbeta(alpha[i], p, q, lower_tail, log_p);
+	return;
+    }
+    double logbeta = lbeta(p, q), qbet[2];
+    bratio_cache bc = { p, q, ML_NAN };
+    for (int i = 0; i < n; i++) {
+	if (ISNAN(alpha[i])) {
+	    y[i] = alpha[i] + p + q;
+	    continue;
+	}
+	qbeta_raw(alpha[i], p, q, lower_tail, log_p,
+		  MLOGICAL_NA, USE_LOG_X_CUTOFF, n_NEWTON_FREE, qbet,
+		  logbeta, &bc);
+	y[i] = qbet[0];
+    }
+}
+
 static const double
 #ifdef IEEE_754
 // CARE: assumes subnormal numbers, i.e., no underflow at DBL_MIN:
@@ -111,7 +136,9 @@ qbeta_raw(double alpha, double p, double q, int lower_tail, int log_p,
 			       otherwise, if finite: the bound for
 			       switching to log(x)-scale; see use_log_x */
 	  int n_N,  // number of "unconstrained" Newton steps before switching to constrained
-	  double *qb) // = qb[0:1] = { qbeta(), 1 - qbeta() }
+	  double *qb, // = qb[0:1] = { qbeta(), 1 - qbeta() }
+	  double logbeta, // = lbeta(p, q) if known, else NaN
+	  bratio_cache *bc) // for pbeta_raw(), or NULL
 {
     Rboolean
 	swap_choose = (swap_01 == MLOGICAL_NA),
@@ -120,7 +147,7 @@ qbeta_raw(double alpha, double p, double q, int lower_tail, int log_p,
 	use_log_x = give_log_q, // or u < log_q_cut  below
 	warned = FALSE, add_N_step = TRUE;
     int i_pb, i_inn;
-    double a, la, logbeta, g, h, pp, p_, qq, r, s, t, w, y = -1.;
+    double a, la, g, h, pp, p_, qq, r, s, t, w, y = -1.;
     volatile double u, xinbta;
 
     // Assuming p >= 0, q >= 0  here ...
@@ -182,7 +209,12 @@ qbeta_raw(double alpha, double p, double q, int lower_tail, int log_p,
     /* initialize */
     p_ = R_DT_qIv(alpha);/* lower_tail prob (in any case) */
     // Conceptually,  0 < p_ < 1  (but can be 0 or 1 because of cancellation!)
-    logbeta = lbeta(p, q);
+    if (ISNAN(logbeta))
+	logbeta = lbeta(p, q);
+    // the Newton steps call pbeta_raw() repeatedly with the same shapes
+    bratio_cache bc0 = { p, q, ML_NAN };
+    if (bc == NULL)
+	bc = &bc0;
 
     swap_tail = (swap_choose) ? (p_ > 0.5) : swap_01;
     // change tail; default (swap_01 = NA): afterwards 0 < a <= 1/2
@@ -360,7 +392,7 @@ qbeta_raw(double alpha, double p, double q, int lower_tail, int log_p,
 		    qbeta(0.21, .001, 0.05)
 		    try "left border" quickly, i.e.,
 		    try at smallest positive number: */
-	w = pbeta_raw(DBL_very_MIN, pp, qq, TRUE, log_p);
+	w = pbeta_raw_c(DBL_very_MIN, pp, qq, TRUE, log_p, bc);
 	if(w > (log_p ? la : a)) {
 	    R_ifDEBUG_printf(" quantile is left of smallest positive number; \"convergence\"\n");
 	    if(log_p || fabs(w - a) < fabs(0 - a)) { // DBL_very_MIN is better than 0
@@ -416,7 +448,7 @@ L_Newton:
 	for (i_pb=0; i_pb < 1000; i_pb++) {
 	    // using log_p == TRUE  unconditionally here
 	    // FIXME: if exp(u) = xinbta underflows to 0, like different formula pbeta_log(u, *)
-	    y = pbeta_raw(xinbta, pp, qq, /*lower_tail = */ TRUE, TRUE);
+	    y = pbeta_raw_c(xinbta, pp, qq, /*lower_tail = */ TRUE, TRUE, bc);
 
 	    /* w := Newton step size for   L(u) = log F(e^u)  =!= 0;   u := log(x)
 	     *   =  (L(.) - la) / L'(.);  L'(u)= (F'(e^u) * e^u ) / F(e^u)
@@ -469,7 +501,7 @@ L_Newton:
     } else
 
     for (i_pb=0; i_pb < 1000; i_pb++) {
-	y = pbeta_raw(xinbta, pp, qq, /*lower_tail = */ TRUE, log_p);
+	y = pbeta_raw_c(xinbta, pp, qq, /*lower_tail = */ TRUE, log_p, bc);
 	// delta{y} :   d_y = y - (log_p ? la : a);
 #ifdef IEEE_754
 	if(!R_FINITE(y) && !(log_p && y == ML_NEGINF))// y = -Inf  is ok if(log_p)
@@ -530,7 +562,7 @@ L_converged:
 	     y - (log_ ? la : a), (log_ ? " (log_)" : ""));
     if((log_ && y == ML_NEGINF) || (!log_ && y == 0)) {
 	// stuck at left, try if smallest positive number is "better"
-	w = pbeta_raw(DBL_very_MIN, pp, qq, TRUE, log_);
+	w = pbeta_raw_c(DBL_very_MIN, pp, qq, TRUE, log_, bc);
 	if(log_ || fabs(w - a) <= fabs(y - a)) {
 	    tx  = DBL_very_MIN;
 	    u_n = DBL_log_v_MIN;// = log(DBL_very_MIN)
@@ -540,8 +572,8 @@ L_converged:
     else if(!warned && (log_ ? fabs(y - la) > 3 : fabs(y - a) > 1e-4)) {
 	if(!(log_ && y == ML_NEGINF &&
 	    // e.g. qbeta(-1e-10, .2, .03, log=TRUE) cannot get accurate ==> do NOT warn
-	     pbeta_raw(DBL_1__eps, // = 1 - eps
-		       pp, qq, TRUE, TRUE) > la + 2))
+	     pbeta_raw_c(DBL_1__eps, // = 1 - eps
+			 pp, qq, TRUE, TRUE, bc) > la + 2))
 	    MATHLIB_WARNING2( // low accuracy for more platform independent output:
     "qbeta(a, *) =: x0 with |pbeta(x0,*%s) - alpha| = %.5g is not accurate",
 	    (log_ ? ", log_" : ""), fabs(y - (log_ ? la : a)));
@@ -564,7 +596,7 @@ L_return:
 		/* add one last Newton step on original x scale, e.g., for
 		   qbeta(2^-98, 0.125, 2^-96) */
 		xinbta = exp(u_n);
-		y = pbeta_raw(xinbta, pp, qq, /*lower_tail = */ TRUE, log_p);
+		y = pbeta_raw_c(xinbta, pp, qq, /*lower_tail = */ TRUE, log_p, bc);
 		w = log_p
 		    ? (y - la) * exp(y + logbeta + r * log(xinbta) + t * log1p(-xinbta))
 		    : (y - a)  * exp(    logbeta + r * log(xinbta) + t * log1p(-xinbta));
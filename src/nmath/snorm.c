@@ -1,7 +1,7 @@
 /*
  *  Mathlib : A C Library of Special Functions
  *  Copyright (C) 1998   Ross Ihaka
- *  Copyright (C) 2000-9 The R Core Team
+ *  Copyright (C) 2000-2017 The R Core Team
  *
  *  This program is free software; you can redistribute it and/or modify
  *  it under the terms of the GNU General Public License as published by
@@ -21,10 +21,12 @@
  *
  *    #include <Rmath.h>
  *    double norm_rand(void);
+ *    void norm_rand_n(double *x, int n);
  *
  *  DESCRIPTION
  *
  *    Random variates from the STANDARD normal distribution  N(0,1).
+ *    norm_rand_n() gives the values of n calls of norm_rand().
  *
  * Is called from  rnorm(..), but also rt(), rf(), rgamma(), ...
  */
@@ -327,3 +329,23 @@ double norm_rand(void)
 	    return 0.0;/*- -Wall */
     }/*switch*/
 }
+
+void norm_rand_n(double *x, int n)
+{
+#ifndef MATHLIB_STANDALONE
+    if (N01_kind == INVERSION) {
+	/* two uniforms per value, drawn a block at a time */
+	double u[1024];
+	for (int i = 0; i < n; ) {
+	    int m = (n - i < 512) ? n - i : 512;
+	    unif_rand_n(u, 2 * m);
+	    for (int j = 0; j < m; j++)
+		x[i + j] = qnorm5(((int)(BIG * u[2*j]) + u[2*j + 1]) / BIG,
+				  0.0, 1.0, 1, 0);
+	    i += m;
+	}
+	return;
+    }
+#endif
+    for (int i = 0; i < n; i++) x[i] = norm_rand();
+}
@@ -36,22 +36,26 @@
 #define R_Log1_Exp(x)   ((x) > -M_LN2 ? log(-rexpm1(x)) : log1p(-exp(x)))
 
 
-static double bfrac(double, double, double, double, double, double, int log_p);
+static double bfrac(double, double, double, double, double, double, int log_p,
+		    bratio_cache *);
 static void bgrat(double, double, double, double, double *, double, int *, Rboolean log_w);
 static double grat_r(double a, double x, double r, double eps);
 static double apser(double, double, double, double);
-static double bpser(double, double, double, double, int log_p);
+static double bpser(double, double, double, double, int log_p, bratio_cache *);
 static double basym(double, double, double, double, int log_p);
 static double fpser(double, double, double, double, int log_p);
-static double bup(double, double, double, double, int, double, int give_log);
+static double bup(double, double, double, double, int, double, int give_log,
+		  bratio_cache *);
 static double exparg(int);
 static double psi(double);
 static double gam1(double);
 static double gamln1(double);
 static double betaln(double, double);
+static double betaln_c(double, double, bratio_cache *);
 static double algdiv(double, double);
-static double brcmp1(int, double, double, double, double, int give_log);
-static double brcomp(double, double, double, double, int log_p);
+static double brcmp1(int, double, double, double, double, int give_log,
+		     bratio_cache *);
+static double brcomp(double, double, double, double, int log_p, bratio_cache *);
 static double rlog1(double);
 static double bcorr(double, double);
 static double gamln(double);
@@ -74,6 +78,15 @@ static double gsumln(double, double);
 void attribute_hidden
 bratio(double a, double b, double x, double y, double *w, double *w1,
        int *ierr, int log_p)
+{
+    bratio_c(a, b, x, y, w, w1, ierr, log_p, NULL);
+}
+
+/* bratio() keeping  betaln(a, b)  in *bc (if not NULL) for other calls
+   with the same a and b */
+void attribute_hidden
+bratio_c(double a, double b, double x, double y, double *w, double *w1,
+	 int *ierr, int log_p, bratio_cache *bc)
 {
 /* -----------------------------------------------------------------------
 
@@ -230,7 +243,7 @@ bratio(double a, double b, double x, double y, double *w, double *w1,
 	    if (x0 >= 0.3)		goto L_w1_bpser;
 	}
 	n = 20; /* goto L130; */
-	*w1 = bup(b0, a0, y0, x0, n, eps, FALSE); did_bup = TRUE;
+	*w1 = bup(b0, a0, y0, x0, n, eps, FALSE, bc); did_bup = TRUE;
 	R_ifDEBUG_printf("  ... n=20 and *w1 := bup(*) = %.15g; ", *w1);
 	b0 += n;
     L131:
@@ -246,7 +259,7 @@ bratio(double a, double b, double x, double y, double *w, double *w1,
 //  !did_bup, i.e., where *w1 = (0 or -Inf) on entry
 	    R_ifDEBUG_printf(" denormalized or underflow (?) -> retrying: ");
 	    if(did_bup) { // re-do that part on log scale:
-		*w1 = bup(b0-n, a0, y0, x0, n, eps, TRUE);
+		*w1 = bup(b0-n, a0, y0, x0, n, eps, TRUE, bc);
 	    }
 	    else *w1 = ML_NEGINF; // = 0 on log-scale
 	    bgrat(b0, a0, y0, x0, w1, 15*eps, &ierr1, TRUE);
@@ -316,19 +329,19 @@ bratio(double a, double b, double x, double y, double *w, double *w1,
 /*            EVALUATION OF THE APPROPRIATE ALGORITHM */
 
 L_w_bpser: // was L100
-    *w = bpser(a0, b0, x0, eps, log_p);
+    *w = bpser(a0, b0, x0, eps, log_p, bc);
     *w1 = log_p ? R_Log1_Exp(*w) : 0.5 - *w + 0.5;
     R_ifDEBUG_printf(" L_w_bpser: *w := bpser(*) = %.15g\n", *w);
     goto L_end;
 
 L_w1_bpser:  // was L110
-    *w1 = bpser(b0, a0, y0, eps, log_p);
+    *w1 = bpser(b0, a0, y0, eps, log_p, bc);
     *w  = log_p ? R_Log1_Exp(*w1) : 0.5 - *w1 + 0.5;
     R_ifDEBUG_printf(" L_w1_bpser: *w1 := bpser(*) = %.15g\n", *w1);
     goto L_end;
 
 L_bfrac:
-    *w = bfrac(a0, b0, x0, y0, lambda, eps * 15., log_p);
+    *w = bfrac(a0, b0, x0, y0, lambda, eps * 15., log_p, bc);
     *w1 = log_p ? R_Log1_Exp(*w) : 0.5 - *w + 0.5;
     R_ifDEBUG_printf(" L_bfrac: *w := bfrac(*) = %g\n", *w);
     goto L_end;
@@ -341,7 +354,7 @@ L140:
 	--n; b0 = 1.;
     }
 
-    *w = bup(b0, a0, y0, x0, n, eps, FALSE);
+    *w = bup(b0, a0, y0, x0, n, eps, FALSE, bc);
 
     if(*w < DBL_MIN && log_p) { /* do not believe it; try bpser() : */
 	R_ifDEBUG_printf(" L140: bup(b0=%g,..)=%.15g < DBL_MIN - not used; ", b0, *w);
@@ -352,14 +365,14 @@ L140:
     R_ifDEBUG_printf(" L140: *w := bup(b0=%g,..) = %.15g; ", b0, *w);
     if (x0 <= 0.7) {
 	/* log_p :  TODO:  w = bup(.) + bpser(.)  -- not so easy to use log-scale */
-	*w += bpser(a0, b0, x0, eps, /* log_p = */ FALSE);
+	*w += bpser(a0, b0, x0, eps, /* log_p = */ FALSE, bc);
 	R_ifDEBUG_printf(" x0 <= 0.7: *w := *w + bpser(*) = %.15g\n", *w);
 	goto L_end_from_w;
     }
     /* L150: */
     if (a0 <= 15.) {
 	n = 20;
-	*w += bup(a0, b0, x0, y0, n, eps, FALSE);
+	*w += bup(a0, b0, x0, y0, n, eps, FALSE, bc);
 	R_ifDEBUG_printf("\n a0 <= 15: *w := *w + bup(*) = %.15g;", *w);
 	a0 += n;
     }
@@ -507,7 +520,8 @@ static double apser(double a, double b, double x, double eps)
     return -a * (c + s);
 } /* apser */
 
-static double bpser(double a, double b, double x, double eps, int log_p)
+static double bpser(double a, double b, double x, double eps, int log_p,
+		    bratio_cache *bc)
 {
 /* -----------------------------------------------------------------------
  * Power SERies expansion for evaluating I_x(a,b) when
@@ -526,7 +540,7 @@ static double bpser(double a, double b, double x, double eps, int log_p)
 /* ----------------------------------------------------------------------- */
     a0 = min(a,b);
     if (a0 >= 1.) { /*		 ------	 1 <= a0 <= b0  ------ */
-	z = a * log(x) - betaln(a, b);
+	z = a * log(x) - betaln_c(a, b, bc);
 	ans = log_p ? z - log(a) : exp(z) / a;
     }
     else {
@@ -644,7 +658,7 @@ static double bpser(double a, double b, double x, double eps, int log_p)
 } /* bpser */
 
 static double bup(double a, double b, double x, double y, int n, double eps,
-		  int give_log)
+		  int give_log, bratio_cache *bc)
 {
 /* ----------------------------------------------------------------------- */
 /*     EVALUATION OF I_x(A,B) - I_x(A+N,B) WHERE N IS A POSITIVE INT. */
@@ -673,8 +687,8 @@ static double bup(double a, double b, double x, double y, int n, double eps,
 
     /* L10: */
     ret_val = give_log
-	? brcmp1(mu, a, b, x, y, TRUE) - log(a)
-	: brcmp1(mu, a, b, x, y, FALSE)  / a;
+	? brcmp1(mu, a, b, x, y, TRUE, bc) - log(a)
+	: brcmp1(mu, a, b, x, y, FALSE, bc)  / a;
     if (n == 1 ||
 	(give_log && ret_val == ML_NEGINF) || (!give_log && ret_val == 0.))
 	return ret_val;
@@ -722,7 +736,7 @@ static double bup(double a, double b, double x, double y, int n, double eps,
 } /* bup */
 
 static double bfrac(double a, double b, double x, double y, double lambda,
-		    double eps, int log_p)
+		    double eps, int log_p, bratio_cache *bc)
 {
 /* -----------------------------------------------------------------------
        Continued fraction expansion for I_x(a,b) when a, b > 1.
@@ -735,7 +749,7 @@ static double bfrac(double a, double b, double x, double y, double lambda,
     if(!R_FINITE(lambda)) return ML_NAN;// TODO: can return 0 or 1 (?)
     R_ifDEBUG_printf(" bfrac(a=%g, b=%g, x=%g, y=%g, lambda=%g, eps=%g, log_p=%d):",
 		     a,b,x,y, lambda, eps, log_p);
-    brc = brcomp(a, b, x, y, log_p);
+    brc = brcomp(a, b, x, y, log_p, bc);
     if(ISNAN(brc)) { // e.g. from   L <- 1e308; pnbinom(L, L, mu = 5)
 	R_ifDEBUG_printf(" --> brcomp(a,b,x,y) = NaN\n");
 	ML_ERR_return_NAN; // TODO: could we know better?
@@ -806,7 +820,8 @@ static double bfrac(double a, double b, double x, double y, double lambda,
     return (log_p ? brc + log(r) : brc * r);
 } /* bfrac */
 
-static double brcomp(double a, double b, double x, double y, int log_p)
+static double brcomp(double a, double b, double x, double y, int log_p,
+		     bratio_cache *bc)
 {
 /* -----------------------------------------------------------------------
  *		 Evaluation of x^a * y^b / Beta(a,b)
@@ -839,7 +854,7 @@ static double brcomp(double a, double b, double x, double y, int log_p)
 
 	z = a * lnx + b * lny;
 	if (a0 >= 1.) {
-	    z -= betaln(a, b);
+	    z -= betaln_c(a, b, bc);
 	    return R_D_exp(z);
 	}
 
@@ -943,7 +958,8 @@ static double brcomp(double a, double b, double x, double y, int log_p)
 
 // called only once from  bup(),  as   r = brcmp1(mu, a, b, x, y, FALSE) / a;
 //                        -----
-static double brcmp1(int mu, double a, double b, double x, double y, int give_log)
+static double brcmp1(int mu, double a, double b, double x, double y, int give_log,
+		     bratio_cache *bc)
 {
 /* -----------------------------------------------------------------------
  *          Evaluation of    exp(mu) * x^a * y^b / beta(a,b)
@@ -973,7 +989,7 @@ static double brcmp1(int mu, double a, double b, double x, double y, int give_lo
 	// L20:
 	z = a * lnx + b * lny;
 	if (a0 >= 1.) {
-	    z -= betaln(a, b);
+	    z -= betaln_c(a, b, bc);
 	    return esum(mu, z, give_log);
 	}
 	// else :
@@ -2009,6 +2025,17 @@ L_err:
     return 0.;
 } /* psi */
 
+/* betaln(a, b), from bc if it is for the same a and b (in either order) */
+static double betaln_c(double a, double b, bratio_cache *bc)
+{
+    if (bc == NULL ||
+	!((a == bc->a && b == bc->b) || (a == bc->b && b == bc->a)))
+	return betaln(a, b);
+    if (ISNAN(bc->lbeta))
+	bc->lbeta = betaln(a, b);
+    return bc->lbeta;
+}
+
 static double betaln(double a0, double b0)
 {
 /* -----------------------------------------------------------------------